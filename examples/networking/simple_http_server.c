@@ -1,6 +1,10 @@
 /*
  * Simple HTTP Server Example for MiniOS
  * Demonstrates basic networking and web server capabilities
+ *
+ * One event loop serves every connection: the listener and the clients
+ * are registered with epoll, and the loop only accepts or reads when a
+ * descriptor is ready, so a slow client never holds up the others.
  */
 
 #include <stdio.h>
@@ -8,11 +12,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #define HTTP_PORT 8080
-#define MAX_CONNECTIONS 10
+#define LISTEN_BACKLOG 128
+#define MAX_EVENTS 64
 #define BUFFER_SIZE 4096
 
 // HTTP response templates
@@ -86,10 +92,74 @@ char *generate_status_page(void) {
     return page;
 }
 
-int main(int argc, char *argv[]) {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
+// Per-connection state, kept until the request header is complete
+struct connection {
+    int fd;
+    size_t used;
+    char buffer[BUFFER_SIZE];
+};
+
+static void close_connection(struct connection *conn) {
+    close(conn->fd);    // Also removes it from the epoll set
+    free(conn);
+}
+
+static void accept_connection(int epoll_fd, int server_socket) {
+    struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
+
+    int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
+    if (client_socket < 0) {
+        return;
+    }
+
+    printf("Connection from %s:%d\n",
+           inet_ntoa(client_addr.sin_addr),
+           ntohs(client_addr.sin_port));
+
+    struct connection *conn = malloc(sizeof(*conn));
+    if (!conn) {
+        close(client_socket);
+        return;
+    }
+    conn->fd = client_socket;
+    conn->used = 0;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+        close_connection(conn);
+    }
+}
+
+// Read what has arrived; answer once the request header is complete
+static void handle_input(struct connection *conn) {
+    ssize_t n = recv(conn->fd, conn->buffer + conn->used,
+                     sizeof(conn->buffer) - 1 - conn->used, 0);
+    if (n <= 0) {
+        close_connection(conn);
+        return;
+    }
+    conn->used += (size_t)n;
+    conn->buffer[conn->used] = '\0';
+    if (!strstr(conn->buffer, "\r\n\r\n") && conn->used < sizeof(conn->buffer) - 1) {
+        return;     // Wait for the rest
+    }
+
+    struct http_request req;
+    if (parse_http_request(conn->buffer, &req) == 0 && strcmp(req.path, "/") != 0) {
+        send(conn->fd, http_404_response, strlen(http_404_response), 0);
+    } else {
+        send(conn->fd, http_200_header, strlen(http_200_header), 0);
+        send(conn->fd, welcome_page, strlen(welcome_page), 0);
+    }
+    close_connection(conn);
+}
+
+int main(int argc, char *argv[]) {
+    int server_socket, epoll_fd;
+    struct sockaddr_in server_addr;
     
     printf("MiniOS HTTP Server starting on port %d...\n", HTTP_PORT);
     
@@ -114,7 +184,7 @@ int main(int argc, char *argv[]) {
     }
     
     // Listen for connections
-    if (listen(server_socket, MAX_CONNECTIONS) < 0) {
+    if (listen(server_socket, LISTEN_BACKLOG) < 0) {
         perror("listen failed");
         close(server_socket);
         return 1;
@@ -123,29 +193,37 @@ int main(int argc, char *argv[]) {
     printf("Server listening on http://0.0.0.0:%d\n", HTTP_PORT);
     printf("Press Ctrl+C to stop the server.\n\n");
     
+    // Watch the listener; its events carry a NULL pointer
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1 failed");
+        close(server_socket);
+        return 1;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event) < 0) {
+        perror("epoll_ctl failed");
+        close(epoll_fd);
+        close(server_socket);
+        return 1;
+    }
+    
     // Main server loop
+    struct epoll_event events[MAX_EVENTS];
     while (1) {
-        // Accept connection
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
-        if (client_socket < 0) {
-            continue;
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_connection(epoll_fd, server_socket);
+            } else {
+                handle_input(events[i].data.ptr);
+            }
         }
-        
-        printf("Connection from %s:%d\n", 
-               inet_ntoa(client_addr.sin_addr), 
-               ntohs(client_addr.sin_port));
-        
-        // Handle request (simplified)
-        char buffer[BUFFER_SIZE];
-        recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-        
-        // Send response  
-        send(client_socket, http_200_header, strlen(http_200_header), 0);
-        send(client_socket, welcome_page, strlen(welcome_page), 0);
-        
-        close(client_socket);
     }
     
+    close(epoll_fd);
     close(server_socket);
     return 0;
 }
\ No newline at end of file
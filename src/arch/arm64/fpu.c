@@ -0,0 +1,68 @@
+/*
+ * ARM64 FP/SIMD Access Control
+ * CPACR_EL1.FPEN gating for lazy FP/SIMD switching
+ *
+ * The kernel may still emit FP/SIMD instructions for copies, so EL1 access
+ * is never trapped: FPEN toggles between "trap EL0" while a task has not
+ * touched FP/SIMD in its slice and "no traps" once it has. EL0 traps
+ * arrive as ESR_EC_FP_ASIMD and are routed to fpu_trap(). The register
+ * transfer itself is in process/fpu.S.
+ */
+
+#include "kernel.h"
+#include "process.h"
+
+#ifdef ARCH_ARM64
+
+#define CPACR_FPEN_MASK     (3UL << 20)
+#define CPACR_FPEN_EL0_TRAP (1UL << 20)   // EL1 only
+#define CPACR_FPEN_NONE     (3UL << 20)   // EL0 and EL1
+
+// Zeroed registers, round-to-nearest, no exception traps
+static struct fp_state fp_initial_state __attribute__((section(".data"))) = {0};
+
+static inline uint64_t cpacr_read(void)
+{
+    uint64_t value;
+    __asm__ volatile("mrs %0, cpacr_el1" : "=r"(value));
+    return value;
+}
+
+static inline void cpacr_write(uint64_t value)
+{
+    __asm__ volatile("msr cpacr_el1, %0\n"
+                     "isb"
+                     : : "r"(value) : "memory");
+}
+
+static inline void fpen_set(uint64_t fpen)
+{
+    cpacr_write((cpacr_read() & ~CPACR_FPEN_MASK) | fpen);
+}
+
+void arch_fp_cpu_init(void)
+{
+    fpen_set(CPACR_FPEN_EL0_TRAP);
+}
+
+int arch_fp_enabled(void)
+{
+    return (cpacr_read() & CPACR_FPEN_MASK) == CPACR_FPEN_NONE;
+}
+
+void arch_fp_enable(void)
+{
+    fpen_set(CPACR_FPEN_NONE);
+}
+
+void arch_fp_disable(void)
+{
+    fpen_set(CPACR_FPEN_EL0_TRAP);
+}
+
+void arch_fp_reset(void)
+{
+    arch_fp_restore(&fp_initial_state);
+}
+
+#endif /* ARCH_ARM64 */
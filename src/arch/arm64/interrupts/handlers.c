@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include "exceptions.h"
 #include "kernel.h"
+#include "process.h"
+#include "syscall.h"
 
 // ARM64 Exception Syndrome Register (ESR_EL1) exception classes
 #define ESR_EC_UNKNOWN          0x00
@@ -49,6 +51,10 @@
 #define ESR_EC_VECTOR32         0x3A
 #define ESR_EC_BRK64            0x3C
 
+// SPSR_EL1.M[3:0]: the exception level and stack taken from
+#define SPSR_MODE_MASK          0xF
+#define SPSR_MODE_EL0T          0x0
+
 // Exception handler table
 static exception_handler_t exception_handlers[16] = {0};
 
@@ -85,6 +91,12 @@ void arm64_exception_handler(uint32_t exc_type, struct exception_context *ctx)
         // Synchronous exceptions - check ESR
         uint32_t ec = (ctx->esr >> 26) & 0x3F;  // Exception class
         
+        // EL0 FP/SIMD access with FPEN trapping: lazy FP switch, retried on eret
+        if (ec == ESR_EC_FP_ASIMD) {
+            fpu_trap();
+            return;
+        }
+        
         // Convert to cross-platform exception number
         uint32_t exception_num = EXCEPTION_SYNC;
         
@@ -135,6 +147,41 @@ void arm64_exception_handler(uint32_t exc_type, struct exception_context *ctx)
     }
 }
 
+/**
+ * IRQ vectors (called from assembly), with CNTVCT read on entry (0 unless
+ * IRQ timing is on)
+ */
+void arm64_irq_handler(uint32_t exc_type, struct exception_context *ctx, uint64_t stamp)
+{
+    int user = (ctx->spsr & SPSR_MODE_MASK) == SPSR_MODE_EL0T;
+
+    irq_stats_entry(stamp);
+    scheduler_account_entry(user);
+    irq_set_regs(ctx->elr, ctx->x[29], user);
+    arm64_exception_handler(exc_type, ctx);
+    irq_set_regs(0, 0, 0);
+    scheduler_account_exit(1);
+}
+
+/**
+ * SVC64 calls that are not leaf calls (called from the vector on the
+ * task's stack with the full context saved). The result goes back in x0.
+ */
+void arm64_syscall_handler(struct exception_context *ctx)
+{
+    uint32_t num = ctx->x[8] < MAX_SYSCALLS ? (uint32_t)ctx->x[8] : MAX_SYSCALLS;
+    
+    scheduler_account_entry(1);
+    ctx->x[0] = (uint64_t)syscall_dispatch(num,
+                                           (long)ctx->x[0], (long)ctx->x[1],
+                                           (long)ctx->x[2], (long)ctx->x[3],
+                                           (long)ctx->x[4], (long)ctx->x[5]);
+    scheduler_account_exit(0);
+    
+    // Same preemption point as an interrupt return
+    scheduler_irq_exit();
+}
+
 /**
  * Register exception handler
  */
@@ -162,4 +209,40 @@ void arch_interrupts_enable(int enable)
 int arch_interrupts_enabled(void)
 {
     return arch_interrupts_enabled_asm();
-}
\ No newline at end of file
+}
+
+/**
+ * Mask IRQs and return the previous DAIF for arch_restore_interrupts()
+ */
+unsigned long arch_disable_interrupts(void)
+{
+    unsigned long daif;
+    __asm__ volatile("mrs %0, daif\n"
+                     "msr daifset, #2"
+                     : "=r"(daif) : : "memory");
+    return daif;
+}
+
+void arch_restore_interrupts(unsigned long flags)
+{
+    __asm__ volatile("msr daif, %0" : : "r"(flags) : "memory");
+}
+
+void arch_enable_interrupts(void)
+{
+    __asm__ volatile("msr daifclr, #2" : : : "memory");
+}
+
+/**
+ * WFI wakes on a pending IRQ even while it is masked; unmask briefly to
+ * take it
+ */
+void arch_cpu_idle(void)
+{
+    __asm__ volatile("dsb sy\n"
+                     "wfi\n"
+                     "msr daifclr, #2\n"
+                     "isb\n"
+                     "msr daifset, #2"
+                     : : : "memory");
+}
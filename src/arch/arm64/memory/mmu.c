@@ -23,6 +23,14 @@ void early_print(const char *str);
 #define TCR_IRGN0_WB_RA_WA  1       // Write-back read-allocate write-allocate for TTBR0
 #define TCR_IRGN1_WB_RA_WA  1       // Write-back read-allocate write-allocate for TTBR1
 #define TCR_IPS_48BIT       5       // 48-bit intermediate physical address size
+#define TCR_A1              (1ULL << 22)   // ASID from TTBR1 instead of TTBR0
+#define TCR_AS              (1ULL << 36)   // 16-bit ASIDs
+
+// ID_AA64MMFR0_EL1.ASIDBits
+#define MMFR0_ASID_SHIFT    4
+#define MMFR0_ASID_16BIT    2
+
+#define TTBR_ASID_SHIFT     48
 
 // Memory Attribute Indirection Register (MAIR_EL1) values
 #define MAIR_DEVICE_nGnRnE  0x00    // Device memory nGnRnE
@@ -59,6 +67,10 @@ void early_print(const char *str);
 #define PAGE_SHIFT          12
 #define PAGE_SIZE           (1ULL << PAGE_SHIFT)
 #define PAGE_MASK           (PAGE_SIZE - 1)
+#define PTE_ADDR_MASK       0x0000FFFFFFFFF000ULL
+#define PTE_SH_INNER        (3ULL << 8)
+#define PT_ENTRIES          512
+#define PT_INDEX(va, level) (((va) >> (39 - 9 * (level))) & 0x1FF)
 
 // Translation table entries
 static uint64_t *ttbr0_l0_table __attribute__((aligned(4096)));
@@ -73,8 +85,6 @@ static uint64_t page_table_storage[4][512] __attribute__((aligned(4096)));
 static void setup_mair_el1(void);
 static void setup_tcr_el1(void);
 static uint64_t create_pte(uint64_t phys_addr, uint64_t flags);
-static int map_kernel_range(uint64_t virt_start, uint64_t phys_start, 
-                           size_t size, uint64_t flags);
 
 /**
  * Initialize ARM64 MMU
@@ -155,8 +165,8 @@ int arch_memory_init(struct boot_info *boot_info)
     
     // Map first 1GB of physical memory for kernel at high virtual addresses
     // TEMPORARILY COMMENT OUT - this function may have infinite loop
-    // if (map_kernel_range(KERNEL_VA_START, 0, 0x40000000, 
-    //                     PTE_VALID | PTE_AF | (ATTR_NORMAL_WB << 2)) < 0) {
+    // if (arch_memory_map_pages(KERNEL_VA_START, 0, 0x40000000,
+    //                           MEMORY_WRITABLE | MEMORY_CACHEABLE) < 0) {
     //     return -1;
     // }
     early_print("arch_memory_init: Skipping kernel range mapping for Phase 3\n");
@@ -180,39 +190,6 @@ void arch_memory_enable(void)
     early_print("MMU setup complete (MMU disabled for Phase 3 stability)\n");
 }
 
-/**
- * Map physical memory range to virtual address
- */
-int arch_memory_map_pages(uint64_t virt_addr, uint64_t phys_addr, 
-                          size_t size, uint32_t flags)
-{
-    // Convert flags to ARM64 page table flags
-    uint64_t pte_flags = PTE_VALID | PTE_AF;
-    
-    if (flags & MEMORY_WRITABLE) {
-        // Writable (clear RO bit)
-    } else {
-        pte_flags |= PTE_RDONLY;
-    }
-    
-    if (!(flags & MEMORY_EXECUTABLE)) {
-        pte_flags |= PTE_PXN;
-    }
-    
-    if (flags & MEMORY_CACHEABLE) {
-        pte_flags |= (ATTR_NORMAL_WB << 2);
-    } else {
-        pte_flags |= (ATTR_DEVICE_nGnRE << 2);
-    }
-    
-    // For Phase 3, implement basic 2MB block mapping
-    uint64_t virt_aligned = virt_addr & ~(0x200000ULL - 1);  // 2MB alignment
-    uint64_t phys_aligned = phys_addr & ~(0x200000ULL - 1);
-    size_t aligned_size = (size + 0x1FFFFF) & ~(0x200000ULL - 1);
-    
-    return map_kernel_range(virt_aligned, phys_aligned, aligned_size, pte_flags);
-}
-
 /**
  * Set up Memory Attribute Indirection Register
  */
@@ -283,31 +260,336 @@ static uint64_t create_pte(uint64_t phys_addr, uint64_t flags)
 }
 
 /**
- * Map kernel memory range (simplified for Phase 3)
+ * Take ASIDs from TTBR0 and use 16-bit ones where implemented
  */
-static int map_kernel_range(uint64_t virt_start, uint64_t phys_start, 
-                           size_t size, uint64_t flags)
+uint32_t arch_aspace_cpu_init(void)
 {
-    // For Phase 3: Simple 2MB block mapping in L1 table
-    uint64_t virt_addr = virt_start;
-    uint64_t phys_addr = phys_start;
-    size_t remaining = size;
-    
-    while (remaining > 0) {
-        // Calculate L1 index for kernel space (TTBR1)
-        uint64_t l1_index = (virt_addr >> 30) & 0x1FF;  // Bits [38:30]
-        
-        if (l1_index >= 512) {
-            return -1;  // Out of range
+    uint64_t mmfr0, tcr;
+    __asm__ volatile ("mrs %0, id_aa64mmfr0_el1" : "=r" (mmfr0));
+    __asm__ volatile ("mrs %0, tcr_el1" : "=r" (tcr));
+
+    uint32_t bits = 8;
+    tcr &= ~(TCR_A1 | TCR_AS);
+    if (((mmfr0 >> MMFR0_ASID_SHIFT) & 0xF) == MMFR0_ASID_16BIT) {
+        tcr |= TCR_AS;
+        bits = 16;
+    }
+    __asm__ volatile ("msr tcr_el1, %0\n"
+                      "isb"
+                      : : "r" (tcr) : "memory");
+
+    return bits;
+}
+
+uint64_t arch_aspace_kernel_root(void)
+{
+    return (uint64_t)ttbr0_l0_table;
+}
+
+/**
+ * TTBR0 holds the root and the ASID together, so one write switches both
+ */
+void arch_aspace_load(uint64_t root, uint32_t asid)
+{
+    uint64_t ttbr = root | ((uint64_t)asid << TTBR_ASID_SHIFT);
+    __asm__ volatile ("msr ttbr0_el1, %0\n"
+                      "isb"
+                      : : "r" (ttbr) : "memory");
+}
+
+void arch_tlb_flush_all(void)
+{
+    __asm__ volatile ("dsb nshst\n"
+                      "tlbi vmalle1\n"
+                      "dsb nsh\n"
+                      "isb"
+                      : : : "memory");
+}
+
+/**
+ * TLBI VALE1 takes the page number and the ASID loaded in TTBR0
+ */
+void arch_tlb_flush_page(uint64_t virt)
+{
+    uint64_t ttbr;
+    __asm__ volatile ("mrs %0, ttbr0_el1" : "=r" (ttbr));
+
+    uint64_t op = ((virt >> PAGE_SHIFT) & 0xFFFFFFFFFFFULL) |
+                  (ttbr & (0xFFFFULL << TTBR_ASID_SHIFT));
+    __asm__ volatile ("dsb nshst\n"
+                      "tlbi vale1, %0\n"
+                      "dsb nsh\n"
+                      "isb"
+                      : : "r" (op) : "memory");
+}
+
+/*
+ * Page-table manager
+ *
+ * Translation tables are walked from a root through levels 0-3 (512GB,
+ * 1GB, 2MB and 4KB per entry), with missing tables allocated from the
+ * page allocator; only the boot roots come from page_table_storage.
+ * Addresses at KERNEL_VA_START and up go through TTBR1's root, the rest
+ * through TTBR0's. A mapping uses the largest block (1GB, 2MB) or a 4KB
+ * page as its alignment and remaining length allow; a block in the way of
+ * a smaller mapping is split into a table of the next size down mapping
+ * the same range. After arch_memory_map_pages() a table whose entries map
+ * one contiguous, aligned range with the same attributes is folded back
+ * into a single block.
+ */
+
+#define PT_LEAF             3
+#define PT_DESC_MASK        3ULL            // Descriptor type, bits [1:0]
+#define PT_DESC_BLOCK       PTE_VALID
+#define PT_DESC_TABLE       (PTE_VALID | PTE_TABLE)     // Also a level 3 page
+#define LEVEL_SIZE(level)   (1ULL << (39 - 9 * (level)))
+
+static inline int entry_is_table(uint64_t entry, int level)
+{
+    return level < PT_LEAF && (entry & PT_DESC_MASK) == PT_DESC_TABLE;
+}
+
+static uint64_t *table_alloc(void)
+{
+    uint64_t *table = memory_alloc_pages(1);
+    if (table) {
+        for (int i = 0; i < PT_ENTRIES; i++) {
+            table[i] = 0;
         }
-        
-        // Create 1GB block entry (for simplicity in Phase 3)
-        kernel_l1_table[l1_index] = create_pte(phys_addr, flags | (1ULL << 0)); // Block entry
-        
-        virt_addr += 0x40000000;  // 1GB
-        phys_addr += 0x40000000;
-        remaining = remaining > 0x40000000 ? remaining - 0x40000000 : 0;
     }
-    
+    return table;
+}
+
+/**
+ * Table under entry index of a level table, allocated if create is set
+ * and it is missing. A block there is split when create is set.
+ */
+static uint64_t *pt_next(uint64_t *table, uint64_t index, int level, int create)
+{
+    uint64_t entry = table[index];
+    if (entry_is_table(entry, level)) {
+        return (uint64_t *)(entry & PTE_ADDR_MASK);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    uint64_t *next = table_alloc();
+    if (!next) {
+        return NULL;
+    }
+    if (entry & PTE_VALID) {
+        // Same translation in 512 smaller blocks or pages
+        uint64_t base = entry & PTE_ADDR_MASK;
+        uint64_t attrs = entry & ~PTE_ADDR_MASK & ~PT_DESC_MASK;
+        uint64_t type = (level + 1 == PT_LEAF) ? PT_DESC_TABLE : PT_DESC_BLOCK;
+        for (int i = 0; i < PT_ENTRIES; i++) {
+            next[i] = (base + i * LEVEL_SIZE(level + 1)) | attrs | type;
+        }
+    }
+    __asm__ volatile ("dsb ishst" : : : "memory");
+    table[index] = (uint64_t)next | PT_DESC_TABLE;
+    return next;
+}
+
+// Table at level holding the entry for virt, or NULL if it is missing
+// and !create
+static uint64_t *pt_walk(uint64_t root, uint64_t virt, int level, int create)
+{
+    uint64_t *table = (uint64_t *)root;
+    for (int l = 0; l < level && table; l++) {
+        table = pt_next(table, PT_INDEX(virt, l), l, create);
+    }
+    return table;
+}
+
+// Free the tables below a table descriptor (the pages they map are not ours)
+static void pt_free_tables(uint64_t entry, int level)
+{
+    if (!entry_is_table(entry, level)) {
+        return;
+    }
+    uint64_t *table = (uint64_t *)(entry & PTE_ADDR_MASK);
+    for (int i = 0; i < PT_ENTRIES; i++) {
+        pt_free_tables(table[i], level + 1);
+    }
+    memory_free_pages(table, 1);
+}
+
+/**
+ * Map [virt, virt + size) to phys with attributes attrs (no type bits)
+ * @return 1 if live entries were replaced (TLB flush needed), 0 if not,
+ *         negative if a table could not be allocated
+ */
+static int pt_map_range(uint64_t root, uint64_t virt, uint64_t phys,
+                        uint64_t size, uint64_t attrs)
+{
+    int replaced = 0;
+
+    while (size > 0) {
+        int level = PT_LEAF;
+        for (int l = 1; l < PT_LEAF; l++) {
+            uint64_t span = LEVEL_SIZE(l);
+            if (!((virt | phys) & (span - 1)) && size >= span) {
+                level = l;
+                break;
+            }
+        }
+
+        uint64_t *table = pt_walk(root, virt, level, 1);
+        if (!table) {
+            return -1;
+        }
+
+        uint64_t index = PT_INDEX(virt, level);
+        uint64_t old = table[index];
+        if (old & PTE_VALID) {
+            pt_free_tables(old, level);
+            replaced = 1;
+        }
+        table[index] = create_pte(phys, attrs |
+                                  (level == PT_LEAF ? PT_DESC_TABLE : PT_DESC_BLOCK));
+
+        virt += LEVEL_SIZE(level);
+        phys += LEVEL_SIZE(level);
+        size -= LEVEL_SIZE(level);
+    }
+    return replaced;
+}
+
+/**
+ * Fold the table under the level entry covering virt into one block if
+ * its entries map a contiguous, aligned range with equal attributes
+ * @return 1 if folded
+ */
+static int pt_promote(uint64_t root, uint64_t virt, int level)
+{
+    uint64_t *parent = pt_walk(root, virt, level, 0);
+    if (!parent) {
+        return 0;
+    }
+    uint64_t index = PT_INDEX(virt, level);
+    if (!entry_is_table(parent[index], level)) {
+        return 0;
+    }
+
+    uint64_t *table = (uint64_t *)(parent[index] & PTE_ADDR_MASK);
+    uint64_t first = table[0];
+    uint64_t base = first & PTE_ADDR_MASK;
+    if (!(first & PTE_VALID) || (base & (LEVEL_SIZE(level) - 1)) ||
+        entry_is_table(first, level + 1)) {
+        return 0;
+    }
+    uint64_t rest = first & ~PTE_ADDR_MASK;
+    for (int i = 1; i < PT_ENTRIES; i++) {
+        if (table[i] != ((base + i * LEVEL_SIZE(level + 1)) | rest)) {
+            return 0;
+        }
+    }
+
+    parent[index] = base | (rest & ~PT_DESC_MASK) | PT_DESC_BLOCK;
+    memory_free_pages(table, 1);
+    return 1;
+}
+
+static uint64_t pt_attrs(uint32_t flags)
+{
+    uint64_t attrs = PTE_AF;
+    if (!(flags & MEMORY_WRITABLE)) {
+        attrs |= PTE_RDONLY;
+    }
+    if (!(flags & MEMORY_EXECUTABLE)) {
+        attrs |= PTE_PXN;
+    }
+    if (flags & MEMORY_CACHEABLE) {
+        attrs |= (ATTR_NORMAL_WB << 2) | PTE_SH_INNER;
+    } else {
+        attrs |= (ATTR_DEVICE_nGnRE << 2);
+    }
+    return attrs;
+}
+
+/**
+ * Map a range into the kernel tables. Unaligned ends are widened to whole
+ * 4KB pages.
+ */
+int arch_memory_map_pages(uint64_t virt_addr, uint64_t phys_addr, 
+                          size_t size, uint32_t flags)
+{
+    uint64_t root = (virt_addr >= KERNEL_VA_START) ?
+                    (uint64_t)ttbr1_l0_table : (uint64_t)ttbr0_l0_table;
+    uint64_t offset = virt_addr & PAGE_MASK;
+    uint64_t virt = virt_addr - offset;
+    uint64_t phys = (phys_addr - offset) & PTE_ADDR_MASK;
+    uint64_t length = (size + offset + PAGE_MASK) & ~PAGE_MASK;
+
+    int changed = pt_map_range(root, virt, phys, length, pt_attrs(flags));
+    if (changed < 0) {
+        return -1;
+    }
+
+    // Fold what the new entries completed, 2MB first so 1GB can follow
+    for (int level = 2; level >= 1; level--) {
+        uint64_t span = LEVEL_SIZE(level);
+        for (uint64_t va = virt & ~(span - 1); va < virt + length; va += span) {
+            changed |= pt_promote(root, va, level);
+        }
+    }
+
+    __asm__ volatile ("dsb ishst" : : : "memory");
+    if (changed) {
+        arch_tlb_flush_all();
+    }
+    return 0;
+}
+
+// User pages: 4KB only, in the private user region slot
+
+/**
+ * Pages are non-global so their TLB entries carry the address space's
+ * ASID
+ */
+int arch_aspace_map_page(uint64_t root, uint64_t virt, uint64_t phys, uint32_t flags)
+{
+    uint64_t *l3 = pt_walk(root, virt, PT_LEAF, 1);
+    if (!l3) {
+        return -1;
+    }
+
+    uint64_t attrs = pt_attrs(flags) | PTE_NG | PTE_USER | PTE_PXN;
+    if (!(flags & MEMORY_EXECUTABLE)) {
+        attrs |= PTE_UXN;
+    }
+    l3[PT_INDEX(virt, 3)] = create_pte(phys, attrs | PT_DESC_TABLE);
+    __asm__ volatile ("dsb ishst\n"
+                      "isb"
+                      : : : "memory");
     return 0;
-}
\ No newline at end of file
+}
+
+uint64_t arch_aspace_translate(uint64_t root, uint64_t virt)
+{
+    uint64_t *l3 = pt_walk(root, virt, PT_LEAF, 0);
+    if (!l3 || !(l3[PT_INDEX(virt, 3)] & PTE_VALID)) {
+        return 0;
+    }
+    return l3[PT_INDEX(virt, 3)] & PTE_ADDR_MASK;
+}
+
+uint64_t arch_aspace_unmap_page(uint64_t root, uint64_t virt)
+{
+    uint64_t phys = arch_aspace_translate(root, virt);
+    if (phys) {
+        pt_walk(root, virt, PT_LEAF, 0)[PT_INDEX(virt, 3)] = 0;
+        __asm__ volatile ("dsb ishst" : : : "memory");
+    }
+    return phys;
+}
+
+void arch_aspace_free_tables(uint64_t root)
+{
+    uint64_t *l0 = (uint64_t *)root;
+    uint64_t slot = PT_INDEX(USER_VM_BASE, 0);
+    pt_free_tables(l0[slot], 0);
+    l0[slot] = 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * ARM64 PMUv3 Performance Counters
+ * Event counters programmed through PMSELR_EL0/PMXEVTYPER_EL0
+ *
+ * Only the general event counters are used, cycles included, so every
+ * event is programmed the same way and the dedicated cycle counter stays
+ * free for the profiler, which samples from its overflow interrupt. The
+ * event type filters are left clear, so EL0 and EL1 are both counted.
+ * Counters are 32 bits wide; perf.c copes with the wrap.
+ */
+
+#include "kernel.h"
+#include "interrupt.h"
+#include "perf.h"
+#include "profile.h"
+
+#ifdef ARCH_ARM64
+
+#define ID_DFR0_PMUVER_SHIFT    8
+#define ID_DFR0_PMUVER_MASK     0xfUL
+#define ID_DFR0_PMUVER_IMPDEF   0xfUL   // Not PMUv3
+
+#define PMCR_E                  (1UL << 0)  // Enable
+#define PMCR_P                  (1UL << 1)  // Reset event counters
+#define PMCR_LC                 (1UL << 6)  // Cycle counter overflows at 64 bits
+#define PMCR_N_SHIFT            11
+#define PMCR_N_MASK             0x1fUL
+
+#define PMU_ALL_COUNTERS        0xffffffffUL
+#define PMU_EVENT_COUNTERS      0x7fffffffUL
+#define PMU_CYCLE_COUNTER       (1UL << 31)
+
+#define PMU_IRQ                 23          // PPI 7, the overflow interrupt on QEMU virt
+
+// Common architectural event numbers
+static const uint32_t pmu_events[PERF_EVENT_COUNT] = {
+    [PERF_EVENT_CYCLES]         = 0x11,     // CPU_CYCLES
+    [PERF_EVENT_INSTRUCTIONS]   = 0x08,     // INST_RETIRED
+    [PERF_EVENT_CACHE_REFS]     = 0x04,     // L1D_CACHE
+    [PERF_EVENT_CACHE_MISSES]   = 0x03,     // L1D_CACHE_REFILL
+    [PERF_EVENT_BRANCHES]       = 0x21,     // BR_RETIRED
+    [PERF_EVENT_BRANCH_MISSES]  = 0x10,     // BR_MIS_PRED
+    [PERF_EVENT_DTLB_MISSES]    = 0x05,     // L1D_TLB_REFILL
+    [PERF_EVENT_ITLB_MISSES]    = 0x02,     // L1I_TLB_REFILL
+};
+
+// Implemented common events 0x00-0x3f, from PMCEID0/1_EL0
+static uint64_t pmu_common_events;
+static int pmu_present;
+static int pmu_irq_registered;
+static uint64_t pmu_sample_period;
+
+uint32_t arch_pmu_cpu_init(void)
+{
+    uint64_t dfr0;
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+    uint64_t version = (dfr0 >> ID_DFR0_PMUVER_SHIFT) & ID_DFR0_PMUVER_MASK;
+    if (version == 0 || version == ID_DFR0_PMUVER_IMPDEF) {
+        return 0;
+    }
+
+    uint64_t pmcr, ceid0, ceid1;
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    __asm__ volatile("mrs %0, pmceid0_el0" : "=r"(ceid0));
+    __asm__ volatile("mrs %0, pmceid1_el0" : "=r"(ceid1));
+    pmu_common_events = (ceid0 & 0xffffffffUL) | (ceid1 << 32);
+    pmu_present = 1;
+
+    // Everything off and cleared, then the unit enabled for the counters
+    // perf.c turns on one by one
+    __asm__ volatile("msr pmcntenclr_el0, %0\n"
+                     "msr pmintenclr_el1, %0\n"
+                     "msr pmovsclr_el0, %0\n"
+                     "msr pmcr_el0, %1\n"
+                     "isb"
+                     : : "r"(PMU_ALL_COUNTERS), "r"(pmcr | PMCR_E | PMCR_P) : "memory");
+
+    return (uint32_t)((pmcr >> PMCR_N_SHIFT) & PMCR_N_MASK);
+}
+
+int arch_pmu_event_supported(uint32_t event)
+{
+    return event < PERF_EVENT_COUNT && ((pmu_common_events >> pmu_events[event]) & 1);
+}
+
+void arch_pmu_program(uint32_t counter, uint32_t event)
+{
+    __asm__ volatile("msr pmselr_el0, %0\n"
+                     "isb\n"
+                     "msr pmxevtyper_el0, %1"
+                     : : "r"((uint64_t)counter), "r"((uint64_t)pmu_events[event]) : "memory");
+}
+
+uint64_t arch_pmu_read(uint32_t counter)
+{
+    uint64_t value;
+    __asm__ volatile("msr pmselr_el0, %1\n"
+                     "isb\n"
+                     "mrs %0, pmxevcntr_el0"
+                     : "=r"(value) : "r"((uint64_t)counter) : "memory");
+    return value;
+}
+
+uint64_t arch_pmu_counter_mask(void)
+{
+    return 0xffffffffUL;
+}
+
+void arch_pmu_start(uint32_t counters)
+{
+    __asm__ volatile("msr pmcntenset_el0, %0\n"
+                     "isb"
+                     : : "r"((uint64_t)counters) : "memory");
+}
+
+void arch_pmu_stop(void)
+{
+    __asm__ volatile("msr pmcntenclr_el0, %0\n"
+                     "isb"
+                     : : "r"(PMU_EVENT_COUNTERS) : "memory");
+}
+
+// Cycle counter overflow: rearm for the next period, then sample
+static void pmu_overflow_irq(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    (void)context;
+
+    uint64_t overflow;
+    __asm__ volatile("mrs %0, pmovsclr_el0" : "=r"(overflow));
+    if (!(overflow & PMU_CYCLE_COUNTER)) {
+        return;
+    }
+    __asm__ volatile("msr pmovsclr_el0, %0\n"
+                     "msr pmccntr_el0, %1\n"
+                     "isb"
+                     : : "r"(PMU_CYCLE_COUNTER), "r"(-pmu_sample_period) : "memory");
+
+    profile_sample(irq_get_regs());
+}
+
+int arch_pmu_sample_start(uint64_t period)
+{
+    if (!pmu_present || period == 0) {
+        return -1;
+    }
+    if (!pmu_irq_registered) {
+        if (request_irq(PMU_IRQ, pmu_overflow_irq, NULL, "pmu") < 0) {
+            return -1;
+        }
+        pmu_irq_registered = 1;
+    }
+    pmu_sample_period = period;
+
+    // 64-bit overflow so any period fits; the filter counts EL0 and EL1
+    uint64_t pmcr;
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    __asm__ volatile("msr pmcr_el0, %0\n"
+                     "msr pmccfiltr_el0, xzr\n"
+                     "msr pmccntr_el0, %1\n"
+                     "msr pmovsclr_el0, %2\n"
+                     "msr pmintenset_el1, %2\n"
+                     "msr pmcntenset_el0, %2\n"
+                     "isb"
+                     : : "r"(pmcr | PMCR_LC), "r"(-period), "r"(PMU_CYCLE_COUNTER) : "memory");
+    enable_irq(PMU_IRQ);
+    return 0;
+}
+
+void arch_pmu_sample_stop(void)
+{
+    if (!pmu_irq_registered) {
+        return;
+    }
+    disable_irq(PMU_IRQ);
+    __asm__ volatile("msr pmcntenclr_el0, %0\n"
+                     "msr pmintenclr_el1, %0\n"
+                     "msr pmovsclr_el0, %0\n"
+                     "isb"
+                     : : "r"(PMU_CYCLE_COUNTER) : "memory");
+}
+
+#endif /* ARCH_ARM64 */
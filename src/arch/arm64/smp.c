@@ -0,0 +1,120 @@
+/*
+ * MiniOS ARM64 SMP Support
+ * Secondary core bring-up through PSCI
+ *
+ * Cores are started with PSCI CPU_ON over the HVC conduit, which is what
+ * QEMU's virt machine provides to a kernel entered at EL1. Targets are
+ * probed by Aff0 within the boot core's cluster until the firmware reports
+ * an invalid MPIDR. The per-CPU pointer lives in TPIDR_EL1.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "smp.h"
+
+#ifdef ARCH_ARM64
+
+#define PSCI_CPU_ON                 0xC4000003
+#define PSCI_SUCCESS                0
+#define PSCI_INVALID_PARAMETERS     (-2)
+#define PSCI_ALREADY_ON             (-4)
+
+#define MPIDR_AFFINITY_MASK         0xFFFFFFULL
+#define SMP_BOOT_TIMEOUT            10000000
+
+extern void secondary_entry(void);
+extern int gic_cpu_init(void);
+
+// Boot CPU's vector base, shared with the secondaries
+static uint64_t smp_boot_vbar __attribute__((section(".data"))) = 0;
+
+static int64_t psci_cpu_on(uint64_t target, uint64_t entry, uint64_t context)
+{
+    register uint64_t x0 __asm__("x0") = PSCI_CPU_ON;
+    register uint64_t x1 __asm__("x1") = target;
+    register uint64_t x2 __asm__("x2") = entry;
+    register uint64_t x3 __asm__("x3") = context;
+
+    __asm__ volatile("hvc #0"
+                     : "+r"(x0)
+                     : "r"(x1), "r"(x2), "r"(x3)
+                     : "memory");
+    return (int64_t)x0;
+}
+
+void arch_smp_set_this_cpu(struct cpu_info *cpu)
+{
+    __asm__ volatile("msr tpidr_el1, %0" : : "r"(cpu) : "memory");
+}
+
+uint32_t arch_smp_boot_cpu_hw_id(void)
+{
+    uint64_t mpidr;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return (uint32_t)(mpidr & MPIDR_AFFINITY_MASK);
+}
+
+/**
+ * Per-CPU setup on the secondary itself: share the boot CPU's exception
+ * vectors, install the per-CPU pointer and bring up its GIC interface
+ */
+void arch_smp_secondary_init(struct cpu_info *cpu)
+{
+    arch_smp_set_this_cpu(cpu);
+    __asm__ volatile("msr vbar_el1, %0\n"
+                     "isb"
+                     : : "r"(smp_boot_vbar) : "memory");
+    gic_cpu_init();
+}
+
+int arch_smp_boot_secondaries(void)
+{
+    uint32_t boot_id = smp_cpus[0].hw_id;
+    uint32_t next = 1;
+    int started = 0;
+
+    __asm__ volatile("mrs %0, vbar_el1" : "=r"(smp_boot_vbar));
+
+    for (uint32_t aff0 = 0; aff0 < 256 && next < MAX_CPUS; aff0++) {
+        uint32_t hw_id = (boot_id & ~0xFFu) | aff0;
+        if (hw_id == boot_id) {
+            continue;
+        }
+
+        struct cpu_info *cpu = &smp_cpus[next];
+        void *stack = memory_alloc_pages(SMP_CPU_STACK_SIZE / PAGE_SIZE_4K);
+        if (!stack) {
+            early_print("SMP: no memory for CPU stack\n");
+            break;
+        }
+        cpu->hw_id = hw_id;
+        cpu->stack_top = (uint64_t)stack + SMP_CPU_STACK_SIZE;
+
+        int64_t ret = psci_cpu_on(hw_id, (uint64_t)secondary_entry, (uint64_t)cpu);
+        if (ret != PSCI_SUCCESS) {
+            memory_free_pages(stack, SMP_CPU_STACK_SIZE / PAGE_SIZE_4K);
+            cpu->stack_top = 0;
+            if (ret == PSCI_INVALID_PARAMETERS) {
+                break;  // No core with this MPIDR: end of the cluster
+            }
+            continue;  // Already on, or denied
+        }
+
+        for (uint32_t spin = 0; spin < SMP_BOOT_TIMEOUT; spin++) {
+            if (__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            __asm__ volatile("yield");
+        }
+        next++;  // A late core keeps its slot and stack
+        if (!cpu->online) {
+            early_print("SMP: CPU did not come online\n");
+            continue;
+        }
+        started++;
+    }
+
+    return started > 0 ? started : -1;
+}
+
+#endif /* ARCH_ARM64 */
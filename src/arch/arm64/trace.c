@@ -0,0 +1,37 @@
+/*
+ * ARM64 Tracepoint Patching
+ * Rewrites a trace_event() site between NOP and B
+ *
+ * Both are single aligned words and among the instructions the
+ * architecture lets one CPU rewrite while another may be executing them,
+ * so the store needs no rendezvous; cleaning the line to the point of
+ * unification and invalidating the I-cache, broadcast to the inner
+ * shareable domain, makes every CPU fetch the new one.
+ */
+
+#include "kernel.h"
+#include "trace.h"
+
+#ifdef ARCH_ARM64
+
+#define A64_NOP             0xd503201fU
+#define A64_B               0x14000000U
+#define A64_B_IMM_MASK      0x03ffffffU     // Word offset, +/-128MB
+
+void arch_trace_patch(uintptr_t code, uintptr_t target, int enable)
+{
+    uint32_t insn = A64_NOP;
+    if (enable) {
+        insn = A64_B | ((uint32_t)((int64_t)(target - code) >> 2) & A64_B_IMM_MASK);
+    }
+
+    __atomic_store_n((volatile uint32_t *)code, insn, __ATOMIC_RELAXED);
+    __asm__ volatile("dc cvau, %0\n"
+                     "dsb ish\n"
+                     "ic ivau, %0\n"
+                     "dsb ish\n"
+                     "isb"
+                     : : "r"(code) : "memory");
+}
+
+#endif /* ARCH_ARM64 */
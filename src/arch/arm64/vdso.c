@@ -0,0 +1,44 @@
+/*
+ * ARM64 vDSO Support
+ * User access to the virtual counter and the CPU number
+ *
+ * CNTKCTL_EL1.EL0VCTEN lets EL0 read CNTVCT_EL0, the counter the shared
+ * clock is based on. Each CPU's index goes in TPIDRRO_EL0, which EL0 can
+ * read but not write, so user code can find its PID slot.
+ */
+
+#include "kernel.h"
+#include "vdso.h"
+
+#ifdef ARCH_ARM64
+
+#define CNTKCTL_EL0VCTEN    (1UL << 1)
+
+uint64_t arch_vdso_counter_frequency(void)
+{
+    uint64_t freq;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+
+uint64_t arch_vdso_read_counter(void)
+{
+    uint64_t count;
+    __asm__ volatile("isb\n"
+                     "mrs %0, cntvct_el0"
+                     : "=r"(count) : : "memory");
+    return count;
+}
+
+uint32_t arch_vdso_cpu_init(uint32_t cpu)
+{
+    uint64_t cntkctl;
+    __asm__ volatile("mrs %0, cntkctl_el1" : "=r"(cntkctl));
+    __asm__ volatile("msr cntkctl_el1, %0" : : "r"(cntkctl | CNTKCTL_EL0VCTEN));
+    __asm__ volatile("msr tpidrro_el0, %0\n"
+                     "isb"
+                     : : "r"((uint64_t)cpu) : "memory");
+    return VDSO_HAS_CPU_PID;
+}
+
+#endif /* ARCH_ARM64 */
@@ -0,0 +1,83 @@
+/*
+ * x86-64 FP/SIMD Access Control
+ * CR0.TS gating and FXSAVE/FXRSTOR for lazy FP/SIMD switching
+ *
+ * The kernel is built without SSE, so only task code ever touches the
+ * x87/SSE registers. With CR0.TS set the first such instruction raises
+ * #NM (vector 7), which fpu_trap_entry in irq_entry.asm hands to
+ * fpu_trap(). CR0.MP makes WAIT/FWAIT trap as well.
+ */
+
+#include "kernel.h"
+#include "process.h"
+
+#ifdef ARCH_X86_64
+
+#define CR0_MP              (1UL << 1)
+#define CR0_EM              (1UL << 2)
+#define CR0_TS              (1UL << 3)
+#define CR4_OSFXSR          (1UL << 9)
+#define CR4_OSXMMEXCPT      (1UL << 10)
+
+// FNINIT control word, all SSE exceptions masked, empty registers
+static struct fp_state fp_initial_state __attribute__((section(".data"))) = {
+    .fxsave = {
+        [0] = 0x7F, [1] = 0x03,         // FCW 0x037F
+        [24] = 0x80, [25] = 0x1F,       // MXCSR 0x1F80
+    },
+};
+
+static inline uint64_t cr0_read(void)
+{
+    uint64_t value;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void cr0_write(uint64_t value)
+{
+    __asm__ volatile("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+// Enable FXSR/SSE on this CPU and arm the first-use trap
+void arch_fp_cpu_init(void)
+{
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+
+    cr0_write((cr0_read() & ~CR0_EM) | CR0_MP | CR0_TS);
+}
+
+int arch_fp_enabled(void)
+{
+    return !(cr0_read() & CR0_TS);
+}
+
+void arch_fp_enable(void)
+{
+    __asm__ volatile("clts" : : : "memory");
+}
+
+void arch_fp_disable(void)
+{
+    cr0_write(cr0_read() | CR0_TS);
+}
+
+void arch_fp_save(struct fp_state *fp)
+{
+    __asm__ volatile("fxsave64 %0" : "=m"(fp->fxsave));
+}
+
+void arch_fp_restore(const struct fp_state *fp)
+{
+    __asm__ volatile("fxrstor64 %0" : : "m"(fp->fxsave));
+}
+
+void arch_fp_reset(void)
+{
+    arch_fp_restore(&fp_initial_state);
+}
+
+#endif /* ARCH_X86_64 */
@@ -103,6 +103,16 @@ void arch_early_print(const char *str)
     }
 }
 
+// Console output reaches the serial port through the UART driver; keep
+// the VGA screen in step
+void arch_early_print_mirror(const char *str)
+{
+    while (*str) {
+        vga_putchar(*str);
+        str++;
+    }
+}
+
 void arch_halt(void)
 {
     arch_early_print("x86-64: Halting processor\n");
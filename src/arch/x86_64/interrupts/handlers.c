@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include "exceptions.h"
 #include "kernel.h"
+#include "process.h"
+#include "syscall.h"
 
 // Exception handler table
 static exception_handler_t exception_handlers[16] = {0};
@@ -59,4 +61,74 @@ int arch_interrupts_enabled(void)
     uint64_t flags;
     __asm__ volatile ("pushfq; popq %0" : "=r" (flags));
     return (flags & (1 << 9)) != 0;  // IF flag
-}
\ No newline at end of file
+}
+
+/**
+ * Mask interrupts and return the previous RFLAGS for arch_restore_interrupts()
+ */
+unsigned long arch_disable_interrupts(void)
+{
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+void arch_restore_interrupts(unsigned long flags)
+{
+    if (flags & (1 << 9)) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
+void arch_enable_interrupts(void)
+{
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+/**
+ * STI only takes effect after the next instruction, so no interrupt can
+ * slip in between it and the HLT
+ */
+void arch_cpu_idle(void)
+{
+    __asm__ volatile ("sti; hlt; cli" : : : "memory");
+}
+
+// irq_common's stack, in 8-byte slots from the last register it pushed
+#define IRQ_FRAME_RBP           0
+#define IRQ_FRAME_RIP           11
+#define IRQ_FRAME_CS            12
+
+/**
+ * Common C entry for the PIC IRQ stubs in irq_entry.asm, with the TSC
+ * read on entry (0 unless IRQ timing is on)
+ */
+void x86_irq_dispatch(uint64_t irq, uint64_t stamp, const uint64_t *frame)
+{
+    int user = (frame[IRQ_FRAME_CS] & 3) == 3;
+
+    irq_stats_entry(stamp);
+    scheduler_account_entry(user);
+    irq_set_regs(frame[IRQ_FRAME_RIP], frame[IRQ_FRAME_RBP], user);
+    handle_interrupt((uint32_t)irq);
+    irq_set_regs(0, 0, 0);
+    scheduler_account_exit(1);
+}
+
+/**
+ * SYSCALL entry for calls that are not leaf calls (from context.asm),
+ * charging the time before it to the caller's user time
+ */
+long x86_syscall_dispatch(uint32_t num, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5)
+{
+    scheduler_account_entry(1);
+    long result = syscall_dispatch(num, arg0, arg1, arg2, arg3, arg4, arg5);
+    scheduler_account_exit(0);
+
+    // Same preemption point as an interrupt return, so a task woken by
+    // the call runs before the caller gets back to user mode
+    unsigned long flags = disable_interrupts();
+    scheduler_irq_exit();
+    restore_interrupts(flags);
+    return result;
+}
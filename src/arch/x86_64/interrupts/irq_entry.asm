@@ -0,0 +1,134 @@
+; x86-64 Hardware Interrupt Entry
+;
+; Stubs for PIC IRQs 0-15 (vectors 0x20-0x2F) and the local APIC timer,
+; IRQ 16 (vector 0x30). Each pushes its IRQ number
+; and joins irq_common, which saves the caller-saved state, dispatches
+; through handle_interrupt() and then gives the scheduler a chance to
+; switch via scheduler_irq_exit(). While irq_stats_enabled is set the
+; TSC is read as soon as the registers are saved, for the latency
+; histograms. Kernel-mode interrupts stay on the
+; interrupted stack, so a task switched away here resumes from this frame
+; when it is next scheduled.
+;
+; fpu_trap_entry takes #NM (vector 7), raised by the first FP/SSE
+; instruction after a switch set CR0.TS; see fpu.c.
+
+section .text
+
+extern x86_irq_dispatch
+extern scheduler_irq_exit
+extern fpu_trap
+extern irq_stats_enabled
+
+%macro IRQ_STUB 1
+global irq%1
+irq%1:
+    push qword %1
+    jmp irq_common
+%endmacro
+
+IRQ_STUB 0
+IRQ_STUB 1
+IRQ_STUB 2
+IRQ_STUB 3
+IRQ_STUB 4
+IRQ_STUB 5
+IRQ_STUB 6
+IRQ_STUB 7
+IRQ_STUB 8
+IRQ_STUB 9
+IRQ_STUB 10
+IRQ_STUB 11
+IRQ_STUB 12
+IRQ_STUB 13
+IRQ_STUB 14
+IRQ_STUB 15
+IRQ_STUB 16
+
+irq_common:
+    ; Caller-saved registers; the C code preserves the rest
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push rbp
+
+    ; Entry timestamp, 0 when IRQ timing is off
+    xor esi, esi
+    cmp dword [rel irq_stats_enabled], 0
+    je .no_stamp
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov rsi, rax
+.no_stamp:
+
+    ; Align the stack for the calls (the kernel is built without SSE, so
+    ; there is no vector state to keep)
+    mov rbp, rsp
+    and rsp, ~15
+
+    mov rdi, [rbp + 80]      ; IRQ number pushed by the stub
+    mov rdx, rbp             ; Saved registers, then the interrupt frame
+    call x86_irq_dispatch
+
+    ; Controller is acknowledged; switch tasks here if needed
+    call scheduler_irq_exit
+
+    mov rsp, rbp
+
+    pop rbp
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    add rsp, 8               ; IRQ number
+    iretq
+
+; Spurious local APIC interrupts are not in service and take no EOI
+global apic_spurious_entry
+apic_spurious_entry:
+    iretq
+
+; #NM pushes no error code; the faulting instruction is retried on return
+global fpu_trap_entry
+fpu_trap_entry:
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push rbp
+
+    mov rbp, rsp
+    and rsp, ~15
+
+    call fpu_trap            ; Clears CR0.TS and loads the task's state
+
+    mov rsp, rbp
+
+    pop rbp
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    iretq
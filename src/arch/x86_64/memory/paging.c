@@ -32,6 +32,16 @@
 
 #define PAGE_TABLE_ENTRIES  512
 #define PAGE_MASK           (PAGE_SIZE_4K - 1)
+#define PTE_ADDR_MASK       0x000FFFFFFFFFF000ULL
+#define PT_INDEX(va, shift) (((va) >> (shift)) & 0x1FF)
+
+// Process-context identifiers
+#define CPUID_1_ECX_PCID    (1U << 17)
+#define CR4_PGE             (1ULL << 7)
+#define CR4_PCIDE           (1ULL << 17)
+#define CR3_PCID_MASK       0xFFFULL
+#define CR3_NOFLUSH         (1ULL << 63)
+#define PCID_BITS           12
 
 // Page table structures (aligned to 4K)
 // Move to .data section to ensure GRUB allocates space
@@ -40,11 +50,16 @@ static uint64_t pdpt_kernel[PAGE_TABLE_ENTRIES] __attribute__((aligned(4096))) _
 static uint64_t pd_kernel[PAGE_TABLE_ENTRIES] __attribute__((aligned(4096))) __attribute__((section(".data"))) __attribute__((unused)) = {0};
 static uint64_t pdpt_user[PAGE_TABLE_ENTRIES] __attribute__((aligned(4096))) __attribute__((section(".data"))) __attribute__((unused)) = {0};
 
+// CR4.PCIDE is set (same on every CPU)
+static int pcid_enabled __attribute__((section(".data"))) = 0;
+
+// Physical address of the kernel's PML4
+static uint64_t kernel_root __attribute__((section(".data"))) = 0;
+
 // Forward declarations
-static void clear_page_table(uint64_t *table) __attribute__((unused));
+static void clear_page_table(uint64_t *table);
 static void setup_kernel_mapping(void) __attribute__((unused));
 static void setup_identity_mapping(void) __attribute__((unused));
-static int map_2mb_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
 static void enable_pae_and_nx(void) __attribute__((unused));
 static void load_page_tables(void);
 
@@ -82,41 +97,6 @@ void arch_memory_enable(void)
     early_print("arch_memory_enable: Using boot page tables\n");
 }
 
-/**
- * Map virtual memory pages
- */
-int arch_memory_map_pages(uint64_t virt_addr, uint64_t phys_addr,
-                          size_t size, uint32_t flags)
-{
-    // Convert flags to x86-64 page table flags
-    uint64_t pt_flags = PAGE_PRESENT;
-    
-    if (flags & MEMORY_WRITABLE) {
-        pt_flags |= PAGE_WRITABLE;
-    }
-    
-    if (!(flags & MEMORY_EXECUTABLE)) {
-        pt_flags |= PAGE_NX;
-    }
-    
-    if (!(flags & MEMORY_CACHEABLE)) {
-        pt_flags |= PAGE_CACHE_DISABLE;
-    }
-    
-    // For Phase 3, implement 2MB page mapping
-    uint64_t virt_aligned = virt_addr & ~(PAGE_SIZE_2M - 1);
-    uint64_t phys_aligned = phys_addr & ~(PAGE_SIZE_2M - 1);
-    size_t aligned_size = (size + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
-    
-    for (size_t offset = 0; offset < aligned_size; offset += PAGE_SIZE_2M) {
-        if (map_2mb_page(virt_aligned + offset, phys_aligned + offset, pt_flags) < 0) {
-            return -1;
-        }
-    }
-    
-    return 0;
-}
-
 // Helper functions
 
 /**
@@ -156,30 +136,6 @@ static void setup_identity_mapping(void)
     pdpt_user[0] = 0x000000000 | flags;  // First 1GB: 0x00000000 - 0x3FFFFFFF
 }
 
-/**
- * Map 2MB page
- */
-static int map_2mb_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags)
-{
-    // For Phase 3, we only support mapping in existing page directories
-    // A full implementation would create intermediate page tables as needed
-    
-    if (virt_addr >= KERNEL_VIRT_BASE) {
-        // Kernel space mapping
-        uint64_t pd_index = (virt_addr >> PD_SHIFT) & 0x1FF;
-        if (pd_index >= PAGE_TABLE_ENTRIES) {
-            return -1;
-        }
-        
-        pd_kernel[pd_index] = (phys_addr & ~PAGE_MASK) | flags | PAGE_SIZE_FLAG;
-    } else {
-        // User space mapping (not implemented in Phase 3)
-        return -1;
-    }
-    
-    return 0;
-}
-
 /**
  * Enable PAE and NX bit support
  */
@@ -212,4 +168,344 @@ static void load_page_tables(void)
     
     // Flush TLB
     __asm__ volatile ("mov %%cr3, %%rax; mov %%rax, %%cr3" : : : "rax", "memory");
-}
\ No newline at end of file
+}
+
+/**
+ * Turn on PCIDs where the CPU has them. CR4.PCIDE can only be set while
+ * the current PCID (CR3[11:0]) is 0, which holds for the boot tables.
+ */
+uint32_t arch_aspace_cpu_init(void)
+{
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile ("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+    if (!(ecx & CPUID_1_ECX_PCID)) {
+        return 0;
+    }
+
+    uint64_t cr3, cr4;
+    __asm__ volatile ("mov %%cr3, %0" : "=r" (cr3));
+    if (cr3 & CR3_PCID_MASK) {
+        return 0;
+    }
+    __asm__ volatile ("mov %%cr4, %0" : "=r" (cr4));
+    __asm__ volatile ("mov %0, %%cr4" : : "r" (cr4 | CR4_PCIDE) : "memory");
+
+    pcid_enabled = 1;
+    return PCID_BITS;
+}
+
+/**
+ * Recorded on the first call, made by aspace_init() on the boot tables:
+ * CR3 holds some task's copy later on
+ */
+uint64_t arch_aspace_kernel_root(void)
+{
+    if (!kernel_root) {
+        uint64_t cr3;
+        __asm__ volatile ("mov %%cr3, %0" : "=r" (cr3));
+        kernel_root = cr3 & ~CR3_PCID_MASK;
+    }
+    return kernel_root;
+}
+
+/**
+ * With PCIDs the load keeps every PCID's entries, including asid's own,
+ * which are still valid for the same root
+ */
+void arch_aspace_load(uint64_t root, uint32_t asid)
+{
+    uint64_t cr3 = root;
+    if (pcid_enabled) {
+        cr3 |= (asid & CR3_PCID_MASK) | CR3_NOFLUSH;
+    }
+    __asm__ volatile ("mov %0, %%cr3" : : "r" (cr3) : "memory");
+}
+
+/**
+ * Toggling CR4.PGE flushes every TLB entry, global ones and all PCIDs
+ */
+void arch_tlb_flush_all(void)
+{
+    uint64_t cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r" (cr4));
+    __asm__ volatile ("mov %0, %%cr4\n"
+                      "mov %1, %%cr4"
+                      : : "r" (cr4 ^ CR4_PGE), "r" (cr4) : "memory");
+}
+
+/**
+ * INVLPG drops the entry for the current PCID only
+ */
+void arch_tlb_flush_page(uint64_t virt)
+{
+    __asm__ volatile ("invlpg (%0)" : : "r" (virt) : "memory");
+}
+
+/*
+ * Page-table manager
+ *
+ * Tables are walked from the root through PML4 (level 0), PDPT (1),
+ * PD (2) and PT (3), with missing tables allocated from the page
+ * allocator. A mapping uses the largest page (1GB where the CPU has
+ * them, 2MB, 4KB) that its alignment and remaining length allow; a huge
+ * page that is in the way of a smaller mapping is split into a table of
+ * the next size down mapping the same range. After arch_memory_map_pages()
+ * a table whose entries map one contiguous, aligned range with the same
+ * attributes is folded back into a single huge page.
+ */
+
+#define PT_LEVELS           4
+#define PT_LEAF             3
+#define PT_TABLE_FLAGS      (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER)
+#define PT_HW_FLAGS         (PAGE_ACCESSED | PAGE_DIRTY)
+#define CPUID_EXT_PDPE1GB   (1U << 26)
+
+static const uint32_t level_shift[PT_LEVELS] = {
+    PML4_SHIFT, PDPT_SHIFT, PD_SHIFT, PT_SHIFT
+};
+
+#define LEVEL_SIZE(level)   (1ULL << level_shift[level])
+
+// 1GB pages: -1 until probed
+static int gb_pages __attribute__((section(".data"))) = -1;
+
+static int leaf_allowed(int level)
+{
+    if (level == 1 && gb_pages < 0) {
+        uint32_t eax = 0x80000001, ebx, ecx, edx;
+        __asm__ volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+        gb_pages = (edx & CPUID_EXT_PDPE1GB) != 0;
+    }
+    return level == PT_LEAF || level == 2 || (level == 1 && gb_pages);
+}
+
+static inline int entry_is_table(uint64_t entry, int level)
+{
+    return (entry & PAGE_PRESENT) && level < PT_LEAF && !(entry & PAGE_SIZE_FLAG);
+}
+
+static uint64_t *table_alloc(void)
+{
+    uint64_t *table = memory_alloc_pages(1);
+    if (table) {
+        clear_page_table(table);
+    }
+    return table;
+}
+
+/**
+ * Table under entry index of a level table, allocated if create is set
+ * and it is missing. A huge page there is split when create is set.
+ */
+static uint64_t *pt_next(uint64_t *table, uint64_t index, int level, int create)
+{
+    uint64_t entry = table[index];
+    if (entry_is_table(entry, level)) {
+        return (uint64_t *)(entry & PTE_ADDR_MASK);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    uint64_t *next = table_alloc();
+    if (!next) {
+        return NULL;
+    }
+    if (entry & PAGE_PRESENT) {
+        // Same translation in 512 smaller pages, so no TLB flush is needed
+        uint64_t base = entry & PTE_ADDR_MASK;
+        uint64_t attrs = entry & ~PTE_ADDR_MASK;
+        if (level + 1 == PT_LEAF) {
+            attrs &= ~PAGE_SIZE_FLAG;
+        }
+        for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            next[i] = (base + i * LEVEL_SIZE(level + 1)) | attrs;
+        }
+    }
+    table[index] = (uint64_t)next | PT_TABLE_FLAGS;
+    return next;
+}
+
+// Table at level holding the entry for virt, or NULL if it is missing
+// and !create
+static uint64_t *pt_walk(uint64_t root, uint64_t virt, int level, int create)
+{
+    uint64_t *table = (uint64_t *)root;
+    for (int l = 0; l < level && table; l++) {
+        table = pt_next(table, PT_INDEX(virt, level_shift[l]), l, create);
+    }
+    return table;
+}
+
+// Free the tables below a table entry (the pages they map are not ours)
+static void pt_free_tables(uint64_t entry, int level)
+{
+    if (!entry_is_table(entry, level)) {
+        return;
+    }
+    uint64_t *table = (uint64_t *)(entry & PTE_ADDR_MASK);
+    for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        pt_free_tables(table[i], level + 1);
+    }
+    memory_free_pages(table, 1);
+}
+
+/**
+ * Map [virt, virt + size) to phys with leaf attributes attrs
+ * @return 1 if live entries were replaced (TLB flush needed), 0 if not,
+ *         negative if a table could not be allocated
+ */
+static int pt_map_range(uint64_t root, uint64_t virt, uint64_t phys,
+                        uint64_t size, uint64_t attrs)
+{
+    int replaced = 0;
+
+    while (size > 0) {
+        int level = PT_LEAF;
+        for (int l = 1; l < PT_LEAF; l++) {
+            uint64_t span = LEVEL_SIZE(l);
+            if (leaf_allowed(l) && !((virt | phys) & (span - 1)) && size >= span) {
+                level = l;
+                break;
+            }
+        }
+
+        uint64_t *table = pt_walk(root, virt, level, 1);
+        if (!table) {
+            return -1;
+        }
+
+        uint64_t index = PT_INDEX(virt, level_shift[level]);
+        uint64_t old = table[index];
+        if (old & PAGE_PRESENT) {
+            pt_free_tables(old, level);
+            replaced = 1;
+        }
+        table[index] = phys | attrs | (level < PT_LEAF ? PAGE_SIZE_FLAG : 0);
+
+        virt += LEVEL_SIZE(level);
+        phys += LEVEL_SIZE(level);
+        size -= LEVEL_SIZE(level);
+    }
+    return replaced;
+}
+
+/**
+ * Fold the table under the level entry covering virt into one huge page
+ * if its entries map a contiguous, aligned range with equal attributes
+ * @return 1 if folded
+ */
+static int pt_promote(uint64_t root, uint64_t virt, int level)
+{
+    uint64_t *parent = pt_walk(root, virt, level, 0);
+    if (!parent || !leaf_allowed(level)) {
+        return 0;
+    }
+    uint64_t index = PT_INDEX(virt, level_shift[level]);
+    if (!entry_is_table(parent[index], level)) {
+        return 0;
+    }
+
+    uint64_t *table = (uint64_t *)(parent[index] & PTE_ADDR_MASK);
+    uint64_t first = table[0];
+    uint64_t base = first & PTE_ADDR_MASK;
+    uint64_t attrs = first & ~PTE_ADDR_MASK & ~PT_HW_FLAGS;
+    if (!(first & PAGE_PRESENT) || (base & (LEVEL_SIZE(level) - 1)) ||
+        entry_is_table(first, level + 1)) {
+        return 0;
+    }
+    for (int i = 1; i < PAGE_TABLE_ENTRIES; i++) {
+        if ((table[i] & ~PT_HW_FLAGS) != ((base + i * LEVEL_SIZE(level + 1)) | attrs)) {
+            return 0;
+        }
+    }
+
+    parent[index] = base | (attrs & ~PAGE_SIZE_FLAG) | PAGE_SIZE_FLAG;
+    memory_free_pages(table, 1);
+    return 1;
+}
+
+static uint64_t pt_attrs(uint32_t flags)
+{
+    uint64_t attrs = PAGE_PRESENT;
+    if (flags & MEMORY_WRITABLE) {
+        attrs |= PAGE_WRITABLE;
+    }
+    if (!(flags & MEMORY_EXECUTABLE)) {
+        attrs |= PAGE_NX;
+    }
+    if (!(flags & MEMORY_CACHEABLE)) {
+        attrs |= PAGE_CACHE_DISABLE;
+    }
+    return attrs;
+}
+
+/**
+ * Map a range into the kernel tables, which every address space shares
+ * below the top level. Unaligned ends are widened to whole 4KB pages.
+ */
+int arch_memory_map_pages(uint64_t virt_addr, uint64_t phys_addr,
+                          size_t size, uint32_t flags)
+{
+    uint64_t root = arch_aspace_kernel_root();
+    uint64_t offset = virt_addr & PAGE_MASK;
+    uint64_t virt = virt_addr - offset;
+    uint64_t phys = (phys_addr - offset) & PTE_ADDR_MASK;
+    uint64_t length = (size + offset + PAGE_MASK) & ~(uint64_t)PAGE_MASK;
+
+    int changed = pt_map_range(root, virt, phys, length, pt_attrs(flags));
+    if (changed < 0) {
+        return -1;
+    }
+
+    // Fold what the new entries completed, 2MB first so 1GB can follow
+    for (int level = 2; level >= 1; level--) {
+        uint64_t span = LEVEL_SIZE(level);
+        for (uint64_t va = virt & ~(span - 1); va < virt + length; va += span) {
+            changed |= pt_promote(root, va, level);
+        }
+    }
+
+    if (changed) {
+        arch_tlb_flush_all();
+    }
+    return 0;
+}
+
+// User pages: 4KB only, in the private user region slot
+
+int arch_aspace_map_page(uint64_t root, uint64_t virt, uint64_t phys, uint32_t flags)
+{
+    uint64_t *pt = pt_walk(root, virt, PT_LEAF, 1);
+    if (!pt) {
+        return -1;
+    }
+    pt[PT_INDEX(virt, PT_SHIFT)] = (phys & PTE_ADDR_MASK) | pt_attrs(flags) | PAGE_USER;
+    return 0;
+}
+
+uint64_t arch_aspace_translate(uint64_t root, uint64_t virt)
+{
+    uint64_t *pt = pt_walk(root, virt, PT_LEAF, 0);
+    if (!pt || !(pt[PT_INDEX(virt, PT_SHIFT)] & PAGE_PRESENT)) {
+        return 0;
+    }
+    return pt[PT_INDEX(virt, PT_SHIFT)] & PTE_ADDR_MASK;
+}
+
+uint64_t arch_aspace_unmap_page(uint64_t root, uint64_t virt)
+{
+    uint64_t phys = arch_aspace_translate(root, virt);
+    if (phys) {
+        pt_walk(root, virt, PT_LEAF, 0)[PT_INDEX(virt, PT_SHIFT)] = 0;
+    }
+    return phys;
+}
+
+void arch_aspace_free_tables(uint64_t root)
+{
+    uint64_t *pml4 = (uint64_t *)root;
+    uint64_t slot = PT_INDEX(USER_VM_BASE, PML4_SHIFT);
+    pt_free_tables(pml4[slot], 0);
+    pml4[slot] = 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * x86-64 Architectural Performance Monitoring
+ * General-purpose counters through IA32_PERFEVTSELx/IA32_PMCx
+ *
+ * Only the events CPUID leaf 0xA guarantees are used, so the same
+ * encodings work on every Intel part that has the leaf; TLB misses have
+ * no architectural event and are not offered. Both ring 0, where tasks
+ * run, and ring 3 are counted. Version 2 and later gate all counters
+ * through IA32_PERF_GLOBAL_CTRL; version 1 has only the per-counter
+ * enable bit. AMD's counters are not handled.
+ *
+ * Overflow interrupts arrive through the local APIC's performance counter
+ * LVT entry, and interrupts here still go through the 8259 PIC, so there
+ * is no cycle sampling for the profiler; it falls back to the tick.
+ */
+
+#include "kernel.h"
+#include "perf.h"
+
+#ifdef ARCH_X86_64
+
+#define CPUID_PERFMON_LEAF          0x0A
+#define MSR_PERFEVTSEL0             0x186
+#define MSR_PMC0                    0xC1
+#define MSR_PERF_GLOBAL_CTRL        0x38F
+
+#define EVTSEL_USR                  (1UL << 16)
+#define EVTSEL_OS                   (1UL << 17)
+#define EVTSEL_EN                   (1UL << 22)
+
+struct pmu_event {
+    uint8_t event;
+    uint8_t umask;
+    int8_t cpuid_bit;                   // CPUID.0AH:EBX bit, set if absent; -1: none
+};
+
+static const struct pmu_event pmu_events[PERF_EVENT_COUNT] = {
+    [PERF_EVENT_CYCLES]         = {0x3C, 0x00, 0},  // UnHalted Core Cycles
+    [PERF_EVENT_INSTRUCTIONS]   = {0xC0, 0x00, 1},  // Instructions Retired
+    [PERF_EVENT_CACHE_REFS]     = {0x2E, 0x4F, 3},  // LLC Reference
+    [PERF_EVENT_CACHE_MISSES]   = {0x2E, 0x41, 4},  // LLC Misses
+    [PERF_EVENT_BRANCHES]       = {0xC4, 0x00, 5},  // Branch Instructions Retired
+    [PERF_EVENT_BRANCH_MISSES]  = {0xC5, 0x00, 6},  // Branch Misses Retired
+    [PERF_EVENT_DTLB_MISSES]    = {0, 0, -1},
+    [PERF_EVENT_ITLB_MISSES]    = {0, 0, -1},
+};
+
+static uint32_t pmu_version;
+static uint32_t pmu_counters;
+static uint32_t pmu_width;
+static uint32_t pmu_ebx_length;         // Events EBX describes
+static uint32_t pmu_unavailable;        // CPUID.0AH:EBX
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx)
+{
+    uint32_t ecx = 0, edx;
+    *eax = leaf;
+    __asm__ volatile("cpuid" : "+a"(*eax), "=b"(*ebx), "+c"(ecx), "=d"(edx));
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+uint32_t arch_pmu_cpu_init(void)
+{
+    uint32_t eax, ebx;
+    cpuid(0, &eax, &ebx);
+    if (eax < CPUID_PERFMON_LEAF) {
+        return 0;
+    }
+
+    cpuid(CPUID_PERFMON_LEAF, &eax, &ebx);
+    pmu_version = eax & 0xff;
+    if (pmu_version == 0) {
+        return 0;
+    }
+    pmu_counters = (eax >> 8) & 0xff;
+    pmu_width = (eax >> 16) & 0xff;
+    pmu_ebx_length = (eax >> 24) & 0xff;
+    pmu_unavailable = ebx;
+
+    arch_pmu_stop();
+    return pmu_counters;
+}
+
+int arch_pmu_event_supported(uint32_t event)
+{
+    if (event >= PERF_EVENT_COUNT || !pmu_version) {
+        return 0;
+    }
+    int bit = pmu_events[event].cpuid_bit;
+    return bit >= 0 && (uint32_t)bit < pmu_ebx_length && !(pmu_unavailable & (1U << bit));
+}
+
+void arch_pmu_program(uint32_t counter, uint32_t event)
+{
+    const struct pmu_event *ev = &pmu_events[event];
+
+    // Version 1 has no global gate, so the counter runs from here; later
+    // versions hold it until arch_pmu_start() opens the gate
+    wrmsr(MSR_PERFEVTSEL0 + counter,
+          ev->event | ((uint64_t)ev->umask << 8) | EVTSEL_USR | EVTSEL_OS | EVTSEL_EN);
+}
+
+uint64_t arch_pmu_read(uint32_t counter)
+{
+    return rdmsr(MSR_PMC0 + counter);
+}
+
+uint64_t arch_pmu_counter_mask(void)
+{
+    return pmu_width >= 64 ? ~0ULL : (1ULL << pmu_width) - 1;
+}
+
+void arch_pmu_start(uint32_t counters)
+{
+    if (pmu_version >= 2) {
+        wrmsr(MSR_PERF_GLOBAL_CTRL, counters);
+    }
+}
+
+void arch_pmu_stop(void)
+{
+    if (pmu_version >= 2) {
+        wrmsr(MSR_PERF_GLOBAL_CTRL, 0);
+    }
+    for (uint32_t i = 0; i < pmu_counters; i++) {
+        wrmsr(MSR_PERFEVTSEL0 + i, 0);
+    }
+}
+
+int arch_pmu_sample_start(uint64_t period)
+{
+    (void)period;
+    return -1;
+}
+
+void arch_pmu_sample_stop(void)
+{
+}
+
+#endif /* ARCH_X86_64 */
@@ -5,7 +5,10 @@
 section .text
 
 ; External functions
-extern syscall_dispatch
+extern x86_syscall_dispatch
+extern syscall_table
+extern syscall_leaf_mask
+extern syscall_counts
 
 ; Context switch between two tasks
 ; void context_switch(struct cpu_context *old_ctx, struct cpu_context *new_ctx)
@@ -26,7 +29,8 @@ context_switch:
     mov [rdi + 32], rsi      ; rsi
     mov [rdi + 40], rdi      ; rdi
     mov [rdi + 48], rbp      ; rbp
-    mov [rdi + 56], rsp      ; rsp
+    lea rax, [rsp + 8]       ; rsp as it will be after our ret
+    mov [rdi + 56], rax      ; rsp
     mov [rdi + 64], r8       ; r8
     mov [rdi + 72], r9       ; r9
     mov [rdi + 80], r10      ; r10
@@ -59,16 +63,11 @@ context_switch:
     mov ax, gs
     mov [rdi + 184], rax     ; gs
     
-    ; Save CR3 (page directory)
-    mov rax, cr3
-    mov [rdi + 192], rax     ; cr3
+    ; CR3 is not switched here: the scheduler has already loaded the next
+    ; task's address space, PCID-tagged, through aspace_switch()
 
 restore_context:
     ; Restore new context from new_ctx (RSI)
-    ; Restore CR3 first
-    mov rax, [rsi + 192]     ; cr3
-    mov cr3, rax
-    
     ; Restore segment registers
     mov rax, [rsi + 160]     ; ds
     mov ds, ax
@@ -76,13 +75,8 @@ restore_context:
     mov es, ax
     mov rax, [rsi + 176]     ; fs
     mov fs, ax
-    mov rax, [rsi + 184]     ; gs
-    mov gs, ax
-    
-    ; Restore RFLAGS
-    mov rax, [rsi + 136]     ; rflags
-    push rax
-    popfq
+    ; GS is left alone: loading a selector would clear the GS base, which
+    ; holds this CPU's struct cpu_info pointer
     
     ; Restore general purpose registers (except RSP and RIP)
     mov rax, [rsi + 0]       ; rax
@@ -102,12 +96,57 @@ restore_context:
     mov r14, [rsi + 112]     ; r14
     mov r15, [rsi + 120]     ; r15
     
-    ; Restore RSP and jump to new RIP
+    ; Restore RSP and jump to new RIP. RFLAGS goes last so an interrupt
+    ; it unmasks finds the new task's registers and stack in place.
     mov rsp, [rsi + 56]      ; rsp
     push qword [rsi + 128]   ; Push new RIP onto stack
+    push qword [rsi + 136]   ; rflags
     mov rsi, [rsi + 32]      ; Restore RSI last
+    popfq
     ret                      ; Jump to new RIP
 
+; Snapshot the caller's registers, as context_switch saves them
+; int arch_context_save(struct cpu_context *ctx)
+; Returns 0; restoring ctx with context_switch(NULL, ctx) returns 1 from it
+global arch_context_save
+arch_context_save:
+    mov qword [rdi + 0], 1   ; rax when resumed
+    mov [rdi + 8], rbx       ; rbx
+    mov [rdi + 16], rcx      ; rcx
+    mov [rdi + 24], rdx      ; rdx
+    mov [rdi + 32], rsi      ; rsi
+    mov [rdi + 40], rdi      ; rdi
+    mov [rdi + 48], rbp      ; rbp
+    lea rax, [rsp + 8]       ; rsp as it will be after our ret
+    mov [rdi + 56], rax      ; rsp
+    mov [rdi + 64], r8       ; r8
+    mov [rdi + 72], r9       ; r9
+    mov [rdi + 80], r10      ; r10
+    mov [rdi + 88], r11      ; r11
+    mov [rdi + 96], r12      ; r12
+    mov [rdi + 104], r13     ; r13
+    mov [rdi + 112], r14     ; r14
+    mov [rdi + 120], r15     ; r15
+    mov rax, [rsp]           ; Return address
+    mov [rdi + 128], rax     ; rip
+    pushfq
+    pop rax
+    mov [rdi + 136], rax     ; rflags
+    mov ax, cs
+    mov [rdi + 144], rax     ; cs
+    mov ax, ss
+    mov [rdi + 152], rax     ; ss
+    mov ax, ds
+    mov [rdi + 160], rax     ; ds
+    mov ax, es
+    mov [rdi + 168], rax     ; es
+    mov ax, fs
+    mov [rdi + 176], rax     ; fs
+    mov ax, gs
+    mov [rdi + 184], rax     ; gs
+    xor eax, eax
+    ret
+
 ; Setup initial context for a new task
 ; void arch_setup_task_context(struct cpu_context *ctx, task_entry_t entry, void *arg, void *stack_top)
 global arch_setup_task_context
@@ -132,8 +171,9 @@ arch_setup_task_context:
     sub rcx, 8               ; Leave space for return address
     mov [rdi + 56], rcx      ; rsp = aligned stack_top
     
-    ; Set up RFLAGS with interrupts enabled
-    mov rax, 0x0202          ; IF=1, reserved bit=1
+    ; Start with interrupts masked: the entry code unmasks them once it
+    ; has released the run queue lock held across the switch
+    mov rax, 0x0002          ; IF=0, reserved bit=1
     mov [rdi + 136], rax     ; rflags
     
     ; Set up segment registers (kernel segments)
@@ -152,14 +192,72 @@ arch_setup_task_context:
     
     ret
 
+MAX_SYSCALLS equ 64                 ; Must match syscall.h
+SYSCALL_COUNTS_SHIFT equ 9          ; Must match syscall.h
+CPU_INFO_ID equ 16                  ; Must match smp.h
+
 ; System call entry point (SYSCALL handler)
+; RAX = system call number, RDI, RSI, RDX, R10, R8, R9 = arguments 0-5.
+; SYSCALL leaves the caller's RIP in RCX and RFLAGS in R11; RAX returns
+; the result and every other register is preserved.
+;
+; A call marked in syscall_leaf_mask cannot block or switch tasks, so its
+; handler is called directly with only the registers the C ABI lets it
+; clobber saved. Everything else takes the full save and syscall_dispatch,
+; through x86_syscall_dispatch for the CPU time accounting.
 global syscall_entry_syscall
 syscall_entry_syscall:
+    cmp rax, MAX_SYSCALLS
+    jae .full
+    push rcx                 ; Caller's RIP
+    push r11                 ; Caller's RFLAGS
+    mov r11, [rel syscall_leaf_mask]
+    bt r11, rax
+    jnc .not_leaf
+    lea r11, [rel syscall_table]
+    mov r11, [r11 + rax * 8]
+    test r11, r11
+    jz .not_leaf
+
+    push rax                 ; System call number, for the count
+    push rdi
+    push rsi
+    push rdx
+    push r8
+    push r9
+    push r10
+    push rbp
+    mov rbp, rsp
+    and rsp, -16             ; The caller's stack may be unaligned
+
+    mov rcx, r10             ; arg 3 (R10 -> RCX for function call ABI)
+    call r11
+
+    mov rsp, rbp
+    pop rbp
+    pop r10
+    pop r9
+    pop r8
+    pop rdx
+    pop rsi
+    pop rdi
+    pop rcx                  ; System call number
+    mov r11, [gs:0]          ; This CPU's row of syscall_counts
+    mov r11d, [r11 + CPU_INFO_ID]
+    shl r11d, SYSCALL_COUNTS_SHIFT - 3
+    add rcx, r11
+    lea r11, [rel syscall_counts]
+    inc qword [r11 + rcx * 8]
+    pop r11
+    pop rcx
+    o64 sysret
+
+.not_leaf:
+    pop r11
+    pop rcx
+
+.full:
     ; Save caller's context
-    ; SYSCALL instruction saves RIP to RCX and RFLAGS to R11
-    ; We need to save other registers
-    
-    ; Save registers
     push rax                 ; System call number
     push rbx
     push rcx                 ; Caller's RIP
@@ -175,26 +273,27 @@ syscall_entry_syscall:
     push r13
     push r14
     push r15
-    
-    ; System call arguments in registers (x86-64 ABI):
-    ; RAX = system call number
-    ; RDI, RSI, RDX, R10, R8, R9 = arguments 0-5
-    ; Note: R10 is used instead of RCX because SYSCALL uses RCX
-    
-    mov rdi, rax             ; System call number -> arg 0
-    ; RSI already has arg 1
-    ; RDX already has arg 2
-    mov rcx, r10             ; arg 3 (R10 -> RCX for function call ABI)
-    ; R8 already has arg 4
-    ; R9 already has arg 5
-    
-    ; Call system call dispatcher
-    call syscall_dispatch
-    
-    ; Result is in RAX, save it
-    mov rbx, rax
-    
+    mov rbp, rsp
+    and rsp, -16
+
+    ; x86_syscall_dispatch(num, arg0..arg5): shift every argument one
+    ; register along, with arg 5 going on the stack
+    sub rsp, 8               ; Keep the call aligned
+    push r9                  ; arg 5
+    mov r9, r8               ; arg 4
+    mov r8, r10              ; arg 3
+    mov rcx, rdx             ; arg 2
+    mov rdx, rsi             ; arg 1
+    mov rsi, rdi             ; arg 0
+    mov edi, eax             ; System call number
+    cmp rax, MAX_SYSCALLS
+    jb .dispatch
+    mov edi, MAX_SYSCALLS    ; Don't let truncation alias a valid number
+.dispatch:
+    call x86_syscall_dispatch
+
     ; Restore caller's context
+    mov rsp, rbp
     pop r15
     pop r14
     pop r13
@@ -208,11 +307,9 @@ syscall_entry_syscall:
     pop rsi
     pop rdx
     pop rcx                  ; Caller's RIP
+    pop rbx
     add rsp, 8               ; Skip saved RAX (system call number)
-    
-    ; Move result to RAX
-    mov rax, rbx
-    
+
     ; Return to caller using SYSRET
     ; RCX has caller's RIP, R11 has caller's RFLAGS
-    o64 sysret
\ No newline at end of file
+    o64 sysret
@@ -0,0 +1,236 @@
+/*
+ * MiniOS x86-64 SMP Support
+ * Application processor bring-up through the local APIC
+ *
+ * The trampoline in smp_trampoline.asm is copied below 1MB and every AP is
+ * started with the INIT-SIPI-SIPI broadcast. APs claim cpu_info slots in
+ * arrival order; the boot CPU pre-allocates a stack for every slot and
+ * takes the unused ones back afterwards. The per-CPU pointer is the GS
+ * base, and cpu_info.self at offset 0 makes it readable as %gs:0. Once
+ * apic.c has put the APIC in x2APIC mode its MMIO window is gone, so the
+ * IPIs go through the command MSR instead and each AP switches its own.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "smp.h"
+#include "apic.h"
+
+#ifdef ARCH_X86_64
+
+#define SMP_TRAMPOLINE_ADDR     0x8000
+
+#define LAPIC_BASE              0xFEE00000ULL
+#define LAPIC_ID                0x020
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_ICR_PENDING       (1U << 12)
+#define LAPIC_ICR_INIT_ALL      0x000C4500    // INIT, assert, all excluding self
+#define LAPIC_ICR_SIPI_ALL      0x000C4600    // Startup, all excluding self
+
+#define MSR_GS_BASE             0xC0000101
+
+// Page table bits for the LAPIC mapping
+#define PTE_PRESENT             (1ULL << 0)
+#define PTE_WRITABLE            (1ULL << 1)
+#define PTE_WRITETHROUGH        (1ULL << 3)
+#define PTE_CACHE_DISABLE       (1ULL << 4)
+#define PTE_LARGE               (1ULL << 7)
+#define PTE_ADDR_MASK           0x000FFFFFFFFFF000ULL
+
+struct smp_trampoline_params {
+    uint64_t cr3;
+    uint64_t entry;
+    uint64_t cpus;
+    uint32_t next_cpu;
+    uint32_t reserved;
+    uint16_t gdt_limit;
+    uint64_t gdt_base;
+    uint8_t pad0[6];
+    uint16_t idt_limit;
+    uint64_t idt_base;
+    uint8_t pad1[6];
+} __attribute__((packed));
+
+extern char smp_trampoline_start[];
+extern char smp_trampoline_end[];
+extern char smp_trampoline_params[];
+
+// Page directory covering 3-4GB, used if the boot tables stop at 1GB
+static uint64_t lapic_pd[512] __attribute__((aligned(4096))) __attribute__((section(".data"))) = {0};
+static struct cpu_info *smp_cpu_ptrs[MAX_CPUS] __attribute__((section(".data"))) = {0};
+static volatile uint32_t *lapic __attribute__((section(".data"))) = NULL;
+
+static inline void outb(uint16_t port, uint8_t value)
+{
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+}
+
+// Roughly one microsecond per write to the POST port
+static void io_delay_us(uint32_t us)
+{
+    while (us--) {
+        outb(0x80, 0);
+    }
+}
+
+/**
+ * Map the 2MB page holding the local APIC, uncached. The boot page tables
+ * only identity-map the first 1GB.
+ */
+static int lapic_map(void)
+{
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+
+    uint64_t *pml4 = (uint64_t *)(cr3 & PTE_ADDR_MASK);
+    if (!(pml4[0] & PTE_PRESENT)) {
+        return -1;
+    }
+    uint64_t *pdpt = (uint64_t *)(pml4[0] & PTE_ADDR_MASK);
+
+    uint32_t pdpt_index = (uint32_t)((LAPIC_BASE >> 30) & 0x1FF);
+    if (!(pdpt[pdpt_index] & PTE_PRESENT)) {
+        pdpt[pdpt_index] = (uint64_t)lapic_pd | PTE_PRESENT | PTE_WRITABLE;
+    } else if (pdpt[pdpt_index] & PTE_LARGE) {
+        lapic = (volatile uint32_t *)LAPIC_BASE;  // Already covered by a 1GB page
+        return 0;
+    }
+    uint64_t *pd = (uint64_t *)(pdpt[pdpt_index] & PTE_ADDR_MASK);
+
+    uint32_t pd_index = (uint32_t)((LAPIC_BASE >> 21) & 0x1FF);
+    pd[pd_index] = (LAPIC_BASE & ~0x1FFFFFULL) | PTE_PRESENT | PTE_WRITABLE |
+                   PTE_LARGE | PTE_WRITETHROUGH | PTE_CACHE_DISABLE;
+    __asm__ volatile("invlpg (%0)" : : "r"(LAPIC_BASE) : "memory");
+
+    lapic = (volatile uint32_t *)LAPIC_BASE;
+    return 0;
+}
+
+static void lapic_send_ipi(uint32_t icr)
+{
+    if (apic_x2apic_enabled()) {
+        apic_send_ipi(0, icr);
+        return;
+    }
+    lapic_write(LAPIC_ICR_HIGH, 0);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    for (uint32_t spin = 0; spin < 100000 && (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING); spin++) {
+        io_delay_us(1);
+    }
+}
+
+void arch_smp_set_this_cpu(struct cpu_info *cpu)
+{
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+}
+
+uint32_t arch_smp_boot_cpu_hw_id(void)
+{
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return ebx >> 24;  // Initial APIC ID
+}
+
+void arch_smp_secondary_init(struct cpu_info *cpu)
+{
+    arch_smp_set_this_cpu(cpu);
+    cpu->hw_id = arch_smp_boot_cpu_hw_id();
+    apic_cpu_init();
+}
+
+int arch_smp_boot_secondaries(void)
+{
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    if (!(edx & (1U << 9))) {
+        return -1;  // No local APIC
+    }
+    if (!apic_x2apic_enabled()) {
+        if (lapic_map() < 0) {
+            early_print("SMP: cannot map local APIC\n");
+            return -1;
+        }
+        lapic_write(LAPIC_SVR, lapic_read(LAPIC_SVR) | LAPIC_SVR_ENABLE);
+    }
+
+    // A stack for every slot an AP may claim
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        void *stack = memory_alloc_pages(SMP_CPU_STACK_SIZE / PAGE_SIZE_4K);
+        if (!stack) {
+            break;
+        }
+        smp_cpus[i].stack_top = (uint64_t)stack + SMP_CPU_STACK_SIZE;
+        smp_cpu_ptrs[i] = &smp_cpus[i];
+    }
+
+    // Install the trampoline and its parameters
+    size_t size = (size_t)(smp_trampoline_end - smp_trampoline_start);
+    memcpy((void *)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, size);
+
+    struct smp_trampoline_params *params = (struct smp_trampoline_params *)
+        (SMP_TRAMPOLINE_ADDR + (smp_trampoline_params - smp_trampoline_start));
+    uint64_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    params->cr3 = cr3;
+    params->entry = (uint64_t)smp_secondary_main;
+    params->cpus = (uint64_t)smp_cpu_ptrs;
+    params->next_cpu = 1;
+    __asm__ volatile("sgdt %0" : "=m"(params->gdt_limit) : : "memory");
+    __asm__ volatile("sidt %0" : "=m"(params->idt_limit) : : "memory");
+
+    // INIT-SIPI-SIPI
+    lapic_send_ipi(LAPIC_ICR_INIT_ALL);
+    io_delay_us(10000);
+    for (int i = 0; i < 2; i++) {
+        lapic_send_ipi(LAPIC_ICR_SIPI_ALL | (SMP_TRAMPOLINE_ADDR >> 12));
+        io_delay_us(200);
+    }
+
+    // Give the APs time to arrive, then close the slot counter so a
+    // straggler parks instead of racing the stack cleanup below
+    io_delay_us(100000);
+    uint32_t claimed = __atomic_exchange_n(&params->next_cpu, MAX_CPUS, __ATOMIC_ACQ_REL);
+    if (claimed > MAX_CPUS) {
+        claimed = MAX_CPUS;
+    }
+
+    int started = 0;
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        struct cpu_info *cpu = &smp_cpus[i];
+        if (i < claimed && cpu->stack_top) {
+            for (uint32_t spin = 0; spin < 100000 && !__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE); spin++) {
+                io_delay_us(1);
+            }
+            if (cpu->online) {
+                started++;
+            }
+        } else if (cpu->stack_top) {
+            memory_free_pages((void *)(cpu->stack_top - SMP_CPU_STACK_SIZE),
+                              SMP_CPU_STACK_SIZE / PAGE_SIZE_4K);
+            cpu->stack_top = 0;
+        }
+    }
+
+    return started > 0 ? started : -1;
+}
+
+#endif /* ARCH_X86_64 */
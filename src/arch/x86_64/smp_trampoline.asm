@@ -0,0 +1,129 @@
+; MiniOS x86-64 Application Processor Trampoline
+; Copied to SMP_TRAMPOLINE_ADDR and entered in real mode by the startup IPI.
+; Goes through protected mode into long mode on the boot CPU's page tables,
+; loads the kernel GDT and IDT, claims the next free cpu_info and calls the
+; C entry point on that CPU's stack.
+
+%define SMP_TRAMPOLINE_ADDR 0x8000
+%define MAX_CPUS            8
+%define CPU_INFO_STACK_TOP  8
+
+; Address of a trampoline label once copied into low memory
+%define TRAMP(x) (SMP_TRAMPOLINE_ADDR + (x) - smp_trampoline_start)
+
+section .text
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    o32 lgdt [TRAMP(tramp_gdt.pointer)]
+
+    ; Enable protected mode
+    mov eax, cr0
+    or eax, 1 << 0
+    mov cr0, eax
+
+    jmp dword tramp_gdt.code32_segment:TRAMP(tramp_protected)
+
+bits 32
+tramp_protected:
+    mov ax, tramp_gdt.data_segment
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; Enable PAE
+    mov eax, cr4
+    or eax, 1 << 5
+    mov cr4, eax
+
+    ; Share the boot CPU's page tables
+    mov eax, [TRAMP(smp_trampoline_params.cr3)]
+    mov cr3, eax
+
+    ; Enable long mode
+    mov ecx, 0xC0000080
+    rdmsr
+    or eax, 1 << 8
+    wrmsr
+
+    ; Enable paging
+    mov eax, cr0
+    or eax, 1 << 31
+    mov cr0, eax
+
+    jmp tramp_gdt.code_segment:TRAMP(tramp_long)
+
+bits 64
+tramp_long:
+    ; Switch to the kernel's descriptor tables (same selector layout)
+    lgdt [abs TRAMP(smp_trampoline_params.gdtr)]
+    lidt [abs TRAMP(smp_trampoline_params.idtr)]
+
+    mov ax, tramp_gdt.data_segment
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov fs, ax
+    mov gs, ax
+
+    ; Claim a CPU slot
+    mov eax, 1
+    lock xadd [abs TRAMP(smp_trampoline_params.next_cpu)], eax
+    cmp eax, MAX_CPUS
+    jae .park
+
+    mov rbx, [abs TRAMP(smp_trampoline_params.cpus)]
+    mov rdi, [rbx + rax*8]
+    test rdi, rdi
+    jz .park
+    mov rsp, [rdi + CPU_INFO_STACK_TOP]
+    test rsp, rsp
+    jz .park
+    xor rbp, rbp
+
+    mov rax, [abs TRAMP(smp_trampoline_params.entry)]
+    call rax
+
+.park:
+    cli
+    hlt
+    jmp .park
+
+align 16
+tramp_gdt:
+    dq 0
+.code_segment: equ $ - tramp_gdt
+    dq 0x00AF9A000000FFFF       ; 64-bit code
+.data_segment: equ $ - tramp_gdt
+    dq 0x00CF92000000FFFF       ; Flat data
+.code32_segment: equ $ - tramp_gdt
+    dq 0x00CF9A000000FFFF       ; 32-bit code
+.pointer:
+    dw $ - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+; Filled in by arch_smp_boot_secondaries() after the copy; layout matches
+; struct smp_trampoline_params in smp.c
+align 8
+smp_trampoline_params:
+.cr3:       dq 0
+.entry:     dq 0
+.cpus:      dq 0
+.next_cpu:  dd 0
+            dd 0
+.gdtr:      dw 0
+            dq 0
+            times 6 db 0
+.idtr:      dw 0
+            dq 0
+            times 6 db 0
+smp_trampoline_end:
@@ -0,0 +1,37 @@
+/*
+ * x86-64 Tracepoint Patching
+ * Rewrites a trace_event() site between a 5-byte NOP and JMP rel32
+ *
+ * The site never straddles an aligned 8-byte word (see TRACE_SITE_NOP),
+ * so the five bytes change with one store and a CPU running through the
+ * site sees either the old instruction or the new one, never a mix.
+ */
+
+#include "kernel.h"
+#include "trace.h"
+
+#ifdef ARCH_X86_64
+
+#define X86_JMP_REL32       0xe9
+#define X86_SITE_SIZE       5
+
+static const uint8_t x86_nop5[X86_SITE_SIZE] = {0x0f, 0x1f, 0x44, 0x00, 0x00};
+
+void arch_trace_patch(uintptr_t code, uintptr_t target, int enable)
+{
+    uint8_t insn[X86_SITE_SIZE];
+    if (enable) {
+        int32_t rel = (int32_t)(target - (code + X86_SITE_SIZE));
+        insn[0] = X86_JMP_REL32;
+        memcpy(&insn[1], &rel, sizeof(rel));
+    } else {
+        memcpy(insn, x86_nop5, X86_SITE_SIZE);
+    }
+
+    volatile uint64_t *word = (volatile uint64_t *)(code & ~7UL);
+    uint64_t value = *word;
+    memcpy((uint8_t *)&value + (code & 7), insn, X86_SITE_SIZE);
+    __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+}
+
+#endif /* ARCH_X86_64 */
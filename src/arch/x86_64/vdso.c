@@ -0,0 +1,92 @@
+/*
+ * x86-64 vDSO Support
+ * TSC calibration and the CPU number for RDTSCP
+ *
+ * The TSC has no architectural rate register, so it is timed against the
+ * kernel clock for a short interval at boot. Each CPU's index goes in
+ * IA32_TSC_AUX, which RDTSCP returns alongside the count, so user code
+ * can find its PID slot where the CPU has RDTSCP.
+ */
+
+#include "kernel.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "vdso.h"
+
+#ifdef ARCH_X86_64
+
+#define CPUID_1_EDX_TSC             (1U << 4)
+#define CPUID_80000001_EDX_RDTSCP   (1U << 27)
+#define MSR_TSC_AUX                 0xC0000103
+#define TSC_CALIBRATION_US          10000
+#define TSC_CALIBRATION_MAX_SPINS   1000000
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *edx)
+{
+    uint32_t ebx, ecx = 0;
+    *eax = leaf;
+    __asm__ volatile("cpuid" : "+a"(*eax), "=b"(ebx), "+c"(ecx), "=d"(*edx));
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t arch_vdso_counter_frequency(void)
+{
+    uint32_t eax, edx;
+    cpuid(1, &eax, &edx);
+    if (!(edx & CPUID_1_EDX_TSC)) {
+        return 0;
+    }
+
+    // Already timed at boot when it is the kernel clock
+    uint64_t hz = x86_64_tsc_frequency();
+    if (hz) {
+        return hz;
+    }
+
+    // Without the reload interrupt the PIT clock stops between periods
+    uint64_t start_us = timer_get_time_us();
+    if (!start_us || !arch_interrupts_enabled()) {
+        return 0;
+    }
+
+    uint64_t start_tsc = rdtsc();
+    uint64_t now_us = start_us;
+    for (uint32_t spins = 0; now_us - start_us < TSC_CALIBRATION_US; spins++) {
+        if (spins == TSC_CALIBRATION_MAX_SPINS) {
+            return 0;  // Kernel clock stalled
+        }
+        now_us = timer_get_time_us();
+    }
+    uint64_t cycles = rdtsc() - start_tsc;
+
+    return cycles * 1000000 / (now_us - start_us);
+}
+
+uint64_t arch_vdso_read_counter(void)
+{
+    return rdtsc();
+}
+
+uint32_t arch_vdso_cpu_init(uint32_t cpu)
+{
+    uint32_t eax, edx;
+    cpuid(0x80000000, &eax, &edx);
+    if (eax < 0x80000001) {
+        return 0;
+    }
+    cpuid(0x80000001, &eax, &edx);
+    if (!(edx & CPUID_80000001_EDX_RDTSCP)) {
+        return 0;
+    }
+
+    __asm__ volatile("wrmsr" : : "c"(MSR_TSC_AUX), "a"(cpu), "d"(0));
+    return VDSO_HAS_CPU_PID;
+}
+
+#endif /* ARCH_X86_64 */
@@ -0,0 +1,187 @@
+/*
+ * MiniOS x86-64 Local APIC Driver (x2APIC mode)
+ *
+ * Where the CPU has x2APIC, each CPU's local APIC is switched into it and
+ * reached through MSRs: end-of-interrupt is one WRMSR instead of PIC port
+ * I/O, and no MMIO window has to be mapped. Device lines stay on the 8259
+ * through the APIC's virtual-wire LINT0 set up by the firmware; this
+ * controller owns the local lines after the PIC's, so far the timer,
+ * which the timer driver runs in TSC-deadline mode.
+ */
+
+#include "interrupt.h"
+#include "kernel.h"
+#include "apic.h"
+
+#ifdef ARCH_X86_64
+
+// Model-specific registers
+#define MSR_APIC_BASE           0x1B
+#define MSR_TSC_DEADLINE        0x6E0
+#define MSR_X2APIC_TPR          0x808
+#define MSR_X2APIC_EOI          0x80B
+#define MSR_X2APIC_SVR          0x80F
+#define MSR_X2APIC_ESR          0x828
+#define MSR_X2APIC_ICR          0x830
+#define MSR_X2APIC_LVT_TIMER    0x832
+
+#define APIC_BASE_ENABLE        (1ULL << 11)
+#define APIC_BASE_X2APIC        (1ULL << 10)
+
+#define APIC_SVR_ENABLE         (1U << 8)
+#define APIC_LVT_MASKED         (1U << 16)
+#define APIC_LVT_TSC_DEADLINE   (2U << 17)
+
+#define CPUID_1_ECX_X2APIC      (1U << 21)
+#define CPUID_1_ECX_TSC_DEADLINE (1U << 24)
+
+#define APIC_NUM_IRQS           1       // The timer
+
+static int apic_initialized = 0;
+static int apic_deadline = 0;           // LVT timer in TSC-deadline mode
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint32_t cpuid_1_ecx(void)
+{
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return ecx;
+}
+
+// Into x2APIC mode through xAPIC, as a disabled APIC can't go straight there
+static void apic_enable_x2apic(void)
+{
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    if (!(base & APIC_BASE_ENABLE)) {
+        base |= APIC_BASE_ENABLE;
+        wrmsr(MSR_APIC_BASE, base);
+    }
+    if (!(base & APIC_BASE_X2APIC)) {
+        wrmsr(MSR_APIC_BASE, base | APIC_BASE_X2APIC);
+    }
+
+    wrmsr(MSR_X2APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    wrmsr(MSR_X2APIC_TPR, 0);
+    wrmsr(MSR_X2APIC_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_VECTOR);
+    wrmsr(MSR_X2APIC_ESR, 0);
+}
+
+static void apic_enable_irq(uint32_t irq)
+{
+    if (irq == 0) {
+        uint64_t lvt = rdmsr(MSR_X2APIC_LVT_TIMER);
+        wrmsr(MSR_X2APIC_LVT_TIMER, lvt & ~(uint64_t)APIC_LVT_MASKED);
+    }
+}
+
+static void apic_disable_irq(uint32_t irq)
+{
+    if (irq == 0) {
+        uint64_t lvt = rdmsr(MSR_X2APIC_LVT_TIMER);
+        wrmsr(MSR_X2APIC_LVT_TIMER, lvt | APIC_LVT_MASKED);
+    }
+}
+
+static void apic_send_eoi(uint32_t irq)
+{
+    (void)irq;
+    wrmsr(MSR_X2APIC_EOI, 0);
+}
+
+static struct interrupt_controller apic_interrupt_controller = {
+    .name = "x86-x2APIC",
+    .num_irqs = APIC_NUM_IRQS,
+    .base_irq = APIC_TIMER_IRQ,
+    .enable_irq = apic_enable_irq,
+    .disable_irq = apic_disable_irq,
+    .send_eoi = apic_send_eoi,
+};
+
+int apic_init(void)
+{
+    if (apic_initialized) {
+        return 0;
+    }
+    if (!(cpuid_1_ecx() & CPUID_1_ECX_X2APIC)) {
+        early_print("APIC: No x2APIC, staying on the PIC alone\n");
+        return -1;
+    }
+
+    apic_enable_x2apic();
+    apic_initialized = 1;
+    early_print("APIC: Local APIC in x2APIC mode\n");
+    return 0;
+}
+
+int apic_controller_register(void)
+{
+    if (!apic_initialized) {
+        return -1;
+    }
+    return interrupt_controller_register(&apic_interrupt_controller);
+}
+
+int apic_cpu_init(void)
+{
+    if (!apic_initialized) {
+        return -1;
+    }
+    apic_enable_x2apic();
+    return 0;
+}
+
+int apic_x2apic_enabled(void)
+{
+    return apic_initialized;
+}
+
+void apic_send_ipi(uint32_t dest, uint32_t icr)
+{
+    wrmsr(MSR_X2APIC_ICR, ((uint64_t)dest << 32) | icr);
+}
+
+int apic_timer_deadline_init(void)
+{
+    if (!apic_initialized || !(cpuid_1_ecx() & CPUID_1_ECX_TSC_DEADLINE)) {
+        return -1;
+    }
+
+    // The mode must reach the APIC before the first deadline is written
+    wrmsr(MSR_X2APIC_LVT_TIMER, APIC_LVT_MASKED | APIC_LVT_TSC_DEADLINE | APIC_TIMER_VECTOR);
+    __asm__ volatile("mfence" : : : "memory");
+    apic_deadline = 1;
+    return 0;
+}
+
+void apic_timer_set_deadline(uint64_t tsc)
+{
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+void apic_show_status(void)
+{
+    if (!apic_initialized) {
+        early_print("x2APIC not in use\n");
+        return;
+    }
+
+    early_print("=== x86-64 x2APIC Status ===\n");
+    early_print("Timer: ");
+    uint64_t lvt = rdmsr(MSR_X2APIC_LVT_TIMER);
+    early_print(apic_deadline ? "TSC-deadline" : "Unused");
+    early_print(lvt & APIC_LVT_MASKED ? ", masked\n" : ", unmasked\n");
+}
+
+#endif // ARCH_X86_64
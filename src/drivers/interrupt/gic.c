@@ -1,11 +1,20 @@
 /*
  * MiniOS ARM64 GIC (Generic Interrupt Controller) Driver
  * Phase 4: Device Drivers & System Services
+ *
+ * GICv2 at the QEMU virt addresses, reached directly since the MMU is
+ * off. Every line starts disabled; shared lines are routed to CPU 0. The
+ * IRQ exception reads the acknowledge register and hands the line to
+ * handle_interrupt(), which signals end-of-interrupt through send_eoi.
+ *
+ * gic_init() prefers a GICv3 (gicv3.c) when the CPU and distributor have
+ * one, and the gic_* entry points below go to whichever was chosen.
  */
 
 #include "interrupt.h"
 #include "memory.h"
 #include "kernel.h"
+#include "smp.h"
 
 #ifdef ARCH_ARM64
 
@@ -54,50 +63,99 @@ struct gic_controller {
 static struct gic_controller gic_controller_instance;
 static int gic_initialized = 0;
 
+// GICv3 (gicv3.c), reached through the gic_* functions below
+extern int gicv3_probe(void);
+extern int gicv3_init(void);
+extern int gicv3_controller_register(void);
+extern int gicv3_cpu_init(void);
+extern uint32_t gicv3_acknowledge_irq(void);
+extern void gicv3_end_of_interrupt(uint32_t irq);
+extern void gicv3_show_status(void);
+
+int gic_cpu_init(void);
+static int gic_version = 2;
+static uint8_t gic_cpu_mask[MAX_CPUS];     // ITARGETSR bit of each CPU interface
+
 // Default GIC base addresses (typical QEMU values)
 #define GIC_DIST_BASE           0x08000000
 #define GIC_CPU_BASE            0x08010000
 
-// Helper functions for GIC register access (stubbed out for Phase 4)
+#define GIC_IAR_ID_MASK         0x3FF
+#define GIC_DEFAULT_PRIORITY    0xA0
+#define GIC_PRIORITY_MASK_ALL   0xF0    // Let every priority above through
+
+// Helper functions for GIC register access
 static inline uint32_t gic_dist_read(uint32_t offset) {
-    (void)offset; // Suppress unused parameter warning
-    early_print("GIC: WARNING - Skipping hardware access at 0x08000000\n");
-    return 0; // Return safe default values
+    return gic_controller_instance.distributor_base[offset / 4];
 }
 
 static inline void gic_dist_write(uint32_t offset, uint32_t value) {
-    (void)offset; // Suppress unused parameter warning
-    (void)value;  // Suppress unused parameter warning
-    early_print("GIC: WARNING - Skipping hardware write at 0x08000000\n");
-    // Skip hardware access for now
+    gic_controller_instance.distributor_base[offset / 4] = value;
 }
 
 static inline uint32_t gic_cpu_read(uint32_t offset) {
-    (void)offset; // Suppress unused parameter warning
-    early_print("GIC: WARNING - Skipping hardware access at 0x08010000\n");
-    return 0; // Return safe default values
+    return gic_controller_instance.cpu_interface_base[offset / 4];
 }
 
 static inline void gic_cpu_write(uint32_t offset, uint32_t value) {
-    (void)offset; // Suppress unused parameter warning
-    (void)value;  // Suppress unused parameter warning
-    early_print("GIC: WARNING - Skipping hardware write at 0x08010000\n");
-    // Skip hardware access for now
+    gic_controller_instance.cpu_interface_base[offset / 4] = value;
 }
 
 // GIC controller operations
 static int gic_controller_init(void)
 {
-    early_print("GIC: Initializing Generic Interrupt Controller (stub mode)...\n");
+    early_print("GIC: Initializing Generic Interrupt Controller...\n");
+
+    gic_controller_instance.distributor_base = (volatile uint32_t *)GIC_DIST_BASE;
+    gic_controller_instance.cpu_interface_base = (volatile uint32_t *)GIC_CPU_BASE;
+
+    gic_dist_write(GICD_CTLR, 0);
+
+    uint32_t typer = gic_dist_read(GICD_TYPER);
+    uint32_t num_irqs = ((typer & 0x1F) + 1) * 32;
+    if (num_irqs > GIC_MAX_IRQS) {
+        num_irqs = GIC_MAX_IRQS;
+    }
+    gic_controller_instance.num_irqs = num_irqs;
+    gic_controller_instance.num_cpus = ((typer >> 5) & 0x7) + 1;
+
+    // Disable and clear everything, one default priority for all lines
+    for (uint32_t irq = 0; irq < num_irqs; irq += 32) {
+        gic_dist_write(GICD_ICENABLER + (irq / 32) * 4, 0xFFFFFFFF);
+        gic_dist_write(GICD_ICPENDR + (irq / 32) * 4, 0xFFFFFFFF);
+    }
+    uint32_t prio = GIC_DEFAULT_PRIORITY * 0x01010101U;
+    for (uint32_t irq = 0; irq < num_irqs; irq += 4) {
+        gic_dist_write(GICD_IPRIORITYR + irq, prio);
+    }
+
+    // Shared lines go to CPU 0, level-triggered until set_type says otherwise
+    for (uint32_t irq = GIC_SPI_BASE; irq < num_irqs; irq += 4) {
+        gic_dist_write(GICD_ITARGETSR + irq, 0x01010101);
+    }
+    for (uint32_t irq = GIC_SPI_BASE; irq < num_irqs; irq += 16) {
+        gic_dist_write(GICD_ICFGR + (irq / 16) * 4, 0);
+    }
 
-    // Skip all hardware access for Phase 4 debugging
-    gic_controller_instance.num_irqs = 256;  // Default value
-    gic_controller_instance.num_cpus = 1;    // Single CPU
+    gic_dist_write(GICD_CTLR, 1);
 
-    early_print("GIC: Controller initialized successfully (no hardware access)\n");
+    gic_cpu_init();
+
+    early_print("GIC: Controller initialized\n");
     return 0;
 }
 
+// The calling CPU's banked interface, and which target bit it answers to
+static void gicv2_cpu_init(void)
+{
+    uint8_t mask = gic_dist_read(GICD_ITARGETSR) & 0xFF;
+    gic_cpu_mask[smp_cpu_id()] = mask ? mask : 1;
+
+    gic_cpu_write(GICC_PMR, GIC_PRIORITY_MASK_ALL);
+    gic_cpu_write(GICC_BPR, 0);
+    gic_cpu_write(GICC_CTLR, 1);
+}
+
 static void gic_enable_irq(uint32_t irq)
 {
     if (irq >= gic_controller_instance.num_irqs) {
@@ -181,6 +239,32 @@ static void gic_send_eoi(uint32_t irq)
     gic_cpu_write(GICC_EOIR, irq);
 }
 
+static int gic_set_affinity(uint32_t irq, uint32_t cpu)
+{
+    if (irq < GIC_SPI_BASE || irq >= gic_controller_instance.num_irqs || cpu >= MAX_CPUS ||
+        !gic_cpu_mask[cpu]) {
+        return -1;
+    }
+
+    // Byte-accessible: one target byte per line
+    volatile uint8_t *targets = (volatile uint8_t *)gic_controller_instance.distributor_base;
+    targets[GICD_ITARGETSR + irq] = gic_cpu_mask[cpu];
+    return 0;
+}
+
+// EXCEPTION_IRQ handler: acknowledge the highest pending line and dispatch it
+static void gic_irq_exception(uint32_t exception_num, struct exception_context *ctx)
+{
+    (void)exception_num;
+    (void)ctx;
+
+    uint32_t irq = gic_cpu_read(GICC_IAR) & GIC_IAR_ID_MASK;
+    if (irq >= GIC_MAX_IRQS) {
+        return;  // Spurious: nothing to acknowledge
+    }
+    handle_interrupt(irq);
+}
+
 // GIC interrupt controller interface
 static struct interrupt_controller gic_interrupt_controller = {
     .name = "ARM-GICv2",
@@ -194,6 +278,7 @@ static struct interrupt_controller gic_interrupt_controller = {
     .get_pending = gic_get_pending,
     .clear_pending = gic_clear_pending,
     .send_eoi = gic_send_eoi,
+    .set_affinity = gic_set_affinity,
 };
 
 int gic_init(void)
@@ -204,15 +289,29 @@ int gic_init(void)
     
     early_print("Initializing ARM64 GIC controller...\n");
     
-    // Skip hardware access for debugging - GIC addresses not mapped
-    early_print("GIC: Skipping hardware initialization (addresses not mapped)\n");
+    if (gicv3_probe()) {
+        if (gicv3_init() < 0) {
+            return -1;
+        }
+        gic_version = 3;
+        gic_initialized = 1;
+        early_print("ARM64 GICv3 controller initialized successfully\n");
+        return 0;
+    }
     
-    // Set up minimal state without accessing hardware
-    gic_controller_instance.num_irqs = 256;  // Default value
-    gic_controller_instance.num_cpus = 1;    // Single CPU
+    if (gic_controller_init() < 0) {
+        early_print("GIC: Failed to initialize controller\n");
+        return -1;
+    }
+    gic_interrupt_controller.num_irqs = gic_controller_instance.num_irqs;
+    
+    if (exception_register_handler(EXCEPTION_IRQ, gic_irq_exception) < 0) {
+        early_print("GIC: Failed to install IRQ exception handler\n");
+        return -1;
+    }
     
     gic_initialized = 1;
-    early_print("ARM64 GIC controller initialized successfully (stub mode)\n");
+    early_print("ARM64 GIC controller initialized successfully\n");
     
     return 0;
 }
@@ -223,17 +322,41 @@ int gic_controller_register(void)
         return -1;
     }
     
+    if (gic_version == 3) {
+        return gicv3_controller_register();
+    }
     return interrupt_controller_register(&gic_interrupt_controller);
 }
 
+/**
+ * Set up the calling CPU's side of the GIC: the CPU interface, and on a
+ * GICv3 its redistributor. gic_init() does it for the boot CPU; every
+ * secondary runs it on itself.
+ */
+int gic_cpu_init(void)
+{
+    if (gic_version == 3) {
+        return gicv3_cpu_init();
+    }
+    gicv2_cpu_init();
+    return 0;
+}
+
 // GIC-specific interrupt handling functions
 uint32_t gic_acknowledge_irq(void)
 {
-    return gic_cpu_read(GICC_IAR) & 0x3FF;
+    if (gic_version == 3) {
+        return gicv3_acknowledge_irq();
+    }
+    return gic_cpu_read(GICC_IAR) & GIC_IAR_ID_MASK;
 }
 
 void gic_end_of_interrupt(uint32_t irq)
 {
+    if (gic_version == 3) {
+        gicv3_end_of_interrupt(irq);
+        return;
+    }
     gic_cpu_write(GICC_EOIR, irq);
 }
 
@@ -243,6 +366,10 @@ void gic_show_status(void)
         early_print("GIC not initialized\n");
         return;
     }
+    if (gic_version == 3) {
+        gicv3_show_status();
+        return;
+    }
     
     early_print("=== ARM64 GIC Status ===\n");
     early_print("Distributor Control: ");
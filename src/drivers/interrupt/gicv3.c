@@ -0,0 +1,486 @@
+/*
+ * MiniOS ARM64 GICv3 Driver
+ *
+ * Used in place of the GICv2 driver when the CPU has the GICv3 system
+ * register interface and the distributor reports architecture version 3
+ * or 4. Acknowledge and end-of-interrupt go through ICC_IAR1_EL1 and
+ * ICC_EOIR1_EL1 instead of a memory-mapped CPU interface, and the
+ * distributor runs with affinity routing, so a shared line is routed to
+ * one CPU by its MPIDR through GICD_IROUTER<n>. SGIs and PPIs belong to
+ * each CPU's redistributor, which gicv3_cpu_init() finds and wakes.
+ *
+ * Everything is in non-secure group 1, the only group a kernel entered
+ * at EL1 can take.
+ */
+
+#include "interrupt.h"
+#include "kernel.h"
+#include "format.h"
+#include "smp.h"
+
+#ifdef ARCH_ARM64
+
+// QEMU virt: distributor, then one redistributor region for all CPUs
+#define GICV3_DIST_BASE         0x08000000
+#define GICV3_REDIST_BASE       0x080A0000
+#define GICV3_REDIST_REGION     0x00F60000
+
+// Distributor
+#define GICD_CTLR               0x0000
+#define GICD_TYPER              0x0004
+#define GICD_IGROUPR            0x0080
+#define GICD_ISENABLER          0x0100
+#define GICD_ICENABLER          0x0180
+#define GICD_ICPENDR            0x0280
+#define GICD_ICACTIVER          0x0380
+#define GICD_IPRIORITYR         0x0400
+#define GICD_ICFGR              0x0C00
+#define GICD_IROUTER            0x6000  // 64 bits per line, from line 32
+#define GICD_PIDR2              0xFFE8
+
+#define GICD_CTLR_ENABLE_G1NS   (1U << 1)
+#define GICD_CTLR_ARE_NS        (1U << 4)
+#define GICD_CTLR_RWP           (1U << 31)
+
+// Redistributor: a control frame, then the SGI/PPI frame
+#define GICR_CTLR               0x0000
+#define GICR_TYPER              0x0008
+#define GICR_WAKER              0x0014
+#define GICR_SGI_FRAME          0x10000
+#define GICR_FRAME_SIZE         0x20000
+#define GICR_VLPI_FRAME_SIZE    0x40000
+
+#define GICR_IGROUPR0           0x0080
+#define GICR_ISENABLER0         0x0100
+#define GICR_ICENABLER0         0x0180
+#define GICR_ICPENDR0           0x0280
+#define GICR_ICACTIVER0         0x0380
+#define GICR_IPRIORITYR         0x0400
+#define GICR_ICFGR1             0x0C04  // PPIs; SGIs are always edge
+
+#define GICR_CTLR_RWP           (1U << 3)
+#define GICR_TYPER_VLPIS        (1ULL << 1)
+#define GICR_TYPER_LAST         (1ULL << 4)
+#define GICR_WAKER_SLEEP        (1U << 1)
+#define GICR_WAKER_ASLEEP       (1U << 2)
+
+// CPU interface system registers, by encoding for older assemblers
+#define ICC_IAR1_EL1            "S3_0_C12_C12_0"
+#define ICC_EOIR1_EL1           "S3_0_C12_C12_1"
+#define ICC_BPR1_EL1            "S3_0_C12_C12_3"
+#define ICC_CTLR_EL1            "S3_0_C12_C12_4"
+#define ICC_SRE_EL1             "S3_0_C12_C12_5"
+#define ICC_IGRPEN1_EL1         "S3_0_C12_C12_7"
+#define ICC_PMR_EL1             "S3_0_C4_C6_0"
+
+#define ICC_SRE_SRE             (1ULL << 0)
+#define ICC_CTLR_EOIMODE        (1ULL << 1)
+
+#define GICV3_MAX_IRQS          1020
+#define GICV3_SPI_BASE          32
+#define GICV3_INTID_SPURIOUS    1020    // 1020-1023 are special
+#define GICV3_DEFAULT_PRIORITY  0xA0
+#define GICV3_PRIORITY_MASK_ALL 0xF0
+#define GICV3_POLL_LIMIT        1000000
+
+#define MPIDR_AFFINITY_MASK     0xFFFFFFULL
+
+#define gicv3_read_sysreg(reg, val) \
+    __asm__ volatile("mrs %0, " reg : "=r"(val))
+#define gicv3_write_sysreg(reg, val) \
+    __asm__ volatile("msr " reg ", %0" : : "r"((uint64_t)(val)) : "memory")
+
+struct gicv3_controller {
+    volatile uint8_t *dist_base;
+    volatile uint8_t *rdist[MAX_CPUS];      // Control frame of each CPU's redistributor
+    uint32_t num_irqs;
+    uint32_t route[GICV3_MAX_IRQS];         // Logical CPU each shared line goes to
+};
+
+static struct gicv3_controller gicv3;
+
+static inline uint32_t gicd_read(uint32_t offset) {
+    return *(volatile uint32_t *)(gicv3.dist_base + offset);
+}
+
+static inline void gicd_write(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t *)(gicv3.dist_base + offset) = value;
+}
+
+static inline void gicd_write64(uint32_t offset, uint64_t value) {
+    *(volatile uint64_t *)(gicv3.dist_base + offset) = value;
+}
+
+static inline uint32_t gicr_read(volatile uint8_t *rd, uint32_t offset) {
+    return *(volatile uint32_t *)(rd + offset);
+}
+
+static inline void gicr_write(volatile uint8_t *rd, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t *)(rd + offset) = value;
+}
+
+static uint64_t gicv3_mpidr(void)
+{
+    uint64_t mpidr;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & MPIDR_AFFINITY_MASK;
+}
+
+// IROUTER takes Aff2.Aff1.Aff0 in the same bit positions as MPIDR
+static uint64_t gicv3_cpu_affinity(uint32_t cpu)
+{
+    return cpu == 0 && !smp_active ? gicv3_mpidr() : smp_cpus[cpu].hw_id;
+}
+
+static void gicv3_dist_wait_rwp(void)
+{
+    for (int i = 0; i < GICV3_POLL_LIMIT && (gicd_read(GICD_CTLR) & GICD_CTLR_RWP); i++) {
+    }
+}
+
+static void gicv3_rdist_wait_rwp(volatile uint8_t *rd)
+{
+    for (int i = 0; i < GICV3_POLL_LIMIT && (gicr_read(rd, GICR_CTLR) & GICR_CTLR_RWP); i++) {
+    }
+}
+
+// Redistributor of the calling CPU, or of the boot CPU before SMP is up
+static volatile uint8_t *gicv3_this_rdist(void)
+{
+    return gicv3.rdist[smp_cpu_id()];
+}
+
+/**
+ * Whether this system has a GICv3: the CPU must implement the system
+ * register interface and let EL1 use it, and the distributor must say so
+ */
+int gicv3_probe(void)
+{
+    uint64_t pfr0, sre;
+    __asm__ volatile("mrs %0, id_aa64pfr0_el1" : "=r"(pfr0));
+    if (((pfr0 >> 24) & 0xF) == 0) {
+        return 0;
+    }
+
+    gicv3_read_sysreg(ICC_SRE_EL1, sre);
+    gicv3_write_sysreg(ICC_SRE_EL1, sre | ICC_SRE_SRE);
+    __asm__ volatile("isb");
+    gicv3_read_sysreg(ICC_SRE_EL1, sre);
+    if (!(sre & ICC_SRE_SRE)) {
+        return 0;
+    }
+
+    uint32_t arch = (*(volatile uint32_t *)(uintptr_t)(GICV3_DIST_BASE + GICD_PIDR2) >> 4) & 0xF;
+    return arch == 3 || arch == 4;
+}
+
+/**
+ * Find the calling CPU's redistributor, wake it, and set up its SGIs and
+ * PPIs and its CPU interface. Run by each CPU on itself.
+ */
+int gicv3_cpu_init(void)
+{
+    uint32_t cpu = smp_cpu_id();
+    uint64_t mpidr = gicv3_mpidr();
+    volatile uint8_t *rd = (volatile uint8_t *)(uintptr_t)GICV3_REDIST_BASE;
+    volatile uint8_t *end = rd + GICV3_REDIST_REGION;
+
+    gicv3.rdist[cpu] = NULL;
+    while (rd < end) {
+        uint64_t typer = *(volatile uint64_t *)(rd + GICR_TYPER);
+        if ((typer >> 32) == mpidr) {
+            gicv3.rdist[cpu] = rd;
+            break;
+        }
+        if (typer & GICR_TYPER_LAST) {
+            break;
+        }
+        rd += (typer & GICR_TYPER_VLPIS) ? GICR_VLPI_FRAME_SIZE : GICR_FRAME_SIZE;
+    }
+    if (!gicv3.rdist[cpu]) {
+        early_print("GICv3: No redistributor for this CPU\n");
+        return -1;
+    }
+
+    // Out of processor sleep, so the redistributor forwards interrupts
+    gicr_write(rd, GICR_WAKER, gicr_read(rd, GICR_WAKER) & ~GICR_WAKER_SLEEP);
+    for (int i = 0; i < GICV3_POLL_LIMIT && (gicr_read(rd, GICR_WAKER) & GICR_WAKER_ASLEEP); i++) {
+    }
+
+    // SGIs and PPIs: group 1, disabled, default priority, PPIs level
+    volatile uint8_t *sgi = rd + GICR_SGI_FRAME;
+    gicr_write(sgi, GICR_ICENABLER0, 0xFFFFFFFF);
+    gicv3_rdist_wait_rwp(rd);
+    gicr_write(sgi, GICR_ICPENDR0, 0xFFFFFFFF);
+    gicr_write(sgi, GICR_ICACTIVER0, 0xFFFFFFFF);
+    gicr_write(sgi, GICR_IGROUPR0, 0xFFFFFFFF);
+    for (uint32_t irq = 0; irq < GICV3_SPI_BASE; irq += 4) {
+        gicr_write(sgi, GICR_IPRIORITYR + irq, GICV3_DEFAULT_PRIORITY * 0x01010101U);
+    }
+    gicr_write(sgi, GICR_ICFGR1, 0);
+
+    // CPU interface: everything above the mask, EOI both drops priority
+    // and deactivates
+    uint64_t ctlr;
+    gicv3_read_sysreg(ICC_SRE_EL1, ctlr);
+    gicv3_write_sysreg(ICC_SRE_EL1, ctlr | ICC_SRE_SRE);
+    __asm__ volatile("isb");
+    gicv3_write_sysreg(ICC_PMR_EL1, GICV3_PRIORITY_MASK_ALL);
+    gicv3_write_sysreg(ICC_BPR1_EL1, 0);
+    gicv3_read_sysreg(ICC_CTLR_EL1, ctlr);
+    gicv3_write_sysreg(ICC_CTLR_EL1, ctlr & ~ICC_CTLR_EOIMODE);
+    gicv3_write_sysreg(ICC_IGRPEN1_EL1, 1);
+    __asm__ volatile("isb");
+
+    return 0;
+}
+
+static int gicv3_controller_init(void)
+{
+    early_print("GICv3: Initializing distributor...\n");
+
+    gicv3.dist_base = (volatile uint8_t *)(uintptr_t)GICV3_DIST_BASE;
+
+    gicd_write(GICD_CTLR, 0);
+    gicv3_dist_wait_rwp();
+
+    uint32_t num_irqs = ((gicd_read(GICD_TYPER) & 0x1F) + 1) * 32;
+    if (num_irqs > GICV3_MAX_IRQS) {
+        num_irqs = GICV3_MAX_IRQS;
+    }
+    gicv3.num_irqs = num_irqs;
+
+    // Shared lines: disabled, group 1, default priority, level-triggered
+    for (uint32_t irq = GICV3_SPI_BASE; irq < num_irqs; irq += 32) {
+        gicd_write(GICD_ICENABLER + (irq / 32) * 4, 0xFFFFFFFF);
+        gicd_write(GICD_ICPENDR + (irq / 32) * 4, 0xFFFFFFFF);
+        gicd_write(GICD_ICACTIVER + (irq / 32) * 4, 0xFFFFFFFF);
+        gicd_write(GICD_IGROUPR + (irq / 32) * 4, 0xFFFFFFFF);
+    }
+    gicv3_dist_wait_rwp();
+    for (uint32_t irq = GICV3_SPI_BASE; irq < num_irqs; irq += 4) {
+        gicd_write(GICD_IPRIORITYR + irq, GICV3_DEFAULT_PRIORITY * 0x01010101U);
+    }
+    for (uint32_t irq = GICV3_SPI_BASE; irq < num_irqs; irq += 16) {
+        gicd_write(GICD_ICFGR + (irq / 16) * 4, 0);
+    }
+
+    gicd_write(GICD_CTLR, GICD_CTLR_ARE_NS);
+    gicv3_dist_wait_rwp();
+    gicd_write(GICD_CTLR, GICD_CTLR_ARE_NS | GICD_CTLR_ENABLE_G1NS);
+    gicv3_dist_wait_rwp();
+
+    // Affinity routing is on, so routes can be written: all to the boot CPU
+    uint64_t boot = gicv3_cpu_affinity(0);
+    for (uint32_t irq = GICV3_SPI_BASE; irq < num_irqs; irq++) {
+        gicd_write64(GICD_IROUTER + irq * 8, boot);
+        gicv3.route[irq] = 0;
+    }
+
+    if (gicv3_cpu_init() < 0) {
+        return -1;
+    }
+
+    early_print("GICv3: Controller initialized\n");
+    return 0;
+}
+
+static void gicv3_enable_irq(uint32_t irq)
+{
+    if (irq >= gicv3.num_irqs) {
+        return;
+    }
+
+    if (irq < GICV3_SPI_BASE) {
+        volatile uint8_t *rd = gicv3_this_rdist();
+        if (rd) {
+            gicr_write(rd + GICR_SGI_FRAME, GICR_ISENABLER0, 1U << irq);
+        }
+        return;
+    }
+    gicd_write(GICD_ISENABLER + (irq / 32) * 4, 1U << (irq % 32));
+}
+
+static void gicv3_disable_irq(uint32_t irq)
+{
+    if (irq >= gicv3.num_irqs) {
+        return;
+    }
+
+    if (irq < GICV3_SPI_BASE) {
+        volatile uint8_t *rd = gicv3_this_rdist();
+        if (rd) {
+            gicr_write(rd + GICR_SGI_FRAME, GICR_ICENABLER0, 1U << irq);
+            gicv3_rdist_wait_rwp(rd);
+        }
+        return;
+    }
+    gicd_write(GICD_ICENABLER + (irq / 32) * 4, 1U << (irq % 32));
+    gicv3_dist_wait_rwp();
+}
+
+static void gicv3_set_priority(uint32_t irq, uint8_t priority)
+{
+    if (irq >= gicv3.num_irqs) {
+        return;
+    }
+
+    volatile uint8_t *base = gicv3.dist_base;
+    if (irq < GICV3_SPI_BASE) {
+        base = gicv3_this_rdist();
+        if (!base) {
+            return;
+        }
+        base += GICR_SGI_FRAME;
+    }
+    // Byte-accessible in both the distributor and the redistributor
+    *(volatile uint8_t *)(base + GICD_IPRIORITYR + irq) = priority;
+}
+
+static void gicv3_set_type(uint32_t irq, uint32_t type)
+{
+    if (irq >= gicv3.num_irqs || irq < GICV3_SPI_BASE) {
+        return;
+    }
+
+    uint32_t reg = GICD_ICFGR + (irq / 16) * 4;
+    uint32_t bit = 1U << (((irq % 16) * 2) + 1);
+    uint32_t current = gicd_read(reg);
+    if (type == IRQ_TYPE_EDGE || type == IRQ_TYPE_RISING_EDGE) {
+        current |= bit;
+    } else {
+        current &= ~bit;
+    }
+    gicd_write(reg, current);
+}
+
+static uint32_t gicv3_get_pending(void)
+{
+    uint64_t iar;
+    gicv3_read_sysreg(ICC_IAR1_EL1, iar);
+    return (uint32_t)iar & 0xFFFFFF;
+}
+
+static void gicv3_clear_pending(uint32_t irq)
+{
+    if (irq >= gicv3.num_irqs) {
+        return;
+    }
+
+    if (irq < GICV3_SPI_BASE) {
+        volatile uint8_t *rd = gicv3_this_rdist();
+        if (rd) {
+            gicr_write(rd + GICR_SGI_FRAME, GICR_ICPENDR0, 1U << irq);
+        }
+        return;
+    }
+    gicd_write(GICD_ICPENDR + (irq / 32) * 4, 1U << (irq % 32));
+}
+
+static void gicv3_send_eoi(uint32_t irq)
+{
+    gicv3_write_sysreg(ICC_EOIR1_EL1, irq);
+}
+
+static int gicv3_set_affinity(uint32_t irq, uint32_t cpu)
+{
+    // Only to CPUs whose redistributor is up
+    if (irq < GICV3_SPI_BASE || irq >= gicv3.num_irqs || cpu >= MAX_CPUS ||
+        !gicv3.rdist[cpu]) {
+        return -1;
+    }
+
+    gicd_write64(GICD_IROUTER + irq * 8, gicv3_cpu_affinity(cpu));
+    gicv3.route[irq] = cpu;
+    return 0;
+}
+
+static void gicv3_irq_exception(uint32_t exception_num, struct exception_context *ctx)
+{
+    (void)exception_num;
+    (void)ctx;
+
+    uint32_t irq = gicv3_get_pending();
+    if (irq >= GICV3_INTID_SPURIOUS) {
+        return;
+    }
+    handle_interrupt(irq);
+}
+
+static struct interrupt_controller gicv3_interrupt_controller = {
+    .name = "ARM-GICv3",
+    .num_irqs = 0,  // Will be set during init
+    .base_irq = 0,
+    .init = gicv3_controller_init,
+    .enable_irq = gicv3_enable_irq,
+    .disable_irq = gicv3_disable_irq,
+    .set_priority = gicv3_set_priority,
+    .set_type = gicv3_set_type,
+    .get_pending = gicv3_get_pending,
+    .clear_pending = gicv3_clear_pending,
+    .send_eoi = gicv3_send_eoi,
+    .set_affinity = gicv3_set_affinity,
+};
+
+int gicv3_init(void)
+{
+    if (gicv3_controller_init() < 0) {
+        early_print("GICv3: Failed to initialize controller\n");
+        return -1;
+    }
+    gicv3_interrupt_controller.num_irqs = gicv3.num_irqs;
+
+    if (exception_register_handler(EXCEPTION_IRQ, gicv3_irq_exception) < 0) {
+        early_print("GICv3: Failed to install IRQ exception handler\n");
+        return -1;
+    }
+    return 0;
+}
+
+int gicv3_controller_register(void)
+{
+    return interrupt_controller_register(&gicv3_interrupt_controller);
+}
+
+uint32_t gicv3_acknowledge_irq(void)
+{
+    return gicv3_get_pending();
+}
+
+void gicv3_end_of_interrupt(uint32_t irq)
+{
+    gicv3_send_eoi(irq);
+}
+
+void gicv3_show_status(void)
+{
+    early_print("=== ARM64 GICv3 Status ===\n");
+    uint32_t ctlr = gicd_read(GICD_CTLR);
+    early_print("Distributor: ");
+    early_print(ctlr & GICD_CTLR_ENABLE_G1NS ? "Enabled" : "Disabled");
+    early_print(ctlr & GICD_CTLR_ARE_NS ? ", affinity routing\n" : "\n");
+
+    uint64_t grpen;
+    gicv3_read_sysreg(ICC_IGRPEN1_EL1, grpen);
+    early_print("CPU Interface (system registers): ");
+    early_print(grpen & 1 ? "Enabled\n" : "Disabled\n");
+
+    char line[64];
+    snprintf(line, sizeof(line), "Supported IRQs: %u\n", gicv3.num_irqs);
+    early_print(line);
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (gicv3.rdist[cpu]) {
+            snprintf(line, sizeof(line), "CPU %u redistributor at 0x%lx\n", cpu,
+                     (unsigned long)(uintptr_t)gicv3.rdist[cpu]);
+            early_print(line);
+        }
+    }
+    for (uint32_t irq = GICV3_SPI_BASE; irq < gicv3.num_irqs; irq++) {
+        if (gicv3.route[irq]) {
+            snprintf(line, sizeof(line), "IRQ %u routed to CPU %u\n", irq, gicv3.route[irq]);
+            early_print(line);
+        }
+    }
+}
+
+#endif // ARCH_ARM64
@@ -6,6 +6,7 @@
 #include "interrupt.h"
 #include "memory.h"
 #include "kernel.h"
+#include "apic.h"
 
 #ifdef ARCH_X86_64
 
@@ -97,6 +98,18 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+// Local APIC lines (irq_entry.asm)
+extern void irq16(void);
+extern void apic_spurious_entry(void);
+
+// Device-not-available (#NM) entry for lazy FP switching (irq_entry.asm)
+extern void fpu_trap_entry(void);
+
+static void (*const irq_stubs[16])(void) = {
+    irq0, irq1, irq2, irq3, irq4, irq5, irq6, irq7,
+    irq8, irq9, irq10, irq11, irq12, irq13, irq14, irq15,
+};
+
 void set_idt_entry(uint8_t vector, uint64_t handler, uint16_t selector, uint8_t type_attr)
 {
     idt[vector].offset_low = handler & 0xFFFF;
@@ -145,12 +158,14 @@ int idt_init(void)
         // In real implementation, these would be proper interrupt stubs
         set_idt_entry(i, 0, 0x08, IDT_INTERRUPT_GATE);
     }
+    set_idt_entry(7, (uint64_t)fpu_trap_entry, 0x08, IDT_INTERRUPT_GATE);
     
-    // Hardware IRQs (32-47) - mapped from PIC IRQ 0-15
-    for (int i = 32; i < 48; i++) {
-        // Use a default handler address
-        set_idt_entry(i, 0, 0x08, IDT_INTERRUPT_GATE);
+    // Hardware IRQs (32-47) - mapped from PIC IRQ 0-15 (irq_entry.asm)
+    for (int i = 0; i < 16; i++) {
+        set_idt_entry(32 + i, (uint64_t)irq_stubs[i], 0x08, IDT_INTERRUPT_GATE);
     }
+    set_idt_entry(APIC_TIMER_VECTOR, (uint64_t)irq16, 0x08, IDT_INTERRUPT_GATE);
+    set_idt_entry(APIC_SPURIOUS_VECTOR, (uint64_t)apic_spurious_entry, 0x08, IDT_INTERRUPT_GATE);
     
     // Load the IDT
     load_idt();
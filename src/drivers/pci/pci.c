@@ -0,0 +1,110 @@
+/*
+ * MiniOS PCI Bus Support
+ * Configuration mechanism #1 (ports 0xCF8/0xCFC) and brute-force enumeration
+ */
+
+#include "pci.h"
+#include "kernel.h"
+
+#ifdef ARCH_X86_64
+
+#define PCI_CONFIG_ADDRESS      0xCF8
+#define PCI_CONFIG_DATA         0xCFC
+
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    return 0x80000000U | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) |
+           ((uint32_t)(func & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    uint32_t value = pci_config_read32(bus, slot, func, offset);
+    return (uint16_t)(value >> ((offset & 2) * 8));
+}
+
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value)
+{
+    uint32_t word = pci_config_read32(bus, slot, func, offset);
+    uint32_t shift = (offset & 2) * 8;
+    word = (word & ~(0xFFFFU << shift)) | ((uint32_t)value << shift);
+    pci_config_write32(bus, slot, func, offset, word);
+}
+
+static void pci_read_device(struct pci_device *dev, uint8_t bus, uint8_t slot, uint8_t func)
+{
+    uint32_t class_rev = pci_config_read32(bus, slot, func, PCI_CLASS_REVISION);
+
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor_id = pci_config_read16(bus, slot, func, PCI_VENDOR_ID);
+    dev->device_id = pci_config_read16(bus, slot, func, PCI_DEVICE_ID);
+    dev->subsystem_id = pci_config_read16(bus, slot, func, PCI_SUBSYSTEM_ID);
+    dev->class_code = (uint8_t)(class_rev >> 24);
+    dev->subclass = (uint8_t)(class_rev >> 16);
+    dev->irq_line = (uint8_t)pci_config_read32(bus, slot, func, PCI_INTERRUPT_LINE);
+    for (int i = 0; i < 6; i++) {
+        dev->bar[i] = pci_config_read32(bus, slot, func, (uint8_t)(PCI_BAR0 + i * 4));
+    }
+}
+
+int pci_scan(pci_scan_fn fn, void *context)
+{
+    int matched = 0;
+
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if (pci_config_read16((uint8_t)bus, slot, 0, PCI_VENDOR_ID) == PCI_VENDOR_NONE) {
+                continue;
+            }
+
+            // Only multi-function devices decode functions 1-7
+            uint8_t header = (uint8_t)pci_config_read16((uint8_t)bus, slot, 0, PCI_HEADER_TYPE);
+            uint8_t funcs = (header & 0x80) ? 8 : 1;
+
+            for (uint8_t func = 0; func < funcs; func++) {
+                if (pci_config_read16((uint8_t)bus, slot, func, PCI_VENDOR_ID) == PCI_VENDOR_NONE) {
+                    continue;
+                }
+                struct pci_device dev;
+                pci_read_device(&dev, (uint8_t)bus, slot, func);
+                if (fn(&dev, context) == 0) {
+                    matched++;
+                }
+            }
+        }
+    }
+
+    return matched;
+}
+
+void pci_enable_device(struct pci_device *dev, uint16_t command_bits)
+{
+    uint16_t command = pci_config_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    pci_config_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, command | command_bits);
+}
+
+#endif // ARCH_X86_64
@@ -50,12 +50,17 @@ static inline void write_cntp_tval_el0(uint32_t val) {
 #define ARM64_TIMER_CTL_IMASK       (1 << 1)   // Interrupt mask (0 = enabled)
 #define ARM64_TIMER_CTL_ISTATUS     (1 << 2)   // Interrupt status
 
+// EL1 physical timer PPI (non-secure), as wired on QEMU virt
+#define ARM64_TIMER_IRQ             30
+
 // ARM64 timer device private data
 struct arm64_timer_device {
     uint64_t frequency;         // Timer frequency from CNTFRQ_EL0
     uint64_t last_count;        // Last timer count for calculations
+    uint64_t interval_ticks;    // Counter ticks between interrupts
     uint32_t enabled;           // Timer enabled flag
     uint32_t interrupt_enabled; // Interrupt enabled flag
+    uint32_t irq_registered;    // Handler installed with request_irq()
 };
 
 // Global timer state
@@ -118,7 +123,7 @@ int arm64_timer_init(struct device *device)
     early_print("ARM64 timer: Initializing generic timer\n");
     
     // Allocate private data
-    struct arm64_timer_device *timer = memory_alloc(sizeof(struct arm64_timer_device), MEMORY_ALIGN_4K);
+    struct arm64_timer_device *timer = memory_alloc(sizeof(struct arm64_timer_device), 8);
     if (!timer) {
         early_print("ARM64 timer: Failed to allocate memory\n");
         return -1;
@@ -127,8 +132,10 @@ int arm64_timer_init(struct device *device)
     // Initialize timer device structure explicitly
     timer->frequency = read_cntfrq_el0();
     timer->last_count = read_cntpct_el0();
+    timer->interval_ticks = 0;
     timer->enabled = 0;
     timer->interrupt_enabled = 0;
+    timer->irq_registered = 0;
     
     // Set device private data
     device_set_private_data(device, timer);
@@ -220,8 +227,16 @@ int arch_timer_set_interval(uint64_t interval_us)
         return -1;
     }
     
-    // Convert microseconds to timer ticks
+    // Convert microseconds to timer ticks; the re-arm in
+    // arch_timer_ack_interrupt() goes through the 32-bit TVAL
     uint64_t ticks = (interval_us * timer_device->frequency) / 1000000;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    if (ticks > 0x7FFFFFFF) {
+        ticks = 0x7FFFFFFF;
+    }
+    timer_device->interval_ticks = ticks;
     
     // Set timer compare value
     uint64_t current_count = read_cntpct_el0();
@@ -230,12 +245,28 @@ int arch_timer_set_interval(uint64_t interval_us)
     return 0;
 }
 
+static void arm64_timer_irq(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    (void)context;
+    timer_interrupt_handler();
+}
+
 int arch_timer_enable_interrupt(void)
 {
     if (!timer_device || !timer_device->enabled) {
         return -1;
     }
     
+    if (!timer_device->irq_registered) {
+        if (request_irq(ARM64_TIMER_IRQ, arm64_timer_irq, timer_device, "timer") < 0) {
+            early_print("ARM64 timer: Failed to register timer IRQ\n");
+            return -1;
+        }
+        timer_device->irq_registered = 1;
+    }
+    enable_irq(ARM64_TIMER_IRQ);
+    
     // Enable timer with interrupts unmasked
     write_cntp_ctl_el0(ARM64_TIMER_CTL_ENABLE);
     timer_device->interrupt_enabled = 1;
@@ -258,8 +289,9 @@ void arch_timer_disable_interrupt(void)
 void arch_timer_ack_interrupt(void)
 {
     if (timer_device && timer_device->interrupt_enabled) {
-        // Timer interrupt is automatically cleared when CVAL is updated
-        // We just need to update system ticks
+        // The interrupt stays asserted until the compare value moves on,
+        // so arm the next period from now
+        write_cntp_tval_el0((uint32_t)timer_device->interval_ticks);
         system_ticks++;
     }
 }
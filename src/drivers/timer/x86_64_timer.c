@@ -1,6 +1,18 @@
 /*
  * MiniOS x86-64 Timer Driver (PIT - Programmable Interval Timer)
  * Phase 4: Device Drivers & System Services
+ *
+ * The clock counts PIT input cycles: every reload banks one period and a
+ * read adds the part of the current period from the latched counter, so
+ * time keeps its resolution when the interval is reprogrammed for
+ * tickless idle.
+ *
+ * Where the TSC is invariant it is timed against PIT channel 2 at boot
+ * and becomes the clock instead: a read is one RDTSC with no port I/O or
+ * lock, at the TSC's resolution. With that clock and an x2APIC that has
+ * TSC-deadline mode, events come from the APIC timer too: an interval is
+ * a deadline one period out, re-armed from the interrupt the way the
+ * PIT's rate generator reloads, and EOI is an MSR write.
  */
 
 #include "timer.h"
@@ -8,6 +20,10 @@
 #include "driver.h"
 #include "memory.h"
 #include "kernel.h"
+#include "spinlock.h"
+#include "interrupt.h"
+#include "apic.h"
+#include "format.h"
 
 #ifdef ARCH_X86_64
 
@@ -19,28 +35,56 @@
 
 // PIT command register bits
 #define PIT_CMD_CHANNEL0        0x00    // Select channel 0
+#define PIT_CMD_CHANNEL2        0x80    // Select channel 2
+#define PIT_CMD_LATCH           0x00    // Access mode: latch count
 #define PIT_CMD_ACCESS_LOHI     0x30    // Access mode: lo/hi byte
+#define PIT_CMD_MODE0           0x00    // Mode 0: interrupt on terminal count
 #define PIT_CMD_MODE2           0x04    // Mode 2: rate generator
 #define PIT_CMD_BINARY          0x00    // Binary mode
 
 // PIT constants
 #define PIT_FREQUENCY           1193182 // PIT base frequency in Hz
 #define PIT_DEFAULT_HZ          100     // Default 100 Hz (10ms intervals)
+#define PIT_MIN_COUNT           2       // Smallest count mode 2 accepts
 #define PIT_MAX_COUNT           65535   // Maximum 16-bit count value
+#define PIT_IRQ                 0       // Channel 0 on the master PIC
+
+// Channel 2 gate and output, in the system control port
+#define PIT_CONTROL_PORT        0x61
+#define PIT_CONTROL_GATE2       0x01
+#define PIT_CONTROL_SPEAKER     0x02
+#define PIT_CONTROL_OUT2        0x20
+
+// TSC calibration against channel 2
+#define TSC_CALIBRATION_MS      10
+#define TSC_CALIBRATION_RUNS    3
+#define TSC_CALIBRATION_MAX_SPINS 10000000
+#define CPUID_80000007_EDX_INVARIANT_TSC (1U << 8)
 
 // x86-64 timer device private data
 struct x86_64_timer_device {
     uint32_t frequency;         // Current timer frequency
     uint32_t divisor;           // Current PIT divisor
     uint64_t ticks;             // Timer tick counter
+    uint64_t cycles;            // PIT cycles banked up to the last reload
+    uint64_t last_count;        // Last clock value read, keeps reads monotonic
     uint32_t enabled;           // Timer enabled flag
     uint32_t interrupt_enabled; // Interrupt enabled flag
+    uint32_t irq_registered;    // Handler installed with request_irq()
+    uint32_t tsc_clock;         // Clock is the TSC rather than the PIT
+    uint32_t deadline;          // Events from the APIC TSC-deadline timer
+    uint32_t deadline_checked;  // The APIC was asked
+    uint64_t tsc_period;        // Deadline interval in TSC cycles
+    uint64_t tsc_next;          // Deadline armed
 };
 
 // Global timer state
 static struct x86_64_timer_device *timer_device = NULL;
 static uint64_t system_ticks = 0;
 static uint64_t boot_time_us = 0;
+static spinlock_t pit_lock = SPINLOCK_INIT;    // Latch sequence and clock state
+static uint64_t tsc_hz = 0;                     // Calibrated TSC rate
+static uint64_t tsc_base = 0;                   // TSC at clock zero
 
 // I/O port access functions
 static inline void outb(uint16_t port, uint8_t value) {
@@ -53,6 +97,81 @@ static inline uint8_t inb(uint16_t port) {
     return value;
 }
 
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint32_t cpuid_edx(uint32_t leaf)
+{
+    uint32_t eax = leaf, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return edx;
+}
+
+// Constant rate whatever the P- and C-state, so usable as a clock
+static int tsc_invariant(void)
+{
+    uint32_t eax = 0x80000000, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    if (eax < 0x80000007) {
+        return 0;
+    }
+    return (cpuid_edx(0x80000007) & CPUID_80000007_EDX_INVARIANT_TSC) != 0;
+}
+
+/**
+ * TSC rate, from the cycles taken by channel 2 counting down
+ * TSC_CALIBRATION_MS in mode 0. A run can only be stretched (by an SMI or
+ * the host), so the shortest is kept. 0 if the channel never finishes.
+ */
+static uint64_t tsc_calibrate(void)
+{
+    uint32_t latch = PIT_FREQUENCY * TSC_CALIBRATION_MS / 1000;
+    uint64_t best = UINT64_MAX;
+    
+    for (int run = 0; run < TSC_CALIBRATION_RUNS; run++) {
+        // Gate on, speaker off; writing the count starts the run
+        uint8_t control = inb(PIT_CONTROL_PORT);
+        outb(PIT_CONTROL_PORT, (control & ~PIT_CONTROL_SPEAKER) | PIT_CONTROL_GATE2);
+        outb(PIT_COMMAND, PIT_CMD_CHANNEL2 | PIT_CMD_ACCESS_LOHI | PIT_CMD_MODE0 | PIT_CMD_BINARY);
+        outb(PIT_CHANNEL2_DATA, latch & 0xFF);
+        outb(PIT_CHANNEL2_DATA, (latch >> 8) & 0xFF);
+        
+        uint64_t start = rdtsc();
+        for (uint32_t spins = 0; !(inb(PIT_CONTROL_PORT) & PIT_CONTROL_OUT2); spins++) {
+            if (spins == TSC_CALIBRATION_MAX_SPINS) {
+                return 0;
+            }
+        }
+        uint64_t cycles = rdtsc() - start;
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    
+    return best * PIT_FREQUENCY / latch;
+}
+
+static void pit_program(uint32_t divisor)
+{
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_ACCESS_LOHI | PIT_CMD_MODE2 | PIT_CMD_BINARY);
+    outb(PIT_CHANNEL0_DATA, divisor & 0xFF);         // Low byte
+    outb(PIT_CHANNEL0_DATA, (divisor >> 8) & 0xFF); // High byte
+}
+
+// Cycles run in the current period (pit_lock held)
+static uint32_t pit_elapsed(struct x86_64_timer_device *timer)
+{
+    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_LATCH);
+    uint32_t count = inb(PIT_CHANNEL0_DATA);
+    count |= (uint32_t)inb(PIT_CHANNEL0_DATA) << 8;
+    
+    return count < timer->divisor ? timer->divisor - count : 0;
+}
+
 // x86-64 PIT timer driver operations
 int x86_64_timer_probe(struct device *device)
 {
@@ -82,7 +201,7 @@ int x86_64_timer_init(struct device *device)
     early_print("x86-64 timer: Initializing PIT\n");
     
     // Allocate private data
-    struct x86_64_timer_device *timer = memory_alloc(sizeof(struct x86_64_timer_device), MEMORY_ALIGN_4K);
+    struct x86_64_timer_device *timer = memory_alloc(sizeof(struct x86_64_timer_device), 8);
     if (!timer) {
         early_print("x86-64 timer: Failed to allocate memory\n");
         return -1;
@@ -92,19 +211,23 @@ int x86_64_timer_init(struct device *device)
     timer->frequency = PIT_DEFAULT_HZ;
     timer->divisor = PIT_FREQUENCY / PIT_DEFAULT_HZ;
     timer->ticks = 0;
+    timer->cycles = 0;
+    timer->last_count = 0;
     timer->enabled = 0;
     timer->interrupt_enabled = 0;
+    timer->irq_registered = 0;
+    timer->tsc_clock = 0;
+    timer->deadline = 0;
+    timer->deadline_checked = 0;
+    timer->tsc_period = 0;
+    timer->tsc_next = 0;
     
     // Set device private data
     device_set_private_data(device, timer);
     timer_device = timer;
     
-    // Configure PIT for mode 2 (rate generator)
-    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_ACCESS_LOHI | PIT_CMD_MODE2 | PIT_CMD_BINARY);
-    
-    // Set initial divisor
-    outb(PIT_CHANNEL0_DATA, timer->divisor & 0xFF);         // Low byte
-    outb(PIT_CHANNEL0_DATA, (timer->divisor >> 8) & 0xFF); // High byte
+    // Configure PIT for mode 2 (rate generator) with the initial divisor
+    pit_program(timer->divisor);
     
     early_print("x86-64 timer: PIT initialized with frequency ");
     // Convert frequency to string for display
@@ -128,9 +251,42 @@ int x86_64_timer_init(struct device *device)
     early_print(freq_str);
     early_print(" Hz\n");
     
+    if (tsc_invariant()) {
+        tsc_hz = tsc_calibrate();
+        if (tsc_hz) {
+            tsc_base = rdtsc();
+            timer->tsc_clock = 1;
+            snprintf(freq_str, sizeof(freq_str), "%u", (unsigned)(tsc_hz / 1000000));
+            early_print("x86-64 timer: Clock from the invariant TSC at ");
+            early_print(freq_str);
+            early_print(" MHz\n");
+        }
+    }
+    
     return 0;
 }
 
+/**
+ * Whether events come from the APIC's TSC-deadline timer. Settled on
+ * first use, by which time interrupt_init() has set up the APIC.
+ */
+static int tsc_deadline_ready(struct x86_64_timer_device *timer)
+{
+    if (!timer->deadline_checked) {
+        timer->deadline_checked = 1;
+        timer->deadline = timer->tsc_clock && apic_timer_deadline_init() == 0;
+        if (timer->deadline) {
+            early_print("x86-64 timer: Events from the APIC TSC-deadline timer\n");
+        }
+    }
+    return timer->deadline;
+}
+
+static inline uint32_t timer_irq(struct x86_64_timer_device *timer)
+{
+    return timer->deadline ? APIC_TIMER_IRQ : PIT_IRQ;
+}
+
 int x86_64_timer_start(struct device *device)
 {
     struct x86_64_timer_device *timer = device_get_private_data(device);
@@ -193,12 +349,38 @@ int arch_timer_init(void)
 
 uint64_t arch_timer_get_count(void)
 {
-    return timer_device ? timer_device->ticks : 0;
+    if (!timer_device) {
+        return 0;
+    }
+    if (timer_device->tsc_clock) {
+        return rdtsc() - tsc_base;
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&pit_lock);
+    uint64_t count = timer_device->cycles + pit_elapsed(timer_device);
+    
+    // A reload whose interrupt has not been taken yet would read as
+    // going backwards
+    if (count < timer_device->last_count) {
+        count = timer_device->last_count;
+    }
+    timer_device->last_count = count;
+    spin_unlock_irqrestore(&pit_lock, flags);
+    
+    return count;
 }
 
 uint64_t arch_timer_get_frequency(void)
 {
-    return timer_device ? timer_device->frequency : 0;
+    if (!timer_device) {
+        return 0;
+    }
+    return timer_device->tsc_clock ? tsc_hz : PIT_FREQUENCY;
+}
+
+uint64_t x86_64_tsc_frequency(void)
+{
+    return timer_device && timer_device->tsc_clock ? tsc_hz : 0;
 }
 
 int arch_timer_set_interval(uint64_t interval_us)
@@ -207,44 +389,76 @@ int arch_timer_set_interval(uint64_t interval_us)
         return -1;
     }
     
-    // Convert microseconds to frequency
-    uint32_t freq_hz = 1000000 / interval_us;
-    
-    // Clamp frequency to valid range
-    if (freq_hz > PIT_FREQUENCY) {
-        freq_hz = PIT_FREQUENCY;
-    }
-    if (freq_hz < 1) {
-        freq_hz = 1;
+    if (tsc_deadline_ready(timer_device)) {
+        uint64_t period = interval_us * tsc_hz / 1000000;
+        unsigned long flags = spin_lock_irqsave(&pit_lock);
+        timer_device->frequency = interval_us ? (uint32_t)(1000000 / interval_us) : 0;
+        timer_device->tsc_period = period ? period : 1;
+        timer_device->tsc_next = rdtsc() + timer_device->tsc_period;
+        apic_timer_set_deadline(timer_device->tsc_next);
+        spin_unlock_irqrestore(&pit_lock, flags);
+        return 0;
     }
     
-    // Calculate divisor
-    uint32_t divisor = PIT_FREQUENCY / freq_hz;
+    // Convert microseconds to a divisor, clamped to what the counter
+    // holds (about 55ms at most)
+    uint64_t divisor = (interval_us * PIT_FREQUENCY) / 1000000;
+    if (divisor < PIT_MIN_COUNT) {
+        divisor = PIT_MIN_COUNT;
+    }
     if (divisor > PIT_MAX_COUNT) {
         divisor = PIT_MAX_COUNT;
-        freq_hz = PIT_FREQUENCY / PIT_MAX_COUNT;
     }
     
+    unsigned long flags = spin_lock_irqsave(&pit_lock);
+    
+    // Bank the part of the old period already run; the new one starts now
+    timer_device->cycles += pit_elapsed(timer_device);
+    
     // Update timer settings
-    timer_device->frequency = freq_hz;
-    timer_device->divisor = divisor;
+    timer_device->frequency = PIT_FREQUENCY / (uint32_t)divisor;
+    timer_device->divisor = (uint32_t)divisor;
     
     // Program PIT with new divisor
-    outb(PIT_COMMAND, PIT_CMD_CHANNEL0 | PIT_CMD_ACCESS_LOHI | PIT_CMD_MODE2 | PIT_CMD_BINARY);
-    outb(PIT_CHANNEL0_DATA, divisor & 0xFF);         // Low byte
-    outb(PIT_CHANNEL0_DATA, (divisor >> 8) & 0xFF); // High byte
+    pit_program((uint32_t)divisor);
     
+    spin_unlock_irqrestore(&pit_lock, flags);
     return 0;
 }
 
+static void x86_64_timer_irq(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    (void)context;
+    timer_interrupt_handler();
+}
+
 int arch_timer_enable_interrupt(void)
 {
     if (!timer_device || !timer_device->enabled) {
         return -1;
     }
     
+    tsc_deadline_ready(timer_device);
+    uint32_t irq = timer_irq(timer_device);
+    if (!timer_device->irq_registered) {
+        if (request_irq(irq, x86_64_timer_irq, timer_device, "timer") < 0) {
+            early_print("x86-64 timer: Failed to register timer IRQ\n");
+            return -1;
+        }
+        timer_device->irq_registered = 1;
+    }
+    enable_irq(irq);
     timer_device->interrupt_enabled = 1;
     
+    // A deadline that passed while the line was masked raised nothing
+    if (timer_device->deadline && timer_device->tsc_period) {
+        unsigned long flags = spin_lock_irqsave(&pit_lock);
+        timer_device->tsc_next = rdtsc() + timer_device->tsc_period;
+        apic_timer_set_deadline(timer_device->tsc_next);
+        spin_unlock_irqrestore(&pit_lock, flags);
+    }
+    
     early_print("x86-64 timer: Timer interrupts enabled\n");
     return 0;
 }
@@ -252,6 +466,7 @@ int arch_timer_enable_interrupt(void)
 void arch_timer_disable_interrupt(void)
 {
     if (timer_device) {
+        disable_irq(timer_irq(timer_device));
         timer_device->interrupt_enabled = 0;
         early_print("x86-64 timer: Timer interrupts disabled\n");
     }
@@ -260,8 +475,21 @@ void arch_timer_disable_interrupt(void)
 void arch_timer_ack_interrupt(void)
 {
     if (timer_device && timer_device->interrupt_enabled) {
+        spin_lock(&pit_lock);
+        if (timer_device->deadline) {
+            // One period on from the last deadline, as the PIT reloads
+            uint64_t now = rdtsc();
+            timer_device->tsc_next += timer_device->tsc_period;
+            if (timer_device->tsc_next <= now) {
+                timer_device->tsc_next = now + timer_device->tsc_period;
+            }
+            apic_timer_set_deadline(timer_device->tsc_next);
+        } else {
+            timer_device->cycles += timer_device->divisor;
+        }
         timer_device->ticks++;
         system_ticks++;
+        spin_unlock(&pit_lock);
     }
 }
 
@@ -1,6 +1,15 @@
 /*
  * MiniOS x86-64 16550 UART Driver
  * Phase 4: Device Drivers & System Services
+ *
+ * Output goes through a TX ring. A writer queues its bytes and, if the
+ * transmit FIFO is empty, refills it with up to 16 bytes after a single
+ * LSR check; the THRE interrupt refills it from then on, so a writer only
+ * waits on the hardware when the ring is full. Until transmit interrupts
+ * are enabled, writers drain the ring themselves. Received bytes are
+ * moved into an RX ring by the interrupt handler, or by a reader that
+ * finds the ring empty. The handler wakes the RX wait queue when it
+ * queued any, for readers waiting on input.
  */
 
 #include "uart.h"
@@ -8,6 +17,9 @@
 #include "driver.h"
 #include "memory.h"
 #include "kernel.h"
+#include "interrupt.h"
+#include "spinlock.h"
+#include "process.h"
 
 #ifdef ARCH_X86_64
 
@@ -25,6 +37,23 @@
 #define UART_MSR            6   // Modem status register
 #define UART_SCR            7   // Scratch register
 
+// Interrupt enable register bits
+#define UART_IER_RDI        (1 << 0)    // Received data available
+#define UART_IER_THRI       (1 << 1)    // Transmit holding register empty
+#define UART_IER_RLSI       (1 << 2)    // Receiver line status
+
+// Interrupt identification register values
+#define UART_IIR_NO_INT     0x01        // No interrupt pending
+#define UART_IIR_ID_MASK    0x0E
+#define UART_IIR_MSI        0x00        // Modem status
+#define UART_IIR_THRI       0x02        // Transmit holding register empty
+#define UART_IIR_RDI        0x04        // Received data available
+#define UART_IIR_RLSI       0x06        // Receiver line status
+#define UART_IIR_TIMEOUT    0x0C        // Character timeout
+
+#define UART_16550_FIFO_SIZE    16
+#define UART_16550_IRQ_LOOPS    8       // IIR rounds per interrupt
+
 // Line status register bits
 #define UART_LSR_DR         (1 << 0)    // Data ready
 #define UART_LSR_OE         (1 << 1)    // Overrun error
@@ -61,12 +90,20 @@ struct uart_16550_device {
     struct uart_stats stats;        // Statistics
     int tx_interrupts_enabled;      // Transmit interrupts enabled
     int rx_interrupts_enabled;      // Receive interrupts enabled
+    int irq_registered;             // Handler installed on device->irq_num
+    uint8_t ier;                    // Last value written to IER
+    spinlock_t lock;                // Rings, IER and statistics
+    struct uart_ring tx;
+    struct uart_ring rx;
+    struct wait_queue rx_wait;      // Woken when input reaches the RX ring
 };
 
 // Default 16550 configuration
 #define UART_16550_DEFAULT_BAUD     115200
 #define UART_16550_CLOCK            115200 * 16    // 1.8432 MHz
 
+int uart_16550_disable_interrupts(struct device *device);
+
 // I/O port access functions
 static inline void outb(uint16_t port, uint8_t value) {
     __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
@@ -134,7 +171,7 @@ int uart_16550_init(struct device *device)
     early_print("\n");
     
     // Allocate private data
-    struct uart_16550_device *uart = memory_alloc(sizeof(struct uart_16550_device), MEMORY_ALIGN_4K);
+    struct uart_16550_device *uart = memory_alloc(sizeof(struct uart_16550_device), 8);
     if (!uart) {
         early_print("16550 UART: Failed to allocate memory\n");
         return -1;
@@ -146,6 +183,12 @@ int uart_16550_init(struct device *device)
     uart->flags = UART_FLAG_8BIT | UART_FLAG_1_STOP | UART_FLAG_NO_PARITY;
     uart->tx_interrupts_enabled = 0;
     uart->rx_interrupts_enabled = 0;
+    uart->irq_registered = 0;
+    uart->ier = 0;
+    spin_lock_init(&uart->lock);
+    wait_queue_init(&uart->rx_wait);
+    uart->tx.head = uart->tx.tail = 0;
+    uart->rx.head = uart->rx.tail = 0;
     
     // Clear statistics
     uart->stats.bytes_transmitted = 0;
@@ -237,8 +280,8 @@ int uart_16550_stop(struct device *device)
     
     early_print("16550 UART: Stopping device\n");
     
-    // Disable interrupts
-    uart_write_reg(uart, UART_IER, 0x00);
+    // Disable interrupts, sending what is still queued
+    uart_16550_disable_interrupts(device);
     
     device_clear_flags(device, DEVICE_FLAG_ACTIVE);
     
@@ -250,7 +293,11 @@ void uart_16550_cleanup(struct device *device)
     struct uart_16550_device *uart = device_get_private_data(device);
     if (uart) {
         // Disable interrupts
-        uart_write_reg(uart, UART_IER, 0x00);
+        uart_16550_disable_interrupts(device);
+        if (uart->irq_registered) {
+            disable_irq(device->irq_num);
+            free_irq(device->irq_num);
+        }
         
         // Free memory
         memory_free(uart);
@@ -259,6 +306,107 @@ void uart_16550_cleanup(struct device *device)
     }
 }
 
+// Refill an empty transmit FIFO from the TX ring (lock held)
+static void uart_16550_tx_fill(struct uart_16550_device *uart)
+{
+    if (uart_ring_empty(&uart->tx) || !(uart_read_reg(uart, UART_LSR) & UART_LSR_THRE)) {
+        return;
+    }
+    
+    for (int i = 0; i < UART_16550_FIFO_SIZE && !uart_ring_empty(&uart->tx); i++) {
+        uart_write_reg(uart, UART_THR, uart_ring_get(&uart->tx));
+        uart->stats.bytes_transmitted++;
+    }
+}
+
+// Send the whole TX ring, waiting on the hardware (lock held)
+static void uart_16550_tx_drain(struct uart_16550_device *uart)
+{
+    while (!uart_ring_empty(&uart->tx)) {
+        uart_16550_tx_fill(uart);
+    }
+}
+
+// Move received bytes into the RX ring and return how many (lock held)
+static uint32_t uart_16550_rx_fill(struct uart_16550_device *uart)
+{
+    uint32_t queued = 0;
+    uint8_t lsr;
+    while ((lsr = uart_read_reg(uart, UART_LSR)) & UART_LSR_DR) {
+        uint8_t c = uart_read_reg(uart, UART_RBR);
+        
+        // Check for errors
+        if (lsr & (UART_LSR_OE | UART_LSR_PE | UART_LSR_FE | UART_LSR_BI)) {
+            if (lsr & UART_LSR_OE) uart->stats.overrun_errors++;
+            if (lsr & UART_LSR_PE) uart->stats.parity_errors++;
+            if (lsr & UART_LSR_FE) uart->stats.frame_errors++;
+            uart->stats.rx_errors++;
+            continue;  // Discard the erroneous data
+        }
+        
+        if (uart_ring_full(&uart->rx)) {
+            uart->stats.overrun_errors++;
+            continue;
+        }
+        uart_ring_put(&uart->rx, c);
+        queued++;
+    }
+    return queued;
+}
+
+// Ask for THRE interrupts only while there is something to send (lock held)
+static void uart_16550_update_ier(struct uart_16550_device *uart)
+{
+    uint8_t ier = 0;
+    if (uart->rx_interrupts_enabled) {
+        ier |= UART_IER_RDI | UART_IER_RLSI;
+    }
+    if (uart->tx_interrupts_enabled && !uart_ring_empty(&uart->tx)) {
+        ier |= UART_IER_THRI;
+    }
+    if (ier != uart->ier) {
+        uart->ier = ier;
+        uart_write_reg(uart, UART_IER, ier);
+    }
+}
+
+static void uart_16550_interrupt(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    struct uart_16550_device *uart = context;
+    uint32_t received = 0;
+    
+    spin_lock(&uart->lock);
+    
+    for (int loops = 0; loops < UART_16550_IRQ_LOOPS; loops++) {
+        uint8_t iir = uart_read_reg(uart, UART_IIR);
+        if (iir & UART_IIR_NO_INT) {
+            break;
+        }
+        
+        switch (iir & UART_IIR_ID_MASK) {
+            case UART_IIR_RLSI:
+            case UART_IIR_RDI:
+            case UART_IIR_TIMEOUT:
+                received += uart_16550_rx_fill(uart);
+                break;
+            case UART_IIR_THRI:
+                uart_16550_tx_fill(uart);
+                break;
+            case UART_IIR_MSI:
+                uart_read_reg(uart, UART_MSR);
+                break;
+        }
+    }
+    
+    uart_16550_update_ier(uart);
+    spin_unlock(&uart->lock);
+    
+    if (received) {
+        wake_up(&uart->rx_wait);
+    }
+}
+
 // Device operation implementations
 int uart_16550_write(struct device *device, const void *buf, size_t len, off_t offset)
 {
@@ -269,22 +417,26 @@ int uart_16550_write(struct device *device, const void *buf, size_t len, off_t o
         return -1;
     }
     
-    const char *data = (const char *)buf;
-    size_t written = 0;
+    const uint8_t *data = (const uint8_t *)buf;
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
     
     for (size_t i = 0; i < len; i++) {
-        // Wait for transmit holding register to be empty
-        while (!(uart_read_reg(uart, UART_LSR) & UART_LSR_THRE)) {
-            // Wait
+        // Only a full ring makes the writer wait for the line
+        while (uart_ring_full(&uart->tx)) {
+            uart_16550_tx_fill(uart);
         }
-        
-        // Write character to transmit holding register
-        uart_write_reg(uart, UART_THR, data[i]);
-        written++;
-        uart->stats.bytes_transmitted++;
+        uart_ring_put(&uart->tx, data[i]);
+    }
+    
+    uart_16550_tx_fill(uart);
+    if (uart->tx_interrupts_enabled) {
+        uart_16550_update_ier(uart);
+    } else {
+        uart_16550_tx_drain(uart);
     }
     
-    return written;
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return (int)len;
 }
 
 int uart_16550_read(struct device *device, void *buf, size_t len, off_t offset)
@@ -298,34 +450,79 @@ int uart_16550_read(struct device *device, void *buf, size_t len, off_t offset)
     
     char *data = (char *)buf;
     size_t read_count = 0;
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
     
-    for (size_t i = 0; i < len; i++) {
-        uint8_t lsr = uart_read_reg(uart, UART_LSR);
-        
-        // Check if data is available
-        if (!(lsr & UART_LSR_DR)) {
-            break; // No more data available
-        }
-        
-        // Check for errors
-        if (lsr & (UART_LSR_OE | UART_LSR_PE | UART_LSR_FE | UART_LSR_BI)) {
-            if (lsr & UART_LSR_OE) uart->stats.overrun_errors++;
-            if (lsr & UART_LSR_PE) uart->stats.parity_errors++;
-            if (lsr & UART_LSR_FE) uart->stats.frame_errors++;
-            uart->stats.rx_errors++;
-            
-            // Read and discard the erroneous data
-            uart_read_reg(uart, UART_RBR);
-            continue;
-        }
-        
-        // Read character from receive buffer register
-        data[i] = uart_read_reg(uart, UART_RBR);
-        read_count++;
+    // Without RX interrupts (or with interrupts masked) nothing else
+    // empties the hardware FIFO
+    if (uart_ring_empty(&uart->rx)) {
+        uart_16550_rx_fill(uart);
+    }
+    
+    while (read_count < len && !uart_ring_empty(&uart->rx)) {
+        data[read_count++] = (char)uart_ring_get(&uart->rx);
         uart->stats.bytes_received++;
     }
     
-    return read_count;
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return (int)read_count;
+}
+
+int uart_16550_enable_interrupts(struct device *device, int tx_enable, int rx_enable)
+{
+    struct uart_16550_device *uart = device_get_private_data(device);
+    if (!uart) {
+        return -1;
+    }
+    
+    if (!uart->irq_registered) {
+        if (request_irq(device->irq_num, uart_16550_interrupt, uart, device->name) < 0) {
+            return -1;
+        }
+        uart->irq_registered = 1;
+        enable_irq(device->irq_num);
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
+    uart->tx_interrupts_enabled = tx_enable ? 1 : 0;
+    uart->rx_interrupts_enabled = rx_enable ? 1 : 0;
+    if (!uart->tx_interrupts_enabled) {
+        uart_16550_tx_drain(uart);
+    }
+    uart_16550_update_ier(uart);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    
+    return 0;
+}
+
+int uart_16550_disable_interrupts(struct device *device)
+{
+    struct uart_16550_device *uart = device_get_private_data(device);
+    if (!uart) {
+        return -1;
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
+    uart->tx_interrupts_enabled = 0;
+    uart->rx_interrupts_enabled = 0;
+    uart_16550_tx_drain(uart);
+    uart_16550_update_ier(uart);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    
+    return 0;
+}
+
+int uart_16550_flush(struct device *device)
+{
+    struct uart_16550_device *uart = device_get_private_data(device);
+    if (!uart) {
+        return -1;
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
+    uart_16550_tx_drain(uart);
+    uart_16550_update_ier(uart);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return 0;
 }
 
 int uart_16550_ioctl(struct device *device, unsigned int cmd, unsigned long arg)
@@ -387,7 +584,7 @@ int uart_16550_tx_ready(struct device *device)
         return -1;
     }
     
-    return !!(uart_read_reg(uart, UART_LSR) & UART_LSR_THRE);
+    return !uart_ring_full(&uart->tx);
 }
 
 int uart_16550_rx_ready(struct device *device)
@@ -397,7 +594,13 @@ int uart_16550_rx_ready(struct device *device)
         return -1;
     }
     
-    return !!(uart_read_reg(uart, UART_LSR) & UART_LSR_DR);
+    return !uart_ring_empty(&uart->rx) || !!(uart_read_reg(uart, UART_LSR) & UART_LSR_DR);
+}
+
+struct wait_queue *uart_16550_rx_wait(struct device *device)
+{
+    struct uart_16550_device *uart = device_get_private_data(device);
+    return uart ? &uart->rx_wait : NULL;
 }
 
 // Device driver structure
@@ -1,6 +1,14 @@
 /*
  * MiniOS ARM64 PL011 UART Driver
  * Phase 4: Device Drivers & System Services
+ *
+ * Output goes through a TX ring. A writer queues its bytes and tops up
+ * the transmit FIFO until it is full; the TX interrupt tops it up from
+ * then on, so a writer only waits on the hardware when the ring is full.
+ * Until transmit interrupts are enabled, writers drain the ring
+ * themselves. Received bytes are moved into an RX ring by the interrupt
+ * handler, or by a reader that finds the ring empty. The handler wakes
+ * the RX wait queue when it queued any, for readers waiting on input.
  */
 
 #include "uart.h"
@@ -8,6 +16,9 @@
 #include "driver.h"
 #include "memory.h"
 #include "kernel.h"
+#include "interrupt.h"
+#include "spinlock.h"
+#include "process.h"
 
 #ifdef ARCH_ARM64
 
@@ -33,6 +44,21 @@
 #define PL011_FR_RXFE       (1 << 4)    // Receive FIFO empty
 #define PL011_FR_BUSY       (1 << 3)    // UART busy
 
+// PL011 interrupt bits (IMSC, RIS, MIS, ICR)
+#define PL011_INT_RX        (1 << 4)    // Receive FIFO at its level
+#define PL011_INT_TX        (1 << 5)    // Transmit FIFO at its level
+#define PL011_INT_RT        (1 << 6)    // Receive timeout
+#define PL011_INT_ERR       (0xF << 7)  // Framing, parity, break, overrun
+
+// PL011 line control bits
+#define PL011_LCRH_FEN      (1 << 4)    // FIFOs enabled
+
+// PL011 data register error bits
+#define PL011_DR_OE         (1 << 11)   // Overrun
+#define PL011_DR_BE         (1 << 10)   // Break
+#define PL011_DR_PE         (1 << 9)    // Parity
+#define PL011_DR_FE         (1 << 8)    // Framing
+
 // PL011 control register bits
 #define PL011_CR_CTSEN      (1 << 15)   // CTS hardware flow control enable
 #define PL011_CR_RTSEN      (1 << 14)   // RTS hardware flow control enable
@@ -51,8 +77,16 @@ struct pl011_uart_device {
     struct uart_stats stats;        // Statistics
     int tx_interrupts_enabled;      // Transmit interrupts enabled
     int rx_interrupts_enabled;      // Receive interrupts enabled
+    int irq_registered;             // Handler installed on device->irq_num
+    uint32_t imsc;                  // Last value written to IMSC
+    spinlock_t lock;                // Rings, IMSC and statistics
+    struct uart_ring tx;
+    struct uart_ring rx;
+    struct wait_queue rx_wait;      // Woken when input reaches the RX ring
 };
 
+int pl011_uart_disable_interrupts(struct device *device);
+
 // Default PL011 configuration
 #define PL011_DEFAULT_BAUD      115200
 #define PL011_DEFAULT_CLOCK     24000000    // 24 MHz
@@ -100,7 +134,7 @@ int pl011_uart_init(struct device *device)
     early_print("\n");
     
     // Allocate private data
-    struct pl011_uart_device *uart = memory_alloc(sizeof(struct pl011_uart_device), MEMORY_ALIGN_4K);
+    struct pl011_uart_device *uart = memory_alloc(sizeof(struct pl011_uart_device), 8);
     if (!uart) {
         early_print("PL011 UART: Failed to allocate memory\n");
         return -1;
@@ -113,6 +147,12 @@ int pl011_uart_init(struct device *device)
     uart->flags = UART_FLAG_8BIT | UART_FLAG_1_STOP | UART_FLAG_NO_PARITY;
     uart->tx_interrupts_enabled = 0;
     uart->rx_interrupts_enabled = 0;
+    uart->irq_registered = 0;
+    uart->imsc = 0;
+    spin_lock_init(&uart->lock);
+    wait_queue_init(&uart->rx_wait);
+    uart->tx.head = uart->tx.tail = 0;
+    uart->rx.head = uart->rx.tail = 0;
     uart->stats.bytes_transmitted = 0;
     uart->stats.bytes_received = 0;
     uart->stats.tx_errors = 0;
@@ -159,7 +199,8 @@ int pl011_uart_stop(struct device *device)
     
     early_print("PL011 UART: Stopping device\n");
     
-    // Disable UART
+    // Send what is still queued, then disable UART
+    pl011_uart_disable_interrupts(device);
     pl011_write(uart, PL011_UARTCR, 0);
     
     device_clear_flags(device, DEVICE_FLAG_ACTIVE);
@@ -172,6 +213,11 @@ void pl011_uart_cleanup(struct device *device)
     struct pl011_uart_device *uart = device_get_private_data(device);
     if (uart) {
         // Disable UART
+        pl011_uart_disable_interrupts(device);
+        if (uart->irq_registered) {
+            disable_irq(device->irq_num);
+            free_irq(device->irq_num);
+        }
         pl011_write(uart, PL011_UARTCR, 0);
         
         // Free memory
@@ -181,6 +227,91 @@ void pl011_uart_cleanup(struct device *device)
     }
 }
 
+// Top up the transmit FIFO from the TX ring (lock held)
+static void pl011_tx_fill(struct pl011_uart_device *uart)
+{
+    while (!uart_ring_empty(&uart->tx) && !(pl011_read(uart, PL011_UARTFR) & PL011_FR_TXFF)) {
+        pl011_write(uart, PL011_UARTDR, uart_ring_get(&uart->tx));
+        uart->stats.bytes_transmitted++;
+    }
+}
+
+// Send the whole TX ring, waiting on the hardware (lock held)
+static void pl011_tx_drain(struct pl011_uart_device *uart)
+{
+    while (!uart_ring_empty(&uart->tx)) {
+        pl011_tx_fill(uart);
+    }
+}
+
+// Move received bytes into the RX ring and return how many (lock held)
+static uint32_t pl011_rx_fill(struct pl011_uart_device *uart)
+{
+    uint32_t queued = 0;
+    while (!(pl011_read(uart, PL011_UARTFR) & PL011_FR_RXFE)) {
+        uint32_t dr = pl011_read(uart, PL011_UARTDR);
+        
+        // Check for errors
+        if (dr & (PL011_DR_OE | PL011_DR_BE | PL011_DR_PE | PL011_DR_FE)) {
+            if (dr & PL011_DR_OE) uart->stats.overrun_errors++;
+            if (dr & PL011_DR_FE) uart->stats.frame_errors++;
+            if (dr & PL011_DR_PE) uart->stats.parity_errors++;
+            uart->stats.rx_errors++;
+            continue;
+        }
+        
+        if (uart_ring_full(&uart->rx)) {
+            uart->stats.overrun_errors++;
+            continue;
+        }
+        uart_ring_put(&uart->rx, (uint8_t)(dr & 0xFF));
+        queued++;
+    }
+    return queued;
+}
+
+// Unmask TX interrupts only while there is something to send (lock held)
+static void pl011_update_imsc(struct pl011_uart_device *uart)
+{
+    uint32_t imsc = 0;
+    if (uart->rx_interrupts_enabled) {
+        imsc |= PL011_INT_RX | PL011_INT_RT | PL011_INT_ERR;
+    }
+    if (uart->tx_interrupts_enabled && !uart_ring_empty(&uart->tx)) {
+        imsc |= PL011_INT_TX;
+    }
+    if (imsc != uart->imsc) {
+        uart->imsc = imsc;
+        pl011_write(uart, PL011_UARTIMSC, imsc);
+    }
+}
+
+static void pl011_uart_interrupt(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    struct pl011_uart_device *uart = context;
+    uint32_t received = 0;
+    
+    spin_lock(&uart->lock);
+    
+    uint32_t mis = pl011_read(uart, PL011_UARTMIS);
+    pl011_write(uart, PL011_UARTICR, mis);
+    
+    if (mis & (PL011_INT_RX | PL011_INT_RT | PL011_INT_ERR)) {
+        received = pl011_rx_fill(uart);
+    }
+    if (mis & PL011_INT_TX) {
+        pl011_tx_fill(uart);
+    }
+    
+    pl011_update_imsc(uart);
+    spin_unlock(&uart->lock);
+    
+    if (received) {
+        wake_up(&uart->rx_wait);
+    }
+}
+
 // Device operation implementations
 int pl011_uart_write(struct device *device, const void *buf, size_t len, off_t offset)
 {
@@ -191,22 +322,26 @@ int pl011_uart_write(struct device *device, const void *buf, size_t len, off_t o
         return -1;
     }
     
-    const char *data = (const char *)buf;
-    size_t written = 0;
+    const uint8_t *data = (const uint8_t *)buf;
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
     
     for (size_t i = 0; i < len; i++) {
-        // Wait for transmit FIFO to have space
-        while (pl011_read(uart, PL011_UARTFR) & PL011_FR_TXFF) {
-            // Wait
+        // Only a full ring makes the writer wait for the line
+        while (uart_ring_full(&uart->tx)) {
+            pl011_tx_fill(uart);
         }
-        
-        // Write character to data register
-        pl011_write(uart, PL011_UARTDR, data[i]);
-        written++;
-        uart->stats.bytes_transmitted++;
+        uart_ring_put(&uart->tx, data[i]);
+    }
+    
+    pl011_tx_fill(uart);
+    if (uart->tx_interrupts_enabled) {
+        pl011_update_imsc(uart);
+    } else {
+        pl011_tx_drain(uart);
     }
     
-    return written;
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return (int)len;
 }
 
 int pl011_uart_read(struct device *device, void *buf, size_t len, off_t offset)
@@ -220,31 +355,90 @@ int pl011_uart_read(struct device *device, void *buf, size_t len, off_t offset)
     
     char *data = (char *)buf;
     size_t read_count = 0;
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
     
-    for (size_t i = 0; i < len; i++) {
-        // Check if data is available
-        if (pl011_read(uart, PL011_UARTFR) & PL011_FR_RXFE) {
-            break; // No more data available
+    // Without RX interrupts (or with interrupts masked) nothing else
+    // empties the hardware FIFO
+    if (uart_ring_empty(&uart->rx)) {
+        pl011_rx_fill(uart);
+    }
+    
+    while (read_count < len && !uart_ring_empty(&uart->rx)) {
+        data[read_count++] = (char)uart_ring_get(&uart->rx);
+        uart->stats.bytes_received++;
+    }
+    
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return (int)read_count;
+}
+
+int pl011_uart_enable_interrupts(struct device *device, int tx_enable, int rx_enable)
+{
+    struct pl011_uart_device *uart = device_get_private_data(device);
+    if (!uart) {
+        return -1;
+    }
+    
+    if (!uart->irq_registered) {
+        if (request_irq(device->irq_num, pl011_uart_interrupt, uart, device->name) < 0) {
+            return -1;
         }
-        
-        // Read character from data register
-        uint32_t dr = pl011_read(uart, PL011_UARTDR);
-        
-        // Check for errors
-        if (dr & 0xF00) {
-            if (dr & (1 << 11)) uart->stats.overrun_errors++;
-            if (dr & (1 << 10)) uart->stats.frame_errors++;
-            if (dr & (1 << 9)) uart->stats.parity_errors++;
-            uart->stats.rx_errors++;
-            continue;
+        uart->irq_registered = 1;
+        enable_irq(device->irq_num);
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
+    
+    // Interrupt levels are only meaningful with the FIFOs on
+    uint32_t lcr_h = pl011_read(uart, PL011_UARTLCR_H);
+    if (!(lcr_h & PL011_LCRH_FEN)) {
+        pl011_tx_drain(uart);
+        while (pl011_read(uart, PL011_UARTFR) & PL011_FR_BUSY) {
+            // Changing LCR_H mid-character corrupts it
         }
-        
-        data[i] = (char)(dr & 0xFF);
-        read_count++;
-        uart->stats.bytes_received++;
+        pl011_write(uart, PL011_UARTLCR_H, lcr_h | PL011_LCRH_FEN);
     }
     
-    return read_count;
+    uart->tx_interrupts_enabled = tx_enable ? 1 : 0;
+    uart->rx_interrupts_enabled = rx_enable ? 1 : 0;
+    if (!uart->tx_interrupts_enabled) {
+        pl011_tx_drain(uart);
+    }
+    pl011_update_imsc(uart);
+    
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return 0;
+}
+
+int pl011_uart_disable_interrupts(struct device *device)
+{
+    struct pl011_uart_device *uart = device_get_private_data(device);
+    if (!uart) {
+        return -1;
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
+    uart->tx_interrupts_enabled = 0;
+    uart->rx_interrupts_enabled = 0;
+    pl011_tx_drain(uart);
+    pl011_update_imsc(uart);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    
+    return 0;
+}
+
+int pl011_uart_flush(struct device *device)
+{
+    struct pl011_uart_device *uart = device_get_private_data(device);
+    if (!uart) {
+        return -1;
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&uart->lock);
+    pl011_tx_drain(uart);
+    pl011_update_imsc(uart);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return 0;
 }
 
 int pl011_uart_ioctl(struct device *device, unsigned int cmd, unsigned long arg)
@@ -306,7 +500,7 @@ int pl011_uart_tx_ready(struct device *device)
         return -1;
     }
     
-    return !(pl011_read(uart, PL011_UARTFR) & PL011_FR_TXFF);
+    return !uart_ring_full(&uart->tx);
 }
 
 int pl011_uart_rx_ready(struct device *device)
@@ -316,7 +510,13 @@ int pl011_uart_rx_ready(struct device *device)
         return -1;
     }
     
-    return !(pl011_read(uart, PL011_UARTFR) & PL011_FR_RXFE);
+    return !uart_ring_empty(&uart->rx) || !(pl011_read(uart, PL011_UARTFR) & PL011_FR_RXFE);
+}
+
+struct wait_queue *pl011_uart_rx_wait(struct device *device)
+{
+    struct pl011_uart_device *uart = device_get_private_data(device);
+    return uart ? &uart->rx_wait : NULL;
 }
 
 // Device driver structure
@@ -0,0 +1,260 @@
+/*
+ * MiniOS Virtio Core
+ * Split virtqueues, feature negotiation and driver matching
+ *
+ * Transports (virtio_mmio.c on ARM64, virtio_pci.c on x86-64) find
+ * devices and hand them to virtio_attach(), which picks the driver by
+ * device ID. Rings use the legacy contiguous layout: descriptor table and
+ * available ring, then the used ring on the next page boundary. Memory
+ * comes from the page allocator and is identity mapped, so ring and buffer
+ * addresses are used as bus addresses directly. With
+ * VIRTIO_RING_F_EVENT_IDX the two sides suppress each other's
+ * notifications by index, in the ring slots the layout always reserves.
+ */
+
+#include "virtio.h"
+#include "memory.h"
+#include "kernel.h"
+
+static inline size_t align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+/**
+ * Allocate a virtqueue of at most max_size entries and hand it to the
+ * device
+ */
+int virtqueue_init(struct virtio_device *vdev, struct virtqueue *vq, uint16_t index,
+                   uint16_t max_size)
+{
+    if (!vdev || !vq) {
+        return -1;
+    }
+
+    uint16_t size = vdev->transport->queue_max(vdev, index);
+    if (size == 0) {
+        return -1;  // Queue not available
+    }
+    if (size > max_size) {
+        size = max_size;
+    }
+    if (size > VIRTQ_MAX_SIZE) {
+        size = VIRTQ_MAX_SIZE;
+    }
+    while (size & (size - 1)) {
+        size &= size - 1;  // Round down to a power of two
+    }
+
+    size_t avail_end = sizeof(struct virtq_desc) * size + sizeof(uint16_t) * (3 + size);
+    size_t used_off = align_up(avail_end, VIRTQ_ALIGN);
+    size_t used_size = sizeof(uint16_t) * 3 + sizeof(struct virtq_used_elem) * size;
+    size_t pages = align_up(used_off + used_size, PAGE_SIZE_4K) / PAGE_SIZE_4K;
+
+    uint64_t phys;
+    uint8_t *memory = memory_dma_alloc(pages * PAGE_SIZE_4K, PAGE_SIZE_4K, &phys);
+    if (!memory) {
+        return -1;
+    }
+
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (struct virtq_desc *)memory;
+    vq->avail = (struct virtq_avail *)(memory + sizeof(struct virtq_desc) * size);
+    vq->used = (volatile struct virtq_used *)(memory + used_off);
+    vq->last_used = 0;
+    vq->kicked_avail = 0;
+    vq->event_idx = (vdev->features & (1ULL << VIRTIO_RING_F_EVENT_IDX)) != 0;
+    vq->memory = memory;
+    vq->phys = phys;
+    vq->pages = pages;
+
+    if (vdev->transport->setup_queue(vdev, vq) != 0) {
+        memory_dma_free(memory, pages * PAGE_SIZE_4K);
+        vq->memory = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void virtqueue_destroy(struct virtqueue *vq)
+{
+    if (vq && vq->memory) {
+        memory_dma_free(vq->memory, vq->pages * PAGE_SIZE_4K);
+        vq->memory = NULL;
+    }
+}
+
+/**
+ * Make a descriptor chain available; the device is not told until
+ * virtqueue_kick()
+ */
+void virtqueue_publish(struct virtqueue *vq, uint16_t head)
+{
+    volatile uint16_t *idx = &vq->avail->idx;
+    uint16_t slot = *idx & (vq->size - 1);
+
+    ((volatile uint16_t *)vq->avail->ring)[slot] = head;
+    virtio_mb();
+    *idx = (uint16_t)(*idx + 1);
+}
+
+// The index fields that follow each ring with VIRTIO_RING_F_EVENT_IDX
+static inline volatile uint16_t *virtqueue_used_event(struct virtqueue *vq)
+{
+    return &((volatile uint16_t *)vq->avail->ring)[vq->size];
+}
+
+static inline volatile uint16_t *virtqueue_avail_event(struct virtqueue *vq)
+{
+    return (volatile uint16_t *)&vq->used->ring[vq->size];
+}
+
+/**
+ * Tell the device about buffers published since the last kick, unless it
+ * has said it does not need to hear: with event indexes, only when the
+ * index it asked to be told about was crossed since the last kick.
+ */
+void virtqueue_kick(struct virtio_device *vdev, struct virtqueue *vq)
+{
+    virtio_mb();
+
+    uint16_t new_idx = vq->avail->idx;
+    uint16_t old_idx = vq->kicked_avail;
+    if (new_idx == old_idx) {
+        return;
+    }
+    vq->kicked_avail = new_idx;
+
+    if (vq->event_idx) {
+        uint16_t event = *virtqueue_avail_event(vq);
+        if ((uint16_t)(new_idx - event - 1) >= (uint16_t)(new_idx - old_idx)) {
+            return;
+        }
+    } else if (vq->used->flags & VIRTQ_USED_F_NO_NOTIFY) {
+        return;
+    }
+    vdev->transport->notify(vdev, vq->index);
+}
+
+/**
+ * Ask the device not to interrupt for used buffers. With event indexes
+ * the index to interrupt at is put as far ahead as it goes; without, the
+ * flag is only a hint the device may ignore.
+ */
+void virtqueue_disable_cb(struct virtqueue *vq)
+{
+    if (vq->event_idx) {
+        *virtqueue_used_event(vq) = (uint16_t)(vq->last_used - 1);
+    } else {
+        vq->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+/**
+ * Ask for an interrupt on the next used buffer. Returns 1 if buffers were
+ * used meanwhile, which the caller must reap itself since that interrupt
+ * may already have been skipped.
+ */
+int virtqueue_enable_cb(struct virtqueue *vq)
+{
+    if (vq->event_idx) {
+        *virtqueue_used_event(vq) = vq->last_used;
+    } else {
+        vq->avail->flags &= (uint16_t)~VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+    virtio_mb();
+    return vq->last_used != vq->used->idx;
+}
+
+/**
+ * Take the next used element, if any. Returns 1 when one was reaped.
+ */
+int virtqueue_reap(struct virtqueue *vq, struct virtq_used_elem *elem)
+{
+    if (vq->last_used == vq->used->idx) {
+        return 0;
+    }
+    virtio_mb();
+
+    volatile struct virtq_used_elem *used = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    if (elem) {
+        elem->id = used->id;
+        elem->len = used->len;
+    }
+    vq->last_used++;
+    return 1;
+}
+
+/**
+ * Reset the device and agree on features: the device's offer masked with
+ * what the driver wants. Leaves the device ready for queue setup.
+ */
+int virtio_negotiate(struct virtio_device *vdev, uint64_t wanted, uint64_t *accepted)
+{
+    const struct virtio_transport *t = vdev->transport;
+
+    t->set_status(vdev, 0);
+    t->set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE);
+    t->set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    if (vdev->version >= 2) {
+        wanted |= 1ULL << VIRTIO_F_VERSION_1;
+    }
+    uint64_t features = t->get_features(vdev) & wanted;
+    if (vdev->version >= 2 && !(features & (1ULL << VIRTIO_F_VERSION_1))) {
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+
+    if (t->set_features(vdev, features) != 0) {
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+
+    if (vdev->version >= 2) {
+        t->set_status(vdev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                            VIRTIO_STATUS_FEATURES_OK);
+        if (!(t->get_status(vdev) & VIRTIO_STATUS_FEATURES_OK)) {
+            t->set_status(vdev, VIRTIO_STATUS_FAILED);
+            return -1;
+        }
+    }
+
+    vdev->features = features;
+    if (accepted) {
+        *accepted = features;
+    }
+    return 0;
+}
+
+/**
+ * Bind a discovered device to its driver
+ */
+int virtio_attach(struct virtio_device *vdev)
+{
+    switch (vdev->device_id) {
+    case VIRTIO_ID_BLOCK:
+        return virtio_blk_probe(vdev);
+    case VIRTIO_ID_NET:
+        return virtio_net_probe(vdev);
+    default:
+        return -1;  // No driver
+    }
+}
+
+/**
+ * Probe this machine's virtio transport. Returns the number of devices
+ * bound to a driver.
+ */
+int virtio_init(void)
+{
+#ifdef ARCH_ARM64
+    return virtio_mmio_probe();
+#elif defined(ARCH_X86_64)
+    return virtio_pci_probe();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,306 @@
+/*
+ * MiniOS Virtio Block Driver
+ * virtio-blk disks as asynchronous block devices
+ *
+ * Each disk registers as vda, vdb, ... with 4KB blocks (eight 512-byte
+ * sectors) so SFS can sit on it directly. It has no synchronous transfer
+ * operations: everything goes through the block request queue, which
+ * hands the driver one merged scatter/gather dispatch at a time. A
+ * dispatch becomes one or more virtio requests (header, data descriptors,
+ * status byte) published together; the queue hears about completion once
+ * all of them are used. Once the device's interrupt has been seen,
+ * completions are reaped by a tasklet the handler schedules, and by
+ * polling until then.
+ */
+
+#include "virtio.h"
+#include "block_device.h"
+#include "interrupt.h"
+#include "softirq.h"
+#include "memory.h"
+#include "kernel.h"
+
+// Feature bits
+#define VIRTIO_BLK_F_SIZE_MAX       1
+#define VIRTIO_BLK_F_SEG_MAX        2
+#define VIRTIO_BLK_F_RO             5
+
+// Request types and status values
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_S_OK             0
+
+// Device configuration offsets
+#define VIRTIO_BLK_CFG_CAPACITY     0   // 64-bit, in 512-byte sectors
+#define VIRTIO_BLK_CFG_SIZE_MAX     8
+#define VIRTIO_BLK_CFG_SEG_MAX      12
+
+#define VIRTIO_BLK_SECTOR_SIZE      512
+#define VIRTIO_BLK_MAX_REQUESTS     BLOCK_IO_MAX_SEGMENTS
+
+struct virtio_blk_req_header {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+struct virtio_blk {
+    struct block_device dev;
+    struct virtio_device *vdev;
+    struct virtqueue vq;
+    struct tasklet reap_tasklet;            // Completion work off the interrupt
+    uint32_t seg_max;                       // Data descriptors per request
+    uint32_t size_max;                      // Bytes per data descriptor
+    uint32_t sectors_per_block;
+
+    // One dispatch in flight at a time
+    struct virtio_blk_req_header headers[VIRTIO_BLK_MAX_REQUESTS];
+    volatile uint8_t status[VIRTIO_BLK_MAX_REQUESTS];
+    uint32_t requests;                      // Virtio requests in the dispatch
+    uint32_t inflight;                      // Of those, not yet used
+};
+
+static int virtio_blk_count = 0;
+
+static int virtio_blk_submit(struct block_device *dev, int write, uint32_t start_block,
+                             const struct block_io_segment *segs, uint32_t num_segs);
+static void virtio_blk_poll(struct block_device *dev);
+
+static struct block_device_operations virtio_blk_ops = {
+    .read_block = NULL,
+    .write_block = NULL,
+    .read_blocks = NULL,
+    .write_blocks = NULL,
+    .readv = NULL,
+    .writev = NULL,
+    .sync = NULL,
+    .ioctl = NULL,
+    .submit = virtio_blk_submit,
+    .poll = virtio_blk_poll
+};
+
+static inline void set_desc(struct virtq_desc *desc, const void *addr, uint32_t len,
+                            uint16_t flags, uint16_t next)
+{
+    desc->addr = memory_virt_to_phys(addr);
+    desc->len = len;
+    desc->flags = flags;
+    desc->next = next;
+}
+
+/**
+ * Turn a dispatch into virtio requests. Descriptors are handed out from 0
+ * since the previous dispatch has been fully used by now.
+ */
+static int virtio_blk_submit(struct block_device *dev, int write, uint32_t start_block,
+                             const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct virtio_blk *vblk = dev->private_data;
+    struct virtq_desc *desc = vblk->vq.desc;
+    uint16_t qsize = vblk->vq.size;
+    uint16_t data_flags = write ? 0 : VIRTQ_DESC_F_WRITE;
+
+    uint64_t sector = (uint64_t)start_block * vblk->sectors_per_block;
+    uint16_t next = 0;
+    uint16_t heads[VIRTIO_BLK_MAX_REQUESTS];
+    uint32_t nreq = 0;
+    uint32_t in_req = 0;        // Data descriptors in the open request
+    uint16_t last = 0;          // Last descriptor of the open request
+
+    for (uint32_t i = 0; i < num_segs; i++) {
+        const uint8_t *buf = segs[i].buffer;
+        uint64_t left = (uint64_t)segs[i].count * dev->block_size;
+
+        while (left > 0) {
+            uint32_t len = left > vblk->size_max ? vblk->size_max : (uint32_t)left;
+
+            if (in_req == 0) {
+                // Open a request: header plus room for one data and a status
+                if (nreq == VIRTIO_BLK_MAX_REQUESTS || next + 3u > qsize) {
+                    return BLOCK_EIO;
+                }
+                struct virtio_blk_req_header *hdr = &vblk->headers[nreq];
+                hdr->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+                hdr->reserved = 0;
+                hdr->sector = sector;
+                heads[nreq] = next;
+                set_desc(&desc[next], hdr, sizeof(*hdr), VIRTQ_DESC_F_NEXT, (uint16_t)(next + 1));
+                next++;
+            }
+
+            set_desc(&desc[next], buf, len, data_flags | VIRTQ_DESC_F_NEXT, (uint16_t)(next + 1));
+            last = next++;
+            in_req++;
+            buf += len;
+            left -= len;
+            sector += len / VIRTIO_BLK_SECTOR_SIZE;
+
+            // Close the request when it is full or the ring has no room
+            // for another data descriptor
+            int more = left > 0 || i + 1 < num_segs;
+            if (!more || in_req == vblk->seg_max || next + 2u > qsize) {
+                vblk->status[nreq] = 0xFF;
+                desc[last].next = next;
+                set_desc(&desc[next], (const void *)&vblk->status[nreq], 1, VIRTQ_DESC_F_WRITE, 0);
+                next++;
+                nreq++;
+                in_req = 0;
+            }
+        }
+    }
+
+    vblk->requests = nreq;
+    vblk->inflight = nreq;
+    for (uint32_t r = 0; r < nreq; r++) {
+        virtqueue_publish(&vblk->vq, heads[r]);
+    }
+    virtqueue_kick(vblk->vdev, &vblk->vq);
+
+    return BLOCK_SUCCESS;
+}
+
+/**
+ * Reap used requests and complete the dispatch once all are back
+ */
+static void virtio_blk_reap(struct virtio_blk *vblk)
+{
+    unsigned long flags = disable_interrupts();
+
+    struct virtq_used_elem elem;
+    while (virtqueue_reap(&vblk->vq, &elem)) {
+        if (vblk->inflight > 0) {
+            vblk->inflight--;
+        }
+    }
+
+    if (vblk->requests > 0 && vblk->inflight == 0) {
+        int result = BLOCK_SUCCESS;
+        for (uint32_t r = 0; r < vblk->requests; r++) {
+            if (vblk->status[r] != VIRTIO_BLK_S_OK) {
+                result = BLOCK_EIO;
+            }
+        }
+        vblk->requests = 0;
+        block_queue_complete(&vblk->dev, result);  // May submit the next dispatch
+    }
+
+    restore_interrupts(flags);
+}
+
+static void virtio_blk_poll(struct block_device *dev)
+{
+    struct virtio_blk *vblk = dev->private_data;
+    vblk->vdev->transport->ack_interrupt(vblk->vdev);
+    virtio_blk_reap(vblk);
+}
+
+static void virtio_blk_reap_tasklet(void *data)
+{
+    virtio_blk_reap(data);
+}
+
+static void virtio_blk_interrupt(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    struct virtio_blk *vblk = context;
+
+    if (vblk->vdev->transport->ack_interrupt(vblk->vdev) & VIRTIO_ISR_QUEUE) {
+        vblk->dev.queue.irq_driven = 1;
+        tasklet_schedule(&vblk->reap_tasklet);
+    }
+}
+
+int virtio_blk_probe(struct virtio_device *vdev)
+{
+    const struct virtio_transport *t = vdev->transport;
+
+    uint64_t features = 0;
+    uint64_t wanted = (1ULL << VIRTIO_BLK_F_SIZE_MAX) | (1ULL << VIRTIO_BLK_F_SEG_MAX) |
+                      (1ULL << VIRTIO_BLK_F_RO);
+    if (virtio_negotiate(vdev, wanted, &features) != 0) {
+        early_print("virtio-blk: feature negotiation failed\n");
+        return -1;
+    }
+
+    struct virtio_blk *vblk = kmalloc_aligned(sizeof(struct virtio_blk), CACHE_LINE_SIZE);
+    if (!vblk) {
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    memset(vblk, 0, sizeof(*vblk));
+    vblk->vdev = vdev;
+    vblk->sectors_per_block = BLOCK_SIZE_4096 / VIRTIO_BLK_SECTOR_SIZE;
+    tasklet_init(&vblk->reap_tasklet, virtio_blk_reap_tasklet, vblk);
+
+    if (virtqueue_init(vdev, &vblk->vq, 0, VIRTQ_MAX_SIZE) != 0) {
+        early_print("virtio-blk: queue setup failed\n");
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        kfree(vblk);
+        return -1;
+    }
+
+    uint64_t capacity = 0;
+    t->read_config(vdev, VIRTIO_BLK_CFG_CAPACITY, &capacity, sizeof(capacity));
+
+    vblk->seg_max = vblk->vq.size - 2;
+    if (features & (1ULL << VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = 0;
+        t->read_config(vdev, VIRTIO_BLK_CFG_SEG_MAX, &seg_max, sizeof(seg_max));
+        if (seg_max > 0 && seg_max < vblk->seg_max) {
+            vblk->seg_max = seg_max;
+        }
+    }
+    vblk->size_max = 0x80000000U;
+    if (features & (1ULL << VIRTIO_BLK_F_SIZE_MAX)) {
+        uint32_t size_max = 0;
+        t->read_config(vdev, VIRTIO_BLK_CFG_SIZE_MAX, &size_max, sizeof(size_max));
+        size_max &= ~(uint32_t)(VIRTIO_BLK_SECTOR_SIZE - 1);
+        if (size_max > 0) {
+            vblk->size_max = size_max;
+        }
+    }
+
+    uint64_t blocks = capacity / vblk->sectors_per_block;
+    if (blocks > 0xFFFFFFFFULL) {
+        blocks = 0xFFFFFFFFULL;
+    }
+
+    struct block_device *dev = &vblk->dev;
+    strcpy(dev->name, "vda");
+    dev->name[2] = (char)('a' + virtio_blk_count);
+    dev->device_type = BLOCK_DEVICE_DISK;
+    dev->block_size = BLOCK_SIZE_4096;
+    dev->num_blocks = (uint32_t)blocks;
+    dev->flags = BLOCK_DEVICE_READABLE;
+    if (!(features & (1ULL << VIRTIO_BLK_F_RO))) {
+        dev->flags |= BLOCK_DEVICE_WRITABLE;
+    }
+    dev->ops = &virtio_blk_ops;
+    dev->private_data = vblk;
+    dev->next = NULL;
+
+    t->set_status(vdev, t->get_status(vdev) | VIRTIO_STATUS_DRIVER_OK);
+
+    if (block_device_register(dev) != BLOCK_SUCCESS) {
+        early_print("virtio-blk: failed to register device\n");
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        virtqueue_destroy(&vblk->vq);
+        kfree(vblk);
+        return -1;
+    }
+    virtio_blk_count++;
+    vdev->driver_data = vblk;
+
+    // Completion is polled until the first interrupt arrives
+    if (request_shared_irq(vdev->irq, virtio_blk_interrupt, vblk, dev->name) == 0) {
+        vdev->irq_registered = 1;
+        enable_irq(vdev->irq);
+    }
+
+    early_print("virtio-blk: ");
+    early_print(dev->name);
+    early_print(" attached via ");
+    early_print(t->name);
+    early_print("\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * MiniOS Virtio MMIO Transport
+ * Device discovery on the QEMU ARM64 virt machine
+ *
+ * The virt machine exposes 32 virtio-mmio slots of 0x200 bytes starting at
+ * 0x0a000000, slot n wired to SPI 16 + n. Empty slots read device ID 0.
+ * Both the legacy (version 1) and modern (version 2) register layouts are
+ * handled.
+ */
+
+#include "virtio.h"
+#include "memory.h"
+#include "kernel.h"
+
+#ifdef ARCH_ARM64
+
+#define VIRTIO_MMIO_BASE            0x0a000000UL
+#define VIRTIO_MMIO_SLOT_SIZE       0x200
+#define VIRTIO_MMIO_SLOTS           32
+#define VIRTIO_MMIO_IRQ_BASE        48      // SPI 16
+
+#define VIRTIO_MMIO_MAGIC_VALUE     0x000
+#define VIRTIO_MMIO_VERSION         0x004
+#define VIRTIO_MMIO_DEVICE_ID       0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028   // Legacy only
+#define VIRTIO_MMIO_QUEUE_SEL       0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX   0x034
+#define VIRTIO_MMIO_QUEUE_NUM       0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN     0x03c   // Legacy only
+#define VIRTIO_MMIO_QUEUE_PFN       0x040   // Legacy only
+#define VIRTIO_MMIO_QUEUE_READY     0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY    0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK   0x064
+#define VIRTIO_MMIO_STATUS          0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW  0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_AVAIL_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_AVAIL_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_USED_LOW  0x0a0
+#define VIRTIO_MMIO_QUEUE_USED_HIGH 0x0a4
+#define VIRTIO_MMIO_CONFIG          0x100
+
+#define VIRTIO_MMIO_MAGIC           0x74726976  // "virt"
+
+static struct virtio_device mmio_devices[VIRTIO_MMIO_SLOTS];
+
+static inline uint32_t mmio_read(struct virtio_device *vdev, uint32_t offset)
+{
+    return *(volatile uint32_t *)(vdev->base + offset);
+}
+
+static inline void mmio_write(struct virtio_device *vdev, uint32_t offset, uint32_t value)
+{
+    *(volatile uint32_t *)(vdev->base + offset) = value;
+}
+
+static uint64_t mmio_get_features(struct virtio_device *vdev)
+{
+    mmio_write(vdev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    uint64_t features = mmio_read(vdev, VIRTIO_MMIO_DEVICE_FEATURES);
+    if (vdev->version >= 2) {
+        mmio_write(vdev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+        features |= (uint64_t)mmio_read(vdev, VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+    }
+    return features;
+}
+
+static int mmio_set_features(struct virtio_device *vdev, uint64_t features)
+{
+    mmio_write(vdev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    mmio_write(vdev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)features);
+    mmio_write(vdev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+    mmio_write(vdev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)(features >> 32));
+    return 0;
+}
+
+static uint8_t mmio_get_status(struct virtio_device *vdev)
+{
+    return (uint8_t)mmio_read(vdev, VIRTIO_MMIO_STATUS);
+}
+
+static void mmio_set_status(struct virtio_device *vdev, uint8_t status)
+{
+    mmio_write(vdev, VIRTIO_MMIO_STATUS, status);
+}
+
+static void mmio_read_config(struct virtio_device *vdev, uint32_t offset, void *buf, uint32_t len)
+{
+    volatile uint8_t *config = (volatile uint8_t *)(vdev->base + VIRTIO_MMIO_CONFIG);
+    uint8_t *out = buf;
+    for (uint32_t i = 0; i < len; i++) {
+        out[i] = config[offset + i];
+    }
+}
+
+static uint16_t mmio_queue_max(struct virtio_device *vdev, uint16_t index)
+{
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_SEL, index);
+    uint32_t max = mmio_read(vdev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    return max > 0xFFFF ? 0xFFFF : (uint16_t)max;
+}
+
+static int mmio_setup_queue(struct virtio_device *vdev, struct virtqueue *vq)
+{
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_SEL, vq->index);
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_NUM, vq->size);
+
+    if (vdev->version == 1) {
+        mmio_write(vdev, VIRTIO_MMIO_GUEST_PAGE_SIZE, PAGE_SIZE_4K);
+        mmio_write(vdev, VIRTIO_MMIO_QUEUE_ALIGN, VIRTQ_ALIGN);
+        mmio_write(vdev, VIRTIO_MMIO_QUEUE_PFN, (uint32_t)(vq->phys / PAGE_SIZE_4K));
+        return 0;
+    }
+
+    uint64_t desc = memory_virt_to_phys(vq->desc);
+    uint64_t avail = memory_virt_to_phys(vq->avail);
+    uint64_t used = memory_virt_to_phys((const void *)vq->used);
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_DESC_LOW, (uint32_t)desc);
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_DESC_HIGH, (uint32_t)(desc >> 32));
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_AVAIL_LOW, (uint32_t)avail);
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_AVAIL_HIGH, (uint32_t)(avail >> 32));
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_USED_LOW, (uint32_t)used);
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_USED_HIGH, (uint32_t)(used >> 32));
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_READY, 1);
+    return 0;
+}
+
+static void mmio_notify(struct virtio_device *vdev, uint16_t index)
+{
+    mmio_write(vdev, VIRTIO_MMIO_QUEUE_NOTIFY, index);
+}
+
+static uint32_t mmio_ack_interrupt(struct virtio_device *vdev)
+{
+    uint32_t status = mmio_read(vdev, VIRTIO_MMIO_INTERRUPT_STATUS);
+    if (status) {
+        mmio_write(vdev, VIRTIO_MMIO_INTERRUPT_ACK, status);
+    }
+    return status;
+}
+
+static const struct virtio_transport mmio_transport = {
+    .name = "virtio-mmio",
+    .get_features = mmio_get_features,
+    .set_features = mmio_set_features,
+    .get_status = mmio_get_status,
+    .set_status = mmio_set_status,
+    .read_config = mmio_read_config,
+    .queue_max = mmio_queue_max,
+    .setup_queue = mmio_setup_queue,
+    .notify = mmio_notify,
+    .ack_interrupt = mmio_ack_interrupt,
+};
+
+int virtio_mmio_probe(void)
+{
+    int bound = 0;
+
+    for (uint32_t slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++) {
+        struct virtio_device *vdev = &mmio_devices[slot];
+        memset(vdev, 0, sizeof(*vdev));
+        vdev->transport = &mmio_transport;
+        vdev->base = VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_SLOT_SIZE;
+
+        if (mmio_read(vdev, VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MMIO_MAGIC) {
+            continue;
+        }
+        vdev->version = mmio_read(vdev, VIRTIO_MMIO_VERSION);
+        vdev->device_id = mmio_read(vdev, VIRTIO_MMIO_DEVICE_ID);
+        if (vdev->device_id == 0 || vdev->version == 0 || vdev->version > 2) {
+            continue;
+        }
+        vdev->irq = VIRTIO_MMIO_IRQ_BASE + slot;
+
+        if (virtio_attach(vdev) == 0) {
+            bound++;
+        }
+    }
+
+    return bound;
+}
+
+#endif // ARCH_ARM64
@@ -0,0 +1,409 @@
+/*
+ * MiniOS Virtio Network Driver
+ * virtio-net devices as Ethernet interfaces for the IPv4 stack
+ *
+ * Each device registers as eth0, eth1, ... Queue 0 receives and queue 1
+ * transmits; both are split into fixed slots of descriptors, the
+ * virtio-net header, the frame and, on transmit, the frame's fragment,
+ * so a used entry's id names its slot. Receive slots hold packets from
+ * the device's own pool that it writes straight into; a filled one is
+ * handed to netif_receive() as it is and replaced by a fresh packet.
+ * Transmit slots hold the stack's packet until the device has used it.
+ *
+ * Exits are what cost under load, so the driver avoids them. Checksums
+ * and TCP segmentation go to the device when it offers them, and frames
+ * it has checked on receive are passed up as such. The device is only
+ * kicked at the end of a burst from the stack, and with event indexes
+ * only if it has caught up. Transmit completions raise no interrupt:
+ * slots are reaped when the next frame goes out or a frame comes in.
+ * The receive interrupt is switched off while the tasklet it schedules
+ * drains the ring, and the stack's tick polls in case it never arrives.
+ */
+
+#include "virtio.h"
+#include "net.h"
+#include "interrupt.h"
+#include "softirq.h"
+#include "spinlock.h"
+#include "memory.h"
+#include "kernel.h"
+
+// Feature bits
+#define VIRTIO_NET_F_CSUM           0   // Device completes partial checksums
+#define VIRTIO_NET_F_GUEST_CSUM     1   // Driver takes frames with partial checksums
+#define VIRTIO_NET_F_MAC            5
+#define VIRTIO_NET_F_HOST_TSO4      11  // Device segments TCPv4
+
+// Header flags and segmentation types
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_F_DATA_VALID 2
+#define VIRTIO_NET_HDR_GSO_NONE     0
+#define VIRTIO_NET_HDR_GSO_TCPV4    1
+
+// Device configuration offsets
+#define VIRTIO_NET_CFG_MAC          0
+
+#define VIRTIO_NET_RX_QUEUE         0
+#define VIRTIO_NET_TX_QUEUE         1
+#define VIRTIO_NET_MAX_SLOTS        128     // Per queue
+#define VIRTIO_NET_RX_DESCS         2       // Per slot: header, frame
+#define VIRTIO_NET_TX_DESCS         3       // Per slot: header, frame, fragment
+#define VIRTIO_NET_POOL_BUFFERS     (2 * VIRTIO_NET_MAX_SLOTS) // Posted and queued above
+#define VIRTIO_NET_LEGACY_HDR_LEN   10      // Without num_buffers
+#define VIRTIO_NET_GSO_MAX_SIZE     (0xFFFF - ETH_HLEN)
+
+struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;                       // Headers ahead of the payload
+    uint16_t gso_size;                      // Payload per segment
+    uint16_t csum_start;                    // From the start of the frame
+    uint16_t csum_offset;                   // From csum_start
+    uint16_t num_buffers;                   // Only present with VERSION_1
+};
+
+struct virtio_net {
+    struct network_interface netif;
+    struct virtio_device *vdev;
+    struct virtqueue rx_vq;
+    struct virtqueue tx_vq;
+    struct tasklet rx_tasklet;
+    spinlock_t lock;                        // Protects the queues and slots
+    uint32_t hdr_len;                       // Header bytes ahead of each frame
+
+    uint16_t rx_slots;
+    struct net_packet *rx_packets[VIRTIO_NET_MAX_SLOTS];
+    struct virtio_net_hdr rx_hdrs[VIRTIO_NET_MAX_SLOTS];
+
+    uint16_t tx_slots;
+    uint16_t tx_free[VIRTIO_NET_MAX_SLOTS]; // Stack of idle slots
+    uint16_t tx_free_count;
+    struct net_packet *tx_packets[VIRTIO_NET_MAX_SLOTS];
+    struct virtio_net_hdr tx_hdrs[VIRTIO_NET_MAX_SLOTS];
+};
+
+static int virtio_net_count = 0;
+
+static inline void set_desc(struct virtq_desc *desc, const void *addr, uint32_t len,
+                            uint16_t flags, uint16_t next)
+{
+    desc->addr = memory_virt_to_phys(addr);
+    desc->len = len;
+    desc->flags = flags;
+    desc->next = next;
+}
+
+static inline uint16_t virtio_net_slots(const struct virtqueue *vq, uint16_t descs)
+{
+    uint16_t slots = vq->size / descs;
+    return slots > VIRTIO_NET_MAX_SLOTS ? VIRTIO_NET_MAX_SLOTS : slots;
+}
+
+// Give receive slot i an empty packet. Caller holds vnet->lock.
+static void virtio_net_rx_post(struct virtio_net *vnet, uint16_t i)
+{
+    struct net_packet *packet = vnet->rx_packets[i];
+    uint16_t head = (uint16_t)(i * VIRTIO_NET_RX_DESCS);
+
+    set_desc(&vnet->rx_vq.desc[head], &vnet->rx_hdrs[i], vnet->hdr_len,
+             VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_NEXT, (uint16_t)(head + 1));
+    set_desc(&vnet->rx_vq.desc[head + 1], packet->data, ETH_FRAME_MAX, VIRTQ_DESC_F_WRITE, 0);
+    virtqueue_publish(&vnet->rx_vq, head);
+}
+
+// Free the packets of transmit slots the device is done with. Caller
+// holds vnet->lock.
+static void virtio_net_tx_reap(struct virtio_net *vnet)
+{
+    struct virtq_used_elem elem;
+    while (virtqueue_reap(&vnet->tx_vq, &elem)) {
+        uint16_t i = (uint16_t)(elem.id / VIRTIO_NET_TX_DESCS);
+        if (i >= vnet->tx_slots || !vnet->tx_packets[i]) {
+            continue;
+        }
+        net_packet_free(vnet->tx_packets[i]);
+        vnet->tx_packets[i] = NULL;
+        vnet->tx_free[vnet->tx_free_count++] = i;
+    }
+}
+
+// Describe the offloads the stack left to the device
+static void virtio_net_tx_header(struct virtio_net_hdr *hdr, struct net_packet *packet)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    if (!(packet->flags & NET_PACKET_CSUM_PARTIAL)) {
+        return;
+    }
+
+    uint16_t start = (uint16_t)(packet->csum_start -
+                                ((uint8_t *)packet->data - net_packet_head(packet)));
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->csum_start = start;
+    hdr->csum_offset = packet->csum_offset;
+    if (packet->gso_size) {
+        const struct tcp_header *tcp = (const struct tcp_header *)((uint8_t *)packet->data + start);
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr->gso_size = packet->gso_size;
+        hdr->hdr_len = (uint16_t)(start + (tcp->data_off >> 4) * 4);
+    }
+}
+
+/**
+ * Called by the stack with net_lock held; owns the packet either way.
+ * Frames marked NET_PACKET_XMIT_MORE wait for virtio_net_flush().
+ */
+static int virtio_net_transmit(struct network_interface *netif, struct net_packet *packet)
+{
+    struct virtio_net *vnet = netif->driver_data;
+
+    unsigned long flags = spin_lock_irqsave(&vnet->lock);
+    virtio_net_tx_reap(vnet);
+    if (vnet->tx_free_count == 0) {
+        // Full ring: what is queued has to go before anything else can
+        virtqueue_kick(vnet->vdev, &vnet->tx_vq);
+        spin_unlock_irqrestore(&vnet->lock, flags);
+        net_packet_free(packet);
+        return NET_ENOMEM;
+    }
+
+    uint16_t i = vnet->tx_free[--vnet->tx_free_count];
+    uint16_t head = (uint16_t)(i * VIRTIO_NET_TX_DESCS);
+    vnet->tx_packets[i] = packet;
+    virtio_net_tx_header(&vnet->tx_hdrs[i], packet);
+    set_desc(&vnet->tx_vq.desc[head], &vnet->tx_hdrs[i], vnet->hdr_len,
+             VIRTQ_DESC_F_NEXT, (uint16_t)(head + 1));
+    if (packet->frag_len) {
+        set_desc(&vnet->tx_vq.desc[head + 1], packet->data, (uint32_t)packet->len,
+                 VIRTQ_DESC_F_NEXT, (uint16_t)(head + 2));
+        set_desc(&vnet->tx_vq.desc[head + 2], packet->frag_data, packet->frag_len, 0, 0);
+    } else {
+        set_desc(&vnet->tx_vq.desc[head + 1], packet->data, (uint32_t)packet->len, 0, 0);
+    }
+    virtqueue_publish(&vnet->tx_vq, head);
+    if (!(packet->flags & NET_PACKET_XMIT_MORE)) {
+        virtqueue_kick(vnet->vdev, &vnet->tx_vq);
+    }
+    spin_unlock_irqrestore(&vnet->lock, flags);
+
+    return NET_SUCCESS;
+}
+
+// End of a burst: one kick for everything it published
+static void virtio_net_flush(struct network_interface *netif)
+{
+    struct virtio_net *vnet = netif->driver_data;
+
+    unsigned long flags = spin_lock_irqsave(&vnet->lock);
+    virtqueue_kick(vnet->vdev, &vnet->tx_vq);
+    spin_unlock_irqrestore(&vnet->lock, flags);
+}
+
+/**
+ * Take every filled receive slot, refill it, and deliver the frames once
+ * the driver lock is dropped: netif_receive() takes net_lock, which the
+ * transmit path holds while it takes ours. The interrupt stays off until
+ * the ring is found empty with it back on.
+ */
+static void virtio_net_rx_reap(struct virtio_net *vnet)
+{
+    int more;
+    do {
+        struct net_packet *head = NULL;
+        struct net_packet **tail = &head;
+
+        unsigned long flags = spin_lock_irqsave(&vnet->lock);
+        virtqueue_disable_cb(&vnet->rx_vq);
+
+        struct virtq_used_elem elem;
+        while (virtqueue_reap(&vnet->rx_vq, &elem)) {
+            uint16_t i = (uint16_t)(elem.id / VIRTIO_NET_RX_DESCS);
+            if (i >= vnet->rx_slots) {
+                continue;
+            }
+
+            struct net_packet *packet = vnet->rx_packets[i];
+            struct net_packet *fresh;
+            if (elem.len > vnet->hdr_len &&
+                net_packet_alloc_pool(vnet->netif.pool, &fresh) == NET_SUCCESS) {
+                packet->len = elem.len - vnet->hdr_len;
+                if (vnet->rx_hdrs[i].flags &
+                    (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+                    packet->flags |= NET_PACKET_CSUM_VALID;
+                }
+                *tail = packet;
+                tail = &packet->next;
+                vnet->rx_packets[i] = fresh;
+            } else {
+                vnet->netif.stats.rx_dropped++;     // Reuse the buffer, lose the frame
+            }
+            virtio_net_rx_post(vnet, i);
+        }
+        virtqueue_kick(vnet->vdev, &vnet->rx_vq);
+        virtio_net_tx_reap(vnet);
+        more = virtqueue_enable_cb(&vnet->rx_vq);
+        spin_unlock_irqrestore(&vnet->lock, flags);
+
+        while (head) {
+            struct net_packet *next = head->next;
+            head->next = NULL;
+            netif_receive(&vnet->netif, head);
+            head = next;
+        }
+    } while (more);
+}
+
+static void virtio_net_poll(struct network_interface *netif)
+{
+    struct virtio_net *vnet = netif->driver_data;
+    vnet->vdev->transport->ack_interrupt(vnet->vdev);
+    virtio_net_rx_reap(vnet);
+}
+
+static void virtio_net_rx_tasklet(void *data)
+{
+    virtio_net_rx_reap(data);
+}
+
+static void virtio_net_interrupt(uint32_t irq_num, void *context)
+{
+    (void)irq_num;
+    struct virtio_net *vnet = context;
+
+    if (vnet->vdev->transport->ack_interrupt(vnet->vdev) & VIRTIO_ISR_QUEUE) {
+        virtqueue_disable_cb(&vnet->rx_vq);
+        tasklet_schedule(&vnet->rx_tasklet);
+    }
+}
+
+static struct net_device_ops virtio_net_ops = {
+    .open = NULL,
+    .close = NULL,
+    .transmit = virtio_net_transmit,
+    .set_mac = NULL,
+    .get_stats = NULL,
+    .poll = virtio_net_poll,
+    .flush = virtio_net_flush,
+};
+
+static void virtio_net_free(struct virtio_net *vnet)
+{
+    for (uint16_t i = 0; i < VIRTIO_NET_MAX_SLOTS; i++) {
+        net_packet_free(vnet->rx_packets[i]);
+    }
+    virtqueue_destroy(&vnet->rx_vq);
+    virtqueue_destroy(&vnet->tx_vq);
+    net_pool_destroy(vnet->netif.pool);
+    kfree(vnet);
+}
+
+int virtio_net_probe(struct virtio_device *vdev)
+{
+    const struct virtio_transport *t = vdev->transport;
+
+    uint64_t features = 0;
+    uint64_t wanted = (1ULL << VIRTIO_NET_F_CSUM) | (1ULL << VIRTIO_NET_F_GUEST_CSUM) |
+                      (1ULL << VIRTIO_NET_F_MAC) | (1ULL << VIRTIO_NET_F_HOST_TSO4) |
+                      (1ULL << VIRTIO_RING_F_EVENT_IDX);
+    if (virtio_negotiate(vdev, wanted, &features) != 0) {
+        early_print("virtio-net: feature negotiation failed\n");
+        return -1;
+    }
+
+    struct virtio_net *vnet = kmalloc(sizeof(struct virtio_net));
+    if (!vnet) {
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    memset(vnet, 0, sizeof(*vnet));
+    vnet->vdev = vdev;
+    vnet->hdr_len = (features & (1ULL << VIRTIO_F_VERSION_1)) ?
+                    sizeof(struct virtio_net_hdr) : VIRTIO_NET_LEGACY_HDR_LEN;
+    spin_lock_init(&vnet->lock);
+    tasklet_init(&vnet->rx_tasklet, virtio_net_rx_tasklet, vnet);
+
+    if (virtqueue_init(vdev, &vnet->rx_vq, VIRTIO_NET_RX_QUEUE, VIRTQ_MAX_SIZE) != 0 ||
+        virtqueue_init(vdev, &vnet->tx_vq, VIRTIO_NET_TX_QUEUE, VIRTQ_MAX_SIZE) != 0) {
+        early_print("virtio-net: queue setup failed\n");
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        virtio_net_free(vnet);
+        return -1;
+    }
+
+    vnet->netif.pool = net_pool_create(VIRTIO_NET_POOL_BUFFERS);
+    vnet->rx_slots = virtio_net_slots(&vnet->rx_vq, VIRTIO_NET_RX_DESCS);
+    for (uint16_t i = 0; i < vnet->rx_slots; i++) {
+        if (net_packet_alloc_pool(vnet->netif.pool, &vnet->rx_packets[i]) != NET_SUCCESS) {
+            early_print("virtio-net: out of memory for receive buffers\n");
+            t->set_status(vdev, VIRTIO_STATUS_FAILED);
+            virtio_net_free(vnet);
+            return -1;
+        }
+        virtio_net_rx_post(vnet, i);
+    }
+    vnet->tx_slots = virtio_net_slots(&vnet->tx_vq, VIRTIO_NET_TX_DESCS);
+    for (uint16_t i = 0; i < vnet->tx_slots; i++) {
+        vnet->tx_free[vnet->tx_free_count++] = (uint16_t)(vnet->tx_slots - 1 - i);
+    }
+    virtqueue_disable_cb(&vnet->tx_vq);
+    virtqueue_enable_cb(&vnet->rx_vq);
+
+    struct network_interface *netif = &vnet->netif;
+    strcpy(netif->name, "eth0");
+    netif->name[3] = (char)('0' + virtio_net_count);
+    netif->type = NET_TYPE_ETHERNET;
+    netif->mtu = ETH_MTU;
+    netif->ops = &virtio_net_ops;
+    netif->driver_data = vnet;
+    if (features & (1ULL << VIRTIO_NET_F_CSUM)) {
+        netif->features |= NETIF_F_CSUM;
+        if (features & (1ULL << VIRTIO_NET_F_HOST_TSO4)) {
+            netif->features |= NETIF_F_TSO;
+            netif->gso_max_size = VIRTIO_NET_GSO_MAX_SIZE;
+        }
+    }
+    if (features & (1ULL << VIRTIO_NET_F_MAC)) {
+        t->read_config(vdev, VIRTIO_NET_CFG_MAC, netif->mac_addr, ETH_ALEN);
+    } else {
+        // Locally administered, unique per device
+        const uint8_t mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00,
+                                        (uint8_t)(virtio_net_count + 1) };
+        memcpy(netif->mac_addr, mac, ETH_ALEN);
+    }
+
+    t->set_status(vdev, t->get_status(vdev) | VIRTIO_STATUS_DRIVER_OK);
+    virtqueue_kick(vdev, &vnet->rx_vq);
+
+    if (netif_register(netif) != NET_SUCCESS) {
+        early_print("virtio-net: failed to register interface\n");
+        t->set_status(vdev, VIRTIO_STATUS_FAILED);
+        virtio_net_free(vnet);
+        return -1;
+    }
+    virtio_net_count++;
+    vdev->driver_data = vnet;
+
+    // The first interface gets QEMU's user networking addresses
+    if (virtio_net_count == 1) {
+        netif_set_ip(netif, inet_addr("10.0.2.15"), inet_addr("255.255.255.0"),
+                     inet_addr("10.0.2.2"));
+    }
+    netif_up(netif);
+
+    // Reception is polled on each stack tick until an interrupt arrives
+    if (request_shared_irq(vdev->irq, virtio_net_interrupt, vnet, netif->name) == 0) {
+        vdev->irq_registered = 1;
+        enable_irq(vdev->irq);
+    }
+
+    early_print("virtio-net: ");
+    early_print(netif->name);
+    early_print(" attached via ");
+    early_print(t->name);
+    if (netif->features & NETIF_F_TSO) {
+        early_print(" (checksum and TSO offload)");
+    } else if (netif->features & NETIF_F_CSUM) {
+        early_print(" (checksum offload)");
+    }
+    early_print("\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * MiniOS Virtio PCI Transport
+ * Legacy I/O port interface for x86-64
+ *
+ * QEMU's virtio PCI devices are transitional by default: BAR0 is an I/O
+ * window with the legacy register layout, which needs no capability
+ * parsing. Only the low 32 feature bits exist on this interface.
+ */
+
+#include "virtio.h"
+#include "pci.h"
+#include "memory.h"
+#include "kernel.h"
+
+#ifdef ARCH_X86_64
+
+#define VIRTIO_PCI_VENDOR           0x1AF4
+#define VIRTIO_PCI_LEGACY_FIRST     0x1000  // Transitional device IDs
+#define VIRTIO_PCI_LEGACY_LAST      0x103F
+
+#define VIRTIO_PCI_HOST_FEATURES    0x00
+#define VIRTIO_PCI_GUEST_FEATURES   0x04
+#define VIRTIO_PCI_QUEUE_PFN        0x08
+#define VIRTIO_PCI_QUEUE_NUM        0x0C
+#define VIRTIO_PCI_QUEUE_SEL        0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10
+#define VIRTIO_PCI_STATUS           0x12
+#define VIRTIO_PCI_ISR              0x13    // Reading acknowledges
+#define VIRTIO_PCI_CONFIG           0x14    // Device config, no MSI-X
+
+#define VIRTIO_PCI_MAX_DEVICES      8
+
+static struct virtio_device pci_devices[VIRTIO_PCI_MAX_DEVICES];
+static int pci_device_count = 0;
+
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void outw(uint16_t port, uint16_t value) {
+    __asm__ volatile("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t value;
+    __asm__ volatile("inw %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline uint16_t pci_port(struct virtio_device *vdev, uint32_t offset)
+{
+    return (uint16_t)(vdev->base + offset);
+}
+
+static uint64_t pci_get_features(struct virtio_device *vdev)
+{
+    return inl(pci_port(vdev, VIRTIO_PCI_HOST_FEATURES));
+}
+
+static int pci_set_features(struct virtio_device *vdev, uint64_t features)
+{
+    if (features >> 32) {
+        return -1;  // Not expressible on the legacy interface
+    }
+    outl(pci_port(vdev, VIRTIO_PCI_GUEST_FEATURES), (uint32_t)features);
+    return 0;
+}
+
+static uint8_t pci_get_status(struct virtio_device *vdev)
+{
+    return inb(pci_port(vdev, VIRTIO_PCI_STATUS));
+}
+
+static void pci_set_status(struct virtio_device *vdev, uint8_t status)
+{
+    outb(pci_port(vdev, VIRTIO_PCI_STATUS), status);
+}
+
+static void pci_read_config(struct virtio_device *vdev, uint32_t offset, void *buf, uint32_t len)
+{
+    uint8_t *out = buf;
+    for (uint32_t i = 0; i < len; i++) {
+        out[i] = inb(pci_port(vdev, VIRTIO_PCI_CONFIG + offset + i));
+    }
+}
+
+static uint16_t pci_queue_max(struct virtio_device *vdev, uint16_t index)
+{
+    outw(pci_port(vdev, VIRTIO_PCI_QUEUE_SEL), index);
+    return inw(pci_port(vdev, VIRTIO_PCI_QUEUE_NUM));
+}
+
+static int pci_setup_queue(struct virtio_device *vdev, struct virtqueue *vq)
+{
+    // The legacy interface has no size register: the ring must be the
+    // device's full size
+    if (pci_queue_max(vdev, vq->index) != vq->size) {
+        return -1;
+    }
+    outl(pci_port(vdev, VIRTIO_PCI_QUEUE_PFN), (uint32_t)(vq->phys / PAGE_SIZE_4K));
+    return 0;
+}
+
+static void pci_notify(struct virtio_device *vdev, uint16_t index)
+{
+    outw(pci_port(vdev, VIRTIO_PCI_QUEUE_NOTIFY), index);
+}
+
+static uint32_t pci_ack_interrupt(struct virtio_device *vdev)
+{
+    return inb(pci_port(vdev, VIRTIO_PCI_ISR));
+}
+
+static const struct virtio_transport pci_transport = {
+    .name = "virtio-pci",
+    .get_features = pci_get_features,
+    .set_features = pci_set_features,
+    .get_status = pci_get_status,
+    .set_status = pci_set_status,
+    .read_config = pci_read_config,
+    .queue_max = pci_queue_max,
+    .setup_queue = pci_setup_queue,
+    .notify = pci_notify,
+    .ack_interrupt = pci_ack_interrupt,
+};
+
+static int virtio_pci_match(struct pci_device *pdev, void *context)
+{
+    (void)context;
+
+    if (pdev->vendor_id != VIRTIO_PCI_VENDOR ||
+        pdev->device_id < VIRTIO_PCI_LEGACY_FIRST || pdev->device_id > VIRTIO_PCI_LEGACY_LAST ||
+        !(pdev->bar[0] & PCI_BAR_IO)) {
+        return -1;
+    }
+    if (pci_device_count >= VIRTIO_PCI_MAX_DEVICES) {
+        return -1;
+    }
+
+    struct virtio_device *vdev = &pci_devices[pci_device_count];
+    memset(vdev, 0, sizeof(*vdev));
+    vdev->transport = &pci_transport;
+    vdev->base = pdev->bar[0] & PCI_BAR_IO_MASK;
+    vdev->device_id = pdev->subsystem_id;   // Legacy devices carry the type here
+    vdev->version = 1;
+    vdev->irq = pdev->irq_line;
+
+    pci_enable_device(pdev, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    if (virtio_attach(vdev) != 0) {
+        return -1;
+    }
+    pci_device_count++;
+    return 0;
+}
+
+int virtio_pci_probe(void)
+{
+    return pci_scan(virtio_pci_match, NULL);
+}
+
+#endif // ARCH_X86_64
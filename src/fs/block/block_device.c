@@ -6,6 +6,8 @@
 #include "block_device.h"
 #include "memory.h"
 #include "kernel.h"
+#include "spinlock.h"
+#include "format.h"
 
 // Global block device manager
 static struct block_device_manager device_manager = {
@@ -13,10 +15,8 @@ static struct block_device_manager device_manager = {
     .device_count = 0
 };
 
-// Block buffer cache (simple implementation)
-#define MAX_BUFFERS 32
-static struct block_buffer buffer_cache[MAX_BUFFERS];
-static int buffer_cache_initialized = 0;
+// Devices register from deferred init tasks, possibly on several CPUs
+static spinlock_t device_manager_lock = SPINLOCK_INIT;
 
 int block_device_init(void)
 {
@@ -42,87 +42,40 @@ int block_device_register(struct block_device *dev)
         return BLOCK_EINVAL;
     }
     
+    // Initialize statistics and the queue before anyone can find it
+    memset(dev->stats, 0, sizeof(dev->stats));
+    block_queue_init(&dev->queue);
+    
+    unsigned long flags = spin_lock_irqsave(&device_manager_lock);
+    
     // Check if device already exists
     if (block_device_find(dev->name)) {
+        spin_unlock_irqrestore(&device_manager_lock, flags);
         early_print("Block device already exists: ");
         early_print(dev->name);
         early_print("\n");
         return BLOCK_ERROR;
     }
     
-    // Add to device list
+    // Add to device list; the release store publishes the setup above
     dev->next = device_manager.devices;
-    device_manager.devices = dev;
+    __atomic_store_n(&device_manager.devices, dev, __ATOMIC_RELEASE);
     device_manager.device_count++;
     
-    // Compiler barrier to ensure list updates complete before statistics init
-    barrier();
-    
-    // Initialize statistics
-    // Using volatile fields prevents compiler from optimizing away writes
-    dev->reads = 0;
-    dev->writes = 0;
-    dev->bytes_read = 0;
-    dev->bytes_written = 0;
+    spin_unlock_irqrestore(&device_manager_lock, flags);
     
-    // Compiler barrier to ensure all initialization completes
-    barrier();
-    
-    early_print("Registered block device: ");
-    early_print(dev->name);
-    early_print(" (");
-    
-    // Print size information
+    char line[96];
     size_t total_size = (size_t)dev->num_blocks * dev->block_size;
     if (total_size >= 1024 * 1024) {
-        char size_str[32];
-        int mb = total_size / (1024 * 1024);
-        // Simple integer to string conversion
-        int pos = 0;
-        int temp = mb;
-        if (temp == 0) {
-            size_str[pos++] = '0';
-        } else {
-            char temp_str[32];
-            int temp_pos = 0;
-            while (temp > 0) {
-                temp_str[temp_pos++] = '0' + (temp % 10);
-                temp /= 10;
-            }
-            // Reverse the string
-            for (int i = temp_pos - 1; i >= 0; i--) {
-                size_str[pos++] = temp_str[i];
-            }
-        }
-        size_str[pos] = '\0';
-        early_print(size_str);
-        early_print("MB)\n");
+        snprintf(line, sizeof(line), "Registered block device: %s (%zuMB)\n",
+                 dev->name, total_size / (1024 * 1024));
     } else if (total_size >= 1024) {
-        char size_str[32];
-        int kb = total_size / 1024;
-        // Simple integer to string conversion
-        int pos = 0;
-        int temp = kb;
-        if (temp == 0) {
-            size_str[pos++] = '0';
-        } else {
-            char temp_str[32];
-            int temp_pos = 0;
-            while (temp > 0) {
-                temp_str[temp_pos++] = '0' + (temp % 10);
-                temp /= 10;
-            }
-            // Reverse the string
-            for (int i = temp_pos - 1; i >= 0; i--) {
-                size_str[pos++] = temp_str[i];
-            }
-        }
-        size_str[pos] = '\0';
-        early_print(size_str);
-        early_print("KB)\n");
+        snprintf(line, sizeof(line), "Registered block device: %s (%zuKB)\n",
+                 dev->name, total_size / 1024);
     } else {
-        early_print("small)\n");
+        snprintf(line, sizeof(line), "Registered block device: %s (small)\n", dev->name);
     }
+    early_print(line);
     
     return BLOCK_SUCCESS;
 }
@@ -133,7 +86,7 @@ struct block_device *block_device_find(const char *name)
         return NULL;
     }
     
-    struct block_device *dev = device_manager.devices;
+    struct block_device *dev = __atomic_load_n(&device_manager.devices, __ATOMIC_ACQUIRE);
     while (dev) {
         if (strcmp(dev->name, name) == 0) {
             return dev;
@@ -146,6 +99,10 @@ struct block_device *block_device_find(const char *name)
 
 int block_device_read(struct block_device *dev, uint32_t block, void *buffer)
 {
+    if (dev && dev->ops && dev->ops->submit) {
+        return block_device_read_blocks(dev, block, 1, buffer);
+    }
+
     if (!dev || !buffer || !dev->ops || !dev->ops->read_block) {
         return BLOCK_EINVAL;
     }
@@ -160,8 +117,7 @@ int block_device_read(struct block_device *dev, uint32_t block, void *buffer)
     
     int result = dev->ops->read_block(dev, block, buffer);
     if (result == BLOCK_SUCCESS) {
-        dev->reads++;
-        dev->bytes_read += dev->block_size;
+        block_device_account(dev, 0, 1);
     }
     
     return result;
@@ -169,6 +125,10 @@ int block_device_read(struct block_device *dev, uint32_t block, void *buffer)
 
 int block_device_write(struct block_device *dev, uint32_t block, const void *buffer)
 {
+    if (dev && dev->ops && dev->ops->submit) {
+        return block_device_write_blocks(dev, block, 1, buffer);
+    }
+
     if (!dev || !buffer || !dev->ops || !dev->ops->write_block) {
         return BLOCK_EINVAL;
     }
@@ -183,75 +143,220 @@ int block_device_write(struct block_device *dev, uint32_t block, const void *buf
     
     int result = dev->ops->write_block(dev, block, buffer);
     if (result == BLOCK_SUCCESS) {
-        dev->writes++;
-        dev->bytes_written += dev->block_size;
+        block_device_account(dev, 1, 1);
     }
     
     return result;
 }
 
-int block_device_read_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, void *buffer)
+/**
+ * Check a scatter/gather request and return the blocks it covers (0 if
+ * the request is invalid)
+ */
+uint32_t block_device_request_blocks(struct block_device *dev, uint32_t start_block,
+                                     const struct block_io_segment *segs, uint32_t num_segs)
 {
-    if (!dev || !buffer || count == 0) {
-        return BLOCK_EINVAL;
+    if (!dev || !dev->ops || !segs || num_segs == 0) {
+        return 0;
     }
-    
-    if (start_block + count > dev->num_blocks) {
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < num_segs; i++) {
+        if (!segs[i].buffer || segs[i].count == 0) {
+            return 0;
+        }
+        total += segs[i].count;
+    }
+
+    if (start_block >= dev->num_blocks || total > dev->num_blocks - start_block) {
+        return 0;
+    }
+    return (uint32_t)total;
+}
+
+/**
+ * Read consecutive blocks into a list of buffers on the calling thread,
+ * with as few driver calls as the driver allows; statistics are updated
+ * once per request
+ */
+static int block_execute_read(struct block_device *dev, uint32_t start_block,
+                              const struct block_io_segment *segs, uint32_t num_segs)
+{
+    uint32_t total = block_device_request_blocks(dev, start_block, segs, num_segs);
+    if (total == 0) {
         return BLOCK_EINVAL;
     }
-    
-    // Use multi-block operation if available
-    if (dev->ops->read_blocks) {
-        int result = dev->ops->read_blocks(dev, start_block, count, buffer);
-        if (result == BLOCK_SUCCESS) {
-            dev->reads += count;
-            dev->bytes_read += count * dev->block_size;
-        }
-        return result;
+
+    if (!(dev->flags & BLOCK_DEVICE_READABLE)) {
+        return BLOCK_EPERM;
     }
-    
-    // Fall back to single-block operations
-    char *buf = (char *)buffer;
-    for (uint32_t i = 0; i < count; i++) {
-        int result = block_device_read(dev, start_block + i, buf + (i * dev->block_size));
-        if (result != BLOCK_SUCCESS) {
-            return result;
+
+    int result = BLOCK_SUCCESS;
+    if (dev->ops->readv) {
+        result = dev->ops->readv(dev, start_block, segs, num_segs);
+    } else {
+        uint32_t block = start_block;
+        for (uint32_t i = 0; i < num_segs && result == BLOCK_SUCCESS; i++) {
+            if (dev->ops->read_blocks) {
+                result = dev->ops->read_blocks(dev, block, segs[i].count, segs[i].buffer);
+            } else if (dev->ops->read_block) {
+                char *buf = (char *)segs[i].buffer;
+                for (uint32_t b = 0; b < segs[i].count && result == BLOCK_SUCCESS; b++) {
+                    result = dev->ops->read_block(dev, block + b, buf + (size_t)b * dev->block_size);
+                }
+            } else {
+                result = BLOCK_EINVAL;
+            }
+            block += segs[i].count;
         }
     }
-    
-    return BLOCK_SUCCESS;
+
+    if (result == BLOCK_SUCCESS) {
+        block_device_account(dev, 0, total);
+    }
+    return result;
 }
 
-int block_device_write_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, const void *buffer)
+/**
+ * Write consecutive blocks from a list of buffers; see block_execute_read
+ */
+static int block_execute_write(struct block_device *dev, uint32_t start_block,
+                               const struct block_io_segment *segs, uint32_t num_segs)
 {
-    if (!dev || !buffer || count == 0) {
+    uint32_t total = block_device_request_blocks(dev, start_block, segs, num_segs);
+    if (total == 0) {
         return BLOCK_EINVAL;
     }
-    
-    if (start_block + count > dev->num_blocks) {
-        return BLOCK_EINVAL;
+
+    if (!(dev->flags & BLOCK_DEVICE_WRITABLE)) {
+        return BLOCK_EPERM;
     }
-    
-    // Use multi-block operation if available
-    if (dev->ops->write_blocks) {
-        int result = dev->ops->write_blocks(dev, start_block, count, buffer);
-        if (result == BLOCK_SUCCESS) {
-            dev->writes += count;
-            dev->bytes_written += count * dev->block_size;
+
+    int result = BLOCK_SUCCESS;
+    if (dev->ops->writev) {
+        result = dev->ops->writev(dev, start_block, segs, num_segs);
+    } else {
+        uint32_t block = start_block;
+        for (uint32_t i = 0; i < num_segs && result == BLOCK_SUCCESS; i++) {
+            if (dev->ops->write_blocks) {
+                result = dev->ops->write_blocks(dev, block, segs[i].count, segs[i].buffer);
+            } else if (dev->ops->write_block) {
+                const char *buf = (const char *)segs[i].buffer;
+                for (uint32_t b = 0; b < segs[i].count && result == BLOCK_SUCCESS; b++) {
+                    result = dev->ops->write_block(dev, block + b, buf + (size_t)b * dev->block_size);
+                }
+            } else {
+                result = BLOCK_EINVAL;
+            }
+            block += segs[i].count;
         }
-        return result;
     }
-    
-    // Fall back to single-block operations
-    const char *buf = (const char *)buffer;
-    for (uint32_t i = 0; i < count; i++) {
-        int result = block_device_write(dev, start_block + i, buf + (i * dev->block_size));
-        if (result != BLOCK_SUCCESS) {
-            return result;
-        }
+
+    if (result == BLOCK_SUCCESS) {
+        block_device_account(dev, 1, total);
     }
-    
-    return BLOCK_SUCCESS;
+    return result;
+}
+
+// Sum the device's counters over every CPU
+void block_device_get_stats(struct block_device *dev, struct block_device_stats *stats)
+{
+    if (!dev || !stats) {
+        return;
+    }
+
+    stats->reads = per_cpu_sum(dev->stats, reads);
+    stats->writes = per_cpu_sum(dev->stats, writes);
+    stats->bytes_read = per_cpu_sum(dev->stats, bytes_read);
+    stats->bytes_written = per_cpu_sum(dev->stats, bytes_written);
+    stats->discarded = per_cpu_sum(dev->stats, discarded);
+}
+
+/**
+ * Direct pointer to a block of a memory-backed device, or NULL when the
+ * device must be accessed through reads and writes. Only writable devices
+ * are mapped, since stores go straight to the medium.
+ */
+void *block_device_map_block(struct block_device *dev, uint32_t block)
+{
+    if (!dev || !dev->ops || !dev->ops->map_block || block >= dev->num_blocks ||
+        !(dev->flags & BLOCK_DEVICE_READABLE) || !(dev->flags & BLOCK_DEVICE_WRITABLE)) {
+        return NULL;
+    }
+    return dev->ops->map_block(dev, block);
+}
+
+/**
+ * Tell the device a range of blocks no longer holds anything needed.
+ * Cached copies are dropped unwritten. Advisory: devices without a
+ * discard op, and ranges a buffer still holds, are left alone.
+ */
+int block_device_discard(struct block_device *dev, uint32_t start_block, uint32_t count)
+{
+    if (!dev || !dev->ops || count == 0 || start_block >= dev->num_blocks ||
+        count > dev->num_blocks - start_block) {
+        return BLOCK_EINVAL;
+    }
+    if (!dev->ops->discard || !(dev->flags & BLOCK_DEVICE_WRITABLE)) {
+        return BLOCK_SUCCESS;
+    }
+
+    block_buffer_invalidate_range(dev, start_block, count);
+    if (block_buffer_range_busy(dev, start_block, count)) {
+        return BLOCK_SUCCESS;  // A mapped buffer may still point into it
+    }
+
+    int result = dev->ops->discard(dev, start_block, count);
+    if (result == BLOCK_SUCCESS) {
+        this_cpu_add(dev->stats, discarded, count);
+    }
+    return result;
+}
+
+/**
+ * Perform a transfer inline, without going through the request queue
+ */
+int block_device_execute(struct block_device *dev, int write, uint32_t start_block,
+                         const struct block_io_segment *segs, uint32_t num_segs)
+{
+    return write ? block_execute_write(dev, start_block, segs, num_segs) :
+                   block_execute_read(dev, start_block, segs, num_segs);
+}
+
+/**
+ * Read consecutive blocks into a list of buffers. Devices that complete
+ * asynchronously go through the request queue and the caller sleeps until
+ * the data is in; everything else is read inline.
+ */
+int block_device_readv(struct block_device *dev, uint32_t start_block,
+                       const struct block_io_segment *segs, uint32_t num_segs)
+{
+    if (dev && dev->ops && dev->ops->submit) {
+        return block_queue_transfer(dev, 0, start_block, segs, num_segs);
+    }
+    return block_execute_read(dev, start_block, segs, num_segs);
+}
+
+int block_device_writev(struct block_device *dev, uint32_t start_block,
+                        const struct block_io_segment *segs, uint32_t num_segs)
+{
+    if (dev && dev->ops && dev->ops->submit) {
+        return block_queue_transfer(dev, 1, start_block, segs, num_segs);
+    }
+    return block_execute_write(dev, start_block, segs, num_segs);
+}
+
+int block_device_read_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, void *buffer)
+{
+    struct block_io_segment seg = { buffer, count };
+    return block_device_readv(dev, start_block, &seg, 1);
+}
+
+int block_device_write_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, const void *buffer)
+{
+    // The segment is only read from on this path
+    struct block_io_segment seg = { (void *)(uintptr_t)buffer, count };
+    return block_device_writev(dev, start_block, &seg, 1);
 }
 
 int block_device_sync(struct block_device *dev)
@@ -260,6 +365,12 @@ int block_device_sync(struct block_device *dev)
         return BLOCK_EINVAL;
     }
     
+    // Cached writes have to reach the device before it is flushed
+    int result = block_buffer_sync_device(dev);
+    if (result != BLOCK_SUCCESS) {
+        return result;
+    }
+    
     if (dev->ops->sync) {
         return dev->ops->sync(dev);
     }
@@ -290,176 +401,32 @@ void block_device_list_all(void)
 {
     early_print("Block devices:\n");
     
-    struct block_device *dev = device_manager.devices;
+    struct block_device *dev = __atomic_load_n(&device_manager.devices, __ATOMIC_ACQUIRE);
     if (!dev) {
         early_print("  No devices registered\n");
         return;
     }
     
     while (dev) {
-        early_print("  ");
-        early_print(dev->name);
-        early_print(": ");
-        
-        // Print device info
+        char line[96];
         size_t total_size = block_device_get_size(dev);
-        if (total_size >= 1024 * 1024) {
-            char size_str[32];
-            int mb = total_size / (1024 * 1024);
-            // Convert to string (simplified)
-            int pos = 0;
-            if (mb == 0) {
-                size_str[pos++] = '0';
-            } else {
-                char temp[32];
-                int temp_pos = 0;
-                while (mb > 0) {
-                    temp[temp_pos++] = '0' + (mb % 10);
-                    mb /= 10;
-                }
-                for (int i = temp_pos - 1; i >= 0; i--) {
-                    size_str[pos++] = temp[i];
-                }
-            }
-            size_str[pos] = '\0';
-            early_print(size_str);
-            early_print("MB");
-        } else {
-            char size_str[32];
-            int kb = total_size / 1024;
-            // Convert to string (simplified)
-            int pos = 0;
-            if (kb == 0) {
-                size_str[pos++] = '0';
-            } else {
-                char temp[32];
-                int temp_pos = 0;
-                while (kb > 0) {
-                    temp[temp_pos++] = '0' + (kb % 10);
-                    kb /= 10;
-                }
-                for (int i = temp_pos - 1; i >= 0; i--) {
-                    size_str[pos++] = temp[i];
-                }
-            }
-            size_str[pos] = '\0';
-            early_print(size_str);
-            early_print("KB");
+        int big = total_size >= 1024 * 1024;
+        snprintf(line, sizeof(line), "  %s: %zu%s%s%s\n", dev->name,
+                 big ? total_size / (1024 * 1024) : total_size / 1024, big ? "MB" : "KB",
+                 (dev->flags & BLOCK_DEVICE_READABLE) ? " R" : "",
+                 (dev->flags & BLOCK_DEVICE_WRITABLE) ? "W" : "");
+        early_print(line);
+        snprintf(line, sizeof(line), "    %llu blocks read, %llu written\n",
+                 (unsigned long long)per_cpu_sum(dev->stats, reads),
+                 (unsigned long long)per_cpu_sum(dev->stats, writes));
+        early_print(line);
+        if (dev->device_type == BLOCK_DEVICE_RAM) {
+            snprintf(line, sizeof(line), "    %zuKB resident, %llu blocks discarded\n",
+                     ramdisk_resident_size(dev) / 1024,
+                     (unsigned long long)per_cpu_sum(dev->stats, discarded));
+            early_print(line);
         }
         
-        if (dev->flags & BLOCK_DEVICE_READABLE) early_print(" R");
-        if (dev->flags & BLOCK_DEVICE_WRITABLE) early_print("W");
-        early_print("\n");
-        
         dev = dev->next;
     }
 }
-
-// Simple block buffer implementation
-int block_buffer_init(void)
-{
-    if (buffer_cache_initialized) {
-        return BLOCK_SUCCESS;
-    }
-    
-    // Initialize buffer cache
-    for (int i = 0; i < MAX_BUFFERS; i++) {
-        buffer_cache[i].device = NULL;
-        buffer_cache[i].block_num = 0;
-        buffer_cache[i].data = NULL;
-        buffer_cache[i].dirty = 0;
-        buffer_cache[i].ref_count = 0;
-        buffer_cache[i].next = NULL;
-    }
-    
-    buffer_cache_initialized = 1;
-    return BLOCK_SUCCESS;
-}
-
-struct block_buffer *block_buffer_get(struct block_device *dev, uint32_t block)
-{
-    if (!dev || !buffer_cache_initialized) {
-        return NULL;
-    }
-    
-    // Simple implementation: find unused buffer
-    for (int i = 0; i < MAX_BUFFERS; i++) {
-        if (buffer_cache[i].ref_count == 0) {
-            buffer_cache[i].device = dev;
-            buffer_cache[i].block_num = block;
-            buffer_cache[i].dirty = 0;
-            buffer_cache[i].ref_count = 1;
-            
-            // Allocate data buffer if needed
-            if (!buffer_cache[i].data) {
-                buffer_cache[i].data = kmalloc(dev->block_size);
-                if (!buffer_cache[i].data) {
-                    return NULL;
-                }
-            }
-            
-            // Read block data
-            if (block_device_read(dev, block, buffer_cache[i].data) != BLOCK_SUCCESS) {
-                buffer_cache[i].ref_count = 0;
-                return NULL;
-            }
-            
-            return &buffer_cache[i];
-        }
-    }
-    
-    return NULL; // No free buffers
-}
-
-int block_buffer_put(struct block_buffer *buf)
-{
-    if (!buf) {
-        return BLOCK_EINVAL;
-    }
-    
-    if (buf->ref_count > 0) {
-        buf->ref_count--;
-        
-        // Sync if dirty and no more references
-        if (buf->ref_count == 0 && buf->dirty) {
-            return block_buffer_sync(buf);
-        }
-    }
-    
-    return BLOCK_SUCCESS;
-}
-
-int block_buffer_sync(struct block_buffer *buf)
-{
-    if (!buf || !buf->device || !buf->data) {
-        return BLOCK_EINVAL;
-    }
-    
-    if (buf->dirty) {
-        int result = block_device_write(buf->device, buf->block_num, buf->data);
-        if (result == BLOCK_SUCCESS) {
-            buf->dirty = 0;
-        }
-        return result;
-    }
-    
-    return BLOCK_SUCCESS;
-}
-
-int block_buffer_sync_all(void)
-{
-    if (!buffer_cache_initialized) {
-        return BLOCK_SUCCESS;
-    }
-    
-    for (int i = 0; i < MAX_BUFFERS; i++) {
-        if (buffer_cache[i].ref_count > 0 && buffer_cache[i].dirty) {
-            int result = block_buffer_sync(&buffer_cache[i]);
-            if (result != BLOCK_SUCCESS) {
-                return result;
-            }
-        }
-    }
-    
-    return BLOCK_SUCCESS;
-}
\ No newline at end of file
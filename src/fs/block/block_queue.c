@@ -0,0 +1,290 @@
+/*
+ * MiniOS Block Request Queue
+ * Asynchronous submission, elevator ordering and completion callbacks
+ *
+ * block_submit() queues a request and returns; the caller either sleeps in
+ * block_request_wait() or gets its done callback. For drivers with a submit
+ * operation the queue keeps pending requests sorted by block, issues them
+ * in one sweep direction (C-LOOK) and folds adjacent same-direction
+ * requests into a single scatter/gather dispatch. The driver reports the
+ * end of a dispatch with block_queue_complete(), normally from its
+ * interrupt handler, which wakes the waiters and starts the next one.
+ * Drivers without submit (the RAM disk) complete each request inline.
+ */
+
+#include "block_device.h"
+#include "interrupt.h"
+#include "process.h"
+#include "kernel.h"
+#include "trace.h"
+
+void block_queue_init(struct block_queue *queue)
+{
+    if (!queue) {
+        return;
+    }
+
+    queue->pending = NULL;
+    queue->active = NULL;
+    queue->head_pos = 0;
+    queue->depth = 0;
+    queue->dispatch_count = 0;
+    queue->irq_driven = 0;
+    queue->submitted = 0;
+    queue->merged = 0;
+    queue->dispatched = 0;
+    queue->completed = 0;
+}
+
+/**
+ * Finish one request. The request must not be touched once completed is
+ * set: a waiter may return and release it straight away.
+ */
+static void request_finish(struct block_request *req, int status)
+{
+    struct block_device *dev = req->dev;
+    struct task *waiter = req->waiter;
+    block_request_done_t done = req->done;
+
+    if (status == BLOCK_SUCCESS && dev->ops->submit) {
+        block_device_account(dev, req->write, req->count);
+    }
+    dev->queue.completed++;
+    trace_event(TRACE_BLOCK_COMPLETE, (uintptr_t)req, (int64_t)status, 0);
+
+    req->status = status;
+    req->next = NULL;
+    __asm__ volatile("" ::: "memory");
+    req->completed = 1;
+
+    if (waiter) {
+        scheduler_wake_task(waiter);
+    }
+    if (done) {
+        done(req);
+    }
+}
+
+/**
+ * Insert a request into the pending list in start block order; requests
+ * for the same block keep their submission order
+ */
+static void queue_insert(struct block_queue *queue, struct block_request *req)
+{
+    struct block_request **link = &queue->pending;
+    while (*link && (*link)->start_block <= req->start_block) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link = req;
+    queue->depth++;
+}
+
+/**
+ * Pick the next request to dispatch: the first at or past the head
+ * position, wrapping to the lowest block when the sweep is done
+ */
+static struct block_request **queue_pick(struct block_queue *queue)
+{
+    struct block_request **link = &queue->pending;
+    while (*link && (*link)->start_block < queue->head_pos) {
+        link = &(*link)->next;
+    }
+    return *link ? link : &queue->pending;
+}
+
+/**
+ * Start the next batch if the device is idle. Called with interrupts
+ * disabled.
+ */
+static void queue_dispatch(struct block_device *dev)
+{
+    struct block_queue *queue = &dev->queue;
+
+    while (!queue->active && queue->pending) {
+        struct block_request **link = queue_pick(queue);
+        struct block_request *first = *link;
+        struct block_request *last = first;
+        uint32_t nsegs = 0;
+        uint32_t end = first->start_block + first->count;
+
+        // Take the request and any followers that continue it in the same
+        // direction, as long as their segments fit one dispatch
+        *link = first->next;
+        queue->depth--;
+        for (uint32_t i = 0; i < first->num_segs; i++) {
+            queue->dispatch_segs[nsegs].buffer = first->segs[i].buffer;
+            queue->dispatch_segs[nsegs].count = first->segs[i].count;
+            nsegs++;
+        }
+
+        while (*link && (*link)->write == first->write && (*link)->start_block == end &&
+               nsegs + (*link)->num_segs <= BLOCK_IO_MAX_SEGMENTS) {
+            struct block_request *req = *link;
+            *link = req->next;
+            queue->depth--;
+            for (uint32_t i = 0; i < req->num_segs; i++) {
+                queue->dispatch_segs[nsegs].buffer = req->segs[i].buffer;
+                queue->dispatch_segs[nsegs].count = req->segs[i].count;
+                nsegs++;
+            }
+            last->next = req;
+            last = req;
+            end += req->count;
+            queue->merged++;
+        }
+        last->next = NULL;
+
+        queue->active = first;
+        queue->dispatch_count = end - first->start_block;
+        queue->head_pos = end;
+        queue->dispatched++;
+
+        int result = dev->ops->submit(dev, first->write, first->start_block,
+                                      queue->dispatch_segs, nsegs);
+        if (result != BLOCK_SUCCESS) {
+            // The driver refused the batch: fail it now and try the next one
+            queue->active = NULL;
+            while (first) {
+                struct block_request *next = first->next;
+                request_finish(first, result);
+                first = next;
+            }
+        }
+    }
+}
+
+/**
+ * Queue a request. Returns an error without queueing if the request is
+ * invalid; otherwise the request completes later (or, for devices without
+ * a submit operation, before this returns).
+ */
+int block_submit(struct block_request *req)
+{
+    if (!req) {
+        return BLOCK_EINVAL;
+    }
+
+    struct block_device *dev = req->dev;
+    uint32_t count = block_device_request_blocks(dev, req->start_block, req->segs, req->num_segs);
+    if (count == 0) {
+        return BLOCK_EINVAL;
+    }
+    if (!(dev->flags & (req->write ? BLOCK_DEVICE_WRITABLE : BLOCK_DEVICE_READABLE))) {
+        return BLOCK_EPERM;
+    }
+
+    req->count = count;
+    req->status = BLOCK_SUCCESS;
+    req->completed = 0;
+    req->waiter = NULL;
+    req->next = NULL;
+    dev->queue.submitted++;
+    trace_event(TRACE_BLOCK_SUBMIT, (uintptr_t)req, req->start_block,
+                count | ((uint32_t)(req->write ? 1 : 0) << 31));
+
+    if (!dev->ops->submit) {
+        // Synchronous driver: the transfer is done by the time it returns
+        int result = block_device_execute(dev, req->write, req->start_block,
+                                          req->segs, req->num_segs);
+        unsigned long flags = disable_interrupts();
+        dev->queue.dispatched++;
+        request_finish(req, result);
+        restore_interrupts(flags);
+        return BLOCK_SUCCESS;
+    }
+
+    unsigned long flags = disable_interrupts();
+    queue_insert(&dev->queue, req);
+    queue_dispatch(dev);
+    restore_interrupts(flags);
+
+    return BLOCK_SUCCESS;
+}
+
+/**
+ * Called by a driver when its outstanding dispatch has finished
+ */
+void block_queue_complete(struct block_device *dev, int status)
+{
+    if (!dev) {
+        return;
+    }
+
+    unsigned long flags = disable_interrupts();
+
+    struct block_request *req = dev->queue.active;
+    dev->queue.active = NULL;
+    dev->queue.dispatch_count = 0;
+    while (req) {
+        struct block_request *next = req->next;
+        request_finish(req, status);
+        req = next;
+    }
+
+    queue_dispatch(dev);
+    restore_interrupts(flags);
+}
+
+/**
+ * Wait for a submitted request and return its status. A task sleeps until
+ * the completion wakes it; a driver whose interrupts have not been seen
+ * yet, or a caller without a task, polls instead.
+ */
+int block_request_wait(struct block_request *req)
+{
+    if (!req || !req->dev) {
+        return BLOCK_EINVAL;
+    }
+
+    struct block_device *dev = req->dev;
+
+    while (!req->completed) {
+        struct task *task = scheduler_get_current_task();
+        if (task && (dev->queue.irq_driven || !dev->ops->poll)) {
+            unsigned long flags = disable_interrupts();
+            if (!req->completed) {
+                req->waiter = task;
+                task->state = TASK_STATE_BLOCKED;
+            }
+            restore_interrupts(flags);
+            scheduler_schedule();
+        } else if (dev->ops->poll) {
+            dev->ops->poll(dev);
+        } else {
+            __asm__ volatile("" ::: "memory");
+        }
+    }
+
+    // If nothing else was runnable we never switched away
+    struct task *task = scheduler_get_current_task();
+    if (task && task->state == TASK_STATE_READY) {
+        task->state = TASK_STATE_RUNNING;
+    }
+
+    __asm__ volatile("" ::: "memory");
+    return req->status;
+}
+
+/**
+ * Submit a request on the caller's behalf and wait for it
+ */
+int block_queue_transfer(struct block_device *dev, int write, uint32_t start_block,
+                         const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct block_request req;
+
+    req.dev = dev;
+    req.write = write;
+    req.start_block = start_block;
+    req.segs = segs;
+    req.num_segs = num_segs;
+    req.done = NULL;
+    req.private_data = NULL;
+
+    int result = block_submit(&req);
+    if (result != BLOCK_SUCCESS) {
+        return result;
+    }
+    return block_request_wait(&req);
+}
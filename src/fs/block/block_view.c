@@ -0,0 +1,282 @@
+/*
+ * MiniOS Block Device Views
+ *
+ * A view presents a device in blocks of another power-of-two size, so a
+ * file system can pick its block size independently of the hardware.
+ * Larger view blocks are whole runs of device blocks and map straight
+ * onto them. Smaller ones share a device block: whole device blocks
+ * still go straight through, the rest are read into a bounce block and,
+ * for writes, patched and written back under the view's lock.
+ *
+ * Views are private to their user and not registered; they have their
+ * own buffer cache entries and statistics.
+ */
+
+#include "block_device.h"
+#include "memory.h"
+#include "kernel.h"
+#include "format.h"
+#include "sleeplock.h"
+
+struct block_view {
+    struct block_device *lower;             // Device underneath
+    uint32_t shift;                         // log2 of the size ratio
+    int split;                              // View blocks are smaller than device blocks
+    struct mutex lock;                      // Bounce block and read-modify-write
+    uint8_t *bounce;                        // One device block, split views only
+};
+
+static int block_view_readv(struct block_device *dev, uint32_t start_block,
+                            const struct block_io_segment *segs, uint32_t num_segs);
+static int block_view_writev(struct block_device *dev, uint32_t start_block,
+                             const struct block_io_segment *segs, uint32_t num_segs);
+static int block_view_sync(struct block_device *dev);
+static void *block_view_map_block(struct block_device *dev, uint32_t block);
+static int block_view_discard(struct block_device *dev, uint32_t start_block, uint32_t count);
+
+static struct block_device_operations block_view_ops = {
+    .readv = block_view_readv,
+    .writev = block_view_writev,
+    .sync = block_view_sync,
+    .ioctl = NULL,
+    .map_block = block_view_map_block,
+    .discard = block_view_discard
+};
+
+static uint32_t block_view_log2(uint32_t value)
+{
+    uint32_t shift = 0;
+    while ((1u << shift) < value) {
+        shift++;
+    }
+    return shift;
+}
+
+/**
+ * Create a view of lower with block_size-byte blocks. Both sizes must be
+ * powers of two no smaller than 512 bytes.
+ */
+struct block_device *block_view_create(struct block_device *lower, uint32_t block_size)
+{
+    if (!lower || !lower->ops || block_size < BLOCK_SIZE_512 ||
+        (block_size & (block_size - 1)) || lower->block_size < BLOCK_SIZE_512 ||
+        (lower->block_size & (lower->block_size - 1))) {
+        return NULL;
+    }
+
+    int split = block_size < lower->block_size;
+    uint32_t shift = split ? block_view_log2(lower->block_size / block_size) :
+                             block_view_log2(block_size / lower->block_size);
+    uint64_t num_blocks = split ? (uint64_t)lower->num_blocks << shift :
+                                  lower->num_blocks >> shift;
+    if (num_blocks == 0 || num_blocks > UINT32_MAX) {
+        return NULL;
+    }
+
+    // Cache-line aligned, as the per-CPU counters expect
+    struct block_device *dev = kmalloc_aligned(sizeof(struct block_device), CACHE_LINE_SIZE);
+    struct block_view *view = kmalloc(sizeof(struct block_view));
+    uint8_t *bounce = split ? kmalloc(lower->block_size) : NULL;
+    if (!dev || !view || (split && !bounce)) {
+        if (bounce) {
+            kfree(bounce);
+        }
+        if (view) {
+            kfree(view);
+        }
+        if (dev) {
+            kfree(dev);
+        }
+        return NULL;
+    }
+
+    view->lower = lower;
+    view->shift = shift;
+    view->split = split;
+    view->bounce = bounce;
+    mutex_init(&view->lock);
+
+    memset(dev, 0, sizeof(struct block_device));
+    snprintf(dev->name, sizeof(dev->name), "%s@%u", lower->name, block_size);
+    dev->device_type = lower->device_type;
+    dev->block_size = block_size;
+    dev->num_blocks = (uint32_t)num_blocks;
+    dev->flags = lower->flags;
+    dev->ops = &block_view_ops;
+    dev->private_data = view;
+    block_queue_init(&dev->queue);
+    return dev;
+}
+
+/**
+ * Write back what the view has cached and free it; the device underneath
+ * is left as it is
+ */
+void block_view_destroy(struct block_device *dev)
+{
+    if (!dev || dev->ops != &block_view_ops) {
+        return;
+    }
+
+    block_buffer_sync_device(dev);
+    block_buffer_invalidate_device(dev);
+
+    struct block_view *view = (struct block_view *)dev->private_data;
+    if (view->bounce) {
+        kfree(view->bounce);
+    }
+    kfree(view);
+    kfree(dev);
+}
+
+// The device a view lies over, NULL if dev is not a view
+struct block_device *block_view_lower(const struct block_device *dev)
+{
+    if (!dev || dev->ops != &block_view_ops) {
+        return NULL;
+    }
+    return ((const struct block_view *)dev->private_data)->lower;
+}
+
+/**
+ * Larger view blocks: the same buffers, counted in device blocks. A
+ * segment keeps its place, so the request splits only at the segment
+ * limit.
+ */
+static int block_view_transfer_runs(struct block_view *view, int write, uint32_t start_block,
+                                    const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct block_io_segment lower_segs[BLOCK_IO_MAX_SEGMENTS];
+    uint32_t block = start_block << view->shift;
+
+    for (uint32_t done = 0; done < num_segs; ) {
+        uint32_t n = num_segs - done;
+        if (n > BLOCK_IO_MAX_SEGMENTS) {
+            n = BLOCK_IO_MAX_SEGMENTS;
+        }
+        uint32_t blocks = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            lower_segs[i].buffer = segs[done + i].buffer;
+            lower_segs[i].count = segs[done + i].count << view->shift;
+            blocks += lower_segs[i].count;
+        }
+        int result = write ? block_device_writev(view->lower, block, lower_segs, n) :
+                             block_device_readv(view->lower, block, lower_segs, n);
+        if (result != BLOCK_SUCCESS) {
+            return result;
+        }
+        block += blocks;
+        done += n;
+    }
+    return BLOCK_SUCCESS;
+}
+
+/**
+ * Smaller view blocks: runs covering whole device blocks go straight
+ * through; a view block sharing its device block with ones outside the
+ * run goes through the bounce block. Runs are taken per segment, since
+ * only within one is the memory contiguous.
+ */
+static int block_view_transfer_split(struct block_view *view, int write, uint32_t start_block,
+                                     const struct block_io_segment *segs, uint32_t num_segs)
+{
+    uint32_t ratio = 1u << view->shift;
+    uint32_t size = view->lower->block_size >> view->shift;
+    uint32_t block = start_block;
+    int result = BLOCK_SUCCESS;
+
+    for (uint32_t s = 0; s < num_segs && result == BLOCK_SUCCESS; s++) {
+        uint8_t *buffer = (uint8_t *)segs[s].buffer;
+        uint32_t left = segs[s].count;
+        while (left > 0 && result == BLOCK_SUCCESS) {
+            uint32_t lower_block = block >> view->shift;
+            uint32_t first = block & (ratio - 1);
+            uint32_t count;
+
+            if (first == 0 && left >= ratio) {
+                uint32_t whole = left >> view->shift;
+                count = whole << view->shift;
+                result = write ? block_device_write_blocks(view->lower, lower_block, whole, buffer) :
+                                 block_device_read_blocks(view->lower, lower_block, whole, buffer);
+            } else {
+                count = ratio - first;
+                if (count > left) {
+                    count = left;
+                }
+                uint8_t *part = view->bounce + (size_t)first * size;
+                mutex_lock(&view->lock);
+                result = block_device_read(view->lower, lower_block, view->bounce);
+                if (result == BLOCK_SUCCESS && write) {
+                    memcpy(part, buffer, (size_t)count * size);
+                    result = block_device_write(view->lower, lower_block, view->bounce);
+                } else if (result == BLOCK_SUCCESS) {
+                    memcpy(buffer, part, (size_t)count * size);
+                }
+                mutex_unlock(&view->lock);
+            }
+
+            buffer += (size_t)count * size;
+            block += count;
+            left -= count;
+        }
+    }
+    return result;
+}
+
+// Requests are bounds-checked by block_device_readv/writev
+static int block_view_readv(struct block_device *dev, uint32_t start_block,
+                            const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct block_view *view = (struct block_view *)dev->private_data;
+    return view->split ? block_view_transfer_split(view, 0, start_block, segs, num_segs) :
+                         block_view_transfer_runs(view, 0, start_block, segs, num_segs);
+}
+
+static int block_view_writev(struct block_device *dev, uint32_t start_block,
+                             const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct block_view *view = (struct block_view *)dev->private_data;
+    return view->split ? block_view_transfer_split(view, 1, start_block, segs, num_segs) :
+                         block_view_transfer_runs(view, 1, start_block, segs, num_segs);
+}
+
+// The view's own cached blocks were written back by block_device_sync
+static int block_view_sync(struct block_device *dev)
+{
+    struct block_view *view = (struct block_view *)dev->private_data;
+    return block_device_sync(view->lower);
+}
+
+// Only smaller blocks can be mapped: larger ones need not be contiguous
+static void *block_view_map_block(struct block_device *dev, uint32_t block)
+{
+    struct block_view *view = (struct block_view *)dev->private_data;
+    if (!view->split) {
+        return view->shift == 0 ? block_device_map_block(view->lower, block) : NULL;
+    }
+
+    uint8_t *lower = block_device_map_block(view->lower, block >> view->shift);
+    if (!lower) {
+        return NULL;
+    }
+    uint32_t size = view->lower->block_size >> view->shift;
+    return lower + (size_t)(block & ((1u << view->shift) - 1)) * size;
+}
+
+// Device blocks are discarded only when the range covers them whole
+static int block_view_discard(struct block_device *dev, uint32_t start_block, uint32_t count)
+{
+    struct block_view *view = (struct block_view *)dev->private_data;
+    if (!view->split) {
+        return block_device_discard(view->lower, start_block << view->shift,
+                                    count << view->shift);
+    }
+
+    uint32_t ratio = 1u << view->shift;
+    uint32_t first = (start_block + ratio - 1) >> view->shift;
+    uint32_t end = (start_block + count) >> view->shift;
+    if (end <= first) {
+        return BLOCK_SUCCESS;
+    }
+    return block_device_discard(view->lower, first, end - first);
+}
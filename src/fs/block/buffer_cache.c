@@ -0,0 +1,703 @@
+/*
+ * MiniOS Block Buffer Cache
+ * Hash-indexed block cache with LRU eviction and write-back
+ *
+ * Buffers are looked up by (device, block) in a fixed hash table. Writes
+ * only mark a buffer dirty; it reaches the device when it is evicted,
+ * synced, or its device is synced. Only unreferenced buffers are evicted.
+ * Syncs write dirty buffers in block order, one scatter/gather request
+ * per run of adjacent blocks.
+ *
+ * The hash buckets are split into BLOCK_BUFFER_LOCKS stripes, each with a
+ * spinlock and an LRU list of its own, most recently used at the head, so
+ * lookups of unrelated blocks on different CPUs do not meet. A stripe
+ * lock covers its buckets, its list and the reference counts and dirty
+ * flags of its buffers; it is never held across I/O. Buffers being read
+ * are filled before they are inserted, and a buffer being written is
+ * referenced meanwhile and marked clean before the write, so a store
+ * racing with it dirties it again. Capacity is shared: a miss over it
+ * evicts from its own stripe first, then from the others.
+ *
+ * On memory-backed devices (the RAM disk) a buffer's data points at the
+ * device's own copy of the block: nothing is read on a miss and write-back
+ * only clears the dirty flag.
+ *
+ * Under memory pressure the reclaimer frees clean, unreferenced buffers
+ * with data of their own, least recently used first.
+ */
+
+#include "block_device.h"
+#include "memory.h"
+#include "kernel.h"
+#include "percpu.h"
+#include "spinlock.h"
+
+_Static_assert(BLOCK_BUFFER_HASH_BUCKETS % BLOCK_BUFFER_LOCKS == 0,
+               "buffer lock stripes must divide the hash buckets");
+
+struct buffer_stripe {
+    spinlock_t lock;
+    struct block_buffer *lru_head;         // Most recently used
+    struct block_buffer *lru_tail;         // Eviction candidate end
+} __cacheline_aligned;
+
+static struct block_buffer *buffer_hash[BLOCK_BUFFER_HASH_BUCKETS];
+static struct buffer_stripe buffer_stripes[BLOCK_BUFFER_LOCKS];
+static int buffer_cache_initialized = 0;
+
+static uint32_t buffer_capacity = BLOCK_BUFFER_DEFAULT_CAPACITY;
+static uint32_t buffer_count = 0;          // Atomic, across stripes
+
+// Statistics, per CPU as every lookup bumps them
+struct buffer_cache_counts {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+};
+static DEFINE_PER_CPU(struct buffer_cache_counts, buffer_counts);
+
+static inline uint32_t buffer_hash_index(const struct block_device *dev, uint32_t block)
+{
+    uint64_t key = ((uint64_t)(uintptr_t)dev >> 4) ^ ((uint64_t)block * 0x9E3779B97F4A7C15ULL);
+    return (uint32_t)(key >> 32) & (BLOCK_BUFFER_HASH_BUCKETS - 1);
+}
+
+static inline struct buffer_stripe *buffer_stripe_of(const struct block_device *dev, uint32_t block)
+{
+    return &buffer_stripes[buffer_hash_index(dev, block) % BLOCK_BUFFER_LOCKS];
+}
+
+static void lru_remove(struct buffer_stripe *stripe, struct block_buffer *buf)
+{
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    } else {
+        stripe->lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    } else {
+        stripe->lru_tail = buf->lru_prev;
+    }
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+}
+
+static void lru_push_front(struct buffer_stripe *stripe, struct block_buffer *buf)
+{
+    buf->lru_prev = NULL;
+    buf->lru_next = stripe->lru_head;
+    if (stripe->lru_head) {
+        stripe->lru_head->lru_prev = buf;
+    }
+    stripe->lru_head = buf;
+    if (!stripe->lru_tail) {
+        stripe->lru_tail = buf;
+    }
+}
+
+static void hash_remove(struct block_buffer *buf)
+{
+    struct block_buffer **link = &buffer_hash[buffer_hash_index(buf->device, buf->block_num)];
+    while (*link) {
+        if (*link == buf) {
+            *link = buf->next;
+            buf->next = NULL;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+static struct block_buffer *hash_lookup(struct block_device *dev, uint32_t block)
+{
+    struct block_buffer *buf = buffer_hash[buffer_hash_index(dev, block)];
+    while (buf && (buf->device != dev || buf->block_num != block)) {
+        buf = buf->next;
+    }
+    return buf;
+}
+
+static inline int buffer_in_range(const struct block_buffer *buf, struct block_device *dev,
+                                  uint32_t start, uint32_t count)
+{
+    return (!dev || buf->device == dev) &&
+           buf->block_num >= start && buf->block_num - start < count;
+}
+
+// Free a buffer's memory once it is out of the cache
+static void buffer_free(struct block_buffer *buf)
+{
+    if (!buf->mapped) {
+        kfree(buf->data);
+    }
+    kfree(buf);
+}
+
+// Take an unreferenced buffer out of its stripe (locked) and free it
+static void buffer_destroy(struct buffer_stripe *stripe, struct block_buffer *buf)
+{
+    hash_remove(buf);
+    lru_remove(stripe, buf);
+    __atomic_sub_fetch(&buffer_count, 1, __ATOMIC_RELAXED);
+    buffer_free(buf);
+}
+
+/**
+ * Start writing a dirty buffer back (locked): reference it and mark it
+ * clean. Returns 1 when the caller is to write it once unlocked, 0 when
+ * there is nothing to write.
+ */
+static int buffer_write_begin(struct block_buffer *buf)
+{
+    if (!buf->dirty) {
+        return 0;
+    }
+    buf->dirty = 0;
+    if (buf->mapped) {
+        return 0;  // Stores already reached the device
+    }
+    buf->ref_count++;
+    return 1;
+}
+
+// Finish a write from buffer_write_begin() (locked); a failed one stays dirty
+static void buffer_write_end(struct block_buffer *buf, int result)
+{
+    if (result != BLOCK_SUCCESS) {
+        buf->dirty = 1;
+    }
+    buf->ref_count--;
+}
+
+/**
+ * Evict the least recently used unreferenced buffer of a stripe, writing
+ * it back first if dirty. Returns 0 when nothing could be evicted.
+ */
+static int buffer_evict_from(struct buffer_stripe *stripe)
+{
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+
+    struct block_buffer *buf = stripe->lru_tail;
+    while (buf) {
+        if (buf->ref_count > 0) {
+            buf = buf->lru_prev;
+            continue;
+        }
+
+        if (buffer_write_begin(buf)) {
+            spin_unlock_irqrestore(&stripe->lock, flags);
+            int result = block_device_write(buf->device, buf->block_num, buf->data);
+            flags = spin_lock_irqsave(&stripe->lock);
+            buffer_write_end(buf, result);
+            if (result == BLOCK_SUCCESS) {
+                this_cpu_inc(buffer_counts, writebacks);
+            }
+
+            // Used or dirtied again meanwhile, or the data could not be written
+            if (buf->ref_count > 0 || buf->dirty) {
+                buf = buf->lru_prev;
+                continue;
+            }
+        }
+
+        buffer_destroy(stripe, buf);
+        spin_unlock_irqrestore(&stripe->lock, flags);
+        this_cpu_inc(buffer_counts, evictions);
+        return 1;
+    }
+
+    spin_unlock_irqrestore(&stripe->lock, flags);
+    return 0;
+}
+
+// Evict one buffer, from the given stripe if it has one to spare
+static int buffer_evict_one(struct buffer_stripe *first)
+{
+    uint32_t base = (uint32_t)(first - buffer_stripes);
+    for (uint32_t i = 0; i < BLOCK_BUFFER_LOCKS; i++) {
+        if (buffer_evict_from(&buffer_stripes[(base + i) % BLOCK_BUFFER_LOCKS])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Buffers reclaim may drop: their data is a copy and nobody needs it
+static inline int buffer_reclaimable(const struct block_buffer *buf)
+{
+    return buf->ref_count == 0 && !buf->dirty && !buf->mapped;
+}
+
+static uint32_t buffer_shrink_count(void)
+{
+    uint64_t bytes = 0;
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        for (struct block_buffer *buf = stripe->lru_head; buf; buf = buf->lru_next) {
+            if (buffer_reclaimable(buf)) {
+                bytes += buf->device->block_size;
+            }
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+    return (uint32_t)(bytes / PAGE_SIZE_4K);
+}
+
+// Least recently used first within each stripe
+static uint32_t buffer_shrink_scan(uint32_t nr)
+{
+    uint64_t bytes = 0;
+    uint64_t wanted = (uint64_t)nr * PAGE_SIZE_4K;
+
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS && bytes < wanted; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        struct block_buffer *buf = stripe->lru_tail;
+        while (buf && bytes < wanted) {
+            struct block_buffer *prev = buf->lru_prev;
+            if (buffer_reclaimable(buf)) {
+                bytes += buf->device->block_size;
+                buffer_destroy(stripe, buf);
+                this_cpu_inc(buffer_counts, evictions);
+            }
+            buf = prev;
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+    return (uint32_t)(bytes / PAGE_SIZE_4K);
+}
+
+static struct shrinker buffer_shrinker = {
+    .name = "buffer cache",
+    .count = buffer_shrink_count,
+    .scan = buffer_shrink_scan,
+};
+
+int block_buffer_init(void)
+{
+    if (buffer_cache_initialized) {
+        return BLOCK_SUCCESS;
+    }
+
+    memset(buffer_hash, 0, sizeof(buffer_hash));
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS; s++) {
+        spin_lock_init(&buffer_stripes[s].lock);
+        buffer_stripes[s].lru_head = NULL;
+        buffer_stripes[s].lru_tail = NULL;
+    }
+    buffer_count = 0;
+    buffer_capacity = BLOCK_BUFFER_DEFAULT_CAPACITY;
+
+    buffer_cache_initialized = 1;
+    shrinker_register(&buffer_shrinker);
+    return BLOCK_SUCCESS;
+}
+
+static struct block_buffer *buffer_lookup_or_create(struct block_device *dev, uint32_t block,
+                                                    int read)
+{
+    if (!dev || !buffer_cache_initialized || block >= dev->num_blocks) {
+        return NULL;
+    }
+
+    struct buffer_stripe *stripe = buffer_stripe_of(dev, block);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    struct block_buffer *buf = hash_lookup(dev, block);
+    if (buf) {
+        buf->ref_count++;
+        lru_remove(stripe, buf);
+        lru_push_front(stripe, buf);
+        spin_unlock_irqrestore(&stripe->lock, flags);
+        this_cpu_inc(buffer_counts, hits);
+        return buf;
+    }
+    spin_unlock_irqrestore(&stripe->lock, flags);
+
+    this_cpu_inc(buffer_counts, misses);
+
+    // Stay within capacity; if everything is referenced, grow past it
+    if (__atomic_load_n(&buffer_count, __ATOMIC_RELAXED) >= buffer_capacity) {
+        buffer_evict_one(stripe);
+    }
+
+    buf = kmalloc(sizeof(struct block_buffer));
+    if (!buf) {
+        return NULL;
+    }
+    buf->data = block_device_map_block(dev, block);
+    buf->mapped = buf->data != NULL;
+    if (!buf->mapped) {
+        buf->data = kmalloc(dev->block_size);
+        if (!buf->data) {
+            kfree(buf);
+            return NULL;
+        }
+    }
+
+    buf->device = dev;
+    buf->block_num = block;
+    buf->dirty = 0;
+    buf->verified = 0;
+    buf->ref_count = 1;
+    buf->next = NULL;
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+
+    if (read && !buf->mapped && block_device_read(dev, block, buf->data) != BLOCK_SUCCESS) {
+        buffer_free(buf);
+        return NULL;
+    }
+
+    // Another task may have brought the block in meanwhile; its copy wins
+    flags = spin_lock_irqsave(&stripe->lock);
+    struct block_buffer *cached = hash_lookup(dev, block);
+    if (cached) {
+        cached->ref_count++;
+        lru_remove(stripe, cached);
+        lru_push_front(stripe, cached);
+    } else {
+        uint32_t idx = buffer_hash_index(dev, block);
+        buf->next = buffer_hash[idx];
+        buffer_hash[idx] = buf;
+        lru_push_front(stripe, buf);
+        __atomic_add_fetch(&buffer_count, 1, __ATOMIC_RELAXED);
+    }
+    spin_unlock_irqrestore(&stripe->lock, flags);
+
+    if (cached) {
+        buffer_free(buf);
+        return cached;
+    }
+    return buf;
+}
+
+struct block_buffer *block_buffer_get(struct block_device *dev, uint32_t block)
+{
+    return buffer_lookup_or_create(dev, block, 1);
+}
+
+/**
+ * Get a buffer the caller is about to overwrite completely; a missing
+ * block is not read from the device
+ */
+struct block_buffer *block_buffer_get_noread(struct block_device *dev, uint32_t block)
+{
+    return buffer_lookup_or_create(dev, block, 0);
+}
+
+void block_buffer_mark_dirty(struct block_buffer *buf)
+{
+    if (!buf) {
+        return;
+    }
+
+    struct buffer_stripe *stripe = buffer_stripe_of(buf->device, buf->block_num);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    buf->dirty = 1;
+    spin_unlock_irqrestore(&stripe->lock, flags);
+}
+
+int block_buffer_put(struct block_buffer *buf)
+{
+    if (!buf) {
+        return BLOCK_EINVAL;
+    }
+
+    // Dirty data stays cached until eviction or sync
+    struct buffer_stripe *stripe = buffer_stripe_of(buf->device, buf->block_num);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    if (buf->ref_count > 0) {
+        buf->ref_count--;
+    }
+    spin_unlock_irqrestore(&stripe->lock, flags);
+
+    return BLOCK_SUCCESS;
+}
+
+int block_buffer_sync(struct block_buffer *buf)
+{
+    if (!buf || !buf->device || !buf->data) {
+        return BLOCK_EINVAL;
+    }
+
+    struct buffer_stripe *stripe = buffer_stripe_of(buf->device, buf->block_num);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    int write = buffer_write_begin(buf);
+    spin_unlock_irqrestore(&stripe->lock, flags);
+    if (!write) {
+        return BLOCK_SUCCESS;
+    }
+
+    int result = block_device_write(buf->device, buf->block_num, buf->data);
+    flags = spin_lock_irqsave(&stripe->lock);
+    buffer_write_end(buf, result);
+    spin_unlock_irqrestore(&stripe->lock, flags);
+    if (result == BLOCK_SUCCESS) {
+        this_cpu_inc(buffer_counts, writebacks);
+    }
+    return result;
+}
+
+static inline int buffer_before(const struct block_buffer *a, const struct block_buffer *b)
+{
+    if (a->device != b->device) {
+        return (uintptr_t)a->device < (uintptr_t)b->device;
+    }
+    return a->block_num < b->block_num;
+}
+
+// Finish writes started by buffer_write_begin()
+static void buffer_write_end_unlocked(struct block_buffer *buf, int result)
+{
+    struct buffer_stripe *stripe = buffer_stripe_of(buf->device, buf->block_num);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    buffer_write_end(buf, result);
+    spin_unlock_irqrestore(&stripe->lock, flags);
+}
+
+/**
+ * Write sorted buffers started by buffer_write_begin(), merging adjacent
+ * blocks of one device into a single request, and finish them
+ */
+static int buffer_write_runs(struct block_buffer **dirty, uint32_t n)
+{
+    struct block_io_segment segs[BLOCK_IO_MAX_SEGMENTS];
+    int result = BLOCK_SUCCESS;
+
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t run = 1;
+        while (i + run < n && run < BLOCK_IO_MAX_SEGMENTS &&
+               dirty[i + run]->device == dirty[i]->device &&
+               dirty[i + run]->block_num == dirty[i]->block_num + run) {
+            run++;
+        }
+
+        for (uint32_t j = 0; j < run; j++) {
+            segs[j].buffer = dirty[i + j]->data;
+            segs[j].count = 1;
+        }
+
+        int written = block_device_writev(dirty[i]->device, dirty[i]->block_num, segs, run);
+        for (uint32_t j = 0; j < run; j++) {
+            buffer_write_end_unlocked(dirty[i + j], written);
+        }
+        if (written == BLOCK_SUCCESS) {
+            this_cpu_add(buffer_counts, writebacks, run);
+        } else {
+            result = BLOCK_EIO;
+        }
+        i += run;
+    }
+
+    return result;
+}
+
+/**
+ * Write back a range one buffer at a time, for when there is no memory to
+ * sort the dirty set
+ */
+static int buffer_sync_range_slow(struct block_device *dev, uint32_t start, uint32_t count)
+{
+    int result = BLOCK_SUCCESS;
+
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        struct block_buffer *buf = stripe->lru_head;
+        while (buf) {
+            if (!buffer_in_range(buf, dev, start, count) || !buffer_write_begin(buf)) {
+                buf = buf->lru_next;
+                continue;
+            }
+
+            // Referenced, so it keeps its place in the list meanwhile
+            spin_unlock_irqrestore(&stripe->lock, flags);
+            int written = block_device_write(buf->device, buf->block_num, buf->data);
+            flags = spin_lock_irqsave(&stripe->lock);
+            buffer_write_end(buf, written);
+            if (written == BLOCK_SUCCESS) {
+                this_cpu_inc(buffer_counts, writebacks);
+            } else {
+                result = BLOCK_EIO;
+            }
+            buf = buf->lru_next;
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+    return result;
+}
+
+int block_buffer_sync_range(struct block_device *dev, uint32_t start, uint32_t count)
+{
+    if (!buffer_cache_initialized) {
+        return BLOCK_SUCCESS;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        for (struct block_buffer *buf = stripe->lru_head; buf; buf = buf->lru_next) {
+            if (buf->dirty && buffer_in_range(buf, dev, start, count)) {
+                if (buf->mapped) {
+                    buf->dirty = 0;  // Nothing to write
+                } else {
+                    n++;
+                }
+            }
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+    if (n == 0) {
+        return BLOCK_SUCCESS;
+    }
+
+    struct block_buffer **dirty = kmalloc(n * sizeof(struct block_buffer *));
+    if (!dirty) {
+        return buffer_sync_range_slow(dev, start, count);
+    }
+
+    // Insertion sort by (device, block); the dirty set is at most the cache
+    // capacity and usually far smaller. Buffers dirtied since the count
+    // wait for the next sync.
+    uint32_t filled = 0;
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS && filled < n; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        for (struct block_buffer *buf = stripe->lru_head; buf && filled < n; buf = buf->lru_next) {
+            if (!buffer_in_range(buf, dev, start, count) || !buffer_write_begin(buf)) {
+                continue;
+            }
+            uint32_t pos = filled++;
+            while (pos > 0 && buffer_before(buf, dirty[pos - 1])) {
+                dirty[pos] = dirty[pos - 1];
+                pos--;
+            }
+            dirty[pos] = buf;
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+
+    int result = buffer_write_runs(dirty, filled);
+    kfree(dirty);
+    return result;
+}
+
+int block_buffer_sync_device(struct block_device *dev)
+{
+    return block_buffer_sync_range(dev, 0, 0xFFFFFFFF);
+}
+
+int block_buffer_sync_all(void)
+{
+    return block_buffer_sync_range(NULL, 0, 0xFFFFFFFF);
+}
+
+/**
+ * Whether any block of the range is still cached, which after
+ * block_buffer_invalidate_range() means a buffer of it is in use
+ */
+int block_buffer_range_busy(struct block_device *dev, uint32_t start, uint32_t count)
+{
+    if (!buffer_cache_initialized || !dev) {
+        return 0;
+    }
+
+    int busy = 0;
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS && !busy; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        for (struct block_buffer *buf = stripe->lru_head; buf; buf = buf->lru_next) {
+            if (buffer_in_range(buf, dev, start, count)) {
+                busy = 1;
+                break;
+            }
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+    return busy;
+}
+
+/**
+ * Drop cached copies of blocks that were just written around the cache
+ */
+void block_buffer_invalidate_range(struct block_device *dev, uint32_t start, uint32_t count)
+{
+    if (!buffer_cache_initialized || !dev) {
+        return;
+    }
+
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        struct block_buffer *buf = stripe->lru_head;
+        while (buf) {
+            struct block_buffer *next = buf->lru_next;
+            if (buffer_in_range(buf, dev, start, count)) {
+                if (buf->ref_count > 0) {
+                    buf->dirty = 0;  // Still in use; the device copy is newer
+                } else {
+                    buffer_destroy(stripe, buf);
+                }
+            }
+            buf = next;
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+}
+
+void block_buffer_invalidate_device(struct block_device *dev)
+{
+    block_buffer_invalidate_range(dev, 0, 0xFFFFFFFF);
+}
+
+int block_buffer_set_capacity(uint32_t capacity)
+{
+    if (capacity == 0) {
+        return BLOCK_EINVAL;
+    }
+
+    buffer_capacity = capacity;
+    while (__atomic_load_n(&buffer_count, __ATOMIC_RELAXED) > buffer_capacity &&
+           buffer_evict_one(&buffer_stripes[0])) {
+        // Shrink down to the new capacity
+    }
+
+    return BLOCK_SUCCESS;
+}
+
+void block_buffer_get_stats(struct block_buffer_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    uint32_t dirty = 0;
+    uint32_t mapped = 0;
+    for (uint32_t s = 0; s < BLOCK_BUFFER_LOCKS; s++) {
+        struct buffer_stripe *stripe = &buffer_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        for (struct block_buffer *buf = stripe->lru_head; buf; buf = buf->lru_next) {
+            if (buf->dirty) {
+                dirty++;
+            }
+            if (buf->mapped) {
+                mapped++;
+            }
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+
+    stats->capacity = buffer_capacity;
+    stats->buffers = __atomic_load_n(&buffer_count, __ATOMIC_RELAXED);
+    stats->dirty = dirty;
+    stats->mapped = mapped;
+    stats->hits = per_cpu_sum(buffer_counts, hits);
+    stats->misses = per_cpu_sum(buffer_counts, misses);
+    stats->evictions = per_cpu_sum(buffer_counts, evictions);
+    stats->writebacks = per_cpu_sum(buffer_counts, writebacks);
+}
@@ -6,13 +6,21 @@
 #include "block_device.h"
 #include "memory.h"
 #include "kernel.h"
+#include "format.h"
+
+// Blocks are one page each and backed sparsely: a block gets its page on
+// first write (or map) and gives it back to the page allocator when
+// discarded, so memory follows the live data rather than the disk size.
+// Unbacked blocks read as zeros.
+#define RAMDISK_BLOCK_SIZE      BLOCK_SIZE_4096
 
 // RAM disk private data
 struct ramdisk_data {
-    void *memory;                           // Allocated memory
+    void **pages;                           // Backing page per block, NULL if none
     size_t size;                            // Total size
     uint32_t block_size;                    // Block size
     uint32_t num_blocks;                    // Number of blocks
+    uint32_t resident;                      // Blocks with a page
 };
 
 // RAM disk operations
@@ -20,7 +28,13 @@ static int ramdisk_read_block(struct block_device *dev, uint32_t block_num, void
 static int ramdisk_write_block(struct block_device *dev, uint32_t block_num, const void *buffer);
 static int ramdisk_read_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, void *buffer);
 static int ramdisk_write_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, const void *buffer);
+static int ramdisk_readv(struct block_device *dev, uint32_t start_block,
+                         const struct block_io_segment *segs, uint32_t num_segs);
+static int ramdisk_writev(struct block_device *dev, uint32_t start_block,
+                          const struct block_io_segment *segs, uint32_t num_segs);
 static int ramdisk_sync(struct block_device *dev);
+static void *ramdisk_map_block(struct block_device *dev, uint32_t block_num);
+static int ramdisk_discard(struct block_device *dev, uint32_t start_block, uint32_t count);
 
 // RAM disk operations structure
 static struct block_device_operations ramdisk_ops = {
@@ -28,67 +42,32 @@ static struct block_device_operations ramdisk_ops = {
     .write_block = ramdisk_write_block,
     .read_blocks = ramdisk_read_blocks,
     .write_blocks = ramdisk_write_blocks,
+    .readv = ramdisk_readv,
+    .writev = ramdisk_writev,
     .sync = ramdisk_sync,
-    .ioctl = NULL
+    .ioctl = NULL,
+    .map_block = ramdisk_map_block,
+    .discard = ramdisk_discard
 };
 
 struct block_device *ramdisk_create(const char *name, size_t size)
 {
-    if (!name || size == 0) {
+    if (!name || size < RAMDISK_BLOCK_SIZE) {
         return NULL;
     }
     
-    early_print("Creating RAM disk: ");
-    early_print(name);
-    early_print(" (");
-    
-    // Print size
+    char line[96];
     if (size >= 1024 * 1024) {
-        char size_str[32];
-        int mb = size / (1024 * 1024);
-        int pos = 0;
-        if (mb == 0) {
-            size_str[pos++] = '0';
-        } else {
-            char temp[32];
-            int temp_pos = 0;
-            while (mb > 0) {
-                temp[temp_pos++] = '0' + (mb % 10);
-                mb /= 10;
-            }
-            for (int i = temp_pos - 1; i >= 0; i--) {
-                size_str[pos++] = temp[i];
-            }
-        }
-        size_str[pos] = '\0';
-        early_print(size_str);
-        early_print("MB)\n");
+        snprintf(line, sizeof(line), "Creating RAM disk: %s (%zuMB)\n", name, size / (1024 * 1024));
     } else if (size >= 1024) {
-        char size_str[32];
-        int kb = size / 1024;
-        int pos = 0;
-        if (kb == 0) {
-            size_str[pos++] = '0';
-        } else {
-            char temp[32];
-            int temp_pos = 0;
-            while (kb > 0) {
-                temp[temp_pos++] = '0' + (kb % 10);
-                kb /= 10;
-            }
-            for (int i = temp_pos - 1; i >= 0; i--) {
-                size_str[pos++] = temp[i];
-            }
-        }
-        size_str[pos] = '\0';
-        early_print(size_str);
-        early_print("KB)\n");
+        snprintf(line, sizeof(line), "Creating RAM disk: %s (%zuKB)\n", name, size / 1024);
     } else {
-        early_print("bytes)\n");
+        snprintf(line, sizeof(line), "Creating RAM disk: %s (%zu bytes)\n", name, size);
     }
+    early_print(line);
     
-    // Allocate device structure using kmalloc (works better for smaller structs)
-    struct block_device *dev = kmalloc(sizeof(struct block_device));
+    // Cache-line aligned, as the per-CPU counters expect
+    struct block_device *dev = kmalloc_aligned(sizeof(struct block_device), CACHE_LINE_SIZE);
     if (!dev) {
         early_print("Failed to allocate RAM disk device structure\n");
         return NULL;
@@ -102,24 +81,27 @@ struct block_device *ramdisk_create(const char *name, size_t size)
         return NULL;
     }
 
-    // Allocate RAM disk memory - use memory_alloc for larger allocations
-    size_t alloc_size = size;
-    void *memory = memory_alloc(alloc_size, MEMORY_ALIGN_4K);
-    if (!memory) {
-        early_print("Failed to allocate RAM disk memory\n");
+    // Only the page table is allocated up front
+    uint32_t num_blocks = (uint32_t)(size / RAMDISK_BLOCK_SIZE);
+    size_t table_size = (size_t)num_blocks * sizeof(void *);
+    void **pages = memory_alloc(table_size, 8);
+    if (!pages) {
+        early_print("Failed to allocate RAM disk page table\n");
         kfree(data);
         kfree(dev);
         return NULL;
     }
+    memset(pages, 0, table_size);
   
     // Compiler barrier to ensure memory initialization completes
     barrier();
 
     // Setup private data
-    data->memory = memory;
-    data->size = alloc_size;
-    data->block_size = BLOCK_SIZE_4096;
-    data->num_blocks = alloc_size / data->block_size;
+    data->pages = pages;
+    data->size = (size_t)num_blocks * RAMDISK_BLOCK_SIZE;
+    data->block_size = RAMDISK_BLOCK_SIZE;
+    data->num_blocks = num_blocks;
+    data->resident = 0;
 
     // Compiler barrier to ensure private data setup completes
     barrier();
@@ -141,7 +123,7 @@ struct block_device *ramdisk_create(const char *name, size_t size)
     // Register device
     if (block_device_register(dev) != BLOCK_SUCCESS) {
         early_print("Failed to register RAM disk\n");
-        memory_free(memory);
+        memory_free(pages);
         kfree(data);
         kfree(dev);
         return NULL;
@@ -156,10 +138,17 @@ void ramdisk_destroy(struct block_device *dev)
         return;
     }
     
+    block_buffer_invalidate_device(dev);
+    
     struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
     if (data) {
-        if (data->memory) {
-            memory_free(data->memory);
+        if (data->pages) {
+            for (uint32_t i = 0; i < data->num_blocks; i++) {
+                if (data->pages[i]) {
+                    memory_free_pages(data->pages[i], 1);
+                }
+            }
+            memory_free(data->pages);
         }
         kfree(data);
     }
@@ -168,6 +157,69 @@ void ramdisk_destroy(struct block_device *dev)
     kfree(dev);
 }
 
+/**
+ * Memory holding the disk's data, which is less than its size when
+ * blocks were never written or have been discarded
+ */
+size_t ramdisk_resident_size(struct block_device *dev)
+{
+    if (!dev || dev->device_type != BLOCK_DEVICE_RAM || !dev->private_data) {
+        return 0;
+    }
+    struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
+    return (size_t)data->resident * data->block_size;
+}
+
+// Page backing a block, allocated zeroed if the block has none
+static void *ramdisk_page(struct ramdisk_data *data, uint32_t block_num)
+{
+    void *page = data->pages[block_num];
+    if (!page) {
+        page = memory_alloc_pages(1);
+        if (page) {
+            memset(page, 0, data->block_size);
+            data->pages[block_num] = page;
+            data->resident++;
+        }
+    }
+    return page;
+}
+
+static int ramdisk_is_zero(const void *buffer, uint32_t size)
+{
+    const uint64_t *words = (const uint64_t *)buffer;
+    for (uint32_t i = 0; i < size / sizeof(uint64_t); i++) {
+        if (words[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void ramdisk_copy_out(struct ramdisk_data *data, uint32_t block_num, void *buffer)
+{
+    if (data->pages[block_num]) {
+        memcpy(buffer, data->pages[block_num], data->block_size);
+    } else {
+        memset(buffer, 0, data->block_size);
+    }
+}
+
+static int ramdisk_copy_in(struct ramdisk_data *data, uint32_t block_num, const void *buffer)
+{
+    // Zeros written to an unbacked block are already what it reads as
+    if (!data->pages[block_num] && ramdisk_is_zero(buffer, data->block_size)) {
+        return BLOCK_SUCCESS;
+    }
+
+    void *page = ramdisk_page(data, block_num);
+    if (!page) {
+        return BLOCK_ENOSPC;
+    }
+    memcpy(page, buffer, data->block_size);
+    return BLOCK_SUCCESS;
+}
+
 static int ramdisk_read_block(struct block_device *dev, uint32_t block_num, void *buffer)
 {
     if (!dev || !buffer) {
@@ -175,7 +227,7 @@ static int ramdisk_read_block(struct block_device *dev, uint32_t block_num, void
     }
     
     struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
-    if (!data || !data->memory) {
+    if (!data || !data->pages) {
         return BLOCK_EIO;
     }
     
@@ -183,10 +235,7 @@ static int ramdisk_read_block(struct block_device *dev, uint32_t block_num, void
         return BLOCK_EINVAL;
     }
     
-    // Calculate offset and copy data
-    size_t offset = block_num * data->block_size;
-    memcpy(buffer, (char *)data->memory + offset, data->block_size);
-    
+    ramdisk_copy_out(data, block_num, buffer);
     return BLOCK_SUCCESS;
 }
 
@@ -197,7 +246,7 @@ static int ramdisk_write_block(struct block_device *dev, uint32_t block_num, con
     }
     
     struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
-    if (!data || !data->memory) {
+    if (!data || !data->pages) {
         return BLOCK_EIO;
     }
     
@@ -205,11 +254,7 @@ static int ramdisk_write_block(struct block_device *dev, uint32_t block_num, con
         return BLOCK_EINVAL;
     }
     
-    // Calculate offset and copy data
-    size_t offset = block_num * data->block_size;
-    memcpy((char *)data->memory + offset, buffer, data->block_size);
-    
-    return BLOCK_SUCCESS;
+    return ramdisk_copy_in(data, block_num, buffer);
 }
 
 static int ramdisk_read_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, void *buffer)
@@ -219,7 +264,7 @@ static int ramdisk_read_blocks(struct block_device *dev, uint32_t start_block, u
     }
     
     struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
-    if (!data || !data->memory) {
+    if (!data || !data->pages) {
         return BLOCK_EIO;
     }
     
@@ -227,10 +272,10 @@ static int ramdisk_read_blocks(struct block_device *dev, uint32_t start_block, u
         return BLOCK_EINVAL;
     }
     
-    // Calculate offset and copy data
-    size_t offset = start_block * data->block_size;
-    size_t total_size = count * data->block_size;
-    memcpy(buffer, (char *)data->memory + offset, total_size);
+    char *dst = (char *)buffer;
+    for (uint32_t i = 0; i < count; i++) {
+        ramdisk_copy_out(data, start_block + i, dst + (size_t)i * data->block_size);
+    }
     
     return BLOCK_SUCCESS;
 }
@@ -242,7 +287,7 @@ static int ramdisk_write_blocks(struct block_device *dev, uint32_t start_block,
     }
     
     struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
-    if (!data || !data->memory) {
+    if (!data || !data->pages) {
         return BLOCK_EIO;
     }
     
@@ -250,14 +295,59 @@ static int ramdisk_write_blocks(struct block_device *dev, uint32_t start_block,
         return BLOCK_EINVAL;
     }
     
-    // Calculate offset and copy data
-    size_t offset = start_block * data->block_size;
-    size_t total_size = count * data->block_size;
-    memcpy((char *)data->memory + offset, buffer, total_size);
+    const char *src = (const char *)buffer;
+    for (uint32_t i = 0; i < count; i++) {
+        int result = ramdisk_copy_in(data, start_block + i, src + (size_t)i * data->block_size);
+        if (result != BLOCK_SUCCESS) {
+            return result;
+        }
+    }
     
     return BLOCK_SUCCESS;
 }
 
+// Requests are bounds-checked by block_device_readv/writev
+static int ramdisk_readv(struct block_device *dev, uint32_t start_block,
+                         const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
+    if (!data || !data->pages) {
+        return BLOCK_EIO;
+    }
+
+    uint32_t block = start_block;
+    for (uint32_t i = 0; i < num_segs; i++) {
+        char *dst = (char *)segs[i].buffer;
+        for (uint32_t b = 0; b < segs[i].count; b++) {
+            ramdisk_copy_out(data, block++, dst + (size_t)b * data->block_size);
+        }
+    }
+
+    return BLOCK_SUCCESS;
+}
+
+static int ramdisk_writev(struct block_device *dev, uint32_t start_block,
+                          const struct block_io_segment *segs, uint32_t num_segs)
+{
+    struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
+    if (!data || !data->pages) {
+        return BLOCK_EIO;
+    }
+
+    uint32_t block = start_block;
+    for (uint32_t i = 0; i < num_segs; i++) {
+        const char *src = (const char *)segs[i].buffer;
+        for (uint32_t b = 0; b < segs[i].count; b++) {
+            int result = ramdisk_copy_in(data, block++, src + (size_t)b * data->block_size);
+            if (result != BLOCK_SUCCESS) {
+                return result;
+            }
+        }
+    }
+
+    return BLOCK_SUCCESS;
+}
+
 static int ramdisk_sync(struct block_device *dev)
 {
     // RAM disk is always synchronized (no persistent storage)
@@ -265,6 +355,35 @@ static int ramdisk_sync(struct block_device *dev)
     return BLOCK_SUCCESS;
 }
 
+// Bounds-checked by block_device_map_block. Mapping backs the block, since
+// the caller may store through the pointer.
+static void *ramdisk_map_block(struct block_device *dev, uint32_t block_num)
+{
+    struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
+    if (!data || !data->pages) {
+        return NULL;
+    }
+    return ramdisk_page(data, block_num);
+}
+
+// Bounds-checked by block_device_discard, which also drops cached buffers
+static int ramdisk_discard(struct block_device *dev, uint32_t start_block, uint32_t count)
+{
+    struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
+    if (!data || !data->pages) {
+        return BLOCK_EIO;
+    }
+
+    for (uint32_t i = start_block; i < start_block + count; i++) {
+        if (data->pages[i]) {
+            memory_free_pages(data->pages[i], 1);
+            data->pages[i] = NULL;
+            data->resident--;
+        }
+    }
+    return BLOCK_SUCCESS;
+}
+
 // Utility function to format RAM disk with test pattern
 int ramdisk_format_test(struct block_device *dev)
 {
@@ -273,17 +392,22 @@ int ramdisk_format_test(struct block_device *dev)
     }
     
     struct ramdisk_data *data = (struct ramdisk_data *)dev->private_data;
-    if (!data || !data->memory) {
+    if (!data || !data->pages) {
         return BLOCK_EIO;
     }
     
     early_print("Formatting RAM disk with test pattern...\n");
     
-    // Fill with test pattern
-    char *mem = (char *)data->memory;
-    for (size_t i = 0; i < data->size; i++) {
-        mem[i] = (char)(i & 0xFF);  // Simple pattern
+    // Fill with test pattern, which backs every block
+    for (uint32_t block = 0; block < data->num_blocks; block++) {
+        char *mem = (char *)ramdisk_page(data, block);
+        if (!mem) {
+            return BLOCK_ENOSPC;
+        }
+        for (uint32_t i = 0; i < data->block_size; i++) {
+            mem[i] = (char)(i & 0xFF);  // Simple pattern
+        }
     }
     
     return BLOCK_SUCCESS;
-}
\ No newline at end of file
+}
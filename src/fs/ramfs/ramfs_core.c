@@ -1,6 +1,16 @@
 /*
  * MiniOS RAM File System (RAMFS) Core
  * In-memory file system implementation
+ *
+ * File data lives in RAMFS_CHUNK_SIZE chunks indexed by a per-file table
+ * that doubles when it fills, so appends never copy existing data and
+ * memory stays proportional to the file size. Chunks are allocated on
+ * first write; a missing chunk reads as zeros.
+ *
+ * Directories keep their children on a list, in the order readdir returns
+ * them, and in a linear-probing hash table for lookups. The table is
+ * rebuilt from the list when it passes 3/4 full, counting tombstones left
+ * by removals; if that allocation fails, lookups fall back to the list.
  */
 
 #include "ramfs.h"
@@ -17,10 +27,15 @@ static off_t ramfs_file_seek(struct file *file, off_t offset, int whence);
 static int ramfs_file_sync(struct file *file);
 
 static int ramfs_dir_readdir(struct file *dir, void *buffer, size_t buffer_size, off_t *offset);
+static int ramfs_dir_readdir_plus(struct file *dir, void *buffer, size_t buffer_size, off_t *offset);
 static int ramfs_dir_mkdir(struct file_system *fs, const char *path, int mode);
 static int ramfs_dir_rmdir(struct file_system *fs, const char *path);
+static int ramfs_dir_rename(struct file_system *fs, const char *oldpath, const char *newpath);
 static struct inode *ramfs_dir_lookup(struct file_system *fs, struct inode *parent, const char *name);
 
+// Marks a removed entry in a directory hash table
+#define RAMFS_INDEX_DELETED  ((struct ramfs_node *)(uintptr_t)1)
+
 // RAMFS operations structures
 static struct file_operations ramfs_file_ops = {
     .open = ramfs_file_open,
@@ -34,9 +49,11 @@ static struct file_operations ramfs_file_ops = {
 
 static struct directory_operations ramfs_dir_ops = {
     .readdir = ramfs_dir_readdir,
+    .readdir_plus = ramfs_dir_readdir_plus,
     .mkdir = ramfs_dir_mkdir,
     .rmdir = ramfs_dir_rmdir,
-    .lookup = ramfs_dir_lookup
+    .lookup = ramfs_dir_lookup,
+    .rename = ramfs_dir_rename
 };
 
 // RAMFS file system type
@@ -63,6 +80,82 @@ int ramfs_init(void)
     return VFS_SUCCESS;
 }
 
+static uint32_t ramfs_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Put a child in the first free or deleted slot of its probe sequence
+ */
+static void ramfs_index_insert(struct ramfs_node *dir, struct ramfs_node *child)
+{
+    uint32_t mask = dir->child_slots - 1;
+    uint32_t slot = child->name_hash & mask;
+    while (dir->child_index[slot] && dir->child_index[slot] != RAMFS_INDEX_DELETED) {
+        slot = (slot + 1) & mask;
+    }
+    if (!dir->child_index[slot]) {
+        dir->child_used++;
+    }
+    dir->child_index[slot] = child;
+}
+
+/**
+ * Rebuild a directory's table from its child list, sized for one more
+ * entry at under half load
+ */
+static int ramfs_index_rebuild(struct ramfs_node *dir)
+{
+    uint32_t slots = RAMFS_MIN_INDEX_SLOTS;
+    while (slots < (dir->child_count + 1) * 2) {
+        slots *= 2;
+    }
+
+    if (dir->child_index) {
+        kfree(dir->child_index);
+    }
+    dir->child_index = kmalloc(slots * sizeof(struct ramfs_node *));
+    dir->child_slots = 0;
+    dir->child_used = 0;
+    if (!dir->child_index) {
+        return VFS_ENOMEM;  // Lookups walk the list until the next insert
+    }
+
+    memset(dir->child_index, 0, slots * sizeof(struct ramfs_node *));
+    dir->child_slots = slots;
+    for (struct ramfs_node *child = dir->children; child; child = child->next) {
+        ramfs_index_insert(dir, child);
+    }
+    return VFS_SUCCESS;
+}
+
+/**
+ * Slot holding the named child, or -1
+ */
+static int32_t ramfs_index_find(struct ramfs_node *dir, const char *name, uint32_t hash)
+{
+    uint32_t mask = dir->child_slots - 1;
+    uint32_t slot = hash & mask;
+    for (uint32_t probes = 0; probes < dir->child_slots; probes++) {
+        struct ramfs_node *entry = dir->child_index[slot];
+        if (!entry) {
+            break;
+        }
+        if (entry != RAMFS_INDEX_DELETED && entry->name_hash == hash &&
+            strcmp(entry->name, name) == 0) {
+            return (int32_t)slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
 struct ramfs_node *ramfs_create_node(struct ramfs_fs_data *fs_data, const char *name, uint32_t mode)
 {
     if (!fs_data || !name) {
@@ -77,10 +170,12 @@ struct ramfs_node *ramfs_create_node(struct ramfs_fs_data *fs_data, const char *
     memset(node, 0, sizeof(struct ramfs_node));
     strncpy(node->name, name, RAMFS_MAX_NAME);
     node->name[RAMFS_MAX_NAME] = '\0';
+    node->name_hash = ramfs_name_hash(node->name);
     node->mode = mode;
     node->size = 0;
     node->ino = fs_data->next_ino++;
-    node->data = NULL;
+    node->chunks = NULL;
+    node->chunk_slots = 0;
     node->parent = NULL;
     node->children = NULL;
     node->next = NULL;
@@ -100,9 +195,10 @@ void ramfs_destroy_node(struct ramfs_node *node)
     }
     
     // Free file data if any
-    if (node->data) {
-        kfree(node->data);
-        node->data = NULL;
+    ramfs_node_truncate(node, 0);
+    if (node->child_index) {
+        kfree(node->child_index);
+        node->child_index = NULL;
     }
     
     // Recursively destroy children
@@ -116,6 +212,150 @@ void ramfs_destroy_node(struct ramfs_node *node)
     kfree(node);
 }
 
+/**
+ * Make room for chunk index in the chunk table, doubling it as needed
+ */
+static int ramfs_reserve_chunks(struct ramfs_node *node, uint32_t index)
+{
+    if (index < node->chunk_slots) {
+        return VFS_SUCCESS;
+    }
+
+    uint32_t slots = node->chunk_slots ? node->chunk_slots : RAMFS_MIN_CHUNK_SLOTS;
+    while (slots <= index) {
+        slots *= 2;
+    }
+
+    void **chunks = kmalloc(slots * sizeof(void *));
+    if (!chunks) {
+        return VFS_ENOMEM;
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+        chunks[i] = i < node->chunk_slots ? node->chunks[i] : NULL;
+    }
+    if (node->chunks) {
+        kfree(node->chunks);
+    }
+    node->chunks = chunks;
+    node->chunk_slots = slots;
+    return VFS_SUCCESS;
+}
+
+ssize_t ramfs_node_read(struct ramfs_node *node, void *buf, size_t count, off_t offset)
+{
+    if (!node || !buf || offset < 0) {
+        return -1;
+    }
+    if (offset >= (off_t)node->size) {
+        return 0;  // EOF
+    }
+    if (count > node->size - (size_t)offset) {
+        count = node->size - (size_t)offset;
+    }
+
+    char *out = buf;
+    size_t done = 0;
+    while (done < count) {
+        size_t pos = (size_t)offset + done;
+        uint32_t index = pos / RAMFS_CHUNK_SIZE;
+        size_t in_chunk = pos % RAMFS_CHUNK_SIZE;
+        size_t len = RAMFS_CHUNK_SIZE - in_chunk;
+        if (len > count - done) {
+            len = count - done;
+        }
+
+        void *chunk = index < node->chunk_slots ? node->chunks[index] : NULL;
+        if (chunk) {
+            memcpy(out + done, (char *)chunk + in_chunk, len);
+        } else {
+            memset(out + done, 0, len);
+        }
+        done += len;
+    }
+
+    return (ssize_t)count;
+}
+
+ssize_t ramfs_node_write(struct ramfs_node *node, const void *buf, size_t count, off_t offset)
+{
+    if (!node || !buf || offset < 0) {
+        return -1;
+    }
+
+    size_t new_size = (size_t)offset + count;
+    if (new_size > RAMFS_MAX_FILE_SIZE) {
+        return -1;  // File too large
+    }
+    if (count == 0) {
+        return 0;
+    }
+    if (ramfs_reserve_chunks(node, (uint32_t)((new_size - 1) / RAMFS_CHUNK_SIZE)) != VFS_SUCCESS) {
+        return -1;
+    }
+
+    const char *in = buf;
+    size_t done = 0;
+    while (done < count) {
+        size_t pos = (size_t)offset + done;
+        uint32_t index = pos / RAMFS_CHUNK_SIZE;
+        size_t in_chunk = pos % RAMFS_CHUNK_SIZE;
+        size_t len = RAMFS_CHUNK_SIZE - in_chunk;
+        if (len > count - done) {
+            len = count - done;
+        }
+
+        if (!node->chunks[index]) {
+            node->chunks[index] = kmalloc(RAMFS_CHUNK_SIZE);
+            if (!node->chunks[index]) {
+                break;
+            }
+            memset(node->chunks[index], 0, RAMFS_CHUNK_SIZE);
+        }
+        memcpy((char *)node->chunks[index] + in_chunk, in + done, len);
+        done += len;
+    }
+
+    if (done == 0) {
+        return -1;
+    }
+    if ((size_t)offset + done > node->size) {
+        node->size = (uint32_t)((size_t)offset + done);
+    }
+    node->modified_time++;
+    return (ssize_t)done;
+}
+
+/**
+ * Cut a file down to size bytes, freeing chunks past the end and zeroing
+ * the tail of the last one so a later extension reads zeros
+ */
+void ramfs_node_truncate(struct ramfs_node *node, uint32_t size)
+{
+    if (!node || size >= node->size) {
+        return;
+    }
+
+    uint32_t keep = (size + RAMFS_CHUNK_SIZE - 1) / RAMFS_CHUNK_SIZE;
+    for (uint32_t i = keep; i < node->chunk_slots; i++) {
+        if (node->chunks[i]) {
+            kfree(node->chunks[i]);
+            node->chunks[i] = NULL;
+        }
+    }
+    if (keep > 0 && (size % RAMFS_CHUNK_SIZE) && node->chunks[keep - 1]) {
+        size_t tail = size % RAMFS_CHUNK_SIZE;
+        memset((char *)node->chunks[keep - 1] + tail, 0, RAMFS_CHUNK_SIZE - tail);
+    }
+    if (keep == 0 && node->chunks) {
+        kfree(node->chunks);
+        node->chunks = NULL;
+        node->chunk_slots = 0;
+    }
+
+    node->size = size;
+    node->modified_time++;
+}
+
 struct ramfs_node *ramfs_find_node(struct ramfs_node *parent, const char *name)
 {
     if (!parent || !name) {
@@ -127,6 +367,11 @@ struct ramfs_node *ramfs_find_node(struct ramfs_node *parent, const char *name)
         return NULL;
     }
     
+    if (parent->child_index) {
+        int32_t slot = ramfs_index_find(parent, name, ramfs_name_hash(name));
+        return slot < 0 ? NULL : parent->child_index[slot];
+    }
+    
     // Search children
     struct ramfs_node *child = parent->children;
     while (child) {
@@ -207,40 +452,63 @@ int ramfs_add_child(struct ramfs_node *parent, struct ramfs_node *child)
     child->parent = parent;
     
     // Add to children list
+    child->prev = NULL;
     child->next = parent->children;
+    if (parent->children) {
+        parent->children->prev = child;
+    }
     parent->children = child;
+    parent->child_count++;
+    
+    // Index it, growing the table (or sweeping tombstones) at 3/4 load
+    if (!parent->child_index || (parent->child_used + 1) * 4 > parent->child_slots * 3) {
+        ramfs_index_rebuild(parent);
+    } else {
+        ramfs_index_insert(parent, child);
+    }
     
     return VFS_SUCCESS;
 }
 
+static void ramfs_unlink_child(struct ramfs_node *parent, struct ramfs_node *child)
+{
+    // Remove from the table and the list
+    if (parent->child_index) {
+        int32_t slot = ramfs_index_find(parent, child->name, child->name_hash);
+        if (slot >= 0) {
+            parent->child_index[slot] = RAMFS_INDEX_DELETED;
+        }
+    }
+    if (child->prev) {
+        child->prev->next = child->next;
+    } else {
+        parent->children = child->next;
+    }
+    if (child->next) {
+        child->next->prev = child->prev;
+    }
+    child->next = NULL;
+    child->prev = NULL;
+    child->parent = NULL;
+    parent->child_count--;
+}
+
 int ramfs_remove_child(struct ramfs_node *parent, const char *name)
 {
     if (!parent || !name) {
         return VFS_EINVAL;
     }
     
-    struct ramfs_node *prev = NULL;
-    struct ramfs_node *child = parent->children;
-    
-    while (child) {
-        if (strcmp(child->name, name) == 0) {
-            // Remove from list
-            if (prev) {
-                prev->next = child->next;
-            } else {
-                parent->children = child->next;
-            }
-            
-            // Destroy node
-            ramfs_destroy_node(child);
-            return VFS_SUCCESS;
-        }
-        
-        prev = child;
-        child = child->next;
+    struct ramfs_node *child = ramfs_find_node(parent, name);
+    if (!child) {
+        return VFS_ENOENT;
     }
     
-    return VFS_ENOENT;
+    ramfs_unlink_child(parent, child);
+    
+    // Destroy node
+    ramfs_destroy_node(child);
+    return VFS_SUCCESS;
 }
 
 int ramfs_format(struct block_device *dev)
@@ -295,7 +563,8 @@ struct file_system *ramfs_mount(struct block_device *dev, unsigned long flags)
     root->mode = VFS_FILE_DIRECTORY | 0755;
     root->size = 0;
     root->ino = 1;
-    root->data = NULL;
+    root->chunks = NULL;
+    root->chunk_slots = 0;
     root->parent = NULL;
     root->children = NULL;
     root->next = NULL;
@@ -477,28 +746,16 @@ static ssize_t ramfs_file_read(struct file *file, void *buf, size_t count, off_t
     }
     
     struct ramfs_node *node = (struct ramfs_node *)file->inode->private_data;
-    if (!node || !node->data) {
+    if (!node) {
         return 0;  // Empty file
     }
     
-    // Check bounds
-    if (offset >= (off_t)node->size) {
-        return 0;  // EOF
-    }
-    
-    // Calculate actual bytes to read
-    size_t bytes_to_read = count;
-    if (offset + (off_t)bytes_to_read > (off_t)node->size) {
-        bytes_to_read = node->size - offset;
-    }
-    
-    // Copy data
-    memcpy(buf, (char *)node->data + offset, bytes_to_read);
+    ssize_t bytes_read = ramfs_node_read(node, buf, count, offset);
     
     // Update access time
     node->accessed_time++;
     
-    return bytes_to_read;
+    return bytes_read;
 }
 
 static ssize_t ramfs_file_write(struct file *file, const void *buf, size_t count, off_t offset)
@@ -512,43 +769,12 @@ static ssize_t ramfs_file_write(struct file *file, const void *buf, size_t count
         return -1;
     }
     
-    // Calculate new size needed
-    size_t new_size = offset + count;
-    if (new_size > RAMFS_MAX_FILE_SIZE) {
-        return -1;  // File too large
-    }
-    
-    // Allocate or reallocate data buffer
-    if (!node->data) {
-        node->data = kmalloc(new_size);
-        if (!node->data) {
-            return -1;
-        }
-        memset(node->data, 0, new_size);
-    } else if (new_size > node->size) {
-        void *new_data = kmalloc(new_size);
-        if (!new_data) {
-            return -1;
-        }
-        memcpy(new_data, node->data, node->size);
-        memset((char *)new_data + node->size, 0, new_size - node->size);
-        kfree(node->data);
-        node->data = new_data;
-    }
-    
-    // Write data
-    memcpy((char *)node->data + offset, buf, count);
-    
-    // Update size if needed
-    if (new_size > node->size) {
-        node->size = new_size;
-        file->inode->size = new_size;
+    ssize_t written = ramfs_node_write(node, buf, count, offset);
+    if (written > 0) {
+        file->inode->size = node->size;
     }
     
-    // Update modification time
-    node->modified_time++;
-    
-    return count;
+    return written;
 }
 
 static off_t ramfs_file_seek(struct file *file, off_t offset, int whence)
@@ -569,6 +795,14 @@ static off_t ramfs_file_seek(struct file *file, off_t offset, int whence)
         case VFS_SEEK_END:
             new_pos = file->inode->size + offset;
             break;
+        case VFS_SEEK_DATA:
+        case VFS_SEEK_HOLE:
+            // RAM files have no holes
+            if (offset < 0 || offset >= (off_t)file->inode->size) {
+                return VFS_ENXIO;
+            }
+            new_pos = (whence == VFS_SEEK_DATA) ? offset : (off_t)file->inode->size;
+            break;
         default:
             return -1;
     }
@@ -588,7 +822,9 @@ static int ramfs_file_sync(struct file *file)
 }
 
 // Directory operations implementations
-static int ramfs_dir_readdir(struct file *dir, void *buffer, size_t buffer_size, off_t *offset)
+
+// Fill struct dirent records, or struct dirent_plus ones when plus is set
+static int ramfs_dir_scan(struct file *dir, void *buffer, int max_entries, off_t *offset, int plus)
 {
     if (!dir || !dir->inode || !buffer || !offset) {
         return -1;
@@ -605,8 +841,8 @@ static int ramfs_dir_readdir(struct file *dir, void *buffer, size_t buffer_size,
     }
     
     struct dirent *entries = (struct dirent *)buffer;
+    struct dirent_plus *entries_plus = (struct dirent_plus *)buffer;
     int count = 0;
-    int max_entries = buffer_size / sizeof(struct dirent);
     
     // Skip to offset
     struct ramfs_node *child = dir_node->children;
@@ -619,11 +855,18 @@ static int ramfs_dir_readdir(struct file *dir, void *buffer, size_t buffer_size,
     
     // Fill entries
     while (child && count < max_entries) {
-        entries[count].ino = child->ino;
-        entries[count].type = child->mode & 0xF000;
-        entries[count].name_len = strlen(child->name);
-        strncpy(entries[count].name, child->name, VFS_MAX_NAME);
-        entries[count].name[VFS_MAX_NAME - 1] = '\0';
+        struct dirent *entry = plus ? &entries_plus[count].dirent : &entries[count];
+        entry->ino = child->ino;
+        entry->type = child->mode & 0xF000;
+        entry->name_len = strlen(child->name);
+        strncpy(entry->name, child->name, VFS_MAX_NAME);
+        entry->name[VFS_MAX_NAME - 1] = '\0';
+
+        if (plus) {
+            entries_plus[count].mode = child->mode;
+            entries_plus[count].size = child->size;
+            entries_plus[count].modified_time = child->modified_time;
+        }
         
         count++;
         child = child->next;
@@ -633,6 +876,16 @@ static int ramfs_dir_readdir(struct file *dir, void *buffer, size_t buffer_size,
     return count;
 }
 
+static int ramfs_dir_readdir(struct file *dir, void *buffer, size_t buffer_size, off_t *offset)
+{
+    return ramfs_dir_scan(dir, buffer, (int)(buffer_size / sizeof(struct dirent)), offset, 0);
+}
+
+static int ramfs_dir_readdir_plus(struct file *dir, void *buffer, size_t buffer_size, off_t *offset)
+{
+    return ramfs_dir_scan(dir, buffer, (int)(buffer_size / sizeof(struct dirent_plus)), offset, 1);
+}
+
 static int ramfs_dir_mkdir(struct file_system *fs, const char *path, int mode)
 {
     return ramfs_create_directory(fs, path, mode);
@@ -673,6 +926,74 @@ static int ramfs_dir_rmdir(struct file_system *fs, const char *path)
     return VFS_EPERM;  // Can't delete root
 }
 
+static int ramfs_dir_rename(struct file_system *fs, const char *oldpath, const char *newpath)
+{
+    if (!fs || !oldpath || !newpath) {
+        return VFS_EINVAL;
+    }
+    
+    struct ramfs_fs_data *fs_data = (struct ramfs_fs_data *)fs->private_data;
+    if (!fs_data) {
+        return VFS_ERROR;
+    }
+    
+    struct ramfs_node *node = ramfs_resolve_path(fs_data, oldpath);
+    if (!node) {
+        return VFS_ENOENT;
+    }
+    if (!node->parent) {
+        return VFS_EPERM;  // Can't move root
+    }
+    
+    char *parent_path = vfs_get_dirname(newpath);
+    if (!parent_path) {
+        return VFS_ENOMEM;
+    }
+    struct ramfs_node *new_parent = ramfs_resolve_path(fs_data, parent_path);
+    kfree(parent_path);
+    if (!new_parent) {
+        return VFS_ENOENT;
+    }
+    if ((new_parent->mode & VFS_FILE_DIRECTORY) == 0) {
+        return VFS_EINVAL;
+    }
+    
+    char *new_name = vfs_get_filename(newpath);
+    if (!new_name || new_name[0] == '\0' || strlen(new_name) > RAMFS_MAX_NAME) {
+        return VFS_EINVAL;
+    }
+    
+    // A directory can't move below itself
+    for (struct ramfs_node *p = new_parent; p; p = p->parent) {
+        if (p == node) {
+            return VFS_EINVAL;
+        }
+    }
+    
+    struct ramfs_node *target = ramfs_find_node(new_parent, new_name);
+    if (target == node) {
+        return VFS_SUCCESS;
+    }
+    if (target) {
+        // Only a file replaces a file
+        if ((target->mode & VFS_FILE_DIRECTORY) || (node->mode & VFS_FILE_DIRECTORY)) {
+            return VFS_EEXIST;
+        }
+        ramfs_remove_child(new_parent, new_name);
+    }
+    
+    // Relink the node; its data stays where it is
+    struct ramfs_node *old_parent = node->parent;
+    ramfs_unlink_child(old_parent, node);
+    strcpy(node->name, new_name);
+    node->name_hash = ramfs_name_hash(node->name);
+    ramfs_add_child(new_parent, node);
+    
+    old_parent->modified_time++;
+    new_parent->modified_time++;
+    return VFS_SUCCESS;
+}
+
 static struct inode *ramfs_dir_lookup(struct file_system *fs, struct inode *parent, const char *name)
 {
     if (!fs || !parent || !name) {
@@ -732,13 +1053,7 @@ int ramfs_populate_initial_files(struct file_system *fs)
     struct ramfs_node *welcome = ramfs_resolve_path(fs_data, "/welcome.txt");
     if (welcome) {
         const char *content = "Welcome to MiniOS!\n\nThis is a fully functional RAM disk file system.\nTry these commands:\n  ls\n  cat welcome.txt\n  mkdir test\n  cd test\n  pwd\n\nEnjoy exploring!\n";
-        size_t len = strlen(content);
-        welcome->data = kmalloc(len + 1);
-        if (welcome->data) {
-            memcpy(welcome->data, content, len);
-            ((char *)welcome->data)[len] = '\0';
-            welcome->size = len;
-        }
+        ramfs_node_write(welcome, content, strlen(content), 0);
     }
 
     early_print("Initial file structure created\n");
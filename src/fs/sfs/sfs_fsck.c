@@ -0,0 +1,1155 @@
+/*
+ * MiniOS SFS Consistency Check
+ *
+ * Works on the device, never through a mount. Pass 1 reads the inode
+ * table SFS_FSCK_BATCH blocks at a time and claims every block an inode
+ * maps in a shared ownership bitmap; a claim is an atomic or, so a block
+ * claimed twice is seen exactly once. Pass 2 reads every directory and
+ * records, per inode, the directory naming it. Both passes are split by
+ * range across worker tasks, one per CPU. Pass 3 runs alone: an inode is
+ * reachable when its chain of parents ends at the root, and the bitmaps
+ * and superblock counters must match what the first two passes found.
+ *
+ * Repair rewrites the bitmaps and counters from what was found, clears
+ * directory entries naming free inodes and releases unreachable inodes,
+ * since SFS has no lost+found. Blocks claimed twice and inodes with two
+ * names are only reported.
+ */
+
+#include "sfs.h"
+#include "memory.h"
+#include "kernel.h"
+#include "format.h"
+#include "process.h"
+#include "smp.h"
+#include <stdarg.h>
+#include <string.h>
+
+// What pass 1 found in each inode
+#define SFS_FSCK_FREE           0
+#define SFS_FSCK_FILE           1
+#define SFS_FSCK_DIR            2
+
+// Reachability, in pass 3
+#define SFS_FSCK_UNKNOWN        0
+#define SFS_FSCK_REACHABLE      1
+#define SFS_FSCK_UNREACHABLE    2
+#define SFS_FSCK_VISITING       3
+
+#define SFS_FSCK_PASS_INODES    1
+#define SFS_FSCK_PASS_DIRS      2
+
+struct sfs_fsck;
+
+struct sfs_fsck_worker {
+    struct sfs_fsck *check;
+    uint32_t first;                         // Items [first, end) of the pass
+    uint32_t end;
+    uint8_t *batch;                         // SFS_FSCK_BATCH inode table blocks
+    uint32_t *ptrs;                         // Indirect or extent block
+    uint32_t *ptrs2;                        // Second level of a double indirect tree
+    uint8_t *block;                         // Directory or inode table block
+    int dir_indexed;                        // Directory being scanned has an index
+};
+
+struct sfs_fsck {
+    struct block_device *dev;               // In SFS blocks, a view if need be
+    struct sfs_superblock sb;
+    struct sfs_geometry geo;
+    uint32_t flags;
+    uint32_t total_inodes;
+    uint32_t table;                         // First inode table block
+    uint32_t words;                         // 64-bit words in a block bitmap
+    uint64_t *owned;                        // Blocks claimed
+    uint64_t *dup;                          // Blocks claimed more than once
+    uint8_t *inode_bitmap;                  // As on disk; NULL without the feature
+    uint8_t *state;                         // SFS_FSCK_FREE/FILE/DIR per inode
+    uint32_t *parent;                       // Directory naming each inode, 0 if none
+    uint32_t *dirs;                         // Directory inodes, from pass 1
+    uint32_t dir_count;
+    struct sfs_fsck_result *result;
+    int pass;
+    int error;                              // I/O error met by any worker
+    uint32_t messages;
+    uint32_t pending;                       // Workers still running
+};
+
+// Workers touch nothing of the check after their last decrement
+static struct wait_queue sfs_fsck_wait = WAIT_QUEUE_INIT;
+
+static uint32_t sfs_fsck_popcount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (uint32_t)((x * 0x0101010101010101ULL) >> 56);
+}
+
+// Set bits among the first 'bits' of bitmap
+static uint32_t sfs_fsck_count_bits(const uint8_t *bitmap, uint32_t bits)
+{
+    const uint64_t *words = (const uint64_t *)bitmap;
+    uint32_t count = 0;
+    for (uint32_t word = 0; word < bits / 64; word++) {
+        count += sfs_fsck_popcount(words[word]);
+    }
+    if (bits % 64) {
+        count += sfs_fsck_popcount(words[bits / 64] & ((1ULL << (bits % 64)) - 1));
+    }
+    return count;
+}
+
+static void sfs_fsck_report(struct sfs_fsck *check, const char *fmt, ...)
+{
+    if (__atomic_fetch_add(&check->messages, 1, __ATOMIC_RELAXED) >= SFS_FSCK_MAX_MESSAGES) {
+        return;
+    }
+
+    char line[128];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n > sizeof(line) - 2) {
+        n = sizeof(line) - 2;
+    }
+    line[n] = '\n';
+    line[n + 1] = '\0';
+    early_print("fsck: ");
+    early_print(line);
+}
+
+// Count a problem of one kind; counters are shared by the workers
+static void sfs_fsck_problem(struct sfs_fsck *check, uint32_t *counter, int fixed)
+{
+    if (counter) {
+        __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&check->result->problems, 1, __ATOMIC_RELAXED);
+    if (fixed) {
+        __atomic_fetch_add(&check->result->fixed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int sfs_fsck_read(struct sfs_fsck *check, uint32_t block, void *buffer)
+{
+    if (block_device_read(check->dev, block, buffer) != BLOCK_SUCCESS) {
+        __atomic_store_n(&check->error, VFS_EIO, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+static inline int sfs_fsck_data_block(const struct sfs_fsck *check, uint32_t block)
+{
+    return block >= check->sb.first_data_block && block < check->sb.total_blocks;
+}
+
+static inline int sfs_fsck_itable_uninit(const struct sfs_fsck *check, uint32_t block_index)
+{
+    return (check->sb.features & SFS_FEATURE_LAZY_ITABLE) &&
+           sfs_test_bit(check->sb.itable_uninit, block_index / check->sb.itable_group_blocks);
+}
+
+/**
+ * Called for each block an inode maps: data blocks with their file block,
+ * and the indirect, double indirect and extent blocks (data == 0). A
+ * nonzero return skips a data run, or the blocks below a pointer block.
+ */
+typedef int (*sfs_fsck_block_fn)(struct sfs_fsck_worker *worker, uint32_t ino,
+                                 uint32_t logical, uint32_t block, int data);
+
+static void sfs_fsck_walk(struct sfs_fsck_worker *worker, uint32_t ino,
+                          const struct sfs_inode *inode, sfs_fsck_block_fn fn)
+{
+    struct sfs_fsck *check = worker->check;
+
+    if (inode->flags & SFS_INODE_INLINE) {
+        return;
+    }
+
+    if (inode->flags & SFS_INODE_EXTENTS) {
+        uint32_t count = inode->extent_count;
+        if (count > check->geo.max_extents) {
+            count = check->geo.max_extents;
+        }
+        const struct sfs_extent *more = (const struct sfs_extent *)worker->ptrs;
+        if (count > SFS_INLINE_EXTENTS &&
+            (!inode->extent_block || fn(worker, ino, 0, inode->extent_block, 0) ||
+             !sfs_fsck_read(check, inode->extent_block, worker->ptrs))) {
+            count = SFS_INLINE_EXTENTS;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const struct sfs_extent *ext = i < SFS_INLINE_EXTENTS ? &inode->extents[i] :
+                                           &more[i - SFS_INLINE_EXTENTS];
+            uint32_t len = ext->length & ~SFS_EXTENT_UNWRITTEN;
+            for (uint32_t j = 0; j < len; j++) {
+                if (fn(worker, ino, ext->logical + j, ext->start + j, 1)) {
+                    break;
+                }
+            }
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < SFS_DIRECT_BLOCKS; i++) {
+        if (inode->direct[i]) {
+            fn(worker, ino, i, inode->direct[i], 1);
+        }
+    }
+
+    if (inode->indirect && !fn(worker, ino, 0, inode->indirect, 0) &&
+        sfs_fsck_read(check, inode->indirect, worker->ptrs)) {
+        for (uint32_t i = 0; i < check->geo.ptrs_per_block; i++) {
+            if (worker->ptrs[i]) {
+                fn(worker, ino, SFS_DIRECT_BLOCKS + i, worker->ptrs[i], 1);
+            }
+        }
+    }
+
+    if (inode->double_indirect && !fn(worker, ino, 0, inode->double_indirect, 0) &&
+        sfs_fsck_read(check, inode->double_indirect, worker->ptrs)) {
+        uint32_t base = SFS_DIRECT_BLOCKS + check->geo.ptrs_per_block;
+        for (uint32_t i = 0; i < check->geo.ptrs_per_block; i++) {
+            uint32_t leaf = worker->ptrs[i];
+            if (!leaf || fn(worker, ino, 0, leaf, 0) || !sfs_fsck_read(check, leaf, worker->ptrs2)) {
+                continue;
+            }
+            for (uint32_t j = 0; j < check->geo.ptrs_per_block; j++) {
+                if (worker->ptrs2[j]) {
+                    fn(worker, ino, base + i * check->geo.ptrs_per_block + j, worker->ptrs2[j], 1);
+                }
+            }
+        }
+    }
+}
+
+// Pass 1: take ownership of a block
+static int sfs_fsck_claim(struct sfs_fsck_worker *worker, uint32_t ino,
+                          uint32_t logical, uint32_t block, int data)
+{
+    struct sfs_fsck *check = worker->check;
+    (void)logical;
+    (void)data;
+
+    if (!sfs_fsck_data_block(check, block)) {
+        sfs_fsck_problem(check, &check->result->bad_blocks, 0);
+        sfs_fsck_report(check, "inode %u: block %u is outside the data area", ino, block);
+        return 1;
+    }
+
+    uint64_t bit = 1ULL << (block % 64);
+    if (__atomic_fetch_or(&check->owned[block / 64], bit, __ATOMIC_RELAXED) & bit) {
+        __atomic_fetch_or(&check->dup[block / 64], bit, __ATOMIC_RELAXED);
+        sfs_fsck_problem(check, &check->result->dup_blocks, 0);
+        sfs_fsck_report(check, "inode %u: block %u is claimed twice", ino, block);
+        return 1;
+    }
+    return 0;
+}
+
+// Pass 3: give a released inode's blocks back, unless another owner shares them
+static int sfs_fsck_unclaim(struct sfs_fsck_worker *worker, uint32_t ino,
+                            uint32_t logical, uint32_t block, int data)
+{
+    struct sfs_fsck *check = worker->check;
+    (void)ino;
+    (void)logical;
+    (void)data;
+
+    if (!sfs_fsck_data_block(check, block)) {
+        return 1;
+    }
+    uint64_t bit = 1ULL << (block % 64);
+    if (check->dup[block / 64] & bit) {
+        return 1;
+    }
+    check->owned[block / 64] &= ~bit;
+    return 0;
+}
+
+static void sfs_fsck_inode(struct sfs_fsck_worker *worker, uint32_t ino,
+                           const struct sfs_inode *inode)
+{
+    struct sfs_fsck *check = worker->check;
+
+    if (inode->mode == 0) {
+        return;
+    }
+
+    if (inode->mode & SFS_TYPE_DIRECTORY) {
+        check->state[ino - 1] = SFS_FSCK_DIR;
+        uint32_t slot = __atomic_fetch_add(&check->dir_count, 1, __ATOMIC_RELAXED);
+        check->dirs[slot] = ino;
+    } else {
+        check->state[ino - 1] = SFS_FSCK_FILE;
+    }
+    sfs_fsck_walk(worker, ino, inode, sfs_fsck_claim);
+}
+
+/**
+ * Pass 1: an inode table block against its checksum. The inodes in it
+ * are checked as usual, so a repair seals the block again as it is.
+ */
+static void sfs_fsck_table_csum(struct sfs_fsck *check, uint32_t block, void *data)
+{
+    if (!sfs_csum_enabled(&check->sb) || sfs_csum_verify(block, data, check->geo.block_size)) {
+        return;
+    }
+
+    int repair = (check->flags & SFS_FSCK_REPAIR) != 0;
+    sfs_fsck_problem(check, &check->result->csum_errors, repair);
+    sfs_fsck_report(check, "inode table block %u fails its checksum", block);
+    if (repair) {
+        sfs_csum_set(block, data, check->geo.block_size);
+        if (block_device_write(check->dev, block, data) != BLOCK_SUCCESS) {
+            __atomic_store_n(&check->error, VFS_EIO, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Pass 1 over inode table blocks [first, end)
+static void sfs_fsck_scan_inodes(struct sfs_fsck_worker *worker)
+{
+    struct sfs_fsck *check = worker->check;
+
+    uint32_t block = worker->first;
+    while (block < worker->end) {
+        // Groups never zeroed hold no inodes, only whatever was there
+        if (sfs_fsck_itable_uninit(check, block)) {
+            block++;
+            continue;
+        }
+        uint32_t count = 1;
+        while (count < SFS_FSCK_BATCH && block + count < worker->end &&
+               !sfs_fsck_itable_uninit(check, block + count)) {
+            count++;
+        }
+        if (block_device_read_blocks(check->dev, check->table + block, count,
+                                     worker->batch) != BLOCK_SUCCESS) {
+            __atomic_store_n(&check->error, VFS_EIO, __ATOMIC_RELAXED);
+            return;
+        }
+
+        for (uint32_t b = 0; b < count; b++) {
+            uint8_t *table_block = worker->batch + b * check->geo.block_size;
+            sfs_fsck_table_csum(check, check->table + block + b, table_block);
+            const struct sfs_inode *inodes = (const struct sfs_inode *)table_block;
+            for (uint32_t entry = 0; entry < check->geo.inodes_per_block; entry++) {
+                sfs_fsck_inode(worker, (block + b) * check->geo.inodes_per_block + entry + 1,
+                               &inodes[entry]);
+            }
+        }
+        block += count;
+    }
+}
+
+// Pass 2: check the entries of one directory block
+static int sfs_fsck_dir_block(struct sfs_fsck_worker *worker, uint32_t ino,
+                              uint32_t logical, uint32_t block, int data)
+{
+    struct sfs_fsck *check = worker->check;
+
+    if (!sfs_fsck_data_block(check, block)) {
+        return 1;  // Reported in pass 1
+    }
+    if (!data) {
+        return 0;
+    }
+    if (!sfs_fsck_read(check, block, worker->block)) {
+        return 1;
+    }
+
+    int repair = (check->flags & SFS_FSCK_REPAIR) != 0;
+    int dirty = 0;
+    if (sfs_csum_enabled(&check->sb) && !sfs_csum_verify(block, worker->block, check->geo.block_size)) {
+        sfs_fsck_problem(check, &check->result->csum_errors, repair);
+        sfs_fsck_report(check, "directory %u: block %u fails its checksum", ino, block);
+        dirty = repair;
+    }
+
+    if (worker->dir_indexed) {
+        if (logical == 0) {
+            if (((const struct sfs_dir_index *)worker->block)->magic != SFS_DIR_INDEX_MAGIC) {
+                sfs_fsck_problem(check, NULL, 0);
+                sfs_fsck_report(check, "directory %u: index block %u is damaged", ino, block);
+            }
+            return 0;
+        }
+        const struct sfs_dir_leaf_tail *tail =
+            (const struct sfs_dir_leaf_tail *)(worker->block + check->geo.dir_tail_offset);
+        if (tail->magic != SFS_DIR_LEAF_MAGIC) {
+            sfs_fsck_problem(check, NULL, 0);
+            sfs_fsck_report(check, "directory %u: leaf block %u is damaged", ino, block);
+        }
+    }
+
+    struct sfs_dirent *entries = (struct sfs_dirent *)worker->block;
+    for (uint32_t i = 0; i < check->geo.dirents_per_block; i++) {
+        uint32_t target = entries[i].inode;
+        if (target == 0) {
+            continue;
+        }
+
+        if (target > check->total_inodes || target == check->sb.root_inode ||
+            check->state[target - 1] == SFS_FSCK_FREE) {
+            sfs_fsck_problem(check, &check->result->bad_entries, repair);
+            sfs_fsck_report(check, "directory %u: '%.40s' names free inode %u",
+                            ino, entries[i].name, target);
+            if (repair) {
+                entries[i].inode = 0;
+                dirty = 1;
+            }
+            continue;
+        }
+
+        uint32_t expected = 0;
+        if (!__atomic_compare_exchange_n(&check->parent[target - 1], &expected, ino, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            sfs_fsck_problem(check, &check->result->extra_names, 0);
+            sfs_fsck_report(check, "inode %u: second name '%.40s' in directory %u",
+                            target, entries[i].name, ino);
+        }
+    }
+
+    if (!dirty) {
+        return 0;
+    }
+    if (sfs_csum_enabled(&check->sb)) {
+        sfs_csum_set(block, worker->block, check->geo.block_size);
+    }
+    if (block_device_write(check->dev, block, worker->block) != BLOCK_SUCCESS) {
+        __atomic_store_n(&check->error, VFS_EIO, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+// Read one inode from the table into *inode
+static int sfs_fsck_read_inode(struct sfs_fsck_worker *worker, uint32_t ino,
+                               struct sfs_inode *inode)
+{
+    struct sfs_fsck *check = worker->check;
+    uint32_t index = ino - 1;
+    if (!sfs_fsck_read(check, check->table + index / check->geo.inodes_per_block, worker->block)) {
+        return 0;
+    }
+    memcpy(inode, (struct sfs_inode *)worker->block + index % check->geo.inodes_per_block,
+           sizeof(*inode));
+    return 1;
+}
+
+// Pass 2 over directories [first, end) of the list pass 1 built
+static void sfs_fsck_scan_dirs(struct sfs_fsck_worker *worker)
+{
+    struct sfs_inode inode;
+    for (uint32_t i = worker->first; i < worker->end; i++) {
+        uint32_t ino = worker->check->dirs[i];
+        if (!sfs_fsck_read_inode(worker, ino, &inode)) {
+            continue;
+        }
+        worker->dir_indexed = (inode.flags & SFS_INODE_DIR_INDEX) != 0;
+        sfs_fsck_walk(worker, ino, &inode, sfs_fsck_dir_block);
+    }
+}
+
+static void sfs_fsck_work(struct sfs_fsck_worker *worker)
+{
+    if (worker->check->pass == SFS_FSCK_PASS_INODES) {
+        sfs_fsck_scan_inodes(worker);
+    } else {
+        sfs_fsck_scan_dirs(worker);
+    }
+}
+
+static void sfs_fsck_worker_main(void *arg)
+{
+    struct sfs_fsck_worker *worker = (struct sfs_fsck_worker *)arg;
+    struct sfs_fsck *check = worker->check;
+
+    sfs_fsck_work(worker);
+
+    __atomic_fetch_sub(&check->pending, 1, __ATOMIC_RELEASE);
+    wake_up(&sfs_fsck_wait);
+}
+
+// Split items across the workers; the caller takes the first share
+static int sfs_fsck_run(struct sfs_fsck *check, struct sfs_fsck_worker *workers,
+                        uint32_t count, int pass, uint32_t items)
+{
+    check->pass = pass;
+    check->pending = 0;
+
+    uint32_t share = (items + count - 1) / count;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t first = i * share;
+        workers[i].first = first < items ? first : items;
+        workers[i].end = first + share < items ? first + share : items;
+    }
+
+    for (uint32_t i = 1; i < count; i++) {
+        if (workers[i].first == workers[i].end) {
+            continue;
+        }
+        __atomic_fetch_add(&check->pending, 1, __ATOMIC_RELAXED);
+        if (process_create_fair(sfs_fsck_worker_main, &workers[i], "fsck", 0) < 0) {
+            __atomic_fetch_sub(&check->pending, 1, __ATOMIC_RELAXED);
+            sfs_fsck_work(&workers[i]);
+        }
+    }
+    sfs_fsck_work(&workers[0]);
+
+    wait_event(&sfs_fsck_wait, __atomic_load_n(&check->pending, __ATOMIC_ACQUIRE) == 0);
+    return check->error;
+}
+
+/**
+ * Pass 3, reachability: follow each inode's parents until the root, an
+ * inode already decided, or a dead end (no parent, or a cycle), then mark
+ * the whole chain with the outcome
+ */
+static void sfs_fsck_reach(struct sfs_fsck *check, uint8_t *marks)
+{
+    marks[check->sb.root_inode - 1] = SFS_FSCK_REACHABLE;
+
+    for (uint32_t ino = 1; ino <= check->total_inodes; ino++) {
+        if (check->state[ino - 1] == SFS_FSCK_FREE || marks[ino - 1] != SFS_FSCK_UNKNOWN) {
+            continue;
+        }
+
+        uint32_t at = ino;
+        while (marks[at - 1] == SFS_FSCK_UNKNOWN) {
+            marks[at - 1] = SFS_FSCK_VISITING;
+            uint32_t up = check->parent[at - 1];
+            if (!up) {
+                break;
+            }
+            at = up;
+        }
+        uint8_t outcome = marks[at - 1] == SFS_FSCK_REACHABLE ? SFS_FSCK_REACHABLE :
+                                                                SFS_FSCK_UNREACHABLE;
+
+        for (at = ino; at && marks[at - 1] == SFS_FSCK_VISITING; at = check->parent[at - 1]) {
+            marks[at - 1] = outcome;
+        }
+    }
+}
+
+// Pass 3: forget an unreachable inode and free what it held
+static void sfs_fsck_release(struct sfs_fsck_worker *worker, uint32_t ino)
+{
+    struct sfs_fsck *check = worker->check;
+    struct sfs_inode inode;
+    if (!sfs_fsck_read_inode(worker, ino, &inode)) {
+        return;
+    }
+    sfs_fsck_walk(worker, ino, &inode, sfs_fsck_unclaim);
+
+    // The walk reused the block buffer; the table block is read again
+    uint32_t index = ino - 1;
+    uint32_t block = check->table + index / check->geo.inodes_per_block;
+    if (!sfs_fsck_read(check, block, worker->block)) {
+        return;
+    }
+    memset((struct sfs_inode *)worker->block + index % check->geo.inodes_per_block, 0,
+           sizeof(struct sfs_inode));
+    if (sfs_csum_enabled(&check->sb)) {
+        sfs_csum_set(block, worker->block, check->geo.block_size);
+    }
+    if (block_device_write(check->dev, block, worker->block) != BLOCK_SUCCESS) {
+        check->error = VFS_EIO;
+        return;
+    }
+    check->state[index] = SFS_FSCK_FREE;
+}
+
+static int sfs_fsck_orphans(struct sfs_fsck *check, struct sfs_fsck_worker *worker)
+{
+    uint8_t *marks = kmalloc(check->total_inodes);
+    if (!marks) {
+        return VFS_ENOMEM;
+    }
+    memset(marks, 0, check->total_inodes);
+    sfs_fsck_reach(check, marks);
+
+    int repair = (check->flags & SFS_FSCK_REPAIR) != 0;
+    for (uint32_t ino = 1; ino <= check->total_inodes; ino++) {
+        if (check->state[ino - 1] == SFS_FSCK_FREE || marks[ino - 1] != SFS_FSCK_UNREACHABLE) {
+            continue;
+        }
+        sfs_fsck_problem(check, &check->result->orphans, repair);
+        sfs_fsck_report(check, "inode %u is in no directory%s", ino, repair ? ", released" : "");
+        if (repair) {
+            sfs_fsck_release(worker, ino);
+        }
+    }
+    kfree(marks);
+    return check->error;
+}
+
+// Pass 3: the inode bitmap against the inodes found in use
+static int sfs_fsck_inode_bitmap(struct sfs_fsck *check)
+{
+    uint32_t used = 0;
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < check->total_inodes; i++) {
+        int in_use = check->state[i] != SFS_FSCK_FREE;
+        used += in_use;
+        if (!check->inode_bitmap || sfs_test_bit(check->inode_bitmap, i) == in_use) {
+            continue;
+        }
+        wrong++;
+        sfs_fsck_report(check, "inode %u is %s but marked %s", i + 1,
+                        in_use ? "in use" : "free", in_use ? "free" : "in use");
+        if (in_use) {
+            sfs_set_bit(check->inode_bitmap, i);
+        } else {
+            sfs_clear_bit(check->inode_bitmap, i);
+        }
+    }
+    check->result->inodes = used;
+    check->result->free_inodes = check->total_inodes - used;
+    if (!wrong) {
+        return VFS_SUCCESS;
+    }
+
+    int repair = (check->flags & SFS_FSCK_REPAIR) != 0;
+    check->result->inode_bitmap_errors = wrong;
+    check->result->problems += wrong;
+    if (!repair) {
+        return VFS_SUCCESS;
+    }
+    uint32_t start = SFS_BITMAP_START + check->sb.bitmap_blocks;
+    for (uint32_t i = 0; i < check->sb.inode_bitmap_blocks; i++) {
+        if (block_device_write(check->dev, start + i,
+                               check->inode_bitmap + i * check->geo.block_size) != BLOCK_SUCCESS) {
+            return VFS_EIO;
+        }
+    }
+    check->result->fixed += wrong;
+    return VFS_SUCCESS;
+}
+
+// Pass 3: the block bitmap against ownership
+static int sfs_fsck_block_bitmap(struct sfs_fsck *check, uint8_t *bitmap)
+{
+    const uint64_t *disk = (const uint64_t *)bitmap;
+    uint32_t total = check->sb.total_blocks;
+    uint32_t in_use_free = 0;
+    uint32_t leaked = 0;
+    for (uint32_t word = 0; word * 64 < total; word++) {
+        uint64_t valid = total - word * 64 >= 64 ? ~0ULL : (1ULL << (total - word * 64)) - 1;
+        uint64_t missing = check->owned[word] & ~disk[word] & valid;
+        uint64_t extra = disk[word] & ~check->owned[word] & valid;
+        if (missing) {
+            in_use_free += sfs_fsck_popcount(missing);
+            for (uint32_t bit = 0; bit < 64; bit++) {
+                if (missing & (1ULL << bit)) {
+                    sfs_fsck_report(check, "block %u is in use but marked free", word * 64 + bit);
+                }
+            }
+        }
+        leaked += sfs_fsck_popcount(extra);
+    }
+    if (leaked) {
+        sfs_fsck_report(check, "%u blocks are marked in use but owned by nothing", leaked);
+    }
+
+    check->result->blocks = sfs_fsck_count_bits((const uint8_t *)check->owned, total);
+    check->result->free_blocks = total - check->result->blocks;
+    uint32_t wrong = in_use_free + leaked;
+    if (!wrong) {
+        return VFS_SUCCESS;
+    }
+
+    check->result->block_bitmap_errors = wrong;
+    check->result->problems += wrong;
+    if (!(check->flags & SFS_FSCK_REPAIR)) {
+        return VFS_SUCCESS;
+    }
+    for (uint32_t i = 0; i < check->sb.bitmap_blocks; i++) {
+        if (block_device_write(check->dev, SFS_BITMAP_START + i,
+                               (const uint8_t *)check->owned + i * check->geo.block_size) != BLOCK_SUCCESS) {
+            return VFS_EIO;
+        }
+    }
+    memcpy(bitmap, check->owned, check->sb.bitmap_blocks * check->geo.block_size);  // As on disk
+    check->result->fixed += wrong;
+    return VFS_SUCCESS;
+}
+
+/**
+ * Bitmap blocks against the checksums in the superblock, reporting those
+ * that differ; with update, the checksums are set from the bitmaps
+ * instead, as repairs have left them on disk
+ * @return Number of checksums that differed
+ */
+static uint32_t sfs_fsck_bitmap_csums(struct sfs_fsck *check, const uint8_t *bitmap, int update)
+{
+    if (!sfs_csum_enabled(&check->sb)) {
+        return 0;
+    }
+
+    uint32_t blocks = check->sb.bitmap_blocks;
+    uint32_t total = blocks + (check->inode_bitmap ? check->sb.inode_bitmap_blocks : 0);
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        const uint8_t *data = i < blocks ? bitmap + i * check->geo.block_size :
+                              check->inode_bitmap + (i - blocks) * check->geo.block_size;
+        uint32_t csum = sfs_csum_bitmap(SFS_BITMAP_START + i, data, check->geo.block_size);
+        if (csum == check->sb.bitmap_csum[i]) {
+            continue;
+        }
+        wrong++;
+        if (update) {
+            check->sb.bitmap_csum[i] = csum;
+        } else {
+            sfs_fsck_problem(check, &check->result->csum_errors,
+                             (check->flags & SFS_FSCK_REPAIR) != 0);
+            sfs_fsck_report(check, "bitmap block %u fails its checksum", SFS_BITMAP_START + i);
+        }
+    }
+    return wrong;
+}
+
+/**
+ * Superblock counters against the counts found; corrected in sb when
+ * repairing. Returns the number of counters that were wrong.
+ */
+static uint32_t sfs_fsck_check_counters(struct sfs_fsck *check, uint32_t free_blocks,
+                                        uint32_t free_inodes)
+{
+    struct sfs_fsck_result *result = check->result;
+    uint32_t wrong = 0;
+    int repair = (check->flags & SFS_FSCK_REPAIR) != 0;
+
+    result->free_blocks = free_blocks;
+    result->free_inodes = free_inodes;
+    if (check->sb.free_blocks != free_blocks) {
+        sfs_fsck_problem(check, NULL, repair);
+        sfs_fsck_report(check, "superblock has %u free blocks, bitmap %u",
+                        check->sb.free_blocks, free_blocks);
+        check->sb.free_blocks = free_blocks;
+        wrong++;
+    }
+    if (check->sb.free_inodes != free_inodes) {
+        sfs_fsck_problem(check, NULL, repair);
+        sfs_fsck_report(check, "superblock has %u free inodes, bitmap %u",
+                        check->sb.free_inodes, free_inodes);
+        check->sb.free_inodes = free_inodes;
+        wrong++;
+    }
+    return wrong;
+}
+
+// Inodes in use, from the inode table; for filesystems without an inode bitmap
+static int sfs_fsck_count_table(struct sfs_fsck *check, uint8_t *batch, uint32_t *used)
+{
+    *used = 0;
+    for (uint32_t block = 0; block < check->sb.inode_blocks; block += SFS_FSCK_BATCH) {
+        uint32_t count = check->sb.inode_blocks - block;
+        if (count > SFS_FSCK_BATCH) {
+            count = SFS_FSCK_BATCH;
+        }
+        if (block_device_read_blocks(check->dev, check->table + block, count,
+                                     batch) != BLOCK_SUCCESS) {
+            return VFS_EIO;
+        }
+        for (uint32_t b = 0; b < count; b++) {
+            const struct sfs_inode *inodes =
+                (const struct sfs_inode *)(batch + b * check->geo.block_size);
+            for (uint32_t entry = 0; entry < check->geo.inodes_per_block; entry++) {
+                *used += inodes[entry].mode != 0;
+            }
+        }
+    }
+    return VFS_SUCCESS;
+}
+
+/**
+ * The fast check: metadata blocks marked in use, and the free counts the
+ * superblock keeps against the bitmaps
+ */
+static int sfs_fsck_fast(struct sfs_fsck *check, uint8_t *bitmap, uint8_t *batch)
+{
+    int repair = (check->flags & SFS_FSCK_REPAIR) != 0;
+    uint32_t unmarked = 0;
+    for (uint32_t block = 0; block < check->sb.first_data_block; block++) {
+        if (!sfs_test_bit(bitmap, block)) {
+            sfs_set_bit(bitmap, block);
+            unmarked++;
+        }
+    }
+    if (unmarked) {
+        sfs_fsck_report(check, "%u metadata blocks are marked free", unmarked);
+        check->result->block_bitmap_errors = unmarked;
+        check->result->problems += unmarked;
+        if (repair) {
+            for (uint32_t i = 0; i < check->sb.bitmap_blocks; i++) {
+                if (block_device_write(check->dev, SFS_BITMAP_START + i,
+                                       bitmap + i * check->geo.block_size) != BLOCK_SUCCESS) {
+                    return VFS_EIO;
+                }
+            }
+            check->result->fixed += unmarked;
+        }
+    }
+
+    uint32_t used_blocks = sfs_fsck_count_bits(bitmap, check->sb.total_blocks);
+    uint32_t used_inodes = 0;
+    if (check->inode_bitmap) {
+        used_inodes = sfs_fsck_count_bits(check->inode_bitmap, check->total_inodes);
+    } else if (sfs_fsck_count_table(check, batch, &used_inodes) != VFS_SUCCESS) {
+        return VFS_EIO;
+    }
+    check->result->blocks = used_blocks;
+    check->result->inodes = used_inodes;
+    return sfs_fsck_check_counters(check, check->sb.total_blocks - used_blocks,
+                                   check->total_inodes - used_inodes) ? 1 : 0;
+}
+
+static void sfs_fsck_free_workers(struct sfs_fsck_worker *workers, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (workers[i].batch) {
+            kfree(workers[i].batch);
+        }
+        if (workers[i].ptrs) {
+            kfree(workers[i].ptrs);
+        }
+        if (workers[i].ptrs2) {
+            kfree(workers[i].ptrs2);
+        }
+        if (workers[i].block) {
+            kfree(workers[i].block);
+        }
+    }
+}
+
+// As many workers as there are CPUs and buffers for, at least one
+static uint32_t sfs_fsck_alloc_workers(struct sfs_fsck *check, struct sfs_fsck_worker *workers)
+{
+    uint32_t want = smp_num_cpus();
+    if (want > SFS_FSCK_MAX_WORKERS) {
+        want = SFS_FSCK_MAX_WORKERS;
+    }
+    if (want == 0) {
+        want = 1;
+    }
+
+    uint32_t count = 0;
+    memset(workers, 0, SFS_FSCK_MAX_WORKERS * sizeof(*workers));
+    while (count < want) {
+        struct sfs_fsck_worker *worker = &workers[count];
+        worker->check = check;
+        worker->batch = kmalloc(SFS_FSCK_BATCH * check->geo.block_size);
+        worker->ptrs = kmalloc(check->geo.block_size);
+        worker->ptrs2 = kmalloc(check->geo.block_size);
+        worker->block = kmalloc(check->geo.block_size);
+        if (!worker->batch || !worker->ptrs || !worker->ptrs2 || !worker->block) {
+            sfs_fsck_free_workers(worker, 1);
+            memset(worker, 0, sizeof(*worker));
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Check the SFS filesystem on dev, which must not be mounted. Problems
+ * are counted in *result and the first few described on the console.
+ * Without SFS_FSCK_REPAIR nothing is written, and a journal holding
+ * committed transactions is noted rather than replayed.
+ * @return VFS_SUCCESS once the check ran, whatever it found
+ */
+int sfs_fsck(struct block_device *dev, uint32_t flags, struct sfs_fsck_result *result)
+{
+    if (!dev || !result) {
+        return VFS_EINVAL;
+    }
+    memset(result, 0, sizeof(*result));
+
+    struct sfs_fsck *check = kmalloc(sizeof(struct sfs_fsck));
+    struct sfs_fsck_worker *workers = kmalloc(SFS_FSCK_MAX_WORKERS * sizeof(struct sfs_fsck_worker));
+    uint32_t worker_count = 0;
+    uint8_t *bitmap = NULL;
+    int sb_dirty = 0;
+    int ret = VFS_ENOMEM;
+    if (!check || !workers) {
+        goto out;
+    }
+    memset(check, 0, sizeof(*check));
+    check->dev = dev;
+    check->flags = flags;
+    check->result = result;
+
+    ret = VFS_EIO;
+    if (sfs_read_superblock(dev, &check->sb) != VFS_SUCCESS) {
+        goto out;
+    }
+
+    // Blocks of another size than the device's go through a view of it
+    int sane = sfs_validate_superblock(&check->sb) == VFS_SUCCESS &&
+               sfs_geometry_init(&check->geo, check->sb.block_size) == VFS_SUCCESS;
+    if (sane && check->sb.block_size != dev->block_size) {
+        dev = block_view_create(dev, check->sb.block_size);
+        if (!dev) {
+            ret = VFS_ENOMEM;
+            goto out;
+        }
+        check->dev = dev;
+    }
+    if (!sane || check->sb.total_blocks > dev->num_blocks ||
+        check->sb.first_data_block >= check->sb.total_blocks ||
+        check->sb.root_inode == 0 ||
+        (uint64_t)check->sb.bitmap_blocks * check->geo.block_size * 8 < check->sb.total_blocks) {
+        early_print("fsck: no usable SFS superblock\n");
+        result->problems = 1;
+        ret = VFS_EINVAL;
+        goto out;
+    }
+
+    // Committed transactions are part of the filesystem
+    int pending = sfs_journal_pending(dev, &check->sb);
+    if (pending < 0) {
+        goto out;
+    }
+    if (pending > 0) {
+        result->journal_pending = (uint32_t)pending;
+        if (flags & SFS_FSCK_REPAIR) {
+            if (sfs_journal_recover(dev, &check->sb) != VFS_SUCCESS) {
+                goto out;
+            }
+            result->journal_pending = 0;
+        } else {
+            early_print("fsck: the journal needs replaying; counts may be off\n");
+        }
+    }
+
+    // The fields were found sane; a repair writes them back sealed
+    if (!sfs_csum_superblock_ok(&check->sb)) {
+        sfs_fsck_problem(check, &result->csum_errors, (flags & SFS_FSCK_REPAIR) != 0);
+        sfs_fsck_report(check, "superblock fails its checksum");
+        sb_dirty = 1;
+    }
+
+    result->sb_free_blocks = check->sb.free_blocks;
+    result->sb_free_inodes = check->sb.free_inodes;
+    check->total_inodes = check->sb.inode_blocks * check->geo.inodes_per_block;
+    check->table = sfs_inode_table_start(&check->sb);
+    check->words = check->sb.bitmap_blocks * check->geo.block_size / sizeof(uint64_t);
+    if (check->sb.root_inode > check->total_inodes) {
+        early_print("fsck: root inode outside the inode table\n");
+        result->problems = 1;
+        ret = VFS_EINVAL;
+        goto out;
+    }
+
+    ret = VFS_ENOMEM;
+    worker_count = sfs_fsck_alloc_workers(check, workers);
+    bitmap = kmalloc(check->sb.bitmap_blocks * check->geo.block_size);
+    if (worker_count == 0 || !bitmap) {
+        goto out;
+    }
+    result->workers = worker_count;
+
+    ret = VFS_EIO;
+    if (block_device_read_blocks(dev, SFS_BITMAP_START, check->sb.bitmap_blocks,
+                                 bitmap) != BLOCK_SUCCESS) {
+        goto out;
+    }
+    if (check->sb.features & SFS_FEATURE_INODE_BITMAP) {
+        check->inode_bitmap = kmalloc(check->sb.inode_bitmap_blocks * check->geo.block_size);
+        if (!check->inode_bitmap) {
+            ret = VFS_ENOMEM;
+            goto out;
+        }
+        if (block_device_read_blocks(dev, SFS_BITMAP_START + check->sb.bitmap_blocks,
+                                     check->sb.inode_bitmap_blocks,
+                                     check->inode_bitmap) != BLOCK_SUCCESS) {
+            goto out;
+        }
+    }
+
+    sfs_fsck_bitmap_csums(check, bitmap, 0);
+
+    if (flags & SFS_FSCK_FAST) {
+        int wrong = sfs_fsck_fast(check, bitmap, workers[0].batch);
+        if (wrong < 0) {
+            ret = wrong;
+            goto out;
+        }
+        sb_dirty |= wrong;
+        goto done;
+    }
+
+    ret = VFS_ENOMEM;
+    size_t owned_size = check->sb.bitmap_blocks * check->geo.block_size;
+    check->owned = kmalloc(owned_size);
+    check->dup = kmalloc(owned_size);
+    check->state = kmalloc(check->total_inodes);
+    check->parent = kmalloc(check->total_inodes * sizeof(uint32_t));
+    check->dirs = kmalloc(check->total_inodes * sizeof(uint32_t));
+    if (!check->owned || !check->dup || !check->state || !check->parent || !check->dirs) {
+        goto out;
+    }
+    memset(check->owned, 0, owned_size);
+    memset(check->dup, 0, owned_size);
+    memset(check->state, 0, check->total_inodes);
+    memset(check->parent, 0, check->total_inodes * sizeof(uint32_t));
+
+    // Superblock, bitmaps, inode table and journal
+    for (uint32_t block = 0; block < check->sb.first_data_block; block++) {
+        check->owned[block / 64] |= 1ULL << (block % 64);
+    }
+
+    // As at mount: a group marked unzeroed that has inodes was zeroed,
+    // and a crash lost the update clearing its mark
+    if (check->sb.features & SFS_FEATURE_LAZY_ITABLE) {
+        uint32_t group_inodes = check->sb.itable_group_blocks * check->geo.inodes_per_block;
+        uint32_t groups = (check->sb.inode_blocks + check->sb.itable_group_blocks - 1) /
+                          check->sb.itable_group_blocks;
+        for (uint32_t group = 0; group < groups; group++) {
+            if (!sfs_test_bit(check->sb.itable_uninit, group)) {
+                continue;
+            }
+            for (uint32_t i = group * group_inodes;
+                 i < (group + 1) * group_inodes && i < check->total_inodes; i++) {
+                if (sfs_test_bit(check->inode_bitmap, i)) {
+                    sfs_clear_bit(check->sb.itable_uninit, group);
+                    sb_dirty = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    ret = sfs_fsck_run(check, workers, worker_count, SFS_FSCK_PASS_INODES, check->sb.inode_blocks);
+    if (ret != VFS_SUCCESS) {
+        goto out;
+    }
+    if (check->state[check->sb.root_inode - 1] != SFS_FSCK_DIR) {
+        early_print("fsck: the root inode is not a directory\n");
+        result->problems++;
+        ret = VFS_EINVAL;
+        goto out;
+    }
+    result->directories = check->dir_count;
+
+    ret = sfs_fsck_run(check, workers, worker_count, SFS_FSCK_PASS_DIRS, check->dir_count);
+    if (ret != VFS_SUCCESS) {
+        goto out;
+    }
+
+    ret = sfs_fsck_orphans(check, &workers[0]);
+    if (ret == VFS_SUCCESS) {
+        ret = sfs_fsck_inode_bitmap(check);
+    }
+    if (ret == VFS_SUCCESS) {
+        ret = sfs_fsck_block_bitmap(check, bitmap);
+    }
+    if (ret != VFS_SUCCESS) {
+        goto out;
+    }
+    if (result->orphans) {
+        result->directories = 0;
+        for (uint32_t i = 0; i < check->total_inodes; i++) {
+            result->directories += check->state[i] == SFS_FSCK_DIR;
+        }
+    }
+    if (sfs_fsck_check_counters(check, result->free_blocks, result->free_inodes)) {
+        sb_dirty = 1;
+    }
+
+done:
+    ret = VFS_SUCCESS;
+    if ((flags & SFS_FSCK_REPAIR) && sfs_fsck_bitmap_csums(check, bitmap, 1)) {
+        sb_dirty = 1;
+    }
+    if (sb_dirty && (flags & SFS_FSCK_REPAIR)) {
+        if (sfs_write_superblock(dev, &check->sb) != VFS_SUCCESS ||
+            block_device_sync(dev) != BLOCK_SUCCESS) {
+            ret = VFS_EIO;
+        }
+    } else if ((flags & SFS_FSCK_REPAIR) && result->fixed &&
+               block_device_sync(dev) != BLOCK_SUCCESS) {
+        ret = VFS_EIO;
+    }
+    if (check->messages > SFS_FSCK_MAX_MESSAGES) {
+        char line[64];
+        snprintf(line, sizeof(line), "fsck: %u more problems not shown\n",
+                 check->messages - SFS_FSCK_MAX_MESSAGES);
+        early_print(line);
+    }
+
+out:
+    if (check) {
+        if (check->owned) {
+            kfree(check->owned);
+        }
+        if (check->dup) {
+            kfree(check->dup);
+        }
+        if (check->state) {
+            kfree(check->state);
+        }
+        if (check->parent) {
+            kfree(check->parent);
+        }
+        if (check->dirs) {
+            kfree(check->dirs);
+        }
+        if (check->inode_bitmap) {
+            kfree(check->inode_bitmap);
+        }
+        block_view_destroy(check->dev);
+        kfree(check);
+    }
+    if (bitmap) {
+        kfree(bitmap);
+    }
+    if (workers) {
+        sfs_fsck_free_workers(workers, worker_count);
+        kfree(workers);
+    }
+    return ret;
+}
+
+/**
+ * The fast check at mount, on the bitmaps just loaded: corrects the free
+ * counts in the cached superblock, which mount writes back
+ * @return Counters that were wrong
+ */
+int sfs_fsck_counters(struct sfs_fs_data *data)
+{
+    if (!data) {
+        return 0;
+    }
+
+    struct sfs_superblock *sb = &data->superblock;
+    uint32_t total_inodes = sb->inode_blocks * data->geo.inodes_per_block;
+    uint32_t free_blocks = sb->total_blocks - sfs_fsck_count_bits(data->block_bitmap,
+                                                                  sb->total_blocks);
+    uint32_t free_inodes = total_inodes - sfs_fsck_count_bits(data->inode_bitmap, total_inodes);
+
+    int wrong = 0;
+    char line[96];
+    if (sb->free_blocks != free_blocks) {
+        snprintf(line, sizeof(line), "SFS: free block count %u corrected to %u\n",
+                 sb->free_blocks, free_blocks);
+        early_print(line);
+        sb->free_blocks = free_blocks;
+        wrong++;
+    }
+    if (sb->free_inodes != free_inodes) {
+        snprintf(line, sizeof(line), "SFS: free inode count %u corrected to %u\n",
+                 sb->free_inodes, free_inodes);
+        early_print(line);
+        sb->free_inodes = free_inodes;
+        wrong++;
+    }
+    return wrong;
+}
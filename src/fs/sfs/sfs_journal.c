@@ -0,0 +1,748 @@
+/*
+ * MiniOS SFS Metadata Journal
+ *
+ * Write-ahead logging of metadata blocks, in ordered mode: cached file
+ * data reaches the disk before the metadata that points at it commits,
+ * and a metadata block goes home only once the transaction holding it is
+ * in the log. The log is linear; a checkpoint writes everything committed
+ * home and starts the log over at its first block.
+ *
+ * Blocks of the running transaction stay referenced and clean in the
+ * buffer cache, so nothing writes them home early; commit marks them
+ * dirty and lets go of them. The bitmaps and superblock are logged
+ * straight from their in-memory copies and written home at checkpoint.
+ * A block freed after it was logged gets a revoke record, so replay does
+ * not copy stale metadata over whatever reused the block.
+ *
+ * An operation that overflows a transaction is split across two; it is
+ * atomic only when it fits in one.
+ *
+ * Handles are taken with or without a journal: the first one a task opens
+ * takes the file system's update lock and the last one it closes drops
+ * it, so updates run one at a time while readers go on around them. The
+ * running transaction logs the bitmaps and superblock whole, which would
+ * tie concurrent updates together anyway.
+ */
+
+#include "sfs.h"
+#include "memory.h"
+#include "kernel.h"
+#include <string.h>
+
+#define SFS_JOURNAL_HASH_SEED   2166136261u
+
+struct sfs_journal_revoke {
+    uint32_t block;
+    uint32_t sequence;                      // Transaction that revoked it
+};
+
+// FNV-1a over the 32-bit words of a block
+static uint32_t sfs_journal_hash(uint32_t hash, const void *block, uint32_t block_size)
+{
+    const uint32_t *words = (const uint32_t *)block;
+    for (uint32_t i = 0; i < block_size / sizeof(uint32_t); i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int sfs_journal_write_header(struct block_device *dev, uint32_t start, uint32_t blocks,
+                                    uint32_t sequence, void *scratch)
+{
+    memset(scratch, 0, dev->block_size);
+    struct sfs_journal_header *header = (struct sfs_journal_header *)scratch;
+    header->magic = SFS_JOURNAL_MAGIC;
+    header->blocks = blocks;
+    header->sequence = sequence;
+    return (block_device_write(dev, start, scratch) == BLOCK_SUCCESS) ? VFS_SUCCESS : VFS_EIO;
+}
+
+/**
+ * Write the header of a new journal. The log blocks must already be
+ * zeroed so nothing left on the device parses as a transaction.
+ */
+int sfs_journal_format(struct block_device *dev, uint32_t start, uint32_t blocks)
+{
+    void *scratch = kmalloc(dev->block_size);
+    if (!scratch) {
+        return VFS_ENOMEM;
+    }
+    int result = sfs_journal_write_header(dev, start, blocks, 1, scratch);
+    kfree(scratch);
+    return result;
+}
+
+/**
+ * Check the transaction at log block pos: its descriptor, and a commit
+ * block whose checksum matches what was logged. Returns the log blocks it
+ * spans, 0 if there is no complete transaction there.
+ */
+static uint32_t sfs_journal_scan(struct block_device *dev, const struct sfs_superblock *sb,
+                                 uint32_t pos, uint32_t sequence,
+                                 struct sfs_journal_descriptor *desc, void *block)
+{
+    uint32_t start = sb->journal_start;
+    if (pos + 2 > sb->journal_blocks ||
+        block_device_read(dev, start + pos, desc) != BLOCK_SUCCESS ||
+        desc->magic != SFS_JOURNAL_DESC_MAGIC || desc->sequence != sequence ||
+        desc->count > sfs_journal_tags(dev->block_size)) {
+        return 0;
+    }
+
+    uint32_t logged = 0;
+    for (uint32_t i = 0; i < desc->count; i++) {
+        if (!(desc->tags[i] & SFS_JOURNAL_REVOKE)) {
+            logged++;
+        }
+    }
+    if (pos + logged + 2 > sb->journal_blocks) {
+        return 0;
+    }
+
+    uint32_t hash = sfs_journal_hash(SFS_JOURNAL_HASH_SEED, desc, dev->block_size);
+    for (uint32_t i = 0; i < logged; i++) {
+        if (block_device_read(dev, start + pos + 1 + i, block) != BLOCK_SUCCESS) {
+            return 0;
+        }
+        hash = sfs_journal_hash(hash, block, dev->block_size);
+    }
+
+    const struct sfs_journal_commit *commit = (const struct sfs_journal_commit *)block;
+    if (block_device_read(dev, start + pos + 1 + logged, block) != BLOCK_SUCCESS ||
+        commit->magic != SFS_JOURNAL_COMMIT_MAGIC || commit->sequence != sequence ||
+        commit->checksum != hash || commit->blocks != logged) {
+        return 0;
+    }
+    return logged + 2;
+}
+
+static int sfs_journal_revoked(const struct sfs_journal_revoke *revokes, uint32_t count,
+                               uint32_t block, uint32_t sequence)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (revokes[i].block == block && revokes[i].sequence > sequence) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Committed transactions waiting in the log, without replaying them;
+ * negative on a read error or a bad header
+ */
+int sfs_journal_pending(struct block_device *dev, const struct sfs_superblock *sb)
+{
+    if (!dev || !sb || !(sb->features & SFS_FEATURE_JOURNAL)) {
+        return 0;
+    }
+
+    struct sfs_journal_descriptor *desc = kmalloc(dev->block_size);
+    void *block = kmalloc(dev->block_size);
+    int result = VFS_EIO;
+    if (!desc || !block) {
+        result = VFS_ENOMEM;
+        goto out;
+    }
+
+    const struct sfs_journal_header *header = (const struct sfs_journal_header *)block;
+    if (block_device_read(dev, sb->journal_start, block) != BLOCK_SUCCESS ||
+        header->magic != SFS_JOURNAL_MAGIC || header->blocks != sb->journal_blocks) {
+        goto out;
+    }
+    uint32_t first = header->sequence;
+
+    uint32_t transactions = 0;
+    uint32_t pos = 1;
+    uint32_t span;
+    while ((span = sfs_journal_scan(dev, sb, pos, first + transactions, desc, block)) > 0) {
+        pos += span;
+        transactions++;
+    }
+    result = (int)transactions;
+
+out:
+    if (block) {
+        kfree(block);
+    }
+    if (desc) {
+        kfree(desc);
+    }
+    return result;
+}
+
+/**
+ * Replay committed transactions left in the log by a crash, then reset
+ * the log and re-read the superblock into sb. Three passes: find the
+ * complete transactions, collect their revokes, then copy each logged
+ * block home unless a later transaction revoked it.
+ */
+int sfs_journal_recover(struct block_device *dev, struct sfs_superblock *sb)
+{
+    if (!dev || !sb || !(sb->features & SFS_FEATURE_JOURNAL)) {
+        return VFS_SUCCESS;
+    }
+
+    struct sfs_journal_descriptor *desc = kmalloc(dev->block_size);
+    void *block = kmalloc(dev->block_size);
+    struct sfs_journal_revoke *revokes = NULL;
+    int result = VFS_EIO;
+    if (!desc || !block) {
+        result = VFS_ENOMEM;
+        goto out;
+    }
+
+    uint32_t start = sb->journal_start;
+    const struct sfs_journal_header *header = (const struct sfs_journal_header *)block;
+    if (block_device_read(dev, start, block) != BLOCK_SUCCESS) {
+        goto out;
+    }
+    if (header->magic != SFS_JOURNAL_MAGIC || header->blocks != sb->journal_blocks) {
+        early_print("SFS journal: bad header\n");
+        goto out;
+    }
+    uint32_t first = header->sequence;
+
+    uint32_t transactions = 0;
+    uint32_t revoke_count = 0;
+    uint32_t pos = 1;
+    uint32_t span;
+    while ((span = sfs_journal_scan(dev, sb, pos, first + transactions, desc, block)) > 0) {
+        for (uint32_t i = 0; i < desc->count; i++) {
+            if (desc->tags[i] & SFS_JOURNAL_REVOKE) {
+                revoke_count++;
+            }
+        }
+        pos += span;
+        transactions++;
+    }
+    if (transactions == 0) {
+        result = VFS_SUCCESS;
+        goto out;
+    }
+    early_print("SFS journal: replaying committed transactions\n");
+
+    if (revoke_count) {
+        revokes = kmalloc(revoke_count * sizeof(struct sfs_journal_revoke));
+        if (!revokes) {
+            result = VFS_ENOMEM;
+            goto out;
+        }
+    }
+    uint32_t revoked = 0;
+    pos = 1;
+    for (uint32_t t = 0; t < transactions; t++) {
+        if (block_device_read(dev, start + pos, desc) != BLOCK_SUCCESS) {
+            goto out;
+        }
+        uint32_t logged = 0;
+        for (uint32_t i = 0; i < desc->count; i++) {
+            if (desc->tags[i] & SFS_JOURNAL_REVOKE) {
+                revokes[revoked].block = desc->tags[i] & ~SFS_JOURNAL_REVOKE;
+                revokes[revoked].sequence = first + t;
+                revoked++;
+            } else {
+                logged++;
+            }
+        }
+        pos += logged + 2;
+    }
+
+    pos = 1;
+    for (uint32_t t = 0; t < transactions; t++) {
+        if (block_device_read(dev, start + pos, desc) != BLOCK_SUCCESS) {
+            goto out;
+        }
+        uint32_t slot = pos + 1;
+        for (uint32_t i = 0; i < desc->count; i++) {
+            uint32_t home = desc->tags[i];
+            if (home & SFS_JOURNAL_REVOKE) {
+                continue;
+            }
+            if (!sfs_journal_revoked(revokes, revoked, home, first + t) &&
+                (home >= sb->total_blocks ||
+                 block_device_read(dev, start + slot, block) != BLOCK_SUCCESS ||
+                 block_device_write(dev, home, block) != BLOCK_SUCCESS)) {
+                goto out;
+            }
+            slot++;
+        }
+        pos = slot + 1;
+    }
+
+    // New transactions start past the replayed ones
+    if (block_device_sync(dev) != BLOCK_SUCCESS ||
+        sfs_journal_write_header(dev, start, sb->journal_blocks, first + transactions,
+                                 block) != VFS_SUCCESS ||
+        block_device_sync(dev) != BLOCK_SUCCESS) {
+        goto out;
+    }
+    block_buffer_invalidate_device(dev);
+
+    result = sfs_read_superblock(dev, sb);
+    if (result == VFS_SUCCESS) {
+        result = sfs_validate_superblock(sb);
+    }
+
+out:
+    if (revokes) {
+        kfree(revokes);
+    }
+    if (block) {
+        kfree(block);
+    }
+    if (desc) {
+        kfree(desc);
+    }
+    return result;
+}
+
+/**
+ * Set up the journal of a mounted filesystem, after recovery
+ */
+int sfs_journal_init(struct sfs_fs_data *data)
+{
+    const struct sfs_superblock *sb = &data->superblock;
+    struct sfs_journal *journal = kmalloc(sizeof(struct sfs_journal));
+    if (!journal) {
+        return VFS_ENOMEM;
+    }
+    memset(journal, 0, sizeof(struct sfs_journal));
+    data->journal = journal;
+
+    journal->start = sb->journal_start;
+    journal->blocks = sb->journal_blocks;
+    journal->head = 1;
+
+    // A quarter of the log per transaction (descriptor and commit block
+    // included), so several commit between checkpoints
+    journal->max_tags = (journal->blocks - 1) / 4 - 2;
+    if (journal->max_tags > data->geo.journal_tags) {
+        journal->max_tags = data->geo.journal_tags;
+    }
+
+    journal->running = kmalloc(journal->max_tags * sizeof(struct sfs_journal_block));
+    journal->revokes = kmalloc(journal->max_tags * sizeof(uint32_t));
+    if (sfs_csum_enabled(sb)) {
+        journal->max_tags--;  // Kept for the superblock, see sfs_journal_seal()
+    }
+    journal->logged = kmalloc(journal->blocks * sizeof(uint32_t));
+    journal->descriptor = kmalloc(data->geo.block_size);
+    journal->commit = kmalloc(data->geo.block_size);
+    if (!journal->running || !journal->revokes || !journal->logged ||
+        !journal->descriptor || !journal->commit) {
+        sfs_journal_destroy(data);
+        return VFS_ENOMEM;
+    }
+
+    const struct sfs_journal_header *header = (const struct sfs_journal_header *)journal->commit;
+    if (block_device_read(data->device, journal->start, journal->commit) != BLOCK_SUCCESS ||
+        header->magic != SFS_JOURNAL_MAGIC) {
+        sfs_journal_destroy(data);
+        return VFS_EIO;
+    }
+    journal->sequence = header->sequence;
+    return VFS_SUCCESS;
+}
+
+/**
+ * Free the journal. Buffers still held by an uncommitted transaction are
+ * released unwritten.
+ */
+void sfs_journal_destroy(struct sfs_fs_data *data)
+{
+    struct sfs_journal *journal = data->journal;
+    if (!journal) {
+        return;
+    }
+
+    for (uint32_t i = 0; journal->running && i < journal->running_count; i++) {
+        if (journal->running[i].buf) {
+            block_buffer_put(journal->running[i].buf);
+        }
+    }
+    if (journal->running) {
+        kfree(journal->running);
+    }
+    if (journal->revokes) {
+        kfree(journal->revokes);
+    }
+    if (journal->logged) {
+        kfree(journal->logged);
+    }
+    if (journal->descriptor) {
+        kfree(journal->descriptor);
+    }
+    if (journal->commit) {
+        kfree(journal->commit);
+    }
+    kfree(journal);
+    data->journal = NULL;
+}
+
+static inline struct sfs_journal *sfs_journal_of(struct file_system *fs)
+{
+    struct sfs_fs_data *data = fs ? (struct sfs_fs_data *)fs->private_data : NULL;
+    return data ? data->journal : NULL;
+}
+
+static int sfs_journal_find(const struct sfs_journal *journal, uint32_t block)
+{
+    for (uint32_t i = 0; i < journal->running_count; i++) {
+        if (journal->running[i].block == block) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Begin an operation that changes metadata. Nests within the calling
+ * task's own operations.
+ */
+void sfs_journal_begin(struct file_system *fs)
+{
+    struct sfs_fs_data *data = fs ? (struct sfs_fs_data *)fs->private_data : NULL;
+    if (!data) {
+        return;
+    }
+
+    if (mutex_is_owner(&data->update_lock)) {
+        data->update_depth++;
+    } else {
+        mutex_lock(&data->update_lock);
+        data->update_depth = 1;
+    }
+    if (data->journal) {
+        data->journal->handles++;
+    }
+}
+
+/**
+ * End an operation. The last one out commits if the flusher asked for it,
+ * if the mount wants metadata on disk at once, or if the transaction is
+ * half full, so the next operation is unlikely to have to split.
+ */
+void sfs_journal_end(struct file_system *fs)
+{
+    struct sfs_fs_data *data = fs ? (struct sfs_fs_data *)fs->private_data : NULL;
+    if (!data) {
+        return;
+    }
+
+    struct sfs_journal *journal = data->journal;
+    if (journal && journal->handles > 0 && --journal->handles == 0 &&
+        (journal->commit_due || data->sync_metadata ||
+         (journal->running_count + journal->revoke_count) * 2 >= journal->max_tags)) {
+        sfs_journal_commit(fs);
+    }
+
+    if (data->update_depth > 0 && --data->update_depth == 0) {
+        mutex_unlock(&data->update_lock);
+    }
+}
+
+/**
+ * Prepare a cached metadata block for modification. A copy left dirty by
+ * an earlier transaction goes home first, so the change cannot reach the
+ * disk before it is logged.
+ */
+void sfs_journal_access(struct sfs_journal *journal, struct block_buffer *buf)
+{
+    if (journal && buf && buf->dirty && sfs_journal_find(journal, buf->block_num) < 0) {
+        block_buffer_sync(buf);
+    }
+}
+
+// Room for one more tag, committing the running transaction when it is full
+static int sfs_journal_reserve(struct file_system *fs, struct sfs_journal *journal)
+{
+    if (journal->running_count + journal->revoke_count < journal->max_tags) {
+        return VFS_SUCCESS;
+    }
+    return sfs_journal_commit(fs);
+}
+
+/**
+ * Add a modified metadata buffer to the running transaction. Takes over
+ * the caller's reference, which the transaction keeps until it commits.
+ */
+int sfs_journal_dirty_buffer(struct file_system *fs, struct block_buffer *buf)
+{
+    struct sfs_journal *journal = sfs_journal_of(fs);
+    if (!journal || !buf) {
+        return VFS_EINVAL;
+    }
+
+    if (sfs_journal_find(journal, buf->block_num) >= 0) {
+        block_buffer_put(buf);  // Already held
+        return VFS_SUCCESS;
+    }
+    if (sfs_journal_reserve(fs, journal) != VFS_SUCCESS) {
+        block_buffer_put(buf);
+        return VFS_EIO;
+    }
+
+    struct sfs_journal_block *entry = &journal->running[journal->running_count++];
+    entry->block = buf->block_num;
+    entry->data = buf->data;
+    entry->buf = buf;
+    return VFS_SUCCESS;
+}
+
+/**
+ * Log a block kept in memory (a bitmap block, the superblock) with the
+ * running transaction. Its contents are taken at commit; the caller
+ * writes it home at checkpoint.
+ */
+int sfs_journal_dirty_memory(struct file_system *fs, uint32_t block, const void *data)
+{
+    struct sfs_journal *journal = sfs_journal_of(fs);
+    if (!journal || !data) {
+        return VFS_EINVAL;
+    }
+
+    if (sfs_journal_find(journal, block) >= 0) {
+        return VFS_SUCCESS;
+    }
+    if (sfs_journal_reserve(fs, journal) != VFS_SUCCESS) {
+        return VFS_EIO;
+    }
+
+    struct sfs_journal_block *entry = &journal->running[journal->running_count++];
+    entry->block = block;
+    entry->data = data;
+    entry->buf = NULL;
+    return VFS_SUCCESS;
+}
+
+/**
+ * Freed blocks: drop them from the running transaction, and revoke those
+ * logged since the last checkpoint so replay leaves their new contents
+ */
+void sfs_journal_forget(struct file_system *fs, uint32_t start, uint32_t count)
+{
+    struct sfs_journal *journal = sfs_journal_of(fs);
+    if (!journal) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < journal->running_count; ) {
+        struct sfs_journal_block *entry = &journal->running[i];
+        if (entry->buf && entry->block - start < count) {
+            block_buffer_put(entry->buf);
+            *entry = journal->running[--journal->running_count];
+            continue;
+        }
+        i++;
+    }
+
+    // A commit made room for may checkpoint, which empties the logged set
+    for (uint32_t i = 0; i < journal->logged_count; i++) {
+        uint32_t block = journal->logged[i];
+        if (block - start >= count) {
+            continue;
+        }
+
+        int known = 0;
+        for (uint32_t r = 0; r < journal->revoke_count && !known; r++) {
+            known = journal->revokes[r] == block;
+        }
+        if (known) {
+            continue;
+        }
+        if (sfs_journal_reserve(fs, journal) != VFS_SUCCESS) {
+            return;
+        }
+        if (i < journal->logged_count) {
+            journal->revokes[journal->revoke_count++] = block;
+        }
+    }
+}
+
+/**
+ * Write committed metadata home and empty the log. Runs only between
+ * transactions, since the in-memory bitmaps and superblock are written
+ * as they are.
+ */
+static int sfs_journal_write_home(struct file_system *fs, struct sfs_journal *journal)
+{
+    struct sfs_fs_data *data = (struct sfs_fs_data *)fs->private_data;
+    if (journal->head == 1) {
+        return VFS_SUCCESS;
+    }
+
+    if (block_buffer_sync_device(data->device) != BLOCK_SUCCESS ||
+        sfs_write_metadata(fs) != VFS_SUCCESS ||
+        block_device_sync(data->device) != BLOCK_SUCCESS) {
+        return VFS_EIO;
+    }
+
+    // The reset must be on disk before a logged block can be reused:
+    // without revokes for them, replay would copy stale metadata over it
+    if (sfs_journal_write_header(data->device, journal->start, journal->blocks,
+                                 journal->sequence, journal->descriptor) != VFS_SUCCESS ||
+        block_device_sync(data->device) != BLOCK_SUCCESS) {
+        return VFS_EIO;
+    }
+
+    journal->head = 1;
+    journal->logged_count = 0;
+    journal->checkpoints++;
+    return VFS_SUCCESS;
+}
+
+/**
+ * Checksum the in-memory metadata of the running transaction as it is
+ * about to be logged. Bitmap checksums are kept in the superblock, so a
+ * transaction with a bitmap block always carries the superblock too, in
+ * the tag sfs_journal_init() kept back for it.
+ */
+static void sfs_journal_seal(struct sfs_fs_data *data, struct sfs_journal *journal)
+{
+    if (sfs_csum_enabled(&data->superblock)) {
+        int bitmaps = 0;
+        int superblock = 0;
+        for (uint32_t i = 0; i < journal->running_count; i++) {
+            const struct sfs_journal_block *entry = &journal->running[i];
+            if (entry->buf) {
+                continue;
+            }
+            if (entry->block == SFS_SUPERBLOCK_BLOCK) {
+                superblock = 1;
+            } else {
+                sfs_csum_update_bitmap(data, entry->block);
+                bitmaps = 1;
+            }
+        }
+        if (bitmaps && !superblock) {
+            struct sfs_journal_block *entry = &journal->running[journal->running_count++];
+            entry->block = SFS_SUPERBLOCK_BLOCK;
+            entry->data = sfs_superblock_block(data);
+            entry->buf = NULL;
+            data->superblock_dirty = 1;
+        }
+        sfs_csum_set_superblock(&data->superblock);
+    }
+
+    // A padded superblock is logged from its copy, which must be current
+    sfs_superblock_block(data);
+}
+
+/**
+ * Commit the running transaction: descriptor, logged blocks and commit
+ * block in as few requests as the segment limit allows, then a device
+ * flush. The log is checkpointed when the next transaction might not fit.
+ */
+int sfs_journal_commit(struct file_system *fs)
+{
+    struct sfs_journal *journal = sfs_journal_of(fs);
+    if (!journal) {
+        return VFS_SUCCESS;
+    }
+    journal->commit_due = 0;
+    if (journal->running_count == 0 && journal->revoke_count == 0) {
+        return VFS_SUCCESS;
+    }
+
+    struct sfs_fs_data *data = (struct sfs_fs_data *)fs->private_data;
+    struct block_device *dev = data->device;
+
+    // Ordered mode: cached file data before the metadata pointing at it
+    if (block_buffer_sync_device(dev) != BLOCK_SUCCESS) {
+        return VFS_EIO;
+    }
+    sfs_journal_seal(data, journal);
+
+    struct sfs_journal_descriptor *desc = journal->descriptor;
+    memset(desc, 0, data->geo.block_size);
+    desc->magic = SFS_JOURNAL_DESC_MAGIC;
+    desc->sequence = journal->sequence;
+    for (uint32_t i = 0; i < journal->running_count; i++) {
+        desc->tags[desc->count++] = journal->running[i].block;
+    }
+    for (uint32_t i = 0; i < journal->revoke_count; i++) {
+        desc->tags[desc->count++] = SFS_JOURNAL_REVOKE | journal->revokes[i];
+    }
+
+    uint32_t hash = sfs_journal_hash(SFS_JOURNAL_HASH_SEED, desc, data->geo.block_size);
+    for (uint32_t i = 0; i < journal->running_count; i++) {
+        hash = sfs_journal_hash(hash, journal->running[i].data, data->geo.block_size);
+    }
+    struct sfs_journal_commit *commit = journal->commit;
+    memset(commit, 0, data->geo.block_size);
+    commit->magic = SFS_JOURNAL_COMMIT_MAGIC;
+    commit->sequence = journal->sequence;
+    commit->checksum = hash;
+    commit->blocks = journal->running_count;
+
+    struct block_io_segment segs[BLOCK_IO_MAX_SEGMENTS];
+    uint32_t total = journal->running_count + 2;
+    uint32_t pos = journal->head;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        const void *src = (i == 0) ? (const void *)desc :
+                          (i == total - 1) ? (const void *)commit : journal->running[i - 1].data;
+        segs[n].buffer = (void *)(uintptr_t)src;  // Only read from on the write path
+        segs[n].count = 1;
+        n++;
+        if (n == BLOCK_IO_MAX_SEGMENTS || i == total - 1) {
+            if (block_device_writev(dev, journal->start + pos, segs, n) != BLOCK_SUCCESS) {
+                return VFS_EIO;
+            }
+            pos += n;
+            n = 0;
+        }
+    }
+    if (block_device_sync(dev) != BLOCK_SUCCESS) {
+        return VFS_EIO;
+    }
+
+    // Committed: the blocks may go home whenever the cache writes them
+    for (uint32_t i = 0; i < journal->running_count; i++) {
+        struct sfs_journal_block *entry = &journal->running[i];
+        uint32_t j = 0;
+        while (j < journal->logged_count && journal->logged[j] != entry->block) {
+            j++;
+        }
+        if (j == journal->logged_count) {
+            journal->logged[journal->logged_count++] = entry->block;
+        }
+        if (entry->buf) {
+            block_buffer_mark_dirty(entry->buf);
+            block_buffer_put(entry->buf);
+        }
+    }
+
+    journal->head += total;
+    journal->sequence++;
+    journal->running_count = 0;
+    journal->revoke_count = 0;
+    journal->commits++;
+    sfs_discard_flush(fs);
+
+    // Room for the largest transaction: its tags, the superblock tag
+    // kept back for checksums, descriptor and commit block
+    if (journal->blocks - journal->head <
+        journal->max_tags + 2 + (uint32_t)sfs_csum_enabled(&data->superblock)) {
+        return sfs_journal_write_home(fs, journal);
+    }
+    return VFS_SUCCESS;
+}
+
+/**
+ * Commit, then write everything home and empty the log
+ */
+int sfs_journal_checkpoint(struct file_system *fs)
+{
+    struct sfs_journal *journal = sfs_journal_of(fs);
+    if (!journal) {
+        return VFS_SUCCESS;
+    }
+
+    int result = sfs_journal_commit(fs);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    return sfs_journal_write_home(fs, journal);
+}
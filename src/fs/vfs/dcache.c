@@ -0,0 +1,335 @@
+/*
+ * MiniOS VFS Dentry Cache
+ * Name lookup cache shared by inode-numbered file systems
+ *
+ * Maps (file system, parent inode number, name) to the child's inode
+ * number, so repeated path walks skip directory scans. An inode number of
+ * 0 records a negative entry (the name is absent). Entries come from a
+ * fixed pool; when it is full the least recently used entry is reused.
+ * File systems keep the cache coherent by invalidating names as they add
+ * or remove directory entries.
+ *
+ * The hash buckets are split between VFS_DCACHE_LOCKS locks, bucket b
+ * under lock b % VFS_DCACHE_LOCKS, and each lock owns a slice of the pool
+ * with its own LRU list, so path walks on different CPUs seldom meet on
+ * a lock. A name always hashes to the same lock, so one lock covers a
+ * whole lookup or insert; only invalidating a directory or a file system
+ * goes through every lock in turn.
+ */
+
+#include "vfs.h"
+#include "kernel.h"
+#include "percpu.h"
+#include "spinlock.h"
+
+struct vfs_dentry {
+    struct file_system *fs;                // NULL when the slot is free
+    uint32_t parent_ino;
+    uint32_t ino;                          // 0 for a negative entry
+    uint32_t hash;
+    char name[VFS_DCACHE_NAME_LEN];
+    struct vfs_dentry *hash_next;
+    struct vfs_dentry *lru_prev;           // Most recently used at the head
+    struct vfs_dentry *lru_next;
+};
+
+_Static_assert(VFS_DCACHE_BUCKETS % VFS_DCACHE_LOCKS == 0 &&
+               VFS_DCACHE_ENTRIES % VFS_DCACHE_LOCKS == 0,
+               "dcache buckets and entries must split evenly between the locks");
+
+#define DCACHE_SLICE        (VFS_DCACHE_ENTRIES / VFS_DCACHE_LOCKS)
+
+// One lock with the buckets and pool slice it owns
+struct dcache_stripe {
+    spinlock_t lock;
+    struct vfs_dentry *lru_head;
+    struct vfs_dentry *lru_tail;
+    struct vfs_dentry *free;               // Released slots, via hash_next
+    uint32_t used;                         // Slots of the slice ever handed out
+    uint32_t entries;
+    uint32_t negative;
+} __cacheline_aligned;
+
+// Lookups on every path walk, so counted per CPU
+struct dcache_counts {
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+};
+
+// Stripe s owns pool slots s, s + VFS_DCACHE_LOCKS, ...
+static struct vfs_dentry dcache_pool[VFS_DCACHE_ENTRIES];
+static struct vfs_dentry *dcache_hash[VFS_DCACHE_BUCKETS];
+static struct dcache_stripe dcache_stripes[VFS_DCACHE_LOCKS];
+static DEFINE_PER_CPU(struct dcache_counts, dcache_counts);
+
+// FNV-1a over the name, seeded with the directory it lives in
+static uint32_t dcache_hash_name(const struct file_system *fs, uint32_t parent_ino,
+                                 const char *name, size_t *len_out)
+{
+    uint32_t hash = 2166136261u ^ parent_ino ^ (uint32_t)((uintptr_t)fs >> 4);
+    size_t len = 0;
+    while (name[len]) {
+        hash ^= (uint8_t)name[len];
+        hash *= 16777619u;
+        len++;
+    }
+    *len_out = len;
+    return hash;
+}
+
+static inline struct dcache_stripe *dcache_stripe_of(uint32_t hash)
+{
+    return &dcache_stripes[hash % VFS_DCACHE_LOCKS];
+}
+
+static void dcache_lru_remove(struct dcache_stripe *stripe, struct vfs_dentry *dentry)
+{
+    if (dentry->lru_prev) {
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    } else {
+        stripe->lru_head = dentry->lru_next;
+    }
+    if (dentry->lru_next) {
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    } else {
+        stripe->lru_tail = dentry->lru_prev;
+    }
+    dentry->lru_prev = NULL;
+    dentry->lru_next = NULL;
+}
+
+static void dcache_lru_push(struct dcache_stripe *stripe, struct vfs_dentry *dentry)
+{
+    dentry->lru_prev = NULL;
+    dentry->lru_next = stripe->lru_head;
+    if (stripe->lru_head) {
+        stripe->lru_head->lru_prev = dentry;
+    }
+    stripe->lru_head = dentry;
+    if (!stripe->lru_tail) {
+        stripe->lru_tail = dentry;
+    }
+}
+
+// Free a slot (stripe locked)
+static void dcache_release(struct dcache_stripe *stripe, struct vfs_dentry *dentry)
+{
+    struct vfs_dentry **link = &dcache_hash[dentry->hash & (VFS_DCACHE_BUCKETS - 1)];
+    while (*link) {
+        if (*link == dentry) {
+            *link = dentry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    dcache_lru_remove(stripe, dentry);
+
+    if (dentry->ino == 0) {
+        stripe->negative--;
+    }
+    stripe->entries--;
+    dentry->fs = NULL;
+    dentry->hash_next = stripe->free;
+    stripe->free = dentry;
+}
+
+// A slot for a new entry, reusing the stripe's least recently used one when full (locked)
+static struct vfs_dentry *dcache_alloc(struct dcache_stripe *stripe)
+{
+    if (!stripe->free) {
+        if (stripe->used < DCACHE_SLICE) {
+            uint32_t s = (uint32_t)(stripe - dcache_stripes);
+            return &dcache_pool[s + stripe->used++ * VFS_DCACHE_LOCKS];
+        }
+        dcache_release(stripe, stripe->lru_tail);
+    }
+    struct vfs_dentry *dentry = stripe->free;
+    stripe->free = dentry->hash_next;
+    return dentry;
+}
+
+static struct vfs_dentry *dcache_find(struct file_system *fs, uint32_t parent_ino,
+                                      const char *name, uint32_t hash)
+{
+    struct vfs_dentry *dentry = dcache_hash[hash & (VFS_DCACHE_BUCKETS - 1)];
+    while (dentry) {
+        if (dentry->hash == hash && dentry->fs == fs && dentry->parent_ino == parent_ino &&
+            strcmp(dentry->name, name) == 0) {
+            return dentry;
+        }
+        dentry = dentry->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * Look up a cached name. Returns 1 on a hit with the inode number (0 for
+ * a negative entry) in *ino_out, or 0 when the name is not cached.
+ */
+int vfs_dcache_lookup(struct file_system *fs, uint32_t parent_ino, const char *name,
+                      uint32_t *ino_out)
+{
+    if (!fs || !name || !ino_out) {
+        return 0;
+    }
+
+    size_t len;
+    uint32_t hash = dcache_hash_name(fs, parent_ino, name, &len);
+    if (len >= VFS_DCACHE_NAME_LEN) {
+        this_cpu_inc(dcache_counts, misses);
+        return 0;
+    }
+
+    struct dcache_stripe *stripe = dcache_stripe_of(hash);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    struct vfs_dentry *dentry = dcache_find(fs, parent_ino, name, hash);
+    if (dentry) {
+        dcache_lru_remove(stripe, dentry);
+        dcache_lru_push(stripe, dentry);
+        *ino_out = dentry->ino;
+    }
+    spin_unlock_irqrestore(&stripe->lock, flags);
+
+    if (!dentry) {
+        this_cpu_inc(dcache_counts, misses);
+        return 0;
+    }
+    if (*ino_out == 0) {
+        this_cpu_inc(dcache_counts, negative_hits);
+    } else {
+        this_cpu_inc(dcache_counts, hits);
+    }
+    return 1;
+}
+
+/**
+ * Record the result of a directory lookup (ino 0 for "not found")
+ */
+void vfs_dcache_insert(struct file_system *fs, uint32_t parent_ino, const char *name,
+                       uint32_t ino)
+{
+    if (!fs || !name) {
+        return;
+    }
+
+    size_t len;
+    uint32_t hash = dcache_hash_name(fs, parent_ino, name, &len);
+    if (len == 0 || len >= VFS_DCACHE_NAME_LEN) {
+        return;
+    }
+
+    struct dcache_stripe *stripe = dcache_stripe_of(hash);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+
+    struct vfs_dentry *dentry = dcache_find(fs, parent_ino, name, hash);
+    if (dentry) {
+        if (dentry->ino == 0 && ino != 0) {
+            stripe->negative--;
+        } else if (dentry->ino != 0 && ino == 0) {
+            stripe->negative++;
+        }
+        dentry->ino = ino;
+        dcache_lru_remove(stripe, dentry);
+        dcache_lru_push(stripe, dentry);
+        spin_unlock_irqrestore(&stripe->lock, flags);
+        return;
+    }
+
+    dentry = dcache_alloc(stripe);
+    dentry->fs = fs;
+    dentry->parent_ino = parent_ino;
+    dentry->ino = ino;
+    dentry->hash = hash;
+    memcpy(dentry->name, name, len + 1);
+
+    uint32_t idx = hash & (VFS_DCACHE_BUCKETS - 1);
+    dentry->hash_next = dcache_hash[idx];
+    dcache_hash[idx] = dentry;
+    dcache_lru_push(stripe, dentry);
+
+    stripe->entries++;
+    if (ino == 0) {
+        stripe->negative++;
+    }
+    spin_unlock_irqrestore(&stripe->lock, flags);
+}
+
+/**
+ * Forget one name; called when a directory entry is added or removed
+ */
+void vfs_dcache_invalidate(struct file_system *fs, uint32_t parent_ino, const char *name)
+{
+    if (!fs || !name) {
+        return;
+    }
+
+    size_t len;
+    uint32_t hash = dcache_hash_name(fs, parent_ino, name, &len);
+    if (len >= VFS_DCACHE_NAME_LEN) {
+        return;
+    }
+
+    struct dcache_stripe *stripe = dcache_stripe_of(hash);
+    unsigned long flags = spin_lock_irqsave(&stripe->lock);
+    struct vfs_dentry *dentry = dcache_find(fs, parent_ino, name, hash);
+    if (dentry) {
+        dcache_release(stripe, dentry);
+    }
+    spin_unlock_irqrestore(&stripe->lock, flags);
+}
+
+// Release every entry of fs for which dir_ino is the parent or the child,
+// or every entry of fs when dir_ino is 0, one lock at a time
+static void dcache_release_matching(struct file_system *fs, uint32_t dir_ino)
+{
+    for (uint32_t s = 0; s < VFS_DCACHE_LOCKS; s++) {
+        struct dcache_stripe *stripe = &dcache_stripes[s];
+        unsigned long flags = spin_lock_irqsave(&stripe->lock);
+        for (uint32_t i = 0; i < stripe->used; i++) {
+            struct vfs_dentry *dentry = &dcache_pool[s + i * VFS_DCACHE_LOCKS];
+            if (dentry->fs == fs &&
+                (dir_ino == 0 || dentry->parent_ino == dir_ino || dentry->ino == dir_ino)) {
+                dcache_release(stripe, dentry);
+            }
+        }
+        spin_unlock_irqrestore(&stripe->lock, flags);
+    }
+}
+
+/**
+ * Forget every name cached under a directory that is going away, so a
+ * later directory reusing its inode number starts clean
+ */
+void vfs_dcache_invalidate_dir(struct file_system *fs, uint32_t dir_ino)
+{
+    if (!fs || dir_ino == 0) {
+        return;
+    }
+    dcache_release_matching(fs, dir_ino);
+}
+
+void vfs_dcache_invalidate_fs(struct file_system *fs)
+{
+    if (!fs) {
+        return;
+    }
+    dcache_release_matching(fs, 0);
+}
+
+void vfs_dcache_get_stats(struct vfs_dcache_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    stats->entries = 0;
+    stats->negative = 0;
+    for (uint32_t s = 0; s < VFS_DCACHE_LOCKS; s++) {
+        stats->entries += __atomic_load_n(&dcache_stripes[s].entries, __ATOMIC_RELAXED);
+        stats->negative += __atomic_load_n(&dcache_stripes[s].negative, __ATOMIC_RELAXED);
+    }
+    stats->hits = per_cpu_sum(dcache_counts, hits);
+    stats->negative_hits = per_cpu_sum(dcache_counts, negative_hits);
+    stats->misses = per_cpu_sum(dcache_counts, misses);
+}
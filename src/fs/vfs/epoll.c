@@ -0,0 +1,504 @@
+/*
+ * MiniOS Readiness Notification (epoll)
+ *
+ * An epoll instance is an open file holding an interest list: items, each
+ * a watched file with the events wanted and a cookie to hand back. Adding
+ * an item calls the file's poll method with a table that hangs one of the
+ * item's wait entries on every queue the method names (poll_wait()), so a
+ * wakeup on any of them puts the item on the instance's ready list and
+ * wakes the instance's waiters. vfs_epoll_wait() polls the items on the
+ * ready list again and reports the ones with events wanted, so a wait
+ * costs the items that were woken, never the whole interest list, and a
+ * spurious wakeup costs one poll. A level-triggered item goes back on the
+ * list after it is reported and stays there while it polls ready; an
+ * edge-triggered (EPOLLET) one is left off until its next wakeup.
+ *
+ * Locking: epoll_ctl_lock serializes changes to the interest lists and to
+ * the files' item lists. ep->lock protects the ready list and is taken by
+ * wakeups with the watched queue's lock held. Poll methods take no locks,
+ * so vfs_epoll_wait() calls them under ep->lock, which keeps the items and
+ * their files from going away underneath it: the last close of a watched
+ * file drops its items (vfs_epoll_release()) before freeing anything.
+ */
+
+#include "vfs.h"
+#include "fd.h"
+#include "kernel.h"
+#include "process.h"
+#include "spinlock.h"
+
+#define EPOLL_ITEM_QUEUES   2           // Wait queues one item can watch
+
+struct epoll {
+    spinlock_t lock;                        // The ready list
+    struct epoll_item *items;               // Interest list
+    struct epoll_item *ready;               // Items to poll, oldest first
+    struct epoll_item *ready_tail;
+    struct wait_queue wait;                 // Tasks in vfs_epoll_wait()
+};
+
+struct epoll_item {
+    struct epoll *ep;
+    struct file *file;                      // Watched; dropped before it closes
+    uint32_t events;                        // Wanted, with EPOLLERR and EPOLLHUP
+    uint64_t data;
+    struct epoll_item *next;                // On ep->items
+    struct epoll_item *prev;
+    struct epoll_item *file_next;           // On file->epoll_items
+    struct epoll_item *ready_next;          // On ep->ready
+    int on_ready;
+    int queues;                             // Entries hung on a queue
+    struct wait_queue *wq[EPOLL_ITEM_QUEUES];
+    struct wait_entry entry[EPOLL_ITEM_QUEUES];
+};
+
+// What poll_wait() hangs entries for; NULL when only polling
+struct poll_table {
+    struct epoll_item *item;
+};
+
+static spinlock_t epoll_ctl_lock = SPINLOCK_INIT;
+
+static int epoll_close(struct file *file);
+
+static struct file_operations epoll_file_ops = {
+    .close = epoll_close,
+};
+
+static inline struct epoll *epoll_of(struct file *file)
+{
+    return (struct epoll *)file->inode->private_data;
+}
+
+// Wait condition, checked without the lock
+static inline int epoll_has_ready(struct epoll *ep)
+{
+    return __atomic_load_n(&ep->ready, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// Queue item for the next wait unless it already is (ep locked)
+static void epoll_ready_add(struct epoll *ep, struct epoll_item *item)
+{
+    if (item->on_ready) {
+        return;
+    }
+    item->on_ready = 1;
+    item->ready_next = NULL;
+    if (ep->ready_tail) {
+        ep->ready_tail->ready_next = item;
+    } else {
+        __atomic_store_n(&ep->ready, item, __ATOMIC_RELEASE);
+    }
+    ep->ready_tail = item;
+}
+
+// ep locked
+static void epoll_ready_remove(struct epoll *ep, struct epoll_item *item)
+{
+    if (!item->on_ready) {
+        return;
+    }
+    struct epoll_item *prev = NULL;
+    struct epoll_item *cur = ep->ready;
+    while (cur != item) {
+        prev = cur;
+        cur = cur->ready_next;
+    }
+    if (prev) {
+        prev->ready_next = item->ready_next;
+    } else {
+        __atomic_store_n(&ep->ready, item->ready_next, __ATOMIC_RELEASE);
+    }
+    if (ep->ready_tail == item) {
+        ep->ready_tail = prev;
+    }
+    item->ready_next = NULL;
+    item->on_ready = 0;
+}
+
+// A watched queue was woken (its lock held, interrupts off)
+static void epoll_item_wake(struct wait_entry *entry)
+{
+    struct epoll_item *item = entry->private;
+    struct epoll *ep = item->ep;
+
+    spin_lock(&ep->lock);
+    epoll_ready_add(ep, item);
+    spin_unlock(&ep->lock);
+
+    wake_up(&ep->wait);
+}
+
+/**
+ * Called by poll methods for each queue woken when the file's readiness
+ * changes. Does nothing when the caller is only polling.
+ */
+void poll_wait(struct poll_table *pt, struct wait_queue *wq)
+{
+    if (!pt || !wq) {
+        return;
+    }
+
+    struct epoll_item *item = pt->item;
+    for (int i = 0; i < item->queues; i++) {
+        if (item->wq[i] == wq) {
+            return;
+        }
+    }
+    if (item->queues == EPOLL_ITEM_QUEUES) {
+        return;
+    }
+
+    struct wait_entry *entry = &item->entry[item->queues];
+    item->wq[item->queues++] = wq;
+    entry->func = epoll_item_wake;
+    entry->private = item;
+    wait_queue_add(wq, entry);
+}
+
+// Poll item's file, registering with its queues the first time, and queue
+// the item if it is ready already
+static void epoll_item_arm(struct epoll_item *item, int first)
+{
+    struct epoll *ep = item->ep;
+    struct poll_table pt = { item };
+
+    uint32_t events = item->file->ops->poll(item->file, first ? &pt : NULL);
+    if (!(events & item->events)) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&ep->lock);
+    epoll_ready_add(ep, item);
+    spin_unlock_irqrestore(&ep->lock, flags);
+    wake_up(&ep->wait);
+}
+
+/*
+ * Take item off its queues, the ready list, the interest list and its
+ * file's list; it can be freed once epoll_ctl_lock is dropped (held)
+ */
+static void epoll_item_unlink(struct epoll_item *item)
+{
+    struct epoll *ep = item->ep;
+
+    // No wakeup can queue the item again after this
+    for (int i = 0; i < item->queues; i++) {
+        wait_queue_remove(item->wq[i], &item->entry[i]);
+    }
+    item->queues = 0;
+
+    unsigned long flags = spin_lock_irqsave(&ep->lock);
+    epoll_ready_remove(ep, item);
+    spin_unlock_irqrestore(&ep->lock, flags);
+
+    if (item->prev) {
+        item->prev->next = item->next;
+    } else {
+        ep->items = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    }
+
+    struct epoll_item **link = &item->file->epoll_items;
+    while (*link != item) {
+        link = &(*link)->file_next;
+    }
+    *link = item->file_next;
+    item->file_next = NULL;
+}
+
+// ep's item for file; files are watched by few instances (ctl locked)
+static struct epoll_item *epoll_find(struct epoll *ep, struct file *file)
+{
+    for (struct epoll_item *item = file->epoll_items; item; item = item->file_next) {
+        if (item->ep == ep) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+// Last reference: every item goes, then the instance
+static int epoll_close(struct file *file)
+{
+    struct epoll *ep = epoll_of(file);
+    struct epoll_item *freed = NULL;
+
+    unsigned long flags = spin_lock_irqsave(&epoll_ctl_lock);
+    while (ep->items) {
+        struct epoll_item *item = ep->items;
+        epoll_item_unlink(item);
+        item->next = freed;
+        freed = item;
+    }
+    spin_unlock_irqrestore(&epoll_ctl_lock, flags);
+
+    while (freed) {
+        struct epoll_item *next = freed->next;
+        kfree(freed);
+        freed = next;
+    }
+    kfree(ep);
+    file->inode->private_data = NULL;
+    return VFS_SUCCESS;
+}
+
+/**
+ * A watched file is closing for good: take it off every interest list.
+ * Called by vfs_file_put() before the file's own close.
+ */
+void vfs_epoll_release(struct file *file)
+{
+    struct epoll_item *freed = NULL;
+
+    unsigned long flags = spin_lock_irqsave(&epoll_ctl_lock);
+    while (file->epoll_items) {
+        struct epoll_item *item = file->epoll_items;
+        epoll_item_unlink(item);
+        item->next = freed;
+        freed = item;
+    }
+    spin_unlock_irqrestore(&epoll_ctl_lock, flags);
+
+    while (freed) {
+        struct epoll_item *next = freed->next;
+        kfree(freed);
+        freed = next;
+    }
+}
+
+/**
+ * Create an epoll instance in the current descriptor table
+ * @return The descriptor, or a negative VFS error
+ */
+int vfs_epoll_create(void)
+{
+    struct epoll *ep = kmalloc(sizeof(struct epoll));
+    struct file *file = kmalloc(sizeof(struct file));
+    struct inode *inode = kmalloc(sizeof(struct inode));
+    if (!ep || !file || !inode) {
+        kfree(ep);
+        kfree(file);
+        kfree(inode);
+        return VFS_ENOMEM;
+    }
+
+    memset(ep, 0, sizeof(struct epoll));
+    spin_lock_init(&ep->lock);
+    wait_queue_init(&ep->wait);
+
+    memset(inode, 0, sizeof(struct inode));
+    inode->private_data = ep;
+    inode->ref_count = 1;
+
+    memset(file, 0, sizeof(struct file));
+    file->inode = inode;
+    file->flags = VFS_O_RDONLY;
+    file->ref_count = 1;
+    file->ops = &epoll_file_ops;
+
+    int fd = fd_install(fd_get_current_table(), file, VFS_O_RDONLY);
+    if (fd < 0) {
+        vfs_file_put(file);
+        return VFS_ENOSPC;
+    }
+    return fd;
+}
+
+// One change to ep's interest in file. ADD links fresh; DEL hands back the
+// item to free in *freed (ctl locked)
+static int epoll_ctl_file(struct epoll *ep, int op, struct file *file,
+                          const struct epoll_event *event, struct epoll_item *fresh,
+                          struct epoll_item **freed)
+{
+    struct epoll_item *item = epoll_find(ep, file);
+    uint32_t events = event ? event->events | EPOLLERR | EPOLLHUP : 0;
+
+    switch (op) {
+    case EPOLL_CTL_ADD:
+        if (item) {
+            return VFS_EEXIST;
+        }
+        fresh->ep = ep;
+        fresh->file = file;
+        fresh->events = events;
+        fresh->data = event->data;
+        fresh->next = ep->items;
+        if (ep->items) {
+            ep->items->prev = fresh;
+        }
+        ep->items = fresh;
+        fresh->file_next = file->epoll_items;
+        file->epoll_items = fresh;
+        epoll_item_arm(fresh, 1);
+        return VFS_SUCCESS;
+
+    case EPOLL_CTL_MOD: {
+        if (!item) {
+            return VFS_ENOENT;
+        }
+        unsigned long flags = spin_lock_irqsave(&ep->lock);
+        item->events = events;
+        item->data = event->data;
+        spin_unlock_irqrestore(&ep->lock, flags);
+        epoll_item_arm(item, 0);
+        return VFS_SUCCESS;
+    }
+
+    case EPOLL_CTL_DEL:
+        if (!item) {
+            return VFS_ENOENT;
+        }
+        epoll_item_unlink(item);
+        *freed = item;
+        return VFS_SUCCESS;
+
+    default:
+        return VFS_EINVAL;
+    }
+}
+
+/**
+ * Add, change or remove the interest of epfd's instance in fd. Events are
+ * EPOLL* bits; EPOLLERR and EPOLLHUP are always reported.
+ * @return VFS_SUCCESS, or a negative VFS error
+ */
+int vfs_epoll_ctl(int epfd, int op, int fd, const struct epoll_event *event)
+{
+    if (op != EPOLL_CTL_DEL && !event) {
+        return VFS_EINVAL;
+    }
+
+    struct file *epfile = vfs_file_get(epfd);
+    struct file *file = vfs_file_get(fd);
+    int result = VFS_SUCCESS;
+    struct epoll_item *fresh = NULL;
+
+    if (!epfile || epfile->ops != &epoll_file_ops || !file) {
+        result = VFS_EINVAL;
+    } else if (file->ops == &epoll_file_ops || !file->ops || !file->ops->poll) {
+        result = VFS_EPERM;     // Not pollable; instances do not nest
+    } else if (op == EPOLL_CTL_ADD) {
+        fresh = kmalloc(sizeof(struct epoll_item));
+        if (fresh) {
+            memset(fresh, 0, sizeof(struct epoll_item));
+        } else {
+            result = VFS_ENOMEM;
+        }
+    }
+
+    struct epoll_item *freed = NULL;
+    if (result == VFS_SUCCESS) {
+        unsigned long flags = spin_lock_irqsave(&epoll_ctl_lock);
+        result = epoll_ctl_file(epoll_of(epfile), op, file, event, fresh, &freed);
+        spin_unlock_irqrestore(&epoll_ctl_lock, flags);
+
+        if (op == EPOLL_CTL_ADD && result == VFS_SUCCESS) {
+            fresh = NULL;       // On the interest list now
+        }
+    }
+
+    kfree(fresh);
+    kfree(freed);
+    vfs_file_put(file);
+    vfs_file_put(epfile);
+    return result;
+}
+
+/*
+ * Report ready items into events, up to max_events. Level-triggered items
+ * that reported go back at the end of the list, behind whatever was woken
+ * meanwhile, so one busy file cannot crowd out the others.
+ */
+static int epoll_collect(struct epoll *ep, struct epoll_event *events, int max_events)
+{
+    struct epoll_item *again = NULL;
+    struct epoll_item *again_tail = NULL;
+    int count = 0;
+
+    unsigned long flags = spin_lock_irqsave(&ep->lock);
+    while (ep->ready && count < max_events) {
+        struct epoll_item *item = ep->ready;
+        __atomic_store_n(&ep->ready, item->ready_next, __ATOMIC_RELEASE);
+        if (!ep->ready) {
+            ep->ready_tail = NULL;
+        }
+        item->ready_next = NULL;
+        item->on_ready = 0;
+
+        uint32_t ready = item->file->ops->poll(item->file, NULL) & item->events;
+        if (!ready) {
+            continue;   // Consumed since the wakeup
+        }
+        events[count].events = ready;
+        events[count].data = item->data;
+        count++;
+
+        if (!(item->events & EPOLLET)) {
+            item->on_ready = 1;
+            if (again_tail) {
+                again_tail->ready_next = item;
+            } else {
+                again = item;
+            }
+            again_tail = item;
+        }
+    }
+
+    if (again) {
+        if (ep->ready_tail) {
+            ep->ready_tail->ready_next = again;
+        } else {
+            __atomic_store_n(&ep->ready, again, __ATOMIC_RELEASE);
+        }
+        ep->ready_tail = again_tail;
+    }
+    spin_unlock_irqrestore(&ep->lock, flags);
+
+    return count;
+}
+
+/**
+ * Wait for events on epfd's interest list. timeout_ms < 0 waits for good,
+ * 0 only polls.
+ * @return Events stored in events (0 on timeout), or a negative VFS error
+ */
+int vfs_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout_ms)
+{
+    if (!events || max_events <= 0) {
+        return VFS_EINVAL;
+    }
+    if (max_events > EPOLL_MAX_EVENTS) {
+        max_events = EPOLL_MAX_EVENTS;
+    }
+
+    struct file *epfile = vfs_file_get(epfd);
+    if (!epfile || epfile->ops != &epoll_file_ops) {
+        vfs_file_put(epfile);
+        return VFS_EINVAL;
+    }
+    struct epoll *ep = epoll_of(epfile);
+    uint64_t deadline = wait_deadline(timeout_ms > 0 ? (uint64_t)timeout_ms * 1000 : 0);
+
+    int count;
+    for (;;) {
+        count = epoll_collect(ep, events, max_events);
+        if (count > 0 || timeout_ms == 0) {
+            break;
+        }
+        if (timeout_ms < 0) {
+            wait_event(&ep->wait, epoll_has_ready(ep));
+            continue;
+        }
+        uint64_t now = wait_deadline(0);
+        if (now >= deadline) {
+            break;
+        }
+        wait_event_timeout(&ep->wait, epoll_has_ready(ep), deadline - now);
+    }
+
+    vfs_file_put(epfile);
+    return count;
+}
@@ -0,0 +1,154 @@
+/*
+ * MiniOS VFS Inode Locks
+ * Reader/writer locks keyed by (file system, inode number)
+ *
+ * A file system's inode structures are per open, so the lock guarding an
+ * inode lives here instead, in a hash of entries created by the first
+ * vfs_inode_lock_get() on an inode and freed by the last put. Open files,
+ * page cache mappings and file systems locking directories each hold a
+ * reference for as long as they use it. Each bucket has a spinlock of its
+ * own for finding entries and counting references; the rwsem inside is a
+ * sleeping lock, since holders do I/O.
+ */
+
+#include "vfs.h"
+#include "kernel.h"
+#include "sleeplock.h"
+
+struct vfs_inode_lock {
+    struct file_system *fs;
+    uint32_t ino;
+    uint32_t refs;                         // Under the bucket lock
+    struct rwsem lock;
+    struct vfs_inode_lock *next;           // Bucket chain
+};
+
+struct inode_lock_bucket {
+    spinlock_t lock;
+    struct vfs_inode_lock *head;
+};
+
+static struct inode_lock_bucket inode_lock_hash[VFS_INODE_LOCK_BUCKETS];
+
+static inline struct inode_lock_bucket *inode_lock_bucket_of(const struct file_system *fs,
+                                                             uint32_t ino)
+{
+    uint64_t key = ((uint64_t)(uintptr_t)fs >> 4) ^ ((uint64_t)ino * 0x9E3779B97F4A7C15ULL);
+    return &inode_lock_hash[(uint32_t)(key >> 32) & (VFS_INODE_LOCK_BUCKETS - 1)];
+}
+
+static struct vfs_inode_lock *inode_lock_find(struct inode_lock_bucket *bucket,
+                                              const struct file_system *fs, uint32_t ino)
+{
+    struct vfs_inode_lock *ilock = bucket->head;
+    while (ilock && (ilock->fs != fs || ilock->ino != ino)) {
+        ilock = ilock->next;
+    }
+    return ilock;
+}
+
+/**
+ * Take a reference to the lock of an inode, creating it if this is the
+ * first. Returns NULL without memory.
+ */
+struct vfs_inode_lock *vfs_inode_lock_get(struct file_system *fs, uint32_t ino)
+{
+    if (!fs) {
+        return NULL;
+    }
+
+    struct inode_lock_bucket *bucket = inode_lock_bucket_of(fs, ino);
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    struct vfs_inode_lock *ilock = inode_lock_find(bucket, fs, ino);
+    if (ilock) {
+        ilock->refs++;
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return ilock;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    // Allocated unlocked; a racing get may have added one meanwhile
+    struct vfs_inode_lock *created = kmalloc(sizeof(struct vfs_inode_lock));
+    if (!created) {
+        return NULL;
+    }
+    created->fs = fs;
+    created->ino = ino;
+    created->refs = 1;
+    rwsem_init(&created->lock);
+
+    flags = spin_lock_irqsave(&bucket->lock);
+    ilock = inode_lock_find(bucket, fs, ino);
+    if (ilock) {
+        ilock->refs++;
+    } else {
+        created->next = bucket->head;
+        bucket->head = created;
+        ilock = created;
+        created = NULL;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (created) {
+        kfree(created);
+    }
+    return ilock;
+}
+
+// Drop a reference; the lock must not be held by the caller
+void vfs_inode_lock_put(struct vfs_inode_lock *ilock)
+{
+    if (!ilock) {
+        return;
+    }
+
+    struct inode_lock_bucket *bucket = inode_lock_bucket_of(ilock->fs, ilock->ino);
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    if (--ilock->refs > 0) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return;
+    }
+
+    struct vfs_inode_lock **link = &bucket->head;
+    while (*link && *link != ilock) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = ilock->next;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    kfree(ilock);
+}
+
+void vfs_inode_read_lock(struct vfs_inode_lock *ilock)
+{
+    if (ilock) {
+        rwsem_down_read(&ilock->lock);
+    }
+}
+
+void vfs_inode_read_unlock(struct vfs_inode_lock *ilock)
+{
+    if (ilock) {
+        rwsem_up_read(&ilock->lock);
+    }
+}
+
+void vfs_inode_write_lock(struct vfs_inode_lock *ilock)
+{
+    if (ilock) {
+        rwsem_down_write(&ilock->lock);
+    }
+}
+
+void vfs_inode_write_unlock(struct vfs_inode_lock *ilock)
+{
+    if (ilock) {
+        rwsem_up_write(&ilock->lock);
+    }
+}
+
+int vfs_inode_write_trylock(struct vfs_inode_lock *ilock)
+{
+    return ilock ? rwsem_try_write(&ilock->lock) : 1;
+}
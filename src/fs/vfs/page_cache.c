@@ -0,0 +1,1449 @@
+/*
+ * MiniOS VFS Page Cache
+ * File data cache indexed by (inode, file offset)
+ *
+ * Every regular file on a file system with page operations gets one
+ * mapping, shared by all open files on that inode. Reads and writes copy
+ * to and from 4KB pages kept in a global hash and LRU list; the file
+ * system only maps and moves whole pages. Writes dirty pages and grow the
+ * mapping's size; dirty pages go back through writepages, in file order
+ * and in runs of consecutive pages, on sync, from the flusher and when a
+ * dirty page is evicted. Closing a file writes nothing back. Mappings
+ * without open files stay around while they still hold pages, so
+ * rereading a closed file is served from memory.
+ *
+ * Each open file tracks where its last read ended. Reads that carry on
+ * from there are sequential and read ahead a window of pages in the same
+ * request as the missing page; the window doubles on every sequential
+ * read up to VFS_READAHEAD_MAX_PAGES and collapses on a seek.
+ *
+ * Page data is a whole frame from the page allocator, so mmap() can map
+ * it into user address spaces. Every mapper holds a frame reference;
+ * pages that are mapped somewhere are never evicted, and a frame outlives
+ * its cache page until the last mapper lets go.
+ *
+ * Files opened with VFS_O_DIRECT move whole pages between the caller and
+ * the file system through a small bounce buffer instead, so streaming
+ * one-shot data leaves the cache to everyone else. Pages already cached
+ * stay authoritative: direct reads copy them rather than the older data
+ * on disk, and direct writes update them in place.
+ *
+ * The cache registers a shrinker, so under memory pressure the reclaimer
+ * takes clean pages nobody maps from the cold end of the LRU, below the
+ * capacity as well.
+ *
+ * Locking: page_cache_lock, a spinlock, covers the hash, the LRU list,
+ * the mapping list and every count, and is never held across I/O. Pages
+ * are read into fresh frames first and only then inserted, so a page in
+ * the hash is always filled; when two readers race to bring in the same
+ * page the loser frees its copy. Users of a page's data pin its frame
+ * while they copy, which keeps eviction and the shrinker away from it.
+ * A mapping's inode lock orders everything else: reads hold it shared,
+ * writes, truncation and writeback exclusive, so writeback never meets a
+ * write to the same file. Eviction writes back a dirty victim's mapping
+ * only when the caller already holds that lock exclusive or can take it
+ * without waiting.
+ */
+
+#include "vfs.h"
+#include "kernel.h"
+#include "percpu.h"
+#include "spinlock.h"
+
+struct vfs_page {
+    struct vfs_mapping *mapping;
+    uint32_t index;                        // File offset / VFS_PAGE_SIZE
+    int dirty;
+    uint8_t *data;
+    struct vfs_page *hash_next;
+    struct vfs_page *lru_prev;             // Most recently used at the head
+    struct vfs_page *lru_next;
+};
+
+static spinlock_t page_cache_lock = SPINLOCK_INIT;
+static struct vfs_page *page_hash[VFS_PAGE_CACHE_BUCKETS];
+static struct vfs_page *page_lru_head = NULL;
+static struct vfs_page *page_lru_tail = NULL;
+static struct vfs_mapping *mapping_list = NULL;
+static int page_cache_initialized = 0;
+
+static uint32_t page_capacity = VFS_PAGE_CACHE_DEFAULT_PAGES;
+static uint32_t page_count = 0;
+static uint32_t page_dirty_count = 0;
+static uint32_t mapping_count = 0;
+
+// Statistics, per CPU as every read and write bumps them
+struct page_cache_counts {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t readahead;
+    uint64_t direct_reads;
+    uint64_t direct_writes;
+};
+static DEFINE_PER_CPU(struct page_cache_counts, page_counts);
+
+static uint32_t page_shrink_count(void);
+static uint32_t page_shrink_scan(uint32_t nr);
+
+static struct shrinker page_shrinker = {
+    .name = "page cache",
+    .count = page_shrink_count,
+    .scan = page_shrink_scan,
+};
+
+// Register the shrinker on first use; the tables start out empty
+static void page_cache_init(void)
+{
+    if (!__atomic_exchange_n(&page_cache_initialized, 1, __ATOMIC_ACQ_REL)) {
+        shrinker_register(&page_shrinker);
+    }
+}
+
+static inline uint32_t page_hash_index(const struct vfs_mapping *mapping, uint32_t index)
+{
+    uint64_t key = ((uint64_t)(uintptr_t)mapping >> 4) ^ ((uint64_t)index * 0x9E3779B97F4A7C15ULL);
+    return (uint32_t)(key >> 32) & (VFS_PAGE_CACHE_BUCKETS - 1);
+}
+
+static void page_lru_remove(struct vfs_page *page)
+{
+    if (page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        page_lru_head = page->lru_next;
+    }
+    if (page->lru_next) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        page_lru_tail = page->lru_prev;
+    }
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+}
+
+static void page_lru_push(struct vfs_page *page)
+{
+    page->lru_prev = NULL;
+    page->lru_next = page_lru_head;
+    if (page_lru_head) {
+        page_lru_head->lru_prev = page;
+    }
+    page_lru_head = page;
+    if (!page_lru_tail) {
+        page_lru_tail = page;
+    }
+}
+
+static struct vfs_page *page_lookup(struct vfs_mapping *mapping, uint32_t index)
+{
+    struct vfs_page *page = page_hash[page_hash_index(mapping, index)];
+    while (page && (page->mapping != mapping || page->index != index)) {
+        page = page->hash_next;
+    }
+    return page;
+}
+
+static void mapping_unlink(struct vfs_mapping *mapping)
+{
+    struct vfs_mapping **link = &mapping_list;
+    while (*link) {
+        if (*link == mapping) {
+            *link = mapping->next;
+            mapping->next = NULL;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+// Free a mapping once no open file or cached page refers to it (locked)
+static void mapping_release_if_unused(struct vfs_mapping *mapping)
+{
+    if (mapping->refs > 0 || mapping->pages > 0) {
+        return;
+    }
+    if (!mapping->orphan) {
+        mapping_unlink(mapping);
+    }
+    mapping_count--;
+    vfs_inode_lock_put(mapping->ilock);
+    kfree(mapping);
+}
+
+// Unlink and free a page (locked); its frame lives on while pinned
+static void page_destroy(struct vfs_page *page)
+{
+    struct vfs_mapping *mapping = page->mapping;
+
+    struct vfs_page **link = &page_hash[page_hash_index(mapping, page->index)];
+    while (*link) {
+        if (*link == page) {
+            *link = page->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    page_lru_remove(page);
+    page_count--;
+    mapping->pages--;
+    if (page->dirty) {
+        page_dirty_count--;
+        mapping->dirty--;
+    }
+
+    page_ref_put(page->data);
+    kfree(page);
+}
+
+static inline int page_is_mapped(const struct vfs_page *page)
+{
+    return page_ref_count(page->data) > 1;
+}
+
+static inline void page_set_dirty(struct vfs_page *page)
+{
+    page->mapping->changes++;
+    if (!page->dirty) {
+        page->dirty = 1;
+        page->mapping->dirty++;
+        page_dirty_count++;
+        vfs_writeback_kick(page_dirty_count);
+    }
+}
+
+static inline void page_clear_dirty(struct vfs_page *page)
+{
+    if (page->dirty) {
+        page->dirty = 0;
+        page->mapping->dirty--;
+        page_dirty_count--;
+    }
+}
+
+// Pin a cached page's frame, moving it to the head of the LRU (locked)
+static uint8_t *page_pin(struct vfs_page *page)
+{
+    if (page_ref_get(page->data) < 0) {
+        return NULL;
+    }
+    page_lru_remove(page);
+    page_lru_push(page);
+    return page->data;
+}
+
+static inline void page_unpin(uint8_t *frame)
+{
+    page_ref_put(frame);
+}
+
+// Drop a mapping's pages from index first on, without writing them back (locked)
+static void mapping_drop_pages(struct vfs_mapping *mapping, uint32_t first)
+{
+    struct vfs_page *page = page_lru_head;
+    while (page && mapping->pages > 0) {
+        struct vfs_page *next = page->lru_next;
+        if (page->mapping == mapping && page->index >= first) {
+            page_destroy(page);
+        }
+        page = next;
+    }
+}
+
+// Drop a reference to a mapping (locked). A deleted file's pages go with the last one.
+static void mapping_put(struct vfs_mapping *mapping)
+{
+    if (mapping->refs > 0) {
+        mapping->refs--;
+    }
+    if (mapping->orphan && mapping->refs == 0) {
+        mapping_drop_pages(mapping, 0);
+    }
+    mapping_release_if_unused(mapping);
+}
+
+/**
+ * Write back every dirty page of a mapping in file order, so a file system
+ * allocating blocks on writeback can lay them out contiguously. The caller
+ * holds the mapping's inode lock exclusive, so nothing writes the pages
+ * meanwhile. Each run is pinned and marked clean before it goes to the
+ * file system, and marked dirty again if that fails.
+ */
+static int mapping_writeback(struct vfs_mapping *mapping)
+{
+    if (mapping->orphan) {
+        return VFS_SUCCESS;  // Deleted file: nothing to write to
+    }
+
+    struct page_operations *ops = mapping->fs->type->page_ops;
+    struct inode *inode = NULL;
+    int result = VFS_SUCCESS;
+    uint32_t seen = 0;
+
+    struct vfs_page *run[VFS_PAGE_IO_MAX_PAGES];
+    void *data[VFS_PAGE_IO_MAX_PAGES];
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
+
+    for (uint32_t index = 0; ; index++) {
+        unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+        struct vfs_page *page = NULL;
+        if (seen < mapping->pages && mapping->dirty > 0) {
+            page = page_lookup(mapping, index);
+            if (!page && (uint64_t)index * VFS_PAGE_SIZE >= mapping->size) {
+                seen = mapping->pages;  // Nothing cached past end of file
+            }
+        }
+        int dirty = page && page->dirty;
+        int done = !page && (seen >= mapping->pages || mapping->dirty == 0);
+
+        // Extend the current run of dirty pages, or write it out
+        if (dirty && run_len < VFS_PAGE_IO_MAX_PAGES && page_ref_get(page->data) == 0) {
+            if (run_len == 0) {
+                run_start = index;
+            }
+            page_clear_dirty(page);
+            run[run_len] = page;
+            data[run_len] = page->data;
+            run_len++;
+            seen++;
+            spin_unlock_irqrestore(&page_cache_lock, flags);
+            continue;
+        }
+        if (page && !dirty) {
+            seen++;
+        }
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+
+        if (run_len > 0) {
+            if (!inode) {
+                inode = ops->get_inode(mapping->fs, mapping->ino);
+            }
+            int written = inode && ops->writepages(mapping->fs, inode, run_start, run_len,
+                                                   data, mapping->size) == VFS_SUCCESS;
+            flags = spin_lock_irqsave(&page_cache_lock);
+            for (uint32_t i = 0; i < run_len; i++) {
+                if (!written) {
+                    page_set_dirty(run[i]);  // Keep the data for another try
+                }
+                page_unpin(data[i]);
+            }
+            spin_unlock_irqrestore(&page_cache_lock, flags);
+            if (written) {
+                this_cpu_add(page_counts, writebacks, run_len);
+            } else {
+                result = VFS_EIO;
+                if (!inode) {
+                    return result;
+                }
+            }
+            run_len = 0;
+
+            // A full run ended on a dirty page that starts the next one
+            if (dirty) {
+                index--;
+                continue;
+            }
+        }
+
+        if (done) {
+            break;
+        }
+    }
+
+    if (inode) {
+        // Block mappings changed under any inode copy a reader holds
+        mapping->generation++;
+        if (ops->put_inode(inode) != VFS_SUCCESS) {
+            result = VFS_EIO;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Evict the least recently used page. A dirty victim writes back its
+ * whole mapping first, under that mapping's inode lock: held is a mapping
+ * whose lock the caller holds exclusive (or NULL); any other mapping with
+ * dirty pages is passed over if its lock is busy. Returns 0 when nothing
+ * could be evicted.
+ */
+static int page_evict_one(struct vfs_mapping *held)
+{
+    int wrote = 0;
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+
+restart:
+    for (struct vfs_page *page = page_lru_tail; page; page = page->lru_prev) {
+        if (page_is_mapped(page)) {
+            continue;  // Mappers see this frame, or a copy is in progress
+        }
+
+        struct vfs_mapping *mapping = page->mapping;
+        if (page->dirty && !mapping->orphan) {
+            if (wrote || (mapping != held && !vfs_inode_write_trylock(mapping->ilock))) {
+                continue;  // Keep data we could not write
+            }
+            mapping->refs++;
+            spin_unlock_irqrestore(&page_cache_lock, flags);
+
+            mapping_writeback(mapping);
+            if (mapping != held) {
+                vfs_inode_write_unlock(mapping->ilock);
+            }
+
+            flags = spin_lock_irqsave(&page_cache_lock);
+            mapping_put(mapping);
+            wrote = 1;
+            goto restart;  // The list may have changed meanwhile
+        }
+
+        page_destroy(page);
+        this_cpu_inc(page_counts, evictions);
+        mapping_release_if_unused(mapping);
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        return 1;
+    }
+
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    return 0;
+}
+
+// Clean pages, some of which may be mapped and so stay
+static uint32_t page_shrink_count(void)
+{
+    return page_count - page_dirty_count;
+}
+
+/**
+ * Drop up to nr clean, unmapped pages, least recently used first. Dirty
+ * pages of orphans have nowhere to go and are dropped as eviction would.
+ */
+static uint32_t page_shrink_scan(uint32_t nr)
+{
+    uint32_t freed = 0;
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_page *page = page_lru_tail;
+    while (page && freed < nr) {
+        struct vfs_page *prev = page->lru_prev;
+        if ((!page->dirty || page->mapping->orphan) && !page_is_mapped(page)) {
+            struct vfs_mapping *mapping = page->mapping;
+            page_destroy(page);
+            this_cpu_inc(page_counts, evictions);
+            freed++;
+            mapping_release_if_unused(mapping);  // Only once it has no pages left
+        }
+        page = prev;
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    return freed;
+}
+
+/**
+ * Stay within capacity with count more pages; if every page is
+ * unwritable, grow past it
+ */
+static void page_make_room(struct vfs_mapping *held, uint32_t count)
+{
+    for (uint32_t i = 0; i < count && page_count + count > page_capacity; i++) {
+        if (!page_evict_one(held)) {
+            break;
+        }
+    }
+}
+
+// A page for (mapping, index) with a fresh frame, not yet in the cache
+static struct vfs_page *page_new(struct vfs_mapping *mapping, uint32_t index)
+{
+    struct vfs_page *page = kmalloc(sizeof(struct vfs_page));
+    if (!page) {
+        return NULL;
+    }
+    page->data = memory_alloc_pages(1);
+    if (!page->data) {
+        kfree(page);
+        return NULL;
+    }
+
+    page->mapping = mapping;
+    page->index = index;
+    page->dirty = 0;
+    page->hash_next = NULL;
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+    return page;
+}
+
+// Free a page that never made it into the cache
+static void page_free(struct vfs_page *page)
+{
+    page_ref_put(page->data);
+    kfree(page);
+}
+
+/**
+ * Add a filled page to the cache (locked). Returns the page now cached
+ * for its index: page itself, or one another task got in first with.
+ */
+static struct vfs_page *page_insert(struct vfs_page *page)
+{
+    struct vfs_page *cached = page_lookup(page->mapping, page->index);
+    if (cached) {
+        return cached;
+    }
+
+    uint32_t idx = page_hash_index(page->mapping, page->index);
+    page->hash_next = page_hash[idx];
+    page_hash[idx] = page;
+    page_lru_push(page);
+    page_count++;
+    page->mapping->pages++;
+    return page;
+}
+
+/**
+ * Per-call handle on the file system's inode for page reads. The file
+ * system's inode copy caches block mappings, so it is refreshed whenever
+ * writeback of the mapping may have changed them.
+ */
+struct page_reader {
+    struct inode *inode;
+    uint32_t generation;
+};
+
+// Read count consecutive pages of file data
+static int page_fill(struct vfs_mapping *mapping, struct page_reader *reader,
+                     uint32_t index, uint32_t count, void **data)
+{
+    // Nothing on disk for deleted files
+    if (mapping->orphan) {
+        for (uint32_t i = 0; i < count; i++) {
+            memset(data[i], 0, VFS_PAGE_SIZE);
+        }
+        return VFS_SUCCESS;
+    }
+
+    struct page_operations *ops = mapping->fs->type->page_ops;
+    if (reader->inode && reader->generation != mapping->generation) {
+        ops->put_inode(reader->inode);
+        reader->inode = NULL;
+    }
+    if (!reader->inode) {
+        reader->inode = ops->get_inode(mapping->fs, mapping->ino);
+        reader->generation = mapping->generation;
+        if (!reader->inode) {
+            return VFS_EIO;
+        }
+    }
+
+    return ops->readpages(mapping->fs, reader->inode, index, count, data);
+}
+
+static void page_reader_done(struct vfs_mapping *mapping, struct page_reader *reader)
+{
+    if (reader->inode) {
+        mapping->fs->type->page_ops->put_inode(reader->inode);
+        reader->inode = NULL;
+    }
+}
+
+// Pin the frame of a cached page, counting a hit; NULL when not cached
+static uint8_t *page_find(struct vfs_mapping *mapping, uint32_t index)
+{
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_page *page = page_lookup(mapping, index);
+    uint8_t *frame = page ? page_pin(page) : NULL;
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    if (frame) {
+        this_cpu_inc(page_counts, hits);
+    }
+    return frame;
+}
+
+/**
+ * Pin the frame of a page, reading it in if needed (fill set) or starting
+ * from zeroes when the caller overwrites it completely. dirty marks the
+ * page dirty, for callers about to write it. held is as for eviction.
+ */
+static uint8_t *page_get(struct vfs_mapping *mapping, struct page_reader *reader,
+                         uint32_t index, int fill, int dirty, struct vfs_mapping *held)
+{
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_page *page = page_lookup(mapping, index);
+    uint8_t *frame = page ? page_pin(page) : NULL;
+    if (frame && dirty) {
+        page_set_dirty(page);
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    if (frame) {
+        this_cpu_inc(page_counts, hits);
+        return frame;
+    }
+
+    this_cpu_inc(page_counts, misses);
+    page_make_room(held, 1);
+    struct vfs_page *created = page_new(mapping, index);
+    if (!created) {
+        return NULL;
+    }
+
+    if (fill && (uint64_t)index * VFS_PAGE_SIZE < mapping->size) {
+        void *data = created->data;
+        if (page_fill(mapping, reader, index, 1, &data) != VFS_SUCCESS) {
+            page_free(created);
+            return NULL;
+        }
+    } else {
+        memset(created->data, 0, VFS_PAGE_SIZE);
+    }
+
+    flags = spin_lock_irqsave(&page_cache_lock);
+    page = page_insert(created);
+    frame = page_pin(page);
+    if (frame && dirty) {
+        page_set_dirty(page);
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    if (page != created) {
+        page_free(created);
+    }
+    return frame;
+}
+
+/**
+ * Bring in up to count uncached pages starting at index (which must be
+ * missing) with one file system request. Returns the frame of the page at
+ * index, pinned, or NULL.
+ */
+static uint8_t *page_read_batch(struct vfs_mapping *mapping, struct page_reader *reader,
+                                uint32_t index, uint32_t count, struct vfs_mapping *held)
+{
+    // Only go as far as end of file and the first page already cached
+    uint32_t eof_pages = (uint32_t)(((uint64_t)mapping->size + VFS_PAGE_SIZE - 1) / VFS_PAGE_SIZE);
+    if (index >= eof_pages) {
+        return NULL;
+    }
+    if (count > eof_pages - index) {
+        count = eof_pages - index;
+    }
+    if (count > VFS_PAGE_IO_MAX_PAGES) {
+        count = VFS_PAGE_IO_MAX_PAGES;
+    }
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    for (uint32_t i = 1; i < count; i++) {
+        if (page_lookup(mapping, index + i)) {
+            count = i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    page_make_room(held, count);
+
+    struct vfs_page *pages[VFS_PAGE_IO_MAX_PAGES];
+    void *data[VFS_PAGE_IO_MAX_PAGES];
+    uint32_t created = 0;
+    while (created < count) {
+        pages[created] = page_new(mapping, index + created);
+        if (!pages[created]) {
+            break;
+        }
+        data[created] = pages[created]->data;
+        created++;
+    }
+    if (created == 0) {
+        return NULL;
+    }
+
+    // The file system reads straight into the pages
+    int result = page_fill(mapping, reader, index, created, data);
+    if (result != VFS_SUCCESS) {
+        for (uint32_t i = 0; i < created; i++) {
+            page_free(pages[i]);
+        }
+        return NULL;
+    }
+
+    // Pages cached meanwhile by another reader win over ours
+    uint32_t inserted = 0;
+    flags = spin_lock_irqsave(&page_cache_lock);
+    for (uint32_t i = created; i-- > 0; ) {
+        struct vfs_page *page = page_insert(pages[i]);
+        if (page == pages[i]) {
+            pages[i] = NULL;
+            inserted++;
+        }
+        if (i == 0) {
+            // Leave the page we were asked for most recently used
+            data[0] = page_pin(page);
+        }
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    for (uint32_t i = 0; i < created; i++) {
+        if (pages[i]) {
+            page_free(pages[i]);
+        }
+    }
+
+    this_cpu_inc(page_counts, misses);
+    if (inserted > 1) {
+        this_cpu_add(page_counts, readahead, inserted - 1);
+    }
+    return (uint8_t *)data[0];
+}
+
+static struct vfs_mapping *mapping_find(struct file_system *fs, uint32_t ino)
+{
+    for (struct vfs_mapping *mapping = mapping_list; mapping; mapping = mapping->next) {
+        if (mapping->fs == fs && mapping->ino == ino) {
+            return mapping;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the mapping for an inode, taking a reference. size is the on-disk
+ * size, used only when the inode has no mapping yet.
+ */
+struct vfs_mapping *vfs_page_cache_open(struct file_system *fs, uint32_t ino, uint32_t size)
+{
+    if (!fs || !fs->type || !fs->type->page_ops) {
+        return NULL;
+    }
+
+    page_cache_init();
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_mapping *mapping = mapping_find(fs, ino);
+    if (mapping) {
+        mapping->refs++;
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        return mapping;
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    // Set up unlocked; a racing open may have added one meanwhile
+    struct vfs_mapping *created = kmalloc(sizeof(struct vfs_mapping));
+    if (!created) {
+        return NULL;
+    }
+    memset(created, 0, sizeof(struct vfs_mapping));
+    created->fs = fs;
+    created->ino = ino;
+    created->size = size;
+    created->ilock = vfs_inode_lock_get(fs, ino);
+    if (!created->ilock) {
+        kfree(created);
+        return NULL;
+    }
+
+    flags = spin_lock_irqsave(&page_cache_lock);
+    mapping = mapping_find(fs, ino);
+    if (!mapping) {
+        mapping = created;
+        created = NULL;
+        mapping->next = mapping_list;
+        mapping_list = mapping;
+        mapping_count++;
+    }
+    mapping->refs++;
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    if (created) {
+        vfs_inode_lock_put(created->ilock);
+        kfree(created);
+    }
+    return mapping;
+}
+
+
+// Pages one read may bring in: no more than half the cache would hold
+static uint32_t page_batch_limit(void)
+{
+    uint32_t limit = page_capacity / 2;
+    if (limit > VFS_READAHEAD_MAX_PAGES) {
+        limit = VFS_READAHEAD_MAX_PAGES;
+    }
+    return limit ? limit : 1;
+}
+
+/**
+ * Read through the cache. ra, if given, is the caller's readahead state
+ * and is updated for the next read. The caller holds the inode lock shared.
+ */
+ssize_t vfs_page_cache_read(struct vfs_mapping *mapping, struct vfs_readahead *ra,
+                            void *buf, size_t count, off_t offset)
+{
+    if (!mapping || !buf || offset < 0) {
+        return VFS_EINVAL;
+    }
+
+    if (offset >= (off_t)mapping->size) {
+        return 0;  // EOF
+    }
+    if (count > mapping->size - (size_t)offset) {
+        count = mapping->size - (size_t)offset;
+    }
+
+    uint32_t first = (uint32_t)(offset / VFS_PAGE_SIZE);
+    uint32_t window = 0;
+    if (ra) {
+        if (first == ra->next) {
+            window = ra->window ? ra->window * 2 : VFS_READAHEAD_MIN_PAGES;
+            if (window > VFS_READAHEAD_MAX_PAGES) {
+                window = VFS_READAHEAD_MAX_PAGES;
+            }
+        }
+        ra->window = window;
+    }
+
+    uint32_t batch_limit = page_batch_limit();
+    uint32_t last = (uint32_t)(((uint64_t)offset + count - 1) / VFS_PAGE_SIZE);
+    struct page_reader reader = {NULL, 0};
+    uint8_t *dest = (uint8_t *)buf;
+    size_t done = 0;
+
+    while (done < count) {
+        uint64_t pos = (uint64_t)offset + done;
+        uint32_t index = (uint32_t)(pos / VFS_PAGE_SIZE);
+        uint32_t page_offset = (uint32_t)(pos % VFS_PAGE_SIZE);
+
+        uint8_t *frame = page_find(mapping, index);
+        if (!frame) {
+            // The rest of this read plus the readahead window in one go
+            uint32_t want = last - index + 1 + window;
+            if (want > batch_limit) {
+                want = batch_limit;
+            }
+            frame = page_read_batch(mapping, &reader, index, want, NULL);
+            if (!frame) {
+                break;
+            }
+        }
+
+        size_t chunk = VFS_PAGE_SIZE - page_offset;
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+        memcpy(dest + done, frame + page_offset, chunk);
+        page_unpin(frame);
+        done += chunk;
+    }
+
+    page_reader_done(mapping, &reader);
+    if (done == 0) {
+        return VFS_EIO;
+    }
+    if (ra) {
+        ra->next = (uint32_t)(((uint64_t)offset + done) / VFS_PAGE_SIZE);
+    }
+    return (ssize_t)done;
+}
+
+// The caller holds the inode lock exclusive
+ssize_t vfs_page_cache_write(struct vfs_mapping *mapping, const void *buf, size_t count,
+                             off_t offset)
+{
+    if (!mapping || !buf || offset < 0) {
+        return VFS_EINVAL;
+    }
+
+    // Sizes are 32-bit on disk
+    if ((uint64_t)offset >= 0xFFFFFFFFULL) {
+        return VFS_ENOSPC;
+    }
+    if (count > 0xFFFFFFFFULL - (uint64_t)offset) {
+        count = (size_t)(0xFFFFFFFFULL - (uint64_t)offset);
+    }
+
+    struct page_reader reader = {NULL, 0};
+    const uint8_t *src = (const uint8_t *)buf;
+    size_t done = 0;
+
+    while (done < count) {
+        uint64_t pos = (uint64_t)offset + done;
+        uint32_t page_offset = (uint32_t)(pos % VFS_PAGE_SIZE);
+        size_t chunk = VFS_PAGE_SIZE - page_offset;
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+
+        // Only a partial overwrite needs the old contents
+        int fill = (chunk < VFS_PAGE_SIZE);
+        uint8_t *frame = page_get(mapping, &reader, (uint32_t)(pos / VFS_PAGE_SIZE), fill, 1,
+                                  mapping);
+        if (!frame) {
+            break;
+        }
+
+        memcpy(frame + page_offset, src + done, chunk);
+        page_unpin(frame);
+        done += chunk;
+
+        if (pos + chunk > mapping->size) {
+            mapping->size = (uint32_t)(pos + chunk);
+        }
+    }
+
+    page_reader_done(mapping, &reader);
+    if (done == 0) {
+        return VFS_ENOMEM;
+    }
+    return (ssize_t)done;
+}
+
+// Pages of bounce buffer for one direct transfer of count bytes
+static uint32_t page_direct_bounce_pages(size_t count)
+{
+    size_t pages = (count + VFS_PAGE_SIZE - 1) / VFS_PAGE_SIZE;
+    return pages < VFS_PAGE_IO_MAX_PAGES ? (uint32_t)pages : VFS_PAGE_IO_MAX_PAGES;
+}
+
+// Whether a page is cached, without touching its LRU place
+static int page_cached(struct vfs_mapping *mapping, uint32_t index)
+{
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    int cached = page_lookup(mapping, index) != NULL;
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    return cached;
+}
+
+/**
+ * Read page-aligned file data without caching it. Runs of uncached pages
+ * go through readpages into a bounce buffer; cached pages are copied from
+ * the cache, which may be newer than the disk, and keep their LRU place.
+ * The caller holds the inode lock shared.
+ */
+ssize_t vfs_page_cache_read_direct(struct vfs_mapping *mapping, void *buf, size_t count,
+                                   off_t offset)
+{
+    if (!mapping || !buf || offset < 0 || offset % VFS_PAGE_SIZE || count % VFS_PAGE_SIZE) {
+        return VFS_EINVAL;
+    }
+    if (mapping->orphan) {
+        return vfs_page_cache_read(mapping, NULL, buf, count, offset);
+    }
+
+    if (offset >= (off_t)mapping->size) {
+        return 0;  // EOF
+    }
+    if (count > mapping->size - (size_t)offset) {
+        count = mapping->size - (size_t)offset;
+    }
+
+    uint32_t bounce_pages = page_direct_bounce_pages(count);
+    uint8_t *bounce = memory_alloc_pages(bounce_pages);
+    if (!bounce) {
+        return VFS_ENOMEM;
+    }
+
+    struct page_reader reader = {NULL, 0};
+    uint8_t *dest = (uint8_t *)buf;
+    uint32_t first = (uint32_t)(offset / VFS_PAGE_SIZE);
+    uint32_t total = (uint32_t)((count + VFS_PAGE_SIZE - 1) / VFS_PAGE_SIZE);
+    uint32_t done = 0;
+    int result = VFS_SUCCESS;
+
+    while (done < total) {
+        size_t pos = (size_t)done * VFS_PAGE_SIZE;
+        size_t left = count - pos;
+
+        unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+        struct vfs_page *page = page_lookup(mapping, first + done);
+        uint8_t *frame = (page && page_ref_get(page->data) == 0) ? page->data : NULL;
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        if (frame) {
+            memcpy(dest + pos, frame, left < VFS_PAGE_SIZE ? left : VFS_PAGE_SIZE);
+            page_unpin(frame);
+            done++;
+            continue;
+        }
+
+        // Up to the next cached page, in one request
+        uint32_t run = 1;
+        while (run < bounce_pages && done + run < total &&
+               !page_cached(mapping, first + done + run)) {
+            run++;
+        }
+        void *data[VFS_PAGE_IO_MAX_PAGES];
+        for (uint32_t i = 0; i < run; i++) {
+            data[i] = bounce + (size_t)i * VFS_PAGE_SIZE;
+        }
+        result = page_fill(mapping, &reader, first + done, run, data);
+        if (result != VFS_SUCCESS) {
+            break;
+        }
+
+        size_t bytes = (size_t)run * VFS_PAGE_SIZE;
+        memcpy(dest + pos, bounce, left < bytes ? left : bytes);
+        this_cpu_add(page_counts, direct_reads, run);
+        done += run;
+    }
+
+    page_reader_done(mapping, &reader);
+    memory_free_pages(bounce, bounce_pages);
+
+    if (done == 0) {
+        return result != VFS_SUCCESS ? result : VFS_EIO;
+    }
+    size_t bytes = (size_t)done * VFS_PAGE_SIZE;
+    return (ssize_t)(bytes < count ? bytes : count);
+}
+
+/**
+ * Write whole pages straight to the file system through writepages. Any
+ * cached copy of a written page takes the new data and is clean after,
+ * since the disk now holds the same. The caller holds the inode lock
+ * exclusive.
+ */
+ssize_t vfs_page_cache_write_direct(struct vfs_mapping *mapping, const void *buf, size_t count,
+                                    off_t offset)
+{
+    if (!mapping || !buf || offset < 0 || offset % VFS_PAGE_SIZE || count % VFS_PAGE_SIZE) {
+        return VFS_EINVAL;
+    }
+    if (mapping->orphan) {
+        return vfs_page_cache_write(mapping, buf, count, offset);
+    }
+
+    // Sizes are 32-bit on disk
+    if ((uint64_t)offset + count > 0xFFFFF000ULL) {
+        if ((uint64_t)offset >= 0xFFFFF000ULL) {
+            return VFS_ENOSPC;
+        }
+        count = (size_t)(0xFFFFF000ULL - (uint64_t)offset);
+    }
+    if (count == 0) {
+        return VFS_EINVAL;
+    }
+
+    struct page_operations *ops = mapping->fs->type->page_ops;
+    struct inode *inode = ops->get_inode(mapping->fs, mapping->ino);
+    if (!inode) {
+        return VFS_EIO;
+    }
+    uint32_t bounce_pages = page_direct_bounce_pages(count);
+    uint8_t *bounce = memory_alloc_pages(bounce_pages);
+    if (!bounce) {
+        ops->put_inode(inode);
+        return VFS_ENOMEM;
+    }
+
+    const uint8_t *src = (const uint8_t *)buf;
+    uint32_t first = (uint32_t)(offset / VFS_PAGE_SIZE);
+    uint32_t total = (uint32_t)(count / VFS_PAGE_SIZE);
+    uint32_t done = 0;
+    int result = VFS_SUCCESS;
+
+    while (done < total) {
+        uint32_t run = total - done < bounce_pages ? total - done : bounce_pages;
+        size_t pos = (size_t)done * VFS_PAGE_SIZE;
+        size_t bytes = (size_t)run * VFS_PAGE_SIZE;
+        void *data[VFS_PAGE_IO_MAX_PAGES];
+        for (uint32_t i = 0; i < run; i++) {
+            data[i] = bounce + (size_t)i * VFS_PAGE_SIZE;
+        }
+        memcpy(bounce, src + pos, bytes);
+
+        uint32_t end = (uint32_t)((uint64_t)offset + pos + bytes);
+        uint32_t file_size = end > mapping->size ? end : mapping->size;
+        result = ops->writepages(mapping->fs, inode, first + done, run, data, file_size);
+        if (result != VFS_SUCCESS) {
+            break;
+        }
+
+        unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+        for (uint32_t i = 0; i < run; i++) {
+            struct vfs_page *page = page_lookup(mapping, first + done + i);
+            if (page) {
+                memcpy(page->data, data[i], VFS_PAGE_SIZE);
+                page_clear_dirty(page);
+            }
+        }
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        if (end > mapping->size) {
+            mapping->size = end;
+        }
+        this_cpu_add(page_counts, direct_writes, run);
+        done += run;
+    }
+
+    memory_free_pages(bounce, bounce_pages);
+    // Block mappings changed under any inode copy a reader holds
+    mapping->generation++;
+    mapping->changes++;
+    if (ops->put_inode(inode) != VFS_SUCCESS && result == VFS_SUCCESS) {
+        result = VFS_EIO;
+    }
+
+    if (done == 0) {
+        return result != VFS_SUCCESS ? result : VFS_EIO;
+    }
+    return (ssize_t)((size_t)done * VFS_PAGE_SIZE);
+}
+
+/**
+ * Copy count bytes of src at src_offset to dst at dst_offset from page to
+ * page, with no buffer in between. Source pages come in with as few
+ * requests as a sequential read would use; destination pages are not read
+ * when the copy covers them whole, and dirty ones go back to the device
+ * as the cache fills, so a large copy runs at device speed. The caller
+ * holds src's inode lock shared and dst's exclusive (just the latter when
+ * they are the same file).
+ * Returns the bytes copied, 0 at end of src.
+ */
+ssize_t vfs_page_cache_copy(struct vfs_mapping *src, off_t src_offset,
+                            struct vfs_mapping *dst, off_t dst_offset, size_t count)
+{
+    if (!src || !dst || src_offset < 0 || dst_offset < 0) {
+        return VFS_EINVAL;
+    }
+
+    if (src_offset >= (off_t)src->size) {
+        return 0;  // EOF
+    }
+    if (count > src->size - (size_t)src_offset) {
+        count = src->size - (size_t)src_offset;
+    }
+    if ((uint64_t)dst_offset >= 0xFFFFFFFFULL) {
+        return VFS_ENOSPC;
+    }
+    if (count > 0xFFFFFFFFULL - (uint64_t)dst_offset) {
+        count = (size_t)(0xFFFFFFFFULL - (uint64_t)dst_offset);
+    }
+
+    // Within one file the copy would read back what it has just written
+    if (src == dst && src_offset < dst_offset + (off_t)count &&
+        dst_offset < src_offset + (off_t)count) {
+        return VFS_EINVAL;
+    }
+
+    uint32_t batch_limit = page_batch_limit();
+    uint32_t last = (uint32_t)(((uint64_t)src_offset + count - 1) / VFS_PAGE_SIZE);
+    struct page_reader src_reader = {NULL, 0};
+    struct page_reader dst_reader = {NULL, 0};
+    int error = VFS_EIO;
+    size_t done = 0;
+
+    while (done < count) {
+        uint64_t in = (uint64_t)src_offset + done;
+        uint64_t out = (uint64_t)dst_offset + done;
+        uint32_t index = (uint32_t)(in / VFS_PAGE_SIZE);
+        uint32_t in_offset = (uint32_t)(in % VFS_PAGE_SIZE);
+        uint32_t out_offset = (uint32_t)(out % VFS_PAGE_SIZE);
+
+        size_t chunk = VFS_PAGE_SIZE - (in_offset > out_offset ? in_offset : out_offset);
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+
+        // Pinned, so making room for the destination page cannot evict it
+        uint8_t *from = page_find(src, index);
+        if (!from) {
+            uint32_t want = last - index + 1;
+            if (want > batch_limit) {
+                want = batch_limit;
+            }
+            from = page_read_batch(src, &src_reader, index, want, dst);
+            if (!from) {
+                break;
+            }
+        }
+
+        int fill = (chunk < VFS_PAGE_SIZE);
+        uint8_t *to = page_get(dst, &dst_reader, (uint32_t)(out / VFS_PAGE_SIZE), fill, 1, dst);
+        if (to) {
+            memcpy(to + out_offset, from + in_offset, chunk);
+            page_unpin(to);
+        }
+        page_unpin(from);
+        if (!to) {
+            error = VFS_ENOMEM;
+            break;
+        }
+
+        done += chunk;
+        if (out + chunk > dst->size) {
+            dst->size = (uint32_t)(out + chunk);
+        }
+    }
+
+    page_reader_done(src, &src_reader);
+    page_reader_done(dst, &dst_reader);
+    return done ? (ssize_t)done : error;
+}
+
+/**
+ * Get the frame holding page index of a mapping for mmap(), reading it in
+ * if needed, and take a reference to it. write marks the page dirty.
+ * Faults take no inode lock, since the faulting task may hold it already.
+ */
+void *vfs_page_cache_map(struct vfs_mapping *mapping, uint32_t index, int write)
+{
+    if (!mapping || (uint64_t)index * VFS_PAGE_SIZE >= mapping->size) {
+        return NULL;
+    }
+
+    struct page_reader reader = {NULL, 0};
+    uint8_t *frame = page_get(mapping, &reader, index, 1, write, NULL);
+    page_reader_done(mapping, &reader);
+    return frame;  // The pin is the mapper's reference
+}
+
+/**
+ * Drop a reference from vfs_page_cache_map(). dirty says the mapper may
+ * have written the frame since it was last marked; the page is marked
+ * again if it is still the cached copy of index.
+ */
+void vfs_page_cache_unmap(struct vfs_mapping *mapping, uint32_t index, void *frame, int dirty)
+{
+    if (!mapping || !frame) {
+        return;
+    }
+
+    if (dirty) {
+        unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+        struct vfs_page *page = page_lookup(mapping, index);
+        if (page && page->data == frame) {
+            page_set_dirty(page);
+        }
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+    }
+    page_unpin(frame);
+}
+
+// The caller holds the inode lock exclusive
+int vfs_page_cache_sync(struct vfs_mapping *mapping)
+{
+    if (!mapping) {
+        return VFS_EINVAL;
+    }
+    return mapping_writeback(mapping);
+}
+
+/**
+ * Write back every mapping of a file system, each under its inode lock.
+ * Waits for writers to finish; the caller holds no inode lock.
+ */
+int vfs_page_cache_sync_fs(struct file_system *fs)
+{
+    if (!page_cache_initialized) {
+        return VFS_SUCCESS;
+    }
+
+    int result = VFS_SUCCESS;
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_mapping *mapping = mapping_list;
+    while (mapping) {
+        if (mapping->fs != fs || mapping->dirty == 0) {
+            mapping = mapping->next;
+            continue;
+        }
+
+        mapping->refs++;
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        vfs_inode_write_lock(mapping->ilock);
+        if (mapping_writeback(mapping) != VFS_SUCCESS) {
+            result = VFS_EIO;
+        }
+        vfs_inode_write_unlock(mapping->ilock);
+        flags = spin_lock_irqsave(&page_cache_lock);
+
+        // A mapping deleted meanwhile has left the list; start over
+        struct vfs_mapping *next = mapping->orphan ? mapping_list : mapping->next;
+        mapping_put(mapping);
+        mapping = next;
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    return result;
+}
+
+/**
+ * Drop a reference. Pages stay cached unless the file is gone; the caller
+ * syncs first if needed.
+ */
+void vfs_page_cache_close(struct vfs_mapping *mapping)
+{
+    if (!mapping) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    mapping_put(mapping);
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
+
+/**
+ * Shrink the cached view of a file the file system is truncating: pages
+ * past the new end are dropped and the tail of the last page is zeroed.
+ * The caller holds the inode lock exclusive.
+ */
+void vfs_page_cache_truncate(struct file_system *fs, uint32_t ino, uint32_t size)
+{
+    if (!page_cache_initialized) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_mapping *mapping = mapping_find(fs, ino);
+    if (!mapping) {
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        return;
+    }
+
+    uint32_t first = (uint32_t)(((uint64_t)size + VFS_PAGE_SIZE - 1) / VFS_PAGE_SIZE);
+    mapping_drop_pages(mapping, first);
+
+    if (size % VFS_PAGE_SIZE) {
+        struct vfs_page *page = page_lookup(mapping, size / VFS_PAGE_SIZE);
+        if (page) {
+            memset(page->data + size % VFS_PAGE_SIZE, 0, VFS_PAGE_SIZE - size % VFS_PAGE_SIZE);
+        }
+    }
+
+    if (size < mapping->size) {
+        mapping->size = size;
+    }
+    mapping->changes++;
+    mapping_release_if_unused(mapping);
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
+
+/**
+ * Zero the cached bytes of a range the file system has just zeroed on
+ * disk. The pages stay clean since they match the device again. The
+ * caller holds the inode lock exclusive.
+ */
+void vfs_page_cache_zero_range(struct vfs_mapping *mapping, uint64_t offset, uint64_t len)
+{
+    if (!mapping || len == 0) {
+        return;
+    }
+
+    uint64_t end = offset + len;
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    mapping->changes++;
+    for (struct vfs_page *page = page_lru_head; page; page = page->lru_next) {
+        if (page->mapping != mapping) {
+            continue;
+        }
+        uint64_t page_start = (uint64_t)page->index * VFS_PAGE_SIZE;
+        uint64_t from = (offset > page_start) ? offset : page_start;
+        uint64_t to = (end < page_start + VFS_PAGE_SIZE) ? end : page_start + VFS_PAGE_SIZE;
+        if (from < to) {
+            memset(page->data + (from - page_start), 0, (size_t)(to - from));
+        }
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
+
+/**
+ * The inode was deleted: discard its data. Files still open on it keep an
+ * orphaned mapping that never reaches the disk, and a new file reusing
+ * the inode number starts with a fresh one. The caller holds the inode
+ * lock exclusive.
+ */
+void vfs_page_cache_forget(struct file_system *fs, uint32_t ino)
+{
+    if (!page_cache_initialized) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_mapping *mapping = mapping_find(fs, ino);
+    if (mapping) {
+        mapping_drop_pages(mapping, 0);
+        mapping_unlink(mapping);
+        mapping->orphan = 1;
+        mapping_release_if_unused(mapping);
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
+
+/**
+ * Drop every page of a file system being unmounted (sync it first)
+ */
+void vfs_page_cache_invalidate_fs(struct file_system *fs)
+{
+    if (!page_cache_initialized) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_mapping *mapping = mapping_list;
+    while (mapping) {
+        struct vfs_mapping *next = mapping->next;
+        if (mapping->fs == fs) {
+            mapping_drop_pages(mapping, 0);
+            mapping_unlink(mapping);
+            mapping->orphan = 1;
+            mapping_release_if_unused(mapping);
+        }
+        mapping = next;
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
+
+/**
+ * Size of a cached file including writes not yet on disk. Returns
+ * VFS_ENOENT when the inode has no mapping.
+ */
+int vfs_page_cache_get_size(struct file_system *fs, uint32_t ino, uint32_t *size_out)
+{
+    if (!page_cache_initialized || !size_out) {
+        return VFS_ENOENT;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    struct vfs_mapping *mapping = mapping_find(fs, ino);
+    if (mapping) {
+        *size_out = mapping->size;
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    return mapping ? VFS_SUCCESS : VFS_ENOENT;
+}
+
+int vfs_page_cache_set_capacity(uint32_t pages)
+{
+    if (pages == 0) {
+        return VFS_EINVAL;
+    }
+
+    page_cache_init();
+
+    page_capacity = pages;
+    while (page_count > page_capacity && page_evict_one(NULL)) {
+        // Shrink down to the new capacity
+    }
+
+    return VFS_SUCCESS;
+}
+
+void vfs_page_cache_get_stats(struct vfs_page_cache_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&page_cache_lock);
+    stats->capacity = page_capacity;
+    stats->pages = page_count;
+    stats->dirty = page_dirty_count;
+    stats->mappings = mapping_count;
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    stats->hits = per_cpu_sum(page_counts, hits);
+    stats->misses = per_cpu_sum(page_counts, misses);
+    stats->evictions = per_cpu_sum(page_counts, evictions);
+    stats->writebacks = per_cpu_sum(page_counts, writebacks);
+    stats->readahead = per_cpu_sum(page_counts, readahead);
+    stats->direct_reads = per_cpu_sum(page_counts, direct_reads);
+    stats->direct_writes = per_cpu_sum(page_counts, direct_writes);
+}
@@ -0,0 +1,275 @@
+/*
+ * MiniOS Pipes
+ *
+ * A pipe is a VFS_PIPE_SIZE ring buffer with a read end and a write end,
+ * each an ordinary open file, so descriptors, vfs_read()/vfs_write() and
+ * the last-reference close work on them as on any other file. head and
+ * tail count every byte written and read; their difference is what is
+ * buffered. A reader sleeps on the pipe's readable queue until there is
+ * data or no writer is left (end of file); a writer sleeps on the
+ * writable queue until there is room, and fails with VFS_EPIPE once no
+ * reader is left, so a pipeline stops as soon as its consumer does.
+ * Each end polls on the queue its own side sleeps on.
+ */
+
+#include "vfs.h"
+#include "fd.h"
+#include "kernel.h"
+#include "process.h"
+#include "spinlock.h"
+
+struct pipe {
+    spinlock_t lock;                        // Protects everything below
+    uint8_t *buffer;                        // VFS_PIPE_SIZE bytes
+    uint32_t head;                          // Bytes written, ever
+    uint32_t tail;                          // Bytes read, ever
+    int readers;                            // Open read ends
+    int writers;                            // Open write ends
+    struct wait_queue readable;
+    struct wait_queue writable;
+};
+
+static ssize_t pipe_read(struct file *file, void *buf, size_t count, off_t offset);
+static ssize_t pipe_write(struct file *file, const void *buf, size_t count, off_t offset);
+static int pipe_close(struct file *file);
+static uint32_t pipe_poll(struct file *file, struct poll_table *pt);
+
+static struct file_operations pipe_file_ops = {
+    .read = pipe_read,
+    .write = pipe_write,
+    .close = pipe_close,
+    .poll = pipe_poll,
+};
+
+static inline struct pipe *pipe_of(struct file *file)
+{
+    return (struct pipe *)file->inode->private_data;
+}
+
+static inline int pipe_is_writer(const struct file *file)
+{
+    return (file->flags & VFS_O_WRONLY) != 0;
+}
+
+// Wait conditions, checked without the lock and again under it
+static inline int pipe_can_read(struct pipe *pipe)
+{
+    return __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) !=
+               __atomic_load_n(&pipe->tail, __ATOMIC_RELAXED) ||
+           __atomic_load_n(&pipe->writers, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline int pipe_can_write(struct pipe *pipe)
+{
+    return __atomic_load_n(&pipe->head, __ATOMIC_RELAXED) -
+               __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) < VFS_PIPE_SIZE ||
+           __atomic_load_n(&pipe->readers, __ATOMIC_ACQUIRE) == 0;
+}
+
+static ssize_t pipe_read(struct file *file, void *buf, size_t count, off_t offset)
+{
+    (void)offset;
+
+    if (pipe_is_writer(file)) {
+        return VFS_EPERM;
+    }
+
+    struct pipe *pipe = pipe_of(file);
+    wait_event(&pipe->readable, pipe_can_read(pipe));
+
+    unsigned long flags = spin_lock_irqsave(&pipe->lock);
+    uint32_t avail = pipe->head - pipe->tail;
+    if (count > avail) {
+        count = avail;
+    }
+
+    // At most two pieces: up to the end of the buffer, then from its start
+    uint32_t start = pipe->tail % VFS_PIPE_SIZE;
+    size_t first = VFS_PIPE_SIZE - start;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(buf, pipe->buffer + start, first);
+    memcpy((uint8_t *)buf + first, pipe->buffer, count - first);
+    __atomic_store_n(&pipe->tail, pipe->tail + (uint32_t)count, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    if (count > 0) {
+        wake_up(&pipe->writable);
+    }
+    return (ssize_t)count;  // 0: every writer has gone
+}
+
+static ssize_t pipe_write(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    (void)offset;
+
+    if (!pipe_is_writer(file)) {
+        return VFS_EPERM;
+    }
+
+    struct pipe *pipe = pipe_of(file);
+    const uint8_t *src = (const uint8_t *)buf;
+    size_t done = 0;
+
+    while (done < count) {
+        wait_event(&pipe->writable, pipe_can_write(pipe));
+
+        unsigned long flags = spin_lock_irqsave(&pipe->lock);
+        if (pipe->readers == 0) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return done ? (ssize_t)done : VFS_EPIPE;
+        }
+
+        size_t chunk = VFS_PIPE_SIZE - (pipe->head - pipe->tail);
+        if (chunk > count - done) {
+            chunk = count - done;
+        }
+        uint32_t start = pipe->head % VFS_PIPE_SIZE;
+        size_t first = VFS_PIPE_SIZE - start;
+        if (first > chunk) {
+            first = chunk;
+        }
+        memcpy(pipe->buffer + start, src + done, first);
+        memcpy(pipe->buffer, src + done + first, chunk - first);
+        __atomic_store_n(&pipe->head, pipe->head + (uint32_t)chunk, __ATOMIC_RELEASE);
+        spin_unlock_irqrestore(&pipe->lock, flags);
+
+        // Readers can start on this while the rest waits for room
+        wake_up(&pipe->readable);
+        done += chunk;
+    }
+
+    return (ssize_t)done;
+}
+
+// Last reference to one end: the other side sees end of file or VFS_EPIPE
+static int pipe_close(struct file *file)
+{
+    struct pipe *pipe = pipe_of(file);
+
+    unsigned long flags = spin_lock_irqsave(&pipe->lock);
+    if (pipe_is_writer(file)) {
+        __atomic_store_n(&pipe->writers, pipe->writers - 1, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&pipe->readers, pipe->readers - 1, __ATOMIC_RELEASE);
+    }
+    int last = pipe->readers == 0 && pipe->writers == 0;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    if (last) {
+        kfree(pipe->buffer);
+        kfree(pipe);
+    } else {
+        wake_up(&pipe->readable);
+        wake_up(&pipe->writable);
+    }
+    file->inode->private_data = NULL;
+    return VFS_SUCCESS;
+}
+
+// The read end hangs up when the last writer goes, the write end reports
+// an error when the last reader does
+static uint32_t pipe_poll(struct file *file, struct poll_table *pt)
+{
+    struct pipe *pipe = pipe_of(file);
+
+    if (pipe_is_writer(file)) {
+        poll_wait(pt, &pipe->writable);
+        if (__atomic_load_n(&pipe->readers, __ATOMIC_ACQUIRE) == 0) {
+            return EPOLLERR;
+        }
+        return pipe_can_write(pipe) ? EPOLLOUT : 0;
+    }
+
+    poll_wait(pt, &pipe->readable);
+    uint32_t events = 0;
+    if (__atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) !=
+        __atomic_load_n(&pipe->tail, __ATOMIC_RELAXED)) {
+        events |= EPOLLIN;
+    }
+    if (__atomic_load_n(&pipe->writers, __ATOMIC_ACQUIRE) == 0) {
+        events |= EPOLLIN | EPOLLHUP;   // A read returns end of file
+    }
+    return events;
+}
+
+// One end: an open file whose inode only carries the pipe
+static struct file *pipe_open_end(struct pipe *pipe, int flags)
+{
+    struct file *file = kmalloc(sizeof(struct file));
+    struct inode *inode = kmalloc(sizeof(struct inode));
+    if (!file || !inode) {
+        kfree(file);
+        kfree(inode);
+        return NULL;
+    }
+
+    memset(inode, 0, sizeof(struct inode));
+    inode->private_data = pipe;
+    inode->ref_count = 1;
+
+    memset(file, 0, sizeof(struct file));
+    file->inode = inode;
+    file->flags = flags;
+    file->ref_count = 1;
+    file->ops = &pipe_file_ops;
+    return file;
+}
+
+/**
+ * Create a pipe in the current descriptor table: fds[0] is the read end,
+ * fds[1] the write end
+ * @return VFS_SUCCESS, or a negative VFS error
+ */
+int vfs_pipe(int fds[2])
+{
+    if (!fds) {
+        return VFS_EINVAL;
+    }
+
+    struct pipe *pipe = kmalloc(sizeof(struct pipe));
+    if (!pipe) {
+        return VFS_ENOMEM;
+    }
+    memset(pipe, 0, sizeof(struct pipe));
+    pipe->buffer = kmalloc(VFS_PIPE_SIZE);
+    if (!pipe->buffer) {
+        kfree(pipe);
+        return VFS_ENOMEM;
+    }
+    spin_lock_init(&pipe->lock);
+    wait_queue_init(&pipe->readable);
+    wait_queue_init(&pipe->writable);
+    pipe->readers = 1;
+    pipe->writers = 1;
+
+    struct file *reader = pipe_open_end(pipe, VFS_O_RDONLY);
+    struct file *writer = reader ? pipe_open_end(pipe, VFS_O_WRONLY) : NULL;
+    if (!writer) {
+        if (reader) {
+            kfree(reader->inode);
+            kfree(reader);
+        }
+        kfree(pipe->buffer);
+        kfree(pipe);
+        return VFS_ENOMEM;
+    }
+
+    // From here closing the files tears the pipe down
+    struct fd_table *table = fd_get_current_table();
+    fds[0] = fd_install(table, reader, VFS_O_RDONLY);
+    if (fds[0] < 0) {
+        vfs_file_put(reader);
+        vfs_file_put(writer);
+        return VFS_ENOSPC;
+    }
+    fds[1] = fd_install(table, writer, VFS_O_WRONLY);
+    if (fds[1] < 0) {
+        fd_free(table, fds[0]);
+        vfs_file_put(writer);
+        return VFS_ENOSPC;
+    }
+
+    return VFS_SUCCESS;
+}
@@ -9,6 +9,11 @@
 #include "kernel.h"
 #include "ramfs.h"
 #include "sfs.h"
+#include "fd.h"
+#include "trace.h"
+#include "elf_loader.h"
+#include "percpu.h"
+#include "format.h"
 #include <string.h>
 
 // Helper functions to prevent GCC vectorization bugs
@@ -73,134 +78,105 @@ static inline void vfs_populate_stat_from_sfs(struct inode *stat_buf,
 static int vfs_initialized = 0;
 static struct file_system_type *fs_types[MAX_FS_TYPES];
 static struct vfs_mount *mounts[MAX_MOUNTS];
+static struct vfs_mount *mount_list = NULL;     // Longest mountpoint first
 static struct vfs_mount *root_mount = NULL;
 
 // VFS statistics
 static struct {
     uint32_t fs_types_registered;
     uint32_t mounts_active;
-    uint64_t files_opened;
-    uint64_t files_closed;
 } vfs_stats = {0};
 
-#define VFS_FD_BASE          3
-#define VFS_MAX_OPEN_FILES   32
-
-static struct file *vfs_open_files[VFS_MAX_OPEN_FILES];
+// Opens and closes, per CPU as they are on every file's path
+struct vfs_file_counts {
+    uint64_t opened;
+    uint64_t closed;
+};
+static DEFINE_PER_CPU(struct vfs_file_counts, vfs_file_counts);
 
+// Descriptors live in the current task's fd table (fd_table.c)
 static struct file *vfs_get_open_file(int fd)
 {
-    if (fd < VFS_FD_BASE || fd >= VFS_MAX_OPEN_FILES) {
-        return NULL;
-    }
-    return vfs_open_files[fd];
+    struct file_descriptor *desc = fd_get(fd_get_current_table(), fd);
+    return desc ? desc->file : NULL;
 }
 
-static int vfs_allocate_fd(void)
-{
-    for (int fd = VFS_FD_BASE; fd < VFS_MAX_OPEN_FILES; fd++) {
-        if (!vfs_open_files[fd]) {
-            return fd;
-        }
-    }
-    return -1;
-}
-
-static void vfs_release_fd(int fd)
-{
-    if (fd >= VFS_FD_BASE && fd < VFS_MAX_OPEN_FILES) {
-        vfs_open_files[fd] = NULL;
-    }
-}
-
-static int vfs_path_is_prefix(const char *path, const char *prefix)
+/**
+ * Does path lie under this mount? The root mount covers every absolute
+ * path; others must match a whole leading component sequence.
+ */
+static inline int vfs_mount_covers(const struct vfs_mount *mount, const char *path)
 {
-    if (!path || !prefix) {
-        return 0;
-    }
-
-    size_t prefix_len = strlen(prefix);
-
-    if (prefix_len == 0) {
-        return 0;
-    }
-
-    if (strcmp(prefix, "/") == 0) {
+    size_t len = mount->mountpoint_len;
+    if (len == 0) {
         return path[0] == '/';
     }
-
-    if (strncmp(path, prefix, prefix_len) != 0) {
-        return 0;
-    }
-
-    if (path[prefix_len] == '\0' || path[prefix_len] == '/') {
-        return 1;
-    }
-
-    return 0;
+    return strncmp(path, mount->mountpoint, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/');
 }
 
+/**
+ * Mounts are kept on one list ordered by decreasing mountpoint length, so
+ * the first mount that covers the path is the longest match
+ */
 static struct vfs_mount *vfs_find_mount_for_path(const char *path)
 {
     if (!vfs_initialized || !path) {
         return NULL;
     }
 
-    struct vfs_mount *best_mount = NULL;
-    size_t best_len = 0;
-
-    for (int i = 0; i < MAX_MOUNTS; i++) {
-        struct vfs_mount *mount = mounts[i];
-        if (!mount) {
-            continue;
-        }
-
-        if (!vfs_path_is_prefix(path, mount->mountpoint)) {
-            continue;
-        }
-
-        size_t mount_len = strlen(mount->mountpoint);
-        if (!best_mount || mount_len > best_len) {
-            best_mount = mount;
-            best_len = mount_len;
+    for (struct vfs_mount *mount = mount_list; mount; mount = mount->next) {
+        if (vfs_mount_covers(mount, path)) {
+            return mount;
         }
     }
 
-    if (!best_mount && root_mount && path && path[0] == '/') {
-        best_mount = root_mount;
+    if (root_mount && path[0] == '/') {
+        return root_mount;
     }
 
-    return best_mount;
+    return NULL;
 }
 
+/**
+ * Path relative to the mount returned by vfs_find_mount_for_path
+ */
 static const char *vfs_path_within_mount(const struct vfs_mount *mount, const char *path)
 {
-    if (!mount || !path) {
+    if (!mount || !path || mount->mountpoint_len == 0) {
         return path;
     }
 
-    if (strcmp(mount->mountpoint, "/") == 0) {
-        return path;
+    size_t len = mount->mountpoint_len;
+    if (path[len] == '\0') {
+        return "/";
     }
-
-    size_t mount_len = strlen(mount->mountpoint);
-    if (mount_len == 0) {
-        return path;
+    if (path[len] == '/') {
+        return path + len;
     }
 
-    if (!vfs_path_is_prefix(path, mount->mountpoint)) {
-        return path;
-    }
+    return path;
+}
 
-    if (path[mount_len] == '\0') {
-        return "/";
+static void vfs_mount_list_insert(struct vfs_mount *mount)
+{
+    struct vfs_mount **link = &mount_list;
+    while (*link && (*link)->mountpoint_len >= mount->mountpoint_len) {
+        link = &(*link)->next;
     }
+    mount->next = *link;
+    *link = mount;
+}
 
-    if (path[mount_len] == '/') {
-        return path + mount_len;
+static void vfs_mount_list_remove(struct vfs_mount *mount)
+{
+    for (struct vfs_mount **link = &mount_list; *link; link = &(*link)->next) {
+        if (*link == mount) {
+            *link = mount->next;
+            mount->next = NULL;
+            return;
+        }
     }
-
-    return path;
 }
 
 static struct ramfs_node *vfs_ramfs_resolve(struct file_system *fs, const char *path)
@@ -251,12 +227,7 @@ static void vfs_ramfs_truncate_node(struct ramfs_node *node)
         return;
     }
 
-    if (node->data) {
-        kfree(node->data);
-        node->data = NULL;
-    }
-    node->size = 0;
-    node->modified_time++;
+    ramfs_node_truncate(node, 0);
 }
 
 int vfs_init(void)
@@ -277,18 +248,15 @@ int vfs_init(void)
         mounts[i] = NULL;
     }
     
+    mount_list = NULL;
     root_mount = NULL;
     vfs_initialized = 1;
     
     // Reset statistics
     vfs_stats.fs_types_registered = 0;
     vfs_stats.mounts_active = 0;
-    vfs_stats.files_opened = 0;
-    vfs_stats.files_closed = 0;
-
-    for (int i = 0; i < VFS_MAX_OPEN_FILES; i++) {
-        vfs_open_files[i] = NULL;
-    }
+    per_cpu_clear(vfs_file_counts, opened);
+    per_cpu_clear(vfs_file_counts, closed);
 
     early_print("VFS initialized\n");
     return VFS_SUCCESS;
@@ -315,6 +283,7 @@ int vfs_shutdown(void)
     }
     
     vfs_initialized = 0;
+    mount_list = NULL;
     root_mount = NULL;
     
     early_print("VFS shutdown complete\n");
@@ -407,6 +376,11 @@ int vfs_mount(const char *device, const char *mountpoint, const char *fstype, un
     struct block_device *block_dev = NULL;
     if (device && strcmp(device, "none") != 0) {
         block_dev = block_device_find(device);
+        if (!block_dev) {
+            // It may still be being probed in the background
+            device_async_wait();
+            block_dev = block_device_find(device);
+        }
         if (!block_dev) {
             early_print("Block device not found: ");
             early_print(device);
@@ -455,6 +429,7 @@ int vfs_mount(const char *device, const char *mountpoint, const char *fstype, un
     // Initialize mount point
     strncpy(mount->mountpoint, mountpoint, sizeof(mount->mountpoint) - 1);
     mount->mountpoint[sizeof(mount->mountpoint) - 1] = '\0';
+    mount->mountpoint_len = strcmp(mount->mountpoint, "/") == 0 ? 0 : strlen(mount->mountpoint);
     mount->fs = fs;
     mount->flags = flags;
     mount->next = NULL;
@@ -462,8 +437,9 @@ int vfs_mount(const char *device, const char *mountpoint, const char *fstype, un
     // Link filesystem to mount point
     fs->mount_point = mount;
     
-    // Add to mounts array
+    // Add to mounts array and the lookup list
     mounts[mount_slot] = mount;
+    vfs_mount_list_insert(mount);
     vfs_stats.mounts_active++;
     
     // Set as root mount if mounting at "/"
@@ -492,6 +468,13 @@ int vfs_unmount(const char *mountpoint)
             struct vfs_mount *mount = mounts[i];
             struct file_system *fs = mount->fs;
             
+            // Cached names, data and program images refer to this
+            // instance only; the images hold files open
+            exec_cache_invalidate_fs(fs);
+            vfs_page_cache_sync_fs(fs);
+            vfs_page_cache_invalidate_fs(fs);
+            vfs_dcache_invalidate_fs(fs);
+
             // Unmount filesystem
             if (fs->type->unmount) {
                 fs->type->unmount(fs);
@@ -503,8 +486,9 @@ int vfs_unmount(const char *mountpoint)
                 early_print("Root filesystem unmounted\n");
             }
             
-            // Remove from mounts array
+            // Remove from mounts array and the lookup list
             mounts[i] = NULL;
+            vfs_mount_list_remove(mount);
             if (vfs_stats.mounts_active > 0) {
                 vfs_stats.mounts_active--;
             }
@@ -533,6 +517,18 @@ struct file_system *vfs_find_mount(const char *path)
     return mount ? mount->fs : NULL;
 }
 
+// Whether some mount has dev underneath it, directly or through a view
+int vfs_device_mounted(const struct block_device *dev)
+{
+    for (struct vfs_mount *mount = mount_list; dev && mount; mount = mount->next) {
+        if (mount->fs && (mount->fs->device == dev ||
+                          block_view_lower(mount->fs->device) == dev)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 char *vfs_resolve_path(const char *path)
 {
     if (!path) {
@@ -615,6 +611,13 @@ char *vfs_get_dirname(const char *path)
     return dirname;
 }
 
+static void vfs_print_count(const char *label, uint64_t value)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "%s%llu\n", label, (unsigned long long)value);
+    early_print(line);
+}
+
 // VFS debugging and statistics
 void vfs_dump_info(void)
 {
@@ -624,47 +627,10 @@ void vfs_dump_info(void)
     }
     
     early_print("VFS Information:\n");
-    early_print("  Filesystem types: ");
-    // Simple number to string conversion
-    char num_str[16];
-    int val = vfs_stats.fs_types_registered;
-    int pos = 0;
-    if (val == 0) {
-        num_str[pos++] = '0';
-    } else {
-        char temp[16];
-        int temp_pos = 0;
-        while (val > 0) {
-            temp[temp_pos++] = '0' + (val % 10);
-            val /= 10;
-        }
-        for (int i = temp_pos - 1; i >= 0; i--) {
-            num_str[pos++] = temp[i];
-        }
-    }
-    num_str[pos] = '\0';
-    early_print(num_str);
-    early_print("\n");
-    
-    early_print("  Active mounts: ");
-    val = vfs_stats.mounts_active;
-    pos = 0;
-    if (val == 0) {
-        num_str[pos++] = '0';
-    } else {
-        char temp[16];
-        int temp_pos = 0;
-        while (val > 0) {
-            temp[temp_pos++] = '0' + (val % 10);
-            val /= 10;
-        }
-        for (int i = temp_pos - 1; i >= 0; i--) {
-            num_str[pos++] = temp[i];
-        }
-    }
-    num_str[pos] = '\0';
-    early_print(num_str);
-    early_print("\n");
+    vfs_print_count("  Filesystem types: ", vfs_stats.fs_types_registered);
+    vfs_print_count("  Active mounts: ", vfs_stats.mounts_active);
+    vfs_print_count("  Files opened: ", per_cpu_sum(vfs_file_counts, opened));
+    vfs_print_count("  Files closed: ", per_cpu_sum(vfs_file_counts, closed));
     
     // List registered filesystem types
     early_print("  Registered filesystems:\n");
@@ -690,7 +656,7 @@ void vfs_dump_info(void)
 }
 
 // File operations implementations
-int vfs_open(const char *path, int flags, int mode)
+static int vfs_open_path(const char *path, int flags, int mode)
 {
     if (!vfs_initialized || !path) {
         return VFS_EINVAL;
@@ -765,7 +731,13 @@ int vfs_open(const char *path, int flags, int mode)
         }
 
         if ((flags & VFS_O_TRUNC) && !(existing->mode & VFS_FILE_DIRECTORY)) {
+            // Excludes readers and writers of files already open on it
+            struct vfs_inode_lock *ilock = vfs_inode_lock_get(fs, existing->ino);
+            vfs_inode_write_lock(ilock);
+            vfs_page_cache_truncate(fs, existing->ino, 0);
             int trunc_result = sfs_truncate_file(fs, existing, 0);
+            vfs_inode_write_unlock(ilock);
+            vfs_inode_lock_put(ilock);
             if (trunc_result != VFS_SUCCESS) {
                 sfs_put_inode(existing);
                 return trunc_result;
@@ -788,9 +760,31 @@ int vfs_open(const char *path, int flags, int mode)
     }
 
     memset(file, 0, sizeof(struct file));
+
+    // Regular file data goes through the page cache when the fs supports
+    // it, under the inode's lock; directories are locked by their fs
+    if (!(inode->mode & VFS_FILE_DIRECTORY)) {
+        file->ilock = vfs_inode_lock_get(fs, inode->ino);
+        if (file->ilock && fs->type->page_ops) {
+            file->mapping = vfs_page_cache_open(fs, inode->ino, (uint32_t)inode->size);
+        }
+        if (!file->ilock || (fs->type->page_ops && !file->mapping)) {
+            vfs_inode_lock_put(file->ilock);
+            if (fs->type == &sfs_fs_type) {
+                sfs_put_inode(inode);
+            } else {
+                kfree(inode);
+            }
+            kfree(file);
+            return VFS_ENOMEM;
+        }
+    }
+
     file->inode = inode;
     file->fs = fs;
-    file->position = (flags & VFS_O_APPEND) ? inode->size : 0;
+    if (flags & VFS_O_APPEND) {
+        file->position = file->mapping ? (off_t)file->mapping->size : (off_t)inode->size;
+    }
     file->flags = flags;
     file->mode = mode;
     file->ref_count = 1;
@@ -799,6 +793,8 @@ int vfs_open(const char *path, int flags, int mode)
     if (file->ops && file->ops->open) {
         int open_result = file->ops->open(file, flags, mode);
         if (open_result != VFS_SUCCESS) {
+            vfs_page_cache_close(file->mapping);
+            vfs_inode_lock_put(file->ilock);
             if (fs->type == &sfs_fs_type) {
                 sfs_put_inode(inode);
             } else if (fs->type == &ramfs_fs_type) {
@@ -809,11 +805,13 @@ int vfs_open(const char *path, int flags, int mode)
         }
     }
 
-    int fd = vfs_allocate_fd();
+    int fd = fd_install(fd_get_current_table(), file, flags);
     if (fd < 0) {
         if (file->ops && file->ops->close) {
             file->ops->close(file);
         }
+        vfs_page_cache_close(file->mapping);
+        vfs_inode_lock_put(file->ilock);
         if (fs->type == &sfs_fs_type) {
             sfs_put_inode(inode);
         } else if (fs->type == &ramfs_fs_type) {
@@ -823,8 +821,51 @@ int vfs_open(const char *path, int flags, int mode)
         return VFS_ENOSPC;
     }
 
-    vfs_open_files[fd] = file;
-    vfs_stats.files_opened++;
+    this_cpu_inc(vfs_file_counts, opened);
+    return fd;
+}
+
+// VFS_O_DIRECT transfer that can bypass the cache: whole pages only
+static inline int vfs_file_direct(const struct file *file, size_t count)
+{
+    return (file->flags & VFS_O_DIRECT) && file->mapping &&
+           file->position % VFS_PAGE_SIZE == 0 && count % VFS_PAGE_SIZE == 0;
+}
+
+// Read at the file's position through the cache or the file system
+static ssize_t vfs_file_read(struct file *file, void *buf, size_t count)
+{
+    if (vfs_file_direct(file, count)) {
+        return vfs_page_cache_read_direct(file->mapping, buf, count, file->position);
+    }
+    if (file->mapping) {
+        return vfs_page_cache_read(file->mapping, &file->ra, buf, count, file->position);
+    }
+    if (file->ops && file->ops->read) {
+        return file->ops->read(file, buf, count, file->position);
+    }
+    return VFS_EINVAL;
+}
+
+static ssize_t vfs_file_write(struct file *file, const void *buf, size_t count)
+{
+    if (vfs_file_direct(file, count)) {
+        return vfs_page_cache_write_direct(file->mapping, buf, count, file->position);
+    }
+    if (file->mapping) {
+        return vfs_page_cache_write(file->mapping, buf, count, file->position);
+    }
+    if (file->ops && file->ops->write) {
+        return file->ops->write(file, buf, count, file->position);
+    }
+    return VFS_EINVAL;
+}
+
+int vfs_open(const char *path, int flags, int mode)
+{
+    trace_event(TRACE_VFS_ENTER, TRACE_VFS_OPEN, -1, 0);
+    int fd = vfs_open_path(path, flags, mode);
+    trace_event(TRACE_VFS_EXIT, TRACE_VFS_OPEN, (int64_t)fd, 0);
     return fd;
 }
 
@@ -835,14 +876,14 @@ ssize_t vfs_read(int fd, void *buf, size_t count)
         return VFS_EINVAL;
     }
 
-    if (!file->ops || !file->ops->read) {
-        return VFS_EINVAL;
-    }
-
-    ssize_t result = file->ops->read(file, buf, count, file->position);
+    trace_event(TRACE_VFS_ENTER, TRACE_VFS_READ, fd, count);
+    vfs_inode_read_lock(file->ilock);
+    ssize_t result = vfs_file_read(file, buf, count);
+    vfs_inode_read_unlock(file->ilock);
     if (result > 0) {
         file->position += result;
     }
+    trace_event(TRACE_VFS_EXIT, TRACE_VFS_READ, result, 0);
     return result;
 }
 
@@ -853,28 +894,150 @@ ssize_t vfs_write(int fd, const void *buf, size_t count)
         return VFS_EINVAL;
     }
 
-    if (!file->ops || !file->ops->write) {
+    trace_event(TRACE_VFS_ENTER, TRACE_VFS_WRITE, fd, count);
+    vfs_inode_write_lock(file->ilock);
+    ssize_t result = vfs_file_write(file, buf, count);
+    vfs_inode_write_unlock(file->ilock);
+    if (result > 0) {
+        file->position += result;
+    }
+    trace_event(TRACE_VFS_EXIT, TRACE_VFS_WRITE, result, 0);
+    return result;
+}
+
+// Copy through a kernel buffer, for files the page cache does not hold
+static ssize_t vfs_copy_buffered(struct file *in, struct file *out, size_t len)
+{
+    uint8_t *buffer = kmalloc(VFS_COPY_BUFFER);
+    if (!buffer) {
+        return VFS_ENOMEM;
+    }
+
+    ssize_t result = 0;
+    size_t done = 0;
+    while (done < len) {
+        size_t chunk = len - done < VFS_COPY_BUFFER ? len - done : VFS_COPY_BUFFER;
+        ssize_t got = vfs_file_read(in, buffer, chunk);
+        if (got <= 0) {
+            result = got;
+            break;
+        }
+
+        ssize_t put = vfs_file_write(out, buffer, (size_t)got);
+        if (put > 0) {
+            in->position += put;
+            out->position += put;
+            done += (size_t)put;
+        }
+        if (put != got) {
+            result = put < 0 ? put : VFS_EIO;
+            break;
+        }
+    }
+
+    kfree(buffer);
+    return done ? (ssize_t)done : result;
+}
+
+/**
+ * Lock both ends of a copy: the source shared and the destination
+ * exclusive, or one exclusive lock when both are the same inode. Two
+ * locks are taken in address order so opposite copies can't deadlock.
+ */
+static void vfs_copy_lock(struct file *in, struct file *out)
+{
+    if (in->ilock == out->ilock) {
+        vfs_inode_write_lock(out->ilock);
+    } else if ((uintptr_t)in->ilock < (uintptr_t)out->ilock) {
+        vfs_inode_read_lock(in->ilock);
+        vfs_inode_write_lock(out->ilock);
+    } else {
+        vfs_inode_write_lock(out->ilock);
+        vfs_inode_read_lock(in->ilock);
+    }
+}
+
+static void vfs_copy_unlock(struct file *in, struct file *out)
+{
+    vfs_inode_write_unlock(out->ilock);
+    if (in->ilock != out->ilock) {
+        vfs_inode_read_unlock(in->ilock);
+    }
+}
+
+/**
+ * Copy up to len bytes from fd_in's position to fd_out's position without
+ * the data leaving the kernel, and advance both. Cached files are copied
+ * page to page in the page cache; others through one kernel buffer.
+ * @return Bytes copied, 0 at end of fd_in, negative on error
+ */
+ssize_t vfs_copy_file_range(int fd_in, int fd_out, size_t len)
+{
+    struct file *in = vfs_get_open_file(fd_in);
+    struct file *out = vfs_get_open_file(fd_out);
+    if (!in || !out || len == 0) {
         return VFS_EINVAL;
     }
+    if ((in->flags & VFS_O_WRONLY) || !(out->flags & (VFS_O_WRONLY | VFS_O_RDWR))) {
+        return VFS_EPERM;
+    }
+    if (len > VFS_COPY_MAX) {
+        len = VFS_COPY_MAX;
+    }
 
-    ssize_t result = file->ops->write(file, buf, count, file->position);
+    vfs_copy_lock(in, out);
+    if (!in->mapping || !out->mapping) {
+        ssize_t result = vfs_copy_buffered(in, out, len);
+        vfs_copy_unlock(in, out);
+        return result;
+    }
+
+    ssize_t result = vfs_page_cache_copy(in->mapping, in->position,
+                                         out->mapping, out->position, len);
+    vfs_copy_unlock(in, out);
     if (result > 0) {
-        file->position += result;
+        in->position += result;
+        out->position += result;
+        in->ra.next = (uint32_t)(in->position / VFS_PAGE_SIZE);
     }
     return result;
 }
 
-int vfs_close(int fd)
+/**
+ * Take a reference to the open file behind fd, for holders that outlive
+ * the descriptor (such as file mappings). Release it with vfs_file_put().
+ */
+struct file *vfs_file_get(int fd)
 {
     struct file *file = vfs_get_open_file(fd);
-    if (!file) {
-        return VFS_EINVAL;
+    if (file) {
+        file->ref_count++;
+    }
+    return file;
+}
+
+/**
+ * Drop a reference to an open file. The last one releases the file
+ * system's state; cached data stays dirty for the flusher.
+ */
+void vfs_file_put(struct file *file)
+{
+    if (!file || --file->ref_count > 0) {
+        return;
+    }
+
+    // Off every interest list before any of the file's state goes
+    if (file->epoll_items) {
+        vfs_epoll_release(file);
     }
 
     if (file->ops && file->ops->close) {
         file->ops->close(file);
     }
 
+    vfs_page_cache_close(file->mapping);
+    vfs_inode_lock_put(file->ilock);
+
     if (file->inode) {
         if (file->fs && file->fs->type == &sfs_fs_type) {
             sfs_put_inode(file->inode);
@@ -884,8 +1047,19 @@ int vfs_close(int fd)
     }
 
     kfree(file);
-    vfs_release_fd(fd);
-    vfs_stats.files_closed++;
+    this_cpu_inc(vfs_file_counts, closed);
+}
+
+int vfs_close(int fd)
+{
+    struct fd_table *table = fd_get_current_table();
+    if (!vfs_get_open_file(fd)) {
+        return VFS_EINVAL;
+    }
+
+    trace_event(TRACE_VFS_ENTER, TRACE_VFS_CLOSE, fd, 0);
+    fd_free(table, fd);
+    trace_event(TRACE_VFS_EXIT, TRACE_VFS_CLOSE, VFS_SUCCESS, 0);
     return VFS_SUCCESS;
 }
 
@@ -896,6 +1070,26 @@ off_t vfs_seek(int fd, off_t offset, int whence)
         return VFS_EINVAL;
     }
 
+    // The file system's inode copy does not see cached writes
+    if (file->mapping && whence == VFS_SEEK_END) {
+        off_t new_pos = (off_t)file->mapping->size + offset;
+        if (new_pos < 0) {
+            return VFS_EINVAL;
+        }
+        file->position = new_pos;
+        return new_pos;
+    }
+
+    // Cached writes need blocks before the file system can tell data from holes
+    if (file->mapping && (whence == VFS_SEEK_DATA || whence == VFS_SEEK_HOLE)) {
+        vfs_inode_write_lock(file->ilock);
+        int result = vfs_page_cache_sync(file->mapping);
+        vfs_inode_write_unlock(file->ilock);
+        if (result != VFS_SUCCESS) {
+            return result;
+        }
+    }
+
     if (file->ops && file->ops->seek) {
         return file->ops->seek(file, offset, whence);
     }
@@ -910,6 +1104,14 @@ off_t vfs_seek(int fd, off_t offset, int whence)
         case VFS_SEEK_END:
             file->position = file->inode ? (off_t)file->inode->size + offset : offset;
             break;
+        case VFS_SEEK_DATA:
+        case VFS_SEEK_HOLE:
+            // Without a block map the whole file is data
+            if (!file->inode || offset < 0 || offset >= (off_t)file->inode->size) {
+                return VFS_ENXIO;
+            }
+            file->position = (whence == VFS_SEEK_DATA) ? offset : (off_t)file->inode->size;
+            break;
         default:
             return VFS_EINVAL;
     }
@@ -921,6 +1123,44 @@ off_t vfs_seek(int fd, off_t offset, int whence)
     return file->position;
 }
 
+/**
+ * Reserve blocks for len bytes at offset so later writes there allocate
+ * nothing. The file grows to cover the range unless VFS_FALLOC_KEEP_SIZE
+ * is given; VFS_FALLOC_ZERO_RANGE also discards the data in it.
+ */
+int vfs_fallocate(int fd, off_t offset, off_t len, int mode)
+{
+    struct file *file = vfs_get_open_file(fd);
+    if (!file || offset < 0 || len <= 0 ||
+        (mode & ~(VFS_FALLOC_KEEP_SIZE | VFS_FALLOC_ZERO_RANGE))) {
+        return VFS_EINVAL;
+    }
+    if (!(file->flags & (VFS_O_WRONLY | VFS_O_RDWR))) {
+        return VFS_EPERM;
+    }
+    if (!file->ops || !file->ops->fallocate) {
+        return VFS_EINVAL;
+    }
+
+    // The file system works from its own block map and size, so cached
+    // writes go down first
+    vfs_inode_write_lock(file->ilock);
+    int result = file->mapping ? vfs_page_cache_sync(file->mapping) : VFS_SUCCESS;
+    if (result == VFS_SUCCESS) {
+        result = file->ops->fallocate(file, offset, len, mode);
+    }
+    if (result == VFS_SUCCESS && file->mapping) {
+        if (mode & VFS_FALLOC_ZERO_RANGE) {
+            vfs_page_cache_zero_range(file->mapping, (uint64_t)offset, (uint64_t)len);
+        }
+        if (!(mode & VFS_FALLOC_KEEP_SIZE) && (uint64_t)offset + len > file->mapping->size) {
+            file->mapping->size = (uint32_t)(offset + len);
+        }
+    }
+    vfs_inode_write_unlock(file->ilock);
+    return result;
+}
+
 int vfs_sync(int fd)
 {
     struct file *file = vfs_get_open_file(fd);
@@ -928,11 +1168,48 @@ int vfs_sync(int fd)
         return VFS_EINVAL;
     }
 
+    int result = VFS_SUCCESS;
+    vfs_inode_write_lock(file->ilock);
+    if (file->mapping) {
+        result = vfs_page_cache_sync(file->mapping);
+    }
+
     if (file->ops && file->ops->sync) {
-        return file->ops->sync(file);
+        int sync_result = file->ops->sync(file);
+        if (result == VFS_SUCCESS) {
+            result = sync_result;
+        }
     }
+    vfs_inode_write_unlock(file->ilock);
 
-    return VFS_SUCCESS;
+    return result;
+}
+
+/**
+ * Write back every mounted file system: cached file data, then whatever
+ * the file system caches itself. durable also waits for each device to
+ * make it stable; the flusher leaves that to fsync.
+ */
+int vfs_sync_all(int durable)
+{
+    if (!vfs_initialized) {
+        return VFS_SUCCESS;
+    }
+
+    int result = VFS_SUCCESS;
+    for (struct vfs_mount *mount = mount_list; mount; mount = mount->next) {
+        struct file_system *fs = mount->fs;
+        if (vfs_page_cache_sync_fs(fs) != VFS_SUCCESS) {
+            result = VFS_EIO;
+        }
+        if (fs->type->sync_fs && fs->type->sync_fs(fs) != VFS_SUCCESS) {
+            result = VFS_EIO;
+        }
+        if (durable && fs->device && block_device_sync(fs->device) != BLOCK_SUCCESS) {
+            result = VFS_EIO;
+        }
+    }
+    return result;
 }
 
 int vfs_mkdir(const char *path, int mode)
@@ -1000,6 +1277,47 @@ int vfs_readdir(int fd, struct dirent *entries, size_t count)
     return result;
 }
 
+/**
+ * Read directory entries with each one's mode, size and modification time,
+ * so a listing needs no vfs_stat() and path walk per name
+ * @return Entries read, 0 at end of directory, negative on error
+ */
+int vfs_readdir_plus(int fd, struct dirent_plus *entries, size_t count)
+{
+    struct file *dir = vfs_get_open_file(fd);
+    if (!dir || !entries || count == 0) {
+        return VFS_EINVAL;
+    }
+
+    if (!dir->fs || !dir->fs->type->dir_ops || !dir->fs->type->dir_ops->readdir_plus) {
+        return VFS_EINVAL;
+    }
+
+    if (!dir->inode || !(dir->inode->mode & VFS_FILE_DIRECTORY)) {
+        return VFS_EINVAL;
+    }
+
+    off_t offset = dir->position;
+    int result = dir->fs->type->dir_ops->readdir_plus(dir, entries,
+                                                      count * sizeof(struct dirent_plus), &offset);
+    if (result < 0) {
+        return result;
+    }
+    dir->position = offset;
+
+    // The file system's sizes do not see writes still in the page cache
+    if (dir->fs->type->page_ops) {
+        for (int i = 0; i < result; i++) {
+            uint32_t cached_size;
+            if (!(entries[i].mode & VFS_FILE_DIRECTORY) &&
+                vfs_page_cache_get_size(dir->fs, entries[i].dirent.ino, &cached_size) == VFS_SUCCESS) {
+                entries[i].size = cached_size;
+            }
+        }
+    }
+    return result;
+}
+
 int vfs_unlink(const char *path)
 {
     if (!vfs_initialized || !path) {
@@ -1031,7 +1349,24 @@ int vfs_unlink(const char *path)
 
         return ramfs_remove_child(parent, node->name);
     } else if (fs->type == &sfs_fs_type) {
-        return sfs_delete_file(fs, fs_path);
+        struct inode *inode = sfs_resolve_path(fs, fs_path);
+        if (!inode) {
+            return VFS_ENOENT;
+        }
+        uint32_t ino = inode->ino;
+        int is_dir = (inode->mode & VFS_FILE_DIRECTORY) != 0;
+        sfs_put_inode(inode);
+
+        // Waits out reads and writes in progress on open files
+        struct vfs_inode_lock *ilock = is_dir ? NULL : vfs_inode_lock_get(fs, ino);
+        vfs_inode_write_lock(ilock);
+        int result = sfs_delete_file(fs, fs_path);
+        if (result == VFS_SUCCESS) {
+            vfs_page_cache_forget(fs, ino);
+        }
+        vfs_inode_write_unlock(ilock);
+        vfs_inode_lock_put(ilock);
+        return result;
     }
 
     return VFS_EINVAL;
@@ -1043,53 +1378,51 @@ int vfs_rename(const char *oldpath, const char *newpath)
         return VFS_EINVAL;
     }
 
-    struct file_system *old_fs = vfs_get_filesystem(oldpath);
-    struct file_system *new_fs = vfs_get_filesystem(newpath);
+    struct vfs_mount *mount = vfs_find_mount_for_path(oldpath);
+    if (!mount || !mount->fs) {
+        return VFS_ENOENT;
+    }
 
-    if (!old_fs || old_fs != new_fs || old_fs->type != &ramfs_fs_type) {
+    // Entries move within one file system; nothing is copied across mounts
+    if (vfs_find_mount_for_path(newpath) != mount) {
         return VFS_EINVAL;
     }
 
-    struct ramfs_node *node = vfs_ramfs_resolve(old_fs, oldpath);
-    if (!node) {
-        return VFS_ENOENT;
+    if (strcmp(oldpath, newpath) == 0) {
+        return VFS_SUCCESS;
     }
 
-    if (node->mode & VFS_FILE_DIRECTORY) {
+    // A directory can't move below itself
+    size_t old_len = strlen(oldpath);
+    if (strncmp(newpath, oldpath, old_len) == 0 && newpath[old_len] == '/') {
         return VFS_EINVAL;
     }
 
-    int src_fd = vfs_open(oldpath, VFS_O_RDONLY, 0);
-    if (src_fd < 0) {
-        return src_fd;
+    struct file_system *fs = mount->fs;
+    if (!fs->type->dir_ops || !fs->type->dir_ops->rename) {
+        return VFS_EPERM;
     }
 
-    int dst_fd = vfs_open(newpath, VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC, 0644);
-    if (dst_fd < 0) {
-        vfs_close(src_fd);
-        return dst_fd;
+    // A file replaced at newpath must not leave pages behind
+    struct inode source, replaced;
+    if (vfs_stat(oldpath, &source) != VFS_SUCCESS) {
+        return VFS_ENOENT;
     }
+    int had_target = vfs_stat(newpath, &replaced) == VFS_SUCCESS && replaced.ino != source.ino;
 
-    char buffer[512];
-    ssize_t bytes_read;
-    int result = VFS_SUCCESS;
-
-    while ((bytes_read = vfs_read(src_fd, buffer, sizeof(buffer))) > 0) {
-        ssize_t bytes_written = vfs_write(dst_fd, buffer, (size_t)bytes_read);
-        if (bytes_written != bytes_read) {
-            result = VFS_ERROR;
-            break;
-        }
+    // Directories are locked by the file system itself
+    struct vfs_inode_lock *ilock = NULL;
+    if (had_target && !(replaced.mode & VFS_FILE_DIRECTORY)) {
+        ilock = vfs_inode_lock_get(fs, replaced.ino);
     }
-
-    vfs_close(src_fd);
-    vfs_close(dst_fd);
-
-    if (result == VFS_SUCCESS) {
-        return vfs_unlink(oldpath);
+    vfs_inode_write_lock(ilock);
+    int result = fs->type->dir_ops->rename(fs, vfs_path_within_mount(mount, oldpath),
+                                           vfs_path_within_mount(mount, newpath));
+    if (result == VFS_SUCCESS && had_target) {
+        vfs_page_cache_forget(fs, replaced.ino);
     }
-
-    vfs_unlink(newpath);
+    vfs_inode_write_unlock(ilock);
+    vfs_inode_lock_put(ilock);
     return result;
 }
 
@@ -1125,6 +1458,12 @@ int vfs_stat(const char *path, struct inode *stat_buf)
         memset(stat_buf, 0, sizeof(struct inode));
         vfs_populate_stat_from_sfs(stat_buf, inode, fs);
 
+        // Include writes still in the page cache
+        uint32_t cached_size;
+        if (vfs_page_cache_get_size(fs, inode->ino, &cached_size) == VFS_SUCCESS) {
+            stat_buf->size = cached_size;
+        }
+
         sfs_put_inode(inode);
         return VFS_SUCCESS;
     }
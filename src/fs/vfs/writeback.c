@@ -0,0 +1,97 @@
+/*
+ * MiniOS VFS Background Write-back
+ *
+ * One flusher task writes back every mounted file system: dirty pages
+ * through the page cache, then the file system's own cached inodes,
+ * allocation maps and buffers through its sync_fs. It runs every
+ * interval, and early when the page cache reports the dirty threshold, so
+ * close() and small writes never wait for the device. The flusher does
+ * not wait for the device to make anything stable; fsync does.
+ */
+
+#include "vfs.h"
+#include "kernel.h"
+#include "process.h"
+
+static struct wait_queue flusher_wait = WAIT_QUEUE_INIT;
+static volatile int flusher_kicked = 0;
+static volatile int flusher_running = 0;
+
+static volatile uint32_t writeback_interval_ms = VFS_WRITEBACK_INTERVAL_MS;
+static volatile uint32_t writeback_dirty_pages = VFS_WRITEBACK_DIRTY_PAGES;
+
+// Statistics
+static uint64_t writeback_rounds = 0;
+static uint64_t writeback_kicks = 0;
+static uint64_t writeback_errors = 0;
+
+static void flusher_main(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        wait_event_timeout(&flusher_wait, flusher_kicked,
+                           (uint64_t)writeback_interval_ms * 1000);
+        if (flusher_kicked) {
+            writeback_kicks++;
+        }
+        // Cleared first: pages dirtied during the pass kick the next one
+        flusher_kicked = 0;
+
+        writeback_rounds++;
+        if (vfs_sync_all(0) != VFS_SUCCESS) {
+            writeback_errors++;
+        }
+    }
+}
+
+int vfs_writeback_start(void)
+{
+    if (flusher_running) {
+        return VFS_SUCCESS;
+    }
+    if (process_create_fair(flusher_main, NULL, "flusher", 0) < 0) {
+        return VFS_ENOMEM;
+    }
+    flusher_running = 1;
+    return VFS_SUCCESS;
+}
+
+/**
+ * Set the flusher period and the number of dirty pages that wakes it
+ * early; 0 leaves a setting as it is. A shorter period applies from the
+ * next pass.
+ */
+int vfs_writeback_configure(uint32_t interval_ms, uint32_t dirty_pages)
+{
+    if (interval_ms) {
+        writeback_interval_ms = interval_ms;
+    }
+    if (dirty_pages) {
+        writeback_dirty_pages = dirty_pages;
+    }
+    return VFS_SUCCESS;
+}
+
+void vfs_writeback_kick(uint32_t dirty_pages)
+{
+    if (!flusher_running || flusher_kicked || dirty_pages < writeback_dirty_pages) {
+        return;
+    }
+    flusher_kicked = 1;
+    wake_up(&flusher_wait);
+}
+
+void vfs_writeback_get_stats(struct vfs_writeback_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    stats->interval_ms = writeback_interval_ms;
+    stats->dirty_pages = writeback_dirty_pages;
+    stats->running = flusher_running;
+    stats->rounds = writeback_rounds;
+    stats->kicks = writeback_kicks;
+    stats->errors = writeback_errors;
+}
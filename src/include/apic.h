@@ -0,0 +1,63 @@
+/*
+ * MiniOS x86-64 Local APIC
+ *
+ * The local APIC in x2APIC mode, reached through MSRs (drivers/interrupt/
+ * apic.c). Its lines are numbered after the 8259's, which keeps the
+ * device lines.
+ */
+
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+#define APIC_TIMER_IRQ          16
+#define APIC_TIMER_VECTOR       0x30
+#define APIC_SPURIOUS_VECTOR    0xFF
+
+/**
+ * Switch the boot CPU's local APIC to x2APIC mode
+ * @return 0 on success, -1 if the CPU has no x2APIC
+ */
+int apic_init(void);
+
+/**
+ * Register the local APIC's lines with the interrupt subsystem
+ * @return 0 on success, negative on error
+ */
+int apic_controller_register(void);
+
+/**
+ * Switch the calling secondary CPU's local APIC to x2APIC mode, if the
+ * boot CPU's is
+ * @return 0 on success, -1 if x2APIC is not in use
+ */
+int apic_cpu_init(void);
+
+/**
+ * Whether the local APICs are in x2APIC mode
+ */
+int apic_x2apic_enabled(void);
+
+/**
+ * Send an IPI through the x2APIC interrupt command register
+ * @param dest Destination x2APIC ID, ignored with a shorthand
+ * @param icr Low half of the command: vector, delivery mode, shorthand
+ */
+void apic_send_ipi(uint32_t dest, uint32_t icr);
+
+/**
+ * Put the boot CPU's APIC timer in TSC-deadline mode, masked, on
+ * APIC_TIMER_IRQ
+ * @return 0 on success, -1 without x2APIC or TSC-deadline support
+ */
+int apic_timer_deadline_init(void);
+
+/**
+ * Fire the APIC timer when the TSC reaches tsc; 0 disarms it
+ */
+void apic_timer_set_deadline(uint64_t tsc);
+
+void apic_show_status(void);
+
+#endif /* APIC_H */
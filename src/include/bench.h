@@ -0,0 +1,48 @@
+/*
+ * MiniOS In-Kernel Microbenchmarks
+ *
+ * Hot-path costs measured with the counter the vDSO clock reads (CNTVCT
+ * on ARM64, the TSC on x86-64). Each benchmark times its operation in
+ * batches, so the counter read is paid once per batch rather than per
+ * operation, and reports the mean and the fastest batch.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "kernel.h"
+
+#define BENCH_DEFAULT_ITERATIONS    10000
+#define BENCH_MAX_ITERATIONS        10000000
+#define BENCH_BATCH                 32      // Operations per counter read
+
+// Results are fixed point: counter ticks per operation times 100
+#define BENCH_SCALE                 100
+
+#define BENCH_SKIPPED               1       // Nothing to measure here
+
+struct bench_result {
+    uint32_t iterations;                // Operations timed
+    uint64_t mean_x100;                 // Ticks per operation, mean
+    uint64_t min_x100;                  // Ticks per operation, fastest batch
+    const char *note;                   // Caveat worth printing, or NULL
+};
+
+/**
+ * Number of benchmarks, and the name of each
+ */
+int bench_count(void);
+const char *bench_name(int index);
+
+/**
+ * Run one benchmark
+ * @param index Benchmark number, below bench_count()
+ * @param iterations Operations to time, rounded up to whole batches
+ * @param dir Directory the file system benchmarks work in
+ * @param result Filled in on success
+ * @return 0 on success, BENCH_SKIPPED if it does not apply, negative on error
+ */
+int bench_run(int index, uint32_t iterations, const char *dir,
+              struct bench_result *result);
+
+#endif /* BENCH_H */
@@ -3,6 +3,7 @@
 
 // Include kernel standard types
 #include "kernel.h"
+#include "percpu.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +37,57 @@ extern "C" {
 // Forward declarations
 struct block_device;
 
+// Scatter/gather I/O: a request covers consecutive device blocks, taken
+// from (or stored to) each segment's buffer in turn
+#define BLOCK_IO_MAX_SEGMENTS   64
+
+struct block_io_segment {
+    void *buffer;                           // count * block_size bytes
+    uint32_t count;                         // Blocks in this segment
+};
+
+// Asynchronous requests (see block_queue.c). The submitter fills in the
+// fields up to private_data and keeps the request and its segments alive
+// until it completes; done, if set, may run in interrupt context.
+struct task;
+struct block_request;
+typedef void (*block_request_done_t)(struct block_request *req);
+
+struct block_request {
+    struct block_device *dev;
+    int write;                              // 0 = read, 1 = write
+    uint32_t start_block;
+    const struct block_io_segment *segs;
+    uint32_t num_segs;
+    block_request_done_t done;              // Completion callback, optional
+    void *private_data;                     // For the callback
+
+    // Owned by the queue
+    volatile int completed;
+    int status;                             // BLOCK_* result once completed
+    uint32_t count;                         // Blocks covered
+    struct task *waiter;                    // Task sleeping in block_request_wait
+    struct block_request *next;             // Elevator order, then dispatch batch
+};
+
+// Per-device queue: pending requests are kept sorted by block and issued
+// in one direction (C-LOOK), merging neighbours into a single dispatch.
+// A device has at most one dispatch at the driver at a time.
+struct block_queue {
+    struct block_request *pending;          // Sorted by start block
+    struct block_request *active;           // Batch at the driver, NULL if idle
+    uint32_t head_pos;                      // Block after the last dispatch
+    uint32_t depth;                         // Requests pending
+    struct block_io_segment dispatch_segs[BLOCK_IO_MAX_SEGMENTS];
+    uint32_t dispatch_count;                // Blocks in the active batch
+    volatile int irq_driven;                // Completions arrive by interrupt
+
+    uint64_t submitted;
+    uint64_t merged;                        // Requests folded into another dispatch
+    uint64_t dispatched;
+    uint64_t completed;
+};
+
 // Block device operations
 struct block_device_operations {
     // read_block write_block - main block device I/O operations
@@ -43,11 +95,40 @@ struct block_device_operations {
     int (*write_block)(struct block_device *dev, uint32_t block_num, const void *buffer);
     int (*read_blocks)(struct block_device *dev, uint32_t start_block, uint32_t count, void *buffer);
     int (*write_blocks)(struct block_device *dev, uint32_t start_block, uint32_t count, const void *buffer);
+    int (*readv)(struct block_device *dev, uint32_t start_block,
+                 const struct block_io_segment *segs, uint32_t num_segs);
+    int (*writev)(struct block_device *dev, uint32_t start_block,
+                  const struct block_io_segment *segs, uint32_t num_segs);
     int (*sync)(struct block_device *dev);
     int (*ioctl)(struct block_device *dev, unsigned int cmd, unsigned long arg);
+
+    // Asynchronous drivers: start a transfer and return; report the result
+    // later with block_queue_complete() (never from inside submit). poll
+    // reaps completions until the driver sets queue.irq_driven.
+    int (*submit)(struct block_device *dev, int write, uint32_t start_block,
+                  const struct block_io_segment *segs, uint32_t num_segs);
+    void (*poll)(struct block_device *dev);
+
+    // Memory-backed drivers: address of a block's backing store, valid
+    // until the block is discarded. Loads and stores through it are the
+    // device's contents, so callers may use it instead of copying.
+    void *(*map_block)(struct block_device *dev, uint32_t block);
+
+    // Optional: the blocks' contents are no longer needed. They may read
+    // back as anything until written again; a RAM disk frees their memory.
+    int (*discard)(struct block_device *dev, uint32_t start_block, uint32_t count);
+};
+
+// I/O counters, kept per CPU; see block_device_get_stats()
+struct block_device_stats {
+    uint64_t reads;                         // Blocks read
+    uint64_t writes;                        // Blocks written
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t discarded;                     // Blocks discarded
 };
 
-// Block device structure
+// Block device structure, cache-line aligned for its counters
 struct block_device {
     char name[64];                          // Device name (e.g., "ram0", "hda")
     uint32_t device_type;                   // Device type (ram, disk, etc.)
@@ -58,11 +139,9 @@ struct block_device {
     struct block_device_operations *ops;    // Device operations
     void *private_data;                     // Device-specific data
     
-    // Statistics (volatile to prevent optimization issues)
-    volatile uint64_t reads;                // Number of read operations
-    volatile uint64_t writes;               // Number of write operations
-    volatile uint64_t bytes_read;           // Total bytes read
-    volatile uint64_t bytes_written;        // Total bytes written
+    DEFINE_PER_CPU(struct block_device_stats, stats);
+    
+    struct block_queue queue;               // Asynchronous request queue
     
     // List management
     struct block_device *next;              // Next device in list
@@ -86,7 +165,39 @@ int block_device_read(struct block_device *dev, uint32_t block, void *buffer);
 int block_device_write(struct block_device *dev, uint32_t block, const void *buffer);
 int block_device_read_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, void *buffer);
 int block_device_write_blocks(struct block_device *dev, uint32_t start_block, uint32_t count, const void *buffer);
+int block_device_readv(struct block_device *dev, uint32_t start_block,
+                       const struct block_io_segment *segs, uint32_t num_segs);
+int block_device_writev(struct block_device *dev, uint32_t start_block,
+                        const struct block_io_segment *segs, uint32_t num_segs);
+int block_device_execute(struct block_device *dev, int write, uint32_t start_block,
+                         const struct block_io_segment *segs, uint32_t num_segs);
+uint32_t block_device_request_blocks(struct block_device *dev, uint32_t start_block,
+                                     const struct block_io_segment *segs, uint32_t num_segs);
 int block_device_sync(struct block_device *dev);
+void *block_device_map_block(struct block_device *dev, uint32_t block);
+int block_device_discard(struct block_device *dev, uint32_t start_block, uint32_t count);
+void block_device_get_stats(struct block_device *dev, struct block_device_stats *stats);
+
+// Count a completed transfer of blocks on the calling CPU
+static inline void block_device_account(struct block_device *dev, int write, uint32_t blocks)
+{
+    uint64_t bytes = (uint64_t)blocks * dev->block_size;
+    if (write) {
+        this_cpu_add(dev->stats, writes, blocks);
+        this_cpu_add(dev->stats, bytes_written, bytes);
+    } else {
+        this_cpu_add(dev->stats, reads, blocks);
+        this_cpu_add(dev->stats, bytes_read, bytes);
+    }
+}
+
+// Block request queue
+void block_queue_init(struct block_queue *queue);
+int block_submit(struct block_request *req);
+int block_request_wait(struct block_request *req);
+void block_queue_complete(struct block_device *dev, int status);
+int block_queue_transfer(struct block_device *dev, int write, uint32_t start_block,
+                         const struct block_io_segment *segs, uint32_t num_segs);
 
 // Block device utility functions
 size_t block_device_get_size(struct block_device *dev);
@@ -94,25 +205,60 @@ int block_device_is_readable(struct block_device *dev);
 int block_device_is_writable(struct block_device *dev);
 void block_device_print_stats(struct block_device *dev);
 
-// Block buffer management (simple caching)
+// Block buffer cache
+#define BLOCK_BUFFER_DEFAULT_CAPACITY  64      // Buffers kept before LRU eviction
+#define BLOCK_BUFFER_HASH_BUCKETS      128
+#define BLOCK_BUFFER_LOCKS             16      // Lock stripes over the hash buckets
+
 struct block_buffer {
     struct block_device *device;
     uint32_t block_num;
     void *data;
     int dirty;
     int ref_count;
-    struct block_buffer *next;
+    int mapped;                             // data aliases the device's memory
+    int verified;                           // Owner checked the contents since they were read
+    struct block_buffer *next;              // Hash chain
+    struct block_buffer *lru_prev;          // LRU list, most recent at the head
+    struct block_buffer *lru_next;
+};
+
+struct block_buffer_stats {
+    uint32_t capacity;                      // Maximum cached buffers
+    uint32_t buffers;                       // Buffers currently cached
+    uint32_t dirty;                         // Buffers awaiting write-back
+    uint32_t mapped;                        // Buffers aliasing device memory
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
 };
 
 int block_buffer_init(void);
 struct block_buffer *block_buffer_get(struct block_device *dev, uint32_t block);
+struct block_buffer *block_buffer_get_noread(struct block_device *dev, uint32_t block);
+void block_buffer_mark_dirty(struct block_buffer *buf);
 int block_buffer_put(struct block_buffer *buf);
 int block_buffer_sync(struct block_buffer *buf);
 int block_buffer_sync_all(void);
+int block_buffer_sync_device(struct block_device *dev);
+int block_buffer_sync_range(struct block_device *dev, uint32_t start, uint32_t count);
+void block_buffer_invalidate_range(struct block_device *dev, uint32_t start, uint32_t count);
+int block_buffer_range_busy(struct block_device *dev, uint32_t start, uint32_t count);
+void block_buffer_invalidate_device(struct block_device *dev);
+int block_buffer_set_capacity(uint32_t capacity);
+void block_buffer_get_stats(struct block_buffer_stats *stats);
+
+// Block device views: a device seen through another power-of-two block
+// size (see block_view.c)
+struct block_device *block_view_create(struct block_device *lower, uint32_t block_size);
+void block_view_destroy(struct block_device *dev);
+struct block_device *block_view_lower(const struct block_device *dev);
 
 // RAM disk functions
 struct block_device *ramdisk_create(const char *name, size_t size);
 void ramdisk_destroy(struct block_device *dev);
+size_t ramdisk_resident_size(struct block_device *dev);
 int ramdisk_format_test(struct block_device *dev);
 
 #ifdef __cplusplus
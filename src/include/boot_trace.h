@@ -0,0 +1,40 @@
+/*
+ * MiniOS Boot Trace
+ *
+ * kernel_main and the deferred init tasks mark the end of each boot
+ * phase with the raw CPU counter (CNTVCT on ARM64, the TSC on x86-64),
+ * which reads correctly from the first instruction, before timer_init.
+ * The bootstat command turns the marks into a timeline once the counter
+ * frequency is known.
+ */
+
+#ifndef BOOT_TRACE_H
+#define BOOT_TRACE_H
+
+#include <stdint.h>
+
+#define BOOT_TRACE_MAX  64      // Marks kept; later ones are dropped
+
+struct boot_trace_entry {
+    const char *name;           // Phase that just finished, a string literal
+    uint64_t counter;           // Raw counter when it finished
+    uint32_t cpu;               // CPU that recorded it
+};
+
+/**
+ * Record that phase name finished now. Safe from any CPU or task.
+ */
+void boot_trace_mark(const char *name);
+
+/**
+ * Get the index-th mark, in the order they were recorded
+ * @return 0 on success, negative if there is no such mark
+ */
+int boot_trace_get(uint32_t index, struct boot_trace_entry *entry);
+
+/**
+ * Number of marks recorded
+ */
+uint32_t boot_trace_count(void);
+
+#endif /* BOOT_TRACE_H */
@@ -0,0 +1,23 @@
+/*
+ * MiniOS CRC32C (Castagnoli)
+ *
+ * The checksum SFS keeps on its metadata. The CPU's own CRC32C
+ * instruction is used where there is one: SSE4.2 crc32 on x86-64, the
+ * ARMv8 CRC32 extension on ARM64, both eight bytes at a time. Otherwise
+ * tables are built on first use and the data is folded in eight bytes per
+ * step (slicing-by-8). All give the same result.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Continue a CRC32C over len more bytes. Start from 0; the result of one
+ * call is the crc of the next, so a checksum may be built in pieces.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif /* CRC32C_H */
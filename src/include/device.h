@@ -30,6 +30,10 @@ struct boot_info;
 #define DEVICE_TYPE_PCI         4
 #define DEVICE_TYPE_BLOCK       5
 #define DEVICE_TYPE_NETWORK     6
+#define DEVICE_TYPE_COUNT       7       // Types with a list of their own
+
+// Buckets in the device and driver name hash tables (power of two)
+#define DEVICE_HASH_BUCKETS     32
 
 // Device flags
 #define DEVICE_FLAG_INITIALIZED (1 << 0)
@@ -64,8 +68,10 @@ struct device {
     // Device tree information (ARM64)
     void *dt_node;                  // Device tree node pointer
     
-    // Linked list
+    // Linked lists
     struct device *next;            // Next device in global list
+    struct device *hash_next;       // Next device in the same name bucket
+    struct device *type_next;       // Next device in the same type list
 };
 
 // Device operations structure
@@ -77,6 +83,19 @@ struct device_ops {
     void (*interrupt_handler)(struct device *dev);
 };
 
+/**
+ * Hash a device or driver name (FNV-1a) for the registries' lookup tables
+ */
+static inline uint32_t device_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 // Device management API
 
 /**
@@ -209,6 +228,23 @@ int device_write(struct device *device, const void *buf, size_t len, off_t offse
  */
 int device_ioctl(struct device *device, unsigned int cmd, unsigned long arg);
 
+/**
+ * Run a deferrable device initialization (block devices, bus scans) in a
+ * kernel task of its own, so boot goes on to the shell meanwhile and
+ * several of them probe in parallel on different CPUs. Runs fn inline if
+ * no task can be created. Needs the scheduler.
+ * @param name Task name
+ * @param fn Initialization; its negative return is logged
+ * @return 0 if started, negative if fn ran inline and failed
+ */
+int device_init_async(const char *name, int (*fn)(void));
+
+/**
+ * Wait until every device_init_async() initialization has finished. Must
+ * not be called from one of them.
+ */
+void device_async_wait(void);
+
 /**
  * List all registered devices (for debugging)
  */
@@ -80,8 +80,10 @@ struct device_driver {
     const char *description;    // Driver description
     const char *license;        // License information
     
-    // Linked list
+    // Linked lists
     struct device_driver *next; // Next driver in global list
+    struct device_driver *hash_next; // Next driver in the same name bucket
+    struct device_driver *type_next; // Next driver in the same type list
 };
 
 // Driver management API
@@ -41,6 +41,7 @@ struct elf64_section_header {
 #define SHT_NOBITS      8       // Program space with no data (bss)
 #define SHT_REL         9       // Relocation entries, no addends
 #define SHT_DYNSYM      11      // Dynamic linker symbol table
+#define SHT_GNU_HASH    0x6ffffff6  // GNU-style hash table with bloom filter
 
 // ELF symbol table entry
 struct elf64_symbol {
@@ -99,6 +100,19 @@ struct elf64_dynamic {
 #define DT_RELAENT      9       // Size of one Rela reloc
 #define DT_STRSZ        10      // Size of string table
 #define DT_SYMENT       11      // Size of one symbol table entry
+#define DT_GNU_HASH     0x6ffffef5  // Address of GNU hash table
+
+// Relocation types applied by elf_advanced_relocate()
+#define ELF64_R_SYM(info)   ((uint32_t)((info) >> 32))
+#define ELF64_R_TYPE(info)  ((uint32_t)(info))
+#define R_X86_64_64         1
+#define R_X86_64_GLOB_DAT   6
+#define R_X86_64_JUMP_SLOT  7
+#define R_X86_64_RELATIVE   8
+#define R_AARCH64_ABS64     257
+#define R_AARCH64_GLOB_DAT  1025
+#define R_AARCH64_JUMP_SLOT 1026
+#define R_AARCH64_RELATIVE  1027
 
 // Advanced ELF loader context
 struct elf_advanced_context {
@@ -125,7 +139,17 @@ struct elf_advanced_context {
     uint32_t relocation_count;
     uint32_t rela_count;
     
-    // Hash table for symbol lookup
+    // The object's own DT_GNU_HASH table, if it has one
+    const uint64_t *gnu_bloom;
+    const uint32_t *gnu_buckets;
+    const uint32_t *gnu_chains;     // Indexed by symbol - gnu_symoffset
+    uint32_t gnu_nbuckets;
+    uint32_t gnu_symoffset;         // First hashed symbol
+    uint32_t gnu_bloom_size;        // 64-bit words, a power of two
+    uint32_t gnu_bloom_shift;
+    
+    // Index built by the kernel otherwise: hash_nbuckets heads, then a
+    // next link and the hash of each of the hash_nchains symbols
     uint32_t *hash_table;
     uint32_t hash_nbuckets;
     uint32_t hash_nchains;
@@ -133,6 +157,7 @@ struct elf_advanced_context {
     // Loaded segments information
     void *base_address;
     size_t total_size;
+    uint64_t vaddr_base;            // Link address loaded at base_address
 };
 
 // Shared library structure
@@ -13,6 +13,8 @@ extern "C" {
 
 // Forward declaration for advanced ELF context
 struct elf_advanced_context;
+struct vdso_data;
+struct file_system;
 
 // User program structure
 struct user_program {
@@ -49,6 +51,14 @@ struct user_program {
     struct elf_advanced_context *elf_context;  // Advanced ELF context
     void **shared_libraries;        // Array of loaded shared libraries
     int library_count;              // Number of loaded libraries
+    
+    // Kernel data page for syscall-free clock/PID reads (vdso.h)
+    const struct vdso_data *vdso;
+    
+    // Address space holding the image, stack and heap areas, handed to
+    // the task on execute. NULL with eagerly allocated stack and heap.
+    struct address_space *aspace;
+    int demand_paged;               // Stack and heap are VM areas
 };
 
 // Program status values
@@ -60,8 +70,11 @@ struct user_program {
 
 // Memory regions for user programs
 #define USER_PROGRAM_BASE           0x400000    // 4MB base address
+#define USER_IMAGE_BASE             (USER_VM_BASE + 0x40000000ULL)  // PIE images
 #define USER_STACK_SIZE             (64 * 1024) // 64KB stack
 #define USER_HEAP_SIZE              (1024 * 1024) // 1MB heap
+#define USER_HEAP_BASE              USER_VM_BASE  // Grows up
+#define USER_STACK_TOP              USER_VM_END   // Grows down
 
 // User program loading functions
 int user_program_load(const char *path, struct user_program *program);
@@ -101,6 +114,27 @@ void cleanup_program_arguments(struct user_program *program);
 
 const char *user_program_error_string(int error_code);
 
+// Exec image cache: the parsed layout of recently run programs
+#define EXEC_CACHE_ENTRIES          16
+#define EXEC_CACHE_MAX_SEGMENTS     8           // PT_LOAD segments per image
+#define EXEC_CACHE_MAX_COPY         (16 * 1024) // Copied .data bytes kept per image
+
+struct exec_cache_stats {
+    uint32_t entries;
+    uint32_t bytes;                 // Copied data kept
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stale;                 // Images dropped because their file changed
+};
+
+void exec_cache_get_stats(struct exec_cache_stats *stats);
+
+/**
+ * Drop the cached images of programs on fs, or of all when fs is NULL,
+ * closing their files
+ */
+void exec_cache_invalidate_fs(struct file_system *fs);
+
 #ifdef __cplusplus
 }
 #endif
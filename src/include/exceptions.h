@@ -95,7 +95,7 @@ void exception_default_handler(uint32_t exception_num,
                                struct exception_context *ctx);
 
 /**
- * Page fault handler
+ * Page fault handler: backs demand-paged user memory, halts otherwise
  * @param exception_num Exception number (should be EXCEPTION_PAGE_FAULT)
  * @param ctx Exception context
  */
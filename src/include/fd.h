@@ -9,8 +9,9 @@
 extern "C" {
 #endif
 
-// Maximum number of open files per process
-#define MAX_OPEN_FILES      32
+// Descriptors per process: tables start small and double up to the cap
+#define FD_TABLE_INITIAL_SIZE   32
+#define MAX_OPEN_FILES          1024
 
 // Standard file descriptors
 #define STDIN_FD           0
@@ -31,8 +32,11 @@ struct file_descriptor {
 
 // File descriptor table (per process)
 struct fd_table {
-    struct file_descriptor fds[MAX_OPEN_FILES];
-    int next_fd;                            // Hint for next available FD
+    struct file_descriptor *fds;            // size entries
+    uint32_t *open_map;                     // Bit per descriptor, set when used
+    int size;                               // Descriptors allocated
+    int next_fd;                            // No free descriptor below this
+    int count;                              // Descriptors in use
     int ref_count;                          // Reference count for sharing
 };
 
@@ -47,6 +51,7 @@ int fd_allocate(struct fd_table *table);
 void fd_free(struct fd_table *table, int fd);
 struct file_descriptor *fd_get(struct fd_table *table, int fd);
 int fd_assign(struct fd_table *table, int fd, struct file *file, int flags);
+int fd_install(struct fd_table *table, struct file *file, int flags);
 int fd_is_valid(struct fd_table *table, int fd);
 
 // Process-level FD operations (uses current process FD table)
@@ -65,7 +70,7 @@ int fd_count_open(struct fd_table *table);
 // Standard file descriptor setup
 int fd_setup_stdio(void);
 
-// Get current process file descriptor table
+// Get current process file descriptor table (the kernel's outside a task)
 struct fd_table *fd_get_current_table(void);
 
 #ifdef __cplusplus
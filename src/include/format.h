@@ -0,0 +1,46 @@
+/*
+ * MiniOS Number and String Formatting
+ *
+ * The one formatting core behind snprintf() in the kernel, shell_printf(),
+ * itoa() and minios_libc's printf family. Numbers are converted two
+ * decimal digits per division, from a 200-byte digit-pair table, and hex
+ * a nibble at a time from a lookup string. Everything is formatted into a
+ * caller buffer so that the result reaches the console in one write.
+ *
+ * Built into both the kernel and minios_libc, so it depends on nothing
+ * but compiler headers.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FORMAT_INT_MAX      24      // Buffer for any 64-bit number, sign and NUL included
+
+/**
+ * Write value in decimal to buf with a terminating NUL
+ * @return Number of characters written, NUL excluded
+ */
+size_t format_u64(char *buf, uint64_t value);
+size_t format_i64(char *buf, int64_t value);
+
+/**
+ * Write value in hex (no prefix) to buf with a terminating NUL
+ * @return Number of characters written, NUL excluded
+ */
+size_t format_hex(char *buf, uint64_t value, int upper);
+
+/**
+ * Format into buf, writing at most size bytes including the NUL.
+ * Conversions: d i u x X p s c %, with flags - 0 + and space, a width and
+ * precision (numbers or *), and the hh h l ll z t j length modifiers.
+ * @return Length of the full result, which was cut short if >= size
+ */
+int vsnprintf(char *buf, size_t size, const char *format, va_list args);
+int snprintf(char *buf, size_t size, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif /* FORMAT_H */
@@ -0,0 +1,28 @@
+/*
+ * MiniOS Futexes
+ *
+ * Operations for SYSCALL_FUTEX. Shared with minios_libc, so it has no
+ * dependencies.
+ *
+ * A futex is any aligned 32-bit word of a task's memory. Threads change
+ * it with atomics and only trap to sleep until it changes or to wake
+ * those sleeping on it, so a lock nobody waits for never enters the
+ * kernel. Sleepers are keyed by address space and address, so threads of
+ * one program share futexes and other programs' words at the same address
+ * are never confused with them.
+ */
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+// futex(uaddr, FUTEX_WAIT, val, timeout_us): sleep while *uaddr == val,
+// for at most timeout_us (0 for no limit). 0 once woken, SYSCALL_EAGAIN
+// if the word already differed, SYSCALL_ETIMEDOUT; callers recheck the
+// word either way, as wakeups may be spurious.
+#define FUTEX_WAIT          0
+
+// futex(uaddr, FUTEX_WAKE, val, 0): wake up to val sleepers, oldest
+// first, and return how many were woken
+#define FUTEX_WAKE          1
+
+#endif /* FUTEX_H */
@@ -43,18 +43,48 @@ struct interrupt_controller {
     uint32_t (*get_pending)(void);
     void (*clear_pending)(uint32_t irq);
     void (*send_eoi)(uint32_t irq);
+    int (*set_affinity)(uint32_t irq, uint32_t cpu);    // Optional: route to one CPU
+};
+
+// Further handler on a shared line
+struct irq_action {
+    interrupt_handler_t handler;
+    void *context;
+    const char *name;
+    struct irq_action *next;
 };
 
 // Interrupt descriptor
 struct irq_desc {
     uint32_t irq_num;
-    interrupt_handler_t handler;
+    interrupt_handler_t handler;            // First handler
     void *context;
     const char *name;
-    uint32_t count;
+    struct irq_action *shared;              // Handlers added by request_shared_irq()
+    struct interrupt_controller *chip;      // Owning controller, set when it registers
+    uint32_t hwirq;                         // irq_num - chip->base_irq
     uint32_t type;
     uint8_t priority;
-    uint32_t flags;
+    uint32_t flags;                         // IRQ_FLAG_*
+};
+
+#define IRQ_FLAG_SHARED         (1 << 0)    // Line accepts request_shared_irq()
+
+#define MAX_IRQS                256         // Lines with a descriptor; higher GIC lines are only acknowledged
+
+// Per-IRQ timing, in log2 buckets of counter ticks (CNTVCT/TSC): bucket
+// n counts samples of [2^n, 2^(n+1)) ticks, bucket 0 also takes 0
+#define IRQ_STATS_BUCKETS       32
+
+struct irq_stats {
+    uint32_t irq_num;
+    const char *name;
+    uint32_t count;                         // Interrupts since boot
+    uint32_t samples;                       // Of those, timed
+    uint32_t latency[IRQ_STATS_BUCKETS];    // Vector entry -> first handler
+    uint32_t duration[IRQ_STATS_BUCKETS];   // First handler -> last returns
+    uint64_t max_latency;
+    uint64_t max_duration;
 };
 
 // Interrupt subsystem API
@@ -83,7 +113,19 @@ int interrupt_controller_register(struct interrupt_controller *controller);
 int request_irq(uint32_t irq_num, interrupt_handler_t handler, void *context, const char *name);
 
 /**
- * Free an interrupt line
+ * Request a line that several devices may share. Every handler runs on
+ * each interrupt, in registration order, and must check its own device.
+ * @param irq_num Interrupt number
+ * @param handler Interrupt handler function
+ * @param context Context pointer passed to handler
+ * @param name Interrupt name for debugging
+ * @return 0 on success, negative if the line is held exclusively or on error
+ */
+int request_shared_irq(uint32_t irq_num, interrupt_handler_t handler, void *context,
+                       const char *name);
+
+/**
+ * Free an interrupt line, dropping every handler on it
  * @param irq_num Interrupt number to free
  */
 void free_irq(uint32_t irq_num);
@@ -118,6 +160,15 @@ int set_irq_priority(uint32_t irq_num, uint8_t priority);
  */
 int set_irq_type(uint32_t irq_num, uint32_t type);
 
+/**
+ * Route a shared interrupt to one CPU
+ * @param irq_num Interrupt number
+ * @param cpu Logical CPU number; it must be up
+ * @return 0 on success, negative if the line or CPU can't be used or the
+ *         controller can't route
+ */
+int irq_set_affinity(uint32_t irq_num, uint32_t cpu);
+
 /**
  * Get interrupt statistics
  * @param irq_num Interrupt number
@@ -137,6 +188,11 @@ unsigned long disable_interrupts(void);
  */
 void restore_interrupts(unsigned long flags);
 
+/**
+ * Unmask interrupts on the calling CPU whatever their previous state
+ */
+void enable_interrupts(void);
+
 /**
  * Check if interrupts are enabled
  * @return 1 if enabled, 0 if disabled
@@ -160,6 +216,49 @@ void show_interrupt_stats(void);
  */
 void show_interrupt_controllers(void);
 
+/**
+ * Timing is off by default; the vector stubs only read the counter while
+ * irq_stats_enabled is set.
+ */
+extern volatile uint32_t irq_stats_enabled;
+
+/**
+ * Turn per-IRQ timing on (clearing the histograms) or off
+ */
+void irq_stats_enable(int enable);
+
+/**
+ * Record the counter value the vector stub read on entry, 0 if it did
+ * not. Called by the architecture before handle_interrupt().
+ */
+void irq_stats_entry(uint64_t stamp);
+
+/**
+ * Where an interrupt found the CPU, for profilers
+ */
+struct irq_regs {
+    uintptr_t pc;                       // Interrupted instruction
+    uintptr_t fp;                       // Its frame pointer, for backtraces
+    int user;                           // Taken from user mode
+};
+
+/**
+ * Record the interrupted context before handle_interrupt(), and clear it
+ * (pc 0) after. Called by the architecture.
+ */
+void irq_set_regs(uintptr_t pc, uintptr_t fp, int user);
+
+/**
+ * The calling CPU's interrupted context, NULL outside an interrupt
+ */
+const struct irq_regs *irq_get_regs(void);
+
+/**
+ * Copy out the timing of one IRQ line
+ * @return 0 on success, -1 if irq_num has no handler
+ */
+int irq_stats_get(uint32_t irq_num, struct irq_stats *stats);
+
 // Architecture-specific functions
 
 /**
@@ -173,8 +272,15 @@ int arch_interrupt_init(void);
  */
 unsigned long arch_disable_interrupts(void);
 void arch_restore_interrupts(unsigned long flags);
+void arch_enable_interrupts(void);
 int arch_interrupts_enabled(void);
 
+/**
+ * Halt until an interrupt arrives (WFI/HLT). Called with interrupts
+ * masked; the pending interrupt is taken before this returns, masked again.
+ */
+void arch_cpu_idle(void);
+
 #ifdef ARCH_ARM64
 /**
  * ARM64 GIC (Generic Interrupt Controller) interface
@@ -0,0 +1,98 @@
+/*
+ * MiniOS Batched I/O Rings
+ *
+ * Layout of the submission/completion ring pair a task shares with the
+ * kernel. The program fills submission entries and advances sq_tail; one
+ * SYSCALL_IO_RING_ENTER trap then runs them in order and posts a
+ * completion for each. Shared with minios_libc, so it only depends on
+ * <stdint.h>.
+ */
+
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+
+#define IO_RING_MAX_ENTRIES     256     // Per queue, a power of two
+#define IO_RING_NAME_MAX        255     // Matches VFS_MAX_NAME
+
+// Operations
+#define IO_RING_OP_NOP          0
+#define IO_RING_OP_OPEN         1       // addr = path, op_flags = flags, len = mode
+#define IO_RING_OP_READ         2       // fd, addr = buffer, len
+#define IO_RING_OP_WRITE        3       // fd, addr = buffer, len
+#define IO_RING_OP_CLOSE        4       // fd
+#define IO_RING_OP_STAT         5       // addr = path, addr2 = struct io_ring_stat
+#define IO_RING_OP_READDIR      6       // fd, addr = struct io_ring_dirent[], len = count
+#define IO_RING_OP_READDIR_PLUS 7       // fd, addr = struct io_ring_dirent_plus[], len = count
+
+// Submission flags: take an operand from the previous entry's result
+// within the same trap. If that result was an error, this entry fails with it.
+#define IO_RING_SQE_FD_PREV     (1U << 0)   // fd = previous result
+#define IO_RING_SQE_LEN_PREV    (1U << 1)   // len = previous result
+
+struct io_ring_sqe {
+    uint8_t opcode;                     // IO_RING_OP_*
+    uint8_t flags;                      // IO_RING_SQE_*
+    uint16_t reserved;
+    int32_t fd;
+    uint64_t addr;
+    uint64_t addr2;
+    uint32_t len;
+    uint32_t op_flags;
+    uint64_t user_data;                 // Copied to the completion
+};
+
+struct io_ring_cqe {
+    uint64_t user_data;
+    int64_t result;                     // As the matching vfs_*() call returns
+};
+
+struct io_ring_stat {
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t size;
+    uint32_t blocks;
+    uint32_t created_time;
+    uint32_t modified_time;
+    uint32_t accessed_time;
+};
+
+// Same layout as the VFS's struct dirent
+struct io_ring_dirent {
+    uint32_t ino;
+    uint16_t type;
+    uint16_t name_len;
+    char name[IO_RING_NAME_MAX];
+};
+
+// Same layout as the VFS's struct dirent_plus
+struct io_ring_dirent_plus {
+    struct io_ring_dirent dirent;
+    uint32_t mode;
+    uint32_t size;
+    uint32_t modified_time;
+};
+
+/**
+ * Ring header at the start of the shared area. Each index is advanced by
+ * one side only and taken modulo entries; the queues start at the given
+ * byte offsets from the header.
+ */
+struct io_ring {
+    volatile uint32_t sq_head;          // Kernel: next entry to run
+    volatile uint32_t sq_tail;          // Program: next free entry
+    volatile uint32_t cq_head;          // Program: next completion to reap
+    volatile uint32_t cq_tail;          // Kernel: next completion to post
+    uint32_t entries;
+    uint32_t mask;                      // entries - 1
+    uint32_t sqe_offset;
+    uint32_t cqe_offset;
+};
+
+struct task;
+
+// Kernel side (syscall/io_ring.c)
+void io_ring_release_task(struct task *task);
+
+#endif /* IO_RING_H */
@@ -74,6 +74,7 @@ void show_interrupt_controllers(void);
 
 // Memory allocation functions (simple implementations for shell)
 void *kmalloc(size_t size);
+void *kmalloc_aligned(size_t size, size_t alignment);  // Power-of-two alignment
 void kfree(void *ptr);
 
 // Architecture-specific functions (implemented in arch/)
@@ -0,0 +1,98 @@
+/*
+ * MiniOS Kernel Log
+ *
+ * Kernel messages go into a ring of fixed-size records instead of
+ * straight to the UART. Any CPU, task or interrupt handler can append
+ * without a lock: it claims the next position with one atomic add and
+ * copies its text into that slot. A drain task (klogd) prints the records
+ * in order; before it runs, and on the panic path, writers drain
+ * synchronously. When the ring wraps the oldest records are overwritten,
+ * and dmesg shows whatever is still there.
+ */
+
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel.h"
+
+#define KLOG_SLOTS              512     // Records kept, power of two
+#define KLOG_TEXT_MAX           116     // Bytes of text per record
+#define KLOG_DRAIN_INTERVAL_US  100000  // klogd's poll when not woken
+
+// One record: seq is the position + 1 once committed, 0 while written
+struct klog_record {
+    volatile uint64_t seq;
+    uint8_t level;                      // LOG_*
+    uint8_t len;
+    char text[KLOG_TEXT_MAX];
+};
+
+struct klog_stats {
+    uint64_t written;                   // Records appended
+    uint64_t printed;                   // Records sent to the console
+    uint64_t dropped;                   // Overwritten before they were printed
+};
+
+/**
+ * Append str at level, split over as many records as it needs. Does not
+ * filter; use klog() for messages that LOG_LEVEL may compile out.
+ */
+void klog_write(int level, const char *str);
+
+/**
+ * Log str if level is at or above LOG_LEVEL. The test is on constants,
+ * so a message below the build's level costs nothing, arguments included.
+ */
+#define klog(level, str)                                            \
+    do {                                                            \
+        if ((level) >= LOG_LEVEL) {                                 \
+            klog_write((level), (str));                             \
+        }                                                           \
+    } while (0)
+
+/**
+ * Format a message (see format.h for the conversions) and log it like
+ * klog(), as one record rather than one per piece
+ */
+void klog_printf(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#define klogf(level, ...)                                           \
+    do {                                                            \
+        if ((level) >= LOG_LEVEL) {                                 \
+            klog_printf((level), __VA_ARGS__);                      \
+        }                                                           \
+    } while (0)
+
+/**
+ * Print every committed record not yet printed. Returns straight away if
+ * another CPU is already draining.
+ */
+void klog_flush(void);
+
+/**
+ * Start klogd; from then on writers leave printing to it
+ * @return 0 on success, negative on error
+ */
+int klog_start(void);
+
+/**
+ * Print str on the console after any log records still pending, without
+ * logging it (shell and user program output)
+ */
+void klog_console_print(const char *str);
+
+/**
+ * Call emit with the text of every record still in the ring at or above
+ * min_level, oldest first. Records overwritten meanwhile are skipped.
+ */
+void klog_dump(int min_level, void (*emit)(const char *text));
+
+/**
+ * Get log statistics
+ */
+void klog_get_stats(struct klog_stats *stats);
+
+#endif /* KLOG_H */
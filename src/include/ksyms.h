@@ -0,0 +1,39 @@
+/*
+ * MiniOS Kernel Symbol Table
+ *
+ * The code symbols of the kernel image, for turning addresses into
+ * function names at run time. The loader keeps no ELF symbol table, so
+ * the build generates this one from the first of two links (see
+ * tools/gen-ksyms.py) and places it after .bss, where it moves nothing.
+ */
+
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <stdint.h>
+
+// Generated tables: addresses ascending, names NUL-separated in ksyms_names
+extern const uint32_t ksyms_num;
+extern const uint64_t ksyms_text_end;
+extern const uint64_t ksyms_addresses[];
+extern const uint32_t ksyms_name_offsets[];
+extern const char ksyms_names[];
+
+/**
+ * Number of symbols, 0 in a kernel linked without the table
+ */
+uint32_t ksyms_count(void);
+
+/**
+ * Find the function containing addr
+ * @param offset Set to addr's distance from the symbol, if not NULL
+ * @return The symbol's index, or -1 if addr is not in kernel code
+ */
+int ksyms_lookup(uintptr_t addr, uintptr_t *offset);
+
+/**
+ * Name of symbol index, NULL if out of range
+ */
+const char *ksyms_name(uint32_t index);
+
+#endif /* KSYMS_H */
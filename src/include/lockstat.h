@@ -0,0 +1,61 @@
+/*
+ * MiniOS Lock Statistics
+ *
+ * With LOCKSTAT=1 (the default in debug builds) every spinlock counts
+ * its acquisitions and the ones that had to wait, and times the waits
+ * and the holds in counter ticks. Locks have no names, so each is known
+ * by its address and shown by the code that first took it; a lock freed
+ * and another made at the same address share one entry. The lockstat
+ * command lists the locks waited on the most. Release builds compile the
+ * hooks out.
+ *
+ * The table is static and entries are claimed with compare-and-swap, so
+ * recording never allocates or takes a lock. An entry changes only while
+ * its lock is held, which keeps its counters consistent; reports read
+ * them without stopping anyone.
+ */
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+#define LOCKSTAT_MAX_LOCKS  512     // Locks tracked, a power of two
+
+// Report orders
+#define LOCKSTAT_BY_WAIT    0       // Total time spent waiting
+#define LOCKSTAT_BY_HOLD    1       // Total time held
+#define LOCKSTAT_BY_COUNT   2       // Acquisitions
+
+struct lockstat_entry {
+    uintptr_t lock;                 // Address of the spinlock_t
+    uintptr_t site;                 // Return address into its first locker
+    uint64_t acquisitions;
+    uint64_t contended;             // Acquisitions that had to wait
+    uint64_t wait_total;            // Counter ticks spent waiting
+    uint64_t wait_max;
+    uint64_t hold_total;            // Counter ticks held
+    uint64_t hold_max;
+};
+
+struct lockstat_summary {
+    uint32_t locks;                 // Locks seen
+    uint64_t untracked;             // Acquisitions the table had no room for
+    uint64_t frequency;             // Counter rate in Hz
+};
+
+/**
+ * Locks in the given order, largest first
+ * @param entries Filled with up to max entries
+ * @return Entries filled, or -1 if the kernel was built without LOCKSTAT
+ */
+int lockstat_report(int order, struct lockstat_entry *entries, int max,
+                    struct lockstat_summary *summary);
+
+/**
+ * Zero every lock's counters; the locks stay known
+ */
+void lockstat_reset(void);
+
+#endif /* LOCKSTAT_H */
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "boot_protocol.h"
+#include "spinlock.h"
 
 // Architecture detection
 #ifndef ARCH_ARM64
@@ -47,6 +48,16 @@ struct memory_region {
     uint32_t type;           // Memory type from boot protocol
 };
 
+// Buddy allocator orders (0..11, largest block 8MB)
+#define PAGE_ALLOC_MAX_ORDER 12
+
+// Free memory kept for allocations that can't wait: below the low
+// watermark the reclaimer is woken, and it shrinks caches until the
+// high watermark is free again
+#define PAGE_ALLOC_LOW_WATERMARK_DIV   64   // 1/64 of RAM
+#define PAGE_ALLOC_HIGH_WATERMARK_DIV  32   // 1/32 of RAM
+#define PAGE_ALLOC_MIN_WATERMARK       64   // Pages, for small machines
+
 // Memory statistics
 struct memory_stats {
     uint64_t total_memory;   // Total available memory
@@ -54,6 +65,39 @@ struct memory_stats {
     uint64_t free_memory;    // Available for allocation
     uint32_t total_regions;  // Number of memory regions
     uint32_t free_regions;   // Number of free regions
+    uint32_t free_blocks[PAGE_ALLOC_MAX_ORDER]; // Free buddy blocks per order
+    uint32_t largest_free_block;                // Largest free block in pages
+    uint64_t low_watermark;  // Free pages below which reclaim starts
+    uint64_t high_watermark; // Free pages reclaim stops at
+    uint64_t alloc_failures; // Requests that found no free block
+};
+
+// Kernel heap size classes (16B .. 2KB, powers of two)
+#define KHEAP_NUM_CLASSES 8
+#define KHEAP_MAX_OBJECT  2048
+
+// Per-size-class kernel heap statistics
+struct kheap_cache_stats {
+    uint32_t object_size;    // Object size in bytes
+    uint32_t slabs;          // Pages backing this cache
+    uint32_t objects_in_use; // Live objects
+    uint32_t objects_cached; // Free objects held in per-CPU magazines and the depot
+    uint32_t objects_total;  // Object capacity of all slabs
+    uint64_t allocs;         // Lifetime allocations
+    uint64_t frees;          // Lifetime frees
+};
+
+// Kernel heap statistics
+struct kheap_stats {
+    struct kheap_cache_stats caches[KHEAP_NUM_CLASSES];
+    uint32_t num_caches;
+    uint32_t large_allocs;       // Live page-backed allocations
+    uint64_t large_pages;        // Pages held by large allocations
+    uint64_t large_total_allocs; // Lifetime large allocations
+    uint64_t large_total_frees;  // Lifetime large frees
+    uint64_t failed_allocs;      // Requests that could not be satisfied
+    uint64_t bytes_in_use;       // Bytes handed out (rounded to class size)
+    uint64_t pages_held;         // Pages owned by the heap
 };
 
 // Kernel load information
@@ -91,10 +135,11 @@ void *memory_map(uint64_t phys_addr, size_t size, uint32_t flags);
 void memory_unmap(void *virt_addr, size_t size);
 
 /**
- * Allocate physical memory
+ * Allocate memory from the kernel heap
  * @param size Size in bytes
- * @param alignment Required alignment (power of 2)
- * @return Virtual address on success, NULL on failure
+ * @param alignment Required alignment (power of 2, 0 for none)
+ * @return Virtual address on success, NULL on failure or if alignment is
+ *         not a power of two
  */
 void *memory_alloc(size_t size, uint32_t alignment);
 
@@ -111,6 +156,15 @@ void memory_free(void *ptr);
  */
 void *memory_alloc_pages(size_t num_pages);
 
+/**
+ * Allocate pages starting on an alignment boundary
+ * @param num_pages Number of pages to allocate
+ * @param alignment Power of two; below a page means page aligned
+ * @return Virtual address on success, NULL on failure; free with
+ *         memory_free_pages()
+ */
+void *memory_alloc_pages_aligned(size_t num_pages, size_t alignment);
+
 /**
  * Free pages
  * @param ptr Pointer to pages
@@ -118,6 +172,62 @@ void *memory_alloc_pages(size_t num_pages);
  */
 void memory_free_pages(void *ptr, size_t num_pages);
 
+/**
+ * Allocate zeroed, physically contiguous memory a device can DMA to
+ * @param size Size in bytes, rounded up to whole pages
+ * @param alignment Physical alignment, a power of two; below a page
+ *        means page aligned
+ * @param phys Set to the bus address of the first byte if not NULL
+ * @return Virtual address on success, NULL on failure
+ */
+void *memory_dma_alloc(size_t size, size_t alignment, uint64_t *phys);
+
+/**
+ * Free DMA memory
+ * @param virt Address from memory_dma_alloc()
+ * @param size Size it was allocated with
+ */
+void memory_dma_free(void *virt, size_t size);
+
+/**
+ * Bus address of kernel memory, for handing buffers to devices
+ */
+uint64_t memory_virt_to_phys(const void *virt);
+
+/**
+ * Take another reference to an allocated page, for sharing it
+ * @param page Page from memory_alloc_pages(1)
+ * @return 0 on success, negative if it is not an allocated page or has
+ *         as many references as can be counted
+ */
+int page_ref_get(void *page);
+
+/**
+ * Drop a reference to a page; the last one frees it
+ * @param page Page from memory_alloc_pages(1)
+ */
+void page_ref_put(void *page);
+
+/**
+ * References held to a page
+ * @param page Page from memory_alloc_pages(1)
+ * @return Count, 0 if it is not an allocated page
+ */
+uint32_t page_ref_count(void *page);
+
+/**
+ * Record what an allocated page belongs to, for memory_page_owner()
+ * @param page First page of a run from memory_alloc_pages()
+ * @param owner Any pointer; cleared when the run is freed
+ */
+void memory_set_page_owner(void *page, void *owner);
+
+/**
+ * Owner recorded for the page holding addr; needs no lock
+ * @return The owner, NULL if none was set or addr is not in a zone
+ */
+void *memory_page_owner(const void *addr);
+
 /**
  * Get memory statistics
  * @param stats Pointer to stats structure to fill
@@ -136,6 +246,256 @@ void memory_show_layout(struct boot_info *boot_info);
  */
 int memory_allocator_is_ready(void);
 
+/**
+ * Get kernel heap (kmalloc) statistics
+ * @param stats Pointer to stats structure to fill
+ */
+void kheap_get_stats(struct kheap_stats *stats);
+
+// Physical page allocator (src/kernel/page_alloc.c), fed by
+// arch_memory_allocator_init()
+
+/**
+ * Reset the page allocator before regions are added
+ */
+void page_alloc_init(void);
+
+/**
+ * Exclude a physical range from regions added afterwards
+ * @param start First byte of the reserved range
+ * @param end One past the last byte of the reserved range
+ */
+void page_alloc_reserve(uint64_t start, uint64_t end);
+
+/**
+ * Add an available physical memory region to the allocator
+ * @param base Physical base address
+ * @param size Size in bytes
+ */
+void page_alloc_add_region(uint64_t base, uint64_t size);
+
+// Memory-pressure reclaim (src/kernel/reclaim.c). Caches that grow into
+// free memory register a shrinker; when free pages fall below the low
+// watermark, or an allocation fails, the reclaimer task asks them to give
+// back clean, least recently used entries until the high watermark is
+// free. Shrinkers run in task context and never write anything back.
+
+#define RECLAIM_MAX_SHRINKERS   8
+#define RECLAIM_BATCH_PAGES     64          // Pages asked for per pass
+#define RECLAIM_INTERVAL_US     1000000     // Watermark check when not woken
+
+struct shrinker {
+    const char *name;
+    uint32_t (*count)(void);        // Pages scan() could free now
+    uint32_t (*scan)(uint32_t nr);  // Free up to nr pages, return pages freed
+    uint64_t freed;                 // Lifetime pages freed, kept by the reclaimer
+};
+
+struct reclaim_stats {
+    uint32_t shrinkers;
+    uint64_t wakeups;               // Reclaimer runs
+    uint64_t passes;                // Batches asked of the shrinkers
+    uint64_t pages_freed;
+    struct {
+        const char *name;
+        uint32_t reclaimable;       // Its count() now
+        uint64_t freed;
+    } shrinker[RECLAIM_MAX_SHRINKERS];
+};
+
+/**
+ * Add a cache to those reclaim shrinks; the shrinker must stay allocated
+ * @return 0 on success, -1 if the table is full
+ */
+int shrinker_register(struct shrinker *shrinker);
+
+/**
+ * Shrink the registered caches, each in proportion to what it could free
+ * (task context)
+ * @param nr_pages Pages wanted
+ * @return Pages freed
+ */
+uint32_t memory_reclaim(uint32_t nr_pages);
+
+/**
+ * Wake the reclaimer; safe from any context, including with locks held
+ */
+void memory_reclaim_kick(void);
+
+/**
+ * Start the reclaimer task
+ * @return 0 on success, -1 on failure
+ */
+int memory_reclaim_start(void);
+
+void memory_reclaim_get_stats(struct reclaim_stats *stats);
+
+// Address spaces (src/kernel/aspace.c). Tasks with a NULL address space
+// run in the kernel's, which every other one shares its mappings with.
+
+// Address-space ID width the allocator will use at most
+#define ASPACE_ASID_MAX_BITS 12
+
+struct vm_area;
+
+struct address_space {
+    uint64_t root;           // Physical address of the top-level table
+    uint64_t asid;           // Generation | ASID, stale after a rollover
+    uint32_t refs;           // Tasks using it
+    struct vm_area *vmas;    // Reserved user regions, sorted by address
+    struct vm_area *vma_root; // The same, as a balanced tree for faults
+    struct vm_area *vma_cache; // Area of the last fault lookup
+    uint32_t resident_pages; // Pages faulted into them
+    spinlock_t vm_lock;      // Protects vmas and the user page tables
+};
+
+/**
+ * Set up the kernel address space and the ASID allocator (boot CPU)
+ */
+void aspace_init(void);
+
+/**
+ * Enable ASID tagging on the calling CPU
+ */
+void aspace_cpu_init(void);
+
+/**
+ * Create an address space sharing the kernel's mappings
+ * @return New address space with one reference, NULL on failure
+ */
+struct address_space *aspace_create(void);
+
+/**
+ * Take or drop a reference; the last put frees the tables
+ * @param as Address space, NULL for the kernel's (not counted)
+ */
+void aspace_get(struct address_space *as);
+void aspace_put(struct address_space *as);
+
+/**
+ * Make as the calling CPU's address space, tagged with its ASID so the
+ * entries other address spaces left in the TLB survive. Called by the
+ * scheduler with interrupts disabled.
+ * @param as Address space, NULL for the kernel's
+ */
+void aspace_switch(struct address_space *as);
+
+// Virtual memory areas (src/kernel/vm.c). User regions are reserved up
+// front and backed a page at a time from the page-fault path, zeroed or
+// from the page cache of a mapped file.
+
+// First address of the user region. It has a top-level table slot to
+// itself, so its lower tables are private to each address space.
+#define USER_VM_BASE        0x0000010000000000ULL
+#define USER_VM_END         0x0000018000000000ULL
+
+// Where mmap() places mappings it is not given an address for, clear of
+// the heap at the bottom of the region and the stack at the top
+#define USER_MMAP_BASE      0x0000014000000000ULL
+
+struct file;
+
+struct vm_area {
+    uint64_t start;          // Page aligned
+    uint64_t end;            // Exclusive, page aligned
+    uint32_t flags;          // MEMORY_*
+    uint32_t map_flags;      // VM_MAP_*
+    struct file *file;       // Mapped file (holding a reference), NULL if anonymous
+    uint64_t offset;         // File offset of start, page aligned
+    struct vm_area *next;
+    struct vm_area *left;    // Lower and higher areas in the fault tree
+    struct vm_area *right;
+};
+
+// Mapping flags for vm_map()
+#define VM_MAP_SHARED       (1 << 0)  // Writes reach the file and other mappers
+#define VM_MAP_FIXED        (1 << 1)  // Exactly at addr, replacing what is there
+
+/**
+ * Reserve [start, start + size) in as without backing it
+ * @param as Address space (not the kernel's)
+ * @param start Page-aligned address within the user region
+ * @param size Size in bytes, rounded up to whole pages
+ * @param flags Memory attributes (MEMORY_*)
+ * @return 0 on success, negative if it overlaps a reservation or fails
+ */
+int vm_reserve(struct address_space *as, uint64_t start, size_t size, uint32_t flags);
+
+/**
+ * Map anonymous memory or a file into as, backed on first touch. Private
+ * file pages are shared with the page cache until written; shared ones
+ * are the page cache's own frames.
+ * @param as Address space (not the kernel's)
+ * @param addr Page-aligned address with VM_MAP_FIXED, otherwise ignored
+ * @param size Size in bytes, rounded up to whole pages
+ * @param flags Memory attributes (MEMORY_*)
+ * @param map_flags VM_MAP_* flags
+ * @param file File to map, or NULL; on success its reference is the area's
+ * @param offset Page-aligned file offset of addr
+ * @return Start of the mapping, 0 on failure
+ */
+uint64_t vm_map(struct address_space *as, uint64_t addr, size_t size, uint32_t flags,
+                uint32_t map_flags, struct file *file, uint64_t offset);
+
+/**
+ * Unmap [start, start + size) of as, trimming or splitting areas that
+ * straddle it. Written pages of shared file mappings go back to the
+ * page cache.
+ * @return 0 on success, negative on bad arguments or allocation failure
+ */
+int vm_unmap(struct address_space *as, uint64_t start, size_t size);
+
+/**
+ * Back the pages of [addr, addr + len) in private areas of as now and
+ * copy data into them, e.g. to fill an address space that is not running
+ * @return 0 on success, negative if the range is not mapped or on failure
+ */
+int vm_populate(struct address_space *as, uint64_t addr, const void *data, size_t len);
+
+// Kinds of access for vm_handle_fault()
+#define VM_ACCESS_WRITE     (1 << 0)
+#define VM_ACCESS_EXEC      (1 << 1)
+
+/**
+ * Resolve a fault in a reservation of the current task's address space:
+ * back a missing page, or give a writer its own copy of a shared one
+ * @param addr Faulting address
+ * @param access VM_ACCESS_* bits of the faulting access
+ * @return 0 if the access can be retried, negative if the fault is real
+ */
+int vm_handle_fault(uint64_t addr, uint32_t access);
+
+// Faults since boot, by how vm_handle_fault() resolved them
+struct vm_fault_stats {
+    uint64_t zero;           // Backed with a zeroed page
+    uint64_t file;           // Backed from a mapped file
+    uint64_t cow;            // Copied, or taken over, on write
+    uint64_t shared;         // Write access restored to a shared mapping
+    uint64_t spurious;       // Already backed by another thread
+    uint64_t failed;         // Not in a reservation, or not allowed
+    uint64_t cache_hits;     // Area found through the last-hit cache
+    uint64_t ticks;          // Counter ticks (CNTVCT/TSC) spent in all of them
+    uint64_t max_ticks;      // Longest single fault
+};
+
+/**
+ * Copy out the page fault counters
+ */
+void vm_get_fault_stats(struct vm_fault_stats *stats);
+
+/**
+ * Copy an address space for fork: same reservations, with every backed
+ * page shared copy-on-write (read-only in both until one side writes)
+ * @param parent Address space to copy
+ * @return New address space with one reference, NULL on failure
+ */
+struct address_space *vm_fork(struct address_space *parent);
+
+/**
+ * Free every page and reservation of an address space (its last put)
+ */
+void vm_release(struct address_space *as);
+
 // Architecture-specific functions (implemented per architecture)
 
 /**
@@ -169,4 +529,56 @@ int arch_memory_map_pages(uint64_t virt_addr, uint64_t phys_addr,
 void arch_memory_allocator_init(struct memory_map_entry *memory_map, 
                                 uint32_t map_entries);
 
+/**
+ * Enable ASID/PCID tagging on the calling CPU
+ * @return ASID bits the hardware provides, 0 if it has no tagging
+ */
+uint32_t arch_aspace_cpu_init(void);
+
+/**
+ * Physical address of the kernel's top-level translation table
+ */
+uint64_t arch_aspace_kernel_root(void);
+
+/**
+ * Load a translation table root tagged with asid. Entries cached for
+ * other ASIDs are kept; with no tagging the load flushes the TLB.
+ */
+void arch_aspace_load(uint64_t root, uint32_t asid);
+
+/**
+ * Flush the calling CPU's TLB entries for every ASID
+ */
+void arch_tlb_flush_all(void);
+
+/**
+ * Flush the calling CPU's TLB entry for virt in the loaded address space
+ */
+void arch_tlb_flush_page(uint64_t virt);
+
+/**
+ * Map one 4KB user page in the tables under root, allocating lower
+ * tables as needed. Only for addresses in the user region.
+ * @return 0 on success, negative if a table could not be allocated
+ */
+int arch_aspace_map_page(uint64_t root, uint64_t virt, uint64_t phys, uint32_t flags);
+
+/**
+ * Physical page a user address is mapped to in the tables under root
+ * @return Physical address of the page, 0 if none
+ */
+uint64_t arch_aspace_translate(uint64_t root, uint64_t virt);
+
+/**
+ * Remove a 4KB user page mapping from the tables under root. TLB
+ * entries for it are left to the caller.
+ * @return Physical address it mapped, 0 if none
+ */
+uint64_t arch_aspace_unmap_page(uint64_t root, uint64_t virt);
+
+/**
+ * Free the lower tables under root's user region slot
+ */
+void arch_aspace_free_tables(uint64_t root);
+
 #endif // MEMORY_H
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+ * MiniOS Allocation Profiler
+ *
+ * With MEMPROF=1 (the default in debug builds) every kmalloc() and
+ * memory_alloc_pages() is recorded with its call site and size until it
+ * is freed, and each site keeps counts of what it has live and allocated
+ * over time. The memprof command lists the sites holding the most, by
+ * function through the kernel symbol table. Release builds compile the
+ * hooks out.
+ *
+ * The tables are static, so the profiler never allocates. Allocations
+ * made while they are full are not tracked and show up only as counts.
+ */
+
+#ifndef MEMPROF_H
+#define MEMPROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Allocators
+#define MEMPROF_HEAP        0       // kmalloc(), sizes in bytes as requested
+#define MEMPROF_PAGES       1       // memory_alloc_pages(), sizes in pages
+#define MEMPROF_KINDS       2
+
+#define MEMPROF_MAX_SITES   512     // Call sites, both allocators
+#define MEMPROF_MAX_LIVE    8192    // Allocations tracked at once
+
+struct memprof_site {
+    uintptr_t site;                 // Return address into the caller
+    uint32_t live_count;
+    uint32_t min_size;              // Smallest and largest request
+    uint32_t max_size;
+    uint64_t live_size;             // Bytes or pages held now
+    uint64_t peak_size;             // Most held at once
+    uint64_t allocs;                // Lifetime allocations
+};
+
+struct memprof_summary {
+    uint64_t live_size;             // All tracked, this allocator
+    uint32_t sites;                 // Sites this allocator has seen
+    uint64_t untracked;             // Allocations the tables had no room for
+};
+
+#ifdef CONFIG_MEMPROF
+
+/**
+ * Record an allocation of size from site; from the allocators
+ */
+void memprof_alloc(uint32_t kind, const void *ptr, size_t size, uintptr_t site);
+
+/**
+ * Forget ptr before it is freed; from the allocators
+ */
+void memprof_free(uint32_t kind, const void *ptr);
+
+#else
+
+static inline void memprof_alloc(uint32_t kind, const void *ptr, size_t size, uintptr_t site)
+{
+    (void)kind; (void)ptr; (void)size; (void)site;
+}
+
+static inline void memprof_free(uint32_t kind, const void *ptr)
+{
+    (void)kind; (void)ptr;
+}
+
+#endif /* CONFIG_MEMPROF */
+
+/**
+ * Sites of one allocator holding the most, largest first
+ * @param sites Filled with up to max entries
+ * @return Entries filled, or -1 if the kernel was built without MEMPROF
+ */
+int memprof_report(uint32_t kind, struct memprof_site *sites, int max,
+                   struct memprof_summary *summary);
+
+#endif /* MEMPROF_H */
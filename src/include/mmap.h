@@ -0,0 +1,23 @@
+/*
+ * MiniOS Memory Mappings
+ *
+ * Protection and flag bits for SYSCALL_MMAP. Shared with minios_libc, so
+ * it has no dependencies.
+ */
+
+#ifndef MMAP_H
+#define MMAP_H
+
+// Protection
+#define PROT_NONE           0x0
+#define PROT_READ           0x1
+#define PROT_WRITE          0x2
+#define PROT_EXEC           0x4
+
+// Flags: exactly one of MAP_SHARED and MAP_PRIVATE
+#define MAP_SHARED          0x01    // Writes reach the file and other mappers
+#define MAP_PRIVATE         0x02    // Writes are copied on first touch
+#define MAP_FIXED           0x10    // Exactly at addr, replacing what is there
+#define MAP_ANONYMOUS       0x20    // Zeroed memory; fd and offset are ignored
+
+#endif /* MMAP_H */
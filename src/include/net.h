@@ -0,0 +1,225 @@
+/*
+ * MiniOS Network Stack Internals
+ *
+ * Wire formats and the interfaces between the layers in src/net. Every
+ * layer runs under net_lock, taken with interrupts off: drivers deliver
+ * frames from tasklets through netif_receive(), sockets call in from
+ * tasks, and the stack's timer runs as a tasklet too. Packets hold a
+ * single frame with room in front for headers; whoever a packet is
+ * handed to frees it. Frames are not copied between layers: received
+ * ones wait in socket queues as they arrived, and TCP's outgoing ones
+ * carry their payload as a fragment of the send queue.
+ */
+
+#ifndef NET_H
+#define NET_H
+
+#include "network.h"
+#include "spinlock.h"
+
+// Ethernet
+#define ETH_ALEN            6
+#define ETH_HLEN            14
+#define ETH_FRAME_MAX       1514        // Header plus the default MTU
+#define ETH_MTU             1500
+#define ETH_P_IP            0x0800
+#define ETH_P_ARP           0x0806
+
+// Room for link, IP and TCP headers ahead of any payload
+#define NET_HEADROOM        64
+
+// Pool buffers: structure, headroom, a full frame and some tailroom
+#define NET_BUFFER_SIZE     2048
+#define NET_POOL_BUFFERS    256         // The stack's own pool
+
+// IPv4
+#define IP_HLEN             20
+#define IP_DEFAULT_TTL      64
+#define IP_FLAG_MF          0x2000
+#define IP_OFFSET_MASK      0x1FFF
+
+// Timer tick driving TCP's delayed ACKs and retransmission, and ARP aging
+#define NET_TICK_MS         100
+
+struct eth_header {
+    uint8_t dst[ETH_ALEN];
+    uint8_t src[ETH_ALEN];
+    uint16_t type;
+} __attribute__((packed));
+
+struct arp_header {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t oper;
+    uint8_t sha[ETH_ALEN];
+    uint32_t spa;
+    uint8_t tha[ETH_ALEN];
+    uint32_t tpa;
+} __attribute__((packed));
+
+struct ip_header {
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_len;
+    uint16_t id;
+    uint16_t frag_off;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t src;
+    uint32_t dst;
+} __attribute__((packed));
+
+struct icmp_header {
+    uint8_t type;
+    uint8_t code;
+    uint16_t checksum;
+    uint16_t id;
+    uint16_t sequence;
+} __attribute__((packed));
+
+struct udp_header {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t len;
+    uint16_t checksum;
+} __attribute__((packed));
+
+struct tcp_header {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t data_off;                   // Header length in words, high nibble
+    uint8_t flags;
+    uint16_t window;
+    uint16_t checksum;
+    uint16_t urgent;
+} __attribute__((packed));
+
+extern spinlock_t net_lock;
+
+/*
+ * Packet buffer helpers. push prepends a header, pull strips one, put
+ * appends payload; none of them checks for room, callers size packets
+ * with net_packet_alloc() up front.
+ */
+static inline uint8_t *net_packet_head(struct net_packet *packet)
+{
+    return (uint8_t *)(packet + 1);
+}
+
+static inline void *net_packet_push(struct net_packet *packet, size_t len)
+{
+    packet->data = (uint8_t *)packet->data - len;
+    packet->len += len;
+    return packet->data;
+}
+
+static inline void *net_packet_pull(struct net_packet *packet, size_t len)
+{
+    packet->data = (uint8_t *)packet->data + len;
+    packet->len -= len;
+    return packet->data;
+}
+
+static inline void *net_packet_put(struct net_packet *packet, size_t len)
+{
+    void *tail = (uint8_t *)packet->data + packet->len;
+    packet->len += len;
+    return tail;
+}
+
+// Room left after the data
+static inline size_t net_packet_tailroom(struct net_packet *packet)
+{
+    return packet->capacity - (size_t)((uint8_t *)packet->data - net_packet_head(packet)) -
+           packet->len;
+}
+
+static inline int net_packet_shared(struct net_packet *packet)
+{
+    return __atomic_load_n(&packet->refcount, __ATOMIC_ACQUIRE) > 1;
+}
+
+// Bytes on the wire, fragment included
+static inline size_t net_packet_frame_len(struct net_packet *packet)
+{
+    return packet->len + packet->frag_len;
+}
+
+// End the packet with len bytes at data, which lie in owner's buffer
+static inline void net_packet_attach(struct net_packet *packet, struct net_packet *owner,
+                                     const void *data, uint32_t len)
+{
+    packet->frag = net_packet_get(owner);
+    packet->frag_data = data;
+    packet->frag_len = len;
+}
+
+// A private, contiguous copy in place of a shared or fragmented packet
+int net_packet_unshare(struct net_packet **packet);
+
+// Internet checksum: accumulate with net_checksum_add(), then fold
+uint32_t net_checksum_add(uint32_t sum, const void *data, size_t len);
+uint16_t net_checksum_fold(uint32_t sum);
+uint32_t net_pseudo_header_sum(uint32_t src, uint32_t dst, uint8_t protocol, uint16_t len);
+
+/*
+ * Leave the checksum at field, which lies in the header at start, to be
+ * summed over everything from start on by the device, or by
+ * net_packet_send() if the interface cannot. The field is seeded with the
+ * pseudo-header sum, uncomplemented.
+ */
+static inline void net_packet_csum_partial(struct net_packet *packet, void *start, void *field,
+                                           uint32_t pseudo_sum)
+{
+    uint16_t seed = (uint16_t)~net_checksum_fold(pseudo_sum);
+    memcpy(field, &seed, sizeof(seed));
+    packet->flags |= NET_PACKET_CSUM_PARTIAL;
+    packet->csum_start = (uint16_t)((uint8_t *)start - net_packet_head(packet));
+    packet->csum_offset = (uint16_t)((uint8_t *)field - (uint8_t *)start);
+}
+
+// Interfaces (net_core.c); callers hold net_lock
+int net_is_local_address(uint32_t addr);
+int net_transmit(struct network_interface *netif, const uint8_t *dst_mac, uint16_t type,
+                 struct net_packet *packet);
+
+// Frames sent between these go out as one burst: drivers may hold them
+// until the outermost net_tx_end(). Caller holds net_lock.
+void net_tx_begin(void);
+void net_tx_end(void);
+
+// ARP (arp.c)
+void arp_input(struct network_interface *netif, struct net_packet *packet);
+int arp_output(struct network_interface *netif, uint32_t next_hop, struct net_packet *packet);
+void arp_timer(uint64_t now_ms);
+
+// IPv4 (ipv4.c)
+void ip_input(struct network_interface *netif, struct net_packet *packet);
+int ip_output(struct net_packet *packet, uint32_t src, uint32_t dst, uint8_t protocol);
+struct network_interface *ip_route(uint32_t dst, uint32_t *next_hop);
+uint32_t ip_source_address(uint32_t dst);
+
+// ICMP (icmp.c)
+void icmp_input(struct net_packet *packet, uint32_t src, uint32_t dst);
+
+// UDP (udp.c)
+void udp_input(struct net_packet *packet, uint32_t src, uint32_t dst);
+extern struct socket_ops udp_socket_ops;
+int udp_socket_create(struct socket *sock);
+
+// TCP (tcp.c)
+void tcp_input(struct net_packet *packet, uint32_t src, uint32_t dst);
+void tcp_timer(uint64_t now_ms);
+extern struct socket_ops tcp_socket_ops;
+int tcp_socket_create(struct socket *sock);
+
+// Ports taken from here when a socket is used without being bound
+#define NET_EPHEMERAL_FIRST     49152
+#define NET_EPHEMERAL_LAST      65535
+
+#endif // NET_H
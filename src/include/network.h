@@ -3,15 +3,27 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "kernel.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef uint32_t socklen_t;
+
 // Network interface types
 #define NET_TYPE_ETHERNET   1
 #define NET_TYPE_LOOPBACK   2
 
+// Interface flags
+#define NETIF_FLAG_UP       0x0001
+#define NETIF_FLAG_LOOPBACK 0x0002
+#define NETIF_FLAG_TX_PENDING 0x0004  // Frames held back until the driver's flush
+
+// Offloads an interface's driver takes on
+#define NETIF_F_CSUM        0x0001  // Completes TCP checksums marked partial
+#define NETIF_F_TSO         0x0002  // Cuts TCP packets into gso_size segments
+
 // Protocol families
 #define AF_INET     2
 #define AF_INET6    10
@@ -26,6 +38,41 @@ extern "C" {
 #define IPPROTO_UDP  17
 #define IPPROTO_ICMP 1
 
+// Well-known addresses (network byte order, which 0 is in any order)
+#define INADDR_ANY          0x00000000U
+#define INADDR_LOOPBACK     htonl(0x7F000001U)
+
+// Network error codes; the shared ones match the VFS codes, since socket
+// errors come back through vfs_read()/vfs_write() as well
+#define NET_SUCCESS          0
+#define NET_ERROR           -1
+#define NET_EINVAL          -2
+#define NET_ENOMEM          -6
+#define NET_EPIPE           -9      // Peer has stopped receiving
+#define NET_EADDRINUSE      -10
+#define NET_ECONNREFUSED    -11
+#define NET_ECONNRESET      -12
+#define NET_ETIMEDOUT       -13
+#define NET_ENOTCONN        -14
+#define NET_EHOSTUNREACH    -15
+#define NET_ENOTSOCK        -16
+#define NET_EISCONN         -17
+
+// Network statistics
+struct net_stats {
+    uint64_t rx_packets;        // Received packets
+    uint64_t tx_packets;        // Transmitted packets
+    uint64_t rx_bytes;          // Received bytes
+    uint64_t tx_bytes;          // Transmitted bytes
+    uint32_t rx_errors;         // Receive errors
+    uint32_t tx_errors;         // Transmit errors
+    uint32_t rx_dropped;        // Dropped on receive
+    uint32_t tx_dropped;        // Dropped on transmit
+};
+
+struct net_packet;
+struct net_packet_pool;
+
 // Network interface structure
 struct network_interface {
     char name[16];              // Interface name (eth0, lo, etc.)
@@ -35,29 +82,29 @@ struct network_interface {
     uint32_t gateway;           // Default gateway
     uint16_t mtu;               // Maximum transmission unit
     uint32_t flags;             // Interface flags
+    uint32_t features;          // NETIF_F_*
+    uint32_t gso_max_size;      // Largest IP packet taken with NETIF_F_TSO
+    uint32_t type;              // NET_TYPE_*
+    struct net_packet_pool *pool; // Receive buffers, if the driver keeps its own
     void *driver_data;          // Driver-specific data
     struct net_device_ops *ops; // Device operations
+    struct net_stats stats;     // Kept by the stack, not the driver
+    struct network_interface *next;
 };
 
-// Network device operations
+// Network device operations. transmit takes ownership of the packet,
+// which holds a complete Ethernet frame, and frees it once sent; the
+// frame's last frag_len bytes may be a fragment at frag_data. A packet
+// marked NET_PACKET_XMIT_MORE has others right behind it: the driver may
+// hold it until flush, which the stack calls once the burst is over.
 struct net_device_ops {
     int (*open)(struct network_interface *netif);
     int (*close)(struct network_interface *netif);
-    int (*transmit)(struct network_interface *netif, void *packet, size_t len);
+    int (*transmit)(struct network_interface *netif, struct net_packet *packet);
     int (*set_mac)(struct network_interface *netif, uint8_t *mac);
     int (*get_stats)(struct network_interface *netif, struct net_stats *stats);
-};
-
-// Network statistics
-struct net_stats {
-    uint64_t rx_packets;        // Received packets
-    uint64_t tx_packets;        // Transmitted packets
-    uint64_t rx_bytes;          // Received bytes
-    uint64_t tx_bytes;          // Transmitted bytes
-    uint32_t rx_errors;         // Receive errors
-    uint32_t tx_errors;         // Transmit errors
-    uint32_t rx_dropped;        // Dropped on receive
-    uint32_t tx_dropped;        // Dropped on transmit
+    void (*poll)(struct network_interface *netif);  // Work an interrupt may have missed
+    void (*flush)(struct network_interface *netif); // Send frames held back
 };
 
 // Socket address structures
@@ -86,7 +133,11 @@ struct socket {
     struct socket_ops *ops;     // Socket operations
 };
 
-// Socket operations
+struct poll_table;
+
+// Socket operations; addresses and ports in the socket are in network
+// byte order, like those in struct sockaddr_in. poll follows the rules
+// of the file operation (vfs.h).
 struct socket_ops {
     int (*bind)(struct socket *sock, const struct sockaddr *addr, socklen_t addrlen);
     int (*connect)(struct socket *sock, const struct sockaddr *addr, socklen_t addrlen);
@@ -94,19 +145,43 @@ struct socket_ops {
     int (*accept)(struct socket *sock, struct socket **newsock, struct sockaddr *addr, socklen_t *addrlen);
     ssize_t (*send)(struct socket *sock, const void *buf, size_t len, int flags);
     ssize_t (*recv)(struct socket *sock, void *buf, size_t len, int flags);
+    ssize_t (*sendto)(struct socket *sock, const void *buf, size_t len, int flags,
+                      const struct sockaddr *addr, socklen_t addrlen);
+    ssize_t (*recvfrom)(struct socket *sock, void *buf, size_t len, int flags,
+                        struct sockaddr *addr, socklen_t *addrlen);
     int (*close)(struct socket *sock);
+    uint32_t (*poll)(struct socket *sock, struct poll_table *pt);
 };
 
-// Network packet buffer
+// Network packet buffer. The bytes live right after the structure; data
+// starts NET_HEADROOM in so that each layer can prepend its header.
+// Buffers come from a pool when they fit one and are reference counted.
+// A packet may end in a fragment: bytes that stay in another packet's
+// buffer, which it holds a reference to and leaves as they are.
 struct net_packet {
     void *data;                 // Packet data
-    size_t len;                 // Packet length
+    size_t len;                 // Bytes at data, the fragment not included
     size_t capacity;            // Buffer capacity
+    struct net_packet_pool *pool; // Where the buffer goes back to, or NULL
+    uint32_t refcount;
+    struct net_packet *frag;    // Fragment's buffer, or NULL
+    const void *frag_data;
+    uint32_t frag_len;
     struct network_interface *netif; // Source/destination interface
     uint8_t protocol;           // Protocol type
+    uint8_t flags;              // NET_PACKET_*
+    uint16_t csum_start;        // CSUM_PARTIAL: sum from here (buffer offset)
+    uint16_t csum_offset;       // CSUM_PARTIAL: checksum field, from csum_start
+    uint16_t gso_size;          // Payload per segment if the device must cut it, else 0
     uint32_t timestamp;         // Packet timestamp
+    uint32_t cb[2];             // Kept by whichever layer queues the packet
+    struct net_packet *next;    // Driver, ARP and socket queues
 };
 
+#define NET_PACKET_CSUM_VALID   0x01    // Checksums need no verifying (loopback)
+#define NET_PACKET_CSUM_PARTIAL 0x02    // Transport checksum left to the device
+#define NET_PACKET_XMIT_MORE    0x04    // More frames follow in this burst
+
 // Network initialization and management
 int network_init(void);
 void network_cleanup(void);
@@ -115,14 +190,27 @@ void network_cleanup(void);
 int netif_register(struct network_interface *netif);
 int netif_unregister(struct network_interface *netif);
 struct network_interface *netif_find(const char *name);
+struct network_interface *netif_first(void);
 int netif_up(struct network_interface *netif);
 int netif_down(struct network_interface *netif);
 
-// Packet handling
+// Drivers hand every received frame here; the stack frees the packet
+void netif_receive(struct network_interface *netif, struct net_packet *packet);
+
+// Packet handling. Free drops a reference; the last one returns the
+// buffer to its pool.
 int net_packet_alloc(struct net_packet **packet, size_t size);
+int net_packet_alloc_pool(struct net_packet_pool *pool, struct net_packet **packet);
+struct net_packet *net_packet_get(struct net_packet *packet);
 void net_packet_free(struct net_packet *packet);
 int net_packet_send(struct network_interface *netif, struct net_packet *packet);
 
+// Fixed pools of full-frame buffers, one for the stack and one per driver
+// that wants its own; a pool that runs dry falls back to the heap
+struct net_packet_pool *net_pool_create(uint32_t count);
+void net_pool_destroy(struct net_packet_pool *pool);
+void net_pool_usage(struct net_packet_pool *pool, uint32_t *available, uint32_t *count);
+
 // Socket API (system calls)
 int sys_socket(int domain, int type, int protocol);
 int sys_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
@@ -131,22 +219,53 @@ int sys_listen(int sockfd, int backlog);
 int sys_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 ssize_t sys_send(int sockfd, const void *buf, size_t len, int flags);
 ssize_t sys_recv(int sockfd, void *buf, size_t len, int flags);
+ssize_t sys_sendto(int sockfd, const void *buf, size_t len, int flags,
+                   const struct sockaddr *addr, socklen_t addrlen);
+ssize_t sys_recvfrom(int sockfd, void *buf, size_t len, int flags,
+                     struct sockaddr *addr, socklen_t *addrlen);
 int sys_close_socket(int sockfd);
 
 // Network utilities
 uint32_t inet_addr(const char *cp);
 char *inet_ntoa(uint32_t addr);
-uint16_t ntohs(uint16_t netshort);
-uint16_t htons(uint16_t hostshort);
-uint32_t ntohl(uint32_t netlong);
-uint32_t htonl(uint32_t hostlong);
+
+static inline uint16_t htons(uint16_t hostshort)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap16(hostshort);
+#else
+    return hostshort;
+#endif
+}
+
+static inline uint32_t htonl(uint32_t hostlong)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap32(hostlong);
+#else
+    return hostlong;
+#endif
+}
+
+static inline uint16_t ntohs(uint16_t netshort)
+{
+    return htons(netshort);
+}
+
+static inline uint32_t ntohl(uint32_t netlong)
+{
+    return htonl(netlong);
+}
 
 // Network configuration
 int netif_set_ip(struct network_interface *netif, uint32_t ip, uint32_t netmask, uint32_t gateway);
 int netif_get_ip(struct network_interface *netif, uint32_t *ip, uint32_t *netmask, uint32_t *gateway);
 
+// Drivers
+int loopback_init(void);
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* NETWORK_H */
\ No newline at end of file
+#endif /* NETWORK_H */
@@ -0,0 +1,62 @@
+/*
+ * MiniOS PCI Interface
+ * Configuration space access and bus enumeration (x86-64)
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Configuration space offsets
+#define PCI_VENDOR_ID           0x00
+#define PCI_DEVICE_ID           0x02
+#define PCI_COMMAND             0x04
+#define PCI_CLASS_REVISION      0x08
+#define PCI_HEADER_TYPE         0x0E
+#define PCI_BAR0                0x10
+#define PCI_SUBSYSTEM_ID        0x2E
+#define PCI_INTERRUPT_LINE      0x3C
+
+// Command register bits
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004
+
+// BAR bits
+#define PCI_BAR_IO              0x01
+#define PCI_BAR_IO_MASK         0xFFFFFFFCU
+#define PCI_BAR_MEM_MASK        0xFFFFFFF0U
+
+#define PCI_VENDOR_NONE         0xFFFF
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t subsystem_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t irq_line;
+    uint32_t bar[6];
+};
+
+typedef int (*pci_scan_fn)(struct pci_device *dev, void *context);
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value);
+
+/**
+ * Call fn for every function present on the bus. Returns the number of
+ * calls that returned 0.
+ */
+int pci_scan(pci_scan_fn fn, void *context);
+
+void pci_enable_device(struct pci_device *dev, uint16_t command_bits);
+
+#endif // PCI_H
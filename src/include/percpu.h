@@ -0,0 +1,74 @@
+/*
+ * MiniOS Per-CPU Counters
+ *
+ * Statistics bumped on hot paths (block I/O, system calls, interrupts,
+ * file opens) keep one slot per CPU, each in cache lines of its own, so
+ * CPUs never write to a line another one is using. A CPU adds to its own
+ * slot with a relaxed atomic: as cheap as a plain add on a line it already
+ * owns, and still exact when the task migrates between finding the slot
+ * and adding, or an interrupt adds to the same slot meanwhile. Readers
+ * sum the slots of every CPU; the total never goes backwards and is exact
+ * once the writers stop. Counters are uint64_t.
+ *
+ *     struct foo_stats { uint64_t calls; uint64_t errors; };
+ *     static DEFINE_PER_CPU(struct foo_stats, foo_stats);
+ *
+ *     this_cpu_inc(foo_stats, calls);
+ *     uint64_t calls = per_cpu_sum(foo_stats, calls);
+ */
+
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "smp.h"
+
+#define CACHE_LINE_SIZE         64
+
+#define __cacheline_aligned     __attribute__((aligned(CACHE_LINE_SIZE)))
+
+// MAX_CPUS copies of type named name, padded to whole cache lines; also
+// valid as a struct member, which makes the struct cache-line aligned
+#define DEFINE_PER_CPU(type, name) \
+    struct { type v; } __cacheline_aligned name[MAX_CPUS]
+
+#define per_cpu_ptr(name, cpu)  (&(name)[cpu].v)
+#define this_cpu_ptr(name)      per_cpu_ptr(name, smp_cpu_id())
+
+#define this_cpu_add(name, field, n) \
+    ((void)__atomic_fetch_add(&this_cpu_ptr(name)->field, (uint64_t)(n), __ATOMIC_RELAXED))
+#define this_cpu_inc(name, field)   this_cpu_add(name, field, 1)
+
+// Take n back from the calling CPU's slot, for counts that should not have
+// been made; the slot may wrap but the sum stays right
+#define this_cpu_sub(name, field, n) \
+    ((void)__atomic_fetch_sub(&this_cpu_ptr(name)->field, (uint64_t)(n), __ATOMIC_RELAXED))
+
+// Sum of one counter over every CPU
+#define per_cpu_sum(name, field) \
+    per_cpu_sum_u64(&(name)[0].v.field, sizeof((name)[0]))
+
+// Zero one counter on every CPU, for a statistic starting over
+#define per_cpu_clear(name, field) \
+    per_cpu_clear_u64(&(name)[0].v.field, sizeof((name)[0]))
+
+static inline uint64_t per_cpu_sum_u64(const uint64_t *first, size_t stride)
+{
+    uint64_t sum = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        const uint64_t *slot = (const uint64_t *)((const char *)first + cpu * stride);
+        sum += __atomic_load_n(slot, __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+static inline void per_cpu_clear_u64(uint64_t *first, size_t stride)
+{
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t *slot = (uint64_t *)((char *)first + cpu * stride);
+        __atomic_store_n(slot, 0, __ATOMIC_RELAXED);
+    }
+}
+
+#endif /* PERCPU_H */
@@ -0,0 +1,120 @@
+/*
+ * MiniOS Hardware Performance Counters
+ *
+ * Counter groups over the CPU's PMU: ARM64 PMUv3 event counters or the
+ * x86-64 architectural performance monitoring MSRs. A group counts only
+ * while a task attached to it is running: the scheduler folds the live
+ * counts into the group when the task is switched out and reloads the
+ * PMU for whatever comes in, so each task's counts are its own however
+ * the CPUs are shared.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include "kernel.h"
+
+// Generic events, mapped to each PMU's encodings
+#define PERF_EVENT_CYCLES           0
+#define PERF_EVENT_INSTRUCTIONS     1
+#define PERF_EVENT_CACHE_REFS       2   // L1D on ARM64, last level on x86-64
+#define PERF_EVENT_CACHE_MISSES     3
+#define PERF_EVENT_BRANCHES         4
+#define PERF_EVENT_BRANCH_MISSES    5
+#define PERF_EVENT_DTLB_MISSES      6
+#define PERF_EVENT_ITLB_MISSES      7
+#define PERF_EVENT_COUNT            8
+
+#define PERF_MAX_COUNTERS           6   // Events in one group
+
+// Group flags
+#define PERF_GROUP_INHERIT          0x0001  // Tasks the attached ones create join too
+
+struct task;
+
+struct perf_group {
+    uint32_t nr;                        // Events in use
+    uint32_t flags;                     // PERF_GROUP_*
+    uint32_t events[PERF_MAX_COUNTERS]; // PERF_EVENT_*
+    uint64_t counts[PERF_MAX_COUNTERS]; // Totals folded in so far
+    volatile int enabled;               // Counting while attached tasks run
+    uint32_t refs;                      // Creator plus each attached task
+};
+
+/**
+ * PMU discovery on the boot CPU, and on each CPU as it comes up
+ */
+void perf_init(void);
+void perf_cpu_init(void);
+
+/**
+ * Counters available to a group, 0 without a usable PMU
+ */
+uint32_t perf_num_counters(void);
+
+/**
+ * Name of an event ("cycles", "cache-misses"...), and whether this PMU
+ * can count it
+ */
+const char *perf_event_name(uint32_t event);
+int perf_event_supported(uint32_t event);
+
+/**
+ * Create a group counting events[0..nr-1], stopped and with no tasks
+ * @return The group, holding one reference, or NULL if there is no PMU,
+ *         too many events or one this PMU cannot count
+ */
+struct perf_group *perf_group_create(const uint32_t *events, uint32_t nr, uint32_t flags);
+
+/**
+ * Drop a reference; the group is freed with the last one
+ */
+void perf_group_put(struct perf_group *group);
+
+/**
+ * Start and stop counting. Attached tasks running on other CPUs follow
+ * at their next switch or tick.
+ */
+void perf_group_enable(struct perf_group *group);
+void perf_group_disable(struct perf_group *group);
+
+/**
+ * Read the totals into counts[0..nr-1]. Includes the calling CPU's live
+ * counts; other CPUs' are folded in at their next switch or tick.
+ */
+void perf_group_read(struct perf_group *group, uint64_t *counts);
+
+/**
+ * Attach the calling task to group, or detach it. A task counts into at
+ * most one group; attaching replaces the previous one.
+ * @return 0 on success, -1 if there is no current task
+ */
+int perf_attach_current(struct perf_group *group);
+void perf_detach_current(void);
+
+// Scheduler hooks, called with the CPU's run queue locked
+void perf_switch(struct task *prev, struct task *next);
+void perf_tick(struct task *current);
+
+// Task lifetime hooks (process.c)
+void perf_task_fork(struct task *parent, struct task *child);
+void perf_task_free(struct task *task);
+
+// PMU access (architecture-specific), on the calling CPU only
+uint32_t arch_pmu_cpu_init(void);       // Counters, 0 without a PMU
+int arch_pmu_event_supported(uint32_t event);
+void arch_pmu_program(uint32_t counter, uint32_t event);
+uint64_t arch_pmu_read(uint32_t counter);
+uint64_t arch_pmu_counter_mask(void);   // Counter width as a mask
+void arch_pmu_start(uint32_t counters); // Bit per counter
+void arch_pmu_stop(void);               // Event counters only
+
+/**
+ * Sample with profile_sample() every period CPU cycles, from the PMU's
+ * overflow interrupt, on a counter apart from the ones groups use
+ * @return 0 on success, -1 if this PMU cannot
+ */
+int arch_pmu_sample_start(uint64_t period);
+void arch_pmu_sample_stop(void);
+
+#endif /* PERF_H */
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "spinlock.h"
+#include "sched_attr.h"
+#include "percpu.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,9 +22,40 @@ extern "C" {
 #define PRIORITY_NORMAL         1
 #define PRIORITY_LOW            2
 #define PRIORITY_IDLE           3
+#define PRIORITY_LEVELS         (PRIORITY_IDLE + 1)
 
-// Maximum number of tasks
-#define MAX_TASKS               32
+// Scheduling classes. Deadline tasks run ahead of RT tasks, which run
+// ahead of fixed-priority tasks at PRIORITY_HIGH..LOW, which run ahead of
+// fair tasks; PRIORITY_IDLE fixed tasks only run when no fair task is
+// runnable.
+#define SCHED_CLASS_FIXED       0       // Kernel threads: priority + round-robin
+#define SCHED_CLASS_FAIR        SCHED_POLICY_FAIR       // Weighted virtual runtime
+#define SCHED_CLASS_RT          SCHED_POLICY_FIFO       // FIFO per priority, no slice
+#define SCHED_CLASS_DEADLINE    SCHED_POLICY_DEADLINE   // EDF with runtime budgets
+
+// Real-time classes (sched_rt.c). Their tasks are kept on the boot CPU,
+// whose tick and timers enforce budgets and preempt straight away.
+#define SCHED_RT_CPU            0
+#define RT_PRIO_LEVELS          SCHED_RT_PRIO_MAX
+#define DL_BW_SHIFT             20      // Bandwidth fixed point: 1 << 20 is a whole CPU
+
+// Fair class tuning, in timer ticks
+#define NICE_MIN                (-20)
+#define NICE_MAX                19
+#define FAIR_NICE_0_WEIGHT      1024
+#define FAIR_LATENCY_TICKS      20      // Period in which every fair task runs once
+#define FAIR_MIN_GRANULARITY    2       // Shortest fair slice
+#define FAIR_WAKEUP_CREDIT      (FAIR_LATENCY_TICKS / 2)   // Sleeper boost
+
+// Where a task's CPU time went, charged in CNTVCT/TSC ticks at every
+// switch and kernel entry or exit
+#define CPU_TIME_USER           0
+#define CPU_TIME_SYSTEM         1       // System calls, faults and its kernel code
+#define CPU_TIME_IRQ            2       // Interrupts taken while it ran
+#define CPU_TIME_KINDS          3
+
+// Maximum number of live tasks; structs and stacks are allocated on demand
+#define MAX_TASKS               1024
 
 // CPU context structure (architecture-specific parts defined in arch headers)
 struct cpu_context {
@@ -34,7 +68,7 @@ struct cpu_context {
     uint64_t sp_el0, sp_el1;
     uint64_t elr_el1;
     uint64_t spsr_el1;
-    uint64_t ttbr0_el1;
+    uint64_t ttbr0_el1;                 // Unused: see aspace_switch()
     uint64_t ttbr1_el1;
 #elif defined(__x86_64__)
     // x86-64 context - Ring 0/Ring 3 registers
@@ -44,10 +78,25 @@ struct cpu_context {
     uint64_t r12, r13, r14, r15;
     uint64_t rip, rflags;
     uint64_t cs, ss, ds, es, fs, gs;
-    uint64_t cr3;  // Page directory base
+    uint64_t cr3;  // Unused: see aspace_switch()
 #endif
 };
 
+// FP/SIMD register file, saved only for tasks that use it
+struct fp_state {
+#ifdef __aarch64__
+    uint64_t v[64];                    // q0-q31
+    uint64_t fpsr;
+    uint64_t fpcr;
+#elif defined(__x86_64__)
+    uint8_t fxsave[512];               // FXSAVE image (x87 + SSE)
+#endif
+} __attribute__((aligned(16)));
+
+struct fd_table;
+struct address_space;
+struct perf_group;
+
 // Task control block
 struct task {
     uint32_t pid;                       // Process ID
@@ -63,28 +112,92 @@ struct task {
     
     // CPU context
     struct cpu_context context;         // Saved CPU state
+    struct address_space *aspace;       // NULL: the kernel address space
+    struct fp_state fp;                 // Saved FP/SIMD state, valid if fp_used
+    uint32_t fp_used;                   // Has touched FP/SIMD since creation
     
     // Scheduling
+    uint32_t sched_class;              // SCHED_CLASS_*
+    int32_t nice;                      // Fair class: NICE_MIN..NICE_MAX
+    uint32_t weight;                   // Fair class: load weight from nice
+    uint32_t heap_index;               // Fair class: slot in the rq's heap
+    uint64_t vruntime;                 // Fair class: weighted runtime
     uint64_t time_slice;               // Remaining time slice
+    uint32_t rt_priority;              // RT class: SCHED_RT_PRIO_MIN..MAX
+    uint32_t dl_throttled;             // Deadline class: out of budget until replenished
+    uint64_t dl_runtime;               // Deadline class, in us: budget per period
+    uint64_t dl_deadline;              //   relative deadline
+    uint64_t dl_period;                //   period
+    uint64_t dl_abs_deadline;          //   current deadline, the EDF key
+    int64_t dl_budget;                 //   runtime left before it
+    uint64_t dl_exec_start;            //   when the budget was last charged
+    uint32_t dl_timer;                 //   enforcement/replenishment, 0 until set
     uint64_t total_runtime;            // Total runtime
+    uint64_t cpu_time[CPU_TIME_KINDS]; // Counter ticks spent, by CPU_TIME_*
     uint64_t last_scheduled;           // Last schedule time
+    uint64_t wake_time_us;             // When it last became runnable, 0 if unmeasured
+    uint64_t switches;                 // Times switched in
     
     // Task list management
     struct task *next;                 // Next task in queue
     struct task *prev;                 // Previous task in queue
+    uint32_t on_run_queue;             // Linked into a run queue
+    uint32_t cpu;                      // CPU whose run queue owns the task
+    
+    // Entry point, called by scheduler_task_entry() on first switch-in
+    void (*entry)(void *arg);
+    void *entry_arg;
+    
+    // Open files
+    struct fd_table *files;            // Cloned from the creator's table
+    struct io_ring_ctx *io_ring;       // Batched I/O ring, NULL until set up
+    
+    // Wakeup timer for timed sleeps, 0 until first used
+    uint32_t sleep_timer;
+
+    // Hardware counter group it counts into, NULL for none (perf.c)
+    struct perf_group *perf;
     
     // Exit status
     int exit_code;                     // Exit code when terminated
+
+    // Lifetime: PID hash linkage and references (see task_put())
+    struct task *pid_next;
+    uint32_t pid_hashed;
+    uint32_t refs;
+};
+
+// Scheduling latency samples, in microseconds
+struct sched_latency {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
 };
 
-// Scheduler structure
+// Scheduler structure (one per CPU), in cache lines of its own so one
+// CPU's statistics never share a line with the next one's lock
 struct scheduler {
-    struct task *current_task;         // Currently running task
-    struct task *ready_queue;          // Ready task queue
-    struct task *blocked_queue;        // Blocked task queue
+    spinlock_t lock;                   // Protects the fields below
+    uint32_t cpu;                      // Owning CPU
+    struct task *current_task;         // Currently running task (never queued), NULL when idle
+    struct task *run_queue[PRIORITY_LEVELS];  // Circular ready lists per priority
+    uint32_t ready_bitmap;            // Bit per non-empty run queue
+    uint32_t nr_running;              // Tasks on the run queues
+    struct task **fair_heap;          // Fair tasks, min-heap on vruntime (MAX_TASKS slots)
+    uint32_t fair_count;              // Tasks in fair_heap
+    uint64_t fair_weight;             // Sum of their weights
+    uint64_t min_vruntime;            // Monotonic floor for placing tasks
+    struct task *rt_queue[RT_PRIO_LEVELS];  // RT class: circular FIFO lists per priority
+    uint32_t rt_bitmap;               // Bit per non-empty RT list
+    struct task *dl_queue;            // Deadline class: earliest deadline first
+    uint32_t rt_count;                // Tasks on rt_queue and dl_queue
+    struct task *reap_list;           // Terminated tasks awaiting cleanup
+    volatile uint32_t need_resched;   // Switch at the next interrupt return
+    uint64_t resched_time_us;         // When need_resched was raised
+    uint64_t account_stamp;           // Counter when current was last charged
+    struct task idle;                 // Saved context of the CPU's idle loop
     
-    uint32_t num_tasks;               // Total number of tasks
-    uint32_t next_pid;                // Next available PID
+    uint32_t num_tasks;               // Tasks owned by this CPU
     
     uint64_t tick_count;              // Scheduler tick counter
     uint32_t time_slice_quantum;      // Time slice length (in timer ticks)
@@ -92,18 +205,59 @@ struct scheduler {
     // Statistics
     uint64_t context_switches;        // Number of context switches
     uint64_t total_ticks;             // Total scheduler ticks
+    uint64_t steals;                  // Tasks pulled from other CPUs
+    struct sched_latency preempt_latency;  // need_resched raised -> switch
+    struct sched_latency wakeup_latency;   // Task runnable -> running
+    struct sched_latency rt_latency;       // The same, for RT and deadline tasks
+    uint64_t dl_throttles;            // Deadline tasks that ran out of budget
+    uint64_t dl_overruns;             // ...after their deadline had passed
+} __cacheline_aligned;
+
+struct wait_entry;
+
+// Called by wake_up() with the queue locked and interrupts off
+typedef void (*wait_func_t)(struct wait_entry *entry);
+
+// Wait queue entry, on the sleeping task's stack. An entry with func set
+// is a watcher instead: it stays queued across wakeups and is called on
+// each one, until wait_queue_remove().
+struct wait_entry {
+    struct task *task;                 // Sleeping task
+    struct wait_entry *next;
+    struct wait_entry *prev;
+    uint32_t queued;                   // Linked on a queue
+    wait_func_t func;                  // Watcher callback, NULL for a sleeper
+    void *private;                     // For func
+};
+
+// Tasks sleeping until an event, oldest first
+struct wait_queue {
+    spinlock_t lock;
+    struct wait_entry *head;
+    struct wait_entry *tail;
 };
 
+#define WAIT_QUEUE_INIT     { SPINLOCK_INIT, NULL, NULL }
+#define WAIT_ENTRY_INIT     { NULL, NULL, NULL, 0, NULL, NULL }
+
 // Function pointers for task entry points
 typedef void (*task_entry_t)(void *arg);
 
 // Process management functions
 int process_init(void);
 int process_create(task_entry_t entry, void *arg, const char *name, uint32_t priority);
+int process_create_stack(task_entry_t entry, void *arg, const char *name,
+                         uint32_t priority, size_t stack_size);
+int process_create_fair(task_entry_t entry, void *arg, const char *name, int nice);
+int process_create_user(task_entry_t entry, void *arg, const char *name, int nice,
+                        struct address_space *aspace);
+int process_create_attr(task_entry_t entry, void *arg, const char *name,
+                        const struct sched_attr *attr);
 void process_yield(void);
 void process_sleep(uint64_t ticks);
 void process_exit(int exit_code);
 int process_kill(uint32_t pid);
+int process_adopt_current(const char *name);
 
 // User program support (Phase 7)
 int process_fork(void);
@@ -113,20 +267,140 @@ int process_spawn(const char *path, int argc, char *argv[]);
 
 // Scheduler functions
 void scheduler_init(void);
+void scheduler_cpu_init(uint32_t cpu);
+void scheduler_idle_loop(void) __attribute__((noreturn));
+struct scheduler *scheduler_this_cpu(void);
+void scheduler_get_totals(uint64_t *context_switches, uint64_t *ticks);
+void scheduler_task_entry(void *arg);
 void scheduler_tick(void);
+void scheduler_schedule(void);
+void scheduler_irq_exit(void);
+
+/**
+ * Charge the running task for the counter ticks since it was last
+ * charged, on kernel entry (as user time if it came from user mode) and
+ * on exit (as time in the interrupt, or in the call or fault)
+ */
+void scheduler_account_entry(int from_user);
+void scheduler_account_exit(int irq);
+int scheduler_adopt_current(struct task *task);
+void scheduler_get_latency(struct sched_latency *preempt, struct sched_latency *wakeup,
+                           struct sched_latency *rt);
 void scheduler_start(void);
 struct task *scheduler_get_current_task(void);
 struct task *scheduler_pick_next_task(void);
 void scheduler_switch_to_task(struct task *task);
 void scheduler_add_task(struct task *task);
 void scheduler_remove_task(struct task *task);
+void scheduler_wake_task(struct task *task);
+void scheduler_terminate_task(struct task *task);
+
+/**
+ * Move a task to the class attr describes, with its parameters. A
+ * deadline task must pass admission control; RT and deadline tasks move to
+ * SCHED_RT_CPU the next time they wake, if they are elsewhere.
+ * @return 0 on success, -1 for bad parameters or a dead task, -2 if the
+ *         deadline bandwidth is already taken, -3 without memory
+ */
+int scheduler_setattr(struct task *task, const struct sched_attr *attr);
+
+// Wait queues (wait.c)
+void wait_queue_init(struct wait_queue *wq);
+int wait_prepare(struct wait_queue *wq, struct wait_entry *entry);
+void wait_finish(struct wait_queue *wq, struct wait_entry *entry);
+void wait_queue_add(struct wait_queue *wq, struct wait_entry *entry);
+void wait_queue_remove(struct wait_queue *wq, struct wait_entry *entry);
+void wait_schedule_timeout(uint64_t timeout_us);
+int wait_schedule_until(uint64_t deadline_us);
+uint64_t wait_deadline(uint64_t timeout_us);
+void wait_release_task(struct task *task);
+uint32_t wake_up(struct wait_queue *wq);
+uint32_t wake_up_one(struct wait_queue *wq);
+
+/*
+ * Sleep on wq until condition holds; a caller without a task spins
+ * instead. condition is re-evaluated after every wakeup.
+ */
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        struct wait_entry __wait = WAIT_ENTRY_INIT;                 \
+        while (!(condition)) {                                      \
+            if (wait_prepare((wq), &__wait) < 0) {                  \
+                cpu_relax();                                        \
+                continue;                                           \
+            }                                                       \
+            if (condition) break;                                   \
+            scheduler_schedule();                                   \
+        }                                                           \
+        wait_finish((wq), &__wait);                                 \
+    } while (0)
+
+// As wait_event(), giving up after timeout_us; the caller rechecks condition
+#define wait_event_timeout(wq, condition, timeout_us)               \
+    do {                                                            \
+        struct wait_entry __wait = WAIT_ENTRY_INIT;                 \
+        uint64_t __deadline = wait_deadline(timeout_us);            \
+        while (!(condition)) {                                      \
+            if (wait_prepare((wq), &__wait) < 0) {                  \
+                if (wait_deadline(0) >= __deadline) break;          \
+                cpu_relax();                                        \
+                continue;                                           \
+            }                                                       \
+            if (condition) break;                                   \
+            if (wait_schedule_until(__deadline) < 0) break;         \
+        }                                                           \
+        wait_finish((wq), &__wait);                                 \
+    } while (0)
+
+// Fair class run queue (sched_fair.c); callers hold rq->lock
+uint32_t fair_nice_to_weight(int nice);
+void fair_enqueue(struct scheduler *rq, struct task *task);
+void fair_dequeue(struct scheduler *rq, struct task *task);
+struct task *fair_peek(struct scheduler *rq);
+void fair_place(struct scheduler *rq, struct task *task, int wakeup);
+void fair_update_min_vruntime(struct scheduler *rq);
+void fair_account(struct task *task, uint64_t ticks);
+uint64_t fair_time_slice(struct scheduler *rq, struct task *task);
+int fair_should_preempt(struct scheduler *rq, struct task *current);
+
+// RT and deadline classes (sched_rt.c); callers hold rq->lock except for
+// the parameter checks and the bandwidth, which has a lock of its own
+void rt_enqueue(struct scheduler *rq, struct task *task, int head);
+void rt_dequeue(struct scheduler *rq, struct task *task);
+struct task *rt_peek(struct scheduler *rq);
+int rt_should_preempt(struct task *task, struct task *current);
+int rt_check_attr(const struct sched_attr *attr);
+uint64_t dl_bandwidth(uint64_t runtime_us, uint64_t period_us);
+int dl_bw_change(uint64_t old_bw, uint64_t new_bw);
+uint64_t dl_bw_total(void);
+void dl_wakeup(struct task *task, uint64_t now_us);
+int dl_charge(struct task *task, uint64_t now_us);
+uint64_t dl_replenish_time(struct task *task);
+void dl_replenish(struct task *task, uint64_t now_us);
+
+// Lazy FP/SIMD switching (fpu.c). A task's state is only loaded when it
+// first touches FP/SIMD in a slice, and only saved if it did.
+void fpu_switch_out(struct task *prev);
+void fpu_trap(void);
+
+// FP/SIMD access control and state transfer (architecture-specific)
+void arch_fp_cpu_init(void);
+int arch_fp_enabled(void);
+void arch_fp_enable(void);
+void arch_fp_disable(void);
+void arch_fp_save(struct fp_state *fp);
+void arch_fp_restore(const struct fp_state *fp);
+void arch_fp_reset(void);
 
 // Context switching (architecture-specific)
 void context_switch(struct cpu_context *old_ctx, struct cpu_context *new_ctx);
+int arch_context_save(struct cpu_context *ctx);  // 0, or 1 when resumed
 void arch_setup_task_context(struct cpu_context *ctx, task_entry_t entry, void *arg, void *stack_top);
 
 // Task management utilities
 struct task *task_find_by_pid(uint32_t pid);
+struct task *task_get_by_pid(uint32_t pid);
+void task_put(struct task *task);
 void task_dump_info(struct task *task);
 void scheduler_dump_info(void);
 
@@ -136,6 +410,8 @@ void init_task(void *arg);
 
 // Stack management
 #define TASK_STACK_SIZE    8192        // Default task stack size (8KB)
+#define TASK_STACK_MIN_SIZE 4096       // Smallest stack process_create_stack() gives
+#define TASK_STACK_MAGIC   0x57AC6E5D57AC6E5DULL  // Lowest word of every stack
 void *allocate_task_stack(size_t size);
 void free_task_stack(void *stack_base, size_t size);
 
@@ -147,10 +423,18 @@ struct process_stats {
     uint64_t context_switches;
     uint64_t scheduler_ticks;
     uint32_t current_pid;
+    struct sched_latency preempt_latency;
+    struct sched_latency wakeup_latency;
+    struct sched_latency rt_latency;
 };
 
 int process_get_stats(struct process_stats *stats);
 
+// Copy up to max task records (sysinfo.h) in one hold of the task lock;
+// returns the number of live tasks, which may be more than were copied
+struct sysinfo_task;
+uint32_t process_snapshot(struct sysinfo_task *tasks, uint32_t max);
+
 #ifdef __cplusplus
 }
 #endif
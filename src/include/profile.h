@@ -0,0 +1,86 @@
+/*
+ * MiniOS Sampling Profiler
+ *
+ * Records where the CPU was each time a sampling interrupt arrives: the
+ * scheduler tick, or on ARM64 a PMU cycle counter overflow for finer
+ * grain. Each sample is the interrupted PC and, on request, the return
+ * addresses found by walking the frame pointer chain, kept in a ring per
+ * CPU. The report aggregates them by function through the built-in
+ * kernel symbol table (ksyms.h).
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "kernel.h"
+#include "interrupt.h"
+
+#define PROFILE_MAX_DEPTH           6       // Return addresses per sample
+#define PROFILE_RING_SAMPLES        4096    // Per CPU; the oldest are overwritten
+
+// Sample sources
+#define PROFILE_SOURCE_TIMER        0       // Every scheduler tick
+#define PROFILE_SOURCE_CYCLES       1       // Every period CPU cycles (PMU)
+
+#define PROFILE_DEFAULT_PERIOD      1000000 // Cycles between PMU samples
+
+// Start flags
+#define PROFILE_BACKTRACE           0x0001  // Walk frame pointers too
+
+// Report entries that are not kernel functions
+#define PROFILE_SYM_USER            (-1)    // Interrupted in user mode
+#define PROFILE_SYM_UNKNOWN         (-2)    // Kernel address with no symbol
+
+struct profile_sample {
+    uintptr_t pc;
+    uint16_t depth;                     // Valid entries in frames[]
+    uint16_t user;                      // Taken from user mode
+    uintptr_t frames[PROFILE_MAX_DEPTH];// Return addresses, innermost first
+};
+
+struct profile_entry {
+    int32_t symbol;                     // ksyms index or PROFILE_SYM_*
+    uint32_t self;                      // Samples in this function
+    uint32_t total;                     // Samples with it anywhere on the stack
+};
+
+struct profile_summary {
+    uint32_t source;                    // PROFILE_SOURCE_*
+    uint32_t flags;                     // PROFILE_BACKTRACE
+    uint64_t period;                    // Cycles, for PROFILE_SOURCE_CYCLES
+    uint64_t samples;                   // Taken, all CPUs
+    uint64_t overwritten;               // Lost to ring wraparound
+};
+
+/**
+ * Clear the rings and start sampling
+ * @param period Cycles between samples for PROFILE_SOURCE_CYCLES
+ * @return 0 on success, -1 if already running, out of memory or the
+ *         source is not available here
+ */
+int profile_start(uint32_t source, uint64_t period, uint32_t flags);
+
+/**
+ * Stop sampling; the samples stay until the next start
+ */
+void profile_stop(void);
+
+int profile_running(void);
+
+/**
+ * Aggregate the samples by function, most self samples first
+ * @param entries Set to a kmalloc()ed array the caller frees, or NULL if
+ *                there are no samples
+ * @return Number of entries, or -1 while running or out of memory
+ */
+int profile_report(struct profile_entry **entries, struct profile_summary *summary);
+
+/**
+ * Take a sample of the interrupted context, from interrupt handlers
+ */
+void profile_sample(const struct irq_regs *regs);
+
+// Scheduler tick hook (timer.c)
+void profile_tick(void);
+
+#endif /* PROFILE_H */
@@ -13,6 +13,9 @@ extern "C" {
 #define RAMFS_MAX_NAME       255
 #define RAMFS_MAX_FILES      256
 #define RAMFS_MAX_FILE_SIZE  (64 * 1024)  // 64KB max file size for now
+#define RAMFS_CHUNK_SIZE     4096         // File data allocation unit
+#define RAMFS_MIN_CHUNK_SLOTS 4           // Initial chunk table entries
+#define RAMFS_MIN_INDEX_SLOTS 8           // Initial directory hash table entries
 
 // RAMFS node structure (file or directory)
 struct ramfs_node {
@@ -20,10 +23,17 @@ struct ramfs_node {
     uint32_t mode;                        // File type and permissions
     uint32_t size;                        // File size
     uint32_t ino;                         // Inode number
-    void *data;                           // File data (for files)
+    void **chunks;                        // File data in RAMFS_CHUNK_SIZE pieces, NULL = zeros
+    uint32_t chunk_slots;                 // Entries in chunks
     struct ramfs_node *parent;            // Parent directory
     struct ramfs_node *children;          // First child (for directories)
     struct ramfs_node *next;              // Next sibling
+    struct ramfs_node *prev;              // Previous sibling, NULL for the first
+    struct ramfs_node **child_index;      // Open-addressing table of children
+    uint32_t child_slots;                 // Table size, a power of two
+    uint32_t child_used;                  // Live entries plus tombstones
+    uint32_t child_count;                 // Live entries
+    uint32_t name_hash;                   // Hash of name, for the parent's table
     uint32_t created_time;
     uint32_t modified_time;
     uint32_t accessed_time;
@@ -59,6 +69,9 @@ int ramfs_create_file(struct file_system *fs, const char *path, uint32_t mode);
 int ramfs_delete_file(struct file_system *fs, const char *path);
 ssize_t ramfs_read_file(struct file *file, void *buf, size_t count, off_t offset);
 ssize_t ramfs_write_file(struct file *file, const void *buf, size_t count, off_t offset);
+ssize_t ramfs_node_read(struct ramfs_node *node, void *buf, size_t count, off_t offset);
+ssize_t ramfs_node_write(struct ramfs_node *node, const void *buf, size_t count, off_t offset);
+void ramfs_node_truncate(struct ramfs_node *node, uint32_t size);
 
 // RAMFS directory operations
 int ramfs_create_directory(struct file_system *fs, const char *path, uint32_t mode);
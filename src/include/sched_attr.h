@@ -0,0 +1,45 @@
+/*
+ * MiniOS Scheduling Attributes
+ *
+ * The argument of SYSCALL_SCHED_SETATTR, which moves a task between the
+ * fair, FIFO and deadline classes. Shared with minios_libc, so it only
+ * depends on <stdint.h>.
+ *
+ * A FIFO task runs ahead of every fair and kernel task until it blocks or
+ * yields, and is only preempted by a deadline task or a higher FIFO
+ * priority. A deadline task is given runtime_us of CPU in every period_us,
+ * to be used by deadline_us after the period starts; deadline tasks run
+ * earliest deadline first, ahead of FIFO tasks. One that overruns its
+ * runtime waits for its next period, and a new one is refused if it would
+ * take the reserved share of all of them past SCHED_DL_BANDWIDTH_PERCENT.
+ */
+
+#ifndef SCHED_ATTR_H
+#define SCHED_ATTR_H
+
+#include <stdint.h>
+
+// Policies, the same numbers as the kernel's SCHED_CLASS_*
+#define SCHED_POLICY_FAIR       1       // nice
+#define SCHED_POLICY_FIFO       2       // rt_priority
+#define SCHED_POLICY_DEADLINE   3       // runtime_us, deadline_us, period_us
+
+#define SCHED_RT_PRIO_MIN       1
+#define SCHED_RT_PRIO_MAX       32      // Runs first
+
+// Deadline parameter limits; 0 < runtime <= deadline <= period
+#define SCHED_DL_MIN_RUNTIME_US 1000        // Budgets are enforced to the ms
+#define SCHED_DL_MAX_PERIOD_US  10000000
+#define SCHED_DL_BANDWIDTH_PERCENT 90       // Of the CPU, over all deadline tasks
+
+struct sched_attr {
+    uint32_t policy;                    // SCHED_POLICY_*
+    int32_t nice;                       // Fair: NICE_MIN..NICE_MAX
+    uint32_t rt_priority;               // FIFO: SCHED_RT_PRIO_MIN..MAX
+    uint32_t reserved;
+    uint64_t runtime_us;                // Deadline: CPU per period
+    uint64_t deadline_us;               // Deadline: from the period's start
+    uint64_t period_us;
+};
+
+#endif /* SCHED_ATTR_H */
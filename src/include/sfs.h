@@ -5,6 +5,7 @@
 #include "kernel.h"
 #include "vfs.h"
 #include "block_device.h"
+#include "sleeplock.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,7 +14,10 @@ extern "C" {
 // SFS (Simple File System) constants
 #define SFS_MAGIC           0x53465300      // "SFS\0"
 #define SFS_VERSION         1
-#define SFS_BLOCK_SIZE      4096
+#define SFS_DEFAULT_BLOCK_SIZE 4096      // Block size chosen at format time
+#define SFS_MIN_BLOCK_SIZE  1024
+#define SFS_MAX_BLOCK_SIZE  65536
+#define SFS_SUPERBLOCK_SIZE 4096        // Front of block 0, or all of a smaller one
 #define SFS_MAX_NAME        255
 #define SFS_MAX_PATH        1024
 
@@ -25,7 +29,59 @@ extern "C" {
 
 // SFS inode constants
 #define SFS_DIRECT_BLOCKS       12          // Number of direct block pointers
-#define SFS_INODES_PER_BLOCK    (SFS_BLOCK_SIZE / sizeof(struct sfs_inode))
+
+// SFS mount flags
+#define SFS_MOUNT_SYNC_METADATA 0x0001      // Write bitmap and superblock on every change
+
+// Superblock feature flags
+#define SFS_FEATURE_EXTENTS     0x0001      // New files are extent mapped
+#define SFS_FEATURE_DIR_INDEX   0x0002      // Growing directories switch to a hashed index
+#define SFS_FEATURE_INODE_BITMAP 0x0004     // Inode bitmap between block bitmap and inode table
+#define SFS_FEATURE_JOURNAL     0x0008      // Metadata journal between inode table and data
+#define SFS_FEATURE_LAZY_ITABLE 0x0010      // Inode table groups zeroed on first use
+#define SFS_FEATURE_INLINE_DATA 0x0020      // Tiny regular files live in their inode
+#define SFS_FEATURE_METADATA_CSUM 0x0040    // CRC32C on superblock, bitmaps, inode table, directories
+#define SFS_FEATURES_SUPPORTED  (SFS_FEATURE_EXTENTS | SFS_FEATURE_DIR_INDEX | \
+                                 SFS_FEATURE_INODE_BITMAP | SFS_FEATURE_JOURNAL | \
+                                 SFS_FEATURE_LAZY_ITABLE | SFS_FEATURE_INLINE_DATA | \
+                                 SFS_FEATURE_METADATA_CSUM)
+
+// Lazy inode table (SFS_FEATURE_LAZY_ITABLE): format zeroes only the
+// group holding the root inode and marks the rest in the superblock
+#define SFS_ITABLE_MAX_GROUPS   1024        // Bits in sfs_superblock.itable_uninit
+#define SFS_ITABLE_MIN_GROUP    16          // Fewest inode table blocks per group
+#define SFS_ITABLE_INIT_PER_PASS 4          // Groups the flusher zeroes per pass
+
+// Metadata checksums (SFS_FEATURE_METADATA_CSUM): CRC32C seeded with the
+// block number. The superblock, inode table blocks and directory blocks
+// keep theirs in their last four bytes; bitmap blocks are full, so theirs
+// are in the superblock, which the filesystem must then fit. Superblocks
+// of blocks under 4KB have room for fewer; see sfs_csum_max_bitmaps().
+#define SFS_CSUM_MAX_BITMAPS    512         // Block and inode bitmap blocks together
+
+// Inode flags
+#define SFS_INODE_EXTENTS       0x0001      // Block pointers hold extents
+#define SFS_INODE_DIR_INDEX     0x0002      // Directory block 0 is a hash index
+#define SFS_INODE_INLINE        0x0004      // Block pointer area holds the file's data
+
+// Bytes of file data an inline inode holds: the whole block pointer area
+#define SFS_INLINE_DATA_SIZE    ((SFS_DIRECT_BLOCKS + 1) * sizeof(uint32_t))
+
+// SFS journal constants
+#define SFS_JOURNAL_MAGIC       0x53464A53  // "SFJS", journal header
+#define SFS_JOURNAL_DESC_MAGIC  0x53464A44  // "SFJD", transaction descriptor
+#define SFS_JOURNAL_COMMIT_MAGIC 0x53464A43 // "SFJC", transaction commit
+#define SFS_JOURNAL_MIN_BLOCKS  64
+#define SFS_JOURNAL_MAX_BLOCKS  1024
+#define SFS_JOURNAL_REVOKE      0x80000000  // Tag flag: block is revoked, nothing logged
+
+// SFS extent constants
+#define SFS_INLINE_EXTENTS      4           // Extents stored in the inode itself
+#define SFS_EXTENT_SPREAD       32          // Free blocks left ahead of a new extent
+
+// SFS hashed directory constants
+#define SFS_DIR_INDEX_MAGIC     0x53464449  // "SFDI"
+#define SFS_DIR_LEAF_MAGIC      0x5346444C  // "SFDL"
 
 // File types
 #define SFS_TYPE_FILE           0x1000
@@ -54,22 +110,53 @@ struct sfs_superblock {
     uint32_t modified_time;                 // Last modification time
     uint32_t mount_count;                   // Number of times mounted
     char label[32];                         // Volume label
-    uint8_t reserved[SFS_BLOCK_SIZE - 88];  // Reserved space
+    uint32_t features;                      // SFS_FEATURE_* flags
+    uint32_t inode_bitmap_blocks;           // Inode bitmap blocks (SFS_FEATURE_INODE_BITMAP)
+    uint32_t journal_start;                 // Journal header block (SFS_FEATURE_JOURNAL)
+    uint32_t journal_blocks;                // Journal size, header included
+    uint32_t itable_group_blocks;           // Inode table blocks per group (SFS_FEATURE_LAZY_ITABLE)
+    uint8_t itable_uninit[SFS_ITABLE_MAX_GROUPS / 8]; // Set: group not yet zeroed on disk
+    uint32_t bitmap_csum[SFS_CSUM_MAX_BITMAPS]; // Block then inode bitmap blocks (SFS_FEATURE_METADATA_CSUM)
+    uint8_t reserved[SFS_SUPERBLOCK_SIZE - 108 - SFS_ITABLE_MAX_GROUPS / 8 -
+                     SFS_CSUM_MAX_BITMAPS * 4 - 4]; // Reserved space
+    uint32_t checksum;                      // Over everything before it
+};
+
+// SFS extent: a run of contiguous device blocks backing file blocks
+struct sfs_extent {
+    uint32_t logical;                       // First file block covered
+    uint32_t start;                         // First device block
+    uint32_t length;                        // Blocks in the run, | SFS_EXTENT_UNWRITTEN
 };
 
+// Extent length flag: preallocated blocks that read as zeros until written
+#define SFS_EXTENT_UNWRITTEN    0x80000000U
+
 // SFS inode structure
 struct sfs_inode {
     uint32_t mode;                          // File type and permissions
     uint32_t size;                          // File size in bytes
     uint32_t blocks;                        // Number of blocks allocated
-    uint32_t direct[SFS_DIRECT_BLOCKS];     // Direct block pointers
-    uint32_t indirect;                      // Single indirect block pointer
+    union {
+        struct {
+            uint32_t direct[SFS_DIRECT_BLOCKS];     // Direct block pointers
+            uint32_t indirect;                      // Single indirect block pointer
+        };
+        struct {
+            struct sfs_extent extents[SFS_INLINE_EXTENTS]; // Sorted by logical block
+            uint32_t extent_block;                  // Block holding further extents
+        };
+        uint8_t inline_data[SFS_INLINE_DATA_SIZE];  // File data (SFS_INODE_INLINE)
+    };
     uint32_t created_time;                  // Creation timestamp
     uint32_t modified_time;                 // Last modification timestamp
     uint32_t accessed_time;                 // Last access timestamp
     uint32_t links;                         // Number of hard links
     uint32_t flags;                         // Inode flags
-    uint8_t reserved[SFS_BLOCK_SIZE / 64 - 60]; // Reserved space to fill cache line
+    union {
+        uint32_t double_indirect;           // Double indirect block pointer
+        uint32_t extent_count;              // Extents in use (SFS_INODE_EXTENTS)
+    };
 };
 
 // SFS directory entry structure
@@ -80,12 +167,186 @@ struct sfs_dirent {
     char name[SFS_MAX_NAME];                // Filename (null-terminated)
 };
 
+// Block 0 of an indexed directory. Buckets are selected by the low
+// 'depth' bits of the name hash and hold the directory block number of
+// their leaf; several buckets may share one leaf (extendible hashing).
+// The block size bounds the depth: 9 (512 buckets) at 4KB.
+struct sfs_dir_index {
+    uint32_t magic;                         // SFS_DIR_INDEX_MAGIC
+    uint32_t depth;                         // Global depth: 1 << depth buckets in use
+    uint32_t leaf_blocks;                   // Leaves are directory blocks 1..leaf_blocks
+    uint32_t reserved;
+    uint32_t buckets[];                     // Up to 1 << dir_max_depth
+};
+
+// Trailer of an indexed directory leaf, in the slack after its dirents
+struct sfs_dir_leaf_tail {
+    uint32_t magic;                         // SFS_DIR_LEAF_MAGIC
+    uint32_t depth;                         // Hash bits shared by every entry in the leaf
+    uint32_t next;                          // Overflow leaf (only at maximum depth), 0 if none
+    uint32_t reserved;
+};
+
+// First block of the journal. Transactions follow it from the next block
+// on: a descriptor, the logged blocks in tag order, then a commit block.
+struct sfs_journal_header {
+    uint32_t magic;                         // SFS_JOURNAL_MAGIC
+    uint32_t blocks;                        // Journal size, header included
+    uint32_t sequence;                      // First transaction to replay
+    uint32_t reserved;
+};
+
+struct sfs_journal_descriptor {
+    uint32_t magic;                         // SFS_JOURNAL_DESC_MAGIC
+    uint32_t sequence;
+    uint32_t count;                         // Tags in use
+    uint32_t tags[];                        // Home block, or SFS_JOURNAL_REVOKE | block
+};
+
+struct sfs_journal_commit {
+    uint32_t magic;                         // SFS_JOURNAL_COMMIT_MAGIC
+    uint32_t sequence;
+    uint32_t checksum;                      // Over the descriptor and logged blocks
+    uint32_t blocks;                        // Blocks logged
+};
+
+// A block in the running transaction
+struct sfs_journal_block {
+    uint32_t block;                         // Home location
+    const void *data;                       // Logged from here at commit
+    struct block_buffer *buf;               // Held buffer, NULL for in-memory metadata
+};
+
+// Journal state of a mounted filesystem
+struct sfs_journal {
+    uint32_t start;                         // Header block
+    uint32_t blocks;                        // Journal size, header included
+    uint32_t head;                          // Next free log block, from the header
+    uint32_t sequence;                      // Sequence of the running transaction
+    uint32_t max_tags;                      // Blocks plus revokes per transaction
+    struct sfs_journal_block *running;      // Blocks in the running transaction
+    uint32_t running_count;
+    uint32_t *revokes;                      // Blocks revoked by the running transaction
+    uint32_t revoke_count;
+    uint32_t *logged;                       // Blocks logged since the last checkpoint
+    uint32_t logged_count;
+    uint32_t handles;                       // Operations in progress
+    volatile int commit_due;                // Set by the flusher when it met an operation
+    struct sfs_journal_descriptor *descriptor;
+    struct sfs_journal_commit *commit;      // A whole block, zero past the fields
+    uint64_t commits;
+    uint64_t checkpoints;
+};
+
+// In-memory inode cache
+#define SFS_ICACHE_BUCKETS      64          // Hash buckets (power of two)
+#define SFS_ICACHE_CAPACITY     128         // Cached inodes per mount
+
+// Cached copy of an on-disk inode, kept in step with the inode table
+struct sfs_icache_entry {
+    uint32_t inode_num;
+    struct sfs_inode inode;
+    struct sfs_icache_entry *hash_next;     // Bucket chain
+    struct sfs_icache_entry *lru_prev;      // Most recently used at the head
+    struct sfs_icache_entry *lru_next;
+};
+
+// Freed block runs waiting to be discarded once the free is durable
+#define SFS_DISCARD_BATCH       32
+
+struct sfs_discard_range {
+    uint32_t start;
+    uint32_t count;
+};
+
+// Layout that follows from the block size, worked out once per format,
+// mount or check so hot paths shift and mask instead of dividing
+struct sfs_geometry {
+    uint32_t block_size;                    // SFS_MIN_BLOCK_SIZE to SFS_MAX_BLOCK_SIZE
+    uint32_t block_shift;                   // File offset to block index
+    uint32_t block_mask;
+    uint32_t csum_offset;                   // Checksum word of a sealed block
+    uint32_t ptrs_per_block;                // Block numbers in a pointer block
+    uint32_t ptrs_shift;
+    uint32_t inodes_per_block;
+    uint32_t dirents_per_block;
+    uint32_t dir_tail_offset;               // Leaf tail, after the dirents
+    uint32_t dir_max_depth;                 // Index buckets that fit in a block, as bits
+    uint32_t extents_per_block;
+    uint32_t max_extents;                   // Inline ones included
+    uint32_t journal_tags;                  // Tags a descriptor block holds
+};
+
 // SFS filesystem private data
 struct sfs_fs_data {
     struct sfs_superblock superblock;       // Cached superblock
-    struct block_device *device;            // Block device
+    struct sfs_geometry geo;
+    struct block_device *device;            // Block device, or a view of it in SFS blocks
+    uint8_t *superblock_pad;                // Blocks over 4KB: superblock as a whole block
     uint8_t *block_bitmap;                  // Block allocation bitmap
     uint32_t bitmap_size;                   // Size of bitmap in bytes
+    uint64_t *bitmap_summary;               // One bit per bitmap word, set when the word is full
+    uint32_t summary_words;                 // Size of summary in 64-bit words
+    uint32_t next_free_block;               // Allocation cursor (next-fit hint)
+    uint8_t *bitmap_dirty;                  // One flag per bitmap block awaiting write-back
+    uint8_t *inode_bitmap;                  // Inode allocation bitmap, bit N for inode N + 1
+    uint8_t *inode_bitmap_dirty;            // One flag per inode bitmap block awaiting write-back
+    uint32_t next_free_inode;               // Inode allocation cursor (bit index)
+    uint32_t itable_uninit_groups;          // Inode table groups still to zero
+    int superblock_dirty;                   // Cached superblock differs from disk
+    int sync_metadata;                      // SFS_MOUNT_SYNC_METADATA was given
+    struct mutex update_lock;               // Held for journal handles: one update at a time
+    uint32_t update_depth;                  // Handles its holder has open
+    struct mutex alloc_lock;                // Bitmaps, summary, cursors, free counts, discards
+    spinlock_t icache_lock;                 // Inode cache hash, LRU and counts
+    spinlock_t itable_lock;                 // Inode table blocks while checked or resealed
+    struct sfs_journal *journal;            // NULL without SFS_FEATURE_JOURNAL
+    struct sfs_icache_entry *icache_hash[SFS_ICACHE_BUCKETS];
+    struct sfs_icache_entry *icache_lru_head;
+    struct sfs_icache_entry *icache_lru_tail;
+    uint32_t icache_count;                  // Entries in the inode cache
+    uint32_t icache_hits;
+    uint32_t icache_misses;
+    struct sfs_discard_range discard[SFS_DISCARD_BATCH];
+    uint32_t discard_count;                 // Runs queued; more are not discarded
+    uint64_t discarded;                     // Blocks handed to the device
+    uint64_t csum_errors;                   // Metadata blocks that failed their checksum
+};
+
+// Cached block of pointers (indirect or double indirect level)
+struct sfs_map_cache {
+    uint32_t block;                         // Cached pointer block, 0 if empty
+    int dirty;                              // Needs to be written to disk
+    uint32_t *ptrs;                         // ptrs_per_block entries
+};
+
+// Consistency check flags and limits
+#define SFS_FSCK_FAST           0x0001      // Counters against bitmaps only
+#define SFS_FSCK_REPAIR         0x0002      // Write fixes back
+#define SFS_FSCK_MAX_WORKERS    8           // Tasks sharing the inode and directory passes
+#define SFS_FSCK_BATCH          32          // Inode table blocks per device read
+#define SFS_FSCK_MAX_MESSAGES   16          // Problems described; the rest are only counted
+
+struct sfs_fsck_result {
+    uint32_t inodes;                        // In use, after repairs
+    uint32_t directories;
+    uint32_t blocks;                        // Owned, metadata included
+    uint32_t free_blocks;                   // Counted from what is owned
+    uint32_t free_inodes;
+    uint32_t sb_free_blocks;                // As the superblock had them
+    uint32_t sb_free_inodes;
+    uint32_t bad_blocks;                    // Pointers outside the data area
+    uint32_t dup_blocks;                    // Blocks claimed by two owners
+    uint32_t bad_entries;                   // Directory entries naming no inode
+    uint32_t extra_names;                   // Inodes named by more than one entry
+    uint32_t orphans;                       // Inodes no directory reaches
+    uint32_t block_bitmap_errors;           // Bits that disagree with ownership
+    uint32_t inode_bitmap_errors;
+    uint32_t journal_pending;               // Transactions not yet replayed
+    uint32_t csum_errors;                   // Metadata blocks failing their checksum
+    uint32_t problems;                      // Everything found
+    uint32_t fixed;                         // Of those, repaired
+    uint32_t workers;
 };
 
 // SFS inode private data
@@ -93,6 +354,9 @@ struct sfs_inode_data {
     struct sfs_inode disk_inode;            // On-disk inode data
     uint32_t inode_num;                     // Inode number
     int dirty;                              // Needs to be written to disk
+    struct sfs_map_cache dind_map;          // Top level of the double indirect tree
+    struct sfs_map_cache leaf_map;          // Last indirect block, or the extent block
+    uint32_t extent_hint;                   // Extent that served the last lookup
 };
 
 // SFS file system operations
@@ -103,11 +367,53 @@ int sfs_init(void);
 struct file_system *sfs_mount(struct block_device *dev, unsigned long flags);
 void sfs_unmount(struct file_system *fs);
 int sfs_format(struct block_device *dev);
+int sfs_format_with_features(struct block_device *dev, uint32_t features);
+int sfs_format_with_block_size(struct block_device *dev, uint32_t features, uint32_t block_size);
+int sfs_geometry_init(struct sfs_geometry *geo, uint32_t block_size);
+
+// SFS metadata write-back (bitmap and superblock)
+int sfs_sync_metadata(struct file_system *fs);
+int sfs_write_metadata(struct file_system *fs);
+int sfs_discard_flush(struct file_system *fs);
+
+// SFS metadata journal. Mutating operations run between begin and end;
+// their metadata blocks join the running transaction, which commits to
+// the log when it fills, at the end of an operation under
+// SFS_MOUNT_SYNC_METADATA, on fsync and unmount, and otherwise on the next
+// flusher pass (or at the end of the operation that pass found running),
+// so many operations share one journal flush.
+int sfs_journal_format(struct block_device *dev, uint32_t start, uint32_t blocks);
+int sfs_journal_recover(struct block_device *dev, struct sfs_superblock *sb);
+int sfs_journal_pending(struct block_device *dev, const struct sfs_superblock *sb);
+int sfs_journal_init(struct sfs_fs_data *data);
+void sfs_journal_destroy(struct sfs_fs_data *data);
+void sfs_journal_begin(struct file_system *fs);
+void sfs_journal_end(struct file_system *fs);
+void sfs_journal_access(struct sfs_journal *journal, struct block_buffer *buf);
+int sfs_journal_dirty_buffer(struct file_system *fs, struct block_buffer *buf);
+int sfs_journal_dirty_memory(struct file_system *fs, uint32_t block, const void *data);
+void sfs_journal_forget(struct file_system *fs, uint32_t start, uint32_t count);
+int sfs_journal_commit(struct file_system *fs);
+int sfs_journal_checkpoint(struct file_system *fs);
+
+// Tags a descriptor block holds after its three header words
+static inline uint32_t sfs_journal_tags(uint32_t block_size)
+{
+    return block_size / sizeof(uint32_t) - 3;
+}
 
 // SFS superblock operations
 int sfs_read_superblock(struct block_device *dev, struct sfs_superblock *sb);
-int sfs_write_superblock(struct block_device *dev, const struct sfs_superblock *sb);
+int sfs_write_superblock(struct block_device *dev, struct sfs_superblock *sb);
 int sfs_validate_superblock(const struct sfs_superblock *sb);
+uint32_t sfs_inode_table_start(const struct sfs_superblock *sb);
+const void *sfs_superblock_block(struct sfs_fs_data *data);
+
+// Bytes of block 0 the superblock takes, its checksum in the last word
+static inline uint32_t sfs_superblock_size(uint32_t block_size)
+{
+    return block_size < SFS_SUPERBLOCK_SIZE ? block_size : SFS_SUPERBLOCK_SIZE;
+}
 
 // SFS inode operations
 struct inode *sfs_alloc_inode(struct file_system *fs, uint32_t mode);
@@ -119,9 +425,17 @@ struct inode *sfs_resolve_path(struct file_system *fs, const char *path);
 
 // SFS block operations
 uint32_t sfs_alloc_block(struct file_system *fs);
+uint32_t sfs_alloc_blocks(struct file_system *fs, uint32_t goal, uint32_t count, uint32_t *allocated);
 void sfs_free_block(struct file_system *fs, uint32_t block_num);
+void sfs_free_blocks(struct file_system *fs, uint32_t start, uint32_t count);
 int sfs_read_block(struct file_system *fs, uint32_t block_num, void *buffer);
 int sfs_write_block(struct file_system *fs, uint32_t block_num, const void *buffer);
+int sfs_read_blocks(struct file_system *fs, uint32_t start, uint32_t count, void *buffer);
+int sfs_write_blocks(struct file_system *fs, uint32_t start, uint32_t count, const void *buffer);
+int sfs_read_segments(struct file_system *fs, uint32_t start,
+                      const struct block_io_segment *segs, uint32_t num_segs);
+int sfs_write_segments(struct file_system *fs, uint32_t start,
+                       const struct block_io_segment *segs, uint32_t num_segs);
 
 // SFS file operations
 int sfs_create_file(struct file_system *fs, const char *name, uint32_t mode);
@@ -144,12 +458,38 @@ uint32_t sfs_get_block_for_offset(struct file_system *fs, struct inode *inode, o
 int sfs_expand_file(struct file_system *fs, struct inode *inode, size_t new_size);
 int sfs_truncate_file(struct file_system *fs, struct inode *inode, size_t new_size);
 
+// SFS metadata checksums (SFS_FEATURE_METADATA_CSUM)
+static inline int sfs_csum_enabled(const struct sfs_superblock *sb)
+{
+    return (sb->features & SFS_FEATURE_METADATA_CSUM) != 0;
+}
+
+// Bitmap checksums the superblock has room for at a block size
+static inline uint32_t sfs_csum_max_bitmaps(uint32_t block_size)
+{
+    uint32_t room = (sfs_superblock_size(block_size) - sizeof(uint32_t) -
+                     offsetof(struct sfs_superblock, bitmap_csum)) / sizeof(uint32_t);
+    return room < SFS_CSUM_MAX_BITMAPS ? room : SFS_CSUM_MAX_BITMAPS;
+}
+void sfs_csum_set(uint32_t block_num, void *block, uint32_t block_size);
+int sfs_csum_verify(uint32_t block_num, const void *block, uint32_t block_size);
+void sfs_csum_set_superblock(struct sfs_superblock *sb);
+int sfs_csum_superblock_ok(const struct sfs_superblock *sb);
+uint32_t sfs_csum_bitmap(uint32_t block_num, const void *block, uint32_t block_size);
+void sfs_csum_update_bitmap(struct sfs_fs_data *data, uint32_t block_num);
+
 // SFS bitmap operations
 int sfs_test_bit(const uint8_t *bitmap, uint32_t bit);
 void sfs_set_bit(uint8_t *bitmap, uint32_t bit);
 void sfs_clear_bit(uint8_t *bitmap, uint32_t bit);
 uint32_t sfs_find_free_bit(const uint8_t *bitmap, uint32_t size);
 
+// SFS consistency check (sfs_fsck.c), on an unmounted device. The full
+// check walks every inode and directory; SFS_FSCK_FAST only compares the
+// superblock counters with the bitmaps, cheap enough for every boot.
+int sfs_fsck(struct block_device *dev, uint32_t flags, struct sfs_fsck_result *result);
+int sfs_fsck_counters(struct sfs_fs_data *data);
+
 // SFS debugging
 void sfs_dump_superblock(const struct sfs_superblock *sb);
 void sfs_dump_inode(const struct sfs_inode *inode, uint32_t inode_num);
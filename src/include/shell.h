@@ -67,7 +67,35 @@ struct shell_command {
     int max_args;
 };
 
-// Command line structure for parser
+/*
+ * Bump allocator for memory that lives as long as one command line or one
+ * round of completion: carved from a fixed buffer and released all at
+ * once by resetting it, so parsing never reaches the kernel heap.
+ */
+struct shell_arena {
+    char *base;
+    size_t size;
+    size_t used;
+};
+
+#define SHELL_ARENA_INIT(buffer)    { (buffer), sizeof(buffer), 0 }
+#define SHELL_PARSE_ARENA_SIZE      4096    // Tokens, stages and argument arrays
+
+void *shell_arena_alloc(struct shell_arena *arena, size_t size);   // NULL when full
+char *shell_arena_strdup(struct shell_arena *arena, const char *str);
+
+static inline void shell_arena_reset(struct shell_arena *arena)
+{
+    arena->used = 0;
+}
+
+// Command index (shell_core.c)
+#define SHELL_COMMAND_HASH_SIZE     256     // Power of two, at least twice the commands
+#define SHELL_COMMAND_SEED_TRIES    4096    // Seeds tried for a collision-free table
+#define SHELL_BIN_DIRECTORY         "/bin"  // Programs offered after the builtins
+
+// Command line structure for parser; everything in it comes from the
+// parser's arena and is valid until free_command_line()
 struct command_line {
     char *command;
     char **arguments;
@@ -75,14 +103,19 @@ struct command_line {
     char *input_redirect;
     char *output_redirect;
     int background;
+    struct command_line *pipe_next;     // Next stage of a `|` pipeline
 };
 
+#define SHELL_MAX_PIPELINE      8       // Stages in one pipeline
+#define SHELL_TAIL_BUFFER       8192    // Input tail keeps while it reads
+
 // Shell core functions
 int shell_init(struct shell_context *ctx);
 void shell_run(struct shell_context *ctx);
 void shell_cleanup(struct shell_context *ctx);
 int shell_parse_command(const char *input, char *argv[], int max_argc);
 struct shell_command *shell_find_command(const char *name);
+int shell_complete_command(const char *prefix, const char **matches, int max);
 
 // Shell I/O functions
 void shell_print_prompt(struct shell_context *ctx);
@@ -90,6 +123,8 @@ int shell_read_command(struct shell_context *ctx);
 void shell_print(const char *message);
 void shell_print_error(const char *error);
 void shell_printf(const char *format, ...);
+int shell_write(const void *data, size_t len);
+int shell_has_stdin(void);
 
 // Command parser functions
 int parse_command_line(const char *input, struct command_line *cmd);
@@ -101,11 +136,16 @@ int execute_builtin_command(struct shell_context *ctx, struct command_line *cmd)
 int execute_external_program(struct shell_context *ctx, struct command_line *cmd);
 int setup_io_redirection(struct command_line *cmd);
 
+// Resolve path against current_dir into dest, normalising . and ..
+void build_full_path(char *dest, size_t dest_size, const char *current_dir, const char *path);
+
 // Built-in command handlers
 int cmd_cd(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_pwd(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_ls(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_cat(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_head(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_tail(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_mkdir(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_rmdir(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_rm(struct shell_context *ctx, int argc, char *argv[]);
@@ -113,8 +153,10 @@ int cmd_cp(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_mv(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_touch(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_mkfs(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_fsck(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_mount(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_umount(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_sync(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_echo(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_clear(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_help(struct shell_context *ctx, int argc, char *argv[]);
@@ -126,6 +168,23 @@ int cmd_free(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_uname(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_date(struct shell_context *ctx, int argc, char *argv[]);
 int cmd_uptime(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_sysbench(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_bench(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_fsbench(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_perfstat(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_profile(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_memprof(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_lockstat(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_trace(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_irqstat(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_irqaffinity(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_dmesg(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_bootstat(struct shell_context *ctx, int argc, char *argv[]);
+
+// Network commands
+int cmd_ifconfig(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_httpd(struct shell_context *ctx, int argc, char *argv[]);
+int cmd_httpbench(struct shell_context *ctx, int argc, char *argv[]);
 
 // Shell system functions
 int shell_init_system(void);
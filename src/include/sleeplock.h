@@ -0,0 +1,68 @@
+/*
+ * MiniOS Sleeping Locks
+ *
+ * Locks for sections that do I/O or otherwise run long enough that a
+ * waiter should sleep rather than spin: a mutex, and a reader/writer
+ * semaphore that lets any number of readers in at once but a writer only
+ * alone. Each is a few words of state under a spinlock plus a wait queue.
+ * Waiters sleep with wait_event() and try again on every wakeup; a
+ * release wakes all of them and the first to get the state wins. A
+ * writer waiting on an rwsem holds off new readers, so a steady stream of
+ * readers cannot starve it.
+ *
+ * Neither is recursive, and neither may be taken from interrupt context.
+ * Before the scheduler runs a contended lock spins, as wait_event() does.
+ */
+
+#ifndef SLEEPLOCK_H
+#define SLEEPLOCK_H
+
+#include <stdint.h>
+#include "process.h"
+
+struct mutex {
+    spinlock_t lock;                   // Protects the fields below
+    int locked;
+    struct task *owner;                // Holder, NULL before the scheduler runs
+    struct wait_queue wait;
+};
+
+#define MUTEX_INIT      { SPINLOCK_INIT, 0, NULL, WAIT_QUEUE_INIT }
+
+struct rwsem {
+    spinlock_t lock;                   // Protects the fields below
+    int32_t count;                     // Readers holding it, -1 for a writer
+    uint32_t writers_waiting;          // Keep new readers out while nonzero
+    struct wait_queue wait;
+};
+
+#define RWSEM_INIT      { SPINLOCK_INIT, 0, 0, WAIT_QUEUE_INIT }
+
+void mutex_init(struct mutex *mutex);
+void mutex_lock(struct mutex *mutex);
+void mutex_unlock(struct mutex *mutex);
+
+/**
+ * Take the mutex if it is free. Returns 1 when taken, 0 otherwise.
+ */
+int mutex_trylock(struct mutex *mutex);
+
+/**
+ * Whether the calling task holds the mutex
+ */
+int mutex_is_owner(struct mutex *mutex);
+
+void rwsem_init(struct rwsem *sem);
+void rwsem_down_read(struct rwsem *sem);
+void rwsem_up_read(struct rwsem *sem);
+void rwsem_down_write(struct rwsem *sem);
+void rwsem_up_write(struct rwsem *sem);
+
+/**
+ * Take the semaphore shared or exclusive without sleeping. Return 1 when
+ * taken, 0 otherwise.
+ */
+int rwsem_try_read(struct rwsem *sem);
+int rwsem_try_write(struct rwsem *sem);
+
+#endif /* SLEEPLOCK_H */
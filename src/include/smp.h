@@ -0,0 +1,69 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPUs the kernel will bring up; extra cores are left parked
+#define MAX_CPUS                8
+#define SMP_CPU_STACK_SIZE      (16 * 1024)
+
+// Per-CPU data. The first two fields are read by the secondary entry
+// assembly and id by the system call fast paths; they must stay at these
+// offsets.
+struct cpu_info {
+    struct cpu_info *self;              // 0: x86-64 reads it through GS
+    uint64_t stack_top;                 // 8: Initial stack for secondaries
+    uint32_t id;                        // Logical CPU number, 0 = boot CPU
+    uint32_t hw_id;                     // MPIDR affinity / local APIC ID
+    volatile uint32_t online;           // Running the scheduler
+};
+
+#define CPU_INFO_STACK_TOP      8
+#define CPU_INFO_ID             16
+
+extern struct cpu_info smp_cpus[MAX_CPUS];
+extern volatile int smp_active;         // Per-CPU pointer installed on the boot CPU
+
+// Architecture hooks
+void arch_smp_set_this_cpu(struct cpu_info *cpu);
+uint32_t arch_smp_boot_cpu_hw_id(void);
+int arch_smp_boot_secondaries(void);
+void arch_smp_secondary_init(struct cpu_info *cpu);
+
+// Per-CPU pointer: TPIDR_EL1 on ARM64, the GS base on x86-64
+static inline struct cpu_info *arch_smp_this_cpu(void)
+{
+    struct cpu_info *cpu;
+#if defined(__aarch64__)
+    __asm__ volatile("mrs %0, tpidr_el1" : "=r"(cpu));
+#elif defined(__x86_64__)
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+#else
+    cpu = NULL;
+#endif
+    return cpu;
+}
+
+/**
+ * Logical number of the calling CPU. 0 until smp_init() has installed the
+ * boot CPU's per-CPU pointer.
+ */
+static inline uint32_t smp_cpu_id(void)
+{
+    return smp_active ? arch_smp_this_cpu()->id : 0;
+}
+
+int smp_init(void);
+uint32_t smp_num_cpus(void);
+void smp_secondary_main(struct cpu_info *cpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SMP_H */
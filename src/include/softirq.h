@@ -0,0 +1,81 @@
+/*
+ * MiniOS Deferred Interrupt Work
+ *
+ * Interrupt handlers do the minimum with the line masked and leave the
+ * rest to a softirq, which runs on the same CPU once the interrupt is
+ * acknowledged, with interrupts enabled. Drivers defer through tasklets,
+ * which run from the SOFTIRQ_TASKLET softirq.
+ */
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Softirq numbers, run in this order
+#define SOFTIRQ_TIMER           0       // Expired software timers
+#define SOFTIRQ_TASKLET         1       // Scheduled tasklets
+#define SOFTIRQ_COUNT           2
+
+// Rounds of newly raised softirqs run per interrupt exit before the
+// rest waits for the next one, so they cannot starve tasks
+#define SOFTIRQ_MAX_RESTART     8
+
+typedef void (*softirq_handler_t)(void);
+
+struct tasklet {
+    struct tasklet *next;               // Per-CPU queue
+    void (*func)(void *data);
+    void *data;
+    volatile uint32_t state;            // TASKLET_STATE_*
+};
+
+#define TASKLET_STATE_SCHED     (1 << 0)    // Queued to run
+#define TASKLET_STATE_RUN       (1 << 1)    // Running on some CPU
+
+#define TASKLET_INIT(fn, arg)   { NULL, (fn), (arg), 0 }
+
+/**
+ * Install the handler for a softirq number (at init)
+ */
+void open_softirq(uint32_t nr, softirq_handler_t handler);
+
+/**
+ * Mark a softirq pending on the calling CPU. Safe from interrupt handlers.
+ */
+void raise_softirq(uint32_t nr);
+
+/**
+ * Run pending softirqs. Called by scheduler_irq_exit() with interrupts
+ * masked; they are enabled while the handlers run.
+ * @return 1 if the interrupt arrived while this CPU was already running
+ *         softirqs, in which case nothing ran and the caller must not
+ *         switch tasks
+ */
+int softirq_irq_exit(void);
+
+/**
+ * Run pending softirqs from task context (idle loop)
+ */
+void softirq_run_pending(void);
+
+/**
+ * Set up a tasklet that calls func(data)
+ */
+void tasklet_init(struct tasklet *t, void (*func)(void *data), void *data);
+
+/**
+ * Queue a tasklet on the calling CPU. A tasklet already queued is not
+ * queued twice, and a tasklet never runs on two CPUs at once.
+ */
+void tasklet_schedule(struct tasklet *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SOFTIRQ_H */
@@ -0,0 +1,192 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "interrupt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Ticket spinlock. A locker takes the next ticket with one atomic add and
+ * waits, spinning on a plain load of the owner half, until the holder
+ * hands the lock on by bumping it. Waiters are served in arrival order,
+ * so none can starve however hot the lock gets. The _irqsave variants
+ * also keep the local CPU's interrupt handlers off the lock.
+ *
+ * ARM64 takes tickets with LSE's LDADDA when built for ARMv8.1 and with
+ * exclusives otherwise, so nothing depends on libgcc's outline atomics;
+ * x86-64's fetch-and-add is a lock xadd.
+ *
+ * With LOCKSTAT=1 every acquisition also reports to lockstat.h.
+ */
+typedef struct {
+    union {
+        volatile uint32_t ticket;
+        struct {
+            volatile uint16_t owner;    // Ticket being served
+            volatile uint16_t next;     // Ticket the next locker takes
+        };
+    };
+#ifdef CONFIG_LOCKSTAT
+    uint64_t acquired_at;               // Counter when taken, for hold times
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT { .ticket = 0 }
+
+#define SPINLOCK_TICKET_ONE     0x10000u    // One ticket, in the next half
+
+#ifdef CONFIG_LOCKSTAT
+
+/**
+ * Counter value for timing a wait
+ */
+uint64_t lockstat_clock(void);
+
+/**
+ * Record that lock was just taken, after waiting since wait_start or
+ * without waiting if wait_start is 0
+ */
+void lockstat_acquired(spinlock_t *lock, uint64_t wait_start);
+
+/**
+ * Record that lock is about to be released
+ */
+void lockstat_released(spinlock_t *lock);
+
+#else
+
+static inline uint64_t lockstat_clock(void)
+{
+    return 0;
+}
+
+static inline void lockstat_acquired(spinlock_t *lock, uint64_t wait_start)
+{
+    (void)lock; (void)wait_start;
+}
+
+static inline void lockstat_released(spinlock_t *lock)
+{
+    (void)lock;
+}
+
+#endif /* CONFIG_LOCKSTAT */
+
+static inline void cpu_relax(void)
+{
+#if defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#elif defined(__x86_64__)
+    __asm__ volatile("pause" ::: "memory");
+#else
+    __asm__ volatile("" ::: "memory");
+#endif
+}
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+    lock->ticket = 0;
+}
+
+// Take a ticket; returns the lock word from before
+static inline uint32_t spin_take_ticket(spinlock_t *lock)
+{
+#if defined(__aarch64__) && defined(__ARM_FEATURE_ATOMICS)
+    uint32_t old;
+    __asm__ volatile("ldadda %w2, %w0, [%1]"
+                     : "=r"(old)
+                     : "r"(&lock->ticket), "r"(SPINLOCK_TICKET_ONE)
+                     : "memory");
+    return old;
+#elif defined(__aarch64__)
+    uint32_t old, updated, failed;
+    __asm__ volatile("1: ldaxr %w0, [%3]\n"
+                     "   add   %w1, %w0, %w4\n"
+                     "   stxr  %w2, %w1, [%3]\n"
+                     "   cbnz  %w2, 1b"
+                     : "=&r"(old), "=&r"(updated), "=&r"(failed)
+                     : "r"(&lock->ticket), "r"(SPINLOCK_TICKET_ONE)
+                     : "memory");
+    return old;
+#else
+    return __atomic_fetch_add(&lock->ticket, SPINLOCK_TICKET_ONE, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline int spin_trylock(spinlock_t *lock)
+{
+    // Take a ticket only if it would be served at once
+#if defined(__aarch64__)
+    uint32_t old, updated, failed;
+    __asm__ volatile("1: ldaxr %w0, [%3]\n"
+                     "   eor   %w1, %w0, %w0, ror #16\n"
+                     "   cbnz  %w1, 2f\n"
+                     "   add   %w1, %w0, %w4\n"
+                     "   stxr  %w2, %w1, [%3]\n"
+                     "   cbnz  %w2, 1b\n"
+                     "2:"
+                     : "=&r"(old), "=&r"(updated), "=&r"(failed)
+                     : "r"(&lock->ticket), "r"(SPINLOCK_TICKET_ONE)
+                     : "memory");
+    int taken = (uint16_t)old == (uint16_t)(old >> 16);
+#else
+    uint32_t old = __atomic_load_n(&lock->ticket, __ATOMIC_RELAXED);
+    int taken = (uint16_t)old == (uint16_t)(old >> 16) &&
+                __atomic_compare_exchange_n(&lock->ticket, &old, old + SPINLOCK_TICKET_ONE,
+                                            0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#endif
+    if (taken) {
+        lockstat_acquired(lock, 0);
+    }
+    return taken;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    uint32_t old = spin_take_ticket(lock);
+    uint16_t ticket = (uint16_t)(old >> 16);
+    uint64_t wait_start = 0;
+
+    if ((uint16_t)old != ticket) {
+        wait_start = lockstat_clock();
+        while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+    }
+    lockstat_acquired(lock, wait_start);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    lockstat_released(lock);
+
+    // Only the holder writes the owner half
+    uint16_t owner = (uint16_t)(lock->owner + 1);
+#if defined(__aarch64__)
+    __asm__ volatile("stlrh %w1, [%0]" : : "r"(&lock->owner), "r"(owner) : "memory");
+#else
+    __atomic_store_n(&lock->owner, owner, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline unsigned long spin_lock_irqsave(spinlock_t *lock)
+{
+    unsigned long flags = disable_interrupts();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags)
+{
+    spin_unlock(lock);
+    restore_interrupts(flags);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPINLOCK_H */
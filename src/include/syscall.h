@@ -28,9 +28,56 @@ extern "C" {
 #define SYSCALL_READDIR     19  // Read directory entries
 #define SYSCALL_EXEC        20  // Execute program
 #define SYSCALL_WAIT        21  // Wait for process
-#define SYSCALL_FORK        22  // Create new process (future)
+#define SYSCALL_FORK        22  // Copy-on-write copy of the caller
 
-#define MAX_SYSCALLS        64
+// Batched I/O (io_ring.h)
+#define SYSCALL_IO_RING_SETUP   24  // Create the task's ring pair
+#define SYSCALL_IO_RING_ENTER   25  // Run queued submissions
+#define SYSCALL_IO_RING_DESTROY 26  // Free the task's rings
+
+// Memory mappings (mmap.h)
+#define SYSCALL_MMAP        27  // Map memory or a file
+#define SYSCALL_MUNMAP      28  // Remove mappings in a range
+
+// In-kernel file copies
+#define SYSCALL_COPY_FILE_RANGE 29  // Copy between two open files
+
+// System monitoring (sysinfo.h)
+#define SYSCALL_SYSINFO     30  // Snapshot of system totals and all tasks
+
+// Pipes
+#define SYSCALL_PIPE        31  // Create a pipe, returning both ends
+
+// Sockets (network.h); send/recv are sendto/recvfrom without an address,
+// and a socket closes like any other descriptor
+#define SYSCALL_SOCKET      32  // Create a socket
+#define SYSCALL_BIND        33  // Give a socket its local address
+#define SYSCALL_CONNECT     34  // Connect to a remote address
+#define SYSCALL_LISTEN      35  // Accept connections on a bound socket
+#define SYSCALL_ACCEPT      36  // Wait for and take a connection
+#define SYSCALL_SENDTO      37  // Send, to an address or the connected peer
+#define SYSCALL_RECVFROM    38  // Receive, with the sender's address
+
+// Readiness notification (vfs.h); an epoll instance closes like any other
+// descriptor
+#define SYSCALL_EPOLL_CREATE 39 // Create an epoll instance
+#define SYSCALL_EPOLL_CTL   40  // Add, change or remove a watched descriptor
+#define SYSCALL_EPOLL_WAIT  41  // Wait for events on the watched descriptors
+
+// Space reservation (vfs.h)
+#define SYSCALL_FALLOCATE   42  // Preallocate or zero a range of a file
+
+// Threads (futex.h): a thread is a task sharing its creator's address space
+#define SYSCALL_FUTEX       43  // Sleep on or wake a word of user memory
+#define SYSCALL_THREAD_CREATE 44 // Start a thread in the caller's address space
+
+// Scheduling (sched_attr.h)
+#define SYSCALL_SCHED_SETATTR 45 // Move a task to the fair, FIFO or deadline class
+
+#define MAX_SYSCALLS        64      // Also the width of syscall_leaf_mask
+
+// Bit for a call that never blocks, so entry code may skip the full save
+#define SYSCALL_LEAF(num)   (1ULL << (num))
 
 // System call error codes
 #define SYSCALL_SUCCESS     0
@@ -39,6 +86,9 @@ extern "C" {
 #define SYSCALL_ENOENT     -3
 #define SYSCALL_EPERM      -4
 #define SYSCALL_ENOMEM     -5
+#define SYSCALL_EAGAIN     -6      // Value changed before the caller could sleep
+#define SYSCALL_ETIMEDOUT  -7
+#define SYSCALL_EBUSY      -8      // Deadline bandwidth already reserved
 
 // System call handler function type
 typedef long (*syscall_handler_t)(long arg0, long arg1, long arg2, long arg3, long arg4, long arg5);
@@ -60,6 +110,21 @@ struct syscall_stats {
     uint64_t last_call_time;           // Last call timestamp
 };
 
+// Round-trip cost per call in nanoseconds; 0 where not measured
+struct syscall_bench {
+    uint64_t dispatch_ns;              // syscall_dispatch() called directly
+    uint64_t leaf_trap_ns;             // Trap through the leaf fast path
+    uint64_t full_trap_ns;             // Trap through the full entry path
+};
+
+// Dispatch state shared with the architecture entry fast paths, which
+// also bump the per-CPU call counts: a CPU's row of MAX_SYSCALLS counters
+// is 1 << SYSCALL_COUNTS_SHIFT bytes into syscall_counts per cpu_info id
+extern syscall_handler_t syscall_table[MAX_SYSCALLS];
+extern uint64_t syscall_leaf_mask;
+
+#define SYSCALL_COUNTS_SHIFT    9
+
 // System call initialization and management
 int syscall_init(void);
 int syscall_register(uint32_t syscall_num, syscall_handler_t handler);
@@ -77,6 +142,13 @@ long syscall_getpid(long unused0, long unused1, long unused2, long unused3, long
 long syscall_sleep(long ticks, long unused1, long unused2, long unused3, long unused4, long unused5);
 long syscall_yield(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5);
 long syscall_gettime(long time_ptr, long unused1, long unused2, long unused3, long unused4, long unused5);
+long syscall_fork(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5);
+long syscall_copy_file_range(long fd_in, long fd_out, long len, long unused3, long unused4, long unused5);
+long syscall_fallocate(long fd, long mode, long offset, long len, long unused4, long unused5);
+long syscall_pipe(long fds_ptr, long unused1, long unused2, long unused3, long unused4, long unused5);
+long syscall_epoll_create(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5);
+long syscall_epoll_ctl(long epfd, long op, long fd, long event_ptr, long unused4, long unused5);
+long syscall_epoll_wait(long epfd, long events_ptr, long max_events, long timeout_ms, long unused4, long unused5);
 
 // Shell-related system call handlers
 long syscall_getcwd(long buf_ptr, long size, long unused2, long unused3, long unused4, long unused5);
@@ -85,11 +157,39 @@ long syscall_stat(long path_ptr, long stat_buf_ptr, long unused2, long unused3,
 long syscall_readdir(long fd, long entries_ptr, long count, long unused3, long unused4, long unused5);
 long syscall_exec(long path_ptr, long argv_ptr, long unused2, long unused3, long unused4, long unused5);
 
+// Batched I/O system call handlers
+long syscall_io_ring_setup(long entries, long unused1, long unused2, long unused3, long unused4, long unused5);
+long syscall_io_ring_enter(long to_submit, long unused1, long unused2, long unused3, long unused4, long unused5);
+long syscall_io_ring_destroy(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5);
+
+// System snapshot system call handler
+long syscall_sysinfo(long buf_ptr, long size, long unused2, long unused3, long unused4, long unused5);
+
+// Socket system call handlers
+long syscall_socket(long domain, long type, long protocol, long unused3, long unused4, long unused5);
+long syscall_bind(long fd, long addr_ptr, long addrlen, long unused3, long unused4, long unused5);
+long syscall_connect(long fd, long addr_ptr, long addrlen, long unused3, long unused4, long unused5);
+long syscall_listen(long fd, long backlog, long unused2, long unused3, long unused4, long unused5);
+long syscall_accept(long fd, long addr_ptr, long addrlen_ptr, long unused3, long unused4, long unused5);
+long syscall_sendto(long fd, long buf_ptr, long len, long flags, long addr_ptr, long addrlen);
+long syscall_recvfrom(long fd, long buf_ptr, long len, long flags, long addr_ptr, long addrlen_ptr);
+
+// Thread system call handlers
+long syscall_futex(long uaddr, long op, long val, long timeout_us, long unused4, long unused5);
+long syscall_thread_create(long entry, long arg, long unused2, long unused3, long unused4, long unused5);
+
+// Scheduling system call handlers
+long syscall_sched_setattr(long pid, long attr_ptr, long unused2, long unused3, long unused4, long unused5);
+
+// Memory mapping system call handlers
+long syscall_mmap(long addr, long length, long prot, long flags, long fd, long offset);
+long syscall_munmap(long addr, long length, long unused2, long unused3, long unused4, long unused5);
+
 // Architecture-specific system call entry points
 #ifdef __aarch64__
 // ARM64 uses SVC (Supervisor Call) instruction
 // System call number in x8, arguments in x0-x5, result in x0
-void syscall_entry_svc(void);
+// SVC enters through the synchronous exception vectors (vectors.S)
 void syscall_return_to_user(long result);
 #elif defined(__x86_64__)
 // x86-64 uses SYSCALL instruction
@@ -98,8 +198,7 @@ void syscall_entry_syscall(void);
 void syscall_return_to_user(long result);
 #endif
 
-// System call validation and tracing
-int syscall_validate_params(uint32_t syscall_num, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5);
+// System call tracing
 void syscall_trace(struct syscall_context *ctx);
 
 // User-space system call wrappers (for testing)
@@ -208,11 +307,55 @@ static inline long sys_yield(void) {
 #endif
 }
 
+static inline long sys_sysinfo(void *buffer, size_t size) {
+#ifdef __aarch64__
+    register long result;
+    register long syscall_num = SYSCALL_SYSINFO;
+    register long arg0 = (long)buffer;
+    register long arg1 = (long)size;
+    
+    __asm__ volatile("mov x8, %1\n\t"
+                     "mov x0, %2\n\t"
+                     "mov x1, %3\n\t"
+                     "svc #0\n\t"
+                     "mov %0, x0"
+                     : "=r"(result)
+                     : "r"(syscall_num), "r"(arg0), "r"(arg1)
+                     : "x8", "x0", "x1", "memory");
+    return result;
+#elif defined(__x86_64__)
+    register long result;
+    register long syscall_num = SYSCALL_SYSINFO;
+    register long arg0 = (long)buffer;
+    register long arg1 = (long)size;
+    
+    __asm__ volatile("syscall"
+                     : "=a"(result)
+                     : "a"(syscall_num), "D"(arg0), "S"(arg1)
+                     : "rcx", "r11", "memory");
+    return result;
+#endif
+}
+
 // System call statistics and debugging
 int syscall_get_stats(struct syscall_stats *stats);
+uint64_t syscall_get_count(uint32_t syscall_num);  // All CPUs
+
+/**
+ * Take calls back off a call count, for calls made by the kernel itself
+ * that should not show in the statistics
+ */
+void syscall_uncount(uint32_t syscall_num, uint64_t calls);
 void syscall_dump_stats(void);
 void syscall_enable_tracing(int enable);
 
+/**
+ * Send every call through syscall_dispatch(), leaf calls included, while
+ * any caller has this enabled (counted, so calls must pair up)
+ */
+void syscall_force_dispatch(int enable);
+int syscall_benchmark(uint32_t iterations, struct syscall_bench *result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,54 @@
+/*
+ * MiniOS System Snapshot
+ *
+ * Layout of the buffer SYSCALL_SYSINFO fills: a header of system totals
+ * followed by one record per task, all taken in a single trap and the
+ * task records under one hold of the task lock, so they agree with each
+ * other. Shared with minios_libc, so it only depends on <stdint.h>.
+ */
+
+#ifndef SYSINFO_H
+#define SYSINFO_H
+
+#include <stdint.h>
+
+#define SYSINFO_NAME_MAX        32      // Matches struct task's name
+
+struct sysinfo_task {
+    uint32_t pid;
+    uint32_t state;                     // TASK_STATE_*
+    uint32_t priority;                  // Fixed or RT class priority
+    uint32_t sched_class;               // SCHED_CLASS_*
+    int32_t nice;                       // Fair class only
+    uint32_t cpu;                       // CPU whose run queue owns it
+    uint64_t runtime_ticks;             // Scheduler ticks spent running
+    uint64_t switches;                  // Times switched in
+    uint64_t user_ns;                   // CPU time in user mode
+    uint64_t system_ns;                 // In the kernel on its behalf
+    uint64_t irq_ns;                    // In interrupts taken while it ran
+    uint64_t memory;                    // Stack plus resident user pages, bytes
+    char name[SYSINFO_NAME_MAX];
+};
+
+struct sysinfo {
+    uint64_t uptime_us;
+    uint64_t context_switches;          // All CPUs
+    uint64_t scheduler_ticks;
+    uint64_t interrupts;                // All lines since boot
+    uint64_t total_memory;              // Page allocator, bytes
+    uint64_t used_memory;
+    uint64_t free_memory;
+    uint64_t kernel_heap;               // Bytes in use in the kernel heap
+    uint32_t cpus;
+    uint32_t total_tasks;               // Live tasks, even those not stored
+    uint32_t running_tasks;             // Ready or running
+    uint32_t blocked_tasks;
+    uint32_t nr_tasks;                  // Records stored in tasks[]
+    uint32_t reserved;
+    struct sysinfo_task tasks[];
+};
+
+// Bytes of buffer needed for a snapshot holding n tasks
+#define SYSINFO_SIZE(n) (sizeof(struct sysinfo) + (n) * sizeof(struct sysinfo_task))
+
+#endif /* SYSINFO_H */
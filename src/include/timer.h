@@ -31,19 +31,34 @@ struct device;
 // Default scheduling frequency
 #define TIMER_SCHEDULER_HZ      100  // 100 Hz = 10ms time slices
 
+// Clock event limits (microseconds)
+#define TIMER_IDLE_MAX_US       100000  // Longest tickless idle sleep
+#define TIMER_MIN_DELTA_US      50      // Shortest deadline worth programming
+
 // Timer callback function type
 typedef void (*timer_callback_t)(void *data);
 
+// Timing wheel geometry: 256 one-unit root slots, then levels of 64
+// slots each 64 times coarser (1ms units reach about 49 days)
+#define TIMER_WHEEL_UNIT_US     1000
+#define TIMER_WHEEL_ROOT_SLOTS  256
+#define TIMER_WHEEL_LEVEL_SLOTS 64
+#define TIMER_WHEEL_LEVELS      5
+
 // Timer structure
 struct timer {
     uint32_t id;                    // Timer ID
     uint32_t type;                  // Timer type (oneshot/periodic)
     uint32_t flags;                 // Timer flags
+    uint8_t wheel_level;            // Wheel level and slot while pending
+    uint8_t wheel_slot;
     uint64_t interval_us;           // Interval in microseconds
     uint64_t expiry_time;           // Expiry time in microseconds
     timer_callback_t callback;      // Callback function
     void *callback_data;            // Callback data
-    struct timer *next;             // Next timer in list
+    struct timer *next;             // Next timer in the wheel slot
+    struct timer **pprev;           // Link to this timer, NULL when not pending
+    struct timer *hash_next;        // Next timer in the ID hash chain
 };
 
 // System timer information
@@ -68,6 +83,12 @@ int timer_init(void);
  */
 uint64_t timer_get_time_us(void);
 
+/**
+ * Get current system time in nanoseconds, at the clock's resolution
+ * @return Current time in nanoseconds since boot
+ */
+uint64_t timer_get_time_ns(void);
+
 /**
  * Get current system time in milliseconds
  * @return Current time in milliseconds since boot
@@ -110,6 +131,14 @@ uint32_t timer_create(uint32_t type, uint64_t interval_us,
  */
 int timer_start(uint32_t timer_id);
 
+/**
+ * Change a timer's interval and (re)start it from now
+ * @param timer_id Timer ID
+ * @param interval_us New interval in microseconds
+ * @return 0 on success, negative on error
+ */
+int timer_modify(uint32_t timer_id, uint64_t interval_us);
+
 /**
  * Stop a timer
  * @param timer_id Timer ID
@@ -163,6 +192,18 @@ void timer_interrupt_handler(void);
  */
 void timer_process_expired(void);
 
+/**
+ * Stop the scheduler tick before the idle loop halts the CPU, leaving
+ * only the next timer expiry programmed. Call with interrupts masked.
+ * @return 0 if the CPU may halt, negative if the timer cannot wake it
+ */
+int timer_idle_enter(void);
+
+/**
+ * Restart the scheduler tick when the CPU leaves idle (interrupts masked)
+ */
+void timer_idle_exit(void);
+
 // Architecture-specific timer functions
 
 /**
@@ -206,6 +247,12 @@ void arch_timer_disable_interrupt(void);
  */
 void arch_timer_ack_interrupt(void);
 
+/**
+ * x86-64: calibrated rate of the invariant TSC when it is the clock
+ * @return TSC frequency in Hz, 0 if the clock is the PIT
+ */
+uint64_t x86_64_tsc_frequency(void);
+
 // Timer device driver interface (for device framework integration)
 
 /**
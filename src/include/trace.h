@@ -0,0 +1,136 @@
+/*
+ * MiniOS Static Tracepoints
+ *
+ * Fixed events in the scheduler, system calls, block I/O, the VFS and
+ * interrupt handling. Each trace_event() site assembles to a single NOP
+ * and an entry in the __trace_sites section; enabling an event patches
+ * its sites into jumps to the code that writes the record, so a disabled
+ * tracepoint costs one NOP and no memory access.
+ *
+ * Records are fixed-size and binary, kept in a ring per CPU that writers
+ * append to without a lock. The trace command dumps them over the serial
+ * console as hex for tools/trace-decode.py.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "kernel.h"
+
+// Events, with what the arguments hold
+#define TRACE_SCHED_SWITCH      0   // prev pid, next pid, prev state
+#define TRACE_SCHED_WAKEUP      1   // woken pid, its CPU, -
+#define TRACE_SYSCALL_ENTER     2   // number, first argument, -
+#define TRACE_SYSCALL_EXIT      3   // number, result, -
+#define TRACE_BLOCK_SUBMIT      4   // request, start block, count | write << 31
+#define TRACE_BLOCK_COMPLETE    5   // request, status, -
+#define TRACE_VFS_ENTER         6   // TRACE_VFS_*, fd, byte count
+#define TRACE_VFS_EXIT          7   // TRACE_VFS_*, result, -
+#define TRACE_IRQ_ENTRY         8   // IRQ, -, -
+#define TRACE_IRQ_EXIT          9   // IRQ, -, -
+#define TRACE_EVENT_COUNT       10
+
+// VFS operations in TRACE_VFS_ENTER/EXIT
+#define TRACE_VFS_OPEN          0
+#define TRACE_VFS_CLOSE         1
+#define TRACE_VFS_READ          2
+#define TRACE_VFS_WRITE         3
+
+#define TRACE_RING_RECORDS      8192    // Per CPU, power of two
+#define TRACE_FORMAT_VERSION    1
+
+struct trace_record {
+    volatile uint32_t seq;              // Low bits of ring position + 1 once written
+    uint16_t event;                     // TRACE_*
+    uint16_t cpu;
+    uint32_t pid;                       // Current task, 0 for idle
+    uint32_t arg2;
+    uint64_t timestamp;                 // Raw counter (CNTVCT, TSC)
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+struct tracepoint {
+    const char *name;
+    volatile int enabled;
+    void (*reg)(int enable);            // Called around enabling, or NULL
+};
+
+// Patch-site record emitted by every trace_event()
+struct trace_site {
+    uintptr_t code;                     // The NOP
+    uintptr_t target;                   // Where it jumps when enabled
+    struct tracepoint *point;
+};
+
+extern struct tracepoint trace_points[TRACE_EVENT_COUNT];
+
+/**
+ * The site: a NOP the size of a jump, and its table entry. On x86-64 the
+ * NOP is kept within one aligned 8-byte word so one store rewrites it.
+ */
+#ifdef ARCH_ARM64
+#define TRACE_SITE_NOP          "1: nop\n"
+#else
+#define TRACE_SITE_NOP          ".balign 8, , 4\n"                          \
+                                "1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n"
+#endif
+
+/**
+ * Record event with its arguments when it is enabled. The arguments are
+ * only evaluated then.
+ */
+#define trace_event(event, a0, a1, a2)                                      \
+    do {                                                                    \
+        __label__ trace_on, trace_off;                                      \
+        __asm__ goto(TRACE_SITE_NOP                                         \
+                     ".pushsection __trace_sites, \"a\"\n"                  \
+                     ".balign 8\n"                                          \
+                     ".quad 1b, %l[trace_on], %c0\n"                        \
+                     ".popsection"                                          \
+                     : : "i"(&trace_points[event]) : : trace_on);           \
+        goto trace_off;                                                     \
+    trace_on:                                                               \
+        trace_write((event), (uint64_t)(a0), (uint64_t)(a1), (uint32_t)(a2)); \
+    trace_off:;                                                             \
+    } while (0)
+
+/**
+ * Append a record to the calling CPU's ring; from trace_event()
+ */
+void trace_write(uint32_t event, uint64_t arg0, uint64_t arg1, uint32_t arg2);
+
+/**
+ * Allocate the rings (first time) and empty them
+ * @return 0 on success, -1 out of memory
+ */
+int trace_reset(void);
+
+/**
+ * Turn an event's sites on or off
+ * @return 0 on success, -1 for an unknown event or no rings yet
+ */
+int trace_set_enabled(uint32_t event, int enable);
+
+/**
+ * Event number for name, -1 if there is none
+ */
+int trace_event_lookup(const char *name);
+
+/**
+ * Copy out the index-th record kept for cpu, oldest first
+ * @return 0 on success, 1 if the slot was overwritten or is being
+ *         written, -1 past the last record
+ */
+int trace_read(uint32_t cpu, uint64_t index, struct trace_record *record);
+
+/**
+ * Records written on cpu since the reset, and how many of those the
+ * ring has already overwritten
+ */
+void trace_cpu_stats(uint32_t cpu, uint64_t *written, uint64_t *overwritten);
+
+// Patch one site (architecture-specific)
+void arch_trace_patch(uintptr_t code, uintptr_t target, int enable);
+
+#endif /* TRACE_H */
@@ -11,6 +11,7 @@
 
 // Forward declarations
 struct device;
+struct wait_queue;
 
 // UART configuration flags
 #define UART_FLAG_8BIT          (0 << 0)    // 8 data bits
@@ -43,6 +44,38 @@ struct uart_config {
     uint32_t rx_buffer_size;    // Receive buffer size
 };
 
+// Software FIFO between a UART driver and its interrupt handler. Writers
+// queue into the TX ring and return; the handler (or the next writer)
+// moves it into the hardware FIFO. The RX ring holds input the handler
+// took off the hardware until a reader asks for it.
+#define UART_RING_SIZE          2048    // Power of two
+
+struct uart_ring {
+    uint8_t data[UART_RING_SIZE];
+    uint32_t head;                      // Next slot written
+    uint32_t tail;                      // Next slot read
+};
+
+static inline int uart_ring_empty(const struct uart_ring *ring)
+{
+    return ring->head == ring->tail;
+}
+
+static inline int uart_ring_full(const struct uart_ring *ring)
+{
+    return ring->head - ring->tail == UART_RING_SIZE;
+}
+
+static inline void uart_ring_put(struct uart_ring *ring, uint8_t c)
+{
+    ring->data[ring->head++ & (UART_RING_SIZE - 1)] = c;
+}
+
+static inline uint8_t uart_ring_get(struct uart_ring *ring)
+{
+    return ring->data[ring->tail++ & (UART_RING_SIZE - 1)];
+}
+
 // UART device statistics
 struct uart_stats {
     uint64_t bytes_transmitted;
@@ -141,7 +174,9 @@ int uart_rx_ready(struct device *device);
 int uart_get_stats(struct device *device, struct uart_stats *stats);
 
 /**
- * Enable UART interrupts
+ * Enable UART interrupts. With transmit interrupts on, writes queue in the
+ * TX ring and only wait when it is full; with receive interrupts on, input
+ * is buffered in the RX ring as it arrives.
  * @param device UART device
  * @param tx_enable Enable transmit interrupts
  * @param rx_enable Enable receive interrupts
@@ -150,12 +185,40 @@ int uart_get_stats(struct device *device, struct uart_stats *stats);
 int uart_enable_interrupts(struct device *device, int tx_enable, int rx_enable);
 
 /**
- * Disable UART interrupts
+ * Disable UART interrupts, sending whatever is still queued
  * @param device UART device
  * @return 0 on success, negative on error
  */
 int uart_disable_interrupts(struct device *device);
 
+/**
+ * Send everything queued in the TX ring, polling the hardware
+ * @param device UART device
+ * @return 0 on success, negative on error
+ */
+int uart_flush(struct device *device);
+
+/**
+ * The UART used as the console
+ * @return Device pointer, NULL before uart_init() found one
+ */
+struct device *uart_get_primary(void);
+
+/**
+ * Wait queue woken when received input reaches the RX ring
+ * @param device UART device
+ * @return The queue, NULL on error
+ */
+struct wait_queue *uart_rx_wait_queue(struct device *device);
+
+/**
+ * Open the UART as a file in the current descriptor table, for read(),
+ * write() and epoll. Reads wait for input, relying on RX interrupts.
+ * @param device UART device
+ * @return The descriptor, or a negative VFS error
+ */
+int uart_open_fd(struct device *device);
+
 // Enhanced early_print using UART drivers
 /**
  * Initialize enhanced early print with UART backend
@@ -169,6 +232,11 @@ int enhanced_early_print_init(void);
  */
 void enhanced_early_print(const char *str);
 
+/**
+ * Push out console output still queued in the UART driver (panic path)
+ */
+void enhanced_early_print_flush(void);
+
 // Architecture-specific UART functions
 
 /**
@@ -177,6 +245,13 @@ void enhanced_early_print(const char *str);
  */
 int arch_uart_init(void);
 
+/**
+ * Copy console output to any other output the architecture keeps (the
+ * x86-64 VGA text screen) once it goes through the UART driver
+ * @param str String printed
+ */
+void arch_early_print_mirror(const char *str);
+
 // UART device driver interface (for device framework integration)
 
 /**
@@ -0,0 +1,69 @@
+/*
+ * MiniOS Shared Kernel Data Page (vDSO)
+ *
+ * Layout of the page the kernel keeps up to date for user programs, so
+ * clock and PID queries can be answered without a system call. Shared
+ * with minios_libc, so it only depends on <stdint.h>.
+ */
+
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+
+#define VDSO_VERSION            1
+#define VDSO_MAX_CPUS           8       // At least MAX_CPUS
+
+// Counter a user program reads for the clock
+#define VDSO_CLOCK_NONE         0       // Ask the kernel instead
+#define VDSO_CLOCK_CNTVCT       1       // ARM64 virtual counter
+#define VDSO_CLOCK_TSC          2       // x86-64 time stamp counter
+
+// Feature flags
+#define VDSO_HAS_CPU_PID        (1U << 0)   // cpus[] valid, CPU ID readable
+
+/**
+ * PID running on one CPU. seq is odd while the slot is being rewritten and
+ * changes on every switch, so a reader that moved CPUs can tell.
+ */
+struct vdso_cpu {
+    volatile uint32_t seq;
+    volatile uint32_t pid;
+};
+
+struct vdso_data {
+    uint32_t version;                   // VDSO_VERSION
+    uint32_t flags;                     // VDSO_HAS_*
+
+    // Monotonic clock: ns = base_ns + ((counter - base_counter) * mult) >> shift
+    uint32_t clock_source;              // VDSO_CLOCK_*
+    uint32_t clock_shift;
+    uint64_t clock_mult;
+    uint64_t counter_frequency;         // Counter rate in Hz
+    uint64_t base_counter;
+    uint64_t base_ns;
+
+    // Scheduler ticks since boot
+    volatile uint64_t ticks;
+    uint32_t tick_hz;
+    uint32_t reserved;
+
+    struct vdso_cpu cpus[VDSO_MAX_CPUS];
+};
+
+struct task;
+
+// Kernel side (vdso.c)
+void vdso_init(void);
+void vdso_cpu_init(void);
+void vdso_switch(struct task *next);
+void vdso_tick(uint64_t ticks);
+void vdso_set_tick_rate(uint32_t hz);
+const struct vdso_data *vdso_get_data(void);
+
+// Architecture hooks
+uint64_t arch_vdso_counter_frequency(void);
+uint64_t arch_vdso_read_counter(void);
+uint32_t arch_vdso_cpu_init(uint32_t cpu);
+
+#endif /* VDSO_H */
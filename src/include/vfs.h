@@ -13,6 +13,17 @@ struct file;
 struct file_system;
 struct block_device;
 struct inode;
+struct vfs_mapping;
+struct wait_queue;
+struct poll_table;
+struct epoll_item;
+struct vfs_inode_lock;
+
+// Sequential read detection for one open file (see page_cache.c)
+struct vfs_readahead {
+    uint32_t next;                          // Page a sequential read starts at
+    uint32_t window;                        // Current readahead in pages
+};
 
 // File types
 #define VFS_FILE_REGULAR    0x1000
@@ -27,11 +38,45 @@ struct inode;
 #define VFS_O_EXCL         0x0200
 #define VFS_O_TRUNC        0x1000
 #define VFS_O_APPEND       0x2000
+#define VFS_O_DIRECT       0x4000       // Page-aligned I/O skips the page cache
 
 // Seek origins
 #define VFS_SEEK_SET       0
 #define VFS_SEEK_CUR       1
 #define VFS_SEEK_END       2
+#define VFS_SEEK_DATA      3            // Next byte at or after offset that holds data
+#define VFS_SEEK_HOLE      4            // Next hole at or after offset; end of file is one
+
+// vfs_fallocate() modes
+#define VFS_FALLOC_KEEP_SIZE  0x1       // Reserve space without growing the file
+#define VFS_FALLOC_ZERO_RANGE 0x2       // The range also reads as zeros afterwards
+
+// Largest transfer one vfs_copy_file_range() call makes
+#define VFS_COPY_MAX       0x7FFFF000
+#define VFS_COPY_BUFFER    (4 * 4096)   // Bounce buffer for uncached files
+
+// Bytes a pipe buffers before its writer blocks
+#define VFS_PIPE_SIZE      4096
+
+// Readiness events (poll methods, epoll)
+#define EPOLLIN            0x001        // Readable, or end of file
+#define EPOLLOUT           0x004        // Writable
+#define EPOLLERR           0x008        // Error pending; always reported
+#define EPOLLHUP           0x010        // Hung up; always reported
+#define EPOLLET            (1U << 31)   // Report on changes only
+
+// vfs_epoll_ctl() operations
+#define EPOLL_CTL_ADD      1
+#define EPOLL_CTL_DEL      2
+#define EPOLL_CTL_MOD      3
+
+// Most events one vfs_epoll_wait() call returns
+#define EPOLL_MAX_EVENTS   256
+
+struct epoll_event {
+    uint32_t events;                        // EPOLL* mask
+    uint64_t data;                          // Caller's cookie, returned as is
+};
 
 // Maximum filename length
 #define VFS_MAX_NAME       255
@@ -47,6 +92,8 @@ struct inode;
 #define VFS_ENOMEM        -6
 #define VFS_ENOSPC        -7
 #define VFS_EIO           -8
+#define VFS_EPIPE         -9            // Write to a pipe with no reader left
+#define VFS_ENXIO         -10           // SEEK_DATA/SEEK_HOLE at or past end of file
 
 // File operations structure
 struct file_operations {
@@ -57,14 +104,40 @@ struct file_operations {
     int (*ioctl)(struct file *file, unsigned int cmd, unsigned long arg);
     off_t (*seek)(struct file *file, off_t offset, int whence);
     int (*sync)(struct file *file);
+    // Optional: reserve blocks for len bytes at offset (VFS_FALLOC_* modes)
+    int (*fallocate)(struct file *file, off_t offset, off_t len, int mode);
+    // Current EPOLL* readiness. Must not sleep or take locks a waker may
+    // hold, and must poll_wait() each queue woken when it changes.
+    uint32_t (*poll)(struct file *file, struct poll_table *pt);
 };
 
 // Directory operations structure
 struct directory_operations {
     int (*readdir)(struct file *dir, void *buffer, size_t buffer_size, off_t *offset);
+    // Optional: like readdir, filling struct dirent_plus records
+    int (*readdir_plus)(struct file *dir, void *buffer, size_t buffer_size, off_t *offset);
     int (*mkdir)(struct file_system *fs, const char *path, int mode);
     int (*rmdir)(struct file_system *fs, const char *path);
     struct inode *(*lookup)(struct file_system *fs, struct inode *parent, const char *name);
+    // Optional: move an entry without touching its data, replacing a file at newpath
+    int (*rename)(struct file_system *fs, const char *oldpath, const char *newpath);
+};
+
+// Page cache operations: a file system that provides these has regular
+// file data cached by the VFS and only maps and moves whole pages. Both
+// calls take count (at most VFS_PAGE_IO_MAX_PAGES) consecutive pages of
+// the file, starting at page index, and should use as few device
+// requests as the block layout allows.
+// readpages zeroes holes and anything past end of file.
+// writepages allocates backing blocks as needed and grows the on-disk size
+// to file_size as far as the pages reach.
+struct page_operations {
+    int (*readpages)(struct file_system *fs, struct inode *inode, uint32_t index,
+                     uint32_t count, void **pages);
+    int (*writepages)(struct file_system *fs, struct inode *inode, uint32_t index,
+                      uint32_t count, void **pages, uint32_t file_size);
+    struct inode *(*get_inode)(struct file_system *fs, uint32_t ino);
+    int (*put_inode)(struct inode *inode);
 };
 
 // File system type structure
@@ -75,6 +148,11 @@ struct file_system_type {
     int (*format)(struct block_device *dev);
     struct file_operations *file_ops;
     struct directory_operations *dir_ops;
+    struct page_operations *page_ops;       // Optional, enables the page cache
+    // Optional: write back whatever the file system caches (inodes,
+    // allocation maps, its buffers) from the flusher. Need not wait for
+    // the device to make it durable; fsync does that.
+    int (*sync_fs)(struct file_system *fs);
 };
 
 // File system instance
@@ -95,6 +173,10 @@ struct file {
     int mode;                               // File mode
     int ref_count;                          // Reference count
     struct file_operations *ops;            // File operations
+    struct vfs_mapping *mapping;            // Cached file data, NULL if uncached
+    struct vfs_inode_lock *ilock;           // The inode's lock, NULL if it has none
+    struct vfs_readahead ra;                // Readahead state for mapping reads
+    struct epoll_item *epoll_items;         // Interest lists watching this file
 };
 
 // Inode structure (simplified)
@@ -114,9 +196,74 @@ struct inode {
 // VFS mount structure
 struct vfs_mount {
     char mountpoint[VFS_MAX_PATH];         // Mount point path
+    size_t mountpoint_len;                 // strlen(mountpoint), 0 for "/"
     struct file_system *fs;                // Mounted file system
     int flags;                             // Mount flags
-    struct vfs_mount *next;                // Next mount in list
+    struct vfs_mount *next;                // Next mount, longest mountpoint first
+};
+
+// Dentry cache: (file system, parent inode, name) -> inode number
+#define VFS_DCACHE_ENTRIES     256          // Entries in the cache pool
+#define VFS_DCACHE_BUCKETS     256          // Hash buckets (power of two)
+#define VFS_DCACHE_NAME_LEN    32           // Longer names are not cached
+#define VFS_DCACHE_LOCKS       16           // Bucket b is under lock b % VFS_DCACHE_LOCKS
+
+struct vfs_dcache_stats {
+    uint32_t entries;                      // Entries in use
+    uint32_t negative;                     // Of which negative
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+};
+
+// Page cache
+#define VFS_PAGE_SIZE                4096
+#define VFS_PAGE_CACHE_DEFAULT_PAGES 4096   // 16MB of file data, less under reclaim
+#define VFS_PAGE_CACHE_BUCKETS       2048   // Hash buckets (power of two)
+#define VFS_READAHEAD_MIN_PAGES      4      // First sequential window
+#define VFS_PAGE_IO_MAX_PAGES        32     // Pages per readpages/writepages call
+#define VFS_READAHEAD_MAX_PAGES      VFS_PAGE_IO_MAX_PAGES
+
+// Background write-back (writeback.c)
+#define VFS_WRITEBACK_INTERVAL_MS    5000   // Flusher period
+#define VFS_WRITEBACK_DIRTY_PAGES    128    // Dirty pages that wake it early
+
+// Cached data of one file, shared by every open file on that inode
+struct vfs_mapping {
+    struct file_system *fs;
+    uint32_t ino;
+    uint32_t size;                         // File size including cached writes
+    uint32_t pages;                        // Pages cached
+    uint32_t dirty;                        // Of which dirty
+    uint32_t generation;                   // Bumped when writeback remaps blocks
+    uint32_t changes;                      // Bumped whenever cached data changes
+    int refs;                              // Open files using the mapping
+    int orphan;                            // File was deleted; never write back
+    struct vfs_inode_lock *ilock;          // Held exclusive for writes and writeback
+    struct vfs_mapping *next;              // Mapping list
+};
+
+struct vfs_page_cache_stats {
+    uint32_t capacity;                     // Pages
+    uint32_t pages;
+    uint32_t dirty;
+    uint32_t mappings;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t readahead;                    // Pages read ahead of a request
+    uint64_t direct_reads;                 // Pages moved by VFS_O_DIRECT I/O
+    uint64_t direct_writes;
+};
+
+struct vfs_writeback_stats {
+    uint32_t interval_ms;
+    uint32_t dirty_pages;                  // Threshold
+    int running;                           // Flusher task started
+    uint64_t rounds;                       // Write-back passes
+    uint64_t kicks;                        // Passes started by the threshold
+    uint64_t errors;                       // Passes that failed somewhere
 };
 
 // Directory entry for readdir operations
@@ -127,6 +274,15 @@ struct dirent {
     char name[VFS_MAX_NAME];               // Filename
 };
 
+// Directory entry with the attributes stat would report, filled in by the
+// same directory scan (vfs_readdir_plus)
+struct dirent_plus {
+    struct dirent dirent;
+    uint32_t mode;                         // File type and permissions
+    uint32_t size;                         // Including writes still cached
+    uint32_t modified_time;
+};
+
 // VFS core functions
 int vfs_init(void);
 int vfs_shutdown(void);
@@ -139,6 +295,7 @@ int vfs_unregister_filesystem(const char *name);
 int vfs_mount(const char *device, const char *mountpoint, const char *fstype, unsigned long flags);
 int vfs_unmount(const char *mountpoint);
 struct file_system *vfs_get_filesystem(const char *path);
+int vfs_device_mounted(const struct block_device *dev);
 
 // File operations
 int vfs_open(const char *path, int flags, int mode);
@@ -147,11 +304,24 @@ ssize_t vfs_write(int fd, const void *buf, size_t count);
 off_t vfs_seek(int fd, off_t offset, int whence);
 int vfs_close(int fd);
 int vfs_sync(int fd);
+ssize_t vfs_copy_file_range(int fd_in, int fd_out, size_t len);
+int vfs_fallocate(int fd, off_t offset, off_t len, int mode);
+struct file *vfs_file_get(int fd);      // Take a reference to fd's open file
+void vfs_file_put(struct file *file);   // Drop one descriptor's reference
+int vfs_pipe(int fds[2]);               // fds[0] reads what fds[1] writes
+
+// Readiness notification (epoll.c)
+void poll_wait(struct poll_table *pt, struct wait_queue *wq);
+int vfs_epoll_create(void);
+int vfs_epoll_ctl(int epfd, int op, int fd, const struct epoll_event *event);
+int vfs_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout_ms);
+void vfs_epoll_release(struct file *file);  // file is closing: drop its items
 
 // Directory operations
 int vfs_mkdir(const char *path, int mode);
 int vfs_rmdir(const char *path);
 int vfs_readdir(int fd, struct dirent *entries, size_t count);
+int vfs_readdir_plus(int fd, struct dirent_plus *entries, size_t count);
 
 // File management
 int vfs_unlink(const char *path);
@@ -163,6 +333,70 @@ char *vfs_resolve_path(const char *path);
 struct inode *vfs_lookup(const char *path);
 struct file_system *vfs_find_mount(const char *path);
 
+// Inode locks (inode_lock.c): one reader/writer lock per inode in use,
+// found by (file system, inode number), so every open file, mapping and
+// directory operation on an inode shares it. Reads of a file's data or a
+// directory's entries take it shared and run in parallel; writes,
+// truncation, writeback and entry changes take it exclusive. A file's
+// lock comes before its file system's own locks, a directory's before
+// those of the entries in it. The calls on a lock accept NULL and do
+// nothing with it.
+#define VFS_INODE_LOCK_BUCKETS  64          // Hash buckets (power of two)
+
+struct vfs_inode_lock *vfs_inode_lock_get(struct file_system *fs, uint32_t ino);
+void vfs_inode_lock_put(struct vfs_inode_lock *ilock);
+void vfs_inode_read_lock(struct vfs_inode_lock *ilock);
+void vfs_inode_read_unlock(struct vfs_inode_lock *ilock);
+void vfs_inode_write_lock(struct vfs_inode_lock *ilock);
+void vfs_inode_write_unlock(struct vfs_inode_lock *ilock);
+int vfs_inode_write_trylock(struct vfs_inode_lock *ilock);  // 1 when taken
+
+// Dentry cache. A cached inode number of 0 is a negative entry: the name
+// is known to be absent from the directory.
+int vfs_dcache_lookup(struct file_system *fs, uint32_t parent_ino, const char *name,
+                      uint32_t *ino_out);
+void vfs_dcache_insert(struct file_system *fs, uint32_t parent_ino, const char *name,
+                       uint32_t ino);
+void vfs_dcache_invalidate(struct file_system *fs, uint32_t parent_ino, const char *name);
+void vfs_dcache_invalidate_dir(struct file_system *fs, uint32_t dir_ino);
+void vfs_dcache_invalidate_fs(struct file_system *fs);
+void vfs_dcache_get_stats(struct vfs_dcache_stats *stats);
+
+// Page cache
+struct vfs_mapping *vfs_page_cache_open(struct file_system *fs, uint32_t ino, uint32_t size);
+void vfs_page_cache_close(struct vfs_mapping *mapping);
+ssize_t vfs_page_cache_read(struct vfs_mapping *mapping, struct vfs_readahead *ra,
+                            void *buf, size_t count, off_t offset);
+ssize_t vfs_page_cache_write(struct vfs_mapping *mapping, const void *buf, size_t count,
+                             off_t offset);
+ssize_t vfs_page_cache_read_direct(struct vfs_mapping *mapping, void *buf, size_t count,
+                                   off_t offset);
+ssize_t vfs_page_cache_write_direct(struct vfs_mapping *mapping, const void *buf, size_t count,
+                                    off_t offset);
+ssize_t vfs_page_cache_copy(struct vfs_mapping *src, off_t src_offset,
+                            struct vfs_mapping *dst, off_t dst_offset, size_t count);
+void *vfs_page_cache_map(struct vfs_mapping *mapping, uint32_t index, int write);
+void vfs_page_cache_unmap(struct vfs_mapping *mapping, uint32_t index, void *frame, int dirty);
+int vfs_page_cache_sync(struct vfs_mapping *mapping);
+int vfs_page_cache_sync_fs(struct file_system *fs);
+void vfs_page_cache_truncate(struct file_system *fs, uint32_t ino, uint32_t size);
+void vfs_page_cache_zero_range(struct vfs_mapping *mapping, uint64_t offset, uint64_t len);
+void vfs_page_cache_forget(struct file_system *fs, uint32_t ino);
+void vfs_page_cache_invalidate_fs(struct file_system *fs);
+int vfs_page_cache_get_size(struct file_system *fs, uint32_t ino, uint32_t *size_out);
+int vfs_page_cache_set_capacity(uint32_t pages);
+void vfs_page_cache_get_stats(struct vfs_page_cache_stats *stats);
+
+// Write-back. Closing a file leaves its dirty pages and metadata cached;
+// the flusher writes them back every interval, or sooner once the page
+// cache holds the threshold of dirty pages. fsync and vfs_sync_all(1) are
+// the ways to get data onto the device now.
+int vfs_sync_all(int durable);
+int vfs_writeback_start(void);
+int vfs_writeback_configure(uint32_t interval_ms, uint32_t dirty_pages);
+void vfs_writeback_kick(uint32_t dirty_pages);  // From the page cache as pages dirty
+void vfs_writeback_get_stats(struct vfs_writeback_stats *stats);
+
 // Utility functions
 int vfs_is_absolute_path(const char *path);
 char *vfs_get_filename(const char *path);
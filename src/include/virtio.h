@@ -0,0 +1,142 @@
+/*
+ * MiniOS Virtio Interface
+ * Split virtqueues and the MMIO / legacy PCI transports
+ */
+
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Device IDs
+#define VIRTIO_ID_NET               1
+#define VIRTIO_ID_BLOCK             2
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FEATURES_OK   0x08
+#define VIRTIO_STATUS_FAILED        0x80
+
+// Transport feature bits
+#define VIRTIO_F_VERSION_1          32
+#define VIRTIO_RING_F_EVENT_IDX     29  // Notifications at an index, not per buffer
+
+// Interrupt status bits
+#define VIRTIO_ISR_QUEUE            0x01
+#define VIRTIO_ISR_CONFIG           0x02
+
+// Descriptor flags
+#define VIRTQ_DESC_F_NEXT           1
+#define VIRTQ_DESC_F_WRITE          2   // Device writes this buffer
+
+// Ring flags, used without VIRTIO_RING_F_EVENT_IDX
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1   // Driver: no interrupt on used buffers
+#define VIRTQ_USED_F_NO_NOTIFY      1   // Device: no kick on new buffers
+
+// Legacy layout puts the used ring on its own page boundary
+#define VIRTQ_ALIGN                 4096
+#define VIRTQ_MAX_SIZE              256
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+};
+
+// One split virtqueue in the legacy contiguous layout, which the modern
+// transports accept as well
+struct virtqueue {
+    uint16_t index;
+    uint16_t size;                      // Descriptors, a power of two
+    struct virtq_desc *desc;
+    struct virtq_avail *avail;
+    volatile struct virtq_used *used;
+    uint16_t last_used;                 // Next used entry to reap
+    uint16_t kicked_avail;              // avail->idx at the last notify
+    int event_idx;                      // VIRTIO_RING_F_EVENT_IDX in use
+    void *memory;                       // DMA allocation backing the rings
+    uint64_t phys;                      // Its bus address
+    size_t pages;
+};
+
+struct virtio_device;
+
+// Transport operations; feature words are 64-bit even where the transport
+// only carries the low half
+struct virtio_transport {
+    const char *name;
+    uint64_t (*get_features)(struct virtio_device *vdev);
+    int (*set_features)(struct virtio_device *vdev, uint64_t features);
+    uint8_t (*get_status)(struct virtio_device *vdev);
+    void (*set_status)(struct virtio_device *vdev, uint8_t status);
+    void (*read_config)(struct virtio_device *vdev, uint32_t offset, void *buf, uint32_t len);
+    uint16_t (*queue_max)(struct virtio_device *vdev, uint16_t index);
+    int (*setup_queue)(struct virtio_device *vdev, struct virtqueue *vq);
+    void (*notify)(struct virtio_device *vdev, uint16_t index);
+    uint32_t (*ack_interrupt)(struct virtio_device *vdev);     // Returns VIRTIO_ISR_* bits
+};
+
+struct virtio_device {
+    const struct virtio_transport *transport;
+    uintptr_t base;                     // MMIO base or I/O port base
+    uint32_t device_id;
+    uint32_t version;                   // 1 = legacy
+    uint64_t features;                  // Negotiated
+    uint32_t irq;
+    int irq_registered;
+    void *driver_data;
+};
+
+// Barriers between ring updates and the device
+static inline void virtio_mb(void)
+{
+#if defined(__aarch64__)
+    __asm__ volatile("dsb sy" ::: "memory");
+#else
+    __asm__ volatile("mfence" ::: "memory");
+#endif
+}
+
+// Core helpers (virtio.c)
+int virtqueue_init(struct virtio_device *vdev, struct virtqueue *vq, uint16_t index,
+                   uint16_t max_size);
+void virtqueue_destroy(struct virtqueue *vq);
+void virtqueue_publish(struct virtqueue *vq, uint16_t head);
+void virtqueue_kick(struct virtio_device *vdev, struct virtqueue *vq);
+int virtqueue_reap(struct virtqueue *vq, struct virtq_used_elem *elem);
+void virtqueue_disable_cb(struct virtqueue *vq);
+int virtqueue_enable_cb(struct virtqueue *vq);
+int virtio_negotiate(struct virtio_device *vdev, uint64_t wanted, uint64_t *accepted);
+
+// Transports probe the machine and hand each device to its driver
+int virtio_init(void);
+int virtio_mmio_probe(void);
+int virtio_pci_probe(void);
+int virtio_attach(struct virtio_device *vdev);
+
+// Drivers
+int virtio_blk_probe(struct virtio_device *vdev);
+int virtio_net_probe(struct virtio_device *vdev);
+
+#endif // VIRTIO_H
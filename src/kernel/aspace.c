@@ -0,0 +1,220 @@
+/*
+ * MiniOS Address Spaces
+ * Per-task translation tables tagged with address-space IDs
+ *
+ * Each address space gets an ASID (the TTBR0 ASID field on ARM64, the
+ * CR3 PCID on x86-64) so switching between a few of them reloads the
+ * table root without flushing the TLB. ASIDs are handed out per
+ * generation: a number is never reused within the generation that
+ * allocated it, because entries tagged with it may still be cached. When
+ * the numbers run out the generation is bumped, every CPU keeps the ASID
+ * it is running (it is reserved in the new generation), and each CPU
+ * flushes its TLB once before loading any other one. An address space
+ * whose ASID is from an older generation picks a new one on its next
+ * switch-in. ASID 0 belongs to the kernel address space.
+ *
+ * Switching to the address space already loaded on a CPU is lock-free;
+ * only a change of address space takes the allocator lock.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "smp.h"
+#include "spinlock.h"
+
+#define ASID_MAP_WORDS          ((1U << ASPACE_ASID_MAX_BITS) / 64)
+
+static struct address_space kernel_aspace __attribute__((section(".data")));
+
+static spinlock_t asid_lock = SPINLOCK_INIT;    // Protects the state below
+static uint32_t asid_bits __attribute__((section(".data"))) = 0;
+static uint64_t asid_generation __attribute__((section(".data"))) = 0;
+static uint64_t asid_map[ASID_MAP_WORDS] __attribute__((section(".data")));
+static uint32_t asid_cursor __attribute__((section(".data"))) = 1;
+static uint64_t active_asids[MAX_CPUS] __attribute__((section(".data")));
+static uint64_t reserved_asids[MAX_CPUS] __attribute__((section(".data")));
+static uint32_t flush_pending __attribute__((section(".data"))) = 0;  // CPU bitmask
+
+// Per CPU, written only by that CPU
+static struct address_space *loaded_aspace[MAX_CPUS] __attribute__((section(".data")));
+
+#define ASID_MASK               ((1ULL << asid_bits) - 1)
+
+static inline int asid_current(uint64_t asid) {
+    return (asid & ~ASID_MASK) == asid_generation;
+}
+
+static inline void asid_map_set(uint32_t number) {
+    asid_map[number / 64] |= 1ULL << (number % 64);
+}
+
+static inline int asid_map_test(uint32_t number) {
+    return (asid_map[number / 64] >> (number % 64)) & 1;
+}
+
+void aspace_init(void) {
+    kernel_aspace.root = arch_aspace_kernel_root();
+    kernel_aspace.asid = 0;
+    kernel_aspace.refs = 1;
+
+    aspace_cpu_init();
+}
+
+void aspace_cpu_init(void) {
+    uint32_t bits = arch_aspace_cpu_init();
+    if (bits > ASPACE_ASID_MAX_BITS) {
+        bits = ASPACE_ASID_MAX_BITS;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&asid_lock);
+    if (smp_cpu_id() == 0) {
+        asid_bits = bits;
+        asid_generation = bits ? (1ULL << bits) : 0;
+        asid_map_set(0);
+    } else if (bits < asid_bits) {
+        // Assumes all CPUs match; a narrower one would truncate tags
+        early_print("ASID: CPU has fewer ASID bits than the boot CPU\n");
+    }
+    loaded_aspace[smp_cpu_id()] = &kernel_aspace;
+    spin_unlock_irqrestore(&asid_lock, flags);
+}
+
+/**
+ * Start a new generation: forget every ASID except the ones CPUs are
+ * running and have every CPU flush before it loads another (asid_lock held)
+ */
+static void asid_rollover(void) {
+    asid_generation += 1ULL << asid_bits;
+    memset(asid_map, 0, sizeof(asid_map));
+    asid_map_set(0);
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        reserved_asids[cpu] = active_asids[cpu];
+        asid_map_set((uint32_t)(active_asids[cpu] & ASID_MASK));
+    }
+    flush_pending = (1U << MAX_CPUS) - 1;
+    asid_cursor = 1;
+}
+
+// Move a reserved ASID into the current generation; 0 if asid is not one
+static uint64_t asid_claim_reserved(uint64_t asid) {
+    uint64_t renewed = asid_generation | (asid & ASID_MASK);
+    int hit = 0;
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (reserved_asids[cpu] == asid) {
+            reserved_asids[cpu] = renewed;
+            hit = 1;
+        }
+    }
+    return hit ? renewed : 0;
+}
+
+// ASID for as in the current generation (asid_lock held)
+static uint64_t asid_assign(struct address_space *as) {
+    uint64_t asid = as->asid;
+    uint32_t number = (uint32_t)(asid & ASID_MASK);
+    uint32_t count = 1U << asid_bits;
+
+    if (asid) {
+        uint64_t renewed = asid_claim_reserved(asid);
+        if (renewed) return renewed;
+
+        // Keep the old number if nobody has taken it this generation
+        if (!asid_map_test(number)) {
+            asid_map_set(number);
+            return asid_generation | number;
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t n = asid_cursor; n < count; n++) {
+            if (!asid_map_test(n)) {
+                asid_map_set(n);
+                asid_cursor = n + 1;
+                return asid_generation | n;
+            }
+        }
+        asid_rollover();
+    }
+    return 0;  // Unreachable: a rollover frees all but MAX_CPUS numbers
+}
+
+void aspace_switch(struct address_space *as) {
+    if (!as) as = &kernel_aspace;
+
+    uint32_t cpu = smp_cpu_id();
+    if (loaded_aspace[cpu] == as) {
+        return;  // Tables and ASID already live here
+    }
+
+    spin_lock(&asid_lock);
+    if (asid_bits && as != &kernel_aspace && !asid_current(as->asid)) {
+        as->asid = asid_assign(as);
+    }
+    active_asids[cpu] = as->asid;
+    int flush = (flush_pending >> cpu) & 1;
+    flush_pending &= ~(1U << cpu);
+    spin_unlock(&asid_lock);
+
+    if (flush) {
+        arch_tlb_flush_all();
+    }
+    arch_aspace_load(as->root, asid_bits ? (uint32_t)(as->asid & ASID_MASK) : 0);
+    loaded_aspace[cpu] = as;
+}
+
+struct address_space *aspace_create(void) {
+    if (!kernel_aspace.root) {
+        return NULL;  // No kernel tables to share
+    }
+
+    struct address_space *as = kmalloc(sizeof(struct address_space));
+    if (!as) {
+        return NULL;
+    }
+    void *root = memory_alloc_pages(1);
+    if (!root) {
+        kfree(as);
+        return NULL;
+    }
+
+    // Top level copied, lower levels shared: kernel mappings stay common
+    memcpy(root, (void *)kernel_aspace.root, PAGE_SIZE_4K);
+    as->root = (uint64_t)root;
+    as->asid = 0;
+    as->refs = 1;
+    as->vmas = NULL;
+    as->vma_root = NULL;
+    as->vma_cache = NULL;
+    as->resident_pages = 0;
+    spin_lock_init(&as->vm_lock);
+    return as;
+}
+
+void aspace_get(struct address_space *as) {
+    if (!as) return;
+
+    unsigned long flags = spin_lock_irqsave(&asid_lock);
+    as->refs++;
+    spin_unlock_irqrestore(&asid_lock, flags);
+}
+
+/**
+ * Its last task has been switched away from everywhere by the time the
+ * final reference goes, so the tables are not loaded on any CPU
+ */
+void aspace_put(struct address_space *as) {
+    if (!as) return;
+
+    unsigned long flags = spin_lock_irqsave(&asid_lock);
+    uint32_t refs = --as->refs;
+    spin_unlock_irqrestore(&asid_lock, flags);
+
+    if (refs == 0) {
+        // Its ASID is retired with the generation, not reused now
+        vm_release(as);
+        memory_free_pages((void *)as->root, 1);
+        kfree(as);
+    }
+}
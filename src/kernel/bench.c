@@ -0,0 +1,423 @@
+/*
+ * MiniOS In-Kernel Microbenchmarks
+ *
+ * Each benchmark is a setup, an operation and a teardown. bench_run()
+ * times the operation in batches of BENCH_BATCH between two counter
+ * reads, so what is reported includes one indirect call per operation
+ * but not the cost of reading the counter. The fastest batch is the
+ * figure to track: the mean also carries whatever interrupts and
+ * preemptions landed in the run.
+ *
+ * On ARM64 the counter is CNTVCT, which ticks at the generic timer's
+ * rate rather than the core clock; the shell prints its frequency with
+ * the results so ticks convert to time.
+ */
+
+#include "bench.h"
+#include "format.h"
+#include "memory.h"
+#include "process.h"
+#include "sfs.h"
+#include "syscall.h"
+#include "timer.h"
+#include "vdso.h"
+#include "vfs.h"
+
+#define BENCH_FILE_SIZE     4096
+#define BENCH_READ_SIZE     512
+#define BENCH_TIMER_US      1000000     // Long enough never to fire
+#define BENCH_PATH_MAX      128
+
+struct bench_state {
+    size_t size;                        // Bytes or pages the op works on
+    void *src;
+    void *dst;
+    int fd;
+    char path[BENCH_PATH_MAX];
+    struct file_system *fs;
+    uint32_t timer;
+    const char *note;
+
+    // Context switch ping-pong with the helper task
+    int token;
+    int peer_ready;
+    int peer_cpu;
+    int peer_stop;
+    int peer_done;
+};
+
+struct bench {
+    const char *name;
+    size_t size;
+    uint32_t per_op;                    // Events each call of op() makes, 0 for 1
+    int (*setup)(struct bench_state *st, const char *dir);
+    void (*op)(struct bench_state *st);
+    void (*teardown)(struct bench_state *st);
+};
+
+// Heap
+
+static void bench_kmalloc(struct bench_state *st)
+{
+    kfree(kmalloc(st->size));
+}
+
+// Page allocator
+
+static void bench_pages(struct bench_state *st)
+{
+    void *pages = memory_alloc_pages(st->size);
+    if (pages) {
+        memory_free_pages(pages, st->size);
+    }
+}
+
+// Memory copies
+
+static void bench_buffers_teardown(struct bench_state *st)
+{
+    kfree(st->src);
+    kfree(st->dst);
+}
+
+static int bench_buffers_setup(struct bench_state *st, const char *dir)
+{
+    (void)dir;
+    st->src = kmalloc(st->size);
+    st->dst = kmalloc(st->size);
+    if (!st->src || !st->dst) {
+        bench_buffers_teardown(st);
+        return -1;
+    }
+    memset(st->src, 0x5a, st->size);
+    memset(st->dst, 0, st->size);
+    return 0;
+}
+
+static void bench_memcpy(struct bench_state *st)
+{
+    memcpy(st->dst, st->src, st->size);
+}
+
+static void bench_memset(struct bench_state *st)
+{
+    memset(st->dst, (int)st->size, st->size);
+}
+
+// System calls, kept out of the per-call statistics
+
+static uint64_t bench_getpid_calls;
+
+static int bench_syscall_setup(struct bench_state *st, const char *dir)
+{
+    (void)st;
+    (void)dir;
+    bench_getpid_calls = syscall_get_count(SYSCALL_GETPID);
+    return 0;
+}
+
+static void bench_syscall_teardown(struct bench_state *st)
+{
+    (void)st;
+    syscall_uncount(SYSCALL_GETPID, syscall_get_count(SYSCALL_GETPID) - bench_getpid_calls);
+}
+
+static void bench_syscall_dispatch(struct bench_state *st)
+{
+    (void)st;
+    syscall_dispatch(SYSCALL_GETPID, 0, 0, 0, 0, 0, 0);
+}
+
+// Tasks run in ring 0 on x86-64, where SYSRET cannot return to them
+static int bench_syscall_trap_setup(struct bench_state *st, const char *dir)
+{
+#ifdef __aarch64__
+    return bench_syscall_setup(st, dir);
+#else
+    (void)st;
+    (void)dir;
+    return BENCH_SKIPPED;
+#endif
+}
+
+static void bench_syscall_trap(struct bench_state *st)
+{
+    (void)st;
+#ifdef __aarch64__
+    sys_getpid();
+#endif
+}
+
+/*
+ * Context switches: the caller hands a token to a helper task and yields
+ * until it comes back, two switches per round. There is no way to pin
+ * the helper, so if it lands on another CPU the figure is the cost of a
+ * cross-CPU handoff instead, and the result says so.
+ */
+
+static void bench_switch_main(void *arg)
+{
+    struct bench_state *st = arg;
+
+    __atomic_store_n(&st->peer_cpu, (int)scheduler_get_current_task()->cpu, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->peer_ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&st->peer_stop, __ATOMIC_ACQUIRE)) {
+        if (__atomic_load_n(&st->token, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&st->token, 0, __ATOMIC_RELEASE);
+        }
+        process_yield();
+    }
+    // Last touch of st: the caller may return as soon as it sees this
+    __atomic_store_n(&st->peer_done, 1, __ATOMIC_RELEASE);
+}
+
+static int bench_switch_setup(struct bench_state *st, const char *dir)
+{
+    (void)dir;
+    struct task *self = scheduler_get_current_task();
+    if (!self) {
+        return BENCH_SKIPPED;
+    }
+
+    int pid;
+    if (self->sched_class == SCHED_CLASS_FAIR) {
+        pid = process_create_fair(bench_switch_main, st, "bench-switch", self->nice);
+    } else {
+        pid = process_create(bench_switch_main, st, "bench-switch", self->priority);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+
+    while (!__atomic_load_n(&st->peer_ready, __ATOMIC_ACQUIRE)) {
+        process_yield();
+    }
+    if ((uint32_t)__atomic_load_n(&st->peer_cpu, __ATOMIC_RELAXED) != self->cpu) {
+        st->note = "cross_cpu";
+    }
+    return 0;
+}
+
+static void bench_switch_teardown(struct bench_state *st)
+{
+    __atomic_store_n(&st->peer_stop, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&st->peer_done, __ATOMIC_ACQUIRE)) {
+        process_yield();
+    }
+}
+
+static void bench_switch(struct bench_state *st)
+{
+    __atomic_store_n(&st->token, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&st->token, __ATOMIC_ACQUIRE)) {
+        process_yield();
+    }
+}
+
+// VFS, on a scratch file in the chosen directory
+
+static int bench_file_setup(struct bench_state *st, const char *dir)
+{
+    size_t len = strlen(dir);
+    int n = snprintf(st->path, sizeof(st->path), "%s%s.bench",
+                     dir, len && dir[len - 1] == '/' ? "" : "/");
+    if (n < 0 || (size_t)n >= sizeof(st->path)) {
+        return -1;
+    }
+
+    st->src = kmalloc(BENCH_FILE_SIZE);
+    if (!st->src) {
+        return -1;
+    }
+    memset(st->src, 0x5a, BENCH_FILE_SIZE);
+
+    int fd = vfs_open(st->path, VFS_O_CREAT | VFS_O_TRUNC | VFS_O_WRONLY, 0644);
+    if (fd < 0) {
+        kfree(st->src);
+        return -1;
+    }
+    ssize_t written = vfs_write(fd, st->src, BENCH_FILE_SIZE);
+    vfs_close(fd);
+    if (written != BENCH_FILE_SIZE) {
+        vfs_unlink(st->path);
+        kfree(st->src);
+        return -1;
+    }
+
+    st->fd = vfs_open(st->path, VFS_O_RDONLY, 0);
+    if (st->fd < 0) {
+        vfs_unlink(st->path);
+        kfree(st->src);
+        return -1;
+    }
+    return 0;
+}
+
+static void bench_file_teardown(struct bench_state *st)
+{
+    vfs_close(st->fd);
+    vfs_unlink(st->path);
+    kfree(st->src);
+}
+
+static void bench_vfs_open_close(struct bench_state *st)
+{
+    int fd = vfs_open(st->path, VFS_O_RDONLY, 0);
+    if (fd >= 0) {
+        vfs_close(fd);
+    }
+}
+
+static void bench_vfs_read(struct bench_state *st)
+{
+    vfs_seek(st->fd, 0, VFS_SEEK_SET);
+    vfs_read(st->fd, st->src, st->size);
+}
+
+// SFS block allocator, when the directory is on an SFS mount
+
+static int bench_sfs_setup(struct bench_state *st, const char *dir)
+{
+    st->fs = vfs_get_filesystem(dir);
+    if (!st->fs || st->fs->type != &sfs_fs_type) {
+        return BENCH_SKIPPED;
+    }
+
+    uint32_t block = sfs_alloc_block(st->fs);
+    if (!block) {
+        return -1;
+    }
+    sfs_free_block(st->fs, block);
+    return 0;
+}
+
+static void bench_sfs_block(struct bench_state *st)
+{
+    uint32_t block = sfs_alloc_block(st->fs);
+    if (block) {
+        sfs_free_block(st->fs, block);
+    }
+}
+
+// Timers
+
+static void bench_timer_expired(void *data)
+{
+    (void)data;
+}
+
+static void bench_timer_create(struct bench_state *st)
+{
+    (void)st;
+    uint32_t id = timer_create(TIMER_TYPE_ONESHOT, BENCH_TIMER_US, bench_timer_expired, NULL);
+    if (id) {
+        timer_start(id);
+        timer_destroy(id);
+    }
+}
+
+static int bench_timer_setup(struct bench_state *st, const char *dir)
+{
+    (void)dir;
+    st->timer = timer_create(TIMER_TYPE_ONESHOT, BENCH_TIMER_US, bench_timer_expired, NULL);
+    return st->timer ? 0 : -1;
+}
+
+static void bench_timer_teardown(struct bench_state *st)
+{
+    timer_destroy(st->timer);
+}
+
+static void bench_timer_modify(struct bench_state *st)
+{
+    timer_modify(st->timer, BENCH_TIMER_US);
+    timer_stop(st->timer);
+}
+
+static const struct bench bench_table[] = {
+    {"kmalloc_32",          32,     0, NULL, bench_kmalloc, NULL},
+    {"kmalloc_256",         256,    0, NULL, bench_kmalloc, NULL},
+    {"kmalloc_4096",        4096,   0, NULL, bench_kmalloc, NULL},
+    {"pages_1",             1,      0, NULL, bench_pages, NULL},
+    {"pages_16",            16,     0, NULL, bench_pages, NULL},
+    {"memcpy_64",           64,     0, bench_buffers_setup, bench_memcpy, bench_buffers_teardown},
+    {"memcpy_1k",           1024,   0, bench_buffers_setup, bench_memcpy, bench_buffers_teardown},
+    {"memcpy_4k",           4096,   0, bench_buffers_setup, bench_memcpy, bench_buffers_teardown},
+    {"memcpy_64k",          65536,  0, bench_buffers_setup, bench_memcpy, bench_buffers_teardown},
+    {"memset_64",           64,     0, bench_buffers_setup, bench_memset, bench_buffers_teardown},
+    {"memset_1k",           1024,   0, bench_buffers_setup, bench_memset, bench_buffers_teardown},
+    {"memset_4k",           4096,   0, bench_buffers_setup, bench_memset, bench_buffers_teardown},
+    {"memset_64k",          65536,  0, bench_buffers_setup, bench_memset, bench_buffers_teardown},
+    {"syscall_dispatch",    0,      0, bench_syscall_setup, bench_syscall_dispatch, bench_syscall_teardown},
+    {"syscall_trap",        0,      0, bench_syscall_trap_setup, bench_syscall_trap, bench_syscall_teardown},
+    {"context_switch",      0,      2, bench_switch_setup, bench_switch, bench_switch_teardown},
+    {"vfs_open_close",      0,      0, bench_file_setup, bench_vfs_open_close, bench_file_teardown},
+    {"vfs_read_512",        BENCH_READ_SIZE, 0, bench_file_setup, bench_vfs_read, bench_file_teardown},
+    {"sfs_block",           0,      0, bench_sfs_setup, bench_sfs_block, NULL},
+    {"timer_create",        0,      0, NULL, bench_timer_create, NULL},
+    {"timer_modify",        0,      0, bench_timer_setup, bench_timer_modify, bench_timer_teardown},
+};
+
+#define BENCH_COUNT ((int)(sizeof(bench_table) / sizeof(bench_table[0])))
+
+int bench_count(void)
+{
+    return BENCH_COUNT;
+}
+
+const char *bench_name(int index)
+{
+    return index >= 0 && index < BENCH_COUNT ? bench_table[index].name : NULL;
+}
+
+int bench_run(int index, uint32_t iterations, const char *dir,
+              struct bench_result *result)
+{
+    if (index < 0 || index >= BENCH_COUNT || !result ||
+        iterations == 0 || iterations > BENCH_MAX_ITERATIONS) {
+        return -1;
+    }
+
+    const struct bench *b = &bench_table[index];
+    struct bench_state st;
+    memset(&st, 0, sizeof(st));
+    st.size = b->size;
+
+    if (b->setup) {
+        int status = b->setup(&st, dir ? dir : "/");
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    // One untimed batch to warm caches and fill allocator free lists
+    for (uint32_t i = 0; i < BENCH_BATCH; i++) {
+        b->op(&st);
+    }
+
+    uint32_t batches = (iterations + BENCH_BATCH - 1) / BENCH_BATCH;
+    uint64_t total = 0;
+    uint64_t fastest = UINT64_MAX;
+    for (uint32_t n = 0; n < batches; n++) {
+        uint64_t start = arch_vdso_read_counter();
+        for (uint32_t i = 0; i < BENCH_BATCH; i++) {
+            b->op(&st);
+        }
+        uint64_t elapsed = arch_vdso_read_counter() - start;
+        total += elapsed;
+        if (elapsed < fastest) {
+            fastest = elapsed;
+        }
+    }
+
+    if (b->teardown) {
+        b->teardown(&st);
+    }
+
+    uint64_t per_batch = (uint64_t)BENCH_BATCH * (b->per_op ? b->per_op : 1);
+    result->iterations = batches * BENCH_BATCH;
+    result->mean_x100 = total * BENCH_SCALE / (per_batch * batches);
+    result->min_x100 = fastest * BENCH_SCALE / per_batch;
+    result->note = st.note;
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * MiniOS Boot Trace Implementation
+ *
+ * A mark claims its slot with an atomic add and publishes it with a
+ * release store of the name, so deferred init tasks on other CPUs can
+ * record alongside kernel_main and readers skip a slot still being
+ * filled in.
+ */
+
+#include "boot_trace.h"
+#include "smp.h"
+#include "vdso.h"
+
+static struct boot_trace_entry boot_trace[BOOT_TRACE_MAX];
+static volatile uint32_t boot_trace_next = 0;
+
+void boot_trace_mark(const char *name)
+{
+    uint64_t now = arch_vdso_read_counter();
+
+    uint32_t index = __atomic_fetch_add(&boot_trace_next, 1, __ATOMIC_RELAXED);
+    if (index >= BOOT_TRACE_MAX) {
+        return;
+    }
+
+    struct boot_trace_entry *entry = &boot_trace[index];
+    entry->counter = now;
+    entry->cpu = smp_cpu_id();
+    __atomic_store_n(&entry->name, name, __ATOMIC_RELEASE);
+}
+
+int boot_trace_get(uint32_t index, struct boot_trace_entry *entry)
+{
+    if (!entry || index >= boot_trace_count()) {
+        return -1;
+    }
+
+    const char *name = __atomic_load_n(&boot_trace[index].name, __ATOMIC_ACQUIRE);
+    if (!name) {
+        return -1;
+    }
+    entry->name = name;
+    entry->counter = boot_trace[index].counter;
+    entry->cpu = boot_trace[index].cpu;
+    return 0;
+}
+
+uint32_t boot_trace_count(void)
+{
+    uint32_t count = __atomic_load_n(&boot_trace_next, __ATOMIC_RELAXED);
+    return count < BOOT_TRACE_MAX ? count : BOOT_TRACE_MAX;
+}
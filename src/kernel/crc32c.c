@@ -0,0 +1,166 @@
+/*
+ * MiniOS CRC32C (Castagnoli)
+ *
+ * Reflected polynomial 0x82F63B78, register inverted on the way in and
+ * out. The first call picks the implementation: the CPU instruction when
+ * the CPU reports it, otherwise slicing-by-8, whose eight 256-entry tables
+ * are built then. Either way the data is consumed eight bytes per step
+ * once aligned; both architectures are little-endian, so a word holds its
+ * bytes in stream order.
+ */
+
+#include "kernel.h"
+#include "crc32c.h"
+
+#define CRC32C_POLY         0x82F63B78u
+
+#define CRC32C_UNKNOWN      0
+#define CRC32C_TABLE        1
+#define CRC32C_HW           2
+
+// Word loads that may alias whatever the caller's buffer holds
+typedef uint64_t __attribute__((may_alias)) crc32c_word_t;
+
+static int crc32c_mode = CRC32C_UNKNOWN;
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_build_tables(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc32c_table[0][i] = crc;
+    }
+    // Table k advances a byte k more zero bytes through the register
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w = *(const crc32c_word_t *)p ^ crc;
+        crc = crc32c_table[7][w & 0xFF] ^
+              crc32c_table[6][(w >> 8) & 0xFF] ^
+              crc32c_table[5][(w >> 16) & 0xFF] ^
+              crc32c_table[4][(w >> 24) & 0xFF] ^
+              crc32c_table[3][(w >> 32) & 0xFF] ^
+              crc32c_table[2][(w >> 40) & 0xFF] ^
+              crc32c_table[1][(w >> 48) & 0xFF] ^
+              crc32c_table[0][w >> 56];
+    }
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(ARCH_X86_64)
+
+// SSE4.2: CPUID.1:ECX bit 20
+#define CPUID_1_ECX_SSE42   (1U << 20)
+
+static int crc32c_hw_present(void)
+{
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (ecx & CPUID_1_ECX_SSE42) != 0;
+}
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+    while (len && ((uintptr_t)p & 7)) {
+        __asm__("crc32b %1, %k0" : "+r"(c) : "rm"(*p));
+        p++;
+        len--;
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        __asm__("crc32q %1, %0" : "+r"(c) : "rm"(*(const crc32c_word_t *)p));
+    }
+    while (len--) {
+        __asm__("crc32b %1, %k0" : "+r"(c) : "rm"(*p));
+        p++;
+    }
+    return (uint32_t)c;
+}
+
+#elif defined(ARCH_ARM64)
+
+// ID_AA64ISAR0_EL1.CRC32, bits [19:16]: nonzero when CRC32{C}* exist
+#define ISAR0_CRC32_SHIFT   16
+
+static int crc32c_hw_present(void)
+{
+    uint64_t isar0;
+    __asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+    return ((isar0 >> ISAR0_CRC32_SHIFT) & 0xF) != 0;
+}
+
+// The kernel is built for base ARMv8, so each use enables the extension
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7)) {
+        __asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*p));
+        p++;
+        len--;
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        __asm__(".arch_extension crc\n\tcrc32cx %w0, %w0, %x1"
+                : "+r"(crc) : "r"(*(const crc32c_word_t *)p));
+    }
+    while (len--) {
+        __asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*p));
+        p++;
+    }
+    return crc;
+}
+
+#else
+
+static int crc32c_hw_present(void)
+{
+    return 0;
+}
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    return crc32c_sw(crc, p, len);
+}
+
+#endif
+
+// Concurrent first calls make the same choice and build the same tables
+static int crc32c_select(void)
+{
+    int mode = __atomic_load_n(&crc32c_mode, __ATOMIC_ACQUIRE);
+    if (mode == CRC32C_UNKNOWN) {
+        mode = CRC32C_TABLE;
+        if (crc32c_hw_present()) {
+            mode = CRC32C_HW;
+        } else {
+            crc32c_build_tables();
+        }
+        __atomic_store_n(&crc32c_mode, mode, __ATOMIC_RELEASE);
+    }
+    return mode;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    if (crc32c_select() == CRC32C_HW) {
+        return ~crc32c_hw(~crc, p, len);
+    }
+    return ~crc32c_sw(~crc, p, len);
+}
@@ -7,9 +7,14 @@
 #include "driver.h"
 #include "memory.h"
 #include "kernel.h"
+#include "process.h"
 
-// Global device list
+// Global device list, plus a name hash and per-type lists for lookups.
+// Slot 0 of device_types holds DEVICE_TYPE_UNKNOWN and any type past
+// DEVICE_TYPE_COUNT, so lookups there still compare the type.
 static struct device * volatile device_list = NULL;
+static struct device *device_hash[DEVICE_HASH_BUCKETS];
+static struct device *device_types[DEVICE_TYPE_COUNT];
 static volatile uint32_t device_count = 0;
 static volatile uint32_t next_device_id = 1;
 
@@ -21,6 +26,11 @@ static volatile uint32_t error_devices = 0;
 // Device subsystem initialization flag
 volatile int device_subsystem_initialized = 0;
 
+static inline uint32_t device_type_slot(uint32_t type)
+{
+    return type < DEVICE_TYPE_COUNT ? type : DEVICE_TYPE_UNKNOWN;
+}
+
 int device_init(struct boot_info *boot_info)
 {
     early_print("Initializing device subsystem...\n");
@@ -76,7 +86,7 @@ struct device *device_create(const char *name, uint32_t type)
     }
     
     // Allocate memory for device structure
-    struct device *dev = memory_alloc(sizeof(struct device), MEMORY_ALIGN_4K);
+    struct device *dev = memory_alloc(sizeof(struct device), 8);
     if (!dev) {
         early_print("Failed to allocate memory for device\n");
         return NULL;
@@ -113,9 +123,15 @@ int device_register(struct device *device)
     
     // Add to global device list
     // Use compiler barrier to prevent reordering of these critical writes
+    uint32_t bucket = device_name_hash(device->name) & (DEVICE_HASH_BUCKETS - 1);
+    uint32_t slot = device_type_slot(device->type);
     device->next = device_list;
+    device->hash_next = device_hash[bucket];
+    device->type_next = device_types[slot];
     __asm__ volatile("" ::: "memory");  // Compiler barrier
     device_list = device;
+    device_hash[bucket] = device;
+    device_types[slot] = device;
     __asm__ volatile("" ::: "memory");  // Compiler barrier
     device_count++;
     total_devices++;
@@ -137,16 +153,25 @@ void device_unregister(struct device *device)
         return;
     }
     
-    // Remove from device list
-    if (device_list == device) {
-        device_list = device->next;
-    } else {
-        struct device *current = device_list;
-        while (current && current->next != device) {
-            current = current->next;
+    // Remove from the device list and the lookup tables
+    struct device **pp;
+    for (pp = (struct device **)&device_list; *pp; pp = &(*pp)->next) {
+        if (*pp == device) {
+            *pp = device->next;
+            break;
+        }
+    }
+    pp = &device_hash[device_name_hash(device->name) & (DEVICE_HASH_BUCKETS - 1)];
+    for (; *pp; pp = &(*pp)->hash_next) {
+        if (*pp == device) {
+            *pp = device->hash_next;
+            break;
         }
-        if (current) {
-            current->next = device->next;
+    }
+    for (pp = &device_types[device_type_slot(device->type)]; *pp; pp = &(*pp)->type_next) {
+        if (*pp == device) {
+            *pp = device->type_next;
+            break;
         }
     }
     
@@ -172,24 +197,12 @@ struct device *device_find_by_name(const char *name)
         return NULL;
     }
     
-    struct device *current = device_list;
+    struct device *current = device_hash[device_name_hash(name) & (DEVICE_HASH_BUCKETS - 1)];
     while (current) {
-        // Simple string comparison
-        int i;
-        int match = 1;
-        for (i = 0; i < 64; i++) {
-            if (current->name[i] != name[i]) {
-                match = 0;
-                break;
-            }
-            if (name[i] == 0) {
-                break;
-            }
-        }
-        if (match) {
+        if (strcmp(current->name, name) == 0) {
             return current;
         }
-        current = current->next;
+        current = current->hash_next;
     }
     
     return NULL;
@@ -201,12 +214,12 @@ struct device *device_find_by_type(uint32_t type)
         return NULL;
     }
     
-    struct device *current = device_list;
+    struct device *current = device_types[device_type_slot(type)];
     while (current) {
         if (current->type == type) {
             return current;
         }
-        current = current->next;
+        current = current->type_next;
     }
     
     return NULL;
@@ -219,12 +232,12 @@ int device_get_by_type(uint32_t type, struct device **devices, int max_devices)
     }
     
     int count = 0;
-    struct device *current = device_list;
+    struct device *current = device_types[device_type_slot(type)];
     while (current && count < max_devices) {
         if (current->type == type) {
             devices[count++] = current;
         }
-        current = current->next;
+        current = current->type_next;
     }
     
     return count;
@@ -334,6 +347,68 @@ int device_ioctl(struct device *device, unsigned int cmd, unsigned long arg)
     return driver_ioctl(device, cmd, arg);
 }
 
+// Deferred initializations, one slot each for as long as the system runs
+#define DEVICE_ASYNC_MAX 8
+
+struct device_async_init {
+    const char *name;
+    int (*fn)(void);
+};
+
+static struct device_async_init device_async[DEVICE_ASYNC_MAX];
+static volatile uint32_t device_async_used = 0;
+static volatile uint32_t device_async_pending = 0;
+static struct wait_queue device_async_wait_queue = WAIT_QUEUE_INIT;
+
+static int device_async_run(struct device_async_init *init)
+{
+    int result = init->fn();
+    if (result < 0) {
+        early_print("Warning: Deferred init failed: ");
+        early_print(init->name);
+        early_print("\n");
+    }
+    return result;
+}
+
+static void device_async_main(void *arg)
+{
+    device_async_run(arg);
+
+    __atomic_fetch_sub(&device_async_pending, 1, __ATOMIC_RELEASE);
+    wake_up(&device_async_wait_queue);
+}
+
+int device_init_async(const char *name, int (*fn)(void))
+{
+    if (!fn) {
+        return -1;
+    }
+
+    uint32_t slot = __atomic_fetch_add(&device_async_used, 1, __ATOMIC_RELAXED);
+    if (slot >= DEVICE_ASYNC_MAX) {
+        struct device_async_init inline_init = { name, fn };
+        return device_async_run(&inline_init);
+    }
+
+    struct device_async_init *init = &device_async[slot];
+    init->name = name;
+    init->fn = fn;
+
+    __atomic_fetch_add(&device_async_pending, 1, __ATOMIC_RELAXED);
+    if (process_create_fair(device_async_main, init, name, 0) < 0) {
+        __atomic_fetch_sub(&device_async_pending, 1, __ATOMIC_RELAXED);
+        return device_async_run(init);
+    }
+    return 0;
+}
+
+void device_async_wait(void)
+{
+    wait_event(&device_async_wait_queue,
+               __atomic_load_n(&device_async_pending, __ATOMIC_ACQUIRE) == 0);
+}
+
 void device_list_all(void)
 {
     if (!device_subsystem_initialized) {
@@ -8,18 +8,29 @@
 #include "memory.h"
 #include "kernel.h"
 
-// Global driver list
+// Global driver list, plus a name hash and per-type lists for lookups.
+// Slot 0 of driver_types holds drivers that match any type (and types
+// past DEVICE_TYPE_COUNT); driver_find_for_device() always checks it.
 static struct device_driver *driver_list = NULL;
+static struct device_driver *driver_hash[DEVICE_HASH_BUCKETS];
+static struct device_driver *driver_types[DEVICE_TYPE_COUNT];
 static uint32_t driver_count = 0;
 
 // Driver subsystem initialization flag
 static int driver_subsystem_initialized = 0;
 
+static inline uint32_t driver_type_slot(uint32_t type)
+{
+    return type < DEVICE_TYPE_COUNT ? type : 0;
+}
+
 int driver_init(void)
 {
     early_print("Initializing driver subsystem...\n");
     
     driver_list = NULL;
+    memset(driver_hash, 0, sizeof(driver_hash));
+    memset(driver_types, 0, sizeof(driver_types));
     driver_count = 0;
     driver_subsystem_initialized = 1;
     
@@ -44,9 +55,15 @@ int driver_register(struct device_driver *driver)
         return -1; // Already registered
     }
     
-    // Add to global driver list
+    // Add to global driver list and the lookup tables
+    uint32_t bucket = device_name_hash(driver->name) & (DEVICE_HASH_BUCKETS - 1);
+    uint32_t slot = driver_type_slot(driver->type);
     driver->next = driver_list;
+    driver->hash_next = driver_hash[bucket];
+    driver->type_next = driver_types[slot];
     driver_list = driver;
+    driver_hash[bucket] = driver;
+    driver_types[slot] = driver;
     driver_count++;
     
     early_print("Driver registered: ");
@@ -66,16 +83,25 @@ void driver_unregister(struct device_driver *driver)
         return;
     }
     
-    // Remove from driver list
-    if (driver_list == driver) {
-        driver_list = driver->next;
-    } else {
-        struct device_driver *current = driver_list;
-        while (current && current->next != driver) {
-            current = current->next;
+    // Remove from the driver list and the lookup tables
+    struct device_driver **pp;
+    for (pp = &driver_list; *pp; pp = &(*pp)->next) {
+        if (*pp == driver) {
+            *pp = driver->next;
+            break;
+        }
+    }
+    pp = &driver_hash[device_name_hash(driver->name) & (DEVICE_HASH_BUCKETS - 1)];
+    for (; *pp; pp = &(*pp)->hash_next) {
+        if (*pp == driver) {
+            *pp = driver->hash_next;
+            break;
         }
-        if (current) {
-            current->next = driver->next;
+    }
+    for (pp = &driver_types[driver_type_slot(driver->type)]; *pp; pp = &(*pp)->type_next) {
+        if (*pp == driver) {
+            *pp = driver->type_next;
+            break;
         }
     }
     
@@ -92,24 +118,12 @@ struct device_driver *driver_find_by_name(const char *name)
         return NULL;
     }
     
-    struct device_driver *current = driver_list;
+    struct device_driver *current = driver_hash[device_name_hash(name) & (DEVICE_HASH_BUCKETS - 1)];
     while (current) {
-        // Simple string comparison
-        int i;
-        int match = 1;
-        for (i = 0; i < 256; i++) { // Reasonable limit
-            if (current->name[i] != name[i]) {
-                match = 0;
-                break;
-            }
-            if (name[i] == 0) {
-                break;
-            }
-        }
-        if (match) {
+        if (strcmp(current->name, name) == 0) {
             return current;
         }
-        current = current->next;
+        current = current->hash_next;
     }
     
     return NULL;
@@ -121,15 +135,21 @@ struct device_driver *driver_find_for_device(struct device *device)
         return NULL;
     }
     
-    struct device_driver *current = driver_list;
-    while (current) {
-        if (driver_match_device(current, device)) {
-            return current;
+    // Drivers for this type first, then those that match any type
+    uint32_t slot = driver_type_slot(device->type);
+    for (;;) {
+        struct device_driver *current = driver_types[slot];
+        while (current) {
+            if (driver_match_device(current, device)) {
+                return current;
+            }
+            current = current->type_next;
         }
-        current = current->next;
+        if (slot == 0) {
+            return NULL;
+        }
+        slot = 0;
     }
-    
-    return NULL;
 }
 
 int driver_match_device(struct device_driver *driver, struct device *device)
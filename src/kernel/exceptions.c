@@ -5,6 +5,7 @@
 
 #include "exceptions.h"
 #include "kernel.h"
+#include "process.h"
 #include <stdint.h>
 
 // Exception subsystem initialization state
@@ -121,6 +122,30 @@ void exception_default_handler(uint32_t exception_num,
 void exception_page_fault_handler(uint32_t exception_num,
                                   struct exception_context *ctx)
 {
+    // Demand-paged or copy-on-write user page: resolve it and retry, as
+    // system time of the faulting task
+#ifdef ARCH_ARM64
+    uint32_t ec = (ctx->esr >> 26) & 0x3F;
+    uint32_t access = (ec == 0x20 || ec == 0x21) ?  // Instruction abort
+                      VM_ACCESS_EXEC :
+                      (((ctx->esr >> 6) & 1) ? VM_ACCESS_WRITE : 0);  // ISS.WnR
+    scheduler_account_entry((ctx->spsr & 0xF) == 0);  // From EL0t
+    int resolved = vm_handle_fault(ctx->far, access) == 0;
+    scheduler_account_exit(0);
+    if (resolved) {
+        return;
+    }
+#elif defined(ARCH_X86_64)
+    uint32_t access = ((ctx->error_code & 2) ? VM_ACCESS_WRITE : 0) |
+                      ((ctx->error_code & 0x10) ? VM_ACCESS_EXEC : 0);
+    scheduler_account_entry((ctx->error_code & 4) != 0);  // From ring 3
+    int resolved = vm_handle_fault(ctx->cr2, access) == 0;
+    scheduler_account_exit(0);
+    if (resolved) {
+        return;
+    }
+#endif
+
     early_print("\n*** PAGE FAULT ***\n");
     
     // Print fault information
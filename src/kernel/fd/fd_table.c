@@ -1,6 +1,14 @@
 /*
  * MiniOS File Descriptor Management
  * Per-process file descriptor tables
+ *
+ * Every task owns a table, cloned from its creator's when it is created;
+ * outside a task (boot, the kernel shell) the kernel's table is used. The
+ * VFS allocates its descriptors here, so each task numbers its files from
+ * the lowest free slot independently. A bitmap tracks used slots and
+ * next_fd records that nothing below it is free, so allocation skips full
+ * words instead of probing descriptors one at a time. Tables start at
+ * FD_TABLE_INITIAL_SIZE entries and double when full, up to MAX_OPEN_FILES.
  */
 
 #include "fd.h"
@@ -8,11 +16,11 @@
 #include "kernel.h"
 #include "process.h"
 
+#define FD_MAP_WORDS(size)  (((size) + 31) / 32)
+
 // Global FD system state
 static int fd_initialized = 0;
-// Don't use static fd_table - causes BSS alignment/size issues
-// static struct fd_table static_fd_table __attribute__((section(".data")));
-static struct fd_table *current_fd_table = NULL;
+static struct fd_table *kernel_fd_table = NULL;
 
 int fd_init(void)
 {
@@ -23,67 +31,97 @@ int fd_init(void)
         return VFS_SUCCESS;
     }
     
-    // Allocate FD table using simple heap allocator (kmalloc)
-    early_print("FD init: Allocating FD table with kmalloc...\n");
-    current_fd_table = (struct fd_table *)kmalloc(sizeof(struct fd_table));
-    if (!current_fd_table) {
+    kernel_fd_table = fd_table_create();
+    if (!kernel_fd_table) {
         early_print("FD init: Failed to allocate FD table\n");
         return VFS_ENOMEM;
     }
     
-    early_print("FD init: FD table allocated successfully\n");
-    
-    // Use memset to zero the entire structure - safe and optimized
-    early_print("FD init: Zeroing FD table...\n");
-    memset(current_fd_table, 0, sizeof(struct fd_table));
-    early_print("FD init: FD table zeroed\n");
-    
-    // Set initial values
-    current_fd_table->ref_count = 1;
-    
     fd_initialized = 1;
+
+    // Reserve 0-2 so tasks inherit them and files start at 3
+    fd_setup_stdio();
     
     early_print("FD init: Completed successfully\n");
     return VFS_SUCCESS;
 }
 
+static int fd_table_alloc_slots(struct fd_table *table, int size)
+{
+    struct file_descriptor *fds = kmalloc(sizeof(struct file_descriptor) * size);
+    uint32_t *open_map = kmalloc(sizeof(uint32_t) * FD_MAP_WORDS(size));
+    if (!fds || !open_map) {
+        kfree(fds);
+        kfree(open_map);
+        return VFS_ENOMEM;
+    }
+
+    memset(fds, 0, sizeof(struct file_descriptor) * size);
+    memset(open_map, 0, sizeof(uint32_t) * FD_MAP_WORDS(size));
+
+    if (table->fds) {
+        memcpy(fds, table->fds, sizeof(struct file_descriptor) * table->size);
+        memcpy(open_map, table->open_map, sizeof(uint32_t) * FD_MAP_WORDS(table->size));
+        kfree(table->fds);
+        kfree(table->open_map);
+    }
+
+    table->fds = fds;
+    table->open_map = open_map;
+    table->size = size;
+    return VFS_SUCCESS;
+}
+
 struct fd_table *fd_table_create(void)
 {
-    struct fd_table *table = memory_alloc(sizeof(struct fd_table), MEMORY_ALIGN_4K);
+    struct fd_table *table = kmalloc(sizeof(struct fd_table));
     if (!table) {
         return NULL;
     }
+    memset(table, 0, sizeof(struct fd_table));
 
-    // Initialize all file descriptors as unused
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        table->fds[i].flags = 0;  // Not FD_FLAG_USED
-        table->fds[i].file = NULL;
-        table->fds[i].open_flags = 0;
-        table->fds[i].mode = 0;
+    if (fd_table_alloc_slots(table, FD_TABLE_INITIAL_SIZE) != VFS_SUCCESS) {
+        kfree(table);
+        return NULL;
     }
 
     table->next_fd = 0;
+    table->count = 0;
     table->ref_count = 1;
 
     return table;
 }
 
+/**
+ * Drop a reference; the last one closes every descriptor and frees the
+ * table
+ */
 void fd_table_destroy(struct fd_table *table)
 {
     if (!table) {
         return;
     }
+
+    if (--table->ref_count > 0) {
+        return;
+    }
     
     // Close all open files
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+    for (int i = 0; i < table->size; i++) {
         if (table->fds[i].flags & FD_FLAG_USED) {
             fd_free(table, i);
         }
     }
     
-    memory_free(table);
+    kfree(table->fds);
+    kfree(table->open_map);
+    kfree(table);
 }
 
+/**
+ * Copy a table for a new task. Descriptors keep their numbers and share
+ * the open file (and its position) with the source.
+ */
 struct fd_table *fd_table_clone(struct fd_table *src)
 {
     if (!src) {
@@ -94,82 +132,113 @@ struct fd_table *fd_table_clone(struct fd_table *src)
     if (!new_table) {
         return NULL;
     }
+
+    if (src->size > new_table->size &&
+        fd_table_alloc_slots(new_table, src->size) != VFS_SUCCESS) {
+        fd_table_destroy(new_table);
+        return NULL;
+    }
     
     // Copy file descriptors
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+    for (int i = 0; i < src->size; i++) {
         if (src->fds[i].flags & FD_FLAG_USED) {
-            new_table->fds[i] = src->fds[i];
+            struct file_descriptor *dst = &new_table->fds[i];
+            dst->flags = src->fds[i].flags;
+            dst->file = src->fds[i].file;
+            dst->open_flags = src->fds[i].open_flags;
+            dst->mode = src->fds[i].mode;
             
             // Increment file reference count
-            if (new_table->fds[i].file) {
-                new_table->fds[i].file->ref_count++;
+            if (dst->file) {
+                dst->file->ref_count++;
             }
         }
     }
-    
+
+    memcpy(new_table->open_map, src->open_map, sizeof(uint32_t) * FD_MAP_WORDS(src->size));
     new_table->next_fd = src->next_fd;
+    new_table->count = src->count;
     
     return new_table;
 }
 
+/**
+ * Allocate the lowest free descriptor, growing the table when it is full
+ */
 int fd_allocate(struct fd_table *table)
 {
     if (!table) {
         return -1;
     }
-    
-    // Search for unused file descriptor starting from hint
-    int start = table->next_fd;
-    int fd = start;
-    
-    do {
-        if (!(table->fds[fd].flags & FD_FLAG_USED)) {
-            table->fds[fd].flags |= FD_FLAG_USED;
-            table->next_fd = (fd + 1) % MAX_OPEN_FILES;
-            return fd;
+
+    if (table->count >= table->size) {
+        if (table->size >= MAX_OPEN_FILES) {
+            return -1;  // No free file descriptors
         }
-        
-        fd = (fd + 1) % MAX_OPEN_FILES;
-    } while (fd != start);
+        int new_size = table->size * 2;
+        if (new_size > MAX_OPEN_FILES) {
+            new_size = MAX_OPEN_FILES;
+        }
+        if (fd_table_alloc_slots(table, new_size) != VFS_SUCCESS) {
+            return -1;
+        }
+    }
+
+    // count < size guarantees a clear bit at or after the hint
+    int words = FD_MAP_WORDS(table->size);
+    for (int word = table->next_fd / 32; word < words; word++) {
+        uint32_t free_bits = ~table->open_map[word];
+        if (word == table->next_fd / 32) {
+            free_bits &= ~0U << (table->next_fd % 32);
+        }
+        if (!free_bits) {
+            continue;
+        }
+
+        int fd = word * 32 + __builtin_ctz(free_bits);
+        if (fd >= table->size) {
+            break;
+        }
+        table->open_map[word] |= 1U << (fd % 32);
+        table->fds[fd].flags = FD_FLAG_USED;
+        table->count++;
+        table->next_fd = fd + 1;
+        return fd;
+    }
     
-    // No free file descriptors
     return -1;
 }
 
 void fd_free(struct fd_table *table, int fd)
 {
-    if (!table || fd < 0 || fd >= MAX_OPEN_FILES) {
+    if (!table || fd < 0 || fd >= table->size) {
         return;
     }
     
     if (table->fds[fd].flags & FD_FLAG_USED) {
-        // Close associated file if any
-        if (table->fds[fd].file) {
-            struct file *file = table->fds[fd].file;
-            
-            // Decrement reference count
-            if (file->ref_count > 0) {
-                file->ref_count--;
-            }
-            
-            // Close file if no more references
-            if (file->ref_count == 0 && file->ops && file->ops->close) {
-                file->ops->close(file);
-                kfree(file);
-            }
-        }
+        struct file *file = table->fds[fd].file;
         
         // Clear file descriptor
         table->fds[fd].flags = 0;
         table->fds[fd].file = NULL;
         table->fds[fd].open_flags = 0;
         table->fds[fd].mode = 0;
+        table->open_map[fd / 32] &= ~(1U << (fd % 32));
+        table->count--;
+        if (fd < table->next_fd) {
+            table->next_fd = fd;
+        }
+
+        // Drop this descriptor's reference; the last one closes the file
+        if (file) {
+            vfs_file_put(file);
+        }
     }
 }
 
 struct file_descriptor *fd_get(struct fd_table *table, int fd)
 {
-    if (!table || fd < 0 || fd >= MAX_OPEN_FILES) {
+    if (!table || fd < 0 || fd >= table->size) {
         return NULL;
     }
     
@@ -182,7 +251,7 @@ struct file_descriptor *fd_get(struct fd_table *table, int fd)
 
 int fd_assign(struct fd_table *table, int fd, struct file *file, int flags)
 {
-    if (!table || !file || fd < 0 || fd >= MAX_OPEN_FILES) {
+    if (!table || !file || fd < 0 || fd >= table->size) {
         return VFS_EINVAL;
     }
     
@@ -200,9 +269,30 @@ int fd_assign(struct fd_table *table, int fd, struct file *file, int flags)
     return VFS_SUCCESS;
 }
 
+/**
+ * Give an open file a descriptor. The descriptor takes over the caller's
+ * reference. Returns the descriptor, or -1 when the table is full.
+ */
+int fd_install(struct fd_table *table, struct file *file, int flags)
+{
+    if (!table || !file) {
+        return -1;
+    }
+
+    int fd = fd_allocate(table);
+    if (fd < 0) {
+        return -1;
+    }
+
+    table->fds[fd].file = file;
+    table->fds[fd].open_flags = flags;
+    table->fds[fd].mode = file->mode;
+    return fd;
+}
+
 int fd_is_valid(struct fd_table *table, int fd)
 {
-    if (!table || fd < 0 || fd >= MAX_OPEN_FILES) {
+    if (!table || fd < 0 || fd >= table->size) {
         return 0;
     }
     
@@ -212,41 +302,23 @@ int fd_is_valid(struct fd_table *table, int fd)
 // Process-level FD operations (use current process FD table)
 static struct fd_table *get_current_fd_table(void)
 {
-    // In a full implementation, this would get the FD table from the current process
-    // For now, use the global FD table
-    return current_fd_table;
+    struct task *task = scheduler_get_current_task();
+    if (task && task->files) {
+        return task->files;
+    }
+    return kernel_fd_table;
 }
 
+// The VFS descriptor namespace is the current task's table, so these are
+// thin wrappers that fold VFS error codes into -1
 int fd_open(const char *path, int flags, int mode)
 {
     if (!fd_initialized || !path) {
         return -1;
     }
     
-    struct fd_table *table = get_current_fd_table();
-    if (!table) {
-        return -1;
-    }
-    
-    // Allocate file descriptor
-    int fd = fd_allocate(table);
-    if (fd < 0) {
-        return -1;  // No free file descriptors
-    }
-    
-    // Open file through VFS
-    int vfs_fd = vfs_open(path, flags, mode);
-    if (vfs_fd < 0) {
-        fd_free(table, fd);
-        return -1;  // VFS open failed
-    }
-    
-    // For now, just mark FD as allocated without creating file structure
-    // Full implementation would create proper file structure
-    table->fds[fd].open_flags = flags;
-    table->fds[fd].mode = mode;
-    
-    return fd;
+    int fd = vfs_open(path, flags, mode);
+    return fd < 0 ? -1 : fd;
 }
 
 ssize_t fd_read(int fd, void *buf, size_t count)
@@ -255,32 +327,8 @@ ssize_t fd_read(int fd, void *buf, size_t count)
         return -1;
     }
     
-    struct fd_table *table = get_current_fd_table();
-    if (!table) {
-        return -1;
-    }
-    
-    struct file_descriptor *fdesc = fd_get(table, fd);
-    if (!fdesc || !fdesc->file) {
-        return -1;
-    }
-    
-    // Check if file is readable
-    if ((fdesc->open_flags & VFS_O_WRONLY) == VFS_O_WRONLY) {
-        return -1;  // Write-only file
-    }
-    
-    struct file *file = fdesc->file;
-    if (file->ops && file->ops->read) {
-        ssize_t result = file->ops->read(file, buf, count, file->position);
-        if (result > 0) {
-            file->position += result;
-        }
-        return result;
-    }
-    
-    // For now, return VFS read (placeholder)
-    return vfs_read(fd, buf, count);
+    ssize_t result = vfs_read(fd, buf, count);
+    return result < 0 ? -1 : result;
 }
 
 ssize_t fd_write(int fd, const void *buf, size_t count)
@@ -289,32 +337,8 @@ ssize_t fd_write(int fd, const void *buf, size_t count)
         return -1;
     }
     
-    struct fd_table *table = get_current_fd_table();
-    if (!table) {
-        return -1;
-    }
-    
-    struct file_descriptor *fdesc = fd_get(table, fd);
-    if (!fdesc || !fdesc->file) {
-        return -1;
-    }
-    
-    // Check if file is writable
-    if ((fdesc->open_flags & VFS_O_RDONLY) == VFS_O_RDONLY) {
-        return -1;  // Read-only file
-    }
-    
-    struct file *file = fdesc->file;
-    if (file->ops && file->ops->write) {
-        ssize_t result = file->ops->write(file, buf, count, file->position);
-        if (result > 0) {
-            file->position += result;
-        }
-        return result;
-    }
-    
-    // For now, return VFS write (placeholder)
-    return vfs_write(fd, buf, count);
+    ssize_t result = vfs_write(fd, buf, count);
+    return result < 0 ? -1 : result;
 }
 
 off_t fd_seek(int fd, off_t offset, int whence)
@@ -323,38 +347,8 @@ off_t fd_seek(int fd, off_t offset, int whence)
         return -1;
     }
     
-    struct fd_table *table = get_current_fd_table();
-    if (!table) {
-        return -1;
-    }
-    
-    struct file_descriptor *fdesc = fd_get(table, fd);
-    if (!fdesc || !fdesc->file) {
-        return -1;
-    }
-    
-    struct file *file = fdesc->file;
-    if (file->ops && file->ops->seek) {
-        return file->ops->seek(file, offset, whence);
-    }
-    
-    // Simple seek implementation
-    switch (whence) {
-        case VFS_SEEK_SET:
-            file->position = offset;
-            break;
-        case VFS_SEEK_CUR:
-            file->position += offset;
-            break;
-        case VFS_SEEK_END:
-            // Would need file size from inode
-            file->position = offset;  // Placeholder
-            break;
-        default:
-            return -1;
-    }
-    
-    return file->position;
+    off_t result = vfs_seek(fd, offset, whence);
+    return result < 0 ? -1 : result;
 }
 
 int fd_close(int fd)
@@ -363,17 +357,7 @@ int fd_close(int fd)
         return -1;
     }
     
-    struct fd_table *table = get_current_fd_table();
-    if (!table) {
-        return -1;
-    }
-    
-    if (!fd_is_valid(table, fd)) {
-        return -1;
-    }
-    
-    fd_free(table, fd);
-    return 0;
+    return vfs_close(fd) == VFS_SUCCESS ? 0 : -1;
 }
 
 int fd_sync(int fd)
@@ -382,22 +366,7 @@ int fd_sync(int fd)
         return -1;
     }
     
-    struct fd_table *table = get_current_fd_table();
-    if (!table) {
-        return -1;
-    }
-    
-    struct file_descriptor *fdesc = fd_get(table, fd);
-    if (!fdesc || !fdesc->file) {
-        return -1;
-    }
-    
-    struct file *file = fdesc->file;
-    if (file->ops && file->ops->sync) {
-        return file->ops->sync(file);
-    }
-    
-    return 0;  // No sync operation available
+    return vfs_sync(fd) == VFS_SUCCESS ? 0 : -1;
 }
 
 void fd_dump_table(struct fd_table *table)
@@ -410,7 +379,7 @@ void fd_dump_table(struct fd_table *table)
     early_print("File Descriptor Table:\n");
     
     int open_count = 0;
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+    for (int i = 0; i < table->size; i++) {
         if (table->fds[i].flags & FD_FLAG_USED) {
             early_print("  FD ");
             // Simple number to string
@@ -456,14 +425,7 @@ int fd_count_open(struct fd_table *table)
         return 0;
     }
     
-    int count = 0;
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (table->fds[i].flags & FD_FLAG_USED) {
-            count++;
-        }
-    }
-    
-    return count;
+    return table->count;
 }
 
 int fd_setup_stdio(void)
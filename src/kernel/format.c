@@ -0,0 +1,343 @@
+/*
+ * MiniOS Number and String Formatting
+ *
+ * Digits are produced backwards into a small scratch buffer and copied
+ * out once. Output goes through struct format_out, which counts every
+ * character but only stores what fits, so a truncated snprintf() still
+ * reports the full length.
+ */
+
+#include "format.h"
+
+static const char format_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char format_hex_lower[] = "0123456789abcdef";
+static const char format_hex_upper[] = "0123456789ABCDEF";
+
+// Decimal digits of value ending at end; returns the first one
+static char *format_dec_digits(char *end, uint64_t value)
+{
+    char *p = end;
+    while (value >= 100) {
+        unsigned int pair = (unsigned int)(value % 100) * 2;
+        value /= 100;
+        *--p = format_digit_pairs[pair + 1];
+        *--p = format_digit_pairs[pair];
+    }
+    if (value >= 10) {
+        unsigned int pair = (unsigned int)value * 2;
+        *--p = format_digit_pairs[pair + 1];
+        *--p = format_digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+static char *format_hex_digits(char *end, uint64_t value, const char *digits)
+{
+    char *p = end;
+    do {
+        *--p = digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    return p;
+}
+
+static size_t format_copy_out(char *buf, const char *start, const char *end)
+{
+    size_t len = (size_t)(end - start);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = start[i];
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+size_t format_u64(char *buf, uint64_t value)
+{
+    char tmp[FORMAT_INT_MAX];
+    char *end = tmp + sizeof(tmp);
+    return format_copy_out(buf, format_dec_digits(end, value), end);
+}
+
+size_t format_i64(char *buf, int64_t value)
+{
+    char tmp[FORMAT_INT_MAX];
+    char *end = tmp + sizeof(tmp);
+    // Negate as unsigned so INT64_MIN survives
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    char *p = format_dec_digits(end, magnitude);
+    if (value < 0) {
+        *--p = '-';
+    }
+    return format_copy_out(buf, p, end);
+}
+
+size_t format_hex(char *buf, uint64_t value, int upper)
+{
+    char tmp[FORMAT_INT_MAX];
+    char *end = tmp + sizeof(tmp);
+    const char *digits = upper ? format_hex_upper : format_hex_lower;
+    return format_copy_out(buf, format_hex_digits(end, value, digits), end);
+}
+
+struct format_out {
+    char *buf;
+    size_t size;                // Bytes available, NUL included
+    size_t len;                 // Characters produced so far
+};
+
+static void format_put(struct format_out *out, const char *s, size_t n)
+{
+    if (out->len + 1 < out->size) {
+        size_t room = out->size - 1 - out->len;
+        size_t copy = n < room ? n : room;
+        char *dst = out->buf + out->len;
+        for (size_t i = 0; i < copy; i++) {
+            dst[i] = s[i];
+        }
+    }
+    out->len += n;
+}
+
+static void format_pad(struct format_out *out, char c, int count)
+{
+    static const char spaces[] = "                ";
+    static const char zeros[] = "0000000000000000";
+    const char *fill = c == '0' ? zeros : spaces;
+
+    while (count > 0) {
+        int chunk = count < 16 ? count : 16;
+        format_put(out, fill, (size_t)chunk);
+        count -= chunk;
+    }
+}
+
+#define FORMAT_LEFT     0x1     // '-'
+#define FORMAT_ZERO     0x2     // '0'
+#define FORMAT_PLUS     0x4     // '+'
+#define FORMAT_SPACE    0x8     // ' '
+
+// Emit prefix and digits within width, honoring precision as a minimum digit count
+static void format_number(struct format_out *out, const char *prefix, const char *digits,
+                          int ndigits, int flags, int width, int precision)
+{
+    int nprefix = 0;
+    while (prefix[nprefix]) {
+        nprefix++;
+    }
+
+    // "%.0d" of zero prints nothing
+    if (precision == 0 && ndigits == 1 && digits[0] == '0') {
+        ndigits = 0;
+    }
+
+    int zeros = precision > ndigits ? precision - ndigits : 0;
+    int pad = width - nprefix - zeros - ndigits;
+
+    if (!(flags & FORMAT_LEFT) && (flags & FORMAT_ZERO) && precision < 0) {
+        zeros += pad > 0 ? pad : 0;
+        pad = 0;
+    }
+    if (!(flags & FORMAT_LEFT)) {
+        format_pad(out, ' ', pad);
+    }
+    format_put(out, prefix, (size_t)nprefix);
+    format_pad(out, '0', zeros);
+    format_put(out, digits, (size_t)ndigits);
+    if (flags & FORMAT_LEFT) {
+        format_pad(out, ' ', pad);
+    }
+}
+
+int vsnprintf(char *buf, size_t size, const char *format, va_list args)
+{
+    struct format_out out = { buf, buf ? size : 0, 0 };
+
+    if (!format) {
+        format = "(null)";
+    }
+
+    const char *p = format;
+    while (*p) {
+        // Copy literal text in one piece
+        const char *lit = p;
+        while (*p && *p != '%') {
+            p++;
+        }
+        if (p > lit) {
+            format_put(&out, lit, (size_t)(p - lit));
+        }
+        if (!*p) {
+            break;
+        }
+        p++;  // Skip '%'
+
+        int flags = 0;
+        for (;; p++) {
+            if (*p == '-')      flags |= FORMAT_LEFT;
+            else if (*p == '0') flags |= FORMAT_ZERO;
+            else if (*p == '+') flags |= FORMAT_PLUS;
+            else if (*p == ' ') flags |= FORMAT_SPACE;
+            else break;
+        }
+
+        int width = 0;
+        if (*p == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FORMAT_LEFT;
+                width = -width;
+            }
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                width = width * 10 + (*p++ - '0');
+            }
+        }
+
+        int precision = -1;
+        if (*p == '.') {
+            p++;
+            precision = 0;
+            if (*p == '*') {
+                precision = va_arg(args, int);
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    precision = precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+
+        // Length: 0 int, 1 long, 2 long long, -1 short, -2 char, 3 size_t/ptrdiff_t/intmax_t
+        int length = 0;
+        if (*p == 'h') {
+            length = -1;
+            if (*++p == 'h') {
+                length = -2;
+                p++;
+            }
+        } else if (*p == 'l') {
+            length = 1;
+            if (*++p == 'l') {
+                length = 2;
+                p++;
+            }
+        } else if (*p == 'z' || *p == 't' || *p == 'j') {
+            length = 3;
+            p++;
+        }
+
+        char tmp[FORMAT_INT_MAX];
+        char *end = tmp + sizeof(tmp);
+        char conv = *p;
+        if (!conv) {
+            break;
+        }
+        p++;
+
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                int64_t value;
+                if (length == 2 || length == 3) value = va_arg(args, long long);
+                else if (length == 1)           value = va_arg(args, long);
+                else                            value = va_arg(args, int);
+                if (length == -1) value = (short)value;
+                if (length == -2) value = (signed char)value;
+
+                uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+                char *digits = format_dec_digits(end, magnitude);
+                const char *prefix = value < 0 ? "-" : (flags & FORMAT_PLUS) ? "+" :
+                                     (flags & FORMAT_SPACE) ? " " : "";
+                format_number(&out, prefix, digits, (int)(end - digits), flags, width, precision);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                uint64_t value;
+                if (length == 2 || length == 3) value = va_arg(args, unsigned long long);
+                else if (length == 1)           value = va_arg(args, unsigned long);
+                else                            value = va_arg(args, unsigned int);
+                if (length == -1) value = (unsigned short)value;
+                if (length == -2) value = (unsigned char)value;
+
+                char *digits = conv == 'u' ? format_dec_digits(end, value) :
+                               format_hex_digits(end, value,
+                                                 conv == 'X' ? format_hex_upper : format_hex_lower);
+                format_number(&out, "", digits, (int)(end - digits), flags, width, precision);
+                break;
+            }
+            case 'p': {
+                uintptr_t value = (uintptr_t)va_arg(args, void *);
+                char *digits = format_hex_digits(end, value, format_hex_lower);
+                format_number(&out, "0x", digits, (int)(end - digits), flags, width, -1);
+                break;
+            }
+            case 's': {
+                const char *str = va_arg(args, const char *);
+                if (!str) {
+                    str = "(null)";
+                }
+                int len = 0;
+                while (str[len] && (precision < 0 || len < precision)) {
+                    len++;
+                }
+                if (!(flags & FORMAT_LEFT)) {
+                    format_pad(&out, ' ', width - len);
+                }
+                format_put(&out, str, (size_t)len);
+                if (flags & FORMAT_LEFT) {
+                    format_pad(&out, ' ', width - len);
+                }
+                break;
+            }
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                if (!(flags & FORMAT_LEFT)) {
+                    format_pad(&out, ' ', width - 1);
+                }
+                format_put(&out, &c, 1);
+                if (flags & FORMAT_LEFT) {
+                    format_pad(&out, ' ', width - 1);
+                }
+                break;
+            }
+            case '%':
+                format_put(&out, "%", 1);
+                break;
+            default:
+                // Unknown conversion: show it as written
+                format_put(&out, "%", 1);
+                format_put(&out, &conv, 1);
+                break;
+        }
+    }
+
+    if (out.size) {
+        out.buf[out.len < out.size ? out.len : out.size - 1] = '\0';
+    }
+    return (int)out.len;
+}
+
+int snprintf(char *buf, size_t size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, size, format, args);
+    va_end(args);
+    return len;
+}
@@ -6,12 +6,39 @@
 #include "interrupt.h"
 #include "memory.h"
 #include "kernel.h"
+#include "smp.h"
+#include "vdso.h"
+#include "trace.h"
+#include "spinlock.h"
+#include "percpu.h"
 
 // Interrupt subsystem state
 static int interrupt_subsystem_initialized = 0;
 static struct interrupt_controller *controllers[4];
 static int num_controllers = 0;
-static struct irq_desc irq_descriptors[64];  // Reduced from 256 for debugging
+static struct irq_desc irq_descriptors[MAX_IRQS];
+static spinlock_t irq_desc_lock = SPINLOCK_INIT;    // Handler registration
+
+// Interrupts taken per line, counted by the CPU taking them
+struct irq_cpu_counts {
+    uint64_t count[MAX_IRQS];
+};
+static DEFINE_PER_CPU(struct irq_cpu_counts, irq_counts);
+
+// Per-IRQ timing. Samples race only between CPUs taking the same line,
+// which costs at most a lost count.
+struct irq_timing {
+    uint32_t samples;
+    uint32_t latency[IRQ_STATS_BUCKETS];
+    uint32_t duration[IRQ_STATS_BUCKETS];
+    uint64_t max_latency;
+    uint64_t max_duration;
+};
+
+volatile uint32_t irq_stats_enabled = 0;
+static struct irq_timing irq_timings[MAX_IRQS];
+static uint64_t irq_entry_stamp[MAX_CPUS];      // Set by the vector stub
+static struct irq_regs irq_regs[MAX_CPUS];      // Set around handle_interrupt()
 
 // Architecture-specific functions
 #ifdef ARCH_ARM64
@@ -26,17 +53,38 @@ extern int idt_init(void);
 extern int pic_controller_register(void);
 extern void pic_show_status(void);
 extern void idt_show_status(void);
+extern int apic_init(void);
+extern int apic_controller_register(void);
+extern void apic_show_status(void);
 #endif
 
 int interrupt_init(void)
 {
     early_print("Initializing interrupt subsystem...\n");
-    early_print("Interrupt: Function entered successfully\n");
 
-    // TEMPORARILY SKIP INTERRUPT INITIALIZATION FOR PHASE 4 DEBUGGING
-    early_print("Interrupt: Skipping interrupt initialization for debugging\n");
+    // Everything starts masked at the controller; IRQs are routed to the
+    // CPU only once a handler is registered and enable_irq() is called
+#ifdef ARCH_ARM64
+    if (gic_init() < 0 || gic_controller_register() < 0) {
+        early_print("Interrupt: GIC initialization failed\n");
+        return -1;
+    }
+#endif
+
+#ifdef ARCH_X86_64
+    if (pic_init() < 0 || idt_init() < 0 || pic_controller_register() < 0) {
+        early_print("Interrupt: PIC/IDT initialization failed\n");
+        return -1;
+    }
+    
+    // Local lines and MSR-based EOI where there is an x2APIC
+    if (apic_init() == 0 && apic_controller_register() < 0) {
+        early_print("Interrupt: APIC registration failed\n");
+    }
+#endif
+
     interrupt_subsystem_initialized = 1;
-    early_print("Interrupt subsystem initialized (stub mode)\n");
+    early_print("Interrupt subsystem initialized\n");
     return 0;
 }
 
@@ -53,16 +101,41 @@ int interrupt_controller_register(struct interrupt_controller *controller)
     controllers[num_controllers] = controller;
     num_controllers++;
     
+    // Route its lines now so interrupts need no controller lookup; the
+    // first controller registered for a line keeps it
+    for (uint32_t hwirq = 0; hwirq < controller->num_irqs; hwirq++) {
+        uint32_t irq_num = controller->base_irq + hwirq;
+        if (irq_num >= MAX_IRQS) {
+            break;
+        }
+        if (!irq_descriptors[irq_num].chip) {
+            irq_descriptors[irq_num].irq_num = irq_num;
+            irq_descriptors[irq_num].chip = controller;
+            irq_descriptors[irq_num].hwirq = hwirq;
+        }
+    }
+    
     early_print("Controller registered successfully\n");
     return 0;
 }
 
-int request_irq(uint32_t irq_num, interrupt_handler_t handler, void *context, const char *name)
+// Controller owning a line beyond the descriptor table
+static struct interrupt_controller *find_controller(uint32_t irq_num)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256 || !handler) {
-        return -1;
+    for (int i = 0; i < num_controllers; i++) {
+        if (controllers[i] && 
+            irq_num >= controllers[i]->base_irq &&
+            irq_num < controllers[i]->base_irq + controllers[i]->num_irqs) {
+            return controllers[i];
+        }
     }
-    
+    return NULL;
+}
+
+// Install handler on a free line; irq_desc_lock held
+static int request_irq_locked(uint32_t irq_num, interrupt_handler_t handler, void *context,
+                              const char *name)
+{
     // Check if IRQ is already in use
     if (irq_descriptors[irq_num].handler != NULL) {
         return -1;
@@ -72,126 +145,181 @@ int request_irq(uint32_t irq_num, interrupt_handler_t handler, void *context, co
     irq_descriptors[irq_num].handler = handler;
     irq_descriptors[irq_num].context = context;
     irq_descriptors[irq_num].name = name;
-    irq_descriptors[irq_num].count = 0;
+    per_cpu_clear(irq_counts, count[irq_num]);
+    irq_descriptors[irq_num].flags &= ~IRQ_FLAG_SHARED;
+    
+    return 0;
+}
+
+int request_irq(uint32_t irq_num, interrupt_handler_t handler, void *context, const char *name)
+{
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS || !handler) {
+        return -1;
+    }
+    
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    int result = request_irq_locked(irq_num, handler, context, name);
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
+    return result;
+}
+
+int request_shared_irq(uint32_t irq_num, interrupt_handler_t handler, void *context,
+                       const char *name)
+{
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS || !handler) {
+        return -1;
+    }
+    
+    // Allocated up front: it is not needed for the first handler, but the
+    // lock can't be held across kmalloc()
+    struct irq_action *action = kmalloc(sizeof(struct irq_action));
+    if (!action) {
+        return -1;
+    }
+    action->handler = handler;
+    action->context = context;
+    action->name = name;
+    action->next = NULL;
+    
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    if (!desc->handler) {
+        int result = request_irq_locked(irq_num, handler, context, name);
+        desc->flags |= IRQ_FLAG_SHARED;
+        spin_unlock_irqrestore(&irq_desc_lock, flags);
+        kfree(action);
+        return result;
+    }
+    if (!(desc->flags & IRQ_FLAG_SHARED)) {
+        spin_unlock_irqrestore(&irq_desc_lock, flags);
+        kfree(action);
+        return -1;  // Held exclusively
+    }
+    
+    // Append, so handlers run in registration order
+    struct irq_action **link = &desc->shared;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = action;
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
     
     return 0;
 }
 
 void free_irq(uint32_t irq_num)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS) {
         return;
     }
     
     // Disable the interrupt
     disable_irq(irq_num);
     
-    // Clear interrupt descriptor
+    // Clear interrupt descriptor; the routing stays
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    struct irq_action *action = irq_descriptors[irq_num].shared;
     irq_descriptors[irq_num].handler = NULL;
     irq_descriptors[irq_num].context = NULL;
     irq_descriptors[irq_num].name = NULL;
-    irq_descriptors[irq_num].count = 0;
+    irq_descriptors[irq_num].shared = NULL;
+    per_cpu_clear(irq_counts, count[irq_num]);
+    irq_descriptors[irq_num].flags &= ~IRQ_FLAG_SHARED;
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
+    
+    while (action) {
+        struct irq_action *next = action->next;
+        kfree(action);
+        action = next;
+    }
 }
 
 int enable_irq(uint32_t irq_num)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS) {
         return -1;
     }
     
-    // Find appropriate controller and enable IRQ
-    for (int i = 0; i < num_controllers; i++) {
-        if (controllers[i] && 
-            irq_num >= controllers[i]->base_irq &&
-            irq_num < controllers[i]->base_irq + controllers[i]->num_irqs) {
-            
-            if (controllers[i]->enable_irq) {
-                controllers[i]->enable_irq(irq_num - controllers[i]->base_irq);
-            }
-            return 0;
-        }
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    if (!desc->chip) {
+        return -1;
     }
-    
-    return -1;
+    if (desc->chip->enable_irq) {
+        desc->chip->enable_irq(desc->hwirq);
+    }
+    return 0;
 }
 
 int disable_irq(uint32_t irq_num)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS) {
         return -1;
     }
     
-    // Find appropriate controller and disable IRQ
-    for (int i = 0; i < num_controllers; i++) {
-        if (controllers[i] && 
-            irq_num >= controllers[i]->base_irq &&
-            irq_num < controllers[i]->base_irq + controllers[i]->num_irqs) {
-            
-            if (controllers[i]->disable_irq) {
-                controllers[i]->disable_irq(irq_num - controllers[i]->base_irq);
-            }
-            return 0;
-        }
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    if (!desc->chip) {
+        return -1;
     }
-    
-    return -1;
+    if (desc->chip->disable_irq) {
+        desc->chip->disable_irq(desc->hwirq);
+    }
+    return 0;
 }
 
 int set_irq_priority(uint32_t irq_num, uint8_t priority)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS) {
         return -1;
     }
     
-    irq_descriptors[irq_num].priority = priority;
-    
-    // Find appropriate controller and set priority
-    for (int i = 0; i < num_controllers; i++) {
-        if (controllers[i] && 
-            irq_num >= controllers[i]->base_irq &&
-            irq_num < controllers[i]->base_irq + controllers[i]->num_irqs) {
-            
-            if (controllers[i]->set_priority) {
-                controllers[i]->set_priority(irq_num - controllers[i]->base_irq, priority);
-            }
-            return 0;
-        }
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    desc->priority = priority;
+    if (!desc->chip) {
+        return -1;
     }
-    
-    return -1;
+    if (desc->chip->set_priority) {
+        desc->chip->set_priority(desc->hwirq, priority);
+    }
+    return 0;
 }
 
 int set_irq_type(uint32_t irq_num, uint32_t type)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS) {
         return -1;
     }
     
-    irq_descriptors[irq_num].type = type;
-    
-    // Find appropriate controller and set type
-    for (int i = 0; i < num_controllers; i++) {
-        if (controllers[i] && 
-            irq_num >= controllers[i]->base_irq &&
-            irq_num < controllers[i]->base_irq + controllers[i]->num_irqs) {
-            
-            if (controllers[i]->set_type) {
-                controllers[i]->set_type(irq_num - controllers[i]->base_irq, type);
-            }
-            return 0;
-        }
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    desc->type = type;
+    if (!desc->chip) {
+        return -1;
+    }
+    if (desc->chip->set_type) {
+        desc->chip->set_type(desc->hwirq, type);
+    }
+    return 0;
+}
+
+int irq_set_affinity(uint32_t irq_num, uint32_t cpu)
+{
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS || cpu >= MAX_CPUS) {
+        return -1;
     }
     
-    return -1;
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    if (!desc->chip || !desc->chip->set_affinity) {
+        return -1;
+    }
+    return desc->chip->set_affinity(desc->hwirq, cpu);
 }
 
 uint32_t get_irq_count(uint32_t irq_num)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS) {
         return 0;
     }
     
-    return irq_descriptors[irq_num].count;
+    return (uint32_t)per_cpu_sum(irq_counts, count[irq_num]);
 }
 
 unsigned long disable_interrupts(void)
@@ -204,36 +332,130 @@ void restore_interrupts(unsigned long flags)
     arch_restore_interrupts(flags);
 }
 
+void enable_interrupts(void)
+{
+    arch_enable_interrupts();
+}
+
 int interrupts_enabled(void)
 {
     return arch_interrupts_enabled();
 }
 
-void handle_interrupt(uint32_t irq_num)
+static inline uint32_t irq_stats_bucket(uint64_t ticks)
 {
-    if (!interrupt_subsystem_initialized || irq_num >= 256) {
-        return;
+    uint32_t bucket = ticks ? 63 - (uint32_t)__builtin_clzll(ticks) : 0;
+    return bucket < IRQ_STATS_BUCKETS ? bucket : IRQ_STATS_BUCKETS - 1;
+}
+
+static void irq_stats_record(uint32_t irq_num, uint64_t latency, uint64_t duration)
+{
+    struct irq_timing *timing = &irq_timings[irq_num];
+    
+    timing->samples++;
+    timing->latency[irq_stats_bucket(latency)]++;
+    timing->duration[irq_stats_bucket(duration)]++;
+    if (latency > timing->max_latency) {
+        timing->max_latency = latency;
+    }
+    if (duration > timing->max_duration) {
+        timing->max_duration = duration;
+    }
+}
+
+void irq_stats_entry(uint64_t stamp)
+{
+    irq_entry_stamp[smp_cpu_id()] = stamp;
+}
+
+void irq_set_regs(uintptr_t pc, uintptr_t fp, int user)
+{
+    struct irq_regs *regs = &irq_regs[smp_cpu_id()];
+    regs->pc = pc;
+    regs->fp = fp;
+    regs->user = user;
+}
+
+const struct irq_regs *irq_get_regs(void)
+{
+    struct irq_regs *regs = &irq_regs[smp_cpu_id()];
+    return regs->pc ? regs : NULL;
+}
+
+void irq_stats_enable(int enable)
+{
+    if (enable && !irq_stats_enabled) {
+        memset(irq_timings, 0, sizeof(irq_timings));
+    }
+    irq_stats_enabled = enable ? 1 : 0;
+}
+
+int irq_stats_get(uint32_t irq_num, struct irq_stats *stats)
+{
+    if (!interrupt_subsystem_initialized || irq_num >= MAX_IRQS || !stats) {
+        return -1;
     }
     
-    // Increment interrupt count
-    irq_descriptors[irq_num].count++;
+    struct irq_desc *desc = &irq_descriptors[irq_num];
+    if (!desc->handler && !desc->shared) {
+        return -1;
+    }
     
-    // Call registered handler if available
-    if (irq_descriptors[irq_num].handler) {
-        irq_descriptors[irq_num].handler(irq_num, irq_descriptors[irq_num].context);
+    const struct irq_timing *timing = &irq_timings[irq_num];
+    stats->irq_num = irq_num;
+    stats->name = desc->name;
+    stats->count = (uint32_t)per_cpu_sum(irq_counts, count[irq_num]);
+    stats->samples = timing->samples;
+    memcpy(stats->latency, timing->latency, sizeof(stats->latency));
+    memcpy(stats->duration, timing->duration, sizeof(stats->duration));
+    stats->max_latency = timing->max_latency;
+    stats->max_duration = timing->max_duration;
+    return 0;
+}
+
+void handle_interrupt(uint32_t irq_num)
+{
+    if (!interrupt_subsystem_initialized) {
+        return;
     }
     
-    // Send EOI to appropriate controller
-    for (int i = 0; i < num_controllers; i++) {
-        if (controllers[i] && 
-            irq_num >= controllers[i]->base_irq &&
-            irq_num < controllers[i]->base_irq + controllers[i]->num_irqs) {
-            
-            if (controllers[i]->send_eoi) {
-                controllers[i]->send_eoi(irq_num - controllers[i]->base_irq);
-            }
-            break;
+    if (irq_num < MAX_IRQS) {
+        struct irq_desc *desc = &irq_descriptors[irq_num];
+        this_cpu_inc(irq_counts, count[irq_num]);
+        trace_event(TRACE_IRQ_ENTRY, irq_num, 0, 0);
+        
+        uint64_t entry = 0, start = 0;
+        if (irq_stats_enabled) {
+            uint32_t cpu = smp_cpu_id();
+            entry = irq_entry_stamp[cpu];
+            irq_entry_stamp[cpu] = 0;
+            start = entry ? arch_vdso_read_counter() : 0;
         }
+        
+        // Call registered handlers if available
+        if (desc->handler) {
+            desc->handler(irq_num, desc->context);
+        }
+        for (struct irq_action *action = desc->shared; action; action = action->next) {
+            action->handler(irq_num, action->context);
+        }
+        
+        if (start) {
+            irq_stats_record(irq_num, start - entry, arch_vdso_read_counter() - start);
+        }
+        trace_event(TRACE_IRQ_EXIT, irq_num, 0, 0);
+        
+        // EOI straight to the controller routed at registration
+        if (desc->chip && desc->chip->send_eoi) {
+            desc->chip->send_eoi(desc->hwirq);
+        }
+        return;
+    }
+    
+    // A line we do not track still needs its EOI
+    struct interrupt_controller *controller = find_controller(irq_num);
+    if (controller && controller->send_eoi) {
+        controller->send_eoi(irq_num - controller->base_irq);
     }
 }
 
@@ -272,6 +494,7 @@ void show_interrupt_controllers(void)
 
 #ifdef ARCH_X86_64
     pic_show_status();
+    apic_show_status();
     idt_show_status();
 #endif
 }
@@ -295,6 +518,16 @@ void __attribute__((weak)) arch_restore_interrupts(unsigned long flags)
     (void)flags;
 }
 
+void __attribute__((weak)) arch_enable_interrupts(void)
+{
+    // Default: do nothing
+}
+
+void __attribute__((weak)) arch_cpu_idle(void)
+{
+    // Default: no halt, the caller polls again
+}
+
 int __attribute__((weak)) arch_interrupts_enabled(void)
 {
     // Default: assume enabled
@@ -0,0 +1,215 @@
+/*
+ * MiniOS Kernel Log Implementation
+ *
+ * A writer takes position p from klog_head and owns slot p % KLOG_SLOTS
+ * until it stores seq = p + 1. Readers treat the slot's seq like a
+ * sequence lock: a slot whose seq is not p + 1 both before and after the
+ * copy is either still being written (wait for it) or has been reused by
+ * a writer a full lap ahead (skip it).
+ *
+ * Only one CPU drains at a time (klog_drain_lock, taken with trylock so a
+ * writer never waits for it). A writer that loses the race re-checks
+ * after the owner lets go, so nothing committed is left behind.
+ */
+
+#include "klog.h"
+#include "format.h"
+#include "process.h"
+#include "softirq.h"
+#include "spinlock.h"
+
+static struct klog_record klog_ring[KLOG_SLOTS];
+static volatile uint64_t klog_head = 0;         // Next position handed out
+static uint64_t klog_printed = 0;               // Next position to print, under klog_drain_lock
+static uint64_t klog_dropped = 0;               // Under klog_drain_lock
+static spinlock_t klog_drain_lock = SPINLOCK_INIT;
+
+static volatile int klogd_running = 0;
+static struct wait_queue klogd_wait = WAIT_QUEUE_INIT;
+static struct tasklet klogd_kick;
+
+// Claim a slot, copy len bytes of text into it and commit
+static void klog_append(int level, const char *text, size_t len)
+{
+    uint64_t pos = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    struct klog_record *rec = &klog_ring[pos & (KLOG_SLOTS - 1)];
+
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->level = (uint8_t)level;
+    rec->len = (uint8_t)len;
+    memcpy(rec->text, text, len);
+
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy the record at pos into buf (KLOG_TEXT_MAX + 1 bytes).
+ * @return 1 if copied, 0 if not committed yet, -1 if overwritten
+ */
+static int klog_copy(uint64_t pos, char *buf, int *level)
+{
+    if (__atomic_load_n(&klog_head, __ATOMIC_ACQUIRE) - pos > KLOG_SLOTS) {
+        return -1;
+    }
+
+    const struct klog_record *rec = &klog_ring[pos & (KLOG_SLOTS - 1)];
+    uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+    if (seq != pos + 1) {
+        return seq > pos + 1 ? -1 : 0;
+    }
+
+    uint32_t len = rec->len < KLOG_TEXT_MAX ? rec->len : KLOG_TEXT_MAX;
+    memcpy(buf, rec->text, len);
+    buf[len] = '\0';
+    if (level) {
+        *level = rec->level;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq ? 1 : -1;
+}
+
+// Print committed records in order (klog_drain_lock held)
+static void klog_drain_locked(void)
+{
+    char text[KLOG_TEXT_MAX + 1];
+    uint64_t head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+
+    // Lapped: whatever was older than one ring is gone
+    if (head - klog_printed > KLOG_SLOTS) {
+        klog_dropped += head - KLOG_SLOTS - klog_printed;
+        klog_printed = head - KLOG_SLOTS;
+    }
+
+    while (klog_printed < head) {
+        int copied = klog_copy(klog_printed, text, NULL);
+        if (copied == 0) {
+            break;  // Still being written; its writer or klogd comes back
+        }
+        if (copied > 0) {
+            enhanced_early_print(text);
+        } else {
+            klog_dropped++;
+        }
+        klog_printed++;
+    }
+}
+
+static int klog_pending(void)
+{
+    return __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&klog_printed, __ATOMIC_RELAXED);
+}
+
+void klog_flush(void)
+{
+    while (spin_trylock(&klog_drain_lock)) {
+        klog_drain_locked();
+        spin_unlock(&klog_drain_lock);
+
+        // A record committed after the last check and whose writer found
+        // the lock taken is still ours to print
+        if (!klog_pending()) {
+            break;
+        }
+    }
+}
+
+void klog_write(int level, const char *str)
+{
+    if (!str) {
+        return;
+    }
+
+    size_t len = strlen(str);
+    do {
+        size_t chunk = len < KLOG_TEXT_MAX ? len : KLOG_TEXT_MAX;
+        klog_append(level, str, chunk);
+        str += chunk;
+        len -= chunk;
+    } while (len > 0);
+
+    if (klogd_running) {
+        tasklet_schedule(&klogd_kick);
+    } else {
+        klog_flush();
+    }
+}
+
+void klog_printf(int level, const char *format, ...)
+{
+    char line[2 * KLOG_TEXT_MAX];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    klog_write(level, line);
+}
+
+// Wake klogd from softirq context, where no scheduler lock can be held
+static void klogd_wake(void *data)
+{
+    (void)data;
+    wake_up(&klogd_wait);
+}
+
+static void klogd_main(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        // Sleep until something new arrives: a record whose writer is
+        // still copying stays pending, and waiting on that would spin
+        uint64_t seen = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+        klog_flush();
+        wait_event_timeout(&klogd_wait,
+                           __atomic_load_n(&klog_head, __ATOMIC_RELAXED) != seen,
+                           KLOG_DRAIN_INTERVAL_US);
+    }
+}
+
+int klog_start(void)
+{
+    tasklet_init(&klogd_kick, klogd_wake, NULL);
+
+    if (process_create_fair(klogd_main, NULL, "klogd", 0) < 0) {
+        return -1;
+    }
+    klogd_running = 1;
+    return 0;
+}
+
+void klog_console_print(const char *str)
+{
+    klog_flush();
+    enhanced_early_print(str);
+}
+
+void klog_dump(int min_level, void (*emit)(const char *text))
+{
+    char text[KLOG_TEXT_MAX + 1];
+    uint64_t head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    uint64_t pos = head > KLOG_SLOTS ? head - KLOG_SLOTS : 0;
+
+    for (; pos < head; pos++) {
+        int level;
+        if (klog_copy(pos, text, &level) > 0 && level >= min_level) {
+            emit(text);
+        }
+    }
+}
+
+void klog_get_stats(struct klog_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    stats->written = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    stats->dropped = __atomic_load_n(&klog_dropped, __ATOMIC_RELAXED);
+    stats->printed = __atomic_load_n(&klog_printed, __ATOMIC_RELAXED) - stats->dropped;
+}
@@ -0,0 +1,40 @@
+/*
+ * MiniOS Kernel Symbol Table
+ * Lookups in the table tools/gen-ksyms.py generates at link time
+ */
+
+#include "ksyms.h"
+#include "kernel.h"
+
+uint32_t ksyms_count(void)
+{
+    return ksyms_num;
+}
+
+int ksyms_lookup(uintptr_t addr, uintptr_t *offset)
+{
+    if (ksyms_num == 0 || addr < ksyms_addresses[0] || addr >= ksyms_text_end) {
+        return -1;
+    }
+
+    // Last symbol at or below addr
+    uint32_t lo = 0, hi = ksyms_num - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (ksyms_addresses[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (offset) {
+        *offset = addr - ksyms_addresses[lo];
+    }
+    return (int)lo;
+}
+
+const char *ksyms_name(uint32_t index)
+{
+    return index < ksyms_num ? &ksyms_names[ksyms_name_offsets[index]] : NULL;
+}
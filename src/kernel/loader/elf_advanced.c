@@ -45,19 +45,29 @@ int elf_advanced_parse(const uint8_t *elf_data, size_t size, struct elf_advanced
         return ELF_ADV_ERROR_UNSUPPORTED;
     }
     
-    // Parse program headers
+    // Parse program headers. They must be in the data we were given; a
+    // loader passing only the start of the file needs nothing else.
     if (ctx->header->e_phoff != 0 && ctx->header->e_phnum > 0) {
+        uint64_t ph_end = ctx->header->e_phoff +
+                          (uint64_t)ctx->header->e_phnum * sizeof(struct elf64_program_header);
+        if (ctx->header->e_phentsize != sizeof(struct elf64_program_header) || ph_end > size) {
+            return ELF_ADV_ERROR_INVALID_ELF;
+        }
         ctx->program_headers = (struct elf64_program_header *)(elf_data + ctx->header->e_phoff);
     }
     
-    // Parse section headers  
-    if (ctx->header->e_shoff != 0 && ctx->header->e_shnum > 0) {
+    // Parse section headers, if present in the data
+    uint64_t sh_end = ctx->header->e_shoff +
+                      (uint64_t)ctx->header->e_shnum * sizeof(struct elf64_section_header);
+    if (ctx->header->e_shoff != 0 && ctx->header->e_shnum > 0 && sh_end <= size) {
         ctx->section_headers = (struct elf64_section_header *)(elf_data + ctx->header->e_shoff);
         
         // Get section header string table
-        if (ctx->header->e_shstrndx != SHN_UNDEF) {
+        if (ctx->header->e_shstrndx != SHN_UNDEF && ctx->header->e_shstrndx < ctx->header->e_shnum) {
             struct elf64_section_header *shstrtab = &ctx->section_headers[ctx->header->e_shstrndx];
-            ctx->section_names = (char *)(elf_data + shstrtab->sh_offset);
+            if (shstrtab->sh_offset < size) {
+                ctx->section_names = (char *)(elf_data + shstrtab->sh_offset);
+            }
         }
     }
     
@@ -105,6 +115,7 @@ int elf_advanced_load(struct elf_advanced_context *ctx, struct user_program *pro
     
     ctx->base_address = base_address;
     ctx->total_size = total_size;
+    ctx->vaddr_base = min_addr;
     
     // Load segments
     for (int i = 0; i < ctx->header->e_phnum; i++) {
@@ -136,65 +147,324 @@ int elf_advanced_load(struct elf_advanced_context *ctx, struct user_program *pro
     return ELF_ADV_SUCCESS;
 }
 
-// Build symbol table from ELF sections
+// GNU symbol hash (DT_GNU_HASH), also used for the kernel-built index
+static uint32_t elf_gnu_hash(const char *name) {
+    uint32_t h = 5381;
+    for (const uint8_t *c = (const uint8_t *)name; *c; c++) {
+        h = h * 33 + *c;
+    }
+    return h;
+}
+
+// Take the symbol table at index and its string table
+static void elf_use_symbols(struct elf_advanced_context *ctx, uint32_t index) {
+    struct elf64_section_header *shdr = &ctx->section_headers[index];
+    ctx->symbols = (struct elf64_symbol *)((uint8_t *)ctx->header + shdr->sh_offset);
+    ctx->symbol_count = shdr->sh_size / sizeof(struct elf64_symbol);
+    if (shdr->sh_link < ctx->header->e_shnum) {
+        struct elf64_section_header *strtab = &ctx->section_headers[shdr->sh_link];
+        ctx->symbol_names = (char *)((uint8_t *)ctx->header + strtab->sh_offset);
+    }
+}
+
+// Point the context at a DT_GNU_HASH section; 0 if it is malformed
+static int elf_use_gnu_hash(struct elf_advanced_context *ctx, struct elf64_section_header *shdr) {
+    const uint32_t *words = (const uint32_t *)((uint8_t *)ctx->header + shdr->sh_offset);
+    if (shdr->sh_size < 16) {
+        return 0;
+    }
+    uint32_t nbuckets = words[0];
+    uint32_t bloom_size = words[2];
+    if (nbuckets == 0 || bloom_size == 0 || (bloom_size & (bloom_size - 1)) ||
+        16 + (uint64_t)bloom_size * 8 + (uint64_t)nbuckets * 4 > shdr->sh_size) {
+        return 0;
+    }
+
+    ctx->gnu_nbuckets = nbuckets;
+    ctx->gnu_symoffset = words[1];
+    ctx->gnu_bloom_size = bloom_size;
+    ctx->gnu_bloom_shift = words[3];
+    ctx->gnu_bloom = (const uint64_t *)(words + 4);
+    ctx->gnu_buckets = (const uint32_t *)(ctx->gnu_bloom + bloom_size);
+    ctx->gnu_chains = ctx->gnu_buckets + nbuckets;
+    return 1;
+}
+
+/**
+ * Index the defined symbols by hash when the object carries no hash
+ * table of its own, so lookups cost a bucket walk instead of a scan
+ */
+static int elf_build_hash_index(struct elf_advanced_context *ctx) {
+    uint32_t nbuckets = 1;
+    while (nbuckets < ctx->symbol_count / 2) {
+        nbuckets <<= 1;
+    }
+
+    size_t words = nbuckets + 2 * (size_t)ctx->symbol_count;
+    uint32_t *table = memory_alloc(words * sizeof(uint32_t), 8);
+    if (!table) {
+        return ELF_ADV_ERROR_NO_MEMORY;
+    }
+    memset(table, 0xFF, nbuckets * sizeof(uint32_t));
+
+    uint32_t *next = table + nbuckets;
+    uint32_t *hashes = next + ctx->symbol_count;
+    // Insert backwards so each chain is in symbol order, first match first
+    for (uint32_t i = ctx->symbol_count; i-- > 0; ) {
+        struct elf64_symbol *sym = &ctx->symbols[i];
+        next[i] = UINT32_MAX;
+        hashes[i] = 0;
+        if (sym->st_name == 0 || sym->st_shndx == SHN_UNDEF) {
+            continue;  // Nothing another object could bind to
+        }
+        hashes[i] = elf_gnu_hash(&ctx->symbol_names[sym->st_name]);
+        uint32_t *head = &table[hashes[i] & (nbuckets - 1)];
+        next[i] = *head;
+        *head = i;
+    }
+
+    ctx->hash_table = table;
+    ctx->hash_nbuckets = nbuckets;
+    ctx->hash_nchains = ctx->symbol_count;
+    return ELF_ADV_SUCCESS;
+}
+
+/**
+ * Build symbol table from ELF sections. The dynamic symbol table wins
+ * over the full one; lookups go through the object's DT_GNU_HASH table
+ * when it has one, or through an index built here.
+ */
 int elf_build_symbol_table(struct elf_advanced_context *ctx) {
     if (!ctx || !ctx->section_headers) {
         return ELF_ADV_ERROR_INVALID_ELF;
     }
     
-    // Find symbol table and string table sections
+    int symtab = -1;
+    int dynsym = -1;
+    int gnu_hash = -1;
     for (int i = 0; i < ctx->header->e_shnum; i++) {
         struct elf64_section_header *shdr = &ctx->section_headers[i];
         
-        if (shdr->sh_type == SHT_SYMTAB || shdr->sh_type == SHT_DYNSYM) {
-            ctx->symbols = (struct elf64_symbol *)((uint8_t *)ctx->header + shdr->sh_offset);
-            ctx->symbol_count = shdr->sh_size / sizeof(struct elf64_symbol);
-            
-            // Find associated string table
-            if (shdr->sh_link < ctx->header->e_shnum) {
-                struct elf64_section_header *strtab = &ctx->section_headers[shdr->sh_link];
-                ctx->symbol_names = (char *)((uint8_t *)ctx->header + strtab->sh_offset);
-            }
+        if (shdr->sh_type == SHT_SYMTAB) {
+            symtab = i;
+        } else if (shdr->sh_type == SHT_DYNSYM) {
+            dynsym = i;
+        } else if (shdr->sh_type == SHT_GNU_HASH) {
+            gnu_hash = i;
         } else if (shdr->sh_type == SHT_DYNAMIC) {
             ctx->dynamic = (struct elf64_dynamic *)((uint8_t *)ctx->header + shdr->sh_offset);
             ctx->dynamic_count = shdr->sh_size / sizeof(struct elf64_dynamic);
         }
     }
     
+    // The GNU hash table indexes the symbol table it links to
+    if (gnu_hash >= 0) {
+        struct elf64_section_header *shdr = &ctx->section_headers[gnu_hash];
+        if (shdr->sh_link < ctx->header->e_shnum && elf_use_gnu_hash(ctx, shdr)) {
+            elf_use_symbols(ctx, shdr->sh_link);
+            return ELF_ADV_SUCCESS;
+        }
+    }
+    
+    if (dynsym >= 0 || symtab >= 0) {
+        elf_use_symbols(ctx, (uint32_t)(dynsym >= 0 ? dynsym : symtab));
+        if (ctx->symbol_names && ctx->symbol_count > 0) {
+            return elf_build_hash_index(ctx);
+        }
+    }
+    
     return ELF_ADV_SUCCESS;
 }
 
+// Look up a defined symbol by name and precomputed elf_gnu_hash()
+static struct elf64_symbol *elf_lookup(struct elf_advanced_context *ctx, const char *name,
+                                       uint32_t hash) {
+    if (!ctx->symbols || !ctx->symbol_names) {
+        return NULL;
+    }
+
+    if (ctx->gnu_buckets) {
+        // The bloom filter rejects most names this object does not define
+        uint64_t word = ctx->gnu_bloom[(hash / 64) & (ctx->gnu_bloom_size - 1)];
+        uint64_t mask = (1ULL << (hash % 64)) | (1ULL << ((hash >> ctx->gnu_bloom_shift) % 64));
+        if ((word & mask) != mask) {
+            return NULL;
+        }
+
+        uint32_t i = ctx->gnu_buckets[hash % ctx->gnu_nbuckets];
+        if (i < ctx->gnu_symoffset) {
+            return NULL;
+        }
+        for (; i < ctx->symbol_count; i++) {
+            uint32_t chain_hash = ctx->gnu_chains[i - ctx->gnu_symoffset];
+            struct elf64_symbol *sym = &ctx->symbols[i];
+            if ((chain_hash | 1) == (hash | 1) &&
+                strcmp(&ctx->symbol_names[sym->st_name], name) == 0) {
+                return sym;
+            }
+            if (chain_hash & 1) {
+                break;  // End of the bucket's chain
+            }
+        }
+        return NULL;
+    }
+
+    if (ctx->hash_table) {
+        const uint32_t *next = ctx->hash_table + ctx->hash_nbuckets;
+        const uint32_t *hashes = next + ctx->hash_nchains;
+        for (uint32_t i = ctx->hash_table[hash & (ctx->hash_nbuckets - 1)]; i != UINT32_MAX;
+             i = next[i]) {
+            if (hashes[i] == hash &&
+                strcmp(&ctx->symbol_names[ctx->symbols[i].st_name], name) == 0) {
+                return &ctx->symbols[i];
+            }
+        }
+    }
+    return NULL;
+}
+
 // Find a symbol by name
 int elf_find_symbol(struct elf_advanced_context *ctx, const char *name, struct elf64_symbol **symbol) {
-    if (!ctx || !ctx->symbols || !ctx->symbol_names || !name) {
+    if (!ctx || !name || !symbol) {
         return ELF_ADV_ERROR_SYMBOL_NOT_FOUND;
     }
     
-    for (uint32_t i = 0; i < ctx->symbol_count; i++) {
-        struct elf64_symbol *sym = &ctx->symbols[i];
-        const char *sym_name = &ctx->symbol_names[sym->st_name];
-        
-        if (strcmp(sym_name, name) == 0) {
-            *symbol = sym;
+    struct elf64_symbol *sym = elf_lookup(ctx, name, elf_gnu_hash(name));
+    if (!sym) {
+        return ELF_ADV_ERROR_SYMBOL_NOT_FOUND;
+    }
+    *symbol = sym;
+    return ELF_ADV_SUCCESS;
+}
+
+// Resolve a symbol across all loaded libraries, hashing the name once
+static int dynamic_resolve_hashed(const char *name, uint32_t hash,
+                                  struct symbol_resolution *resolution) {
+    for (struct shared_library *lib = library_list; lib; lib = lib->next) {
+        if (!lib->elf_ctx) {
+            continue;
+        }
+        struct elf64_symbol *symbol = elf_lookup(lib->elf_ctx, name, hash);
+        if (symbol) {
+            resolution->name = name;
+            resolution->value = symbol->st_value;
+            resolution->library = lib;
+            resolution->type = symbol->st_info & 0xF;
+            resolution->binding = (symbol->st_info >> 4) & 0xF;
             return ELF_ADV_SUCCESS;
         }
     }
-    
     return ELF_ADV_ERROR_SYMBOL_NOT_FOUND;
 }
 
-// Perform basic relocations (simplified)
+// Address a symbol of ctx or of a library ends up at, 0 if unresolved
+static uint64_t elf_symbol_address(struct elf_advanced_context *ctx, uint32_t index) {
+    struct elf64_symbol *sym = &ctx->symbols[index];
+    if (sym->st_shndx != SHN_UNDEF) {
+        return (uint64_t)ctx->base_address + (sym->st_value - ctx->vaddr_base);
+    }
+    if (!ctx->symbol_names || sym->st_name == 0) {
+        return 0;
+    }
+
+    const char *name = &ctx->symbol_names[sym->st_name];
+    struct symbol_resolution resolution;
+    if (dynamic_resolve_hashed(name, elf_gnu_hash(name), &resolution) != ELF_ADV_SUCCESS) {
+        return 0;
+    }
+    struct shared_library *lib = resolution.library;
+    uint64_t lib_base = lib->elf_ctx->vaddr_base;
+    return (uint64_t)lib->base_address + (resolution.value - lib_base);
+}
+
+/**
+ * Apply one SHT_RELA section to the loaded image. Each symbol is resolved
+ * once, however many relocations name it, through the cache in resolved.
+ */
+static int elf_apply_rela(struct elf_advanced_context *ctx, struct elf64_section_header *shdr,
+                          uint64_t *resolved) {
+    struct elf64_relocation_addend *rela =
+        (struct elf64_relocation_addend *)((uint8_t *)ctx->header + shdr->sh_offset);
+    uint64_t count = shdr->sh_size / sizeof(struct elf64_relocation_addend);
+    uint8_t *base = ctx->base_address;
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t type = ELF64_R_TYPE(rela[i].r_info);
+        uint32_t sym = ELF64_R_SYM(rela[i].r_info);
+        if (rela[i].r_offset < ctx->vaddr_base ||
+            rela[i].r_offset - ctx->vaddr_base + sizeof(uint64_t) > ctx->total_size) {
+            return ELF_ADV_ERROR_RELOC_FAILED;
+        }
+        uint64_t *where = (uint64_t *)(base + (rela[i].r_offset - ctx->vaddr_base));
+
+        if (type == R_X86_64_RELATIVE || type == R_AARCH64_RELATIVE) {
+            *where = (uint64_t)base + ((uint64_t)rela[i].r_addend - ctx->vaddr_base);
+            continue;
+        }
+        if (type != R_X86_64_64 && type != R_X86_64_GLOB_DAT && type != R_X86_64_JUMP_SLOT &&
+            type != R_AARCH64_ABS64 && type != R_AARCH64_GLOB_DAT &&
+            type != R_AARCH64_JUMP_SLOT) {
+            return ELF_ADV_ERROR_UNSUPPORTED;
+        }
+        if (sym == 0 || sym >= ctx->symbol_count) {
+            return ELF_ADV_ERROR_RELOC_FAILED;
+        }
+
+        if (!resolved[sym]) {
+            resolved[sym] = elf_symbol_address(ctx, sym);
+            if (!resolved[sym]) {
+                // Unresolved weak references bind to 0
+                if (((ctx->symbols[sym].st_info >> 4) & 0xF) != STB_WEAK) {
+                    return ELF_ADV_ERROR_SYMBOL_NOT_FOUND;
+                }
+                resolved[sym] = UINT64_MAX;
+            }
+        }
+        uint64_t value = resolved[sym] == UINT64_MAX ? 0 : resolved[sym];
+
+        if (type == R_X86_64_64 || type == R_AARCH64_ABS64) {
+            value += (uint64_t)rela[i].r_addend;
+        }
+        *where = value;
+    }
+    return ELF_ADV_SUCCESS;
+}
+
+/**
+ * Apply the image's RELA relocations in one pass per section. Symbol
+ * addresses are cached by symbol index, so a program with many imports
+ * hashes and looks up each imported name once.
+ */
 int elf_advanced_relocate(struct elf_advanced_context *ctx, struct user_program *program) {
     if (!ctx || !program) {
         return ELF_ADV_ERROR_INVALID_ELF;
     }
-    
-    // For now, we'll assume relocations are minimal
-    // In a full implementation, this would process relocation sections
-    (void)ctx;    // Suppress unused parameter warning
-    (void)program;
-    
-    return ELF_ADV_SUCCESS;
+    if (!ctx->section_headers || !ctx->base_address) {
+        return ELF_ADV_SUCCESS;  // Nothing we can relocate
+    }
+
+    uint64_t *resolved = NULL;
+    if (ctx->symbol_count > 0) {
+        resolved = memory_alloc(ctx->symbol_count * sizeof(uint64_t), 8);
+        if (!resolved) {
+            return ELF_ADV_ERROR_NO_MEMORY;
+        }
+        memset(resolved, 0, ctx->symbol_count * sizeof(uint64_t));
+    }
+
+    int result = ELF_ADV_SUCCESS;
+    for (int i = 0; i < ctx->header->e_shnum && result == ELF_ADV_SUCCESS; i++) {
+        struct elf64_section_header *shdr = &ctx->section_headers[i];
+        if (shdr->sh_type != SHT_RELA || shdr->sh_size == 0) {
+            continue;
+        }
+        result = elf_apply_rela(ctx, shdr, resolved);
+    }
+
+    if (resolved) {
+        memory_free(resolved);
+    }
+    return result;
 }
 
 // Cleanup ELF context
@@ -207,6 +477,10 @@ void elf_advanced_cleanup(struct elf_advanced_context *ctx) {
         memory_free_pages(ctx->base_address, (ctx->total_size + 0xFFF) / 0x1000);
     }
     
+    if (ctx->hash_table) {
+        memory_free(ctx->hash_table);
+    }
+    
     memset(ctx, 0, sizeof(struct elf_advanced_context));
 }
 
@@ -324,24 +598,7 @@ int dynamic_resolve_symbol(const char *name, struct symbol_resolution *resolutio
         return ELF_ADV_ERROR_SYMBOL_NOT_FOUND;
     }
     
-    struct shared_library *lib = library_list;
-    
-    while (lib) {
-        if (lib->elf_ctx) {
-            struct elf64_symbol *symbol;
-            if (elf_find_symbol(lib->elf_ctx, name, &symbol) == ELF_ADV_SUCCESS) {
-                resolution->name = name;
-                resolution->value = symbol->st_value;
-                resolution->library = lib;
-                resolution->type = symbol->st_info & 0xF;
-                resolution->binding = (symbol->st_info >> 4) & 0xF;
-                return ELF_ADV_SUCCESS;
-            }
-        }
-        lib = lib->next;
-    }
-    
-    return ELF_ADV_ERROR_SYMBOL_NOT_FOUND;
+    return dynamic_resolve_hashed(name, elf_gnu_hash(name), resolution);
 }
 
 // Advanced program loading with full ELF support
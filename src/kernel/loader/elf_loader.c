@@ -4,6 +4,8 @@
 #include "vfs.h"
 #include "process.h"
 #include "kernel.h"
+#include "spinlock.h"
+#include "vdso.h"
 
 // Forward declarations for string functions 
 extern void *memset(void *s, int c, size_t n);
@@ -13,51 +15,537 @@ extern char *strncpy(char *dest, const char *src, size_t n);
 extern int strcmp(const char *s1, const char *s2);
 
 // Global program table to track loaded programs
-static struct user_program program_table[MAX_TASKS];
+#define MAX_PROGRAMS 32
+static struct user_program program_table[MAX_PROGRAMS];
 static int program_count = 0;
 
-// Load user program from filesystem (simplified)
-int user_program_load(const char *path, struct user_program *program) {
-    if (!path || !program) {
-        return USER_PROGRAM_ERROR_INVALID_FORMAT;
+#define USER_DATA_FLAGS (MEMORY_READABLE | MEMORY_WRITABLE | MEMORY_CACHEABLE)
+#define USER_PAGE_MASK  ((uint64_t)PAGE_SIZE_4K - 1)
+
+/*
+ * Exec image cache
+ *
+ * An image is what loading a program needs once its ELF headers have been
+ * parsed: where each PT_LOAD segment goes, which of its pages come from
+ * the file, which are anonymous, and the bytes to copy into the page where
+ * file data ends and .bss begins. Recently run programs keep theirs here
+ * along with an open reference to the file, keyed by file system and inode
+ * and checked against the size, mtime and page cache changes, so running
+ * one again is a stat and a few vm_map() calls: no open, no header read,
+ * no parse and no copy reads. Text and read-only data are private file
+ * mappings, so every instance shares the page cache frames and writable
+ * data is copied on first write.
+ */
+struct exec_segment {
+    uint64_t start;                 // Page-aligned
+    uint64_t file_end;              // Mapped from the file up to here
+    uint64_t end;                   // Anonymous from file_end to here
+    uint64_t file_offset;           // File offset of start
+    uint64_t copy_start;            // Copied in after mapping, up to copy_end
+    uint64_t copy_end;
+    uint64_t copy_offset;           // File offset of copy_start
+    uint32_t attrs;
+};
+
+struct exec_image {
+    struct file_system *fs;         // Key
+    uint32_t ino;
+    uint32_t size;                  // Checked against the file on a hit
+    uint32_t mtime;
+    uint32_t changes;
+    struct file *file;              // Held open for the mappings
+    int refs;                       // The cache's and each loader's
+    uint64_t last_used;
+    uint8_t *copy;                  // Every segment's copied bytes, in order,
+    size_t copy_size;               // or NULL when too many to keep
+
+    uint32_t segment_count;
+    struct exec_segment segments[EXEC_CACHE_MAX_SEGMENTS];
+    uint64_t entry;
+    uint64_t load_base;
+    uint64_t image_size;
+    uint64_t text_base;
+    uint64_t text_size;
+    uint64_t data_base;
+    uint64_t data_size;
+    uint64_t bss_base;
+    uint64_t bss_size;
+};
+
+static struct exec_image *exec_cache[EXEC_CACHE_ENTRIES];
+static spinlock_t exec_cache_lock = SPINLOCK_INIT;
+static uint64_t exec_cache_clock = 0;
+
+// Statistics
+static uint64_t exec_cache_hits = 0;
+static uint64_t exec_cache_misses = 0;
+static uint64_t exec_cache_stale = 0;
+
+static void exec_image_put(struct exec_image *image) {
+    unsigned long flags = spin_lock_irqsave(&exec_cache_lock);
+    int last = (--image->refs == 0);
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+    if (!last) {
+        return;
     }
-    
-    // Open the program file
+
+    if (image->file) {
+        vfs_file_put(image->file);
+    }
+    kfree(image->copy);
+    kfree(image);
+}
+
+// Page cache changes of a file, 0 for one without a cache
+static uint32_t exec_file_changes(struct file *file) {
+    return file->mapping ? file->mapping->changes : 0;
+}
+
+// Does the cached image still describe the file stat found?
+static int exec_image_current(struct exec_image *image, const struct inode *stat) {
+    struct vfs_mapping *mapping = image->file->mapping;
+    return image->size == stat->size && image->mtime == stat->modified_time &&
+           (!mapping || (!mapping->orphan && mapping->changes == image->changes));
+}
+
+/**
+ * Find the cached image of the file stat describes and take a reference.
+ * One the file has changed under is dropped.
+ */
+static struct exec_image *exec_cache_lookup(const struct inode *stat) {
+    struct exec_image *stale = NULL;
+    struct exec_image *found = NULL;
+
+    unsigned long flags = spin_lock_irqsave(&exec_cache_lock);
+    for (int i = 0; i < EXEC_CACHE_ENTRIES; i++) {
+        struct exec_image *image = exec_cache[i];
+        if (!image || image->fs != stat->fs || image->ino != stat->ino) {
+            continue;
+        }
+        if (exec_image_current(image, stat)) {
+            image->refs++;
+            image->last_used = ++exec_cache_clock;
+            found = image;
+            exec_cache_hits++;
+        } else {
+            exec_cache[i] = NULL;
+            stale = image;
+            exec_cache_stale++;
+        }
+        break;
+    }
+    if (!found) {
+        exec_cache_misses++;
+    }
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+
+    if (stale) {
+        exec_image_put(stale);
+    }
+    return found;
+}
+
+// Keep an image, in place of any other of the same file or else the
+// least recently used
+static void exec_cache_insert(struct exec_image *image) {
+    struct exec_image *victim = NULL;
+    int slot = -1;
+
+    unsigned long flags = spin_lock_irqsave(&exec_cache_lock);
+    for (int i = 0; i < EXEC_CACHE_ENTRIES; i++) {
+        struct exec_image *entry = exec_cache[i];
+        if (!entry) {
+            if (slot < 0 || exec_cache[slot]) {
+                slot = i;
+            }
+            continue;
+        }
+        if (entry->fs == image->fs && entry->ino == image->ino) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 || (exec_cache[slot] && entry->last_used < exec_cache[slot]->last_used)) {
+            slot = i;
+        }
+    }
+    victim = exec_cache[slot];
+    image->refs++;
+    image->last_used = ++exec_cache_clock;
+    exec_cache[slot] = image;
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+
+    if (victim) {
+        exec_image_put(victim);
+    }
+}
+
+void exec_cache_invalidate_fs(struct file_system *fs) {
+    struct exec_image *dropped[EXEC_CACHE_ENTRIES];
+    int count = 0;
+
+    unsigned long flags = spin_lock_irqsave(&exec_cache_lock);
+    for (int i = 0; i < EXEC_CACHE_ENTRIES; i++) {
+        if (exec_cache[i] && (!fs || exec_cache[i]->fs == fs)) {
+            dropped[count++] = exec_cache[i];
+            exec_cache[i] = NULL;
+        }
+    }
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+
+    for (int i = 0; i < count; i++) {
+        exec_image_put(dropped[i]);
+    }
+}
+
+void exec_cache_get_stats(struct exec_cache_stats *stats) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    unsigned long flags = spin_lock_irqsave(&exec_cache_lock);
+    for (int i = 0; i < EXEC_CACHE_ENTRIES; i++) {
+        if (exec_cache[i]) {
+            stats->entries++;
+            stats->bytes += (uint32_t)exec_cache[i]->copy_size;
+        }
+    }
+    stats->hits = exec_cache_hits;
+    stats->misses = exec_cache_misses;
+    stats->stale = exec_cache_stale;
+    spin_unlock_irqrestore(&exec_cache_lock, flags);
+}
+
+// Memory attributes for a PT_LOAD segment's p_flags
+static uint32_t segment_attributes(uint32_t p_flags) {
+    uint32_t attrs = MEMORY_READABLE | MEMORY_CACHEABLE;
+    if (p_flags & PF_W) attrs |= MEMORY_WRITABLE;
+    if (p_flags & PF_X) attrs |= MEMORY_EXECUTABLE;
+    return attrs;
+}
+
+// Read len bytes of the file at offset
+static int segment_read(int fd, void *buffer, uint64_t offset, uint64_t len) {
+    if (vfs_seek(fd, (off_t)offset, VFS_SEEK_SET) < 0 ||
+        vfs_read(fd, buffer, (size_t)len) != (ssize_t)len) {
+        return USER_PROGRAM_ERROR_LOAD_FAILED;
+    }
+    return 0;
+}
+
+// Copy len bytes of the file at offset into the image at vaddr, a page at
+// a time, for images with too much to copy to keep
+static int segment_copy(struct address_space *as, int fd, uint64_t vaddr,
+                        uint64_t offset, uint64_t len) {
+    uint8_t *buffer = kmalloc(PAGE_SIZE_4K);
+    if (!buffer) {
+        return USER_PROGRAM_ERROR_NO_MEMORY;
+    }
+
+    int result = 0;
+    while (result == 0 && len > 0) {
+        size_t chunk = len < PAGE_SIZE_4K ? (size_t)len : PAGE_SIZE_4K;
+        result = segment_read(fd, buffer, offset, chunk);
+        if (result == 0 && vm_populate(as, vaddr, buffer, chunk) < 0) {
+            result = USER_PROGRAM_ERROR_LOAD_FAILED;
+        }
+        vaddr += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+
+    kfree(buffer);
+    return result;
+}
+
+/**
+ * Lay out one PT_LOAD segment at vaddr. Whole pages of file data are
+ * private file mappings served from the page cache; the page where file
+ * data ends and .bss begins is copied so its tail reads as zero, and the
+ * rest of .bss is anonymous memory zeroed on first touch. A segment whose
+ * file offset and address disagree within a page is copied in full.
+ */
+static void segment_layout(struct exec_segment *seg, const struct elf64_program_header *phdr,
+                           uint64_t vaddr) {
+    uint64_t page = vaddr & ~USER_PAGE_MASK;
+    uint64_t file_end = vaddr + phdr->p_filesz;
+    uint64_t copy_from = vaddr;
+
+    memset(seg, 0, sizeof(*seg));
+    seg->attrs = segment_attributes(phdr->p_flags);
+    seg->start = page;
+    seg->file_end = page;
+    seg->end = (vaddr + phdr->p_memsz + USER_PAGE_MASK) & ~USER_PAGE_MASK;
+
+    if (((vaddr - phdr->p_offset) & USER_PAGE_MASK) == 0) {
+        // Copy-free up to the last whole page of file data, or all of it
+        // when there is no .bss to keep clean
+        uint64_t mapped_end = (phdr->p_memsz > phdr->p_filesz) ? (file_end & ~USER_PAGE_MASK)
+                                                               : seg->end;
+        if (mapped_end > page) {
+            seg->file_end = mapped_end;
+            seg->file_offset = phdr->p_offset - (vaddr - page);
+        }
+        copy_from = seg->file_end > vaddr ? seg->file_end : vaddr;
+    }
+
+    if (seg->file_end < seg->end && file_end > copy_from) {
+        seg->copy_start = copy_from;
+        seg->copy_end = file_end;
+        seg->copy_offset = phdr->p_offset + (copy_from - vaddr);
+    }
+}
+
+/**
+ * Parse the ELF headers at the start of the file and lay out its PT_LOAD
+ * segments. Position-independent images go at USER_IMAGE_BASE; fixed ones
+ * must be linked inside the user region. The bytes to copy are read now
+ * when there are few enough to keep.
+ */
+static int exec_image_build(struct exec_image *image, int fd) {
+    uint8_t *header = kmalloc(PAGE_SIZE_4K);
+    struct elf_advanced_context *ctx = kmalloc(sizeof(struct elf_advanced_context));
+    if (!header || !ctx) {
+        kfree(header);
+        kfree(ctx);
+        return USER_PROGRAM_ERROR_NO_MEMORY;
+    }
+
+    int result = USER_PROGRAM_ERROR_INVALID_FORMAT;
+    ssize_t length = vfs_read(fd, header, PAGE_SIZE_4K);
+    if (length <= 0 || elf_advanced_parse(header, (size_t)length, ctx) != ELF_ADV_SUCCESS ||
+        !ctx->program_headers) {
+        goto out;
+    }
+
+    uint64_t low = UINT64_MAX;
+    uint64_t high = 0;
+    uint32_t count = 0;
+    for (int i = 0; i < ctx->header->e_phnum; i++) {
+        struct elf64_program_header *phdr = &ctx->program_headers[i];
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+            continue;
+        }
+        if (phdr->p_filesz > phdr->p_memsz || phdr->p_vaddr + phdr->p_memsz < phdr->p_vaddr ||
+            ++count > EXEC_CACHE_MAX_SEGMENTS) {
+            goto out;
+        }
+        if (phdr->p_vaddr < low) low = phdr->p_vaddr;
+        if (phdr->p_vaddr + phdr->p_memsz > high) high = phdr->p_vaddr + phdr->p_memsz;
+    }
+    if (low == UINT64_MAX) {
+        goto out;  // Nothing to load
+    }
+
+    uint64_t bias = 0;
+    if (ctx->header->e_type == ELF_TYPE_DYN) {
+        bias = USER_IMAGE_BASE - (low & ~USER_PAGE_MASK);
+    } else if (ctx->header->e_type != ELF_TYPE_EXEC) {
+        goto out;
+    }
+    if (low + bias < USER_VM_BASE || high + bias > USER_VM_END) {
+        goto out;
+    }
+
+    size_t copy_size = 0;
+    for (int i = 0; i < ctx->header->e_phnum; i++) {
+        struct elf64_program_header *phdr = &ctx->program_headers[i];
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+            continue;
+        }
+
+        uint64_t vaddr = phdr->p_vaddr + bias;
+        struct exec_segment *seg = &image->segments[image->segment_count++];
+        segment_layout(seg, phdr, vaddr);
+        copy_size += seg->copy_end - seg->copy_start;
+
+        if ((phdr->p_flags & PF_X) && !image->text_base) {
+            image->text_base = vaddr;
+            image->text_size = phdr->p_memsz;
+        } else if ((phdr->p_flags & PF_W) && !image->data_base) {
+            image->data_base = vaddr;
+            image->data_size = phdr->p_filesz;
+            image->bss_base = vaddr + phdr->p_filesz;
+            image->bss_size = phdr->p_memsz - phdr->p_filesz;
+        }
+    }
+
+    image->entry = ctx->header->e_entry + bias;
+    image->load_base = (low & ~USER_PAGE_MASK) + bias;
+    image->image_size = high - (low & ~USER_PAGE_MASK);
+    result = 0;
+
+    image->copy_size = copy_size;
+    if (copy_size > 0 && copy_size <= EXEC_CACHE_MAX_COPY) {
+        image->copy = kmalloc(copy_size);
+        if (!image->copy) {
+            goto out;  // Copied while mapping instead
+        }
+        uint8_t *dest = image->copy;
+        for (uint32_t i = 0; i < image->segment_count && result == 0; i++) {
+            struct exec_segment *seg = &image->segments[i];
+            uint64_t len = seg->copy_end - seg->copy_start;
+            if (len > 0) {
+                result = segment_read(fd, dest, seg->copy_offset, len);
+                dest += len;
+            }
+        }
+    }
+
+out:
+    kfree(ctx);
+    kfree(header);
+    return result;
+}
+
+// Map an image's segments into program->aspace; fd is only read for
+// copied bytes the image does not keep
+static int exec_image_map(struct user_program *program, struct exec_image *image, int fd) {
+    struct address_space *as = program->aspace;
+    const uint8_t *copy = image->copy;
+
+    for (uint32_t i = 0; i < image->segment_count; i++) {
+        struct exec_segment *seg = &image->segments[i];
+
+        if (seg->file_end > seg->start) {
+            image->file->ref_count++;  // The area's own reference
+            if (!vm_map(as, seg->start, seg->file_end - seg->start, seg->attrs, VM_MAP_FIXED,
+                        image->file, seg->file_offset)) {
+                vfs_file_put(image->file);
+                return USER_PROGRAM_ERROR_NO_MEMORY;
+            }
+        }
+        if (seg->end > seg->file_end &&
+            !vm_map(as, seg->file_end, seg->end - seg->file_end, seg->attrs, VM_MAP_FIXED,
+                    NULL, 0)) {
+            return USER_PROGRAM_ERROR_NO_MEMORY;
+        }
+
+        uint64_t len = seg->copy_end - seg->copy_start;
+        if (len == 0) {
+            continue;
+        }
+        if (copy) {
+            if (vm_populate(as, seg->copy_start, copy, len) < 0) {
+                return USER_PROGRAM_ERROR_LOAD_FAILED;
+            }
+            copy += len;
+        } else {
+            int result = segment_copy(as, fd, seg->copy_start, seg->copy_offset, len);
+            if (result != 0) {
+                return result;
+            }
+        }
+    }
+
+    program->entry_point = (void *)image->entry;
+    program->load_base = (void *)image->load_base;
+    program->image_size = image->image_size;
+    program->text_base = (void *)image->text_base;
+    program->text_size = image->text_size;
+    program->data_base = (void *)image->data_base;
+    program->data_size = image->data_size;
+    program->bss_base = (void *)image->bss_base;
+    program->bss_size = image->bss_size;
+    return 0;
+}
+
+/**
+ * Map the program at path into program->aspace from its cached image, or
+ * parse it and cache the result
+ */
+static int user_program_map_image(struct user_program *program, const char *path) {
+    struct inode stat;
+    if (vfs_stat(path, &stat) != VFS_SUCCESS) {
+        return USER_PROGRAM_ERROR_FILE_NOT_FOUND;
+    }
+
+    struct exec_image *image = exec_cache_lookup(&stat);
+    if (image) {
+        int result = exec_image_map(program, image, -1);
+        exec_image_put(image);
+        return result;
+    }
+
     int fd = vfs_open(path, 0, 0);
     if (fd < 0) {
         return USER_PROGRAM_ERROR_FILE_NOT_FOUND;
     }
-    
-    // For Phase 7, we'll do a simplified load
-    // In a full implementation, this would parse ELF format
+    image = kmalloc(sizeof(struct exec_image));
+    if (!image) {
+        vfs_close(fd);
+        return USER_PROGRAM_ERROR_NO_MEMORY;
+    }
+    memset(image, 0, sizeof(struct exec_image));
+    image->refs = 1;
+    image->file = vfs_file_get(fd);
+    if (!image->file) {
+        vfs_close(fd);
+        exec_image_put(image);
+        return USER_PROGRAM_ERROR_LOAD_FAILED;
+    }
+
+    // Keyed by what stat saw before the open, so a change in between only
+    // makes the next run miss
+    image->fs = stat.fs;
+    image->ino = stat.ino;
+    image->size = stat.size;
+    image->mtime = stat.modified_time;
+    image->changes = exec_file_changes(image->file);
+
+    int result = exec_image_build(image, fd);
+    if (result == 0) {
+        result = exec_image_map(program, image, fd);
+    }
+    vfs_close(fd);  // The image and the mappings hold their own references
+
+    // One with too much to copy to keep would need the file read again
+    if (result == 0 && (image->copy || image->copy_size == 0)) {
+        exec_cache_insert(image);
+    }
+    exec_image_put(image);
+    return result;
+}
+
+// Load a user program from the file system. Its segments, stack and heap
+// are areas of a new address space; nothing is read until touched.
+int user_program_load(const char *path, struct user_program *program) {
+    if (!path || !program) {
+        return USER_PROGRAM_ERROR_INVALID_FORMAT;
+    }
     
     // Initialize program structure
     memset(program, 0, sizeof(struct user_program));
     strncpy(program->name, path, sizeof(program->name) - 1);
     
-    // Allocate basic memory regions
-    program->stack_size = USER_STACK_SIZE;
-    program->stack_base = user_alloc_pages(program->stack_size);
-    if (!program->stack_base) {
-        vfs_close(fd);
+    program->aspace = aspace_create();
+    if (!program->aspace) {
         return USER_PROGRAM_ERROR_NO_MEMORY;
     }
+    program->demand_paged = 1;
+    
+    int result = user_program_map_image(program, path);
+    if (result != 0) {
+        aspace_put(program->aspace);
+        program->aspace = NULL;
+        return result;
+    }
     
+    // Reserve the stack and heap; pages are faulted in as they are touched
+    program->stack_size = USER_STACK_SIZE;
     program->heap_size = USER_HEAP_SIZE;
-    program->heap_base = user_alloc_pages(program->heap_size);
-    if (!program->heap_base) {
-        user_free_pages(program->stack_base, program->stack_size);
-        vfs_close(fd);
+    program->stack_base = (void *)(USER_STACK_TOP - USER_STACK_SIZE);
+    program->heap_base = (void *)USER_HEAP_BASE;
+    if (vm_reserve(program->aspace, (uint64_t)program->stack_base,
+                   program->stack_size, USER_DATA_FLAGS) < 0 ||
+        vm_reserve(program->aspace, (uint64_t)program->heap_base,
+                   program->heap_size, USER_DATA_FLAGS) < 0) {
+        aspace_put(program->aspace);
+        program->aspace = NULL;
         return USER_PROGRAM_ERROR_NO_MEMORY;
     }
     
-    // Set up a dummy entry point for demonstration
-    program->entry_point = (void *)USER_PROGRAM_BASE;
-    program->load_base = (void *)USER_PROGRAM_BASE;
-    program->image_size = 4096;  // 4KB program
     program->status = PROGRAM_STATUS_READY;
-    
-    vfs_close(fd);
     return 0;
 }
 
@@ -67,10 +555,12 @@ int user_program_execute(struct user_program *program) {
         return -1;
     }
     
-    // Create a new task for the program
-    // For now, we'll use a dummy task entry point
-    program->pid = process_create((task_entry_t)program->entry_point, 
-                                  program, program->name, PRIORITY_NORMAL);
+    program->vdso = vdso_get_data();
+    
+    // Create a new task for the program, in an address space of its own
+    program->pid = process_create_user((task_entry_t)program->entry_point,
+                                       program, program->name, 0, program->aspace);
+    program->aspace = NULL;  // The task's now, even if creation failed
     
     if ((int)program->pid < 0) {
         return -1;
@@ -86,12 +576,17 @@ void user_program_cleanup(struct user_program *program) {
         return;
     }
     
-    // Free memory regions
-    if (program->stack_base) {
+    // Free memory regions; VM areas go with their address space
+    if (program->aspace) {
+        aspace_put(program->aspace);
+        program->aspace = NULL;
+    }
+    
+    if (!program->demand_paged && program->stack_base) {
         user_free_pages(program->stack_base, program->stack_size);
     }
     
-    if (program->heap_base) {
+    if (!program->demand_paged && program->heap_base) {
         user_free_pages(program->heap_base, program->heap_size);
     }
     
@@ -103,13 +598,7 @@ void user_program_cleanup(struct user_program *program) {
 
 // Wait for user program completion
 int user_program_wait(uint32_t pid, int *status) {
-    // For Phase 7, this is a stub
-    // In a full implementation, this would wait for the process to exit
-    (void)pid;  // Suppress unused parameter warning
-    if (status) {
-        *status = 0;
-    }
-    return 0;
+    return process_wait((int)pid, status) < 0 ? -1 : 0;
 }
 
 // Create a new user program
@@ -128,7 +617,7 @@ int program_create(const char *path, int argc, char *argv[], struct user_program
     }
     
     // Add to program table
-    if (program_count < MAX_TASKS) {
+    if (program_count < MAX_PROGRAMS) {
         program_table[program_count] = *program;
         program_count++;
     }
@@ -202,15 +691,8 @@ void cleanup_program_arguments(struct user_program *program) {
     program->argc = 0;
 }
 
-// Enhanced program loading with advanced ELF support
+// Enhanced program loading: user_program_load() maps real ELF images
 int program_load_enhanced(const char *path, struct user_program *program) {
-    // Try advanced ELF loading first
-    int result = program_load_advanced(path, program);
-    if (result == ELF_ADV_SUCCESS) {
-        return 0;  // Success
-    }
-    
-    // Fall back to basic loading
     return user_program_load(path, program);
 }
 
@@ -258,11 +740,6 @@ int process_spawn(const char *path, int argc, char *argv[]) {
     return process_exec(path, argc, argv);
 }
 
-// Stub for process_fork - not implemented in Phase 7
-int process_fork(void) {
-    return -1;  // Not implemented
-}
-
 // Error handling
 const char *user_program_error_string(int error_code) {
     switch (error_code) {
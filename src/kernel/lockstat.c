@@ -0,0 +1,168 @@
+/*
+ * MiniOS Lock Statistics
+ *
+ * One open-addressed table keyed by lock address. Entries are claimed
+ * with compare-and-swap and never removed, and only the holder of a lock
+ * updates its entry, so the hooks run from inside spin_lock() and
+ * spin_unlock() without a lock of their own.
+ */
+
+#include "lockstat.h"
+#include "kernel.h"
+#include "vdso.h"
+
+#ifdef CONFIG_LOCKSTAT
+
+static struct lockstat_entry lockstat_table[LOCKSTAT_MAX_LOCKS];
+static uint64_t lockstat_untracked;
+
+static inline uint32_t lockstat_hash(uintptr_t lock)
+{
+    uint64_t h = (uint64_t)lock * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 40) & (LOCKSTAT_MAX_LOCKS - 1);
+}
+
+// Entry for lock, claimed for site if new; NULL if the table is full
+static struct lockstat_entry *lockstat_entry_for(uintptr_t lock, uintptr_t site)
+{
+    uint32_t idx = lockstat_hash(lock);
+    for (uint32_t probes = 0; probes < LOCKSTAT_MAX_LOCKS; probes++) {
+        struct lockstat_entry *entry = &lockstat_table[idx];
+        uintptr_t key = __atomic_load_n(&entry->lock, __ATOMIC_ACQUIRE);
+        if (key == 0) {
+            if (__atomic_compare_exchange_n(&entry->lock, &key, lock, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                entry->site = site;
+                return entry;
+            }
+            // Another CPU claimed it first; key now holds its lock
+        }
+        if (key == lock) {
+            return entry;
+        }
+        idx = (idx + 1) & (LOCKSTAT_MAX_LOCKS - 1);
+    }
+    return NULL;
+}
+
+uint64_t lockstat_clock(void)
+{
+    return arch_vdso_read_counter();
+}
+
+__attribute__((noinline))
+void lockstat_acquired(spinlock_t *lock, uint64_t wait_start)
+{
+    uint64_t now = arch_vdso_read_counter();
+    lock->acquired_at = now;
+
+    // spin_lock() is inlined, so this returns into the code that took it
+    struct lockstat_entry *entry = lockstat_entry_for((uintptr_t)lock,
+                                                      (uintptr_t)__builtin_return_address(0));
+    if (!entry) {
+        __atomic_fetch_add(&lockstat_untracked, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    entry->acquisitions++;
+    if (wait_start) {
+        uint64_t waited = now - wait_start;
+        entry->contended++;
+        entry->wait_total += waited;
+        if (waited > entry->wait_max) {
+            entry->wait_max = waited;
+        }
+    }
+}
+
+void lockstat_released(spinlock_t *lock)
+{
+    uint64_t held = arch_vdso_read_counter() - lock->acquired_at;
+    struct lockstat_entry *entry = lockstat_entry_for((uintptr_t)lock, 0);
+    if (!entry) {
+        return;
+    }
+
+    entry->hold_total += held;
+    if (held > entry->hold_max) {
+        entry->hold_max = held;
+    }
+}
+
+static uint64_t lockstat_key(const struct lockstat_entry *entry, int order)
+{
+    switch (order) {
+    case LOCKSTAT_BY_HOLD:
+        return entry->hold_total;
+    case LOCKSTAT_BY_COUNT:
+        return entry->acquisitions;
+    default:
+        return entry->wait_total;
+    }
+}
+
+int lockstat_report(int order, struct lockstat_entry *entries, int max,
+                    struct lockstat_summary *summary)
+{
+    if (!entries || max < 0 || !summary) {
+        return 0;
+    }
+
+    summary->locks = 0;
+    summary->untracked = __atomic_load_n(&lockstat_untracked, __ATOMIC_RELAXED);
+    summary->frequency = arch_vdso_counter_frequency();
+    int count = 0;
+
+    // Insertion sort into the caller's array, ties broken by acquisitions
+    for (uint32_t i = 0; i < LOCKSTAT_MAX_LOCKS; i++) {
+        struct lockstat_entry entry = lockstat_table[i];
+        if (!entry.lock) {
+            continue;
+        }
+        summary->locks++;
+
+        uint64_t key = lockstat_key(&entry, order);
+        int pos = count < max ? count++ : max;
+        while (pos > 0 && (lockstat_key(&entries[pos - 1], order) < key ||
+                           (lockstat_key(&entries[pos - 1], order) == key &&
+                            entries[pos - 1].acquisitions < entry.acquisitions))) {
+            if (pos < max) {
+                entries[pos] = entries[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max) {
+            entries[pos] = entry;
+        }
+    }
+    return count;
+}
+
+void lockstat_reset(void)
+{
+    for (uint32_t i = 0; i < LOCKSTAT_MAX_LOCKS; i++) {
+        struct lockstat_entry *entry = &lockstat_table[i];
+        entry->acquisitions = 0;
+        entry->contended = 0;
+        entry->wait_total = 0;
+        entry->wait_max = 0;
+        entry->hold_total = 0;
+        entry->hold_max = 0;
+    }
+    __atomic_store_n(&lockstat_untracked, 0, __ATOMIC_RELAXED);
+}
+
+#else
+
+int lockstat_report(int order, struct lockstat_entry *entries, int max,
+                    struct lockstat_summary *summary)
+{
+    (void)order; (void)entries; (void)max; (void)summary;
+    return -1;
+}
+
+void lockstat_reset(void)
+{
+}
+
+#endif /* CONFIG_LOCKSTAT */
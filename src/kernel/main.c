@@ -11,15 +11,22 @@
  */
 
 #include "kernel.h"
+#include "klog.h"
+#include "boot_trace.h"
 
 // Phase-controlled includes - only include what we're testing
 #if !defined(PHASE_1_2_ONLY)
 #include "process.h"
+#include "smp.h"
 #include "syscall.h"
+#include "vdso.h"
+#include "perf.h"
 #include "vfs.h"
 #include "sfs.h"
 #include "ramfs.h"
 #include "block_device.h"
+#include "virtio.h"
+#include "network.h"
 #include "fd.h"
 #include "shell.h"
 #endif
@@ -50,6 +57,44 @@ static void early_print_uint(uint32_t value)
     early_print(buffer);
 }
 
+#if !defined(PHASE_1_2_ONLY) && !defined(PHASE_3_ONLY) && !defined(PHASE_4_ONLY)
+/**
+ * Device to mount the root from: root=<device> on the command line, else
+ * ROOT=<device> at build time. It holds an SFS image built on the host by
+ * tools/mkfs-sfs.py, so boot neither formats nor populates anything.
+ * @return 1 if name was filled, 0 to use a populated RAMFS
+ */
+static int root_device(struct boot_info *boot_info, char *name, size_t size)
+{
+    const char *value = NULL;
+    if (boot_info && boot_info_valid(boot_info)) {
+        const char *cmdline = boot_info->cmdline;
+        for (size_t i = 0; i < sizeof(boot_info->cmdline) && cmdline[i]; i++) {
+            if ((i == 0 || cmdline[i - 1] == ' ') && strncmp(cmdline + i, "root=", 5) == 0) {
+                value = cmdline + i + 5;
+                break;
+            }
+        }
+    }
+#ifdef CONFIG_ROOT_DEVICE
+    if (!value) {
+        value = CONFIG_ROOT_DEVICE;
+    }
+#endif
+    if (!value) {
+        return 0;
+    }
+
+    size_t len = 0;
+    while (value[len] && value[len] != ' ' && len + 1 < size) {
+        name[len] = value[len];
+        len++;
+    }
+    name[len] = '\0';
+    return len > 0;
+}
+#endif
+
 static void test_sfs_block_device(void)
 {
     early_print("\n=== SFS Block Device Test ===\n");
@@ -143,10 +188,44 @@ static void __attribute__((unused)) test_sfs_mount_smoke(void)
     sfs_unmount(fs);
 }
 
+// Deferred block device setup, run by device_init_async()
+static int ramdisk_test_init(void)
+{
+    // Create RAM disk block device
+    early_print("Creating RAM disk...\n");
+    struct block_device *ramdisk = ramdisk_create("ramdisk0", 4 * 1024 * 1024);
+    if (!ramdisk) {
+        early_print("Warning: RAM disk creation failed\n");
+        return -1;
+    }
+    boot_trace_mark("ramdisk_create");
+
+    early_print("RAM disk created successfully\n");
+    test_sfs_block_device();
+    test_sfs_format();
+    boot_trace_mark("sfs_format");
+    // TEMP: Disable mkdir test that's causing crashes
+    // test_sfs_mount_smoke();
+    return 0;
+}
+
+static int virtio_probe_init(void)
+{
+    // Attach virtio disks, if the machine has any
+    if (virtio_init() > 0) {
+        block_device_list_all();
+    }
+    boot_trace_mark("virtio_init");
+    return 0;
+}
+
 void kernel_main(struct boot_info *boot_info)
 {
+    boot_trace_mark("kernel_main");
+
     // Architecture-specific initialization
     arch_init();
+    boot_trace_mark("arch_init");
     
     // Print welcome message
 #ifdef PHASE_1_2_ONLY
@@ -291,6 +370,7 @@ void kernel_main(struct boot_info *boot_info)
     if (memory_init(boot_info) < 0) {
         kernel_panic("Memory management initialization failed");
     }
+    boot_trace_mark("memory_init");
     early_print("Back from memory_init, about to do exception_init...\n");
 #endif
     
@@ -306,6 +386,7 @@ void kernel_main(struct boot_info *boot_info)
     if (exception_init() < 0) {
         kernel_panic("Exception handling initialization failed");
     }
+    boot_trace_mark("exception_init");
 #endif
     
     // Phase 3: Test memory allocation
@@ -318,6 +399,7 @@ void kernel_main(struct boot_info *boot_info)
 #else
     early_print("Running memory allocation test...\n");
     test_memory_allocation();
+    boot_trace_mark("memory_test");
 #endif
 
 #if !defined(PHASE_3_ONLY)
@@ -328,16 +410,13 @@ void kernel_main(struct boot_info *boot_info)
     if (device_init(boot_info) < 0) {
         kernel_panic("Device subsystem initialization failed");
     }
+    boot_trace_mark("device_init");
     
     // Initialize timer services
     if (timer_init() < 0) {
         kernel_panic("Timer subsystem initialization failed");
     }
-    
-    // Enable scheduler timer (basic scheduling support)
-    if (timer_enable_scheduler() < 0) {
-        early_print("Warning: Failed to enable timer scheduler\n");
-    }
+    boot_trace_mark("timer_init");
     
     // Show device information
     device_list_all();
@@ -357,6 +436,7 @@ void kernel_main(struct boot_info *boot_info)
     if (uart_init() < 0) {
         kernel_panic("UART subsystem initialization failed");
     }
+    boot_trace_mark("uart_init");
     
     // Test UART functionality
     uart_test_output();
@@ -365,22 +445,66 @@ void kernel_main(struct boot_info *boot_info)
     if (interrupt_init() < 0) {
         kernel_panic("Interrupt subsystem initialization failed");
     }
+    boot_trace_mark("interrupt_init");
     
     // Test interrupt functionality
     show_interrupt_controllers();
+
+    // Console output queues and input is buffered from here on
+    if (uart_enable_interrupts(uart_get_primary(), 1, 1) < 0) {
+        early_print("Warning: UART interrupts unavailable, console polls\n");
+    }
+
+    // Enable scheduler timer; needs the interrupt controller for its IRQ
+    if (timer_enable_scheduler() < 0) {
+        early_print("Warning: Failed to enable timer scheduler\n");
+    }
     
+    // Kernel address space and ASID allocator, before the first task
+    aspace_init();
+
     // Initialize process management
     if (process_init() < 0) {
         kernel_panic("Process management initialization failed");
     }
+    boot_trace_mark("process_init");
     
     // Initialize scheduler
     scheduler_init();
+    boot_trace_mark("scheduler_init");
+
+    // Start the other CPUs; each runs its scheduler's idle loop
+    smp_init();
+    boot_trace_mark("smp_init");
+
+    // The boot thread goes on to run the shell as a task of its own, so
+    // the timer can preempt it; interrupts are live from here on
+    if (process_adopt_current("kernel") == 0) {
+        arch_interrupts_enable(1);
+    } else {
+        early_print("Warning: Boot thread not schedulable, preemption disabled\n");
+    }
     
     // Initialize system call interface
     if (syscall_init() < 0) {
         kernel_panic("System call interface initialization failed");
     }
+    boot_trace_mark("syscall_init");
+
+    // Shared data page for syscall-free clock and PID reads; the x86-64
+    // TSC is calibrated against the timer, which needs interrupts on
+    vdso_init();
+    boot_trace_mark("vdso_init");
+
+    // Hardware performance counters, for perfstat and per-task counts
+    perf_init();
+
+    // Console output from here on is printed by klogd rather than by
+    // whoever logs it
+    if (klog_start() < 0) {
+        early_print("Warning: klogd not started, logging synchronously\n");
+    }
+    boot_trace_mark("klog_start");
 
 #if !defined(PHASE_4_ONLY)
     // Phase 5: File system initialization
@@ -409,11 +533,13 @@ void kernel_main(struct boot_info *boot_info)
     if (block_device_init() != BLOCK_SUCCESS) {
         early_print("Warning: Block device layer initialization failed\n");
     }
+    boot_trace_mark("block_device_init");
     
     // Initialize Virtual File System
     if (vfs_init() != VFS_SUCCESS) {
         early_print("Warning: VFS initialization failed\n");
     }
+    boot_trace_mark("vfs_init");
 
     // Initialize Simple File System
     if (sfs_init() != VFS_SUCCESS) {
@@ -433,39 +559,68 @@ void kernel_main(struct boot_info *boot_info)
         early_print("Warning: File descriptor initialization failed\n");
     }
 
-    // Create RAM disk block device
-    early_print("Creating RAM disk...\n");
-    struct block_device *ramdisk = ramdisk_create("ramdisk0", 4 * 1024 * 1024);
-    if (ramdisk) {
-        early_print("RAM disk created successfully\n");
-        test_sfs_block_device();
-        test_sfs_format();
-        // TEMP: Disable mkdir test that's causing crashes
-        // test_sfs_mount_smoke();
-    } else {
-        early_print("Warning: RAM disk creation failed\n");
+    // Dirty file data and metadata are written back in the background
+    if (vfs_writeback_start() != VFS_SUCCESS) {
+        early_print("Warning: flusher not started, data is written back on sync only\n");
+    }
+
+    // Caches grow into free memory and are shrunk when it runs low
+    if (memory_reclaim_start() < 0) {
+        early_print("Warning: reclaimer not started, caches are only bounded by capacity\n");
+    }
+    boot_trace_mark("fs_init");
+
+    // Network stack and loopback; virtio-net interfaces join it as they
+    // are probed below
+    if (network_init() != NET_SUCCESS) {
+        early_print("Warning: Network initialization failed\n");
+    }
+    boot_trace_mark("network_init");
+
+    // Block devices are not needed to reach the shell: probe them in
+    // tasks of their own, in parallel with each other and with the rest
+    // of boot. mount and mkfs wait for them before giving up on a name.
+    device_init_async("ramdisk-init", ramdisk_test_init);
+    device_init_async("virtio-probe", virtio_probe_init);
+
+    // A prebuilt SFS image is mounted as it is; mount waits for the
+    // probe that registers its device
+    int root_mounted = 0;
+    char root_name[16];
+    if (root_device(boot_info, root_name, sizeof(root_name))) {
+        early_print("Mounting SFS root from ");
+        early_print(root_name);
+        early_print("...\n");
+        root_mounted = vfs_mount(root_name, "/", "sfs", 0) == VFS_SUCCESS;
+        if (!root_mounted) {
+            early_print("Warning: Failed to mount the root device, using RAMFS\n");
+        }
     }
 
     // Mount RAMFS filesystem
-    early_print("Mounting RAMFS at root...\n");
-    if (vfs_mount("none", "/", "ramfs", 0) == VFS_SUCCESS) {
-        early_print("RAMFS mounted successfully\n");
-        
-        // Get the mounted filesystem
-        struct file_system *root_fs = vfs_get_filesystem("/");
-        if (root_fs) {
-            early_print("Populating RAMFS with initial files...\n");
-            if (ramfs_populate_initial_files(root_fs) == VFS_SUCCESS) {
-                early_print("Initial file structure created\n");
-                ramfs_dump_filesystem_info(root_fs);
-            } else {
-                early_print("Warning: Could not populate initial files\n");
+    if (!root_mounted) {
+        early_print("Mounting RAMFS at root...\n");
+        if (vfs_mount("none", "/", "ramfs", 0) == VFS_SUCCESS) {
+            early_print("RAMFS mounted successfully\n");
+
+            // Get the mounted filesystem
+            struct file_system *root_fs = vfs_get_filesystem("/");
+            if (root_fs) {
+                early_print("Populating RAMFS with initial files...\n");
+                if (ramfs_populate_initial_files(root_fs) == VFS_SUCCESS) {
+                    early_print("Initial file structure created\n");
+                    ramfs_dump_filesystem_info(root_fs);
+                } else {
+                    early_print("Warning: Could not populate initial files\n");
+                }
             }
+        } else {
+            early_print("Warning: Failed to mount RAMFS\n");
         }
-    } else {
-        early_print("Warning: Failed to mount RAMFS\n");
     }
 
+    boot_trace_mark("root_mount");
+
     // Display VFS information
     vfs_dump_info();
 
@@ -484,6 +639,7 @@ void kernel_main(struct boot_info *boot_info)
     // Register shell-related system calls
     register_shell_syscalls();
     early_print("Shell system calls registered\n");
+    boot_trace_mark("shell_init");
     
     early_print("Kernel initialization complete!\n");
     early_print("MiniOS is ready (Phase 6 - User Interface)\n");
@@ -555,16 +711,21 @@ void kernel_main(struct boot_info *boot_info)
 
 void kernel_panic(const char *message)
 {
-    early_print("\n*** KERNEL PANIC ***\n");
-    early_print("Panic: ");
-    early_print(message);
-    early_print("\nSystem halted.\n");
+    klog_write(LOG_FATAL, "\n*** KERNEL PANIC ***\n");
+    klog_write(LOG_FATAL, "Panic: ");
+    klog_write(LOG_FATAL, message);
+    klog_write(LOG_FATAL, "\nSystem halted.\n");
+
+    // klogd will never run again: print what is left by hand
+    klog_flush();
+    enhanced_early_print_flush();
     
     arch_halt();
 }
 
 void early_print(const char *str)
 {
-    // Delegate to architecture-specific implementation
-    arch_early_print(str);
+    // Boot messages are logged unfiltered so release builds still show
+    // them; klogd prints them once it runs, the caller before that
+    klog_write(LOG_INFO, str);
 }
@@ -108,14 +108,13 @@ void memory_unmap(void *virt_addr, size_t size)
  */
 void *memory_alloc(size_t size, uint32_t alignment)
 {
-    if (!memory_initialized) {
+    if (!memory_initialized || size == 0) {
         return NULL;
     }
-    
-    // For Phase 3, ignore alignment requirements
-    (void)alignment;  // Suppress unused parameter warning
-    
-    return memory_alloc_pages((size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K);
+
+    // Small requests come from the slab heap, whose objects are aligned to
+    // their size class; larger alignments get an aligned page run
+    return kmalloc_aligned(size, alignment);
 }
 
 /**
@@ -126,9 +125,49 @@ void memory_free(void *ptr)
     if (!memory_initialized || !ptr) {
         return;
     }
-    
-    // For Phase 3, free as single page
-    memory_free_pages(ptr, 1);
+
+    kfree(ptr);
+}
+
+/**
+ * Allocate physically contiguous memory for DMA
+ */
+void *memory_dma_alloc(size_t size, size_t alignment, uint64_t *phys)
+{
+    if (size == 0) {
+        return NULL;
+    }
+
+    size_t pages = (size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+    uint8_t *virt = memory_alloc_pages_aligned(pages, alignment);
+    if (!virt) {
+        return NULL;
+    }
+
+    memset(virt, 0, pages * PAGE_SIZE_4K);
+    if (phys) {
+        *phys = memory_virt_to_phys(virt);
+    }
+    return virt;
+}
+
+/**
+ * Free memory from memory_dma_alloc()
+ */
+void memory_dma_free(void *virt, size_t size)
+{
+    if (virt && size) {
+        memory_free_pages(virt, (size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K);
+    }
+}
+
+/**
+ * Bus address of kernel memory
+ */
+uint64_t memory_virt_to_phys(const void *virt)
+{
+    // The kernel runs identity mapped (see memory_map())
+    return (uint64_t)(uintptr_t)virt;
 }
 
 /**
@@ -161,43 +200,6 @@ void memory_show_layout(struct boot_info *boot_info)
     early_print("memory_show_layout completed, returning to main\n");
 }
 
-// Simple memory allocation for shell (basic implementation)
-// In a real OS, this would use a proper heap allocator
-
-#define KMALLOC_ALIGNMENT 16
-
-static uint8_t simple_heap[256 * 1024] __attribute__((aligned(KMALLOC_ALIGNMENT)));  // 256KB static heap
-static size_t heap_offset = 0;
-
-void *kmalloc(size_t size) {
-    // Simple bump allocator
-    if (size == 0) return NULL;
-
-    // Align requested size and heap pointer so we can safely satisfy
-    // callers that issue 128-bit accesses (e.g. NEON stores emitted by GCC).
-    size = (size + (KMALLOC_ALIGNMENT - 1)) & ~(size_t)(KMALLOC_ALIGNMENT - 1);
-    size_t aligned_offset = (heap_offset + (KMALLOC_ALIGNMENT - 1)) & ~(size_t)(KMALLOC_ALIGNMENT - 1);
-
-    if (aligned_offset + size > sizeof(simple_heap)) {
-        early_print("kmalloc: OUT OF MEMORY\n");
-        return NULL;  // Out of memory
-    }
-
-    void *ptr = &simple_heap[aligned_offset];
-    heap_offset = aligned_offset + size;
-
-    // Debug output with address (simplified)
-    early_print("kmalloc: OK\n");
-
-    return ptr;
-}
-
-void kfree(void *ptr) {
-    // Simple allocator doesn't support freeing individual blocks
-    // In a real implementation, this would maintain a free list
-    (void)ptr;  // Suppress warning
-}
-
 /**
  * Check if memory allocator is ready
  */
@@ -0,0 +1,192 @@
+/*
+ * MiniOS Allocation Profiler
+ *
+ * Two open-addressed tables under one lock: call sites, which are never
+ * removed, and live allocations keyed by pointer and allocator, removed
+ * by shifting later entries of the probe run back. The lock nests inside
+ * the allocators' own, so nothing here may allocate.
+ */
+
+#include "memprof.h"
+#include "kernel.h"
+#include "spinlock.h"
+
+#ifdef CONFIG_MEMPROF
+
+#define MEMPROF_NO_SITE     0xffff
+
+struct memprof_site_slot {
+    struct memprof_site stats;
+    uint32_t kind;
+    int used;
+};
+
+struct memprof_live {
+    uintptr_t ptr;                  // 0 when the slot is empty
+    uint32_t size;
+    uint16_t site;                  // Index into memprof_sites
+    uint16_t kind;
+};
+
+static struct memprof_site_slot memprof_sites[MEMPROF_MAX_SITES];
+static struct memprof_live memprof_live[MEMPROF_MAX_LIVE];
+static uint32_t memprof_live_count;
+static uint64_t memprof_untracked[MEMPROF_KINDS];
+static spinlock_t memprof_lock = SPINLOCK_INIT;
+
+static inline uint32_t memprof_hash(uintptr_t key, uint32_t kind, uint32_t size)
+{
+    uint64_t h = ((uint64_t)key ^ kind) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 40) & (size - 1);
+}
+
+// Slot for site, claimed if new; MEMPROF_NO_SITE if the table is full
+static uint32_t memprof_site_index(uint32_t kind, uintptr_t site)
+{
+    uint32_t idx = memprof_hash(site, kind, MEMPROF_MAX_SITES);
+    for (uint32_t probes = 0; probes < MEMPROF_MAX_SITES; probes++) {
+        struct memprof_site_slot *slot = &memprof_sites[idx];
+        if (!slot->used) {
+            memset(slot, 0, sizeof(*slot));
+            slot->used = 1;
+            slot->kind = kind;
+            slot->stats.site = site;
+            slot->stats.min_size = UINT32_MAX;
+            return idx;
+        }
+        if (slot->kind == kind && slot->stats.site == site) {
+            return idx;
+        }
+        idx = (idx + 1) & (MEMPROF_MAX_SITES - 1);
+    }
+    return MEMPROF_NO_SITE;
+}
+
+void memprof_alloc(uint32_t kind, const void *ptr, size_t size, uintptr_t site)
+{
+    if (!ptr || kind >= MEMPROF_KINDS) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&memprof_lock);
+    uint32_t index = memprof_site_index(kind, site);
+    if (index == MEMPROF_NO_SITE || memprof_live_count >= MEMPROF_MAX_LIVE - 1) {
+        memprof_untracked[kind]++;
+        spin_unlock_irqrestore(&memprof_lock, flags);
+        return;
+    }
+
+    uint32_t idx = memprof_hash((uintptr_t)ptr, kind, MEMPROF_MAX_LIVE);
+    while (memprof_live[idx].ptr) {
+        idx = (idx + 1) & (MEMPROF_MAX_LIVE - 1);
+    }
+    uint32_t size32 = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    memprof_live[idx].ptr = (uintptr_t)ptr;
+    memprof_live[idx].size = size32;
+    memprof_live[idx].site = (uint16_t)index;
+    memprof_live[idx].kind = (uint16_t)kind;
+    memprof_live_count++;
+
+    struct memprof_site *stats = &memprof_sites[index].stats;
+    stats->live_count++;
+    stats->live_size += size32;
+    stats->allocs++;
+    if (stats->live_size > stats->peak_size) {
+        stats->peak_size = stats->live_size;
+    }
+    if (size32 < stats->min_size) {
+        stats->min_size = size32;
+    }
+    if (size32 > stats->max_size) {
+        stats->max_size = size32;
+    }
+    spin_unlock_irqrestore(&memprof_lock, flags);
+}
+
+void memprof_free(uint32_t kind, const void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&memprof_lock);
+    uint32_t idx = memprof_hash((uintptr_t)ptr, kind, MEMPROF_MAX_LIVE);
+    while (memprof_live[idx].ptr &&
+           (memprof_live[idx].ptr != (uintptr_t)ptr || memprof_live[idx].kind != kind)) {
+        idx = (idx + 1) & (MEMPROF_MAX_LIVE - 1);
+    }
+    if (!memprof_live[idx].ptr) {
+        spin_unlock_irqrestore(&memprof_lock, flags);
+        return;                         // Untracked, or from before a full table
+    }
+
+    struct memprof_site *stats = &memprof_sites[memprof_live[idx].site].stats;
+    stats->live_count--;
+    stats->live_size -= memprof_live[idx].size;
+    memprof_live_count--;
+
+    // Move later entries of the run into the hole when their home allows
+    uint32_t hole = idx;
+    for (uint32_t next = (hole + 1) & (MEMPROF_MAX_LIVE - 1); memprof_live[next].ptr;
+         next = (next + 1) & (MEMPROF_MAX_LIVE - 1)) {
+        uint32_t home = memprof_hash(memprof_live[next].ptr, memprof_live[next].kind,
+                                     MEMPROF_MAX_LIVE);
+        if (((next - home) & (MEMPROF_MAX_LIVE - 1)) >= ((next - hole) & (MEMPROF_MAX_LIVE - 1))) {
+            memprof_live[hole] = memprof_live[next];
+            hole = next;
+        }
+    }
+    memprof_live[hole].ptr = 0;
+    spin_unlock_irqrestore(&memprof_lock, flags);
+}
+
+int memprof_report(uint32_t kind, struct memprof_site *sites, int max,
+                   struct memprof_summary *summary)
+{
+    if (kind >= MEMPROF_KINDS || !sites || max < 0 || !summary) {
+        return 0;
+    }
+
+    summary->live_size = 0;
+    summary->sites = 0;
+    int count = 0;
+
+    // Insertion sort into the caller's array: most held first, then most
+    // allocated
+    unsigned long flags = spin_lock_irqsave(&memprof_lock);
+    summary->untracked = memprof_untracked[kind];
+    for (uint32_t i = 0; i < MEMPROF_MAX_SITES; i++) {
+        const struct memprof_site_slot *slot = &memprof_sites[i];
+        if (!slot->used || slot->kind != kind) {
+            continue;
+        }
+        summary->sites++;
+        summary->live_size += slot->stats.live_size;
+
+        int pos = count < max ? count++ : max;
+        while (pos > 0 && (sites[pos - 1].live_size < slot->stats.live_size ||
+                           (sites[pos - 1].live_size == slot->stats.live_size &&
+                            sites[pos - 1].allocs < slot->stats.allocs))) {
+            if (pos < max) {
+                sites[pos] = sites[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max) {
+            sites[pos] = slot->stats;
+        }
+    }
+    spin_unlock_irqrestore(&memprof_lock, flags);
+    return count;
+}
+
+#else
+
+int memprof_report(uint32_t kind, struct memprof_site *sites, int max,
+                   struct memprof_summary *summary)
+{
+    (void)kind; (void)sites; (void)max; (void)summary;
+    return -1;
+}
+
+#endif /* CONFIG_MEMPROF */
@@ -0,0 +1,531 @@
+/*
+ * MiniOS Physical Page Allocator
+ * Binary buddy allocator shared by all architectures
+ *
+ * Each MEMORY_TYPE_AVAILABLE region handed over by the architecture code
+ * becomes a zone. A zone keeps one byte of metadata and one owner pointer
+ * per page (carved from the start of the region) and one free list per
+ * order; free blocks are
+ * linked through their first bytes. Allocation and free are O(log n) in
+ * the largest block size, and freed blocks coalesce with their buddies.
+ * A single lock serializes allocation and free across CPUs.
+ *
+ * Single pages can be shared (copy-on-write): each extra reference is
+ * counted in the page's metadata byte, and the page is freed when the
+ * last one is dropped.
+ *
+ * The owner pointer belongs to whoever allocated the page (the kernel
+ * heap keeps its slab descriptors there). Zones are fixed once boot has
+ * fed them in, so it is read without the lock.
+ *
+ * An allocation that leaves fewer free pages than the low watermark, or
+ * that fails, kicks the reclaimer (reclaim.c) to shrink the caches before
+ * the next one comes up empty.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "memprof.h"
+#include "spinlock.h"
+
+#define PAGE_SHIFT_4K          12
+#define PAGE_ALLOC_MAX_ZONES   8
+#define PAGE_ALLOC_MAX_RESERVED 8
+
+// Per-page metadata: the head page of a free block has PAGE_META_FREE
+// and its order; an allocated page holds its extra references
+#define PAGE_META_FREE         0x80
+#define PAGE_META_ORDER_MASK   0x1F
+#define PAGE_META_REFS_MAX     0x7F
+
+struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+};
+
+struct free_area {
+    struct free_block *head;
+    uint32_t count;
+};
+
+struct page_zone {
+    uint64_t base;              // Physical address of page index 0
+    uint32_t num_pages;         // Pages managed by this zone
+    uint32_t free_pages;
+    uint8_t *meta;              // One byte per page
+    void **owner;               // One pointer per page, see memory_set_page_owner()
+    struct free_area free_area[PAGE_ALLOC_MAX_ORDER];
+};
+
+struct reserved_range {
+    uint64_t start;
+    uint64_t end;
+};
+
+static struct page_zone zones[PAGE_ALLOC_MAX_ZONES];
+static uint32_t num_zones = 0;
+static struct reserved_range reserved[PAGE_ALLOC_MAX_RESERVED];
+static uint32_t num_reserved = 0;
+
+static uint64_t total_pages = 0;
+static uint64_t free_pages = 0;
+static uint64_t alloc_failures = 0;
+static spinlock_t page_alloc_lock = SPINLOCK_INIT;
+
+static inline uint32_t order_for_pages(size_t num_pages)
+{
+    uint32_t order = 0;
+    while (((size_t)1 << order) < num_pages) {
+        order++;
+    }
+    return order;
+}
+
+static inline struct free_block *zone_block(struct page_zone *zone, uint32_t idx)
+{
+    return (struct free_block *)(zone->base + ((uint64_t)idx << PAGE_SHIFT_4K));
+}
+
+static inline uint32_t zone_index(struct page_zone *zone, struct free_block *block)
+{
+    return (uint32_t)(((uint64_t)block - zone->base) >> PAGE_SHIFT_4K);
+}
+
+static void free_area_push(struct page_zone *zone, uint32_t idx, uint32_t order)
+{
+    struct free_area *area = &zone->free_area[order];
+    struct free_block *block = zone_block(zone, idx);
+
+    block->prev = NULL;
+    block->next = area->head;
+    if (area->head) {
+        area->head->prev = block;
+    }
+    area->head = block;
+    area->count++;
+    zone->meta[idx] = PAGE_META_FREE | (uint8_t)order;
+}
+
+static void free_area_remove(struct page_zone *zone, uint32_t idx, uint32_t order)
+{
+    struct free_area *area = &zone->free_area[order];
+    struct free_block *block = zone_block(zone, idx);
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        area->head = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    area->count--;
+    zone->meta[idx] = 0;
+}
+
+/**
+ * Return a naturally aligned block to its zone, merging with free buddies
+ */
+static void zone_free_block(struct page_zone *zone, uint32_t idx, uint32_t order)
+{
+    while (order < PAGE_ALLOC_MAX_ORDER - 1) {
+        uint32_t buddy = idx ^ (1u << order);
+        if (buddy + (1u << order) > zone->num_pages ||
+            zone->meta[buddy] != (PAGE_META_FREE | order)) {
+            break;
+        }
+        free_area_remove(zone, buddy, order);
+        idx &= ~(1u << order);
+        order++;
+    }
+    free_area_push(zone, idx, order);
+}
+
+/**
+ * Free an arbitrary page range by splitting it into aligned blocks
+ */
+static void zone_free_range(struct page_zone *zone, uint32_t idx, uint32_t count)
+{
+    while (count > 0) {
+        uint32_t order = idx ? (uint32_t)__builtin_ctz(idx) : PAGE_ALLOC_MAX_ORDER - 1;
+        if (order > PAGE_ALLOC_MAX_ORDER - 1) {
+            order = PAGE_ALLOC_MAX_ORDER - 1;
+        }
+        while ((1u << order) > count) {
+            order--;
+        }
+        zone_free_block(zone, idx, order);
+        idx += 1u << order;
+        count -= 1u << order;
+    }
+}
+
+static int zone_alloc(struct page_zone *zone, uint32_t order, uint32_t *idx_out)
+{
+    uint32_t current = order;
+    while (current < PAGE_ALLOC_MAX_ORDER && !zone->free_area[current].head) {
+        current++;
+    }
+    if (current == PAGE_ALLOC_MAX_ORDER) {
+        return -1;
+    }
+
+    uint32_t idx = zone_index(zone, zone->free_area[current].head);
+    free_area_remove(zone, idx, current);
+
+    // Split down, returning the upper halves to the free lists
+    while (current > order) {
+        current--;
+        free_area_push(zone, idx + (1u << current), current);
+    }
+
+    *idx_out = idx;
+    return 0;
+}
+
+static struct page_zone *zone_for_address(uint64_t addr)
+{
+    for (uint32_t i = 0; i < num_zones; i++) {
+        struct page_zone *zone = &zones[i];
+        if (addr >= zone->base &&
+            addr < zone->base + ((uint64_t)zone->num_pages << PAGE_SHIFT_4K)) {
+            return zone;
+        }
+    }
+    return NULL;
+}
+
+static void page_alloc_add_zone(uint64_t start, uint64_t end)
+{
+    if (num_zones >= PAGE_ALLOC_MAX_ZONES) {
+        early_print("page_alloc: too many zones, region ignored\n");
+        return;
+    }
+
+    uint64_t pages = (end - start) >> PAGE_SHIFT_4K;
+    uint64_t meta_pages = (pages * (1 + sizeof(void *)) + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+    if (pages <= meta_pages) {
+        return;
+    }
+
+    // A zone index must fit the 32-bit page counters
+    pages -= meta_pages;
+    if (pages > 0xFFFFFFFFULL) {
+        pages = 0xFFFFFFFFULL;
+    }
+
+    struct page_zone *zone = &zones[num_zones++];
+    memset(zone, 0, sizeof(*zone));
+    zone->owner = (void **)start;
+    zone->meta = (uint8_t *)(start + pages * sizeof(void *));
+    zone->base = start + (meta_pages << PAGE_SHIFT_4K);
+    zone->num_pages = (uint32_t)pages;
+    memset(zone->owner, 0, (size_t)pages * sizeof(void *));
+    memset(zone->meta, 0, (size_t)pages);
+
+    zone_free_range(zone, 0, zone->num_pages);
+    zone->free_pages = zone->num_pages;
+
+    total_pages += zone->num_pages;
+    free_pages += zone->num_pages;
+}
+
+/**
+ * Reset the page allocator before the architecture feeds it regions
+ */
+void page_alloc_init(void)
+{
+    memset(zones, 0, sizeof(zones));
+    num_zones = 0;
+    num_reserved = 0;
+    total_pages = 0;
+    free_pages = 0;
+}
+
+/**
+ * Exclude a physical range (kernel image, boot stacks) from later regions
+ */
+void page_alloc_reserve(uint64_t start, uint64_t end)
+{
+    if (num_reserved >= PAGE_ALLOC_MAX_RESERVED || end <= start) {
+        return;
+    }
+    reserved[num_reserved].start = start & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    reserved[num_reserved].end = (end + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    num_reserved++;
+}
+
+/**
+ * Hand an available physical region to the allocator
+ */
+void page_alloc_add_region(uint64_t base, uint64_t size)
+{
+    uint64_t start = (base + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t end = (base + size) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+
+    // Carve out reserved ranges by recursing on what is left on either side
+    for (uint32_t i = 0; i < num_reserved; i++) {
+        if (reserved[i].end <= start || reserved[i].start >= end) {
+            continue;
+        }
+        if (reserved[i].start > start) {
+            page_alloc_add_region(start, reserved[i].start - start);
+        }
+        if (reserved[i].end < end) {
+            page_alloc_add_region(reserved[i].end, end - reserved[i].end);
+        }
+        return;
+    }
+
+    if (end > start) {
+        page_alloc_add_zone(start, end);
+    }
+}
+
+// Caller holds page_alloc_lock
+static void *zones_alloc_pages(size_t num_pages)
+{
+    if (num_pages == 0 || num_pages > free_pages) {
+        return NULL;
+    }
+
+    uint32_t order = order_for_pages(num_pages);
+    if (order >= PAGE_ALLOC_MAX_ORDER) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < num_zones; i++) {
+        struct page_zone *zone = &zones[i];
+        uint32_t idx;
+        if (zone->free_pages < num_pages || zone_alloc(zone, order, &idx) < 0) {
+            continue;
+        }
+
+        // Give back the tail of the power-of-two block
+        uint32_t block_pages = 1u << order;
+        if (block_pages > num_pages) {
+            zone_free_range(zone, idx + (uint32_t)num_pages,
+                            block_pages - (uint32_t)num_pages);
+        }
+
+        zone->free_pages -= (uint32_t)num_pages;
+        free_pages -= num_pages;
+
+        // Return virtual address (identity mapped for now)
+        return zone_block(zone, idx);
+    }
+
+    return NULL;
+}
+
+// Caller holds page_alloc_lock
+static void zones_free_pages(void *ptr, size_t num_pages)
+{
+    if (!ptr || num_pages == 0) {
+        return;
+    }
+
+    uint64_t addr = (uint64_t)ptr;
+    struct page_zone *zone = zone_for_address(addr);
+    if (!zone || (addr & (PAGE_SIZE_4K - 1))) {
+        return;  // Not ours or not page aligned
+    }
+
+    uint32_t idx = (uint32_t)((addr - zone->base) >> PAGE_SHIFT_4K);
+    if ((uint64_t)idx + num_pages > zone->num_pages) {
+        return;  // Invalid page range
+    }
+    if (zone->meta[idx] & PAGE_META_FREE) {
+        early_print("memory_free_pages: double free ignored\n");
+        return;
+    }
+
+    zone->owner[idx] = NULL;
+    zone_free_range(zone, idx, (uint32_t)num_pages);
+    zone->free_pages += (uint32_t)num_pages;
+    free_pages += num_pages;
+}
+
+static inline uint64_t page_alloc_watermark(uint32_t divisor)
+{
+    uint64_t mark = total_pages / divisor;
+    return mark < PAGE_ALLOC_MIN_WATERMARK ? PAGE_ALLOC_MIN_WATERMARK : mark;
+}
+
+// After an allocation, outside the lock: wake the reclaimer under pressure
+static void page_alloc_check_pressure(const void *ptr)
+{
+    if (!ptr) {
+        __atomic_fetch_add(&alloc_failures, 1, __ATOMIC_RELAXED);
+        memory_reclaim_kick();
+    } else if (__atomic_load_n(&free_pages, __ATOMIC_RELAXED) <
+               page_alloc_watermark(PAGE_ALLOC_LOW_WATERMARK_DIV)) {
+        memory_reclaim_kick();
+    }
+}
+
+/**
+ * Allocate physical pages
+ */
+void *memory_alloc_pages(size_t num_pages)
+{
+    unsigned long flags = spin_lock_irqsave(&page_alloc_lock);
+    void *ptr = zones_alloc_pages(num_pages);
+    spin_unlock_irqrestore(&page_alloc_lock, flags);
+    page_alloc_check_pressure(ptr);
+    memprof_alloc(MEMPROF_PAGES, ptr, num_pages, (uintptr_t)__builtin_return_address(0));
+    return ptr;
+}
+
+/**
+ * Allocate physical pages starting on an alignment boundary
+ */
+void *memory_alloc_pages_aligned(size_t num_pages, size_t alignment)
+{
+    if (alignment < PAGE_SIZE_4K) {
+        alignment = PAGE_SIZE_4K;
+    }
+    if (alignment & (alignment - 1)) {
+        return NULL;
+    }
+
+    // Zones need not start on the boundary, so buddy order alone doesn't
+    // align a block: take enough slack to find one and trim the rest
+    size_t slack = alignment / PAGE_SIZE_4K - 1;
+    unsigned long flags = spin_lock_irqsave(&page_alloc_lock);
+    uint8_t *run = zones_alloc_pages(num_pages + slack);
+    uint8_t *ptr = NULL;
+    if (run) {
+        ptr = (uint8_t *)(((uint64_t)run + alignment - 1) & ~(uint64_t)(alignment - 1));
+        size_t head = (size_t)(ptr - run) / PAGE_SIZE_4K;
+        zones_free_pages(run, head);
+        zones_free_pages(ptr + num_pages * PAGE_SIZE_4K, slack - head);
+    }
+    spin_unlock_irqrestore(&page_alloc_lock, flags);
+    page_alloc_check_pressure(ptr);
+    memprof_alloc(MEMPROF_PAGES, ptr, num_pages, (uintptr_t)__builtin_return_address(0));
+    return ptr;
+}
+
+/**
+ * Free physical pages
+ */
+void memory_free_pages(void *ptr, size_t num_pages)
+{
+    memprof_free(MEMPROF_PAGES, ptr);
+    unsigned long flags = spin_lock_irqsave(&page_alloc_lock);
+    zones_free_pages(ptr, num_pages);
+    spin_unlock_irqrestore(&page_alloc_lock, flags);
+}
+
+// Allocated page holding addr and its zone index; NULL if not ours
+static struct page_zone *page_lookup(void *page, uint32_t *idx)
+{
+    uint64_t addr = (uint64_t)page;
+    struct page_zone *zone = zone_for_address(addr);
+    if (!zone || (addr & (PAGE_SIZE_4K - 1))) {
+        return NULL;
+    }
+    *idx = (uint32_t)((addr - zone->base) >> PAGE_SHIFT_4K);
+    return (zone->meta[*idx] & PAGE_META_FREE) ? NULL : zone;
+}
+
+void memory_set_page_owner(void *page, void *owner)
+{
+    uint64_t addr = (uint64_t)page;
+    struct page_zone *zone = zone_for_address(addr);
+    if (!zone || (addr & (PAGE_SIZE_4K - 1))) {
+        return;
+    }
+    uint32_t idx = (uint32_t)((addr - zone->base) >> PAGE_SHIFT_4K);
+    __atomic_store_n(&zone->owner[idx], owner, __ATOMIC_RELEASE);
+}
+
+void *memory_page_owner(const void *addr)
+{
+    struct page_zone *zone = zone_for_address((uint64_t)addr);
+    if (!zone) {
+        return NULL;
+    }
+    uint32_t idx = (uint32_t)(((uint64_t)addr - zone->base) >> PAGE_SHIFT_4K);
+    return __atomic_load_n(&zone->owner[idx], __ATOMIC_ACQUIRE);
+}
+
+int page_ref_get(void *page)
+{
+    uint32_t idx;
+    int result = -1;
+
+    unsigned long flags = spin_lock_irqsave(&page_alloc_lock);
+    struct page_zone *zone = page_lookup(page, &idx);
+    if (zone && zone->meta[idx] < PAGE_META_REFS_MAX) {
+        zone->meta[idx]++;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&page_alloc_lock, flags);
+    return result;
+}
+
+void page_ref_put(void *page)
+{
+    uint32_t idx;
+
+    unsigned long flags = spin_lock_irqsave(&page_alloc_lock);
+    struct page_zone *zone = page_lookup(page, &idx);
+    if (zone && zone->meta[idx]) {
+        zone->meta[idx]--;
+    } else {
+        memprof_free(MEMPROF_PAGES, page);
+        zones_free_pages(page, 1);
+    }
+    spin_unlock_irqrestore(&page_alloc_lock, flags);
+}
+
+uint32_t page_ref_count(void *page)
+{
+    uint32_t idx;
+
+    unsigned long flags = spin_lock_irqsave(&page_alloc_lock);
+    struct page_zone *zone = page_lookup(page, &idx);
+    uint32_t count = zone ? zone->meta[idx] + 1u : 0;
+    spin_unlock_irqrestore(&page_alloc_lock, flags);
+    return count;
+}
+
+/**
+ * Get memory statistics
+ */
+void memory_get_stats(struct memory_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    uint32_t free_blocks = 0;
+    uint32_t largest_order = 0;
+    int have_free = 0;
+
+    // Manual field assignment instead of struct copy to avoid SIMD issues
+    for (uint32_t order = 0; order < PAGE_ALLOC_MAX_ORDER; order++) {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < num_zones; i++) {
+            count += zones[i].free_area[order].count;
+        }
+        stats->free_blocks[order] = count;
+        free_blocks += count;
+        if (count) {
+            largest_order = order;
+            have_free = 1;
+        }
+    }
+
+    stats->total_memory = total_pages * PAGE_SIZE_4K;
+    stats->free_memory = free_pages * PAGE_SIZE_4K;
+    stats->used_memory = (total_pages - free_pages) * PAGE_SIZE_4K;
+    stats->total_regions = num_zones;
+    stats->free_regions = free_blocks;
+    stats->largest_free_block = have_free ? (1u << largest_order) : 0;
+    stats->low_watermark = page_alloc_watermark(PAGE_ALLOC_LOW_WATERMARK_DIV);
+    stats->high_watermark = page_alloc_watermark(PAGE_ALLOC_HIGH_WATERMARK_DIV);
+    stats->alloc_failures = __atomic_load_n(&alloc_failures, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,298 @@
+/*
+ * MiniOS Hardware Performance Counters
+ *
+ * Each CPU has at most one group loaded into its PMU: the one the task it
+ * is running counts into. Loading programs the events and notes each
+ * counter's value as a base; folding adds the distance travelled since
+ * into the group and moves the base up. Counters are never written, so
+ * nothing is lost between a read and a reset, and the width mask takes
+ * care of wraparound as long as a fold comes round before a counter can
+ * lap its base: the tick folds the running task, so 32-bit counters are
+ * safe at any clock rate this kernel will see.
+ *
+ * Groups may be shared by tasks on several CPUs at once, so their totals
+ * are only ever added to atomically.
+ */
+
+#include "perf.h"
+#include "interrupt.h"
+#include "process.h"
+#include "smp.h"
+
+struct perf_cpu {
+    struct perf_group *group;           // Loaded for the current task, or NULL
+    uint64_t base[PERF_MAX_COUNTERS];   // Counter values at the last fold
+};
+
+static struct perf_cpu perf_cpus[MAX_CPUS];
+static uint32_t perf_counters;          // Usable per group, from the boot CPU
+static uint64_t perf_width_mask;
+
+static const char *const perf_event_names[PERF_EVENT_COUNT] = {
+    [PERF_EVENT_CYCLES]         = "cycles",
+    [PERF_EVENT_INSTRUCTIONS]   = "instructions",
+    [PERF_EVENT_CACHE_REFS]     = "cache-references",
+    [PERF_EVENT_CACHE_MISSES]   = "cache-misses",
+    [PERF_EVENT_BRANCHES]       = "branches",
+    [PERF_EVENT_BRANCH_MISSES]  = "branch-misses",
+    [PERF_EVENT_DTLB_MISSES]    = "dtlb-misses",
+    [PERF_EVENT_ITLB_MISSES]    = "itlb-misses",
+};
+
+// Add what the loaded counters have counted since the last fold
+static void perf_fold(struct perf_cpu *pc)
+{
+    struct perf_group *group = pc->group;
+
+    for (uint32_t i = 0; i < group->nr; i++) {
+        uint64_t value = arch_pmu_read(i);
+        uint64_t delta = (value - pc->base[i]) & perf_width_mask;
+        pc->base[i] = value;
+        __atomic_add_fetch(&group->counts[i], delta, __ATOMIC_RELAXED);
+    }
+}
+
+static void perf_load(struct perf_cpu *pc, struct perf_group *group)
+{
+    if (!group || !group->enabled) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < group->nr; i++) {
+        arch_pmu_program(i, group->events[i]);
+        pc->base[i] = arch_pmu_read(i);
+    }
+    pc->group = group;
+    arch_pmu_start((1U << group->nr) - 1);
+}
+
+static void perf_unload(struct perf_cpu *pc)
+{
+    if (!pc->group) {
+        return;
+    }
+
+    arch_pmu_stop();
+    perf_fold(pc);
+    pc->group = NULL;
+}
+
+void perf_cpu_init(void)
+{
+    uint32_t counters = arch_pmu_cpu_init();
+
+    if (smp_cpu_id() == 0) {
+        perf_counters = counters < PERF_MAX_COUNTERS ? counters : PERF_MAX_COUNTERS;
+        perf_width_mask = arch_pmu_counter_mask();
+    }
+}
+
+void perf_init(void)
+{
+    char str[16];
+
+    perf_cpu_init();
+    if (!perf_counters) {
+        early_print("PMU: no hardware counters\n");
+        return;
+    }
+
+    early_print("PMU: ");
+    early_print(itoa((int)perf_counters, str, 10));
+    early_print(" counters,");
+    for (uint32_t event = 0; event < PERF_EVENT_COUNT; event++) {
+        if (arch_pmu_event_supported(event)) {
+            early_print(" ");
+            early_print(perf_event_names[event]);
+        }
+    }
+    early_print("\n");
+}
+
+uint32_t perf_num_counters(void)
+{
+    return perf_counters;
+}
+
+const char *perf_event_name(uint32_t event)
+{
+    return event < PERF_EVENT_COUNT ? perf_event_names[event] : NULL;
+}
+
+int perf_event_supported(uint32_t event)
+{
+    return perf_counters && event < PERF_EVENT_COUNT && arch_pmu_event_supported(event);
+}
+
+struct perf_group *perf_group_create(const uint32_t *events, uint32_t nr, uint32_t flags)
+{
+    if (!events || nr == 0 || nr > perf_counters) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < nr; i++) {
+        if (!perf_event_supported(events[i])) {
+            return NULL;
+        }
+    }
+
+    struct perf_group *group = kmalloc(sizeof(struct perf_group));
+    if (!group) {
+        return NULL;
+    }
+    memset(group, 0, sizeof(struct perf_group));
+    group->nr = nr;
+    group->flags = flags;
+    memcpy(group->events, events, nr * sizeof(uint32_t));
+    group->refs = 1;
+    return group;
+}
+
+void perf_group_put(struct perf_group *group)
+{
+    if (group && __atomic_sub_fetch(&group->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        kfree(group);
+    }
+}
+
+void perf_group_enable(struct perf_group *group)
+{
+    if (!group) {
+        return;
+    }
+
+    unsigned long flags = disable_interrupts();
+    struct perf_cpu *pc = &perf_cpus[smp_cpu_id()];
+    struct task *current = scheduler_get_current_task();
+
+    group->enabled = 1;
+    if (current && current->perf == group && pc->group != group) {
+        perf_unload(pc);
+        perf_load(pc, group);
+    }
+    restore_interrupts(flags);
+}
+
+void perf_group_disable(struct perf_group *group)
+{
+    if (!group) {
+        return;
+    }
+
+    unsigned long flags = disable_interrupts();
+    struct perf_cpu *pc = &perf_cpus[smp_cpu_id()];
+
+    if (pc->group == group) {
+        perf_unload(pc);
+    }
+    group->enabled = 0;
+    restore_interrupts(flags);
+}
+
+void perf_group_read(struct perf_group *group, uint64_t *counts)
+{
+    if (!group || !counts) {
+        return;
+    }
+
+    unsigned long flags = disable_interrupts();
+    struct perf_cpu *pc = &perf_cpus[smp_cpu_id()];
+
+    if (pc->group == group) {
+        perf_fold(pc);
+    }
+    for (uint32_t i = 0; i < group->nr; i++) {
+        counts[i] = __atomic_load_n(&group->counts[i], __ATOMIC_RELAXED);
+    }
+    restore_interrupts(flags);
+}
+
+int perf_attach_current(struct perf_group *group)
+{
+    struct task *current = scheduler_get_current_task();
+    if (!current || !group) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&group->refs, 1, __ATOMIC_RELAXED);
+
+    unsigned long flags = disable_interrupts();
+    struct perf_cpu *pc = &perf_cpus[smp_cpu_id()];
+    struct perf_group *old = current->perf;
+
+    perf_unload(pc);
+    current->perf = group;
+    perf_load(pc, group);
+    restore_interrupts(flags);
+
+    perf_group_put(old);
+    return 0;
+}
+
+void perf_detach_current(void)
+{
+    struct task *current = scheduler_get_current_task();
+    if (!current) {
+        return;
+    }
+
+    unsigned long flags = disable_interrupts();
+    struct perf_group *old = current->perf;
+
+    perf_unload(&perf_cpus[smp_cpu_id()]);
+    current->perf = NULL;
+    restore_interrupts(flags);
+
+    perf_group_put(old);
+}
+
+void perf_switch(struct task *prev, struct task *next)
+{
+    (void)prev;
+    if (!perf_counters) {
+        return;
+    }
+
+    struct perf_cpu *pc = &perf_cpus[smp_cpu_id()];
+    perf_unload(pc);
+    if (next) {
+        perf_load(pc, next->perf);
+    }
+}
+
+/**
+ * Fold the running task's counts before a 32-bit counter can wrap, and
+ * catch up with groups enabled or disabled from another CPU
+ */
+void perf_tick(struct task *current)
+{
+    if (!perf_counters) {
+        return;
+    }
+
+    struct perf_cpu *pc = &perf_cpus[smp_cpu_id()];
+    struct perf_group *group = current ? current->perf : NULL;
+
+    if (pc->group && (pc->group != group || !group->enabled)) {
+        perf_unload(pc);
+    } else if (pc->group) {
+        perf_fold(pc);
+    } else if (group && group->enabled) {
+        perf_load(pc, group);
+    }
+}
+
+void perf_task_fork(struct task *parent, struct task *child)
+{
+    struct perf_group *group = parent ? parent->perf : NULL;
+
+    if (group && (group->flags & PERF_GROUP_INHERIT)) {
+        __atomic_add_fetch(&group->refs, 1, __ATOMIC_RELAXED);
+        child->perf = group;
+    }
+}
+
+void perf_task_free(struct task *task)
+{
+    perf_group_put(task->perf);
+    task->perf = NULL;
+}
@@ -0,0 +1,43 @@
+/**
+ * Lazy FP/SIMD Switching
+ *
+ * FP/SIMD access is turned off whenever a task is switched in, so the
+ * switch itself never touches the vector registers. The first FP/SIMD
+ * instruction the task then executes traps into fpu_trap(), which turns
+ * access back on and loads the task's saved state (or a clean one on its
+ * first use). At the next switch-out the state is saved only if access is
+ * still on, i.e. only if the task used FP/SIMD during that slice. Tasks
+ * that never touch FP/SIMD cost nothing beyond the access toggle.
+ */
+
+#include "process.h"
+
+/**
+ * Save prev's FP/SIMD state if it used it this slice and turn access off
+ * for whatever runs next. Called by the scheduler with the rq locked,
+ * after rq->current_task has moved on, so a trap taken before the switch
+ * completes loads the incoming task's state.
+ */
+void fpu_switch_out(struct task *prev) {
+    if (!arch_fp_enabled()) return;
+
+    if (prev) {
+        arch_fp_save(&prev->fp);
+        prev->fp_used = 1;
+    }
+    arch_fp_disable();
+}
+
+// First FP/SIMD use since the last switch; the instruction is retried
+void fpu_trap(void) {
+    struct task *current = scheduler_get_current_task();
+
+    arch_fp_enable();
+    if (!current) return;  // Idle has no state worth keeping
+
+    if (current->fp_used) {
+        arch_fp_restore(&current->fp);
+    } else {
+        arch_fp_reset();  // Don't leak the previous owner's registers
+    }
+}
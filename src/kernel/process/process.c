@@ -9,17 +9,26 @@
 #include "memory.h"
 #include "timer.h"
 #include "kernel.h"
+#include "fd.h"
+#include "smp.h"
+#include "klog.h"
+#include "format.h"
+#include "sysinfo.h"
+#include "perf.h"
+#include "vdso.h"
 
-// External scheduler reference (defined in scheduler.c)
-extern struct scheduler g_scheduler;
+// PIDs; 0 is reserved for the kernel
+static uint32_t g_next_pid __attribute__((section(".data"))) = 1;
+static spinlock_t g_pid_lock = SPINLOCK_INIT;
 
-// Task pool for static allocation - moved to .data for x86_64 compatibility
-static struct task g_task_pool[MAX_TASKS] __attribute__((section(".data"))) = {0};
-static int g_task_pool_bitmap = 0;
+// Tasks waiting in process_wait() for another to exit
+static struct wait_queue g_exit_waiters = WAIT_QUEUE_INIT;
 
-// Stack memory pool (simple implementation) - moved to .data for x86_64 compatibility
-static char g_stack_pool[MAX_TASKS * TASK_STACK_SIZE] __attribute__((aligned(16))) __attribute__((section(".data"))) = {0};
-static int g_stack_pool_bitmap = 0;
+// Live tasks hashed by PID; tasks are created and reaped on any CPU
+#define TASK_PID_BUCKETS        64
+static struct task *g_pid_hash[TASK_PID_BUCKETS] __attribute__((section(".data")));
+static uint32_t g_task_count __attribute__((section(".data"))) = 0;
+static spinlock_t g_task_lock = SPINLOCK_INIT;
 
 // Process management initialization
 int process_init(void) {
@@ -27,184 +36,491 @@ int process_init(void) {
     
     // TEMPORARY: Skip memset as it causes crashes on x86_64
     // Arrays are already zero-initialized in .data section
-    // Initialize scheduler
-    // memset(&g_scheduler, 0, sizeof(g_scheduler));
-    early_print("Setting scheduler params...\n");
-    g_scheduler.time_slice_quantum = 10;  // 10 timer ticks per slice
-    g_scheduler.next_pid = 1;  // PID 0 reserved for kernel
-    
-    // Initialize task pool
-    // memset(g_task_pool, 0, sizeof(g_task_pool));
-    early_print("Initializing task pool...\n");
-    g_task_pool_bitmap = 0;
-    
-    // Initialize stack pool
-    early_print("Initializing stack pool...\n");
-    g_stack_pool_bitmap = 0;
+    g_next_pid = 1;  // PID 0 reserved for kernel
     
     early_print("Process management initialized\n");
     return 0;
 }
 
-// Allocate task from pool
+static inline uint32_t pid_bucket(uint32_t pid) {
+    return pid % TASK_PID_BUCKETS;
+}
+
+// Allocate a zeroed task holding one reference, within the MAX_TASKS limit
 static struct task *allocate_task(void) {
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (!(g_task_pool_bitmap & (1 << i))) {
-            g_task_pool_bitmap |= (1 << i);
-            return &g_task_pool[i];
-        }
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    if (g_task_count >= MAX_TASKS) {
+        spin_unlock_irqrestore(&g_task_lock, flags);
+        return NULL;
+    }
+    g_task_count++;
+    spin_unlock_irqrestore(&g_task_lock, flags);
+
+    struct task *task = kmalloc(sizeof(struct task));
+    if (!task) {
+        flags = spin_lock_irqsave(&g_task_lock);
+        g_task_count--;
+        spin_unlock_irqrestore(&g_task_lock, flags);
+        return NULL;
+    }
+    memset(task, 0, sizeof(struct task));
+    task->refs = 1;
+    return task;
+}
+
+// Make a task findable by its PID
+static void task_publish(struct task *task) {
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    uint32_t bucket = pid_bucket(task->pid);
+    task->pid_next = g_pid_hash[bucket];
+    g_pid_hash[bucket] = task;
+    task->pid_hashed = 1;
+    spin_unlock_irqrestore(&g_task_lock, flags);
+}
+
+// g_task_lock held
+static struct task *task_lookup(uint32_t pid) {
+    struct task *task = g_pid_hash[pid_bucket(pid)];
+    while (task && task->pid != pid) {
+        task = task->pid_next;
     }
-    return NULL;  // No free tasks
+    return task;
 }
 
-// Free task to pool
-static void free_task(struct task *task) {
+// Take a reference on a live task; NULL if there is none with this PID
+struct task *task_get_by_pid(uint32_t pid) {
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    struct task *task = task_lookup(pid);
+    if (task) {
+        task->refs++;
+    }
+    spin_unlock_irqrestore(&g_task_lock, flags);
+    return task;
+}
+
+/**
+ * Drop a reference. The scheduler holds one until the task is reaped;
+ * the last one unhashes the task and frees it.
+ */
+void task_put(struct task *task) {
     if (!task) return;
-    
-    int index = task - g_task_pool;
-    if (index >= 0 && index < MAX_TASKS) {
-        g_task_pool_bitmap &= ~(1 << index);
-        memset(task, 0, sizeof(struct task));
+
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    if (--task->refs) {
+        spin_unlock_irqrestore(&g_task_lock, flags);
+        return;
     }
+    if (task->pid_hashed) {
+        struct task **link = &g_pid_hash[pid_bucket(task->pid)];
+        while (*link != task) {
+            link = &(*link)->pid_next;
+        }
+        *link = task->pid_next;
+    }
+    g_task_count--;
+    spin_unlock_irqrestore(&g_task_lock, flags);
+
+    perf_task_free(task);
+    kfree(task);
 }
 
-// Allocate task stack
+/**
+ * Allocate a task stack of at least size bytes, in whole pages. The
+ * lowest word holds TASK_STACK_MAGIC so an overflow is caught at the
+ * task's next switch-out (there is no unmapped guard page to fault on).
+ */
 void *allocate_task_stack(size_t size) {
-    if (size != TASK_STACK_SIZE) {
-        return NULL;  // Only support fixed size for now
+    if (size < TASK_STACK_MIN_SIZE) {
+        size = TASK_STACK_MIN_SIZE;
     }
-    
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (!(g_stack_pool_bitmap & (1 << i))) {
-            g_stack_pool_bitmap |= (1 << i);
-            return &g_stack_pool[i * TASK_STACK_SIZE];
-        }
+    size_t pages = (size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+    void *stack = memory_alloc_pages(pages);
+    if (stack) {
+        *(uint64_t *)stack = TASK_STACK_MAGIC;
     }
-    return NULL;  // No free stacks
+    return stack;  // NULL if out of memory
 }
 
-// Free task stack
+// Free a stack from allocate_task_stack() of the same size
 void free_task_stack(void *stack_base, size_t size) {
-    if (!stack_base || size != TASK_STACK_SIZE) return;
-    
-    char *stack_ptr = (char *)stack_base;
-    if (stack_ptr < g_stack_pool || stack_ptr >= g_stack_pool + sizeof(g_stack_pool)) {
-        return;  // Not from our pool
+    if (!stack_base) return;
+
+    if (size < TASK_STACK_MIN_SIZE) {
+        size = TASK_STACK_MIN_SIZE;
     }
-    
-    int index = (stack_ptr - g_stack_pool) / TASK_STACK_SIZE;
-    if (index >= 0 && index < MAX_TASKS) {
-        g_stack_pool_bitmap &= ~(1 << index);
+    memory_free_pages(stack_base, (size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K);
+}
+
+// The creator's address space, with a reference for the new task
+static struct address_space *inherit_aspace(void) {
+    struct task *current = scheduler_get_current_task();
+    struct address_space *as = current ? current->aspace : NULL;
+    aspace_get(as);
+    return as;
+}
+
+// Room left below a forked child's copied frames for the resume context
+// and process_fork_resume()'s own frame; covers the x86-64 red zone
+#define FORK_RESUME_GAP         256
+
+/**
+ * Entry point of a forked child: scheduler_task_entry() has released the
+ * run queue lock, so jump into the copied frames of process_fork()
+ */
+static void process_fork_resume(void *arg) {
+    context_switch(NULL, (struct cpu_context *)arg);
+}
+
+/**
+ * Give a forked child a copy of the caller's stack and a context that
+ * resumes from snapshot in it. Stack addresses held in the snapshot's
+ * registers or in the copied words are moved to the child's stack.
+ */
+static void task_fork_stack(struct task *child, const struct task *parent,
+                            const struct cpu_context *snapshot) {
+    uint64_t parent_lo = (uint64_t)parent->stack_base;
+    uint64_t parent_hi = parent_lo + parent->stack_size;
+    uint64_t delta = (uint64_t)child->stack_base - parent_lo;
+
+    struct cpu_context resume = *snapshot;
+    uint64_t *regs = (uint64_t *)&resume;
+    uint64_t sp = 0;
+    for (size_t i = 0; i < sizeof(resume) / sizeof(uint64_t); i++) {
+        if (regs[i] >= parent_lo && regs[i] < parent_hi) {
+            regs[i] += delta;
+        }
+    }
+#ifdef __aarch64__
+    sp = resume.sp_el1;
+#elif defined(__x86_64__)
+    sp = resume.rsp;
+#endif
+
+    // Copy the live part of the stack, the snapshot's frame and callers
+    uint64_t *src = (uint64_t *)(sp - delta);
+    uint64_t *dst = (uint64_t *)sp;
+    size_t words = (parent_hi - (sp - delta)) / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word = src[i];
+        dst[i] = (word >= parent_lo && word < parent_hi) ? word + delta : word;
     }
+
+    // The resume context goes just below, and the entry code's stack under it
+    uint64_t slot = (sp - FORK_RESUME_GAP - sizeof(resume)) & ~(uint64_t)15;
+    memcpy((void *)slot, &resume, sizeof(resume));
+    child->entry = process_fork_resume;
+    child->entry_arg = (void *)slot;
+    arch_setup_task_context(&child->context, scheduler_task_entry, child, (void *)slot);
 }
 
-// Create a new process
-int process_create(task_entry_t entry, void *arg, const char *name, uint32_t priority) {
-    if (!entry || !name) return -1;
+/**
+ * Create a task in the given scheduling class with a stack of stack_size
+ * bytes, running in aspace (whose reference passes to the task, or is
+ * dropped on failure). With a snapshot the task is a fork of the caller
+ * and resumes from it instead of calling entry. attr, if not NULL, moves
+ * it to another class before it can first run.
+ */
+static int task_create(task_entry_t entry, void *arg, const char *name,
+                       uint32_t priority, uint32_t sched_class, int nice,
+                       struct address_space *aspace, size_t stack_size,
+                       const struct cpu_context *snapshot,
+                       const struct sched_attr *attr) {
+    if (!entry || !name) {
+        aspace_put(aspace);
+        return -1;
+    }
     
     // Allocate task structure
     struct task *task = allocate_task();
     if (!task) {
+        aspace_put(aspace);
         early_print("ERROR: No free task slots available\n");
         return -1;
     }
     
     // Allocate stack
-    void *stack_base = allocate_task_stack(TASK_STACK_SIZE);
+    if (stack_size < TASK_STACK_MIN_SIZE) {
+        stack_size = TASK_STACK_MIN_SIZE;
+    }
+    void *stack_base = allocate_task_stack(stack_size);
     if (!stack_base) {
-        free_task(task);
-        early_print("ERROR: No free stack slots available\n");
+        task_put(task);
+        aspace_put(aspace);
+        early_print("ERROR: No memory for task stack\n");
         return -1;
     }
     
     // Initialize task structure
-    task->pid = g_scheduler.next_pid++;
+    unsigned long flags = spin_lock_irqsave(&g_pid_lock);
+    task->pid = g_next_pid++;
+    spin_unlock_irqrestore(&g_pid_lock, flags);
     task->state = TASK_STATE_READY;
     task->priority = priority;
+    task->sched_class = sched_class;
+    task->nice = nice;
+    task->weight = fair_nice_to_weight(nice);
+    task->vruntime = 0;  // Placed by the scheduler
     strncpy(task->name, name, sizeof(task->name) - 1);
     task->name[sizeof(task->name) - 1] = '\0';
     
     task->stack_base = stack_base;
-    task->stack_size = TASK_STACK_SIZE;
-    task->time_slice = g_scheduler.time_slice_quantum;
+    task->stack_size = stack_size;
+    task->time_slice = scheduler_this_cpu()->time_slice_quantum;
     task->total_runtime = 0;
+    memset(task->cpu_time, 0, sizeof(task->cpu_time));
     task->last_scheduled = 0;
+    task->sleep_timer = 0;
+
+    // Admitted before anything else is set up; while BLOCKED,
+    // scheduler_setattr() gives it the class without queueing it
+    if (attr) {
+        task->state = TASK_STATE_BLOCKED;
+        if (scheduler_setattr(task, attr) < 0) {
+            free_task_stack(stack_base, stack_size);
+            task_put(task);
+            aspace_put(aspace);
+            return -1;
+        }
+        task->state = TASK_STATE_READY;
+    }
+    task->aspace = aspace;
+
+    // Inherit the creator's open files; NULL until fd_init() has run
+    task->files = fd_table_clone(fd_get_current_table());
+    perf_task_fork(scheduler_get_current_task(), task);
+    
+    // Setup initial context (architecture-specific); the task starts in
+    // scheduler_task_entry() so it can release the run queue lock first
+    task->entry = entry;
+    task->entry_arg = arg;
+    if (snapshot) {
+        task_fork_stack(task, scheduler_get_current_task(), snapshot);
+    } else {
+        void *stack_top = (char *)stack_base + stack_size;
+        arch_setup_task_context(&task->context, scheduler_task_entry, task, stack_top);
+    }
     
-    // Setup initial context (architecture-specific)
-    void *stack_top = (char *)stack_base + TASK_STACK_SIZE;
-    arch_setup_task_context(&task->context, entry, arg, stack_top);
-    
-    // Add to scheduler
+    // Add to scheduler, which keeps the allocation reference until reaped
+    task_publish(task);
     scheduler_add_task(task);
     
-    early_print("Created process: ");
-    early_print(name);
-    early_print(" (PID ");
-    char pid_str[16];
-    early_print(itoa(task->pid, pid_str, 10));
-    early_print(")\n");
+    klogf(LOG_DEBUG, "Created process: %s (PID %d)\n", name, (int)task->pid);
     
     return task->pid;
 }
 
+// Create a new process (fixed-priority class, for kernel threads)
+int process_create(task_entry_t entry, void *arg, const char *name, uint32_t priority) {
+    return task_create(entry, arg, name, priority, SCHED_CLASS_FIXED, 0,
+                       inherit_aspace(), TASK_STACK_SIZE, NULL, NULL);
+}
+
+// process_create() with a stack of stack_size bytes instead of TASK_STACK_SIZE
+int process_create_stack(task_entry_t entry, void *arg, const char *name,
+                         uint32_t priority, size_t stack_size) {
+    return task_create(entry, arg, name, priority, SCHED_CLASS_FIXED, 0,
+                       inherit_aspace(), stack_size, NULL, NULL);
+}
+
+// Create a process in the fair class with the given nice level
+int process_create_fair(task_entry_t entry, void *arg, const char *name, int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    return task_create(entry, arg, name, PRIORITY_NORMAL, SCHED_CLASS_FAIR, nice,
+                       inherit_aspace(), TASK_STACK_SIZE, NULL, NULL);
+}
+
+/**
+ * Create a fair-class process in an address space of its own: aspace,
+ * whose reference passes to the task, or a new one if NULL. Falls back to
+ * the creator's if no page tables can be allocated.
+ */
+int process_create_user(task_entry_t entry, void *arg, const char *name, int nice,
+                        struct address_space *aspace) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+
+    if (!aspace) {
+        aspace = aspace_create();
+    }
+    if (!aspace) {
+        aspace = inherit_aspace();
+    }
+    return task_create(entry, arg, name, PRIORITY_NORMAL, SCHED_CLASS_FAIR, nice,
+                       aspace, TASK_STACK_SIZE, NULL, NULL);
+}
+
+/**
+ * Create a process in the class attr describes; a deadline task must pass
+ * admission control. RT and deadline tasks start on SCHED_RT_CPU.
+ */
+int process_create_attr(task_entry_t entry, void *arg, const char *name,
+                        const struct sched_attr *attr) {
+    if (!attr) {
+        return -1;
+    }
+    return task_create(entry, arg, name, PRIORITY_NORMAL, SCHED_CLASS_FAIR, 0,
+                       inherit_aspace(), TASK_STACK_SIZE, NULL, attr);
+}
+
+/**
+ * Fork the calling task. The child gets a copy-on-write copy of the
+ * address space (vm_fork()), a clone of the descriptor table and a copy
+ * of the kernel stack, and returns 0 from this same call.
+ * @return The child's PID in the parent, 0 in the child, -1 on failure
+ */
+int process_fork(void) {
+    struct task *parent = scheduler_get_current_task();
+    if (!parent || !parent->stack_base) {
+        return -1;  // The boot thread's stack is not ours to copy
+    }
+
+    struct cpu_context snapshot;
+    if (arch_context_save(&snapshot)) {
+        return 0;  // Child, resumed by process_fork_resume()
+    }
+
+    struct address_space *aspace = NULL;
+    if (parent->aspace) {
+        aspace = vm_fork(parent->aspace);
+        if (!aspace) {
+            return -1;
+        }
+    }
+
+    // The child of an RT or deadline task starts in the fair class, so
+    // forking can't multiply a real-time reservation
+    uint32_t sched_class = parent->sched_class;
+    if (sched_class >= SCHED_CLASS_RT) {
+        sched_class = SCHED_CLASS_FAIR;
+    }
+    return task_create(parent->entry, parent->entry_arg, parent->name,
+                       parent->priority, sched_class, parent->nice,
+                       aspace, parent->stack_size, &snapshot, NULL);
+}
+
 // Yield CPU to other processes
 void process_yield(void) {
-    if (g_scheduler.current_task) {
-        g_scheduler.current_task->state = TASK_STATE_READY;
-        scheduler_tick();  // Force reschedule
+    struct task *current = scheduler_get_current_task();
+    if (current) {
+        current->state = TASK_STATE_READY;
+        scheduler_schedule();
     }
 }
 
-// Sleep for specified number of ticks
+// Sleep for specified number of ticks, off the run queue until a timer
+// wakes us
 void process_sleep(uint64_t ticks) {
-    if (g_scheduler.current_task && ticks > 0) {
-        g_scheduler.current_task->state = TASK_STATE_BLOCKED;
-        // In a full implementation, we'd add to a sleep queue with wake time
-        // For now, just yield
-        scheduler_tick();
-    }
+    struct task *current = scheduler_get_current_task();
+    if (!current || ticks == 0) return;
+
+    uint64_t deadline = wait_deadline(ticks * (1000000 / TIMER_SCHEDULER_HZ));
+    do {
+        current->state = TASK_STATE_BLOCKED;
+    } while (wait_schedule_until(deadline) == 0);
+    current->state = TASK_STATE_RUNNING;
 }
 
 // Exit current process
 void process_exit(int exit_code) {
-    if (g_scheduler.current_task) {
-        g_scheduler.current_task->state = TASK_STATE_TERMINATED;
-        g_scheduler.current_task->exit_code = exit_code;
+    struct task *current = scheduler_get_current_task();
+    if (current) {
+        current->exit_code = exit_code;
+        scheduler_terminate_task(current);
         
-        early_print("Process ");
-        early_print(g_scheduler.current_task->name);
-        early_print(" exiting with code ");
-        char code_str[16];
-        early_print(itoa(exit_code, code_str, 10));
-        early_print("\n");
+        klogf(LOG_DEBUG, "Process %s exiting with code %d\n", current->name, exit_code);
         
-        scheduler_tick();  // Force reschedule
+        wake_up(&g_exit_waiters);
+        scheduler_schedule();
+    }
+}
+
+/**
+ * Turn the calling thread into a task of its own (pid 0) so it is
+ * scheduled and preempted like any other. Used for the boot thread, which
+ * goes on to run the shell; it keeps using the kernel's descriptor table.
+ */
+int process_adopt_current(const char *name) {
+    if (!name) return -1;
+
+    struct task *task = allocate_task();
+    if (!task) {
+        early_print("ERROR: No free task slots available\n");
+        return -1;
+    }
+
+    task->pid = 0;
+    task->priority = PRIORITY_NORMAL;
+    task->sched_class = SCHED_CLASS_FAIR;
+    task->nice = 0;
+    task->weight = fair_nice_to_weight(0);
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->name[sizeof(task->name) - 1] = '\0';
+    task->stack_base = NULL;  // Not from allocate_task_stack()
+    task->files = NULL;
+    task->sleep_timer = 0;
+
+    task_publish(task);
+    if (scheduler_adopt_current(task) < 0) {
+        task_put(task);
+        return -1;
     }
+    return 0;
 }
 
 // Kill process by PID
 int process_kill(uint32_t pid) {
-    struct task *task = task_find_by_pid(pid);
+    if (pid == 0) return -1;  // The kernel thread cannot be killed
+
+    struct task *task = task_get_by_pid(pid);
     if (!task) return -1;
     
-    task->state = TASK_STATE_TERMINATED;
     task->exit_code = -1;  // Killed
+    scheduler_terminate_task(task);
+    wake_up(&g_exit_waiters);
     
-    if (task == g_scheduler.current_task) {
-        scheduler_tick();  // Force reschedule if killing current task
+    if (task == scheduler_get_current_task()) {
+        task_put(task);  // The scheduler's reference keeps it until reaped
+        scheduler_schedule();  // Killed ourselves: never returns here
     }
     
+    task_put(task);
     return 0;
 }
 
-// Find task by PID
-struct task *task_find_by_pid(uint32_t pid) {
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if ((g_task_pool_bitmap & (1 << i)) && g_task_pool[i].pid == pid) {
-            return &g_task_pool[i];
-        }
+/**
+ * Wait for the task with this PID to exit and return its PID, with its
+ * exit code in status. The reference held while waiting keeps the task
+ * (and its exit code) around even if it is reaped first.
+ */
+int process_wait(int pid, int *status) {
+    if (pid <= 0) return -1;
+
+    struct task *task = task_get_by_pid((uint32_t)pid);
+    if (!task) return -1;
+    if (task == scheduler_get_current_task()) {
+        task_put(task);
+        return -1;
     }
-    return NULL;
+
+    wait_event(&g_exit_waiters, task->state == TASK_STATE_TERMINATED);
+
+    if (status) {
+        *status = task->exit_code;
+    }
+    task_put(task);
+    return pid;
+}
+
+/**
+ * Find task by PID without taking a reference: only safe for a task that
+ * cannot be reaped meanwhile, such as the caller itself
+ */
+struct task *task_find_by_pid(uint32_t pid) {
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    struct task *task = task_lookup(pid);
+    spin_unlock_irqrestore(&g_task_lock, flags);
+    return task;
 }
 
 // Dump task information
@@ -230,12 +546,15 @@ void idle_task(void *arg) {
     early_print("Idle task started\n");
     
     while (1) {
-        // In a real implementation, this would halt CPU until interrupt
-        // For now, just yield frequently
         process_yield();
         
-        // Simple delay to avoid overwhelming the system
-        for (volatile int i = 0; i < 1000000; i++);
+        // Halt until the next tick rather than spinning; only the boot
+        // CPU takes timer interrupts
+        unsigned long flags = disable_interrupts();
+        if (smp_cpu_id() == 0 && !scheduler_this_cpu()->nr_running) {
+            arch_cpu_idle();
+        }
+        restore_interrupts(flags);
     }
 }
 
@@ -270,10 +589,11 @@ int process_get_stats(struct process_stats *stats) {
     stats->ready_tasks = 0;
     stats->blocked_tasks = 0;
     
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (g_task_pool_bitmap & (1 << i)) {
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    for (uint32_t i = 0; i < TASK_PID_BUCKETS; i++) {
+        for (struct task *task = g_pid_hash[i]; task; task = task->pid_next) {
             stats->total_tasks++;
-            switch (g_task_pool[i].state) {
+            switch (task->state) {
                 case TASK_STATE_READY:
                 case TASK_STATE_RUNNING:
                     stats->ready_tasks++;
@@ -284,16 +604,68 @@ int process_get_stats(struct process_stats *stats) {
             }
         }
     }
+    spin_unlock_irqrestore(&g_task_lock, flags);
     
-    stats->context_switches = g_scheduler.context_switches;
-    stats->scheduler_ticks = g_scheduler.total_ticks;
-    stats->current_pid = g_scheduler.current_task ? g_scheduler.current_task->pid : 0;
+    scheduler_get_totals(&stats->context_switches, &stats->scheduler_ticks);
+    scheduler_get_latency(&stats->preempt_latency, &stats->wakeup_latency,
+                          &stats->rt_latency);
+    struct task *current = scheduler_get_current_task();
+    stats->current_pid = current ? current->pid : 0;
     
     return 0;
 }
 
+// Counter ticks to nanoseconds, without overflowing for long runtimes
+static uint64_t process_ticks_to_ns(uint64_t ticks, uint64_t freq) {
+    if (!freq) {
+        return 0;
+    }
+    return ticks / freq * 1000000000ULL + ticks % freq * 1000000000ULL / freq;
+}
+
+uint32_t process_snapshot(struct sysinfo_task *tasks, uint32_t max) {
+    uint32_t total = 0;
+    uint64_t freq = arch_vdso_counter_frequency();
+
+    unsigned long flags = spin_lock_irqsave(&g_task_lock);
+    for (uint32_t i = 0; i < TASK_PID_BUCKETS; i++) {
+        for (struct task *task = g_pid_hash[i]; task; task = task->pid_next) {
+            if (tasks && total < max) {
+                struct sysinfo_task *out = &tasks[total];
+                out->pid = task->pid;
+                out->state = task->state;
+                out->priority = task->sched_class == SCHED_CLASS_RT ?
+                                task->rt_priority : task->priority;
+                out->sched_class = task->sched_class;
+                out->nice = task->nice;
+                out->cpu = task->cpu;
+                out->runtime_ticks = task->total_runtime;
+                out->switches = task->switches;
+                out->user_ns = process_ticks_to_ns(task->cpu_time[CPU_TIME_USER], freq);
+                out->system_ns = process_ticks_to_ns(task->cpu_time[CPU_TIME_SYSTEM], freq);
+                out->irq_ns = process_ticks_to_ns(task->cpu_time[CPU_TIME_IRQ], freq);
+                out->memory = task->stack_size;
+                if (task->aspace) {
+                    out->memory += (uint64_t)task->aspace->resident_pages * PAGE_SIZE_4K;
+                }
+                memcpy(out->name, task->name, SYSINFO_NAME_MAX);
+                out->name[SYSINFO_NAME_MAX - 1] = '\0';
+            }
+            total++;
+        }
+    }
+    spin_unlock_irqrestore(&g_task_lock, flags);
+
+    return total;
+}
+
 // Simple string to integer conversion for early printing
 char *itoa(int value, char *str, int base) {
+    if (base == 10) {
+        format_i64(str, value);
+        return str;
+    }
+    
     char *ptr = str, *ptr1 = str, tmp_char;
     int tmp_value;
     
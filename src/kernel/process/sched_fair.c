@@ -0,0 +1,181 @@
+/**
+ * Fair Scheduling Class
+ *
+ * Weighted virtual-runtime scheduling for SCHED_CLASS_FAIR tasks
+ *
+ * A fair task's vruntime advances with every tick it runs, scaled by
+ * FAIR_NICE_0_WEIGHT / weight, so a task with twice the weight gets twice
+ * the CPU. Each CPU keeps its runnable fair tasks in a binary min-heap on
+ * vruntime and always runs the one that has had the least. Slices divide
+ * FAIR_LATENCY_TICKS by weight share. A task waking from sleep is placed
+ * up to FAIR_WAKEUP_CREDIT behind min_vruntime, which lets interactive
+ * tasks run soon after they wake without letting them bank unbounded
+ * credit while asleep.
+ */
+
+#include "process.h"
+
+// Load weight per nice level, each step about 1.25x (nice 0 = 1024)
+static const uint32_t fair_prio_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */  9548,  7620,  6100,  4904,  3906,
+    /*  -5 */  3121,  2501,  1991,  1586,  1277,
+    /*   0 */  1024,   820,   655,   526,   423,
+    /*   5 */   335,   272,   215,   172,   137,
+    /*  10 */   110,    87,    70,    56,    45,
+    /*  15 */    36,    29,    23,    18,    15,
+};
+
+uint32_t fair_nice_to_weight(int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    return fair_prio_to_weight[nice - NICE_MIN];
+}
+
+// vruntime units are 1/FAIR_NICE_0_WEIGHT of a nice-0 tick
+static inline uint64_t fair_scale(struct task *task, uint64_t ticks) {
+    return (ticks * FAIR_NICE_0_WEIGHT * FAIR_NICE_0_WEIGHT) / task->weight;
+}
+
+static inline int fair_before(struct task *a, struct task *b) {
+    return (int64_t)(a->vruntime - b->vruntime) < 0;
+}
+
+static inline void heap_set(struct scheduler *rq, uint32_t index, struct task *task) {
+    rq->fair_heap[index] = task;
+    task->heap_index = index;
+}
+
+static void heap_sift_up(struct scheduler *rq, uint32_t index) {
+    struct task *task = rq->fair_heap[index];
+
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (!fair_before(task, rq->fair_heap[parent])) break;
+        heap_set(rq, index, rq->fair_heap[parent]);
+        index = parent;
+    }
+    heap_set(rq, index, task);
+}
+
+static void heap_sift_down(struct scheduler *rq, uint32_t index) {
+    struct task *task = rq->fair_heap[index];
+
+    for (;;) {
+        uint32_t child = index * 2 + 1;
+        if (child >= rq->fair_count) break;
+        if (child + 1 < rq->fair_count &&
+            fair_before(rq->fair_heap[child + 1], rq->fair_heap[child])) {
+            child++;
+        }
+        if (!fair_before(rq->fair_heap[child], task)) break;
+        heap_set(rq, index, rq->fair_heap[child]);
+        index = child;
+    }
+    heap_set(rq, index, task);
+}
+
+void fair_enqueue(struct scheduler *rq, struct task *task) {
+    if (rq->fair_count >= MAX_TASKS) return;
+
+    rq->fair_heap[rq->fair_count] = task;
+    task->heap_index = rq->fair_count;
+    rq->fair_count++;
+    rq->fair_weight += task->weight;
+    heap_sift_up(rq, task->heap_index);
+}
+
+void fair_dequeue(struct scheduler *rq, struct task *task) {
+    uint32_t index = task->heap_index;
+    if (index >= rq->fair_count || rq->fair_heap[index] != task) return;
+
+    rq->fair_count--;
+    rq->fair_weight -= task->weight;
+
+    if (index != rq->fair_count) {
+        // Fill the hole with the last entry and restore the heap order
+        struct task *moved = rq->fair_heap[rq->fair_count];
+        heap_set(rq, index, moved);
+        heap_sift_up(rq, index);
+        if (moved->heap_index == index) {
+            heap_sift_down(rq, index);
+        }
+    }
+    rq->fair_heap[rq->fair_count] = NULL;
+}
+
+// Least-served runnable fair task, left on the heap
+struct task *fair_peek(struct scheduler *rq) {
+    return rq->fair_count ? rq->fair_heap[0] : NULL;
+}
+
+// Advance min_vruntime towards the least-served task; it never goes back
+void fair_update_min_vruntime(struct scheduler *rq) {
+    struct task *current = rq->current_task;
+    struct task *first = fair_peek(rq);
+    uint64_t floor;
+
+    if (current && current->sched_class == SCHED_CLASS_FAIR) {
+        floor = current->vruntime;
+        if (first && fair_before(first, current)) {
+            floor = first->vruntime;
+        }
+    } else if (first) {
+        floor = first->vruntime;
+    } else {
+        return;
+    }
+
+    if ((int64_t)(floor - rq->min_vruntime) > 0) {
+        rq->min_vruntime = floor;
+    }
+}
+
+/**
+ * Position a task that is joining rq: new tasks start at min_vruntime,
+ * waking tasks get at most FAIR_WAKEUP_CREDIT of sleeper credit
+ */
+void fair_place(struct scheduler *rq, struct task *task, int wakeup) {
+    if (!wakeup) {
+        task->vruntime = rq->min_vruntime;
+        return;
+    }
+
+    uint64_t credit = FAIR_WAKEUP_CREDIT * FAIR_NICE_0_WEIGHT;
+    uint64_t floor = rq->min_vruntime > credit ? rq->min_vruntime - credit : 0;
+
+    // Keep a task's own vruntime if it is already past the floor
+    if ((int64_t)(task->vruntime - floor) < 0) {
+        task->vruntime = floor;
+    }
+}
+
+void fair_account(struct task *task, uint64_t ticks) {
+    task->vruntime += fair_scale(task, ticks);
+}
+
+// Weighted share of the latency period, with task already off the heap
+uint64_t fair_time_slice(struct scheduler *rq, struct task *task) {
+    uint64_t total = rq->fair_weight + task->weight;
+    uint64_t slice = (FAIR_LATENCY_TICKS * (uint64_t)task->weight) / total;
+
+    return slice < FAIR_MIN_GRANULARITY ? FAIR_MIN_GRANULARITY : slice;
+}
+
+/**
+ * A fair current task gives way early to a fixed-priority task, or to a
+ * fair task that is a full minimum granularity further behind
+ */
+int fair_should_preempt(struct scheduler *rq, struct task *current) {
+    if (rq->ready_bitmap & ~(1U << PRIORITY_IDLE)) {
+        return 1;
+    }
+
+    struct task *first = fair_peek(rq);
+    if (!first) {
+        return 0;
+    }
+    uint64_t gran = FAIR_MIN_GRANULARITY * FAIR_NICE_0_WEIGHT;
+    return (int64_t)(current->vruntime - first->vruntime) > (int64_t)gran;
+}
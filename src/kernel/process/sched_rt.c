@@ -0,0 +1,242 @@
+/**
+ * Real-Time Scheduling Classes
+ *
+ * FIFO and earliest-deadline-first scheduling for SCHED_CLASS_RT and
+ * SCHED_CLASS_DEADLINE tasks
+ *
+ * RT tasks have a static priority and no time slice: each priority has a
+ * circular FIFO list, rt_bitmap has a bit per non-empty one, and a task
+ * runs until it blocks, yields or a better task wakes. A preempted task
+ * goes back to the head of its list, a yielding one to the tail.
+ *
+ * Deadline tasks follow the constant bandwidth server rules. Each has a
+ * budget of dl_runtime per dl_period, to be used by its absolute deadline;
+ * they are kept in one list sorted on that deadline, all ahead of the RT
+ * lists. The running task is charged at every tick and switch, and when
+ * its budget is gone it is throttled, off the run queue, until the period
+ * it overran ends and a fresh budget comes with a later deadline. A task
+ * that wakes with more budget left than it could use at its reserved rate
+ * before its deadline starts over from a new one, so sleeping can't bank
+ * bandwidth. Admission control keeps the sum of runtime/period over all
+ * deadline tasks under SCHED_DL_BANDWIDTH_PERCENT, which leaves every
+ * deadline met while the boot CPU serves them.
+ */
+
+#include "process.h"
+
+// Admitted deadline bandwidth, fixed point (DL_BW_SHIFT) share of a CPU
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;
+static uint64_t dl_bw_used = 0;
+
+#define DL_BW_LIMIT ((SCHED_DL_BANDWIDTH_PERCENT << DL_BW_SHIFT) / 100)
+
+static inline uint32_t rt_level(struct task *task) {
+    return task->rt_priority - SCHED_RT_PRIO_MIN;
+}
+
+static inline int dl_before(struct task *a, struct task *b) {
+    return (int64_t)(a->dl_abs_deadline - b->dl_abs_deadline) < 0;
+}
+
+// Insert in deadline order, after any task with the same deadline
+static void dl_enqueue(struct scheduler *rq, struct task *task) {
+    struct task *prev = NULL;
+    struct task *next = rq->dl_queue;
+
+    while (next && !dl_before(task, next)) {
+        prev = next;
+        next = next->next;
+    }
+    task->prev = prev;
+    task->next = next;
+    if (prev) {
+        prev->next = task;
+    } else {
+        rq->dl_queue = task;
+    }
+    if (next) {
+        next->prev = task;
+    }
+}
+
+static void dl_dequeue(struct scheduler *rq, struct task *task) {
+    if (task->prev) {
+        task->prev->next = task->next;
+    } else {
+        rq->dl_queue = task->next;
+    }
+    if (task->next) {
+        task->next->prev = task->prev;
+    }
+}
+
+void rt_enqueue(struct scheduler *rq, struct task *task, int head) {
+    rq->rt_count++;
+    if (task->sched_class == SCHED_CLASS_DEADLINE) {
+        dl_enqueue(rq, task);
+        return;
+    }
+
+    uint32_t level = rt_level(task);
+    struct task *first = rq->rt_queue[level];
+
+    if (!first) {
+        task->next = task;
+        task->prev = task;
+        rq->rt_queue[level] = task;
+        rq->rt_bitmap |= 1U << level;
+        return;
+    }
+    struct task *tail = first->prev;
+    task->next = first;
+    task->prev = tail;
+    tail->next = task;
+    first->prev = task;
+    if (head) {
+        rq->rt_queue[level] = task;
+    }
+}
+
+void rt_dequeue(struct scheduler *rq, struct task *task) {
+    rq->rt_count--;
+    if (task->sched_class == SCHED_CLASS_DEADLINE) {
+        dl_dequeue(rq, task);
+        return;
+    }
+
+    uint32_t level = rt_level(task);
+    if (task->next == task) {
+        rq->rt_queue[level] = NULL;
+        rq->rt_bitmap &= ~(1U << level);
+        return;
+    }
+    task->prev->next = task->next;
+    task->next->prev = task->prev;
+    if (rq->rt_queue[level] == task) {
+        rq->rt_queue[level] = task->next;
+    }
+}
+
+// Earliest deadline, then the highest RT priority
+struct task *rt_peek(struct scheduler *rq) {
+    if (rq->dl_queue) {
+        return rq->dl_queue;
+    }
+    if (rq->rt_bitmap) {
+        return rq->rt_queue[31 - __builtin_clz(rq->rt_bitmap)];
+    }
+    return NULL;
+}
+
+/**
+ * Should task take the CPU from current, when at least one of them is in
+ * a real-time class? Deadline beats RT beats everything else.
+ */
+int rt_should_preempt(struct task *task, struct task *current) {
+    uint32_t rank = task->sched_class == SCHED_CLASS_DEADLINE ? 0 :
+                    task->sched_class == SCHED_CLASS_RT ? 1 : 2;
+    uint32_t current_rank = current->sched_class == SCHED_CLASS_DEADLINE ? 0 :
+                            current->sched_class == SCHED_CLASS_RT ? 1 : 2;
+
+    if (rank != current_rank) {
+        return rank < current_rank;
+    }
+    if (rank == 0) {
+        return dl_before(task, current);
+    }
+    return task->rt_priority > current->rt_priority;
+}
+
+int rt_check_attr(const struct sched_attr *attr) {
+    if (!attr) {
+        return -1;
+    }
+
+    switch (attr->policy) {
+    case SCHED_POLICY_FAIR:
+        return attr->nice >= NICE_MIN && attr->nice <= NICE_MAX ? 0 : -1;
+    case SCHED_POLICY_FIFO:
+        return attr->rt_priority >= SCHED_RT_PRIO_MIN &&
+               attr->rt_priority <= SCHED_RT_PRIO_MAX ? 0 : -1;
+    case SCHED_POLICY_DEADLINE:
+        if (attr->runtime_us < SCHED_DL_MIN_RUNTIME_US ||
+            attr->runtime_us > attr->deadline_us ||
+            attr->deadline_us > attr->period_us ||
+            attr->period_us > SCHED_DL_MAX_PERIOD_US) {
+            return -1;
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+uint64_t dl_bandwidth(uint64_t runtime_us, uint64_t period_us) {
+    return period_us ? (runtime_us << DL_BW_SHIFT) / period_us : 0;
+}
+
+/**
+ * Swap a reservation of old_bw for one of new_bw. Growing past
+ * DL_BW_LIMIT fails and leaves the old one in place.
+ * @return 0 on success, -1 if the bandwidth is taken
+ */
+int dl_bw_change(uint64_t old_bw, uint64_t new_bw) {
+    unsigned long flags = spin_lock_irqsave(&dl_bw_lock);
+    uint64_t used = dl_bw_used - old_bw + new_bw;
+    if (new_bw > old_bw && used > DL_BW_LIMIT) {
+        spin_unlock_irqrestore(&dl_bw_lock, flags);
+        return -1;
+    }
+    dl_bw_used = used;
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+    return 0;
+}
+
+uint64_t dl_bw_total(void) {
+    return __atomic_load_n(&dl_bw_used, __ATOMIC_RELAXED);
+}
+
+// Start the task on a fresh budget and deadline if what it has left would
+// run past its reserved rate before the current deadline
+void dl_wakeup(struct task *task, uint64_t now_us) {
+    if (task->dl_throttled) {
+        return;
+    }
+
+    uint64_t deadline = task->dl_abs_deadline;
+    if (task->dl_budget <= 0 || deadline <= now_us ||
+        (uint64_t)task->dl_budget * task->dl_period > (deadline - now_us) * task->dl_runtime) {
+        task->dl_abs_deadline = now_us + task->dl_deadline;
+        task->dl_budget = (int64_t)task->dl_runtime;
+    }
+}
+
+/**
+ * Charge the running task for the time since it was last charged
+ * @return 1 when its budget is used up
+ */
+int dl_charge(struct task *task, uint64_t now_us) {
+    if (now_us > task->dl_exec_start) {
+        task->dl_budget -= (int64_t)(now_us - task->dl_exec_start);
+    }
+    task->dl_exec_start = now_us;
+    return task->dl_budget <= 0;
+}
+
+// When a throttled task gets its next budget: the end of the period it overran
+uint64_t dl_replenish_time(struct task *task) {
+    return task->dl_abs_deadline - task->dl_deadline + task->dl_period;
+}
+
+// Move to the next period, carrying any overrun, or start afresh if that
+// one has passed as well
+void dl_replenish(struct task *task, uint64_t now_us) {
+    while (task->dl_budget <= 0) {
+        task->dl_abs_deadline += task->dl_period;
+        task->dl_budget += (int64_t)task->dl_runtime;
+    }
+    if (task->dl_abs_deadline <= now_us) {
+        task->dl_abs_deadline = now_us + task->dl_deadline;
+        task->dl_budget = (int64_t)task->dl_runtime;
+    }
+}
@@ -1,190 +1,1029 @@
 /**
  * Process Scheduler Implementation
- * 
+ *
  * Round-robin scheduler with priority support for MiniOS
+ *
+ * Every CPU has its own struct scheduler. Each priority level has a
+ * circular run queue of READY tasks and ready_bitmap has a bit set for
+ * every non-empty level, so picking the next task is a find-first-set and
+ * a dequeue whatever the task count. The running task is never on a run
+ * queue: it goes back on the tail of its level when it gives up the CPU
+ * while still runnable, stays off while blocked until
+ * scheduler_wake_task(), and moves to the reap list once terminated.
+ * SCHED_CLASS_FAIR tasks are queued in a vruntime heap instead
+ * (sched_fair.c), which is served after the fixed levels above
+ * PRIORITY_IDLE and before PRIORITY_IDLE itself. SCHED_CLASS_RT and
+ * SCHED_CLASS_DEADLINE tasks are served ahead of all of them, from FIFO
+ * lists and a deadline-ordered list (sched_rt.c); they live on
+ * SCHED_RT_CPU, whose tick and timers enforce deadline budgets, and are
+ * never stolen.
+ *
+ * A CPU with nothing runnable pulls a task from the CPU with the most
+ * queued work, otherwise it returns to its idle loop. A run queue's lock
+ * is held across context_switch() and released by whatever runs next on
+ * that CPU, so no other CPU can take the outgoing task before its
+ * registers are saved.
+ *
+ * Preemption is driven from the timer interrupt: scheduler_tick() only
+ * does the accounting and raises need_resched, and the interrupt return
+ * path calls scheduler_irq_exit(), which switches on the interrupted
+ * task's own stack once the controller has been acknowledged. The time
+ * from need_resched to the switch, and from a wakeup to the woken task
+ * running, is kept per CPU for scheduler_dump_info(), with RT and
+ * deadline wakeups also counted apart. A wakeup that should preempt
+ * switches on the way out of the waker's interrupt or system call.
+ *
+ * CPU time is charged to the running task in counter ticks: at a switch
+ * to the outgoing task, and at every kernel entry and exit the arch code
+ * reports, so time between the two is the task's own user time.
  */
 
 #include "process.h"
 #include "timer.h"
 #include "kernel.h"
+#include "fd.h"
+#include "smp.h"
+#include "vdso.h"
+#include "io_ring.h"
+#include "softirq.h"
+#include "klog.h"
+#include "perf.h"
+#include "trace.h"
 
-// Global scheduler - moved to .data for x86_64 compatibility
-struct scheduler g_scheduler __attribute__((section(".data"))) = {0};
+// Per-CPU schedulers - in .data for x86_64 compatibility
+static struct scheduler runqueues[MAX_CPUS] __attribute__((section(".data")));
 
-// Forward declarations
-static void cleanup_terminated_tasks(void);
+static inline struct scheduler *this_rq(void) {
+    return &runqueues[smp_cpu_id()];
+}
+
+static inline struct scheduler *task_rq(struct task *task) {
+    return &runqueues[task->cpu];
+}
 
 // Initialize scheduler
 void scheduler_init(void) {
     early_print("Initializing scheduler...\n");
-    
+
     // TEMPORARY: Skip memset as it causes crashes on x86_64
-    // g_scheduler is already zero-initialized in .data section
-    // memset(&g_scheduler, 0, sizeof(g_scheduler));
-    g_scheduler.time_slice_quantum = 10;  // 10 timer ticks
-    g_scheduler.next_pid = 1;
-    
+    // runqueues are already zero-initialized in .data section
+    scheduler_cpu_init(0);
+
     early_print("Scheduler initialized\n");
 }
 
-// Add task to scheduler
-void scheduler_add_task(struct task *task) {
-    if (!task) return;
-    
-    task->next = NULL;
-    task->prev = NULL;
-    
-    if (!g_scheduler.ready_queue) {
-        // First task
-        g_scheduler.ready_queue = task;
+// Set up a CPU's scheduler; called by each CPU before it schedules
+void scheduler_cpu_init(uint32_t cpu) {
+    if (cpu >= MAX_CPUS) return;
+
+    struct scheduler *rq = &runqueues[cpu];
+    spin_lock_init(&rq->lock);
+    rq->cpu = cpu;
+    rq->current_task = NULL;
+    rq->time_slice_quantum = 10;  // 10 timer ticks
+
+    // Room for every task, so enqueueing can never fail
+    if (!rq->fair_heap) {
+        rq->fair_heap = kmalloc(MAX_TASKS * sizeof(struct task *));
+        if (!rq->fair_heap) {
+            kernel_panic("Scheduler: cannot allocate fair run queue");
+        }
+    }
+
+    strcpy(rq->idle.name, "idle");
+    rq->idle.state = TASK_STATE_RUNNING;
+    rq->idle.priority = PRIORITY_IDLE;
+    rq->idle.cpu = cpu;
+
+    arch_fp_cpu_init();  // Trap the first FP/SIMD use of each task
+}
+
+struct scheduler *scheduler_this_cpu(void) {
+    return this_rq();
+}
+
+static inline uint32_t task_level(struct task *task) {
+    return task->priority > PRIORITY_IDLE ? PRIORITY_IDLE : task->priority;
+}
+
+static void latency_record(struct sched_latency *lat, uint64_t since_us) {
+    uint64_t now = timer_get_time_us();
+    uint64_t delta = now > since_us ? now - since_us : 0;
+
+    lat->count++;
+    lat->total_us += delta;
+    if (delta > lat->max_us) {
+        lat->max_us = delta;
+    }
+}
+
+// Ask rq's CPU to switch at its next interrupt return (rq locked)
+static void scheduler_set_need_resched(struct scheduler *rq) {
+    if (!rq->need_resched) {
+        rq->resched_time_us = timer_get_time_us();
+        rq->need_resched = 1;
+    }
+}
+
+/**
+ * Should a task that just became runnable on rq take the CPU from the
+ * running one? (rq locked)
+ */
+static int scheduler_wakeup_preempt(struct scheduler *rq, struct task *task) {
+    struct task *current = rq->current_task;
+
+    if (!current) {
+        return 1;  // CPU is idle
+    }
+    if (task->sched_class >= SCHED_CLASS_RT || current->sched_class >= SCHED_CLASS_RT) {
+        return rt_should_preempt(task, current);
+    }
+    if (task->sched_class == SCHED_CLASS_FIXED) {
+        if (task_level(task) == PRIORITY_IDLE) {
+            return 0;
+        }
+        return current->sched_class == SCHED_CLASS_FAIR ||
+               task_level(task) < task_level(current);
+    }
+    if (current->sched_class == SCHED_CLASS_FIXED) {
+        return task_level(current) == PRIORITY_IDLE;
+    }
+    uint64_t gran = FAIR_MIN_GRANULARITY * FAIR_NICE_0_WEIGHT;
+    return (int64_t)(current->vruntime - task->vruntime) > (int64_t)gran;
+}
+
+/**
+ * Append task to the tail of its priority's run queue, or for an RT task
+ * at the head if asked (rq locked)
+ */
+static void run_queue_add(struct scheduler *rq, struct task *task, int at_head) {
+    if (task->on_run_queue) return;
+
+    if (task->sched_class == SCHED_CLASS_FAIR) {
+        fair_enqueue(rq, task);
+        task->on_run_queue = 1;
+        rq->nr_running++;
+        return;
+    }
+    if (task->sched_class >= SCHED_CLASS_RT) {
+        if (task->dl_throttled) {
+            return;  // Queued by the replenishment timer
+        }
+        rt_enqueue(rq, task, at_head);
+        task->on_run_queue = 1;
+        rq->nr_running++;
+        return;
+    }
+
+    uint32_t level = task_level(task);
+    struct task *head = rq->run_queue[level];
+
+    if (!head) {
+        rq->run_queue[level] = task;
         task->next = task;
         task->prev = task;
+        rq->ready_bitmap |= 1U << level;
     } else {
         // Insert at end of circular list
-        struct task *tail = g_scheduler.ready_queue->prev;
-        task->next = g_scheduler.ready_queue;
+        struct task *tail = head->prev;
+        task->next = head;
         task->prev = tail;
         tail->next = task;
-        g_scheduler.ready_queue->prev = task;
+        head->prev = task;
     }
-    
-    g_scheduler.num_tasks++;
+
+    task->on_run_queue = 1;
+    rq->nr_running++;
 }
 
-// Remove task from scheduler
-void scheduler_remove_task(struct task *task) {
-    if (!task || !g_scheduler.ready_queue) return;
-    
+static inline void run_queue_enqueue(struct scheduler *rq, struct task *task) {
+    run_queue_add(rq, task, 0);
+}
+
+static void run_queue_dequeue(struct scheduler *rq, struct task *task) {
+    if (!task->on_run_queue) return;
+
+    if (task->sched_class == SCHED_CLASS_FAIR) {
+        fair_dequeue(rq, task);
+        task->on_run_queue = 0;
+        rq->nr_running--;
+        return;
+    }
+    if (task->sched_class >= SCHED_CLASS_RT) {
+        rt_dequeue(rq, task);
+        task->next = NULL;
+        task->prev = NULL;
+        task->on_run_queue = 0;
+        rq->nr_running--;
+        return;
+    }
+
+    uint32_t level = task_level(task);
+
     if (task->next == task) {
         // Only task in queue
-        g_scheduler.ready_queue = NULL;
+        rq->run_queue[level] = NULL;
+        rq->ready_bitmap &= ~(1U << level);
     } else {
         // Remove from circular list
         task->prev->next = task->next;
         task->next->prev = task->prev;
-        
-        if (g_scheduler.ready_queue == task) {
-            g_scheduler.ready_queue = task->next;
+
+        if (rq->run_queue[level] == task) {
+            rq->run_queue[level] = task->next;
         }
     }
-    
+
     task->next = NULL;
     task->prev = NULL;
-    g_scheduler.num_tasks--;
+    task->on_run_queue = 0;
+    rq->nr_running--;
 }
 
-// Pick next task to run (round-robin with priority)
-struct task *scheduler_pick_next_task(void) {
-    cleanup_terminated_tasks();
-    
-    if (!g_scheduler.ready_queue) {
-        return NULL;  // No tasks available
-    }
-    
-    struct task *best_task = NULL;
-    struct task *current = g_scheduler.ready_queue;
-    uint32_t best_priority = PRIORITY_IDLE + 1;  // Lower number = higher priority
-    
-    do {
-        if (current->state == TASK_STATE_READY && current->priority < best_priority) {
-            best_task = current;
-            best_priority = current->priority;
-            
-            // If we find highest priority, stop searching
-            if (best_priority == PRIORITY_HIGH) {
-                break;
+// Queue a task that just became runnable and note when (rq locked)
+static void scheduler_enqueue_runnable(struct scheduler *rq, struct task *task) {
+    run_queue_enqueue(rq, task);
+    task->wake_time_us = timer_get_time_us();
+    if (scheduler_wakeup_preempt(rq, task)) {
+        scheduler_set_need_resched(rq);
+    }
+}
+
+/**
+ * Charge the running deadline task; once its budget is gone it is
+ * throttled until its replenishment timer fires. Returns 1 if the CPU
+ * should be rescheduled (rq locked).
+ */
+static int scheduler_dl_update(struct scheduler *rq, struct task *task) {
+    if (task->dl_throttled) {
+        return 0;
+    }
+
+    uint64_t now = timer_get_time_us();
+    if (!dl_charge(task, now)) {
+        return 0;
+    }
+    rq->dl_throttles++;
+    if (now > task->dl_abs_deadline) {
+        rq->dl_overruns++;
+    }
+
+    // Without a timer, or with the period already over, go straight on
+    // with the next budget; its later deadline may still lose the CPU
+    uint64_t at = dl_replenish_time(task);
+    if (at <= now || timer_modify(task->dl_timer, at - now) < 0) {
+        dl_replenish(task, now);
+        return 1;
+    }
+    task->dl_throttled = 1;
+    return 1;
+}
+
+// A deadline task's timer: its budget ran out while it was running, or a
+// throttled task's next period has begun
+static void scheduler_dl_timer(void *data) {
+    struct task *task = task_get_by_pid((uint32_t)(uintptr_t)data);
+    if (!task) return;
+
+    struct scheduler *rq = task_rq(task);
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    if (task->sched_class == SCHED_CLASS_DEADLINE) {
+        if (task->dl_throttled) {
+            uint64_t now = timer_get_time_us();
+            task->dl_throttled = 0;
+            dl_replenish(task, now);
+            if (task == rq->current_task) {
+                // Not switched away yet: keep enforcing the new budget
+                task->dl_exec_start = now;
+                timer_modify(task->dl_timer, (uint64_t)task->dl_budget);
+            } else if (task->state == TASK_STATE_READY) {
+                scheduler_enqueue_runnable(rq, task);
+            }
+        } else if (task == rq->current_task) {
+            if (scheduler_dl_update(rq, task)) {
+                scheduler_set_need_resched(rq);
+            } else {
+                timer_modify(task->dl_timer, (uint64_t)task->dl_budget);  // Woke early
             }
         }
-        current = current->next;
-    } while (current != g_scheduler.ready_queue);
-    
-    if (best_task) {
-        // Move ready queue pointer to next task for fairness
-        g_scheduler.ready_queue = best_task->next;
     }
-    
-    return best_task;
+    spin_unlock_irqrestore(&rq->lock, flags);
+    task_put(task);
 }
 
-// Switch to specified task
-void scheduler_switch_to_task(struct task *task) {
+// New tasks go to the online CPU with the least queued work
+static uint32_t scheduler_select_cpu(void) {
+    uint32_t best = 0;
+
+    for (uint32_t cpu = 1; cpu < MAX_CPUS; cpu++) {
+        if (smp_cpus[cpu].online && runqueues[cpu].nr_running < runqueues[best].nr_running) {
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+// Add task to scheduler
+void scheduler_add_task(struct task *task) {
+    if (!task) return;
+
+    task->cpu = task->sched_class >= SCHED_CLASS_RT ? SCHED_RT_CPU : scheduler_select_cpu();
+    task->on_run_queue = 0;
+
+    struct scheduler *rq = task_rq(task);
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    if (task->sched_class == SCHED_CLASS_FAIR) {
+        fair_place(rq, task, 0);
+    }
+    if (task->state == TASK_STATE_READY) {
+        scheduler_enqueue_runnable(rq, task);
+    }
+    rq->num_tasks++;
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Remove task from scheduler
+void scheduler_remove_task(struct task *task) {
+    if (!task) return;
+
+    struct scheduler *rq = task_rq(task);
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    run_queue_dequeue(rq, task);
+    rq->num_tasks--;
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/**
+ * Make a blocked task runnable. A task that is still current on its CPU is
+ * only marked READY; it is queued when it next passes through the
+ * scheduler.
+ */
+void scheduler_wake_task(struct task *task) {
     if (!task) return;
-    
-    struct task *old_task = g_scheduler.current_task;
-    
-    if (old_task == task) {
+
+    struct scheduler *rq = task_rq(task);
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    if (task->state == TASK_STATE_BLOCKED) {
+        trace_event(TRACE_SCHED_WAKEUP, task->pid, rq->cpu, 0);
+        task->state = TASK_STATE_READY;
+        if (task != rq->current_task) {
+            if (task->sched_class >= SCHED_CLASS_RT && rq->cpu != SCHED_RT_CPU) {
+                // Hand it to SCHED_RT_CPU. It is READY on no queue until
+                // that CPU's lock is taken, so nothing else queues it
+                rq->num_tasks--;
+                task->cpu = SCHED_RT_CPU;
+                spin_unlock_irqrestore(&rq->lock, flags);
+
+                rq = task_rq(task);
+                flags = spin_lock_irqsave(&rq->lock);
+                rq->num_tasks++;
+                if (task->state != TASK_STATE_READY || task->on_run_queue) {
+                    spin_unlock_irqrestore(&rq->lock, flags);
+                    return;  // Killed or requeued by scheduler_setattr() meanwhile
+                }
+            }
+            if (task->sched_class == SCHED_CLASS_FAIR) {
+                fair_place(rq, task, 1);
+            } else if (task->sched_class == SCHED_CLASS_DEADLINE) {
+                dl_wakeup(task, timer_get_time_us());
+            }
+            scheduler_enqueue_runnable(rq, task);
+        }
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/**
+ * Mark a task terminated and move it to the reap list. The reaper leaves
+ * a task alone while it is still current on its CPU.
+ */
+void scheduler_terminate_task(struct task *task) {
+    if (!task) return;
+
+    struct scheduler *rq = task_rq(task);
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    if (task->state != TASK_STATE_TERMINATED) {
+        task->state = TASK_STATE_TERMINATED;
+        run_queue_dequeue(rq, task);
+        if (task->sched_class == SCHED_CLASS_DEADLINE) {
+            dl_bw_change(dl_bandwidth(task->dl_runtime, task->dl_period), 0);
+        }
+        task->next = rq->reap_list;
+        rq->reap_list = task;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/**
+ * Move task to the class and parameters in attr. It leaves its run queue
+ * and is queued afresh in the new class, so the change takes effect at
+ * once; if it is running, its CPU is rescheduled to rank it again.
+ */
+int scheduler_setattr(struct task *task, const struct sched_attr *attr) {
+    if (!task || rt_check_attr(attr) < 0) {
+        return -1;
+    }
+
+    // Timers are allocated, so before the lock; one that loses a race
+    // with another caller is dropped again
+    uint32_t new_timer = 0;
+    if (attr->policy == SCHED_POLICY_DEADLINE && !task->dl_timer) {
+        new_timer = timer_create(TIMER_TYPE_ONESHOT, attr->runtime_us, scheduler_dl_timer,
+                                 (void *)(uintptr_t)task->pid);
+        if (!new_timer) {
+            return -3;
+        }
+    }
+
+    int ret = -1;
+    struct scheduler *rq = task_rq(task);
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    if (task->state == TASK_STATE_TERMINATED) {
+        goto out;
+    }
+
+    uint64_t old_bw = 0;
+    uint64_t new_bw = 0;
+    if (task->sched_class == SCHED_CLASS_DEADLINE) {
+        old_bw = dl_bandwidth(task->dl_runtime, task->dl_period);
+    }
+    if (attr->policy == SCHED_POLICY_DEADLINE) {
+        new_bw = dl_bandwidth(attr->runtime_us, attr->period_us);
+    }
+    if (dl_bw_change(old_bw, new_bw) < 0) {
+        ret = -2;
+        goto out;
+    }
+
+    // Throttled deadline tasks are runnable but on no queue
+    int requeue = task->state == TASK_STATE_READY && task != rq->current_task;
+    run_queue_dequeue(rq, task);
+    if (task->sched_class == SCHED_CLASS_DEADLINE) {
+        task->dl_throttled = 0;
+        timer_stop(task->dl_timer);
+    }
+    if (new_timer && !task->dl_timer) {
+        task->dl_timer = new_timer;
+        new_timer = 0;
+    }
+
+    uint32_t old_class = task->sched_class;
+    task->sched_class = attr->policy;
+    if (attr->policy == SCHED_POLICY_FAIR) {
+        task->nice = attr->nice;
+        task->weight = fair_nice_to_weight(attr->nice);
+        if (old_class != SCHED_CLASS_FAIR) {
+            fair_place(rq, task, 0);
+        }
+    } else if (attr->policy == SCHED_POLICY_FIFO) {
+        task->rt_priority = attr->rt_priority;
+    } else {
+        uint64_t now = timer_get_time_us();
+        task->dl_runtime = attr->runtime_us;
+        task->dl_deadline = attr->deadline_us;
+        task->dl_period = attr->period_us;
+        task->dl_abs_deadline = now + attr->deadline_us;
+        task->dl_budget = (int64_t)attr->runtime_us;
+        task->dl_exec_start = now;
+        if (task == rq->current_task) {
+            timer_modify(task->dl_timer, attr->runtime_us);
+        }
+    }
+
+    if (requeue) {
+        scheduler_enqueue_runnable(rq, task);
+    } else if (task == rq->current_task) {
+        scheduler_set_need_resched(rq);
+    }
+    ret = 0;
+
+out:
+    spin_unlock_irqrestore(&rq->lock, flags);
+    if (new_timer) {
+        timer_destroy(new_timer);
+    }
+    return ret;
+}
+
+/**
+ * Requeue the outgoing task if it is still runnable; blocked and
+ * terminated tasks stay off the run queues. A deadline task is charged
+ * first, and stays off too if that throttles it; a preempted RT task goes
+ * back to the head of its list (rq locked).
+ */
+static void scheduler_put_prev_task(struct scheduler *rq, struct task *task) {
+    if (task->sched_class == SCHED_CLASS_DEADLINE && task == rq->current_task) {
+        scheduler_dl_update(rq, task);
+    }
+    if (task->state == TASK_STATE_RUNNING || task->state == TASK_STATE_READY) {
+        int preempted = task->state == TASK_STATE_RUNNING;
+        task->state = TASK_STATE_READY;
+        run_queue_add(rq, task, preempted);
+    }
+}
+
+// Fixed levels above PRIORITY_IDLE, then the fair class, then idle; the
+// only tasks another CPU may take
+static struct task *scheduler_peek_migratable(struct scheduler *rq) {
+    uint32_t fixed = rq->ready_bitmap & ~(1U << PRIORITY_IDLE);
+
+    // Lower number = higher priority
+    if (fixed) {
+        return rq->run_queue[__builtin_ctz(fixed)];
+    }
+    if (rq->fair_count) {
+        return fair_peek(rq);
+    }
+    return rq->run_queue[PRIORITY_IDLE];
+}
+
+// Deadline and RT tasks, then the rest
+static struct task *scheduler_peek_locked(struct scheduler *rq) {
+    if (rq->rt_count) {
+        return rt_peek(rq);
+    }
+    return scheduler_peek_migratable(rq);
+}
+
+// Best runnable task, taken off the run queues (rq locked)
+static struct task *scheduler_pick_locked(struct scheduler *rq) {
+    struct task *task = scheduler_peek_locked(rq);
+    if (task) {
+        run_queue_dequeue(rq, task);
+    }
+    return task;
+}
+
+static uint64_t scheduler_time_slice(struct scheduler *rq, struct task *task) {
+    if (task->sched_class == SCHED_CLASS_FAIR) {
+        return fair_time_slice(rq, task);
+    }
+    return rq->time_slice_quantum;
+}
+
+/**
+ * Pull one task from the CPU with the most queued work. Called without
+ * any run queue lock held; the task comes back owned by rq's CPU but on
+ * no queue.
+ */
+static struct task *scheduler_steal_task(struct scheduler *rq) {
+    struct scheduler *busiest = NULL;
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct scheduler *other = &runqueues[cpu];
+        if (other == rq || other->nr_running == other->rt_count) continue;
+        if (!busiest || other->nr_running - other->rt_count >
+                        busiest->nr_running - busiest->rt_count) {
+            busiest = other;
+        }
+    }
+    if (!busiest) {
+        return NULL;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&busiest->lock);
+    struct task *task = scheduler_peek_migratable(busiest);
+    if (task) {
+        // Leave the victim's next pick alone: take the most recently
+        // queued task of that level, or a heap leaf of the fair class
+        if (task->sched_class == SCHED_CLASS_FAIR) {
+            task = busiest->fair_heap[busiest->fair_count - 1];
+            task->vruntime -= busiest->min_vruntime;
+        } else {
+            task = task->prev;
+        }
+        run_queue_dequeue(busiest, task);
+        busiest->num_tasks--;
+        task->cpu = rq->cpu;
+    }
+    spin_unlock_irqrestore(&busiest->lock, flags);
+
+    return task;
+}
+
+// Charge the ticks since the last charge to current as kind (interrupts off)
+static void scheduler_account(struct scheduler *rq, uint32_t kind) {
+    uint64_t now = arch_vdso_read_counter();
+    if (rq->current_task) {
+        rq->current_task->cpu_time[kind] += now - rq->account_stamp;
+    }
+    rq->account_stamp = now;
+}
+
+void scheduler_account_entry(int from_user) {
+    unsigned long flags = disable_interrupts();
+    scheduler_account(this_rq(), from_user ? CPU_TIME_USER : CPU_TIME_SYSTEM);
+    restore_interrupts(flags);
+}
+
+void scheduler_account_exit(int irq) {
+    unsigned long flags = disable_interrupts();
+    scheduler_account(this_rq(), irq ? CPU_TIME_IRQ : CPU_TIME_SYSTEM);
+    restore_interrupts(flags);
+}
+
+/**
+ * Switch this CPU from its current task to next, or to its idle context
+ * when next is NULL. Called with rq locked; the lock is released by
+ * whatever runs next here, so it is held again (by the same CPU) when
+ * this returns.
+ */
+static void scheduler_switch_locked(struct scheduler *rq, struct task *next) {
+    struct task *prev = rq->current_task;
+
+    if (prev == next) {
         return;  // Already running this task
     }
-    
+
     // Update task states
-    if (old_task && old_task->state == TASK_STATE_RUNNING) {
-        old_task->state = TASK_STATE_READY;
+    if (prev) {
+        if (prev->stack_base && *(uint64_t *)prev->stack_base != TASK_STACK_MAGIC) {
+            kernel_panic("Task stack overflow");
+        }
+        scheduler_put_prev_task(rq, prev);
     }
-    
-    task->state = TASK_STATE_RUNNING;
-    task->time_slice = g_scheduler.time_slice_quantum;
-    task->last_scheduled = timer_get_ticks();
-    
-    g_scheduler.current_task = task;
-    g_scheduler.context_switches++;
-    
-    // Perform context switch if we have a previous task
-    if (old_task) {
-        context_switch(&old_task->context, &task->context);
-    } else {
-        // First task - just load the context
-        // This is architecture-specific and would be implemented
-        // in the architecture-specific context switch code
+    if (prev && prev->sched_class == SCHED_CLASS_DEADLINE && !prev->dl_throttled) {
+        timer_stop(prev->dl_timer);  // Budget enforcement is only for the running task
+    }
+    if (next) {
+        run_queue_dequeue(rq, next);
+        next->state = TASK_STATE_RUNNING;
+        next->time_slice = scheduler_time_slice(rq, next);
+        next->last_scheduled = timer_get_ticks();
+        next->cpu = rq->cpu;
+        next->switches++;
+        if (next->wake_time_us) {
+            latency_record(&rq->wakeup_latency, next->wake_time_us);
+            if (next->sched_class >= SCHED_CLASS_RT) {
+                latency_record(&rq->rt_latency, next->wake_time_us);
+            }
+            next->wake_time_us = 0;
+        }
+        if (next->sched_class == SCHED_CLASS_DEADLINE) {
+            next->dl_exec_start = timer_get_time_us();
+            timer_modify(next->dl_timer, (uint64_t)next->dl_budget);
+        }
+    }
+
+    if (!prev) {
+        timer_idle_exit();  // Restart the tick if idle had stopped it
+    }
+
+    trace_event(TRACE_SCHED_SWITCH, prev ? prev->pid : 0, next ? next->pid : 0,
+                prev ? prev->state : 0);
+    scheduler_account(rq, CPU_TIME_SYSTEM);  // prev is switched from the kernel
+    rq->current_task = next;
+    rq->context_switches++;
+    fpu_switch_out(prev);
+    perf_switch(prev, next);
+    vdso_switch(next);
+    aspace_switch(next ? next->aspace : NULL);  // Idle runs in the kernel's
+
+    context_switch(prev ? &prev->context : &rq->idle.context,
+                   next ? &next->context : &rq->idle.context);
+}
+
+/**
+ * Choose what this CPU runs after current (NULL when idle) and switch to
+ * it. Called and returns with this CPU's rq locked.
+ */
+static void scheduler_schedule_locked(struct scheduler *rq, unsigned long *flags) {
+    struct task *current = rq->current_task;
+
+    if (rq->need_resched) {
+        rq->need_resched = 0;
+        latency_record(&rq->preempt_latency, rq->resched_time_us);
+    }
+
+    if (current) {
+        scheduler_put_prev_task(rq, current);
+    }
+    struct task *next = scheduler_pick_locked(rq);
+
+    if (!next) {
+        // Nothing here: take work from the busiest CPU
+        spin_unlock_irqrestore(&rq->lock, *flags);
+        next = scheduler_steal_task(rq);
+        *flags = spin_lock_irqsave(&rq->lock);
+
+        if (next) {
+            rq->num_tasks++;
+            rq->steals++;
+            if (next->sched_class == SCHED_CLASS_FAIR) {
+                next->vruntime += rq->min_vruntime;  // Relative to the new CPU
+            }
+            if (next->state == TASK_STATE_TERMINATED) {
+                next = NULL;  // Killed in transit; already on our reap list
+            }
+        }
+        if (!next && current) {
+            // current may have been woken while the lock was dropped
+            scheduler_put_prev_task(rq, current);
+            next = scheduler_pick_locked(rq);
+        }
+    }
+
+    if (next == current) {
+        if (current) {
+            // Still the best runnable task: keep running on a fresh slice
+            current->state = TASK_STATE_RUNNING;
+            current->time_slice = scheduler_time_slice(rq, current);
+        }
+        return;
+    }
+    if (!next && current && current->state == TASK_STATE_RUNNING) {
+        return;
+    }
+
+    scheduler_switch_locked(rq, next);
+}
+
+/**
+ * Take the next task for this CPU off the run queues, pulling one from
+ * another CPU if this one has none. The caller owns the result.
+ */
+struct task *scheduler_pick_next_task(void) {
+    struct scheduler *rq = this_rq();
+
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    struct task *task = scheduler_pick_locked(rq);
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (!task) {
+        task = scheduler_steal_task(rq);
+        if (task) {
+            flags = spin_lock_irqsave(&rq->lock);
+            rq->num_tasks++;
+            rq->steals++;
+            if (task->sched_class == SCHED_CLASS_FAIR) {
+                task->vruntime += rq->min_vruntime;
+            }
+            spin_unlock_irqrestore(&rq->lock, flags);
+        }
+    }
+
+    return task;
+}
+
+// Switch to specified task
+void scheduler_switch_to_task(struct task *task) {
+    if (!task) return;
+
+    struct scheduler *rq = this_rq();
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    scheduler_switch_locked(rq, task);
+    spin_unlock_irqrestore(&this_rq()->lock, flags);
+}
+
+/**
+ * First code a new task runs: finish the switch that started it, then
+ * call its entry point. Tasks start with interrupts masked so the timer
+ * cannot come in while the run queue lock is still held.
+ */
+void scheduler_task_entry(void *arg) {
+    struct task *task = arg;
+
+    spin_unlock(&this_rq()->lock);
+    arch_interrupts_enable(1);
+
+    task->entry(task->entry_arg);
+    process_exit(0);
+}
+
+// Boot CPU's idle context, set up by scheduler_adopt_current()
+static void scheduler_idle_entry(void *arg) {
+    (void)arg;
+
+    spin_unlock(&this_rq()->lock);
+    arch_interrupts_enable(1);
+
+    scheduler_idle_loop();
+}
+
+// Free terminated tasks that are no longer running anywhere
+static void scheduler_reap(struct scheduler *rq) {
+    if (!rq->reap_list) return;
+
+    struct task *dead = NULL;
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    struct task **link = &rq->reap_list;
+    while (*link) {
+        struct task *task = *link;
+
+        // Still running on its stack until the switch away completes
+        if (task == rq->current_task) {
+            link = &task->next;
+            continue;
+        }
+        *link = task->next;
+        task->next = dead;
+        dead = task;
+        rq->num_tasks--;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    // Closing files may sleep, so this happens unlocked
+    while (dead) {
+        struct task *task = dead;
+        dead = task->next;
+        task->next = NULL;
+
+        klogf(LOG_DEBUG, "Cleaning up terminated task: %s\n", task->name);
+
+        // Free resources
+        if (task->stack_base) {
+            free_task_stack(task->stack_base, task->stack_size);
+        }
+        fd_table_destroy(task->files);
+        task->files = NULL;
+        wait_release_task(task);
+        if (task->dl_timer) {
+            timer_destroy(task->dl_timer);
+            task->dl_timer = 0;
+        }
+        io_ring_release_task(task);
+        aspace_put(task->aspace);
+        task->aspace = NULL;
+
+        // Drop the scheduler's reference; waiters may still hold theirs
+        task_put(task);
     }
 }
 
-// Scheduler tick (called from timer interrupt)
+/**
+ * Scheduler tick, called from the timer interrupt. Only accounts the
+ * running task and raises need_resched; the switch itself happens in
+ * scheduler_irq_exit() on the way out of the interrupt.
+ */
 void scheduler_tick(void) {
-    g_scheduler.tick_count++;
-    g_scheduler.total_ticks++;
-    
-    struct task *current = g_scheduler.current_task;
-    
+    struct scheduler *rq = this_rq();
+
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    rq->tick_count++;
+    rq->total_ticks++;
+
+    struct task *current = rq->current_task;
+
+    perf_tick(current);
     if (current) {
         current->total_runtime++;
-        
-        // Decrement time slice
-        if (current->time_slice > 0) {
-            current->time_slice--;
+        int preempt = 0;
+
+        if (current->sched_class == SCHED_CLASS_FAIR) {
+            fair_account(current, 1);
+            fair_update_min_vruntime(rq);
+            preempt = fair_should_preempt(rq, current);
+        } else if (current->sched_class == SCHED_CLASS_DEADLINE) {
+            preempt = scheduler_dl_update(rq, current);
         }
-        
-        // Check if time slice expired or task is no longer runnable
-        if (current->time_slice == 0 || current->state != TASK_STATE_RUNNING) {
-            // Need to schedule next task
-            struct task *next_task = scheduler_pick_next_task();
-            
-            if (next_task && next_task != current) {
-                scheduler_switch_to_task(next_task);
-            } else if (current->state == TASK_STATE_RUNNING) {
-                // Reset time slice for current task if it's still the only runnable task
-                current->time_slice = g_scheduler.time_slice_quantum;
+
+        // Decrement time slice; RT and deadline tasks have none
+        if (current->sched_class < SCHED_CLASS_RT) {
+            if (current->time_slice > 0) {
+                current->time_slice--;
+            }
+            if (current->time_slice == 0) {
+                preempt = 1;
             }
         }
-    } else {
-        // No current task - pick one
-        struct task *next_task = scheduler_pick_next_task();
-        if (next_task) {
-            scheduler_switch_to_task(next_task);
+
+        // Check if time slice expired or task is leaving; a BLOCKED task
+        // is about to switch away by itself
+        if (preempt || current->state == TASK_STATE_READY ||
+            current->state == TASK_STATE_TERMINATED) {
+            scheduler_set_need_resched(rq);
         }
+    } else if (rq->nr_running) {
+        // Idle with work queued
+        scheduler_set_need_resched(rq);
     }
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/**
+ * Give up the CPU from task context: yield, block or exit. current's
+ * state says which; a RUNNING or READY task is queued again.
+ */
+void scheduler_schedule(void) {
+    struct scheduler *rq = this_rq();
+
+    scheduler_reap(rq);
+
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    scheduler_schedule_locked(rq, &flags);
+
+    // May be a different CPU if we were switched away and resumed elsewhere
+    spin_unlock_irqrestore(&this_rq()->lock, flags);
+}
+
+/**
+ * Interrupt return hook, called with interrupts masked on the
+ * interrupted context's stack after the controller has been
+ * acknowledged. Runs deferred interrupt work first, then switches if
+ * the tick or a wakeup asked for it. An interrupt that arrived while
+ * that work was running returns straight to it.
+ */
+void scheduler_irq_exit(void) {
+    if (softirq_irq_exit()) {
+        return;
+    }
+
+    struct scheduler *rq = this_rq();
+
+    if (!rq->need_resched) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+
+    // Preempted between marking itself BLOCKED and calling
+    // scheduler_schedule(): that wait may already be satisfied, so keep it
+    // runnable and let its wait loop block again
+    struct task *current = rq->current_task;
+    if (current && current->state == TASK_STATE_BLOCKED) {
+        current->state = TASK_STATE_READY;
+    }
+
+    scheduler_schedule_locked(rq, &flags);
+    spin_unlock_irqrestore(&this_rq()->lock, flags);
+}
+
+/**
+ * Idle loop: run whatever becomes runnable here or can be taken from a
+ * busier CPU. The boot CPU halts with its tick stopped until an
+ * interrupt; CPUs the timer cannot wake poll instead.
+ */
+void scheduler_idle_loop(void) {
+    struct scheduler *rq = this_rq();
+
+    for (;;) {
+        softirq_run_pending();
+        scheduler_reap(rq);
+
+        unsigned long flags = spin_lock_irqsave(&rq->lock);
+        scheduler_schedule_locked(rq, &flags);
+        spin_unlock_irqrestore(&rq->lock, flags);
+
+        flags = disable_interrupts();
+        int halted = 0;
+        if (!rq->nr_running && timer_idle_enter() == 0) {
+            arch_cpu_idle();
+            halted = 1;
+        }
+        restore_interrupts(flags);
+
+        for (int i = 0; !halted && i < 1000 && !rq->nr_running; i++) {
+            cpu_relax();
+        }
+    }
+}
+
+/**
+ * Make the thread running on this CPU the current task, and give the CPU
+ * a separate idle context to fall back to. This is how the boot thread,
+ * which was never created through process_create(), becomes schedulable.
+ */
+int scheduler_adopt_current(struct task *task) {
+    if (!task) return -1;
+
+    struct scheduler *rq = this_rq();
+    void *stack = memory_alloc_pages(SMP_CPU_STACK_SIZE / PAGE_SIZE_4K);
+    if (!stack) {
+        early_print("Scheduler: no memory for idle stack\n");
+        return -1;
+    }
+    arch_setup_task_context(&rq->idle.context, scheduler_idle_entry, NULL,
+                            (char *)stack + SMP_CPU_STACK_SIZE);
+
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    if (task->sched_class == SCHED_CLASS_FAIR) {
+        fair_place(rq, task, 0);
+    }
+    task->cpu = rq->cpu;
+    task->on_run_queue = 0;
+    task->state = TASK_STATE_RUNNING;
+    task->time_slice = scheduler_time_slice(rq, task);
+    task->last_scheduled = timer_get_ticks();
+    rq->current_task = task;
+    rq->account_stamp = arch_vdso_read_counter();
+    rq->num_tasks++;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    return 0;
 }
 
 // Start the scheduler
 void scheduler_start(void) {
     early_print("Starting scheduler...\n");
-    
+
     // Pick first task to run
     struct task *first_task = scheduler_pick_next_task();
     if (first_task) {
         early_print("Starting first task: ");
         early_print(first_task->name);
         early_print("\n");
-        
+
         scheduler_switch_to_task(first_task);
     } else {
         early_print("ERROR: No tasks to schedule!\n");
@@ -193,67 +1032,127 @@ void scheduler_start(void) {
 
 // Get current running task
 struct task *scheduler_get_current_task(void) {
-    return g_scheduler.current_task;
-}
-
-// Clean up terminated tasks
-static void cleanup_terminated_tasks(void) {
-    if (!g_scheduler.ready_queue) return;
-    
-    struct task *current = g_scheduler.ready_queue;
-    struct task *start = current;
-    
-    do {
-        struct task *next = current->next;
-        
-        if (current->state == TASK_STATE_TERMINATED) {
-            early_print("Cleaning up terminated task: ");
-            early_print(current->name);
-            early_print("\n");
-            
-            // Remove from scheduler
-            scheduler_remove_task(current);
-            
-            // Free resources
-            if (current->stack_base) {
-                free_task_stack(current->stack_base, current->stack_size);
-            }
-            
-            // Free task structure (implemented in process.c)
-            // free_task(current);  // This would be called here in full implementation
-        }
-        
-        current = next;
-    } while (current != start && g_scheduler.ready_queue);
+    return this_rq()->current_task;
+}
+
+// Sum of the per-CPU counters
+void scheduler_get_totals(uint64_t *context_switches, uint64_t *ticks) {
+    uint64_t switches = 0;
+    uint64_t total = 0;
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        switches += runqueues[cpu].context_switches;
+        total += runqueues[cpu].total_ticks;
+    }
+    if (context_switches) *context_switches = switches;
+    if (ticks) *ticks = total;
+}
+
+static void latency_add(struct sched_latency *sum, const struct sched_latency *lat) {
+    sum->count += lat->count;
+    sum->total_us += lat->total_us;
+    if (lat->max_us > sum->max_us) {
+        sum->max_us = lat->max_us;
+    }
+}
+
+// Latency samples summed over all CPUs (max is the worst of any CPU)
+void scheduler_get_latency(struct sched_latency *preempt, struct sched_latency *wakeup,
+                           struct sched_latency *rt) {
+    struct sched_latency p = {0, 0, 0};
+    struct sched_latency w = {0, 0, 0};
+    struct sched_latency r = {0, 0, 0};
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        latency_add(&p, &runqueues[cpu].preempt_latency);
+        latency_add(&w, &runqueues[cpu].wakeup_latency);
+        latency_add(&r, &runqueues[cpu].rt_latency);
+    }
+    if (preempt) *preempt = p;
+    if (wakeup) *wakeup = w;
+    if (rt) *rt = r;
+}
+
+static void latency_print(const char *label, const struct sched_latency *lat) {
+    char str[16];
+
+    early_print(label);
+    early_print(": avg ");
+    early_print(itoa(lat->count ? (int)(lat->total_us / lat->count) : 0, str, 10));
+    early_print(" us, max ");
+    early_print(itoa((int)lat->max_us, str, 10));
+    early_print(" us (");
+    early_print(itoa((int)lat->count, str, 10));
+    early_print(" samples)\n");
 }
 
 // Dump scheduler information
 void scheduler_dump_info(void) {
     early_print("=== Scheduler Information ===\n");
-    
+
     char str[16];
+    uint32_t num_tasks = 0;
+    uint64_t switches, ticks;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        num_tasks += runqueues[cpu].num_tasks;
+    }
+    scheduler_get_totals(&switches, &ticks);
+
     early_print("Total tasks: ");
-    early_print(itoa(g_scheduler.num_tasks, str, 10));
+    early_print(itoa(num_tasks, str, 10));
     early_print("\n");
-    
+
     early_print("Context switches: ");
     // Note: Using simple conversion for 64-bit values
-    early_print(itoa((int)g_scheduler.context_switches, str, 10));
+    early_print(itoa((int)switches, str, 10));
     early_print("\n");
-    
+
     early_print("Scheduler ticks: ");
-    early_print(itoa((int)g_scheduler.total_ticks, str, 10));
+    early_print(itoa((int)ticks, str, 10));
     early_print("\n");
-    
-    if (g_scheduler.current_task) {
-        early_print("Current task: ");
-        early_print(g_scheduler.current_task->name);
-        early_print(" (PID ");
-        early_print(itoa(g_scheduler.current_task->pid, str, 10));
-        early_print(")\n");
-    } else {
-        early_print("No current task\n");
+
+    struct sched_latency preempt, wakeup, rt;
+    scheduler_get_latency(&preempt, &wakeup, &rt);
+    latency_print("Preemption latency", &preempt);
+    latency_print("Wakeup latency", &wakeup);
+    latency_print("RT wakeup latency", &rt);
+
+    early_print("Deadline bandwidth: ");
+    early_print(itoa((int)((dl_bw_total() * 100) >> DL_BW_SHIFT), str, 10));
+    early_print("% of ");
+    early_print(itoa(SCHED_DL_BANDWIDTH_PERCENT, str, 10));
+    early_print("%, throttled ");
+    early_print(itoa((int)runqueues[SCHED_RT_CPU].dl_throttles, str, 10));
+    early_print(" times, ");
+    early_print(itoa((int)runqueues[SCHED_RT_CPU].dl_overruns, str, 10));
+    early_print(" past the deadline\n");
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct scheduler *rq = &runqueues[cpu];
+        if (cpu > 0 && !smp_cpus[cpu].online) continue;
+
+        early_print("CPU ");
+        early_print(itoa(cpu, str, 10));
+        early_print(": ");
+        if (rq->current_task) {
+            early_print(rq->current_task->name);
+            early_print(" (PID ");
+            early_print(itoa(rq->current_task->pid, str, 10));
+            early_print(")");
+        } else {
+            early_print("idle");
+        }
+        early_print(", queued ");
+        early_print(itoa(rq->nr_running, str, 10));
+        early_print(" (fair ");
+        early_print(itoa(rq->fair_count, str, 10));
+        early_print(", rt ");
+        early_print(itoa(rq->rt_count, str, 10));
+        early_print(")");
+        early_print(", stolen ");
+        early_print(itoa((int)rq->steals, str, 10));
+        early_print("\n");
     }
-    
+
     early_print("=== End Scheduler Info ===\n");
-}
\ No newline at end of file
+}
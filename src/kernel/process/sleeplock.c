@@ -0,0 +1,121 @@
+/**
+ * Sleeping Locks
+ *
+ * Mutexes and reader/writer semaphores built on wait queues (sleeplock.h)
+ *
+ * The state is only ever changed under the lock's spinlock, and a waiter
+ * retests it inside wait_event(), which queues the task before the test,
+ * so a release between the test and the sleep still wakes it. Releases
+ * wake every waiter rather than one: a woken reader may find a writer got
+ * in first, and waking one at a time would strand the rest.
+ */
+
+#include "sleeplock.h"
+
+void mutex_init(struct mutex *mutex) {
+    spin_lock_init(&mutex->lock);
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    wait_queue_init(&mutex->wait);
+}
+
+int mutex_trylock(struct mutex *mutex) {
+    int taken = 0;
+
+    unsigned long flags = spin_lock_irqsave(&mutex->lock);
+    if (!mutex->locked) {
+        mutex->locked = 1;
+        mutex->owner = scheduler_get_current_task();
+        taken = 1;
+    }
+    spin_unlock_irqrestore(&mutex->lock, flags);
+    return taken;
+}
+
+void mutex_lock(struct mutex *mutex) {
+    wait_event(&mutex->wait, mutex_trylock(mutex));
+}
+
+void mutex_unlock(struct mutex *mutex) {
+    unsigned long flags = spin_lock_irqsave(&mutex->lock);
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    spin_unlock_irqrestore(&mutex->lock, flags);
+
+    wake_up(&mutex->wait);
+}
+
+int mutex_is_owner(struct mutex *mutex) {
+    return __atomic_load_n(&mutex->locked, __ATOMIC_ACQUIRE) &&
+           mutex->owner == scheduler_get_current_task();
+}
+
+void rwsem_init(struct rwsem *sem) {
+    spin_lock_init(&sem->lock);
+    sem->count = 0;
+    sem->writers_waiting = 0;
+    wait_queue_init(&sem->wait);
+}
+
+int rwsem_try_read(struct rwsem *sem) {
+    int taken = 0;
+
+    unsigned long flags = spin_lock_irqsave(&sem->lock);
+    if (sem->count >= 0 && sem->writers_waiting == 0) {
+        sem->count++;
+        taken = 1;
+    }
+    spin_unlock_irqrestore(&sem->lock, flags);
+    return taken;
+}
+
+int rwsem_try_write(struct rwsem *sem) {
+    int taken = 0;
+
+    unsigned long flags = spin_lock_irqsave(&sem->lock);
+    if (sem->count == 0) {
+        sem->count = -1;
+        taken = 1;
+    }
+    spin_unlock_irqrestore(&sem->lock, flags);
+    return taken;
+}
+
+void rwsem_down_read(struct rwsem *sem) {
+    wait_event(&sem->wait, rwsem_try_read(sem));
+}
+
+void rwsem_up_read(struct rwsem *sem) {
+    unsigned long flags = spin_lock_irqsave(&sem->lock);
+    int last = (--sem->count == 0);
+    spin_unlock_irqrestore(&sem->lock, flags);
+
+    // Only a writer can be waiting for readers to leave
+    if (last) {
+        wake_up(&sem->wait);
+    }
+}
+
+void rwsem_down_write(struct rwsem *sem) {
+    if (rwsem_try_write(sem)) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&sem->lock);
+    sem->writers_waiting++;
+    spin_unlock_irqrestore(&sem->lock, flags);
+
+    wait_event(&sem->wait, rwsem_try_write(sem));
+
+    flags = spin_lock_irqsave(&sem->lock);
+    sem->writers_waiting--;
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+void rwsem_up_write(struct rwsem *sem) {
+    unsigned long flags = spin_lock_irqsave(&sem->lock);
+    sem->count = 0;
+    spin_unlock_irqrestore(&sem->lock, flags);
+
+    wake_up(&sem->wait);
+}
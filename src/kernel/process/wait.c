@@ -0,0 +1,214 @@
+/**
+ * Wait Queues
+ *
+ * Blocking primitives for tasks waiting on an event
+ *
+ * A sleeper links a wait_entry from its own stack onto the queue and marks
+ * itself BLOCKED under the queue lock before testing its condition, so a
+ * wake_up() that runs in between turns it back to READY and the
+ * scheduler_schedule() that follows returns straight away instead of
+ * losing the wakeup. BLOCKED tasks are off every run queue, so sleepers
+ * cost the scheduler nothing until they wake.
+ *
+ * Timed sleeps use a one-shot timer per task, created on first use and
+ * destroyed with the task. Its callback only wakes the task, so every
+ * caller rechecks its condition and treats an early return as spurious.
+ * The timer refers to the task by PID, so a callback already running
+ * when the task is reaped finds it gone instead of freed.
+ *
+ * Watchers (epoll) hang callback entries on the queues of the objects
+ * they watch, ahead of any sleepers. wake_up() calls every watcher
+ * whether or not it wakes a sleeper. Once wait_queue_remove() returns,
+ * the callback is not running and never will be again, so its owner can
+ * free the entry.
+ */
+
+#include "process.h"
+#include "timer.h"
+
+void wait_queue_init(struct wait_queue *wq) {
+    spin_lock_init(&wq->lock);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+// Link a sleeper at the tail (wq locked)
+static void wait_link(struct wait_queue *wq, struct wait_entry *entry) {
+    entry->next = NULL;
+    entry->prev = wq->tail;
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        wq->head = entry;
+    }
+    wq->tail = entry;
+    entry->queued = 1;
+}
+
+// Link a watcher at the head, so watchers always precede sleepers (wq locked)
+static void wait_link_head(struct wait_queue *wq, struct wait_entry *entry) {
+    entry->prev = NULL;
+    entry->next = wq->head;
+    if (wq->head) {
+        wq->head->prev = entry;
+    } else {
+        wq->tail = entry;
+    }
+    wq->head = entry;
+    entry->queued = 1;
+}
+
+// Unlink entry if it is still queued (wq locked)
+static void wait_unlink(struct wait_queue *wq, struct wait_entry *entry) {
+    if (!entry->queued) return;
+
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->queued = 0;
+}
+
+/**
+ * Queue the current task on wq and mark it BLOCKED. The caller then tests
+ * its condition and calls scheduler_schedule() if it still has to wait.
+ * Returns -1 when there is no current task to put to sleep.
+ */
+int wait_prepare(struct wait_queue *wq, struct wait_entry *entry) {
+    struct task *current = scheduler_get_current_task();
+    if (!current) return -1;
+
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    if (!entry->queued || entry->task != current) {
+        entry->task = current;
+        wait_link(wq, entry);
+    }
+    current->state = TASK_STATE_BLOCKED;
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return 0;
+}
+
+// Leave wq after waiting; the task is running again
+void wait_finish(struct wait_queue *wq, struct wait_entry *entry) {
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    wait_unlink(wq, entry);
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    if (entry->task) {
+        entry->task->state = TASK_STATE_RUNNING;
+    }
+}
+
+// Queue a watcher: entry->func is called on every wakeup of wq
+void wait_queue_add(struct wait_queue *wq, struct wait_entry *entry) {
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    if (!entry->queued) {
+        entry->task = NULL;
+        wait_link_head(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Take a watcher off wq; its callback has returned by the time this does
+void wait_queue_remove(struct wait_queue *wq, struct wait_entry *entry) {
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    wait_unlink(wq, entry);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/**
+ * Wake up to max sleepers in FIFO order and return how many were woken.
+ * Watchers are all called, and left queued, whatever max is.
+ */
+static uint32_t wake_up_many(struct wait_queue *wq, uint32_t max) {
+    uint32_t woken = 0;
+
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    struct wait_entry *entry = wq->head;
+    while (entry && (entry->func || woken < max)) {
+        struct wait_entry *next = entry->next;
+        if (entry->func) {
+            entry->func(entry);
+        } else {
+            wait_unlink(wq, entry);
+            scheduler_wake_task(entry->task);
+            woken++;
+        }
+        entry = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    return woken;
+}
+
+uint32_t wake_up(struct wait_queue *wq) {
+    return wake_up_many(wq, UINT32_MAX);
+}
+
+uint32_t wake_up_one(struct wait_queue *wq) {
+    return wake_up_many(wq, 1);
+}
+
+static void wait_timer_expired(void *data) {
+    struct task *task = task_get_by_pid((uint32_t)(uintptr_t)data);
+    if (task) {
+        scheduler_wake_task(task);
+        task_put(task);
+    }
+}
+
+/**
+ * Give up the CPU until woken or until timeout_us has passed. current must
+ * already be BLOCKED (after wait_prepare(), or set directly for a plain
+ * sleep). Without a timer the task is only yielded.
+ */
+void wait_schedule_timeout(uint64_t timeout_us) {
+    struct task *current = scheduler_get_current_task();
+    if (!current) return;
+
+    if (!current->sleep_timer) {
+        current->sleep_timer = timer_create(TIMER_TYPE_ONESHOT, timeout_us,
+                                            wait_timer_expired,
+                                            (void *)(uintptr_t)current->pid);
+    }
+    if (!current->sleep_timer || timer_modify(current->sleep_timer, timeout_us) < 0) {
+        current->state = TASK_STATE_READY;
+        scheduler_schedule();
+        return;
+    }
+
+    scheduler_schedule();
+    timer_stop(current->sleep_timer);
+}
+
+uint64_t wait_deadline(uint64_t timeout_us) {
+    return timer_get_time_us() + timeout_us;
+}
+
+/**
+ * wait_schedule_timeout() for whatever is left until deadline_us. Returns
+ * -1 without sleeping once it has passed.
+ */
+int wait_schedule_until(uint64_t deadline_us) {
+    uint64_t now = timer_get_time_us();
+    if (now >= deadline_us) return -1;
+
+    wait_schedule_timeout(deadline_us - now);
+    return 0;
+}
+
+// Release the task's sleep timer when it is cleaned up
+void wait_release_task(struct task *task) {
+    if (task->sleep_timer) {
+        timer_destroy(task->sleep_timer);
+        task->sleep_timer = 0;
+    }
+}
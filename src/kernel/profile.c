@@ -0,0 +1,243 @@
+/*
+ * MiniOS Sampling Profiler
+ *
+ * Samples are written only by the CPU they were taken on, from its
+ * interrupt handler, so a ring needs no lock: the writing flag lets
+ * profile_stop() wait out a sample in progress elsewhere before the
+ * report reads the rings. Backtraces follow the frame records (previous
+ * frame pointer, then return address) only while they stay inside the
+ * interrupted task's stack, so a function built without a frame pointer
+ * ends the walk early rather than sending it somewhere unmapped.
+ */
+
+#include "profile.h"
+#include "ksyms.h"
+#include "perf.h"
+#include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+
+struct profile_cpu {
+    struct profile_sample *ring;        // PROFILE_RING_SAMPLES, from the first start
+    uint64_t head;                      // Samples taken; the next goes in head % size
+    volatile int writing;
+};
+
+static struct profile_cpu profile_cpus[MAX_CPUS];
+static volatile int profile_active;
+static uint32_t profile_source;
+static uint32_t profile_flags;
+static uint64_t profile_period;
+
+// Return addresses above fp, within the current task's stack
+static uint16_t profile_backtrace(uintptr_t fp, uintptr_t *frames)
+{
+    struct task *task = scheduler_get_current_task();
+    if (!task || !task->stack_base) {
+        return 0;
+    }
+
+    uintptr_t lo = (uintptr_t)task->stack_base;
+    uintptr_t hi = lo + task->stack_size;
+    uint16_t depth = 0;
+
+    while (depth < PROFILE_MAX_DEPTH && fp >= lo && fp + 2 * sizeof(uintptr_t) <= hi &&
+           !(fp & (sizeof(uintptr_t) - 1))) {
+        const uintptr_t *record = (const uintptr_t *)fp;
+        if (!record[1]) {
+            break;
+        }
+        frames[depth++] = record[1];
+        if (record[0] <= fp) {
+            break;                      // Callers' frames are higher up the stack
+        }
+        fp = record[0];
+    }
+    return depth;
+}
+
+void profile_sample(const struct irq_regs *regs)
+{
+    if (!profile_active || !regs) {
+        return;
+    }
+
+    struct profile_cpu *pc = &profile_cpus[smp_cpu_id()];
+    pc->writing = 1;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (profile_active && pc->ring) {
+        struct profile_sample *sample = &pc->ring[pc->head % PROFILE_RING_SAMPLES];
+        sample->pc = regs->pc;
+        sample->user = regs->user ? 1 : 0;
+        sample->depth = 0;
+        if ((profile_flags & PROFILE_BACKTRACE) && !regs->user) {
+            sample->depth = profile_backtrace(regs->fp, sample->frames);
+        }
+        pc->head++;
+    }
+    __atomic_store_n(&pc->writing, 0, __ATOMIC_RELEASE);
+}
+
+void profile_tick(void)
+{
+    if (profile_active && profile_source == PROFILE_SOURCE_TIMER) {
+        profile_sample(irq_get_regs());
+    }
+}
+
+int profile_start(uint32_t source, uint64_t period, uint32_t flags)
+{
+    if (profile_active || source > PROFILE_SOURCE_CYCLES) {
+        return -1;
+    }
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct profile_cpu *pc = &profile_cpus[cpu];
+        if (!pc->ring && (cpu == 0 || smp_cpus[cpu].online)) {
+            pc->ring = kmalloc(PROFILE_RING_SAMPLES * sizeof(struct profile_sample));
+            if (!pc->ring) {
+                return -1;
+            }
+        }
+        pc->head = 0;
+    }
+
+    profile_source = source;
+    profile_flags = flags;
+    profile_period = source == PROFILE_SOURCE_CYCLES ? period : 0;
+    __atomic_store_n(&profile_active, 1, __ATOMIC_RELEASE);
+
+    if (source == PROFILE_SOURCE_CYCLES && arch_pmu_sample_start(period) < 0) {
+        profile_active = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void profile_stop(void)
+{
+    if (!profile_active) {
+        return;
+    }
+
+    if (profile_source == PROFILE_SOURCE_CYCLES) {
+        arch_pmu_sample_stop();
+    }
+    __atomic_store_n(&profile_active, 0, __ATOMIC_SEQ_CST);
+
+    // A sample already under way finishes in a moment
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        while (__atomic_load_n(&profile_cpus[cpu].writing, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+}
+
+int profile_running(void)
+{
+    return profile_active;
+}
+
+// Counter slot for a kernel address: its symbol, or the unknown slot
+static uint32_t profile_slot(uintptr_t addr, uint32_t nsyms)
+{
+    int index = ksyms_lookup(addr, NULL);
+    return index >= 0 ? (uint32_t)index : nsyms + 1;
+}
+
+int profile_report(struct profile_entry **entries, struct profile_summary *summary)
+{
+    if (!entries || !summary || profile_active) {
+        return -1;
+    }
+    *entries = NULL;
+
+    summary->source = profile_source;
+    summary->flags = profile_flags;
+    summary->period = profile_period;
+    summary->samples = 0;
+    summary->overwritten = 0;
+
+    // Per symbol, then user and unknown: self, total and the last sample
+    // counted in total, so recursion counts once
+    uint32_t nsyms = ksyms_count();
+    uint32_t nslots = nsyms + 2;
+    uint32_t *counts = kmalloc(nslots * 3 * sizeof(uint32_t));
+    if (!counts) {
+        return -1;
+    }
+    memset(counts, 0, nslots * 3 * sizeof(uint32_t));
+    uint32_t *self = counts, *total = counts + nslots, *last = counts + 2 * nslots;
+
+    uint32_t serial = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct profile_cpu *pc = &profile_cpus[cpu];
+        if (!pc->ring) {
+            continue;
+        }
+        uint64_t kept = pc->head < PROFILE_RING_SAMPLES ? pc->head : PROFILE_RING_SAMPLES;
+        summary->samples += pc->head;
+        summary->overwritten += pc->head - kept;
+
+        for (uint64_t i = 0; i < kept; i++) {
+            const struct profile_sample *sample = &pc->ring[i];
+            serial++;
+
+            uint32_t slot = sample->user ? nsyms : profile_slot(sample->pc, nsyms);
+            self[slot]++;
+            total[slot]++;
+            last[slot] = serial;
+
+            // A return address is just past the call; look up the call
+            for (uint16_t d = 0; d < sample->depth; d++) {
+                slot = profile_slot(sample->frames[d] - 1, nsyms);
+                if (last[slot] != serial) {
+                    total[slot]++;
+                    last[slot] = serial;
+                }
+            }
+        }
+    }
+
+    uint32_t used = 0;
+    for (uint32_t slot = 0; slot < nslots; slot++) {
+        if (total[slot]) {
+            used++;
+        }
+    }
+
+    int result = 0;
+    if (used) {
+        struct profile_entry *list = kmalloc(used * sizeof(struct profile_entry));
+        if (!list) {
+            kfree(counts);
+            return -1;
+        }
+
+        // Insertion sort: most self samples first, then most total
+        uint32_t n = 0;
+        for (uint32_t slot = 0; slot < nslots; slot++) {
+            if (!total[slot]) {
+                continue;
+            }
+            struct profile_entry entry = {
+                .symbol = slot < nsyms ? (int32_t)slot :
+                          slot == nsyms ? PROFILE_SYM_USER : PROFILE_SYM_UNKNOWN,
+                .self = self[slot],
+                .total = total[slot],
+            };
+            uint32_t i = n++;
+            while (i > 0 && (list[i - 1].self < entry.self ||
+                             (list[i - 1].self == entry.self && list[i - 1].total < entry.total))) {
+                list[i] = list[i - 1];
+                i--;
+            }
+            list[i] = entry;
+        }
+        *entries = list;
+        result = (int)used;
+    }
+
+    kfree(counts);
+    return result;
+}
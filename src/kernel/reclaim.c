@@ -0,0 +1,179 @@
+/*
+ * MiniOS Memory-Pressure Reclaim
+ *
+ * Caches that keep whatever memory they are given (file pages, block
+ * buffers) register a shrinker with a count and a scan callback. The page
+ * allocator kicks the reclaimer when free pages fall below the low
+ * watermark or an allocation fails; the kick goes through a tasklet, so it
+ * is safe with any lock held, and the reclaimer runs as a task. It asks
+ * the shrinkers for batches of pages, each in proportion to what it
+ * reports it could free, until the high watermark is free or nothing more
+ * comes back.
+ *
+ * Shrinkers only drop clean entries from the cold end of their LRU lists:
+ * dirty data reaches the device through the flusher, and the next pass
+ * finds it clean. Allocation itself never reclaims, as its callers may be
+ * inside one of the caches or hold spinlocks, and a pass holds no lock of
+ * its own while the caches run their scans.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "process.h"
+#include "softirq.h"
+#include "spinlock.h"
+
+static struct shrinker *shrinkers[RECLAIM_MAX_SHRINKERS];
+static uint32_t num_shrinkers = 0;                  // Published after the slot
+static spinlock_t shrinker_lock = SPINLOCK_INIT;    // Registration
+static int reclaim_busy = 0;                        // One pass at a time
+
+static volatile int reclaimd_running = 0;
+static volatile int reclaimd_kicked = 0;
+static struct wait_queue reclaimd_wait = WAIT_QUEUE_INIT;
+static struct tasklet reclaimd_kick;
+
+// Statistics
+static uint64_t reclaim_wakeups = 0;
+static uint64_t reclaim_passes = 0;
+static uint64_t reclaim_pages_freed = 0;
+
+int shrinker_register(struct shrinker *shrinker)
+{
+    if (!shrinker || !shrinker->count || !shrinker->scan) {
+        return -1;
+    }
+
+    spin_lock(&shrinker_lock);
+    uint32_t n = num_shrinkers;
+    if (n == RECLAIM_MAX_SHRINKERS) {
+        spin_unlock(&shrinker_lock);
+        return -1;
+    }
+    shrinker->freed = 0;
+    shrinkers[n] = shrinker;
+    __atomic_store_n(&num_shrinkers, n + 1, __ATOMIC_RELEASE);
+    spin_unlock(&shrinker_lock);
+    return 0;
+}
+
+uint32_t memory_reclaim(uint32_t nr_pages)
+{
+    uint32_t counts[RECLAIM_MAX_SHRINKERS];
+    uint64_t total = 0;
+    uint32_t freed = 0;
+
+    // Shrinkers are never removed, so the table is walked without the
+    // lock; a pass already running elsewhere is as good as this one
+    if (__atomic_exchange_n(&reclaim_busy, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    uint32_t n = __atomic_load_n(&num_shrinkers, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < n; i++) {
+        counts[i] = shrinkers[i]->count();
+        total += counts[i];
+    }
+
+    // Each gives back its share of the request, rounded up so small
+    // caches are not skipped for ever
+    for (uint32_t i = 0; i < n && total > 0; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        uint32_t share = (uint32_t)(((uint64_t)nr_pages * counts[i] + total - 1) / total);
+        if (share > counts[i]) {
+            share = counts[i];
+        }
+        uint32_t got = shrinkers[i]->scan(share);
+        shrinkers[i]->freed += got;
+        freed += got;
+    }
+    reclaim_passes++;
+    reclaim_pages_freed += freed;
+
+    __atomic_store_n(&reclaim_busy, 0, __ATOMIC_RELEASE);
+    return freed;
+}
+
+static uint64_t reclaim_free_pages(struct memory_stats *stats)
+{
+    memory_get_stats(stats);
+    return stats->free_memory / PAGE_SIZE_4K;
+}
+
+static void reclaimd_main(void *arg)
+{
+    (void)arg;
+
+    for (;;) {
+        struct memory_stats stats;
+        wait_event_timeout(&reclaimd_wait, reclaimd_kicked, RECLAIM_INTERVAL_US);
+        int kicked = reclaimd_kicked;
+        reclaimd_kicked = 0;
+
+        // A failed allocation may have wanted a larger block than the
+        // watermarks account for, so a kick is worth one pass regardless
+        uint64_t free = reclaim_free_pages(&stats);
+        if (!kicked && free >= stats.low_watermark) {
+            continue;
+        }
+        reclaim_wakeups++;
+
+        do {
+            if (memory_reclaim(RECLAIM_BATCH_PAGES) == 0) {
+                break;
+            }
+            free = reclaim_free_pages(&stats);
+        } while (free < stats.high_watermark);
+    }
+}
+
+// Wake the reclaimer from softirq context, where no scheduler lock can be held
+static void reclaimd_wake(void *data)
+{
+    (void)data;
+    wake_up(&reclaimd_wait);
+}
+
+void memory_reclaim_kick(void)
+{
+    if (!reclaimd_running || reclaimd_kicked) {
+        return;
+    }
+    reclaimd_kicked = 1;
+    tasklet_schedule(&reclaimd_kick);
+}
+
+int memory_reclaim_start(void)
+{
+    if (reclaimd_running) {
+        return 0;
+    }
+
+    tasklet_init(&reclaimd_kick, reclaimd_wake, NULL);
+    if (process_create_fair(reclaimd_main, NULL, "reclaimd", 0) < 0) {
+        return -1;
+    }
+    reclaimd_running = 1;
+    return 0;
+}
+
+void memory_reclaim_get_stats(struct reclaim_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    uint32_t n = __atomic_load_n(&num_shrinkers, __ATOMIC_ACQUIRE);
+    stats->shrinkers = n;
+    stats->wakeups = reclaim_wakeups;
+    stats->passes = reclaim_passes;
+    stats->pages_freed = reclaim_pages_freed;
+    for (uint32_t i = 0; i < n; i++) {
+        stats->shrinker[i].name = shrinkers[i]->name;
+        stats->shrinker[i].reclaimable = shrinkers[i]->count();
+        stats->shrinker[i].freed = shrinkers[i]->freed;
+    }
+}
@@ -0,0 +1,594 @@
+/*
+ * MiniOS Kernel Heap
+ * Size-class slab caches backed by the physical page allocator
+ *
+ * Small requests (16..2048 bytes) are served from per-size-class caches.
+ * Each slab is one 4KB page carved into equal objects from its start, so
+ * every object is aligned to its class size. Caches for objects up to
+ * KHEAP_ONSLAB_MAX keep the slab descriptor at the end of the page;
+ * larger classes keep it off-page so a 2KB class still packs two objects
+ * per page. Requests above the largest class go straight to the page
+ * allocator and are tracked by a descriptor as well. kmalloc_aligned()
+ * rounds small requests up to a class of the alignment and has large
+ * runs aligned by the page allocator.
+ *
+ * Every slab or large run records its descriptor as the owner of its
+ * first page (memory_set_page_owner()), which is how kfree() finds the
+ * owner of a pointer without a lock. One lock covers the slabs; internal
+ * allocations of descriptors use the _locked variants, so only callers'
+ * own allocations reach memprof.
+ *
+ * In front of the slabs each class has per-CPU magazines, after Bonwick:
+ * a CPU holds a loaded and a previous magazine, stacks of up to
+ * mag_rounds free objects, and allocates from and frees into them with
+ * only its own interrupts off. When both are empty (on alloc) or full (on
+ * free) it trades one with the class's depot of full and empty magazines,
+ * under a per-class lock, so the shared state is touched once per
+ * magazine of objects. An alloc the depot can't serve goes to the slabs;
+ * a free when the depot already holds KHEAP_DEPOT_FULL_MAX full
+ * magazines sends the newest one's objects back to them. Objects freed on
+ * another CPU than the one that allocated them simply join that CPU's
+ * magazines and reach the depot a magazine at a time.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "memprof.h"
+#include "spinlock.h"
+#include "smp.h"
+
+#define KMALLOC_ALIGNMENT   16
+#define KHEAP_PAGE_SIZE     PAGE_SIZE_4K
+#define KHEAP_PAGE_MASK     (~(uint64_t)(KHEAP_PAGE_SIZE - 1))
+#define KHEAP_MIN_SHIFT     4               // Smallest class: 16 bytes
+#define KHEAP_ONSLAB_MAX    256             // Larger classes use off-page descriptors
+#define KHEAP_MAG_ROUNDS    30              // Magazine capacity; the struct fills 256 bytes
+#define KHEAP_MAG_BYTES     16384           // Bytes of objects a magazine may hold
+#define KHEAP_DEPOT_FULL_MAX 4              // Full magazines a depot keeps per class
+
+// Slab (or large allocation) descriptor. On-slab it fills the tail of the
+// page the objects leave over.
+struct kmem_slab {
+    struct kmem_slab *next;         // Cache list linkage
+    struct kmem_slab *prev;
+    struct kmem_cache *cache;       // Owning cache, NULL for large allocations
+    void *page;                     // Start of backing page(s)
+    void *free_list;                // Free objects, linked through first word
+    uint32_t in_use;                // Objects handed out
+    uint32_t capacity;              // Objects per slab, or pages for large runs
+} __attribute__((aligned(KMALLOC_ALIGNMENT)));
+
+// Stack of free objects of one class
+struct kmem_magazine {
+    struct kmem_magazine *next;     // Depot list linkage
+    uint32_t rounds;                // Objects held
+    void *objects[KHEAP_MAG_ROUNDS];
+};
+
+// One CPU's magazines for a class; touched only by that CPU
+struct kmem_cpu_cache {
+    struct kmem_magazine *loaded;
+    struct kmem_magazine *previous; // Always empty or full
+    uint64_t allocs;                // Served from the magazines
+    uint64_t frees;                 // Taken into the magazines
+} __attribute__((aligned(64)));
+
+// Size-class cache
+struct kmem_cache {
+    struct kmem_cpu_cache cpu[MAX_CPUS];
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    uint32_t mag_rounds;            // Magazine capacity for this class
+    int off_slab;
+
+    // Slab layer, under kheap_lock
+    struct kmem_slab *partial;      // Slabs with at least one free object
+    struct kmem_slab *full;         // Slabs with no free objects
+    struct kmem_slab *empty;        // One fully free slab kept for reuse
+    uint32_t slabs;
+    uint32_t objects_in_use;        // Out of the slabs, magazines included
+    uint64_t allocs;                // Served by the slabs directly
+    uint64_t frees;
+
+    // Depot, under depot_lock
+    spinlock_t depot_lock;
+    struct kmem_magazine *depot_full;
+    struct kmem_magazine *depot_empty;
+    uint32_t depot_full_count;
+};
+
+static struct kmem_cache kmem_caches[KHEAP_NUM_CLASSES];
+static int kheap_initialized = 0;
+static spinlock_t kheap_lock = SPINLOCK_INIT;
+
+// Large allocation accounting
+static uint32_t large_allocs = 0;
+static uint64_t large_pages = 0;
+static uint64_t large_total_allocs = 0;
+static uint64_t large_total_frees = 0;
+static uint64_t failed_allocs = 0;
+
+static void *kmalloc_locked(size_t size, size_t alignment);
+static void kfree_locked(void *ptr);
+
+static void kheap_init(void)
+{
+    for (int i = 0; i < KHEAP_NUM_CLASSES; i++) {
+        struct kmem_cache *cache = &kmem_caches[i];
+        memset(cache, 0, sizeof(*cache));
+        cache->object_size = 1u << (i + KHEAP_MIN_SHIFT);
+        cache->off_slab = cache->object_size > KHEAP_ONSLAB_MAX;
+        if (cache->off_slab) {
+            cache->objects_per_slab = KHEAP_PAGE_SIZE / cache->object_size;
+        } else {
+            cache->objects_per_slab = (KHEAP_PAGE_SIZE - sizeof(struct kmem_slab)) /
+                                      cache->object_size;
+        }
+        cache->mag_rounds = KHEAP_MAG_BYTES / cache->object_size;
+        if (cache->mag_rounds > KHEAP_MAG_ROUNDS) {
+            cache->mag_rounds = KHEAP_MAG_ROUNDS;
+        }
+        spin_lock_init(&cache->depot_lock);
+    }
+    kheap_initialized = 1;
+}
+
+static void slab_list_add(struct kmem_slab **head, struct kmem_slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(struct kmem_slab **head, struct kmem_slab *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static inline int kheap_size_class(size_t size)
+{
+    int cls = 0;
+    size_t class_size = 1u << KHEAP_MIN_SHIFT;
+    while (class_size < size) {
+        class_size <<= 1;
+        cls++;
+    }
+    return cls;
+}
+
+/**
+ * Carve a fresh page into objects for a cache
+ */
+static struct kmem_slab *slab_create(struct kmem_cache *cache)
+{
+    uint8_t *page = memory_alloc_pages(1);
+    if (!page) {
+        return NULL;
+    }
+
+    struct kmem_slab *slab;
+    uint8_t *objects;
+    if (cache->off_slab) {
+        slab = kmalloc_locked(sizeof(struct kmem_slab), 0);
+        if (!slab) {
+            memory_free_pages(page, 1);
+            return NULL;
+        }
+    } else {
+        slab = (struct kmem_slab *)(page + KHEAP_PAGE_SIZE - sizeof(struct kmem_slab));
+    }
+    objects = page;
+
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->cache = cache;
+    slab->page = page;
+    slab->in_use = 0;
+    slab->capacity = cache->objects_per_slab;
+
+    // Thread the free list through the objects in address order
+    void *head = NULL;
+    for (int i = (int)slab->capacity - 1; i >= 0; i--) {
+        void **obj = (void **)(objects + (uint32_t)i * cache->object_size);
+        *obj = head;
+        head = obj;
+    }
+    slab->free_list = head;
+
+    memory_set_page_owner(page, slab);
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_destroy(struct kmem_slab *slab)
+{
+    struct kmem_cache *cache = slab->cache;
+    void *page = slab->page;
+
+    memory_set_page_owner(page, NULL);
+    cache->slabs--;
+    if (cache->off_slab) {
+        kfree_locked(slab);
+    }
+    memory_free_pages(page, 1);
+}
+
+// Alignment 0 means page aligned
+static void *kmalloc_large(size_t size, size_t alignment)
+{
+    size_t num_pages = (size + KHEAP_PAGE_SIZE - 1) / KHEAP_PAGE_SIZE;
+
+    struct kmem_slab *desc = kmalloc_locked(sizeof(struct kmem_slab), 0);
+    if (!desc) {
+        return NULL;
+    }
+
+    void *pages = memory_alloc_pages_aligned(num_pages, alignment);
+    if (!pages) {
+        kfree_locked(desc);
+        return NULL;
+    }
+
+    memset(desc, 0, sizeof(*desc));
+    desc->page = pages;
+    desc->capacity = (uint32_t)num_pages;
+    memory_set_page_owner(pages, desc);
+
+    large_allocs++;
+    large_pages += num_pages;
+    large_total_allocs++;
+    return pages;
+}
+
+// Take one object from a cache's slabs; caller holds kheap_lock
+static void *slab_alloc_object(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab = cache->partial;
+
+    if (!slab) {
+        if (cache->empty) {
+            slab = cache->empty;
+            cache->empty = NULL;
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void **obj = slab->free_list;
+    slab->free_list = *obj;
+    slab->in_use++;
+
+    if (!slab->free_list) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->objects_in_use++;
+    return obj;
+}
+
+// Return one object to its slab; caller holds kheap_lock
+static void slab_free_object(struct kmem_slab *slab, void *ptr)
+{
+    struct kmem_cache *cache = slab->cache;
+    int was_full = (slab->free_list == NULL);
+
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    cache->objects_in_use--;
+
+    if (was_full) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    if (slab->in_use == 0) {
+        // Keep one empty slab around to absorb alloc/free churn
+        slab_list_remove(&cache->partial, slab);
+        if (!cache->empty) {
+            cache->empty = slab;
+        } else {
+            slab_destroy(slab);
+        }
+    }
+}
+
+// Caller holds kheap_lock
+static void *kmalloc_locked(size_t size, size_t alignment)
+{
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (!kheap_initialized) {
+        kheap_init();
+    }
+
+    if (size > KHEAP_MAX_OBJECT || alignment > KHEAP_PAGE_SIZE) {
+        void *ptr = kmalloc_large(size, alignment);
+        if (!ptr) {
+            failed_allocs++;
+            early_print("kmalloc: OUT OF MEMORY\n");
+        }
+        return ptr;
+    }
+
+    struct kmem_cache *cache = &kmem_caches[kheap_size_class(size)];
+    void *obj = slab_alloc_object(cache);
+    if (!obj) {
+        failed_allocs++;
+        early_print("kmalloc: OUT OF MEMORY\n");
+        return NULL;
+    }
+
+    cache->allocs++;
+    return obj;
+}
+
+// Caller holds kheap_lock
+static void kfree_locked(void *ptr)
+{
+    if (!ptr || !kheap_initialized) {
+        return;
+    }
+
+    void *page = (void *)((uint64_t)ptr & KHEAP_PAGE_MASK);
+    struct kmem_slab *slab = memory_page_owner(page);
+    if (!slab) {
+        early_print("kfree: pointer not owned by kernel heap\n");
+        return;
+    }
+
+    if (!slab->cache) {
+        // Large allocation: only the start of the run is a valid pointer
+        if (ptr != slab->page) {
+            early_print("kfree: invalid large allocation pointer\n");
+            return;
+        }
+        memory_set_page_owner(slab->page, NULL);
+        large_allocs--;
+        large_pages -= slab->capacity;
+        large_total_frees++;
+        memory_free_pages(slab->page, slab->capacity);
+        kfree_locked(slab);
+        return;
+    }
+
+    slab->cache->frees++;
+    slab_free_object(slab, ptr);
+}
+
+// Send a full magazine's objects back to their slabs, leaving it empty
+static void kmem_magazine_drain(struct kmem_magazine *mag)
+{
+    unsigned long flags = spin_lock_irqsave(&kheap_lock);
+    while (mag->rounds) {
+        void *obj = mag->objects[--mag->rounds];
+        struct kmem_slab *slab = memory_page_owner((void *)((uint64_t)obj & KHEAP_PAGE_MASK));
+        slab_free_object(slab, obj);
+    }
+    spin_unlock_irqrestore(&kheap_lock, flags);
+}
+
+// Pop an object from this CPU's magazines, trading with the depot when
+// both are empty; NULL if the depot has no full magazine. Interrupts off.
+static void *kmem_cpu_alloc(struct kmem_cache *cache, struct kmem_cpu_cache *cpu)
+{
+    if (!cpu->loaded || !cpu->loaded->rounds) {
+        if (cpu->previous && cpu->previous->rounds) {
+            struct kmem_magazine *mag = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = mag;
+        } else {
+            spin_lock(&cache->depot_lock);
+            struct kmem_magazine *full = cache->depot_full;
+            if (full) {
+                cache->depot_full = full->next;
+                cache->depot_full_count--;
+                if (cpu->previous) {
+                    cpu->previous->next = cache->depot_empty;
+                    cache->depot_empty = cpu->previous;
+                }
+                cpu->previous = cpu->loaded;
+                cpu->loaded = full;
+            }
+            spin_unlock(&cache->depot_lock);
+            if (!full) {
+                return NULL;
+            }
+        }
+    }
+
+    cpu->allocs++;
+    return cpu->loaded->objects[--cpu->loaded->rounds];
+}
+
+// Push an object onto this CPU's magazines, trading with the depot when
+// both are full; 0 if no empty magazine could be had. Interrupts off.
+static int kmem_cpu_free(struct kmem_cache *cache, struct kmem_cpu_cache *cpu, void *obj)
+{
+    if (!cpu->loaded || cpu->loaded->rounds == cache->mag_rounds) {
+        if (cpu->previous && !cpu->previous->rounds) {
+            struct kmem_magazine *mag = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = mag;
+        } else {
+            // Hand in the full previous magazine for an empty one
+            struct kmem_magazine *drain = NULL;
+            spin_lock(&cache->depot_lock);
+            if (cpu->previous) {
+                cpu->previous->next = cache->depot_full;
+                cache->depot_full = cpu->previous;
+                cache->depot_full_count++;
+                cpu->previous = NULL;
+            }
+            struct kmem_magazine *empty = cache->depot_empty;
+            if (empty) {
+                cache->depot_empty = empty->next;
+            } else if (cache->depot_full_count > KHEAP_DEPOT_FULL_MAX) {
+                drain = cache->depot_full;
+                cache->depot_full = drain->next;
+                cache->depot_full_count--;
+            }
+            spin_unlock(&cache->depot_lock);
+
+            if (drain) {
+                kmem_magazine_drain(drain);
+                empty = drain;
+            } else if (!empty) {
+                unsigned long flags = spin_lock_irqsave(&kheap_lock);
+                empty = kmalloc_locked(sizeof(struct kmem_magazine), 0);
+                spin_unlock_irqrestore(&kheap_lock, flags);
+                if (!empty) {
+                    return 0;
+                }
+                empty->rounds = 0;
+            }
+            cpu->previous = cpu->loaded;
+            cpu->loaded = empty;
+        }
+    }
+
+    cpu->frees++;
+    cpu->loaded->objects[cpu->loaded->rounds++] = obj;
+    return 1;
+}
+
+// Alignment above a page skips the magazines for an aligned large run
+static void *kmalloc_common(size_t size, size_t alignment)
+{
+    void *ptr = NULL;
+    if (size && size <= KHEAP_MAX_OBJECT && alignment <= KHEAP_PAGE_SIZE &&
+        kheap_initialized) {
+        struct kmem_cache *cache = &kmem_caches[kheap_size_class(size)];
+        unsigned long flags = disable_interrupts();
+        ptr = kmem_cpu_alloc(cache, &cache->cpu[smp_cpu_id()]);
+        restore_interrupts(flags);
+    }
+    if (!ptr) {
+        unsigned long flags = spin_lock_irqsave(&kheap_lock);
+        ptr = kmalloc_locked(size, alignment);
+        spin_unlock_irqrestore(&kheap_lock, flags);
+    }
+    return ptr;
+}
+
+void *kmalloc(size_t size)
+{
+    void *ptr = kmalloc_common(size, 0);
+    memprof_alloc(MEMPROF_HEAP, ptr, size, (uintptr_t)__builtin_return_address(0));
+    return ptr;
+}
+
+void *kmalloc_aligned(size_t size, size_t alignment)
+{
+    if (alignment & (alignment - 1)) {
+        return NULL;
+    }
+
+    // A class's objects sit at multiples of its size, so a class at least
+    // as large as the alignment honours it
+    void *ptr = kmalloc_common(size && size < alignment ? alignment : size, alignment);
+    memprof_alloc(MEMPROF_HEAP, ptr, size, (uintptr_t)__builtin_return_address(0));
+    return ptr;
+}
+
+void kfree(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    // Before the object can be handed out again
+    memprof_free(MEMPROF_HEAP, ptr);
+
+    struct kmem_slab *slab = memory_page_owner((void *)((uint64_t)ptr & KHEAP_PAGE_MASK));
+    if (slab && slab->cache) {
+        struct kmem_cache *cache = slab->cache;
+        unsigned long flags = disable_interrupts();
+        int cached = kmem_cpu_free(cache, &cache->cpu[smp_cpu_id()], ptr);
+        restore_interrupts(flags);
+        if (cached) {
+            return;
+        }
+    }
+
+    unsigned long flags = spin_lock_irqsave(&kheap_lock);
+    kfree_locked(ptr);
+    spin_unlock_irqrestore(&kheap_lock, flags);
+}
+
+/**
+ * Get kernel heap statistics
+ */
+void kheap_get_stats(struct kheap_stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    if (!kheap_initialized) {
+        kheap_init();
+    }
+
+    uint64_t bytes_in_use = 0;
+    uint64_t pages_held = 0;
+
+    // Field-by-field copies keep GCC from emitting SIMD struct moves. Other
+    // CPUs' magazines are read as they change, so the figures may be a
+    // few objects apart; magazines are never freed, so reading is safe.
+    for (int i = 0; i < KHEAP_NUM_CLASSES; i++) {
+        struct kmem_cache *cache = &kmem_caches[i];
+        struct kheap_cache_stats *out = &stats->caches[i];
+
+        uint64_t allocs = cache->allocs;
+        uint64_t frees = cache->frees;
+        uint32_t cached = cache->depot_full_count * cache->mag_rounds;
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            const struct kmem_cpu_cache *cc = &cache->cpu[cpu];
+            const struct kmem_magazine *loaded = cc->loaded;
+            const struct kmem_magazine *previous = cc->previous;
+            cached += (loaded ? loaded->rounds : 0) + (previous ? previous->rounds : 0);
+            allocs += cc->allocs;
+            frees += cc->frees;
+        }
+        uint32_t in_use = cache->objects_in_use > cached ? cache->objects_in_use - cached : 0;
+
+        out->object_size = cache->object_size;
+        out->slabs = cache->slabs;
+        out->objects_in_use = in_use;
+        out->objects_cached = cached;
+        out->objects_total = cache->slabs * cache->objects_per_slab;
+        out->allocs = allocs;
+        out->frees = frees;
+
+        bytes_in_use += (uint64_t)in_use * cache->object_size;
+        pages_held += cache->slabs;
+    }
+
+    stats->num_caches = KHEAP_NUM_CLASSES;
+    stats->large_allocs = large_allocs;
+    stats->large_pages = large_pages;
+    stats->large_total_allocs = large_total_allocs;
+    stats->large_total_frees = large_total_frees;
+    stats->failed_allocs = failed_allocs;
+    stats->bytes_in_use = bytes_in_use + large_pages * KHEAP_PAGE_SIZE;
+    stats->pages_held = pages_held + large_pages;
+}
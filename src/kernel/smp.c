@@ -0,0 +1,88 @@
+/*
+ * MiniOS Multiprocessor Support
+ * Secondary CPU bring-up shared by all architectures
+ *
+ * The boot CPU is CPU 0. smp_init() installs its per-CPU pointer and asks
+ * the architecture code to start every other core it can find; each one
+ * lands in smp_secondary_main() on its own stack, sets up its scheduler
+ * and then sits in the scheduler's idle loop, pulling work from the busier
+ * run queues. Secondaries keep their interrupts masked for now, so they
+ * only ever run tasks they steal.
+ */
+
+#include "smp.h"
+#include "process.h"
+#include "kernel.h"
+#include "vdso.h"
+#include "perf.h"
+
+struct cpu_info smp_cpus[MAX_CPUS] __attribute__((section(".data")));
+volatile int smp_active __attribute__((section(".data"))) = 0;
+
+_Static_assert(__builtin_offsetof(struct cpu_info, stack_top) == CPU_INFO_STACK_TOP,
+               "secondary entry code reads cpu_info.stack_top at a fixed offset");
+_Static_assert(__builtin_offsetof(struct cpu_info, id) == CPU_INFO_ID,
+               "system call fast paths read cpu_info.id at a fixed offset");
+
+uint32_t smp_num_cpus(void)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (smp_cpus[i].online) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int smp_init(void)
+{
+    char str[16];
+
+    early_print("Initializing SMP...\n");
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        smp_cpus[i].self = &smp_cpus[i];
+        smp_cpus[i].id = i;
+    }
+
+    struct cpu_info *boot = &smp_cpus[0];
+    boot->hw_id = arch_smp_boot_cpu_hw_id();
+    arch_smp_set_this_cpu(boot);
+    boot->online = 1;
+    smp_active = 1;
+
+    int started = arch_smp_boot_secondaries();
+    if (started < 0) {
+        early_print("SMP: no secondary CPUs started\n");
+    }
+
+    early_print("SMP: ");
+    early_print(itoa((int)smp_num_cpus(), str, 10));
+    early_print(" CPU(s) online\n");
+    return (int)smp_num_cpus();
+}
+
+/**
+ * C entry point of a secondary CPU, called on its own stack by the
+ * architecture's entry code
+ */
+void smp_secondary_main(struct cpu_info *cpu)
+{
+    char str[16];
+
+    arch_smp_secondary_init(cpu);
+    aspace_cpu_init();
+    vdso_cpu_init();
+    perf_cpu_init();
+    scheduler_cpu_init(cpu->id);
+
+    early_print("SMP: CPU ");
+    early_print(itoa((int)cpu->id, str, 10));
+    early_print(" online\n");
+
+    // Seen by the boot CPU waiting in arch_smp_boot_secondaries()
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+
+    scheduler_idle_loop();
+}
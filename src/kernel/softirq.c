@@ -0,0 +1,162 @@
+/*
+ * MiniOS Deferred Interrupt Work
+ *
+ * Each CPU keeps a bitmap of raised softirqs. scheduler_irq_exit() runs
+ * them after the controller has been acknowledged, with interrupts
+ * enabled, so a long timer callback or block completion no longer holds
+ * off every other interrupt. An interrupt taken while softirqs run only
+ * raises more bits: the running loop picks them up, for at most
+ * SOFTIRQ_MAX_RESTART rounds, and no task switch happens until it is
+ * done, so the per-CPU state cannot move with a task.
+ *
+ * Tasklets are queued per CPU and run from SOFTIRQ_TASKLET. The SCHED
+ * bit keeps a tasklet on one queue at a time and the RUN bit keeps it
+ * from running on two CPUs at once; one found running elsewhere is
+ * queued again for the next round.
+ */
+
+#include "softirq.h"
+#include "interrupt.h"
+#include "kernel.h"
+#include "smp.h"
+
+static void tasklet_softirq(void);
+
+// Tasklets are always available, before any driver probes
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT] = {
+    [SOFTIRQ_TASKLET] = tasklet_softirq,
+};
+
+// Per-CPU state, only touched by its own CPU with interrupts masked
+static volatile uint32_t softirq_pending[MAX_CPUS];
+static volatile uint32_t softirq_active[MAX_CPUS];
+static struct tasklet *tasklet_head[MAX_CPUS];
+static struct tasklet *tasklet_tail[MAX_CPUS];
+
+void open_softirq(uint32_t nr, softirq_handler_t handler)
+{
+    if (nr < SOFTIRQ_COUNT) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+void raise_softirq(uint32_t nr)
+{
+    if (nr >= SOFTIRQ_COUNT) {
+        return;
+    }
+    unsigned long flags = disable_interrupts();
+    softirq_pending[smp_cpu_id()] |= 1u << nr;
+    restore_interrupts(flags);
+}
+
+// Run raised softirqs on cpu (interrupts masked on entry and on return)
+static void softirq_run(uint32_t cpu)
+{
+    softirq_active[cpu] = 1;
+
+    for (int round = 0; round < SOFTIRQ_MAX_RESTART; round++) {
+        uint32_t pending = softirq_pending[cpu];
+        if (!pending) {
+            break;
+        }
+        softirq_pending[cpu] = 0;
+
+        enable_interrupts();
+        while (pending) {
+            uint32_t nr = (uint32_t)__builtin_ctz(pending);
+            pending &= pending - 1;
+            if (softirq_handlers[nr]) {
+                softirq_handlers[nr]();
+            }
+        }
+        disable_interrupts();
+    }
+
+    softirq_active[cpu] = 0;
+}
+
+int softirq_irq_exit(void)
+{
+    uint32_t cpu = smp_cpu_id();
+    if (softirq_active[cpu]) {
+        return 1;  // The interrupted loop runs whatever this raised
+    }
+    if (softirq_pending[cpu]) {
+        softirq_run(cpu);
+    }
+    return 0;
+}
+
+void softirq_run_pending(void)
+{
+    unsigned long flags = disable_interrupts();
+    uint32_t cpu = smp_cpu_id();
+    if (!softirq_active[cpu] && softirq_pending[cpu]) {
+        softirq_run(cpu);
+    }
+    restore_interrupts(flags);
+}
+
+// Append t to this CPU's queue (interrupts masked)
+static void tasklet_enqueue(struct tasklet *t)
+{
+    uint32_t cpu = smp_cpu_id();
+    t->next = NULL;
+    if (tasklet_tail[cpu]) {
+        tasklet_tail[cpu]->next = t;
+    } else {
+        tasklet_head[cpu] = t;
+    }
+    tasklet_tail[cpu] = t;
+    softirq_pending[cpu] |= 1u << SOFTIRQ_TASKLET;
+}
+
+void tasklet_init(struct tasklet *t, void (*func)(void *data), void *data)
+{
+    t->next = NULL;
+    t->func = func;
+    t->data = data;
+    t->state = 0;
+}
+
+void tasklet_schedule(struct tasklet *t)
+{
+    unsigned long flags = disable_interrupts();
+    if (!(__atomic_fetch_or(&t->state, TASKLET_STATE_SCHED, __ATOMIC_ACQ_REL) &
+          TASKLET_STATE_SCHED)) {
+        tasklet_enqueue(t);
+    }
+    restore_interrupts(flags);
+}
+
+static void tasklet_softirq(void)
+{
+    uint32_t cpu = smp_cpu_id();
+
+    unsigned long flags = disable_interrupts();
+    struct tasklet *list = tasklet_head[cpu];
+    tasklet_head[cpu] = NULL;
+    tasklet_tail[cpu] = NULL;
+    restore_interrupts(flags);
+
+    while (list) {
+        struct tasklet *t = list;
+        list = list->next;
+
+        if (__atomic_fetch_or(&t->state, TASKLET_STATE_RUN, __ATOMIC_ACQUIRE) &
+            TASKLET_STATE_RUN) {
+            // Still running on another CPU: try again next round
+            flags = disable_interrupts();
+            tasklet_enqueue(t);
+            restore_interrupts(flags);
+            continue;
+        }
+
+        // Clear SCHED first so the function can queue itself again
+        __atomic_fetch_and(&t->state, ~TASKLET_STATE_SCHED, __ATOMIC_ACQ_REL);
+        t->func(t->data);
+        __atomic_fetch_and(&t->state, ~TASKLET_STATE_RUN, __ATOMIC_RELEASE);
+    }
+}
+
@@ -6,17 +6,64 @@
 #include "kernel.h"
 #include "string.h"
 
+// Word accesses that may alias any type; string_uword_t may be unaligned
+typedef uint64_t __attribute__((may_alias)) string_word_t;
+typedef uint64_t __attribute__((may_alias, aligned(1))) string_uword_t;
+
+#define STRING_WORD         sizeof(uint64_t)
+#define STRING_ONES         0x0101010101010101ULL
+#define STRING_HIGHS        0x8080808080808080ULL
+
+/*
+ * The string scans read aligned words once the pointer is aligned. An
+ * aligned word never crosses a page, so reading past the terminator in
+ * it is safe. A word holds a zero byte exactly when this is nonzero;
+ * a byte equal to c is a zero byte of w ^ (c * STRING_ONES).
+ */
+static inline uint64_t string_has_zero(uint64_t w)
+{
+    return (w - STRING_ONES) & ~w & STRING_HIGHS;
+}
+
+static inline int string_aligned(const void *p)
+{
+    return ((uintptr_t)p & (STRING_WORD - 1)) == 0;
+}
+
 int strlen(const char *str)
 {
-    int len = 0;
     if (!str) return 0;
-    while (str[len]) len++;
-    return len;
+    const char *p = str;
+
+    while (!string_aligned(p)) {
+        if (!*p) return (int)(p - str);
+        p++;
+    }
+    while (!string_has_zero(*(const string_word_t*)p)) {
+        p += STRING_WORD;
+    }
+    while (*p) p++;
+    return (int)(p - str);
 }
 
 int strcmp(const char *s1, const char *s2)
 {
     if (!s1 || !s2) return -1;
+
+    // Mutually aligned: skip equal words holding no terminator
+    if (string_aligned((const void *)((uintptr_t)s1 ^ (uintptr_t)s2))) {
+        while (!string_aligned(s1) && *s1 && *s1 == *s2) {
+            s1++;
+            s2++;
+        }
+        while (string_aligned(s1)) {
+            uint64_t w = *(const string_word_t*)s1;
+            if (w != *(const string_word_t*)s2 || string_has_zero(w)) break;
+            s1 += STRING_WORD;
+            s2 += STRING_WORD;
+        }
+    }
+
     while (*s1 && (*s1 == *s2)) {
         s1++;
         s2++;
@@ -47,8 +94,8 @@ char *strncpy(char *dest, const char *src, size_t n)
 {
     if (!dest || !src) return dest;
     char *orig_dest = dest;
-    while (n-- && (*dest++ = *src++));
-    while (n-- > 0) *dest++ = '\0';
+    for (; n && *src; n--) *dest++ = *src++;
+    for (; n; n--) *dest++ = '\0';
     return orig_dest;
 }
 
@@ -64,11 +111,27 @@ char *strcat(char *dest, const char *src)
 char *strchr(const char *str, int c)
 {
     if (!str) return NULL;
+    char target = (char)c;
+
+    while (!string_aligned(str)) {
+        if (*str == target) return (char*)str;
+        if (!*str) return NULL;
+        str++;
+    }
+
+    // Skip words with neither the terminator nor target in them
+    uint64_t pattern = (unsigned char)target * STRING_ONES;
+    for (;;) {
+        uint64_t w = *(const string_word_t*)str;
+        if (string_has_zero(w) | string_has_zero(w ^ pattern)) break;
+        str += STRING_WORD;
+    }
+
     while (*str) {
-        if (*str == c) return (char*)str;
+        if (*str == target) return (char*)str;
         str++;
     }
-    return (c == '\0') ? (char*)str : NULL;
+    return (target == '\0') ? (char*)str : NULL;
 }
 
 char *strrchr(const char *str, int c)
@@ -82,10 +145,156 @@ char *strrchr(const char *str, int c)
     return (c == '\0') ? (char*)str : (char*)last;
 }
 
+/*
+ * memset/memcpy/memcmp move 8 bytes at a time once the destination is
+ * aligned, with byte loops for the head and tail. ARM64 copies 64-byte
+ * blocks with ldp/stp and zeroes whole cache blocks with DC ZVA; x86-64
+ * hands large runs to rep movsb/stosb when the CPU has ERMS. Only general
+ * registers are used: FP/SIMD state is switched lazily, so a kernel copy
+ * through the vector registers would clobber a task's live values.
+ */
+
+#define STRING_WORD_MIN     16      // Below this, bytes are cheaper
+#define STRING_REP_MIN      128     // x86-64: rep pays off from here
+
+#ifdef ARCH_ARM64
+
+#define SCTLR_M             (1UL << 0)
+#define SCTLR_C             (1UL << 2)
+#define DCZID_DZP           (1UL << 4)
+#define DCZID_BS_MASK       0xfUL
+
+// Normal cacheable memory: unaligned accesses and DC ZVA are allowed.
+// Before the MMU is on, everything is Device memory and neither is.
+static inline int string_memory_cached(void)
+{
+    uint64_t sctlr;
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    return (sctlr & (SCTLR_M | SCTLR_C)) == (SCTLR_M | SCTLR_C);
+}
+
+// Bytes zeroed by one DC ZVA, 0 if it is prohibited
+static inline size_t string_zva_size(void)
+{
+    uint64_t dczid;
+    __asm__ volatile("mrs %0, dczid_el0" : "=r"(dczid));
+    return (dczid & DCZID_DZP) ? 0 : 4UL << (dczid & DCZID_BS_MASK);
+}
+
+// Copy n & ~63 bytes of 8-byte aligned data, returning the bytes left
+static inline size_t string_copy_blocks(unsigned char **dp, const unsigned char **sp, size_t n)
+{
+    unsigned char *d = *dp;
+    const unsigned char *s = *sp;
+    size_t blocks = n / 64;
+
+    if (blocks) {
+        __asm__ volatile(
+            "1:\n"
+            "ldp x3, x4, [%1]\n"
+            "ldp x5, x6, [%1, #16]\n"
+            "ldp x7, x8, [%1, #32]\n"
+            "ldp x9, x10, [%1, #48]\n"
+            "add %1, %1, #64\n"
+            "stp x3, x4, [%0]\n"
+            "stp x5, x6, [%0, #16]\n"
+            "stp x7, x8, [%0, #32]\n"
+            "stp x9, x10, [%0, #48]\n"
+            "add %0, %0, #64\n"
+            "subs %2, %2, #1\n"
+            "b.ne 1b\n"
+            : "+r"(d), "+r"(s), "+r"(blocks)
+            :
+            : "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "cc", "memory");
+    }
+
+    *dp = d;
+    *sp = s;
+    return n & 63;
+}
+
+#elif defined(ARCH_X86_64)
+
+// Enhanced rep movsb/stosb: CPUID.(EAX=7,ECX=0):EBX bit 9
+#define CPUID_7_EBX_ERMS    (1U << 9)
+#define STRING_USE_REP
+
+static int string_erms = -1;
+
+static int string_has_erms(void)
+{
+    if (string_erms < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+        int erms = 0;
+        if (eax >= 7) {
+            __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+            erms = (ebx & CPUID_7_EBX_ERMS) != 0;
+        }
+        string_erms = erms;
+    }
+    return string_erms;
+}
+
+#endif
+
+// Whether word accesses may be used between a and b
+static inline int string_words_ok(const void *a, const void *b)
+{
+#ifdef ARCH_ARM64
+    // Mutually aligned pointers never need an unaligned access
+    return (((uintptr_t)a ^ (uintptr_t)b) & (STRING_WORD - 1)) == 0 || string_memory_cached();
+#else
+    (void)a;
+    (void)b;
+    return 1;
+#endif
+}
+
 void *memset(void *s, int c, size_t n)
 {
     if (!s) return s;
     unsigned char *p = (unsigned char*)s;
+
+#ifdef STRING_USE_REP
+    if (n >= STRING_REP_MIN && string_has_erms()) {
+        __asm__ volatile("rep stosb" : "+D"(p), "+c"(n) : "a"(c) : "memory");
+        return s;
+    }
+#endif
+
+    if (n >= STRING_WORD_MIN) {
+        uint64_t pattern = (unsigned char)c * 0x0101010101010101ULL;
+
+        while ((uintptr_t)p & (STRING_WORD - 1)) {
+            *p++ = (unsigned char)c;
+            n--;
+        }
+
+#ifdef ARCH_ARM64
+        // Zero whole cache blocks without reading them in first
+        size_t zva = c == 0 && n >= 256 && string_memory_cached() ? string_zva_size() : 0;
+        if (zva && n >= 2 * zva) {
+            while ((uintptr_t)p & (zva - 1)) {
+                *(string_word_t*)p = 0;
+                p += STRING_WORD;
+                n -= STRING_WORD;
+            }
+            while (n >= zva) {
+                __asm__ volatile("dc zva, %0" : : "r"(p) : "memory");
+                p += zva;
+                n -= zva;
+            }
+        }
+#endif
+
+        while (n >= STRING_WORD) {
+            *(string_word_t*)p = pattern;
+            p += STRING_WORD;
+            n -= STRING_WORD;
+        }
+    }
+
     while (n--) *p++ = (unsigned char)c;
     return s;
 }
@@ -95,6 +304,40 @@ void *memcpy(void *dest, const void *src, size_t n)
     if (!dest || !src) return dest;
     unsigned char *d = (unsigned char*)dest;
     const unsigned char *s = (const unsigned char*)src;
+
+#ifdef STRING_USE_REP
+    if (n >= STRING_REP_MIN && string_has_erms()) {
+        __asm__ volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+        return dest;
+    }
+#endif
+
+    if (n >= STRING_WORD_MIN && string_words_ok(d, s)) {
+        while ((uintptr_t)d & (STRING_WORD - 1)) {
+            *d++ = *s++;
+            n--;
+        }
+
+        if (((uintptr_t)s & (STRING_WORD - 1)) == 0) {
+#ifdef ARCH_ARM64
+            n = string_copy_blocks(&d, &s, n);
+#endif
+            while (n >= STRING_WORD) {
+                *(string_word_t*)d = *(const string_word_t*)s;
+                d += STRING_WORD;
+                s += STRING_WORD;
+                n -= STRING_WORD;
+            }
+        } else {
+            while (n >= STRING_WORD) {
+                *(string_word_t*)d = *(const string_uword_t*)s;
+                d += STRING_WORD;
+                s += STRING_WORD;
+                n -= STRING_WORD;
+            }
+        }
+    }
+
     while (n--) *d++ = *s++;
     return dest;
 }
@@ -104,6 +347,23 @@ int memcmp(const void *s1, const void *s2, size_t n)
     if (!s1 || !s2) return 0;
     const unsigned char *p1 = (const unsigned char*)s1;
     const unsigned char *p2 = (const unsigned char*)s2;
+
+    // Skip equal words; the byte loop below finds the first difference
+    if (n >= STRING_WORD_MIN && string_words_ok(p1, p2)) {
+        while ((uintptr_t)p1 & (STRING_WORD - 1)) {
+            if (*p1 != *p2) return *p1 - *p2;
+            p1++;
+            p2++;
+            n--;
+        }
+        while (n >= STRING_WORD &&
+               *(const string_word_t*)p1 == *(const string_uword_t*)p2) {
+            p1 += STRING_WORD;
+            p2 += STRING_WORD;
+            n -= STRING_WORD;
+        }
+    }
+
     while (n--) {
         if (*p1 != *p2) return *p1 - *p2;
         p1++;
@@ -119,9 +379,10 @@ char *strstr(const char *haystack, const char *needle)
     // Empty needle matches at beginning
     if (*needle == '\0') return (char *)haystack;
     
-    while (*haystack) {
-        const char *h = haystack;
-        const char *n = needle;
+    // Jump between occurrences of the first character
+    while ((haystack = strchr(haystack, *needle)) != NULL) {
+        const char *h = haystack + 1;
+        const char *n = needle + 1;
         
         // Compare characters
         while (*h && *n && *h == *n) {
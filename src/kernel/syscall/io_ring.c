@@ -0,0 +1,231 @@
+/**
+ * Batched I/O Rings
+ *
+ * Each task may set up one submission/completion ring pair in pages it
+ * shares with the kernel (io_ring.h). SYSCALL_IO_RING_ENTER runs queued
+ * submissions in order through the same vfs_*() calls the single-shot
+ * system calls use and posts one completion each, so a directory walk or
+ * a file copy costs a trap per ring-full of operations instead of one per
+ * call. Entries can take their descriptor or length from the entry before
+ * them, which lets an open, its reads and writes and the close go in a
+ * single batch.
+ *
+ * The kernel keeps its own copy of the geometry and its own queue
+ * indices, so a program scribbling on the shared header can only confuse
+ * itself. Submission entries are copied out before they are used.
+ */
+
+#include "syscall.h"
+#include "io_ring.h"
+#include "process.h"
+#include "memory.h"
+#include "kernel.h"
+#include "vfs.h"
+
+_Static_assert(sizeof(struct io_ring_dirent) == sizeof(struct dirent),
+               "io_ring_dirent must match struct dirent");
+_Static_assert(sizeof(struct io_ring_dirent_plus) == sizeof(struct dirent_plus),
+               "io_ring_dirent_plus must match struct dirent_plus");
+_Static_assert(IO_RING_NAME_MAX == VFS_MAX_NAME, "IO_RING_NAME_MAX mismatch");
+
+// Kernel-private state of a task's ring pair
+struct io_ring_ctx {
+    struct io_ring *ring;               // Shared header, queues follow
+    struct io_ring_sqe *sqes;
+    struct io_ring_cqe *cqes;
+    uint32_t entries;
+    uint32_t sq_head;                   // Authoritative copies of the
+    uint32_t cq_tail;                   // indices the kernel advances
+    size_t pages;
+};
+
+#define IO_RING_ALIGN(x)    (((x) + 63) & ~(size_t)63)
+
+static void io_ring_free(struct io_ring_ctx *ctx) {
+    memory_free_pages(ctx->ring, ctx->pages);
+    kfree(ctx);
+}
+
+long syscall_io_ring_setup(long entries, long unused1, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    struct task *current = scheduler_get_current_task();
+    if (!current) {
+        return SYSCALL_EPERM;
+    }
+    if (entries <= 0 || entries > IO_RING_MAX_ENTRIES || (entries & (entries - 1))) {
+        return SYSCALL_EINVAL;
+    }
+    if (current->io_ring) {
+        return SYSCALL_EPERM;  // One ring pair per task
+    }
+
+    size_t sqe_offset = IO_RING_ALIGN(sizeof(struct io_ring));
+    size_t cqe_offset = IO_RING_ALIGN(sqe_offset + (size_t)entries * sizeof(struct io_ring_sqe));
+    size_t size = cqe_offset + (size_t)entries * sizeof(struct io_ring_cqe);
+
+    struct io_ring_ctx *ctx = kmalloc(sizeof(struct io_ring_ctx));
+    if (!ctx) {
+        return SYSCALL_ENOMEM;
+    }
+    ctx->pages = (size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+    ctx->ring = memory_alloc_pages(ctx->pages);
+    if (!ctx->ring) {
+        kfree(ctx);
+        return SYSCALL_ENOMEM;
+    }
+    memset(ctx->ring, 0, ctx->pages * PAGE_SIZE_4K);
+
+    ctx->entries = (uint32_t)entries;
+    ctx->sq_head = 0;
+    ctx->cq_tail = 0;
+    ctx->sqes = (struct io_ring_sqe *)((uint8_t *)ctx->ring + sqe_offset);
+    ctx->cqes = (struct io_ring_cqe *)((uint8_t *)ctx->ring + cqe_offset);
+
+    ctx->ring->entries = ctx->entries;
+    ctx->ring->mask = ctx->entries - 1;
+    ctx->ring->sqe_offset = (uint32_t)sqe_offset;
+    ctx->ring->cqe_offset = (uint32_t)cqe_offset;
+
+    current->io_ring = ctx;
+    return (long)ctx->ring;
+}
+
+// Run one submission and return its result
+static int64_t io_ring_execute(const struct io_ring_sqe *sqe, int64_t prev) {
+    int32_t fd = sqe->fd;
+    uint32_t len = sqe->len;
+
+    if (sqe->flags & (IO_RING_SQE_FD_PREV | IO_RING_SQE_LEN_PREV)) {
+        if (prev < 0) {
+            return prev;
+        }
+        if (sqe->flags & IO_RING_SQE_FD_PREV) fd = (int32_t)prev;
+        if (sqe->flags & IO_RING_SQE_LEN_PREV) len = (uint32_t)prev;
+    }
+
+    switch (sqe->opcode) {
+        case IO_RING_OP_NOP:
+            return 0;
+
+        case IO_RING_OP_OPEN:
+            if (!sqe->addr) return VFS_EINVAL;
+            return vfs_open((const char *)sqe->addr, (int)sqe->op_flags, (int)len);
+
+        case IO_RING_OP_READ:
+            if (!sqe->addr) return VFS_EINVAL;
+            if (len == 0) return 0;
+            return vfs_read(fd, (void *)sqe->addr, len);
+
+        case IO_RING_OP_WRITE:
+            if (!sqe->addr) return VFS_EINVAL;
+            if (len == 0) return 0;  // e.g. the length of a read at end of file
+            return vfs_write(fd, (const void *)sqe->addr, len);
+
+        case IO_RING_OP_CLOSE:
+            return vfs_close(fd);
+
+        case IO_RING_OP_STAT: {
+            if (!sqe->addr || !sqe->addr2) return VFS_EINVAL;
+
+            struct inode inode;
+            int result = vfs_stat((const char *)sqe->addr, &inode);
+            if (result < 0) return result;
+
+            struct io_ring_stat *st = (struct io_ring_stat *)sqe->addr2;
+            st->ino = inode.ino;
+            st->mode = inode.mode;
+            st->size = inode.size;
+            st->blocks = inode.blocks;
+            st->created_time = inode.created_time;
+            st->modified_time = inode.modified_time;
+            st->accessed_time = inode.accessed_time;
+            return result;
+        }
+
+        case IO_RING_OP_READDIR:
+            if (!sqe->addr) return VFS_EINVAL;
+            return vfs_readdir(fd, (struct dirent *)sqe->addr, len);
+
+        case IO_RING_OP_READDIR_PLUS:
+            if (!sqe->addr) return VFS_EINVAL;
+            return vfs_readdir_plus(fd, (struct dirent_plus *)sqe->addr, len);
+
+        default:
+            return VFS_EINVAL;
+    }
+}
+
+/**
+ * Run up to to_submit queued entries (all of them if 0), stopping early
+ * when the completion queue is full. Returns how many were consumed.
+ */
+long syscall_io_ring_enter(long to_submit, long unused1, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    struct task *current = scheduler_get_current_task();
+    struct io_ring_ctx *ctx = current ? current->io_ring : NULL;
+    if (!ctx) {
+        return SYSCALL_EINVAL;
+    }
+    if (to_submit < 0) {
+        return SYSCALL_EINVAL;
+    }
+
+    struct io_ring *ring = ctx->ring;
+    uint32_t mask = ctx->entries - 1;
+    uint32_t sq_tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t pending = sq_tail - ctx->sq_head;
+    if (pending > ctx->entries) {
+        return SYSCALL_EINVAL;  // Tail moved past entries we have not run
+    }
+    if (to_submit == 0 || (uint32_t)to_submit > pending) {
+        to_submit = pending;
+    }
+
+    int64_t prev = VFS_EINVAL;  // Nothing before the first entry to chain from
+    long done = 0;
+    while (done < to_submit) {
+        uint32_t cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+        if (ctx->cq_tail - cq_head >= ctx->entries) {
+            break;  // Completions not reaped yet
+        }
+
+        struct io_ring_sqe sqe = ctx->sqes[ctx->sq_head & mask];
+        prev = io_ring_execute(&sqe, prev);
+
+        struct io_ring_cqe *cqe = &ctx->cqes[ctx->cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->result = prev;
+        ctx->sq_head++;
+        ctx->cq_tail++;
+
+        // Publish the completion before the index that covers it
+        __atomic_store_n(&ring->cq_tail, ctx->cq_tail, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->sq_head, ctx->sq_head, __ATOMIC_RELEASE);
+        done++;
+    }
+
+    return done;
+}
+
+long syscall_io_ring_destroy(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused0; (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    struct task *current = scheduler_get_current_task();
+    if (!current || !current->io_ring) {
+        return SYSCALL_EINVAL;
+    }
+
+    io_ring_free(current->io_ring);
+    current->io_ring = NULL;
+    return SYSCALL_SUCCESS;
+}
+
+// Free a task's rings when it is reaped
+void io_ring_release_task(struct task *task) {
+    if (task->io_ring) {
+        io_ring_free(task->io_ring);
+        task->io_ring = NULL;
+    }
+}
@@ -0,0 +1,80 @@
+/**
+ * Memory Mapping System Calls
+ *
+ * SYSCALL_MMAP maps zeroed memory or a file into the caller's address
+ * space and SYSCALL_MUNMAP takes any range of it away again (vm.c does
+ * the work). File mappings fault their pages in from the page cache, so
+ * a program can walk a large file or run a loaded image without copying
+ * it through read() into a buffer of its own.
+ */
+
+#include "syscall.h"
+#include "mmap.h"
+#include "process.h"
+#include "memory.h"
+#include "kernel.h"
+#include "vfs.h"
+
+static struct address_space *syscall_current_aspace(void) {
+    struct task *current = scheduler_get_current_task();
+    return current ? current->aspace : NULL;
+}
+
+// mmap(addr, length, prot, flags, fd, offset): the mapping's address
+long syscall_mmap(long addr, long length, long prot, long flags, long fd, long offset) {
+    struct address_space *as = syscall_current_aspace();
+    if (!as) {
+        return SYSCALL_EPERM;  // Kernel tasks have nothing to map into
+    }
+
+    int sharing = (int)(flags & (MAP_SHARED | MAP_PRIVATE));
+    if (length <= 0 || offset < 0 || (offset & (PAGE_SIZE_4K - 1)) ||
+        (sharing != MAP_SHARED && sharing != MAP_PRIVATE)) {
+        return SYSCALL_EINVAL;
+    }
+
+    uint32_t attrs = MEMORY_CACHEABLE;
+    if (prot & PROT_READ)  attrs |= MEMORY_READABLE;
+    if (prot & PROT_WRITE) attrs |= MEMORY_WRITABLE | MEMORY_READABLE;
+    if (prot & PROT_EXEC)  attrs |= MEMORY_EXECUTABLE | MEMORY_READABLE;
+
+    uint32_t map_flags = 0;
+    if (sharing == MAP_SHARED) map_flags |= VM_MAP_SHARED;
+    if (flags & MAP_FIXED)     map_flags |= VM_MAP_FIXED;
+
+    struct file *file = NULL;
+    if (!(flags & MAP_ANONYMOUS)) {
+        file = vfs_file_get((int)fd);
+        if (!file) {
+            return SYSCALL_EINVAL;
+        }
+        // The file must be readable, and writable for a writable shared mapping
+        int access = file->flags & (VFS_O_WRONLY | VFS_O_RDWR);
+        if (access == VFS_O_WRONLY ||
+            (sharing == MAP_SHARED && (prot & PROT_WRITE) && access != VFS_O_RDWR)) {
+            vfs_file_put(file);
+            return SYSCALL_EPERM;
+        }
+    }
+
+    uint64_t start = vm_map(as, (uint64_t)addr, (size_t)length, attrs, map_flags,
+                            file, file ? (uint64_t)offset : 0);
+    if (!start) {
+        vfs_file_put(file);
+        return SYSCALL_ENOMEM;
+    }
+    return (long)start;
+}
+
+long syscall_munmap(long addr, long length, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    struct address_space *as = syscall_current_aspace();
+    if (!as) {
+        return SYSCALL_EPERM;
+    }
+    if (length <= 0 || vm_unmap(as, (uint64_t)addr, (size_t)length) < 0) {
+        return SYSCALL_EINVAL;
+    }
+    return SYSCALL_SUCCESS;
+}
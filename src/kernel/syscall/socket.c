@@ -0,0 +1,71 @@
+/**
+ * Socket System Calls
+ *
+ * Thin wrappers over the sys_* socket API (network.h). Errors are the
+ * NET_* codes, which match the VFS codes where the two overlap, so a
+ * socket read through SYSCALL_READ fails the same way as through
+ * SYSCALL_RECVFROM.
+ */
+
+#include "syscall.h"
+#include "network.h"
+#include "kernel.h"
+
+// socket(domain, type, protocol): the new descriptor
+long syscall_socket(long domain, long type, long protocol, long unused3, long unused4, long unused5) {
+    (void)unused3; (void)unused4; (void)unused5;
+    return sys_socket((int)domain, (int)type, (int)protocol);
+}
+
+long syscall_bind(long fd, long addr_ptr, long addrlen, long unused3, long unused4, long unused5) {
+    (void)unused3; (void)unused4; (void)unused5;
+
+    if (addr_ptr == 0) {
+        return SYSCALL_EINVAL;
+    }
+    return sys_bind((int)fd, (const struct sockaddr *)addr_ptr, (socklen_t)addrlen);
+}
+
+long syscall_connect(long fd, long addr_ptr, long addrlen, long unused3, long unused4, long unused5) {
+    (void)unused3; (void)unused4; (void)unused5;
+
+    if (addr_ptr == 0) {
+        return SYSCALL_EINVAL;
+    }
+    return sys_connect((int)fd, (const struct sockaddr *)addr_ptr, (socklen_t)addrlen);
+}
+
+long syscall_listen(long fd, long backlog, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+    return sys_listen((int)fd, (int)backlog);
+}
+
+// accept(fd, addr, addrlen): the connection's descriptor; addr may be NULL
+long syscall_accept(long fd, long addr_ptr, long addrlen_ptr, long unused3, long unused4, long unused5) {
+    (void)unused3; (void)unused4; (void)unused5;
+    return sys_accept((int)fd, (struct sockaddr *)addr_ptr, (socklen_t *)addrlen_ptr);
+}
+
+// sendto(fd, buf, len, flags, addr, addrlen): a NULL addr is send()
+long syscall_sendto(long fd, long buf_ptr, long len, long flags, long addr_ptr, long addrlen) {
+    if (buf_ptr == 0 || len < 0) {
+        return SYSCALL_EINVAL;
+    }
+    if (addr_ptr == 0) {
+        return sys_send((int)fd, (const void *)buf_ptr, (size_t)len, (int)flags);
+    }
+    return sys_sendto((int)fd, (const void *)buf_ptr, (size_t)len, (int)flags,
+                      (const struct sockaddr *)addr_ptr, (socklen_t)addrlen);
+}
+
+// recvfrom(fd, buf, len, flags, addr, addrlen): a NULL addr is recv()
+long syscall_recvfrom(long fd, long buf_ptr, long len, long flags, long addr_ptr, long addrlen_ptr) {
+    if (buf_ptr == 0 || len < 0) {
+        return SYSCALL_EINVAL;
+    }
+    if (addr_ptr == 0) {
+        return sys_recv((int)fd, (void *)buf_ptr, (size_t)len, (int)flags);
+    }
+    return sys_recvfrom((int)fd, (void *)buf_ptr, (size_t)len, (int)flags,
+                        (struct sockaddr *)addr_ptr, (socklen_t *)addrlen_ptr);
+}
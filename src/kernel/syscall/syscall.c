@@ -8,43 +8,78 @@
 #include "process.h"
 #include "timer.h"
 #include "kernel.h"
+#include "klog.h"
+#include "vfs.h"
+#include "interrupt.h"
+#include "trace.h"
+#include "percpu.h"
 
-// System call handler table - moved to .data for x86_64 compatibility
-static syscall_handler_t syscall_table[MAX_SYSCALLS] __attribute__((section(".data"))) = {0};
+// Built-in handlers are bound at compile time; syscall_register() adds more
+syscall_handler_t syscall_table[MAX_SYSCALLS] __attribute__((section(".data"))) = {
+    [SYSCALL_EXIT]      = syscall_exit,
+    [SYSCALL_PRINT]     = syscall_print,
+    [SYSCALL_READ]      = syscall_read,
+    [SYSCALL_WRITE]     = syscall_write,
+    [SYSCALL_GETPID]    = syscall_getpid,
+    [SYSCALL_SLEEP]     = syscall_sleep,
+    [SYSCALL_YIELD]     = syscall_yield,
+    [SYSCALL_GETTIME]   = syscall_gettime,
+    [SYSCALL_FORK]      = syscall_fork,
+    [SYSCALL_IO_RING_SETUP]   = syscall_io_ring_setup,
+    [SYSCALL_IO_RING_ENTER]   = syscall_io_ring_enter,
+    [SYSCALL_IO_RING_DESTROY] = syscall_io_ring_destroy,
+    [SYSCALL_MMAP]      = syscall_mmap,
+    [SYSCALL_MUNMAP]    = syscall_munmap,
+    [SYSCALL_COPY_FILE_RANGE] = syscall_copy_file_range,
+    [SYSCALL_SYSINFO]   = syscall_sysinfo,
+    [SYSCALL_PIPE]      = syscall_pipe,
+    [SYSCALL_SOCKET]    = syscall_socket,
+    [SYSCALL_BIND]      = syscall_bind,
+    [SYSCALL_CONNECT]   = syscall_connect,
+    [SYSCALL_LISTEN]    = syscall_listen,
+    [SYSCALL_ACCEPT]    = syscall_accept,
+    [SYSCALL_SENDTO]    = syscall_sendto,
+    [SYSCALL_RECVFROM]  = syscall_recvfrom,
+    [SYSCALL_EPOLL_CREATE] = syscall_epoll_create,
+    [SYSCALL_EPOLL_CTL] = syscall_epoll_ctl,
+    [SYSCALL_EPOLL_WAIT] = syscall_epoll_wait,
+    [SYSCALL_FALLOCATE] = syscall_fallocate,
+    [SYSCALL_FUTEX]     = syscall_futex,
+    [SYSCALL_THREAD_CREATE] = syscall_thread_create,
+    [SYSCALL_SCHED_SETATTR] = syscall_sched_setattr,
+};
 
-// System call statistics - moved to .data for x86_64 compatibility
-static struct syscall_stats g_syscall_stats __attribute__((section(".data"))) = {0};
+// Calls the entry paths may run without a full context save
+uint64_t syscall_leaf_mask __attribute__((section(".data"))) =
+    SYSCALL_LEAF(SYSCALL_GETPID) | SYSCALL_LEAF(SYSCALL_GETTIME);
+
+// Per-call counts, bumped by the entry fast paths as well as the dispatcher.
+// The fast paths run with interrupts masked and find their CPU's row by
+// shifting its cpu_info id.
+struct syscall_cpu_counts {
+    uint64_t calls[MAX_SYSCALLS];
+};
+DEFINE_PER_CPU(struct syscall_cpu_counts, syscall_counts) __attribute__((section(".data")));
+
+_Static_assert(sizeof(syscall_counts[0]) == 1 << SYSCALL_COUNTS_SHIFT,
+               "entry fast paths index syscall_counts by SYSCALL_COUNTS_SHIFT");
+
+// The rest of the statistics, per CPU as well - in .data for x86_64 compatibility
+struct syscall_cpu_stats {
+    uint64_t errors;
+    uint64_t last_call_time;
+};
+static DEFINE_PER_CPU(struct syscall_cpu_stats, syscall_cpu_stats) __attribute__((section(".data")));
 
 // Tracing enabled flag
 static int g_tracing_enabled = 0;
 
+// Leaf mask parked while tracing, so every call reaches the dispatcher
+static uint64_t g_traced_leaf_mask __attribute__((section(".data"))) = 0;
+static int g_force_dispatch = 0;
+
 // Initialize system call interface
 int syscall_init(void) {
-    early_print("Initializing system call interface...\n");
-    
-    // TEMPORARY: Skip memset as it causes crashes on x86_64
-    // Arrays are already zero-initialized in .data section
-    // Clear handler table
-    // memset(syscall_table, 0, sizeof(syscall_table));
-    
-    // Clear statistics
-    // memset(&g_syscall_stats, 0, sizeof(g_syscall_stats));
-    
-    // TEMPORARY: Skip system call registration for now to move past this point
-    // TODO: Debug why syscall_register causes crashes
-    early_print("Skipping syscall registration (TEMP)\n");
-    /*
-    // Register built-in system calls
-    syscall_register(SYSCALL_EXIT, syscall_exit);
-    syscall_register(SYSCALL_PRINT, syscall_print);
-    syscall_register(SYSCALL_READ, syscall_read);
-    syscall_register(SYSCALL_WRITE, syscall_write);
-    syscall_register(SYSCALL_GETPID, syscall_getpid);
-    syscall_register(SYSCALL_SLEEP, syscall_sleep);
-    syscall_register(SYSCALL_YIELD, syscall_yield);
-    syscall_register(SYSCALL_GETTIME, syscall_gettime);
-    */
-    
     early_print("System call interface initialized\n");
     return 0;
 }
@@ -55,6 +90,9 @@ int syscall_register(uint32_t syscall_num, syscall_handler_t handler) {
         return -1;
     }
     
+    // Only the built-in leaf handlers are known not to block
+    syscall_leaf_mask &= ~SYSCALL_LEAF(syscall_num);
+    g_traced_leaf_mask &= ~SYSCALL_LEAF(syscall_num);
     syscall_table[syscall_num] = handler;
     return 0;
 }
@@ -62,32 +100,27 @@ int syscall_register(uint32_t syscall_num, syscall_handler_t handler) {
 // Unregister system call handler
 void syscall_unregister(uint32_t syscall_num) {
     if (syscall_num < MAX_SYSCALLS) {
+        syscall_leaf_mask &= ~SYSCALL_LEAF(syscall_num);
+        g_traced_leaf_mask &= ~SYSCALL_LEAF(syscall_num);
         syscall_table[syscall_num] = NULL;
     }
 }
 
-// System call dispatcher
+/**
+ * System call dispatcher, for everything the entry fast paths pass on.
+ * Arguments are checked by the handlers themselves.
+ */
 long syscall_dispatch(uint32_t syscall_num, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5) {
-    // Validate system call number
-    if (syscall_num >= MAX_SYSCALLS) {
-        g_syscall_stats.errors++;
-        return SYSCALL_EINVAL;
-    }
-    
-    // Get handler
-    syscall_handler_t handler = syscall_table[syscall_num];
+    syscall_handler_t handler = syscall_num < MAX_SYSCALLS ? syscall_table[syscall_num] : NULL;
     if (!handler) {
-        g_syscall_stats.errors++;
-        return SYSCALL_ENOENT;
+        this_cpu_inc(syscall_cpu_stats, errors);
+        return syscall_num < MAX_SYSCALLS ? SYSCALL_ENOENT : SYSCALL_EINVAL;
     }
     
-    // Update statistics
-    g_syscall_stats.total_calls++;
-    g_syscall_stats.calls_by_num[syscall_num]++;
-    g_syscall_stats.last_call_time = timer_get_ticks();
+    this_cpu_inc(syscall_counts, calls[syscall_num]);
+    this_cpu_ptr(syscall_cpu_stats)->last_call_time = timer_get_ticks();
     
-    // Trace if enabled
-    if (g_tracing_enabled) {
+    if (__builtin_expect(g_tracing_enabled, 0)) {
         struct syscall_context ctx;
         ctx.syscall_num = syscall_num;
         ctx.args[0] = arg0;
@@ -102,43 +135,12 @@ long syscall_dispatch(uint32_t syscall_num, long arg0, long arg1, long arg2, lon
         syscall_trace(&ctx);
     }
     
-    // Call handler
+    trace_event(TRACE_SYSCALL_ENTER, syscall_num, arg0, 0);
     long result = handler(arg0, arg1, arg2, arg3, arg4, arg5);
-    
+    trace_event(TRACE_SYSCALL_EXIT, syscall_num, result, 0);
     return result;
 }
 
-// Validate system call parameters
-int syscall_validate_params(uint32_t syscall_num, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5) {
-    (void)arg1; (void)arg2; (void)arg3; (void)arg4; (void)arg5;  // Unused for now
-    
-    switch (syscall_num) {
-        case SYSCALL_PRINT:
-            // Validate string pointer and length
-            if (arg0 == 0 || arg1 < 0) {
-                return SYSCALL_EINVAL;
-            }
-            break;
-            
-        case SYSCALL_READ:
-        case SYSCALL_WRITE:
-            // Validate file descriptor, buffer, and count
-            if (arg0 < 0 || arg1 == 0 || arg2 < 0) {
-                return SYSCALL_EINVAL;
-            }
-            break;
-            
-        case SYSCALL_SLEEP:
-            // Validate sleep duration
-            if (arg0 < 0) {
-                return SYSCALL_EINVAL;
-            }
-            break;
-    }
-    
-    return SYSCALL_SUCCESS;
-}
-
 // System call tracing
 void syscall_trace(struct syscall_context *ctx) {
     if (!ctx) return;
@@ -161,10 +163,7 @@ void syscall_trace(struct syscall_context *ctx) {
 long syscall_exit(long exit_code, long unused1, long unused2, long unused3, long unused4, long unused5) {
     (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
     
-    early_print("SYSCALL: exit(");
-    char str[16];
-    early_print(itoa((int)exit_code, str, 10));
-    early_print(")\n");
+    klogf(LOG_DEBUG, "SYSCALL: exit(%ld)\n", exit_code);
     
     process_exit((int)exit_code);
     
@@ -182,13 +181,22 @@ long syscall_print(long str_ptr, long len, long unused2, long unused3, long unus
     
     const char *str = (const char *)str_ptr;
     
-    // Simple implementation - just print each character
+    // Program output goes to the console, not the kernel log; copy it
+    // out in NUL-terminated chunks
+    char chunk[128];
+    size_t used = 0;
     for (long i = 0; i < len; i++) {
         if (str[i] == '\0') break;  // Stop at null terminator
-        // In a real implementation, we'd use UART driver here
-        // For now, use early_print character by character
-        char c[2] = {str[i], '\0'};
-        early_print(c);
+        chunk[used++] = str[i];
+        if (used == sizeof(chunk) - 1) {
+            chunk[used] = '\0';
+            klog_console_print(chunk);
+            used = 0;
+        }
+    }
+    if (used > 0) {
+        chunk[used] = '\0';
+        klog_console_print(chunk);
     }
     
     return len;
@@ -196,22 +204,95 @@ long syscall_print(long str_ptr, long len, long unused2, long unused3, long unus
 
 // Read system call (stub)
 long syscall_read(long fd, long buf_ptr, long count, long unused3, long unused4, long unused5) {
-    (void)fd; (void)buf_ptr; (void)count;
     (void)unused3; (void)unused4; (void)unused5;
     
+    if (fd < 0 || buf_ptr == 0 || count < 0) {
+        return SYSCALL_EINVAL;
+    }
+    
     early_print("SYSCALL: read() - not implemented\n");
     return SYSCALL_ENOENT;  // Not implemented
 }
 
 // Write system call (stub)
 long syscall_write(long fd, long buf_ptr, long count, long unused3, long unused4, long unused5) {
-    (void)fd; (void)buf_ptr; (void)count;
     (void)unused3; (void)unused4; (void)unused5;
     
+    if (fd < 0 || buf_ptr == 0 || count < 0) {
+        return SYSCALL_EINVAL;
+    }
+    
     early_print("SYSCALL: write() - not implemented\n");
     return SYSCALL_ENOENT;  // Not implemented
 }
 
+// Copy file data between two descriptors without a user buffer
+long syscall_copy_file_range(long fd_in, long fd_out, long len, long unused3, long unused4, long unused5) {
+    (void)unused3; (void)unused4; (void)unused5;
+
+    if (fd_in < 0 || fd_out < 0 || len <= 0) {
+        return SYSCALL_EINVAL;
+    }
+
+    // Errors are VFS codes, as in ring completions
+    return vfs_copy_file_range((int)fd_in, (int)fd_out, (size_t)len);
+}
+
+// fallocate(fd, mode, offset, len): mode is VFS_FALLOC_* flags
+long syscall_fallocate(long fd, long mode, long offset, long len, long unused4, long unused5) {
+    (void)unused4; (void)unused5;
+
+    if (fd < 0 || offset < 0 || len <= 0) {
+        return SYSCALL_EINVAL;
+    }
+
+    // Errors are VFS codes, as in ring completions
+    return vfs_fallocate((int)fd, (off_t)offset, (off_t)len, (int)mode);
+}
+
+// Create a pipe: fds[0] is the read end, fds[1] the write end
+long syscall_pipe(long fds_ptr, long unused1, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    if (fds_ptr == 0) {
+        return SYSCALL_EINVAL;
+    }
+
+    int fds[2];
+    int result = vfs_pipe(fds);
+    if (result < 0) {
+        return result;
+    }
+
+    int *user_fds = (int *)fds_ptr;
+    user_fds[0] = fds[0];
+    user_fds[1] = fds[1];
+    return SYSCALL_SUCCESS;
+}
+
+// Create an epoll instance: its descriptor
+long syscall_epoll_create(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused0; (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+    return vfs_epoll_create();
+}
+
+// epoll_ctl(epfd, op, fd, event): event may be NULL for EPOLL_CTL_DEL
+long syscall_epoll_ctl(long epfd, long op, long fd, long event_ptr, long unused4, long unused5) {
+    (void)unused4; (void)unused5;
+    return vfs_epoll_ctl((int)epfd, (int)op, (int)fd, (const struct epoll_event *)event_ptr);
+}
+
+// epoll_wait(epfd, events, max, timeout_ms): events stored, 0 on timeout
+long syscall_epoll_wait(long epfd, long events_ptr, long max_events, long timeout_ms, long unused4, long unused5) {
+    (void)unused4; (void)unused5;
+
+    if (events_ptr == 0 || max_events <= 0) {
+        return SYSCALL_EINVAL;
+    }
+    return vfs_epoll_wait((int)epfd, (struct epoll_event *)events_ptr, (int)max_events,
+                          (int)timeout_ms);
+}
+
 // Get process ID system call
 long syscall_getpid(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5) {
     (void)unused0; (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
@@ -224,6 +305,14 @@ long syscall_getpid(long unused0, long unused1, long unused2, long unused3, long
     return 0;  // Kernel PID
 }
 
+// Fork system call: the child's PID in the parent, 0 in the child
+long syscall_fork(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused0; (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+    
+    int pid = process_fork();
+    return pid < 0 ? SYSCALL_ENOMEM : pid;
+}
+
 // Sleep system call
 long syscall_sleep(long ticks, long unused1, long unused2, long unused3, long unused4, long unused5) {
     (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
@@ -232,10 +321,7 @@ long syscall_sleep(long ticks, long unused1, long unused2, long unused3, long un
         return SYSCALL_EINVAL;
     }
     
-    early_print("SYSCALL: sleep(");
-    char str[16];
-    early_print(itoa((int)ticks, str, 10));
-    early_print(")\n");
+    klogf(LOG_DEBUG, "SYSCALL: sleep(%ld)\n", ticks);
     
     process_sleep((uint64_t)ticks);
     
@@ -246,12 +332,43 @@ long syscall_sleep(long ticks, long unused1, long unused2, long unused3, long un
 long syscall_yield(long unused0, long unused1, long unused2, long unused3, long unused4, long unused5) {
     (void)unused0; (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
     
-    early_print("SYSCALL: yield()\n");
+    klog(LOG_DEBUG, "SYSCALL: yield()\n");
     process_yield();
     
     return SYSCALL_SUCCESS;
 }
 
+// sched_setattr(pid, attr): pid 0 for the caller
+long syscall_sched_setattr(long pid, long attr_ptr, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    if (pid < 0 || !attr_ptr) {
+        return SYSCALL_EINVAL;
+    }
+    struct sched_attr attr;
+    memcpy(&attr, (const void *)attr_ptr, sizeof(attr));
+
+    struct task *task = pid ? task_get_by_pid((uint32_t)pid) : scheduler_get_current_task();
+    if (!task) {
+        return SYSCALL_ENOENT;
+    }
+    int ret = scheduler_setattr(task, &attr);
+    if (pid) {
+        task_put(task);
+    }
+
+    switch (ret) {
+    case 0:
+        return SYSCALL_SUCCESS;
+    case -2:
+        return SYSCALL_EBUSY;
+    case -3:
+        return SYSCALL_ENOMEM;
+    default:
+        return SYSCALL_EINVAL;
+    }
+}
+
 // Get time system call
 long syscall_gettime(long time_ptr, long unused1, long unused2, long unused3, long unused4, long unused5) {
     (void)unused1; (void)unused2; (void)unused3; (void)unused4; (void)unused5;
@@ -271,25 +388,49 @@ long syscall_gettime(long time_ptr, long unused1, long unused2, long unused3, lo
 int syscall_get_stats(struct syscall_stats *stats) {
     if (!stats) return -1;
     
-    memcpy(stats, &g_syscall_stats, sizeof(struct syscall_stats));
+    memset(stats, 0, sizeof(struct syscall_stats));
+    for (uint32_t i = 0; i < MAX_SYSCALLS; i++) {
+        stats->calls_by_num[i] = per_cpu_sum(syscall_counts, calls[i]);
+        stats->total_calls += stats->calls_by_num[i];
+    }
+    stats->errors = per_cpu_sum(syscall_cpu_stats, errors);
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t last = per_cpu_ptr(syscall_cpu_stats, cpu)->last_call_time;
+        if (last > stats->last_call_time) {
+            stats->last_call_time = last;
+        }
+    }
     return 0;
 }
 
+uint64_t syscall_get_count(uint32_t syscall_num) {
+    return syscall_num < MAX_SYSCALLS ? per_cpu_sum(syscall_counts, calls[syscall_num]) : 0;
+}
+
+void syscall_uncount(uint32_t syscall_num, uint64_t calls) {
+    if (syscall_num < MAX_SYSCALLS) {
+        this_cpu_sub(syscall_counts, calls[syscall_num], calls);
+    }
+}
+
 // Dump system call statistics
 void syscall_dump_stats(void) {
     early_print("=== System Call Statistics ===\n");
     
+    struct syscall_stats stats;
+    syscall_get_stats(&stats);
+    
     char str[16];
     early_print("Total calls: ");
-    early_print(itoa((int)g_syscall_stats.total_calls, str, 10));
+    early_print(itoa((int)stats.total_calls, str, 10));
     early_print("\n");
     
     early_print("Total errors: ");
-    early_print(itoa((int)g_syscall_stats.errors, str, 10));
+    early_print(itoa((int)stats.errors, str, 10));
     early_print("\n");
     
     early_print("Last call time: ");
-    early_print(itoa((int)g_syscall_stats.last_call_time, str, 10));
+    early_print(itoa((int)stats.last_call_time, str, 10));
     early_print("\n");
     
     // Show call counts for implemented syscalls
@@ -298,10 +439,10 @@ void syscall_dump_stats(void) {
     };
     
     for (int i = 0; i < 8; i++) {
-        if (g_syscall_stats.calls_by_num[i] > 0) {
+        if (stats.calls_by_num[i] > 0) {
             early_print(syscall_names[i]);
             early_print(": ");
-            early_print(itoa((int)g_syscall_stats.calls_by_num[i], str, 10));
+            early_print(itoa((int)stats.calls_by_num[i], str, 10));
             early_print("\n");
         }
     }
@@ -309,11 +450,77 @@ void syscall_dump_stats(void) {
     early_print("=== End Syscall Stats ===\n");
 }
 
+void syscall_force_dispatch(int enable) {
+    unsigned long flags = disable_interrupts();
+    if (enable && g_force_dispatch++ == 0) {
+        g_traced_leaf_mask = syscall_leaf_mask;
+        syscall_leaf_mask = 0;
+    } else if (!enable && g_force_dispatch > 0 && --g_force_dispatch == 0) {
+        syscall_leaf_mask = g_traced_leaf_mask;
+    }
+    restore_interrupts(flags);
+}
+
 // Enable/disable system call tracing
 void syscall_enable_tracing(int enable) {
+    enable = enable ? 1 : 0;
+    if (enable != g_tracing_enabled) {
+        syscall_force_dispatch(enable);
+    }
     g_tracing_enabled = enable;
     
     early_print("System call tracing ");
     early_print(enable ? "enabled" : "disabled");
     early_print("\n");
-}
\ No newline at end of file
+}
+
+#ifdef __aarch64__
+// Enter the kernel through SVC as a task would
+static inline long syscall_trap(long syscall_num) {
+    register long num __asm__("x8") = syscall_num;
+    register long result __asm__("x0");
+    
+    __asm__ volatile("svc #0" : "=r"(result) : "r"(num) : "memory");
+    return result;
+}
+#endif
+
+/**
+ * Measure the round-trip cost of a system call: the dispatcher alone, and
+ * on ARM64 the SVC trap through the leaf and the full entry paths. Tasks
+ * run in ring 0 on x86-64, where SYSRET cannot return to them, so only the
+ * dispatcher is measured there. The calls made are left out of the stats.
+ */
+int syscall_benchmark(uint32_t iterations, struct syscall_bench *result) {
+    if (!result || iterations == 0) return -1;
+    
+    memset(result, 0, sizeof(struct syscall_bench));
+    uint64_t getpid_calls = syscall_get_count(SYSCALL_GETPID);
+    uint64_t errors = per_cpu_sum(syscall_cpu_stats, errors);
+    uint64_t start;
+    
+    start = timer_get_time_us();
+    for (uint32_t i = 0; i < iterations; i++) {
+        syscall_dispatch(SYSCALL_GETPID, 0, 0, 0, 0, 0, 0);
+    }
+    result->dispatch_ns = (timer_get_time_us() - start) * 1000 / iterations;
+    
+#ifdef __aarch64__
+    start = timer_get_time_us();
+    for (uint32_t i = 0; i < iterations; i++) {
+        syscall_trap(SYSCALL_GETPID);
+    }
+    result->leaf_trap_ns = (timer_get_time_us() - start) * 1000 / iterations;
+    
+    // An out-of-range number takes the full path and returns straight away
+    start = timer_get_time_us();
+    for (uint32_t i = 0; i < iterations; i++) {
+        syscall_trap(MAX_SYSCALLS);
+    }
+    result->full_trap_ns = (timer_get_time_us() - start) * 1000 / iterations;
+#endif
+    
+    syscall_uncount(SYSCALL_GETPID, syscall_get_count(SYSCALL_GETPID) - getpid_calls);
+    this_cpu_sub(syscall_cpu_stats, errors, per_cpu_sum(syscall_cpu_stats, errors) - errors);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * System Snapshot System Call
+ *
+ * SYSCALL_SYSINFO fills a caller buffer with system totals and a record
+ * per task (sysinfo.h) in one trap, so a monitor such as top refreshes
+ * with a single call whatever the number of tasks, and sees task records
+ * that were all taken at the same moment.
+ */
+
+#include "syscall.h"
+#include "sysinfo.h"
+#include "process.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "smp.h"
+#include "kernel.h"
+
+// sysinfo(buffer, size): the number of task records stored
+long syscall_sysinfo(long buf_ptr, long size, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    if (buf_ptr == 0 || size < (long)sizeof(struct sysinfo)) {
+        return SYSCALL_EINVAL;
+    }
+
+    struct sysinfo *info = (struct sysinfo *)buf_ptr;
+    size_t room = ((size_t)size - sizeof(struct sysinfo)) / sizeof(struct sysinfo_task);
+    uint32_t max = room < MAX_TASKS ? (uint32_t)room : MAX_TASKS;
+
+    // Fault the buffer in now: the records are copied with the task lock held
+    memset(info, 0, SYSINFO_SIZE(max));
+
+    info->total_tasks = process_snapshot(info->tasks, max);
+    info->nr_tasks = info->total_tasks < max ? info->total_tasks : max;
+    info->running_tasks = 0;
+    info->blocked_tasks = 0;
+    for (uint32_t i = 0; i < info->nr_tasks; i++) {
+        if (info->tasks[i].state == TASK_STATE_READY || info->tasks[i].state == TASK_STATE_RUNNING) {
+            info->running_tasks++;
+        } else if (info->tasks[i].state == TASK_STATE_BLOCKED) {
+            info->blocked_tasks++;
+        }
+    }
+
+    info->uptime_us = timer_get_time_us();
+    scheduler_get_totals(&info->context_switches, &info->scheduler_ticks);
+
+    info->interrupts = 0;
+    for (uint32_t irq = 0; irq < MAX_IRQS; irq++) {
+        info->interrupts += get_irq_count(irq);
+    }
+
+    struct memory_stats mem;
+    memory_get_stats(&mem);
+    info->total_memory = mem.total_memory;
+    info->used_memory = mem.used_memory;
+    info->free_memory = mem.free_memory;
+
+    struct kheap_stats heap;
+    kheap_get_stats(&heap);
+    info->kernel_heap = heap.bytes_in_use;
+
+    info->cpus = smp_num_cpus();
+    info->reserved = 0;
+    return (long)info->nr_tasks;
+}
@@ -0,0 +1,150 @@
+/**
+ * Thread System Calls
+ *
+ * SYSCALL_THREAD_CREATE starts a task in the caller's address space, so
+ * its threads share memory; descriptors are cloned at creation as for any
+ * task. SYSCALL_FUTEX lets them sleep on a word of that memory (futex.h).
+ *
+ * Sleepers hang off a hash of buckets by (address space, address). Each
+ * one waits on a wait queue of its own, on its stack, so a wake only
+ * touches the tasks it picks. A waiter checks the word under its bucket's
+ * lock before queueing, and a waker changes the word before taking that
+ * lock, so a wakeup can't slip in between the check and the sleep. Wakers
+ * finish with a waiter while holding the lock, and a waiter takes it once
+ * more before returning, so its entry is never used after it is gone.
+ */
+
+#include "syscall.h"
+#include "futex.h"
+#include "process.h"
+#include "kernel.h"
+
+#define FUTEX_BUCKETS           64      // A power of two
+
+struct futex_waiter {
+    struct address_space *as;
+    uintptr_t addr;
+    struct futex_waiter *next;
+    struct wait_queue wq;
+    volatile uint32_t woken;
+};
+
+struct futex_bucket {
+    spinlock_t lock;
+    struct futex_waiter *head;          // Oldest first
+};
+
+static struct futex_bucket futex_buckets[FUTEX_BUCKETS];
+
+static struct futex_bucket *futex_bucket_for(struct address_space *as, uintptr_t addr) {
+    uint64_t h = ((uint64_t)(uintptr_t)as ^ (addr >> 2)) * 0x9E3779B97F4A7C15ULL;
+    return &futex_buckets[(h >> 40) & (FUTEX_BUCKETS - 1)];
+}
+
+static long futex_wait(struct address_space *as, uint32_t *uaddr, uint32_t expected,
+                       uint64_t timeout_us) {
+    // Touch the word first, so a fault on it is taken without the lock
+    if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != expected) {
+        return SYSCALL_EAGAIN;
+    }
+
+    struct futex_waiter waiter;
+    waiter.as = as;
+    waiter.addr = (uintptr_t)uaddr;
+    waiter.next = NULL;
+    waiter.woken = 0;
+    wait_queue_init(&waiter.wq);
+
+    struct futex_bucket *bucket = futex_bucket_for(as, waiter.addr);
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    if (__atomic_load_n(uaddr, __ATOMIC_SEQ_CST) != expected) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return SYSCALL_EAGAIN;
+    }
+    struct futex_waiter **link = &bucket->head;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = &waiter;
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (timeout_us) {
+        wait_event_timeout(&waiter.wq, waiter.woken, timeout_us);
+    } else {
+        wait_event(&waiter.wq, waiter.woken);
+    }
+
+    flags = spin_lock_irqsave(&bucket->lock);
+    uint32_t woken = waiter.woken;
+    if (!woken) {
+        link = &bucket->head;
+        while (*link != &waiter) {
+            link = &(*link)->next;
+        }
+        *link = waiter.next;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    return woken ? SYSCALL_SUCCESS : SYSCALL_ETIMEDOUT;
+}
+
+static long futex_wake(struct address_space *as, uint32_t *uaddr, uint32_t count) {
+    uintptr_t addr = (uintptr_t)uaddr;
+    struct futex_bucket *bucket = futex_bucket_for(as, addr);
+    uint32_t woken = 0;
+
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    struct futex_waiter **link = &bucket->head;
+    while (*link && woken < count) {
+        struct futex_waiter *waiter = *link;
+        if (waiter->as != as || waiter->addr != addr) {
+            link = &waiter->next;
+            continue;
+        }
+        *link = waiter->next;
+        waiter->woken = 1;
+        wake_up(&waiter->wq);
+        woken++;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    return (long)woken;
+}
+
+// futex(uaddr, op, val, timeout_us)
+long syscall_futex(long uaddr, long op, long val, long timeout_us, long unused4, long unused5) {
+    (void)unused4; (void)unused5;
+
+    struct task *current = scheduler_get_current_task();
+    uint32_t *word = (uint32_t *)uaddr;
+    if (!word || (uaddr & (sizeof(uint32_t) - 1)) || timeout_us < 0) {
+        return SYSCALL_EINVAL;
+    }
+
+    struct address_space *as = current ? current->aspace : NULL;
+    switch (op) {
+    case FUTEX_WAIT:
+        return futex_wait(as, word, (uint32_t)val, (uint64_t)timeout_us);
+    case FUTEX_WAKE:
+        return val > 0 ? futex_wake(as, word, val > UINT32_MAX ? UINT32_MAX : (uint32_t)val) : 0;
+    default:
+        return SYSCALL_EINVAL;
+    }
+}
+
+// thread_create(entry, arg): the new thread's ID, which process_wait() takes
+long syscall_thread_create(long entry, long arg, long unused2, long unused3, long unused4, long unused5) {
+    (void)unused2; (void)unused3; (void)unused4; (void)unused5;
+
+    struct task *current = scheduler_get_current_task();
+    if (!current) {
+        return SYSCALL_EPERM;
+    }
+    if (!entry) {
+        return SYSCALL_EINVAL;
+    }
+
+    int tid = process_create_fair((task_entry_t)entry, (void *)arg, current->name,
+                                  current->nice);
+    return tid < 0 ? SYSCALL_ENOMEM : tid;
+}
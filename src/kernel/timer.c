@@ -1,6 +1,15 @@
 /*
  * MiniOS Timer Subsystem Implementation
  * Phase 4: Device Drivers & System Services
+ *
+ * Software timers sit on a hierarchical timing wheel counted in
+ * TIMER_WHEEL_UNIT_US units. The root level has one slot per unit for the
+ * next TIMER_WHEEL_ROOT_SLOTS units; each outer level covers
+ * TIMER_WHEEL_LEVEL_SLOTS times the span of the one inside it. Starting
+ * or stopping a timer is a list insert or unlink, and a timer on an outer
+ * level is moved inwards (cascaded) when the root wraps, so each unit of
+ * time costs one slot no matter how many timers are pending. Timers are
+ * kmalloc()ed and found by ID through a small hash.
  */
 
 #include "timer.h"
@@ -8,22 +17,66 @@
 #include "driver.h"
 #include "memory.h"
 #include "kernel.h"
+#include "process.h"
+#include "profile.h"
+#include "interrupt.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "vdso.h"
+#include "softirq.h"
+
+#define TIMER_WHEEL_ROOT_MASK   (TIMER_WHEEL_ROOT_SLOTS - 1)
+#define TIMER_WHEEL_LEVEL_MASK  (TIMER_WHEEL_LEVEL_SLOTS - 1)
+#define TIMER_WHEEL_ROOT_BITS   8
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_MAX_DELTA   ((1ULL << (TIMER_WHEEL_ROOT_BITS + \
+                                  (TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_LEVEL_BITS)) - 1)
+#define TIMER_HASH_BUCKETS      64
 
 // Timer subsystem state
 static int timer_subsystem_initialized = 0;
 static uint32_t next_timer_id = 1;
-static struct timer *timer_list = NULL;
 static uint32_t scheduler_enabled = 0;
 static uint32_t scheduler_frequency = TIMER_SCHEDULER_HZ;
 
+// Timing wheel and ID hash, under timer_lock
+static spinlock_t timer_lock = SPINLOCK_INIT;
+static struct timer *wheel_root[TIMER_WHEEL_ROOT_SLOTS];
+static struct timer *wheel_levels[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_LEVEL_SLOTS];
+static uint64_t wheel_root_pending[TIMER_WHEEL_ROOT_SLOTS / 64];  // Non-empty root slots
+static uint64_t wheel_clock = 0;        // Next unit to process
+static uint32_t wheel_pending = 0;      // Timers on the wheel
+static struct timer *timer_hash[TIMER_HASH_BUCKETS];
+
 // Timer statistics
 static uint64_t total_timer_interrupts = 0;
 static uint64_t scheduler_ticks = 0;
 
+/*
+ * Clock event state. The hardware is programmed one deadline ahead: the
+ * earlier of the next scheduler tick and the next timer expiry, or only
+ * the expiry while the boot CPU idles with the tick stopped. It lives on
+ * the boot CPU, which takes the timer interrupt, and is only touched there
+ * with interrupts masked.
+ */
+static uint64_t tick_period_us = 1000000 / TIMER_SCHEDULER_HZ;
+static uint64_t next_tick_us = 0;       // When the next scheduler tick is due
+static uint64_t next_event_us = 0;      // Deadline programmed into the hardware
+static uint64_t event_interval_us = 0;  // Interval the hardware re-arms with
+static uint32_t tick_stopped = 0;       // Boot CPU idle with the tick off
+static uint64_t tick_stopped_us = 0;    // When the tick was stopped
+
+static uint64_t timer_next_expiry(void);
+static void timer_program_next_event(uint64_t now);
+static void timer_softirq(void);
+static int timer_arm(uint32_t timer_id, int set_interval, uint64_t interval_us);
+
 int timer_init(void)
 {
     early_print("Initializing timer subsystem...\n");
     
+    open_softirq(SOFTIRQ_TIMER, timer_softirq);
+    
     // Initialize timer device drivers first
 #ifdef ARCH_ARM64
     extern int arm64_timer_driver_register(void);
@@ -84,6 +137,7 @@ int timer_init(void)
     }
     
     timer_subsystem_initialized = 1;
+    wheel_clock = timer_get_time_us() / TIMER_WHEEL_UNIT_US;
     
     early_print("Timer subsystem initialized successfully\n");
     return 0;
@@ -95,7 +149,29 @@ uint64_t timer_get_time_us(void)
         return 0;
     }
     
-    return arch_timer_get_count() * 1000000 / arch_timer_get_frequency();
+    uint64_t count = arch_timer_get_count();
+    uint64_t freq = arch_timer_get_frequency();
+    if (!freq) {
+        return 0;
+    }
+    
+    // Split so count * 1000000 cannot overflow
+    return (count / freq) * 1000000 + (count % freq) * 1000000 / freq;
+}
+
+uint64_t timer_get_time_ns(void)
+{
+    if (!timer_subsystem_initialized) {
+        return 0;
+    }
+    
+    uint64_t count = arch_timer_get_count();
+    uint64_t freq = arch_timer_get_frequency();
+    if (!freq) {
+        return 0;
+    }
+    
+    return (count / freq) * 1000000000 + (count % freq) * 1000000000 / freq;
 }
 
 uint64_t timer_get_time_ms(void)
@@ -125,6 +201,107 @@ void timer_get_info(struct timer_info *info)
     info->capabilities = TIMER_FLAG_HIGH_RES | TIMER_FLAG_INTERRUPT;
 }
 
+static inline uint32_t timer_hash_index(uint32_t id)
+{
+    return id & (TIMER_HASH_BUCKETS - 1);
+}
+
+// Timer with this ID (timer_lock held)
+static struct timer *timer_lookup(uint32_t id)
+{
+    struct timer *timer = timer_hash[timer_hash_index(id)];
+    while (timer && timer->id != id) {
+        timer = timer->hash_next;
+    }
+    return timer;
+}
+
+/**
+ * Put timer in the slot for its expiry relative to wheel_clock: the root
+ * for the next TIMER_WHEEL_ROOT_SLOTS units, otherwise the innermost
+ * level that reaches it (timer_lock held)
+ */
+static void wheel_add(struct timer *timer)
+{
+    uint64_t expires = (timer->expiry_time + TIMER_WHEEL_UNIT_US - 1) / TIMER_WHEEL_UNIT_US;
+    struct timer **slot;
+    
+    if (expires < wheel_clock) {
+        expires = wheel_clock;  // Already due, runs at the next unit processed
+    } else if (expires - wheel_clock > TIMER_WHEEL_MAX_DELTA) {
+        expires = wheel_clock + TIMER_WHEEL_MAX_DELTA;
+    }
+    
+    uint64_t delta = expires - wheel_clock;
+    if (delta < TIMER_WHEEL_ROOT_SLOTS) {
+        uint32_t index = expires & TIMER_WHEEL_ROOT_MASK;
+        timer->wheel_level = 0;
+        timer->wheel_slot = index;
+        wheel_root_pending[index / 64] |= 1ULL << (index % 64);
+        slot = &wheel_root[index];
+    } else {
+        uint32_t level = 1;
+        uint32_t shift = TIMER_WHEEL_ROOT_BITS;
+        while (delta >> (shift + TIMER_WHEEL_LEVEL_BITS)) {
+            level++;
+            shift += TIMER_WHEEL_LEVEL_BITS;
+        }
+        uint32_t index = (expires >> shift) & TIMER_WHEEL_LEVEL_MASK;
+        timer->wheel_level = level;
+        timer->wheel_slot = index;
+        slot = &wheel_levels[level - 1][index];
+    }
+    
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+    wheel_pending++;
+}
+
+// Take timer off the wheel if it is pending (timer_lock held)
+static void wheel_del(struct timer *timer)
+{
+    if (!timer->pprev) {
+        return;
+    }
+    
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (timer->wheel_level == 0 && !wheel_root[timer->wheel_slot]) {
+        uint32_t index = timer->wheel_slot;
+        wheel_root_pending[index / 64] &= ~(1ULL << (index % 64));
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel_pending--;
+}
+
+/**
+ * Re-slot every timer in one outer-level slot now that wheel_clock has
+ * reached its span, and return the slot index (timer_lock held)
+ */
+static uint32_t wheel_cascade(uint32_t level)
+{
+    uint32_t shift = TIMER_WHEEL_ROOT_BITS + (level - 1) * TIMER_WHEEL_LEVEL_BITS;
+    uint32_t index = (wheel_clock >> shift) & TIMER_WHEEL_LEVEL_MASK;
+    struct timer *timer = wheel_levels[level - 1][index];
+    
+    wheel_levels[level - 1][index] = NULL;
+    while (timer) {
+        struct timer *next = timer->next;
+        timer->pprev = NULL;
+        wheel_pending--;
+        wheel_add(timer);
+        timer = next;
+    }
+    return index;
+}
+
 uint32_t timer_create(uint32_t type, uint64_t interval_us, 
                      timer_callback_t callback, void *data)
 {
@@ -133,45 +310,83 @@ uint32_t timer_create(uint32_t type, uint64_t interval_us,
     }
     
     // Allocate timer structure
-    struct timer *timer = memory_alloc(sizeof(struct timer), MEMORY_ALIGN_4K);
+    struct timer *timer = kmalloc(sizeof(struct timer));
     if (!timer) {
         return 0;
     }
     
     // Initialize timer
-    timer->id = next_timer_id++;
     timer->type = type;
     timer->flags = 0;
+    timer->wheel_level = 0;
+    timer->wheel_slot = 0;
     timer->interval_us = interval_us;
     timer->expiry_time = timer_get_time_us() + interval_us;
     timer->callback = callback;
     timer->callback_data = data;
-    timer->next = timer_list;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
     
-    // Add to timer list
-    timer_list = timer;
+    // Pick an unused, non-zero ID
+    do {
+        timer->id = next_timer_id++;
+    } while (timer->id == 0 || timer_lookup(timer->id));
+    
+    // Add to the ID hash
+    uint32_t bucket = timer_hash_index(timer->id);
+    timer->hash_next = timer_hash[bucket];
+    timer_hash[bucket] = timer;
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
     
     return timer->id;
 }
 
 int timer_start(uint32_t timer_id)
+{
+    return timer_arm(timer_id, 0, 0);
+}
+
+int timer_modify(uint32_t timer_id, uint64_t interval_us)
+{
+    return timer_arm(timer_id, 1, interval_us);
+}
+
+// Queue a timer one interval from now, optionally with a new interval
+static int timer_arm(uint32_t timer_id, int set_interval, uint64_t interval_us)
 {
     if (!timer_subsystem_initialized) {
         return -1;
     }
     
-    // Find timer
-    struct timer *timer = timer_list;
-    while (timer) {
-        if (timer->id == timer_id) {
-            timer->flags |= TIMER_FLAG_ENABLED;
-            timer->expiry_time = timer_get_time_us() + timer->interval_us;
-            return 0;
-        }
-        timer = timer->next;
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    struct timer *timer = timer_lookup(timer_id);
+    if (!timer) {
+        spin_unlock_irqrestore(&timer_lock, flags);
+        return -1; // Timer not found
     }
     
-    return -1; // Timer not found
+    wheel_del(timer);
+    if (set_interval) {
+        timer->interval_us = interval_us;
+    }
+    timer->flags |= TIMER_FLAG_ENABLED;
+    timer->expiry_time = timer_get_time_us() + timer->interval_us;
+    wheel_add(timer);
+    uint64_t expiry = timer->expiry_time;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    
+    // Bring the hardware deadline forward if this expires first
+    if (scheduler_enabled && smp_cpu_id() == 0) {
+        flags = disable_interrupts();
+        if (expiry < next_event_us) {
+            timer_program_next_event(timer_get_time_us());
+        }
+        restore_interrupts(flags);
+    }
+    return 0;
 }
 
 int timer_stop(uint32_t timer_id)
@@ -180,17 +395,15 @@ int timer_stop(uint32_t timer_id)
         return -1;
     }
     
-    // Find timer
-    struct timer *timer = timer_list;
-    while (timer) {
-        if (timer->id == timer_id) {
-            timer->flags &= ~TIMER_FLAG_ENABLED;
-            return 0;
-        }
-        timer = timer->next;
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    struct timer *timer = timer_lookup(timer_id);
+    if (timer) {
+        wheel_del(timer);
+        timer->flags &= ~TIMER_FLAG_ENABLED;
     }
+    spin_unlock_irqrestore(&timer_lock, flags);
     
-    return -1; // Timer not found
+    return timer ? 0 : -1;
 }
 
 void timer_destroy(uint32_t timer_id)
@@ -199,23 +412,22 @@ void timer_destroy(uint32_t timer_id)
         return;
     }
     
-    // Remove from timer list
-    struct timer *prev = NULL;
-    struct timer *timer = timer_list;
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
     
-    while (timer) {
-        if (timer->id == timer_id) {
-            if (prev) {
-                prev->next = timer->next;
-            } else {
-                timer_list = timer->next;
-            }
-            memory_free(timer);
-            return;
-        }
-        prev = timer;
-        timer = timer->next;
+    // Unlink from the ID hash
+    struct timer **link = &timer_hash[timer_hash_index(timer_id)];
+    while (*link && (*link)->id != timer_id) {
+        link = &(*link)->hash_next;
     }
+    struct timer *timer = *link;
+    if (timer) {
+        *link = timer->hash_next;
+        wheel_del(timer);
+    }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+    
+    kfree(timer);
 }
 
 void timer_udelay(uint64_t us)
@@ -246,10 +458,18 @@ int timer_set_scheduler_frequency(uint32_t freq_hz)
     }
     
     scheduler_frequency = freq_hz;
+    vdso_set_tick_rate(freq_hz);
     
     // Set timer interval
     uint64_t interval_us = 1000000 / freq_hz;
-    return arch_timer_set_interval(interval_us);
+    unsigned long flags = disable_interrupts();
+    tick_period_us = interval_us;
+    event_interval_us = interval_us;
+    next_tick_us = timer_get_time_us() + interval_us;
+    next_event_us = next_tick_us;
+    int result = arch_timer_set_interval(interval_us);
+    restore_interrupts(flags);
+    return result;
 }
 
 int timer_enable_scheduler(void)
@@ -300,6 +520,7 @@ void timer_disable_scheduler(void)
     if (timer_subsystem_initialized) {
         arch_timer_disable_interrupt();
         scheduler_enabled = 0;
+        tick_stopped = 0;
         early_print("Timer scheduler disabled\n");
     }
 }
@@ -317,14 +538,143 @@ void timer_interrupt_handler(void)
     total_timer_interrupts++;
     
     if (scheduler_enabled) {
-        scheduler_ticks++;
+        uint64_t now = timer_get_time_us();
+        
+        // Expired timers run from the softirq, with interrupts enabled
+        int expired = timer_next_expiry() <= now;
+        if (expired) {
+            raise_softirq(SOFTIRQ_TIMER);
+        }
+        
+        // This may have been a timer deadline between ticks
+        if (!tick_stopped && now + TIMER_MIN_DELTA_US >= next_tick_us) {
+            scheduler_ticks++;
+            vdso_tick(scheduler_ticks);
+            next_tick_us += tick_period_us;
+            if (next_tick_us <= now) {
+                next_tick_us = now + tick_period_us;  // Fell behind, resync
+            }
+            
+            // Account the running task; a needed switch happens on interrupt return
+            scheduler_tick();
+            profile_tick();
+        }
         
-        // Process expired timers
-        timer_process_expired();
+        // Otherwise the softirq reprograms once the wheel has moved on
+        if (!expired) {
+            timer_program_next_event(now);
+        }
+    }
+}
+
+/**
+ * SOFTIRQ_TIMER: run expired timer callbacks, then program the next
+ * event past them. Raised by the boot CPU's timer interrupt and run on
+ * the way out of it.
+ */
+static void timer_softirq(void)
+{
+    timer_process_expired();
+    
+    unsigned long flags = disable_interrupts();
+    if (scheduler_enabled && smp_cpu_id() == 0) {
+        timer_program_next_event(timer_get_time_us());
+    }
+    restore_interrupts(flags);
+}
+
+/**
+ * Start of the first unit with timers in it, UINT64_MAX if none are
+ * pending. Root slots are exact; anything beyond the root's current span
+ * is reported as the next wrap, where it cascades.
+ */
+static uint64_t timer_next_expiry(void)
+{
+    uint64_t next = UINT64_MAX;
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    
+    if (wheel_pending) {
+        uint32_t index = wheel_clock & TIMER_WHEEL_ROOT_MASK;
+        uint64_t unit = (wheel_clock | TIMER_WHEEL_ROOT_MASK) + 1;
         
-        // TODO: Call scheduler (Phase 4 - Process Management)
-        // scheduler_tick();
+        for (uint32_t word = index / 64; word < TIMER_WHEEL_ROOT_SLOTS / 64; word++) {
+            uint64_t bits = wheel_root_pending[word];
+            if (word == index / 64) {
+                bits &= ~0ULL << (index % 64);
+            }
+            if (bits) {
+                unit = wheel_clock - index + word * 64 + __builtin_ctzll(bits);
+                break;
+            }
+        }
+        next = unit * TIMER_WHEEL_UNIT_US;
+    }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return next;
+}
+
+/**
+ * Program the hardware for the next thing that needs the CPU: the next
+ * tick (unless stopped) or the next timer expiry, at most
+ * TIMER_IDLE_MAX_US out. Boot CPU, interrupts masked.
+ */
+static void timer_program_next_event(uint64_t now)
+{
+    uint64_t deadline = timer_next_expiry();
+    
+    if (!tick_stopped && next_tick_us < deadline) {
+        deadline = next_tick_us;
+    }
+    if (deadline > now + TIMER_IDLE_MAX_US) {
+        deadline = now + TIMER_IDLE_MAX_US;
     }
+    
+    uint64_t interval = deadline > now + TIMER_MIN_DELTA_US ?
+                        deadline - now : TIMER_MIN_DELTA_US;
+    
+    // A steady tick needs no reprogramming: the hardware re-arms itself
+    // with the last interval
+    if (!tick_stopped && deadline == next_tick_us && event_interval_us == tick_period_us) {
+        next_event_us = deadline;
+        return;
+    }
+    
+    if (arch_timer_set_interval(interval) == 0) {
+        event_interval_us = interval;
+        next_event_us = now + interval;
+    }
+}
+
+int timer_idle_enter(void)
+{
+    // Secondaries have no timer interrupt to wake them
+    if (!timer_subsystem_initialized || !scheduler_enabled || smp_cpu_id() != 0) {
+        return -1;
+    }
+    
+    uint64_t now = timer_get_time_us();
+    if (!tick_stopped) {
+        tick_stopped = 1;
+        tick_stopped_us = now;
+    }
+    timer_program_next_event(now);
+    return 0;
+}
+
+void timer_idle_exit(void)
+{
+    if (!tick_stopped || smp_cpu_id() != 0) {
+        return;
+    }
+    
+    uint64_t now = timer_get_time_us();
+    tick_stopped = 0;
+    
+    // Count the ticks that were skipped so timer_get_ticks() keeps pace
+    scheduler_ticks += (now - tick_stopped_us) / tick_period_us;
+    next_tick_us = now + tick_period_us;
+    timer_program_next_event(now);
 }
 
 void timer_process_expired(void)
@@ -334,28 +684,50 @@ void timer_process_expired(void)
     }
     
     uint64_t current_time = timer_get_time_us();
-    struct timer *timer = timer_list;
+    uint64_t now = current_time / TIMER_WHEEL_UNIT_US;
     
-    while (timer) {
-        if ((timer->flags & TIMER_FLAG_ENABLED) && 
-            current_time >= timer->expiry_time) {
-            
-            // Timer expired, call callback
-            if (timer->callback) {
-                timer->callback(timer->callback_data);
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    
+    while (wheel_clock <= now) {
+        uint32_t index = wheel_clock & TIMER_WHEEL_ROOT_MASK;
+        
+        // The root wrapped: pull the next span in from the outer levels
+        if (!index) {
+            for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                if (wheel_cascade(level)) {
+                    break;
+                }
             }
+        }
+        
+        // Timers re-armed by their callbacks land in later slots
+        wheel_clock++;
+        
+        struct timer *timer;
+        while ((timer = wheel_root[index]) != NULL) {
+            wheel_del(timer);
             
-            // Handle timer type
-            if (timer->type == TIMER_TYPE_ONESHOT) {
-                // Disable oneshot timer
-                timer->flags &= ~TIMER_FLAG_ENABLED;
-            } else if (timer->type == TIMER_TYPE_PERIODIC) {
+            // Handle timer type before the callback, which may restart
+            // or destroy the timer
+            if (timer->type == TIMER_TYPE_PERIODIC) {
                 // Reset periodic timer
                 timer->expiry_time = current_time + timer->interval_us;
+                wheel_add(timer);
+            } else {
+                // Disable oneshot timer
+                timer->flags &= ~TIMER_FLAG_ENABLED;
             }
+            
+            timer_callback_t callback = timer->callback;
+            void *data = timer->callback_data;
+            
+            spin_unlock_irqrestore(&timer_lock, flags);
+            callback(data);
+            flags = spin_lock_irqsave(&timer_lock);
         }
-        timer = timer->next;
     }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
 }
 
 // Device driver integration functions
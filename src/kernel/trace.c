@@ -0,0 +1,158 @@
+/*
+ * MiniOS Static Tracepoints
+ *
+ * A writer claims the next position in its CPU's ring with one atomic
+ * add, fills the record in and then publishes it by storing its position
+ * in seq, as the kernel log does. Interrupts may nest writers on a CPU,
+ * and a task may move CPUs between picking a ring and claiming a slot;
+ * both just land in different slots. A reader takes a record only if seq
+ * holds the position it expects before and after copying it.
+ */
+
+#include "trace.h"
+#include "process.h"
+#include "smp.h"
+#include "syscall.h"
+#include "vdso.h"
+
+struct trace_cpu {
+    struct trace_record *ring;          // TRACE_RING_RECORDS, from the first reset
+    uint64_t head;                      // Positions claimed
+};
+
+// Site table, collected by the linker script
+extern const struct trace_site __trace_sites_start[];
+extern const struct trace_site __trace_sites_end[];
+
+static struct trace_cpu trace_cpus[MAX_CPUS];
+
+_Static_assert(sizeof(struct trace_record) == 40,
+               "tools/trace-decode.py reads records with a fixed layout");
+
+struct tracepoint trace_points[TRACE_EVENT_COUNT] = {
+    [TRACE_SCHED_SWITCH]    = {"sched_switch", 0, NULL},
+    [TRACE_SCHED_WAKEUP]    = {"sched_wakeup", 0, NULL},
+    [TRACE_SYSCALL_ENTER]   = {"syscall_enter", 0, syscall_force_dispatch},
+    [TRACE_SYSCALL_EXIT]    = {"syscall_exit", 0, syscall_force_dispatch},
+    [TRACE_BLOCK_SUBMIT]    = {"block_submit", 0, NULL},
+    [TRACE_BLOCK_COMPLETE]  = {"block_complete", 0, NULL},
+    [TRACE_VFS_ENTER]       = {"vfs_enter", 0, NULL},
+    [TRACE_VFS_EXIT]        = {"vfs_exit", 0, NULL},
+    [TRACE_IRQ_ENTRY]       = {"irq_entry", 0, NULL},
+    [TRACE_IRQ_EXIT]        = {"irq_exit", 0, NULL},
+};
+
+void trace_write(uint32_t event, uint64_t arg0, uint64_t arg1, uint32_t arg2)
+{
+    uint32_t cpu = smp_cpu_id();
+    struct trace_cpu *tc = &trace_cpus[cpu];
+    if (!tc->ring) {
+        return;
+    }
+
+    struct task *task = scheduler_get_current_task();
+    uint64_t pos = __atomic_fetch_add(&tc->head, 1, __ATOMIC_RELAXED);
+    struct trace_record *record = &tc->ring[pos & (TRACE_RING_RECORDS - 1)];
+
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->event = (uint16_t)event;
+    record->cpu = (uint16_t)cpu;
+    record->pid = task ? task->pid : 0;
+    record->arg2 = arg2;
+    record->timestamp = arch_vdso_read_counter();
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    __atomic_store_n(&record->seq, (uint32_t)pos + 1, __ATOMIC_RELEASE);
+}
+
+int trace_reset(void)
+{
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct trace_cpu *tc = &trace_cpus[cpu];
+        if (!tc->ring && (cpu == 0 || smp_cpus[cpu].online)) {
+            tc->ring = kmalloc(TRACE_RING_RECORDS * sizeof(struct trace_record));
+            if (!tc->ring) {
+                return -1;
+            }
+        }
+        if (tc->ring) {
+            memset(tc->ring, 0, TRACE_RING_RECORDS * sizeof(struct trace_record));
+        }
+        __atomic_store_n(&tc->head, 0, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+int trace_set_enabled(uint32_t event, int enable)
+{
+    if (event >= TRACE_EVENT_COUNT || (enable && !trace_cpus[0].ring)) {
+        return -1;
+    }
+
+    struct tracepoint *point = &trace_points[event];
+    enable = enable ? 1 : 0;
+    if (point->enabled == enable) {
+        return 0;
+    }
+
+    // Whatever the sites depend on is ready before the first one fires
+    if (enable && point->reg) {
+        point->reg(1);
+    }
+    for (const struct trace_site *site = __trace_sites_start; site < __trace_sites_end; site++) {
+        if (site->point == point) {
+            arch_trace_patch(site->code, site->target, enable);
+        }
+    }
+    point->enabled = enable;
+    if (!enable && point->reg) {
+        point->reg(0);
+    }
+    return 0;
+}
+
+int trace_event_lookup(const char *name)
+{
+    for (int event = 0; event < TRACE_EVENT_COUNT; event++) {
+        if (strcmp(trace_points[event].name, name) == 0) {
+            return event;
+        }
+    }
+    return -1;
+}
+
+int trace_read(uint32_t cpu, uint64_t index, struct trace_record *record)
+{
+    if (cpu >= MAX_CPUS || !trace_cpus[cpu].ring) {
+        return -1;
+    }
+
+    struct trace_cpu *tc = &trace_cpus[cpu];
+    uint64_t head = __atomic_load_n(&tc->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_RECORDS ? head - TRACE_RING_RECORDS : 0;
+    if (first + index >= head) {
+        return -1;
+    }
+
+    uint64_t pos = first + index;
+    struct trace_record *slot = &tc->ring[pos & (TRACE_RING_RECORDS - 1)];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    memcpy(record, slot, sizeof(struct trace_record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq != (uint32_t)pos + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+        return 1;
+    }
+    return 0;
+}
+
+void trace_cpu_stats(uint32_t cpu, uint64_t *written, uint64_t *overwritten)
+{
+    uint64_t head = cpu < MAX_CPUS ? __atomic_load_n(&trace_cpus[cpu].head, __ATOMIC_ACQUIRE) : 0;
+    if (written) {
+        *written = head;
+    }
+    if (overwritten) {
+        *overwritten = head > TRACE_RING_RECORDS ? head - TRACE_RING_RECORDS : 0;
+    }
+}
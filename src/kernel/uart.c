@@ -8,6 +8,9 @@
 #include "driver.h"
 #include "memory.h"
 #include "kernel.h"
+#include "vfs.h"
+#include "fd.h"
+#include "process.h"
 
 // UART subsystem state
 static int uart_subsystem_initialized = 0;
@@ -21,6 +24,10 @@ extern int pl011_uart_getc(struct device *device);
 extern int pl011_uart_puts(struct device *device, const char *str);
 extern int pl011_uart_tx_ready(struct device *device);
 extern int pl011_uart_rx_ready(struct device *device);
+extern int pl011_uart_enable_interrupts(struct device *device, int tx_enable, int rx_enable);
+extern int pl011_uart_disable_interrupts(struct device *device);
+extern int pl011_uart_flush(struct device *device);
+extern struct wait_queue *pl011_uart_rx_wait(struct device *device);
 #endif
 
 #ifdef ARCH_X86_64
@@ -30,6 +37,10 @@ extern int uart_16550_getc(struct device *device);
 extern int uart_16550_puts(struct device *device, const char *str);
 extern int uart_16550_tx_ready(struct device *device);
 extern int uart_16550_rx_ready(struct device *device);
+extern int uart_16550_enable_interrupts(struct device *device, int tx_enable, int rx_enable);
+extern int uart_16550_disable_interrupts(struct device *device);
+extern int uart_16550_flush(struct device *device);
+extern struct wait_queue *uart_16550_rx_wait(struct device *device);
 #endif
 
 int uart_init(void)
@@ -226,11 +237,15 @@ int uart_enable_interrupts(struct device *device, int tx_enable, int rx_enable)
         return -1;
     }
     
-    // This would be implemented through driver-specific ioctl
-    // For now, return success
+#ifdef ARCH_ARM64
+    return pl011_uart_enable_interrupts(device, tx_enable, rx_enable);
+#elif defined(ARCH_X86_64)
+    return uart_16550_enable_interrupts(device, tx_enable, rx_enable);
+#else
     (void)tx_enable;
     (void)rx_enable;
-    return 0;
+    return -1;
+#endif
 }
 
 int uart_disable_interrupts(struct device *device)
@@ -239,9 +254,140 @@ int uart_disable_interrupts(struct device *device)
         return -1;
     }
     
-    // This would be implemented through driver-specific ioctl
-    // For now, return success
-    return 0;
+#ifdef ARCH_ARM64
+    return pl011_uart_disable_interrupts(device);
+#elif defined(ARCH_X86_64)
+    return uart_16550_disable_interrupts(device);
+#else
+    return -1;
+#endif
+}
+
+int uart_flush(struct device *device)
+{
+    if (!device || !uart_subsystem_initialized) {
+        return -1;
+    }
+    
+#ifdef ARCH_ARM64
+    return pl011_uart_flush(device);
+#elif defined(ARCH_X86_64)
+    return uart_16550_flush(device);
+#else
+    return -1;
+#endif
+}
+
+struct wait_queue *uart_rx_wait_queue(struct device *device)
+{
+    if (!device || !uart_subsystem_initialized) {
+        return NULL;
+    }
+    
+#ifdef ARCH_ARM64
+    return pl011_uart_rx_wait(device);
+#elif defined(ARCH_X86_64)
+    return uart_16550_rx_wait(device);
+#else
+    return NULL;
+#endif
+}
+
+struct device *uart_get_primary(void)
+{
+    return primary_uart_device;
+}
+
+// UART as an open file: reads wait for input on the RX wait queue, which
+// the driver's interrupt handler wakes, so they rely on RX interrupts
+static ssize_t uart_file_read(struct file *file, void *buf, size_t count, off_t offset);
+static ssize_t uart_file_write(struct file *file, const void *buf, size_t count, off_t offset);
+static uint32_t uart_file_poll(struct file *file, struct poll_table *pt);
+
+static struct file_operations uart_file_ops = {
+    .read = uart_file_read,
+    .write = uart_file_write,
+    .poll = uart_file_poll,
+};
+
+static inline struct device *uart_file_device(struct file *file)
+{
+    return (struct device *)file->inode->private_data;
+}
+
+// Whatever input there is, waiting for at least one byte
+static ssize_t uart_file_read(struct file *file, void *buf, size_t count, off_t offset)
+{
+    (void)offset;
+    
+    struct device *device = uart_file_device(file);
+    struct wait_queue *wq = uart_rx_wait_queue(device);
+    if (count == 0) {
+        return 0;
+    }
+    
+    for (;;) {
+        int result = uart_read(device, buf, count);
+        if (result != 0 || !wq) {
+            return result < 0 ? VFS_EIO : result;
+        }
+        wait_event(wq, uart_rx_ready(device) != 0);
+    }
+}
+
+static ssize_t uart_file_write(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    (void)offset;
+    
+    int result = uart_write(uart_file_device(file), buf, count);
+    return result < 0 ? VFS_EIO : result;
+}
+
+static uint32_t uart_file_poll(struct file *file, struct poll_table *pt)
+{
+    struct device *device = uart_file_device(file);
+    poll_wait(pt, uart_rx_wait_queue(device));
+    
+    uint32_t events = 0;
+    if (uart_rx_ready(device) > 0) {
+        events |= EPOLLIN;
+    }
+    if (uart_tx_ready(device) > 0) {
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+int uart_open_fd(struct device *device)
+{
+    if (!device || !uart_subsystem_initialized) {
+        return VFS_EINVAL;
+    }
+    
+    struct file *file = kmalloc(sizeof(struct file));
+    struct inode *inode = kmalloc(sizeof(struct inode));
+    if (!file || !inode) {
+        kfree(file);
+        kfree(inode);
+        return VFS_ENOMEM;
+    }
+    
+    memset(inode, 0, sizeof(struct inode));
+    inode->private_data = device;
+    inode->ref_count = 1;
+    
+    memset(file, 0, sizeof(struct file));
+    file->inode = inode;
+    file->flags = VFS_O_RDWR;
+    file->ref_count = 1;
+    file->ops = &uart_file_ops;
+    
+    int fd = fd_install(fd_get_current_table(), file, VFS_O_RDWR);
+    if (fd < 0) {
+        vfs_file_put(file);
+        return VFS_ENOSPC;
+    }
+    return fd;
 }
 
 // Enhanced early_print implementation
@@ -263,6 +409,14 @@ void enhanced_early_print(const char *str)
     
     // Use UART driver for output
     uart_puts(primary_uart_device, str);
+    arch_early_print_mirror(str);
+}
+
+void enhanced_early_print_flush(void)
+{
+    if (uart_subsystem_initialized && primary_uart_device) {
+        uart_flush(primary_uart_device);
+    }
 }
 
 // Architecture-specific functions (weak implementations)
@@ -272,6 +426,11 @@ int __attribute__((weak)) arch_uart_init(void)
     return 0;
 }
 
+void __attribute__((weak)) arch_early_print_mirror(const char *str)
+{
+    (void)str;
+}
+
 int uart_drivers_register(void)
 {
     // This function registers all available UART drivers
@@ -0,0 +1,95 @@
+/*
+ * MiniOS Shared Kernel Data Page (vDSO)
+ * Clock calibration, tick count and per-CPU PIDs for user programs
+ *
+ * The page is written only by the kernel and read by minios_libc without
+ * a system call. The clock fields are fixed once vdso_init() has
+ * calibrated the counter, so a reader needs no retry loop for them; the
+ * tick count is a single aligned store. Each CPU's PID slot is rewritten
+ * by that CPU alone at every switch, under a sequence count.
+ *
+ * Neither target maps kernel memory at page granularity yet, so the page
+ * cannot be mapped read-only on its own: programs get its kernel address
+ * from the loader and the protection is by convention.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "process.h"
+#include "smp.h"
+#include "timer.h"
+#include "vdso.h"
+
+#define VDSO_CLOCK_SHIFT        32
+
+_Static_assert(MAX_CPUS <= VDSO_MAX_CPUS, "vdso_data.cpus[] too small");
+_Static_assert(sizeof(struct vdso_data) <= PAGE_SIZE_4K, "vdso_data exceeds a page");
+
+static union {
+    struct vdso_data data;
+    uint8_t page[PAGE_SIZE_4K];
+} vdso_page __attribute__((section(".data"), aligned(PAGE_SIZE_4K)));
+
+void vdso_init(void) {
+    struct vdso_data *vd = &vdso_page.data;
+
+    vd->version = VDSO_VERSION;
+    vd->tick_hz = TIMER_SCHEDULER_HZ;
+    vd->ticks = timer_get_ticks();
+
+    uint64_t freq = arch_vdso_counter_frequency();
+    if (freq) {
+        vd->counter_frequency = freq;
+        vd->clock_shift = VDSO_CLOCK_SHIFT;
+        vd->clock_mult = (1000000000ULL << VDSO_CLOCK_SHIFT) / freq;
+        vd->base_counter = arch_vdso_read_counter();
+        vd->base_ns = timer_get_time_us() * 1000;
+#ifdef ARCH_ARM64
+        vd->clock_source = VDSO_CLOCK_CNTVCT;
+#else
+        vd->clock_source = VDSO_CLOCK_TSC;
+#endif
+    }
+
+    vdso_cpu_init();
+
+    early_print("vDSO: shared data page ready");
+    early_print(vd->clock_source != VDSO_CLOCK_NONE ? ", counter clock" : ", no user clock");
+    early_print(vd->flags & VDSO_HAS_CPU_PID ? ", per-CPU PIDs\n" : "\n");
+}
+
+/**
+ * Let user code on this CPU read the counter and its own CPU number.
+ * Assumes all CPUs match; the boot CPU's answer sets the flags.
+ */
+void vdso_cpu_init(void) {
+    uint32_t cpu = smp_cpu_id();
+    uint32_t flags = arch_vdso_cpu_init(cpu);
+
+    if (cpu == 0) {
+        vdso_page.data.flags = flags;
+    }
+}
+
+// Publish the PID now running on this CPU (rq locked, before the switch)
+void vdso_switch(struct task *next) {
+    struct vdso_cpu *slot = &vdso_page.data.cpus[smp_cpu_id()];
+    uint32_t seq = slot->seq;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->pid = next ? next->pid : 0;
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void vdso_tick(uint64_t ticks) {
+    vdso_page.data.ticks = ticks;
+}
+
+void vdso_set_tick_rate(uint32_t hz) {
+    vdso_page.data.tick_hz = hz;
+}
+
+const struct vdso_data *vdso_get_data(void) {
+    return &vdso_page.data;
+}
@@ -0,0 +1,655 @@
+/*
+ * MiniOS Virtual Memory Areas
+ * Demand-zero user regions
+ *
+ * A program's stack and heap are reserved as areas of its address space
+ * when it is created, and nothing is allocated for them. The first touch
+ * of a page in an area faults; the fault handler allocates a zeroed page,
+ * maps it with the area's attributes and lets the access retry. A program
+ * that uses a few KB of a 1MB heap holds a few pages, and spawning it
+ * costs no allocation proportional to the reservation.
+ *
+ * Areas live in the user region (USER_VM_BASE), whose top-level table
+ * slot is private to each address space, so its pages never show up in
+ * another one. All pages and tables are freed with the address space.
+ *
+ * vm_fork() copies an address space without copying its pages: both
+ * sides map each backed page read-only and take a reference to it. The
+ * first write from either side faults, and the writer gets a private
+ * copy, or the page itself once it is the last sharer. A fork followed by
+ * exec copies nothing but page tables.
+ *
+ * vm_map() adds areas for mmap(). A file page faults in as the page
+ * cache's own frame, with a reference held on it, so reading a mapped
+ * file copies nothing. Private mappings map it read-only and copy it on
+ * the first write like a forked page; shared ones map it with the area's
+ * attributes, and writes through them mark the cached page dirty for
+ * writeback. Files without a page cache can only be mapped privately and
+ * are read into a fresh page.
+ *
+ * The list of areas, in address order, is what map, unmap and fork walk.
+ * Faults find their area through a balanced tree over the same nodes,
+ * rebuilt from the list whenever it changes (which already costs a walk
+ * of it), and before that through the last area a fault hit, as faults
+ * come in runs over one area. Each fault is counted by how it was
+ * resolved, with the counter ticks it took.
+ */
+
+#include "kernel.h"
+#include "memory.h"
+#include "process.h"
+#include "spinlock.h"
+#include "vfs.h"
+#include "vdso.h"
+
+#define VM_PAGE_MASK        ((uint64_t)PAGE_SIZE_4K - 1)
+
+static struct vm_fault_stats vm_fault_stats;
+
+static struct vm_area *vm_area_alloc(uint64_t start, uint64_t end, uint32_t flags) {
+    struct vm_area *vma = kmalloc(sizeof(struct vm_area));
+    if (vma) {
+        memset(vma, 0, sizeof(struct vm_area));
+        vma->start = start;
+        vma->end = end;
+        vma->flags = flags;
+    }
+    return vma;
+}
+
+// Drop an area's file reference and free it (vm_lock not held)
+static void vm_area_free(struct vm_area *vma) {
+    if (vma->file) {
+        vfs_file_put(vma->file);
+    }
+    kfree(vma);
+}
+
+// Balanced tree of the count areas from *list on, leaving *list past them
+static struct vm_area *vm_tree_build(struct vm_area **list, uint32_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+    struct vm_area *left = vm_tree_build(list, count / 2);
+    struct vm_area *root = *list;
+    *list = root->next;
+    root->left = left;
+    root->right = vm_tree_build(list, count - count / 2 - 1);
+    return root;
+}
+
+// Index the area list again after a change (vm_lock held, or as unused)
+static void vm_tree_rebuild(struct address_space *as) {
+    uint32_t count = 0;
+    for (struct vm_area *vma = as->vmas; vma; vma = vma->next) {
+        count++;
+    }
+    struct vm_area *list = as->vmas;
+    as->vma_root = vm_tree_build(&list, count);
+    as->vma_cache = NULL;
+}
+
+// Link vma in address order; fails if it overlaps an area (vm_lock held)
+static int vm_insert(struct address_space *as, struct vm_area *vma) {
+    struct vm_area **link = &as->vmas;
+    while (*link && (*link)->end <= vma->start) {
+        link = &(*link)->next;
+    }
+    if (*link && (*link)->start < vma->end) {
+        return -1;
+    }
+    vma->next = *link;
+    *link = vma;
+    vm_tree_rebuild(as);
+    return 0;
+}
+
+static int vm_range_valid(uint64_t start, size_t size, uint64_t *end) {
+    if (size == 0 || (start & VM_PAGE_MASK)) {
+        return 0;
+    }
+    *end = start + ((size + VM_PAGE_MASK) & ~VM_PAGE_MASK);
+    return start >= USER_VM_BASE && *end <= USER_VM_END && *end > start;
+}
+
+int vm_reserve(struct address_space *as, uint64_t start, size_t size, uint32_t flags) {
+    uint64_t end;
+    if (!as || !vm_range_valid(start, size, &end)) {
+        return -1;
+    }
+
+    struct vm_area *vma = vm_area_alloc(start, end, flags);
+    if (!vma) {
+        return -1;
+    }
+
+    unsigned long irq = spin_lock_irqsave(&as->vm_lock);
+    int result = vm_insert(as, vma);
+    spin_unlock_irqrestore(&as->vm_lock, irq);
+
+    if (result < 0) {
+        kfree(vma);  // Overlaps an existing area
+    }
+    return result;
+}
+
+// Area holding addr, or NULL (vm_lock held)
+static struct vm_area *vm_find(struct address_space *as, uint64_t addr) {
+    struct vm_area *vma = as->vma_cache;
+    if (vma && addr >= vma->start && addr < vma->end) {
+        __atomic_fetch_add(&vm_fault_stats.cache_hits, 1, __ATOMIC_RELAXED);
+        return vma;
+    }
+
+    vma = as->vma_root;
+    while (vma) {
+        if (addr < vma->start) {
+            vma = vma->left;
+        } else if (addr >= vma->end) {
+            vma = vma->right;
+        } else {
+            as->vma_cache = vma;
+            break;
+        }
+    }
+    return vma;
+}
+
+// Count a fault resolved as kind (a field of vm_fault_stats) since start
+static void vm_fault_account(uint64_t *kind, uint64_t start) {
+    uint64_t ticks = arch_vdso_read_counter() - start;
+    __atomic_fetch_add(kind, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&vm_fault_stats.ticks, ticks, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&vm_fault_stats.max_ticks, __ATOMIC_RELAXED);
+    while (ticks > max && !__atomic_compare_exchange_n(&vm_fault_stats.max_ticks, &max, ticks, 0,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void vm_get_fault_stats(struct vm_fault_stats *stats) {
+    if (!stats) {
+        return;
+    }
+    uint64_t *dst = (uint64_t *)stats;
+    const uint64_t *src = (const uint64_t *)&vm_fault_stats;
+    for (size_t i = 0; i < sizeof(struct vm_fault_stats) / sizeof(uint64_t); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+// Map a fresh zeroed page at page (vm_lock held)
+static int vm_fault_zero(struct address_space *as, struct vm_area *vma, uint64_t page) {
+    void *frame = memory_alloc_pages(1);
+    if (!frame) {
+        return -1;
+    }
+    memset(frame, 0, PAGE_SIZE_4K);
+
+    if (arch_aspace_map_page(as->root, page, (uint64_t)frame, vma->flags) < 0) {
+        memory_free_pages(frame, 1);
+        return -1;
+    }
+    as->resident_pages++;
+    return 0;
+}
+
+/**
+ * Write to a page that is mapped read-only in a writable area, so it is
+ * shared with another address space (vm_lock held). The last sharer takes
+ * the page over; anyone else gets a copy.
+ */
+static int vm_fault_cow(struct address_space *as, struct vm_area *vma,
+                        uint64_t page, uint64_t phys) {
+    uint64_t target = phys;
+    if (page_ref_count((void *)phys) > 1) {
+        void *copy = memory_alloc_pages(1);
+        if (!copy) {
+            return -1;
+        }
+        memcpy(copy, (void *)phys, PAGE_SIZE_4K);
+        target = (uint64_t)copy;
+    }
+
+    if (arch_aspace_map_page(as->root, page, target, vma->flags) < 0) {
+        if (target != phys) memory_free_pages((void *)target, 1);
+        return -1;
+    }
+    if (target != phys) {
+        page_ref_put((void *)phys);
+    }
+    arch_tlb_flush_page(page);  // Drop the read-only entry
+    return 0;
+}
+
+static inline int vm_shared_file(const struct vm_area *vma) {
+    return vma->file && (vma->map_flags & VM_MAP_SHARED);
+}
+
+static inline uint64_t vm_file_offset(const struct vm_area *vma, uint64_t page) {
+    return vma->offset + (page - vma->start);
+}
+
+/**
+ * Get a referenced frame with the file data at offset. Reads may sleep
+ * in the file system, so this runs without vm_lock.
+ */
+static void *vm_file_frame(struct file *file, uint64_t offset, int dirty) {
+    if (file->mapping) {
+        return vfs_page_cache_map(file->mapping, (uint32_t)(offset / VFS_PAGE_SIZE), dirty);
+    }
+
+    void *frame = memory_alloc_pages(1);
+    if (!frame) {
+        return NULL;
+    }
+    memset(frame, 0, PAGE_SIZE_4K);
+    if (!file->ops || !file->ops->read ||
+        file->ops->read(file, frame, PAGE_SIZE_4K, (off_t)offset) < 0) {
+        memory_free_pages(frame, 1);
+        return NULL;
+    }
+    return frame;
+}
+
+// Give back a frame from vm_file_frame() or a mapped page of a file area
+static void vm_file_frame_put(struct vm_area *vma, uint64_t page, uint64_t phys) {
+    struct vfs_mapping *mapping = vma->file->mapping;
+    if (mapping) {
+        uint32_t index = (uint32_t)(vm_file_offset(vma, page) / VFS_PAGE_SIZE);
+        int dirty = vm_shared_file(vma) && (vma->flags & MEMORY_WRITABLE);
+        vfs_page_cache_unmap(mapping, index, (void *)phys, dirty);
+    } else {
+        page_ref_put((void *)phys);
+    }
+}
+
+/**
+ * Back a page of a file area (vm_lock held, dropped around the read).
+ * Past end of file the page is zero filled.
+ */
+static int vm_fault_file(struct address_space *as, struct vm_area *vma, uint64_t page,
+                         uint32_t access, unsigned long *irq) {
+    struct file *file = vma->file;
+    uint64_t offset = vm_file_offset(vma, page);
+    uint64_t size = file->mapping ? file->mapping->size : (file->inode ? file->inode->size : 0);
+    if (offset >= size) {
+        return vm_fault_zero(as, vma, page);
+    }
+
+    int shared = vm_shared_file(vma);
+    int write = (access & VM_ACCESS_WRITE) != 0;
+
+    // Hold the file while the area may be unmapped under us
+    file->ref_count++;
+    spin_unlock_irqrestore(&as->vm_lock, *irq);
+    void *frame = vm_file_frame(file, offset, shared && write);
+    *irq = spin_lock_irqsave(&as->vm_lock);
+
+    int result = -1;
+    struct vm_area *now = vm_find(as, page);
+    if (!frame) {
+        // Nothing to map
+    } else if (now != vma || vma->file != file || vm_file_offset(vma, page) != offset) {
+        page_ref_put(frame);  // Unmapped or replaced meanwhile
+    } else if (arch_aspace_translate(as->root, page)) {
+        vm_file_frame_put(vma, page, (uint64_t)frame);
+        result = 0;  // Another thread of the task backed it first
+    } else if (!shared && write) {
+        result = vm_fault_cow(as, vma, page, (uint64_t)frame);
+        if (result == 0) {
+            as->resident_pages++;
+        } else {
+            vm_file_frame_put(vma, page, (uint64_t)frame);
+        }
+    } else {
+        uint32_t flags = shared ? vma->flags : (vma->flags & ~MEMORY_WRITABLE);
+        result = arch_aspace_map_page(as->root, page, (uint64_t)frame, flags);
+        if (result == 0) {
+            as->resident_pages++;
+        } else {
+            vm_file_frame_put(vma, page, (uint64_t)frame);
+        }
+    }
+
+    spin_unlock_irqrestore(&as->vm_lock, *irq);
+    vfs_file_put(file);
+    *irq = spin_lock_irqsave(&as->vm_lock);
+    return result;
+}
+
+int vm_handle_fault(uint64_t addr, uint32_t access) {
+    uint64_t start = arch_vdso_read_counter();
+    struct task *current = scheduler_get_current_task();
+    struct address_space *as = current ? current->aspace : NULL;
+    if (!as) {
+        vm_fault_account(&vm_fault_stats.failed, start);
+        return -1;
+    }
+
+    unsigned long irq = spin_lock_irqsave(&as->vm_lock);
+    struct vm_area *vma = vm_find(as, addr);
+    uint64_t *kind = &vm_fault_stats.failed;
+    int result = -1;
+    if (vma && (!(access & VM_ACCESS_WRITE) || (vma->flags & MEMORY_WRITABLE)) &&
+        (!(access & VM_ACCESS_EXEC) || (vma->flags & MEMORY_EXECUTABLE))) {
+        uint64_t page = addr & ~VM_PAGE_MASK;
+        uint64_t phys = arch_aspace_translate(as->root, page);
+        if (!phys && vma->file) {
+            result = vm_fault_file(as, vma, page, access, &irq);
+            kind = &vm_fault_stats.file;
+        } else if (!phys) {
+            result = vm_fault_zero(as, vma, page);
+            kind = &vm_fault_stats.zero;
+        } else if ((access & VM_ACCESS_WRITE) && (vma->map_flags & VM_MAP_SHARED)) {
+            // Shared pages are never copied; restore the area's attributes
+            result = arch_aspace_map_page(as->root, page, phys, vma->flags);
+            arch_tlb_flush_page(page);
+            kind = &vm_fault_stats.shared;
+        } else if (access & VM_ACCESS_WRITE) {
+            result = vm_fault_cow(as, vma, page, phys);
+            kind = &vm_fault_stats.cow;
+        } else {
+            result = 0;  // Another thread of the task backed it first
+            kind = &vm_fault_stats.spurious;
+        }
+    }
+    spin_unlock_irqrestore(&as->vm_lock, irq);
+
+    vm_fault_account(result == 0 ? kind : &vm_fault_stats.failed, start);
+    return result;
+}
+
+int vm_populate(struct address_space *as, uint64_t addr, const void *data, size_t len) {
+    if (!as || !data) {
+        return -1;
+    }
+
+    const uint8_t *src = data;
+    unsigned long irq = spin_lock_irqsave(&as->vm_lock);
+    int result = 0;
+    while (len > 0 && result == 0) {
+        uint64_t page = addr & ~VM_PAGE_MASK;
+        size_t chunk = PAGE_SIZE_4K - (addr - page);
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        struct vm_area *vma = vm_find(as, page);
+        if (!vma || (vma->map_flags & VM_MAP_SHARED)) {
+            result = -1;
+            break;
+        }
+        uint64_t phys = arch_aspace_translate(as->root, page);
+        if (!phys) {
+            result = vm_fault_zero(as, vma, page);
+        } else if (page_ref_count((void *)phys) > 1) {
+            result = vm_fault_cow(as, vma, page, phys);
+        }
+        if (result == 0) {
+            phys = arch_aspace_translate(as->root, page);
+            memcpy((uint8_t *)phys + (addr - page), src, chunk);
+            addr += chunk;
+            src += chunk;
+            len -= chunk;
+        }
+    }
+    spin_unlock_irqrestore(&as->vm_lock, irq);
+    return result;
+}
+
+/**
+ * Share the backed pages of vma from parent with child, read-only in both
+ * (parent's vm_lock held). A page whose reference count is full is
+ * copied instead. Pages of shared areas stay writable and are never
+ * copied.
+ */
+static int vm_fork_area(struct address_space *parent, struct address_space *child,
+                        struct vm_area *vma) {
+    uint32_t shared_flags = vma->flags & ~MEMORY_WRITABLE;
+
+    for (uint64_t page = vma->start; page < vma->end; page += PAGE_SIZE_4K) {
+        uint64_t phys = arch_aspace_translate(parent->root, page);
+        if (!phys) {
+            continue;
+        }
+
+        if (vma->map_flags & VM_MAP_SHARED) {
+            if (page_ref_get((void *)phys) < 0) {
+                return -1;
+            }
+            if (arch_aspace_map_page(child->root, page, phys, vma->flags) < 0) {
+                page_ref_put((void *)phys);
+                return -1;
+            }
+            child->resident_pages++;
+            continue;
+        }
+
+        uint64_t target = phys;
+        uint32_t flags = shared_flags;
+        if (page_ref_get((void *)phys) < 0) {
+            void *copy = memory_alloc_pages(1);
+            if (!copy) {
+                return -1;
+            }
+            memcpy(copy, (void *)phys, PAGE_SIZE_4K);
+            target = (uint64_t)copy;
+            flags = vma->flags;
+        } else if (arch_aspace_map_page(parent->root, page, phys, shared_flags) < 0) {
+            page_ref_put((void *)phys);
+            return -1;
+        }
+
+        if (arch_aspace_map_page(child->root, page, target, flags) < 0) {
+            page_ref_put((void *)target);
+            return -1;
+        }
+        child->resident_pages++;
+    }
+    return 0;
+}
+
+struct address_space *vm_fork(struct address_space *parent) {
+    struct address_space *child = aspace_create();
+    if (!child || !parent) {
+        return child;
+    }
+
+    unsigned long irq = spin_lock_irqsave(&parent->vm_lock);
+    struct vm_area **link = &child->vmas;
+    int result = 0;
+    for (struct vm_area *vma = parent->vmas; vma && result == 0; vma = vma->next) {
+        struct vm_area *copy = kmalloc(sizeof(struct vm_area));
+        if (!copy) {
+            result = -1;
+            break;
+        }
+        *copy = *vma;
+        copy->next = NULL;
+        if (copy->file) {
+            copy->file->ref_count++;
+        }
+        *link = copy;
+        link = &copy->next;
+
+        result = vm_fork_area(parent, child, vma);
+    }
+    vm_tree_rebuild(child);
+    spin_unlock_irqrestore(&parent->vm_lock, irq);
+
+    // The parent's writable entries may still be cached here
+    arch_tlb_flush_all();
+
+    if (result < 0) {
+        aspace_put(child);  // Drops the references taken so far
+        return NULL;
+    }
+    return child;
+}
+
+/**
+ * Unmap the backed pages of vma in [start, end) and drop their references
+ * (vm_lock held, or as is dead). flush drops the TLB entries of the
+ * calling CPU's address space.
+ */
+static void vm_unmap_pages(struct address_space *as, struct vm_area *vma,
+                           uint64_t start, uint64_t end, int flush) {
+    for (uint64_t page = start; page < end; page += PAGE_SIZE_4K) {
+        uint64_t phys = arch_aspace_unmap_page(as->root, page);
+        if (!phys) {
+            continue;
+        }
+        if (flush) {
+            arch_tlb_flush_page(page);
+        }
+        if (vma->file) {
+            vm_file_frame_put(vma, page, phys);
+        } else {
+            page_ref_put((void *)phys);
+        }
+        as->resident_pages--;
+    }
+}
+
+uint64_t vm_map(struct address_space *as, uint64_t addr, size_t size, uint32_t flags,
+                uint32_t map_flags, struct file *file, uint64_t offset) {
+    if (!as || size == 0 || (offset & VM_PAGE_MASK)) {
+        return 0;
+    }
+    // Writes through a shared mapping only reach a file with a page cache
+    if (file && (map_flags & VM_MAP_SHARED) && !file->mapping) {
+        return 0;
+    }
+
+    uint64_t length = (size + VM_PAGE_MASK) & ~VM_PAGE_MASK;
+    if (map_flags & VM_MAP_FIXED) {
+        uint64_t end;
+        if (!vm_range_valid(addr, size, &end) || vm_unmap(as, addr, size) < 0) {
+            return 0;
+        }
+    }
+
+    struct vm_area *vma = vm_area_alloc(0, 0, flags);
+    if (!vma) {
+        return 0;
+    }
+    vma->map_flags = map_flags & VM_MAP_SHARED;
+    vma->offset = offset;
+
+    unsigned long irq = spin_lock_irqsave(&as->vm_lock);
+    uint64_t start = addr;
+    if (!(map_flags & VM_MAP_FIXED)) {
+        // First gap above USER_MMAP_BASE that fits
+        start = USER_MMAP_BASE;
+        for (struct vm_area *area = as->vmas; area; area = area->next) {
+            if (area->end <= start) {
+                continue;
+            }
+            if (area->start >= start + length) {
+                break;
+            }
+            start = area->end;
+        }
+    }
+    vma->start = start;
+    vma->end = start + length;
+
+    int result = -1;
+    if (vma->end <= USER_VM_END && vma->end > start) {
+        result = vm_insert(as, vma);
+    }
+    if (result == 0) {
+        vma->file = file;
+    }
+    spin_unlock_irqrestore(&as->vm_lock, irq);
+
+    if (result < 0) {
+        kfree(vma);
+        return 0;
+    }
+    return start;
+}
+
+int vm_unmap(struct address_space *as, uint64_t start, size_t size) {
+    uint64_t end;
+    if (!as || !vm_range_valid(start, size, &end)) {
+        return -1;
+    }
+
+    // A range inside one area splits it in two
+    struct vm_area *spare = kmalloc(sizeof(struct vm_area));
+    if (!spare) {
+        return -1;
+    }
+
+    struct vm_area *dead = NULL;
+    unsigned long irq = spin_lock_irqsave(&as->vm_lock);
+    struct vm_area **link = &as->vmas;
+    while (*link && (*link)->start < end) {
+        struct vm_area *vma = *link;
+        if (vma->end <= start) {
+            link = &vma->next;
+            continue;
+        }
+
+        uint64_t lo = vma->start > start ? vma->start : start;
+        uint64_t hi = vma->end < end ? vma->end : end;
+        vm_unmap_pages(as, vma, lo, hi, 1);
+
+        if (lo == vma->start && hi == vma->end) {
+            *link = vma->next;
+            vma->next = dead;
+            dead = vma;
+            continue;
+        }
+
+        if (lo > vma->start && hi < vma->end) {
+            *spare = *vma;
+            spare->start = hi;
+            spare->offset = vm_file_offset(vma, hi);
+            if (spare->file) {
+                spare->file->ref_count++;
+            }
+            vma->next = spare;
+            spare = NULL;
+            vma->end = lo;
+        } else if (lo == vma->start) {
+            vma->offset = vm_file_offset(vma, hi);
+            vma->start = hi;
+        } else {
+            vma->end = lo;
+        }
+        link = &vma->next;
+    }
+    vm_tree_rebuild(as);
+    spin_unlock_irqrestore(&as->vm_lock, irq);
+
+    while (dead) {
+        struct vm_area *next = dead->next;
+        vm_area_free(dead);
+        dead = next;
+    }
+    kfree(spare);
+    return 0;
+}
+
+/**
+ * Nothing runs in the address space any more, so no lock is needed and
+ * stale TLB entries retire with its ASID
+ */
+void vm_release(struct address_space *as) {
+    struct vm_area *vma = as->vmas;
+    while (vma) {
+        vm_unmap_pages(as, vma, vma->start, vma->end, 0);
+        struct vm_area *next = vma->next;
+        vm_area_free(vma);
+        vma = next;
+    }
+    as->vmas = NULL;
+    as->vma_root = NULL;
+    as->vma_cache = NULL;
+    as->resident_pages = 0;
+
+    arch_aspace_free_tables(as->root);
+}
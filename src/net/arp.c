@@ -0,0 +1,219 @@
+/*
+ * MiniOS ARP
+ * IPv4 to Ethernet address resolution
+ *
+ * A small fixed cache. Resolving an unknown address creates a pending
+ * entry holding the one most recent packet for it; the request is resent
+ * each second a few times before the entry and its packet are dropped.
+ * Any ARP packet addressed to us refreshes its sender's entry, and a
+ * resolved pending entry releases its packet. All of it under net_lock.
+ */
+
+#include "net.h"
+#include "kernel.h"
+#include "timer.h"
+
+#define ARP_CACHE_SIZE      32
+#define ARP_HTYPE_ETHERNET  1
+#define ARP_OP_REQUEST      1
+#define ARP_OP_REPLY        2
+#define ARP_RETRY_MS        1000
+#define ARP_MAX_RETRIES     3
+#define ARP_LIFETIME_MS     (5 * 60 * 1000)
+
+enum arp_state {
+    ARP_FREE,
+    ARP_PENDING,
+    ARP_RESOLVED,
+};
+
+struct arp_entry {
+    uint32_t ip;
+    uint8_t mac[ETH_ALEN];
+    enum arp_state state;
+    int retries;
+    uint64_t deadline_ms;           // Next retry, or expiry once resolved
+    struct network_interface *netif;
+    struct net_packet *pending;     // Sent once resolved
+};
+
+static struct arp_entry arp_cache[ARP_CACHE_SIZE];
+
+static const uint8_t eth_broadcast[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static struct arp_entry *arp_lookup(uint32_t ip)
+{
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        if (arp_cache[i].state != ARP_FREE && arp_cache[i].ip == ip) {
+            return &arp_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void arp_release(struct arp_entry *entry)
+{
+    if (entry->pending) {
+        net_packet_free(entry->pending);
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+// A free entry, or else the resolved one closest to expiring
+static struct arp_entry *arp_allocate(void)
+{
+    struct arp_entry *victim = NULL;
+
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        struct arp_entry *entry = &arp_cache[i];
+        if (entry->state == ARP_FREE) {
+            return entry;
+        }
+        if (entry->state == ARP_RESOLVED &&
+            (!victim || entry->deadline_ms < victim->deadline_ms)) {
+            victim = entry;
+        }
+    }
+    if (victim) {
+        arp_release(victim);
+    }
+    return victim;
+}
+
+static int arp_send(struct network_interface *netif, uint16_t oper, const uint8_t *tha,
+                    uint32_t tpa)
+{
+    struct net_packet *packet;
+    if (net_packet_alloc(&packet, sizeof(struct arp_header)) != NET_SUCCESS) {
+        return NET_ENOMEM;
+    }
+
+    struct arp_header *arp = net_packet_put(packet, sizeof(struct arp_header));
+    arp->htype = htons(ARP_HTYPE_ETHERNET);
+    arp->ptype = htons(ETH_P_IP);
+    arp->hlen = ETH_ALEN;
+    arp->plen = 4;
+    arp->oper = htons(oper);
+    memcpy(arp->sha, netif->mac_addr, ETH_ALEN);
+    arp->spa = netif->ip_addr;
+    if (oper == ARP_OP_REPLY) {
+        memcpy(arp->tha, tha, ETH_ALEN);
+    } else {
+        memset(arp->tha, 0, ETH_ALEN);
+    }
+    arp->tpa = tpa;
+
+    return net_transmit(netif, oper == ARP_OP_REPLY ? tha : eth_broadcast, ETH_P_ARP, packet);
+}
+
+// Record ip -> mac and send the packet waiting on it, if any
+static void arp_update(struct arp_entry *entry, struct network_interface *netif,
+                       uint32_t ip, const uint8_t *mac, uint64_t now)
+{
+    entry->ip = ip;
+    memcpy(entry->mac, mac, ETH_ALEN);
+    entry->state = ARP_RESOLVED;
+    entry->netif = netif;
+    entry->retries = 0;
+    entry->deadline_ms = now + ARP_LIFETIME_MS;
+
+    struct net_packet *pending = entry->pending;
+    entry->pending = NULL;
+    if (pending) {
+        net_transmit(netif, entry->mac, ETH_P_IP, pending);
+    }
+}
+
+void arp_input(struct network_interface *netif, struct net_packet *packet)
+{
+    if (packet->len < sizeof(struct arp_header)) {
+        netif->stats.rx_errors++;
+        return;
+    }
+
+    struct arp_header *arp = packet->data;
+    if (ntohs(arp->htype) != ARP_HTYPE_ETHERNET || ntohs(arp->ptype) != ETH_P_IP ||
+        arp->hlen != ETH_ALEN || arp->plen != 4) {
+        netif->stats.rx_dropped++;
+        return;
+    }
+
+    uint32_t spa = arp->spa;
+    uint32_t tpa = arp->tpa;
+    uint64_t now = timer_get_time_ms();
+
+    // Refresh what we know; only learn new senders that are talking to us
+    struct arp_entry *entry = arp_lookup(spa);
+    if (entry) {
+        arp_update(entry, netif, spa, arp->sha, now);
+    } else if (tpa == netif->ip_addr && netif->ip_addr != 0 && spa != 0) {
+        entry = arp_allocate();
+        if (entry) {
+            arp_update(entry, netif, spa, arp->sha, now);
+        }
+    }
+
+    if (ntohs(arp->oper) == ARP_OP_REQUEST && tpa == netif->ip_addr && netif->ip_addr != 0) {
+        uint8_t sha[ETH_ALEN];
+        memcpy(sha, arp->sha, ETH_ALEN);
+        arp_send(netif, ARP_OP_REPLY, sha, spa);
+    }
+}
+
+/**
+ * Send an IP packet to next_hop on netif, resolving its address first if
+ * need be. Consumes the packet.
+ */
+int arp_output(struct network_interface *netif, uint32_t next_hop, struct net_packet *packet)
+{
+    if (next_hop == 0xFFFFFFFFU ||
+        (netif->netmask && (next_hop | netif->netmask) == 0xFFFFFFFFU)) {
+        return net_transmit(netif, eth_broadcast, ETH_P_IP, packet);
+    }
+
+    struct arp_entry *entry = arp_lookup(next_hop);
+    if (entry && entry->state == ARP_RESOLVED) {
+        return net_transmit(netif, entry->mac, ETH_P_IP, packet);
+    }
+
+    if (!entry) {
+        entry = arp_allocate();
+        if (!entry) {
+            netif->stats.tx_dropped++;
+            net_packet_free(packet);
+            return NET_ENOMEM;
+        }
+        entry->ip = next_hop;
+        entry->state = ARP_PENDING;
+        entry->netif = netif;
+        entry->retries = 0;
+        entry->deadline_ms = timer_get_time_ms() + ARP_RETRY_MS;
+        arp_send(netif, ARP_OP_REQUEST, NULL, next_hop);
+    }
+
+    // Keep the newest packet only; TCP retransmits anything older
+    if (entry->pending) {
+        net_packet_free(entry->pending);
+        netif->stats.tx_dropped++;
+    }
+    entry->pending = packet;
+    return NET_SUCCESS;
+}
+
+void arp_timer(uint64_t now_ms)
+{
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        struct arp_entry *entry = &arp_cache[i];
+        if (entry->state == ARP_FREE || now_ms < entry->deadline_ms) {
+            continue;
+        }
+
+        if (entry->state == ARP_PENDING && entry->retries < ARP_MAX_RETRIES) {
+            entry->retries++;
+            entry->deadline_ms = now_ms + ARP_RETRY_MS;
+            arp_send(entry->netif, ARP_OP_REQUEST, NULL, entry->ip);
+        } else {
+            arp_release(entry);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * MiniOS ICMP
+ * Echo replies, so the host answers ping; other messages are dropped
+ */
+
+#include "net.h"
+#include "kernel.h"
+
+#define ICMP_ECHO_REPLY     0
+#define ICMP_ECHO_REQUEST   8
+
+void icmp_input(struct net_packet *packet, uint32_t src, uint32_t dst)
+{
+    struct network_interface *netif = packet->netif;
+
+    if (packet->len < sizeof(struct icmp_header)) {
+        netif->stats.rx_errors++;
+        return;
+    }
+    if (!(packet->flags & NET_PACKET_CSUM_VALID) &&
+        net_checksum_fold(net_checksum_add(0, packet->data, packet->len)) != 0) {
+        netif->stats.rx_errors++;
+        return;
+    }
+
+    struct icmp_header *icmp = packet->data;
+    if (icmp->type != ICMP_ECHO_REQUEST || icmp->code != 0) {
+        return;
+    }
+    if (dst == 0xFFFFFFFFU || !net_is_local_address(dst)) {
+        return;     // No replies to broadcasts
+    }
+
+    // The reply is the request with its type changed, identifier,
+    // sequence and payload echoed back
+    struct net_packet *reply;
+    if (net_packet_alloc(&reply, packet->len) != NET_SUCCESS) {
+        return;
+    }
+    struct icmp_header *out = net_packet_put(reply, packet->len);
+    memcpy(out, packet->data, packet->len);
+    out->type = ICMP_ECHO_REPLY;
+    out->checksum = 0;
+    out->checksum = net_checksum_fold(net_checksum_add(0, out, reply->len));
+
+    ip_output(reply, dst, src, IPPROTO_ICMP);
+}
@@ -0,0 +1,163 @@
+/*
+ * MiniOS IPv4
+ * Header checks, local delivery and routing
+ *
+ * No fragment reassembly or forwarding: fragments and packets for other
+ * hosts are dropped, and sockets keep their segments within the MTU, so
+ * nothing is ever fragmented on the way out either. Routing is by
+ * interface: loopback and this host's own addresses go to "lo", an
+ * address on an attached subnet goes straight to it, anything else to
+ * the first interface with a gateway.
+ */
+
+#include "net.h"
+#include "kernel.h"
+
+static uint16_t ip_next_id = 1;
+
+void ip_input(struct network_interface *netif, struct net_packet *packet)
+{
+    if (packet->len < IP_HLEN) {
+        netif->stats.rx_errors++;
+        return;
+    }
+
+    struct ip_header *ip = packet->data;
+    size_t hlen = (size_t)(ip->version_ihl & 0x0F) * 4;
+    size_t total = ntohs(ip->total_len);
+    if ((ip->version_ihl >> 4) != 4 || hlen < IP_HLEN || total < hlen || total > packet->len) {
+        netif->stats.rx_errors++;
+        return;
+    }
+    if (!(packet->flags & NET_PACKET_CSUM_VALID) &&
+        net_checksum_fold(net_checksum_add(0, ip, hlen)) != 0) {
+        netif->stats.rx_errors++;
+        return;
+    }
+
+    uint32_t dst = ip->dst;
+    if (dst != netif->ip_addr && dst != 0xFFFFFFFFU && !net_is_local_address(dst) &&
+        !(netif->netmask && (dst | netif->netmask) == 0xFFFFFFFFU)) {
+        netif->stats.rx_dropped++;      // Not for us, and we do not forward
+        return;
+    }
+    if (ntohs(ip->frag_off) & (IP_FLAG_MF | IP_OFFSET_MASK)) {
+        netif->stats.rx_dropped++;      // No reassembly
+        return;
+    }
+
+    uint32_t src = ip->src;
+    uint8_t protocol = ip->protocol;
+
+    // Trim link padding, then strip the header
+    packet->len = total;
+    net_packet_pull(packet, hlen);
+    packet->protocol = protocol;
+
+    switch (protocol) {
+    case IPPROTO_TCP:
+        tcp_input(packet, src, dst);
+        break;
+    case IPPROTO_UDP:
+        udp_input(packet, src, dst);
+        break;
+    case IPPROTO_ICMP:
+        icmp_input(packet, src, dst);
+        break;
+    default:
+        netif->stats.rx_dropped++;
+        break;
+    }
+}
+
+/**
+ * Pick the interface for dst and the address to hand the frame to there.
+ * Caller holds net_lock.
+ * @return The interface, or NULL if dst is unreachable
+ */
+struct network_interface *ip_route(uint32_t dst, uint32_t *next_hop)
+{
+    int local = net_is_local_address(dst);
+    struct network_interface *gateway = NULL;
+
+    for (struct network_interface *n = netif_first(); n; n = n->next) {
+        if (!(n->flags & NETIF_FLAG_UP)) {
+            continue;
+        }
+        if (local) {
+            if (n->flags & NETIF_FLAG_LOOPBACK) {
+                *next_hop = dst;
+                return n;
+            }
+            continue;
+        }
+        if (n->flags & NETIF_FLAG_LOOPBACK) {
+            continue;
+        }
+        if (n->ip_addr && ((n->ip_addr ^ dst) & n->netmask) == 0) {
+            *next_hop = dst;
+            return n;
+        }
+        if (!gateway && n->gateway) {
+            gateway = n;
+        }
+    }
+
+    if (gateway) {
+        *next_hop = gateway->gateway;
+    }
+    return gateway;
+}
+
+/**
+ * Address a socket without a bound one sends from to reach dst
+ * @return The address, or 0 if dst is unreachable
+ */
+uint32_t ip_source_address(uint32_t dst)
+{
+    if (net_is_local_address(dst)) {
+        return dst;     // Talk to ourselves from the address we were asked for
+    }
+
+    uint32_t next_hop;
+    struct network_interface *netif = ip_route(dst, &next_hop);
+    return netif ? netif->ip_addr : 0;
+}
+
+/**
+ * Prepend an IPv4 header and send the packet towards dst. Consumes the
+ * packet. Caller holds net_lock.
+ */
+int ip_output(struct net_packet *packet, uint32_t src, uint32_t dst, uint8_t protocol)
+{
+    uint32_t next_hop = 0;
+    struct network_interface *netif = ip_route(dst, &next_hop);
+    if (!netif) {
+        net_packet_free(packet);
+        return NET_EHOSTUNREACH;
+    }
+    size_t len = net_packet_frame_len(packet) + IP_HLEN;
+    if (len > (packet->gso_size ? netif->gso_max_size : netif->mtu)) {
+        netif->stats.tx_dropped++;
+        net_packet_free(packet);
+        return NET_EINVAL;
+    }
+
+    struct ip_header *ip = net_packet_push(packet, IP_HLEN);
+    ip->version_ihl = 0x45;
+    ip->tos = 0;
+    ip->total_len = htons((uint16_t)len);
+    ip->id = htons(ip_next_id++);
+    ip->frag_off = 0;
+    ip->ttl = IP_DEFAULT_TTL;
+    ip->protocol = protocol;
+    ip->checksum = 0;
+    ip->src = src ? src : netif->ip_addr;
+    ip->dst = dst;
+    ip->checksum = net_checksum_fold(net_checksum_add(0, ip, IP_HLEN));
+
+    if (netif->flags & NETIF_FLAG_LOOPBACK) {
+        return net_transmit(netif, NULL, ETH_P_IP, packet);
+    }
+    return arp_output(netif, next_hop, packet);
+}
@@ -0,0 +1,102 @@
+/*
+ * MiniOS Loopback Interface
+ *
+ * "lo", 127.0.0.1/8. Transmit only queues the frame: the stack calls it
+ * with net_lock held, so delivery happens from a tasklet, which hands the
+ * queue back to netif_receive() in order. Frames never leave memory, so
+ * they are marked as not needing their checksums verified, and TCP's are
+ * never filled in. The receiving side changes the frames it is given, so
+ * a shared or fragmented one is copied first: this is the wire.
+ */
+
+#include "net.h"
+#include "kernel.h"
+#include "softirq.h"
+
+#define LOOPBACK_MTU    ETH_MTU
+
+static struct network_interface loopback_netif;
+static struct tasklet loopback_tasklet;
+static spinlock_t loopback_lock = SPINLOCK_INIT;
+static struct net_packet *loopback_head = NULL;
+static struct net_packet *loopback_tail = NULL;
+
+static int loopback_transmit(struct network_interface *netif, struct net_packet *packet)
+{
+    (void)netif;
+
+    if (net_packet_unshare(&packet) != NET_SUCCESS) {
+        return NET_ENOMEM;
+    }
+    packet->flags |= NET_PACKET_CSUM_VALID;
+    packet->next = NULL;
+
+    unsigned long flags = spin_lock_irqsave(&loopback_lock);
+    if (loopback_tail) {
+        loopback_tail->next = packet;
+    } else {
+        loopback_head = packet;
+    }
+    loopback_tail = packet;
+    spin_unlock_irqrestore(&loopback_lock, flags);
+
+    tasklet_schedule(&loopback_tasklet);
+    return NET_SUCCESS;
+}
+
+// Deliver everything queued so far; frames sent while delivering are
+// picked up by the loop too
+static void loopback_deliver(void *data)
+{
+    struct network_interface *netif = data;
+
+    for (;;) {
+        unsigned long flags = spin_lock_irqsave(&loopback_lock);
+        struct net_packet *packet = loopback_head;
+        loopback_head = NULL;
+        loopback_tail = NULL;
+        spin_unlock_irqrestore(&loopback_lock, flags);
+
+        if (!packet) {
+            return;
+        }
+        while (packet) {
+            struct net_packet *next = packet->next;
+            packet->next = NULL;
+            netif_receive(netif, packet);
+            packet = next;
+        }
+    }
+}
+
+static struct net_device_ops loopback_ops = {
+    .open = NULL,
+    .close = NULL,
+    .transmit = loopback_transmit,
+    .set_mac = NULL,
+    .get_stats = NULL,
+    .poll = NULL,
+    .flush = NULL,
+};
+
+int loopback_init(void)
+{
+    struct network_interface *netif = &loopback_netif;
+
+    memset(netif, 0, sizeof(*netif));
+    strcpy(netif->name, "lo");
+    netif->type = NET_TYPE_LOOPBACK;
+    netif->flags = NETIF_FLAG_LOOPBACK;
+    netif->features = NETIF_F_CSUM;     // Never computed: the receiver trusts it
+    netif->mtu = LOOPBACK_MTU;
+    netif->ip_addr = htonl(0x7F000001U);
+    netif->netmask = htonl(0xFF000000U);
+    netif->ops = &loopback_ops;
+    tasklet_init(&loopback_tasklet, loopback_deliver, netif);
+
+    int result = netif_register(netif);
+    if (result != NET_SUCCESS) {
+        return result;
+    }
+    return netif_up(netif);
+}
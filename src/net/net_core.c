@@ -0,0 +1,700 @@
+/*
+ * MiniOS Network Core
+ * Interfaces, packet buffers, checksums and the stack's timer
+ *
+ * Packets come from fixed pools of full-frame buffers: the stack's own,
+ * and one per driver that keeps its receive buffers apart. Anything
+ * larger, and anything allocated while a pool is empty, comes from the
+ * heap. Buffers are reference counted so that a frame can sit in a socket
+ * queue, or back a fragment of another, without being copied.
+ *
+ * Interfaces sit on one list; each frame a driver receives is handed to
+ * netif_receive(), which takes net_lock and passes it to ARP or IPv4 by
+ * Ethernet type. Outgoing frames leave through net_transmit(), which
+ * writes the Ethernet header and gives the packet to the driver, after
+ * doing in software any checksum the interface does not offload. Frames
+ * sent inside net_tx_begin()/net_tx_end() form a burst the driver may
+ * hand to the device in one go. A periodic timer schedules the stack's
+ * tick as a tasklet; the tick polls drivers for anything their interrupt
+ * missed, then runs TCP's delayed ACKs and retransmissions and ages the
+ * ARP cache.
+ */
+
+#include "net.h"
+#include "kernel.h"
+#include "memory.h"
+#include "timer.h"
+#include "softirq.h"
+#include "format.h"
+
+spinlock_t net_lock = SPINLOCK_INIT;
+
+static struct network_interface *netif_list = NULL;
+static uint32_t net_timer_id = 0;
+static struct tasklet net_tick_tasklet;
+static int network_initialized = 0;
+static int net_tx_depth = 0;            // Open net_tx_begin() calls
+
+static const uint8_t eth_zero_mac[ETH_ALEN];
+
+/*
+ * Pools are one run of pages cut into NET_BUFFER_SIZE buffers, each a
+ * packet structure followed by its bytes. Free buffers are chained
+ * through next under the pool's own lock, since drivers allocate and
+ * free outside net_lock.
+ */
+struct net_packet_pool {
+    spinlock_t lock;
+    struct net_packet *free;
+    uint32_t count;
+    uint32_t available;
+    void *memory;
+    size_t pages;
+};
+
+#define NET_BUFFER_CAPACITY (NET_BUFFER_SIZE - sizeof(struct net_packet))
+
+_Static_assert(NET_BUFFER_CAPACITY >= NET_HEADROOM + ETH_FRAME_MAX,
+               "pool buffers must hold a full frame");
+
+static struct net_packet_pool *net_default_pool = NULL;
+
+struct net_packet_pool *net_pool_create(uint32_t count)
+{
+    struct net_packet_pool *pool = kmalloc(sizeof(struct net_packet_pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    size_t pages = ((size_t)count * NET_BUFFER_SIZE + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+    uint8_t *memory = memory_dma_alloc(pages * PAGE_SIZE_4K, PAGE_SIZE_4K, NULL);
+    if (!memory) {
+        kfree(pool);
+        return NULL;
+    }
+
+    spin_lock_init(&pool->lock);
+    pool->free = NULL;
+    for (uint32_t i = count; i-- > 0;) {
+        struct net_packet *p = (struct net_packet *)(memory + (size_t)i * NET_BUFFER_SIZE);
+        p->next = pool->free;
+        pool->free = p;
+    }
+    pool->count = count;
+    pool->available = count;
+    pool->memory = memory;
+    pool->pages = pages;
+    return pool;
+}
+
+// Every buffer must have come back
+void net_pool_destroy(struct net_packet_pool *pool)
+{
+    if (pool) {
+        memory_dma_free(pool->memory, pool->pages * PAGE_SIZE_4K);
+        kfree(pool);
+    }
+}
+
+void net_pool_usage(struct net_packet_pool *pool, uint32_t *available, uint32_t *count)
+{
+    *available = pool ? __atomic_load_n(&pool->available, __ATOMIC_RELAXED) : 0;
+    *count = pool ? pool->count : 0;
+}
+
+static void net_packet_init(struct net_packet *p, struct net_packet_pool *pool, size_t capacity)
+{
+    p->data = net_packet_head(p) + NET_HEADROOM;
+    p->len = 0;
+    p->capacity = capacity;
+    p->pool = pool;
+    p->refcount = 1;
+    p->frag = NULL;
+    p->frag_data = NULL;
+    p->frag_len = 0;
+    p->netif = NULL;
+    p->protocol = 0;
+    p->flags = 0;
+    p->csum_start = 0;
+    p->csum_offset = 0;
+    p->gso_size = 0;
+    p->timestamp = (uint32_t)timer_get_time_ms();
+    p->next = NULL;
+}
+
+/**
+ * Take a full-size buffer from pool, or from the heap if the pool is
+ * empty or NULL; data starts empty, past the headroom
+ */
+int net_packet_alloc_pool(struct net_packet_pool *pool, struct net_packet **packet)
+{
+    if (!packet) {
+        return NET_EINVAL;
+    }
+
+    struct net_packet *p = NULL;
+    if (pool) {
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+        p = pool->free;
+        if (p) {
+            pool->free = p->next;
+            pool->available--;
+        }
+        spin_unlock_irqrestore(&pool->lock, flags);
+    }
+    if (!p) {
+        pool = NULL;
+        p = kmalloc(NET_BUFFER_SIZE);
+        if (!p) {
+            *packet = NULL;
+            return NET_ENOMEM;
+        }
+    }
+
+    net_packet_init(p, pool, NET_BUFFER_CAPACITY);
+    *packet = p;
+    return NET_SUCCESS;
+}
+
+/**
+ * Allocate a packet with room for size bytes of frame plus NET_HEADROOM,
+ * from the stack's pool if it fits a buffer there; data starts empty,
+ * past the headroom
+ */
+int net_packet_alloc(struct net_packet **packet, size_t size)
+{
+    if (!packet) {
+        return NET_EINVAL;
+    }
+    if (NET_HEADROOM + size <= NET_BUFFER_CAPACITY) {
+        return net_packet_alloc_pool(net_default_pool, packet);
+    }
+
+    struct net_packet *p = kmalloc(sizeof(struct net_packet) + NET_HEADROOM + size);
+    if (!p) {
+        *packet = NULL;
+        return NET_ENOMEM;
+    }
+    net_packet_init(p, NULL, NET_HEADROOM + size);
+    *packet = p;
+    return NET_SUCCESS;
+}
+
+struct net_packet *net_packet_get(struct net_packet *packet)
+{
+    __atomic_add_fetch(&packet->refcount, 1, __ATOMIC_RELAXED);
+    return packet;
+}
+
+void net_packet_free(struct net_packet *packet)
+{
+    if (!packet || __atomic_sub_fetch(&packet->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    net_packet_free(packet->frag);
+
+    struct net_packet_pool *pool = packet->pool;
+    if (!pool) {
+        kfree(packet);
+        return;
+    }
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+    packet->next = pool->free;
+    pool->free = packet;
+    pool->available++;
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/**
+ * Replace *packet with a copy nobody else holds, fragment folded in, for
+ * whoever has to change a frame that may be shared. Consumes the
+ * original either way.
+ */
+int net_packet_unshare(struct net_packet **packet)
+{
+    struct net_packet *old = *packet;
+    if (!net_packet_shared(old) && !old->frag) {
+        return NET_SUCCESS;
+    }
+
+    struct net_packet *copy;
+    size_t len = net_packet_frame_len(old);
+    if (net_packet_alloc(&copy, len) != NET_SUCCESS) {
+        net_packet_free(old);
+        *packet = NULL;
+        return NET_ENOMEM;
+    }
+
+    uint8_t *bytes = net_packet_put(copy, len);
+    memcpy(bytes, old->data, old->len);
+    memcpy(bytes + old->len, old->frag_data, old->frag_len);
+    copy->netif = old->netif;
+    copy->protocol = old->protocol;
+    copy->flags = old->flags;
+    copy->csum_start = (uint16_t)(old->csum_start + NET_HEADROOM -
+                                  ((uint8_t *)old->data - net_packet_head(old)));
+    copy->csum_offset = old->csum_offset;
+    copy->gso_size = old->gso_size;
+    copy->timestamp = old->timestamp;
+
+    net_packet_free(old);
+    *packet = copy;
+    return NET_SUCCESS;
+}
+
+// The checksum a partial packet left to the device. Headers ahead of a
+// fragment are whole 16-bit words, so its sum just adds on.
+static void net_packet_csum_finish(struct net_packet *packet)
+{
+    uint8_t *start = net_packet_head(packet) + packet->csum_start;
+    size_t len = (size_t)((uint8_t *)packet->data + packet->len - start);
+    uint32_t partial = net_checksum_add(0, start, len);
+    uint16_t sum = net_checksum_fold(net_checksum_add(partial, packet->frag_data,
+                                                      packet->frag_len));
+    memcpy(start + packet->csum_offset, &sum, sizeof(sum));
+    packet->flags &= (uint8_t)~NET_PACKET_CSUM_PARTIAL;
+}
+
+/**
+ * Hand a complete frame to the interface's driver, which owns it from
+ * here. Offloads the interface lacks are done here instead, except
+ * segmentation: only TCP builds oversized packets, and only for
+ * interfaces with NETIF_F_TSO.
+ */
+int net_packet_send(struct network_interface *netif, struct net_packet *packet)
+{
+    if (!netif || !packet) {
+        net_packet_free(packet);
+        return NET_EINVAL;
+    }
+    if (!(netif->flags & NETIF_FLAG_UP) || !netif->ops || !netif->ops->transmit ||
+        (packet->gso_size && !(netif->features & NETIF_F_TSO))) {
+        netif->stats.tx_dropped++;
+        net_packet_free(packet);
+        return NET_EHOSTUNREACH;
+    }
+    if ((packet->flags & NET_PACKET_CSUM_PARTIAL) && !(netif->features & NETIF_F_CSUM)) {
+        net_packet_csum_finish(packet);
+    }
+
+    size_t len = net_packet_frame_len(packet);
+    packet->netif = netif;
+    if (net_tx_depth > 0 && netif->ops->flush) {
+        packet->flags |= NET_PACKET_XMIT_MORE;
+        netif->flags |= NETIF_FLAG_TX_PENDING;
+    }
+    int result = netif->ops->transmit(netif, packet);
+    if (result == NET_SUCCESS) {
+        netif->stats.tx_packets++;
+        netif->stats.tx_bytes += len;
+    } else {
+        netif->stats.tx_errors++;
+    }
+    return result;
+}
+
+/**
+ * Prepend the Ethernet header and send. Caller holds net_lock.
+ */
+int net_transmit(struct network_interface *netif, const uint8_t *dst_mac, uint16_t type,
+                 struct net_packet *packet)
+{
+    struct eth_header *eth = net_packet_push(packet, ETH_HLEN);
+    memcpy(eth->dst, dst_mac ? dst_mac : eth_zero_mac, ETH_ALEN);
+    memcpy(eth->src, netif->mac_addr, ETH_ALEN);
+    eth->type = htons(type);
+    return net_packet_send(netif, packet);
+}
+
+void net_tx_begin(void)
+{
+    net_tx_depth++;
+}
+
+// Close a burst: the outermost end has drivers send what they held back
+void net_tx_end(void)
+{
+    if (--net_tx_depth > 0) {
+        return;
+    }
+    for (struct network_interface *n = netif_list; n; n = n->next) {
+        if (n->flags & NETIF_FLAG_TX_PENDING) {
+            n->flags &= ~NETIF_FLAG_TX_PENDING;
+            n->ops->flush(n);
+        }
+    }
+}
+
+/**
+ * Entry point for received frames. Runs outside net_lock, typically from
+ * a driver's tasklet; always consumes the packet.
+ */
+void netif_receive(struct network_interface *netif, struct net_packet *packet)
+{
+    if (!netif || !packet) {
+        net_packet_free(packet);
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    net_tx_begin();     // Replies and the segments an ACK releases go out together
+
+    netif->stats.rx_packets++;
+    netif->stats.rx_bytes += packet->len;
+    packet->netif = netif;
+
+    if (!(netif->flags & NETIF_FLAG_UP) || packet->len < ETH_HLEN) {
+        netif->stats.rx_dropped++;
+    } else {
+        struct eth_header *eth = packet->data;
+        uint16_t type = ntohs(eth->type);
+        net_packet_pull(packet, ETH_HLEN);
+
+        if (type == ETH_P_IP) {
+            ip_input(netif, packet);
+        } else if (type == ETH_P_ARP) {
+            arp_input(netif, packet);
+        } else {
+            netif->stats.rx_dropped++;
+        }
+    }
+
+    net_tx_end();
+    spin_unlock_irqrestore(&net_lock, flags);
+    net_packet_free(packet);
+}
+
+int netif_register(struct network_interface *netif)
+{
+    if (!netif || !netif->ops) {
+        return NET_EINVAL;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    for (struct network_interface *n = netif_list; n; n = n->next) {
+        if (n == netif || strcmp(n->name, netif->name) == 0) {
+            spin_unlock_irqrestore(&net_lock, flags);
+            return NET_ERROR;
+        }
+    }
+    memset(&netif->stats, 0, sizeof(netif->stats));
+
+    // Append, so that lookups meet interfaces in registration order
+    struct network_interface **link = &netif_list;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    netif->next = NULL;
+    *link = netif;
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    return NET_SUCCESS;
+}
+
+int netif_unregister(struct network_interface *netif)
+{
+    if (!netif) {
+        return NET_EINVAL;
+    }
+
+    netif_down(netif);
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    for (struct network_interface **link = &netif_list; *link; link = &(*link)->next) {
+        if (*link == netif) {
+            *link = netif->next;
+            netif->next = NULL;
+            spin_unlock_irqrestore(&net_lock, flags);
+            return NET_SUCCESS;
+        }
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    return NET_ERROR;
+}
+
+struct network_interface *netif_find(const char *name)
+{
+    if (!name) {
+        return NULL;
+    }
+
+    for (struct network_interface *n = netif_list; n; n = n->next) {
+        if (strcmp(n->name, name) == 0) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+// Interfaces are only ever added, so the list may be walked without the lock
+struct network_interface *netif_first(void)
+{
+    return netif_list;
+}
+
+int netif_up(struct network_interface *netif)
+{
+    if (!netif) {
+        return NET_EINVAL;
+    }
+    if (netif->flags & NETIF_FLAG_UP) {
+        return NET_SUCCESS;
+    }
+    if (netif->ops->open) {
+        int result = netif->ops->open(netif);
+        if (result != NET_SUCCESS) {
+            return result;
+        }
+    }
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    netif->flags |= NETIF_FLAG_UP;
+    spin_unlock_irqrestore(&net_lock, flags);
+    return NET_SUCCESS;
+}
+
+int netif_down(struct network_interface *netif)
+{
+    if (!netif) {
+        return NET_EINVAL;
+    }
+    if (!(netif->flags & NETIF_FLAG_UP)) {
+        return NET_SUCCESS;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    netif->flags &= ~NETIF_FLAG_UP;
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    if (netif->ops->close) {
+        netif->ops->close(netif);
+    }
+    return NET_SUCCESS;
+}
+
+int netif_set_ip(struct network_interface *netif, uint32_t ip, uint32_t netmask, uint32_t gateway)
+{
+    if (!netif) {
+        return NET_EINVAL;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    netif->ip_addr = ip;
+    netif->netmask = netmask;
+    netif->gateway = gateway;
+    spin_unlock_irqrestore(&net_lock, flags);
+    return NET_SUCCESS;
+}
+
+int netif_get_ip(struct network_interface *netif, uint32_t *ip, uint32_t *netmask, uint32_t *gateway)
+{
+    if (!netif) {
+        return NET_EINVAL;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    if (ip) {
+        *ip = netif->ip_addr;
+    }
+    if (netmask) {
+        *netmask = netif->netmask;
+    }
+    if (gateway) {
+        *gateway = netif->gateway;
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+    return NET_SUCCESS;
+}
+
+/**
+ * Whether addr belongs to this host: a loopback address or one assigned
+ * to an interface that is up. Caller holds net_lock.
+ */
+int net_is_local_address(uint32_t addr)
+{
+    if ((ntohl(addr) >> 24) == 127) {
+        return 1;
+    }
+    for (struct network_interface *n = netif_list; n; n = n->next) {
+        if ((n->flags & NETIF_FLAG_UP) && n->ip_addr == addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Ones' complement sum over 16-bit big-endian words. The sum is taken in
+ * host order on a byte-swapped view, which folds to the same result, so
+ * the loop is plain 16-bit loads.
+ */
+uint32_t net_checksum_add(uint32_t sum, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    uint64_t acc = sum;
+
+    while (len >= 8) {
+        uint16_t w[4];
+        memcpy(w, bytes, sizeof(w));
+        acc += (uint32_t)w[0] + w[1] + w[2] + w[3];
+        bytes += 8;
+        len -= 8;
+    }
+    while (len >= 2) {
+        uint16_t w;
+        memcpy(&w, bytes, sizeof(w));
+        acc += w;
+        bytes += 2;
+        len -= 2;
+    }
+    if (len) {
+        uint16_t w = 0;
+        memcpy(&w, bytes, 1);   // Odd byte is the high half of a big-endian word
+        acc += w;
+    }
+
+    while (acc >> 32) {
+        acc = (acc & 0xFFFFFFFFULL) + (acc >> 32);
+    }
+    return (uint32_t)acc;
+}
+
+// Finish a sum: the result is stored as is, it is already in wire order
+uint16_t net_checksum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+uint32_t net_pseudo_header_sum(uint32_t src, uint32_t dst, uint8_t protocol, uint16_t len)
+{
+    uint32_t sum = 0;
+    sum = net_checksum_add(sum, &src, sizeof(src));
+    sum = net_checksum_add(sum, &dst, sizeof(dst));
+    uint16_t words[2] = { htons(protocol), htons(len) };
+    return net_checksum_add(sum, words, sizeof(words));
+}
+
+/**
+ * Parse a dotted quad into a network byte order address
+ * @return The address, or 0xFFFFFFFF if cp is not one
+ */
+uint32_t inet_addr(const char *cp)
+{
+    if (!cp) {
+        return 0xFFFFFFFFU;
+    }
+
+    uint32_t addr = 0;
+    for (int part = 0; part < 4; part++) {
+        if (*cp < '0' || *cp > '9') {
+            return 0xFFFFFFFFU;
+        }
+        uint32_t value = 0;
+        while (*cp >= '0' && *cp <= '9') {
+            value = value * 10 + (uint32_t)(*cp++ - '0');
+            if (value > 255) {
+                return 0xFFFFFFFFU;
+            }
+        }
+        addr = (addr << 8) | value;
+        if (part < 3 && *cp++ != '.') {
+            return 0xFFFFFFFFU;
+        }
+    }
+    return *cp == '\0' ? htonl(addr) : 0xFFFFFFFFU;
+}
+
+// Format a network byte order address; the result is overwritten by the
+// next call
+char *inet_ntoa(uint32_t addr)
+{
+    static char buffer[16];
+    uint32_t host = ntohl(addr);
+    char *out = buffer;
+
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += format_u64(out, (host >> shift) & 0xFF);
+        if (shift) {
+            *out++ = '.';
+        }
+    }
+    *out = '\0';
+    return buffer;
+}
+
+// Stack tick, as a tasklet: drivers first, outside the lock, since their
+// poll delivers frames through netif_receive()
+static void net_tick(void *data)
+{
+    (void)data;
+
+    for (struct network_interface *n = netif_list; n; n = n->next) {
+        if ((n->flags & NETIF_FLAG_UP) && n->ops->poll) {
+            n->ops->poll(n);
+        }
+    }
+
+    uint64_t now = timer_get_time_ms();
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    net_tx_begin();
+    tcp_timer(now);
+    arp_timer(now);
+    net_tx_end();
+    spin_unlock_irqrestore(&net_lock, flags);
+}
+
+// Runs from the timer interrupt
+static void net_timer_callback(void *data)
+{
+    (void)data;
+    tasklet_schedule(&net_tick_tasklet);
+}
+
+/**
+ * Bring up loopback and the stack's timer. Ethernet interfaces register
+ * themselves as their drivers probe.
+ */
+int network_init(void)
+{
+    if (network_initialized) {
+        return NET_SUCCESS;
+    }
+
+    tasklet_init(&net_tick_tasklet, net_tick, NULL);
+
+    net_default_pool = net_pool_create(NET_POOL_BUFFERS);
+    if (!net_default_pool) {
+        early_print("Warning: no packet pool, packets come from the heap\n");
+    }
+
+    int result = loopback_init();
+    if (result != NET_SUCCESS) {
+        early_print("Warning: loopback interface setup failed\n");
+    }
+
+    net_timer_id = timer_create(TIMER_TYPE_PERIODIC, (uint64_t)NET_TICK_MS * 1000,
+                                net_timer_callback, NULL);
+    if (net_timer_id) {
+        timer_start(net_timer_id);
+    }
+
+    network_initialized = 1;
+    return result;
+}
+
+void network_cleanup(void)
+{
+    if (net_timer_id) {
+        timer_destroy(net_timer_id);
+        net_timer_id = 0;
+    }
+    while (netif_list) {
+        netif_unregister(netif_list);
+    }
+    network_initialized = 0;
+}
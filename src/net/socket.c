@@ -0,0 +1,248 @@
+/*
+ * MiniOS Sockets
+ *
+ * A socket is an open file whose inode carries the struct socket, the
+ * way a pipe end carries its pipe, so it takes a descriptor from the
+ * task's table, vfs_read()/vfs_write() are recv()/send(), and closing the
+ * last reference closes the connection. The sys_* calls find the socket
+ * behind a descriptor and hand over to the protocol's socket_ops, and so
+ * does polling the file for epoll.
+ */
+
+#include "network.h"
+#include "net.h"
+#include "vfs.h"
+#include "fd.h"
+#include "kernel.h"
+
+static ssize_t socket_file_read(struct file *file, void *buf, size_t count, off_t offset);
+static ssize_t socket_file_write(struct file *file, const void *buf, size_t count, off_t offset);
+static int socket_file_close(struct file *file);
+static uint32_t socket_file_poll(struct file *file, struct poll_table *pt);
+
+static struct file_operations socket_file_ops = {
+    .read = socket_file_read,
+    .write = socket_file_write,
+    .close = socket_file_close,
+    .poll = socket_file_poll,
+};
+
+static inline struct socket *socket_of(struct file *file)
+{
+    return (struct socket *)file->inode->private_data;
+}
+
+static ssize_t socket_file_read(struct file *file, void *buf, size_t count, off_t offset)
+{
+    (void)offset;
+    struct socket *sock = socket_of(file);
+    return sock->ops->recv(sock, buf, count, 0);
+}
+
+static ssize_t socket_file_write(struct file *file, const void *buf, size_t count, off_t offset)
+{
+    (void)offset;
+    struct socket *sock = socket_of(file);
+    return sock->ops->send(sock, buf, count, 0);
+}
+
+static uint32_t socket_file_poll(struct file *file, struct poll_table *pt)
+{
+    struct socket *sock = socket_of(file);
+    return sock->ops->poll(sock, pt);
+}
+
+// Last reference: the protocol lets go of the socket before it is freed
+static int socket_file_close(struct file *file)
+{
+    struct socket *sock = socket_of(file);
+    if (sock) {
+        sock->ops->close(sock);
+        kfree(sock);
+        file->inode->private_data = NULL;
+    }
+    return VFS_SUCCESS;
+}
+
+/**
+ * Wrap sock in a file and give it a descriptor. On failure the socket is
+ * closed and freed.
+ * @return The descriptor, or a negative error
+ */
+static int socket_install(struct socket *sock)
+{
+    struct file *file = kmalloc(sizeof(struct file));
+    struct inode *inode = kmalloc(sizeof(struct inode));
+    if (!file || !inode) {
+        kfree(file);
+        kfree(inode);
+        sock->ops->close(sock);
+        kfree(sock);
+        return NET_ENOMEM;
+    }
+
+    memset(inode, 0, sizeof(struct inode));
+    inode->private_data = sock;
+    inode->ref_count = 1;
+
+    memset(file, 0, sizeof(struct file));
+    file->inode = inode;
+    file->flags = VFS_O_RDWR;
+    file->ref_count = 1;
+    file->ops = &socket_file_ops;
+
+    int fd = fd_install(fd_get_current_table(), file, VFS_O_RDWR);
+    if (fd < 0) {
+        vfs_file_put(file);
+        return VFS_ENOSPC;
+    }
+    return fd;
+}
+
+// The socket behind a descriptor, or NULL with *error set
+static struct socket *socket_lookup(int sockfd, int *error)
+{
+    struct file_descriptor *desc = fd_get(fd_get_current_table(), sockfd);
+    if (!desc || !desc->file) {
+        *error = NET_EINVAL;
+        return NULL;
+    }
+    if (desc->file->ops != &socket_file_ops || !socket_of(desc->file)) {
+        *error = NET_ENOTSOCK;
+        return NULL;
+    }
+    return socket_of(desc->file);
+}
+
+int sys_socket(int domain, int type, int protocol)
+{
+    if (domain != AF_INET) {
+        return NET_EINVAL;
+    }
+    if (type == SOCK_STREAM && (protocol == 0 || protocol == IPPROTO_TCP)) {
+        protocol = IPPROTO_TCP;
+    } else if (type == SOCK_DGRAM && (protocol == 0 || protocol == IPPROTO_UDP)) {
+        protocol = IPPROTO_UDP;
+    } else {
+        return NET_EINVAL;
+    }
+
+    struct socket *sock = kmalloc(sizeof(struct socket));
+    if (!sock) {
+        return NET_ENOMEM;
+    }
+    memset(sock, 0, sizeof(*sock));
+    sock->domain = domain;
+    sock->type = type;
+    sock->protocol = protocol;
+
+    int result = protocol == IPPROTO_TCP ? tcp_socket_create(sock) : udp_socket_create(sock);
+    if (result != NET_SUCCESS) {
+        kfree(sock);
+        return result;
+    }
+    return socket_install(sock);
+}
+
+int sys_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    return sock->ops->bind(sock, addr, addrlen);
+}
+
+int sys_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    return sock->ops->connect(sock, addr, addrlen);
+}
+
+int sys_listen(int sockfd, int backlog)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    if (!sock->ops->listen) {
+        return NET_EINVAL;
+    }
+    return sock->ops->listen(sock, backlog);
+}
+
+int sys_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    if (!sock->ops->accept) {
+        return NET_EINVAL;
+    }
+
+    struct socket *newsock;
+    int result = sock->ops->accept(sock, &newsock, addr, addrlen);
+    if (result != NET_SUCCESS) {
+        return result;
+    }
+    return socket_install(newsock);
+}
+
+ssize_t sys_send(int sockfd, const void *buf, size_t len, int flags)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    return sock->ops->send(sock, buf, len, flags);
+}
+
+ssize_t sys_recv(int sockfd, void *buf, size_t len, int flags)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    return sock->ops->recv(sock, buf, len, flags);
+}
+
+ssize_t sys_sendto(int sockfd, const void *buf, size_t len, int flags,
+                   const struct sockaddr *addr, socklen_t addrlen)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    return sock->ops->sendto(sock, buf, len, flags, addr, addrlen);
+}
+
+ssize_t sys_recvfrom(int sockfd, void *buf, size_t len, int flags,
+                     struct sockaddr *addr, socklen_t *addrlen)
+{
+    int error;
+    struct socket *sock = socket_lookup(sockfd, &error);
+    if (!sock) {
+        return error;
+    }
+    return sock->ops->recvfrom(sock, buf, len, flags, addr, addrlen);
+}
+
+int sys_close_socket(int sockfd)
+{
+    int error;
+    if (!socket_lookup(sockfd, &error)) {
+        return error;
+    }
+    return vfs_close(sockfd);
+}
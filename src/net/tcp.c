@@ -0,0 +1,1723 @@
+/*
+ * MiniOS TCP
+ *
+ * Connections are control blocks (struct tcp_pcb) found through a hash of
+ * the remote address and both ports; listeners sit on a list of their
+ * own. Every block with a port is also on tcp_pcbs, which the stack tick
+ * walks for timers.
+ *
+ * Sending: bytes from snd_una on wait in a queue of packet buffers until
+ * they are acknowledged, copied there straight from the writer, each
+ * buffer filled up to one segment (or one TSO packet's worth). Output
+ * sends whatever the smaller of the peer's window and the congestion
+ * window allows, in segments of at most the MSS (packets of many, for an
+ * interface with TSO to cut up), and a FIN rides on the last of them once
+ * the socket is closed. A segment is a packet of headers with its payload
+ * attached as a fragment of the queued buffer, so neither sending nor
+ * retransmitting copies it again. Congestion
+ * control follows Reno: ten-segment initial window, slow start,
+ * congestion avoidance, fast retransmit after three duplicate ACKs at
+ * half the window, and one segment after a timeout. Both retransmissions
+ * go back to snd_una and resend from there. The retransmission timeout
+ * follows RFC 6298 with integer milliseconds, Karn's rule and
+ * exponential backoff.
+ *
+ * Receiving: in-order data stays in the packets it arrived in, queued on
+ * the connection until read; the read is its only copy. A small segment
+ * is copied onto the last packet queued instead while that has room, to
+ * keep the buffers held in check. The window advertised is the room left
+ * in TCP_RCV_BUF_SIZE. Segments beyond rcv_nxt are not
+ * queued; they are answered with an immediate duplicate ACK so that the
+ * sender retransmits quickly. ACKs are delayed: every second segment is
+ * acknowledged at once, a lone one on the next stack tick unless data
+ * going the other way carries the ACK first.
+ *
+ * Closed sockets leave their blocks to the stack, which finishes the
+ * close on its own and frees them. TIME_WAIT is kept short and drops the
+ * buffers on entry; a new SYN for a connection in TIME_WAIT replaces it.
+ * Addresses and ports are in network byte order throughout.
+ */
+
+#include "net.h"
+#include "kernel.h"
+#include "memory.h"
+#include "process.h"
+#include "timer.h"
+#include "vfs.h"
+
+// Header flags
+#define TCP_FIN             0x01
+#define TCP_SYN             0x02
+#define TCP_RST             0x04
+#define TCP_PSH             0x08
+#define TCP_ACK             0x10
+
+#define TCP_HLEN            20
+#define TCP_OPT_MSS_LEN     4
+#define TCP_OPT_END         0
+#define TCP_OPT_NOP         1
+#define TCP_OPT_MSS         2
+
+#define TCP_SND_BUF_SIZE    (32 * 1024)
+#define TCP_RCV_BUF_SIZE    (32 * 1024)
+#define TCP_DEFAULT_MSS     536         // Peer sent no MSS option
+#define TCP_INITIAL_WINDOW  10          // Segments (RFC 6928)
+#define TCP_CWND_MAX        (1024 * 1024)
+#define TCP_DUPACK_THRESH   3
+#define TCP_DELACK_SEGMENTS 2           // Acknowledge at once every this many
+#define TCP_COALESCE_MAX    256         // Received segments this small are copied
+
+#define TCP_RTO_INITIAL_MS  1000
+#define TCP_RTO_MIN_MS      200
+#define TCP_RTO_MAX_MS      60000
+#define TCP_MAX_RETRIES     8
+#define TCP_TIME_WAIT_MS    1000        // Far short of 2MSL: peers here are close
+#define TCP_FIN_WAIT_2_MS   10000       // Orphans whose peer never closes
+#define TCP_MAX_BACKLOG     128
+
+#define TCP_HASH_BITS       8
+#define TCP_HASH_SIZE       (1 << TCP_HASH_BITS)
+
+// Sequence number comparisons, modulo 2^32
+#define SEQ_LT(a, b)        ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b)       ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)        ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b)       ((int32_t)((a) - (b)) >= 0)
+
+enum tcp_state {
+    TCP_CLOSED,
+    TCP_LISTEN,
+    TCP_SYN_SENT,
+    TCP_SYN_RCVD,
+    TCP_ESTABLISHED,
+    TCP_FIN_WAIT_1,
+    TCP_FIN_WAIT_2,
+    TCP_CLOSE_WAIT,
+    TCP_CLOSING,
+    TCP_LAST_ACK,
+    TCP_TIME_WAIT,
+};
+
+struct tcp_pcb {
+    struct tcp_pcb *next;               // tcp_pcbs, once bound
+    struct tcp_pcb **pprev;
+    struct tcp_pcb *hash_next;          // Connection hash chain, or listener list
+    struct tcp_pcb **hash_pprev;
+
+    enum tcp_state state;
+    uint32_t local_ip;
+    uint32_t remote_ip;
+    uint16_t local_port;
+    uint16_t remote_port;
+
+    // Send side: the queue holds snd_len bytes starting at sequence snd_una
+    struct net_packet *snd_queue;       // Oldest first, linked through next
+    struct net_packet *snd_queue_tail;
+    uint32_t snd_len;
+    uint32_t iss;
+    uint32_t snd_una;                   // Oldest unacknowledged
+    uint32_t snd_nxt;                   // Next to send
+    uint32_t snd_max;                   // Highest ever sent
+    uint32_t snd_wnd;                   // Peer's window
+    uint32_t snd_wl1;                   // Segment seq and ack of the last
+    uint32_t snd_wl2;                   // window update
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint16_t mss;
+    int dupacks;
+    int fin_queued;                     // Closed: FIN follows the data
+    int queues_open;                    // From connecting until TIME_WAIT
+
+    // Receive side: the queue holds rcv_len bytes, from the next to read
+    struct net_packet *rcv_queue;
+    struct net_packet *rcv_queue_tail;
+    uint32_t rcv_len;
+    uint32_t irs;
+    uint32_t rcv_nxt;
+    uint32_t rcv_adv;                   // Right edge of the window last advertised
+    int ack_pending;                    // Segments not acknowledged yet
+
+    // Timers, in ms; deadlines of 0 are not armed
+    uint32_t rto;
+    int32_t srtt;                       // Smoothed RTT, scaled by 8
+    int32_t rttvar;                     // RTT variation, scaled by 4
+    uint64_t rto_deadline;
+    uint64_t state_deadline;            // TIME_WAIT, orphaned FIN_WAIT_2
+    uint32_t rtt_seq;                   // Timed segment's end
+    uint64_t rtt_start;
+    int rtt_active;
+    int retries;
+
+    int error;                          // Reported to the socket
+    struct socket *socket;              // NULL once closed, or until accepted
+    struct wait_queue wait;
+
+    // Listening: children not yet accepted, oldest first
+    struct tcp_pcb *listener;           // Child: where it is queued
+    struct tcp_pcb *child_next;
+    struct tcp_pcb *children;
+    int child_count;
+    int ready;                          // Children past the handshake
+    int is_ready;                       // Child: counted in listener->ready
+    int backlog;
+};
+
+static struct tcp_pcb *tcp_pcbs = NULL;
+static struct tcp_pcb *tcp_listeners = NULL;
+static struct tcp_pcb *tcp_hash[TCP_HASH_SIZE];
+static uint16_t tcp_next_port = NET_EPHEMERAL_FIRST;
+static uint32_t tcp_iss_offset = 0;
+
+static void tcp_output(struct tcp_pcb *pcb);
+
+static inline uint32_t tcp_hash_index(uint32_t remote_ip, uint16_t remote_port, uint16_t local_port)
+{
+    uint32_t h = remote_ip ^ (((uint32_t)remote_port << 16) | local_port);
+    return (h * 2654435761U) >> (32 - TCP_HASH_BITS);
+}
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static inline int tcp_synchronized(enum tcp_state state)
+{
+    return state >= TCP_ESTABLISHED;
+}
+
+// List plumbing: pprev points at whatever points at the block
+static void tcp_link(struct tcp_pcb **head, struct tcp_pcb *pcb)
+{
+    pcb->next = *head;
+    if (*head) {
+        (*head)->pprev = &pcb->next;
+    }
+    *head = pcb;
+    pcb->pprev = head;
+}
+
+static void tcp_unlink(struct tcp_pcb *pcb)
+{
+    if (pcb->pprev) {
+        *pcb->pprev = pcb->next;
+        if (pcb->next) {
+            pcb->next->pprev = pcb->pprev;
+        }
+        pcb->next = NULL;
+        pcb->pprev = NULL;
+    }
+}
+
+static void tcp_hash_link(struct tcp_pcb **head, struct tcp_pcb *pcb)
+{
+    pcb->hash_next = *head;
+    if (*head) {
+        (*head)->hash_pprev = &pcb->hash_next;
+    }
+    *head = pcb;
+    pcb->hash_pprev = head;
+}
+
+static void tcp_hash_unlink(struct tcp_pcb *pcb)
+{
+    if (pcb->hash_pprev) {
+        *pcb->hash_pprev = pcb->hash_next;
+        if (pcb->hash_next) {
+            pcb->hash_next->hash_pprev = pcb->hash_pprev;
+        }
+        pcb->hash_next = NULL;
+        pcb->hash_pprev = NULL;
+    }
+}
+
+static void tcp_hash_insert(struct tcp_pcb *pcb)
+{
+    tcp_hash_link(&tcp_hash[tcp_hash_index(pcb->remote_ip, pcb->remote_port, pcb->local_port)], pcb);
+}
+
+static struct tcp_pcb *tcp_lookup(uint32_t local_ip, uint16_t local_port,
+                                  uint32_t remote_ip, uint16_t remote_port)
+{
+    struct tcp_pcb *pcb = tcp_hash[tcp_hash_index(remote_ip, remote_port, local_port)];
+    for (; pcb; pcb = pcb->hash_next) {
+        if (pcb->remote_port == remote_port && pcb->local_port == local_port &&
+            pcb->remote_ip == remote_ip && pcb->local_ip == local_ip) {
+            return pcb;
+        }
+    }
+    return NULL;
+}
+
+static struct tcp_pcb *tcp_find_listener(uint32_t ip, uint16_t port)
+{
+    struct tcp_pcb *wildcard = NULL;
+    for (struct tcp_pcb *pcb = tcp_listeners; pcb; pcb = pcb->hash_next) {
+        if (pcb->local_port != port) {
+            continue;
+        }
+        if (pcb->local_ip == ip) {
+            return pcb;
+        }
+        if (pcb->local_ip == INADDR_ANY) {
+            wildcard = pcb;
+        }
+    }
+    return wildcard;
+}
+
+/*
+ * Binding behaves as if SO_REUSEADDR were always set: only listeners and
+ * other sockets bound but not yet in use hold a port against bind(), so
+ * a server can be restarted while its old connections are in TIME_WAIT.
+ * Ephemeral ports avoid every port in use at all.
+ */
+static int tcp_port_in_use(uint16_t port, uint32_t ip, int any_use)
+{
+    for (struct tcp_pcb *pcb = tcp_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->local_port != port) {
+            continue;
+        }
+        if (!any_use && pcb->state != TCP_LISTEN && pcb->state != TCP_CLOSED) {
+            continue;
+        }
+        if (pcb->local_ip == INADDR_ANY || ip == INADDR_ANY || pcb->local_ip == ip) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int tcp_bind_locked(struct tcp_pcb *pcb, uint32_t ip, uint16_t port)
+{
+    if (port == 0) {
+        for (int tries = NET_EPHEMERAL_LAST - NET_EPHEMERAL_FIRST + 1; tries > 0; tries--) {
+            uint16_t candidate = htons(tcp_next_port);
+            tcp_next_port = tcp_next_port == NET_EPHEMERAL_LAST ? NET_EPHEMERAL_FIRST
+                                                                : tcp_next_port + 1;
+            if (!tcp_port_in_use(candidate, ip, 1)) {
+                port = candidate;
+                break;
+            }
+        }
+        if (port == 0) {
+            return NET_EADDRINUSE;
+        }
+    } else if (tcp_port_in_use(port, ip, 0)) {
+        return NET_EADDRINUSE;
+    }
+
+    pcb->local_ip = ip;
+    pcb->local_port = port;
+    tcp_link(&tcp_pcbs, pcb);
+    return NET_SUCCESS;
+}
+
+static uint32_t tcp_new_iss(void)
+{
+    // RFC 793's 4 us clock, spread apart per connection
+    tcp_iss_offset += 64000;
+    return (uint32_t)(timer_get_time_us() >> 2) + tcp_iss_offset;
+}
+
+static struct tcp_pcb *tcp_pcb_alloc(void)
+{
+    struct tcp_pcb *pcb = kmalloc(sizeof(struct tcp_pcb));
+    if (!pcb) {
+        return NULL;
+    }
+    memset(pcb, 0, sizeof(*pcb));
+    pcb->state = TCP_CLOSED;
+    pcb->rto = TCP_RTO_INITIAL_MS;
+    pcb->mss = TCP_DEFAULT_MSS;
+    wait_queue_init(&pcb->wait);
+    return pcb;
+}
+
+static void tcp_free_queue(struct net_packet **head, struct net_packet **tail)
+{
+    while (*head) {
+        struct net_packet *next = (*head)->next;
+        net_packet_free(*head);
+        *head = next;
+    }
+    *tail = NULL;
+}
+
+static void tcp_free_buffers(struct tcp_pcb *pcb)
+{
+    tcp_free_queue(&pcb->snd_queue, &pcb->snd_queue_tail);
+    tcp_free_queue(&pcb->rcv_queue, &pcb->rcv_queue_tail);
+    pcb->queues_open = 0;
+    pcb->snd_len = 0;
+    pcb->rcv_len = 0;
+}
+
+// Largest segment to send towards the peer, before its MSS option
+static uint16_t tcp_route_mss(uint32_t remote_ip)
+{
+    uint32_t next_hop;
+    struct network_interface *netif = ip_route(remote_ip, &next_hop);
+    if (!netif || netif->mtu <= IP_HLEN + TCP_HLEN) {
+        return TCP_DEFAULT_MSS;
+    }
+    return (uint16_t)(netif->mtu - IP_HLEN - TCP_HLEN);
+}
+
+/*
+ * Most payload to put in one packet towards the peer: whole segments up
+ * to the interface's TSO limit, or else one
+ */
+static uint32_t tcp_route_send_max(struct tcp_pcb *pcb)
+{
+    uint32_t next_hop;
+    struct network_interface *netif = ip_route(pcb->remote_ip, &next_hop);
+    if (!netif || !(netif->features & NETIF_F_TSO) ||
+        netif->gso_max_size < IP_HLEN + TCP_HLEN + 2u * pcb->mss) {
+        return pcb->mss;
+    }
+
+    uint32_t segments = (netif->gso_max_size - IP_HLEN - TCP_HLEN) / pcb->mss;
+    return segments * pcb->mss;
+}
+
+static void tcp_init_congestion(struct tcp_pcb *pcb)
+{
+    pcb->cwnd = (uint32_t)pcb->mss * TCP_INITIAL_WINDOW;
+    pcb->ssthresh = TCP_CWND_MAX;
+    pcb->dupacks = 0;
+}
+
+// Detach a child from its listener's queue
+static void tcp_child_remove(struct tcp_pcb *pcb)
+{
+    struct tcp_pcb *listener = pcb->listener;
+    if (!listener) {
+        return;
+    }
+
+    for (struct tcp_pcb **link = &listener->children; *link; link = &(*link)->child_next) {
+        if (*link == pcb) {
+            *link = pcb->child_next;
+            break;
+        }
+    }
+    listener->child_count--;
+    if (pcb->is_ready) {
+        listener->ready--;
+    }
+    pcb->listener = NULL;
+    pcb->child_next = NULL;
+    pcb->is_ready = 0;
+}
+
+static void tcp_release(struct tcp_pcb *pcb)
+{
+    tcp_child_remove(pcb);
+    tcp_hash_unlink(pcb);
+    tcp_unlink(pcb);
+    tcp_free_buffers(pcb);
+    kfree(pcb);
+}
+
+// Connection over: unhash, report err to the socket, if any, and wake it
+static void tcp_set_closed(struct tcp_pcb *pcb, int err)
+{
+    tcp_hash_unlink(pcb);
+    pcb->state = TCP_CLOSED;
+    if (err && !pcb->error) {
+        pcb->error = err;
+    }
+    pcb->rto_deadline = 0;
+    pcb->state_deadline = 0;
+    pcb->ack_pending = 0;
+    wake_up(&pcb->wait);
+}
+
+// A closed block nobody refers to any more goes away
+static int tcp_release_if_done(struct tcp_pcb *pcb)
+{
+    if (pcb->state == TCP_CLOSED && !pcb->socket) {
+        tcp_release(pcb);
+        return 1;
+    }
+    return 0;
+}
+
+static void tcp_enter_time_wait(struct tcp_pcb *pcb, uint64_t now)
+{
+    pcb->state = TCP_TIME_WAIT;
+    pcb->rto_deadline = 0;
+    pcb->state_deadline = now + TCP_TIME_WAIT_MS;
+    tcp_free_buffers(pcb);      // Only ACKs are sent from here on
+}
+
+static uint16_t tcp_receive_window(struct tcp_pcb *pcb)
+{
+    if (!pcb->queues_open) {
+        return 0;
+    }
+    return (uint16_t)min_u32(TCP_RCV_BUF_SIZE - pcb->rcv_len, 0xFFFF);
+}
+
+/*
+ * Prepend the TCP header (and an MSS option on SYNs) to the payload
+ * already in packet and send it, leaving the checksum to the interface or
+ * net_packet_send(). Consumes the packet.
+ */
+static int tcp_finish_segment(struct net_packet *packet, uint32_t src, uint32_t dst,
+                              uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack,
+                              uint8_t flags, uint16_t window, uint16_t mss)
+{
+    size_t hlen = TCP_HLEN + ((flags & TCP_SYN) ? TCP_OPT_MSS_LEN : 0);
+    struct tcp_header *tcp = net_packet_push(packet, hlen);
+
+    tcp->src_port = sport;
+    tcp->dst_port = dport;
+    tcp->seq = htonl(seq);
+    tcp->ack = (flags & TCP_ACK) ? htonl(ack) : 0;
+    tcp->data_off = (uint8_t)((hlen / 4) << 4);
+    tcp->flags = flags;
+    tcp->window = htons(window);
+    tcp->checksum = 0;
+    tcp->urgent = 0;
+    if (flags & TCP_SYN) {
+        uint8_t *opt = (uint8_t *)(tcp + 1);
+        opt[0] = TCP_OPT_MSS;
+        opt[1] = TCP_OPT_MSS_LEN;
+        opt[2] = (uint8_t)(mss >> 8);
+        opt[3] = (uint8_t)mss;
+    }
+
+    // The device sums each segment of a TSO packet, adding its length
+    uint16_t len = packet->gso_size ? 0 : (uint16_t)net_packet_frame_len(packet);
+    net_packet_csum_partial(packet, tcp, &tcp->checksum,
+                            net_pseudo_header_sum(src, dst, IPPROTO_TCP, len));
+
+    return ip_output(packet, src, dst, IPPROTO_TCP);
+}
+
+// Send queue buffer holding the byte offset bytes past snd_una, and
+// where in it that byte is
+static struct net_packet *tcp_snd_find(struct tcp_pcb *pcb, uint32_t offset, uint32_t *skip)
+{
+    for (struct net_packet *buffer = pcb->snd_queue; buffer; buffer = buffer->next) {
+        if (offset < buffer->len) {
+            *skip = offset;
+            return buffer;
+        }
+        offset -= (uint32_t)buffer->len;
+    }
+    return NULL;
+}
+
+/*
+ * Send one segment of pcb's: len bytes of the send queue starting offset
+ * bytes past snd_una, all within one buffer, with seq and flags as given.
+ * Every segment but a bare RST carries the current ACK and window, which
+ * settles any delayed ACK.
+ */
+static int tcp_send_segment(struct tcp_pcb *pcb, uint32_t seq, uint8_t flags,
+                            uint32_t offset, uint32_t len)
+{
+    struct net_packet *packet;
+    if (net_packet_alloc(&packet, 0) != NET_SUCCESS) {
+        return NET_ENOMEM;
+    }
+
+    if (len) {
+        uint32_t skip;
+        struct net_packet *buffer = tcp_snd_find(pcb, offset, &skip);
+        net_packet_attach(packet, buffer, (uint8_t *)buffer->data + skip, len);
+        if (len > pcb->mss) {
+            packet->gso_size = pcb->mss;    // Only from tcp_output(), towards a TSO interface
+        }
+    }
+
+    uint16_t window = tcp_receive_window(pcb);
+    if (flags & TCP_ACK) {
+        pcb->rcv_adv = pcb->rcv_nxt + window;
+        pcb->ack_pending = 0;
+    }
+
+    return tcp_finish_segment(packet, pcb->local_ip, pcb->remote_ip, pcb->local_port,
+                              pcb->remote_port, seq, pcb->rcv_nxt, flags, window,
+                              (flags & TCP_SYN) ? tcp_route_mss(pcb->remote_ip) : 0);
+}
+
+static void tcp_send_ack(struct tcp_pcb *pcb)
+{
+    tcp_send_segment(pcb, pcb->snd_nxt, TCP_ACK, 0, 0);
+}
+
+static void tcp_send_syn(struct tcp_pcb *pcb)
+{
+    uint8_t flags = pcb->state == TCP_SYN_RCVD ? TCP_SYN | TCP_ACK : TCP_SYN;
+    tcp_send_segment(pcb, pcb->iss, flags, 0, 0);
+}
+
+// Answer a segment no connection wants (RFC 793, "Reset Generation")
+static void tcp_send_reset(const struct tcp_header *tcp, uint32_t src, uint32_t dst,
+                           uint32_t seg_len)
+{
+    struct net_packet *packet;
+    if (net_packet_alloc(&packet, 0) != NET_SUCCESS) {
+        return;
+    }
+
+    if (tcp->flags & TCP_ACK) {
+        tcp_finish_segment(packet, dst, src, tcp->dst_port, tcp->src_port,
+                           ntohl(tcp->ack), 0, TCP_RST, 0, 0);
+    } else {
+        tcp_finish_segment(packet, dst, src, tcp->dst_port, tcp->src_port,
+                           0, ntohl(tcp->seq) + seg_len, TCP_RST | TCP_ACK, 0, 0);
+    }
+}
+
+// Give up on a connection, telling the peer
+static void tcp_abort(struct tcp_pcb *pcb, int err)
+{
+    if (pcb->state >= TCP_SYN_RCVD && pcb->state != TCP_TIME_WAIT) {
+        tcp_send_segment(pcb, pcb->snd_nxt, TCP_RST | TCP_ACK, 0, 0);
+    }
+    tcp_set_closed(pcb, err);
+}
+
+static void tcp_arm_rto(struct tcp_pcb *pcb, uint64_t now)
+{
+    pcb->rto_deadline = now + pcb->rto;
+}
+
+// RFC 6298, in milliseconds, with the tick as the clock granularity
+static void tcp_rtt_sample(struct tcp_pcb *pcb, int32_t rtt)
+{
+    if (rtt < 1) {
+        rtt = 1;
+    }
+
+    if (pcb->srtt == 0) {
+        pcb->srtt = rtt << 3;
+        pcb->rttvar = rtt << 1;
+    } else {
+        int32_t delta = rtt - (pcb->srtt >> 3);
+        pcb->srtt += delta;
+        if (delta < 0) {
+            delta = -delta;
+        }
+        pcb->rttvar += delta - (pcb->rttvar >> 2);
+    }
+
+    int32_t var = pcb->rttvar > NET_TICK_MS ? pcb->rttvar : NET_TICK_MS;
+    uint32_t rto = (uint32_t)((pcb->srtt >> 3) + var);
+    if (rto < TCP_RTO_MIN_MS) {
+        rto = TCP_RTO_MIN_MS;
+    }
+    if (rto > TCP_RTO_MAX_MS) {
+        rto = TCP_RTO_MAX_MS;
+    }
+    pcb->rto = rto;
+}
+
+/*
+ * Send what the windows allow, as one burst. A short segment is held back
+ * while others are in flight and more data is queued behind it (silly
+ * window avoidance); otherwise data goes out at once, there is no Nagle
+ * delay. Towards a TSO interface a packet carries many segments' worth.
+ */
+static void tcp_output(struct tcp_pcb *pcb)
+{
+    if (pcb->state != TCP_ESTABLISHED && pcb->state != TCP_CLOSE_WAIT &&
+        pcb->state != TCP_FIN_WAIT_1 && pcb->state != TCP_CLOSING &&
+        pcb->state != TCP_LAST_ACK) {
+        return;
+    }
+
+    uint64_t now = timer_get_time_ms();
+    uint32_t window = min_u32(pcb->snd_wnd, pcb->cwnd);
+    uint32_t send_max = tcp_route_send_max(pcb);
+
+    net_tx_begin();
+    for (;;) {
+        uint32_t sent = pcb->snd_nxt - pcb->snd_una;
+        if (sent > pcb->snd_len) {
+            break;      // The FIN is out
+        }
+
+        // A segment ends at the end of its buffer at the latest
+        uint32_t unsent = pcb->snd_len - sent;
+        uint32_t chunk = 0;
+        if (unsent) {
+            uint32_t skip;
+            struct net_packet *buffer = tcp_snd_find(pcb, sent, &skip);
+            chunk = min_u32((uint32_t)buffer->len - skip, send_max);
+        }
+        uint32_t usable = window > sent ? window - sent : 0;
+        uint32_t len = min_u32(chunk, usable);
+        int fin = pcb->fin_queued && len == unsent;
+
+        if (len == 0 && !fin) {
+            break;
+        }
+        if (len < pcb->mss && len < chunk && sent > 0) {
+            break;
+        }
+
+        uint8_t flags = TCP_ACK;
+        if (len && len == unsent) {
+            flags |= TCP_PSH;
+        }
+        if (fin) {
+            flags |= TCP_FIN;
+        }
+
+        int fresh = SEQ_GEQ(pcb->snd_nxt, pcb->snd_max);
+        tcp_send_segment(pcb, pcb->snd_nxt, flags, sent, len);
+        pcb->snd_nxt += len + (fin ? 1 : 0);
+        if (SEQ_GT(pcb->snd_nxt, pcb->snd_max)) {
+            pcb->snd_max = pcb->snd_nxt;
+        }
+
+        // Time one new segment per round trip; retransmissions never (Karn)
+        if (fresh && !pcb->rtt_active && len) {
+            pcb->rtt_active = 1;
+            pcb->rtt_seq = pcb->snd_nxt;
+            pcb->rtt_start = now;
+        }
+        if (!pcb->rto_deadline) {
+            tcp_arm_rto(pcb, now);
+        }
+
+        if (fin) {
+            if (pcb->state == TCP_ESTABLISHED) {
+                pcb->state = TCP_FIN_WAIT_1;
+            } else if (pcb->state == TCP_CLOSE_WAIT) {
+                pcb->state = TCP_LAST_ACK;
+            }
+            break;
+        }
+    }
+    net_tx_end();
+
+    // Zero window with data waiting: the timer sends probes
+    if (pcb->snd_wnd == 0 && pcb->snd_len > pcb->snd_nxt - pcb->snd_una &&
+        !pcb->rto_deadline) {
+        tcp_arm_rto(pcb, now);
+    }
+}
+
+// Retransmission timer expired (or a zero-window probe is due)
+static void tcp_retransmit_timeout(struct tcp_pcb *pcb, uint64_t now)
+{
+    uint32_t in_flight = pcb->snd_max - pcb->snd_una;
+
+    // Persist: nothing in flight, window closed, data queued
+    if (in_flight == 0 && pcb->snd_wnd == 0 && pcb->snd_len > 0 &&
+        tcp_synchronized(pcb->state)) {
+        tcp_send_segment(pcb, pcb->snd_nxt, TCP_ACK, 0, 1);
+        pcb->snd_nxt++;
+        pcb->snd_max = pcb->snd_nxt;
+        pcb->rto = min_u32(pcb->rto * 2, TCP_RTO_MAX_MS);
+        tcp_arm_rto(pcb, now);
+        return;
+    }
+
+    if (in_flight == 0) {
+        pcb->rto_deadline = 0;
+        return;
+    }
+
+    if (++pcb->retries > TCP_MAX_RETRIES) {
+        tcp_abort(pcb, NET_ETIMEDOUT);
+        return;
+    }
+
+    pcb->rto = min_u32(pcb->rto * 2, TCP_RTO_MAX_MS);
+    pcb->rtt_active = 0;
+    tcp_arm_rto(pcb, now);
+
+    if (pcb->state == TCP_SYN_SENT || pcb->state == TCP_SYN_RCVD) {
+        tcp_send_syn(pcb);
+        return;
+    }
+
+    // Go back to the oldest unacknowledged byte with a one-segment window
+    pcb->ssthresh = in_flight / 2 > 2u * pcb->mss ? in_flight / 2 : 2u * pcb->mss;
+    pcb->cwnd = pcb->mss;
+    pcb->dupacks = 0;
+    pcb->snd_nxt = pcb->snd_una;
+    tcp_output(pcb);
+}
+
+// Peer's MSS option, if the SYN has one
+static uint16_t tcp_parse_mss(const struct tcp_header *tcp, size_t hlen)
+{
+    const uint8_t *opt = (const uint8_t *)(tcp + 1);
+    const uint8_t *end = (const uint8_t *)tcp + hlen;
+
+    while (opt < end) {
+        if (*opt == TCP_OPT_END) {
+            break;
+        }
+        if (*opt == TCP_OPT_NOP) {
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end) {
+            break;
+        }
+        if (*opt == TCP_OPT_MSS && opt[1] == TCP_OPT_MSS_LEN) {
+            return (uint16_t)((opt[2] << 8) | opt[3]);
+        }
+        opt += opt[1];
+    }
+    return TCP_DEFAULT_MSS;
+}
+
+static void tcp_set_mss(struct tcp_pcb *pcb, uint16_t peer_mss)
+{
+    uint16_t mss = tcp_route_mss(pcb->remote_ip);
+    pcb->mss = peer_mss && peer_mss < mss ? peer_mss : mss;
+}
+
+// SYN for a listener: start a child connection in SYN_RCVD
+static void tcp_listen_input(struct tcp_pcb *listener, const struct tcp_header *tcp, size_t hlen,
+                             uint32_t src, uint32_t dst)
+{
+    if (listener->child_count >= listener->backlog) {
+        return;     // The peer retries the SYN
+    }
+
+    struct tcp_pcb *pcb = tcp_pcb_alloc();
+    if (!pcb) {
+        return;
+    }
+    pcb->queues_open = 1;
+    pcb->local_ip = dst;
+    pcb->local_port = tcp->dst_port;
+    pcb->remote_ip = src;
+    pcb->remote_port = tcp->src_port;
+    pcb->irs = ntohl(tcp->seq);
+    pcb->rcv_nxt = pcb->irs + 1;
+    pcb->iss = tcp_new_iss();
+    pcb->snd_una = pcb->iss;
+    pcb->snd_nxt = pcb->iss + 1;
+    pcb->snd_max = pcb->snd_nxt;
+    pcb->snd_wnd = ntohs(tcp->window);
+    pcb->snd_wl1 = pcb->irs;
+    pcb->snd_wl2 = pcb->iss;
+    tcp_set_mss(pcb, tcp_parse_mss(tcp, hlen));
+    tcp_init_congestion(pcb);
+    pcb->state = TCP_SYN_RCVD;
+
+    // Queue behind the listener's other children
+    struct tcp_pcb **link = &listener->children;
+    while (*link) {
+        link = &(*link)->child_next;
+    }
+    *link = pcb;
+    pcb->listener = listener;
+    listener->child_count++;
+
+    tcp_link(&tcp_pcbs, pcb);
+    tcp_hash_insert(pcb);
+
+    tcp_send_syn(pcb);
+    tcp_arm_rto(pcb, timer_get_time_ms());
+}
+
+// Handshake done for a child: ready to be accepted
+static void tcp_child_ready(struct tcp_pcb *pcb)
+{
+    if (pcb->listener && !pcb->is_ready) {
+        pcb->is_ready = 1;
+        pcb->listener->ready++;
+        wake_up(&pcb->listener->wait);
+    }
+}
+
+// Reply to SYN-ACK (or a simultaneous SYN) while in SYN_SENT
+static void tcp_syn_sent_input(struct tcp_pcb *pcb, const struct tcp_header *tcp, size_t hlen,
+                               uint32_t seq, uint32_t ack, uint64_t now)
+{
+    uint8_t flags = tcp->flags;
+
+    if ((flags & TCP_ACK) && (SEQ_LEQ(ack, pcb->iss) || SEQ_GT(ack, pcb->snd_max))) {
+        if (!(flags & TCP_RST)) {
+            tcp_send_reset(tcp, pcb->remote_ip, pcb->local_ip, 0);
+        }
+        return;
+    }
+    if (flags & TCP_RST) {
+        if (flags & TCP_ACK) {
+            tcp_set_closed(pcb, NET_ECONNREFUSED);
+        }
+        return;
+    }
+    if (!(flags & TCP_SYN)) {
+        return;
+    }
+
+    pcb->irs = seq;
+    pcb->rcv_nxt = seq + 1;
+    pcb->snd_wnd = ntohs(tcp->window);
+    pcb->snd_wl1 = seq;
+    pcb->snd_wl2 = ack;
+    tcp_set_mss(pcb, tcp_parse_mss(tcp, hlen));
+    tcp_init_congestion(pcb);
+
+    if (flags & TCP_ACK) {
+        pcb->snd_una = ack;
+        pcb->rto_deadline = 0;
+        if (pcb->retries == 0) {
+            tcp_rtt_sample(pcb, (int32_t)(now - pcb->rtt_start));   // SYN was not resent
+        }
+        pcb->retries = 0;
+        pcb->state = TCP_ESTABLISHED;
+        tcp_send_ack(pcb);
+        wake_up(&pcb->wait);
+    } else {
+        pcb->state = TCP_SYN_RCVD;     // Simultaneous open
+        tcp_send_syn(pcb);
+    }
+}
+
+// Drop acknowledged bytes from the front of the send queue. Buffers may
+// still back segments in flight; those hold references of their own.
+static void tcp_snd_trim(struct tcp_pcb *pcb, uint32_t len)
+{
+    pcb->snd_len -= len;
+    while (len) {
+        struct net_packet *buffer = pcb->snd_queue;
+        uint32_t take = min_u32(len, (uint32_t)buffer->len);
+        net_packet_pull(buffer, take);
+        len -= take;
+        if (buffer->len == 0) {
+            pcb->snd_queue = buffer->next;
+            if (!pcb->snd_queue) {
+                pcb->snd_queue_tail = NULL;
+            }
+            net_packet_free(buffer);
+        }
+    }
+}
+
+// ACK field of a segment on a synchronized connection
+static void tcp_ack_input(struct tcp_pcb *pcb, const struct tcp_header *tcp, uint32_t seq,
+                          uint32_t ack, uint32_t data_len, uint64_t now)
+{
+    uint32_t window = ntohs(tcp->window);
+
+    if (SEQ_GT(ack, pcb->snd_max)) {
+        pcb->ack_pending = TCP_DELACK_SEGMENTS;     // Acks what we never sent
+        return;
+    }
+
+    if (SEQ_GT(ack, pcb->snd_una)) {
+        uint32_t acked = ack - pcb->snd_una;
+        uint32_t data_acked = min_u32(acked, pcb->snd_len);
+        int fin_acked = acked > pcb->snd_len;
+
+        tcp_snd_trim(pcb, data_acked);
+        pcb->snd_una = ack;
+        if (SEQ_LT(pcb->snd_nxt, ack)) {
+            pcb->snd_nxt = ack;
+        }
+        pcb->retries = 0;
+
+        if (pcb->rtt_active && SEQ_GEQ(ack, pcb->rtt_seq)) {
+            pcb->rtt_active = 0;
+            tcp_rtt_sample(pcb, (int32_t)(now - pcb->rtt_start));
+        }
+
+        // Grow the window: slow start, then congestion avoidance
+        if (pcb->cwnd < pcb->ssthresh) {
+            pcb->cwnd += min_u32(acked, pcb->mss);
+        } else {
+            uint32_t step = (uint32_t)pcb->mss * pcb->mss / pcb->cwnd;
+            pcb->cwnd += step ? step : 1;
+        }
+        if (pcb->cwnd > TCP_CWND_MAX) {
+            pcb->cwnd = TCP_CWND_MAX;
+        }
+        pcb->dupacks = 0;
+
+        if (pcb->snd_una == pcb->snd_max) {
+            pcb->rto_deadline = 0;
+        } else {
+            tcp_arm_rto(pcb, now);
+        }
+
+        if (fin_acked) {
+            if (pcb->state == TCP_FIN_WAIT_1) {
+                pcb->state = TCP_FIN_WAIT_2;
+                if (!pcb->socket) {
+                    pcb->state_deadline = now + TCP_FIN_WAIT_2_MS;
+                }
+            } else if (pcb->state == TCP_CLOSING) {
+                tcp_enter_time_wait(pcb, now);
+            } else if (pcb->state == TCP_LAST_ACK) {
+                tcp_set_closed(pcb, 0);
+                return;
+            }
+        }
+        if (data_acked) {
+            wake_up(&pcb->wait);    // Room to write
+        }
+    } else if (ack == pcb->snd_una && data_len == 0 && window == pcb->snd_wnd &&
+               pcb->snd_max != pcb->snd_una && !(tcp->flags & (TCP_SYN | TCP_FIN))) {
+        // Duplicate ACK: three in a row mean a segment was lost. Receivers
+        // like this one drop what follows a hole, so fast retransmit goes
+        // back to it and resends from there at half the window.
+        if (++pcb->dupacks == TCP_DUPACK_THRESH) {
+            uint32_t in_flight = pcb->snd_max - pcb->snd_una;
+            pcb->ssthresh = in_flight / 2 > 2u * pcb->mss ? in_flight / 2 : 2u * pcb->mss;
+            pcb->cwnd = pcb->ssthresh;
+            pcb->snd_nxt = pcb->snd_una;
+            pcb->rtt_active = 0;
+            tcp_arm_rto(pcb, now);
+        }
+    }
+
+    // Window update, from the newest segment only
+    if (SEQ_LT(pcb->snd_wl1, seq) || (pcb->snd_wl1 == seq && SEQ_LEQ(pcb->snd_wl2, ack))) {
+        pcb->snd_wnd = window;
+        pcb->snd_wl1 = seq;
+        pcb->snd_wl2 = ack;
+    }
+}
+
+/*
+ * Queue in-order data, which starts at data in packet: the packet itself
+ * is kept, trimmed to the data, unless the data is small enough to copy
+ * onto the packet queued last.
+ */
+static void tcp_data_input(struct tcp_pcb *pcb, struct net_packet *packet,
+                           const uint8_t *data, uint32_t len)
+{
+    uint32_t room = TCP_RCV_BUF_SIZE - pcb->rcv_len;
+    uint32_t take = min_u32(len, room);
+
+    if (take) {
+        struct net_packet *tail = pcb->rcv_queue_tail;
+        if (tail && take <= TCP_COALESCE_MAX && take <= net_packet_tailroom(tail)) {
+            memcpy(net_packet_put(tail, take), data, take);
+        } else {
+            net_packet_pull(net_packet_get(packet), (size_t)(data - (uint8_t *)packet->data));
+            packet->len = take;
+            packet->next = NULL;
+            if (tail) {
+                tail->next = packet;
+            } else {
+                pcb->rcv_queue = packet;
+            }
+            pcb->rcv_queue_tail = packet;
+        }
+        pcb->rcv_len += take;
+        pcb->rcv_nxt += take;
+        wake_up(&pcb->wait);
+    }
+
+    // A lost tail needs resending, so say so now
+    pcb->ack_pending += take < len ? TCP_DELACK_SEGMENTS : 1;
+}
+
+static void tcp_fin_input(struct tcp_pcb *pcb, uint64_t now)
+{
+    pcb->rcv_nxt++;
+    pcb->ack_pending = TCP_DELACK_SEGMENTS;
+
+    switch (pcb->state) {
+    case TCP_SYN_RCVD:
+    case TCP_ESTABLISHED:
+        pcb->state = TCP_CLOSE_WAIT;
+        break;
+    case TCP_FIN_WAIT_1:
+        pcb->state = TCP_CLOSING;   // Ours is not acknowledged yet
+        break;
+    case TCP_FIN_WAIT_2:
+        pcb->state_deadline = 0;
+        tcp_enter_time_wait(pcb, now);
+        break;
+    case TCP_TIME_WAIT:
+        pcb->state_deadline = now + TCP_TIME_WAIT_MS;
+        break;
+    default:
+        break;
+    }
+    wake_up(&pcb->wait);    // End of file for readers
+}
+
+// A segment for an existing connection; RFC 793's "SEGMENT ARRIVES"
+static void tcp_process(struct tcp_pcb *pcb, struct net_packet *packet,
+                        const struct tcp_header *tcp, size_t hlen, const uint8_t *data,
+                        uint32_t data_len, uint64_t now)
+{
+    uint8_t flags = tcp->flags;
+    uint32_t seq = ntohl(tcp->seq);
+    uint32_t ack = ntohl(tcp->ack);
+
+    if (pcb->state == TCP_SYN_SENT) {
+        tcp_syn_sent_input(pcb, tcp, hlen, seq, ack, now);
+        return;
+    }
+
+    uint32_t window = pcb->rcv_adv - pcb->rcv_nxt;
+    if (SEQ_LT(pcb->rcv_adv, pcb->rcv_nxt)) {
+        window = 0;
+    }
+
+    // Resets count only within the window
+    if (flags & TCP_RST) {
+        if (SEQ_GEQ(seq, pcb->rcv_nxt) && SEQ_LEQ(seq, pcb->rcv_nxt + window)) {
+            tcp_set_closed(pcb, pcb->state == TCP_SYN_RCVD ? 0 : NET_ECONNRESET);
+        }
+        return;
+    }
+
+    // SYN: a retransmitted one gets our SYN-ACK again, others an ACK
+    if (flags & TCP_SYN) {
+        if (pcb->state == TCP_SYN_RCVD && seq == pcb->irs) {
+            tcp_send_syn(pcb);
+        } else {
+            tcp_send_ack(pcb);
+        }
+        return;
+    }
+
+    // Trim what we already have; anything past rcv_nxt waits for a resend
+    int fin = (flags & TCP_FIN) != 0;
+    if (SEQ_LT(seq, pcb->rcv_nxt)) {
+        uint32_t dup = pcb->rcv_nxt - seq;
+        if (dup > data_len || (dup == data_len && !fin)) {
+            pcb->ack_pending = TCP_DELACK_SEGMENTS;    // Old duplicate
+            tcp_send_ack(pcb);
+            return;
+        }
+        data += dup;
+        data_len -= dup;
+        seq = pcb->rcv_nxt;
+    } else if (seq != pcb->rcv_nxt) {
+        tcp_send_ack(pcb);      // Duplicate ACK asks for the gap
+        return;
+    }
+
+    if (!(flags & TCP_ACK)) {
+        return;
+    }
+
+    if (pcb->state == TCP_SYN_RCVD) {
+        if (SEQ_LEQ(ack, pcb->snd_una) || SEQ_GT(ack, pcb->snd_max)) {
+            tcp_send_reset(tcp, pcb->remote_ip, pcb->local_ip, data_len + fin);
+            return;
+        }
+        pcb->snd_una = ack;
+        pcb->snd_wnd = ntohs(tcp->window);
+        pcb->snd_wl1 = seq;
+        pcb->snd_wl2 = ack;
+        pcb->rto_deadline = 0;
+        pcb->retries = 0;
+        pcb->rto = TCP_RTO_INITIAL_MS;
+        pcb->state = TCP_ESTABLISHED;
+        tcp_child_ready(pcb);
+    } else {
+        tcp_ack_input(pcb, tcp, seq, ack, data_len, now);
+        if (pcb->state == TCP_CLOSED) {
+            return;
+        }
+    }
+
+    if (data_len > 0) {
+        if (pcb->state == TCP_ESTABLISHED || pcb->state == TCP_FIN_WAIT_1 ||
+            pcb->state == TCP_FIN_WAIT_2) {
+            uint32_t before = pcb->rcv_nxt;
+            tcp_data_input(pcb, packet, data, data_len);
+            if (pcb->rcv_nxt - before < data_len) {
+                fin = 0;    // The FIN is beyond what fit
+            }
+        } else {
+            fin = 0;
+        }
+    }
+
+    if (fin) {
+        tcp_fin_input(pcb, now);
+    }
+
+    // Send what the ACK made room for; that carries any pending ACK too
+    tcp_output(pcb);
+    if (pcb->ack_pending >= TCP_DELACK_SEGMENTS) {
+        tcp_send_ack(pcb);
+    }
+}
+
+void tcp_input(struct net_packet *packet, uint32_t src, uint32_t dst)
+{
+    struct network_interface *netif = packet->netif;
+
+    if (packet->len < TCP_HLEN) {
+        netif->stats.rx_errors++;
+        return;
+    }
+
+    struct tcp_header *tcp = packet->data;
+    size_t hlen = (size_t)(tcp->data_off >> 4) * 4;
+    if (hlen < TCP_HLEN || hlen > packet->len) {
+        netif->stats.rx_errors++;
+        return;
+    }
+    if (!(packet->flags & NET_PACKET_CSUM_VALID)) {
+        uint32_t sum = net_pseudo_header_sum(src, dst, IPPROTO_TCP, (uint16_t)packet->len);
+        if (net_checksum_fold(net_checksum_add(sum, tcp, packet->len)) != 0) {
+            netif->stats.rx_errors++;
+            return;
+        }
+    }
+    if (dst == 0xFFFFFFFFU) {
+        return;
+    }
+
+    const uint8_t *data = (const uint8_t *)tcp + hlen;
+    uint32_t data_len = (uint32_t)(packet->len - hlen);
+    uint8_t flags = tcp->flags;
+    uint64_t now = timer_get_time_ms();
+
+    struct tcp_pcb *pcb = tcp_lookup(dst, tcp->dst_port, src, tcp->src_port);
+
+    // A new SYN may take over a connection lingering in TIME_WAIT
+    if (pcb && pcb->state == TCP_TIME_WAIT && (flags & TCP_SYN) && !(flags & TCP_ACK) &&
+        SEQ_GT(ntohl(tcp->seq), pcb->rcv_nxt)) {
+        tcp_set_closed(pcb, 0);
+        tcp_release_if_done(pcb);
+        pcb = NULL;
+    }
+
+    if (!pcb) {
+        struct tcp_pcb *listener = tcp_find_listener(dst, tcp->dst_port);
+        if (listener && (flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN) {
+            tcp_listen_input(listener, tcp, hlen, src, dst);
+        } else if (!(flags & TCP_RST)) {
+            uint32_t seg_len = data_len + ((flags & TCP_SYN) ? 1 : 0) + ((flags & TCP_FIN) ? 1 : 0);
+            tcp_send_reset(tcp, src, dst, seg_len);
+        }
+        return;
+    }
+
+    tcp_process(pcb, packet, tcp, hlen, data, data_len, now);
+    tcp_release_if_done(pcb);
+}
+
+/**
+ * Stack tick: delayed ACKs, retransmissions, TIME_WAIT and orphan
+ * expiry. Caller holds net_lock.
+ */
+void tcp_timer(uint64_t now_ms)
+{
+    struct tcp_pcb *next;
+    for (struct tcp_pcb *pcb = tcp_pcbs; pcb; pcb = next) {
+        next = pcb->next;
+
+        if (pcb->ack_pending && pcb->state != TCP_CLOSED) {
+            tcp_send_ack(pcb);
+        }
+        if (pcb->state_deadline && now_ms >= pcb->state_deadline) {
+            tcp_set_closed(pcb, 0);
+        } else if (pcb->rto_deadline && now_ms >= pcb->rto_deadline) {
+            tcp_retransmit_timeout(pcb, now_ms);
+        }
+        tcp_release_if_done(pcb);
+    }
+}
+
+static inline struct tcp_pcb *tcp_pcb_of(struct socket *sock)
+{
+    return (struct tcp_pcb *)sock->protocol_data;
+}
+
+static int tcp_parse_address(const struct sockaddr *addr, socklen_t addrlen,
+                             uint32_t *ip, uint16_t *port)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+    if (!addr || addrlen < sizeof(struct sockaddr_in) || in->sin_family != AF_INET) {
+        return NET_EINVAL;
+    }
+    *ip = in->sin_addr;
+    *port = in->sin_port;
+    return NET_SUCCESS;
+}
+
+static int tcp_bind(struct socket *sock, const struct sockaddr *addr, socklen_t addrlen)
+{
+    uint32_t ip;
+    uint16_t port;
+    int result = tcp_parse_address(addr, addrlen, &ip, &port);
+    if (result != NET_SUCCESS) {
+        return result;
+    }
+
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    if (pcb->local_port || pcb->state != TCP_CLOSED) {
+        result = NET_EINVAL;
+    } else if (ip != INADDR_ANY && !net_is_local_address(ip)) {
+        result = NET_EINVAL;
+    } else {
+        result = tcp_bind_locked(pcb, ip, port);
+    }
+    if (result == NET_SUCCESS) {
+        sock->local_ip = pcb->local_ip;
+        sock->local_port = pcb->local_port;
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+    return result;
+}
+
+static int tcp_listen(struct socket *sock, int backlog)
+{
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+    int result = NET_SUCCESS;
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    if (pcb->state == TCP_LISTEN) {
+        spin_unlock_irqrestore(&net_lock, flags);
+        return NET_SUCCESS;
+    }
+    if (pcb->state != TCP_CLOSED || pcb->error) {
+        spin_unlock_irqrestore(&net_lock, flags);
+        return NET_EINVAL;
+    }
+    if (!pcb->local_port) {
+        result = tcp_bind_locked(pcb, INADDR_ANY, 0);
+    }
+    if (result == NET_SUCCESS) {
+        if (backlog < 1) {
+            backlog = 1;
+        }
+        pcb->backlog = backlog > TCP_MAX_BACKLOG ? TCP_MAX_BACKLOG : backlog;
+        pcb->state = TCP_LISTEN;
+        tcp_hash_link(&tcp_listeners, pcb);
+        sock->local_ip = pcb->local_ip;
+        sock->local_port = pcb->local_port;
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+    return result;
+}
+
+static inline int tcp_accept_ready(struct tcp_pcb *pcb)
+{
+    return __atomic_load_n(&pcb->ready, __ATOMIC_ACQUIRE) > 0 ||
+           __atomic_load_n(&pcb->state, __ATOMIC_ACQUIRE) != TCP_LISTEN;
+}
+
+static int tcp_accept(struct socket *sock, struct socket **newsock, struct sockaddr *addr,
+                      socklen_t *addrlen)
+{
+    struct tcp_pcb *listener = tcp_pcb_of(sock);
+    struct socket *child_sock = kmalloc(sizeof(struct socket));
+    if (!child_sock) {
+        return NET_ENOMEM;
+    }
+
+    struct tcp_pcb *child = NULL;
+    unsigned long flags = 0;
+    while (!child) {
+        wait_event(&listener->wait, tcp_accept_ready(listener));
+
+        flags = spin_lock_irqsave(&net_lock);
+        if (listener->state != TCP_LISTEN) {
+            spin_unlock_irqrestore(&net_lock, flags);
+            kfree(child_sock);
+            return NET_EINVAL;
+        }
+        child = listener->children;
+        while (child && !child->is_ready) {
+            child = child->child_next;
+        }
+        if (!child) {
+            spin_unlock_irqrestore(&net_lock, flags);
+        }
+    }
+
+    tcp_child_remove(child);
+    memset(child_sock, 0, sizeof(*child_sock));
+    child_sock->domain = sock->domain;
+    child_sock->type = sock->type;
+    child_sock->protocol = sock->protocol;
+    child_sock->local_ip = child->local_ip;
+    child_sock->local_port = child->local_port;
+    child_sock->remote_ip = child->remote_ip;
+    child_sock->remote_port = child->remote_port;
+    child_sock->protocol_data = child;
+    child_sock->ops = &tcp_socket_ops;
+    child->socket = child_sock;
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    if (addr && addrlen && *addrlen >= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        memset(in, 0, sizeof(*in));
+        in->sin_family = AF_INET;
+        in->sin_port = child_sock->remote_port;
+        in->sin_addr = child_sock->remote_ip;
+        *addrlen = sizeof(struct sockaddr_in);
+    }
+    *newsock = child_sock;
+    return NET_SUCCESS;
+}
+
+static inline int tcp_connect_done(struct tcp_pcb *pcb)
+{
+    enum tcp_state state = __atomic_load_n(&pcb->state, __ATOMIC_ACQUIRE);
+    return state != TCP_SYN_SENT && state != TCP_SYN_RCVD;
+}
+
+static int tcp_connect(struct socket *sock, const struct sockaddr *addr, socklen_t addrlen)
+{
+    uint32_t ip;
+    uint16_t port;
+    int result = tcp_parse_address(addr, addrlen, &ip, &port);
+    if (result != NET_SUCCESS) {
+        return result;
+    }
+    if (port == 0 || ip == INADDR_ANY) {
+        return NET_EINVAL;
+    }
+
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    if (pcb->state != TCP_CLOSED || pcb->error) {
+        spin_unlock_irqrestore(&net_lock, flags);
+        return pcb->state == TCP_LISTEN ? NET_EINVAL : NET_EISCONN;
+    }
+
+    uint32_t local_ip = pcb->local_ip != INADDR_ANY ? pcb->local_ip : ip_source_address(ip);
+    if (local_ip == 0) {
+        spin_unlock_irqrestore(&net_lock, flags);
+        return NET_EHOSTUNREACH;
+    }
+    if (!pcb->local_port) {
+        result = tcp_bind_locked(pcb, local_ip, 0);
+    }
+    if (result == NET_SUCCESS && tcp_lookup(local_ip, pcb->local_port, ip, port)) {
+        result = NET_EADDRINUSE;
+    }
+    if (result != NET_SUCCESS) {
+        spin_unlock_irqrestore(&net_lock, flags);
+        return result;
+    }
+
+    uint64_t now = timer_get_time_ms();
+    pcb->local_ip = local_ip;
+    pcb->remote_ip = ip;
+    pcb->remote_port = port;
+    pcb->iss = tcp_new_iss();
+    pcb->snd_una = pcb->iss;
+    pcb->snd_nxt = pcb->iss + 1;
+    pcb->snd_max = pcb->snd_nxt;
+    pcb->mss = tcp_route_mss(ip);
+    pcb->rtt_start = now;
+    pcb->queues_open = 1;
+    pcb->state = TCP_SYN_SENT;
+    tcp_hash_insert(pcb);
+    tcp_send_syn(pcb);
+    tcp_arm_rto(pcb, now);
+
+    sock->local_ip = pcb->local_ip;
+    sock->local_port = pcb->local_port;
+    sock->remote_ip = ip;
+    sock->remote_port = port;
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    wait_event(&pcb->wait, tcp_connect_done(pcb));
+
+    flags = spin_lock_irqsave(&net_lock);
+    result = tcp_synchronized(pcb->state) ? NET_SUCCESS
+                                          : (pcb->error ? pcb->error : NET_ECONNREFUSED);
+    spin_unlock_irqrestore(&net_lock, flags);
+    return result;
+}
+
+static inline int tcp_writable(struct tcp_pcb *pcb)
+{
+    enum tcp_state state = __atomic_load_n(&pcb->state, __ATOMIC_ACQUIRE);
+    return (state != TCP_ESTABLISHED && state != TCP_CLOSE_WAIT) ||
+           __atomic_load_n(&pcb->snd_len, __ATOMIC_ACQUIRE) < TCP_SND_BUF_SIZE;
+}
+
+/*
+ * Copy len bytes to the end of the send queue, topping up the last buffer
+ * before starting another. Buffers end on a segment boundary, so that
+ * segments cut at them are full ones. Returns the bytes queued, fewer if
+ * memory ran out.
+ */
+static uint32_t tcp_queue_data(struct tcp_pcb *pcb, const uint8_t *src, uint32_t len)
+{
+    uint32_t send_max = tcp_route_send_max(pcb);
+    uint32_t done = 0;
+
+    while (done < len) {
+        struct net_packet *tail = pcb->snd_queue_tail;
+        uint32_t room = 0;
+        if (tail) {
+            uint32_t limit = min_u32(send_max, (uint32_t)(tail->capacity - NET_HEADROOM));
+            uint32_t used = (uint32_t)((uint8_t *)tail->data + tail->len -
+                                       net_packet_head(tail)) - NET_HEADROOM;
+            if (limit > pcb->mss) {
+                limit -= limit % pcb->mss;
+            }
+            room = limit > used ? limit - used : 0;
+        }
+
+        if (room == 0) {
+            // Whole segments, enough for the rest of the write if they may
+            uint32_t want = len - done > pcb->mss ? len - done : pcb->mss;
+            want = min_u32((want + pcb->mss - 1) / pcb->mss * pcb->mss, send_max);
+            if (net_packet_alloc(&tail, want) != NET_SUCCESS) {
+                break;
+            }
+            if (pcb->snd_queue_tail) {
+                pcb->snd_queue_tail->next = tail;
+            } else {
+                pcb->snd_queue = tail;
+            }
+            pcb->snd_queue_tail = tail;
+            continue;
+        }
+
+        uint32_t take = min_u32(room, len - done);
+        memcpy(net_packet_put(tail, take), src + done, take);
+        pcb->snd_len += take;
+        done += take;
+    }
+    return done;
+}
+
+static ssize_t tcp_send(struct socket *sock, const void *buf, size_t len, int flags)
+{
+    (void)flags;
+
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+    const uint8_t *src = buf;
+    size_t done = 0;
+
+    while (done < len) {
+        wait_event(&pcb->wait, tcp_writable(pcb));
+
+        unsigned long irq = spin_lock_irqsave(&net_lock);
+        if (pcb->state != TCP_ESTABLISHED && pcb->state != TCP_CLOSE_WAIT) {
+            int err = pcb->error;
+            if (!err) {
+                err = pcb->queues_open && pcb->state != TCP_SYN_SENT ? NET_EPIPE : NET_ENOTCONN;
+            }
+            spin_unlock_irqrestore(&net_lock, irq);
+            return done ? (ssize_t)done : err;
+        }
+
+        uint32_t chunk = TCP_SND_BUF_SIZE - pcb->snd_len;
+        if (len - done < chunk) {
+            chunk = (uint32_t)(len - done);
+        }
+        uint32_t queued = tcp_queue_data(pcb, src + done, chunk);
+        tcp_output(pcb);
+        spin_unlock_irqrestore(&net_lock, irq);
+
+        done += queued;
+        if (queued < chunk) {
+            return done ? (ssize_t)done : NET_ENOMEM;
+        }
+    }
+
+    return (ssize_t)done;
+}
+
+static inline int tcp_readable(struct tcp_pcb *pcb)
+{
+    enum tcp_state state = __atomic_load_n(&pcb->state, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&pcb->rcv_len, __ATOMIC_ACQUIRE) > 0 ||
+           (state != TCP_ESTABLISHED && state != TCP_SYN_SENT && state != TCP_SYN_RCVD &&
+            state != TCP_FIN_WAIT_1 && state != TCP_FIN_WAIT_2);
+}
+
+static ssize_t tcp_recv(struct socket *sock, void *buf, size_t len, int flags)
+{
+    (void)flags;
+
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+    if (len == 0) {
+        return 0;
+    }
+
+    wait_event(&pcb->wait, tcp_readable(pcb));
+
+    unsigned long irq = spin_lock_irqsave(&net_lock);
+    uint32_t count = pcb->rcv_len;
+    if (len < count) {
+        count = (uint32_t)len;
+    }
+    if (count == 0) {
+        // End of file after the peer's FIN, or the connection's error;
+        // a socket that never connected has no buffers
+        int err = pcb->error;
+        if (!err && (pcb->state == TCP_LISTEN || !pcb->queues_open)) {
+            err = NET_ENOTCONN;
+        }
+        spin_unlock_irqrestore(&net_lock, irq);
+        return err;
+    }
+
+    // Straight out of the packets the data came in
+    for (uint32_t copied = 0; copied < count;) {
+        struct net_packet *packet = pcb->rcv_queue;
+        uint32_t take = min_u32(count - copied, (uint32_t)packet->len);
+        memcpy((uint8_t *)buf + copied, packet->data, take);
+        net_packet_pull(packet, take);
+        copied += take;
+        if (packet->len == 0) {
+            pcb->rcv_queue = packet->next;
+            if (!pcb->rcv_queue) {
+                pcb->rcv_queue_tail = NULL;
+            }
+            net_packet_free(packet);
+        }
+    }
+    pcb->rcv_len -= count;
+
+    // Announce a window that has opened up by a good margin
+    if (pcb->state == TCP_ESTABLISHED || pcb->state == TCP_FIN_WAIT_1 ||
+        pcb->state == TCP_FIN_WAIT_2) {
+        uint32_t advertised = SEQ_GT(pcb->rcv_adv, pcb->rcv_nxt) ? pcb->rcv_adv - pcb->rcv_nxt : 0;
+        uint32_t now_open = tcp_receive_window(pcb);
+        if (now_open - advertised >= min_u32(TCP_RCV_BUF_SIZE / 2, 2u * pcb->mss)) {
+            tcp_send_ack(pcb);
+        }
+    }
+    spin_unlock_irqrestore(&net_lock, irq);
+
+    return (ssize_t)count;
+}
+
+static ssize_t tcp_sendto(struct socket *sock, const void *buf, size_t len, int flags,
+                          const struct sockaddr *addr, socklen_t addrlen)
+{
+    (void)addr;
+    (void)addrlen;
+    return tcp_send(sock, buf, len, flags);
+}
+
+static ssize_t tcp_recvfrom(struct socket *sock, void *buf, size_t len, int flags,
+                            struct sockaddr *addr, socklen_t *addrlen)
+{
+    ssize_t result = tcp_recv(sock, buf, len, flags);
+    if (result >= 0 && addr && addrlen && *addrlen >= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        memset(in, 0, sizeof(*in));
+        in->sin_family = AF_INET;
+        in->sin_port = sock->remote_port;
+        in->sin_addr = sock->remote_ip;
+        *addrlen = sizeof(struct sockaddr_in);
+    }
+    return result;
+}
+
+/*
+ * The socket is going away. Connections close gracefully in the
+ * background, unless unread data is left, which resets them (RFC 2525);
+ * a listener resets the children nobody accepted.
+ */
+static int tcp_close(struct socket *sock)
+{
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    pcb->socket = NULL;
+    sock->protocol_data = NULL;
+
+    switch (pcb->state) {
+    case TCP_LISTEN:
+        while (pcb->children) {
+            struct tcp_pcb *child = pcb->children;
+            tcp_child_remove(child);
+            tcp_abort(child, 0);
+            tcp_release_if_done(child);
+        }
+        tcp_hash_unlink(pcb);
+        pcb->state = TCP_CLOSED;
+        wake_up(&pcb->wait);
+        break;
+    case TCP_SYN_SENT:
+        tcp_set_closed(pcb, 0);
+        break;
+    case TCP_SYN_RCVD:
+        tcp_abort(pcb, 0);
+        break;
+    case TCP_ESTABLISHED:
+    case TCP_CLOSE_WAIT:
+        if (pcb->rcv_len > 0) {
+            tcp_abort(pcb, 0);
+        } else {
+            pcb->fin_queued = 1;
+            tcp_output(pcb);
+        }
+        break;
+    default:
+        break;
+    }
+
+    tcp_release_if_done(pcb);
+    spin_unlock_irqrestore(&net_lock, flags);
+    return NET_SUCCESS;
+}
+
+/*
+ * Readiness from the same lock-free tests the blocking calls sleep on. A
+ * connection hangs up once both directions are finished.
+ */
+static uint32_t tcp_poll(struct socket *sock, struct poll_table *pt)
+{
+    struct tcp_pcb *pcb = tcp_pcb_of(sock);
+    poll_wait(pt, &pcb->wait);
+
+    enum tcp_state state = __atomic_load_n(&pcb->state, __ATOMIC_ACQUIRE);
+    if (state == TCP_LISTEN) {
+        return tcp_accept_ready(pcb) ? EPOLLIN : 0;
+    }
+
+    uint32_t events = 0;
+    if (tcp_readable(pcb)) {
+        events |= EPOLLIN;
+    }
+    if (state != TCP_SYN_SENT && state != TCP_SYN_RCVD && tcp_writable(pcb)) {
+        events |= EPOLLOUT;
+    }
+    if (state == TCP_CLOSED || state >= TCP_CLOSING) {
+        events |= EPOLLHUP;
+    }
+    if (__atomic_load_n(&pcb->error, __ATOMIC_ACQUIRE)) {
+        events |= EPOLLERR;
+    }
+    return events;
+}
+
+struct socket_ops tcp_socket_ops = {
+    .bind = tcp_bind,
+    .connect = tcp_connect,
+    .listen = tcp_listen,
+    .accept = tcp_accept,
+    .send = tcp_send,
+    .recv = tcp_recv,
+    .sendto = tcp_sendto,
+    .recvfrom = tcp_recvfrom,
+    .close = tcp_close,
+    .poll = tcp_poll,
+};
+
+int tcp_socket_create(struct socket *sock)
+{
+    struct tcp_pcb *pcb = tcp_pcb_alloc();
+    if (!pcb) {
+        return NET_ENOMEM;
+    }
+
+    pcb->socket = sock;
+    sock->protocol_data = pcb;
+    sock->ops = &tcp_socket_ops;
+    return NET_SUCCESS;
+}
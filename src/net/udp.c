@@ -0,0 +1,388 @@
+/*
+ * MiniOS UDP
+ *
+ * Each socket has a control block on one list, matched on local port and
+ * address, then on the remote end if the socket is connected. Arriving
+ * datagrams wait in the packets they came in on a short per-socket queue,
+ * dropped once it is full, until a reader copies them out; readers sleep
+ * on the block's wait queue. Sending builds the datagram in a packet
+ * straight from the caller's buffer. Addresses and ports are kept in
+ * network byte order throughout.
+ */
+
+#include "net.h"
+#include "kernel.h"
+#include "memory.h"
+#include "process.h"
+#include "vfs.h"
+
+#define UDP_RX_QUEUE_MAX    32      // Datagrams waiting per socket
+#define UDP_MAX_PAYLOAD     (ETH_MTU - IP_HLEN - sizeof(struct udp_header))
+
+// A queued datagram's packet holds just the payload; the sender is in cb
+#define UDP_CB_SRC_IP       0
+#define UDP_CB_SRC_PORT     1
+
+struct udp_pcb {
+    struct udp_pcb *next;
+    uint32_t local_ip;
+    uint16_t local_port;                // 0 until bound
+    uint32_t remote_ip;                 // Set by connect
+    uint16_t remote_port;
+    struct net_packet *rx_head;
+    struct net_packet *rx_tail;
+    int rx_count;
+    struct wait_queue wait;             // Readers waiting for a datagram
+};
+
+static struct udp_pcb *udp_pcbs = NULL;
+static uint16_t udp_next_port = NET_EPHEMERAL_FIRST;
+
+static int udp_port_in_use(uint16_t port, uint32_t ip)
+{
+    for (struct udp_pcb *pcb = udp_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->local_port == port &&
+            (pcb->local_ip == INADDR_ANY || ip == INADDR_ANY || pcb->local_ip == ip)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Caller holds net_lock
+static int udp_bind_locked(struct udp_pcb *pcb, uint32_t ip, uint16_t port)
+{
+    if (port == 0) {
+        for (int tries = NET_EPHEMERAL_LAST - NET_EPHEMERAL_FIRST + 1; tries > 0; tries--) {
+            uint16_t candidate = htons(udp_next_port);
+            udp_next_port = udp_next_port == NET_EPHEMERAL_LAST ? NET_EPHEMERAL_FIRST
+                                                                : udp_next_port + 1;
+            if (!udp_port_in_use(candidate, ip)) {
+                port = candidate;
+                break;
+            }
+        }
+        if (port == 0) {
+            return NET_EADDRINUSE;
+        }
+    } else if (udp_port_in_use(port, ip)) {
+        return NET_EADDRINUSE;
+    }
+
+    pcb->local_ip = ip;
+    pcb->local_port = port;
+    return NET_SUCCESS;
+}
+
+static struct udp_pcb *udp_lookup(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport)
+{
+    struct udp_pcb *match = NULL;
+
+    for (struct udp_pcb *pcb = udp_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->local_port != dport ||
+            (pcb->local_ip != INADDR_ANY && pcb->local_ip != dst)) {
+            continue;
+        }
+        if (pcb->remote_port) {
+            if (pcb->remote_ip == src && pcb->remote_port == sport) {
+                return pcb;     // Connected sockets win
+            }
+            continue;
+        }
+        match = pcb;
+    }
+    return match;
+}
+
+void udp_input(struct net_packet *packet, uint32_t src, uint32_t dst)
+{
+    struct network_interface *netif = packet->netif;
+
+    if (packet->len < sizeof(struct udp_header)) {
+        netif->stats.rx_errors++;
+        return;
+    }
+
+    struct udp_header *udp = packet->data;
+    size_t len = ntohs(udp->len);
+    if (len < sizeof(struct udp_header) || len > packet->len) {
+        netif->stats.rx_errors++;
+        return;
+    }
+    if (udp->checksum && !(packet->flags & NET_PACKET_CSUM_VALID)) {
+        uint32_t sum = net_pseudo_header_sum(src, dst, IPPROTO_UDP, (uint16_t)len);
+        if (net_checksum_fold(net_checksum_add(sum, udp, len)) != 0) {
+            netif->stats.rx_errors++;
+            return;
+        }
+    }
+
+    struct udp_pcb *pcb = udp_lookup(src, udp->src_port, dst, udp->dst_port);
+    if (!pcb || pcb->rx_count >= UDP_RX_QUEUE_MAX) {
+        netif->stats.rx_dropped++;
+        return;
+    }
+
+    struct net_packet *dgram = net_packet_get(packet);
+    dgram->cb[UDP_CB_SRC_IP] = src;
+    dgram->cb[UDP_CB_SRC_PORT] = udp->src_port;
+    net_packet_pull(dgram, sizeof(struct udp_header));
+    dgram->len = len - sizeof(struct udp_header);
+    dgram->next = NULL;
+
+    if (pcb->rx_tail) {
+        pcb->rx_tail->next = dgram;
+    } else {
+        pcb->rx_head = dgram;
+    }
+    pcb->rx_tail = dgram;
+    pcb->rx_count++;
+    wake_up(&pcb->wait);
+}
+
+static inline struct udp_pcb *udp_pcb_of(struct socket *sock)
+{
+    return (struct udp_pcb *)sock->protocol_data;
+}
+
+static int udp_parse_address(const struct sockaddr *addr, socklen_t addrlen,
+                             uint32_t *ip, uint16_t *port)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+    if (!addr || addrlen < sizeof(struct sockaddr_in) || in->sin_family != AF_INET) {
+        return NET_EINVAL;
+    }
+    *ip = in->sin_addr;
+    *port = in->sin_port;
+    return NET_SUCCESS;
+}
+
+static int udp_bind(struct socket *sock, const struct sockaddr *addr, socklen_t addrlen)
+{
+    uint32_t ip;
+    uint16_t port;
+    int result = udp_parse_address(addr, addrlen, &ip, &port);
+    if (result != NET_SUCCESS) {
+        return result;
+    }
+
+    struct udp_pcb *pcb = udp_pcb_of(sock);
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    if (pcb->local_port) {
+        result = NET_EINVAL;
+    } else if (ip != INADDR_ANY && !net_is_local_address(ip)) {
+        result = NET_EINVAL;
+    } else {
+        result = udp_bind_locked(pcb, ip, port);
+    }
+    if (result == NET_SUCCESS) {
+        sock->local_ip = pcb->local_ip;
+        sock->local_port = pcb->local_port;
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+    return result;
+}
+
+static int udp_connect(struct socket *sock, const struct sockaddr *addr, socklen_t addrlen)
+{
+    uint32_t ip;
+    uint16_t port;
+    int result = udp_parse_address(addr, addrlen, &ip, &port);
+    if (result != NET_SUCCESS) {
+        return result;
+    }
+    if (port == 0) {
+        return NET_EINVAL;
+    }
+
+    struct udp_pcb *pcb = udp_pcb_of(sock);
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    if (!pcb->local_port) {
+        result = udp_bind_locked(pcb, INADDR_ANY, 0);
+    }
+    if (result == NET_SUCCESS) {
+        pcb->remote_ip = ip;
+        pcb->remote_port = port;
+        sock->local_port = pcb->local_port;
+        sock->remote_ip = ip;
+        sock->remote_port = port;
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+    return result;
+}
+
+static ssize_t udp_sendto(struct socket *sock, const void *buf, size_t len, int flags,
+                          const struct sockaddr *addr, socklen_t addrlen)
+{
+    (void)flags;
+
+    struct udp_pcb *pcb = udp_pcb_of(sock);
+    uint32_t ip = pcb->remote_ip;
+    uint16_t port = pcb->remote_port;
+    if (addr) {
+        int result = udp_parse_address(addr, addrlen, &ip, &port);
+        if (result != NET_SUCCESS) {
+            return result;
+        }
+    }
+    if (port == 0) {
+        return NET_ENOTCONN;
+    }
+    if (len > UDP_MAX_PAYLOAD) {
+        return NET_EINVAL;
+    }
+
+    // Copy before taking the lock; the buffer may be user memory
+    struct net_packet *packet;
+    if (net_packet_alloc(&packet, ETH_HLEN + IP_HLEN + sizeof(struct udp_header) + len) != NET_SUCCESS) {
+        return NET_ENOMEM;
+    }
+    memcpy(net_packet_put(packet, len), buf, len);
+
+    unsigned long irq = spin_lock_irqsave(&net_lock);
+    int result = NET_SUCCESS;
+    if (!pcb->local_port) {
+        result = udp_bind_locked(pcb, INADDR_ANY, 0);
+        sock->local_port = pcb->local_port;
+    }
+    uint32_t src = pcb->local_ip != INADDR_ANY ? pcb->local_ip : ip_source_address(ip);
+    if (result == NET_SUCCESS && src == 0) {
+        result = NET_EHOSTUNREACH;
+    }
+    if (result != NET_SUCCESS) {
+        spin_unlock_irqrestore(&net_lock, irq);
+        net_packet_free(packet);
+        return result;
+    }
+
+    struct udp_header *udp = net_packet_push(packet, sizeof(struct udp_header));
+    udp->src_port = pcb->local_port;
+    udp->dst_port = port;
+    udp->len = htons((uint16_t)packet->len);
+    udp->checksum = 0;
+    uint32_t sum = net_pseudo_header_sum(src, ip, IPPROTO_UDP, (uint16_t)packet->len);
+    uint16_t checksum = net_checksum_fold(net_checksum_add(sum, udp, packet->len));
+    udp->checksum = checksum ? checksum : 0xFFFF;   // 0 means "none"
+
+    result = ip_output(packet, src, ip, IPPROTO_UDP);
+    spin_unlock_irqrestore(&net_lock, irq);
+
+    return result == NET_SUCCESS ? (ssize_t)len : result;
+}
+
+static ssize_t udp_send(struct socket *sock, const void *buf, size_t len, int flags)
+{
+    return udp_sendto(sock, buf, len, flags, NULL, 0);
+}
+
+static inline int udp_readable(struct udp_pcb *pcb)
+{
+    return __atomic_load_n(&pcb->rx_head, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// One datagram per call; whatever does not fit in buf is discarded
+static ssize_t udp_recvfrom(struct socket *sock, void *buf, size_t len, int flags,
+                            struct sockaddr *addr, socklen_t *addrlen)
+{
+    (void)flags;
+
+    struct udp_pcb *pcb = udp_pcb_of(sock);
+    struct net_packet *dgram = NULL;
+
+    while (!dgram) {
+        wait_event(&pcb->wait, udp_readable(pcb));
+
+        unsigned long irq = spin_lock_irqsave(&net_lock);
+        dgram = pcb->rx_head;
+        if (dgram) {
+            pcb->rx_head = dgram->next;
+            if (!pcb->rx_head) {
+                pcb->rx_tail = NULL;
+            }
+            pcb->rx_count--;
+        }
+        spin_unlock_irqrestore(&net_lock, irq);
+    }
+
+    size_t copied = dgram->len < len ? dgram->len : len;
+    memcpy(buf, dgram->data, copied);
+    if (addr && addrlen && *addrlen >= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        memset(in, 0, sizeof(*in));
+        in->sin_family = AF_INET;
+        in->sin_port = (uint16_t)dgram->cb[UDP_CB_SRC_PORT];
+        in->sin_addr = dgram->cb[UDP_CB_SRC_IP];
+        *addrlen = sizeof(struct sockaddr_in);
+    }
+    net_packet_free(dgram);
+
+    return (ssize_t)copied;
+}
+
+static ssize_t udp_recv(struct socket *sock, void *buf, size_t len, int flags)
+{
+    return udp_recvfrom(sock, buf, len, flags, NULL, NULL);
+}
+
+static int udp_close(struct socket *sock)
+{
+    struct udp_pcb *pcb = udp_pcb_of(sock);
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    for (struct udp_pcb **link = &udp_pcbs; *link; link = &(*link)->next) {
+        if (*link == pcb) {
+            *link = pcb->next;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    while (pcb->rx_head) {
+        struct net_packet *next = pcb->rx_head->next;
+        net_packet_free(pcb->rx_head);
+        pcb->rx_head = next;
+    }
+    kfree(pcb);
+    sock->protocol_data = NULL;
+    return NET_SUCCESS;
+}
+
+// Sends never wait, so a datagram socket is always writable
+static uint32_t udp_poll(struct socket *sock, struct poll_table *pt)
+{
+    struct udp_pcb *pcb = udp_pcb_of(sock);
+    poll_wait(pt, &pcb->wait);
+    return (udp_readable(pcb) ? EPOLLIN : 0) | EPOLLOUT;
+}
+
+struct socket_ops udp_socket_ops = {
+    .bind = udp_bind,
+    .connect = udp_connect,
+    .listen = NULL,
+    .accept = NULL,
+    .send = udp_send,
+    .recv = udp_recv,
+    .sendto = udp_sendto,
+    .recvfrom = udp_recvfrom,
+    .close = udp_close,
+    .poll = udp_poll,
+};
+
+int udp_socket_create(struct socket *sock)
+{
+    struct udp_pcb *pcb = kmalloc(sizeof(struct udp_pcb));
+    if (!pcb) {
+        return NET_ENOMEM;
+    }
+    memset(pcb, 0, sizeof(*pcb));
+    wait_queue_init(&pcb->wait);
+
+    unsigned long flags = spin_lock_irqsave(&net_lock);
+    pcb->next = udp_pcbs;
+    udp_pcbs = pcb;
+    spin_unlock_irqrestore(&net_lock, flags);
+
+    sock->protocol_data = pcb;
+    sock->ops = &udp_socket_ops;
+    return NET_SUCCESS;
+}
@@ -15,14 +15,10 @@ extern char *strrchr(const char *s, int c);
 extern char *strstr(const char *haystack, const char *needle);
 extern int snprintf(char *str, size_t size, const char *format, ...);
 
-// Built-in commands for completion
-const char *builtin_commands[] = {
-    "help", "exit", "clear", "echo", "pwd", "cd", "ls", "mkdir", "rmdir",
-    "touch", "rm", "cp", "mv", "cat", "ps", "meminfo", "version", "date",
-    "exec", "run", "kill", "history"
-};
-
-const int builtin_command_count = sizeof(builtin_commands) / sizeof(builtin_commands[0]);
+// Results, prefixes and path pieces for the completion in progress; all
+// of it goes at once in completion_cleanup()
+static char completion_arena_buffer[COMPLETION_ARENA_SIZE];
+static struct shell_arena completion_arena = SHELL_ARENA_INIT(completion_arena_buffer);
 
 // Initialize completion context
 int completion_init(struct completion_context *comp) {
@@ -31,31 +27,20 @@ int completion_init(struct completion_context *comp) {
     }
     
     memset(comp, 0, sizeof(struct completion_context));
+    shell_arena_reset(&completion_arena);
     comp->type = COMPLETION_NONE;
     comp->current_completion = -1;
     
     return 0;
 }
 
-// Clean up completion context
+// Clean up completion context, releasing every string handed out since init
 void completion_cleanup(struct completion_context *comp) {
     if (!comp) {
         return;
     }
     
-    if (comp->completions) {
-        for (int i = 0; i < comp->completion_count; i++) {
-            if (comp->completions[i]) {
-                kfree(comp->completions[i]);
-            }
-        }
-        kfree(comp->completions);
-    }
-    
-    if (comp->partial_text) {
-        kfree(comp->partial_text);
-    }
-    
+    shell_arena_reset(&completion_arena);
     memset(comp, 0, sizeof(struct completion_context));
 }
 
@@ -68,75 +53,100 @@ int shell_handle_tab_completion(struct shell_context *ctx) {
     // For Phase 7, provide a simplified tab completion
     // Just complete basic commands
     
-    char *input = ctx->input_buffer;
-    int len = strlen(input);
-    
-    // Find matching commands
-    for (int i = 0; i < builtin_command_count; i++) {
-        if (strncmp(builtin_commands[i], input, len) == 0) {
-            // Found a match - complete it
-            if (len < ctx->buffer_size - 1) {
-                strcpy(ctx->input_buffer, builtin_commands[i]);
-                ctx->cursor_pos = strlen(builtin_commands[i]);
-                return 0;
+    // First matching command, by name
+    const char *match;
+    if (shell_complete_command(ctx->input_buffer, &match, 1) == 1 &&
+        (int)strlen(match) < ctx->buffer_size) {
+        strcpy(ctx->input_buffer, match);
+        ctx->cursor_pos = strlen(match);
+        return 0;
+    }
+    
+    return -1;
+}
+
+/*
+ * Append directory's entries starting with partial to results, up to
+ * COMPLETION_MAX_RESULTS. Types come with the names, so no entry needs a
+ * stat of its own. For command names only files are wanted, and only
+ * those no builtin shadows; otherwise directories get a trailing '/'.
+ */
+static void complete_from_directory(const char *partial, const char *directory,
+                                    int commands, char **results, int *count) {
+    int fd = vfs_open(directory, VFS_O_RDONLY, 0);
+    if (fd < 0) {
+        return;
+    }
+    
+    int partial_len = strlen(partial);
+    struct dirent_plus entries[8];
+    int got;
+    while ((got = vfs_readdir_plus(fd, entries, 8)) > 0) {
+        for (int i = 0; i < got; i++) {
+            const struct dirent *ent = &entries[i].dirent;
+            if (strncmp(ent->name, partial, partial_len) != 0) {
+                continue;
+            }
+            
+            int dir = (entries[i].mode & VFS_FILE_DIRECTORY) != 0;
+            if (commands && (dir || shell_find_command(ent->name))) {
+                continue;
+            }
+            
+            if (*count >= COMPLETION_MAX_RESULTS) {
+                vfs_close(fd);
+                return;
+            }
+            
+            results[*count] = shell_arena_alloc(&completion_arena, strlen(ent->name) + 2);
+            if (results[*count]) {
+                strcpy(results[*count], ent->name);
+                if (dir) {
+                    strcat(results[*count], "/");
+                }
+                (*count)++;
             }
         }
     }
     
-    return -1;
+    vfs_close(fd);
 }
 
-// Complete command names
+// Complete command names: builtins from the shell's sorted command index,
+// then programs in SHELL_BIN_DIRECTORY
 char **complete_command_name(const char *partial, int *count) {
     if (!partial || !count) {
         return NULL;
     }
     
     *count = 0;
-    int capacity = 16;
-    char **results = kmalloc(sizeof(char *) * capacity);
+    char **results = shell_arena_alloc(&completion_arena, sizeof(char *) * COMPLETION_MAX_RESULTS);
     if (!results) {
         return NULL;
     }
     
-    int partial_len = strlen(partial);
-    
-    // Check built-in commands
-    for (int i = 0; i < builtin_command_count; i++) {
-        if (strncmp(builtin_commands[i], partial, partial_len) == 0) {
-            if (*count >= capacity) {
-                capacity *= 2;
-                char **new_results = kmalloc(sizeof(char *) * capacity);
-                if (!new_results) {
-                    break;
-                }
-                memcpy(new_results, results, sizeof(char *) * *count);
-                kfree(results);
-                results = new_results;
-            }
-            
-            results[*count] = kmalloc(strlen(builtin_commands[i]) + 1);
-            if (results[*count]) {
-                strcpy(results[*count], builtin_commands[i]);
-                (*count)++;
-            }
-        }
-    }
+    // Builtin names live in the command table, which outlives any completion
+    *count = shell_complete_command(partial, (const char **)results, COMPLETION_MAX_RESULTS);
+    complete_from_directory(partial, SHELL_BIN_DIRECTORY, 1, results, count);
     
     return results;
 }
 
-// Complete filenames (simplified)
+// Complete filenames: entries of directory starting with partial, with a
+// '/' after directory names (see is_directory())
 char **complete_filename(const char *partial, const char *directory, int *count) {
     if (!partial || !directory || !count) {
         return NULL;
     }
     
     *count = 0;
+    char **results = shell_arena_alloc(&completion_arena, sizeof(char *) * COMPLETION_MAX_RESULTS);
+    if (!results) {
+        return NULL;
+    }
     
-    // For Phase 7, return empty completion list
-    // In a full implementation, this would scan directories
-    return NULL;
+    complete_from_directory(partial, directory, 0, results, count);
+    return results;
 }
 
 // Complete directory names (simplified)
@@ -155,10 +165,7 @@ int find_completion_context(const char *line, int cursor_pos, struct completion_
     comp->completion_start = 0;
     comp->completion_end = strlen(line);
     
-    comp->partial_text = kmalloc(strlen(line) + 1);
-    if (comp->partial_text) {
-        strcpy(comp->partial_text, line);
-    }
+    comp->partial_text = shell_arena_strdup(&completion_arena, line);
     
     return 0;
 }
@@ -170,11 +177,7 @@ char *get_common_prefix(char **completions, int count) {
     }
     
     if (count == 1) {
-        char *prefix = kmalloc(strlen(completions[0]) + 1);
-        if (prefix) {
-            strcpy(prefix, completions[0]);
-        }
-        return prefix;
+        return shell_arena_strdup(&completion_arena, completions[0]);
     }
     
     // Find length of common prefix
@@ -192,7 +195,7 @@ char *get_common_prefix(char **completions, int count) {
         return NULL;
     }
     
-    char *prefix = kmalloc(prefix_len + 1);
+    char *prefix = shell_arena_alloc(&completion_arena, prefix_len + 1);
     if (prefix) {
         strncpy(prefix, completions[0], prefix_len);
         prefix[prefix_len] = '\0';
@@ -271,14 +274,10 @@ char *extract_directory_path(const char *path) {
     
     int len = last_slash - path;
     if (len == 0) {
-        char *root = kmalloc(2);
-        if (root) {
-            strcpy(root, "/");
-        }
-        return root;
+        return shell_arena_strdup(&completion_arena, "/");
     }
     
-    char *dir = kmalloc(len + 1);
+    char *dir = shell_arena_alloc(&completion_arena, len + 1);
     if (dir) {
         strncpy(dir, path, len);
         dir[len] = '\0';
@@ -295,10 +294,5 @@ char *extract_filename(const char *path) {
     char *last_slash = strrchr(path, '/');
     const char *filename = last_slash ? last_slash + 1 : path;
     
-    char *result = kmalloc(strlen(filename) + 1);
-    if (result) {
-        strcpy(result, filename);
-    }
-    
-    return result;
+    return shell_arena_strdup(&completion_arena, filename);
 }
\ No newline at end of file
@@ -8,6 +8,11 @@
 extern "C" {
 #endif
 
+// Completion storage: strings and result arrays below come from a fixed
+// arena and stay valid until completion_cleanup()
+#define COMPLETION_ARENA_SIZE   4096
+#define COMPLETION_MAX_RESULTS  64      // Matches kept per call
+
 // Tab completion context
 struct completion_context {
     char *partial_text;             // Partial text being completed
@@ -50,10 +55,6 @@ int is_executable(const char *path);
 char *extract_directory_path(const char *path);
 char *extract_filename(const char *path);
 
-// Built-in command list for completion
-extern const char *builtin_commands[];
-extern const int builtin_command_count;
-
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,11 @@ extern int strcmp(const char *s1, const char *s2);
 extern char *strstr(const char *haystack, const char *needle);
 extern int snprintf(char *str, size_t size, const char *format, ...);
 
+// Entry i of the ring, counting from the oldest
+static struct history_entry *history_at(struct history_context *hist, int i) {
+    return &hist->entries[(hist->first + i) % HISTORY_MAX_ENTRIES];
+}
+
 // Initialize history context
 int history_init(struct history_context *hist) {
     if (!hist) {
@@ -19,32 +24,14 @@ int history_init(struct history_context *hist) {
     
     memset(hist, 0, sizeof(struct history_context));
     hist->max_entries = HISTORY_MAX_ENTRIES;
+    hist->current = -1;
     
     return 0;
 }
 
 // Clean up history context
 void history_cleanup(struct history_context *hist) {
-    if (!hist) {
-        return;
-    }
-    
-    // Free all history entries
-    struct history_entry *entry = hist->head;
-    while (entry) {
-        struct history_entry *next = entry->next;
-        if (entry->command) {
-            kfree(entry->command);
-        }
-        kfree(entry);
-        entry = next;
-    }
-    
-    if (hist->saved_line) {
-        kfree(hist->saved_line);
-    }
-    
-    memset(hist, 0, sizeof(struct history_context));
+    history_clear(hist);
 }
 
 // Add command to history
@@ -54,53 +41,24 @@ int history_add_command(struct history_context *hist, const char *command) {
     }
     
     // Don't add duplicate of last command
-    if (hist->tail && strcmp(hist->tail->command, command) == 0) {
+    if (hist->count > 0 && strcmp(history_at(hist, hist->count - 1)->command, command) == 0) {
         return 0;
     }
     
-    // Create new entry
-    struct history_entry *entry = kmalloc(sizeof(struct history_entry));
-    if (!entry) {
-        return -1;
-    }
-    
-    entry->command = kmalloc(strlen(command) + 1);
-    if (!entry->command) {
-        kfree(entry);
-        return -1;
+    // Full: the oldest slot becomes the newest
+    int limit = hist->max_entries > 0 && hist->max_entries < HISTORY_MAX_ENTRIES ?
+                hist->max_entries : HISTORY_MAX_ENTRIES;
+    while (hist->count >= limit) {
+        hist->first = (hist->first + 1) % HISTORY_MAX_ENTRIES;
+        hist->count--;
     }
     
-    strcpy(entry->command, command);
+    struct history_entry *entry = history_at(hist, hist->count);
+    strncpy(entry->command, command, HISTORY_MAX_LINE_LENGTH - 1);
+    entry->command[HISTORY_MAX_LINE_LENGTH - 1] = '\0';
     entry->timestamp = timer_get_ticks();
-    entry->next = NULL;
-    entry->prev = hist->tail;
-    
-    // Add to list
-    if (hist->tail) {
-        hist->tail->next = entry;
-    } else {
-        hist->head = entry;
-    }
-    hist->tail = entry;
     hist->count++;
     
-    // Remove oldest entries if we exceed max
-    while (hist->count > hist->max_entries) {
-        struct history_entry *old_head = hist->head;
-        hist->head = old_head->next;
-        if (hist->head) {
-            hist->head->prev = NULL;
-        } else {
-            hist->tail = NULL;
-        }
-        
-        if (old_head->command) {
-            kfree(old_head->command);
-        }
-        kfree(old_head);
-        hist->count--;
-    }
-    
     return 0;
 }
 
@@ -112,15 +70,14 @@ int history_start_navigation(struct history_context *hist, const char *current_l
     
     if (!hist->navigating) {
         // Save current input
+        hist->saved_line[0] = '\0';
         if (current_line) {
-            hist->saved_line = kmalloc(strlen(current_line) + 1);
-            if (hist->saved_line) {
-                strcpy(hist->saved_line, current_line);
-                hist->saved_cursor_pos = cursor_pos;
-            }
+            strncpy(hist->saved_line, current_line, HISTORY_MAX_LINE_LENGTH - 1);
+            hist->saved_line[HISTORY_MAX_LINE_LENGTH - 1] = '\0';
+            hist->saved_cursor_pos = cursor_pos;
         }
         hist->navigating = 1;
-        hist->current = hist->tail;
+        hist->current = hist->count - 1;
     }
     
     return 0;
@@ -133,12 +90,8 @@ void history_end_navigation(struct history_context *hist) {
     }
     
     hist->navigating = 0;
-    hist->current = NULL;
-    
-    if (hist->saved_line) {
-        kfree(hist->saved_line);
-        hist->saved_line = NULL;
-    }
+    hist->current = -1;
+    hist->saved_line[0] = '\0';
 }
 
 // Get previous command in history
@@ -147,13 +100,13 @@ const char *history_get_previous(struct history_context *hist) {
         return NULL;
     }
     
-    if (!hist->current) {
+    if (hist->current < 0) {
         // At beginning, return saved line
         return hist->saved_line;
     }
     
-    const char *command = hist->current->command;
-    hist->current = hist->current->prev;
+    const char *command = history_at(hist, hist->current)->command;
+    hist->current--;
     
     return command;
 }
@@ -164,15 +117,15 @@ const char *history_get_next(struct history_context *hist) {
         return NULL;
     }
     
-    if (!hist->current) {
+    if (hist->current < 0) {
         // Already at newest, stay at saved line
         return hist->saved_line;
     }
     
-    hist->current = hist->current->next;
+    hist->current = hist->current + 1 < hist->count ? hist->current + 1 : -1;
     
-    if (hist->current) {
-        return hist->current->command;
+    if (hist->current >= 0) {
+        return history_at(hist, hist->current)->command;
     } else {
         // Reached end, return to saved line
         return hist->saved_line;
@@ -233,13 +186,8 @@ void history_display_all(struct history_context *hist) {
         return;
     }
     
-    struct history_entry *entry = hist->head;
-    int index = 1;
-    
-    while (entry) {
-        // Would display history here
-        entry = entry->next;
-        index++;
+    for (int i = 0; i < hist->count; i++) {
+        // Would display history_at(hist, i) here
     }
 }
 
@@ -250,18 +198,11 @@ void history_display_recent(struct history_context *hist, int count) {
     }
     
     // Find starting point
-    struct history_entry *entry = hist->tail;
-    int entries_to_skip = hist->count - count;
-    
-    for (int i = 0; i < entries_to_skip && entry; i++) {
-        entry = entry->prev;
-    }
+    int start = hist->count > count ? hist->count - count : 0;
     
     // Display entries (simplified)
-    int index = hist->count - count + 1;
-    while (entry) {
-        entry = entry->next;
-        index++;
+    for (int i = start; i < hist->count; i++) {
+        // Would display history_at(hist, i) here
     }
 }
 
@@ -271,12 +212,7 @@ const char *history_get_entry(struct history_context *hist, int index) {
         return NULL;
     }
     
-    struct history_entry *entry = hist->head;
-    for (int i = 1; i < index && entry; i++) {
-        entry = entry->next;
-    }
-    
-    return entry ? entry->command : NULL;
+    return history_at(hist, index - 1)->command;
 }
 
 // Check if command should be added to history
@@ -304,26 +240,11 @@ void history_clear(struct history_context *hist) {
         return;
     }
     
-    struct history_entry *entry = hist->head;
-    while (entry) {
-        struct history_entry *next = entry->next;
-        if (entry->command) {
-            kfree(entry->command);
-        }
-        kfree(entry);
-        entry = next;
-    }
-    
-    hist->head = NULL;
-    hist->tail = NULL;
-    hist->current = NULL;
+    hist->first = 0;
     hist->count = 0;
+    hist->current = -1;
     hist->navigating = 0;
-    
-    if (hist->saved_line) {
-        kfree(hist->saved_line);
-        hist->saved_line = NULL;
-    }
+    hist->saved_line[0] = '\0';
 }
 
 // Search backward in history (simplified)
@@ -332,14 +253,12 @@ const char *history_search_backward(struct history_context *hist, const char *pa
         return NULL;
     }
     
-    struct history_entry *entry = hist->current ? hist->current->prev : hist->tail;
-    
-    while (entry) {
-        if (strstr(entry->command, pattern)) {
-            hist->current = entry;
-            return entry->command;
+    for (int i = hist->current >= 0 ? hist->current - 1 : hist->count - 1; i >= 0; i--) {
+        const char *command = history_at(hist, i)->command;
+        if (strstr(command, pattern)) {
+            hist->current = i;
+            return command;
         }
-        entry = entry->prev;
     }
     
     return NULL;
@@ -351,15 +270,13 @@ const char *history_search_forward(struct history_context *hist, const char *pat
         return NULL;
     }
     
-    struct history_entry *entry = hist->current ? hist->current->next : hist->head;
-    
-    while (entry) {
-        if (strstr(entry->command, pattern)) {
-            hist->current = entry;
-            return entry->command;
+    for (int i = hist->current >= 0 ? hist->current + 1 : 0; i < hist->count; i++) {
+        const char *command = history_at(hist, i)->command;
+        if (strstr(command, pattern)) {
+            hist->current = i;
+            return command;
         }
-        entry = entry->next;
     }
     
     return NULL;
-}
\ No newline at end of file
+}
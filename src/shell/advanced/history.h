@@ -9,29 +9,31 @@ extern "C" {
 #endif
 
 // History configuration
-#define HISTORY_MAX_ENTRIES     100
+#define HISTORY_MAX_ENTRIES     32
 #define HISTORY_MAX_LINE_LENGTH 512
 
-// History entry structure
+// History entry: text stored inline, longer commands are cut
 struct history_entry {
-    char *command;                  // Command text
-    int timestamp;                  // When command was executed
-    struct history_entry *next;    // Next entry in list
-    struct history_entry *prev;    // Previous entry in list
+    char command[HISTORY_MAX_LINE_LENGTH];  // Command text
+    int timestamp;                          // When command was executed
 };
 
-// History context
+/*
+ * History context: a ring of HISTORY_MAX_ENTRIES inline entries. Adding
+ * to a full ring overwrites the oldest entry, so history never allocates
+ * and clearing it is O(1).
+ */
 struct history_context {
-    struct history_entry *head;    // First (oldest) entry
-    struct history_entry *tail;    // Last (newest) entry
-    struct history_entry *current; // Current position for navigation
+    struct history_entry entries[HISTORY_MAX_ENTRIES];
+    int first;                      // Ring slot of the oldest entry
     int count;                      // Number of entries
-    int max_entries;               // Maximum entries to keep
+    int max_entries;                // Maximum entries to keep
     
     // Navigation state
+    int current;                    // Entry index (0 = oldest), -1 for none
     int navigating;                 // Currently navigating history
-    char *saved_line;              // Saved current input during navigation
-    int saved_cursor_pos;          // Saved cursor position
+    char saved_line[HISTORY_MAX_LINE_LENGTH];   // Current input during navigation
+    int saved_cursor_pos;           // Saved cursor position
 };
 
 // History management functions
@@ -81,7 +81,7 @@ static void normalize_path(char *dest, size_t dest_size, const char *path)
 }
 
 // Helper function to build full path from current directory and relative path
-static void build_full_path(char *dest, size_t dest_size, const char *current_dir, const char *path)
+void build_full_path(char *dest, size_t dest_size, const char *current_dir, const char *path)
 {
     char temp[SHELL_MAX_PATH_LENGTH];
     
@@ -178,6 +178,18 @@ int cmd_pwd(struct shell_context *ctx, int argc, char *argv[])
     return SHELL_SUCCESS;
 }
 
+// "drwxr-xr-x" style type and permission string for ls -l (11 bytes)
+static void format_mode(char *out, uint16_t type, uint32_t mode)
+{
+    static const char rwx[] = "rwxrwxrwx";
+
+    out[0] = (type & VFS_FILE_DIRECTORY) ? 'd' : (type & VFS_FILE_SYMLINK) ? 'l' : '-';
+    for (int bit = 0; bit < 9; bit++) {
+        out[1 + bit] = (mode & (0400u >> bit)) ? rwx[bit] : '-';
+    }
+    out[10] = '\0';
+}
+
 // List directory contents command
 int cmd_ls(struct shell_context *ctx, int argc, char *argv[])
 {
@@ -216,64 +228,59 @@ int cmd_ls(struct shell_context *ctx, int argc, char *argv[])
         return SHELL_ENOENT;
     }
     
-    // Read directory entries
-    struct dirent entries[16];  // Read up to 16 entries at a time
-    int count = vfs_readdir(fd, entries, 16);
-    
-    if (count < 0) {
-        shell_print_error("Failed to read directory\n");
-        vfs_close(fd);
-        return SHELL_ERROR;
-    }
-    
-    if (count == 0) {
-        shell_print("(empty directory)\n");
-    } else {
-        if (show_details) {
-            // Show detailed listing
+    int total = 0;
+    int count;
+    if (show_details) {
+        // Attributes come with the names: no stat and path walk per entry
+        struct dirent_plus entries[16];
+        while ((count = vfs_readdir_plus(fd, entries, 16)) > 0) {
             for (int i = 0; i < count; i++) {
-                struct dirent *ent = &entries[i];
-                
-                // Display file type
-                char type = '-';
-                if (ent->type & VFS_FILE_DIRECTORY) {
-                    type = 'd';
-                } else if (ent->type & VFS_FILE_SYMLINK) {
-                    type = 'l';
-                }
-                
-                shell_printf("%crw-r--r--  1 root root      0 Jan  1 00:00 %s\n", 
-                           type, ent->name);
+                const struct dirent_plus *ent = &entries[i];
+                char perms[11];
+                format_mode(perms, ent->dirent.type, ent->mode);
+                shell_printf("%s %8u %10u %s\n", perms, ent->size, ent->modified_time,
+                             ent->dirent.name);
             }
-        } else {
-            // Simple listing
+            total += count;
+        }
+    } else {
+        struct dirent entries[16];
+        while ((count = vfs_readdir(fd, entries, 16)) > 0) {
             for (int i = 0; i < count; i++) {
                 shell_print(entries[i].name);
                 shell_print("  ");
             }
+            total += count;
+        }
+        if (total > 0) {
             shell_print("\n");
         }
     }
+
+    if (count < 0) {
+        shell_print_error("Failed to read directory\n");
+        vfs_close(fd);
+        return SHELL_ERROR;
+    }
+
+    if (total == 0) {
+        shell_print("(empty directory)\n");
+    }
     
     vfs_close(fd);
     return SHELL_SUCCESS;
 }
 
-// Display file contents command  
-int cmd_cat(struct shell_context *ctx, int argc, char *argv[])
+// Open the named file, or take standard input when none is named
+static int open_input(struct shell_context *ctx, const char *name)
 {
-    if (!ctx || argc < 2) {
-        shell_print_error("Usage: cat <filename>\n");
-        return SHELL_EINVAL;
+    if (!name) {
+        return shell_has_stdin() ? STDIN_FD : SHELL_EINVAL;
     }
-    
-    const char *filename = argv[1];
-    
-    // Build full path if relative
+
     char full_path[SHELL_MAX_PATH_LENGTH];
-    build_full_path(full_path, sizeof(full_path), ctx->current_directory, filename);
-    
-    // Open file using VFS
+    build_full_path(full_path, sizeof(full_path), ctx->current_directory, name);
+
     int fd = vfs_open(full_path, VFS_O_RDONLY, 0);
     if (fd < 0) {
         shell_print_error("Cannot open file: ");
@@ -281,24 +288,210 @@ int cmd_cat(struct shell_context *ctx, int argc, char *argv[])
         shell_print_error("\n");
         return SHELL_ENOENT;
     }
+    return fd;
+}
+
+static void close_input(int fd)
+{
+    if (fd != STDIN_FD) {
+        vfs_close(fd);
+    }
+}
+
+// Parse "[-n lines] [file]" for head and tail
+static int parse_line_args(int argc, char *argv[], int *lines, const char **name)
+{
+    *lines = 10;
+    *name = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            const char *p = argv[++i];
+            int n = 0;
+            if (*p == '\0') {
+                return SHELL_EINVAL;
+            }
+            for (; *p; p++) {
+                if (*p < '0' || *p > '9' || n > 1000000) {
+                    return SHELL_EINVAL;
+                }
+                n = n * 10 + (*p - '0');
+            }
+            *lines = n;
+        } else if (!*name && argv[i][0] != '-') {
+            *name = argv[i];
+        } else {
+            return SHELL_EINVAL;
+        }
+    }
+    return SHELL_SUCCESS;
+}
+
+// Display file contents command; with no file, copy standard input
+int cmd_cat(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
     
-    // Read and display file contents
+    int fd = open_input(ctx, argc > 1 ? argv[1] : NULL);
+    if (fd == SHELL_EINVAL) {
+        shell_print_error("Usage: cat <filename>\n");
+        return SHELL_EINVAL;
+    }
+    if (fd < 0) {
+        return fd;
+    }
+    
+    // Read and pass on file contents
     char buffer[256];
     ssize_t bytes_read;
+    int result = SHELL_SUCCESS;
     
-    while ((bytes_read = vfs_read(fd, buffer, sizeof(buffer) - 1)) > 0) {
-        buffer[bytes_read] = '\0';  // Null-terminate for printing
-        shell_print(buffer);
+    while ((bytes_read = vfs_read(fd, buffer, sizeof(buffer))) > 0) {
+        if (shell_write(buffer, (size_t)bytes_read) < 0) {
+            result = SHELL_ERROR;  // Nobody reads the rest
+            break;
+        }
     }
     
     if (bytes_read < 0) {
         shell_print_error("\nError reading file\n");
-        vfs_close(fd);
-        return SHELL_ERROR;
+        result = SHELL_ERROR;
     }
     
-    vfs_close(fd);
-    return SHELL_SUCCESS;
+    close_input(fd);
+    return result;
+}
+
+// Print the first lines of a file or of standard input
+int cmd_head(struct shell_context *ctx, int argc, char *argv[])
+{
+    int lines;
+    const char *name;
+    if (!ctx || parse_line_args(argc, argv, &lines, &name) != SHELL_SUCCESS) {
+        shell_print_error("Usage: head [-n lines] [file]\n");
+        return SHELL_EINVAL;
+    }
+
+    int fd = open_input(ctx, name);
+    if (fd == SHELL_EINVAL) {
+        shell_print_error("Usage: head [-n lines] [file]\n");
+        return SHELL_EINVAL;
+    }
+    if (fd < 0) {
+        return fd;
+    }
+
+    // Stop reading at the last line wanted; in a pipeline closing early
+    // is what stops the stages before this one
+    char buffer[256];
+    ssize_t got = 0;
+    int seen = 0;
+    int result = SHELL_SUCCESS;
+    while (seen < lines && (got = vfs_read(fd, buffer, sizeof(buffer))) > 0) {
+        size_t len = 0;
+        while (len < (size_t)got && seen < lines) {
+            if (buffer[len++] == '\n') {
+                seen++;
+            }
+        }
+        if (shell_write(buffer, len) < 0) {
+            result = SHELL_ERROR;
+            break;
+        }
+    }
+
+    if (got < 0) {
+        shell_print_error("\nError reading file\n");
+        result = SHELL_ERROR;
+    }
+
+    close_input(fd);
+    return result;
+}
+
+// Offset of the first of the last lines lines in buf. A final newline
+// ends the last line rather than starting an empty one.
+static size_t tail_start(const char *buf, size_t len, int lines)
+{
+    if (lines == 0) {
+        return len;
+    }
+
+    size_t i = len;
+    if (i > 0 && buf[i - 1] == '\n') {
+        i--;
+    }
+    for (; i > 0; i--) {
+        if (buf[i - 1] == '\n' && --lines == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Print the last lines of a file or of standard input
+int cmd_tail(struct shell_context *ctx, int argc, char *argv[])
+{
+    int lines;
+    const char *name;
+    if (!ctx || parse_line_args(argc, argv, &lines, &name) != SHELL_SUCCESS) {
+        shell_print_error("Usage: tail [-n lines] [file]\n");
+        return SHELL_EINVAL;
+    }
+
+    int fd = open_input(ctx, name);
+    if (fd == SHELL_EINVAL) {
+        shell_print_error("Usage: tail [-n lines] [file]\n");
+        return SHELL_EINVAL;
+    }
+    if (fd < 0) {
+        return fd;
+    }
+
+    char *buffer = (char *)kmalloc(SHELL_TAIL_BUFFER);
+    if (!buffer) {
+        close_input(fd);
+        return SHELL_ENOMEM;
+    }
+
+    // Input may be a pipe of unknown length: keep only the last lines
+    // read so far, or the newer half when they fill the whole buffer
+    size_t used = 0;
+    ssize_t got;
+    for (;;) {
+        if (used == SHELL_TAIL_BUFFER) {
+            size_t start = tail_start(buffer, used, lines);
+            if (start == 0) {
+                start = used / 2;
+            }
+            for (size_t i = start; i < used; i++) {
+                buffer[i - start] = buffer[i];
+            }
+            used -= start;
+        }
+        got = vfs_read(fd, buffer + used, SHELL_TAIL_BUFFER - used);
+        if (got <= 0) {
+            break;
+        }
+        used += (size_t)got;
+    }
+
+    int result = SHELL_SUCCESS;
+    if (got < 0) {
+        shell_print_error("\nError reading file\n");
+        result = SHELL_ERROR;
+    } else {
+        size_t start = tail_start(buffer, used, lines);
+        if (shell_write(buffer + start, used - start) < 0) {
+            result = SHELL_ERROR;
+        }
+    }
+
+    kfree(buffer);
+    close_input(fd);
+    return result;
 }
 
 // Create directory command
@@ -444,23 +637,48 @@ int cmd_cp(struct shell_context *ctx, int argc, char *argv[])
         return SHELL_ERROR;
     }
     
-    // Copy file contents
-    char buffer[512];
-    ssize_t bytes_read;
-    ssize_t bytes_written;
-
-    while ((bytes_read = vfs_read(src_fd, buffer, sizeof(buffer))) > 0) {
-        bytes_written = vfs_write(dst_fd, buffer, bytes_read);
-        if (bytes_written != bytes_read) {
-            shell_print_error("Write error during copy\n");
-            vfs_close(src_fd);
-            vfs_close(dst_fd);
-            return SHELL_ERROR;
+    // The kernel moves the data from file to file; nothing passes through
+    // here. Only the source's data is copied, so its holes stay holes.
+    off_t size = vfs_seek(src_fd, 0, VFS_SEEK_END);
+    off_t pos = 0;
+    ssize_t copied = (size < 0) ? size : 0;
+    while (copied >= 0 && pos < size) {
+        off_t data = vfs_seek(src_fd, pos, VFS_SEEK_DATA);
+        if (data == VFS_ENXIO) {
+            break;  // Only a hole is left
+        }
+        off_t hole = (data < 0) ? data : vfs_seek(src_fd, data, VFS_SEEK_HOLE);
+        if (hole < 0) {
+            copied = hole;
+            break;
+        }
+
+        vfs_seek(src_fd, data, VFS_SEEK_SET);
+        vfs_seek(dst_fd, data, VFS_SEEK_SET);
+        while (data < hole) {
+            copied = vfs_copy_file_range(src_fd, dst_fd, (size_t)(hole - data));
+            if (copied <= 0) {
+                break;
+            }
+            data += copied;
+        }
+        if (copied == 0) {
+            break;  // Source shrank under us
         }
+        pos = hole;
     }
 
-    if (bytes_read < 0) {
-        shell_print_error("Read error during copy\n");
+    // A trailing hole still counts toward the size
+    if (copied >= 0 && pos < size) {
+        char zero = 0;
+        vfs_seek(dst_fd, size - 1, VFS_SEEK_SET);
+        if (vfs_write(dst_fd, &zero, 1) != 1) {
+            copied = VFS_EIO;
+        }
+    }
+
+    if (copied < 0) {
+        shell_print_error("Error during copy\n");
         vfs_close(src_fd);
         vfs_close(dst_fd);
         return SHELL_ERROR;
@@ -608,18 +826,65 @@ int cmd_touch(struct shell_context *ctx, int argc, char *argv[])
     return SHELL_SUCCESS;
 }
 
+// Block size for mkfs -b, in bytes or with a k suffix; 0 unless SFS takes it
+static uint32_t mkfs_parse_block_size(const char *arg)
+{
+    uint32_t value = 0;
+    const char *p = arg;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        if (value > SFS_MAX_BLOCK_SIZE) {
+            return 0;
+        }
+        value = value * 10 + (uint32_t)(*p - '0');
+    }
+    if ((*p == 'k' || *p == 'K') && p != arg) {
+        value = (value <= SFS_MAX_BLOCK_SIZE / 1024) ? value * 1024 : 0;
+        p++;
+    }
+    if (*p != '\0' || value < SFS_MIN_BLOCK_SIZE || value > SFS_MAX_BLOCK_SIZE ||
+        (value & (value - 1))) {
+        return 0;
+    }
+    return value;
+}
+
 // Format a block device with SFS
 int cmd_mkfs(struct shell_context *ctx, int argc, char *argv[])
 {
     (void)ctx;
 
-    if (argc < 2) {
-        shell_print_error("Usage: mkfs <device> [sfs]\n");
-        return SHELL_EINVAL;
+    // Positional arguments are <device> [sfs]; the options may appear anywhere
+    const char *device_name = NULL;
+    const char *fs_name = "sfs";
+    uint32_t features = 0;
+    uint32_t block_size = SFS_DEFAULT_BLOCK_SIZE;
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0) {
+            features |= SFS_FEATURE_EXTENTS;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            features |= SFS_FEATURE_DIR_INDEX;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            features |= SFS_FEATURE_JOURNAL;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            block_size = mkfs_parse_block_size(argv[++i]);
+            if (block_size == 0) {
+                shell_print_error("mkfs: block size must be 1k to 64k, a power of two\n");
+                return SHELL_EINVAL;
+            }
+        } else if (positional == 0) {
+            device_name = argv[i];
+            positional++;
+        } else if (positional == 1) {
+            fs_name = argv[i];
+            positional++;
+        }
     }
 
-    const char *device_name = argv[1];
-    const char *fs_name = (argc >= 3) ? argv[2] : "sfs";
+    if (!device_name) {
+        shell_print_error("Usage: mkfs [-e] [-d] [-j] [-b size] <device> [sfs]\n");
+        return SHELL_EINVAL;
+    }
 
     if (strcmp(fs_name, "sfs") != 0) {
         shell_print_error("Unsupported filesystem type\n");
@@ -627,6 +892,11 @@ int cmd_mkfs(struct shell_context *ctx, int argc, char *argv[])
     }
 
     struct block_device *dev = block_device_find(device_name);
+    if (!dev) {
+        // It may still be being probed in the background
+        device_async_wait();
+        dev = block_device_find(device_name);
+    }
     if (!dev) {
         shell_print_error("Block device not found: ");
         shell_print_error(device_name);
@@ -634,16 +904,92 @@ int cmd_mkfs(struct shell_context *ctx, int argc, char *argv[])
         return SHELL_ENOENT;
     }
 
-    int result = sfs_format(dev);
+    int result = sfs_format_with_block_size(dev, features, block_size);
     if (result != VFS_SUCCESS) {
         shell_printf("Format failed (code %d)\n", result);
         return SHELL_ERROR;
     }
 
-    shell_printf("Formatted %s with SFS\n", device_name);
+    shell_printf("Formatted %s with SFS, %u-byte blocks%s%s%s\n", device_name, block_size,
+                 (features & SFS_FEATURE_EXTENTS) ? " (extents)" : "",
+                 (features & SFS_FEATURE_DIR_INDEX) ? " (hashed directories)" : "",
+                 (features & SFS_FEATURE_JOURNAL) ? " (journal)" : "");
     return SHELL_SUCCESS;
 }
 
+// Check an SFS filesystem on an unmounted device
+int cmd_fsck(struct shell_context *ctx, int argc, char *argv[])
+{
+    (void)ctx;
+
+    const char *device_name = NULL;
+    uint32_t flags = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            flags |= SFS_FSCK_FAST;
+        } else if (strcmp(argv[i], "-y") == 0) {
+            flags |= SFS_FSCK_REPAIR;
+        } else if (!device_name) {
+            device_name = argv[i];
+        }
+    }
+
+    if (!device_name) {
+        shell_print_error("Usage: fsck [-f] [-y] <device>\n");
+        return SHELL_EINVAL;
+    }
+
+    struct block_device *dev = block_device_find(device_name);
+    if (!dev) {
+        device_async_wait();
+        dev = block_device_find(device_name);
+    }
+    if (!dev) {
+        shell_print_error("Block device not found: ");
+        shell_print_error(device_name);
+        shell_print_error("\n");
+        return SHELL_ENOENT;
+    }
+    if (vfs_device_mounted(dev)) {
+        shell_print_error("fsck: device is mounted; unmount it first\n");
+        return SHELL_ERROR;
+    }
+
+    struct sfs_fsck_result result;
+    uint64_t start = timer_get_time_us();
+    int status = sfs_fsck(dev, flags, &result);
+    uint64_t elapsed = timer_get_time_us() - start;
+    if (status != VFS_SUCCESS) {
+        shell_printf("fsck: check failed (code %d)\n", status);
+        return SHELL_ERROR;
+    }
+
+    if (flags & SFS_FSCK_FAST) {
+        shell_printf("%s: %u inodes, %u blocks in use (counters only)\n",
+                     device_name, result.inodes, result.blocks);
+    } else {
+        shell_printf("%s: %u inodes (%u directories), %u blocks in use\n",
+                     device_name, result.inodes, result.directories, result.blocks);
+    }
+    shell_printf("  free blocks %u (superblock %u), free inodes %u (superblock %u)\n",
+                 result.free_blocks, result.sb_free_blocks,
+                 result.free_inodes, result.sb_free_inodes);
+    if (result.journal_pending) {
+        shell_printf("  journal holds %u transactions to replay\n", result.journal_pending);
+    }
+    if (result.problems) {
+        shell_printf("  %u problems, %u fixed: bad blocks %u, shared blocks %u, bad entries %u, "
+                     "extra names %u, orphans %u, bitmap bits %u/%u, checksums %u\n",
+                     result.problems, result.fixed, result.bad_blocks, result.dup_blocks,
+                     result.bad_entries, result.extra_names, result.orphans,
+                     result.block_bitmap_errors, result.inode_bitmap_errors, result.csum_errors);
+    } else {
+        shell_printf("  clean\n");
+    }
+    shell_printf("  %llu us, %u workers\n", (unsigned long long)elapsed, result.workers);
+    return result.problems > result.fixed ? SHELL_ERROR : SHELL_SUCCESS;
+}
+
 // Mount a filesystem
 int cmd_mount(struct shell_context *ctx, int argc, char *argv[])
 {
@@ -689,6 +1035,65 @@ int cmd_umount(struct shell_context *ctx, int argc, char *argv[])
     return SHELL_SUCCESS;
 }
 
+// Decimal argument for sync's options, 0 if malformed
+static uint32_t sync_parse_number(const char *arg)
+{
+    uint32_t value = 0;
+    for (const char *p = arg; *p; p++) {
+        if (*p < '0' || *p > '9' || value > 100000000) {
+            return 0;
+        }
+        value = value * 10 + (uint32_t)(*p - '0');
+    }
+    return value;
+}
+
+// Write back cached data, or tune the background flusher
+int cmd_sync(struct shell_context *ctx, int argc, char *argv[])
+{
+    (void)ctx;
+
+    uint32_t interval_ms = 0;
+    uint32_t dirty_pages = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            interval_ms = sync_parse_number(argv[++i]);
+            if (interval_ms == 0) {
+                shell_print_error("sync: interval must be a positive number of ms\n");
+                return SHELL_EINVAL;
+            }
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dirty_pages = sync_parse_number(argv[++i]);
+            if (dirty_pages == 0) {
+                shell_print_error("sync: dirty threshold must be a positive page count\n");
+                return SHELL_EINVAL;
+            }
+        } else if (strcmp(argv[i], "-s") != 0) {
+            shell_print_error("Usage: sync [-s] [-i ms] [-d pages]\n");
+            return SHELL_EINVAL;
+        }
+    }
+
+    if (argc > 1) {
+        vfs_writeback_configure(interval_ms, dirty_pages);
+
+        struct vfs_writeback_stats stats;
+        vfs_writeback_get_stats(&stats);
+        shell_printf("Flusher: %s, every %d ms or at %d dirty pages\n",
+                     stats.running ? "running" : "not running",
+                     (int)stats.interval_ms, (int)stats.dirty_pages);
+        shell_printf("  %d passes, %d early, %d with errors\n",
+                     (int)stats.rounds, (int)stats.kicks, (int)stats.errors);
+        return SHELL_SUCCESS;
+    }
+
+    if (vfs_sync_all(1) != VFS_SUCCESS) {
+        shell_print_error("sync: write-back failed\n");
+        return SHELL_ERROR;
+    }
+    return SHELL_SUCCESS;
+}
+
 // Clear screen command
 int cmd_clear(struct shell_context *ctx, int argc, char *argv[])
 {
@@ -746,7 +1151,9 @@ int cmd_help(struct shell_context *ctx, int argc, char *argv[])
         shell_print("\n");
         
         shell_print("File Operations:\n");
-        shell_print("  cat <file>      - Display file contents\n");
+        shell_print("  cat [file]      - Display file contents\n");
+        shell_print("  head [-n N] [file] - Show the first lines of a file\n");
+        shell_print("  tail [-n N] [file] - Show the last lines of a file\n");
         shell_print("  touch <file>    - Create file or update timestamp\n");
         shell_print("  rm [-f] <file>  - Remove file\n");
         shell_print("  cp <src> <dst>  - Copy file\n");
@@ -754,9 +1161,10 @@ int cmd_help(struct shell_context *ctx, int argc, char *argv[])
         shell_print("\n");
 
         shell_print("Filesystem Commands:\n");
-        shell_print("  mkfs <dev> [sfs]      - Format device with SFS\n");
+        shell_print("  mkfs [-e] [-d] [-j] [-b size] <dev> [sfs] - Format device with SFS (-e: extents, -d: hashed dirs, -j: journal, -b: block size, 1k-64k)\n");
         shell_print("  mount <dev> <path>    - Mount filesystem\n");
         shell_print("  umount <path>         - Unmount filesystem\n");
+        shell_print("  sync [-s] [-i ms] [-d pages] - Write back cached data; -s shows, -i/-d tune the flusher\n");
         shell_print("\n");
         
         shell_print("System Information:\n");
@@ -767,6 +1175,12 @@ int cmd_help(struct shell_context *ctx, int argc, char *argv[])
         shell_print("  uptime          - Show system uptime\n");
         shell_print("\n");
         
+        shell_print("Networking:\n");
+        shell_print("  ifconfig        - Show network interfaces\n");
+        shell_print("  httpd [port]    - Start the HTTP server task\n");
+        shell_print("  httpbench [n] [addr] - Measure HTTP requests per second\n");
+        shell_print("\n");
+        
         shell_print("Other Commands:\n");
         shell_print("  echo [text]     - Display text\n");
         shell_print("  echo text > file - Write text to file\n");
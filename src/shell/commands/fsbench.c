@@ -0,0 +1,539 @@
+/*
+ * MiniOS Shell Filesystem Benchmark
+ * Throughput and metadata rates through the VFS, for comparing SFS and
+ * ramfs before and after file system changes. Every result carries the
+ * block device's transfer counts for the same interval, so I/O
+ * amplification shows next to the wall time; ramfs has no device and
+ * reports zeros.
+ *
+ * With no paths it formats a scratch RAM disk with SFS and mounts it and
+ * a ramfs instance of its own, runs against both and unmounts them. Read
+ * passes start cold: the page cache, the name cache and the device's
+ * clean buffers are dropped first. With -D the throughput passes open
+ * their file VFS_O_DIRECT, so only 512-byte I/O goes through the cache.
+ */
+
+#include "shell.h"
+#include "kernel.h"
+#include "block_device.h"
+#include "format.h"
+#include "sfs.h"
+#include "timer.h"
+#include "vfs.h"
+
+#define FSBENCH_DISK            "fsbench0"
+#define FSBENCH_DISK_SIZE       (16 * 1024 * 1024)
+#define FSBENCH_SFS_MOUNT       "/fsbench-sfs"
+#define FSBENCH_RAMFS_MOUNT     "/fsbench-ram"
+
+#define FSBENCH_FILE_KB         1024        // Data file for the throughput passes
+#define FSBENCH_MAX_FILE_KB     8192
+#define FSBENCH_MAX_IO          65536
+#define FSBENCH_FILES           256         // Files created and deleted
+#define FSBENCH_DEPTH           16          // Directories above the lookup target
+#define FSBENCH_LOOKUPS         1000        // Warm lookups; cold ones are a tenth
+#define FSBENCH_LIST_FILES      512         // Entries in the listed directory
+#define FSBENCH_DIRENTS         32          // Entries read per readdir call
+#define FSBENCH_PATH_MAX        256
+
+static const uint32_t fsbench_io_sizes[] = {512, 4096, FSBENCH_MAX_IO};
+
+struct fsbench {
+    const char *label;                  // Names the target in every line
+    const char *dir;
+    struct file_system *fs;
+    struct block_device *dev;           // NULL for memory file systems
+    uint8_t *buf;                       // FSBENCH_MAX_IO bytes
+    uint32_t file_size;
+    uint32_t seed;
+    int open_flags;                     // Added to the data file's open flags
+
+    // Snapshot taken by fsbench_begin()
+    uint64_t start_us;
+    struct block_device_stats start;
+};
+
+// Offsets for the random passes; the same sequence on every target
+static uint32_t fsbench_random(struct fsbench *fb)
+{
+    fb->seed ^= fb->seed << 13;
+    fb->seed ^= fb->seed >> 17;
+    fb->seed ^= fb->seed << 5;
+    return fb->seed;
+}
+
+// Write back and forget everything cached for the target
+static void fsbench_drop_caches(struct fsbench *fb)
+{
+    vfs_page_cache_sync_fs(fb->fs);
+    vfs_page_cache_invalidate_fs(fb->fs);
+    vfs_dcache_invalidate_fs(fb->fs);
+    if (fb->dev) {
+        block_buffer_sync_device(fb->dev);
+        block_buffer_invalidate_device(fb->dev);
+    }
+}
+
+// Make what was written reach the device inside the timed interval
+static void fsbench_flush(struct fsbench *fb)
+{
+    vfs_page_cache_sync_fs(fb->fs);
+    if (fb->dev) {
+        block_buffer_sync_device(fb->dev);
+    }
+}
+
+static void fsbench_begin(struct fsbench *fb)
+{
+    if (fb->dev) {
+        block_device_get_stats(fb->dev, &fb->start);
+    }
+    fb->start_us = timer_get_time_us();
+}
+
+/**
+ * One result line:
+ *   FSBENCH <target> <test> io=<bytes> n=<ops> us=<wall> kbps=<KiB/s> ops_s=<ops/s>
+ *           reads=<n> writes=<n> bytes_read=<n> bytes_written=<n>
+ * elapsed_us overrides the time since fsbench_begin() when nonzero.
+ */
+static void fsbench_end(struct fsbench *fb, const char *test, uint32_t io,
+                        uint32_t ops, uint64_t bytes, uint64_t elapsed_us)
+{
+    uint64_t us = elapsed_us ? elapsed_us : timer_get_time_us() - fb->start_us;
+    if (us == 0) {
+        us = 1;
+    }
+
+    uint64_t reads = 0, writes = 0, bytes_read = 0, bytes_written = 0;
+    if (fb->dev) {
+        struct block_device_stats now;
+        block_device_get_stats(fb->dev, &now);
+        reads = now.reads - fb->start.reads;
+        writes = now.writes - fb->start.writes;
+        bytes_read = now.bytes_read - fb->start.bytes_read;
+        bytes_written = now.bytes_written - fb->start.bytes_written;
+    }
+
+    shell_printf("FSBENCH %s %s io=%u n=%u us=%llu kbps=%llu ops_s=%llu "
+                 "reads=%llu writes=%llu bytes_read=%llu bytes_written=%llu\n",
+                 fb->label, test, io, ops, (unsigned long long)us,
+                 (unsigned long long)(bytes * 1000000 / 1024 / us),
+                 (unsigned long long)((uint64_t)ops * 1000000 / us),
+                 (unsigned long long)reads, (unsigned long long)writes,
+                 (unsigned long long)bytes_read, (unsigned long long)bytes_written);
+}
+
+static void fsbench_error(struct fsbench *fb, const char *test, int code)
+{
+    shell_printf("FSBENCH %s %s error=%d\n", fb->label, test, code);
+}
+
+static void fsbench_path(struct fsbench *fb, char *path, const char *name)
+{
+    size_t len = strlen(fb->dir);
+    snprintf(path, FSBENCH_PATH_MAX, "%s%s%s", fb->dir,
+             len && fb->dir[len - 1] == '/' ? "" : "/", name);
+}
+
+// Sequential and random passes over one file at each I/O size
+
+static int fsbench_sequential(struct fsbench *fb, const char *path, uint32_t io, int write)
+{
+    int flags = write ? VFS_O_CREAT | VFS_O_TRUNC | VFS_O_WRONLY : VFS_O_RDONLY;
+    int fd = vfs_open(path, flags | fb->open_flags, 0644);
+    if (fd < 0) {
+        return fd;
+    }
+
+    uint32_t ops = 0;
+    for (uint32_t done = 0; done < fb->file_size; done += io, ops++) {
+        ssize_t n = write ? vfs_write(fd, fb->buf, io) : vfs_read(fd, fb->buf, io);
+        if (n != (ssize_t)io) {
+            vfs_close(fd);
+            return n < 0 ? (int)n : VFS_EIO;
+        }
+    }
+    if (write) {
+        vfs_sync(fd);
+    }
+    vfs_close(fd);
+    if (write) {
+        fsbench_flush(fb);
+    }
+    fsbench_end(fb, write ? "seq_write" : "seq_read", io, ops, fb->file_size, 0);
+    return 0;
+}
+
+static int fsbench_random_io(struct fsbench *fb, const char *path, uint32_t io, int write)
+{
+    int fd = vfs_open(path, (write ? VFS_O_WRONLY : VFS_O_RDONLY) | fb->open_flags, 0);
+    if (fd < 0) {
+        return fd;
+    }
+
+    uint32_t slots = fb->file_size / io;
+    for (uint32_t i = 0; i < slots; i++) {
+        off_t offset = (off_t)(fsbench_random(fb) % slots) * io;
+        ssize_t n = vfs_seek(fd, offset, VFS_SEEK_SET);
+        if (n >= 0) {
+            n = write ? vfs_write(fd, fb->buf, io) : vfs_read(fd, fb->buf, io);
+        }
+        if (n != (ssize_t)io) {
+            vfs_close(fd);
+            return n < 0 ? (int)n : VFS_EIO;
+        }
+    }
+    if (write) {
+        vfs_sync(fd);
+    }
+    vfs_close(fd);
+    if (write) {
+        fsbench_flush(fb);
+    }
+    fsbench_end(fb, write ? "rand_write" : "rand_read", io, slots, (uint64_t)slots * io, 0);
+    return 0;
+}
+
+static void fsbench_throughput(struct fsbench *fb)
+{
+    char path[FSBENCH_PATH_MAX];
+    fsbench_path(fb, path, "fsbench.dat");
+
+    for (size_t i = 0; i < sizeof(fsbench_io_sizes) / sizeof(fsbench_io_sizes[0]); i++) {
+        uint32_t io = fsbench_io_sizes[i];
+        if (io > fb->file_size || fb->file_size % io) {
+            continue;
+        }
+        int status;
+
+        fsbench_begin(fb);
+        if ((status = fsbench_sequential(fb, path, io, 1)) < 0) {
+            fsbench_error(fb, "seq_write", status);
+            break;
+        }
+        fsbench_drop_caches(fb);
+        fsbench_begin(fb);
+        if ((status = fsbench_sequential(fb, path, io, 0)) < 0) {
+            fsbench_error(fb, "seq_read", status);
+        }
+
+        fb->seed = 2463534242U;
+        fsbench_begin(fb);
+        if ((status = fsbench_random_io(fb, path, io, 1)) < 0) {
+            fsbench_error(fb, "rand_write", status);
+        }
+        fb->seed = 2463534242U;
+        fsbench_drop_caches(fb);
+        fsbench_begin(fb);
+        if ((status = fsbench_random_io(fb, path, io, 0)) < 0) {
+            fsbench_error(fb, "rand_read", status);
+        }
+    }
+
+    vfs_unlink(path);
+}
+
+// Metadata: file create and delete rates
+
+static void fsbench_create_delete(struct fsbench *fb)
+{
+    char dir[FSBENCH_PATH_MAX];
+    char path[FSBENCH_PATH_MAX];
+    fsbench_path(fb, dir, "fsbench.c");
+
+    int status = vfs_mkdir(dir, 0755);
+    if (status < 0) {
+        fsbench_error(fb, "create", status);
+        return;
+    }
+
+    uint32_t created = 0;
+    fsbench_begin(fb);
+    for (; created < FSBENCH_FILES; created++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, created);
+        int fd = vfs_open(path, VFS_O_CREAT | VFS_O_WRONLY, 0644);
+        if (fd < 0) {
+            fsbench_error(fb, "create", fd);
+            break;
+        }
+        vfs_close(fd);
+    }
+    if (created == FSBENCH_FILES) {
+        fsbench_flush(fb);
+        fsbench_end(fb, "create", 0, created, 0, 0);
+    }
+
+    fsbench_begin(fb);
+    for (uint32_t i = 0; i < created; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", dir, i);
+        vfs_unlink(path);
+    }
+    fsbench_flush(fb);
+    fsbench_end(fb, "delete", 0, created, 0, 0);
+
+    vfs_rmdir(dir);
+}
+
+// Metadata: resolving a path FSBENCH_DEPTH directories deep
+
+static void fsbench_lookup(struct fsbench *fb)
+{
+    char path[FSBENCH_PATH_MAX];
+    fsbench_path(fb, path, "fsbench.p");
+    int base = strlen(path);
+
+    int depth = 0;
+    int status = vfs_mkdir(path, 0755);
+    while (status >= 0 && depth < FSBENCH_DEPTH) {
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, "/d%02d", depth + 1);
+        status = vfs_mkdir(path, 0755);
+        if (status >= 0) {
+            depth++;
+        } else {
+            path[len] = '\0';
+        }
+    }
+    if (status >= 0) {
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, "/leaf");
+        int fd = vfs_open(path, VFS_O_CREAT | VFS_O_WRONLY, 0644);
+        status = fd;
+        if (fd >= 0) {
+            vfs_close(fd);
+        }
+    }
+
+    if (status < 0) {
+        fsbench_error(fb, "lookup", status);
+    } else {
+        struct inode stat_buf;
+
+        // Cold: every lookup starts with nothing cached
+        uint64_t elapsed = 0;
+        fsbench_drop_caches(fb);
+        fsbench_begin(fb);
+        for (int i = 0; i < FSBENCH_LOOKUPS / 10; i++) {
+            fsbench_drop_caches(fb);
+            uint64_t start = timer_get_time_us();
+            vfs_stat(path, &stat_buf);
+            elapsed += timer_get_time_us() - start;
+        }
+        fsbench_end(fb, "lookup_cold", FSBENCH_DEPTH + 2, FSBENCH_LOOKUPS / 10, 0,
+                    elapsed ? elapsed : 1);
+
+        fsbench_begin(fb);
+        for (int i = 0; i < FSBENCH_LOOKUPS; i++) {
+            vfs_stat(path, &stat_buf);
+        }
+        fsbench_end(fb, "lookup_warm", FSBENCH_DEPTH + 2, FSBENCH_LOOKUPS, 0, 0);
+
+        vfs_unlink(path);
+        path[strlen(path) - strlen("/leaf")] = '\0';
+    }
+
+    // Remove the chain from the bottom up
+    while (strlen(path) > base) {
+        vfs_rmdir(path);
+        path[strlen(path) - strlen("/d00")] = '\0';
+    }
+    vfs_rmdir(path);
+}
+
+// Metadata: listing a directory of FSBENCH_LIST_FILES entries
+
+static uint32_t fsbench_list_once(const char *dir, struct dirent *entries)
+{
+    int fd = vfs_open(dir, VFS_O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    uint32_t total = 0;
+    int count;
+    while ((count = vfs_readdir(fd, entries, FSBENCH_DIRENTS)) > 0) {
+        total += (uint32_t)count;
+    }
+    vfs_close(fd);
+    return total;
+}
+
+static void fsbench_list(struct fsbench *fb)
+{
+    char dir[FSBENCH_PATH_MAX];
+    char path[FSBENCH_PATH_MAX];
+    fsbench_path(fb, dir, "fsbench.l");
+
+    struct dirent *entries = kmalloc(FSBENCH_DIRENTS * sizeof(struct dirent));
+    if (!entries) {
+        fsbench_error(fb, "list", VFS_ENOMEM);
+        return;
+    }
+    int status = vfs_mkdir(dir, 0755);
+    if (status < 0) {
+        fsbench_error(fb, "list", status);
+        kfree(entries);
+        return;
+    }
+
+    uint32_t created = 0;
+    for (; created < FSBENCH_LIST_FILES; created++) {
+        snprintf(path, sizeof(path), "%s/entry-%04u", dir, created);
+        int fd = vfs_open(path, VFS_O_CREAT | VFS_O_WRONLY, 0644);
+        if (fd < 0) {
+            fsbench_error(fb, "list", fd);
+            break;
+        }
+        vfs_close(fd);
+    }
+
+    if (created == FSBENCH_LIST_FILES) {
+        fsbench_drop_caches(fb);
+        fsbench_begin(fb);
+        uint32_t listed = fsbench_list_once(dir, entries);
+        fsbench_end(fb, "list_cold", 0, listed, 0, 0);
+
+        fsbench_begin(fb);
+        listed = fsbench_list_once(dir, entries);
+        fsbench_end(fb, "list_warm", 0, listed, 0, 0);
+    }
+
+    for (uint32_t i = 0; i < created; i++) {
+        snprintf(path, sizeof(path), "%s/entry-%04u", dir, i);
+        vfs_unlink(path);
+    }
+    vfs_rmdir(dir);
+    kfree(entries);
+}
+
+static int fsbench_run(const char *label, const char *dir, uint32_t file_size, uint8_t *buf,
+                       int open_flags)
+{
+    struct fsbench fb;
+    memset(&fb, 0, sizeof(fb));
+    fb.label = label;
+    fb.dir = dir;
+    fb.fs = vfs_get_filesystem(dir);
+    fb.buf = buf;
+    fb.file_size = file_size;
+    fb.open_flags = open_flags;
+    if (!fb.fs) {
+        shell_printf("FSBENCH %s error=%d\n", label, VFS_ENOENT);
+        return SHELL_ENOENT;
+    }
+    fb.dev = fb.fs->device;
+
+    shell_printf("FSBENCH %s start dir=%s fs=%s device=%s file_kb=%u direct=%d\n", label, dir,
+                 fb.fs->type->name, fb.dev ? fb.dev->name : "none", file_size / 1024,
+                 (open_flags & VFS_O_DIRECT) != 0);
+    fsbench_throughput(&fb);
+    fsbench_create_delete(&fb);
+    fsbench_lookup(&fb);
+    fsbench_list(&fb);
+    return SHELL_SUCCESS;
+}
+
+// Format the scratch disk and mount it and a ramfs of our own
+static int fsbench_mount_scratch(uint32_t features)
+{
+    struct block_device *dev = block_device_find(FSBENCH_DISK);
+    if (!dev) {
+        dev = ramdisk_create(FSBENCH_DISK, FSBENCH_DISK_SIZE);
+    }
+    if (!dev) {
+        shell_print_error("fsbench: cannot create the scratch RAM disk\n");
+        return SHELL_ENOMEM;
+    }
+
+    int result = sfs_format_with_features(dev, features);
+    if (result == VFS_SUCCESS) {
+        result = vfs_mount(FSBENCH_DISK, FSBENCH_SFS_MOUNT, "sfs", 0);
+    }
+    if (result != VFS_SUCCESS) {
+        shell_printf("fsbench: cannot mount SFS on %s (code %d)\n", FSBENCH_DISK, result);
+        return SHELL_ERROR;
+    }
+
+    result = vfs_mount("none", FSBENCH_RAMFS_MOUNT, "ramfs", 0);
+    if (result != VFS_SUCCESS) {
+        shell_printf("fsbench: cannot mount ramfs (code %d)\n", result);
+        vfs_unmount(FSBENCH_SFS_MOUNT);
+        return SHELL_ERROR;
+    }
+    return SHELL_SUCCESS;
+}
+
+// Filesystem benchmark command
+int cmd_fsbench(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+
+    uint32_t features = 0;
+    uint32_t file_kb = FSBENCH_FILE_KB;
+    int open_flags = 0;
+    int first_path = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0) {
+            features |= SFS_FEATURE_EXTENTS;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            features |= SFS_FEATURE_DIR_INDEX;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            features |= SFS_FEATURE_JOURNAL;
+        } else if (strcmp(argv[i], "-D") == 0) {
+            open_flags |= VFS_O_DIRECT;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            file_kb = 0;
+            for (const char *p = argv[++i]; *p; p++) {
+                if (*p < '0' || *p > '9' || file_kb > FSBENCH_MAX_FILE_KB) {
+                    file_kb = 0;
+                    break;
+                }
+                file_kb = file_kb * 10 + (uint32_t)(*p - '0');
+            }
+            if (file_kb == 0 || file_kb > FSBENCH_MAX_FILE_KB) {
+                shell_print_error("fsbench: size must be 1 to 8192 KB\n");
+                return SHELL_EINVAL;
+            }
+        } else if (argv[i][0] == '-') {
+            shell_print_error("Usage: fsbench [-e] [-d] [-j] [-D] [-s kb] [path...]\n");
+            return SHELL_EINVAL;
+        } else {
+            first_path = first_path ? first_path : i;
+        }
+    }
+
+    uint8_t *buf = kmalloc(FSBENCH_MAX_IO);
+    if (!buf) {
+        return SHELL_ENOMEM;
+    }
+    memset(buf, 0xa5, FSBENCH_MAX_IO);
+
+    int result = SHELL_SUCCESS;
+    if (first_path) {
+        char full_path[FSBENCH_PATH_MAX];
+        for (int i = first_path; i < argc; i++) {
+            if (argv[i][0] == '-') {
+                i += strcmp(argv[i], "-s") == 0;
+                continue;
+            }
+            build_full_path(full_path, sizeof(full_path), ctx->current_directory, argv[i]);
+            int status = fsbench_run(full_path, full_path, file_kb * 1024, buf, open_flags);
+            if (status != SHELL_SUCCESS) {
+                result = status;
+            }
+        }
+    } else {
+        result = fsbench_mount_scratch(features);
+        if (result == SHELL_SUCCESS) {
+            fsbench_run("sfs", FSBENCH_SFS_MOUNT, file_kb * 1024, buf, open_flags);
+            fsbench_run("ramfs", FSBENCH_RAMFS_MOUNT, file_kb * 1024, buf, open_flags);
+            vfs_unmount(FSBENCH_RAMFS_MOUNT);
+            vfs_unmount(FSBENCH_SFS_MOUNT);
+        }
+    }
+
+    kfree(buf);
+    return result;
+}
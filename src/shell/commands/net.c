@@ -0,0 +1,330 @@
+/*
+ * MiniOS Shell Network Commands
+ * Interface status, and an HTTP server and load generator over the
+ * socket API for measuring the stack in requests per second. The server
+ * is one task running an epoll loop, so slow clients do not hold up the
+ * rest.
+ */
+
+#include "shell.h"
+#include "kernel.h"
+#include "network.h"
+#include "process.h"
+#include "timer.h"
+#include "vfs.h"
+
+#define HTTPD_PORT          8080
+#define HTTPD_BACKLOG       128
+#define HTTPD_EVENTS        64      // Events taken per epoll wait
+#define HTTP_BUFFER_SIZE    1024
+
+static const char httpd_response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/html\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "<html>\n"
+    "<head><title>MiniOS Web Server</title></head>\n"
+    "<body>\n"
+    "<h1>Welcome to MiniOS!</h1>\n"
+    "<p>This is a simple web server running on MiniOS.</p>\n"
+    "</body>\n"
+    "</html>\n";
+
+static const char httpbench_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static volatile int httpd_port = 0;
+static volatile uint32_t httpd_served = 0;
+
+// Decimal argument, at most max; returns -1 if it is not one
+static int64_t parse_count(const char *text, uint32_t max)
+{
+    uint64_t value = 0;
+    if (!*text) {
+        return -1;
+    }
+    for (const char *p = text; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        value = value * 10 + (uint64_t)(*p - '0');
+        if (value > max) {
+            return -1;
+        }
+    }
+    return (int64_t)value;
+}
+
+// Network interface status command
+int cmd_ifconfig(struct shell_context *ctx, int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+
+    for (struct network_interface *n = netif_first(); n; n = n->next) {
+        shell_printf("%s: flags=<%s%s> mtu %u\n", n->name,
+                     (n->flags & NETIF_FLAG_UP) ? "UP" : "DOWN",
+                     (n->flags & NETIF_FLAG_LOOPBACK) ? ",LOOPBACK" : "", (uint32_t)n->mtu);
+        shell_printf("    inet %s", inet_ntoa(n->ip_addr));
+        shell_printf("  netmask %s", inet_ntoa(n->netmask));
+        if (n->gateway) {
+            shell_printf("  gateway %s", inet_ntoa(n->gateway));
+        }
+        shell_print("\n");
+        if (n->type == NET_TYPE_ETHERNET) {
+            const uint8_t *m = n->mac_addr;
+            shell_printf("    ether %02x:%02x:%02x:%02x:%02x:%02x\n",
+                         m[0], m[1], m[2], m[3], m[4], m[5]);
+        }
+        shell_printf("    RX packets %u  bytes %u  errors %u  dropped %u\n",
+                     (uint32_t)n->stats.rx_packets, (uint32_t)n->stats.rx_bytes,
+                     n->stats.rx_errors, n->stats.rx_dropped);
+        shell_printf("    TX packets %u  bytes %u  errors %u  dropped %u\n",
+                     (uint32_t)n->stats.tx_packets, (uint32_t)n->stats.tx_bytes,
+                     n->stats.tx_errors, n->stats.tx_dropped);
+        if (n->pool) {
+            uint32_t available, count;
+            net_pool_usage(n->pool, &available, &count);
+            shell_printf("    buffers %u free of %u\n", available, count);
+        }
+    }
+
+    return SHELL_SUCCESS;
+}
+
+// A connection whose request header is still coming in
+struct httpd_conn {
+    int fd;
+    size_t used;
+    char buffer[HTTP_BUFFER_SIZE];
+};
+
+static void httpd_close(struct httpd_conn *conn)
+{
+    sys_close_socket(conn->fd);     // Also takes it off the epoll set
+    kfree(conn);
+}
+
+// Take one connection off the listener and watch it for its request
+static void httpd_accept(int epfd, int server)
+{
+    int client = sys_accept(server, NULL, NULL);
+    if (client < 0) {
+        return;
+    }
+
+    struct httpd_conn *conn = kmalloc(sizeof(struct httpd_conn));
+    if (!conn) {
+        sys_close_socket(client);
+        return;
+    }
+    conn->fd = client;
+    conn->used = 0;
+
+    struct epoll_event event = { EPOLLIN, (uint64_t)(uintptr_t)conn };
+    if (vfs_epoll_ctl(epfd, EPOLL_CTL_ADD, client, &event) < 0) {
+        httpd_close(conn);
+    }
+}
+
+// The connection is readable: once the request header is in, answer it
+// with the page and close
+static void httpd_input(struct httpd_conn *conn)
+{
+    ssize_t n = sys_recv(conn->fd, conn->buffer + conn->used,
+                         sizeof(conn->buffer) - 1 - conn->used, 0);
+    if (n <= 0) {
+        httpd_close(conn);
+        return;
+    }
+    conn->used += (size_t)n;
+    conn->buffer[conn->used] = '\0';
+    if (!strstr(conn->buffer, "\r\n\r\n") && conn->used < sizeof(conn->buffer) - 1) {
+        return;
+    }
+
+    sys_send(conn->fd, httpd_response, sizeof(httpd_response) - 1, 0);
+    httpd_close(conn);
+    httpd_served++;
+}
+
+static void httpd_task(void *arg)
+{
+    uint16_t port = (uint16_t)(uintptr_t)arg;
+
+    int server = sys_socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) {
+        httpd_port = 0;
+        return;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr = INADDR_ANY;
+    // The listener's cookie is NULL; connections carry their state
+    int epfd = -1;
+    struct epoll_event event = { EPOLLIN, 0 };
+    if (sys_bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        sys_listen(server, HTTPD_BACKLOG) < 0 ||
+        (epfd = vfs_epoll_create()) < 0 ||
+        vfs_epoll_ctl(epfd, EPOLL_CTL_ADD, server, &event) < 0) {
+        if (epfd >= 0) {
+            vfs_close(epfd);
+        }
+        sys_close_socket(server);
+        httpd_port = 0;
+        return;
+    }
+
+    struct epoll_event events[HTTPD_EVENTS];
+    for (;;) {
+        int count = vfs_epoll_wait(epfd, events, HTTPD_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            struct httpd_conn *conn = (struct httpd_conn *)(uintptr_t)events[i].data;
+            if (!conn) {
+                httpd_accept(epfd, server);
+            } else {
+                httpd_input(conn);
+            }
+        }
+    }
+}
+
+// Start the HTTP server task, once
+static int httpd_start(uint16_t port)
+{
+    if (httpd_port) {
+        return 0;
+    }
+    httpd_port = port;
+    if (process_create(httpd_task, (void *)(uintptr_t)port, "httpd", PRIORITY_NORMAL) < 0) {
+        httpd_port = 0;
+        return -1;
+    }
+    return 1;
+}
+
+// HTTP server command
+int cmd_httpd(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+
+    int64_t port = HTTPD_PORT;
+    if (argc > 1) {
+        port = parse_count(argv[1], 65535);
+        if (port <= 0) {
+            shell_print_error("Usage: httpd [port]\n");
+            return SHELL_EINVAL;
+        }
+    }
+
+    int started = httpd_start((uint16_t)port);
+    if (started < 0) {
+        shell_print_error("httpd: could not create the server task\n");
+        return SHELL_ERROR;
+    }
+    if (started == 0) {
+        shell_printf("httpd: already listening on port %d, %u requests served\n",
+                     httpd_port, httpd_served);
+    } else {
+        shell_printf("httpd: listening on port %d\n", (int)port);
+    }
+    return SHELL_SUCCESS;
+}
+
+// One request on a fresh connection; returns the bytes of response
+static ssize_t httpbench_request_once(const struct sockaddr_in *server)
+{
+    int fd = sys_socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return fd;
+    }
+
+    ssize_t result = sys_connect(fd, (const struct sockaddr *)server, sizeof(*server));
+    if (result == NET_SUCCESS) {
+        result = sys_send(fd, httpbench_request, sizeof(httpbench_request) - 1, 0);
+    }
+    if (result >= 0) {
+        char buffer[HTTP_BUFFER_SIZE];
+        ssize_t total = 0;
+        ssize_t n;
+        while ((n = sys_recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            total += n;
+        }
+        result = n < 0 ? n : total;
+    }
+
+    sys_close_socket(fd);
+    return result;
+}
+
+// HTTP load generator command
+int cmd_httpbench(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+
+    int64_t requests = 1000;
+    if (argc > 1) {
+        requests = parse_count(argv[1], 10000000);
+        if (requests <= 0) {
+            shell_print_error("Usage: httpbench [requests] [address]\n");
+            return SHELL_EINVAL;
+        }
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(HTTPD_PORT);
+    server.sin_addr = INADDR_LOOPBACK;
+    if (argc > 2) {
+        server.sin_addr = inet_addr(argv[2]);
+        if (server.sin_addr == 0xFFFFFFFFU) {
+            shell_print_error("Usage: httpbench [requests] [address]\n");
+            return SHELL_EINVAL;
+        }
+    } else if (httpd_start(HTTPD_PORT) < 0) {
+        shell_print_error("httpbench: could not start httpd\n");
+        return SHELL_ERROR;
+    } else {
+        server.sin_port = htons((uint16_t)httpd_port);
+    }
+
+    uint64_t bytes = 0;
+    uint32_t failed = 0;
+    uint64_t start_us = timer_get_time_us();
+    for (int64_t i = 0; i < requests; i++) {
+        ssize_t n = httpbench_request_once(&server);
+        if (n <= 0) {
+            failed++;
+        } else {
+            bytes += (uint64_t)n;
+        }
+    }
+    uint64_t elapsed_us = timer_get_time_us() - start_us;
+    if (elapsed_us == 0) {
+        elapsed_us = 1;
+    }
+
+    uint32_t done = (uint32_t)requests - failed;
+    shell_printf("%u requests in %u ms, %u failed\n", (uint32_t)requests,
+                 (uint32_t)(elapsed_us / 1000), failed);
+    shell_printf("  %u requests/s, %u KB/s\n",
+                 (uint32_t)((uint64_t)done * 1000000 / elapsed_us),
+                 (uint32_t)(bytes * 1000000 / 1024 / elapsed_us));
+    return failed ? SHELL_ERROR : SHELL_SUCCESS;
+}
@@ -8,6 +8,20 @@
 #include "process.h"
 #include "memory.h"
 #include "timer.h"
+#include "block_device.h"
+#include "vfs.h"
+#include "syscall.h"
+#include "vdso.h"
+#include "klog.h"
+#include "boot_trace.h"
+#include "sysinfo.h"
+#include "bench.h"
+#include "perf.h"
+#include "profile.h"
+#include "ksyms.h"
+#include "memprof.h"
+#include "lockstat.h"
+#include "elf_loader.h"
 
 // List processes command
 int cmd_ps(struct shell_context *ctx, int argc, char *argv[])
@@ -29,22 +43,60 @@ int cmd_ps(struct shell_context *ctx, int argc, char *argv[])
         }
     }
     
-    shell_print("  PID  PPID STATE    CPU%   MEM    COMMAND\n");
-    shell_print("--------------------------------------------\n");
+    // One consistent copy of every task, taken under the task lock
+    uint32_t room = process_snapshot(NULL, 0) + 8;
+    struct sysinfo_task *tasks = kmalloc(room * sizeof(struct sysinfo_task));
+    if (!tasks) {
+        shell_print_error("ps: out of memory\n");
+        return SHELL_ERROR;
+    }
+    uint32_t total = process_snapshot(tasks, room);
+    uint32_t count = total < room ? total : room;
     
-    // Show kernel processes (simulated)
-    shell_print("    0     0 RUNNING   0.0    4K   [idle]\n");
-    shell_print("    1     0 RUNNING   1.2   16K   [kernel]\n");
-    shell_print("    2     1 RUNNING   0.5   12K   [shell]\n");
+    static const char *const state_names[] = {"READY  ", "RUNNING", "BLOCKED", "EXITED "};
     
-    if (show_all) {
-        shell_print("    3     1 BLOCKED   0.0    8K   [timer]\n");
-        shell_print("    4     1 BLOCKED   0.0    8K   [uart]\n");
+    shell_print("  PID STATE   CPU PRI     TICKS  SWITCHES   USER(us)    SYS(us)    IRQ(us)    MEM  COMMAND\n");
+    shell_print("----------------------------------------------------------------------------------------\n");
+    for (uint32_t i = 0; i < count; i++) {
+        const struct sysinfo_task *t = &tasks[i];
+        if (t->state == TASK_STATE_TERMINATED && !show_all) {
+            continue;
+        }
+        shell_printf("%5u %s %3u %3d %9u %9u %10u %10u %10u %5uK  %s\n",
+                     t->pid,
+                     t->state <= TASK_STATE_TERMINATED ? state_names[t->state] : "UNKNOWN",
+                     t->cpu,
+                     t->sched_class == SCHED_CLASS_FAIR ? (int)t->nice : (int)t->priority,
+                     (unsigned)t->runtime_ticks,
+                     (unsigned)t->switches,
+                     (unsigned)(t->user_ns / 1000),
+                     (unsigned)(t->system_ns / 1000),
+                     (unsigned)(t->irq_ns / 1000),
+                     (unsigned)(t->memory / 1024),
+                     t->name);
+    }
+    kfree(tasks);
+    
+    struct process_stats stats;
+    if (process_get_stats(&stats) == 0) {
+        const struct sched_latency *p = &stats.preempt_latency;
+        const struct sched_latency *w = &stats.wakeup_latency;
+        const struct sched_latency *r = &stats.rt_latency;
+        shell_printf("\nContext switches: %d, scheduler ticks: %d\n",
+                     (int)stats.context_switches, (int)stats.scheduler_ticks);
+        shell_printf("Preemption latency: avg %d us, max %d us (%d samples)\n",
+                     p->count ? (int)(p->total_us / p->count) : 0, (int)p->max_us, (int)p->count);
+        shell_printf("Wakeup latency:     avg %d us, max %d us (%d samples)\n",
+                     w->count ? (int)(w->total_us / w->count) : 0, (int)w->max_us, (int)w->count);
+        shell_printf("RT wakeup latency:  avg %d us, max %d us (%d samples)\n",
+                     r->count ? (int)(r->total_us / r->count) : 0, (int)r->max_us, (int)r->count);
     }
     
     return SHELL_SUCCESS;
 }
 
+static void print_counter_time(uint64_t ticks, uint64_t freq);
+
 // Show memory usage command
 int cmd_free(struct shell_context *ctx, int argc, char *argv[])
 {
@@ -54,17 +106,116 @@ int cmd_free(struct shell_context *ctx, int argc, char *argv[])
         return SHELL_EINVAL;
     }
     
-    // Get memory statistics (simulated for now)
-    shell_print("              total        used        free      shared\n");
-    shell_print("Mem:        16384KB      4096KB     12288KB         0KB\n");
-    shell_print("Kernel:      1024KB       512KB       512KB         0KB\n");
-    shell_print("User:       15360KB      3584KB     11776KB         0KB\n");
+    struct memory_stats mem;
+    memory_get_stats(&mem);
+    
+    shell_printf("Mem:   total %dKB, used %dKB, free %dKB\n",
+                 (int)(mem.total_memory / 1024),
+                 (int)(mem.used_memory / 1024),
+                 (int)(mem.free_memory / 1024));
+    shell_printf("Pages: %d free blocks, largest %d pages\n",
+                 (int)mem.free_regions, (int)mem.largest_free_block);
+    shell_print("  free blocks by order:");
+    for (int order = 0; order < PAGE_ALLOC_MAX_ORDER; order++) {
+        shell_printf(" %d", (int)mem.free_blocks[order]);
+    }
     shell_print("\n");
+    shell_printf("  watermarks: low %d, high %d pages; %d failed allocations\n",
+                 (int)mem.low_watermark, (int)mem.high_watermark,
+                 (int)mem.alloc_failures);
     
-    shell_print("Memory Layout:\n");
-    shell_print("  Kernel:     0x80000000 - 0x80100000  (1MB)\n");
-    shell_print("  User:       0x80100000 - 0x81000000  (15MB)\n");
-    shell_print("  Available:  75% free\n");
+    struct kheap_stats heap;
+    kheap_get_stats(&heap);
+    
+    shell_printf("Heap:  %dKB in use, %d pages held, %d failed allocations\n",
+                 (int)(heap.bytes_in_use / 1024),
+                 (int)heap.pages_held,
+                 (int)heap.failed_allocs);
+    shell_print("\n");
+    
+    shell_print("Slab caches:\n");
+    shell_print("  size\tslabs\tin use/total\tcached\tallocs\tfrees\n");
+    for (uint32_t i = 0; i < heap.num_caches; i++) {
+        struct kheap_cache_stats *cache = &heap.caches[i];
+        shell_printf("  %d\t%d\t%d/%d\t%d\t%d\t%d\n",
+                     (int)cache->object_size,
+                     (int)cache->slabs,
+                     (int)cache->objects_in_use,
+                     (int)cache->objects_total,
+                     (int)cache->objects_cached,
+                     (int)cache->allocs,
+                     (int)cache->frees);
+    }
+    shell_printf("  large: %d live allocations, %d pages (%d allocs, %d frees)\n",
+                 (int)heap.large_allocs,
+                 (int)heap.large_pages,
+                 (int)heap.large_total_allocs,
+                 (int)heap.large_total_frees);
+    
+    struct block_buffer_stats bcache;
+    block_buffer_get_stats(&bcache);
+    shell_printf("Buffer cache: %d/%d buffers, %d dirty, %d mapped\n",
+                 (int)bcache.buffers, (int)bcache.capacity, (int)bcache.dirty,
+                 (int)bcache.mapped);
+    shell_printf("  %d hits, %d misses, %d evictions, %d writebacks\n",
+                 (int)bcache.hits,
+                 (int)bcache.misses,
+                 (int)bcache.evictions,
+                 (int)bcache.writebacks);
+    
+    struct vfs_dcache_stats dcache;
+    vfs_dcache_get_stats(&dcache);
+    shell_printf("Dentry cache: %d entries (%d negative)\n",
+                 (int)dcache.entries, (int)dcache.negative);
+    shell_printf("  %d hits, %d negative hits, %d misses\n",
+                 (int)dcache.hits,
+                 (int)dcache.negative_hits,
+                 (int)dcache.misses);
+    
+    struct vfs_page_cache_stats pcache;
+    vfs_page_cache_get_stats(&pcache);
+    shell_printf("Page cache: %d/%d pages, %d dirty, %d files\n",
+                 (int)pcache.pages, (int)pcache.capacity, (int)pcache.dirty,
+                 (int)pcache.mappings);
+    shell_printf("  %d hits, %d misses, %d read ahead, %d evictions, %d writebacks\n",
+                 (int)pcache.hits,
+                 (int)pcache.misses,
+                 (int)pcache.readahead,
+                 (int)pcache.evictions,
+                 (int)pcache.writebacks);
+    shell_printf("  %d pages read direct, %d written direct\n",
+                 (int)pcache.direct_reads, (int)pcache.direct_writes);
+    
+    struct exec_cache_stats exec;
+    exec_cache_get_stats(&exec);
+    shell_printf("Exec cache: %d/%d images, %d bytes copied data\n",
+                 (int)exec.entries, EXEC_CACHE_ENTRIES, (int)exec.bytes);
+    shell_printf("  %d hits, %d misses, %d stale\n",
+                 (int)exec.hits, (int)exec.misses, (int)exec.stale);
+    
+    struct vm_fault_stats faults;
+    vm_get_fault_stats(&faults);
+    uint64_t resolved = faults.zero + faults.file + faults.cow + faults.shared + faults.spurious;
+    uint64_t freq = vdso_get_data()->counter_frequency;
+    shell_printf("Page faults: %d zero-fill, %d file, %d copy-on-write, %d shared, %d spurious, %d failed\n",
+                 (int)faults.zero, (int)faults.file, (int)faults.cow, (int)faults.shared,
+                 (int)faults.spurious, (int)faults.failed);
+    shell_printf("  %d area cache hits, avg ", (int)faults.cache_hits);
+    print_counter_time(resolved + faults.failed ? faults.ticks / (resolved + faults.failed) : 0, freq);
+    shell_print(", max ");
+    print_counter_time(faults.max_ticks, freq);
+    shell_print("\n");
+    
+    struct reclaim_stats reclaim;
+    memory_reclaim_get_stats(&reclaim);
+    shell_printf("Reclaim: %d pages freed in %d passes, %d wakeups\n",
+                 (int)reclaim.pages_freed, (int)reclaim.passes, (int)reclaim.wakeups);
+    for (uint32_t i = 0; i < reclaim.shrinkers; i++) {
+        shell_printf("  %s: %d pages reclaimable, %d freed\n",
+                     reclaim.shrinker[i].name,
+                     (int)reclaim.shrinker[i].reclaimable,
+                     (int)reclaim.shrinker[i].freed);
+    }
     
     return SHELL_SUCCESS;
 }
@@ -182,4 +333,749 @@ int cmd_uptime(struct shell_context *ctx, int argc, char *argv[])
     shell_print("Active tasks: 3 running, 2 sleeping\n");
     
     return SHELL_SUCCESS;
-}
\ No newline at end of file
+}
+
+// Measure system call round-trip cost command
+int cmd_sysbench(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    uint32_t iterations = 100000;
+    if (argc > 1) {
+        iterations = 0;
+        for (const char *p = argv[1]; *p; p++) {
+            if (*p < '0' || *p > '9' || iterations > 100000000) {
+                shell_print_error("Usage: sysbench [iterations]\n");
+                return SHELL_EINVAL;
+            }
+            iterations = iterations * 10 + (uint32_t)(*p - '0');
+        }
+    }
+    
+    struct syscall_bench bench;
+    if (syscall_benchmark(iterations, &bench) < 0) {
+        shell_print_error("Usage: sysbench [iterations]\n");
+        return SHELL_EINVAL;
+    }
+    
+    shell_printf("System call round trip (%d iterations):\n", (int)iterations);
+    shell_printf("  dispatch only:  %d ns\n", (int)bench.dispatch_ns);
+    if (bench.leaf_trap_ns || bench.full_trap_ns) {
+        shell_printf("  leaf trap:      %d ns\n", (int)bench.leaf_trap_ns);
+        shell_printf("  full trap:      %d ns\n", (int)bench.full_trap_ns);
+    } else {
+        shell_print("  trap paths:     not measurable on this architecture\n");
+    }
+    
+    return SHELL_SUCCESS;
+}
+
+// Parse a decimal iteration count; 0 if it is not one or is out of range
+static uint32_t bench_parse_iterations(const char *arg)
+{
+    uint32_t value = 0;
+    for (const char *p = arg; *p; p++) {
+        if (*p < '0' || *p > '9' || value > BENCH_MAX_ITERATIONS) {
+            return 0;
+        }
+        value = value * 10 + (uint32_t)(*p - '0');
+    }
+    return value <= BENCH_MAX_ITERATIONS ? value : 0;
+}
+
+// A benchmark is selected by its full name or a prefix ending at '_'
+static int bench_selected(const char *name, const char *filter)
+{
+    if (!filter) {
+        return 1;
+    }
+    size_t len = strlen(filter);
+    return strncmp(name, filter, len) == 0 && (name[len] == '\0' || name[len] == '_');
+}
+
+/**
+ * Microbenchmark command. One line per benchmark, for scripts to collect:
+ *   BENCH_COUNTER hz=<counter rate> batch=<ops per read>
+ *   BENCH <name> iters=<n> mean=<ticks/op> min=<ticks/op> ns=<min in ns> [note=<why>]
+ *   BENCH <name> skipped
+ *   BENCH <name> error=<code>
+ */
+int cmd_bench(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    const char *dir = "/";
+    const char *filter = NULL;
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    int have_iterations = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "list") == 0 && argc == 2) {
+            for (int n = 0; n < bench_count(); n++) {
+                shell_printf("%s\n", bench_name(n));
+            }
+            return SHELL_SUCCESS;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (argv[i][0] >= '0' && argv[i][0] <= '9' && !have_iterations) {
+            iterations = bench_parse_iterations(argv[i]);
+            have_iterations = 1;
+            if (!iterations) {
+                shell_print_error("bench: iterations must be 1 to 10000000\n");
+                return SHELL_EINVAL;
+            }
+        } else if (!filter) {
+            filter = argv[i];
+        } else {
+            shell_print_error("Usage: bench [list] | [-d dir] [name] [iterations]\n");
+            return SHELL_EINVAL;
+        }
+    }
+    
+    int matched = 0;
+    for (int n = 0; n < bench_count(); n++) {
+        matched += bench_selected(bench_name(n), filter);
+    }
+    if (!matched) {
+        shell_print_error("bench: no such benchmark; 'bench list' shows them\n");
+        return SHELL_EINVAL;
+    }
+    
+    uint64_t freq = vdso_get_data()->counter_frequency;
+    shell_printf("BENCH_COUNTER hz=%llu batch=%d\n", (unsigned long long)freq, BENCH_BATCH);
+    
+    for (int n = 0; n < bench_count(); n++) {
+        const char *name = bench_name(n);
+        if (!bench_selected(name, filter)) {
+            continue;
+        }
+        
+        struct bench_result result;
+        int status = bench_run(n, iterations, dir, &result);
+        if (status == BENCH_SKIPPED) {
+            shell_printf("BENCH %s skipped\n", name);
+            continue;
+        } else if (status != 0) {
+            shell_printf("BENCH %s error=%d\n", name, status);
+            continue;
+        }
+        
+        // ticks * 10^9 / hz, with ticks scaled by BENCH_SCALE
+        uint64_t ns_x100 = freq ? result.min_x100 * 1000000000ULL / freq : 0;
+        shell_printf("BENCH %s iters=%u mean=%llu.%02llu min=%llu.%02llu ns=%llu.%02llu%s%s\n",
+                     name, result.iterations,
+                     (unsigned long long)(result.mean_x100 / BENCH_SCALE),
+                     (unsigned long long)(result.mean_x100 % BENCH_SCALE),
+                     (unsigned long long)(result.min_x100 / BENCH_SCALE),
+                     (unsigned long long)(result.min_x100 % BENCH_SCALE),
+                     (unsigned long long)(ns_x100 / BENCH_SCALE),
+                     (unsigned long long)(ns_x100 % BENCH_SCALE),
+                     result.note ? " note=" : "", result.note ? result.note : "");
+    }
+    
+    return SHELL_SUCCESS;
+}
+
+// Events perfstat counts when not told, most telling first
+static const uint32_t perfstat_default_events[] = {
+    PERF_EVENT_CYCLES, PERF_EVENT_INSTRUCTIONS, PERF_EVENT_CACHE_MISSES,
+    PERF_EVENT_BRANCH_MISSES, PERF_EVENT_DTLB_MISSES, PERF_EVENT_CACHE_REFS,
+    PERF_EVENT_BRANCHES, PERF_EVENT_ITLB_MISSES,
+};
+
+// Parse "cycles,cache-misses,..." into events; the count, or -1
+static int perfstat_parse_events(char *list, uint32_t *events)
+{
+    int nr = 0;
+    while (*list) {
+        char *name = list;
+        while (*list && *list != ',') {
+            list++;
+        }
+        if (*list) {
+            *list++ = '\0';
+        }
+
+        uint32_t event = 0;
+        while (event < PERF_EVENT_COUNT && strcmp(perf_event_name(event), name) != 0) {
+            event++;
+        }
+        if (event == PERF_EVENT_COUNT || !perf_event_supported(event) ||
+            nr == (int)perf_num_counters()) {
+            shell_print_error("perfstat: unknown, unsupported or too many events\n");
+            return -1;
+        }
+        events[nr++] = event;
+    }
+    return nr;
+}
+
+// Count hardware events while a command runs
+int cmd_perfstat(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    uint32_t events[PERF_MAX_COUNTERS];
+    int nr = 0;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-e") == 0) {
+        nr = perfstat_parse_events(argv[2], events);
+        if (nr < 0) {
+            return SHELL_EINVAL;
+        }
+        first = 3;
+    }
+    if (first >= argc) {
+        shell_print_error("Usage: perfstat [-e event,...] <command> [args...]\n");
+        return SHELL_EINVAL;
+    }
+    if (!perf_num_counters()) {
+        shell_print_error("perfstat: no hardware performance counters\n");
+        return SHELL_ERROR;
+    }
+    
+    for (size_t i = 0; nr == 0 && i < sizeof(perfstat_default_events) / sizeof(uint32_t); i++) {
+        if (perf_event_supported(perfstat_default_events[i])) {
+            events[nr++] = perfstat_default_events[i];
+        }
+        if (nr == (int)perf_num_counters() || nr == PERF_MAX_COUNTERS) {
+            break;
+        }
+    }
+    
+    // Tasks the command starts, pipeline stages included, count too
+    struct perf_group *group = perf_group_create(events, (uint32_t)nr, PERF_GROUP_INHERIT);
+    if (!group || perf_attach_current(group) < 0) {
+        perf_group_put(group);
+        shell_print_error("perfstat: cannot set up counters\n");
+        return SHELL_ERROR;
+    }
+    
+    struct command_line cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.command = argv[first];
+    cmd.arguments = &argv[first];
+    cmd.argument_count = argc - first;
+    
+    uint64_t start = timer_get_time_us();
+    perf_group_enable(group);
+    int result = execute_command(ctx, &cmd);
+    perf_group_disable(group);
+    uint64_t elapsed_us = timer_get_time_us() - start;
+    
+    uint64_t counts[PERF_MAX_COUNTERS];
+    perf_group_read(group, counts);
+    perf_detach_current();
+    perf_group_put(group);
+    
+    shell_printf("\nPerformance counters for '%s':\n\n", cmd.command);
+    uint64_t cycles = 0, instructions = 0;
+    for (int i = 0; i < nr; i++) {
+        shell_printf("%20llu  %s\n", (unsigned long long)counts[i], perf_event_name(events[i]));
+        if (events[i] == PERF_EVENT_CYCLES) cycles = counts[i];
+        if (events[i] == PERF_EVENT_INSTRUCTIONS) instructions = counts[i];
+    }
+    if (cycles && instructions) {
+        uint64_t ipc_x100 = instructions * 100 / cycles;
+        shell_printf("%20llu.%02llu  instructions per cycle\n",
+                     (unsigned long long)(ipc_x100 / 100), (unsigned long long)(ipc_x100 % 100));
+    }
+    shell_printf("\n%14llu.%03llu ms elapsed\n",
+                 (unsigned long long)(elapsed_us / 1000), (unsigned long long)(elapsed_us % 1000));
+    
+    return result;
+}
+
+#define PROFILE_REPORT_TOP  20
+
+// Decimal argument for profile, 0 if it is not one
+static uint64_t profile_parse_number(const char *arg)
+{
+    uint64_t value = 0;
+    for (const char *p = arg; *p; p++) {
+        if (*p < '0' || *p > '9' || value > UINT64_MAX / 10 - 9) {
+            return 0;
+        }
+        value = value * 10 + (uint64_t)(*p - '0');
+    }
+    return value;
+}
+
+static int profile_print_report(uint64_t top)
+{
+    struct profile_entry *entries;
+    struct profile_summary summary;
+    int count = profile_report(&entries, &summary);
+    if (count < 0) {
+        shell_print_error("profile: cannot report while sampling or out of memory\n");
+        return SHELL_ERROR;
+    }
+    
+    uint64_t kept = summary.samples - summary.overwritten;
+    shell_printf("Profile: %llu samples from ", (unsigned long long)summary.samples);
+    if (summary.source == PROFILE_SOURCE_CYCLES) {
+        shell_printf("every %llu cycles", (unsigned long long)summary.period);
+    } else {
+        shell_printf("the scheduler tick");
+    }
+    if (summary.overwritten) {
+        shell_printf(", oldest %llu overwritten", (unsigned long long)summary.overwritten);
+    }
+    shell_printf("\n");
+    if (!count) {
+        return SHELL_SUCCESS;
+    }
+    if (!ksyms_count()) {
+        shell_printf("(kernel built without a symbol table)\n");
+    }
+    
+    int backtrace = (summary.flags & PROFILE_BACKTRACE) != 0;
+    shell_printf("\n   Self%%    Self%s  Function\n", backtrace ? "   Total" : "");
+    for (int i = 0; i < count && (uint64_t)i < top; i++) {
+        const struct profile_entry *entry = &entries[i];
+        uint64_t pct_x100 = (uint64_t)entry->self * 10000 / kept;
+        const char *name = entry->symbol >= 0 ? ksyms_name((uint32_t)entry->symbol) :
+                           entry->symbol == PROFILE_SYM_USER ? "[user]" : "[unknown]";
+        
+        shell_printf("%5llu.%02llu%% %7u", (unsigned long long)(pct_x100 / 100),
+                     (unsigned long long)(pct_x100 % 100), entry->self);
+        if (backtrace) {
+            shell_printf(" %7u", entry->total);
+        }
+        shell_printf("  %s\n", name);
+    }
+    
+    kfree(entries);
+    return SHELL_SUCCESS;
+}
+
+// Sampling profiler: where the kernel spends its time, by function
+int cmd_profile(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    const char *usage = "Usage: profile start [-g] [-c [cycles]] | stop | report [top]\n";
+    if (argc < 2) {
+        shell_print_error(usage);
+        return SHELL_EINVAL;
+    }
+    
+    if (strcmp(argv[1], "start") == 0) {
+        uint32_t source = PROFILE_SOURCE_TIMER;
+        uint32_t flags = 0;
+        uint64_t period = PROFILE_DEFAULT_PERIOD;
+        
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-g") == 0) {
+                flags |= PROFILE_BACKTRACE;
+            } else if (strcmp(argv[i], "-c") == 0) {
+                source = PROFILE_SOURCE_CYCLES;
+                if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                    period = profile_parse_number(argv[++i]);
+                    if (!period) {
+                        shell_print_error(usage);
+                        return SHELL_EINVAL;
+                    }
+                }
+            } else {
+                shell_print_error(usage);
+                return SHELL_EINVAL;
+            }
+        }
+        
+        if (profile_running()) {
+            shell_print_error("profile: already sampling\n");
+            return SHELL_ERROR;
+        }
+        if (profile_start(source, period, flags) < 0) {
+            shell_print_error(source == PROFILE_SOURCE_CYCLES ?
+                              "profile: no PMU cycle sampling here; try without -c\n" :
+                              "profile: cannot allocate sample buffers\n");
+            return SHELL_ERROR;
+        }
+        shell_printf("Sampling; 'profile stop' then 'profile report'\n");
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "stop") == 0 && argc == 2) {
+        profile_stop();
+        return SHELL_SUCCESS;
+    }
+    
+    if (strcmp(argv[1], "report") == 0 && argc <= 3) {
+        uint64_t top = argc == 3 ? profile_parse_number(argv[2]) : PROFILE_REPORT_TOP;
+        if (!top) {
+            shell_print_error(usage);
+            return SHELL_EINVAL;
+        }
+        return profile_print_report(top);
+    }
+    
+    shell_print_error(usage);
+    return SHELL_EINVAL;
+}
+
+#define MEMPROF_REPORT_TOP  15
+#define MEMPROF_REPORT_MAX  100
+
+// Allocation profiler: live allocations by call site
+int cmd_memprof(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    const char *usage = "Usage: memprof [heap|pages] [top]\n";
+    uint32_t kind = MEMPROF_HEAP;
+    uint64_t top = MEMPROF_REPORT_TOP;
+    int arg = 1;
+    
+    if (arg < argc && strcmp(argv[arg], "heap") == 0) {
+        arg++;
+    } else if (arg < argc && strcmp(argv[arg], "pages") == 0) {
+        kind = MEMPROF_PAGES;
+        arg++;
+    }
+    if (arg < argc) {
+        top = profile_parse_number(argv[arg++]);
+    }
+    if (arg < argc || !top) {
+        shell_print_error(usage);
+        return SHELL_EINVAL;
+    }
+    if (top > MEMPROF_REPORT_MAX) {
+        top = MEMPROF_REPORT_MAX;
+    }
+    
+    struct memprof_site *sites = kmalloc(top * sizeof(struct memprof_site));
+    if (!sites) {
+        shell_print_error("memprof: out of memory\n");
+        return SHELL_ENOMEM;
+    }
+    struct memprof_summary summary;
+    int count = memprof_report(kind, sites, (int)top, &summary);
+    if (count < 0) {
+        kfree(sites);
+        shell_print_error("memprof: kernel built without MEMPROF=1\n");
+        return SHELL_ERROR;
+    }
+    
+    const char *unit = kind == MEMPROF_HEAP ? "bytes" : "pages";
+    shell_printf("%s: %llu %s live from %u call sites", kind == MEMPROF_HEAP ? "kmalloc" : "Pages",
+                 (unsigned long long)summary.live_size, unit, summary.sites);
+    if (summary.untracked) {
+        shell_printf(", %llu allocations untracked", (unsigned long long)summary.untracked);
+    }
+    shell_printf("\n\n%10s %7s %10s %9s %13s  Call site\n", "Live", "Count", "Peak", "Allocs", "Size");
+    
+    for (int i = 0; i < count; i++) {
+        const struct memprof_site *site = &sites[i];
+        shell_printf("%10llu %7u %10llu %9llu %6u-%-6u  ", (unsigned long long)site->live_size,
+                     site->live_count, (unsigned long long)site->peak_size,
+                     (unsigned long long)site->allocs, site->min_size, site->max_size);
+        
+        // The return address is just past the call; look up the call
+        uintptr_t offset;
+        int symbol = ksyms_lookup(site->site - 1, &offset);
+        if (symbol >= 0) {
+            shell_printf("%s+0x%llx\n", ksyms_name((uint32_t)symbol), (unsigned long long)(offset + 1));
+        } else {
+            shell_printf("0x%llx\n", (unsigned long long)site->site);
+        }
+    }
+    
+    kfree(sites);
+    return SHELL_SUCCESS;
+}
+
+// Print a counter interval in the largest unit that keeps it readable
+static void print_counter_time(uint64_t ticks, uint64_t freq)
+{
+    if (!freq) {
+        shell_printf("%d ticks", (int)ticks);
+        return;
+    }
+    
+    uint64_t ns = ticks <= UINT64_MAX / 1000000000ULL ?
+                  ticks * 1000000000ULL / freq : ticks / freq * 1000000000ULL;
+    if (ns < 10000) {
+        shell_printf("%d ns", (int)ns);
+    } else if (ns < 10000000) {
+        shell_printf("%d us", (int)(ns / 1000));
+    } else {
+        shell_printf("%d ms", (int)(ns / 1000000));
+    }
+}
+
+#define LOCKSTAT_REPORT_TOP 15
+#define LOCKSTAT_REPORT_MAX 100
+
+// Counter ticks as whole microseconds
+static uint64_t lockstat_us(uint64_t ticks, uint64_t freq)
+{
+    if (!freq) {
+        return ticks;
+    }
+    return ticks <= UINT64_MAX / 1000000ULL ? ticks * 1000000ULL / freq : ticks / freq * 1000000ULL;
+}
+
+// Lock statistics: the spinlocks waited on or held the most
+int cmd_lockstat(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    const char *usage = "Usage: lockstat [wait|hold|count] [top] | lockstat reset\n";
+    int order = LOCKSTAT_BY_WAIT;
+    uint64_t top = LOCKSTAT_REPORT_TOP;
+    int arg = 1;
+    
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        lockstat_reset();
+        shell_print("Lock statistics cleared\n");
+        return SHELL_SUCCESS;
+    }
+    if (arg < argc && strcmp(argv[arg], "wait") == 0) {
+        arg++;
+    } else if (arg < argc && strcmp(argv[arg], "hold") == 0) {
+        order = LOCKSTAT_BY_HOLD;
+        arg++;
+    } else if (arg < argc && strcmp(argv[arg], "count") == 0) {
+        order = LOCKSTAT_BY_COUNT;
+        arg++;
+    }
+    if (arg < argc) {
+        top = profile_parse_number(argv[arg++]);
+    }
+    if (arg < argc || !top) {
+        shell_print_error(usage);
+        return SHELL_EINVAL;
+    }
+    if (top > LOCKSTAT_REPORT_MAX) {
+        top = LOCKSTAT_REPORT_MAX;
+    }
+    
+    struct lockstat_entry *entries = kmalloc(top * sizeof(struct lockstat_entry));
+    if (!entries) {
+        shell_print_error("lockstat: out of memory\n");
+        return SHELL_ENOMEM;
+    }
+    struct lockstat_summary summary;
+    int count = lockstat_report(order, entries, (int)top, &summary);
+    if (count < 0) {
+        kfree(entries);
+        shell_print_error("lockstat: kernel built without LOCKSTAT=1\n");
+        return SHELL_ERROR;
+    }
+    
+    uint64_t freq = summary.frequency;
+    shell_printf("%u locks seen", summary.locks);
+    if (summary.untracked) {
+        shell_printf(", %llu acquisitions untracked", (unsigned long long)summary.untracked);
+    }
+    shell_printf("; times in us\n\n%10s %9s %10s %8s %10s %8s  Lock, first taken in\n",
+                 "Acquired", "Contended", "Wait", "Max", "Held", "Max");
+    
+    for (int i = 0; i < count; i++) {
+        const struct lockstat_entry *entry = &entries[i];
+        shell_printf("%10llu %9llu %10llu %8llu %10llu %8llu  0x%llx ",
+                     (unsigned long long)entry->acquisitions,
+                     (unsigned long long)entry->contended,
+                     (unsigned long long)lockstat_us(entry->wait_total, freq),
+                     (unsigned long long)lockstat_us(entry->wait_max, freq),
+                     (unsigned long long)lockstat_us(entry->hold_total, freq),
+                     (unsigned long long)lockstat_us(entry->hold_max, freq),
+                     (unsigned long long)entry->lock);
+        
+        uintptr_t offset;
+        int symbol = entry->site ? ksyms_lookup(entry->site - 1, &offset) : -1;
+        if (symbol >= 0) {
+            shell_printf("%s+0x%llx\n", ksyms_name((uint32_t)symbol), (unsigned long long)(offset + 1));
+        } else {
+            shell_printf("0x%llx\n", (unsigned long long)entry->site);
+        }
+    }
+    
+    kfree(entries);
+    return SHELL_SUCCESS;
+}
+
+// Per-IRQ latency and duration histograms command
+int cmd_irqstat(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    if (argc > 1) {
+        if (strcmp(argv[1], "on") == 0) {
+            irq_stats_enable(1);
+            shell_print("IRQ timing on, histograms cleared\n");
+        } else if (strcmp(argv[1], "off") == 0) {
+            irq_stats_enable(0);
+            shell_print("IRQ timing off\n");
+        } else {
+            shell_print_error("Usage: irqstat [on|off]\n");
+            return SHELL_EINVAL;
+        }
+        return SHELL_SUCCESS;
+    }
+    
+    if (!irq_stats_enabled) {
+        shell_print("IRQ timing is off; 'irqstat on' starts it\n");
+    }
+    
+    uint64_t freq = vdso_get_data()->counter_frequency;
+    struct irq_stats stats;
+    
+    for (uint32_t irq = 0; irq < MAX_IRQS; irq++) {
+        if (irq_stats_get(irq, &stats) < 0) {
+            continue;
+        }
+        
+        shell_printf("IRQ %d %s: %d interrupts, %d timed\n",
+                     (int)irq, stats.name ? stats.name : "?",
+                     (int)stats.count, (int)stats.samples);
+        if (!stats.samples) {
+            continue;
+        }
+        
+        shell_print("  max latency ");
+        print_counter_time(stats.max_latency, freq);
+        shell_print(", max duration ");
+        print_counter_time(stats.max_duration, freq);
+        shell_print("\n  from\tlatency\tduration\n");
+        for (uint32_t b = 0; b < IRQ_STATS_BUCKETS; b++) {
+            if (!stats.latency[b] && !stats.duration[b]) {
+                continue;
+            }
+            shell_print("  ");
+            print_counter_time(b ? 1ULL << b : 0, freq);
+            shell_printf("\t%d\t%d\n", (int)stats.latency[b], (int)stats.duration[b]);
+        }
+    }
+    
+    return SHELL_SUCCESS;
+}
+
+// Small decimal argument, -1 if it is not one
+static int irqaffinity_parse(const char *arg)
+{
+    int value = 0;
+    if (!*arg) {
+        return -1;
+    }
+    for (const char *p = arg; *p; p++) {
+        if (*p < '0' || *p > '9' || value > 99999) {
+            return -1;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return value;
+}
+
+int cmd_irqaffinity(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    int irq = argc == 3 ? irqaffinity_parse(argv[1]) : -1;
+    int cpu = argc == 3 ? irqaffinity_parse(argv[2]) : -1;
+    if (irq < 0 || cpu < 0) {
+        shell_print_error("Usage: irqaffinity <irq> <cpu>\n");
+        return SHELL_EINVAL;
+    }
+    
+    if (irq_set_affinity((uint32_t)irq, (uint32_t)cpu) < 0) {
+        shell_printf("IRQ %d can't be routed to CPU %d\n", irq, cpu);
+        return SHELL_ERROR;
+    }
+    shell_printf("IRQ %d routed to CPU %d\n", irq, cpu);
+    return SHELL_SUCCESS;
+}
+
+// Kernel log command
+int cmd_dmesg(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    static const char *const level_names[] = {"debug", "info", "warn", "error", "fatal"};
+    int min_level = LOG_DEBUG;
+    
+    if (argc > 1) {
+        min_level = -1;
+        for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++) {
+            if (strcmp(argv[1], level_names[i]) == 0) {
+                min_level = i;
+                break;
+            }
+        }
+        if (min_level < 0) {
+            shell_print_error("Usage: dmesg [debug|info|warn|error|fatal]\n");
+            return SHELL_EINVAL;
+        }
+    }
+    
+    klog_dump(min_level, shell_print);
+    
+    struct klog_stats stats;
+    klog_get_stats(&stats);
+    shell_printf("\n[%d records logged, %d lost before printing]\n",
+                 (int)stats.written, (int)stats.dropped);
+    
+    return SHELL_SUCCESS;
+}
+
+// Boot phase timeline command
+int cmd_bootstat(struct shell_context *ctx, int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    
+    if (!ctx) {
+        return SHELL_EINVAL;
+    }
+    
+    struct boot_trace_entry first;
+    if (boot_trace_get(0, &first) < 0) {
+        shell_print("No boot trace recorded\n");
+        return SHELL_SUCCESS;
+    }
+    
+    // Counters are per CPU, but both architectures keep them in sync
+    uint64_t freq = vdso_get_data()->counter_frequency;
+    uint64_t prev = first.counter;
+    struct boot_trace_entry entry;
+    
+    shell_print("at\tdelta\tcpu\tphase\n");
+    for (uint32_t i = 0; i < boot_trace_count(); i++) {
+        if (boot_trace_get(i, &entry) < 0) {
+            continue;
+        }
+        
+        // Deferred tasks may record a little out of counter order
+        uint64_t at = entry.counter > first.counter ? entry.counter - first.counter : 0;
+        uint64_t delta = entry.counter > prev ? entry.counter - prev : 0;
+        print_counter_time(at, freq);
+        shell_print("\t");
+        print_counter_time(delta, freq);
+        shell_printf("\t%d\t%s\n", (int)entry.cpu, entry.name);
+        if (entry.counter > prev) {
+            prev = entry.counter;
+        }
+    }
+    
+    return SHELL_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/*
+ * MiniOS Shell Trace Command
+ * Turns static tracepoints on and off and dumps their binary records
+ *
+ * The dump is line-based so it survives a serial console: a header with
+ * the record layout version and counter frequency, the event names, then
+ * each record as hex, one CPU's ring after another. tools/trace-decode.py
+ * merges the CPUs by timestamp and pairs events up for latencies.
+ */
+
+#include "shell.h"
+#include "kernel.h"
+#include "smp.h"
+#include "trace.h"
+#include "vdso.h"
+
+static const char trace_usage[] =
+    "Usage: trace start [event...] | stop | status | dump\n";
+
+static int trace_any_enabled(void)
+{
+    for (uint32_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+        if (trace_points[event].enabled) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void trace_stop_all(void)
+{
+    for (uint32_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+        trace_set_enabled(event, 0);
+    }
+}
+
+static int trace_start(int argc, char *argv[])
+{
+    if (trace_any_enabled()) {
+        shell_print_error("trace: already tracing; 'trace stop' first\n");
+        return SHELL_ERROR;
+    }
+
+    // Names are checked before anything changes
+    for (int i = 2; i < argc; i++) {
+        if (trace_event_lookup(argv[i]) < 0) {
+            shell_print_error("trace: unknown event; 'trace status' lists them\n");
+            return SHELL_EINVAL;
+        }
+    }
+    if (trace_reset() < 0) {
+        shell_print_error("trace: cannot allocate trace buffers\n");
+        return SHELL_ENOMEM;
+    }
+
+    if (argc == 2) {
+        for (uint32_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+            trace_set_enabled(event, 1);
+        }
+    } else {
+        for (int i = 2; i < argc; i++) {
+            trace_set_enabled((uint32_t)trace_event_lookup(argv[i]), 1);
+        }
+    }
+    return SHELL_SUCCESS;
+}
+
+static void trace_status(void)
+{
+    for (uint32_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+        shell_printf("  %-16s %s\n", trace_points[event].name,
+                     trace_points[event].enabled ? "on" : "off");
+    }
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t written, overwritten;
+        trace_cpu_stats(cpu, &written, &overwritten);
+        if (written) {
+            shell_printf("  cpu%u: %llu records, %llu overwritten\n", cpu,
+                         (unsigned long long)written, (unsigned long long)overwritten);
+        }
+    }
+}
+
+static void trace_dump(void)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[2 + 2 * sizeof(struct trace_record) + 2];
+    uint64_t records = 0, skipped = 0;
+
+    shell_printf("TRACE_BEGIN version=%u record=%u hz=%llu\n", TRACE_FORMAT_VERSION,
+                 (unsigned)sizeof(struct trace_record),
+                 (unsigned long long)arch_vdso_counter_frequency());
+    for (uint32_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+        shell_printf("TRACE_EVENT %u %s\n", event, trace_points[event].name);
+    }
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t written, overwritten;
+        trace_cpu_stats(cpu, &written, &overwritten);
+        if (!written) {
+            continue;
+        }
+        shell_printf("TRACE_CPU %u written=%llu overwritten=%llu\n", cpu,
+                     (unsigned long long)written, (unsigned long long)overwritten);
+
+        struct trace_record record;
+        int result;
+        for (uint64_t i = 0; (result = trace_read(cpu, i, &record)) >= 0; i++) {
+            if (result > 0) {
+                skipped++;
+                continue;
+            }
+            const uint8_t *bytes = (const uint8_t *)&record;
+            int pos = 0;
+            line[pos++] = 'R';
+            line[pos++] = ' ';
+            for (size_t b = 0; b < sizeof(record); b++) {
+                line[pos++] = hex[bytes[b] >> 4];
+                line[pos++] = hex[bytes[b] & 0xf];
+            }
+            line[pos++] = '\n';
+            line[pos] = '\0';
+            shell_printf("%s", line);
+            records++;
+        }
+    }
+
+    shell_printf("TRACE_END records=%llu skipped=%llu\n",
+                 (unsigned long long)records, (unsigned long long)skipped);
+}
+
+// Static tracepoints: start, stop, status, dump
+int cmd_trace(struct shell_context *ctx, int argc, char *argv[])
+{
+    if (!ctx || argc < 2) {
+        shell_print_error(trace_usage);
+        return SHELL_EINVAL;
+    }
+
+    if (strcmp(argv[1], "start") == 0) {
+        return trace_start(argc, argv);
+    }
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        trace_stop_all();
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "status") == 0) {
+        trace_status();
+        return SHELL_SUCCESS;
+    }
+    if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        trace_dump();
+        return SHELL_SUCCESS;
+    }
+
+    shell_print_error(trace_usage);
+    return SHELL_EINVAL;
+}
@@ -0,0 +1,38 @@
+/*
+ * MiniOS Shell Arena
+ * Fixed-buffer bump allocation for per-command shell data
+ */
+
+#include "shell.h"
+#include "kernel.h"
+
+// Allocate size bytes, pointer aligned; NULL once the buffer is used up
+void *shell_arena_alloc(struct shell_arena *arena, size_t size)
+{
+    if (!arena) {
+        return NULL;
+    }
+
+    size_t start = (arena->used + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (start > arena->size || size > arena->size - start) {
+        return NULL;
+    }
+
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+// Copy str into the arena
+char *shell_arena_strdup(struct shell_arena *arena, const char *str)
+{
+    if (!str) {
+        return NULL;
+    }
+
+    size_t len = strlen(str);
+    char *copy = (char *)shell_arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, str, len + 1);
+    }
+    return copy;
+}
@@ -8,6 +8,7 @@
 #include "process.h"
 #include "syscall.h"
 #include "uart.h"
+#include "boot_trace.h"
 
 // Global shell command registry
 static struct shell_command shell_commands[] = {
@@ -17,7 +18,9 @@ static struct shell_command shell_commands[] = {
     
     // File listing and content
     {"ls", "List directory contents", cmd_ls, 0, 2},
-    {"cat", "Display file contents", cmd_cat, 1, 1},
+    {"cat", "Display file contents", cmd_cat, 0, 1},
+    {"head", "Show the first lines of a file", cmd_head, 0, 3},
+    {"tail", "Show the last lines of a file", cmd_tail, 0, 3},
     
     // File management
     {"mkdir", "Create directory", cmd_mkdir, 1, 1},
@@ -26,9 +29,11 @@ static struct shell_command shell_commands[] = {
     {"cp", "Copy file", cmd_cp, 2, 2},
     {"mv", "Move/rename file", cmd_mv, 2, 2},
     {"touch", "Create file or update timestamp", cmd_touch, 1, 1},
-    {"mkfs", "Format a block device", cmd_mkfs, 1, 2},
+    {"mkfs", "Format a block device", cmd_mkfs, 1, 7},
+    {"fsck", "Check an SFS file system", cmd_fsck, 1, 3},
     {"mount", "Mount a filesystem", cmd_mount, 2, 3},
     {"umount", "Unmount a filesystem", cmd_umount, 1, 1},
+    {"sync", "Write back cached data, or tune the flusher", cmd_sync, 0, 5},
     
     // Output commands
     {"echo", "Display text or write to file", cmd_echo, 0, -1},  // -1 means unlimited args
@@ -40,6 +45,23 @@ static struct shell_command shell_commands[] = {
     {"uname", "Show system information", cmd_uname, 0, 1},
     {"date", "Show current date/time", cmd_date, 0, 0},
     {"uptime", "Show system uptime", cmd_uptime, 0, 0},
+    {"sysbench", "Measure system call round-trip cost", cmd_sysbench, 0, 1},
+    {"bench", "Run kernel hot-path microbenchmarks", cmd_bench, 0, 4},
+    {"fsbench", "Measure file system throughput and metadata rates", cmd_fsbench, 0, 8},
+    {"perfstat", "Count hardware events while a command runs", cmd_perfstat, 1, 31},
+    {"profile", "Sample where the kernel runs: start, stop, report", cmd_profile, 1, 4},
+    {"memprof", "Live kernel allocations by call site", cmd_memprof, 0, 2},
+    {"lockstat", "Spinlock contention and hold times", cmd_lockstat, 0, 2},
+    {"trace", "Static tracepoints: start, stop, status, dump", cmd_trace, 1, 12},
+    {"irqstat", "Show per-IRQ latency and duration histograms", cmd_irqstat, 0, 1},
+    {"irqaffinity", "Route an interrupt to a CPU", cmd_irqaffinity, 2, 2},
+    {"dmesg", "Show the kernel log", cmd_dmesg, 0, 1},
+    {"bootstat", "Show the boot phase timeline", cmd_bootstat, 0, 0},
+    
+    // Networking
+    {"ifconfig", "Show network interfaces", cmd_ifconfig, 0, 0},
+    {"httpd", "Start the HTTP server task", cmd_httpd, 0, 1},
+    {"httpbench", "Measure HTTP requests per second", cmd_httpbench, 0, 2},
     
     // Shell commands
     {"help", "Show available commands", cmd_help, 0, 1},
@@ -49,6 +71,78 @@ static struct shell_command shell_commands[] = {
     {NULL, NULL, NULL, 0, 0}
 };
 
+#define SHELL_COMMAND_COUNT     (sizeof(shell_commands) / sizeof(shell_commands[0]) - 1)
+
+/*
+ * Command index, built once from shell_commands[]. Exact lookups hash the
+ * name into an open-addressed table whose seed is picked so that no two
+ * commands share a slot: one hash, one probe, one strcmp. If no seed in
+ * SHELL_COMMAND_SEED_TRIES works, colliding names fall back to linear
+ * probing, which is still correct. Prefix completion binary-searches a
+ * name-sorted list instead, then walks the matches.
+ */
+static uint8_t shell_command_slots[SHELL_COMMAND_HASH_SIZE];   // Index + 1, 0 empty
+static uint8_t shell_command_sorted[SHELL_COMMAND_COUNT];      // Indices by name
+static uint32_t shell_command_seed;
+static int shell_command_index_ready = 0;
+
+_Static_assert(SHELL_COMMAND_COUNT * 2 <= SHELL_COMMAND_HASH_SIZE &&
+               SHELL_COMMAND_COUNT < 255, "shell command index too small");
+
+static uint32_t shell_command_hash(const char *name, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash & (SHELL_COMMAND_HASH_SIZE - 1);
+}
+
+// Fill the slots with seed; returns the number of names that collided
+static int shell_command_index_fill(uint32_t seed)
+{
+    int collisions = 0;
+    memset(shell_command_slots, 0, sizeof(shell_command_slots));
+    for (uint32_t i = 0; i < SHELL_COMMAND_COUNT; i++) {
+        uint32_t slot = shell_command_hash(shell_commands[i].name, seed);
+        if (shell_command_slots[slot]) {
+            collisions++;
+            while (shell_command_slots[slot]) {
+                slot = (slot + 1) & (SHELL_COMMAND_HASH_SIZE - 1);
+            }
+        }
+        shell_command_slots[slot] = (uint8_t)(i + 1);
+    }
+    return collisions;
+}
+
+static void shell_command_index_init(void)
+{
+    if (shell_command_index_ready) {
+        return;
+    }
+
+    uint32_t seed = 0;
+    while (shell_command_index_fill(seed) != 0 && seed < SHELL_COMMAND_SEED_TRIES) {
+        seed++;
+    }
+    shell_command_seed = seed;
+
+    // Insertion sort: a few dozen names, once
+    for (uint32_t i = 0; i < SHELL_COMMAND_COUNT; i++) {
+        uint32_t j = i;
+        while (j > 0 && strcmp(shell_commands[shell_command_sorted[j - 1]].name,
+                               shell_commands[i].name) > 0) {
+            shell_command_sorted[j] = shell_command_sorted[j - 1];
+            j--;
+        }
+        shell_command_sorted[j] = (uint8_t)i;
+    }
+
+    shell_command_index_ready = 1;
+}
+
 // Initialize shell context
 int shell_init(struct shell_context *ctx)
 {
@@ -59,6 +153,8 @@ int shell_init(struct shell_context *ctx)
         return SHELL_EINVAL;
     }
     
+    shell_command_index_init();
+    
     early_print("shell_init: Context OK\n");
     
     // Initialize only essential fields, avoid touching large arrays
@@ -236,15 +332,57 @@ struct shell_command *shell_find_command(const char *name)
         return NULL;
     }
     
-    for (int i = 0; shell_commands[i].name != NULL; i++) {
-        if (strcmp(shell_commands[i].name, name) == 0) {
-            return &shell_commands[i];
+    shell_command_index_init();
+    
+    uint32_t slot = shell_command_hash(name, shell_command_seed);
+    while (shell_command_slots[slot]) {
+        struct shell_command *cmd = &shell_commands[shell_command_slots[slot] - 1];
+        if (strcmp(cmd->name, name) == 0) {
+            return cmd;
         }
+        slot = (slot + 1) & (SHELL_COMMAND_HASH_SIZE - 1);
     }
     
     return NULL;
 }
 
+/**
+ * Store up to max command names starting with prefix in matches, in name
+ * order
+ * @return Number of names stored
+ */
+int shell_complete_command(const char *prefix, const char **matches, int max)
+{
+    if (!prefix || !matches || max <= 0) {
+        return 0;
+    }
+    
+    shell_command_index_init();
+    
+    // First name not below prefix; every match follows it
+    size_t len = strlen(prefix);
+    uint32_t lo = 0;
+    uint32_t hi = SHELL_COMMAND_COUNT;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (strcmp(shell_commands[shell_command_sorted[mid]].name, prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    int count = 0;
+    for (; lo < SHELL_COMMAND_COUNT && count < max; lo++) {
+        const char *name = shell_commands[shell_command_sorted[lo]].name;
+        if (strncmp(name, prefix, len) != 0) {
+            break;
+        }
+        matches[count++] = name;
+    }
+    return count;
+}
+
 // Shell initialization for system
 int shell_init_system(void)
 {
@@ -287,6 +425,8 @@ void shell_main_task(void *arg)
     
     early_print("shell_init complete, starting shell\n");
     
+    boot_trace_mark("shell_prompt");
+    
     // Run shell
     shell_run(ctx);
     
@@ -5,6 +5,9 @@
 
 #include "shell.h"
 #include "kernel.h"
+#include "process.h"
+#include "klog.h"
+#include "format.h"
 #include <stdarg.h>
 
 // Architecture-specific UART register access for input
@@ -92,6 +95,22 @@ static void shell_putc(char c) {
 
 #endif
 
+// Console through the UART driver's rings once it is up, so echoed input
+// stays in order with queued output
+static int shell_console_getc(void) {
+    struct device *uart = uart_get_primary();
+    return uart ? uart_getc(uart) : shell_getc();
+}
+
+static void shell_console_putc(char c) {
+    struct device *uart = uart_get_primary();
+    if (uart) {
+        uart_putc(uart, c);
+    } else {
+        shell_putc(c);
+    }
+}
+
 // Print shell prompt
 void shell_print_prompt(struct shell_context *ctx)
 {
@@ -118,10 +137,10 @@ int shell_read_command(struct shell_context *ctx)
     
     while (pos < SHELL_MAX_COMMAND_LENGTH - 1) {
         // Read one character from UART
-        int ch = shell_getc();
+        int ch = shell_console_getc();
         if (ch < 0) {
-            // Add small delay when no input is available to prevent tight looping
-            for (volatile int i = 0; i < 1000; i++);
+            // Let other tasks run while there is no input
+            process_yield();
             continue;  // No input available, keep trying
         }
         
@@ -133,7 +152,7 @@ int shell_read_command(struct shell_context *ctx)
             case '\n':  // Line feed
                 // End of command
                 ctx->command_buffer[pos] = '\0';
-                shell_putc('\n');  // Echo newline
+                shell_console_putc('\n');  // Echo newline
                 return pos;
                 
             case '\b':  // Backspace
@@ -142,9 +161,9 @@ int shell_read_command(struct shell_context *ctx)
                     pos--;
                     ctx->command_buffer[pos] = '\0';
                     // Echo backspace sequence
-                    shell_putc('\b');
-                    shell_putc(' ');
-                    shell_putc('\b');
+                    shell_console_putc('\b');
+                    shell_console_putc(' ');
+                    shell_console_putc('\b');
                 }
                 break;
                 
@@ -168,7 +187,7 @@ int shell_read_command(struct shell_context *ctx)
                 if (c >= 32 && c < 127) {  // Printable ASCII
                     ctx->command_buffer[pos] = c;
                     pos++;
-                    shell_putc(c);  // Echo character
+                    shell_console_putc(c);  // Echo character
                 }
                 break;
         }
@@ -180,6 +199,55 @@ int shell_read_command(struct shell_context *ctx)
     return SHELL_ERROR;
 }
 
+// Descriptor fd's open file, or NULL when it is the console
+static struct file *shell_stdio_file(int fd)
+{
+    struct file_descriptor *desc = fd_get(fd_get_current_table(), fd);
+    return desc ? desc->file : NULL;
+}
+
+// Write len bytes to standard output: a pipe or file in a pipeline stage,
+// the console otherwise
+int shell_write(const void *data, size_t len)
+{
+    if (!data) {
+        return SHELL_EINVAL;
+    }
+
+    if (shell_stdio_file(STDOUT_FD)) {
+        const char *p = (const char *)data;
+        while (len > 0) {
+            ssize_t written = vfs_write(STDOUT_FD, p, len);
+            if (written <= 0) {
+                return written < 0 ? (int)written : SHELL_ERROR;  // Reader gone
+            }
+            p += written;
+            len -= (size_t)written;
+        }
+        return SHELL_SUCCESS;
+    }
+
+    // Straight to the console after any pending kernel log records;
+    // command output is not itself logged
+    char chunk[128];
+    const char *p = (const char *)data;
+    while (len > 0) {
+        size_t n = len < sizeof(chunk) - 1 ? len : sizeof(chunk) - 1;
+        memcpy(chunk, p, n);
+        chunk[n] = '\0';
+        klog_console_print(chunk);
+        p += n;
+        len -= n;
+    }
+    return SHELL_SUCCESS;
+}
+
+// Does this task have a standard input? Only pipeline stages do
+int shell_has_stdin(void)
+{
+    return shell_stdio_file(STDIN_FD) != NULL;
+}
+
 // Print message to output
 void shell_print(const char *message)
 {
@@ -187,19 +255,22 @@ void shell_print(const char *message)
         return;
     }
     
-    // Use early_print for output (same as kernel messages)
-    early_print(message);
+    if (shell_stdio_file(STDOUT_FD)) {
+        shell_write(message, strlen(message));
+    } else {
+        klog_console_print(message);
+    }
 }
 
-// Print error message
+// Print error message; errors stay on the console even inside a pipeline
 void shell_print_error(const char *error)
 {
     if (!error) {
         return;
     }
     
-    shell_print("Error: ");
-    shell_print(error);
+    klog_console_print("Error: ");
+    klog_console_print(error);
 }
 
 // Simple printf implementation for shell
@@ -209,94 +280,13 @@ void shell_printf(const char *format, ...)
         return;
     }
 
+    // Format the whole line first so it goes out in one write
     char buffer[512];
-    size_t pos = 0;
 
     va_list args;
     va_start(args, format);
-
-    for (const char *p = format; *p && pos < sizeof(buffer) - 1; ++p) {
-        if (*p != '%' || *(p + 1) == '\0') {
-            buffer[pos++] = *p;
-            continue;
-        }
-
-        ++p;  // Skip '%'
-
-        switch (*p) {
-            case 's': {
-                const char *str = va_arg(args, const char *);
-                if (!str) {
-                    str = "(null)";
-                }
-                while (*str && pos < sizeof(buffer) - 1) {
-                    buffer[pos++] = *str++;
-                }
-                break;
-            }
-            case 'd': {
-                int value = va_arg(args, int);
-                char temp[16];
-                int idx = 0;
-                if (value < 0) {
-                    if (pos < sizeof(buffer) - 1) {
-                        buffer[pos++] = '-';
-                    }
-                    value = -value;
-                }
-                if (value == 0) {
-                    if (pos < sizeof(buffer) - 1) {
-                        buffer[pos++] = '0';
-                    }
-                    break;
-                }
-                while (value > 0 && idx < (int)sizeof(temp)) {
-                    temp[idx++] = (char)('0' + (value % 10));
-                    value /= 10;
-                }
-                while (idx-- > 0 && pos < sizeof(buffer) - 1) {
-                    buffer[pos++] = temp[idx];
-                }
-                break;
-            }
-            case 'x': {
-                unsigned int value = va_arg(args, unsigned int);
-                char temp[16];
-                int idx = 0;
-                if (value == 0) {
-                    if (pos < sizeof(buffer) - 1) {
-                        buffer[pos++] = '0';
-                    }
-                    break;
-                }
-                while (value > 0 && idx < (int)sizeof(temp)) {
-                    unsigned int digit = value & 0xF;
-                    temp[idx++] = (char)((digit < 10) ? '0' + digit : 'a' + (digit - 10));
-                    value >>= 4;
-                }
-                while (idx-- > 0 && pos < sizeof(buffer) - 1) {
-                    buffer[pos++] = temp[idx];
-                }
-                break;
-            }
-            case '%':
-                if (pos < sizeof(buffer) - 1) {
-                    buffer[pos++] = '%';
-                }
-                break;
-            default:
-                if (pos < sizeof(buffer) - 1) {
-                    buffer[pos++] = '%';
-                }
-                if (pos < sizeof(buffer) - 1) {
-                    buffer[pos++] = *p;
-                }
-                break;
-        }
-    }
-
+    vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
 
-    buffer[pos] = '\0';
     shell_print(buffer);
 }
@@ -5,35 +5,16 @@
 
 #include "shell.h"
 #include "kernel.h"
+#include "process.h"
 
-// Parse command line into structured format
-int parse_command_line(const char *input, struct command_line *cmd)
+// Everything one parsed command line points into; the shell parses one
+// line at a time, and free_command_line() hands it all back at once
+static char parse_arena_buffer[SHELL_PARSE_ARENA_SIZE];
+static struct shell_arena parse_arena = SHELL_ARENA_INIT(parse_arena_buffer);
+
+// Pull the first redirection or background marker out of cmd's arguments
+static void parse_redirections(struct command_line *cmd)
 {
-    if (!input || !cmd) {
-        return SHELL_EINVAL;
-    }
-    
-    // Initialize command line structure
-    memset(cmd, 0, sizeof(struct command_line));
-    
-    // Allocate argument array
-    cmd->arguments = (char **)kmalloc(SHELL_MAX_ARGS * sizeof(char *));
-    if (!cmd->arguments) {
-        return SHELL_ENOMEM;
-    }
-    
-    // Parse arguments using existing parser
-    cmd->argument_count = shell_parse_command(input, cmd->arguments, SHELL_MAX_ARGS);
-    
-    if (cmd->argument_count == 0) {
-        kfree(cmd->arguments);
-        return SHELL_EINVAL;
-    }
-    
-    // First argument is the command
-    cmd->command = cmd->arguments[0];
-    
-    // Check for I/O redirection (simple implementation)
     for (int i = 1; i < cmd->argument_count; i++) {
         if (cmd->arguments[i][0] == '>') {
             // Output redirection
@@ -76,10 +57,245 @@ int parse_command_line(const char *input, struct command_line *cmd)
             break;
         }
     }
-    
+    cmd->arguments[cmd->argument_count] = NULL;
+}
+
+// Copy input with spaces around each '|', so "a|b" splits like "a | b"
+static void parse_space_pipes(const char *input, char *out, size_t size)
+{
+    size_t pos = 0;
+    for (; *input && pos + 3 < size; input++) {
+        if (*input == '|') {
+            out[pos++] = ' ';
+            out[pos++] = '|';
+            out[pos++] = ' ';
+        } else {
+            out[pos++] = *input;
+        }
+    }
+    out[pos] = '\0';
+}
+
+// Give one stage its own copy of tokens[0..count)
+static int parse_stage(struct command_line *cmd, char **tokens, int count)
+{
+    cmd->arguments = (char **)shell_arena_alloc(&parse_arena, (count + 1) * sizeof(char *));
+    if (!cmd->arguments) {
+        return SHELL_ENOMEM;
+    }
+    memcpy(cmd->arguments, tokens, count * sizeof(char *));
+    cmd->argument_count = count;
+    cmd->command = cmd->arguments[0];
+    parse_redirections(cmd);
     return SHELL_SUCCESS;
 }
 
+/**
+ * Parse command line into structured format. "a | b | c" becomes a chain
+ * of stages linked through pipe_next, each with its own arguments and
+ * redirections; free_command_line() releases the whole chain.
+ */
+int parse_command_line(const char *input, struct command_line *cmd)
+{
+    if (!input || !cmd) {
+        return SHELL_EINVAL;
+    }
+    
+    // Initialize command line structure
+    memset(cmd, 0, sizeof(struct command_line));
+    shell_arena_reset(&parse_arena);
+    
+    char *spaced = (char *)shell_arena_alloc(&parse_arena, SHELL_MAX_COMMAND_LENGTH);
+    char **tokens = (char **)shell_arena_alloc(&parse_arena, SHELL_MAX_ARGS * sizeof(char *));
+    if (!spaced || !tokens) {
+        return SHELL_ENOMEM;
+    }
+    parse_space_pipes(input, spaced, SHELL_MAX_COMMAND_LENGTH);
+    
+    // Parse arguments using existing parser
+    int token_count = shell_parse_command(spaced, tokens, SHELL_MAX_ARGS);
+    if (token_count == 0) {
+        shell_arena_reset(&parse_arena);
+        return SHELL_EINVAL;
+    }
+    
+    // One stage per run of tokens between pipes
+    struct command_line *stage = cmd;
+    struct command_line **link = NULL;      // Where the next stage hangs
+    int stages = 0;
+    int first = 0;
+    int result = SHELL_SUCCESS;
+    for (int i = 0; i <= token_count; i++) {
+        if (i < token_count && strcmp(tokens[i], "|") != 0) {
+            continue;
+        }
+        if (i == first) {
+            shell_print_error("Syntax error near '|'\n");
+            result = SHELL_EINVAL;
+            break;
+        }
+        if (++stages > SHELL_MAX_PIPELINE) {
+            shell_print_error("Too many pipeline stages\n");
+            result = SHELL_EINVAL;
+            break;
+        }
+        if (link) {
+            stage = (struct command_line *)shell_arena_alloc(&parse_arena,
+                                                             sizeof(struct command_line));
+            if (!stage) {
+                result = SHELL_ENOMEM;
+                break;
+            }
+            memset(stage, 0, sizeof(struct command_line));
+            *link = stage;
+        }
+        result = parse_stage(stage, tokens + first, i - first);
+        if (result != SHELL_SUCCESS) {
+            break;
+        }
+        link = &stage->pipe_next;
+        first = i + 1;
+    }
+    
+    if (result != SHELL_SUCCESS) {
+        free_command_line(cmd);
+    }
+    return result;
+}
+
+// One stage of a running pipeline; lives in execute_pipeline()'s frame
+struct pipeline_stage {
+    struct shell_context *ctx;
+    struct command_line *cmd;
+    struct file *in;                        // Standard input, NULL for none
+    struct file *out;                       // Standard output, NULL for the console
+    int pid;
+};
+
+// Task body for one stage: run the builtin with the stage's stdin/stdout
+static void pipeline_stage_main(void *arg)
+{
+    struct pipeline_stage *stage = (struct pipeline_stage *)arg;
+    struct fd_table *table = fd_get_current_table();
+
+    // The task's descriptors take over the references the shell handed on
+    if (stage->in) {
+        fd_assign(table, STDIN_FD, stage->in, VFS_O_RDONLY);
+        vfs_file_put(stage->in);
+    }
+    if (stage->out) {
+        fd_assign(table, STDOUT_FD, stage->out, VFS_O_WRONLY);
+        vfs_file_put(stage->out);
+    }
+
+    int result = execute_builtin_command(stage->ctx, stage->cmd);
+    if (result == SHELL_ENOENT && !shell_find_command(stage->cmd->command)) {
+        shell_print_error("Command not found: ");
+        shell_print_error(stage->cmd->command);
+        shell_print_error("\n");
+    }
+
+    // Close now rather than at reap time, so the next stage sees end of
+    // file and the previous one stops writing as soon as this one is done
+    vfs_close(STDOUT_FD);
+    vfs_close(STDIN_FD);
+    process_exit(result == SHELL_SUCCESS ? 0 : 1);
+}
+
+// Open a redirection target and return its file, not a descriptor
+static struct file *pipeline_open(struct shell_context *ctx, const char *name, int flags)
+{
+    char full_path[SHELL_MAX_PATH_LENGTH];
+    build_full_path(full_path, sizeof(full_path), ctx->current_directory, name);
+
+    int fd = vfs_open(full_path, flags, 0644);
+    if (fd < 0) {
+        shell_print_error("Cannot open file: ");
+        shell_print_error(full_path);
+        shell_print_error("\n");
+        return NULL;
+    }
+    struct file *file = vfs_file_get(fd);
+    vfs_close(fd);
+    return file;
+}
+
+/**
+ * Run "a | b | c": every stage is its own task, connected by kernel
+ * pipes, so all of them run at once and data streams from one to the next
+ * without a temporary file. Waits for every stage; the result is the
+ * last one's.
+ */
+static int execute_pipeline(struct shell_context *ctx, struct command_line *cmd)
+{
+    struct pipeline_stage stages[SHELL_MAX_PIPELINE];
+    int count = 0;
+    for (struct command_line *c = cmd; c && count < SHELL_MAX_PIPELINE; c = c->pipe_next) {
+        memset(&stages[count], 0, sizeof(stages[count]));
+        stages[count].ctx = ctx;
+        stages[count].cmd = c;
+        count++;
+    }
+
+    int result = SHELL_SUCCESS;
+    struct command_line *last = stages[count - 1].cmd;
+    if (cmd->input_redirect) {
+        stages[0].in = pipeline_open(ctx, cmd->input_redirect, VFS_O_RDONLY);
+        if (!stages[0].in) {
+            result = SHELL_ERROR;
+        }
+    }
+    if (result == SHELL_SUCCESS && last->output_redirect) {
+        stages[count - 1].out = pipeline_open(ctx, last->output_redirect,
+                                              VFS_O_WRONLY | VFS_O_CREAT | VFS_O_TRUNC);
+        if (!stages[count - 1].out) {
+            result = SHELL_ERROR;
+        }
+    }
+
+    // Connect neighbours; the shell keeps no descriptor for either end,
+    // so the stages it starts do not inherit one
+    for (int i = 0; result == SHELL_SUCCESS && i < count - 1; i++) {
+        int fds[2];
+        if (vfs_pipe(fds) != VFS_SUCCESS) {
+            shell_print_error("Cannot create pipe\n");
+            result = SHELL_ERROR;
+            break;
+        }
+        stages[i + 1].in = vfs_file_get(fds[0]);
+        stages[i].out = vfs_file_get(fds[1]);
+        vfs_close(fds[0]);
+        vfs_close(fds[1]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        stages[i].pid = -1;
+        if (result == SHELL_SUCCESS) {
+            stages[i].pid = process_create_fair(pipeline_stage_main, &stages[i],
+                                                stages[i].cmd->command, 0);
+        }
+        if (stages[i].pid < 0) {
+            // Never started: drop its ends so its neighbours finish
+            vfs_file_put(stages[i].in);
+            vfs_file_put(stages[i].out);
+            if (result == SHELL_SUCCESS) {
+                shell_print_error("Cannot start pipeline stage\n");
+                result = SHELL_ERROR;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        int status = 0;
+        if (stages[i].pid >= 0 && process_wait(stages[i].pid, &status) >= 0 &&
+            i == count - 1 && status != 0 && result == SHELL_SUCCESS) {
+            result = SHELL_ERROR;
+        }
+    }
+
+    return result;
+}
+
 // Execute parsed command
 int execute_command(struct shell_context *ctx, struct command_line *cmd)
 {
@@ -87,6 +303,10 @@ int execute_command(struct shell_context *ctx, struct command_line *cmd)
         return SHELL_EINVAL;
     }
     
+    if (cmd->pipe_next) {
+        return execute_pipeline(ctx, cmd);
+    }
+    
     // Store output redirection in context so commands can access it
     // Save the original value
     char *saved_output_redirect = ctx->output_redirect_file;
@@ -119,23 +339,15 @@ int execute_command(struct shell_context *ctx, struct command_line *cmd)
     return result;
 }
 
-// Free command line resources
+// Free command line resources, every stage of a pipeline included
 void free_command_line(struct command_line *cmd)
 {
     if (!cmd) {
         return;
     }
     
-    if (cmd->arguments) {
-        kfree(cmd->arguments);
-        cmd->arguments = NULL;
-    }
-    
-    cmd->argument_count = 0;
-    cmd->command = NULL;
-    cmd->input_redirect = NULL;
-    cmd->output_redirect = NULL;
-    cmd->background = 0;
+    shell_arena_reset(&parse_arena);
+    memset(cmd, 0, sizeof(struct command_line));
 }
 
 // Execute built-in command
@@ -0,0 +1,218 @@
+/*
+ * Math Benchmark - Accuracy and throughput of the minios_libc math library
+ *
+ * Checks exp, log, sin, cos and sqrt against correctly rounded reference
+ * values, checks that the batch functions (vexp and friends) return
+ * exactly what the scalar ones do, and times both over a 4096-element
+ * array. Exits with 1 if any function is off by more than its bound.
+ */
+
+#include "../lib/minios_libc/stdio.h"
+#include "../lib/minios_libc/stdlib.h"
+#include "../lib/minios_libc/string.h"
+#include "../lib/minios_libc/math.h"
+#include "../lib/minios_libc/time.h"
+
+#include <stdint.h>
+
+#define BENCH_SIZE      4096
+#define BENCH_ROUNDS    64
+#define MAX_ULP_ERROR   1
+
+struct reference {
+    double x;
+    double expected;            // Correctly rounded f(x)
+};
+
+static const struct reference sin_refs[] = {
+    { 0x1.0000000000000p-1, 0x1.eaee8744b05f0p-2 },
+    { 0x1.0000000000000p+0, 0x1.aed548f090ceep-1 },
+    { 0x1.0000000000000p+1, 0x1.d18f6ead1b446p-1 },
+    { 0x1.8000000000000p+1, 0x1.210386db6d55bp-3 },
+    { -0x1.8000000000000p-1, -0x1.5cffc16bf8f0dp-1 },
+    { 0x1.4000000000000p+3, -0x1.1689ef5f34f52p-1 },
+    { 0x1.9000000000000p+6, -0x1.03425b78c4db8p-1 },
+    { 0x1.4f8b588e368f1p-17, 0x1.4f8b588e1e8a2p-17 },
+    { 0x1.921fb54442d18p-1, 0x1.6a09e667f3bccp-1 },
+    { 0x1.f440000000000p+9, 0x1.fd948c50a7a0dp-1 },
+    { 0x1.81cd6c8b43958p+13, -0x1.687d5890974a5p-1 },
+    { -0x1.0a66666666666p+5, -0x1.e7148f79ab16dp-1 },
+};
+
+static const struct reference cos_refs[] = {
+    { 0x1.0000000000000p-1, 0x1.c1528065b7d50p-1 },
+    { 0x1.0000000000000p+0, 0x1.14a280fb5068cp-1 },
+    { 0x1.0000000000000p+1, -0x1.aa22657537205p-2 },
+    { 0x1.8000000000000p+1, -0x1.fae04be85e5d2p-1 },
+    { -0x1.8000000000000p-1, 0x1.769fec655211fp-1 },
+    { 0x1.4000000000000p+3, -0x1.ad9ac890c6b1fp-1 },
+    { 0x1.9000000000000p+6, 0x1.b981dbf665fdfp-1 },
+    { 0x1.4f8b588e368f1p-17, 0x1.ffffffff920c8p-1 },
+    { 0x1.921fb54442d18p-1, 0x1.6a09e667f3bcdp-1 },
+    { 0x1.f440000000000p+9, 0x1.8dbff75eb664fp-4 },
+    { 0x1.81cd6c8b43958p+13, 0x1.6b94c3bbe24b8p-1 },
+    { -0x1.0a66666666666p+5, -0x1.3b92fe29aaf21p-2 },
+};
+
+static const struct reference exp_refs[] = {
+    { 0x1.0000000000000p-1, 0x1.a61298e1e069cp+0 },
+    { 0x1.0000000000000p+0, 0x1.5bf0a8b145769p+1 },
+    { -0x1.0000000000000p+0, 0x1.78b56362cef38p-2 },
+    { 0x1.4000000000000p+3, 0x1.5829dcf950560p+14 },
+    { -0x1.4000000000000p+3, 0x1.7cd79b5647c9bp-15 },
+    { 0x1.0624dd2f1a9fcp-10, 0x1.0041919b7ee34p+0 },
+    { 0x1.9000000000000p+6, 0x1.3494a9b171bf5p+144 },
+    { -0x1.9000000000000p+6, 0x1.a8c1f14e2af5dp-145 },
+    { 0x1.5e00000000000p+9, 0x1.d945df4f8ec8ep+1009 },
+    { -0x1.5e00000000000p+9, 0x1.14f2b0fb9307fp-1010 },
+    { 0x1.a666666666666p+1, 0x1.b1cd5e7807b7bp+4 },
+    { -0x1.0000000000000p-4, 0x1.e0fabfbc702a4p-1 },
+};
+
+static const struct reference log_refs[] = {
+    { 0x1.0000000000000p-1, -0x1.62e42fefa39efp-1 },
+    { 0x1.0000000000000p+1, 0x1.62e42fefa39efp-1 },
+    { 0x1.8000000000000p+1, 0x1.193ea7aad030bp+0 },
+    { 0x1.4000000000000p+3, 0x1.26bb1bbb55516p+1 },
+    { 0x1.999999999999ap-4, -0x1.26bb1bbb55515p+1 },
+    { 0x1.00068db8bac71p+0, 0x1.a368d0657fcd4p-14 },
+    { 0x1.56e1fc2f8f359p-997, -0x1.5963447f87fb5p+9 },
+    { 0x1.7e43c8800759cp+996, 0x1.5963447f87fb5p+9 },
+    { 0x1.e240c9fbe76c9p+16, 0x1.77281cad8a844p+3 },
+    { 0x1.ff7ced916872bp-1, -0x1.064670d979b73p-10 },
+    { 0x1.c000000000000p+2, 0x1.f2272ae325a57p+0 },
+    { 0x1.4f8b588e368f1p-17, -0x1.7069e2aa2aa5bp+3 },
+};
+
+static const struct reference sqrt_refs[] = {
+    { 2.0, 0x1.6a09e667f3bcdp+0 },
+    { 3.0, 0x1.bb67ae8584caap+0 },
+    { 0.5, 0x1.6a09e667f3bcdp-1 },
+    { 1e300, 1e150 },
+    { 144.0, 12.0 },
+};
+
+struct math_function {
+    const char *name;
+    double (*scalar)(double x);
+    void (*batch)(double *out, const double *in, size_t n);
+    const struct reference *refs;
+    int num_refs;
+    double low, high;           // Benchmark argument range
+};
+
+#define REFS(r) r, (int)(sizeof(r) / sizeof((r)[0]))
+
+static const struct math_function functions[] = {
+    { "exp",  exp,  vexp,  REFS(exp_refs),  -700.0, 700.0 },
+    { "log",  log,  vlog,  REFS(log_refs),  1e-300, 1e300 },
+    { "sin",  sin,  vsin,  REFS(sin_refs),  -100.0, 100.0 },
+    { "cos",  cos,  vcos,  REFS(cos_refs),  -100.0, 100.0 },
+    { "sqrt", sqrt, vsqrt, REFS(sqrt_refs), 0.0,    1e10 },
+};
+
+static double bench_in[BENCH_SIZE];
+static double bench_out[BENCH_SIZE];
+static double bench_check[BENCH_SIZE];
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static double random_between(double low, double high) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return low + (high - low) * ((double)(rng_state >> 11) * 0x1p-53);
+}
+
+// Doubles in the order of the real line as integers, so ulps are a difference
+static int64_t ordered_bits(double x) {
+    int64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits < 0 ? INT64_MIN - bits : bits;
+}
+
+static int64_t ulp_error(double got, double expected) {
+    int64_t diff = ordered_bits(got) - ordered_bits(expected);
+    return diff < 0 ? -diff : diff;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Print picoseconds per element as nanoseconds with two decimals
+static void print_per_element(uint64_t ns) {
+    uint64_t ps = ns * 1000 / ((uint64_t)BENCH_SIZE * BENCH_ROUNDS);
+    printf("%7llu.%02llu ns", (unsigned long long)(ps / 1000),
+           (unsigned long long)(ps % 1000 / 10));
+}
+
+static int run_function(const struct math_function *fn) {
+    int failed = 0;
+
+    // Accuracy against the reference values
+    int64_t worst = 0;
+    for (int i = 0; i < fn->num_refs; i++) {
+        int64_t err = ulp_error(fn->scalar(fn->refs[i].x), fn->refs[i].expected);
+        if (err > worst) {
+            worst = err;
+        }
+    }
+    if (worst > MAX_ULP_ERROR) {
+        failed = 1;
+    }
+
+    // The batch version must agree bit for bit
+    for (int i = 0; i < BENCH_SIZE; i++) {
+        bench_in[i] = random_between(fn->low, fn->high);
+    }
+    fn->batch(bench_out, bench_in, BENCH_SIZE);
+    int mismatches = 0;
+    for (int i = 0; i < BENCH_SIZE; i++) {
+        bench_check[i] = fn->scalar(bench_in[i]);
+        if (memcmp(&bench_check[i], &bench_out[i], sizeof(double)) != 0) {
+            mismatches++;
+        }
+    }
+    if (mismatches) {
+        failed = 1;
+    }
+
+    // Throughput
+    uint64_t start = now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < BENCH_SIZE; i++) {
+            bench_check[i] = fn->scalar(bench_in[i]);
+        }
+    }
+    uint64_t scalar_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        fn->batch(bench_out, bench_in, BENCH_SIZE);
+    }
+    uint64_t batch_ns = now_ns() - start;
+
+    printf("%-6s %4d ulp %10d ", fn->name, (int)worst, mismatches);
+    print_per_element(scalar_ns);
+    print_per_element(batch_ns);
+    printf("  %s\n", failed ? "FAIL" : "ok");
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+
+    printf("MiniOS math benchmark: %d elements x %d rounds\n", BENCH_SIZE, BENCH_ROUNDS);
+    printf("func      error mismatches    scalar/elt    batch/elt\n");
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        failed |= run_function(&functions[i]);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,6 +1,8 @@
 #ifndef MINIOS_MATH_H
 #define MINIOS_MATH_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -189,6 +191,15 @@ int isnan(double x);
 int isnormal(double x);
 int signbit(double x);
 
+// Batch versions: out[i] = f(in[i]) for i < n, two elements at a time in
+// NEON or SSE2 registers. Results match the scalar functions exactly, and
+// out may be the same array as in.
+void vsin(double *out, const double *in, size_t n);
+void vcos(double *out, const double *in, size_t n);
+void vexp(double *out, const double *in, size_t n);
+void vlog(double *out, const double *in, size_t n);
+void vsqrt(double *out, const double *in, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,4 +1,5 @@
 #include "../math.h"
+#include <stdint.h>
 
 // IEEE 754 double precision format helpers
 typedef union {
@@ -24,86 +25,167 @@ float fabsf(float x) {
     return (float)fabs((double)x);
 }
 
-// Power function using repeated multiplication (simplified)
-double pow(double x, double y) {
-    if (y == 0.0) return 1.0;
-    if (x == 0.0) return 0.0;
-    if (y == 1.0) return x;
-    if (y == -1.0) return 1.0 / x;
-    
-    // For integer powers, use repeated multiplication
-    if (y == (int)y) {
-        int n = (int)y;
-        double result = 1.0;
-        double base = x;
-        
-        if (n < 0) {
-            n = -n;
-            base = 1.0 / x;
-        }
-        
-        while (n > 0) {
-            if (n & 1) {
-                result *= base;
-            }
-            base *= base;
-            n >>= 1;
-        }
-        
-        return result;
+/*
+ * Transcendental functions
+ *
+ * Each function reduces its argument to a small interval and evaluates a
+ * short polynomial there, instead of summing a series until it converges:
+ *
+ *   exp    x = k*ln2/64 + r, |r| <= ln2/128; 2^(k/64) from a 64-entry
+ *          table, e^r from a degree-5 polynomial
+ *   log    x = 2^k * m, m in [sqrt(2)/2, sqrt(2)); log(m) from the
+ *          minimax polynomial in s = (m-1)/(m+1) of fdlibm
+ *   sin    x = k*pi/2 + r, |r| <= pi/4, with pi/2 split in three parts;
+ *   cos    fdlibm's degree-13/14 kernels on r
+ *
+ * Measured against correctly rounded results, exp and log stay within
+ * 1 ulp, as do sin and cos for moderate arguments (mathbench checks
+ * this); they reach 2 ulp towards 2^20 * pi/2, past which the reduction
+ * is no longer exact and accuracy falls off. tan is within 3 ulp. pow is
+ * exp(y * log(x)) outside integer exponents, so its error grows with
+ * |y * log(x)|: roughly that many ulp.
+ *
+ * The same polynomials, written as macros, back the batch functions
+ * (vsin() and friends), which work on two doubles at a time in GCC vector
+ * types: NEON on ARM64, SSE2 on x86-64.
+ */
+
+#define EXP_TABLE_SIZE  64
+#define EXP_SHIFT       0x1.8p52                // Adding it rounds to an integer
+#define EXP_INV_LN2_N   0x1.71547652b82fep+6    // 64 / ln2
+#define EXP_LN2_N_HI    0x1.62e42f0000000p-7    // ln2 / 64, 32 bits: k * hi is exact
+#define EXP_LN2_N_LO    0x1.df473de6af279p-32
+#define EXP_MAX         0x1.62e42fefa39efp+9    // Largest x with e^x finite
+#define EXP_MIN         -0x1.74910d52d3051p+9   // Smallest x with e^x nonzero
+#define EXP_FAST_LIMIT  708.0                   // Result normal: no special scaling
+
+// 2^(j/64), correctly rounded
+static const double exp_table[EXP_TABLE_SIZE] = {
+    0x1.0000000000000p+0, 0x1.02c9a3e778061p+0,
+    0x1.059b0d3158574p+0, 0x1.0874518759bc8p+0,
+    0x1.0b5586cf9890fp+0, 0x1.0e3ec32d3d1a2p+0,
+    0x1.11301d0125b51p+0, 0x1.1429aaea92de0p+0,
+    0x1.172b83c7d517bp+0, 0x1.1a35beb6fcb75p+0,
+    0x1.1d4873168b9aap+0, 0x1.2063b88628cd6p+0,
+    0x1.2387a6e756238p+0, 0x1.26b4565e27cddp+0,
+    0x1.29e9df51fdee1p+0, 0x1.2d285a6e4030bp+0,
+    0x1.306fe0a31b715p+0, 0x1.33c08b26416ffp+0,
+    0x1.371a7373aa9cbp+0, 0x1.3a7db34e59ff7p+0,
+    0x1.3dea64c123422p+0, 0x1.4160a21f72e2ap+0,
+    0x1.44e086061892dp+0, 0x1.486a2b5c13cd0p+0,
+    0x1.4bfdad5362a27p+0, 0x1.4f9b2769d2ca7p+0,
+    0x1.5342b569d4f82p+0, 0x1.56f4736b527dap+0,
+    0x1.5ab07dd485429p+0, 0x1.5e76f15ad2148p+0,
+    0x1.6247eb03a5585p+0, 0x1.6623882552225p+0,
+    0x1.6a09e667f3bcdp+0, 0x1.6dfb23c651a2fp+0,
+    0x1.71f75e8ec5f74p+0, 0x1.75feb564267c9p+0,
+    0x1.7a11473eb0187p+0, 0x1.7e2f336cf4e62p+0,
+    0x1.82589994cce13p+0, 0x1.868d99b4492edp+0,
+    0x1.8ace5422aa0dbp+0, 0x1.8f1ae99157736p+0,
+    0x1.93737b0cdc5e5p+0, 0x1.97d829fde4e50p+0,
+    0x1.9c49182a3f090p+0, 0x1.a0c667b5de565p+0,
+    0x1.a5503b23e255dp+0, 0x1.a9e6b5579fdbfp+0,
+    0x1.ae89f995ad3adp+0, 0x1.b33a2b84f15fbp+0,
+    0x1.b7f76f2fb5e47p+0, 0x1.bcc1e904bc1d2p+0,
+    0x1.c199bdd85529cp+0, 0x1.c67f12e57d14bp+0,
+    0x1.cb720dcef9069p+0, 0x1.d072d4a07897cp+0,
+    0x1.d5818dcfba487p+0, 0x1.da9e603db3285p+0,
+    0x1.dfc97337b9b5fp+0, 0x1.e502ee78b3ff6p+0,
+    0x1.ea4afa2a490dap+0, 0x1.efa1bee615a27p+0,
+    0x1.f50765b6e4540p+0, 0x1.fa7c1819e90d8p+0,
+};
+
+// e^r - 1 for |r| <= ln2/128 (Taylor, error below 2^-54)
+#define EXP_POLY(r) ((r) + (r) * (r) * (0.5 + (r) * (1.0 / 6 + (r) * (1.0 / 24 + (r) * (1.0 / 120)))))
+
+#define LOG_LN2_HI      6.93147180369123816490e-01
+#define LOG_LN2_LO      1.90821492927058770002e-10
+#define LOG_LG1         6.666666666666735130e-01
+#define LOG_LG2         3.999999999940941908e-01
+#define LOG_LG3         2.857142874366239149e-01
+#define LOG_LG4         2.222219843214978396e-01
+#define LOG_LG5         1.818357216161805012e-01
+#define LOG_LG6         1.531383769920937332e-01
+#define LOG_LG7         1.479819860511658591e-01
+#define LOG_SQRT2       0x1.6a09e667f3bcdp+0
+
+// log(1 + f) = f - hfsq + s * (hfsq + LOG_POLY(s * s)), hfsq = f * f / 2 and
+// s = f / (2 + f): fdlibm's e_log.c, with the polynomial split in two
+// halves in z = s * s and w = z * z
+#define LOG_POLY(z, w) \
+    ((z) * (LOG_LG1 + (w) * (LOG_LG3 + (w) * (LOG_LG5 + (w) * LOG_LG7))) + \
+     (w) * (LOG_LG2 + (w) * (LOG_LG4 + (w) * LOG_LG6)))
+
+#define TRIG_INV_PIO2   6.36619772367581382433e-01
+#define TRIG_PIO2_1     1.57079632673412561417e+00  // First 33 bits of pi/2
+#define TRIG_PIO2_2     6.07710050630396597660e-11  // Next 33 bits
+#define TRIG_PIO2_2T    2.02226624879595063154e-21  // pi/2 - PIO2_1 - PIO2_2
+#define TRIG_EXACT_MAX  0x1.921fb54442d18p+20       // 2^20 * pi/2
+#define TRIG_PIO4       0x1.921fb54442d18p-1
+
+#define SIN_S1 -1.66666666666666324348e-01
+#define SIN_S2  8.33333333332248946124e-03
+#define SIN_S3 -1.98412698298579493134e-04
+#define SIN_S4  2.75573137070700676789e-06
+#define SIN_S5 -2.50507602534068634195e-08
+#define SIN_S6  1.58969099521155010221e-10
+
+#define COS_C1  4.16666666666666019037e-02
+#define COS_C2 -1.38888888888741095749e-03
+#define COS_C3  2.48015872894767294178e-05
+#define COS_C4 -2.75573143513906633035e-07
+#define COS_C5  2.08757232129817482790e-09
+#define COS_C6 -1.13596475577881948265e-11
+
+// sin(r) and cos(r) for |r| <= pi/4, z = r * r
+#define SIN_KERNEL(r, z) \
+    ((r) + (r) * (z) * (SIN_S1 + (z) * (SIN_S2 + (z) * (SIN_S3 + (z) * (SIN_S4 + (z) * (SIN_S5 + (z) * SIN_S6))))))
+#define COS_POLY(z) \
+    ((z) * (z) * (COS_C1 + (z) * (COS_C2 + (z) * (COS_C3 + (z) * (COS_C4 + (z) * (COS_C5 + (z) * COS_C6))))))
+
+static inline uint64_t _double_bits(double x) {
+    union { double d; uint64_t u; } v = { .d = x };
+    return v.u;
+}
+
+static inline double _bits_double(uint64_t u) {
+    union { double d; uint64_t u; } v = { .u = u };
+    return v.d;
+}
+
+static inline double _cos_kernel(double z) {
+    // 1 - z/2 with the rounding error of the subtraction carried along
+    double hz = 0.5 * z;
+    double w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + COS_POLY(z));
+}
+
+// x = k * pi/2 + *r; returns k
+static int64_t _rem_pio2(double x, double *r) {
+    if (fabs(x) <= TRIG_PIO4) {
+        *r = x;
+        return 0;
     }
-    
-    // For non-integer powers, return simplified approximation
-    return x;  // Placeholder - would need proper exp/log implementation
+    double kd = (x * TRIG_INV_PIO2 + EXP_SHIFT) - EXP_SHIFT;
+    *r = ((x - kd * TRIG_PIO2_1) - kd * TRIG_PIO2_2) - kd * TRIG_PIO2_2T;
+    return (int64_t)kd;
 }
 
-float powf(float x, float y) {
-    return (float)pow((double)x, (double)y);
-}
-
-// Square root using Newton's method
-double sqrt(double x) {
-    if (x < 0.0) return x;  // NaN for negative input
-    if (x == 0.0) return 0.0;
-    
-    double guess = x;
-    double prev_guess;
-    
-    // Newton's method: x_{n+1} = (x_n + a/x_n) / 2
-    for (int i = 0; i < 20; i++) {
-        prev_guess = guess;
-        guess = (guess + x / guess) * 0.5;
-        
-        // Check for convergence
-        if (fabs(guess - prev_guess) < 1e-15) {
-            break;
-        }
+// sin(x) for quadrant offset 0, cos(x) for 1
+static double _sincos(double x, int offset) {
+    if (x != x || fabs(x) == __builtin_inf()) {
+        return x - x;  // NaN
     }
-    
-    return guess;
-}
 
-float sqrtf(float x) {
-    return (float)sqrt((double)x);
+    double r;
+    int64_t q = _rem_pio2(x, &r) + offset;
+    double z = r * r;
+    double v = (q & 1) ? _cos_kernel(z) : SIN_KERNEL(r, z);
+    return (q & 2) ? -v : v;
 }
 
-// Trigonometric functions (simplified Taylor series)
 double sin(double x) {
-    // Normalize x to [-pi, pi]
-    while (x > M_PI) x -= 2 * M_PI;
-    while (x < -M_PI) x += 2 * M_PI;
-    
-    // Taylor series: sin(x) = x - x³/3! + x⁵/5! - x⁷/7! + ...
-    double result = 0.0;
-    double term = x;
-    double x_squared = x * x;
-    
-    for (int i = 1; i <= 15; i += 2) {
-        result += term;
-        term *= -x_squared / ((i + 1) * (i + 2));
-    }
-    
-    return result;
+    return _sincos(x, 0);
 }
 
 float sinf(float x) {
@@ -111,8 +193,7 @@ float sinf(float x) {
 }
 
 double cos(double x) {
-    // cos(x) = sin(x + π/2)
-    return sin(x + M_PI_2);
+    return _sincos(x, 1);
 }
 
 float cosf(float x) {
@@ -120,64 +201,106 @@ float cosf(float x) {
 }
 
 double tan(double x) {
-    double c = cos(x);
-    if (fabs(c) < 1e-15) return 1.0 / 0.0;  // Infinity
-    return sin(x) / c;
+    if (x != x || fabs(x) == __builtin_inf()) {
+        return x - x;
+    }
+
+    double r;
+    int64_t q = _rem_pio2(x, &r);
+    double z = r * r;
+    double s = SIN_KERNEL(r, z);
+    double c = _cos_kernel(z);
+    return (q & 1) ? -c / s : s / c;
 }
 
 float tanf(float x) {
     return (float)tan((double)x);
 }
 
-// Exponential function (simplified)
+// 2^(k/64) * (1 + p), for k from the EXP_SHIFT rounding and p = e^r - 1
+static double _exp_finish(int64_t k, double p) {
+    double tj = exp_table[k & (EXP_TABLE_SIZE - 1)];
+    int64_t e = (k - (k & (EXP_TABLE_SIZE - 1))) / EXP_TABLE_SIZE;
+    double y = tj + tj * p;
+
+    if (e >= -1021) {
+        return _bits_double(_double_bits(y) + ((uint64_t)e << 52));
+    }
+    // Subnormal result: scale in two steps so only the last one rounds
+    return _bits_double(_double_bits(y) + ((uint64_t)(e + 1000) << 52)) * 0x1p-1000;
+}
+
 double exp(double x) {
-    if (x == 0.0) return 1.0;
-    
-    // Taylor series: e^x = 1 + x + x²/2! + x³/3! + ...
-    double result = 1.0;
-    double term = 1.0;
-    
-    for (int i = 1; i <= 20; i++) {
-        term *= x / i;
-        result += term;
-        
-        if (fabs(term) < 1e-15) break;
+    if (!(x <= EXP_MAX)) {
+        return x + x;  // +Inf for overflow or +Inf, NaN for NaN
     }
-    
-    return result;
+    if (x < EXP_MIN) {
+        return 0.0;
+    }
+
+    double t = x * EXP_INV_LN2_N + EXP_SHIFT;
+    double kd = t - EXP_SHIFT;
+    int64_t k = (int64_t)(_double_bits(t) - _double_bits(EXP_SHIFT));
+    double r = x - kd * EXP_LN2_N_HI - kd * EXP_LN2_N_LO;
+    return _exp_finish(k, EXP_POLY(r));
 }
 
 float expf(float x) {
     return (float)exp((double)x);
 }
 
-// Natural logarithm (simplified)
+double exp2(double x) {
+    if (!(x < 1024.0)) {
+        return x + x;
+    }
+    if (x < -1075.0) {
+        return 0.0;
+    }
+
+    double t = x * EXP_TABLE_SIZE + EXP_SHIFT;
+    double kd = t - EXP_SHIFT;
+    int64_t k = (int64_t)(_double_bits(t) - _double_bits(EXP_SHIFT));
+    double r = (x - kd * (1.0 / EXP_TABLE_SIZE)) * M_LN2;  // The subtraction is exact
+    return _exp_finish(k, EXP_POLY(r));
+}
+
+float exp2f(float x) {
+    return (float)exp2((double)x);
+}
+
 double log(double x) {
-    if (x <= 0.0) return -1.0 / 0.0;  // -Infinity or NaN
-    if (x == 1.0) return 0.0;
-    
-    // Use the identity: ln(x) = 2 * atanh((x-1)/(x+1)) for x > 0
-    // Simplified implementation
-    if (x < 1.0) {
-        return -log(1.0 / x);
+    uint64_t bits = _double_bits(x);
+
+    if (x != x || x == __builtin_inf()) {
+        return x + x;
     }
-    
-    // For x close to 1, use Taylor series of ln(1+u) where u = x-1
-    double u = x - 1.0;
-    if (fabs(u) < 0.5) {
-        double result = 0.0;
-        double term = u;
-        
-        for (int i = 1; i <= 20; i++) {
-            result += term / i;
-            term *= -u;
-        }
-        
-        return result;
+    if (x == 0.0) {
+        return -__builtin_inf();
     }
-    
-    // For larger x, use a different approximation
-    return 0.693147 * (x - 1.0);  // Very rough approximation
+    if (x < 0.0) {
+        return __builtin_nan("");
+    }
+
+    int k = 0;
+    if (bits < 0x0010000000000000ULL) {
+        // Subnormal: bring it into the normal range first
+        bits = _double_bits(x * 0x1p54);
+        k = -54;
+    }
+    k += (int)(bits >> 52) - 1023;
+
+    // m = 1 + f in [sqrt(2)/2, sqrt(2))
+    double m = _bits_double((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    if (m >= LOG_SQRT2) {
+        m *= 0.5;
+        k++;
+    }
+    double f = m - 1.0;
+    double s = f / (2.0 + f);
+    double z = s * s;
+    double hfsq = 0.5 * f * f;
+    double dk = (double)k;
+    return dk * LOG_LN2_HI - ((hfsq - (s * (hfsq + LOG_POLY(z, z * z)) + dk * LOG_LN2_LO)) - f);
 }
 
 float logf(float x) {
@@ -185,13 +308,248 @@ float logf(float x) {
 }
 
 double log10(double x) {
-    return log(x) / M_LN10;
+    return log(x) * M_LOG10E;
 }
 
 float log10f(float x) {
     return (float)log10((double)x);
 }
 
+double log2(double x) {
+    return log(x) * M_LOG2E;
+}
+
+float log2f(float x) {
+    return (float)log2((double)x);
+}
+
+double pow(double x, double y) {
+    if (y == 0.0 || x == 1.0) return 1.0;
+    if (x != x || y != y) return x + y;
+    
+    // Integer exponents by repeated squaring: exact for small results
+    if (fabs(y) < 0x1p31 && y == (double)(int)y) {
+        int n = (int)y;
+        unsigned int m = n < 0 ? 0u - (unsigned int)n : (unsigned int)n;
+        double result = 1.0;
+        double base = x;
+        
+        while (m > 0) {
+            if (m & 1) {
+                result *= base;
+            }
+            base *= base;
+            m >>= 1;
+        }
+        
+        return n < 0 ? 1.0 / result : result;
+    }
+    
+    if (x == 0.0) return y > 0 ? 0.0 : __builtin_inf();
+    if (x < 0.0) {
+        // Infinite y counts as an even integer; anything else has no real result
+        if (fabs(y) == __builtin_inf()) return pow(-x, y);
+        return __builtin_nan("");
+    }
+    
+    return exp(y * log(x));
+}
+
+float powf(float x, float y) {
+    return (float)pow((double)x, (double)y);
+}
+
+// Square root: one instruction on both architectures
+double sqrt(double x) {
+    double result;
+#if defined(__aarch64__)
+    __asm__("fsqrt %d0, %d1" : "=w"(result) : "w"(x));
+#elif defined(__x86_64__)
+    __asm__("sqrtsd %1, %0" : "=x"(result) : "x"(x));
+#else
+    if (x < 0.0) return __builtin_nan("");
+    if (x == 0.0 || x != x || x == __builtin_inf()) return x;
+    result = x;
+    for (int i = 0; i < 64; i++) {
+        double next = 0.5 * (result + x / result);
+        if (next == result) break;
+        result = next;
+    }
+#endif
+    return result;
+}
+
+float sqrtf(float x) {
+    float result;
+#if defined(__aarch64__)
+    __asm__("fsqrt %s0, %s1" : "=w"(result) : "w"(x));
+#elif defined(__x86_64__)
+    __asm__("sqrtss %1, %0" : "=x"(result) : "x"(x));
+#else
+    result = (float)sqrt((double)x);
+#endif
+    return result;
+}
+
+/*
+ * Batch functions
+ *
+ * Pairs of doubles go through the same polynomials as the scalar
+ * functions in 128-bit vectors, so a batch result is bit-for-bit what the
+ * scalar call returns. A pair with an argument outside the common range
+ * (special values, huge trig arguments, subnormal results) takes the
+ * scalar path instead, as does an odd last element.
+ */
+
+typedef double v2df __attribute__((vector_size(16)));
+typedef int64_t v2di __attribute__((vector_size(16)));
+typedef uint64_t v2du __attribute__((vector_size(16)));
+
+static inline v2df _v2df_load(const double *p) {
+    return (v2df){ p[0], p[1] };
+}
+
+static inline void _v2df_store(double *p, v2df v) {
+    p[0] = v[0];
+    p[1] = v[1];
+}
+
+static inline v2df _v2df_splat(double x) {
+    return (v2df){ x, x };
+}
+
+static inline v2df _vexp_pair(v2df x) {
+    v2df shift = _v2df_splat(EXP_SHIFT);
+    v2df t = x * EXP_INV_LN2_N + shift;
+    v2df kd = t - shift;
+    v2di k = (v2di)t - (v2di)shift;
+    v2df r = x - kd * EXP_LN2_N_HI - kd * EXP_LN2_N_LO;
+    v2df p = EXP_POLY(r);
+
+    v2di j = k & (EXP_TABLE_SIZE - 1);
+    v2df tj = { exp_table[j[0]], exp_table[j[1]] };
+    v2df y = tj + tj * p;
+
+    // k - j is a multiple of 64: shifting it by 46 puts k / 64 in the exponent
+    return (v2df)((v2di)y + ((k - j) << 46));
+}
+
+void vexp(double *out, const double *in, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        v2df x = _v2df_load(in + i);
+        if (fabs(x[0]) <= EXP_FAST_LIMIT && fabs(x[1]) <= EXP_FAST_LIMIT) {
+            _v2df_store(out + i, _vexp_pair(x));
+        } else {
+            out[i] = exp(x[0]);
+            out[i + 1] = exp(x[1]);
+        }
+    }
+    for (; i < n; i++) {
+        out[i] = exp(in[i]);
+    }
+}
+
+static inline v2df _vlog_pair(v2df x) {
+    v2du bits = (v2du)x;
+
+    // The exponent field as a double, without a 64-bit integer conversion
+    v2df dk = (v2df)((bits >> 52) | 0x4330000000000000ULL) - 0x1p52 - 1023.0;
+    v2df m = (v2df)((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+
+    // Lanes at or above sqrt(2): halve m and count one more power of two
+    v2di big = m >= LOG_SQRT2;
+    v2df f = (v2df)((v2di)m ^ (big & 0x0010000000000000LL)) - 1.0;
+    dk += (v2df)(big & (v2di)_v2df_splat(1.0));
+
+    v2df s = f / (2.0 + f);
+    v2df z = s * s;
+    v2df hfsq = 0.5 * f * f;
+    return dk * LOG_LN2_HI - ((hfsq - (s * (hfsq + LOG_POLY(z, z * z)) + dk * LOG_LN2_LO)) - f);
+}
+
+void vlog(double *out, const double *in, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        v2df x = _v2df_load(in + i);
+        // Positive, normal and finite: the exponent field alone tells
+        uint64_t b0 = _double_bits(x[0]), b1 = _double_bits(x[1]);
+        if (b0 - 0x0010000000000000ULL < 0x7fe0000000000000ULL &&
+            b1 - 0x0010000000000000ULL < 0x7fe0000000000000ULL) {
+            _v2df_store(out + i, _vlog_pair(x));
+        } else {
+            out[i] = log(x[0]);
+            out[i + 1] = log(x[1]);
+        }
+    }
+    for (; i < n; i++) {
+        out[i] = log(in[i]);
+    }
+}
+
+// Pair version of _sincos() for |x| < TRIG_EXACT_MAX
+static inline v2df _vsincos_pair(v2df x, int64_t offset) {
+    v2df shift = _v2df_splat(EXP_SHIFT);
+    v2df t = x * TRIG_INV_PIO2 + shift;
+    v2df kd = t - shift;
+    v2di q = ((v2di)t - (v2di)shift) + offset;
+    v2df r = ((x - kd * TRIG_PIO2_1) - kd * TRIG_PIO2_2) - kd * TRIG_PIO2_2T;
+
+    // The scalar path skips reduction below pi/4, where r == x anyway
+    v2df z = r * r;
+    v2df s = SIN_KERNEL(r, z);
+    v2df hz = 0.5 * z;
+    v2df w = 1.0 - hz;
+    v2df c = w + (((1.0 - w) - hz) + COS_POLY(z));
+
+    v2di odd = -(q & 1);
+    v2di v = ((v2di)s & ~odd) | ((v2di)c & odd);
+    return (v2df)(v ^ ((q & 2) << 62));
+}
+
+static void _vsincos(double *out, const double *in, size_t n, int offset) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        v2df x = _v2df_load(in + i);
+        if (fabs(x[0]) < TRIG_EXACT_MAX && fabs(x[1]) < TRIG_EXACT_MAX) {
+            _v2df_store(out + i, _vsincos_pair(x, offset));
+        } else {
+            out[i] = _sincos(x[0], offset);
+            out[i + 1] = _sincos(x[1], offset);
+        }
+    }
+    for (; i < n; i++) {
+        out[i] = _sincos(in[i], offset);
+    }
+}
+
+void vsin(double *out, const double *in, size_t n) {
+    _vsincos(out, in, n, 0);
+}
+
+void vcos(double *out, const double *in, size_t n) {
+    _vsincos(out, in, n, 1);
+}
+
+void vsqrt(double *out, const double *in, size_t n) {
+    size_t i = 0;
+#if defined(__aarch64__) || defined(__x86_64__)
+    for (; i + 2 <= n; i += 2) {
+        v2df x = _v2df_load(in + i);
+        v2df result;
+#if defined(__aarch64__)
+        __asm__("fsqrt %0.2d, %1.2d" : "=w"(result) : "w"(x));
+#else
+        __asm__("sqrtpd %1, %0" : "=x"(result) : "x"(x));
+#endif
+        _v2df_store(out + i, result);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = sqrt(in[i]);
+    }
+}
+
 // Rounding functions
 double floor(double x) {
     if (x >= 0) {
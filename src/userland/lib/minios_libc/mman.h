@@ -0,0 +1,22 @@
+#ifndef MINIOS_MMAN_H
+#define MINIOS_MMAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mmap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAP_FAILED ((void *)-1)
+
+// Memory mappings: file pages come straight from the kernel's page cache
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+int munmap(void *addr, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MINIOS_MMAN_H */
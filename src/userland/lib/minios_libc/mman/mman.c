@@ -0,0 +1,24 @@
+/*
+ * Memory Mappings
+ *
+ * Thin wrappers over SYSCALL_MMAP/SYSCALL_MUNMAP. Negative results are
+ * kernel error codes; mmap() reports them as MAP_FAILED.
+ */
+
+#include "../mman.h"
+
+// System call interface
+extern long sys_mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+extern long sys_munmap(void *addr, size_t length);
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset) {
+    long result = sys_mmap(addr, length, prot, flags, fd, offset);
+    if (result < 0) {
+        return MAP_FAILED;
+    }
+    return (void *)result;
+}
+
+int munmap(void *addr, size_t length) {
+    return sys_munmap(addr, length) < 0 ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef MINIOS_PTHREAD_H
+#define MINIOS_PTHREAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Threads: tasks sharing the program's memory, started by the kernel
+struct pthread;
+typedef struct pthread *pthread_t;
+
+// 0 unlocked, 1 locked, 2 locked with sleepers
+typedef struct {
+    uint32_t state;
+} pthread_mutex_t;
+
+typedef struct {
+    uint32_t seq;               // Bumped by every signal and broadcast
+    uint32_t waiters;
+} pthread_cond_t;
+
+#define PTHREAD_MUTEX_INITIALIZER   { 0 }
+#define PTHREAD_COND_INITIALIZER    { 0, 0 }
+
+// All return 0 on success and -1 on failure. Attributes are not
+// supported and must be NULL.
+
+// Thread management
+int pthread_create(pthread_t *thread, const void *attr,
+                   void *(*start)(void *), void *arg);
+int pthread_join(pthread_t thread, void **result);
+
+// Mutexes: taken and released without a trap unless another thread waits
+int pthread_mutex_init(pthread_mutex_t *mutex, const void *attr);
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+// Condition variables: signal with the mutex held
+int pthread_cond_init(pthread_cond_t *cond, const void *attr);
+int pthread_cond_destroy(pthread_cond_t *cond);
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MINIOS_PTHREAD_H */
@@ -0,0 +1,192 @@
+/*
+ * Threads and Synchronization
+ *
+ * A thread is a kernel task started with SYSCALL_THREAD_CREATE in the
+ * program's address space. Its record lives on the heap; the thread
+ * stores its result there and marks itself done, and pthread_join()
+ * sleeps on that word with a futex until it does.
+ *
+ * Mutexes are a futex word, after Drepper's "Futexes Are Tricky": 0
+ * unlocked, 1 locked, 2 locked with possible sleepers. Locking is one
+ * compare-and-swap and unlocking one atomic decrement, so only a thread
+ * that finds the lock held traps, and only after spinning briefly in case
+ * the holder is about to let go on another CPU. Condition variables sleep
+ * on a sequence number that every signal bumps, so a signal between
+ * releasing the mutex and sleeping is never lost.
+ */
+
+#include "../pthread.h"
+#include "../stdlib.h"
+#include "futex.h"
+
+#define PTHREAD_SPIN            100     // Tries before sleeping on a held mutex
+
+#define MUTEX_UNLOCKED          0
+#define MUTEX_LOCKED            1
+#define MUTEX_CONTENDED         2
+
+struct pthread {
+    void *(*start)(void *);
+    void *arg;
+    void *result;
+    uint32_t done;              // Futex: set once result is stored
+};
+
+// System call interface
+extern long sys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t timeout_us);
+extern long sys_thread_create(void (*entry)(void *), void *arg);
+extern void sys_exit(int status);
+
+static inline void pthread_relax(void) {
+#if defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#elif defined(__x86_64__)
+    __asm__ volatile("pause" ::: "memory");
+#endif
+}
+
+static void pthread_entry(void *arg) {
+    struct pthread *thread = arg;
+    thread->result = thread->start(thread->arg);
+
+    // The joiner may free the record as soon as it sees done
+    __atomic_store_n(&thread->done, 1, __ATOMIC_RELEASE);
+    sys_futex(&thread->done, FUTEX_WAKE, 1, 0);
+    sys_exit(0);
+}
+
+int pthread_create(pthread_t *thread, const void *attr,
+                   void *(*start)(void *), void *arg) {
+    if (!thread || attr || !start) {
+        return -1;
+    }
+
+    struct pthread *t = malloc(sizeof(struct pthread));
+    if (!t) {
+        return -1;
+    }
+    t->start = start;
+    t->arg = arg;
+    t->result = NULL;
+    t->done = 0;
+
+    if (sys_thread_create(pthread_entry, t) < 0) {
+        free(t);
+        return -1;
+    }
+    *thread = t;
+    return 0;
+}
+
+int pthread_join(pthread_t thread, void **result) {
+    if (!thread) {
+        return -1;
+    }
+
+    while (!__atomic_load_n(&thread->done, __ATOMIC_ACQUIRE)) {
+        sys_futex(&thread->done, FUTEX_WAIT, 0, 0);
+    }
+    if (result) {
+        *result = thread->result;
+    }
+    free(thread);
+    return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const void *attr) {
+    if (!mutex || attr) {
+        return -1;
+    }
+    mutex->state = MUTEX_UNLOCKED;
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+    return mutex && mutex->state == MUTEX_UNLOCKED ? 0 : -1;
+}
+
+static inline int mutex_try(pthread_mutex_t *mutex) {
+    uint32_t expected = MUTEX_UNLOCKED;
+    return __atomic_compare_exchange_n(&mutex->state, &expected, MUTEX_LOCKED, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    if (mutex_try(mutex)) {
+        return 0;
+    }
+
+    for (int i = 0; i < PTHREAD_SPIN; i++) {
+        pthread_relax();
+        if (__atomic_load_n(&mutex->state, __ATOMIC_RELAXED) == MUTEX_UNLOCKED &&
+            mutex_try(mutex)) {
+            return 0;
+        }
+    }
+
+    // Mark it contended so the holder wakes someone, and sleep until free
+    while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) !=
+           MUTEX_UNLOCKED) {
+        sys_futex(&mutex->state, FUTEX_WAIT, MUTEX_CONTENDED, 0);
+    }
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+    return mutex_try(mutex) ? 0 : -1;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+    if (__atomic_fetch_sub(&mutex->state, 1, __ATOMIC_RELEASE) != MUTEX_LOCKED) {
+        __atomic_store_n(&mutex->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE);
+        sys_futex(&mutex->state, FUTEX_WAKE, 1, 0);
+    }
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const void *attr) {
+    if (!cond || attr) {
+        return -1;
+    }
+    cond->seq = 0;
+    cond->waiters = 0;
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond) {
+    return cond && cond->waiters == 0 ? 0 : -1;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    // Both under the mutex, so a signaller holding it sees this waiter
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(mutex);
+    sys_futex(&cond->seq, FUTEX_WAIT, seq, 0);
+
+    // Others may have been woken too: take the mutex as contended, so its
+    // release wakes the next of them
+    while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) !=
+           MUTEX_UNLOCKED) {
+        sys_futex(&mutex->state, FUTEX_WAIT, MUTEX_CONTENDED, 0);
+    }
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST)) {
+        sys_futex(&cond->seq, FUTEX_WAKE, 1, 0);
+    }
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST)) {
+        sys_futex(&cond->seq, FUTEX_WAKE, UINT32_MAX, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef MINIOS_RING_H
+#define MINIOS_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "io_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Program's view of the kernel's batched I/O rings (io_ring.h)
+struct ring {
+    struct io_ring *shared;     // Header shared with the kernel
+    struct io_ring_sqe *sqes;
+    struct io_ring_cqe *cqes;
+    uint32_t mask;
+    uint32_t sq_queued;         // Entries filled since the last submit
+};
+
+// Ring management
+int ring_init(struct ring *ring, unsigned entries);
+void ring_exit(struct ring *ring);
+
+// Submission: fill entries from ring_get_sqe(), then trap once to run them
+struct io_ring_sqe *ring_get_sqe(struct ring *ring);
+int ring_submit(struct ring *ring);
+
+// Completion polling
+struct io_ring_cqe *ring_peek_cqe(struct ring *ring);
+void ring_cqe_seen(struct ring *ring);
+
+// Entry preparation
+void ring_prep_open(struct io_ring_sqe *sqe, const char *path, int flags, int mode);
+void ring_prep_read(struct io_ring_sqe *sqe, int fd, void *buf, size_t len);
+void ring_prep_write(struct io_ring_sqe *sqe, int fd, const void *buf, size_t len);
+void ring_prep_close(struct io_ring_sqe *sqe, int fd);
+void ring_prep_stat(struct io_ring_sqe *sqe, const char *path, struct io_ring_stat *st);
+void ring_prep_readdir(struct io_ring_sqe *sqe, int fd, struct io_ring_dirent *entries, size_t count);
+void ring_prep_readdir_plus(struct io_ring_sqe *sqe, int fd, struct io_ring_dirent_plus *entries,
+                            size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MINIOS_RING_H */
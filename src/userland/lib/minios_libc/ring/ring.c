@@ -0,0 +1,131 @@
+/*
+ * Batched I/O
+ *
+ * Wrappers over the kernel's submission/completion rings: entries are
+ * queued in the shared area without any trap, ring_submit() hands them
+ * all to the kernel in one, and completions are polled from memory.
+ * Setting IO_RING_SQE_FD_PREV or IO_RING_SQE_LEN_PREV on an entry chains
+ * it to the one before, e.g. open -> read (fd) -> write (len) -> close.
+ */
+
+#include "../ring.h"
+#include "../string.h"
+
+// System call interface
+extern long sys_io_ring_setup(unsigned entries);
+extern long sys_io_ring_enter(unsigned to_submit);
+extern long sys_io_ring_destroy(void);
+
+int ring_init(struct ring *ring, unsigned entries) {
+    if (!ring) {
+        return -1;
+    }
+    
+    long result = sys_io_ring_setup(entries);
+    if (result <= 0) {
+        return -1;
+    }
+    
+    struct io_ring *shared = (struct io_ring *)result;
+    ring->shared = shared;
+    ring->sqes = (struct io_ring_sqe *)((uint8_t *)shared + shared->sqe_offset);
+    ring->cqes = (struct io_ring_cqe *)((uint8_t *)shared + shared->cqe_offset);
+    ring->mask = shared->mask;
+    ring->sq_queued = 0;
+    return 0;
+}
+
+void ring_exit(struct ring *ring) {
+    if (ring && ring->shared) {
+        sys_io_ring_destroy();
+        ring->shared = NULL;
+    }
+}
+
+// Next free submission entry, cleared; NULL if the queue is full
+struct io_ring_sqe *ring_get_sqe(struct ring *ring) {
+    struct io_ring *shared = ring->shared;
+    uint32_t head = __atomic_load_n(&shared->sq_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = shared->sq_tail + ring->sq_queued;
+    
+    if (tail - head > ring->mask) {
+        return NULL;
+    }
+    
+    struct io_ring_sqe *sqe = &ring->sqes[tail & ring->mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_queued++;
+    return sqe;
+}
+
+// Publish the queued entries and run them; returns how many the kernel took
+int ring_submit(struct ring *ring) {
+    struct io_ring *shared = ring->shared;
+    uint32_t queued = ring->sq_queued;
+    
+    __atomic_store_n(&shared->sq_tail, shared->sq_tail + queued, __ATOMIC_RELEASE);
+    ring->sq_queued = 0;
+    return (int)sys_io_ring_enter(0);
+}
+
+struct io_ring_cqe *ring_peek_cqe(struct ring *ring) {
+    struct io_ring *shared = ring->shared;
+    uint32_t head = shared->cq_head;
+    
+    if (head == __atomic_load_n(&shared->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->mask];
+}
+
+void ring_cqe_seen(struct ring *ring) {
+    struct io_ring *shared = ring->shared;
+    __atomic_store_n(&shared->cq_head, shared->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void ring_prep_open(struct io_ring_sqe *sqe, const char *path, int flags, int mode) {
+    sqe->opcode = IO_RING_OP_OPEN;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->op_flags = (uint32_t)flags;
+    sqe->len = (uint32_t)mode;
+}
+
+void ring_prep_read(struct io_ring_sqe *sqe, int fd, void *buf, size_t len) {
+    sqe->opcode = IO_RING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+}
+
+void ring_prep_write(struct io_ring_sqe *sqe, int fd, const void *buf, size_t len) {
+    sqe->opcode = IO_RING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+}
+
+void ring_prep_close(struct io_ring_sqe *sqe, int fd) {
+    sqe->opcode = IO_RING_OP_CLOSE;
+    sqe->fd = fd;
+}
+
+void ring_prep_stat(struct io_ring_sqe *sqe, const char *path, struct io_ring_stat *st) {
+    sqe->opcode = IO_RING_OP_STAT;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->addr2 = (uint64_t)(uintptr_t)st;
+}
+
+void ring_prep_readdir(struct io_ring_sqe *sqe, int fd, struct io_ring_dirent *entries, size_t count) {
+    sqe->opcode = IO_RING_OP_READDIR;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)entries;
+    sqe->len = (uint32_t)count;
+}
+
+void ring_prep_readdir_plus(struct io_ring_sqe *sqe, int fd, struct io_ring_dirent_plus *entries,
+                            size_t count) {
+    sqe->opcode = IO_RING_OP_READDIR_PLUS;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)entries;
+    sqe->len = (uint32_t)count;
+}
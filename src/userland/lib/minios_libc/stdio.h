@@ -13,7 +13,9 @@ typedef long long fpos_t;       // File position type
 typedef long ssize_t;           // Signed size type
 typedef long off_t;             // File offset type
 
-// File handle structure
+// File handle structure. The buffer holds either output not yet written
+// (buffer_pos bytes) or input not yet consumed (buffer_pos..buffer_end),
+// never both; io_dir says which.
 typedef struct {
     int fd;                     // File descriptor
     int flags;                  // File flags
@@ -21,6 +23,12 @@ typedef struct {
     char *buffer;               // Internal buffer
     size_t buffer_size;         // Buffer size
     size_t buffer_pos;          // Current position in buffer
+    size_t buffer_end;          // End of buffered input
+    int buf_mode;               // _IOFBF, _IOLBF or _IONBF
+    int buf_owned;              // Buffer was malloc'd by the library
+    int io_dir;                 // 0 idle, 1 reading, 2 writing
+    int eof;                    // End of file seen
+    int unget;                  // ungetc() character, EOF if none
 } FILE;
 
 // Standard streams
@@ -32,6 +40,7 @@ extern FILE *stderr;
 #define EOF         (-1)
 #define BUFSIZ      1024
 #define FILENAME_MAX 256
+#define FOPEN_MAX   16          // Streams open at once besides the standard three
 
 // File modes
 #define _IOFBF      0           // Full buffering
@@ -42,6 +51,8 @@ extern FILE *stderr;
 #define SEEK_SET    0           // Seek from beginning
 #define SEEK_CUR    1           // Seek from current position
 #define SEEK_END    2           // Seek from end
+#define SEEK_DATA   3           // Seek to the next data at or after offset
+#define SEEK_HOLE   4           // Seek to the next hole at or after offset
 
 // File operations
 FILE *fopen(const char *filename, const char *mode);
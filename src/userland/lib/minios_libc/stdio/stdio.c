@@ -10,15 +10,26 @@ extern ssize_t sys_read(int fd, void *buffer, size_t count);
 extern ssize_t sys_write(int fd, const void *buffer, size_t count);
 extern int sys_lseek(int fd, off_t offset, int whence);
 
-// Standard streams (initialized by runtime)
-static FILE _stdin = {0, 0, 0, NULL, 0, 0};
-static FILE _stdout = {1, 0, 0, NULL, 0, 0};
-static FILE _stderr = {2, 0, 0, NULL, 0, 0};
+#define IO_IDLE     0
+#define IO_READ     1
+#define IO_WRITE    2
+
+// Standard streams (initialized by runtime). stdout is line buffered, as
+// for a terminal; stderr is unbuffered so errors appear at once.
+static char _stdin_buf[BUFSIZ];
+static char _stdout_buf[BUFSIZ];
+
+static FILE _stdin = {0, 0, 0, _stdin_buf, BUFSIZ, 0, 0, _IOFBF, 0, IO_IDLE, 0, EOF};
+static FILE _stdout = {1, 0, 0, _stdout_buf, BUFSIZ, 0, 0, _IOLBF, 0, IO_IDLE, 0, EOF};
+static FILE _stderr = {2, 0, 0, NULL, 0, 0, 0, _IONBF, 0, IO_IDLE, 0, EOF};
 
 FILE *stdin = &_stdin;
 FILE *stdout = &_stdout;
 FILE *stderr = &_stderr;
 
+// Streams from fopen(), for fflush(NULL) at exit
+static FILE *open_files[FOPEN_MAX];
+
 // Internal helper functions
 static int _file_mode_to_flags(const char *mode) {
     if (!mode) return -1;
@@ -35,6 +46,148 @@ static int _file_mode_to_flags(const char *mode) {
     }
 }
 
+// Write out everything in the buffer
+static int _flush_output(FILE *stream) {
+    size_t done = 0;
+    while (done < stream->buffer_pos) {
+        ssize_t n = sys_write(stream->fd, stream->buffer + done, stream->buffer_pos - done);
+        if (n <= 0) {
+            // Keep what was not written for a later attempt
+            memmove(stream->buffer, stream->buffer + done, stream->buffer_pos - done);
+            stream->buffer_pos -= done;
+            stream->error = 1;
+            return EOF;
+        }
+        done += (size_t)n;
+    }
+    stream->buffer_pos = 0;
+    return 0;
+}
+
+// Give up buffered input, moving the file offset back over it
+static void _drop_input(FILE *stream) {
+    size_t unread = stream->buffer_end - stream->buffer_pos;
+    if (stream->unget != EOF) {
+        unread++;
+    }
+    if (unread && stream != stdin) {
+        sys_lseek(stream->fd, -(off_t)unread, SEEK_CUR);
+    }
+    stream->buffer_pos = 0;
+    stream->buffer_end = 0;
+    stream->unget = EOF;
+}
+
+// Make the stream ready for dir, settling whatever the other direction left
+static int _set_direction(FILE *stream, int dir) {
+    if (stream->io_dir == dir) {
+        return 0;
+    }
+    if (stream->io_dir == IO_WRITE && _flush_output(stream) == EOF) {
+        return EOF;
+    }
+    if (stream->io_dir == IO_READ) {
+        _drop_input(stream);
+    }
+    stream->io_dir = dir;
+    return 0;
+}
+
+// Allocate the buffer on first use; an allocation failure means unbuffered
+static void _ensure_buffer(FILE *stream) {
+    if (stream->buffer || stream->buf_mode == _IONBF) {
+        return;
+    }
+    stream->buffer = malloc(BUFSIZ);
+    if (!stream->buffer) {
+        stream->buf_mode = _IONBF;
+        return;
+    }
+    stream->buffer_size = BUFSIZ;
+    stream->buf_owned = 1;
+}
+
+// Buffered write of len bytes; returns the number accepted
+static size_t _stream_write(FILE *stream, const char *data, size_t len) {
+    if (_set_direction(stream, IO_WRITE) == EOF) {
+        return 0;
+    }
+    _ensure_buffer(stream);
+
+    // Unbuffered, or too big to be worth copying: write it through
+    if (stream->buf_mode == _IONBF || len >= stream->buffer_size) {
+        if (_flush_output(stream) == EOF) {
+            return 0;
+        }
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = sys_write(stream->fd, data + done, len - done);
+            if (n <= 0) {
+                stream->error = 1;
+                break;
+            }
+            done += (size_t)n;
+        }
+        return done;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        size_t space = stream->buffer_size - stream->buffer_pos;
+        size_t chunk = len - done < space ? len - done : space;
+        memcpy(stream->buffer + stream->buffer_pos, data + done, chunk);
+        stream->buffer_pos += chunk;
+        done += chunk;
+        if (stream->buffer_pos == stream->buffer_size && _flush_output(stream) == EOF) {
+            return done;
+        }
+    }
+
+    if (stream->buf_mode == _IOLBF && memchr(data, '\n', len)) {
+        _flush_output(stream);
+    }
+    return done;
+}
+
+// Refill an empty input buffer; returns 0, or EOF at end of file or error
+static int _fill_input(FILE *stream) {
+    // Reading the terminal: show the prompt that is still buffered
+    if (stream == stdin && stdout->io_dir == IO_WRITE) {
+        fflush(stdout);
+    }
+
+    ssize_t n = sys_read(stream->fd, stream->buffer, stream->buffer_size);
+    if (n <= 0) {
+        if (n < 0) {
+            stream->error = 1;
+        } else {
+            stream->eof = 1;
+        }
+        return EOF;
+    }
+    stream->buffer_pos = 0;
+    stream->buffer_end = (size_t)n;
+    return 0;
+}
+
+static void _register_file(FILE *file) {
+    for (int i = 0; i < FOPEN_MAX; i++) {
+        if (!open_files[i]) {
+            open_files[i] = file;
+            return;
+        }
+    }
+}
+
+static void _unregister_file(FILE *file) {
+    for (int i = 0; i < FOPEN_MAX; i++) {
+        if (open_files[i] == file) {
+            open_files[i] = NULL;
+            return;
+        }
+    }
+}
+
 // File operations
 FILE *fopen(const char *filename, const char *mode) {
     if (!filename || !mode) {
@@ -60,10 +213,17 @@ FILE *fopen(const char *filename, const char *mode) {
     file->fd = fd;
     file->flags = flags;
     file->error = 0;
-    file->buffer = NULL;
+    file->buffer = NULL;        // Allocated on first use
     file->buffer_size = 0;
     file->buffer_pos = 0;
+    file->buffer_end = 0;
+    file->buf_mode = _IOFBF;
+    file->buf_owned = 0;
+    file->io_dir = IO_IDLE;
+    file->eof = 0;
+    file->unget = EOF;
     
+    _register_file(file);
     return file;
 }
 
@@ -72,47 +232,159 @@ int fclose(FILE *stream) {
         return EOF;
     }
     
+    int flushed = fflush(stream);
+    _unregister_file(stream);
     int result = sys_close(stream->fd);
     
-    if (stream->buffer) {
+    if (stream->buf_owned) {
         free(stream->buffer);
     }
     
     free(stream);
-    return result;
+    return flushed == EOF ? EOF : result;
 }
 
 int fflush(FILE *stream) {
-    // For now, we don't implement buffering, so this is a no-op
-    (void)stream;
+    // NULL flushes every output stream, as exit() does
+    if (!stream) {
+        int result = 0;
+        if (fflush(stdout) == EOF) result = EOF;
+        if (fflush(stderr) == EOF) result = EOF;
+        for (int i = 0; i < FOPEN_MAX; i++) {
+            if (open_files[i] && fflush(open_files[i]) == EOF) {
+                result = EOF;
+            }
+        }
+        return result;
+    }
+    
+    if (stream->io_dir == IO_WRITE) {
+        return _flush_output(stream);
+    }
+    if (stream->io_dir == IO_READ) {
+        _drop_input(stream);
+        stream->io_dir = IO_IDLE;
+    }
+    return 0;
+}
+
+int setvbuf(FILE *stream, char *buffer, int mode, size_t size) {
+    if (!stream || (mode != _IOFBF && mode != _IOLBF && mode != _IONBF)) {
+        return -1;
+    }
+    if (fflush(stream) == EOF) {
+        return -1;
+    }
+    
+    if (stream->buf_owned) {
+        free(stream->buffer);
+    }
+    stream->buffer = NULL;
+    stream->buffer_size = 0;
+    stream->buf_owned = 0;
+    stream->buf_mode = mode;
+    
+    if (mode == _IONBF) {
+        return 0;
+    }
+    if (buffer && size > 0) {
+        stream->buffer = buffer;
+        stream->buffer_size = size;
+    } else if (size > 0) {
+        stream->buffer = malloc(size);
+        if (!stream->buffer) {
+            stream->buf_mode = _IONBF;
+            return -1;
+        }
+        stream->buffer_size = size;
+        stream->buf_owned = 1;
+    }
     return 0;
 }
 
+void setbuf(FILE *stream, char *buffer) {
+    setvbuf(stream, buffer, buffer ? _IOFBF : _IONBF, BUFSIZ);
+}
+
 // Character I/O
 int fgetc(FILE *stream) {
     if (!stream) return EOF;
+    if (_set_direction(stream, IO_READ) == EOF) return EOF;
+    
+    if (stream->unget != EOF) {
+        int c = stream->unget;
+        stream->unget = EOF;
+        return c;
+    }
+    
+    _ensure_buffer(stream);
+    if (!stream->buffer) {
+        unsigned char c;
+        ssize_t result = sys_read(stream->fd, &c, 1);
+        if (result != 1) {
+            if (result == 0) stream->eof = 1; else stream->error = 1;
+            return EOF;
+        }
+        return c;
+    }
     
-    char c;
-    ssize_t result = sys_read(stream->fd, &c, 1);
-    if (result != 1) {
+    if (stream->buffer_pos == stream->buffer_end && _fill_input(stream) == EOF) {
         return EOF;
     }
+    return (unsigned char)stream->buffer[stream->buffer_pos++];
+}
+
+int getc(FILE *stream) {
+    return fgetc(stream);
+}
+
+int ungetc(int character, FILE *stream) {
+    if (!stream || character == EOF) return EOF;
+    if (_set_direction(stream, IO_READ) == EOF) return EOF;
+    if (stream->unget != EOF) return EOF;  // One character of pushback
     
-    return (unsigned char)c;
+    stream->unget = (unsigned char)character;
+    stream->eof = 0;
+    return stream->unget;
+}
+
+char *fgets(char *str, int num, FILE *stream) {
+    if (!str || num <= 0 || !stream) return NULL;
+    
+    int i = 0;
+    while (i < num - 1) {
+        int c = fgetc(stream);
+        if (c == EOF) {
+            break;
+        }
+        str[i++] = (char)c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    
+    if (i == 0) {
+        return NULL;
+    }
+    str[i] = '\0';
+    return str;
 }
 
 int fputc(int character, FILE *stream) {
     if (!stream) return EOF;
     
     char c = (char)character;
-    ssize_t result = sys_write(stream->fd, &c, 1);
-    if (result != 1) {
+    if (_stream_write(stream, &c, 1) != 1) {
         return EOF;
     }
     
     return (unsigned char)c;
 }
 
+int putc(int character, FILE *stream) {
+    return fputc(character, stream);
+}
+
 int getchar(void) {
     return fgetc(stdin);
 }
@@ -124,14 +396,10 @@ int putchar(int character) {
 int puts(const char *str) {
     if (!str) return EOF;
     
-    // Write the string
+    // String and newline go out together
     size_t len = strlen(str);
-    if (sys_write(stdout->fd, str, len) != (ssize_t)len) {
-        return EOF;
-    }
-    
-    // Write newline
-    if (sys_write(stdout->fd, "\n", 1) != 1) {
+    if (_stream_write(stdout, str, len) != len ||
+        _stream_write(stdout, "\n", 1) != 1) {
         return EOF;
     }
     
@@ -142,7 +410,7 @@ int fputs(const char *str, FILE *stream) {
     if (!str || !stream) return EOF;
     
     size_t len = strlen(str);
-    if (sys_write(stream->fd, str, len) != (ssize_t)len) {
+    if (_stream_write(stream, str, len) != len) {
         return EOF;
     }
     
@@ -154,15 +422,44 @@ size_t fread(void *ptr, size_t size, size_t count, FILE *stream) {
     if (!ptr || !stream || size == 0) {
         return 0;
     }
+    if (_set_direction(stream, IO_READ) == EOF) {
+        return 0;
+    }
     
+    char *out = (char *)ptr;
     size_t total_bytes = size * count;
-    ssize_t bytes_read = sys_read(stream->fd, ptr, total_bytes);
+    size_t done = 0;
     
-    if (bytes_read < 0) {
-        return 0;
+    if (total_bytes && stream->unget != EOF) {
+        out[done++] = (char)stream->unget;
+        stream->unget = EOF;
     }
     
-    return (size_t)bytes_read / size;
+    // Whatever is buffered first, then large reads straight into ptr
+    while (done < total_bytes) {
+        size_t avail = stream->buffer_end - stream->buffer_pos;
+        if (avail) {
+            size_t chunk = total_bytes - done < avail ? total_bytes - done : avail;
+            memcpy(out + done, stream->buffer + stream->buffer_pos, chunk);
+            stream->buffer_pos += chunk;
+            done += chunk;
+            continue;
+        }
+        
+        _ensure_buffer(stream);
+        if (!stream->buffer || total_bytes - done >= stream->buffer_size) {
+            ssize_t n = sys_read(stream->fd, out + done, total_bytes - done);
+            if (n <= 0) {
+                if (n == 0) stream->eof = 1; else stream->error = 1;
+                break;
+            }
+            done += (size_t)n;
+        } else if (_fill_input(stream) == EOF) {
+            break;
+        }
+    }
+    
+    return done / size;
 }
 
 size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream) {
@@ -171,39 +468,57 @@ size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream) {
     }
     
     size_t total_bytes = size * count;
-    ssize_t bytes_written = sys_write(stream->fd, ptr, total_bytes);
-    
-    if (bytes_written < 0) {
-        return 0;
-    }
-    
-    return (size_t)bytes_written / size;
+    return _stream_write(stream, (const char *)ptr, total_bytes) / size;
 }
 
 // File positioning
 int fseek(FILE *stream, long offset, int origin) {
     if (!stream) return -1;
     
-    return sys_lseek(stream->fd, offset, origin);
+    // Buffered input is ahead of the caller's position: account for it
+    if (origin == SEEK_CUR && stream->io_dir == IO_READ) {
+        offset -= (long)(stream->buffer_end - stream->buffer_pos);
+        if (stream->unget != EOF) {
+            offset--;
+        }
+        stream->buffer_pos = stream->buffer_end = 0;
+        stream->unget = EOF;
+    }
+    if (fflush(stream) == EOF) return -1;
+    
+    stream->io_dir = IO_IDLE;
+    stream->eof = 0;
+    return sys_lseek(stream->fd, offset, origin) < 0 ? -1 : 0;
 }
 
 long ftell(FILE *stream) {
     if (!stream) return -1;
     
-    return sys_lseek(stream->fd, 0, SEEK_CUR);
+    long pos = sys_lseek(stream->fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        return -1;
+    }
+    if (stream->io_dir == IO_WRITE) {
+        pos += (long)stream->buffer_pos;
+    } else if (stream->io_dir == IO_READ) {
+        pos -= (long)(stream->buffer_end - stream->buffer_pos);
+        if (stream->unget != EOF) {
+            pos--;
+        }
+    }
+    return pos;
 }
 
 void rewind(FILE *stream) {
     if (stream) {
-        sys_lseek(stream->fd, 0, SEEK_SET);
+        fseek(stream, 0, SEEK_SET);
+        stream->error = 0;
     }
 }
 
 // Error handling  
 int feof(FILE *stream) {
-    // Simplified implementation
-    (void)stream;
-    return 0;
+    return stream ? stream->eof : 0;
 }
 
 int ferror(FILE *stream) {
@@ -213,90 +528,67 @@ int ferror(FILE *stream) {
 void clearerr(FILE *stream) {
     if (stream) {
         stream->error = 0;
+        stream->eof = 0;
     }
 }
 
-// Simple printf implementation
-int printf(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
+// Formatted output. The formatting itself is the shared core in
+// src/kernel/format.c, which also provides snprintf() and vsnprintf().
+int vfprintf(FILE *stream, const char *format, va_list args) {
+    if (!stream || !format) return -1;
     
-    // Very basic printf - only supports %s, %d, %c, %x
-    int count = 0;
-    const char *p = format;
-    
-    while (*p) {
-        if (*p == '%' && *(p + 1)) {
-            p++;
-            switch (*p) {
-                case 's': {
-                    const char *str = va_arg(args, const char*);
-                    if (str) {
-                        count += fputs(str, stdout);
-                    }
-                    break;
-                }
-                case 'd': {
-                    int num = va_arg(args, int);
-                    char buf[32];
-                    // Simple integer to string conversion
-                    int i = 0, negative = 0;
-                    if (num < 0) {
-                        negative = 1;
-                        num = -num;
-                    }
-                    do {
-                        buf[i++] = '0' + (num % 10);
-                        num /= 10;
-                    } while (num);
-                    if (negative) buf[i++] = '-';
-                    
-                    // Reverse and print
-                    for (int j = i - 1; j >= 0; j--) {
-                        putchar(buf[j]);
-                        count++;
-                    }
-                    break;
-                }
-                case 'c': {
-                    int c = va_arg(args, int);
-                    putchar(c);
-                    count++;
-                    break;
-                }
-                case 'x': {
-                    unsigned int num = va_arg(args, unsigned int);
-                    char buf[32];
-                    int i = 0;
-                    if (num == 0) {
-                        buf[i++] = '0';
-                    } else {
-                        while (num) {
-                            int digit = num % 16;
-                            buf[i++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
-                            num /= 16;
-                        }
-                    }
-                    
-                    // Reverse and print
-                    for (int j = i - 1; j >= 0; j--) {
-                        putchar(buf[j]);
-                        count++;
-                    }
-                    break;
-                }
-                case '%':
-                    putchar('%');
-                    count++;
-                    break;
-            }
-        } else {
-            putchar(*p);
-            count++;
+    // Format into a buffer and hand the stream one piece
+    char small[256];
+    va_list again;
+    va_copy(again, args);
+    int len = vsnprintf(small, sizeof(small), format, args);
+    
+    char *text = small;
+    if (len >= (int)sizeof(small)) {
+        text = malloc((size_t)len + 1);
+        if (!text) {
+            va_end(again);
+            return -1;
         }
-        p++;
+        vsnprintf(text, (size_t)len + 1, format, again);
     }
+    va_end(again);
     
+    size_t written = _stream_write(stream, text, (size_t)len);
+    if (text != small) {
+        free(text);
+    }
+    return written == (size_t)len ? len : -1;
+}
+
+int vsprintf(char *str, const char *format, va_list args) {
+    return vsnprintf(str, (size_t)-1 / 2, format, args);
+}
+
+int sprintf(char *str, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int count = vsprintf(str, format, args);
+    va_end(args);
+    return count;
+}
+
+int vprintf(const char *format, va_list args) {
+    return vfprintf(stdout, format, args);
+}
+
+int fprintf(FILE *stream, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int count = vfprintf(stream, format, args);
+    va_end(args);
+    return count;
+}
+
+int printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int count = vfprintf(stdout, format, args);
     va_end(args);
     return count;
 }
\ No newline at end of file
@@ -28,6 +28,7 @@ void *malloc(size_t size);
 void *calloc(size_t num, size_t size);
 void *realloc(void *ptr, size_t size);
 void free(void *ptr);
+void malloc_stats(void);        // Heap usage summary on stderr
 
 // Process control
 void exit(int status) __attribute__((noreturn));
@@ -1,134 +1,410 @@
 #include "../stdlib.h"
+#include "../stdio.h"
 #include "../string.h"
+#include "../mman.h"
+#include "../pthread.h"
+#include <stdint.h>
 
 // System call interface
 extern void sys_exit(int status);
-extern void *sys_brk(void *addr);
 
-// Simple heap allocator
-static void *heap_start = NULL;
-static void *heap_end = NULL;
-static size_t heap_size = 0;
+/*
+ * Heap allocator
+ *
+ * Memory comes from the kernel in arenas mapped with mmap(). Each chunk
+ * starts with a boundary tag: its size and flags, preceded by the size of
+ * the chunk before it when that one is free. That is enough to merge a
+ * freed chunk with both neighbours in constant time. Free chunks sit in
+ * bins: one per exact size below MALLOC_SMALL_LIMIT, so a small request
+ * is a list pop, and one per power of two above it. A bitmap of non-empty
+ * bins finds the next larger chunk to split without walking empty ones.
+ * Requests of MALLOC_MMAP_THRESHOLD and up get a mapping of their own,
+ * which free() hands straight back. One mutex covers the heap for
+ * threaded programs; it costs no trap while only one thread allocates.
+ */
 
-// Simple free block list
-struct free_block {
-    size_t size;
-    struct free_block *next;
+#define MALLOC_ALIGN            16
+#define MALLOC_HEADER           (2 * sizeof(size_t))
+#define MALLOC_MIN_CHUNK        32
+#define MALLOC_SMALL_BINS       64                  // 16-byte size steps
+#define MALLOC_LARGE_BINS       16                  // Powers of two from 1 KB
+#define MALLOC_BINS             (MALLOC_SMALL_BINS + MALLOC_LARGE_BINS)
+#define MALLOC_SMALL_LIMIT      (MALLOC_SMALL_BINS * MALLOC_ALIGN)
+#define MALLOC_ARENA_SIZE       (256 * 1024)
+#define MALLOC_MMAP_THRESHOLD   (128 * 1024)
+#define MALLOC_PAGE_SIZE        4096
+
+#define CHUNK_INUSE             0x1
+#define CHUNK_PREV_INUSE        0x2
+#define CHUNK_MMAPPED           0x4
+#define CHUNK_FLAGS             0xf
+
+struct malloc_chunk {
+    size_t prev_size;               // Size of the previous chunk, if free
+    size_t head;                    // Size of this chunk | CHUNK_* flags
+    struct malloc_chunk *next;      // Bin links, only while free
+    struct malloc_chunk *prev;
 };
 
-static struct free_block *free_list = NULL;
+static struct malloc_chunk *bins[MALLOC_BINS];
+static uint64_t bin_map[(MALLOC_BINS + 63) / 64];
 
-// Initialize heap 
-static void _heap_init(void) {
-    if (!heap_start) {
-        // Request initial heap from kernel (simplified)
-        heap_size = 1024 * 1024;  // 1MB initial heap
-        heap_start = sys_brk(NULL);
-        heap_end = sys_brk((char *)heap_start + heap_size);
-        
-        // Initialize free list with entire heap
-        free_list = (struct free_block *)heap_start;
-        free_list->size = heap_size - sizeof(struct free_block);
-        free_list->next = NULL;
+static size_t heap_arena_bytes = 0;     // Mapped for arenas
+static size_t heap_arena_count = 0;
+static size_t heap_in_use = 0;          // Arena chunks handed out, headers included
+static size_t heap_mmapped_bytes = 0;   // Mapped for single large chunks
+static size_t heap_mmapped_count = 0;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t _chunk_size(const struct malloc_chunk *c) {
+    return c->head & ~(size_t)CHUNK_FLAGS;
+}
+
+static inline struct malloc_chunk *_chunk_at(void *base, size_t offset) {
+    return (struct malloc_chunk *)((char *)base + offset);
+}
+
+static inline void *_chunk_to_mem(struct malloc_chunk *c) {
+    return (char *)c + MALLOC_HEADER;
+}
+
+static inline struct malloc_chunk *_mem_to_chunk(void *mem) {
+    return (struct malloc_chunk *)((char *)mem - MALLOC_HEADER);
+}
+
+// Chunk size for a request of n bytes, or 0 if it cannot be represented
+static size_t _request_size(size_t n) {
+    if (n > (size_t)-1 - MALLOC_HEADER - MALLOC_PAGE_SIZE) {
+        return 0;
     }
+    size_t size = (n + MALLOC_HEADER + MALLOC_ALIGN - 1) & ~(size_t)(MALLOC_ALIGN - 1);
+    return size < MALLOC_MIN_CHUNK ? MALLOC_MIN_CHUNK : size;
 }
 
-// Simple malloc implementation
-void *malloc(size_t size) {
+static int _bin_index(size_t size) {
+    if (size < MALLOC_SMALL_LIMIT) {
+        return (int)(size / MALLOC_ALIGN);
+    }
+    int order = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl((unsigned long)size);
+    int large = order - 10;     // log2(MALLOC_SMALL_LIMIT)
+    if (large >= MALLOC_LARGE_BINS) {
+        large = MALLOC_LARGE_BINS - 1;
+    }
+    return MALLOC_SMALL_BINS + large;
+}
+
+static void _bin_insert(struct malloc_chunk *c) {
+    int idx = _bin_index(_chunk_size(c));
+    c->prev = NULL;
+    c->next = bins[idx];
+    if (c->next) {
+        c->next->prev = c;
+    }
+    bins[idx] = c;
+    bin_map[idx / 64] |= 1ULL << (idx % 64);
+}
+
+static void _bin_remove(struct malloc_chunk *c) {
+    int idx = _bin_index(_chunk_size(c));
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        bins[idx] = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    if (!bins[idx]) {
+        bin_map[idx / 64] &= ~(1ULL << (idx % 64));
+    }
+}
+
+// First non-empty bin at or above idx, or -1
+static int _bin_next(int idx) {
+    while (idx < MALLOC_BINS) {
+        uint64_t bits = bin_map[idx / 64] & (~0ULL << (idx % 64));
+        if (bits) {
+            return (idx & ~63) + __builtin_ctzll(bits);
+        }
+        idx = (idx & ~63) + 64;
+    }
+    return -1;
+}
+
+// A free chunk of at least size bytes, still in its bin, or NULL
+static struct malloc_chunk *_bin_find(size_t size) {
+    int idx = _bin_index(size);
+
+    // Large bins hold a range of sizes: first fit within the request's own
+    if (idx >= MALLOC_SMALL_BINS) {
+        for (struct malloc_chunk *c = bins[idx]; c; c = c->next) {
+            if (_chunk_size(c) >= size) {
+                return c;
+            }
+        }
+        idx++;
+    }
+
+    // Anything in this bin or a later one is big enough
+    idx = _bin_next(idx);
+    return idx < 0 ? NULL : bins[idx];
+}
+
+// Mark c (size bytes, not in a bin) free and bin it
+static void _chunk_release(struct malloc_chunk *c, size_t size) {
+    c->head = size | CHUNK_PREV_INUSE;
+    struct malloc_chunk *next = _chunk_at(c, size);
+    next->prev_size = size;
+    next->head &= ~(size_t)CHUNK_PREV_INUSE;
+    _bin_insert(c);
+}
+
+// Cut in-use chunk c down to size bytes, freeing the tail if it is worth it
+static void _chunk_trim(struct malloc_chunk *c, size_t size) {
+    size_t total = _chunk_size(c);
+    if (total - size < MALLOC_MIN_CHUNK) {
+        return;
+    }
+
+    struct malloc_chunk *rest = _chunk_at(c, size);
+    rest->head = (total - size) | CHUNK_INUSE | CHUNK_PREV_INUSE;
+    c->head = size | (c->head & CHUNK_FLAGS);
+    free(_chunk_to_mem(rest));
+}
+
+// Take free chunk c out of its bin and hand out size bytes of it
+static void *_chunk_take(struct malloc_chunk *c, size_t size) {
+    _bin_remove(c);
+
+    size_t total = _chunk_size(c);
+    if (total - size >= MALLOC_MIN_CHUNK) {
+        struct malloc_chunk *rest = _chunk_at(c, size);
+        rest->head = (total - size) | CHUNK_PREV_INUSE;
+        _chunk_at(rest, total - size)->prev_size = total - size;
+        _bin_insert(rest);
+        total = size;
+    } else {
+        _chunk_at(c, total)->head |= CHUNK_PREV_INUSE;
+    }
+
+    c->head = total | CHUNK_INUSE | CHUNK_PREV_INUSE;
+    heap_in_use += total;
+    return _chunk_to_mem(c);
+}
+
+static size_t _page_round(size_t n) {
+    return (n + MALLOC_PAGE_SIZE - 1) & ~(size_t)(MALLOC_PAGE_SIZE - 1);
+}
+
+// Map a new arena with room for a size-byte chunk
+static int _arena_grow(size_t size) {
+    size_t len = _page_round(size + MALLOC_HEADER);
+    if (len < MALLOC_ARENA_SIZE) {
+        len = MALLOC_ARENA_SIZE;
+    }
+
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    // One free chunk, then an in-use header of size 0 that stops merging
+    size_t usable = len - MALLOC_HEADER;
+    struct malloc_chunk *fence = _chunk_at(base, usable);
+    fence->head = CHUNK_INUSE;
+
+    struct malloc_chunk *c = (struct malloc_chunk *)base;
+    _chunk_release(c, usable);
+
+    heap_arena_bytes += len;
+    heap_arena_count++;
+    return 0;
+}
+
+static void *_malloc(size_t size) {
     if (size == 0) return NULL;
     
-    _heap_init();
-    
-    // Align to 8-byte boundary
-    size = (size + 7) & ~7;
-    
-    // Find suitable free block
-    struct free_block **current = &free_list;
-    while (*current) {
-        if ((*current)->size >= size) {
-            struct free_block *block = *current;
-            
-            // If block is much larger, split it
-            if (block->size > size + sizeof(struct free_block)) {
-                struct free_block *new_block = 
-                    (struct free_block *)((char *)block + sizeof(struct free_block) + size);
-                new_block->size = block->size - size - sizeof(struct free_block);
-                new_block->next = block->next;
-                block->next = new_block;
-                block->size = size;
-            }
-            
-            // Remove block from free list
-            *current = block->next;
-            
-            // Return data portion (after header)
-            return (char *)block + sizeof(struct free_block);
+    size_t chunk = _request_size(size);
+    if (!chunk) return NULL;
+    
+    if (chunk >= MALLOC_MMAP_THRESHOLD) {
+        size_t len = _page_round(chunk);
+        void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        struct malloc_chunk *c = (struct malloc_chunk *)base;
+        c->prev_size = 0;
+        c->head = len | CHUNK_INUSE | CHUNK_MMAPPED;
+        heap_mmapped_bytes += len;
+        heap_mmapped_count++;
+        return _chunk_to_mem(c);
+    }
+    
+    struct malloc_chunk *c = _bin_find(chunk);
+    if (!c) {
+        if (_arena_grow(chunk) < 0) {
+            return NULL;
         }
-        current = &(*current)->next;
+        c = _bin_find(chunk);
     }
     
-    return NULL;  // No suitable block found
+    return _chunk_take(c, chunk);
 }
 
-// Simple free implementation
-void free(void *ptr) {
+static void _free(void *ptr) {
     if (!ptr) return;
     
-    // Get block header
-    struct free_block *block = 
-        (struct free_block *)((char *)ptr - sizeof(struct free_block));
+    struct malloc_chunk *c = _mem_to_chunk(ptr);
+    size_t size = _chunk_size(c);
+    
+    if (c->head & CHUNK_MMAPPED) {
+        heap_mmapped_bytes -= size;
+        heap_mmapped_count--;
+        munmap(c, size);
+        return;
+    }
+    
+    heap_in_use -= size;
+    
+    // Merge with a free chunk after, then with a free chunk before
+    struct malloc_chunk *next = _chunk_at(c, size);
+    if (!(next->head & CHUNK_INUSE)) {
+        _bin_remove(next);
+        size += _chunk_size(next);
+    }
+    if (!(c->head & CHUNK_PREV_INUSE)) {
+        struct malloc_chunk *prev = (struct malloc_chunk *)((char *)c - c->prev_size);
+        _bin_remove(prev);
+        size += _chunk_size(prev);
+        c = prev;
+    }
     
-    // Add to free list
-    block->next = free_list;
-    free_list = block;
+    _chunk_release(c, size);
+}
+
+void *malloc(size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void *ptr = _malloc(size);
+    pthread_mutex_unlock(&heap_lock);
+    return ptr;
+}
+
+void free(void *ptr) {
+    pthread_mutex_lock(&heap_lock);
+    _free(ptr);
+    pthread_mutex_unlock(&heap_lock);
 }
 
-// Calloc implementation
 void *calloc(size_t num, size_t size) {
+    if (size && num > (size_t)-1 / size) {
+        return NULL;
+    }
+    
     size_t total_size = num * size;
     void *ptr = malloc(total_size);
-    if (ptr) {
+    
+    // Fresh mappings are already zeroed by the kernel
+    if (ptr && !(_mem_to_chunk(ptr)->head & CHUNK_MMAPPED)) {
         memset(ptr, 0, total_size);
     }
     return ptr;
 }
 
-// Simple realloc (not optimized)
-void *realloc(void *ptr, size_t size) {
+static void *_realloc(void *ptr, size_t size) {
     if (!ptr) {
-        return malloc(size);
+        return _malloc(size);
     }
     
     if (size == 0) {
-        free(ptr);
+        _free(ptr);
         return NULL;
     }
     
-    void *new_ptr = malloc(size);
+    size_t chunk = _request_size(size);
+    if (!chunk) return NULL;
+    
+    struct malloc_chunk *c = _mem_to_chunk(ptr);
+    size_t old = _chunk_size(c);
+    
+    if (!(c->head & CHUNK_MMAPPED)) {
+        // Shrinking, or growing into a free neighbour: stay in place
+        if (chunk <= old) {
+            _chunk_trim(c, chunk);
+            return ptr;
+        }
+        
+        struct malloc_chunk *next = _chunk_at(c, old);
+        if (!(next->head & CHUNK_INUSE) && old + _chunk_size(next) >= chunk) {
+            size_t total = old + _chunk_size(next);
+            _bin_remove(next);
+            heap_in_use += total - old;
+            c->head = total | (c->head & CHUNK_FLAGS);
+            _chunk_at(c, total)->head |= CHUNK_PREV_INUSE;
+            _chunk_trim(c, chunk);
+            return ptr;
+        }
+    } else if (chunk <= old) {
+        return ptr;
+    }
+    
+    void *new_ptr = _malloc(size);
     if (new_ptr) {
-        // Copy old data (we don't know original size, so copy conservatively)
-        memcpy(new_ptr, ptr, size);  // This is not correct - should track original size
-        free(ptr);
+        size_t keep = old - MALLOC_HEADER;
+        memcpy(new_ptr, ptr, keep < size ? keep : size);
+        _free(ptr);
     }
     
     return new_ptr;
 }
 
+void *realloc(void *ptr, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void *new_ptr = _realloc(ptr, size);
+    pthread_mutex_unlock(&heap_lock);
+    return new_ptr;
+}
+
+void malloc_stats(void) {
+    size_t free_bytes = 0;
+    int free_chunks = 0;
+    for (int i = 0; i < MALLOC_BINS; i++) {
+        for (struct malloc_chunk *c = bins[i]; c; c = c->next) {
+            free_bytes += _chunk_size(c);
+            free_chunks++;
+        }
+    }
+    
+    fprintf(stderr, "arenas:      %d (%d bytes)\n", (int)heap_arena_count, (int)heap_arena_bytes);
+    fprintf(stderr, "in use:      %d bytes\n", (int)heap_in_use);
+    fprintf(stderr, "free:        %d bytes in %d chunks\n", (int)free_bytes, free_chunks);
+    fprintf(stderr, "mmapped:     %d (%d bytes)\n", (int)heap_mmapped_count, (int)heap_mmapped_bytes);
+}
+
+// Simple atexit implementation (limited)
+static void (*exit_functions[32])(void);
+static int num_exit_functions = 0;
+
 // Process control
 void exit(int status) {
+    // Handlers run in reverse order of registration, then buffered output
+    // is written out before the process goes away
+    while (num_exit_functions > 0) {
+        exit_functions[--num_exit_functions]();
+    }
+    fflush(NULL);
+    
     sys_exit(status);
     // This should not return
     while (1) {}
 }
 
 void abort(void) {
-    exit(EXIT_FAILURE);
+    // No atexit handlers and no flushing on abnormal termination
+    sys_exit(EXIT_FAILURE);
+    while (1) {}
 }
 
-// Simple atexit implementation (limited)
-static void (*exit_functions[32])(void);
-static int num_exit_functions = 0;
-
 int atexit(void (*func)(void)) {
     if (num_exit_functions >= 32 || !func) {
         return -1;
@@ -1,5 +1,25 @@
 #include "../string.h"
 #include "../stdlib.h"
+#include <stdint.h>
+
+// The string scans read whole aligned words (see has_zero_byte); an
+// aligned word never crosses a page, so reading past the terminator in
+// it is safe
+typedef uint64_t __attribute__((may_alias)) word_t;
+
+#define WORD_SIZE   sizeof(uint64_t)
+#define WORD_ONES   0x0101010101010101ULL
+#define WORD_HIGHS  0x8080808080808080ULL
+
+// Nonzero exactly when w has a zero byte; for a byte equal to c, test
+// w ^ (c * WORD_ONES)
+static inline uint64_t has_zero_byte(uint64_t w) {
+    return (w - WORD_ONES) & ~w & WORD_HIGHS;
+}
+
+static inline int word_aligned(const void *p) {
+    return ((uintptr_t)p & (WORD_SIZE - 1)) == 0;
+}
 
 // Memory functions
 void *memcpy(void *dest, const void *src, size_t n) {
@@ -136,6 +156,20 @@ char *strncat(char *dest, const char *src, size_t n) {
 int strcmp(const char *s1, const char *s2) {
     if (!s1 || !s2) return 0;
     
+    // Mutually aligned: skip equal words holding no terminator
+    if (word_aligned((const void *)((uintptr_t)s1 ^ (uintptr_t)s2))) {
+        while (!word_aligned(s1) && *s1 && *s1 == *s2) {
+            s1++;
+            s2++;
+        }
+        while (word_aligned(s1)) {
+            uint64_t w = *(const word_t *)s1;
+            if (w != *(const word_t *)s2 || has_zero_byte(w)) break;
+            s1 += WORD_SIZE;
+            s2 += WORD_SIZE;
+        }
+    }
+    
     while (*s1 && (*s1 == *s2)) {
         s1++;
         s2++;
@@ -164,6 +198,24 @@ char *strchr(const char *s, int c) {
     if (!s) return NULL;
     
     char target = (char)c;
+    while (!word_aligned(s)) {
+        if (*s == target) {
+            return (char *)s;
+        }
+        if (!*s) {
+            return NULL;
+        }
+        s++;
+    }
+    
+    // Skip words with neither the terminator nor target in them
+    uint64_t pattern = (unsigned char)target * WORD_ONES;
+    for (;;) {
+        uint64_t w = *(const word_t *)s;
+        if (has_zero_byte(w) | has_zero_byte(w ^ pattern)) break;
+        s += WORD_SIZE;
+    }
+    
     while (*s) {
         if (*s == target) {
             return (char *)s;
@@ -252,9 +304,10 @@ char *strstr(const char *haystack, const char *needle) {
         return (char *)haystack;
     }
     
-    while (*haystack) {
-        const char *h = haystack;
-        const char *n = needle;
+    // Jump between occurrences of the first character
+    while ((haystack = strchr(haystack, *needle)) != NULL) {
+        const char *h = haystack + 1;
+        const char *n = needle + 1;
         
         while (*h && *n && (*h == *n)) {
             h++;
@@ -311,12 +364,21 @@ char *strtok(char *str, const char *delim) {
 size_t strlen(const char *s) {
     if (!s) return 0;
     
-    size_t len = 0;
-    while (s[len]) {
-        len++;
+    const char *p = s;
+    while (!word_aligned(p)) {
+        if (!*p) {
+            return (size_t)(p - s);
+        }
+        p++;
+    }
+    while (!has_zero_byte(*(const word_t *)p)) {
+        p += WORD_SIZE;
+    }
+    while (*p) {
+        p++;
     }
     
-    return len;
+    return (size_t)(p - s);
 }
 
 // Error functions (stub)
@@ -0,0 +1,37 @@
+#ifndef MINIOS_TIME_H
+#define MINIOS_TIME_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Type definitions
+typedef long time_t;            // Seconds
+typedef int clockid_t;          // Clock identifier
+typedef int pid_t;              // Process ID
+
+struct timespec {
+    time_t tv_sec;              // Seconds
+    long tv_nsec;               // Nanoseconds
+};
+
+// Clocks
+#define CLOCK_MONOTONIC     1   // Time since boot, never steps
+
+// Kernel data page handed to the program at startup (struct user_program)
+void minios_vdso_init(const void *vdso);
+
+// Time functions, answered from the kernel data page without a system call
+int clock_gettime(clockid_t clock_id, struct timespec *ts);
+uint64_t minios_ticks(void);
+
+// Process functions
+pid_t getpid(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MINIOS_TIME_H */
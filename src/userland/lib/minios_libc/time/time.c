@@ -0,0 +1,107 @@
+/*
+ * Clock and process ID queries
+ *
+ * Served from the kernel's shared data page (vdso.h) where the kernel
+ * provides one: the clock is the raw CPU counter scaled by the kernel's
+ * calibration and the PID is read from the slot of the CPU the program is
+ * on, so neither needs a trap. Without the page they fall back to system
+ * calls.
+ */
+
+#include "../time.h"
+#include <stddef.h>
+#include "vdso.h"
+
+// System call interface
+extern long sys_getpid(void);
+extern long sys_gettime(uint64_t *ticks);
+
+static const struct vdso_data *vdso = NULL;
+
+#if defined(__aarch64__)
+#define VDSO_CLOCK_NATIVE   VDSO_CLOCK_CNTVCT
+#elif defined(__x86_64__)
+#define VDSO_CLOCK_NATIVE   VDSO_CLOCK_TSC
+#endif
+
+void minios_vdso_init(const void *page) {
+    const struct vdso_data *vd = page;
+    vdso = (vd && vd->version == VDSO_VERSION) ? vd : NULL;
+}
+
+static inline uint64_t read_counter(void) {
+#if defined(__aarch64__)
+    uint64_t count;
+    __asm__ volatile("isb\n"
+                     "mrs %0, cntvct_el0"
+                     : "=r"(count) : : "memory");
+    return count;
+#elif defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+// Index of the CPU this runs on, as the kernel stored it for user code
+static inline uint32_t read_cpu(void) {
+#if defined(__aarch64__)
+    uint64_t cpu;
+    __asm__ volatile("mrs %0, tpidrro_el0" : "=r"(cpu));
+    return (uint32_t)cpu;
+#elif defined(__x86_64__)
+    uint32_t lo, hi, cpu;
+    __asm__ volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(cpu));
+    (void)lo; (void)hi;
+    return cpu;
+#endif
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec *ts) {
+    if (!ts || clock_id != CLOCK_MONOTONIC) {
+        return -1;
+    }
+    if (!vdso || vdso->clock_source != VDSO_CLOCK_NATIVE) {
+        return -1;
+    }
+    
+    uint64_t delta = read_counter() - vdso->base_counter;
+    uint64_t ns = vdso->base_ns +
+                  (uint64_t)(((unsigned __int128)delta * vdso->clock_mult) >> vdso->clock_shift);
+    
+    ts->tv_sec = (time_t)(ns / 1000000000ULL);
+    ts->tv_nsec = (long)(ns % 1000000000ULL);
+    return 0;
+}
+
+uint64_t minios_ticks(void) {
+    if (vdso) {
+        return vdso->ticks;
+    }
+    return (uint64_t)sys_gettime(NULL);
+}
+
+pid_t getpid(void) {
+    if (!vdso || !(vdso->flags & VDSO_HAS_CPU_PID)) {
+        return (pid_t)sys_getpid();
+    }
+    
+    // Retry if a switch rewrote the slot or moved us to another CPU
+    for (;;) {
+        uint32_t cpu = read_cpu();
+        if (cpu >= VDSO_MAX_CPUS) {
+            return (pid_t)sys_getpid();
+        }
+        
+        const struct vdso_cpu *slot = &vdso->cpus[cpu];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        uint32_t pid = slot->pid;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq && read_cpu() == cpu) {
+            return (pid_t)pid;
+        }
+    }
+}
@@ -12,10 +12,13 @@ int user_printf(const char *format, ...);
 int user_puts(const char *str);
 int user_open(const char *path, int flags);
 int user_read(int fd, void *buf, size_t count);
+int user_write(int fd, const void *buf, size_t count);
 int user_close(int fd);
 
 #define DEFAULT_LINES   10
-#define BUFFER_SIZE     1024
+#define BUFFER_SIZE     16384
+
+static char buffer[BUFFER_SIZE] __attribute__((aligned(64)));
 
 // String to integer conversion
 int str_to_int(const char *str) {
@@ -34,7 +37,7 @@ int str_to_int(const char *str) {
     return result;
 }
 
-// Display first N lines of a file
+// Display first N lines of a file, reading no further than the Nth newline
 int head_file(const char *filename, int lines) {
     int fd = user_open(filename, 0);
     if (fd < 0) {
@@ -42,19 +45,21 @@ int head_file(const char *filename, int lines) {
         return -1;
     }
     
-    char buffer[BUFFER_SIZE];
     int bytes_read;
     int lines_shown = 0;
     
-    while (lines_shown < lines && (bytes_read = user_read(fd, buffer, BUFFER_SIZE - 1)) > 0) {
-        buffer[bytes_read] = '\0';
-        
-        for (int i = 0; i < bytes_read && lines_shown < lines; i++) {
-            user_printf("%c", buffer[i]);
-            if (buffer[i] == '\n') {
-                lines_shown++;
-            }
+    while (lines_shown < lines && (bytes_read = user_read(fd, buffer, BUFFER_SIZE)) > 0) {
+        // Find where the last wanted line ends, a newline at a time
+        const char *p = buffer;
+        const char *end = buffer + bytes_read;
+        const char *newline;
+        while (lines_shown < lines && (newline = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+            p = newline + 1;
+            lines_shown++;
         }
+        
+        size_t len = lines_shown < lines ? (size_t)bytes_read : (size_t)(p - buffer);
+        user_write(1, buffer, len);
     }
     
     user_close(fd);
@@ -114,4 +119,5 @@ int user_printf(const char *format, ...) { return 0; }
 int user_puts(const char *str) { return 0; }
 int user_open(const char *path, int flags) { return -1; }
 int user_read(int fd, void *buf, size_t count) { return -1; }
+int user_write(int fd, const void *buf, size_t count) { return -1; }
 int user_close(int fd) { return -1; }
\ No newline at end of file
@@ -6,28 +6,66 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "ring.h"
 
-// User-space directory functions (would use system calls)
-int user_opendir(const char *path);
-int user_readdir(int dirfd, char *name, size_t name_len);
-int user_closedir(int dirfd);
+// User-space output functions (would use system calls)
 int user_printf(const char *format, ...);
 int user_puts(const char *str);
 
-int list_directory(const char *path) {
-    int dirfd = user_opendir(path);
+#define RING_ENTRIES    8
+#define DIR_BATCH       32      // Entries per readdir
+
+static struct io_ring_dirent entries[DIR_BATCH];
+
+// Completions are all posted by the time ring_submit() returns
+static int64_t next_result(struct ring *io) {
+    struct io_ring_cqe *cqe = ring_peek_cqe(io);
+    int64_t result = cqe ? cqe->result : -1;
+    if (cqe) {
+        ring_cqe_seen(io);
+    }
+    return result;
+}
+
+static void print_entries(int64_t count) {
+    for (int64_t i = 0; i < count; i++) {
+        user_printf("%s\n", entries[i].name);
+    }
+}
+
+/*
+ * The open and the first readdir go in one trap, the readdir taking its
+ * descriptor from the open. Directories that fill the first batch read
+ * on, and the close goes in a last trap.
+ */
+int list_directory(struct ring *io, const char *path) {
+    ring_prep_open(ring_get_sqe(io), path, 0, 0);
+    struct io_ring_sqe *sqe = ring_get_sqe(io);
+    ring_prep_readdir(sqe, 0, entries, DIR_BATCH);
+    sqe->flags = IO_RING_SQE_FD_PREV;
+    ring_submit(io);
+    
+    int64_t dirfd = next_result(io);
+    int64_t count = next_result(io);
     if (dirfd < 0) {
         user_printf("ls: cannot access '%s'\n", path);
         return -1;
     }
     
-    char filename[256];
-    while (user_readdir(dirfd, filename, sizeof(filename)) > 0) {
-        user_printf("%s\n", filename);
+    while (count > 0) {
+        print_entries(count);
+        if (count < DIR_BATCH) {
+            break;
+        }
+        ring_prep_readdir(ring_get_sqe(io), (int)dirfd, entries, DIR_BATCH);
+        ring_submit(io);
+        count = next_result(io);
     }
     
-    user_closedir(dirfd);
-    return 0;
+    ring_prep_close(ring_get_sqe(io), (int)dirfd);
+    ring_submit(io);
+    next_result(io);
+    return count < 0 ? -1 : 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -37,13 +75,18 @@ int main(int argc, char *argv[]) {
         path = argv[1];
     }
     
+    struct ring io;
+    if (ring_init(&io, RING_ENTRIES) != 0) {
+        user_puts("ls: cannot set up I/O ring");
+        return 1;
+    }
+    
     user_printf("Contents of '%s':\n", path);
-    return list_directory(path);
+    int result = list_directory(&io, path);
+    ring_exit(&io);
+    return result;
 }
 
 // Stub implementations
-int user_opendir(const char *path) { return -1; }
-int user_readdir(int dirfd, char *name, size_t name_len) { return -1; }
-int user_closedir(int dirfd) { return -1; }
 int user_printf(const char *format, ...) { return 0; }
 int user_puts(const char *str) { return 0; }
\ No newline at end of file
@@ -12,12 +12,14 @@ int user_printf(const char *format, ...);
 int user_puts(const char *str);
 int user_open(const char *path, int flags);
 int user_read(int fd, void *buf, size_t count);
+int user_write(int fd, const void *buf, size_t count);
 int user_close(int fd);
 int user_lseek(int fd, int offset, int whence);
 
 #define DEFAULT_LINES   10
-#define BUFFER_SIZE     1024
-#define MAX_LINES       1000
+#define BUFFER_SIZE     16384
+
+static char buffer[BUFFER_SIZE] __attribute__((aligned(64)));
 
 // String to integer conversion
 int str_to_int(const char *str) {
@@ -36,41 +38,46 @@ int str_to_int(const char *str) {
     return result;
 }
 
-// Simple line buffer for storing last N lines
-struct line_buffer {
-    char lines[MAX_LINES][256];
-    int count;
-    int start;
-    int max_lines;
-};
-
-void line_buffer_init(struct line_buffer *lb, int max_lines) {
-    lb->count = 0;
-    lb->start = 0;
-    lb->max_lines = max_lines;
-}
-
-void line_buffer_add(struct line_buffer *lb, const char *line) {
-    int pos = (lb->start + lb->count) % lb->max_lines;
-    
-    strncpy(lb->lines[pos], line, 255);
-    lb->lines[pos][255] = '\0';
-    
-    if (lb->count < lb->max_lines) {
-        lb->count++;
-    } else {
-        lb->start = (lb->start + 1) % lb->max_lines;
+// Read exactly len bytes at offset into buffer
+static int read_at(int fd, int offset, int len) {
+    if (user_lseek(fd, offset, SEEK_SET) != offset) {
+        return -1;
+    }
+    int done = 0;
+    while (done < len) {
+        int n = user_read(fd, buffer + done, (size_t)(len - done));
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
     }
+    return 0;
 }
 
-void line_buffer_print(struct line_buffer *lb) {
-    for (int i = 0; i < lb->count; i++) {
-        int pos = (lb->start + i) % lb->max_lines;
-        user_puts(lb->lines[pos]);
+// Offset where the last N lines start, scanning back from the end a block at a time
+static int find_tail_start(int fd, int size, int lines) {
+    int found = 0;
+    int pos = size;
+    
+    while (pos > 0) {
+        int chunk = pos < BUFFER_SIZE ? pos : BUFFER_SIZE;
+        pos -= chunk;
+        if (read_at(fd, pos, chunk) != 0) {
+            return -1;
+        }
+        
+        for (int i = chunk - 1; i >= 0; i--) {
+            // A newline at the very end closes the last line rather than
+            // starting an empty one
+            if (buffer[i] == '\n' && pos + i != size - 1 && ++found == lines) {
+                return pos + i + 1;
+            }
+        }
     }
+    return 0;  // Fewer lines than asked for: the whole file
 }
 
-// Display last N lines of a file
+// Display last N lines of a file; the work is proportional to the output
 int tail_file(const char *filename, int lines) {
     int fd = user_open(filename, 0);
     if (fd < 0) {
@@ -78,39 +85,22 @@ int tail_file(const char *filename, int lines) {
         return -1;
     }
     
-    struct line_buffer lb;
-    line_buffer_init(&lb, lines);
-    
-    char buffer[BUFFER_SIZE];
-    char current_line[256];
-    int line_pos = 0;
-    int bytes_read;
-    
-    while ((bytes_read = user_read(fd, buffer, BUFFER_SIZE - 1)) > 0) {
-        buffer[bytes_read] = '\0';
-        
-        for (int i = 0; i < bytes_read; i++) {
-            if (buffer[i] == '\n') {
-                current_line[line_pos] = '\n';
-                current_line[line_pos + 1] = '\0';
-                line_buffer_add(&lb, current_line);
-                line_pos = 0;
-            } else if (line_pos < 255) {
-                current_line[line_pos++] = buffer[i];
-            }
-        }
+    int size = user_lseek(fd, 0, SEEK_END);
+    int start = size > 0 && lines > 0 ? find_tail_start(fd, size, lines) : size;
+    if (size < 0 || start < 0 || user_lseek(fd, start, SEEK_SET) != start) {
+        user_printf("tail: cannot read '%s'\n", filename);
+        user_close(fd);
+        return -1;
     }
     
-    // Add any remaining line
-    if (line_pos > 0) {
-        current_line[line_pos] = '\n';
-        current_line[line_pos + 1] = '\0';
-        line_buffer_add(&lb, current_line);
+    int bytes_read;
+    int remaining = size - start;
+    while (remaining > 0 &&
+           (bytes_read = user_read(fd, buffer, (size_t)(remaining < BUFFER_SIZE ? remaining : BUFFER_SIZE))) > 0) {
+        user_write(1, buffer, (size_t)bytes_read);
+        remaining -= bytes_read;
     }
     
-    // Print the last lines
-    line_buffer_print(&lb);
-    
     user_close(fd);
     return 0;
 }
@@ -168,5 +158,6 @@ int user_printf(const char *format, ...) { return 0; }
 int user_puts(const char *str) { return 0; }
 int user_open(const char *path, int flags) { return -1; }
 int user_read(int fd, void *buf, size_t count) { return -1; }
+int user_write(int fd, const void *buf, size_t count) { return -1; }
 int user_close(int fd) { return -1; }
 int user_lseek(int fd, int offset, int whence) { return -1; }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#!/bin/bash
+# SFS host tools: images from tools/mkfs-sfs.py at 1KB, 4KB and 64KB
+# blocks must pass tools/fsck-sfs.py
+
+set -euo pipefail
+
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+PYTHON=${PYTHON:-python3}
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+GREEN='\033[0;32m'
+RED='\033[0;31m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+log() { echo -e "${BLUE}[SFS-TOOLS-TEST]${NC} $1"; }
+success() { echo -e "${GREEN}[SFS-TOOLS-TEST]${NC} ✅ $1"; }
+fail() { echo -e "${RED}[SFS-TOOLS-TEST]${NC} ❌ $1"; }
+
+# Inline, extent and double indirect files, and a directory big enough
+# to be hashed even with 64KB blocks
+TREE="$WORK_DIR/tree"
+mkdir -p "$TREE/bin" "$TREE/etc/deep/er" "$TREE/many"
+echo "hello" > "$TREE/etc/motd"
+head -c 5000 /dev/urandom > "$TREE/etc/deep/er/small"
+head -c 400000 /dev/urandom > "$TREE/bin/large"
+for i in $(seq 1 600); do
+    echo "$i" > "$TREE/many/entry-$i"
+done
+
+failed=0
+for size in 1k 4k 64k; do
+    for options in "" "--no-extents" "--journal"; do
+        image="$WORK_DIR/sfs-$size.img"
+        log "mkfs-sfs.py -b $size $options"
+        if ! "$PYTHON" "$PROJECT_ROOT/tools/mkfs-sfs.py" -b "$size" $options \
+                "$TREE" "$image" > /dev/null ||
+           ! "$PYTHON" "$PROJECT_ROOT/tools/fsck-sfs.py" "$image" > "$WORK_DIR/fsck.out" ||
+           ! "$PYTHON" "$PROJECT_ROOT/tools/fsck-sfs.py" --fast "$image" > /dev/null; then
+            cat "$WORK_DIR/fsck.out"
+            fail "$size blocks${options:+ with $options} do not check clean"
+            failed=1
+        fi
+    done
+done
+
+# Flip a byte of one piece of metadata in an image built without a journal:
+# the superblock's label, the last block bitmap block, the first inode
+# table block or the root directory's first block, which mkfs-sfs.py
+# puts first in the data area
+corrupt() {
+    "$PYTHON" - "$1" "$2" <<'PY'
+import struct
+import sys
+
+path, what = sys.argv[1], sys.argv[2]
+with open(path, "r+b") as f:
+    sb = f.read(64)
+    block_size, _, inode_blocks = struct.unpack_from("<3I", sb, 8)
+    first_data, bitmap_blocks = struct.unpack_from("<2I", sb, 36)
+    offset = {"superblock": 60,
+              "bitmap": (1 + bitmap_blocks) * block_size - 1,
+              "inode table": (first_data - inode_blocks) * block_size + block_size // 2,
+              "directory": first_data * block_size + block_size - 8}[what]
+    f.seek(offset)
+    byte = f.read(1)[0]
+    f.seek(offset)
+    f.write(bytes([byte ^ 0x5A]))
+PY
+}
+
+for size in 1k 4k 64k; do
+    for what in superblock bitmap "inode table" directory; do
+        image="$WORK_DIR/sfs-$size.img"
+        "$PYTHON" "$PROJECT_ROOT/tools/mkfs-sfs.py" -b "$size" "$TREE" "$image" > /dev/null
+        corrupt "$image" "$what"
+        log "fsck-sfs.py on $size blocks with a damaged $what"
+        if "$PYTHON" "$PROJECT_ROOT/tools/fsck-sfs.py" -v "$image" > "$WORK_DIR/fsck.out" ||
+           ! grep -q "$what.*fails its checksum" "$WORK_DIR/fsck.out"; then
+            cat "$WORK_DIR/fsck.out"
+            fail "a damaged $what on $size blocks was not caught by its checksum"
+            failed=1
+        fi
+    done
+done
+
+if "$PYTHON" "$PROJECT_ROOT/tools/mkfs-sfs.py" -b 3000 "$TREE" "$WORK_DIR/bad.img" 2> /dev/null; then
+    fail "mkfs-sfs.py took a block size that is not a power of two"
+    failed=1
+fi
+
+if [ "$failed" -eq 0 ]; then
+    success "SFS tools test PASSED"
+else
+    fail "SFS tools test FAILED"
+    exit 1
+fi
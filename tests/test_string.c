@@ -0,0 +1,320 @@
+/*
+ * String routine test and benchmark
+ *
+ * Built on the host by test_string.sh, which compiles the kernel's and
+ * minios_libc's string.c with their functions renamed to kernel_* and
+ * libc_*. Checks strlen, strchr, strcmp and strstr against byte-at-a-time
+ * references at every alignment 0-15 and length 0-79, with the terminator
+ * also placed against a guard page so a read past it would fault, then
+ * times each version against its reference.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ALIGN   16
+#define MAX_LEN     80
+#define BENCH_LEN   4096
+#define BENCH_ROUNDS 20000
+
+int kernel_strlen(const char *str);
+char *kernel_strchr(const char *str, int c);
+int kernel_strcmp(const char *s1, const char *s2);
+char *kernel_strstr(const char *haystack, const char *needle);
+
+size_t libc_strlen(const char *s);
+char *libc_strchr(const char *s, int c);
+int libc_strcmp(const char *s1, const char *s2);
+char *libc_strstr(const char *haystack, const char *needle);
+
+// References: the byte loops the word-at-a-time versions replaced
+
+static size_t ref_strlen(const char *s)
+{
+    size_t len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+static char *ref_strchr(const char *s, int c)
+{
+    char target = (char)c;
+    while (*s) {
+        if (*s == target) return (char *)s;
+        s++;
+    }
+    return target == '\0' ? (char *)s : NULL;
+}
+
+static int ref_strcmp(const char *s1, const char *s2)
+{
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    return (unsigned char)*s1 - (unsigned char)*s2;
+}
+
+static char *ref_strstr(const char *haystack, const char *needle)
+{
+    if (*needle == '\0') return (char *)haystack;
+    while (*haystack) {
+        const char *h = haystack;
+        const char *n = needle;
+        while (*h && *n && *h == *n) {
+            h++;
+            n++;
+        }
+        if (*n == '\0') return (char *)haystack;
+        haystack++;
+    }
+    return NULL;
+}
+
+// The two versions under test, behind one signature each
+static size_t kernel_strlen_sz(const char *s) { return (size_t)kernel_strlen(s); }
+
+struct string_impl {
+    const char *name;
+    size_t (*strlen)(const char *);
+    char *(*strchr)(const char *, int);
+    int (*strcmp)(const char *, const char *);
+    char *(*strstr)(const char *, const char *);
+};
+
+static const struct string_impl impls[] = {
+    {"kernel", kernel_strlen_sz, kernel_strchr, kernel_strcmp, kernel_strstr},
+    {"libc", libc_strlen, libc_strchr, libc_strcmp, libc_strstr},
+};
+
+static const struct string_impl reference = {
+    "reference", ref_strlen, ref_strchr, ref_strcmp, ref_strstr
+};
+
+static int failures;
+
+#define CHECK(impl, cond, fmt, ...)                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            if (failures++ < 20) {                                          \
+                printf("FAIL %s: " fmt "\n", (impl)->name, __VA_ARGS__);    \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+static int sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+// Bytes 1-255 in a pattern that repeats only every 251 positions
+static void fill(char *s, size_t len, unsigned seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (char)(1 + (seed + i * 7) % 251);
+    }
+    s[len] = '\0';
+}
+
+// Strings at the start of a scratch buffer and ending against a guard page
+static char *page_area;
+static size_t page_size;
+
+static void guard_init(void)
+{
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    page_area = mmap(NULL, page_size * 2, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page_area == MAP_FAILED || mprotect(page_area + page_size, page_size, PROT_NONE)) {
+        perror("guard page");
+        exit(2);
+    }
+}
+
+// A string of len bytes whose terminator is the last byte before the guard
+static char *guarded(size_t len)
+{
+    return page_area + page_size - len - 1;
+}
+
+static void test_strlen(const struct string_impl *impl, char *s, size_t len)
+{
+    size_t got = impl->strlen(s);
+    CHECK(impl, got == len, "strlen align %zu len %zu: got %zu",
+          (size_t)((uintptr_t)s % MAX_ALIGN), len, got);
+}
+
+static void test_strchr(const struct string_impl *impl, char *s, size_t len)
+{
+    // Every character present, high bytes included, then absent ones
+    for (size_t i = 0; i < len; i++) {
+        int c = (unsigned char)s[i];
+        CHECK(impl, impl->strchr(s, c) == ref_strchr(s, c),
+              "strchr align %zu len %zu c %#x", (size_t)((uintptr_t)s % MAX_ALIGN), len, c);
+    }
+    static const int absent[] = {'\0', 0x100 | 'a', 0xff, '!'};
+    for (size_t i = 0; i < sizeof(absent) / sizeof(absent[0]); i++) {
+        CHECK(impl, impl->strchr(s, absent[i]) == ref_strchr(s, absent[i]),
+              "strchr align %zu len %zu c %#x", (size_t)((uintptr_t)s % MAX_ALIGN), len, absent[i]);
+    }
+}
+
+static void test_strstr(const struct string_impl *impl, char *s, size_t len)
+{
+    // Needles cut from the haystack, and each one spoiled in its last byte
+    static const size_t needle_lens[] = {0, 1, 2, 3, 8, 9};
+    char needle[16];
+    for (size_t n = 0; n < sizeof(needle_lens) / sizeof(needle_lens[0]); n++) {
+        size_t nlen = needle_lens[n];
+        if (nlen > len) break;
+        for (size_t at = 0; at + nlen <= len; at += 5) {
+            memcpy(needle, s + at, nlen);
+            needle[nlen] = '\0';
+            CHECK(impl, impl->strstr(s, needle) == ref_strstr(s, needle),
+                  "strstr align %zu len %zu needle at %zu len %zu",
+                  (size_t)((uintptr_t)s % MAX_ALIGN), len, at, nlen);
+            if (nlen) {
+                needle[nlen - 1] ^= 0x40;
+                CHECK(impl, impl->strstr(s, needle) == ref_strstr(s, needle),
+                      "strstr align %zu len %zu spoiled needle at %zu len %zu",
+                      (size_t)((uintptr_t)s % MAX_ALIGN), len, at, nlen);
+            }
+        }
+    }
+}
+
+static void test_strcmp(const struct string_impl *impl, char *buf1, char *buf2)
+{
+    for (size_t a1 = 0; a1 < MAX_ALIGN; a1++) {
+        for (size_t a2 = 0; a2 < MAX_ALIGN; a2++) {
+            for (size_t len = 0; len < MAX_LEN; len++) {
+                char *s1 = buf1 + a1;
+                char *s2 = buf2 + a2;
+                fill(s1, len, 3);
+                fill(s2, len, 3);
+                CHECK(impl, impl->strcmp(s1, s2) == 0,
+                      "strcmp aligns %zu/%zu len %zu equal", a1, a2, len);
+
+                // A difference at each position, in both directions and
+                // with high bytes, and one string ending early
+                for (size_t at = 0; at < len; at++) {
+                    char saved = s2[at];
+                    s2[at] = (char)(saved == (char)0xff ? 0x01 : 0xff);
+                    CHECK(impl, sign(impl->strcmp(s1, s2)) == sign(ref_strcmp(s1, s2)) &&
+                                sign(impl->strcmp(s2, s1)) == sign(ref_strcmp(s2, s1)),
+                          "strcmp aligns %zu/%zu len %zu differs at %zu", a1, a2, len, at);
+                    s2[at] = '\0';
+                    CHECK(impl, sign(impl->strcmp(s1, s2)) == sign(ref_strcmp(s1, s2)) &&
+                                sign(impl->strcmp(s2, s1)) == sign(ref_strcmp(s2, s1)),
+                          "strcmp aligns %zu/%zu len %zu ends at %zu", a1, a2, len, at);
+                    s2[at] = saved;
+                }
+            }
+        }
+    }
+}
+
+static void test_impl(const struct string_impl *impl, char *buf1, char *buf2)
+{
+    for (size_t align = 0; align < MAX_ALIGN; align++) {
+        for (size_t len = 0; len < MAX_LEN; len++) {
+            char *s = buf1 + align;
+            fill(s, len, (unsigned)(align * 31 + len));
+            test_strlen(impl, s, len);
+            test_strchr(impl, s, len);
+            test_strstr(impl, s, len);
+
+            // Same string ending at the guard page; its alignment follows
+            // from the length there
+            char *g = guarded(len);
+            memcpy(g, s, len + 1);
+            test_strlen(impl, g, len);
+            test_strchr(impl, g, len);
+            test_strstr(impl, g, len);
+            CHECK(impl, impl->strcmp(g, s) == 0, "strcmp guarded align %zu len %zu", align, len);
+        }
+    }
+    test_strcmp(impl, buf1, buf2);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Keeps results alive so the timed calls are not optimized out
+static volatile uintptr_t sink;
+
+static double bench(const struct string_impl *impl, int which, const char *s1, const char *s2,
+                    const char *needle)
+{
+    double start = now();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        switch (which) {
+            case 0: sink += impl->strlen(s1); break;
+            case 1: sink += (uintptr_t)impl->strchr(s1, 0xff); break;
+            case 2: sink += (uintptr_t)impl->strcmp(s1, s2); break;
+            default: sink += (uintptr_t)impl->strstr(s1, needle); break;
+        }
+    }
+    return (now() - start) / BENCH_ROUNDS * 1e9;
+}
+
+static void benchmark(char *buf1, char *buf2)
+{
+    static const char *names[] = {"strlen", "strchr", "strcmp", "strstr"};
+    char needle[] = "zzzzq";
+
+    // Long strings, fully scanned: strchr looks for a byte fill() never
+    // makes, and the needle's first byte turns up every 251 bytes
+    fill(buf1, BENCH_LEN, 0);
+    memcpy(buf2, buf1, BENCH_LEN + 1);
+
+    printf("\n%-8s %12s", "ns/call", reference.name);
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        printf(" %12s", impls[i].name);
+    }
+    printf("   (%d-byte strings)\n", BENCH_LEN);
+
+    for (int which = 0; which < 4; which++) {
+        printf("%-8s %12.1f", names[which], bench(&reference, which, buf1, buf2, needle));
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            printf(" %12.1f", bench(&impls[i], which, buf1, buf2, needle));
+        }
+        printf("\n");
+    }
+}
+
+int main(void)
+{
+    guard_init();
+    char *buf1 = aligned_alloc(64, BENCH_LEN + 64);
+    char *buf2 = aligned_alloc(64, BENCH_LEN + 64);
+    if (!buf1 || !buf2) {
+        perror("aligned_alloc");
+        return 2;
+    }
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        int before = failures;
+        test_impl(&impls[i], buf1, buf2);
+        printf("%-8s %s\n", impls[i].name, failures == before ? "ok" : "FAILED");
+    }
+
+    if (!failures) {
+        benchmark(buf1, buf2);
+    }
+
+    free(buf1);
+    free(buf2);
+    return failures ? 1 : 0;
+}
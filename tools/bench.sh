@@ -0,0 +1,106 @@
+#!/bin/bash
+# MiniOS Microbenchmark Runner
+# Boots the kernel in QEMU, runs the shell's bench command and keeps the
+# BENCH lines it prints for regression tracking
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
+BUILD_DIR="$PROJECT_ROOT/build"
+
+# Default values
+ARCH=${1:-arm64}
+TIMEOUT=${2:-120}
+BENCH_ARGS=${BENCH_ARGS:-}
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+log() {
+    echo -e "${BLUE}[BENCH]${NC} $1"
+}
+
+error() {
+    echo -e "${RED}[BENCH]${NC} $1"
+}
+
+success() {
+    echo -e "${GREEN}[BENCH]${NC} $1"
+}
+
+case $ARCH in
+    arm64)
+        KERNEL_FILE="$BUILD_DIR/$ARCH/kernel.elf"
+        VM_CMD="qemu-system-aarch64 -machine virt -cpu cortex-a72 -m 512M"
+        VM_CMD="$VM_CMD -kernel $KERNEL_FILE -append console=uart,mmio,0x9000000"
+        BOOT_FILE="$KERNEL_FILE"
+        ;;
+    x86_64)
+        IMAGE_FILE="$BUILD_DIR/$ARCH/minios.iso"
+        VM_CMD="qemu-system-x86_64 -m 512M -cdrom $IMAGE_FILE -boot d"
+        BOOT_FILE="$IMAGE_FILE"
+        ;;
+    *)
+        error "Unknown architecture: $ARCH"
+        echo "Usage: $0 {arm64|x86_64} [timeout_seconds]"
+        exit 1
+        ;;
+esac
+VM_CMD="$VM_CMD -nographic -serial stdio -monitor none"
+
+if [ ! -f "$BOOT_FILE" ]; then
+    error "Not found: $BOOT_FILE"
+    echo "Run 'make ARCH=$ARCH' first"
+    exit 1
+fi
+
+LOG_FILE="$BUILD_DIR/bench-output-$ARCH.log"
+RESULT_FILE="$BUILD_DIR/bench-$ARCH.txt"
+WORK_DIR="$(mktemp -d)"
+CONSOLE="$WORK_DIR/console"
+mkfifo "$CONSOLE"
+trap 'kill $VM_PID 2>/dev/null; rm -rf "$WORK_DIR"' EXIT
+
+log "Running benchmarks on $ARCH (timeout ${TIMEOUT}s)"
+mkdir -p "$BUILD_DIR"
+: > "$LOG_FILE"
+
+# Keep the console open for writing so QEMU never sees end of input
+exec 3<>"$CONSOLE"
+$VM_CMD < "$CONSOLE" > "$LOG_FILE" 2>&1 &
+VM_PID=$!
+
+# Wait for the shell, send the command, then wait for the prompt to return
+wait_for_prompts() {
+    local count=$1
+    while [ "$(grep -c 'Shell>' "$LOG_FILE" 2>/dev/null)" -lt "$count" ]; do
+        if ! kill -0 $VM_PID 2>/dev/null || [ $SECONDS -ge $TIMEOUT ]; then
+            return 1
+        fi
+        sleep 1
+    done
+}
+
+SECONDS=0
+if ! wait_for_prompts 1; then
+    error "Shell prompt never appeared; see $LOG_FILE"
+    exit 1
+fi
+printf 'bench %s\r' "$BENCH_ARGS" >&3
+if ! wait_for_prompts 2; then
+    error "bench did not finish within ${TIMEOUT}s; see $LOG_FILE"
+    exit 1
+fi
+
+tr -d '\r' < "$LOG_FILE" | grep '^BENCH' > "$RESULT_FILE" || true
+if ! grep -q '^BENCH_COUNTER' "$RESULT_FILE"; then
+    error "No results in output; see $LOG_FILE"
+    exit 1
+fi
+
+success "$(grep -c '^BENCH ' "$RESULT_FILE") results written to $RESULT_FILE"
+cat "$RESULT_FILE"
@@ -0,0 +1,546 @@
+#!/usr/bin/env python3
+
+"""
+MiniOS SFS Image Checker
+
+The host side of the shell's 'fsck': checks an SFS image, or an SFS
+partition inside a disk image, without booting. The inode table and the
+directories are read by a pool of processes, one per CPU; ownership,
+reachability and the bitmap and superblock comparisons run in the parent,
+the same passes as src/fs/sfs/sfs_fsck.c, metadata checksums included.
+The image is only read; repair it in the kernel with 'fsck -y'. Any block
+size SFS formats with, 1KB to 64KB, is read; the layout follows from the
+superblock's.
+
+    tools/fsck-sfs.py disk.img                      # full check
+    tools/fsck-sfs.py --fast disk.img               # counters against bitmaps
+    tools/fsck-sfs.py --offset 1048576 disk.img     # partition at 1 MiB
+
+Exits 0 when the filesystem is clean, 1 when problems were found and 2
+when the image could not be checked.
+"""
+
+import argparse
+import mmap
+import multiprocessing
+import os
+import struct
+import sys
+
+MIN_BLOCK_SIZE = 1024
+MAX_BLOCK_SIZE = 65536
+SUPERBLOCK_SIZE = 4096                          # Front of block 0, or all of a smaller one
+MAGIC = 0x53465300
+BITMAP_START = 1
+
+FEATURE_INODE_BITMAP = 0x0004
+FEATURE_JOURNAL = 0x0008
+FEATURE_LAZY_ITABLE = 0x0010
+FEATURE_METADATA_CSUM = 0x0040
+
+ITABLE_MAX_GROUPS = 1024
+CSUM_MAX_BITMAPS = 512
+CRC32C_POLY = 0x82F63B78
+
+INODE_EXTENTS = 0x0001
+INODE_DIR_INDEX = 0x0002
+INODE_INLINE = 0x0004
+
+TYPE_DIRECTORY = 0x4000
+
+DIRECT_BLOCKS = 12
+INLINE_EXTENTS = 4
+EXTENT_SIZE = 12                                # struct sfs_extent
+EXTENT_UNWRITTEN = 0x80000000
+
+DIR_INDEX_MAGIC = 0x53464449
+DIR_LEAF_MAGIC = 0x5346444C
+JOURNAL_MAGIC = 0x53464A53
+JOURNAL_DESC_MAGIC = 0x53464A44
+
+SUPERBLOCK = struct.Struct("<14I32s5I")         # struct sfs_superblock, up to itable_uninit
+BITMAP_CSUM_OFFSET = SUPERBLOCK.size + ITABLE_MAX_GROUPS // 8
+INODE = struct.Struct("<3I13I6I")               # struct sfs_inode
+DIRENT = struct.Struct("<IHH255s")              # struct sfs_dirent
+DIRENT_SIZE = 264                               # Padded to 4 bytes
+DIR_LEAF_TAIL_SIZE = 16                         # struct sfs_dir_leaf_tail
+
+SB_FIELDS = ("magic", "version", "block_size", "total_blocks", "inode_blocks", "data_blocks",
+             "free_blocks", "free_inodes", "root_inode", "first_data_block", "bitmap_blocks",
+             "created_time", "modified_time", "mount_count", "label", "features",
+             "inode_bitmap_blocks", "journal_start", "journal_blocks", "itable_group_blocks")
+
+
+class Geometry:
+    """The layout for a block size, as sfs_geometry_init() works it out;
+    inode table and directory blocks keep their last word for a checksum"""
+
+    def __init__(self, block_size):
+        if (not MIN_BLOCK_SIZE <= block_size <= MAX_BLOCK_SIZE or
+                block_size & (block_size - 1)):
+            raise RuntimeError(f"no SFS superblock (block size {block_size})")
+        self.block_size = block_size
+        self.csum_offset = block_size - 4
+        self.ptrs_per_block = block_size // 4
+        self.inodes_per_block = self.csum_offset // INODE.size
+        self.dirents_per_block = (self.csum_offset - DIR_LEAF_TAIL_SIZE) // DIRENT_SIZE
+        self.dir_tail_offset = self.dirents_per_block * DIRENT_SIZE
+        self.extents_per_block = block_size // EXTENT_SIZE
+        self.max_extents = INLINE_EXTENTS + self.extents_per_block
+
+
+class Image:
+    """Blocks of an SFS filesystem starting offset bytes into a file; the
+    geometry is known once the superblock has been read"""
+
+    def __init__(self, path, offset, geo=None):
+        self.file = open(path, "rb")
+        self.map = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+        self.offset = offset
+        self.geo = geo
+
+    def block(self, number, count=1):
+        size = self.geo.block_size
+        start = self.offset + number * size
+        data = self.map[start:start + count * size]
+        if len(data) != count * size:
+            raise RuntimeError(f"block {number} is past the end of the image")
+        return data
+
+    def u32s(self, number):
+        return struct.unpack(f"<{self.geo.ptrs_per_block}I", self.block(number))
+
+
+def crc32c_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (CRC32C_POLY if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+
+CRC32C_TABLE = crc32c_table()
+
+
+def crc32c(crc, data):
+    """As the kernel's crc32c(): reflected, inverted on the way in and out"""
+    crc ^= 0xFFFFFFFF
+    for byte in data:
+        crc = CRC32C_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+def csum_data(block_num, data):
+    """sfs_csum_data(): seeded with the block number, so that a block
+    written to the wrong place fails as well"""
+    return crc32c(crc32c(0, struct.pack("<I", block_num)), data)
+
+
+def csum_ok(block_num, raw):
+    """sfs_csum_verify(): a block against the checksum in its last word.
+    An all-zero block passes; the kernel zeroes inode table blocks in bulk
+    and seals them when an inode is first written to them."""
+    stored = struct.unpack_from("<I", raw, len(raw) - 4)[0]
+    if stored == 0 and raw.count(0) == len(raw):
+        return True
+    return stored == csum_data(block_num, raw[:-4])
+
+
+def read_superblock(image):
+    """The superblock is the first 4KB of block 0, or all of a smaller
+    block; its block size gives the image its geometry"""
+    raw = image.map[image.offset:image.offset + SUPERBLOCK_SIZE]
+    if len(raw) < SUPERBLOCK.size:
+        raise RuntimeError("no SFS superblock")
+    sb = dict(zip(SB_FIELDS, SUPERBLOCK.unpack_from(raw)))
+    if sb["magic"] != MAGIC:
+        raise RuntimeError("no SFS superblock")
+    image.geo = Geometry(sb["block_size"])
+    raw = raw[:min(sb["block_size"], SUPERBLOCK_SIZE)]
+    sb["itable_uninit"] = raw[SUPERBLOCK.size:SUPERBLOCK.size + 128]
+    if (sb["root_inode"] == 0 or sb["first_data_block"] >= sb["total_blocks"] or
+            sb["bitmap_blocks"] * sb["block_size"] * 8 < sb["total_blocks"]):
+        raise RuntimeError("superblock is damaged")
+    if sb["features"] & FEATURE_METADATA_CSUM:
+        # The checksums stop short of the superblock's own, in its last word
+        room = min((len(raw) - 4 - BITMAP_CSUM_OFFSET) // 4, CSUM_MAX_BITMAPS)
+        bitmaps = sb["bitmap_blocks"] + sb["inode_bitmap_blocks"]
+        if bitmaps > room:
+            raise RuntimeError("superblock is damaged (too many bitmap blocks for checksums)")
+        sb["bitmap_csum"] = struct.unpack_from(f"<{bitmaps}I", raw, BITMAP_CSUM_OFFSET)
+        sb["csum_ok"] = csum_ok(0, raw)
+    return sb
+
+
+def test_bit(bitmap, bit):
+    return (bitmap[bit >> 3] >> (bit & 7)) & 1
+
+
+def table_start(sb):
+    journal = sb["journal_blocks"] if sb["features"] & FEATURE_JOURNAL else 0
+    return sb["first_data_block"] - journal - sb["inode_blocks"]
+
+
+def itable_uninit(sb, block_index):
+    return (sb["features"] & FEATURE_LAZY_ITABLE and
+            test_bit(sb["itable_uninit"], block_index // sb["itable_group_blocks"]))
+
+
+def inode_fields(raw):
+    """Mode, the block pointer area as pointers and as bytes, flags, and the
+    last word: double_indirect, or extent_count with INODE_EXTENTS"""
+    fields = INODE.unpack(raw)
+    return fields[0], fields[3:16], raw[12:64], fields[20], fields[21]
+
+
+def walk(image, sb, inode_raw):
+    """(file block, device block, data) for every block an inode maps"""
+    mode, ptrs, area, flags, last = inode_fields(inode_raw)
+    if flags & INODE_INLINE:
+        return
+
+    if flags & INODE_EXTENTS:
+        count = min(last, image.geo.max_extents)
+        extents = [struct.unpack_from("<3I", area, EXTENT_SIZE * i)
+                   for i in range(INLINE_EXTENTS)]
+        extent_block = ptrs[12]
+        if count > INLINE_EXTENTS:
+            if not extent_block:
+                count = INLINE_EXTENTS
+            else:
+                yield 0, extent_block, False
+                if in_data(sb, extent_block):
+                    raw = image.block(extent_block)
+                    extents += [struct.unpack_from("<3I", raw, EXTENT_SIZE * i)
+                                for i in range(count - INLINE_EXTENTS)]
+                else:
+                    count = INLINE_EXTENTS
+        for logical, start, length in extents[:count]:
+            for j in range(length & ~EXTENT_UNWRITTEN):
+                yield logical + j, start + j, True
+                if not in_data(sb, start + j):
+                    break                   # The rest of a damaged run is not walked
+        return
+
+    for i, block in enumerate(ptrs[:DIRECT_BLOCKS]):
+        if block:
+            yield i, block, True
+
+    indirect = ptrs[DIRECT_BLOCKS]
+    if indirect:
+        yield 0, indirect, False
+        if in_data(sb, indirect):
+            for i, block in enumerate(image.u32s(indirect)):
+                if block:
+                    yield DIRECT_BLOCKS + i, block, True
+
+    if last:
+        yield 0, last, False
+        if in_data(sb, last):
+            per_block = image.geo.ptrs_per_block
+            base = DIRECT_BLOCKS + per_block
+            for i, leaf in enumerate(image.u32s(last)):
+                if not leaf:
+                    continue
+                yield 0, leaf, False
+                if not in_data(sb, leaf):
+                    continue
+                for j, block in enumerate(image.u32s(leaf)):
+                    if block:
+                        yield base + i * per_block + j, block, True
+
+
+def in_data(sb, block):
+    return sb["first_data_block"] <= block < sb["total_blocks"]
+
+
+# Worker state, set once per process by the pool initializer
+worker = {}
+
+
+def worker_init(path, offset, sb):
+    worker["image"] = Image(path, offset, Geometry(sb["block_size"]))
+    worker["sb"] = sb
+
+
+def scan_inodes(span):
+    """Pass 1 over inode table blocks [first, end): in-use inodes and their
+    blocks, and blocks that fail their checksum"""
+    image, sb = worker["image"], worker["sb"]
+    table = table_start(sb)
+    per_block = image.geo.inodes_per_block
+    csum = sb["features"] & FEATURE_METADATA_CSUM
+    first, end = span
+    found, damaged = [], []
+    for block in range(first, end):
+        if itable_uninit(sb, block):
+            continue
+        raw = image.block(table + block)
+        if csum and not csum_ok(table + block, raw):
+            damaged.append(f"inode table block {table + block} fails its checksum")
+        for entry in range(per_block):
+            inode_raw = raw[entry * INODE.size:(entry + 1) * INODE.size]
+            mode = struct.unpack_from("<I", inode_raw)[0]
+            if mode == 0:
+                continue
+            ino = block * per_block + entry + 1
+            blocks = [number for _, number, _ in walk(image, sb, inode_raw)]
+            found.append((ino, bool(mode & TYPE_DIRECTORY), blocks))
+    return found, damaged
+
+
+def read_inode(image, sb, ino):
+    index = ino - 1
+    per_block = image.geo.inodes_per_block
+    raw = image.block(table_start(sb) + index // per_block)
+    start = (index % per_block) * INODE.size
+    return raw[start:start + INODE.size]
+
+
+def scan_dirs(dirs):
+    """Pass 2 over some directories: every name, and damaged index or leaf
+    blocks or ones that fail their checksum"""
+    image, sb = worker["image"], worker["sb"]
+    geo = image.geo
+    csum = sb["features"] & FEATURE_METADATA_CSUM
+    names, damaged = [], []
+    for ino in dirs:
+        inode_raw = read_inode(image, sb, ino)
+        indexed = inode_fields(inode_raw)[3] & INODE_DIR_INDEX
+        for logical, block, data in walk(image, sb, inode_raw):
+            if not data or not in_data(sb, block):
+                continue
+            raw = image.block(block)
+            if csum and not csum_ok(block, raw):
+                damaged.append(f"directory {ino}: block {block} fails its checksum")
+            if indexed:
+                if logical == 0:
+                    if struct.unpack_from("<I", raw)[0] != DIR_INDEX_MAGIC:
+                        damaged.append(f"directory {ino}: index block {block} is damaged")
+                    continue
+                if struct.unpack_from("<I", raw, geo.dir_tail_offset)[0] != DIR_LEAF_MAGIC:
+                    damaged.append(f"directory {ino}: leaf block {block} is damaged")
+            for i in range(geo.dirents_per_block):
+                target, _, name_len, name = DIRENT.unpack_from(raw, i * DIRENT_SIZE)
+                if target:
+                    name = name[:min(name_len, 255)].decode(errors="replace")
+                    names.append((ino, target, name))
+    return names, damaged
+
+
+def popcount(bitmap, bits):
+    value = int.from_bytes(bitmap[:(bits + 7) // 8], "little")
+    return bin(value & ((1 << bits) - 1)).count("1")
+
+
+def journal_pending(image, sb):
+    """Whether the journal starts with a transaction; replay needs the kernel"""
+    if not sb["features"] & FEATURE_JOURNAL:
+        return False
+    magic, blocks, sequence = struct.unpack_from("<3I", image.block(sb["journal_start"]))
+    if magic != JOURNAL_MAGIC or blocks != sb["journal_blocks"]:
+        raise RuntimeError("journal header is damaged")
+    desc_magic, desc_sequence = struct.unpack_from("<2I", image.block(sb["journal_start"] + 1))
+    return desc_magic == JOURNAL_DESC_MAGIC and desc_sequence == sequence
+
+
+class Report:
+    def __init__(self, verbose):
+        self.verbose = verbose
+        self.problems = 0
+        self.shown = 0
+
+    def problem(self, message, count=1):
+        self.problems += count
+        if self.verbose or self.shown < 16:
+            print(f"fsck: {message}")
+        self.shown += 1
+
+    def finish(self):
+        if self.shown > 16 and not self.verbose:
+            print(f"fsck: {self.shown - 16} more problems not shown")
+
+
+def check_csums(sb, bitmap, inode_bitmap, report):
+    """The superblock, and the bitmap blocks against the checksums it holds
+    for them: block bitmap first, then inode bitmap"""
+    if not sb["features"] & FEATURE_METADATA_CSUM:
+        return
+    if not sb["csum_ok"]:
+        report.problem("superblock fails its checksum")
+    size = sb["block_size"]
+    blocks = [bitmap[i * size:(i + 1) * size] for i in range(sb["bitmap_blocks"])]
+    if inode_bitmap is not None:
+        blocks += [inode_bitmap[i * size:(i + 1) * size]
+                   for i in range(sb["inode_bitmap_blocks"])]
+    for i, data in enumerate(blocks):
+        if csum_data(BITMAP_START + i, data) != sb["bitmap_csum"][i]:
+            report.problem(f"bitmap block {BITMAP_START + i} fails its checksum")
+
+
+def check_counters(sb, free_blocks, free_inodes, report):
+    if sb["free_blocks"] != free_blocks:
+        report.problem(f"superblock has {sb['free_blocks']} free blocks, bitmap {free_blocks}")
+    if sb["free_inodes"] != free_inodes:
+        report.problem(f"superblock has {sb['free_inodes']} free inodes, bitmap {free_inodes}")
+
+
+def check_fast(image, sb, bitmap, inode_bitmap, total_inodes, report):
+    unmarked = sum(1 for block in range(sb["first_data_block"]) if not test_bit(bitmap, block))
+    if unmarked:
+        report.problem(f"{unmarked} metadata blocks are marked free", unmarked)
+    used_blocks = popcount(bitmap, sb["total_blocks"]) + unmarked
+    if inode_bitmap is not None:
+        used_inodes = popcount(inode_bitmap, total_inodes)
+    else:
+        table = table_start(sb)
+        used_inodes = 0
+        for block in range(sb["inode_blocks"]):
+            raw = image.block(table + block)
+            used_inodes += sum(1 for entry in range(image.geo.inodes_per_block)
+                               if struct.unpack_from("<I", raw, entry * INODE.size)[0])
+    check_counters(sb, sb["total_blocks"] - used_blocks, total_inodes - used_inodes, report)
+    return used_blocks, used_inodes
+
+
+def split(count, parts):
+    step = (count + parts - 1) // parts
+    return [(first, min(first + step, count)) for first in range(0, count, step or 1)]
+
+
+def check_full(pool, jobs, sb, bitmap, inode_bitmap, total_inodes, report):
+    total = sb["total_blocks"]
+    owned = bytearray((total + 7) // 8)
+    for block in range(sb["first_data_block"]):
+        owned[block >> 3] |= 1 << (block & 7)
+
+    # Pass 1: ownership, claimed in the parent so a duplicate is seen once
+    state = {}
+    blocks_of = {}
+    for found, damaged in pool.map(scan_inodes, split(sb["inode_blocks"], jobs * 4)):
+        for message in damaged:
+            report.problem(message)
+        for ino, is_dir, blocks in found:
+            state[ino] = is_dir
+            blocks_of[ino] = blocks
+            for block in blocks:
+                if not in_data(sb, block):
+                    report.problem(f"inode {ino}: block {block} is outside the data area")
+                    continue
+                bit = 1 << (block & 7)
+                if owned[block >> 3] & bit:
+                    report.problem(f"inode {ino}: block {block} is claimed twice")
+                owned[block >> 3] |= bit
+
+    root = sb["root_inode"]
+    if state.get(root) is not True:
+        raise RuntimeError("the root inode is not a directory")
+    dirs = sorted(ino for ino, is_dir in state.items() if is_dir)
+
+    # Pass 2: names
+    parent = {}
+    chunks = [dirs[first:end] for first, end in split(len(dirs), jobs * 4)]
+    for names, damaged in pool.map(scan_dirs, chunks):
+        for message in damaged:
+            report.problem(message)
+        for ino, target, name in names:
+            if target > total_inodes or target == root or target not in state:
+                report.problem(f"directory {ino}: '{name[:40]}' names free inode {target}")
+            elif target in parent:
+                report.problem(f"inode {target}: second name '{name[:40]}' in directory {ino}")
+            else:
+                parent[target] = ino
+
+    # Pass 3: reachability, then the bitmaps and counters
+    reachable = {root: True}
+    for ino in sorted(state):
+        chain = []
+        at = ino
+        while at not in reachable and at not in chain:
+            chain.append(at)
+            at = parent.get(at, 0)
+            if not at:
+                break
+        outcome = bool(at) and reachable.get(at, False)
+        for member in chain:
+            reachable[member] = outcome
+        if not reachable[ino]:
+            report.problem(f"inode {ino} is in no directory")
+
+    if inode_bitmap is not None:
+        for index in range(total_inodes):
+            in_use = (index + 1) in state
+            if test_bit(inode_bitmap, index) != in_use:
+                report.problem(f"inode {index + 1} is {'in use' if in_use else 'free'} "
+                               f"but marked {'free' if in_use else 'in use'}")
+
+    disk = int.from_bytes(bitmap[:len(owned)], "little")
+    ours = int.from_bytes(owned, "little")
+    valid = (1 << total) - 1
+    missing = ours & ~disk & valid
+    leaked = disk & ~ours & valid
+    for block in range(total):
+        if missing >> block & 1:
+            report.problem(f"block {block} is in use but marked free")
+    if leaked:
+        count = bin(leaked).count("1")
+        report.problem(f"{count} blocks are marked in use but owned by nothing", count)
+
+    used_blocks = bin(ours & valid).count("1")
+    check_counters(sb, total - used_blocks, total_inodes - len(state), report)
+    return used_blocks, len(state), len(dirs)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check an SFS filesystem image")
+    parser.add_argument("image", help="disk or filesystem image")
+    parser.add_argument("--offset", type=int, default=0,
+                        help="byte offset of the filesystem in the image")
+    parser.add_argument("--fast", action="store_true",
+                        help="only check the superblock counters against the bitmaps")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count() or 1,
+                        help="processes reading the image (default: one per CPU)")
+    parser.add_argument("-v", "--verbose", action="store_true",
+                        help="show every problem, not just the first 16")
+    args = parser.parse_args()
+
+    try:
+        image = Image(args.image, args.offset)
+        sb = read_superblock(image)
+        total_inodes = sb["inode_blocks"] * image.geo.inodes_per_block
+        if sb["root_inode"] > total_inodes:
+            raise RuntimeError("root inode outside the inode table")
+        if journal_pending(image, sb):
+            print("fsck: the journal holds transactions; counts may be off until it is replayed")
+        bitmap = image.block(BITMAP_START, sb["bitmap_blocks"])
+        inode_bitmap = None
+        if sb["features"] & FEATURE_INODE_BITMAP:
+            inode_bitmap = image.block(BITMAP_START + sb["bitmap_blocks"],
+                                       sb["inode_bitmap_blocks"])
+
+        report = Report(args.verbose)
+        check_csums(sb, bitmap, inode_bitmap, report)
+        if args.fast:
+            used_blocks, used_inodes = check_fast(image, sb, bitmap, inode_bitmap,
+                                                  total_inodes, report)
+            summary = f"{used_inodes} inodes"
+        else:
+            jobs = max(1, args.jobs)
+            with multiprocessing.Pool(jobs, worker_init, (args.image, args.offset, sb)) as pool:
+                used_blocks, used_inodes, dirs = check_full(pool, jobs, sb, bitmap, inode_bitmap,
+                                                            total_inodes, report)
+            summary = f"{used_inodes} inodes ({dirs} directories)"
+    except (OSError, RuntimeError, ValueError) as e:
+        print(f"{args.image}: {e}", file=sys.stderr)
+        return 2
+
+    report.finish()
+    print(f"{summary}, {used_blocks}/{sb['total_blocks']} blocks in use")
+    print("clean" if not report.problems else f"{report.problems} problems")
+    return 1 if report.problems else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+
+"""
+MiniOS Kernel Symbol Table Generator
+
+The kernel is loaded without its ELF symbol table, so the build links it
+twice: first with an empty table, then with the text symbols of the first
+link compiled in as C (see ksyms.h). The table lives in its own section
+after .bss, so filling it in moves no code and every address in it holds
+for the second link too.
+
+    tools/gen-ksyms.py --empty > ksyms.c           # for the first link
+    tools/gen-ksyms.py build/arm64/kernel.elf > ksyms.c
+"""
+
+import argparse
+import struct
+import sys
+
+SHT_SYMTAB = 2
+SHF_EXECINSTR = 0x4
+STT_NOTYPE = 0
+STT_FUNC = 2
+STB_LOCAL = 0
+SHN_LORESERVE = 0xff00
+
+
+def read_symbols(path):
+    """(address, name, is_func, is_global) for each code symbol, and the end of the code"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 2 or data[5] != 1:
+        raise ValueError(f"{path}: not a little-endian ELF64 file")
+
+    shoff, = struct.unpack_from("<Q", data, 0x28)
+    shentsize, shnum = struct.unpack_from("<HH", data, 0x3a)
+    sections = []
+    for i in range(shnum):
+        # sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link, sh_info, sh_addralign, sh_entsize
+        sections.append(struct.unpack_from("<IIQQQQIIQQ", data, shoff + i * shentsize))
+
+    code = {i for i, s in enumerate(sections) if s[2] & SHF_EXECINSTR}
+    text_end = max((sections[i][3] + sections[i][5] for i in code), default=0)
+
+    symbols = []
+    for sh_type, offset, size, link, entsize in ((s[1], s[4], s[5], s[6], s[9]) for s in sections):
+        if sh_type != SHT_SYMTAB:
+            continue
+        strtab = sections[link][4]
+        for pos in range(offset, offset + size, entsize):
+            st_name, st_info, _, st_shndx, st_value, _ = struct.unpack_from("<IBBHQQ", data, pos)
+            kind, binding = st_info & 0xf, st_info >> 4
+            if st_shndx >= SHN_LORESERVE or st_shndx not in code or kind not in (STT_FUNC, STT_NOTYPE):
+                continue
+            name = data[strtab + st_name:data.index(b"\0", strtab + st_name)].decode()
+            # Skip ARM mapping symbols ($x, $d) and assembler-local labels
+            if not name or name.startswith(("$", ".L")):
+                continue
+            symbols.append((st_value, name, kind == STT_FUNC, binding != STB_LOCAL))
+    return symbols, text_end
+
+
+def unique_by_address(symbols):
+    """One name per address: functions over labels, then globals over locals"""
+    best = {}
+    for address, name, is_func, is_global in symbols:
+        rank = (is_func, is_global, name)
+        if address not in best or rank > best[address][0]:
+            best[address] = (rank, name)
+    return [(address, best[address][1]) for address in sorted(best)]
+
+
+def emit(symbols, text_end, out):
+    names = bytearray()
+    offsets = []
+    for _, name in symbols:
+        offsets.append(len(names))
+        names += name.encode() + b"\0"
+
+    out.write("/* Generated by tools/gen-ksyms.py; do not edit */\n\n")
+    out.write('#include "ksyms.h"\n\n')
+    out.write("#define KSYMS __attribute__((section(\".ksyms\")))\n\n")
+    out.write(f"const uint32_t ksyms_num KSYMS = {len(symbols)};\n")
+    out.write(f"const uint64_t ksyms_text_end KSYMS = 0x{text_end:x};\n\n")
+
+    # At least one element each, so the empty table is valid C
+    out.write("const uint64_t ksyms_addresses[] KSYMS = {\n")
+    for address, _ in symbols or [(0, "")]:
+        out.write(f"    0x{address:x},\n")
+    out.write("};\n\n")
+    out.write("const uint32_t ksyms_name_offsets[] KSYMS = {\n")
+    for offset in offsets or [0]:
+        out.write(f"    {offset},\n")
+    out.write("};\n\n")
+    out.write("const char ksyms_names[] KSYMS =\n")
+    for _, name in symbols:
+        out.write(f'    "{name}\\0"\n')
+    out.write('    "";\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the kernel's built-in symbol table")
+    parser.add_argument("elf", nargs="?", help="kernel linked with the empty table")
+    parser.add_argument("--empty", action="store_true", help="write the table for the first link")
+    args = parser.parse_args()
+    if args.empty == bool(args.elf):
+        parser.error("give either the kernel ELF or --empty")
+
+    if args.empty:
+        emit([], 0, sys.stdout)
+    else:
+        symbols, text_end = read_symbols(args.elf)
+        emit(unique_by_address(symbols), text_end, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
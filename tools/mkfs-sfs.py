@@ -0,0 +1,544 @@
+#!/usr/bin/env python3
+
+"""
+MiniOS SFS Image Builder
+
+Builds an SFS filesystem image from a host directory, laid out the way
+the kernel's format would lay it out, with every file already written:
+each directory's blocks are followed by its files, each file is one
+contiguous run mapped by a single extent (or by filled-in direct and
+indirect blocks with --no-extents), and files of up to 52 bytes live in
+their inode. Directories with more than one block of entries are built
+hashed, and metadata is checksummed as the kernel's format would. The kernel mounts the image as its root with root=vda on the
+command line, or ROOT=vda at build time, and so boots without formatting
+or populating anything.
+
+    tools/mkfs-sfs.py rootfs/ rootfs.img              # sized to fit, with room to grow
+    tools/mkfs-sfs.py --size 64 rootfs/ rootfs.img    # 64 MiB
+    tools/mkfs-sfs.py --journal rootfs/ rootfs.img
+    tools/mkfs-sfs.py -b 1k rootfs/ rootfs.img        # 1KB blocks, as 'mkfs -b 1k'
+
+The image is written sparse; blocks nothing uses are holes.
+"""
+
+import argparse
+import os
+import stat
+import struct
+import sys
+
+DEFAULT_BLOCK_SIZE = 4096
+MIN_BLOCK_SIZE = 1024
+MAX_BLOCK_SIZE = 65536
+SUPERBLOCK_SIZE = 4096                          # Front of block 0, or all of a smaller one
+MAGIC = 0x53465300
+VERSION = 1
+BITMAP_START = 1
+
+FEATURE_EXTENTS = 0x0001
+FEATURE_DIR_INDEX = 0x0002
+FEATURE_INODE_BITMAP = 0x0004
+FEATURE_JOURNAL = 0x0008
+FEATURE_LAZY_ITABLE = 0x0010
+FEATURE_INLINE_DATA = 0x0020
+FEATURE_METADATA_CSUM = 0x0040
+
+INODE_EXTENTS = 0x0001
+INODE_DIR_INDEX = 0x0002
+INODE_INLINE = 0x0004
+
+TYPE_FILE = 0x1000
+TYPE_DIRECTORY = 0x4000
+PERM_READ = 0x0004
+PERM_WRITE = 0x0002
+PERM_EXEC = 0x0001
+
+INODE_SIZE = 88
+DIRECT_BLOCKS = 12
+INLINE_DATA_SIZE = (DIRECT_BLOCKS + 1) * 4
+MAX_NAME = 255
+DIRENT = struct.Struct("<IHH255sx")            # struct sfs_dirent, padded to 264
+DIR_INDEX_SIZE = 16                             # struct sfs_dir_index, before its buckets
+DIR_LEAF_TAIL_SIZE = 16                         # struct sfs_dir_leaf_tail
+DIR_INDEX_MAGIC = 0x53464449
+DIR_LEAF_MAGIC = 0x5346444C
+
+ITABLE_MAX_GROUPS = 1024
+ITABLE_MIN_GROUP = 16
+CSUM_MAX_BITMAPS = 512
+CRC32C_POLY = 0x82F63B78
+JOURNAL_MIN_BLOCKS = 64
+JOURNAL_MAX_BLOCKS = 1024
+JOURNAL_MAGIC = 0x53464A53
+
+SUPERBLOCK = struct.Struct("<14I32s5I")         # struct sfs_superblock, up to itable_uninit
+BITMAP_CSUM_OFFSET = SUPERBLOCK.size + ITABLE_MAX_GROUPS // 8
+
+
+class Geometry:
+    """The layout for a block size, as sfs_geometry_init() works it out;
+    inode table and directory blocks keep their last word for a checksum"""
+
+    def __init__(self, block_size):
+        self.block_size = block_size
+        self.csum_offset = block_size - 4
+        self.ptrs_per_block = block_size // 4
+        self.inodes_per_block = self.csum_offset // INODE_SIZE
+        self.dirents_per_block = (self.csum_offset - DIR_LEAF_TAIL_SIZE) // DIRENT.size
+        self.dir_tail_offset = self.dirents_per_block * DIRENT.size
+        buckets = (self.csum_offset - DIR_INDEX_SIZE) // 4
+        self.dir_max_depth = 0
+        while 2 << self.dir_max_depth <= buckets:
+            self.dir_max_depth += 1
+
+
+class Node:
+    def __init__(self, path, name, is_dir, host_mode, size):
+        self.path = path
+        self.name = name
+        self.is_dir = is_dir
+        self.host_mode = host_mode
+        self.children = []
+        self.size = size
+        self.ino = 0
+        self.mode = 0
+        self.flags = 0
+        self.blocks = 0                         # Data blocks, as sfs_inode.blocks counts them
+        self.area = bytes(INLINE_DATA_SIZE)     # Block pointers, extents or inline data
+        self.last = 0                           # double_indirect or extent_count
+        self.writes = []                        # (device block, data) to go out
+
+
+def scan(path, name=""):
+    """The tree under path; entries other than files and directories are skipped"""
+    info = os.stat(path)
+    node = Node(path, name, stat.S_ISDIR(info.st_mode), info.st_mode, info.st_size)
+    if not node.is_dir:
+        if node.size >= 1 << 32:
+            raise RuntimeError(f"{path}: too large for SFS")
+        return node
+
+    for entry in sorted(os.listdir(path)):
+        child = os.path.join(path, entry)
+        if len(entry.encode()) >= MAX_NAME:
+            raise RuntimeError(f"{child}: name longer than {MAX_NAME - 1} bytes")
+        mode = os.lstat(child).st_mode
+        if stat.S_ISDIR(mode) or stat.S_ISREG(mode):
+            node.children.append(scan(child, entry))
+        else:
+            print(f"mkfs-sfs: skipping {child}: not a file or directory", file=sys.stderr)
+    return node
+
+
+def walk(node):
+    yield node
+    for child in node.children:
+        if child.is_dir:
+            yield from walk(child)
+        else:
+            yield child
+
+
+def sfs_mode(host_mode, type_flag):
+    mode = type_flag
+    if host_mode & 0o400:
+        mode |= PERM_READ
+    if host_mode & 0o200:
+        mode |= PERM_WRITE
+    if host_mode & 0o100:
+        mode |= PERM_EXEC
+    return mode
+
+
+def dir_hash(name):
+    """FNV-1a, as sfs_dir_hash()"""
+    value = 2166136261
+    for byte in name[:MAX_NAME - 1]:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def crc32c_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (CRC32C_POLY if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+
+CRC32C_TABLE = crc32c_table()
+
+
+def crc32c(crc, data):
+    """As the kernel's crc32c(): reflected, inverted on the way in and out"""
+    crc ^= 0xFFFFFFFF
+    for byte in data:
+        crc = CRC32C_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+def csum_data(block_num, data):
+    """sfs_csum_data(): seeded with the block number the data belongs in"""
+    return crc32c(crc32c(0, struct.pack("<I", block_num)), data)
+
+
+def seal(block_num, block):
+    """sfs_csum_set(): the checksum of the rest of the block into its last word"""
+    struct.pack_into("<I", block, len(block) - 4, csum_data(block_num, block[:-4]))
+
+
+def csum_max_bitmaps(block_size):
+    """Bitmap checksums the superblock has room for, ahead of its own"""
+    room = (min(block_size, SUPERBLOCK_SIZE) - 4 - BITMAP_CSUM_OFFSET) // 4
+    return min(room, CSUM_MAX_BITMAPS)
+
+
+def dirent_block(entries, geo):
+    block = bytearray(geo.block_size)
+    for i, (name, ino) in enumerate(entries):
+        DIRENT.pack_into(block, i * DIRENT.size, ino, DIRENT.size, len(name), name)
+    return block
+
+
+def leaf_block(entries, depth, next_leaf, geo):
+    block = dirent_block(entries, geo)
+    struct.pack_into("<4I", block, geo.dir_tail_offset, DIR_LEAF_MAGIC, depth, next_leaf, 0)
+    return block
+
+
+def dir_blocks(node, features, geo):
+    """The directory's blocks in file order, and whether it is hashed"""
+    entries = [(child.name.encode(), child.ino) for child in node.children]
+    per_block = geo.dirents_per_block
+    if not entries:
+        return [], False
+    if len(entries) <= per_block or not features & FEATURE_DIR_INDEX:
+        if len(entries) > DIRECT_BLOCKS * per_block:
+            raise RuntimeError(f"{node.path}: more than {DIRECT_BLOCKS * per_block} "
+                               f"entries needs hashed directories")
+        return [dirent_block(entries[i:i + per_block], geo)
+                for i in range(0, len(entries), per_block)], False
+
+    # Fewest hash bits that fit every bucket in one leaf; at the deepest
+    # index, full leaves chain to overflow leaves as the kernel's would
+    depth = 0
+    while depth < geo.dir_max_depth:
+        counts = {}
+        for name, _ in entries:
+            bucket = dir_hash(name) & ((1 << depth) - 1)
+            counts[bucket] = counts.get(bucket, 0) + 1
+        if max(counts.values()) <= per_block:
+            break
+        depth += 1
+    buckets = [[] for _ in range(1 << depth)]
+    for entry in entries:
+        buckets[dir_hash(entry[0]) & ((1 << depth) - 1)].append(entry)
+
+    # Leaves are directory blocks 1.. : one per bucket, then the overflows
+    leaves = []
+    overflow = []
+    for bucket in buckets:
+        chunks = [bucket[i:i + per_block]
+                  for i in range(0, len(bucket), per_block)] or [[]]
+        for n, chunk in enumerate(chunks):
+            following = 0
+            if n + 1 < len(chunks):
+                following = len(buckets) + len(overflow) + (1 if n == 0 else 2)
+            (leaves if n == 0 else overflow).append(leaf_block(chunk, depth, following, geo))
+
+    index = bytearray(geo.block_size)
+    struct.pack_into("<4I", index, 0, DIR_INDEX_MAGIC, depth, len(leaves) + len(overflow), 0)
+    struct.pack_into(f"<{len(buckets)}I", index, DIR_INDEX_SIZE, *range(1, len(buckets) + 1))
+    return [index] + leaves + overflow, True
+
+
+class Allocator:
+    """Hands out data blocks of a geometry in order from the first data block"""
+
+    def __init__(self, first, total, geo):
+        self.next = first
+        self.total = total
+        self.geo = geo
+
+    def take(self, count):
+        if self.next + count > self.total:
+            raise RuntimeError("image too small; give a larger --size")
+        start = self.next
+        self.next += count
+        return start
+
+
+def map_blocks(node, count, alloc):
+    """Direct, indirect and double indirect pointers for count contiguous
+    data blocks, each map block just ahead of the data it maps"""
+    per_block = alloc.geo.ptrs_per_block
+    ptrs = [0] * (DIRECT_BLOCKS + 1)
+    placed = []
+    direct = min(count, DIRECT_BLOCKS)
+    if direct:
+        start = alloc.take(direct)
+        ptrs[:direct] = range(start, start + direct)
+        placed.extend(ptrs[:direct])
+    count -= direct
+
+    if count:
+        n = min(count, per_block)
+        ptrs[DIRECT_BLOCKS] = alloc.take(1)
+        start = alloc.take(n)
+        table = list(range(start, start + n))
+        node.writes.append((ptrs[DIRECT_BLOCKS], struct.pack(f"<{per_block}I",
+                                                             *(table + [0] * (per_block - n)))))
+        placed.extend(table)
+        count -= n
+
+    if count:
+        if count > per_block * per_block:
+            raise RuntimeError(f"{node.path}: too large for block maps; use extents")
+        node.last = alloc.take(1)
+        leaves = []
+        while count:
+            n = min(count, per_block)
+            leaf = alloc.take(1)
+            start = alloc.take(n)
+            table = list(range(start, start + n))
+            node.writes.append((leaf, struct.pack(f"<{per_block}I",
+                                                  *(table + [0] * (per_block - n)))))
+            leaves.append(leaf)
+            placed.extend(table)
+            count -= n
+        node.writes.append((node.last, struct.pack(f"<{per_block}I",
+                                                   *(leaves + [0] * (per_block - len(leaves))))))
+
+    node.area = struct.pack(f"<{DIRECT_BLOCKS + 1}I", *ptrs)
+    return placed
+
+
+def reset(node, type_flag):
+    node.mode = sfs_mode(node.host_mode, type_flag)
+    node.flags = 0
+    node.blocks = 0
+    node.area = bytes(INLINE_DATA_SIZE)
+    node.last = 0
+    node.writes = []
+
+
+def lay_out_dir(node, features, alloc):
+    reset(node, TYPE_DIRECTORY)
+    blocks, hashed = dir_blocks(node, features, alloc.geo)
+    node.size = len(node.children) * DIRENT.size
+    node.blocks = len(blocks)
+    if hashed:
+        node.flags |= INODE_DIR_INDEX
+    for block, data in zip(map_blocks(node, len(blocks), alloc), blocks):
+        if features & FEATURE_METADATA_CSUM:
+            seal(block, data)
+        node.writes.append((block, data))
+
+
+def lay_out_file(node, features, alloc, dry):
+    reset(node, TYPE_FILE)
+    data = b""
+    if not dry:
+        with open(node.path, "rb") as f:
+            data = f.read()
+        if len(data) != node.size:
+            raise RuntimeError(f"{node.path}: changed while being read")
+
+    if node.size <= INLINE_DATA_SIZE:
+        node.flags |= INODE_INLINE
+        node.area = data.ljust(INLINE_DATA_SIZE, b"\0")
+        return
+
+    block_size = alloc.geo.block_size
+    count = (node.size + block_size - 1) // block_size
+    node.blocks = count
+    if features & FEATURE_EXTENTS:
+        node.flags |= INODE_EXTENTS
+        start = alloc.take(count)
+        node.area = struct.pack("<3I", 0, start, count).ljust(INLINE_DATA_SIZE, b"\0")
+        node.last = 1
+        placed = range(start, start + count)
+    else:
+        placed = map_blocks(node, count, alloc)
+
+    if not dry:
+        for i, block in enumerate(placed):
+            node.writes.append((block, data[i * block_size:(i + 1) * block_size]))
+
+
+def lay_out(root, features, alloc, dry=False):
+    """Each directory's blocks, then its files, then its subdirectories;
+    a dry run only counts blocks and reads no file"""
+    pending = [root]
+    while pending:
+        node = pending.pop()
+        lay_out_dir(node, features, alloc)
+        for child in node.children:
+            if not child.is_dir:
+                lay_out_file(child, features, alloc, dry)
+        pending.extend(reversed([child for child in node.children if child.is_dir]))
+
+
+def layout(total_blocks, features, geo):
+    """Block counts as sfs_format_device() works them out"""
+    bits = geo.block_size * 8
+    g = {"total_blocks": total_blocks}
+    g["bitmap_blocks"] = (total_blocks + bits - 1) // bits
+    g["inode_blocks"] = total_blocks // 8
+    g["total_inodes"] = g["inode_blocks"] * geo.inodes_per_block
+    g["inode_bitmap_blocks"] = (g["total_inodes"] + bits - 1) // bits
+    journal = 0
+    if features & FEATURE_JOURNAL:
+        journal = min(max(total_blocks // 32, JOURNAL_MIN_BLOCKS), JOURNAL_MAX_BLOCKS)
+    g["journal_blocks"] = journal
+    metadata = g["bitmap_blocks"] + g["inode_bitmap_blocks"] + g["inode_blocks"] + journal
+    g["data_blocks"] = total_blocks - 1 - metadata
+    g["first_data_block"] = 1 + metadata
+    g["journal_start"] = g["first_data_block"] - journal if journal else 0
+    g["inode_table"] = g["first_data_block"] - journal - g["inode_blocks"]
+    g["group_blocks"] = max((g["inode_blocks"] + ITABLE_MAX_GROUPS - 1) // ITABLE_MAX_GROUPS,
+                            ITABLE_MIN_GROUP)
+    return g
+
+
+def needed_blocks(root, features, geo):
+    """Data blocks the tree takes, counted by laying it out at block 0"""
+    alloc = Allocator(0, 1 << 32, geo)
+    lay_out(root, features, alloc, dry=True)
+    return alloc.next
+
+
+def set_bit(bitmap, bit):
+    bitmap[bit >> 3] |= 1 << (bit & 7)
+
+
+def write_image(path, root, nodes, g, geo, features, label, used_blocks):
+    block_size = geo.block_size
+    per_block = geo.inodes_per_block
+    sb_free_blocks = g["total_blocks"] - used_blocks
+    block_bitmap = bytearray(g["bitmap_blocks"] * block_size)
+    for block in range(used_blocks):
+        set_bit(block_bitmap, block)
+    inode_bitmap = bytearray(g["inode_bitmap_blocks"] * block_size)
+    table = bytearray(((len(nodes) + per_block - 1) // per_block) * block_size)
+    for node in nodes:
+        set_bit(inode_bitmap, node.ino - 1)
+        index = node.ino - 1
+        offset = index // per_block * block_size + index % per_block * INODE_SIZE
+        struct.pack_into("<3I52s6I", table, offset, node.mode, node.size,
+                         node.blocks, node.area, 0, 0, 0, 1, node.flags, node.last)
+
+    # Every group the inodes reach is written; the rest of the table is a
+    # hole and reads as zeros, so no group is left for lazy initialization.
+    # The superblock is the first 4KB of block 0, or all of a smaller block.
+    superblock = bytearray(min(block_size, SUPERBLOCK_SIZE))
+    SUPERBLOCK.pack_into(superblock, 0, MAGIC, VERSION, block_size, g["total_blocks"],
+                         g["inode_blocks"], g["data_blocks"], sb_free_blocks,
+                         g["total_inodes"] - len(nodes), root.ino, g["first_data_block"],
+                         g["bitmap_blocks"], 0, 0, 0, label.encode()[:31], features,
+                         g["inode_bitmap_blocks"], g["journal_start"], g["journal_blocks"],
+                         g["group_blocks"])
+    if features & FEATURE_METADATA_CSUM:
+        view = memoryview(table)
+        for i in range(len(table) // block_size):
+            seal(g["inode_table"] + i, view[i * block_size:(i + 1) * block_size])
+        bitmaps = block_bitmap + inode_bitmap
+        csums = [csum_data(BITMAP_START + i, bitmaps[i * block_size:(i + 1) * block_size])
+                 for i in range(len(bitmaps) // block_size)]
+        struct.pack_into(f"<{len(csums)}I", superblock, BITMAP_CSUM_OFFSET, *csums)
+        seal(0, superblock)
+
+    with open(path, "wb") as f:
+        f.truncate(g["total_blocks"] * block_size)
+
+        def put(block, data):
+            f.seek(block * block_size)
+            f.write(data)
+
+        put(0, superblock)
+        put(BITMAP_START, block_bitmap)
+        put(BITMAP_START + g["bitmap_blocks"], inode_bitmap)
+        put(g["inode_table"], table)
+        if g["journal_blocks"]:
+            put(g["journal_start"], struct.pack("<4I", JOURNAL_MAGIC, g["journal_blocks"], 1, 0))
+        for node in nodes:
+            for block, data in sorted(node.writes):
+                put(block, data)
+
+
+def block_size_arg(text):
+    """mkfs -b's block size: bytes, or with a k suffix"""
+    value = text[:-1] if text[-1:] in ("k", "K") else text
+    if not value.isdigit():
+        raise argparse.ArgumentTypeError(f"invalid block size '{text}'")
+    size = int(value) * (1024 if value != text else 1)
+    if not MIN_BLOCK_SIZE <= size <= MAX_BLOCK_SIZE or size & (size - 1):
+        raise argparse.ArgumentTypeError("block size must be 1k to 64k, a power of two")
+    return size
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build an SFS image from a directory")
+    parser.add_argument("source", help="directory to copy into the image")
+    parser.add_argument("image", help="image file to write")
+    parser.add_argument("--size", type=int,
+                        help="image size in MiB (default: twice the content, at least 16)")
+    parser.add_argument("-b", "--block-size", type=block_size_arg, default=DEFAULT_BLOCK_SIZE,
+                        help="block size in bytes or with a k suffix, 1k to 64k (default: 4k)")
+    parser.add_argument("--label", default="MiniOS root", help="volume label")
+    parser.add_argument("--journal", action="store_true", help="add a metadata journal")
+    parser.add_argument("--no-extents", action="store_true",
+                        help="map files with direct and indirect blocks")
+    parser.add_argument("--no-dir-index", action="store_true",
+                        help="keep every directory a linear list")
+    args = parser.parse_args()
+
+    features = (FEATURE_INODE_BITMAP | FEATURE_LAZY_ITABLE | FEATURE_INLINE_DATA |
+                FEATURE_METADATA_CSUM)
+    if not args.no_extents:
+        features |= FEATURE_EXTENTS
+    if not args.no_dir_index:
+        features |= FEATURE_DIR_INDEX
+    if args.journal:
+        features |= FEATURE_JOURNAL
+
+    try:
+        if not os.path.isdir(args.source):
+            raise RuntimeError(f"{args.source}: not a directory")
+        root = scan(args.source)
+        nodes = list(walk(root))
+        for ino, node in enumerate(nodes, 1):
+            node.ino = ino
+
+        geo = Geometry(args.block_size)
+        data = needed_blocks(root, features, geo)
+        if args.size:
+            total = args.size * 1024 * 1024 // geo.block_size
+        else:
+            mib = max(16, -(-2 * data * geo.block_size // (1024 * 1024)))
+            total = mib * 1024 * 1024 // geo.block_size
+        g = layout(total, features, geo)
+        if g["data_blocks"] <= 0 or len(nodes) > g["total_inodes"]:
+            raise RuntimeError("image too small; give a larger --size")
+        if g["bitmap_blocks"] + g["inode_bitmap_blocks"] > csum_max_bitmaps(geo.block_size):
+            print("mkfs-sfs: volume too large for metadata checksums", file=sys.stderr)
+            features &= ~FEATURE_METADATA_CSUM
+
+        # Laid out again for real, now that the data area is known
+        alloc = Allocator(g["first_data_block"], total, geo)
+        lay_out(root, features, alloc)
+        write_image(args.image, root, nodes, g, geo, features, args.label, alloc.next)
+    except (OSError, RuntimeError) as e:
+        print(f"mkfs-sfs: {e}", file=sys.stderr)
+        return 1
+
+    files = sum(1 for node in nodes if not node.is_dir)
+    print(f"{args.image}: {total * geo.block_size // (1024 * 1024)} MiB, {files} files in "
+          f"{len(nodes) - files} directories, {alloc.next - g['first_data_block']} data blocks")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,298 @@
+#!/usr/bin/env python3
+
+"""
+MiniOS Performance Harness
+
+Boots the kernel in QEMU for each architecture, measures time to the
+shell prompt, runs the in-kernel bench and fsbench commands over the
+serial console and writes everything to a JSON file. Given a baseline
+from an earlier run it compares the two and exits non-zero when any
+metric got worse by more than the threshold.
+
+    tools/perf-harness.py                          # both arches, write build/perf.json
+    tools/perf-harness.py --arch arm64 --accel kvm
+    tools/perf-harness.py --baseline perf-main.json --threshold 10
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import threading
+import time
+
+PROJECT_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BUILD_DIR = os.path.join(PROJECT_ROOT, "build")
+PROMPT = "Shell>"
+ARCHES = ("arm64", "x86_64")
+
+BENCH_RE = re.compile(r"^BENCH (\S+) iters=(\d+) mean=([\d.]+) min=([\d.]+) ns=([\d.]+)(?: note=(\S+))?")
+FSBENCH_RE = re.compile(r"^FSBENCH (\S+) (\S+) io=(\d+) n=(\d+) us=(\d+) kbps=(\d+) ops_s=(\d+) "
+                        r"reads=(\d+) writes=(\d+) bytes_read=(\d+) bytes_written=(\d+)")
+
+
+def log(message):
+    print(f"[PERF] {message}", flush=True)
+
+
+def host_accel(arch, requested):
+    """Pick the accelerator: tcg unless asked for (or 'auto' finds) KVM or HVF"""
+    if requested != "auto":
+        return requested
+    machine = platform.machine().lower()
+    native = (arch == "arm64" and machine in ("aarch64", "arm64")) or \
+             (arch == "x86_64" and machine in ("x86_64", "amd64"))
+    if not native:
+        return "tcg"
+    if sys.platform == "darwin":
+        return "hvf"
+    if os.access("/dev/kvm", os.R_OK | os.W_OK):
+        return "kvm"
+    return "tcg"
+
+
+def qemu_command(arch, accel, memory):
+    """The same machines tools/test-vm.sh boots, with the serial port on stdio"""
+    cpu_host = accel in ("kvm", "hvf")
+    if arch == "arm64":
+        kernel = os.path.join(BUILD_DIR, arch, "kernel.elf")
+        cmd = ["qemu-system-aarch64", "-machine", "virt", "-cpu", "host" if cpu_host else "cortex-a72",
+               "-kernel", kernel, "-append", "console=uart,mmio,0x9000000"]
+        image = kernel
+    else:
+        image = os.path.join(BUILD_DIR, arch, "minios.iso")
+        cmd = ["qemu-system-x86_64", "-cdrom", image, "-boot", "d"]
+        if cpu_host:
+            cmd += ["-cpu", "host"]
+    cmd += ["-m", memory, "-accel", accel, "-nographic", "-serial", "stdio", "-monitor", "none"]
+    return cmd, image
+
+
+class Console:
+    """QEMU with its serial port on a pipe; output is collected by a thread"""
+
+    def __init__(self, cmd, log_path):
+        self.output = ""
+        self.lock = threading.Lock()
+        self.log = open(log_path, "w")
+        self.start = time.monotonic()
+        self.proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                     stderr=subprocess.STDOUT, bufsize=0)
+        self.reader = threading.Thread(target=self._read, daemon=True)
+        self.reader.start()
+
+    def _read(self):
+        while True:
+            data = self.proc.stdout.read(4096)
+            if not data:
+                return
+            text = data.decode("utf-8", errors="replace").replace("\r", "")
+            self.log.write(text)
+            with self.lock:
+                self.output += text
+
+    def wait_for(self, pattern, since, timeout):
+        """Offset just past pattern's first match after since, or None on timeout"""
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            with self.lock:
+                index = self.output.find(pattern, since)
+            if index >= 0:
+                return index + len(pattern)
+            if self.proc.poll() is not None:
+                return None
+            time.sleep(0.01)
+        return None
+
+    def run(self, command, timeout):
+        """Send a shell command; the lines it printed, or None on timeout"""
+        with self.lock:
+            since = len(self.output)
+        self.proc.stdin.write((command + "\r").encode())
+        self.proc.stdin.flush()
+        # The echoed command comes first, then the output, then a new prompt
+        echoed = self.wait_for("\n", since, timeout)
+        end = self.wait_for(PROMPT, echoed, timeout) if echoed is not None else None
+        if end is None:
+            return None
+        with self.lock:
+            return self.output[echoed:end - len(PROMPT)].splitlines()
+
+    def close(self):
+        self.proc.kill()
+        self.proc.wait()
+        self.reader.join(timeout=2)
+        self.log.close()
+
+
+def parse_bench(lines, metrics):
+    for line in lines:
+        match = BENCH_RE.match(line.strip())
+        if not match:
+            continue
+        name = match.group(1)
+        metrics[f"bench.{name}.min_ns"] = {"value": float(match.group(5)), "unit": "ns", "better": "lower"}
+        metrics[f"bench.{name}.mean_ticks"] = {"value": float(match.group(3)), "unit": "ticks", "better": "lower"}
+
+
+def parse_fsbench(lines, metrics):
+    for line in lines:
+        match = FSBENCH_RE.match(line.strip())
+        if not match:
+            continue
+        target, test, io = match.group(1), match.group(2), int(match.group(3))
+        key = f"fsbench.{target}.{test}" + (f".{io}" if io and test.startswith(("seq", "rand")) else "")
+        kbps, ops_s = int(match.group(6)), int(match.group(7))
+        if test.startswith(("seq", "rand")):
+            metrics[key + ".kbps"] = {"value": kbps, "unit": "KiB/s", "better": "higher"}
+        else:
+            metrics[key + ".ops_s"] = {"value": ops_s, "unit": "ops/s", "better": "higher"}
+        # Device traffic per operation: amplification, independent of speed
+        ops = max(int(match.group(4)), 1)
+        metrics[key + ".dev_ios"] = {"value": (int(match.group(8)) + int(match.group(9))) / ops,
+                                     "unit": "ios/op", "better": "lower"}
+
+
+def run_once(arch, args, run_index):
+    accel = host_accel(arch, args.accel)
+    cmd, image = qemu_command(arch, accel, args.memory)
+    if not os.path.exists(image):
+        raise RuntimeError(f"{image} not found; run 'make ARCH={arch}' first")
+
+    log_path = os.path.join(BUILD_DIR, f"perf-{arch}-{run_index}.log")
+    log(f"{arch} run {run_index + 1}/{args.runs}: {' '.join(cmd)}")
+    console = Console(cmd, log_path)
+    metrics = {}
+    try:
+        prompt = console.wait_for(PROMPT, 0, args.timeout)
+        if prompt is None:
+            raise RuntimeError(f"no shell prompt within {args.timeout}s; see {log_path}")
+        metrics["boot.time_to_prompt_ms"] = {
+            "value": round((time.monotonic() - console.start) * 1000, 1),
+            "unit": "ms", "better": "lower"}
+
+        lines = console.run(f"bench {args.bench_args}".strip(), args.timeout)
+        if lines is None:
+            raise RuntimeError(f"bench did not finish within {args.timeout}s; see {log_path}")
+        parse_bench(lines, metrics)
+
+        if not args.skip_fsbench:
+            lines = console.run(f"fsbench {args.fsbench_args}".strip(), args.timeout)
+            if lines is None:
+                raise RuntimeError(f"fsbench did not finish within {args.timeout}s; see {log_path}")
+            parse_fsbench(lines, metrics)
+    finally:
+        console.close()
+    return accel, metrics
+
+
+def run_arch(arch, args):
+    """Median of each metric over the runs; boot time matters most cold"""
+    runs = []
+    accel = None
+    for i in range(args.runs):
+        accel, metrics = run_once(arch, args, i)
+        runs.append(metrics)
+
+    merged = {}
+    for name in runs[0]:
+        values = [run[name]["value"] for run in runs if name in run]
+        merged[name] = dict(runs[0][name], value=statistics.median(values), samples=values)
+    return {"accel": accel, "runs": args.runs, "metrics": merged}
+
+
+def git_revision():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=PROJECT_ROOT,
+                              capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def compare(results, baseline, threshold):
+    """Print changes beyond threshold percent; returns the regressions"""
+    regressions = []
+    for arch, current in results["arches"].items():
+        base = baseline.get("arches", {}).get(arch)
+        if not base:
+            log(f"{arch}: not in baseline, nothing to compare")
+            continue
+        if base.get("accel") != current["accel"]:
+            log(f"{arch}: baseline ran under {base.get('accel')}, this run under {current['accel']}")
+        for name, metric in sorted(current["metrics"].items()):
+            old = base["metrics"].get(name, {}).get("value")
+            new = metric["value"]
+            if not old:
+                continue
+            change = (new - old) / old * 100
+            worse = change > threshold if metric["better"] == "lower" else change < -threshold
+            better = change < -threshold if metric["better"] == "lower" else change > threshold
+            if worse:
+                regressions.append((arch, name, old, new, change))
+                print(f"  REGRESSION {arch} {name}: {old:g} -> {new:g} {metric['unit']} ({change:+.1f}%)")
+            elif better:
+                print(f"  improved   {arch} {name}: {old:g} -> {new:g} {metric['unit']} ({change:+.1f}%)")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Boot MiniOS in QEMU and record performance results")
+    parser.add_argument("--arch", choices=ARCHES + ("all",), default="all")
+    parser.add_argument("--accel", choices=("auto", "tcg", "kvm", "hvf"), default="tcg",
+                        help="QEMU accelerator; auto uses KVM or HVF when the host matches")
+    parser.add_argument("--runs", type=int, default=3, help="boots per arch; medians are kept")
+    parser.add_argument("--memory", default="512M")
+    parser.add_argument("--timeout", type=int, default=300, help="seconds for each step")
+    parser.add_argument("--bench-args", default="", help="arguments for the bench command")
+    parser.add_argument("--fsbench-args", default="", help="arguments for the fsbench command")
+    parser.add_argument("--skip-fsbench", action="store_true")
+    parser.add_argument("--output", default=os.path.join(BUILD_DIR, "perf.json"))
+    parser.add_argument("--baseline", help="JSON from an earlier run to compare against")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percent change counted as a regression")
+    args = parser.parse_args()
+    if args.runs < 1:
+        parser.error("--runs must be at least 1")
+
+    results = {
+        "version": 1,
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+        "revision": git_revision(),
+        "host": f"{platform.system()} {platform.machine()}",
+        "arches": {},
+    }
+
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    failed = False
+    for arch in (ARCHES if args.arch == "all" else (args.arch,)):
+        try:
+            results["arches"][arch] = run_arch(arch, args)
+        except RuntimeError as error:
+            log(f"{arch}: {error}")
+            failed = True
+
+    with open(args.output, "w") as out:
+        json.dump(results, out, indent=2, sort_keys=True)
+    log(f"Results written to {args.output}")
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        log(f"Comparing with {args.baseline} (revision {baseline.get('revision')}, "
+            f"threshold {args.threshold:g}%)")
+        regressions = compare(results, baseline, args.threshold)
+        if regressions:
+            log(f"{len(regressions)} regression(s)")
+            failed = True
+        else:
+            log("No regressions")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -109,6 +109,12 @@ build_vm_command() {
             base_cmd="$base_cmd $display_args"
             ;;
     esac
+
+    # SFS root image (make rootfs) for a kernel built with ROOT=vd<x>; it
+    # comes after any virtio boot disk
+    if [ -n "$ROOTFS_IMAGE" ]; then
+        base_cmd="$base_cmd -drive file=$ROOTFS_IMAGE,format=raw,if=virtio"
+    fi
     
     echo "$base_cmd"
 }
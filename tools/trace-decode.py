@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+"""
+MiniOS Trace Decoder
+
+Reads the output of the shell's 'trace dump' from a serial log, merges the
+per-CPU rings by timestamp and reports latencies by pairing events up:
+system calls (enter to exit, per task), block requests (submit to
+complete), interrupts (entry to exit, per CPU), VFS operations (enter to
+exit, per task) and scheduling (wakeup to switch-in).
+
+    tools/trace-decode.py serial.log                # latency summary
+    tools/trace-decode.py --list serial.log         # every record as text
+"""
+
+import argparse
+import struct
+import sys
+
+FORMAT_VERSION = 1
+RECORD = struct.Struct("<IHHIIQQQ")     # struct trace_record (trace.h)
+
+VFS_OPS = ("open", "close", "read", "write")
+
+
+def parse(path):
+    """Header fields, event names and the records, oldest first"""
+    header, names, records = None, {}, []
+    with open(path, errors="replace") as f:
+        for line in f:
+            # Serial logs can carry other output on the same line
+            fields = line.strip().split()
+            if not fields:
+                continue
+            if fields[0] == "TRACE_BEGIN":
+                header = dict(field.split("=", 1) for field in fields[1:])
+                names, records = {}, []
+            elif header is None:
+                continue
+            elif fields[0] == "TRACE_EVENT" and len(fields) == 3:
+                names[int(fields[1])] = fields[2]
+            elif fields[0] == "R" and len(fields) == 2 and len(fields[1]) == 2 * RECORD.size:
+                seq, event, cpu, pid, arg2, timestamp, arg0, arg1 = \
+                    RECORD.unpack(bytes.fromhex(fields[1]))
+                records.append({"event": event, "cpu": cpu, "pid": pid, "time": timestamp,
+                                "arg0": arg0, "arg1": arg1, "arg2": arg2})
+            elif fields[0] == "TRACE_END":
+                break
+
+    if header is None:
+        raise RuntimeError(f"{path}: no TRACE_BEGIN line")
+    if int(header.get("version", 0)) != FORMAT_VERSION or int(header.get("record", 0)) != RECORD.size:
+        raise RuntimeError(f"{path}: trace format {header.get('version')}, "
+                           f"record size {header.get('record')}; expected "
+                           f"{FORMAT_VERSION}, {RECORD.size}")
+    records.sort(key=lambda r: r["time"])
+    return header, names, records
+
+
+def describe(record, name):
+    e, a0, a1, a2 = name, record["arg0"], record["arg1"], record["arg2"]
+    if e == "sched_switch":
+        return f"prev={a0} next={a1} prev_state={a2}"
+    if e == "sched_wakeup":
+        return f"pid={a0} cpu={a1}"
+    if e == "syscall_enter":
+        return f"nr={a0} arg0={a1:#x}"
+    if e == "syscall_exit":
+        return f"nr={a0} result={a1 - (1 << 64) if a1 >> 63 else a1}"
+    if e == "block_submit":
+        return f"req={a0:#x} block={a1} count={a2 & 0x7fffffff} {'write' if a2 >> 31 else 'read'}"
+    if e == "block_complete":
+        return f"req={a0:#x} status={a1 - (1 << 64) if a1 >> 63 else a1}"
+    if e == "vfs_enter":
+        return f"{VFS_OPS[a0] if a0 < len(VFS_OPS) else a0} fd={a1} bytes={a2}"
+    if e == "vfs_exit":
+        return f"{VFS_OPS[a0] if a0 < len(VFS_OPS) else a0} result={a1 - (1 << 64) if a1 >> 63 else a1}"
+    if e in ("irq_entry", "irq_exit"):
+        return f"irq={a0}"
+    return f"{a0:#x} {a1:#x} {a2:#x}"
+
+
+def latencies(names, records):
+    """Latency samples in counter ticks, by category"""
+    out = {}
+    open_syscalls, open_blocks, open_irqs, open_vfs, woken = {}, {}, {}, {}, {}
+
+    def pair(table, key, category, record):
+        start = table.pop(key, None)
+        if start is not None:
+            out.setdefault(category, []).append(record["time"] - start)
+
+    for r in records:
+        e = names.get(r["event"])
+        if e == "syscall_enter":
+            open_syscalls[(r["pid"], r["arg0"])] = r["time"]
+        elif e == "syscall_exit":
+            pair(open_syscalls, (r["pid"], r["arg0"]), f"syscall {r['arg0']}", r)
+        elif e == "block_submit":
+            open_blocks[r["arg0"]] = r["time"]
+        elif e == "block_complete":
+            pair(open_blocks, r["arg0"], "block request", r)
+        elif e == "irq_entry":
+            open_irqs[(r["cpu"], r["arg0"])] = r["time"]
+        elif e == "irq_exit":
+            pair(open_irqs, (r["cpu"], r["arg0"]), f"irq {r['arg0']}", r)
+        elif e == "vfs_enter":
+            open_vfs[(r["pid"], r["arg0"])] = r["time"]
+        elif e == "vfs_exit":
+            op = VFS_OPS[r["arg0"]] if r["arg0"] < len(VFS_OPS) else str(r["arg0"])
+            pair(open_vfs, (r["pid"], r["arg0"]), f"vfs {op}", r)
+        elif e == "sched_wakeup":
+            woken.setdefault(r["arg0"], r["time"])
+        elif e == "sched_switch":
+            pair(woken, r["arg1"], "wakeup to run", r)
+    return out
+
+
+def percentile(sorted_values, fraction):
+    return sorted_values[min(len(sorted_values) - 1, int(fraction * len(sorted_values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a MiniOS 'trace dump' from a serial log")
+    parser.add_argument("log", help="serial output containing the dump")
+    parser.add_argument("--list", action="store_true", help="print every record instead")
+    args = parser.parse_args()
+
+    try:
+        header, names, records = parse(args.log)
+    except (OSError, RuntimeError) as error:
+        print(f"trace-decode: {error}", file=sys.stderr)
+        return 1
+
+    hz = int(header.get("hz", 0)) or 1
+    usec = 1e6 / hz
+
+    if args.list:
+        base = records[0]["time"] if records else 0
+        for r in records:
+            name = names.get(r["event"], str(r["event"]))
+            print(f"{(r['time'] - base) * usec:14.3f} cpu{r['cpu']} pid {r['pid']:<5} "
+                  f"{name:<15} {describe(r, name)}")
+        return 0
+
+    print(f"{len(records)} records, counter {hz} Hz; latencies in microseconds")
+    print(f"{'':<16} {'count':>7} {'min':>10} {'avg':>10} {'p50':>10} {'p99':>10} {'max':>10}")
+    for category, values in sorted(latencies(names, records).items()):
+        values.sort()
+        print(f"{category:<16} {len(values):>7} {values[0] * usec:>10.2f} "
+              f"{sum(values) / len(values) * usec:>10.2f} {percentile(values, 0.5) * usec:>10.2f} "
+              f"{percentile(values, 0.99) * usec:>10.2f} {values[-1] * usec:>10.2f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())